@@ -0,0 +1,35 @@
+/*
+ * Query the I/O statistics of a tapdisk process.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "tap-ctl.h"
+
+int
+tap_ctl_stats(const int id, char *buf, size_t size)
+{
+	int err;
+	tapdisk_message_t message;
+
+	memset(&message, 0, sizeof(message));
+	message.type = TAPDISK_MESSAGE_STATS;
+
+	err = tap_ctl_connect_send_and_receive(id, &message, 2);
+	if (err)
+		return err;
+
+	if (message.type == TAPDISK_MESSAGE_STATS_RSP) {
+		message.u.string.text[sizeof(message.u.string.text) - 1] = '\0';
+		snprintf(buf, size, "%s", message.u.string.text);
+	} else {
+		err = EINVAL;
+		EPRINTF("got unexpected result '%s' from %d\n",
+			tapdisk_message_name(message.type), id);
+	}
+
+	return err;
+}
@@ -676,6 +676,48 @@ usage:
 	return EINVAL;
 }
 
+static void
+tap_cli_stats_usage(FILE *stream)
+{
+	fprintf(stream, "usage: stats <-p pid>\n");
+}
+
+static int
+tap_cli_stats(int argc, char **argv)
+{
+	int c, pid, err;
+	char buf[TAPDISK_MESSAGE_STRING_LENGTH];
+
+	pid = -1;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "p:h")) != -1) {
+		switch (c) {
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		case '?':
+			goto usage;
+		case 'h':
+			tap_cli_stats_usage(stdout);
+			return 0;
+		}
+	}
+
+	if (pid == -1)
+		goto usage;
+
+	err = tap_ctl_stats(pid, buf, sizeof(buf));
+	if (!err)
+		printf("%s\n", buf);
+
+	return err;
+
+usage:
+	tap_cli_stats_usage(stderr);
+	return EINVAL;
+}
+
 static void
 tap_cli_check_usage(FILE *stream)
 {
@@ -717,6 +759,7 @@ struct command commands[] = {
 	{ .name = "unpause",      .func = tap_cli_unpause       },
 	{ .name = "major",        .func = tap_cli_major         },
 	{ .name = "check",        .func = tap_cli_check         },
+	{ .name = "stats",        .func = tap_cli_stats         },
 };
 
 #define print_commands()					\
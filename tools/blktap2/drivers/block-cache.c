@@ -30,6 +30,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 
 #include "tapdisk.h"
 #include "tapdisk-utils.h"
@@ -58,6 +60,19 @@
 #define BLOCK_CACHE_REQUESTS            (TAPDISK_DATA_REQUESTS << 3)
 #define BLOCK_CACHE_PAGE_IDLETIME       60
 
+/*
+ * Behind each tapdisk's own cache sits one shared by every tapdisk on the
+ * host caching the same image: a direct mapped table of page-sized slots
+ * in POSIX shared memory, named after the image file's identity.  Each
+ * slot has a sequence count, odd while a writer owns it, so lookups take
+ * no lock: a reader whose copy raced with a writer treats it as a miss.
+ */
+#define BLOCK_CACHE_SHARED_ENV          "TAPDISK_SHARED_CACHE_MB"
+#define BLOCK_CACHE_SHARED_MB           256 /* default; 0 disables */
+#define BLOCK_CACHE_SHARED_MAGIC        0x5444534843414348ULL
+#define BLOCK_CACHE_SHARED_VERSION      1
+#define BLOCK_CACHE_SHARED_SECS         BLOCK_CACHE_NODES_PER_PAGE
+
 typedef struct radix_tree               radix_tree_t;
 typedef struct radix_tree_node          radix_tree_node_t;
 typedef struct radix_tree_link          radix_tree_link_t;
@@ -67,6 +82,9 @@ typedef struct radix_tree_page          radix_tree_page_t;
 typedef struct block_cache              block_cache_t;
 typedef struct block_cache_request      block_cache_request_t;
 typedef struct block_cache_stats        block_cache_stats_t;
+typedef struct block_cache_shared       block_cache_shared_t;
+typedef struct block_cache_shared_hdr   block_cache_shared_hdr_t;
+typedef struct block_cache_shared_slot  block_cache_shared_slot_t;
 
 struct radix_tree_page {
 	char                           *buf;
@@ -115,6 +133,32 @@ struct block_cache_stats {
 	uint64_t                        hits;
 	uint64_t                        misses;
 	uint64_t                        prunes;
+	uint64_t                        shared_hits;
+	uint64_t                        shared_fills;
+};
+
+struct block_cache_shared_hdr {
+	uint64_t                        magic;
+	uint32_t                        version;
+	uint32_t                        slots;
+	uint64_t                        dev;
+	uint64_t                        ino;
+	uint64_t                        size;
+	uint64_t                        mtime;
+};
+
+struct block_cache_shared_slot {
+	uint32_t                        seq;
+	uint32_t                        pad;
+	uint64_t                        key;  /* first sector + 1, 0 if empty */
+};
+
+struct block_cache_shared {
+	void                           *mem;
+	size_t                          size;
+	uint32_t                        mask;
+	block_cache_shared_slot_t      *slots;
+	char                           *data;
 };
 
 struct block_cache {
@@ -130,6 +174,7 @@ struct block_cache {
 	event_id_t                      timeout_id;
 
 	radix_tree_t                    tree;
+	block_cache_shared_t            shared;
 
 	block_cache_stats_t             stats;
 };
@@ -516,6 +561,225 @@ block_cache_put_request(block_cache_t *cache, block_cache_request_t *breq)
 	cache->request_free_list[cache->requests_free++] = breq;
 }
 
+static inline size_t
+block_cache_shared_size(uint32_t slots)
+{
+	size_t meta;
+
+	meta  = RADIX_TREE_PAGE_SIZE + slots * sizeof(block_cache_shared_slot_t);
+	meta  = (meta + RADIX_TREE_PAGE_SIZE - 1) & ~(RADIX_TREE_PAGE_SIZE - 1);
+
+	return meta + (size_t)slots * RADIX_TREE_PAGE_SIZE;
+}
+
+static uint32_t
+block_cache_shared_slots(void)
+{
+	const char *env;
+	unsigned long mb;
+	uint32_t slots;
+	char *end;
+
+	mb  = BLOCK_CACHE_SHARED_MB;
+	env = getenv(BLOCK_CACHE_SHARED_ENV);
+	if (env && *env) {
+		mb = strtoul(env, &end, 0);
+		if (*end || mb > (1UL << 20)) {
+			WARN("ignoring %s=%s\n", BLOCK_CACHE_SHARED_ENV, env);
+			mb = BLOCK_CACHE_SHARED_MB;
+		}
+	}
+
+	/* a power of 2 pages, no more than asked for */
+	for (slots = 1; (uint64_t)(slots << 1) * RADIX_TREE_PAGE_SIZE <=
+		     ((uint64_t)mb << 20); slots <<= 1)
+		;
+
+	return mb ? slots : 0;
+}
+
+static void
+block_cache_shared_close(block_cache_t *cache)
+{
+	block_cache_shared_t *shared = &cache->shared;
+
+	if (shared->mem)
+		munmap(shared->mem, shared->size);
+	memset(shared, 0, sizeof(*shared));
+}
+
+/*
+ * Map the shared cache of @cache's image, creating it if we are first.
+ * Without it we run on the private cache alone, so failures only warn.
+ */
+static void
+block_cache_shared_open(block_cache_t *cache)
+{
+	int fd;
+	char path[64];
+	struct stat st;
+	uint32_t slots;
+	uint64_t hash;
+	void *mem;
+	size_t size;
+	block_cache_shared_hdr_t *hdr;
+	block_cache_shared_t *shared = &cache->shared;
+
+	slots = block_cache_shared_slots();
+	if (!slots)
+		return;
+
+	if (stat(cache->name, &st)) {
+		WARN("%s: no shared cache: stat: %d\n", cache->name, -errno);
+		return;
+	}
+
+	/* FNV-1a over what identifies this version of the image */
+	hash  = 0xcbf29ce484222325ULL;
+	hash  = (hash ^ st.st_dev)   * 0x100000001b3ULL;
+	hash  = (hash ^ st.st_ino)   * 0x100000001b3ULL;
+	hash  = (hash ^ st.st_size)  * 0x100000001b3ULL;
+	hash  = (hash ^ st.st_mtime) * 0x100000001b3ULL;
+	snprintf(path, sizeof(path), "/tapdisk-cache-%016"PRIx64, hash);
+
+	fd = shm_open(path, O_CREAT | O_RDWR, 0600);
+	if (fd == -1) {
+		WARN("%s: no shared cache: shm_open %s: %d\n",
+		     cache->name, path, -errno);
+		return;
+	}
+
+	mem = MAP_FAILED;
+	if (flock(fd, LOCK_EX))
+		goto out;
+
+	hdr = mmap(NULL, RADIX_TREE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (lseek(fd, 0, SEEK_END) == 0) {
+		/* we're first: size it, and stamp it once initialized */
+		size = block_cache_shared_size(slots);
+		if (ftruncate(fd, size))
+			goto unlock;
+		if (hdr == MAP_FAILED)
+			hdr = mmap(NULL, RADIX_TREE_PAGE_SIZE,
+				   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (hdr == MAP_FAILED)
+			goto unlock;
+
+		hdr->version = BLOCK_CACHE_SHARED_VERSION;
+		hdr->slots   = slots;
+		hdr->dev     = st.st_dev;
+		hdr->ino     = st.st_ino;
+		hdr->size    = st.st_size;
+		hdr->mtime   = st.st_mtime;
+		__sync_synchronize();
+		hdr->magic   = BLOCK_CACHE_SHARED_MAGIC;
+	}
+
+	if (hdr == MAP_FAILED ||
+	    hdr->magic   != BLOCK_CACHE_SHARED_MAGIC   ||
+	    hdr->version != BLOCK_CACHE_SHARED_VERSION ||
+	    hdr->dev     != st.st_dev   || hdr->ino   != st.st_ino  ||
+	    hdr->size    != st.st_size  || hdr->mtime != st.st_mtime ||
+	    !hdr->slots  || (hdr->slots & (hdr->slots - 1)))
+		goto unlock;
+
+	/* whoever created it chose the size */
+	slots = hdr->slots;
+	size  = block_cache_shared_size(slots);
+	mem   = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+ unlock:
+	if (hdr != MAP_FAILED)
+		munmap(hdr, RADIX_TREE_PAGE_SIZE);
+	flock(fd, LOCK_UN);
+ out:
+	close(fd);
+
+	if (mem == MAP_FAILED) {
+		WARN("%s: no shared cache %s\n", cache->name, path);
+		return;
+	}
+
+	shared->mem   = mem;
+	shared->size  = size;
+	shared->mask  = slots - 1;
+	shared->slots = (block_cache_shared_slot_t *)
+		((char *)mem + RADIX_TREE_PAGE_SIZE);
+	shared->data  = (char *)mem + size -
+		(size_t)slots * RADIX_TREE_PAGE_SIZE;
+
+	DPRINTF("%s: shared cache %s, %u pages\n", cache->name, path, slots);
+}
+
+static inline int
+block_cache_shared_request(block_cache_t *cache, td_request_t treq)
+{
+	return (cache->shared.mem &&
+		treq.secs == BLOCK_CACHE_SHARED_SECS &&
+		!(treq.sec & (BLOCK_CACHE_SHARED_SECS - 1)));
+}
+
+static inline block_cache_shared_slot_t *
+block_cache_shared_slot(block_cache_shared_t *shared,
+			uint64_t sec, char **data)
+{
+	uint32_t idx;
+
+	idx   = (sec / BLOCK_CACHE_SHARED_SECS) & shared->mask;
+	*data = shared->data + ((size_t)idx << RADIX_TREE_PAGE_SHIFT);
+
+	return shared->slots + idx;
+}
+
+static int
+block_cache_shared_lookup(block_cache_t *cache, td_request_t treq)
+{
+	char *data;
+	uint32_t seq;
+	block_cache_shared_slot_t *slot;
+
+	slot = block_cache_shared_slot(&cache->shared, treq.sec, &data);
+
+	seq = *(volatile uint32_t *)&slot->seq;
+	if (seq & 1)
+		return 0;
+	__sync_synchronize();
+
+	if (*(volatile uint64_t *)&slot->key != treq.sec + 1)
+		return 0;
+
+	memcpy(treq.buf, data, RADIX_TREE_PAGE_SIZE);
+	__sync_synchronize();
+
+	return *(volatile uint32_t *)&slot->seq == seq;
+}
+
+static void
+block_cache_shared_fill(block_cache_t *cache, uint64_t sec, const char *buf)
+{
+	char *data;
+	uint32_t seq;
+	block_cache_shared_slot_t *slot;
+
+	slot = block_cache_shared_slot(&cache->shared, sec, &data);
+
+	seq = *(volatile uint32_t *)&slot->seq;
+	if (seq & 1)
+		return;
+	if (*(volatile uint64_t *)&slot->key == sec + 1)
+		return;
+	if (!__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1))
+		return;
+
+	slot->key = sec + 1;
+	memcpy(data, buf, RADIX_TREE_PAGE_SIZE);
+	__sync_synchronize();
+	*(volatile uint32_t *)&slot->seq = seq + 2;
+
+	cache->stats.shared_fills++;
+}
+
 static int
 block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 {
@@ -554,6 +818,8 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 	if (cache->timeout_id < 0)
 		goto fail;
 
+	block_cache_shared_open(cache);
+
 	DPRINTF("opening cache for %s, sectors: %"PRIu64", "
 		"tree: %p, height: %d\n",
 		cache->name, cache->sectors, tree, tree->height);
@@ -581,6 +847,7 @@ block_cache_close(td_driver_t *driver)
 	DPRINTF("closing cache for %s\n", cache->name);
 
 	tapdisk_server_unregister_event(cache->timeout_id);
+	block_cache_shared_close(cache);
 	radix_tree_free(tree);
 	free(cache->name);
 
@@ -654,6 +921,9 @@ block_cache_populate_cache(td_request_t clone, int err)
 		       breq->buf + off, RADIX_TREE_NODE_SIZE);
 	}
 
+	if (block_cache_shared_request(cache, breq->treq))
+		block_cache_shared_fill(cache, breq->treq.sec, breq->buf);
+
 	if (radix_tree_add_leaves(tree, breq->buf,
 				  breq->treq.sec, breq->treq.secs))
 		free(breq->buf);
@@ -725,10 +995,19 @@ block_cache_queue_read(td_driver_t *driver, td_request_t treq)
 	for (i = 0; i < treq.secs; i++) {
 		iov[i] = radix_tree_find_leaf(tree, treq.sec + i);
 		if (!iov[i])
-			return block_cache_miss(cache, treq);
+			goto miss;
 	}
 
 	return block_cache_hit(cache, treq, iov);
+
+miss:
+	if (block_cache_shared_request(cache, treq) &&
+	    block_cache_shared_lookup(cache, treq)) {
+		cache->stats.shared_hits += treq.secs;
+		return td_complete_request(treq, 0);
+	}
+
+	return block_cache_miss(cache, treq);
 }
 
 static void
@@ -771,6 +1050,8 @@ block_cache_debug(td_driver_t *driver)
 	WARN("BLOCK CACHE %s\n", cache->name);
 	WARN("reads: %"PRIu64", hits: %"PRIu64", misses: %"PRIu64", prunes: %"PRIu64"\n",
 	     stats->reads, stats->hits, stats->misses, stats->prunes);
+	WARN("shared hits: %"PRIu64", shared fills: %"PRIu64"\n",
+	     stats->shared_hits, stats->shared_fills);
 }
 
 struct tap_disk tapdisk_block_cache = {
@@ -29,6 +29,16 @@
  * After a commit request, the client must wait for a competion message:
  * 4. completion
  *    "done"      4
+ * 5. write batch, which carries any number of write requests
+ *    "wbat"      4
+ *    flags       4 (TDREMUS_BATCH_ZLIB: payload is deflated)
+ *    length      4 (of the write requests)
+ *    wire length 4 (of the payload which follows)
+ *    payload     (wire length), write requests without their "wreq"
+ *
+ * The primary batches writes and streams them to the backup as the socket
+ * allows, so that at a checkpoint only what is still queued has to be sent
+ * before the commit request.
  */
 
 /* due to architectural choices in tapdisk, block-buffer is forced to
@@ -57,6 +67,7 @@
 #include <sys/sysctl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <zlib.h>
 
 /* timeout for reads and writes in ms */
 #define HEARTBEAT_MS 1000
@@ -65,6 +76,15 @@
 /* connect retry timeout (seconds) */
 #define REMUS_CONNRETRY_TIMEOUT 10
 
+/* a write batch is sent once this large, even if the stream is busy */
+#define REMUS_BATCH_BYTES (256 << 10)
+/* the primary stops queueing and waits for the backup beyond this */
+#define REMUS_QUEUE_MAX (32 << 20)
+/* the largest frame the backup accepts */
+#define REMUS_FRAME_MAX (64 << 20)
+/* set to 1 to deflate write batches */
+#define REMUS_COMPRESS_ENV "TAPDISK_REMUS_COMPRESS"
+
 #define RPRINTF(_f, _a...) syslog (LOG_DEBUG, "remus: " _f, ## _a)
 
 enum tdremus_mode {
@@ -144,6 +164,14 @@ struct ramdisk_write_cbdata {
 
 typedef void (*queue_rw_t) (td_driver_t *driver, td_request_t treq);
 
+/* a growable byte buffer, of which off bytes have been consumed */
+struct remus_buf {
+	char   *data;
+	size_t  off;
+	size_t  len;
+	size_t  size;
+};
+
 /* poll_fd type for blktap2 fd system. taken from block_log.c */
 typedef struct poll_fd {
 	int        fd;
@@ -172,6 +200,18 @@ struct tdremus_state {
 	/* queue write requests, batch-replicate at submit */
 	struct req_ring write_ring;
 
+	/* primary: writes are collected in batch, which is moved to out as
+	 * a frame whenever the stream is idle or the batch is full. out is
+	 * drained by out_id whenever the socket is writable. */
+	struct remus_buf batch;
+	struct remus_buf out;
+	event_id_t       out_id;
+	int              compress;
+
+	/* backup: the write batch being applied */
+	struct remus_buf in;
+	struct remus_buf inflated;
+
 	/* ramdisk data*/
 	struct ramdisk ramdisk;
 
@@ -193,6 +233,15 @@ typedef struct tdremus_wire {
 #define TDREMUS_COMMIT "creq"
 #define TDREMUS_DONE "done"
 #define TDREMUS_FAIL "fail"
+#define TDREMUS_BATCH "wbat"
+
+#define TDREMUS_BATCH_ZLIB 1
+
+typedef struct tdremus_batch {
+	uint32_t flags;
+	uint32_t len;
+	uint32_t wire_len;
+} tdremus_batch_t;
 
 /* primary read/write functions */
 static void primary_queue_read(td_driver_t *driver, td_request_t treq);
@@ -633,6 +682,54 @@ static int ramdisk_start(td_driver_t *driver)
 	return 0;
 }
 
+/* make room for len more bytes in b, dropping what has been consumed */
+static int remus_buf_reserve(struct remus_buf *b, size_t len)
+{
+	size_t size;
+	char *data;
+
+	if (b->off) {
+		memmove(b->data, b->data + b->off, b->len - b->off);
+		b->len -= b->off;
+		b->off  = 0;
+	}
+
+	if (b->len + len <= b->size)
+		return 0;
+
+	for (size = b->size ? : REMUS_BATCH_BYTES; size < b->len + len; size *= 2)
+		;
+
+	if (!(data = realloc(b->data, size))) {
+		RPRINTF("error allocating %zu byte buffer\n", size);
+		return -ENOMEM;
+	}
+
+	b->data = data;
+	b->size = size;
+
+	return 0;
+}
+
+static int remus_buf_append(struct remus_buf *b, const void *data, size_t len)
+{
+	int err;
+
+	if ((err = remus_buf_reserve(b, len)))
+		return err;
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+
+	return 0;
+}
+
+static void remus_buf_free(struct remus_buf *b)
+{
+	free(b->data);
+	memset(b, 0, sizeof(*b));
+}
+
 /* common client/server functions */
 /* mayberead: Time out after a certain interval. */
 static int mread(int fd, void* buf, size_t len)
@@ -735,6 +832,12 @@ static void inline close_stream_fd(struct tdremus_state *s)
 	tapdisk_server_unregister_event(s->stream_fd.id);
 	close(s->stream_fd.fd);
 	s->stream_fd.fd = -2;
+
+	/* whatever the primary had yet to send is lost with the backup */
+	tapdisk_server_unregister_event(s->out_id);
+	s->out_id = 0;
+	s->out.off = s->out.len = 0;
+	s->batch.len = 0;
 }
 
 /* primary functions */
@@ -835,13 +938,113 @@ static void primary_queue_read(td_driver_t *driver, td_request_t treq)
 	td_forward_request(treq);
 }
 
-/* TODO:
- * The primary uses mwrite() to write the contents of a write request to the
- * backup. This effectively blocks until all data has been copied into a system
- * buffer or a timeout has occured. We may wish to instead use tapdisk's
- * nonblocking i/o interface, tapdisk_server_register_event(), to set timeouts
- * and write data in an asynchronous fashion.
- */
+/* move the write batch to the output queue as one frame */
+static int primary_seal_batch(struct tdremus_state *s)
+{
+	tdremus_batch_t hdr;
+	size_t op = strlen(TDREMUS_BATCH);
+	uLongf wire_len;
+	char *frame;
+	int err;
+
+	if (!s->batch.len)
+		return 0;
+
+	wire_len = s->compress ? compressBound(s->batch.len) : s->batch.len;
+	if ((err = remus_buf_reserve(&s->out, op + sizeof(hdr) + wire_len)))
+		return err;
+
+	frame     = s->out.data + s->out.len;
+	hdr.flags = 0;
+	hdr.len   = s->batch.len;
+
+	if (s->compress &&
+	    compress2((Bytef *)frame + op + sizeof(hdr), &wire_len,
+		      (Bytef *)s->batch.data, s->batch.len,
+		      Z_BEST_SPEED) == Z_OK &&
+	    wire_len < s->batch.len)
+		hdr.flags |= TDREMUS_BATCH_ZLIB;
+	else {
+		wire_len = s->batch.len;
+		memcpy(frame + op + sizeof(hdr), s->batch.data, wire_len);
+	}
+	hdr.wire_len = wire_len;
+
+	memcpy(frame, TDREMUS_BATCH, op);
+	memcpy(frame + op, &hdr, sizeof(hdr));
+	s->out.len += op + sizeof(hdr) + wire_len;
+	s->batch.len = 0;
+
+	return 0;
+}
+
+static void remus_send_event(event_id_t id, char mode, void *private);
+
+/* send as much as the socket takes, and wait for it to become writable
+ * while anything is left */
+static int primary_send(struct tdremus_state *s)
+{
+	event_id_t id;
+	ssize_t n;
+
+	for (;;) {
+		if (s->out.off == s->out.len) {
+			s->out.off = s->out.len = 0;
+			/* the stream is idle, send what has been batched */
+			if (!s->batch.len)
+				break;
+			if (primary_seal_batch(s))
+				return -1;
+		}
+
+		n = write(s->stream_fd.fd, s->out.data + s->out.off,
+			  s->out.len - s->out.off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			RPRINTF("error during write: %s\n", strerror(errno));
+			return -1;
+		}
+
+		s->out.off += n;
+	}
+
+	if (s->out.len || s->batch.len) {
+		if (s->out_id)
+			return 0;
+
+		id = tapdisk_server_register_event(SCHEDULER_POLL_WRITE_FD,
+						   s->stream_fd.fd, 0,
+						   remus_send_event, s);
+		if (id < 0) {
+			RPRINTF("error registering send event handler: %s\n",
+				strerror(-id));
+			return -1;
+		}
+		s->out_id = id;
+	} else if (s->out_id) {
+		tapdisk_server_unregister_event(s->out_id);
+		s->out_id = 0;
+	}
+
+	return 0;
+}
+
+static void remus_send_event(event_id_t id, char mode, void *private)
+{
+	struct tdremus_state *s = (struct tdremus_state *)private;
+
+	if (primary_send(s) < 0) {
+		RPRINTF("error streaming to backup\n");
+		close_stream_fd(s);
+	}
+}
+
+/* Writes are only queued for the backup here, and streamed out by
+ * primary_send() as the socket allows. Should the backup fall behind by
+ * more than REMUS_QUEUE_MAX, wait for it instead of queueing more. */
 static void primary_queue_write(td_driver_t *driver, td_request_t treq)
 {
 	struct tdremus_state *s = (struct tdremus_state *)driver->data;
@@ -857,16 +1060,29 @@ static void primary_queue_write(td_driver_t *driver, td_request_t treq)
 		RPRINTF("connecting to backup...\n");
 		primary_blocking_connect(s);
 	}
+	if (s->stream_fd.fd < 0)
+		goto fail;
 
 	*sectors = treq.secs;
 	*sector = treq.sec;
 
-	if (mwrite(s->stream_fd.fd, TDREMUS_WRITE, strlen(TDREMUS_WRITE)) < 0)
+	if (remus_buf_append(&s->batch, header, sizeof(header)) < 0)
+		goto fail;
+	if (remus_buf_append(&s->batch, treq.buf,
+			     treq.secs * driver->info.sector_size) < 0)
 		goto fail;
-	if (mwrite(s->stream_fd.fd, header, sizeof(header)) < 0)
+
+	if (s->batch.len >= REMUS_BATCH_BYTES && primary_seal_batch(s) < 0)
 		goto fail;
 
-	if (mwrite(s->stream_fd.fd, treq.buf, treq.secs * driver->info.sector_size) < 0)
+	if (s->out.len - s->out.off >= REMUS_QUEUE_MAX) {
+		if (mwrite(s->stream_fd.fd, s->out.data + s->out.off,
+			   s->out.len - s->out.off) < 0)
+			goto fail;
+		s->out.off = s->out.len = 0;
+	}
+
+	if (primary_send(s) < 0)
 		goto fail;
 
 	td_forward_request(treq);
@@ -891,7 +1107,11 @@ static int client_flush(td_driver_t *driver)
 		/* connection not yet established, nothing to flush */
 		return 0;
 
-	if (mwrite(s->stream_fd.fd, TDREMUS_COMMIT, strlen(TDREMUS_COMMIT)) < 0) {
+	/* the commit request follows every write of the epoch */
+	if (primary_seal_batch(s) < 0 ||
+	    remus_buf_append(&s->out, TDREMUS_COMMIT,
+			     strlen(TDREMUS_COMMIT)) < 0 ||
+	    primary_send(s) < 0) {
 		RPRINTF("error flushing output");
 		close_stream_fd(s);
 		return -1;
@@ -925,6 +1145,11 @@ static int primary_start(td_driver_t *driver)
 	s->stream_fd.fd = -1;
 	s->stream_fd.id = -1;
 
+	s->compress = getenv(REMUS_COMPRESS_ENV) &&
+		atoi(getenv(REMUS_COMPRESS_ENV));
+	if (s->compress)
+		RPRINTF("compressing replication stream\n");
+
 	return 0;
 }
 
@@ -1238,6 +1463,73 @@ static int server_do_wreq(td_driver_t *driver)
 	return -1;
 }
 
+/* apply a batch of writes to the ramdisk, as server_do_wreq() would */
+static int server_do_wbat(td_driver_t *driver)
+{
+	struct tdremus_state *s = (struct tdremus_state *)driver->data;
+	size_t size = driver->info.sector_size;
+	tdremus_batch_t hdr;
+	char *req, *end;
+	uLongf len;
+	uint32_t sectors;
+	uint64_t sector;
+
+	if (mread(s->stream_fd.fd, &hdr, sizeof(hdr)) < 0)
+		goto err;
+
+	if (hdr.len > REMUS_FRAME_MAX || hdr.wire_len > REMUS_FRAME_MAX) {
+		RPRINTF("write batch too large: %u/%u\n", hdr.len, hdr.wire_len);
+		goto err;
+	}
+
+	s->in.off = s->in.len = 0;
+	if (remus_buf_reserve(&s->in, hdr.wire_len) < 0)
+		goto err;
+	if (mread(s->stream_fd.fd, s->in.data, hdr.wire_len) < 0)
+		goto err;
+
+	req = s->in.data;
+	if (hdr.flags & TDREMUS_BATCH_ZLIB) {
+		s->inflated.off = s->inflated.len = 0;
+		if (remus_buf_reserve(&s->inflated, hdr.len) < 0)
+			goto err;
+
+		len = hdr.len;
+		if (uncompress((Bytef *)s->inflated.data, &len,
+			       (Bytef *)s->in.data, hdr.wire_len) != Z_OK ||
+		    len != hdr.len)
+			goto bad;
+		req = s->inflated.data;
+	} else if (hdr.len != hdr.wire_len)
+		goto bad;
+
+	for (end = req + hdr.len; req < end; req += sectors * size) {
+		if (end - req < sizeof(sectors) + sizeof(sector))
+			goto bad;
+
+		memcpy(&sectors, req, sizeof(sectors));
+		memcpy(&sector, req + sizeof(sectors), sizeof(sector));
+		req += sizeof(sectors) + sizeof(sector);
+
+		if ((end - req) / size < sectors)
+			goto bad;
+
+		if (ramdisk_write(&s->ramdisk, sector, sectors, req) < 0)
+			goto err;
+	}
+
+	return 0;
+
+ bad:
+	RPRINTF("corrupt write batch\n");
+ err:
+	/* should start failover */
+	RPRINTF("backup write batch error\n");
+	close_stream_fd(s);
+
+	return -1;
+}
+
 static int server_do_sreq(td_driver_t *driver)
 {
 	/*
@@ -1287,6 +1579,8 @@ static void remus_server_event(event_id_t id, char mode, void *private)
 
 	if (!strcmp(req, TDREMUS_WRITE))
 		server_do_wreq(driver);
+	else if (!strcmp(req, TDREMUS_BATCH))
+		server_do_wbat(driver);
 	else if (!strcmp(req, TDREMUS_SUBMIT))
 		server_do_sreq(driver);
 	else if (!strcmp(req, TDREMUS_COMMIT))
@@ -1703,6 +1997,11 @@ static int tdremus_close(td_driver_t *driver)
 	if (s->stream_fd.fd >= 0)
 		close_stream_fd(s);
 
+	remus_buf_free(&s->batch);
+	remus_buf_free(&s->out);
+	remus_buf_free(&s->in);
+	remus_buf_free(&s->inflated);
+
 	ctl_close(driver);
 
 	return 0;
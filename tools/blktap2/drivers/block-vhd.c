@@ -41,6 +41,10 @@
  *     writes and the zero-bitmap write complete, the BAT and bitmap writes
  *     are started in parallel.  The transaction is completed only after both
  *     the BAT and bitmap writes successfully return.
+ * Writes to a block whose bitmap is being written join the next transaction,
+ * which starts as soon as that bitmap write finishes, so a burst of writes
+ * to one block costs one bitmap write per transaction rather than one per
+ * request.  A transaction which sets no new bits skips its bitmap write.
  */
 
 #include <errno.h>
@@ -109,7 +113,10 @@ unsigned int SPB;
 #endif
 
 /******VHD DEFINES******/
-#define VHD_CACHE_SIZE               32
+#define VHD_CACHE_SIZE               32        /* default, and minimum */
+#define VHD_CACHE_SIZE_MAX           65536
+#define VHD_CACHE_SIZE_ENV           "TAPDISK_VHD_BITMAP_CACHE"
+#define VHD_BM_PREFETCH              4         /* bitmaps read ahead */
 
 #define VHD_REQS_DATA                TAPDISK_DATA_REQUESTS
 #define VHD_REQS_META                (VHD_CACHE_SIZE + 2)
@@ -197,6 +204,7 @@ struct vhd_bitmap {
 	u32                       blk;
 	u64                       seqno;       /* lru sequence number */
 	vhd_flag_t                status;
+	struct vhd_bitmap        *hash_next;   /* in bm_hash chain of blk */
 
 	char                     *map;         /* map should only be modified
 					        * in finish_bitmap_write */
@@ -229,11 +237,16 @@ struct vhd_state {
 
 	u64                       bm_lru;      /* lru sequence number */
 	u32                       bm_secs;     /* size of bitmap, in sectors */
-	struct vhd_bitmap        *bitmap[VHD_CACHE_SIZE];
+	u32                       bm_last_miss;/* blk of the last read miss */
+	int                       bm_cache_size;
+	struct vhd_bitmap       **bitmap;
+
+	u32                       bm_hash_mask;
+	struct vhd_bitmap       **bm_hash;     /* cached bitmaps, by blk */
 
 	int                       bm_free_count;
-	struct vhd_bitmap        *bitmap_free[VHD_CACHE_SIZE];
-	struct vhd_bitmap         bitmap_list[VHD_CACHE_SIZE];
+	struct vhd_bitmap       **bitmap_free;
+	struct vhd_bitmap        *bitmap_list;
 
 	int                       vreq_free_count;
 	struct vhd_request       *vreq_free[VHD_REQS_DATA];
@@ -456,29 +469,77 @@ vhd_free_bitmap_cache(struct vhd_state *s)
 	int i;
 	struct vhd_bitmap *bm;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
-		bm = s->bitmap_list + i;
-		free(bm->map);
-		free(bm->shadow);
-		s->bitmap_free[i] = NULL;
+	if (s->bitmap_list) {
+		for (i = 0; i < s->bm_cache_size; i++) {
+			bm = s->bitmap_list + i;
+			free(bm->map);
+			free(bm->shadow);
+		}
+	}
+
+	free(s->bitmap_list);
+	free(s->bitmap_free);
+	free(s->bitmap);
+	free(s->bm_hash);
+
+	s->bitmap_list   = NULL;
+	s->bitmap_free   = NULL;
+	s->bitmap        = NULL;
+	s->bm_hash       = NULL;
+	s->bm_free_count = 0;
+}
+
+/*
+ * The number of bitmaps to cache, from the environment: random I/O over
+ * large images touches many more blocks than the default covers.
+ */
+static int
+vhd_bitmap_cache_size(void)
+{
+	const char *env;
+	unsigned long n;
+	char *end;
+
+	env = getenv(VHD_CACHE_SIZE_ENV);
+	if (!env || !*env)
+		return VHD_CACHE_SIZE;
+
+	n = strtoul(env, &end, 0);
+	if (*end || n < VHD_CACHE_SIZE || n > VHD_CACHE_SIZE_MAX) {
+		EPRINTF("ignoring %s=%s: must be %d to %d\n", VHD_CACHE_SIZE_ENV,
+			env, VHD_CACHE_SIZE, VHD_CACHE_SIZE_MAX);
+		return VHD_CACHE_SIZE;
 	}
 
-	memset(s->bitmap_list, 0, sizeof(struct vhd_bitmap) * VHD_CACHE_SIZE);
+	return n;
 }
 
 static int
 vhd_initialize_bitmap_cache(struct vhd_state *s)
 {
-	int i, err, map_size;
+	int i, err, map_size, buckets;
 	struct vhd_bitmap *bm;
 
-	memset(s->bitmap_list, 0, sizeof(struct vhd_bitmap) * VHD_CACHE_SIZE);
+	s->bm_cache_size = vhd_bitmap_cache_size();
+	for (buckets = 1; buckets < s->bm_cache_size; buckets <<= 1)
+		;
+
+	s->bitmap_list  = calloc(s->bm_cache_size, sizeof(struct vhd_bitmap));
+	s->bitmap_free  = calloc(s->bm_cache_size, sizeof(struct vhd_bitmap *));
+	s->bitmap       = calloc(s->bm_cache_size, sizeof(struct vhd_bitmap *));
+	s->bm_hash      = calloc(buckets, sizeof(struct vhd_bitmap *));
+	s->bm_hash_mask = buckets - 1;
+	if (!s->bitmap_list || !s->bitmap_free || !s->bitmap || !s->bm_hash) {
+		err = -ENOMEM;
+		goto fail;
+	}
 
 	s->bm_lru        = 0;
+	s->bm_last_miss  = DD_BLK_UNUSED;
 	map_size         = vhd_sectors_to_bytes(s->bm_secs);
-	s->bm_free_count = VHD_CACHE_SIZE;
+	s->bm_free_count = s->bm_cache_size;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	for (i = 0; i < s->bm_cache_size; i++) {
 		bm = s->bitmap_list + i;
 
 		err = posix_memalign((void **)&bm->map, 512, map_size);
@@ -957,9 +1018,10 @@ bat_locked(struct vhd_state *s)
 static inline void
 init_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
-	bm->blk    = 0;
-	bm->seqno  = 0;
-	bm->status = 0;
+	bm->blk       = 0;
+	bm->seqno     = 0;
+	bm->status    = 0;
+	bm->hash_next = NULL;
 	init_tx(&bm->tx);
 	clear_req_list(&bm->queue);
 	clear_req_list(&bm->waiting);
@@ -968,17 +1030,43 @@ init_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 	init_vhd_request(s, &bm->req);
 }
 
+static inline struct vhd_bitmap **
+bitmap_hash(struct vhd_state *s, uint32_t block)
+{
+	return &s->bm_hash[block & s->bm_hash_mask];
+}
+
+static inline void
+hash_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
+{
+	struct vhd_bitmap **head = bitmap_hash(s, bm->blk);
+
+	bm->hash_next = *head;
+	*head         = bm;
+}
+
+static inline void
+unhash_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
+{
+	struct vhd_bitmap **p;
+
+	for (p = bitmap_hash(s, bm->blk); *p; p = &(*p)->hash_next)
+		if (*p == bm) {
+			*p = bm->hash_next;
+			break;
+		}
+
+	bm->hash_next = NULL;
+}
+
 static inline struct vhd_bitmap *
 get_bitmap(struct vhd_state *s, uint32_t block)
 {
-	int i;
 	struct vhd_bitmap *bm;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
-		bm = s->bitmap[i];
-		if (bm && bm->blk == block)
+	for (bm = *bitmap_hash(s, block); bm; bm = bm->hash_next)
+		if (bm->blk == block)
 			return bm;
-	}
 
 	return NULL;
 }
@@ -1037,7 +1125,7 @@ remove_lru_bitmap(struct vhd_state *s)
 	u64 seq = s->bm_lru;
 	struct vhd_bitmap *bm, *lru = NULL;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	for (i = 0; i < s->bm_cache_size; i++) {
 		bm = s->bitmap[i];
 		if (bm && bm->seqno < seq && !bitmap_locked(bm)) {
 			idx = i;
@@ -1048,6 +1136,7 @@ remove_lru_bitmap(struct vhd_state *s)
 
 	if (lru) {
 		s->bitmap[idx] = NULL;
+		unhash_bitmap(s, lru);
 		ASSERT(!bitmap_in_use(lru));
 	}
 
@@ -1084,7 +1173,7 @@ __bitmap_lru_seqno(struct vhd_state *s)
 
 	if (s->bm_lru == 0xffffffff) {
 		s->bm_lru = 0;
-		for (i = 0; i < VHD_CACHE_SIZE; i++) {
+		for (i = 0; i < s->bm_cache_size; i++) {
 			bm = s->bitmap[i];
 			if (bm) {
 				bm->seqno >>= 1;
@@ -1107,10 +1196,11 @@ static inline void
 install_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
 	int i;
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	for (i = 0; i < s->bm_cache_size; i++) {
 		if (!s->bitmap[i]) {
 			touch_bitmap(s, bm);
 			s->bitmap[i] = bm;
+			hash_bitmap(s, bm);
 			return;
 		}
 	}
@@ -1123,15 +1213,16 @@ free_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
 	int i;
 
-	for (i = 0; i < VHD_CACHE_SIZE; i++)
+	for (i = 0; i < s->bm_cache_size; i++)
 		if (s->bitmap[i] == bm)
 			break;
 
 	ASSERT(!bitmap_locked(bm));
 	ASSERT(!bitmap_in_use(bm));
-	ASSERT(i < VHD_CACHE_SIZE);
+	ASSERT(i < s->bm_cache_size);
 
 	s->bitmap[i] = NULL;
+	unhash_bitmap(s, bm);
 	s->bitmap_free[s->bm_free_count++] = bm;
 }
 
@@ -1670,6 +1761,38 @@ __vhd_queue_request(struct vhd_state *s, uint8_t op, td_request_t treq)
 	return 0;
 }
 
+/*
+ * On the bitmap miss of a sequential read, read the bitmaps of the next
+ * few allocated blocks too, so that the read does not stall on a bitmap
+ * read at every block boundary.
+ */
+static void
+prefetch_bitmaps(struct vhd_state *s, uint32_t blk)
+{
+	int i;
+	uint32_t next;
+
+	if (blk != s->bm_last_miss + 1) {
+		s->bm_last_miss = blk;
+		return;
+	}
+
+	for (i = 1; i <= VHD_BM_PREFETCH; i++) {
+		next = blk + i;
+		if (next >= s->bat.bat.entries)
+			break;
+
+		if (bat_entry(s, next) == DD_BLK_UNUSED ||
+		    test_batmap(s, next) || get_bitmap(s, next))
+			continue;
+
+		if (schedule_bitmap_read(s, next))
+			break;
+	}
+
+	s->bm_last_miss = blk + VHD_BM_PREFETCH;
+}
+
 static void
 vhd_queue_read(td_driver_t *driver, td_request_t treq)
 {
@@ -1716,6 +1839,8 @@ vhd_queue_read(td_driver_t *driver, td_request_t treq)
 			err = __vhd_queue_request(s, VHD_OP_DATA_READ, clone);
 			if (err)
 				goto fail;
+
+			prefetch_bitmaps(s, clone.sec / s->spb);
 			break;
 
 		case VHD_BM_READ_PENDING:
@@ -1977,7 +2102,14 @@ finish_data_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
 
 	tx->closed = 1;
 
-	if (!tx->error)
+	/*
+	 * A transaction which allocated the block always sets new bits;
+	 * one whose writes only hit sectors already marked on disk (they
+	 * raced with the bitmap write of the previous transaction) has
+	 * nothing to write.
+	 */
+	if (!tx->error &&
+	    memcmp(bm->shadow, bm->map, vhd_sectors_to_bytes(s->bm_secs)))
 		return schedule_bitmap_write(s, bm->blk);
 
 	return finish_bitmap_transaction(s, bm, 0);
@@ -2261,8 +2393,8 @@ vhd_debug(td_driver_t *driver)
 			    t->sec, r->flags, r, r->next, r->tx);
 	}
 
-	DBG(TLOG_WARN, "BITMAP CACHE:\n");
-	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+	DBG(TLOG_WARN, "BITMAP CACHE: (%d total)\n", s->bm_cache_size);
+	for (i = 0; i < s->bm_cache_size; i++) {
 		int qnum = 0, wnum = 0, rnum = 0;
 		struct vhd_bitmap *bm = s->bitmap[i];
 		struct vhd_transaction *tx;
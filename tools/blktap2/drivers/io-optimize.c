@@ -111,9 +111,10 @@ restore_iocb(struct opio *op)
 {
 	struct iocb *io = op->iocb;
 
-	io->data        = op->data;
-	io->u.c.buf     = op->buf;
-	io->u.c.nbytes  = op->nbytes;
+	io->data           = op->data;
+	io->aio_lio_opcode = op->opcode;
+	io->u.c.buf        = op->buf;
+	io->u.c.nbytes     = op->nbytes;
 }
 
 static inline int
@@ -138,13 +139,6 @@ contiguous_buffers(struct iocb *l, struct iocb *r)
 	return (l->u.c.buf + l->u.c.nbytes == r->u.c.buf);
 }
 
-static inline int
-contiguous_iocbs(struct iocb *l, struct iocb *r)
-{
-	return ((l->aio_fildes == r->aio_fildes) &&
-		contiguous_sectors(l, r) &&
-		contiguous_buffers(l, r));
-}
 
 static inline void
 init_opio_list(struct opio *op)
@@ -164,6 +158,7 @@ opio_iocb_init(struct opioctx *ctx, struct iocb *io)
 	op->buf    = io->u.c.buf;
 	op->nbytes = io->u.c.nbytes;
 	op->offset = io->u.c.offset;
+	op->opcode = io->aio_lio_opcode;
 	op->data   = io->data;
 	op->iocb   = io;
 	io->data   = op;
@@ -202,16 +197,90 @@ merge_tail(struct opioctx *ctx, struct iocb *head, struct iocb *io)
 	return 0;
 }
 
+/*
+ * @io follows @head on disk but not in memory: describe the merged
+ * buffers with an iovec, to be issued as one preadv/pwritev.
+ */
+static int
+merge_vector(struct opioctx *ctx, struct iocb *head, struct iocb *io)
+{
+	struct opio *ophead;
+	struct iovec *last;
+
+	ophead = opio_get(ctx, head);
+	if (!ophead)
+		return -ENOMEM;
+
+	if (!ophead->iovcnt) {
+		ophead->iov[0].iov_base = head->u.c.buf;
+		ophead->iov[0].iov_len  = head->u.c.nbytes;
+		ophead->iovcnt          = 1;
+	}
+
+	last = &ophead->iov[ophead->iovcnt - 1];
+	if ((char *)last->iov_base + last->iov_len != io->u.c.buf &&
+	    ophead->iovcnt == OPIO_MAX_IOVS)
+		return -EINVAL;
+
+	if (merge_tail(ctx, head, io))
+		return -ENOMEM;
+
+	if ((char *)last->iov_base + last->iov_len == io->u.c.buf)
+		last->iov_len += io->u.c.nbytes;
+	else {
+		last++;
+		last->iov_base = io->u.c.buf;
+		last->iov_len  = io->u.c.nbytes;
+		ophead->iovcnt++;
+	}
+
+	return 0;
+}
+
 static int
 merge(struct opioctx *ctx, struct iocb *head, struct iocb *io)
 {
+	struct opio *ophead;
+
 	if (head->aio_lio_opcode != io->aio_lio_opcode)
 		return -EINVAL;
 
-	if (!contiguous_iocbs(head, io))
+	if (head->aio_fildes != io->aio_fildes ||
+	    !contiguous_sectors(head, io))
 		return -EINVAL;
 
-	return merge_tail(ctx, head, io);		
+	ophead = iocb_optimized(ctx, head) ? head->data : NULL;
+	if ((!ophead || !ophead->iovcnt) && contiguous_buffers(head, io))
+		return merge_tail(ctx, head, io);
+
+	return merge_vector(ctx, head, io);
+}
+
+/* Turn heads with scattered buffers into vectored iocbs. */
+static void
+vectorize(struct opioctx *ctx, struct iocb **queue, int num)
+{
+	int i;
+	struct iocb *io;
+	struct opio *op;
+
+	for (i = 0; i < num; i++) {
+		io = queue[i];
+		if (!iocb_optimized(ctx, io))
+			continue;
+
+		op = (struct opio *)io->data;
+		if (!op->iovcnt)
+			continue;
+
+		op->total          = io->u.c.nbytes;
+		io->aio_lio_opcode = (io->aio_lio_opcode == IO_CMD_PREAD ?
+				      IO_CMD_PREADV : IO_CMD_PWRITEV);
+		io->u.c.buf        = op->iov;
+		io->u.c.nbytes     = op->iovcnt;
+
+		ctx->stats.vectored++;
+	}
 }
 
 int
@@ -238,7 +307,12 @@ io_merge(struct opioctx *ctx, struct iocb **queue, int num)
 	print_merged_iocbs(ctx, queue, on_queue + 1);
 #endif
 
-	return ++on_queue;
+	vectorize(ctx, queue, ++on_queue);
+
+	ctx->stats.iocbs     += num;
+	ctx->stats.submitted += on_queue;
+
+	return on_queue;
 }
 
 static int
@@ -297,7 +371,7 @@ expand_event(struct opioctx *ctx,
 	ophead = (struct opio *)io->data;
 	op     = ophead;
 
-	if (event->res == io->u.c.nbytes)
+	if (event->res == (ophead->iovcnt ? ophead->total : io->u.c.nbytes))
 		err = 0;
 	else if ((int)event->res < 0)
 		err = (int)event->res;
@@ -528,10 +602,22 @@ simulate_io(struct iocb **iocbs, struct io_event *events, int num_iocbs)
 		done = num_iocbs;
 
 	for (i = 0; i < done; i++) {
+		unsigned long nbytes;
+
 		io      = iocbs[i];
 		ep      = &events[i];
 		ep->obj = io;
-		ep->res = (random() % 10 < 8 ? io->u.c.nbytes : 0);
+		nbytes  = io->u.c.nbytes;
+
+		if (iocb_vectored(io)) {
+			const struct iovec *iov = io->u.c.buf;
+			int j;
+
+			for (nbytes = 0, j = 0; j < io->u.c.nbytes; j++)
+				nbytes += iov[j].iov_len;
+		}
+
+		ep->res = (random() % 10 < 8 ? nbytes : 0);
 	}
 
 	return done;
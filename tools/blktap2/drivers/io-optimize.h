@@ -30,6 +30,11 @@
 #define __IO_OPTIMIZE_H__
 
 #include <libaio.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* file-contiguous iocbs with scattered buffers merge into one vector */
+#define OPIO_MAX_IOVS       32
 
 struct opio;
 
@@ -48,6 +53,16 @@ struct opio {
 	struct opio        *head;
 	struct opio        *next;
 	struct opio_list    list;
+	short               opcode;
+	int                 iovcnt;      /* of head, once vectored */
+	unsigned long       total;       /* bytes, of vectored head */
+	struct iovec        iov[OPIO_MAX_IOVS];
+};
+
+struct opio_stats {
+	uint64_t            iocbs;       /* given to io_merge */
+	uint64_t            submitted;   /* after merging */
+	uint64_t            vectored;    /* of those, as preadv/pwritev */
 };
 
 struct opioctx {
@@ -57,6 +72,7 @@ struct opioctx {
 	struct opio       **free_opios;
 	struct iocb       **iocb_queue;
 	struct io_event    *event_queue;
+	struct opio_stats   stats;
 };
 
 int opio_init(struct opioctx *ctx, int num_iocbs);
@@ -65,4 +81,11 @@ int io_merge(struct opioctx *ctx, struct iocb **queue, int num);
 int io_split(struct opioctx *ctx, struct io_event *events, int num);
 int io_expand_iocbs(struct opioctx *ctx, struct iocb **queue, int idx, int num);
 
+static inline int
+iocb_vectored(const struct iocb *io)
+{
+	return (io->aio_lio_opcode == IO_CMD_PREADV ||
+		io->aio_lio_opcode == IO_CMD_PWRITEV);
+}
+
 #endif
@@ -306,6 +306,22 @@ tapdisk_control_get_pid(struct tapdisk_control_connection *connection,
 	tapdisk_control_close_connection(connection);
 }
 
+static void
+tapdisk_control_get_stats(struct tapdisk_control_connection *connection,
+			  tapdisk_message_t *request)
+{
+	tapdisk_message_t response;
+
+	memset(&response, 0, sizeof(response));
+	response.type = TAPDISK_MESSAGE_STATS_RSP;
+	response.cookie = request->cookie;
+	tapdisk_server_queue_stats(response.u.string.text,
+				   sizeof(response.u.string.text));
+
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
 static void
 tapdisk_control_attach_vbd(struct tapdisk_control_connection *connection,
 			   tapdisk_message_t *request)
@@ -664,6 +680,8 @@ tapdisk_control_handle_request(event_id_t id, char mode, void *private)
 		return tapdisk_control_resume_vbd(connection, &message);
 	case TAPDISK_MESSAGE_CLOSE:
 		return tapdisk_control_close_image(connection, &message);
+	case TAPDISK_MESSAGE_STATS:
+		return tapdisk_control_get_stats(connection, &message);
 	default: {
 		tapdisk_message_t response;
 	fail:
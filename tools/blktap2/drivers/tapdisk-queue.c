@@ -27,9 +27,13 @@
 */
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <libaio.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #ifdef __linux__
 #include <linux/version.h>
 #endif
@@ -42,6 +46,7 @@
 #include "tapdisk-utils.h"
 
 #include "libaio-compat.h"
+#include "uring-compat.h"
 #include "atomicio.h"
 
 #define WARN(_f, _a...) tlog_write(TLOG_WARN, _f, ##_a)
@@ -213,6 +218,18 @@ tapdisk_rwio_rw(const struct iocb *iocb)
 	ssize_t (*func)(int, void *, size_t) = 
 		(iocb->aio_lio_opcode == IO_CMD_PWRITE ? vwrite : read);
 
+	if (iocb_vectored(iocb)) {
+		const struct iovec *iov = iocb->u.c.buf;
+		int iovcnt = iocb->u.c.nbytes;
+		ssize_t ret;
+
+		ret = (iocb->aio_lio_opcode == IO_CMD_PWRITEV ?
+		       pwritev(fd, iov, iovcnt, off) :
+		       preadv(fd, iov, iovcnt, off));
+
+		return ret < 0 ? -errno : ret;
+	}
+
 	if (lseek(fd, off, SEEK_SET) == (off_t)-1)
 		return -errno;
 
@@ -547,6 +564,489 @@ static const struct tio td_tio_lio = {
 	.tio_submit  = tapdisk_lio_submit,
 };
 
+#ifdef HAVE_IO_URING
+
+/*
+ * io_uring
+ *
+ * Completions are reaped straight off the CQ ring when the ring fd polls
+ * readable, so there is neither an eventfd to ack nor an io_getevents()
+ * call per batch.  Requests on buffers within a registered region (the
+ * blkif data pages of each vbd) use the fixed buffer ops, which spare the
+ * kernel pinning the pages for every request.  With SQ polling, a kernel
+ * thread picks up submissions and io_uring_enter() is only needed to wake
+ * it once it went idle.
+ */
+
+#define URING_MAX_BUFS          16
+#define URING_SQ_THREAD_IDLE    50 /* ms */
+
+struct uring {
+	int                   ring_fd;
+	int                   event_id;
+	int                   flags;
+
+	void                 *sq_ring;
+	size_t                sq_ring_sz;
+	unsigned             *sq_head;
+	unsigned             *sq_tail;
+	unsigned             *sq_flags;
+	unsigned             *sq_array;
+	unsigned              sq_mask;
+	unsigned              sq_entries;
+
+	struct io_uring_sqe  *sqes;
+	size_t                sqes_sz;
+
+	void                 *cq_ring;
+	size_t                cq_ring_sz;
+	unsigned             *cq_head;
+	unsigned             *cq_tail;
+	struct io_uring_cqe  *cqes;
+	unsigned              cq_mask;
+	unsigned              cq_entries;
+
+	struct io_event      *aio_events;
+
+	struct iovec          bufs[URING_MAX_BUFS];
+	int                   nr_bufs;
+	/* number of bufs the kernel knows about, 0 if registration failed */
+	int                   nr_registered;
+};
+
+#define URING_FLAG_SQPOLL       (1<<0)
+
+static void
+tapdisk_uring_destroy(struct tqueue *queue)
+{
+	struct uring *uring = queue->tio_data;
+
+	if (!uring)
+		return;
+
+	if (uring->event_id >= 0) {
+		tapdisk_server_unregister_event(uring->event_id);
+		uring->event_id = -1;
+	}
+
+	if (uring->sqes) {
+		munmap(uring->sqes, uring->sqes_sz);
+		uring->sqes = NULL;
+	}
+
+	if (uring->cq_ring) {
+		munmap(uring->cq_ring, uring->cq_ring_sz);
+		uring->cq_ring = NULL;
+	}
+
+	if (uring->sq_ring) {
+		munmap(uring->sq_ring, uring->sq_ring_sz);
+		uring->sq_ring = NULL;
+	}
+
+	if (uring->ring_fd >= 0) {
+		close(uring->ring_fd);
+		uring->ring_fd = -1;
+	}
+
+	free(uring->aio_events);
+	uring->aio_events = NULL;
+}
+
+/*
+ * We only use IORING_OP_READ and IORING_OP_WRITE (and their fixed
+ * variants), which came with IORING_REGISTER_PROBE in 5.6.
+ */
+static int
+tapdisk_uring_probe(struct uring *uring)
+{
+	struct io_uring_probe *probe;
+	size_t sz;
+	int err;
+
+	sz    = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = calloc(1, sz);
+	if (!probe)
+		return -errno;
+
+	err = tapdisk_sys_io_uring_register(uring->ring_fd,
+					    IORING_REGISTER_PROBE, probe, 256);
+	if (err < 0)
+		err = -errno;
+	else if (probe->last_op < IORING_OP_WRITE ||
+		 !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+		 !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
+		err = -ENOSYS;
+
+	free(probe);
+	return err;
+}
+
+static int
+tapdisk_uring_map_rings(struct uring *uring, struct io_uring_params *p)
+{
+	int fd = uring->ring_fd;
+
+	uring->sq_ring_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	uring->sq_ring    = mmap(NULL, uring->sq_ring_sz,
+				 PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, fd,
+				 IORING_OFF_SQ_RING);
+	if (uring->sq_ring == MAP_FAILED) {
+		uring->sq_ring = NULL;
+		return -errno;
+	}
+
+	uring->cq_ring_sz = p->cq_off.cqes +
+		p->cq_entries * sizeof(struct io_uring_cqe);
+	uring->cq_ring    = mmap(NULL, uring->cq_ring_sz,
+				 PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, fd,
+				 IORING_OFF_CQ_RING);
+	if (uring->cq_ring == MAP_FAILED) {
+		uring->cq_ring = NULL;
+		return -errno;
+	}
+
+	uring->sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes    = mmap(NULL, uring->sqes_sz,
+			      PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, fd,
+			      IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		return -errno;
+	}
+
+	uring->sq_head    = uring->sq_ring + p->sq_off.head;
+	uring->sq_tail    = uring->sq_ring + p->sq_off.tail;
+	uring->sq_flags   = uring->sq_ring + p->sq_off.flags;
+	uring->sq_array   = uring->sq_ring + p->sq_off.array;
+	uring->sq_mask    = *(unsigned *)(uring->sq_ring + p->sq_off.ring_mask);
+	uring->sq_entries = p->sq_entries;
+
+	uring->cq_head    = uring->cq_ring + p->cq_off.head;
+	uring->cq_tail    = uring->cq_ring + p->cq_off.tail;
+	uring->cqes       = uring->cq_ring + p->cq_off.cqes;
+	uring->cq_mask    = *(unsigned *)(uring->cq_ring + p->cq_off.ring_mask);
+	uring->cq_entries = p->cq_entries;
+
+	return 0;
+}
+
+static void
+tapdisk_uring_event(event_id_t id, char mode, void *private)
+{
+	struct tqueue *queue = private;
+	struct uring *uring = queue->tio_data;
+	unsigned head, tail;
+	int i, ret, split;
+	struct iocb *iocb;
+	struct tiocb *tiocb;
+	struct io_event *ep;
+
+	/* reap everything there is in one go */
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (ret = 0; head != tail && ret < uring->cq_entries; head++, ret++) {
+		struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+
+		ep      = uring->aio_events + ret;
+		ep->obj = (struct iocb *)(uintptr_t)cqe->user_data;
+		ep->res = (long)cqe->res;
+	}
+
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+	split = io_split(&queue->opioctx, uring->aio_events, ret);
+	tapdisk_filter_events(queue->filter, uring->aio_events, split);
+
+	DBG("events: %d, tiocbs: %d\n", ret, split);
+
+	queue->iocbs_pending  -= ret;
+	queue->tiocbs_pending -= split;
+
+	for (i = split, ep = uring->aio_events; i-- > 0; ep++) {
+		iocb  = ep->obj;
+		tiocb = iocb->data;
+		complete_tiocb(queue, tiocb, ep->res);
+	}
+
+	queue_deferred_tiocbs(queue);
+}
+
+static int
+tapdisk_uring_setup_flags(struct tqueue *queue, int qlen, int flags)
+{
+	struct uring *uring = queue->tio_data;
+	struct io_uring_params p;
+	int err;
+
+	uring->ring_fd  = -1;
+	uring->event_id = -1;
+	uring->flags    = flags;
+
+	memset(&p, 0, sizeof(p));
+	if (flags & URING_FLAG_SQPOLL) {
+		p.flags          = IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = URING_SQ_THREAD_IDLE;
+	}
+
+	uring->ring_fd = tapdisk_sys_io_uring_setup(qlen, &p);
+	if (uring->ring_fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	/* before 5.11, SQ polling only worked with registered files */
+	if ((flags & URING_FLAG_SQPOLL) &&
+	    !(p.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+		err = -ENOSYS;
+		goto fail;
+	}
+
+	err = tapdisk_uring_probe(uring);
+	if (err)
+		goto fail;
+
+	err = tapdisk_uring_map_rings(uring, &p);
+	if (err)
+		goto fail;
+
+	uring->aio_events = calloc(uring->cq_entries, sizeof(struct io_event));
+	if (!uring->aio_events) {
+		err = -errno;
+		goto fail;
+	}
+
+	uring->event_id =
+		tapdisk_server_register_event(SCHEDULER_POLL_READ_FD,
+					      uring->ring_fd, 0,
+					      tapdisk_uring_event,
+					      queue);
+	err = uring->event_id;
+	if (err < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	tapdisk_uring_destroy(queue);
+	return err;
+}
+
+static int
+tapdisk_uring_setup(struct tqueue *queue, int qlen)
+{
+	return tapdisk_uring_setup_flags(queue, qlen, 0);
+}
+
+static int
+tapdisk_uring_setup_sqpoll(struct tqueue *queue, int qlen)
+{
+	return tapdisk_uring_setup_flags(queue, qlen, URING_FLAG_SQPOLL);
+}
+
+/* index of the registered buffer containing the request, or -1 */
+static int
+tapdisk_uring_find_buffer(struct uring *uring, const struct iocb *iocb)
+{
+	char *buf = iocb->u.c.buf;
+	int i;
+
+	if (iocb_vectored(iocb))
+		return -1;
+
+	for (i = 0; i < uring->nr_registered; i++) {
+		char *base = uring->bufs[i].iov_base;
+
+		if (buf >= base &&
+		    buf + iocb->u.c.nbytes <= base + uring->bufs[i].iov_len)
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+tapdisk_uring_prep_sqe(struct uring *uring, struct io_uring_sqe *sqe,
+		       struct iocb *iocb)
+{
+	int write = (iocb->aio_lio_opcode == IO_CMD_PWRITE ||
+		     iocb->aio_lio_opcode == IO_CMD_PWRITEV);
+	int idx   = tapdisk_uring_find_buffer(uring, iocb);
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	if (iocb_vectored(iocb))
+		sqe->opcode    = write ? IORING_OP_WRITEV : IORING_OP_READV;
+	else if (idx >= 0) {
+		sqe->opcode    = write ? IORING_OP_WRITE_FIXED :
+					 IORING_OP_READ_FIXED;
+		sqe->buf_index = idx;
+	} else
+		sqe->opcode    = write ? IORING_OP_WRITE : IORING_OP_READ;
+
+	sqe->fd        = iocb->aio_fildes;
+	sqe->off       = iocb->u.c.offset;
+	sqe->addr      = (uintptr_t)iocb->u.c.buf;
+	sqe->len       = iocb->u.c.nbytes;
+	sqe->user_data = (uintptr_t)iocb;
+}
+
+static int
+tapdisk_uring_submit(struct tqueue *queue)
+{
+	struct uring *uring = queue->tio_data;
+	int i, merged, submitted, ret, err = 0;
+	unsigned head, tail;
+
+	if (!queue->queued)
+		return 0;
+
+	tapdisk_filter_iocbs(queue->filter, queue->iocbs, queue->queued);
+	merged = io_merge(&queue->opioctx, queue->iocbs, queue->queued);
+
+	head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	tail = *uring->sq_tail;
+
+	for (i = 0; i < merged && tail - head < uring->sq_entries; i++) {
+		unsigned idx = tail & uring->sq_mask;
+
+		tapdisk_uring_prep_sqe(uring, &uring->sqes[idx],
+				       queue->iocbs[i]);
+		uring->sq_array[idx] = idx;
+		tail++;
+	}
+
+	__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	if (uring->flags & URING_FLAG_SQPOLL) {
+		submitted = i;
+		if (__atomic_load_n(uring->sq_flags, __ATOMIC_ACQUIRE) &
+		    IORING_SQ_NEED_WAKEUP)
+			tapdisk_sys_io_uring_enter(uring->ring_fd, 0, 0,
+						   IORING_ENTER_SQ_WAKEUP);
+	} else {
+		ret = tapdisk_sys_io_uring_enter(uring->ring_fd, i, 0, 0);
+		if (ret < 0) {
+			err = -errno;
+			ret = 0;
+		}
+		submitted = ret;
+
+		/* take back what the kernel did not consume */
+		if (submitted < i)
+			__atomic_store_n(uring->sq_tail, tail - (i - submitted),
+					 __ATOMIC_RELEASE);
+	}
+
+	DBG("queued: %d, merged: %d, submitted: %d\n",
+	    queue->queued, merged, submitted);
+
+	if (!err && submitted < merged)
+		err = -EIO;
+
+	queue->iocbs_pending  += submitted;
+	queue->tiocbs_pending += queue->queued;
+	queue->queued          = 0;
+
+	if (err)
+		queue->tiocbs_pending -=
+			fail_tiocbs(queue, submitted, merged, err);
+
+	return submitted;
+}
+
+/*
+ * The kernel takes the whole table at once, so any change re-registers
+ * every region.  Failing that, requests just use the plain ops.
+ */
+static int
+tapdisk_uring_update_buffers(struct uring *uring)
+{
+	int err;
+
+	if (uring->nr_registered) {
+		tapdisk_sys_io_uring_register(uring->ring_fd,
+					      IORING_UNREGISTER_BUFFERS,
+					      NULL, 0);
+		uring->nr_registered = 0;
+	}
+
+	if (!uring->nr_bufs)
+		return 0;
+
+	err = tapdisk_sys_io_uring_register(uring->ring_fd,
+					    IORING_REGISTER_BUFFERS,
+					    uring->bufs, uring->nr_bufs);
+	if (err < 0) {
+		err = -errno;
+		DPRINTF("io_uring: cannot register %d buffers: %d\n",
+			uring->nr_bufs, err);
+		return err;
+	}
+
+	uring->nr_registered = uring->nr_bufs;
+
+	return 0;
+}
+
+static int
+tapdisk_uring_register_buffer(struct tqueue *queue, void *buf, size_t size)
+{
+	struct uring *uring = queue->tio_data;
+
+	if (uring->nr_bufs == URING_MAX_BUFS)
+		return -ENOSPC;
+
+	uring->bufs[uring->nr_bufs].iov_base = buf;
+	uring->bufs[uring->nr_bufs].iov_len  = size;
+	uring->nr_bufs++;
+
+	return tapdisk_uring_update_buffers(uring);
+}
+
+static void
+tapdisk_uring_unregister_buffer(struct tqueue *queue, void *buf)
+{
+	struct uring *uring = queue->tio_data;
+	int i;
+
+	for (i = 0; i < uring->nr_bufs; i++)
+		if (uring->bufs[i].iov_base == buf)
+			break;
+
+	if (i == uring->nr_bufs)
+		return;
+
+	uring->bufs[i] = uring->bufs[--uring->nr_bufs];
+	tapdisk_uring_update_buffers(uring);
+}
+
+static const struct tio td_tio_uring = {
+	.name                  = "uring",
+	.data_size             = sizeof(struct uring),
+	.tio_setup             = tapdisk_uring_setup,
+	.tio_destroy           = tapdisk_uring_destroy,
+	.tio_submit            = tapdisk_uring_submit,
+	.tio_register_buffer   = tapdisk_uring_register_buffer,
+	.tio_unregister_buffer = tapdisk_uring_unregister_buffer,
+};
+
+static const struct tio td_tio_uring_sqpoll = {
+	.name                  = "uring-sqpoll",
+	.data_size             = sizeof(struct uring),
+	.tio_setup             = tapdisk_uring_setup_sqpoll,
+	.tio_destroy           = tapdisk_uring_destroy,
+	.tio_submit            = tapdisk_uring_submit,
+	.tio_register_buffer   = tapdisk_uring_register_buffer,
+	.tio_unregister_buffer = tapdisk_uring_unregister_buffer,
+};
+
+#endif /* HAVE_IO_URING */
+
 static void
 tapdisk_queue_free_io(struct tqueue *queue)
 {
@@ -575,6 +1075,14 @@ tapdisk_queue_init_io(struct tqueue *queue, int drv)
 	case TIO_DRV_RWIO:
 		tio = &td_tio_rwio;
 		break;
+#ifdef HAVE_IO_URING
+	case TIO_DRV_URING:
+		tio = &td_tio_uring;
+		break;
+	case TIO_DRV_URING_SQPOLL:
+		tio = &td_tio_uring_sqpoll;
+		break;
+#endif
 	default:
 		err = -EINVAL;
 		goto fail;
@@ -619,6 +1127,11 @@ tapdisk_init_queue(struct tqueue *queue, int size,
 		return 0;
 
 	err = tapdisk_queue_init_io(queue, drv);
+	if (err && (drv == TIO_DRV_URING || drv == TIO_DRV_URING_SQPOLL)) {
+		DPRINTF("io_uring not available (%d), falling back to lio\n",
+			err);
+		err = tapdisk_queue_init_io(queue, TIO_DRV_LIO);
+	}
 	if (err)
 		goto fail;
 
@@ -650,6 +1163,36 @@ tapdisk_free_queue(struct tqueue *queue)
 	opio_free(&queue->opioctx);
 }
 
+int
+tapdisk_queue_driver(const char *name)
+{
+	if (!strcmp(name, "lio"))
+		return TIO_DRV_LIO;
+	if (!strcmp(name, "rwio"))
+		return TIO_DRV_RWIO;
+	if (!strcmp(name, "uring"))
+		return TIO_DRV_URING;
+	if (!strcmp(name, "uring-sqpoll"))
+		return TIO_DRV_URING_SQPOLL;
+	return -EINVAL;
+}
+
+int
+tapdisk_queue_register_buffer(struct tqueue *queue, void *buf, size_t size)
+{
+	if (!queue->tio || !queue->tio->tio_register_buffer)
+		return -ENOSYS;
+
+	return queue->tio->tio_register_buffer(queue, buf, size);
+}
+
+void
+tapdisk_queue_unregister_buffer(struct tqueue *queue, void *buf)
+{
+	if (queue->tio && queue->tio->tio_unregister_buffer)
+		queue->tio->tio_unregister_buffer(queue, buf);
+}
+
 void 
 tapdisk_debug_queue(struct tqueue *queue)
 {
@@ -660,6 +1203,9 @@ tapdisk_debug_queue(struct tqueue *queue)
 	     "tiocbs_pending: %d, tiocbs_deferred: %d, deferrals: %"PRIx64"\n",
 	     queue->size, queue->tio->name, queue->queued, queue->iocbs_pending,
 	     queue->tiocbs_pending, queue->tiocbs_deferred, queue->deferrals);
+	WARN("merged %"PRIu64" iocbs into %"PRIu64", %"PRIu64" vectored\n",
+	     queue->opioctx.stats.iocbs, queue->opioctx.stats.submitted,
+	     queue->opioctx.stats.vectored);
 
 	if (tiocb) {
 		WARN("deferred:\n");
@@ -673,6 +1219,20 @@ tapdisk_debug_queue(struct tqueue *queue)
 	}
 }
 
+/* The merge ratio of the queue, for tapdisk-control. */
+int
+tapdisk_queue_stats(struct tqueue *queue, char *buf, size_t size)
+{
+	const struct opio_stats *st = &queue->opioctx.stats;
+
+	return snprintf(buf, size,
+			"tio=%s iocbs=%"PRIu64" submitted=%"PRIu64" "
+			"vectored=%"PRIu64" ratio=%.2f",
+			queue->tio->name, st->iocbs, st->submitted,
+			st->vectored, st->submitted ?
+			(double)st->iocbs / st->submitted : 0.0);
+}
+
 void
 tapdisk_prep_tiocb(struct tiocb *tiocb, int fd, int rw, char *buf, size_t size,
 		   long long offset, td_queue_callback_t cb, void *arg)
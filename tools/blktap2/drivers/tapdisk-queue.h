@@ -91,11 +91,18 @@ struct tio {
 	int  (*tio_setup)    (struct tqueue *queue, int qlen);
 	void (*tio_destroy)  (struct tqueue *queue);
 	int  (*tio_submit)   (struct tqueue *queue);
+
+	/* optional: let the driver pre-register a data buffer region */
+	int  (*tio_register_buffer)   (struct tqueue *queue,
+				       void *buf, size_t size);
+	void (*tio_unregister_buffer) (struct tqueue *queue, void *buf);
 };
 
 enum {
-	TIO_DRV_LIO     = 1,
-	TIO_DRV_RWIO    = 2,
+	TIO_DRV_LIO          = 1,
+	TIO_DRV_RWIO         = 2,
+	TIO_DRV_URING        = 3,
+	TIO_DRV_URING_SQPOLL = 4,
 };
 
 /*
@@ -113,7 +120,11 @@ enum {
 	(((q)->tiocbs_pending + (q)->queued) >= (q)->size)
 int tapdisk_init_queue(struct tqueue *, int size, int drv, struct tfilter *);
 void tapdisk_free_queue(struct tqueue *);
+int tapdisk_queue_driver(const char *name);
+int tapdisk_queue_register_buffer(struct tqueue *, void *buf, size_t size);
+void tapdisk_queue_unregister_buffer(struct tqueue *, void *buf);
 void tapdisk_debug_queue(struct tqueue *);
+int tapdisk_queue_stats(struct tqueue *, char *buf, size_t size);
 void tapdisk_queue_tiocb(struct tqueue *, struct tiocb *);
 int tapdisk_submit_tiocbs(struct tqueue *);
 int tapdisk_submit_all_tiocbs(struct tqueue *);
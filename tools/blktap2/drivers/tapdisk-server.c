@@ -101,6 +101,24 @@ tapdisk_server_queue_tiocb(struct tiocb *tiocb)
 	tapdisk_queue_tiocb(&server.aio_queue, tiocb);
 }
 
+int
+tapdisk_server_register_buffer(void *buf, size_t size)
+{
+	return tapdisk_queue_register_buffer(&server.aio_queue, buf, size);
+}
+
+void
+tapdisk_server_unregister_buffer(void *buf)
+{
+	tapdisk_queue_unregister_buffer(&server.aio_queue, buf);
+}
+
+int
+tapdisk_server_queue_stats(char *buf, size_t size)
+{
+	return tapdisk_queue_stats(&server.aio_queue, buf, size);
+}
+
 void
 tapdisk_server_debug(void)
 {
@@ -209,7 +227,7 @@ static int
 tapdisk_server_init_aio(void)
 {
 	return tapdisk_init_queue(&server.aio_queue, TAPDISK_TIOCBS,
-				  TIO_DRV_LIO, NULL);
+				  server.io_drv ? : TIO_DRV_LIO, NULL);
 }
 
 static void
@@ -288,6 +306,12 @@ tapdisk_server_init(void)
 	return 0;
 }
 
+void
+tapdisk_server_set_io_driver(int drv)
+{
+	server.io_drv = drv;
+}
+
 int
 tapdisk_server_complete(void)
 {
@@ -42,6 +42,9 @@ void tapdisk_server_add_vbd(td_vbd_t *);
 void tapdisk_server_remove_vbd(td_vbd_t *);
 
 void tapdisk_server_queue_tiocb(struct tiocb *);
+int tapdisk_server_register_buffer(void *, size_t);
+void tapdisk_server_unregister_buffer(void *);
+int tapdisk_server_queue_stats(char *, size_t);
 
 void tapdisk_server_check_state(void);
 
@@ -50,6 +53,7 @@ void tapdisk_server_unregister_event(event_id_t);
 void tapdisk_server_set_max_timeout(int);
 
 int tapdisk_server_init(void);
+void tapdisk_server_set_io_driver(int);
 int tapdisk_server_initialize(void);
 int tapdisk_server_complete(void);
 int tapdisk_server_run(void);
@@ -62,6 +66,7 @@ typedef struct tapdisk_server {
 	struct list_head             vbds;
 	scheduler_t                  scheduler;
 	struct tqueue                aio_queue;
+	int                          io_drv;
 } tapdisk_server_t;
 
 #endif
@@ -26,7 +26,9 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <errno.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -92,6 +94,69 @@ tapdisk_set_resource_limits(void)
 	return 0;
 }
 
+#ifdef __linux__
+
+/*
+ * Pin the process to @cpus, a list like "0-3,8".  Queue threads the
+ * kernel starts on our behalf (io_uring's SQPOLL thread) inherit it, so
+ * this keeps all of a tapdisk's work on the CPUs near the guest it serves.
+ */
+int
+tapdisk_set_cpu_affinity(const char *cpus)
+{
+	cpu_set_t set;
+	const char *p;
+	char *end;
+	unsigned long first, last;
+
+	CPU_ZERO(&set);
+
+	for (p = cpus; *p; p = end) {
+		first = strtoul(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first)
+				return -EINVAL;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -EINVAL;
+
+		for (; first <= last; first++)
+			CPU_SET(first, &set);
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -EINVAL;
+	}
+
+	if (!CPU_COUNT(&set))
+		return -EINVAL;
+
+	if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+		EPRINTF("sched_setaffinity(%s) failed: %d\n", cpus, errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+#else
+
+int
+tapdisk_set_cpu_affinity(const char *cpus)
+{
+	return -ENOSYS;
+}
+
+#endif
+
 int
 tapdisk_namedup(char **dup, const char *name)
 {
@@ -179,11 +179,135 @@ tapdisk_vbd_validate_chain(td_vbd_t *vbd)
 	return 0;
 }
 
+static void
+tapdisk_vbd_free_owners(td_vbd_t *vbd)
+{
+	free(vbd->owners);
+	vbd->owners = NULL;
+}
+
+static void
+tapdisk_vbd_flush_owners(td_vbd_t *vbd)
+{
+	if (vbd->owners)
+		memset(vbd->owners, 0,
+		       TD_VBD_OWNER_ENTRIES * sizeof(td_vbd_owner_t));
+}
+
+/*
+ * Only plain VHD chains get an owner cache: the block-vhd driver either
+ * serves a sector or forwards it, so where a read ended up is where the
+ * data lives.  Filters such as the block cache or dirty log must see
+ * every request.
+ */
+static void
+tapdisk_vbd_alloc_owners(td_vbd_t *vbd)
+{
+	int depth;
+	td_image_t *image, *tmp;
+
+	depth = 0;
+	tapdisk_vbd_for_each_image(vbd, image, tmp) {
+		if (image->type != DISK_TYPE_VHD)
+			return;
+		depth++;
+	}
+
+	if (depth < 2)
+		return;
+
+	vbd->owners = calloc(TD_VBD_OWNER_ENTRIES, sizeof(td_vbd_owner_t));
+	if (!vbd->owners)
+		DPRINTF("no owner cache for %s: %d\n", vbd->name, -ENOMEM);
+}
+
+static inline td_vbd_owner_t *
+tapdisk_vbd_owner(td_vbd_t *vbd, uint64_t chunk)
+{
+	return &vbd->owners[chunk & (TD_VBD_OWNER_ENTRIES - 1)];
+}
+
+/* The image holding all of @secs at @sec, if known. */
+static td_image_t *
+tapdisk_vbd_lookup_owner(td_vbd_t *vbd, td_sector_t sec, int secs)
+{
+	uint64_t chunk, last;
+	td_image_t *image;
+	td_vbd_owner_t *o;
+
+	if (!vbd->owners ||
+	    (sec | secs) & ((1 << TD_VBD_OWNER_SHIFT) - 1))
+		return NULL;
+
+	image = NULL;
+	chunk = sec >> TD_VBD_OWNER_SHIFT;
+	last  = (sec + secs) >> TD_VBD_OWNER_SHIFT;
+
+	for (; chunk < last; chunk++) {
+		o = tapdisk_vbd_owner(vbd, chunk);
+		if (o->chunk != chunk + 1)
+			return NULL;
+		if (image && o->image != image)
+			return NULL;
+		image = o->image;
+	}
+
+	if (image && sec + secs > image->info.size)
+		return NULL;
+
+	return image;
+}
+
+/* Remember that @image served the chunks wholly within a completed read. */
+static void
+tapdisk_vbd_record_owner(td_vbd_t *vbd, td_vbd_request_t *vreq,
+			 td_request_t treq)
+{
+	uint64_t chunk, last;
+	td_vbd_owner_t *o;
+
+	/* a write racing with the read may have changed the owner */
+	if (vbd->owner_writes || vreq->owner_gen != vbd->owner_gen)
+		return;
+
+	if (treq.image == tapdisk_vbd_first_image(vbd) ||
+	    treq.sec + treq.secs > treq.image->info.size)
+		return;
+
+	chunk = (treq.sec + (1 << TD_VBD_OWNER_SHIFT) - 1) >> TD_VBD_OWNER_SHIFT;
+	last  = (treq.sec + treq.secs) >> TD_VBD_OWNER_SHIFT;
+
+	for (; chunk < last; chunk++) {
+		o        = tapdisk_vbd_owner(vbd, chunk);
+		o->chunk = chunk + 1;
+		o->image = treq.image;
+	}
+}
+
+/* Writes go to the top image, which then owns everything they touch. */
+static void
+tapdisk_vbd_invalidate_owners(td_vbd_t *vbd, td_sector_t sec, int secs)
+{
+	uint64_t chunk, last;
+	td_vbd_owner_t *o;
+
+	chunk = sec >> TD_VBD_OWNER_SHIFT;
+	last  = (sec + secs - 1) >> TD_VBD_OWNER_SHIFT;
+
+	for (; chunk <= last; chunk++) {
+		o = tapdisk_vbd_owner(vbd, chunk);
+		if (o->chunk == chunk + 1)
+			o->chunk = 0;
+	}
+}
+
 void
 tapdisk_vbd_close_vdi(td_vbd_t *vbd)
 {
 	td_image_t *image, *tmp;
 
+	tapdisk_vbd_free_owners(vbd);
+
 	tapdisk_vbd_for_each_image(vbd, image, tmp) {
 		td_close(image);
 		tapdisk_image_free(image);
@@ -432,6 +556,8 @@ __tapdisk_vbd_open_vdi(td_vbd_t *vbd, td_flag_t extra_flags)
 	if (err)
 		goto fail;
 
+	tapdisk_vbd_alloc_owners(vbd);
+
 	td_flag_clear(vbd->state, TD_VBD_CLOSED);
 
 	return 0;
@@ -629,6 +755,14 @@ tapdisk_vbd_map_device(td_vbd_t *vbd, const char *devname)
 	ring->vstart =
 		(unsigned long)ring->mem + (BLKTAP_RING_PAGES * psize);
 
+	/* let the I/O driver pin the data pages once and for all */
+	err = tapdisk_server_register_buffer((void *)ring->vstart,
+					     psize * (BLKTAP_MMAP_REGION_SIZE -
+						      BLKTAP_RING_PAGES));
+	if (err && err != -ENOSYS)
+		DPRINTF("failed to register data pages of %s: %d\n",
+			devname, err);
+
 	ioctl(ring->fd, BLKTAP_IOCTL_SETMODE, BLKTAP_MODE_INTERPOSE);
 
 	return 0;
@@ -650,6 +784,8 @@ tapdisk_vbd_unmap_device(td_vbd_t *vbd)
 
 	psize = getpagesize();
 
+	if (vbd->ring.mem > 0)
+		tapdisk_server_unregister_buffer((void *)vbd->ring.vstart);
 	if (vbd->ring.fd != -1)
 		close(vbd->ring.fd);
 	if (vbd->ring.mem > 0)
@@ -934,6 +1070,7 @@ tapdisk_vbd_close_and_reopen_image(td_vbd_t *vbd, td_image_t *image)
 {
 	int i, err = 0;
 
+	tapdisk_vbd_flush_owners(vbd);
 	td_close(image);
 
 	for (i = 0; i < TD_VBD_EIO_RETRIES; i++) {
@@ -1202,6 +1339,14 @@ __tapdisk_vbd_complete_td_request(td_vbd_t *vbd, td_vbd_request_t *vreq,
 	vbd->secs_pending  -= treq.secs;
 	vreq->secs_pending -= treq.secs;
 
+	if (vbd->owners) {
+		if (treq.op == TD_OP_WRITE) {
+			vbd->owner_writes -= treq.secs;
+			vbd->owner_gen++;
+		} else if (!err)
+			tapdisk_vbd_record_owner(vbd, vreq, treq);
+	}
+
 	vreq->blocked = treq.blocked;
 
 	if (err) {
@@ -1357,7 +1502,7 @@ tapdisk_vbd_issue_request(td_vbd_t *vbd, td_vbd_request_t *vreq)
 {
 	char *page;
 	td_ring_t *ring;
-	td_image_t *image;
+	td_image_t *image, *owner;
 	td_request_t treq;
 	uint64_t sector_nr;
 	blkif_request_t *req;
@@ -1370,6 +1515,7 @@ tapdisk_vbd_issue_request(td_vbd_t *vbd, td_vbd_request_t *vreq)
 	image     = tapdisk_vbd_first_image(vbd);
 
 	vreq->submitting = 1;
+	vreq->owner_gen  = vbd->owner_gen;
 	gettimeofday(&vbd->ts, NULL);
 	gettimeofday(&vreq->last_try, NULL);
 	tapdisk_vbd_move_request(vreq, &vbd->pending_requests);
@@ -1411,12 +1557,24 @@ tapdisk_vbd_issue_request(td_vbd_t *vbd, td_vbd_request_t *vreq)
 		switch (req->operation)	{
 		case BLKIF_OP_WRITE:
 			treq.op = TD_OP_WRITE;
+			if (vbd->owners) {
+				tapdisk_vbd_invalidate_owners(vbd, treq.sec,
+							      treq.secs);
+				vbd->owner_writes += treq.secs;
+				vbd->owner_gen++;
+			}
 			td_queue_write(image, treq);
 			break;
 
 		case BLKIF_OP_READ:
 			treq.op = TD_OP_READ;
-			td_queue_read(image, treq);
+			owner   = tapdisk_vbd_lookup_owner(vbd, treq.sec,
+							   treq.secs);
+			if (owner) {
+				treq.image = owner;
+				td_queue_read(owner, treq);
+			} else
+				td_queue_read(image, treq);
 			break;
 		}
 
@@ -54,6 +54,7 @@ typedef struct td_ring              td_ring_t;
 typedef struct td_vbd_request       td_vbd_request_t;
 typedef struct td_vbd_driver_info   td_vbd_driver_info_t;
 typedef struct td_vbd_handle        td_vbd_t;
+typedef struct td_vbd_owner         td_vbd_owner_t;
 typedef void (*td_vbd_cb_t)        (void *, blkif_response_t *);
 
 struct td_ring {
@@ -74,11 +75,25 @@ struct td_vbd_request {
 	int                         secs_pending;
 	int                         num_retries;
 	struct timeval              last_try;
+	uint64_t                    owner_gen;
 
 	td_vbd_t                   *vbd;
 	struct list_head            next;
 };
 
+/*
+ * Cache of which image of a VHD chain holds a chunk of the disk, so that
+ * reads go straight to it instead of falling through every image above.
+ * Direct mapped; chunk is the chunk number plus one, 0 for empty.
+ */
+#define TD_VBD_OWNER_SHIFT          3           /* 4k chunks */
+#define TD_VBD_OWNER_ENTRIES        65536
+
+struct td_vbd_owner {
+	uint64_t                    chunk;
+	td_image_t                 *image;
+};
+
 struct td_vbd_driver_info {
 	char                       *params;
 	int                         type;
@@ -102,6 +117,10 @@ struct td_vbd_handle {
 
 	struct list_head            images;
 
+	td_vbd_owner_t             *owners;
+	uint64_t                    owner_gen;  /* bumped as writes come and go */
+	uint64_t                    owner_writes; /* write sectors in flight */
+
 	struct list_head            new_requests;
 	struct list_head            pending_requests;
 	struct list_head            failed_requests;
@@ -42,24 +42,35 @@
 static void
 usage(const char *app, int err)
 {
-	fprintf(stderr, "usage: %s [-D] <-u uuid> <-c control socket>\n", app);
+	fprintf(stderr, "usage: %s [-D] [-i lio|rwio|uring|uring-sqpoll] "
+		"[-a cpulist] <-u uuid> <-c control socket>\n", app);
 	exit(err);
 }
 
 int
 main(int argc, char *argv[])
 {
-	char *control;
-	int c, err, nodaemon;
+	char *control, *cpus;
+	int c, err, nodaemon, io_drv;
 
 	control  = NULL;
+	cpus     = NULL;
 	nodaemon = 0;
+	io_drv   = 0;
 
-	while ((c = getopt(argc, argv, "s:Dh")) != -1) {
+	while ((c = getopt(argc, argv, "s:i:a:Dh")) != -1) {
 		switch (c) {
 		case 'D':
 			nodaemon = 1;
 			break;
+		case 'i':
+			io_drv = tapdisk_queue_driver(optarg);
+			if (io_drv < 0)
+				usage(argv[0], EINVAL);
+			break;
+		case 'a':
+			cpus = optarg;
+			break;
 		case 'h':
 			usage(argv[0], 0);
 			break;
@@ -87,12 +98,22 @@ main(int argc, char *argv[])
 
 	tapdisk_start_logging("tapdisk2");
 
+	if (cpus) {
+		err = tapdisk_set_cpu_affinity(cpus);
+		if (err) {
+			DPRINTF("failed to set CPU affinity %s: %d\n", cpus, err);
+			goto out;
+		}
+	}
+
 	err = tapdisk_server_init();
 	if (err) {
 		DPRINTF("failed to initialize server: %d\n", err);
 		goto out;
 	}
 
+	tapdisk_server_set_io_driver(io_drv);
+
 	if (!nodaemon) {
 		err = daemon(0, 1);
 		if (err) {
@@ -126,6 +126,8 @@ enum tapdisk_message_id {
 	TAPDISK_MESSAGE_LIST_RSP,
 	TAPDISK_MESSAGE_FORCE_SHUTDOWN,
 	TAPDISK_MESSAGE_EXIT,
+	TAPDISK_MESSAGE_STATS,
+	TAPDISK_MESSAGE_STATS_RSP,
 };
 
 static inline char *
@@ -195,6 +197,12 @@ tapdisk_message_name(enum tapdisk_message_id id)
 	case TAPDISK_MESSAGE_EXIT:
 		return "exit";
 
+	case TAPDISK_MESSAGE_STATS:
+		return "stats";
+
+	case TAPDISK_MESSAGE_STATS_RSP:
+		return "stats response";
+
 	default:
 		return "unknown";
 	}
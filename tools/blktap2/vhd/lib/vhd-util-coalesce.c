@@ -28,39 +28,78 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "libvhd.h"
 
+/* blocks handed to a thread at a time, to keep its I/O sequential */
+#define COALESCE_CHUNK          32
+#define COALESCE_MAX_THREADS    64
+
+struct vhd_coalesce {
+	const char       *name;
+	vhd_context_t    *parent;        /* if the parent is VHD */
+	int               parent_fd;     /* if the parent is raw */
+	uint64_t          blocks;
+	int               progress;
+
+	pthread_mutex_t   lock;          /* protects the fields below */
+	uint64_t          next;          /* first block not handed out */
+	uint64_t          done;
+	uint64_t          bytes;
+	struct timeval    start;
+	struct timeval    report;
+	int               err;
+
+	/* libvhd contexts aren't thread safe, so writes to a VHD parent
+	 * are serialised. Raw parents are written with pwrite() in
+	 * parallel. */
+	pthread_mutex_t   parent_lock;
+};
+
 static int
 __raw_io_write(int fd, char* buf, uint64_t sec, uint32_t secs)
 {
-	off_t off;
-	size_t ret;
+	ssize_t ret;
 
 	errno = 0;
-	off = lseek(fd, vhd_sectors_to_bytes(sec), SEEK_SET);
-	if (off == (off_t)-1) {
-		printf("raw parent: seek(0x%08"PRIx64") failed: %d\n",
-		       vhd_sectors_to_bytes(sec), -errno);
-		return -errno;
-	}
-
-	ret = write(fd, buf, vhd_sectors_to_bytes(secs));
+	ret = pwrite(fd, buf, vhd_sectors_to_bytes(secs),
+		     vhd_sectors_to_bytes(sec));
 	if (ret == vhd_sectors_to_bytes(secs))
 		return 0;
 
-	printf("raw parent: write of 0x%"PRIx64" returned %zd, errno: %d\n",
-	       vhd_sectors_to_bytes(secs), ret, -errno);
+	printf("raw parent: write of 0x%"PRIx64" at 0x%08"PRIx64" returned "
+	       "%zd, errno: %d\n", vhd_sectors_to_bytes(secs),
+	       vhd_sectors_to_bytes(sec), ret, -errno);
 	return (errno ? -errno : -EIO);
 }
 
+static int
+vhd_util_coalesce_write(struct vhd_coalesce *co,
+			char *buf, uint64_t sec, uint32_t secs)
+{
+	int err;
+
+	if (!co->parent)
+		return __raw_io_write(co->parent_fd, buf, sec, secs);
+
+	pthread_mutex_lock(&co->parent_lock);
+	err = vhd_io_write(co->parent, buf, sec, secs);
+	pthread_mutex_unlock(&co->parent_lock);
+
+	return err;
+}
+
 /*
- * Use 'parent' if the parent is VHD, and 'parent_fd' if the parent is raw
+ * Copy the sectors present in one block of 'vhd' to its parent. Only the
+ * block itself is read, not the rest of the chain.
  */
 static int
-vhd_util_coalesce_block(vhd_context_t *vhd, vhd_context_t *parent,
-		int parent_fd, uint64_t block)
+vhd_util_coalesce_block(struct vhd_coalesce *co, vhd_context_t *vhd,
+			uint64_t block, uint64_t *bytes)
 {
 	int i, err;
 	char *buf, *map;
@@ -73,19 +112,14 @@ vhd_util_coalesce_block(vhd_context_t *vhd, vhd_context_t *parent,
 	if (vhd->bat.bat[block] == DD_BLK_UNUSED)
 		return 0;
 
-	err = posix_memalign((void **)&buf, 4096, vhd->header.block_size);
-	if (err)
-		return -err;
-
-	err = vhd_io_read(vhd, buf, sec, vhd->spb);
+	err = vhd_read_block(vhd, block, &buf);
 	if (err)
 		goto done;
 
 	if (vhd_has_batmap(vhd) && vhd_batmap_test(vhd, &vhd->batmap, block)) {
-		if (parent->file)
-			err = vhd_io_write(parent, buf, sec, vhd->spb);
-		else
-			err = __raw_io_write(parent_fd, buf, sec, vhd->spb);
+		err = vhd_util_coalesce_write(co, buf, sec, vhd->spb);
+		if (!err)
+			*bytes += vhd_sectors_to_bytes(vhd->spb);
 		goto done;
 	}
 
@@ -101,17 +135,13 @@ vhd_util_coalesce_block(vhd_context_t *vhd, vhd_context_t *parent,
 			if (!vhd_bitmap_test(vhd, map, i + secs))
 				break;
 
-		if (parent->file)
-			err = vhd_io_write(parent,
-					   buf + vhd_sectors_to_bytes(i),
-					   sec + i, secs);
-		else
-			err = __raw_io_write(parent_fd,
-					     buf + vhd_sectors_to_bytes(i),
-					     sec + i, secs);
+		err = vhd_util_coalesce_write(co,
+					      buf + vhd_sectors_to_bytes(i),
+					      sec + i, secs);
 		if (err)
 			goto done;
 
+		*bytes += vhd_sectors_to_bytes(secs);
 		i += secs;
 	}
 
@@ -123,35 +153,140 @@ done:
 	return err;
 }
 
+static double
+timeval_since(const struct timeval *then, const struct timeval *now)
+{
+	return (now->tv_sec - then->tv_sec) +
+		(now->tv_usec - then->tv_usec) / 1000000.0;
+}
+
+/* account for finished blocks, and report progress about once a second */
+static void
+vhd_util_coalesce_account(struct vhd_coalesce *co,
+			  uint64_t blocks, uint64_t bytes, int final)
+{
+	struct timeval now;
+	double secs;
+
+	pthread_mutex_lock(&co->lock);
+
+	co->done  += blocks;
+	co->bytes += bytes;
+
+	if (co->progress) {
+		gettimeofday(&now, NULL);
+		if (final || timeval_since(&co->report, &now) >= 1) {
+			secs = timeval_since(&co->start, &now);
+			printf("%"PRIu64"/%"PRIu64" blocks, %"PRIu64" MB "
+			       "coalesced, %.1f MB/s\n", co->done, co->blocks,
+			       co->bytes >> 20,
+			       secs > 0 ? (co->bytes >> 20) / secs : 0);
+			fflush(stdout);
+			co->report = now;
+		}
+	}
+
+	pthread_mutex_unlock(&co->lock);
+}
+
+static void *
+vhd_util_coalesce_thread(void *arg)
+{
+	struct vhd_coalesce *co = arg;
+	vhd_context_t vhd;
+	uint64_t i, first, last, bytes;
+	int err;
+
+	/* each thread reads the child through its own context */
+	err = vhd_open(&vhd, co->name, VHD_OPEN_RDONLY);
+	if (err) {
+		printf("error opening %s: %d\n", co->name, err);
+		goto out;
+	}
+
+	err = vhd_get_bat(&vhd);
+	if (err)
+		goto close;
+
+	if (vhd_has_batmap(&vhd)) {
+		err = vhd_get_batmap(&vhd);
+		if (err)
+			goto close;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&co->lock);
+		first    = co->err ? co->blocks : co->next;
+		last     = MIN(first + COALESCE_CHUNK, co->blocks);
+		co->next = last;
+		pthread_mutex_unlock(&co->lock);
+
+		if (first >= last)
+			break;
+
+		for (bytes = 0, i = first; i < last; i++) {
+			err = vhd_util_coalesce_block(co, &vhd, i, &bytes);
+			if (err) {
+				printf("error coalescing block %"PRIu64
+				       ": %d\n", i, err);
+				goto close;
+			}
+		}
+
+		vhd_util_coalesce_account(co, last - first, bytes, 0);
+	}
+
+close:
+	vhd_close(&vhd);
+out:
+	if (err) {
+		pthread_mutex_lock(&co->lock);
+		if (!co->err)
+			co->err = err;
+		pthread_mutex_unlock(&co->lock);
+	}
+	return NULL;
+}
+
 int
 vhd_util_coalesce(int argc, char **argv)
 {
-	int err, c;
-	uint64_t i;
+	int err, c, i, threads;
 	char *name, *pname;
 	vhd_context_t vhd, parent;
+	struct vhd_coalesce co;
+	pthread_t tids[COALESCE_MAX_THREADS];
 	int parent_fd = -1;
 
-	name  = NULL;
-	pname = NULL;
+	name    = NULL;
+	pname   = NULL;
+	threads = 1;
 	parent.file = NULL;
+	memset(&co, 0, sizeof(co));
 
 	if (!argc || !argv)
 		goto usage;
 
 	optind = 0;
-	while ((c = getopt(argc, argv, "n:h")) != -1) {
+	while ((c = getopt(argc, argv, "n:t:ph")) != -1) {
 		switch (c) {
 		case 'n':
 			name = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'p':
+			co.progress = 1;
+			break;
 		case 'h':
 		default:
 			goto usage;
 		}
 	}
 
-	if (!name || optind != argc)
+	if (!name || optind != argc ||
+	    threads < 1 || threads > COALESCE_MAX_THREADS)
 		goto usage;
 
 	err = vhd_open(&vhd, name, VHD_OPEN_RDONLY);
@@ -189,19 +324,38 @@ vhd_util_coalesce(int argc, char **argv)
 	if (err)
 		goto done;
 
-	if (vhd_has_batmap(&vhd)) {
-		err = vhd_get_batmap(&vhd);
-		if (err)
-			goto done;
+	co.name      = name;
+	co.parent    = parent.file ? &parent : NULL;
+	co.parent_fd = parent_fd;
+	co.blocks    = vhd.bat.entries;
+	pthread_mutex_init(&co.lock, NULL);
+	pthread_mutex_init(&co.parent_lock, NULL);
+	gettimeofday(&co.start, NULL);
+	co.report = co.start;
+
+	for (i = 1; i < threads; i++) {
+		err = pthread_create(&tids[i], NULL,
+				     vhd_util_coalesce_thread, &co);
+		if (err) {
+			printf("error creating thread: %d, continuing with "
+			       "%d\n", err, i);
+			err = 0;
+			break;
+		}
 	}
 
-	for (i = 0; i < vhd.bat.entries; i++) {
-		err = vhd_util_coalesce_block(&vhd, &parent, parent_fd, i);
-		if (err)
-			goto done;
-	}
+	vhd_util_coalesce_thread(&co);
 
-	err = 0;
+	while (--i > 0)
+		pthread_join(tids[i], NULL);
+
+	if (!err)
+		err = co.err;
+	if (!err)
+		vhd_util_coalesce_account(&co, 0, 0, 1);
+
+	pthread_mutex_destroy(&co.parent_lock);
+	pthread_mutex_destroy(&co.lock);
 
  done:
 	free(pname);
@@ -213,6 +367,6 @@ vhd_util_coalesce(int argc, char **argv)
 	return err;
 
 usage:
-	printf("options: <-n name> [-h help]\n");
+	printf("options: <-n name> [-t threads] [-p progress] [-h help]\n");
 	return -EINVAL;
 }
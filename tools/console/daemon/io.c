@@ -31,6 +31,10 @@
 #include <errno.h>
 #include <string.h>
 #include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
 #include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
@@ -61,6 +65,17 @@
 /* Duration of each time period in ms */
 #define RATE_LIMIT_PERIOD 200
 
+/* Log output is flushed once this much is buffered... */
+#define LOG_FLUSH_BYTES (16 * 1024)
+/* ...or this many ms after it was produced */
+#define LOG_FLUSH_DELAY 100
+
+/* Most bytes written to a pty per wakeup, so no domain hogs the loop */
+#define MAX_TTY_WRITE (16 * 1024)
+
+/* Most events handled per wakeup; the rest are seen on the next one */
+#define MAX_EVENTS 128
+
 extern int log_reload;
 extern int log_guest;
 extern int log_hv;
@@ -69,15 +84,44 @@ extern int log_time_guest;
 extern char *log_dir;
 extern int discard_overflowed_data;
 
-static int log_time_hv_needts = 1;
-static int log_time_guest_needts = 1;
-static int log_hv_fd = -1;
+struct logfile {
+	int fd;
+	char *path;
+	/* Output is buffered until the deadline, when there is any */
+	char *data;
+	size_t size;
+	size_t capacity;
+	long long deadline;
+	/* Next output starts a line, so needs a timestamp */
+	bool needts;
+	bool timestamps;
+};
+
+static struct logfile log_hv_file = { .fd = -1 };
 
 static xengnttab_handle *xgt_handle = NULL;
 
+/* An fd to wait on, and what for */
+struct io_fd {
+	int fd;
+	short events;
+	short revents;
+#ifdef USE_EPOLL
+	/* What the epoll set has for $fd */
+	int registered_fd;
+	short registered;
+#else
+	int pollfd_idx;
+#endif
+};
+
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+#else
 static struct pollfd  *fds;
 static unsigned int current_array_size;
 static unsigned int nr_fds;
+#endif
 
 #define ROUNDUP(_x,_w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
 
@@ -92,9 +136,9 @@ struct buffer {
 struct domain {
 	int domid;
 	int master_fd;
-	int master_pollfd_idx;
+	struct io_fd master_io;
 	int slave_fd;
-	int log_fd;
+	struct logfile log;
 	bool is_dead;
 	unsigned last_seen;
 	struct buffer buffer;
@@ -104,7 +148,7 @@ struct domain {
 	xenevtchn_port_or_error_t local_port;
 	xenevtchn_port_or_error_t remote_port;
 	xenevtchn_handle *xce_handle;
-	int xce_pollfd_idx;
+	struct io_fd xce_io;
 	struct xencons_interface *interface;
 	int event_count;
 	long long next_period;
@@ -112,6 +156,150 @@ struct domain {
 
 static struct domain *dom_head;
 
+#ifndef USE_EPOLL
+/* Returns index inside fds array if succees, -1 if fail */
+static int set_fds(int fd, short events)
+{
+	int ret;
+	if (current_array_size < nr_fds + 1) {
+		struct pollfd  *new_fds = NULL;
+		unsigned long newsize;
+
+		/* Round up to 2^8 boundary, in practice this just
+		 * make newsize larger than current_array_size.
+		 */
+		newsize = ROUNDUP(nr_fds + 1, 8);
+
+		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
+		if (!new_fds)
+			goto fail;
+		fds = new_fds;
+
+		memset(&fds[0] + current_array_size, 0,
+		       sizeof(struct pollfd) * (newsize-current_array_size));
+		current_array_size = newsize;
+	}
+
+	fds[nr_fds].fd = fd;
+	fds[nr_fds].events = events;
+	ret = nr_fds;
+	nr_fds++;
+
+	return ret;
+fail:
+	dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
+	return -1;
+}
+
+static void reset_fds(void)
+{
+	nr_fds = 0;
+	if (fds)
+		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
+}
+#endif
+
+static void io_fd_init(struct io_fd *f)
+{
+	f->fd = -1;
+	f->events = f->revents = 0;
+#ifdef USE_EPOLL
+	f->registered_fd = -1;
+	f->registered = 0;
+#else
+	f->pollfd_idx = -1;
+#endif
+}
+
+/* Stop waiting on the fd of $f, which must be done before closing it. */
+static void io_fd_release(struct io_fd *f)
+{
+#ifdef USE_EPOLL
+	if (f->registered)
+		(void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, f->registered_fd, NULL);
+#endif
+	io_fd_init(f);
+}
+
+/*
+ * Wait on $fd for $events (none: don't) in the next io_wait().  The epoll
+ * set is only updated when this changes from one call to the next.
+ */
+static void io_fd_set(struct io_fd *f, int fd, short events)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+	int op;
+
+	if (f->registered && f->registered_fd != fd)
+		io_fd_release(f);
+	f->fd = fd;
+	f->events = events;
+	f->revents = 0;
+	if (events == f->registered)
+		return;
+
+	/* The EPOLL* flags have the values of their POLL* counterparts. */
+	ev.events = events;
+	ev.data.ptr = f;
+	op = !events ? EPOLL_CTL_DEL :
+	     f->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(epoll_fd, op, fd, &ev) == -1 && op != EPOLL_CTL_DEL) {
+		dolog(LOG_ERR, "epoll_ctl failed, ignoring fd %d: %d (%s)",
+		      fd, errno, strerror(errno));
+		events = 0;
+	}
+	f->registered = events;
+	f->registered_fd = events ? fd : -1;
+#else
+	f->fd = fd;
+	f->events = events;
+	f->pollfd_idx = events ? set_fds(fd, events) : -1;
+#endif
+}
+
+/* What was seen on the fd of $f by the last io_wait(). */
+static short io_fd_revents(struct io_fd *f)
+{
+#ifdef USE_EPOLL
+	return f->revents;
+#else
+	return f->pollfd_idx != -1 ? fds[f->pollfd_idx].revents : 0;
+#endif
+}
+
+/* Before any io_fd_set() for the next io_wait() */
+static void io_reset(void)
+{
+#ifndef USE_EPOLL
+	reset_fds();
+#endif
+}
+
+/* Like poll(2), on everything io_fd_set() since the last io_reset(). */
+static int io_wait(int timeout)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev[MAX_EVENTS];
+	int i, ret;
+
+	ret = epoll_wait(epoll_fd, ev, MAX_EVENTS, timeout);
+	for (i = 0; i < ret; i++)
+		((struct io_fd *)ev[i].data.ptr)->revents = ev[i].events;
+	return ret;
+#else
+	return poll(fds, nr_fds, timeout);
+#endif
+}
+
+static void domain_close_evtchn(struct domain *dom)
+{
+	io_fd_release(&dom->xce_io);
+	if (dom->xce_handle != NULL)
+		xenevtchn_close(dom->xce_handle);
+	dom->xce_handle = NULL;
+}
+
 static int write_all(int fd, const char* buf, size_t len)
 {
 	while (len) {
@@ -127,26 +315,81 @@ static int write_all(int fd, const char* buf, size_t len)
 	return 0;
 }
 
-static int write_with_timestamp(int fd, const char *data, size_t sz,
-				int *needts)
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return -1;
+	return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* Write out what is buffered for $log, returning -1 on error. */
+static int log_flush(struct logfile *log)
+{
+	int ret = 0;
+
+	if (log->size && log->fd != -1) {
+		ret = write_all(log->fd, log->data, log->size);
+		if (ret < 0)
+			dolog(LOG_ERR, "Write to log %s failed: %d (%s)",
+			      log->path, errno, strerror(errno));
+	}
+	log->size = 0;
+	log->deadline = 0;
+
+	return ret;
+}
+
+static void log_copy(struct logfile *log, const char *data, size_t sz)
+{
+	if (log->capacity - log->size < sz) {
+		log->capacity = MAX(log->size + sz, 2 * log->capacity);
+		log->data = realloc(log->data, log->capacity);
+		if (log->data == NULL) {
+			dolog(LOG_ERR, "Memory allocation failed");
+			exit(ENOMEM);
+		}
+	}
+	memcpy(log->data + log->size, data, sz);
+	log->size += sz;
+}
+
+/*
+ * Buffer $sz bytes of output for $log, timestamping each line if asked,
+ * and write it out once there's enough.
+ */
+static void log_append(struct logfile *log, const char *data, size_t sz)
 {
 	char ts[32];
-	time_t now = time(NULL);
-	const struct tm *tmnow = localtime(&now);
-	size_t tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ", tmnow);
+	time_t now;
+	const struct tm *tmnow;
+	size_t tslen;
 	const char *last_byte = data + sz - 1;
 
+	if (log->fd == -1 || sz == 0)
+		return;
+
+	if (!log->timestamps) {
+		log_copy(log, data, sz);
+		goto out;
+	}
+
+	now = time(NULL);
+	tmnow = localtime(&now);
+	tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ", tmnow);
+
 	while (data <= last_byte) {
 		const char *nl = memchr(data, '\n', last_byte + 1 - data);
 		int found_nl = (nl != NULL);
 		if (!found_nl)
 			nl = last_byte;
 
-		if ((*needts && write_all(fd, ts, tslen))
-		    || write_all(fd, data, nl + 1 - data))
-			return -1;
+		if (log->needts)
+			log_copy(log, ts, tslen);
+		log_copy(log, data, nl + 1 - data);
 
-		*needts = found_nl;
+		log->needts = found_nl;
 		data = nl + 1;
 		if (found_nl) {
 			// If we printed a newline, strip all \r following it
@@ -155,6 +398,47 @@ static int write_with_timestamp(int fd, const char *data, size_t sz,
 		}
 	}
 
+ out:
+	if (log->size >= LOG_FLUSH_BYTES)
+		log_flush(log);
+	else if (!log->deadline)
+		log->deadline = now_ms() + LOG_FLUSH_DELAY;
+}
+
+static void log_close(struct logfile *log)
+{
+	log_flush(log);
+	if (log->fd != -1)
+		close(log->fd);
+	log->fd = -1;
+	free(log->path);
+	log->path = NULL;
+	free(log->data);
+	log->data = NULL;
+	log->capacity = 0;
+}
+
+/* Returns 0 on success, else -1 with $log closed. */
+static int log_open(struct logfile *log, const char *path, bool timestamps)
+{
+	log_close(log);
+
+	log->fd = open(path, O_WRONLY|O_CREAT|O_APPEND, 0644);
+	if (log->fd == -1) {
+		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
+		      path, errno, strerror(errno));
+		return -1;
+	}
+	log->path = strdup(path);
+	log->timestamps = timestamps;
+	log->needts = true;
+	if (timestamps) {
+		log_append(log, "Logfile Opened\n", strlen("Logfile Opened\n"));
+		if (log_flush(log) < 0) {
+			log_close(log);
+			return -1;
+		}
+	}
 	return 0;
 }
 
@@ -193,24 +477,7 @@ static void buffer_append(struct domain *dom)
 	 * no one is listening on the console pty then it will fill up
 	 * and handle_tty_write will stop being called.
 	 */
-	if (dom->log_fd != -1) {
-		int logret;
-		if (log_time_guest) {
-			logret = write_with_timestamp(
-				dom->log_fd,
-				buffer->data + buffer->size - size,
-				size, &log_time_guest_needts);
-		} else {
-			logret = write_all(
-				dom->log_fd,
-				buffer->data + buffer->size - size,
-				size);
-		}
-		if (logret < 0)
-			dolog(LOG_ERR, "Write to log failed "
-			      "on domain %d: %d (%s)\n",
-			      dom->domid, errno, strerror(errno));
-	}
+	log_append(&dom->log, buffer->data + buffer->size - size, size);
 
 	if (discard_overflowed_data && buffer->max_capacity &&
 	    buffer->size > 5 * buffer->max_capacity / 4) {
@@ -268,33 +535,16 @@ static bool domain_is_valid(int domid)
 static int create_hv_log(void)
 {
 	char logfile[PATH_MAX];
-	int fd;
 	snprintf(logfile, PATH_MAX-1, "%s/hypervisor.log", log_dir);
 	logfile[PATH_MAX-1] = '\0';
 
-	fd = open(logfile, O_WRONLY|O_CREAT|O_APPEND, 0644);
-	if (fd == -1)
-		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
-		      logfile, errno, strerror(errno));
-	if (fd != -1 && log_time_hv) {
-		if (write_with_timestamp(fd, "Logfile Opened\n",
-					 strlen("Logfile Opened\n"),
-					 &log_time_hv_needts) < 0) {
-			dolog(LOG_ERR, "Failed to log opening timestamp "
-				       "in %s: %d (%s)", logfile, errno,
-				       strerror(errno));
-			close(fd);
-			return -1;
-		}
-	}
-	return fd;
+	return log_open(&log_hv_file, logfile, log_time_hv);
 }
 
 static int create_domain_log(struct domain *dom)
 {
 	char logfile[PATH_MAX];
 	char *namepath, *data, *s;
-	int fd;
 	unsigned int len;
 
 	namepath = xs_get_domain_path(xs, dom->domid);
@@ -318,27 +568,13 @@ static int create_domain_log(struct domain *dom)
 	free(data);
 	logfile[PATH_MAX-1] = '\0';
 
-	fd = open(logfile, O_WRONLY|O_CREAT|O_APPEND, 0644);
-	if (fd == -1)
-		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
-		      logfile, errno, strerror(errno));
-	if (fd != -1 && log_time_guest) {
-		if (write_with_timestamp(fd, "Logfile Opened\n",
-					 strlen("Logfile Opened\n"),
-					 &log_time_guest_needts) < 0) {
-			dolog(LOG_ERR, "Failed to log opening timestamp "
-				       "in %s: %d (%s)", logfile, errno,
-				       strerror(errno));
-			close(fd);
-			return -1;
-		}
-	}
-	return fd;
+	return log_open(&dom->log, logfile, log_time_guest);
 }
 
 static void domain_close_tty(struct domain *dom)
 {
 	if (dom->master_fd != -1) {
+		io_fd_release(&dom->master_io);
 		close(dom->master_fd);
 		dom->master_fd = -1;
 	}
@@ -585,8 +821,7 @@ static int domain_create_ring(struct domain *dom)
 
 	dom->local_port = -1;
 	dom->remote_port = -1;
-	if (dom->xce_handle != NULL)
-		xenevtchn_close(dom->xce_handle);
+	domain_close_evtchn(dom);
 
 	/* Opening evtchn independently for each console is a bit
 	 * wasteful, but that's how the code is structured... */
@@ -601,8 +836,7 @@ static int domain_create_ring(struct domain *dom)
 
 	if (rc == -1) {
 		err = errno;
-		xenevtchn_close(dom->xce_handle);
-		dom->xce_handle = NULL;
+		domain_close_evtchn(dom);
 		goto out;
 	}
 	dom->local_port = rc;
@@ -611,16 +845,15 @@ static int domain_create_ring(struct domain *dom)
 	if (dom->master_fd == -1) {
 		if (!domain_create_tty(dom)) {
 			err = errno;
-			xenevtchn_close(dom->xce_handle);
-			dom->xce_handle = NULL;
+			domain_close_evtchn(dom);
 			dom->local_port = -1;
 			dom->remote_port = -1;
 			goto out;
 		}
 	}
 
-	if (log_guest && (dom->log_fd == -1))
-		dom->log_fd = create_domain_log(dom);
+	if (log_guest && (dom->log.fd == -1))
+		create_domain_log(dom);
 
  out:
 	return err;
@@ -676,10 +909,10 @@ static struct domain *create_domain(int domid)
 	strcat(dom->conspath, "/console");
 
 	dom->master_fd = -1;
-	dom->master_pollfd_idx = -1;
+	io_fd_init(&dom->master_io);
 	dom->slave_fd = -1;
-	dom->log_fd = -1;
-	dom->xce_pollfd_idx = -1;
+	dom->log.fd = -1;
+	io_fd_init(&dom->xce_io);
 
 	dom->next_period = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + RATE_LIMIT_PERIOD;
 
@@ -731,10 +964,7 @@ static void cleanup_domain(struct domain *d)
 {
 	domain_close_tty(d);
 
-	if (d->log_fd != -1) {
-		close(d->log_fd);
-		d->log_fd = -1;
-	}
+	log_close(&d->log);
 
 	free(d->buffer.data);
 	d->buffer.data = NULL;
@@ -750,9 +980,7 @@ static void shutdown_domain(struct domain *d)
 	d->is_dead = true;
 	watch_domain(d, false);
 	domain_unmap_interface(d);
-	if (d->xce_handle != NULL)
-		xenevtchn_close(d->xce_handle);
-	d->xce_handle = NULL;
+	domain_close_evtchn(d);
 }
 
 static unsigned enum_pass = 0;
@@ -856,7 +1084,8 @@ static void handle_tty_write(struct domain *dom)
 		return;
 
 	len = write(dom->master_fd, dom->buffer.data + dom->buffer.consumed,
-		    dom->buffer.size - dom->buffer.consumed);
+		    MIN(dom->buffer.size - dom->buffer.consumed,
+			MAX_TTY_WRITE));
  	if (len < 1) {
 		dolog(LOG_DEBUG, "Write failed on domain %d: %zd, %d\n",
 		      dom->domid, len, errno);
@@ -921,22 +1150,12 @@ static void handle_hv_logs(xenevtchn_handle *xce_handle, bool force)
 
 	do
 	{
-		int logret;
-
 		size = sizeof(buffer);
 		if (xc_readconsolering(xc, bufptr, &size, 0, 1, &index) != 0 ||
 		    size == 0)
 			break;
 
-		if (log_time_hv)
-			logret = write_with_timestamp(log_hv_fd, buffer, size,
-						      &log_time_hv_needts);
-		else
-			logret = write_all(log_hv_fd, buffer, size);
-
-		if (logret < 0)
-			dolog(LOG_ERR, "Failed to write hypervisor log: "
-				       "%d (%s)", errno, strerror(errno));
+		log_append(&log_hv_file, buffer, size);
 	} while (size == sizeof(buffer));
 
 	if (port != -1)
@@ -947,68 +1166,41 @@ static void handle_log_reload(void)
 {
 	if (log_guest) {
 		struct domain *d;
-		for (d = dom_head; d; d = d->next) {
-			if (d->log_fd != -1)
-				close(d->log_fd);
-			d->log_fd = create_domain_log(d);
-		}
+		for (d = dom_head; d; d = d->next)
+			create_domain_log(d);
 	}
 
 	if (log_hv) {
-		if (log_hv_fd != -1)
-			close(log_hv_fd);
-		log_hv_fd = create_hv_log();
+		create_hv_log();
 	}
 }
 
-/* Returns index inside fds array if succees, -1 if fail */
-static int set_fds(int fd, short events)
+/* Make *$next_timeout the earlier of itself (0: none) and $when. */
+static void set_timeout(long long *next_timeout, long long when)
 {
-	int ret;
-	if (current_array_size < nr_fds + 1) {
-		struct pollfd  *new_fds = NULL;
-		unsigned long newsize;
-
-		/* Round up to 2^8 boundary, in practice this just
-		 * make newsize larger than current_array_size.
-		 */
-		newsize = ROUNDUP(nr_fds + 1, 8);
-
-		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
-		if (!new_fds)
-			goto fail;
-		fds = new_fds;
-
-		memset(&fds[0] + current_array_size, 0,
-		       sizeof(struct pollfd) * (newsize-current_array_size));
-		current_array_size = newsize;
-	}
-
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
-
-	return ret;
-fail:
-	dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
-	return -1;
-}
-
-static void reset_fds(void)
-{
-	nr_fds = 0;
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
+	if (!*next_timeout || when < *next_timeout)
+		*next_timeout = when;
 }
 
 void handle_io(void)
 {
 	int ret;
 	xenevtchn_port_or_error_t log_hv_evtchn = -1;
-	int xce_pollfd_idx = -1;
-	int xs_pollfd_idx = -1;
+	struct io_fd xce_io, xs_io;
 	xenevtchn_handle *xce_handle = NULL;
+	struct domain *d;
+
+	io_fd_init(&xce_io);
+	io_fd_init(&xs_io);
+
+#ifdef USE_EPOLL
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		dolog(LOG_ERR, "Failed to create epoll set: %d (%s)",
+		      errno, strerror(errno));
+		return;
+	}
+#endif
 
 	if (log_hv) {
 		xce_handle = xenevtchn_open(NULL, 0);
@@ -1017,8 +1209,7 @@ void handle_io(void)
 			      errno, strerror(errno));
 			goto out;
 		}
-		log_hv_fd = create_hv_log();
-		if (log_hv_fd == -1)
+		if (create_hv_log())
 			goto out;
 		log_hv_evtchn = xenevtchn_bind_virq(xce_handle, VIRQ_CON_RING);
 		if (log_hv_evtchn == -1) {
@@ -1039,22 +1230,29 @@ void handle_io(void)
 	enum_domains();
 
 	for (;;) {
-		struct domain *d, *n;
+		struct domain *n;
 		int poll_timeout; /* timeout in milliseconds */
-		struct timespec ts;
 		long long now, next_timeout = 0;
+		short revents;
 
-		reset_fds();
+		io_reset();
 
-		xs_pollfd_idx = set_fds(xs_fileno(xs), POLLIN|POLLPRI);
+		io_fd_set(&xs_io, xs_fileno(xs), POLLIN|POLLPRI);
 
 		if (log_hv)
-			xce_pollfd_idx = set_fds(xenevtchn_fd(xce_handle),
-						 POLLIN|POLLPRI);
+			io_fd_set(&xce_io, xenevtchn_fd(xce_handle),
+				  POLLIN|POLLPRI);
 
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		now = now_ms();
+		if (now < 0)
 			break;
-		now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+
+		if (log_hv_file.deadline) {
+			if (log_hv_file.deadline <= now)
+				log_flush(&log_hv_file);
+			else
+				set_timeout(&next_timeout, log_hv_file.deadline);
+		}
 
 		/* Re-calculate any event counter allowances & unblock
 		   domains with new allowance */
@@ -1075,23 +1273,30 @@ void handle_io(void)
 		}
 
 		for (d = dom_head; d; d = d->next) {
+			short events = 0;
+
+			if (d->log.deadline) {
+				if (d->log.deadline <= now)
+					log_flush(&d->log);
+				else
+					set_timeout(&next_timeout,
+						    d->log.deadline);
+			}
+
 			if (d->event_count >= RATE_LIMIT_ALLOWANCE) {
 				/* Determine if we're going to be the next time slice to expire */
-				if (!next_timeout ||
-				    d->next_period < next_timeout)
-					next_timeout = d->next_period;
+				set_timeout(&next_timeout, d->next_period);
 			} else if (d->xce_handle != NULL) {
 				if (discard_overflowed_data ||
 				    !d->buffer.max_capacity ||
-				    d->buffer.size < d->buffer.max_capacity) {
-					int evtchn_fd = xenevtchn_fd(d->xce_handle);
-					d->xce_pollfd_idx = set_fds(evtchn_fd,
-								    POLLIN|POLLPRI);
-				}
+				    d->buffer.size < d->buffer.max_capacity)
+					events = POLLIN|POLLPRI;
 			}
+			io_fd_set(&d->xce_io, d->xce_handle ?
+				  xenevtchn_fd(d->xce_handle) : -1, events);
 
+			events = 0;
 			if (d->master_fd != -1) {
-				short events = 0;
 				if (!d->is_dead && ring_free_bytes(d))
 					events |= POLLIN;
 
@@ -1099,14 +1304,13 @@ void handle_io(void)
 					events |= POLLOUT;
 
 				if (events)
-					d->master_pollfd_idx =
-						set_fds(d->master_fd,
-							events|POLLPRI);
+					events |= POLLPRI;
 			}
+			io_fd_set(&d->master_io, d->master_fd, events);
 		}
 
-		/* If any domain has been rate limited, we need to work
-		   out what timeout to supply to poll */
+		/* If any domain has been rate limited, or has log output
+		   to flush, we need to work out what timeout to supply */
 		if (next_timeout) {
 			long long duration = (next_timeout - now);
 			if (duration <= 0) /* sanity check */
@@ -1114,7 +1318,7 @@ void handle_io(void)
 			poll_timeout = (int)duration;
 		}
 
-		ret = poll(fds, nr_fds, next_timeout ? poll_timeout : -1);
+		ret = io_wait(next_timeout ? poll_timeout : -1);
 
 		if (log_reload) {
 			handle_log_reload();
@@ -1131,62 +1335,52 @@ void handle_io(void)
 			break;
 		}
 
-		if (log_hv && xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		if (log_hv) {
+			revents = io_fd_revents(&xce_io);
+			if (revents & ~(POLLIN|POLLOUT|POLLPRI)) {
 				dolog(LOG_ERR,
 				      "Failure in poll xce_handle: %d (%s)",
 				      errno, strerror(errno));
 				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN)
+			} else if (revents & POLLIN)
 				handle_hv_logs(xce_handle, false);
-
-			xce_pollfd_idx = -1;
 		}
 
 		if (ret <= 0)
 			continue;
 
-		if (xs_pollfd_idx != -1) {
-			if (fds[xs_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xs_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xs_pollfd_idx].revents & POLLIN)
-				handle_xs();
-
-			xs_pollfd_idx = -1;
-		}
+		revents = io_fd_revents(&xs_io);
+		if (revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+			dolog(LOG_ERR,
+			      "Failure in poll xs_handle: %d (%s)",
+			      errno, strerror(errno));
+			break;
+		} else if (revents & POLLIN)
+			handle_xs();
 
 		for (d = dom_head; d; d = n) {
 			n = d->next;
+			revents = io_fd_revents(&d->xce_io);
 			if (d->event_count < RATE_LIMIT_ALLOWANCE) {
 				if (d->xce_handle != NULL &&
-				    d->xce_pollfd_idx != -1 &&
-				    !(fds[d->xce_pollfd_idx].revents &
-				      ~(POLLIN|POLLOUT|POLLPRI)) &&
-				      (fds[d->xce_pollfd_idx].revents &
-				       POLLIN))
+				    !(revents & ~(POLLIN|POLLOUT|POLLPRI)) &&
+				    (revents & POLLIN))
 				    handle_ring_read(d);
 			}
 
-			if (d->master_fd != -1 && d->master_pollfd_idx != -1) {
-				if (fds[d->master_pollfd_idx].revents &
-				    ~(POLLIN|POLLOUT|POLLPRI))
+			revents = io_fd_revents(&d->master_io);
+			if (d->master_fd != -1 && revents) {
+				if (revents & ~(POLLIN|POLLOUT|POLLPRI))
 					domain_handle_broken_tty(d,
 						   domain_is_valid(d->domid));
 				else {
-					if (fds[d->master_pollfd_idx].revents &
-					    POLLIN)
+					if (revents & POLLIN)
 						handle_tty_read(d);
-					if (fds[d->master_pollfd_idx].revents &
-					    POLLOUT)
+					if (revents & POLLOUT)
 						handle_tty_write(d);
 				}
 			}
 
-			d->xce_pollfd_idx = d->master_pollfd_idx = -1;
-
 			if (d->last_seen != enum_pass)
 				shutdown_domain(d);
 
@@ -1195,14 +1389,17 @@ void handle_io(void)
 		}
 	}
 
+	for (d = dom_head; d; d = d->next)
+		log_flush(&d->log);
+
+#ifndef USE_EPOLL
 	free(fds);
 	current_array_size = 0;
+#endif
 
  out:
-	if (log_hv_fd != -1) {
-		close(log_hv_fd);
-		log_hv_fd = -1;
-	}
+	log_close(&log_hv_file);
+	io_fd_release(&xce_io);
 	if (xce_handle != NULL) {
 		xenevtchn_close(xce_handle);
 		xce_handle = NULL;
@@ -1212,6 +1409,10 @@ void handle_io(void)
 		xgt_handle = NULL;
 	}
 	log_hv_evtchn = -1;
+#ifdef USE_EPOLL
+	close(epoll_fd);
+	epoll_fd = -1;
+#endif
 }
 
 /*
@@ -126,6 +126,9 @@ int scan_etherboot_nic(unsigned int option_rom_end,
 
     for ( devfn = 0; (devfn < 256) && !rom_size; devfn++ )
     {
+        if ( !pci_devfn_is_present(devfn) )
+            continue;
+
         class     = pci_readw(devfn, PCI_CLASS_DEVICE);
         vendor_id = pci_readw(devfn, PCI_VENDOR_ID);
         device_id = pci_readw(devfn, PCI_DEVICE_ID);
@@ -154,6 +157,9 @@ int pci_load_option_roms(unsigned int option_rom_end,
 
     for ( devfn = 0; devfn < 256; devfn++ )
     {
+        if ( !pci_devfn_is_present(devfn) )
+            continue;
+
         class     = pci_readb(devfn, PCI_CLASS_DEVICE + 1);
         vendor_id = pci_readw(devfn, PCI_VENDOR_ID);
         device_id = pci_readw(devfn, PCI_DEVICE_ID);
@@ -37,6 +37,8 @@ uint64_t pci_hi_mem_start = 0, pci_hi_mem_end = 0;
 enum virtual_vga virtual_vga = VGA_none;
 unsigned long igd_opregion_pgbase = 0;
 
+uint32_t pci_devfn_present[256 / 32];
+
 /* Check if the specified range conflicts with any reserved device memory. */
 static bool check_overlap_all(uint64_t start, uint64_t size)
 {
@@ -84,6 +86,7 @@ void pci_setup(void)
     uint32_t vga_devfn = 256;
     uint16_t class, vendor_id, device_id;
     unsigned int bar, pin, link, isa_irq;
+    bool single_function;
     int next_rmrr;
 
     /* Resources assignable to PCI devices via BARs. */
@@ -152,7 +155,21 @@ void pci_setup(void)
         vendor_id = pci_readw(devfn, PCI_VENDOR_ID);
         device_id = pci_readw(devfn, PCI_DEVICE_ID);
         if ( (vendor_id == 0xffff) && (device_id == 0xffff) )
+        {
+            /* No function 0 means an empty slot: skip functions 1-7. */
+            if ( !(devfn & 7) )
+                devfn |= 7;
             continue;
+        }
+
+        /*
+         * Functions 1-7 of a single-function device are not decoded, so
+         * each probe of them is a wasted round trip to the device model.
+         */
+        single_function = !(devfn & 7) &&
+                          !(pci_readb(devfn, PCI_HEADER_TYPE) & 0x80);
+
+        pci_devfn_present[devfn >> 5] |= 1u << (devfn & 31);
 
         ASSERT((devfn != PCI_ISA_DEVFN) ||
                ((vendor_id == 0x8086) && (device_id == 0x7000)));
@@ -294,6 +311,9 @@ void pci_setup(void)
         cmd = pci_readw(devfn, PCI_COMMAND);
         cmd |= PCI_COMMAND_MASTER;
         pci_writew(devfn, PCI_COMMAND, cmd);
+
+        if ( single_function )
+            devfn |= 7;
     }
 
     if ( mmio_hole_size )
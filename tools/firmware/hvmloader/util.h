@@ -236,6 +236,14 @@ int hvm_param_set(uint32_t index, uint64_t value);
 /* Setup PCI bus */
 void pci_setup(void);
 
+/*
+ * Functions found by pci_setup(), so that later scans of the bus need not
+ * probe all 256 devfns through the device model again.
+ */
+extern uint32_t pci_devfn_present[256 / 32];
+#define pci_devfn_is_present(devfn) \
+    (pci_devfn_present[(devfn) >> 5] & (1u << ((devfn) & 31)))
+
 /* Setup memory map  */
 void memory_map_setup(void);
 
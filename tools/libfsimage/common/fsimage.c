@@ -142,6 +142,24 @@ ssize_t fsi_pread_file(fsi_file_t *ffi, void *buf, size_t nbytes, uint64_t off)
 	return (ret);
 }
 
+int fsi_stat_file(fsi_file_t *ffi, fsi_stat_t *st)
+{
+	fsi_plugin_ops_t *ops;
+	int ret;
+
+	pthread_mutex_lock(&fsi_lock);
+	ops = ffi->ff_fsi->f_plugin->fp_ops;
+	if (ops->fpo_version < 2 || ops->fpo_stat == NULL) {
+		errno = ENOSYS;
+		ret = -1;
+	} else {
+		ret = ops->fpo_stat(ffi, st);
+	}
+	pthread_mutex_unlock(&fsi_lock);
+
+	return (ret);
+}
+
 char *
 fsi_bootstring_alloc(fsi_t *fsi, size_t len)
 {
@@ -35,6 +35,17 @@ extern C {
 typedef struct fsi fsi_t;
 typedef struct fsi_file fsi_file_t;
 
+/*
+ * Identity of a file within an image.  A file whose size, mtime and
+ * generation number are unchanged since it was last read can be assumed to
+ * have unchanged contents, which lets callers cache what they extracted.
+ */
+typedef struct fsi_stat {
+	uint64_t fst_size;
+	uint64_t fst_mtime;
+	uint32_t fst_gen;
+} fsi_stat_t;
+
 fsi_t *fsi_open_fsimage(const char *, uint64_t, const char *);
 void fsi_close_fsimage(fsi_t *);
 
@@ -44,6 +55,7 @@ int fsi_close_file(fsi_file_t *);
 
 ssize_t fsi_read_file(fsi_file_t *, void *, size_t);
 ssize_t fsi_pread_file(fsi_file_t *, void *, size_t, uint64_t);
+int fsi_stat_file(fsi_file_t *, fsi_stat_t *);
 
 char *fsi_bootstring_alloc(fsi_t *, size_t);
 void fsi_bootstring_free(fsi_t *);
@@ -156,6 +156,24 @@ ext2lib_close(fsi_file_t *file)
 	return (0);
 }
 
+int
+ext2lib_stat(fsi_file_t *file, fsi_stat_t *st)
+{
+	ext2_file_t *f = fsip_file_data(file);
+	struct ext2_inode *inode = ext2fs_file_get_inode(*f);
+	__u64 size;
+
+	if (ext2fs_file_get_lsize(*f, &size) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	st->fst_size = size;
+	st->fst_mtime = inode->i_mtime;
+	st->fst_gen = inode->i_generation;
+	return (0);
+}
+
 fsi_plugin_ops_t *
 fsi_init_plugin(int version, fsi_plugin_t *fp, const char **name)
 {
@@ -166,7 +184,8 @@ fsi_init_plugin(int version, fsi_plugin_t *fp, const char **name)
 		.fpo_open = ext2lib_open,
 		.fpo_read = ext2lib_read,
 		.fpo_pread = ext2lib_pread,
-		.fpo_close = ext2lib_close
+		.fpo_close = ext2lib_close,
+		.fpo_stat = ext2lib_stat
 	};
 
 	*name = "ext2fs-lib";
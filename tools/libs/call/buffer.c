@@ -14,6 +14,7 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 
@@ -24,14 +25,28 @@
 
 #define ROUNDUP(_x,_w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
 
-pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Per-thread cache of free buffers.  Only the owning thread touches the
+ * buffers; the list linkage is protected by buffer_lock.
+ */
+#define THREAD_CACHE_SIZE 4
+
+struct buffer_thread_cache {
+    xencall_handle *xcall;
+    struct buffer_thread_cache *next, **pprev;
+
+    int nr[BUFFER_NR_CLASSES];
+    void *buf[BUFFER_NR_CLASSES][THREAD_CACHE_SIZE];
+
+    int allocations, releases, hits;
+};
 
 static void cache_lock(xencall_handle *xcall)
 {
     int saved_errno = errno;
     if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
         return;
-    pthread_mutex_lock(&cache_mutex);
+    pthread_mutex_lock(&xcall->buffer_lock);
     /* Ignore pthread errors. */
     errno = saved_errno;
 }
@@ -41,34 +56,194 @@ static void cache_unlock(xencall_handle *xcall)
     int saved_errno = errno;
     if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
         return;
-    pthread_mutex_unlock(&cache_mutex);
+    pthread_mutex_unlock(&xcall->buffer_lock);
     /* Ignore pthread errors. */
     errno = saved_errno;
 }
 
-static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
+/* The size class of a buffer of @nr_pages, or -1 if it is too big. */
+static int size_class(size_t nr_pages)
 {
-    void *p = NULL;
+    int c = 0;
+
+    if ( nr_pages > BUFFER_MAX_PAGES )
+        return -1;
+
+    while ( (1UL << c) < nr_pages )
+        c++;
+
+    return c;
+}
+
+/* Free buffers are linked through their first word. */
+static void free_push(xencall_handle *xcall, int c, void *p)
+{
+    *(void **)p = xcall->buffer_free[c];
+    xcall->buffer_free[c] = p;
+}
+
+static void *free_pop(xencall_handle *xcall, int c)
+{
+    void *p = xcall->buffer_free[c];
+
+    if ( p )
+        xcall->buffer_free[c] = *(void **)p;
+
+    return p;
+}
+
+static bool in_slab(xencall_handle *xcall, void *p)
+{
+    int i;
+
+    for ( i = 0; i < xcall->buffer_nr_slabs; i++ )
+        if ( (char *)p >= (char *)xcall->buffer_slab[i] &&
+             (char *)p < (char *)xcall->buffer_slab[i] +
+                         BUFFER_SLAB_PAGES * PAGE_SIZE )
+            return true;
+
+    return false;
+}
+
+/*
+ * Carve a buffer of class @c out of the last slab, starting a new one if
+ * it hasn't room.  What is left of a full slab goes to the free lists of
+ * the smaller classes.  Called with buffer_lock held.
+ */
+static void *slab_alloc(xencall_handle *xcall, int c)
+{
+    size_t nr_pages = 1UL << c, left;
+    char *slab;
+    int i;
+
+    if ( xcall->buffer_nr_slabs == 0 ||
+         xcall->buffer_slab_used + nr_pages > BUFFER_SLAB_PAGES )
+    {
+        if ( xcall->buffer_nr_slabs == BUFFER_MAX_SLABS )
+            return NULL;
+
+        slab = osdep_alloc_pages(xcall, BUFFER_SLAB_PAGES);
+        if ( !slab )
+            return NULL;
+
+        if ( xcall->buffer_nr_slabs > 0 )
+        {
+            char *last = xcall->buffer_slab[xcall->buffer_nr_slabs - 1];
+
+            left = BUFFER_SLAB_PAGES - xcall->buffer_slab_used;
+            for ( i = c - 1; i >= 0; i-- )
+            {
+                if ( left & (1UL << i) )
+                {
+                    free_push(xcall, i,
+                              last + xcall->buffer_slab_used * PAGE_SIZE);
+                    xcall->buffer_slab_used += 1UL << i;
+                }
+            }
+        }
+
+        xcall->buffer_slab[xcall->buffer_nr_slabs++] = slab;
+        xcall->buffer_slab_used = 0;
+    }
+
+    slab = xcall->buffer_slab[xcall->buffer_nr_slabs - 1];
+    xcall->buffer_slab_used += nr_pages;
+
+    return slab + (xcall->buffer_slab_used - nr_pages) * PAGE_SIZE;
+}
+
+static void thread_cache_destroy(void *arg)
+{
+    struct buffer_thread_cache *tc = arg;
+    xencall_handle *xcall = tc->xcall;
+    int c;
 
     cache_lock(xcall);
 
-    xcall->buffer_total_allocations++;
-    xcall->buffer_current_allocations++;
-    if ( xcall->buffer_current_allocations > xcall->buffer_maximum_allocations )
-        xcall->buffer_maximum_allocations = xcall->buffer_current_allocations;
+    for ( c = 0; c < BUFFER_NR_CLASSES; c++ )
+        while ( tc->nr[c] > 0 )
+            free_push(xcall, c, tc->buf[c][--tc->nr[c]]);
+
+    xcall->buffer_total_allocations += tc->allocations;
+    xcall->buffer_total_releases += tc->releases;
+    xcall->buffer_cache_hits += tc->hits;
+
+    *tc->pprev = tc->next;
+    if ( tc->next )
+        tc->next->pprev = tc->pprev;
+
+    cache_unlock(xcall);
+
+    free(tc);
+}
+
+/* The calling thread's cache, or NULL if it cannot have one. */
+static struct buffer_thread_cache *thread_cache(xencall_handle *xcall)
+{
+    struct buffer_thread_cache *tc;
+    int saved_errno = errno;
+
+    if ( !xcall->buffer_have_key )
+        return NULL;
+
+    tc = pthread_getspecific(xcall->buffer_key);
+    if ( tc )
+        return tc;
 
-    if ( nr_pages > 1 )
+    tc = calloc(1, sizeof(*tc));
+    if ( !tc )
+        goto out;
+
+    tc->xcall = xcall;
+    if ( pthread_setspecific(xcall->buffer_key, tc) )
     {
-        xcall->buffer_cache_toobig++;
+        free(tc);
+        tc = NULL;
+        goto out;
     }
-    else if ( xcall->buffer_cache_nr > 0 )
+
+    cache_lock(xcall);
+    tc->next = xcall->buffer_threads;
+    if ( tc->next )
+        tc->next->pprev = &tc->next;
+    tc->pprev = &xcall->buffer_threads;
+    xcall->buffer_threads = tc;
+    cache_unlock(xcall);
+
+ out:
+    errno = saved_errno;
+    return tc;
+}
+
+static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
+{
+    struct buffer_thread_cache *tc = thread_cache(xcall);
+    int c = size_class(nr_pages);
+    void *p = NULL;
+
+    if ( tc )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        xcall->buffer_cache_hits++;
+        tc->allocations++;
+        if ( c >= 0 && tc->nr[c] > 0 )
+        {
+            tc->hits++;
+            return tc->buf[c][--tc->nr[c]];
+        }
     }
+
+    cache_lock(xcall);
+
+    if ( !tc )
+        xcall->buffer_total_allocations++;
+
+    if ( c < 0 )
+        xcall->buffer_cache_toobig++;
+    else if ( (p = free_pop(xcall, c)) != NULL )
+        xcall->buffer_cache_hits++;
     else
     {
         xcall->buffer_cache_misses++;
+        p = slab_alloc(xcall, c);
     }
 
     cache_unlock(xcall);
@@ -78,17 +253,29 @@ static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
 
 static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
 {
+    struct buffer_thread_cache *tc = thread_cache(xcall);
+    int c = size_class(nr_pages);
     int rc = 0;
 
+    if ( tc )
+    {
+        tc->releases++;
+        if ( c >= 0 && tc->nr[c] < THREAD_CACHE_SIZE &&
+             in_slab(xcall, p) )
+        {
+            tc->buf[c][tc->nr[c]++] = p;
+            return 1;
+        }
+    }
+
     cache_lock(xcall);
 
-    xcall->buffer_total_releases++;
-    xcall->buffer_current_allocations--;
+    if ( !tc )
+        xcall->buffer_total_releases++;
 
-    if ( nr_pages == 1 &&
-         xcall->buffer_cache_nr < BUFFER_CACHE_SIZE )
+    if ( c >= 0 && in_slab(xcall, p) )
     {
-        xcall->buffer_cache[xcall->buffer_cache_nr++] = p;
+        free_push(xcall, c, p);
         rc = 1;
     }
 
@@ -97,32 +284,82 @@ static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
     return rc;
 }
 
+int buffer_init_cache(xencall_handle *xcall)
+{
+    int c;
+
+    for ( c = 0; c < BUFFER_NR_CLASSES; c++ )
+        xcall->buffer_free[c] = NULL;
+    xcall->buffer_nr_slabs = 0;
+    xcall->buffer_slab_used = 0;
+    xcall->buffer_threads = NULL;
+
+    xcall->buffer_total_allocations = 0;
+    xcall->buffer_total_releases = 0;
+    xcall->buffer_cache_hits = 0;
+    xcall->buffer_cache_misses = 0;
+    xcall->buffer_cache_toobig = 0;
+
+    xcall->buffer_have_key = false;
+    if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
+        return 0;
+
+    if ( pthread_mutex_init(&xcall->buffer_lock, NULL) )
+    {
+        PERROR("Could not initialise the buffer cache lock");
+        return -1;
+    }
+
+    /* Without per-thread caches, everything just goes through the lock. */
+    xcall->buffer_have_key =
+        !pthread_key_create(&xcall->buffer_key, thread_cache_destroy);
+
+    return 0;
+}
+
 void buffer_release_cache(xencall_handle *xcall)
 {
-    void *p;
+    struct buffer_thread_cache *tc;
+    int i;
 
     cache_lock(xcall);
 
+    /*
+     * The threads' caches are freed without their threads knowing: the
+     * key is deleted below, so they are never looked up again.
+     */
+    while ( (tc = xcall->buffer_threads) != NULL )
+    {
+        xcall->buffer_threads = tc->next;
+        xcall->buffer_total_allocations += tc->allocations;
+        xcall->buffer_total_releases += tc->releases;
+        xcall->buffer_cache_hits += tc->hits;
+        free(tc);
+    }
+
     DBGPRINTF("total allocations:%d total releases:%d",
               xcall->buffer_total_allocations,
               xcall->buffer_total_releases);
-    DBGPRINTF("current allocations:%d maximum allocations:%d",
-              xcall->buffer_current_allocations,
-              xcall->buffer_maximum_allocations);
-    DBGPRINTF("cache current size:%d",
-              xcall->buffer_cache_nr);
+    DBGPRINTF("slabs:%d of %d pages",
+              xcall->buffer_nr_slabs, BUFFER_SLAB_PAGES);
     DBGPRINTF("cache hits:%d misses:%d toobig:%d",
               xcall->buffer_cache_hits,
               xcall->buffer_cache_misses,
               xcall->buffer_cache_toobig);
 
-    while ( xcall->buffer_cache_nr > 0 )
-    {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        osdep_free_pages(xcall, p, 1);
-    }
+    /* Buffers in slabs are never freed on their own. */
+    for ( i = 0; i < xcall->buffer_nr_slabs; i++ )
+        osdep_free_pages(xcall, xcall->buffer_slab[i], BUFFER_SLAB_PAGES);
+    xcall->buffer_nr_slabs = 0;
 
     cache_unlock(xcall);
+
+    if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
+        return;
+
+    if ( xcall->buffer_have_key )
+        pthread_key_delete(xcall->buffer_key);
+    pthread_mutex_destroy(&xcall->buffer_lock);
 }
 
 void *xencall_alloc_buffer_pages(xencall_handle *xcall, size_t nr_pages)
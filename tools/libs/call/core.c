@@ -27,15 +27,6 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
     xcall->fd = -1;
 
     xcall->flags = open_flags;
-    xcall->buffer_cache_nr = 0;
-
-    xcall->buffer_total_allocations = 0;
-    xcall->buffer_total_releases = 0;
-    xcall->buffer_current_allocations = 0;
-    xcall->buffer_maximum_allocations = 0;
-    xcall->buffer_cache_hits = 0;
-    xcall->buffer_cache_misses = 0;
-    xcall->buffer_cache_toobig = 0;
     xcall->logger = logger;
     xcall->logger_tofree = NULL;
 
@@ -49,6 +40,9 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
     rc = osdep_xencall_open(xcall);
     if ( rc  < 0 ) goto err;
 
+    rc = buffer_init_cache(xcall);
+    if ( rc < 0 ) goto err;
+
     return xcall;
 
 err:
@@ -1,6 +1,9 @@
 #ifndef XENCALL_PRIVATE_H
 #define XENCALL_PRIVATE_H
 
+#include <stdbool.h>
+#include <pthread.h>
+
 #include <xentoollog.h>
 
 #include <xencall.h>
@@ -22,22 +25,34 @@ struct xencall_handle {
     int fd;
 
     /*
-     * A simple cache of unused, single page, hypercall buffers
+     * A cache of unused hypercall buffers of up to BUFFER_MAX_PAGES,
+     * in power of two size classes.  They are carved out of slabs of
+     * locked memory, which are only given back when the handle is closed.
      *
-     * Protected by a global lock.
+     * Each thread keeps a few buffers of each class to itself, so that
+     * most allocations take no lock.  The rest of the cache, the slabs
+     * and the statistics are protected by buffer_lock.
      */
-#define BUFFER_CACHE_SIZE 4
-    int buffer_cache_nr;
-    void *buffer_cache[BUFFER_CACHE_SIZE];
+#define BUFFER_NR_CLASSES   5
+#define BUFFER_MAX_PAGES    (1U << (BUFFER_NR_CLASSES - 1))
+#define BUFFER_SLAB_PAGES   64
+#define BUFFER_MAX_SLABS    8
+    pthread_mutex_t buffer_lock;
+    void *buffer_free[BUFFER_NR_CLASSES];
+    void *buffer_slab[BUFFER_MAX_SLABS];
+    int buffer_nr_slabs;
+    size_t buffer_slab_used; /* Pages handed out of the last slab. */
+
+    bool buffer_have_key;
+    pthread_key_t buffer_key;
+    struct buffer_thread_cache *buffer_threads;
 
     /*
-     * Hypercall buffer statistics. All protected by the global
-     * buffer_cache lock.
+     * Hypercall buffer statistics.  Those of threads are added in when
+     * they exit or the handle is closed.
      */
     int buffer_total_allocations;
     int buffer_total_releases;
-    int buffer_current_allocations;
-    int buffer_maximum_allocations;
     int buffer_cache_hits;
     int buffer_cache_misses;
     int buffer_cache_toobig;
@@ -51,6 +66,7 @@ int osdep_hypercall(xencall_handle *xcall, privcmd_hypercall_t *hypercall);
 void *osdep_alloc_pages(xencall_handle *xcall, size_t nr_pages);
 void osdep_free_pages(xencall_handle *xcall, void *p, size_t nr_pages);
 
+int buffer_init_cache(xencall_handle *xcall);
 void buffer_release_cache(xencall_handle *xcall);
 
 #define PERROR(_f...) xtl_log(xcall->logger, XTL_ERROR, errno, "xencall", _f)
@@ -151,6 +151,35 @@ xenevtchn_pending(xenevtchn_handle *xce);
  */
 int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port);
 
+/*
+ * As xenevtchn_pending(), but return up to @max pending event
+ * channels in @ports, with a single call into the driver where it
+ * supports it.  Returns the number of ports stored, at least 1, or -1
+ * on failure, in which case errno will be set appropriately.
+ *
+ * Like xenevtchn_pending(), this blocks if nothing is pending, so the
+ * fd should be polled first.  A result smaller than @max means that no
+ * more ports were pending at the time of the call.
+ *
+ * This makes it possible to use the fd with edge triggered epoll
+ * (EPOLLET): on each wakeup, call xenevtchn_pending_batch() until it
+ * returns fewer than @max ports.  (If it returns exactly @max, poll()
+ * the fd with a zero timeout before calling it again, since it would
+ * block if that was all.)  Every port signalled after the final call
+ * wakes epoll up again.
+ */
+int xenevtchn_pending_batch(xenevtchn_handle *xce, evtchn_port_t *ports,
+                            unsigned int max);
+
+/*
+ * Unmask the @count event channels in @ports, with as few calls into
+ * the driver as it allows.  Returns -1 on failure, in which case errno
+ * will be set appropriately, and some of the ports may have been
+ * unmasked.
+ */
+int xenevtchn_unmask_batch(xenevtchn_handle *xce, const evtchn_port_t *ports,
+                           unsigned int count);
+
 #endif
 
 /*
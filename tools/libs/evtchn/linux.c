@@ -129,6 +129,51 @@ int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port)
     return 0;
 }
 
+int xenevtchn_pending_batch(xenevtchn_handle *xce, evtchn_port_t *ports,
+                            unsigned int max)
+{
+    int fd = xce->fd;
+    ssize_t rc;
+
+    if ( max == 0 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The driver returns as many pending ports as fit, at most a page. */
+    rc = read(fd, ports, max * sizeof(*ports));
+    if ( rc < 0 )
+        return -1;
+
+    return rc / sizeof(*ports);
+}
+
+int xenevtchn_unmask_batch(xenevtchn_handle *xce, const evtchn_port_t *ports,
+                           unsigned int count)
+{
+    int fd = xce->fd;
+    const char *p = (const char *)ports;
+    size_t len = count * sizeof(*ports);
+    ssize_t rc;
+
+    /* The driver unmasks at most a page of ports per write. */
+    while ( len )
+    {
+        rc = write(fd, p, len);
+        if ( rc < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        p += rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -19,6 +19,7 @@
  * Split out from xc_netbsd.c
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -136,6 +137,38 @@ int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port)
     return write_exact(fd, (char *)&port, sizeof(port));
 }
 
+int xenevtchn_pending_batch(xenevtchn_handle *xce, evtchn_port_t *ports,
+                            unsigned int max)
+{
+    xenevtchn_port_or_error_t port;
+
+    if ( max == 0 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The driver hands out one port per read. */
+    port = xenevtchn_pending(xce);
+    if ( port == -1 )
+        return -1;
+    ports[0] = port;
+
+    return 1;
+}
+
+int xenevtchn_unmask_batch(xenevtchn_handle *xce, const evtchn_port_t *ports,
+                           unsigned int count)
+{
+    unsigned int i;
+
+    for ( i = 0; i < count; i++ )
+        if ( xenevtchn_unmask(xce, ports[i]) == -1 )
+            return -1;
+
+    return 0;
+}
+
 /*
  * Local variables:
  * mode: C
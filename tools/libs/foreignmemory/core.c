@@ -41,6 +41,9 @@ xenforeignmemory_handle *xenforeignmemory_open(xentoollog_logger *logger,
     rc = osdep_xenforeignmemory_open(fmem);
     if ( rc  < 0 ) goto err;
 
+    rc = mapcache_init(fmem);
+    if ( rc < 0 ) goto err;
+
     return fmem;
 
 err:
@@ -57,6 +60,7 @@ int xenforeignmemory_close(xenforeignmemory_handle *fmem)
     if ( !fmem )
         return 0;
 
+    mapcache_destroy(fmem);
     rc = osdep_xenforeignmemory_close(fmem);
     xtl_logger_destroy(fmem->logger_tofree);
     free(fmem);
@@ -106,6 +110,26 @@ int xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
     return osdep_xenforeignmemory_unmap(fmem, addr, num);
 }
 
+void *xenforeignmemory_map_range(xenforeignmemory_handle *fmem, uint32_t dom,
+                                 int prot, xen_pfn_t gfn, size_t pages)
+{
+    xen_pfn_t *arr;
+    void *ret;
+    size_t i;
+
+    arr = malloc(pages * sizeof(*arr));
+    if ( arr == NULL )
+        return NULL;
+
+    for ( i = 0; i < pages; i++ )
+        arr[i] = gfn + i;
+
+    ret = xenforeignmemory_map(fmem, dom, prot, pages, arr, NULL);
+    free(arr);
+
+    return ret;
+}
+
 /*
  * Local variables:
  * mode: C
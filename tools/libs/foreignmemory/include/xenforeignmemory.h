@@ -115,6 +115,48 @@ void *xenforeignmemory_map(xenforeignmemory_handle *fmem, uint32_t dom,
 int xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
                            void *addr, size_t pages);
 
+/*
+ * Maps @pages consecutive gfns of @dom, starting at @gfn, as
+ * xenforeignmemory_map() does with a NULL @err.
+ *
+ * Ranges of 2M or more are mapped 2M aligned where the platform allows,
+ * so that each 2M of the guest range is mapped by a single page table.
+ *
+ * The mapping must be unmapped with xenforeignmemory_unmap().
+ */
+void *xenforeignmemory_map_range(xenforeignmemory_handle *fmem, uint32_t dom,
+                                 int prot, xen_pfn_t gfn, size_t pages);
+
+/*
+ * Cached ranged mappings, for callers which map the same regions of a
+ * guest over and over.
+ *
+ * xenforeignmemory_map_cached() is as xenforeignmemory_map_range(),
+ * except that a range inside one already in the handle's cache, and
+ * mapped with at least @prot, is returned from the existing mapping.
+ *
+ * Each xenforeignmemory_map_cached() must be matched by one
+ * xenforeignmemory_unmap_cached(), of any address in the mapping.
+ * Mappings no longer in use stay cached, up to a total of
+ * XENFOREIGNMEMORY_CACHE_PAGES, the least recently used being unmapped
+ * first.
+ *
+ * A cached mapping maps the frames which were at its gfns when it was
+ * made, so must not outlive changes to the guest's physmap:
+ * xenforeignmemory_cache_flush() unmaps the cached mappings of @dom, or
+ * of every domain for DOMID_INVALID, which are not in use.
+ *
+ * The cache may be used by several threads at once.
+ */
+#define XENFOREIGNMEMORY_CACHE_PAGES 16384
+
+void *xenforeignmemory_map_cached(xenforeignmemory_handle *fmem,
+                                  uint32_t dom, int prot,
+                                  xen_pfn_t gfn, size_t pages);
+int xenforeignmemory_unmap_cached(xenforeignmemory_handle *fmem, void *addr);
+void xenforeignmemory_cache_flush(xenforeignmemory_handle *fmem,
+                                  uint32_t dom);
+
 #endif
 
 /*
@@ -65,6 +65,46 @@ int osdep_xenforeignmemory_close(xenforeignmemory_handle *fmem)
     return close(fd);
 }
 
+/*
+ * Mappings of 2M or more are placed 2M aligned, so that each 2M of a
+ * contiguous range takes a single page table, rather than straddling two.
+ * privcmd only maps 4K frames, so there are no larger pages than that to
+ * be had.
+ */
+#define MAP_ALIGN_SHIFT 21
+
+static void *map_privcmd(int fd, size_t num, int prot)
+{
+    size_t size = num << PAGE_SHIFT, align = 1UL << MAP_ALIGN_SHIFT;
+    char *res, *addr;
+
+    if ( size < align )
+        return mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+
+    /* Reserve enough address space to find an aligned range in. */
+    res = mmap(NULL, size + align - PAGE_SIZE, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if ( res == MAP_FAILED )
+        return MAP_FAILED;
+
+    addr = (char *)ROUNDUP(res, MAP_ALIGN_SHIFT);
+    if ( mmap(addr, size, prot, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED )
+    {
+        int saved_errno = errno;
+
+        (void)munmap(res, size + align - PAGE_SIZE);
+        errno = saved_errno;
+        return MAP_FAILED;
+    }
+
+    if ( addr > res )
+        (void)munmap(res, addr - res);
+    if ( addr + size < res + size + align - PAGE_SIZE )
+        (void)munmap(addr + size, res + align - PAGE_SIZE - addr);
+
+    return addr;
+}
+
 static int map_foreign_batch_single(int fd, uint32_t dom,
                                     xen_pfn_t *mfn, unsigned long addr)
 {
@@ -152,8 +192,7 @@ void *osdep_xenforeignmemory_map(xenforeignmemory_handle *fmem,
     size_t i;
     int rc;
 
-    addr = mmap(NULL, num << PAGE_SHIFT, prot, MAP_SHARED,
-                fd, 0);
+    addr = map_privcmd(fd, num, prot);
     if ( addr == MAP_FAILED )
     {
         PERROR("mmap failed");
@@ -0,0 +1,252 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "private.h"
+
+struct mapcache_entry {
+    struct mapcache_entry *next, *prev;
+    uint32_t dom;
+    int prot;
+    xen_pfn_t gfn;
+    size_t pages;
+    char *addr;
+    unsigned int refs;
+};
+
+static void cache_lock(xenforeignmemory_handle *fmem)
+{
+    int saved_errno = errno;
+    pthread_mutex_lock(&fmem->cache_lock);
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+}
+
+static void cache_unlock(xenforeignmemory_handle *fmem)
+{
+    int saved_errno = errno;
+    pthread_mutex_unlock(&fmem->cache_lock);
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+}
+
+static void entry_unlink(xenforeignmemory_handle *fmem,
+                         struct mapcache_entry *e)
+{
+    if ( e->prev )
+        e->prev->next = e->next;
+    else
+        fmem->cache_head = e->next;
+
+    if ( e->next )
+        e->next->prev = e->prev;
+    else
+        fmem->cache_tail = e->prev;
+}
+
+static void entry_push(xenforeignmemory_handle *fmem,
+                       struct mapcache_entry *e)
+{
+    e->prev = NULL;
+    e->next = fmem->cache_head;
+    if ( e->next )
+        e->next->prev = e;
+    else
+        fmem->cache_tail = e;
+    fmem->cache_head = e;
+}
+
+/* Unmap and free @e, which must be unlinked and not in use. */
+static void entry_free(xenforeignmemory_handle *fmem,
+                       struct mapcache_entry *e)
+{
+    int saved_errno = errno;
+
+    (void)osdep_xenforeignmemory_unmap(fmem, e->addr, e->pages);
+    free(e);
+    errno = saved_errno;
+}
+
+/* Unmap the least recently used entries while too much is idle. */
+static void cache_trim(xenforeignmemory_handle *fmem)
+{
+    struct mapcache_entry *e, *prev;
+
+    for ( e = fmem->cache_tail;
+          e && fmem->cache_idle_pages > XENFOREIGNMEMORY_CACHE_PAGES;
+          e = prev )
+    {
+        prev = e->prev;
+        if ( e->refs )
+            continue;
+
+        entry_unlink(fmem, e);
+        fmem->cache_idle_pages -= e->pages;
+        entry_free(fmem, e);
+    }
+}
+
+void *xenforeignmemory_map_cached(xenforeignmemory_handle *fmem,
+                                  uint32_t dom, int prot,
+                                  xen_pfn_t gfn, size_t pages)
+{
+    struct mapcache_entry *e;
+    void *addr;
+
+    cache_lock(fmem);
+
+    for ( e = fmem->cache_head; e; e = e->next )
+    {
+        if ( e->dom != dom || (e->prot & prot) != prot ||
+             gfn < e->gfn || gfn + pages > e->gfn + e->pages )
+            continue;
+
+        if ( e->refs++ == 0 )
+            fmem->cache_idle_pages -= e->pages;
+        entry_unlink(fmem, e);
+        entry_push(fmem, e);
+        addr = e->addr + ((gfn - e->gfn) << PAGE_SHIFT);
+
+        cache_unlock(fmem);
+        return addr;
+    }
+
+    cache_unlock(fmem);
+
+    e = malloc(sizeof(*e));
+    if ( e == NULL )
+        return NULL;
+
+    /* Map without the lock: the hypercalls can take a while. */
+    e->addr = xenforeignmemory_map_range(fmem, dom, prot, gfn, pages);
+    if ( e->addr == NULL )
+    {
+        int saved_errno = errno;
+
+        free(e);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    e->dom = dom;
+    e->prot = prot;
+    e->gfn = gfn;
+    e->pages = pages;
+    e->refs = 1;
+
+    cache_lock(fmem);
+    entry_push(fmem, e);
+    cache_unlock(fmem);
+
+    return e->addr;
+}
+
+int xenforeignmemory_unmap_cached(xenforeignmemory_handle *fmem, void *addr)
+{
+    struct mapcache_entry *e;
+
+    cache_lock(fmem);
+
+    for ( e = fmem->cache_head; e; e = e->next )
+        if ( (char *)addr >= e->addr &&
+             (char *)addr < e->addr + (e->pages << PAGE_SHIFT) )
+            break;
+
+    if ( e == NULL || e->refs == 0 )
+    {
+        cache_unlock(fmem);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( --e->refs == 0 )
+    {
+        fmem->cache_idle_pages += e->pages;
+        cache_trim(fmem);
+    }
+
+    cache_unlock(fmem);
+
+    return 0;
+}
+
+void xenforeignmemory_cache_flush(xenforeignmemory_handle *fmem,
+                                  uint32_t dom)
+{
+    struct mapcache_entry *e, *next;
+
+    cache_lock(fmem);
+
+    for ( e = fmem->cache_head; e; e = next )
+    {
+        next = e->next;
+        if ( e->refs || (dom != DOMID_INVALID && e->dom != dom) )
+            continue;
+
+        entry_unlink(fmem, e);
+        fmem->cache_idle_pages -= e->pages;
+        entry_free(fmem, e);
+    }
+
+    cache_unlock(fmem);
+}
+
+int mapcache_init(xenforeignmemory_handle *fmem)
+{
+    fmem->cache_head = fmem->cache_tail = NULL;
+    fmem->cache_idle_pages = 0;
+    fmem->cache_pid = getpid();
+
+    if ( pthread_mutex_init(&fmem->cache_lock, NULL) )
+    {
+        PERROR("Could not initialise the map cache lock");
+        return -1;
+    }
+
+    return 0;
+}
+
+void mapcache_destroy(xenforeignmemory_handle *fmem)
+{
+    struct mapcache_entry *e;
+
+    /*
+     * After fork(2) the mappings aren't there to unmap, and something
+     * else may be at their addresses.
+     */
+    while ( (e = fmem->cache_head) != NULL )
+    {
+        entry_unlink(fmem, e);
+        if ( fmem->cache_pid == getpid() )
+            entry_free(fmem, e);
+        else
+            free(e);
+    }
+
+    pthread_mutex_destroy(&fmem->cache_lock);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
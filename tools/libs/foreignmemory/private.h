@@ -1,6 +1,9 @@
 #ifndef XENFOREIGNMEMORY_PRIVATE_H
 #define XENFOREIGNMEMORY_PRIVATE_H
 
+#include <pthread.h>
+#include <sys/types.h>
+
 #include <xentoollog.h>
 
 #include <xenforeignmemory.h>
@@ -20,6 +23,15 @@ struct xenforeignmemory_handle {
     xentoollog_logger *logger, *logger_tofree;
     unsigned flags;
     int fd;
+
+    /*
+     * Cached mappings, most recently used first, and the total size of
+     * those not in use.  Protected by cache_lock.
+     */
+    pthread_mutex_t cache_lock;
+    struct mapcache_entry *cache_head, *cache_tail;
+    size_t cache_idle_pages;
+    pid_t cache_pid; /* Of the process the cached mappings are in. */
 };
 
 int osdep_xenforeignmemory_open(xenforeignmemory_handle *fmem);
@@ -32,6 +44,9 @@ void *osdep_xenforeignmemory_map(xenforeignmemory_handle *fmem,
 int osdep_xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
                                  void *addr, size_t num);
 
+int mapcache_init(xenforeignmemory_handle *fmem);
+void mapcache_destroy(xenforeignmemory_handle *fmem);
+
 #if defined(__NetBSD__) || defined(__sun__)
 /* Strictly compat for those two only only */
 void *compat_mapforeign_batch(xenforeignmem_handle *fmem, uint32_t dom,
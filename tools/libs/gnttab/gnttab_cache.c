@@ -0,0 +1,426 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Persistent grant mappings.
+ *
+ * Each region is what one osdep_gnttab_grant_map() call mapped: the
+ * grants which missed in one xengnttab_map_cached().  The driver can
+ * only unmap a region as a whole, so a region stays mapped until none
+ * of its pages are in use.  Pages are found by (domid, ref) through a
+ * hash, and regions are kept most recently used first.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "private.h"
+
+#define GTERROR(_l, _f...) xtl_log(_l, XTL_ERROR, errno, "gnttab", _f)
+
+#ifndef PAGE_SHIFT
+#define PAGE_SHIFT 12
+#endif
+
+struct gnttab_cache_page {
+    struct gnttab_cache_page *hash_next;
+    struct gnttab_cache_region *region;
+    uint32_t domid, ref;
+    unsigned int refs;
+};
+
+struct gnttab_cache_region {
+    struct gnttab_cache_region *next, *prev;
+    char *addr;
+    int prot;
+    uint32_t count;
+    uint32_t busy; /* Pages with refs != 0. */
+    struct gnttab_cache_page pages[];
+};
+
+static void cache_lock(xengnttab_handle *xgt)
+{
+    int saved_errno = errno;
+    pthread_mutex_lock(&xgt->cache_lock);
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+}
+
+static void cache_unlock(xengnttab_handle *xgt)
+{
+    int saved_errno = errno;
+    pthread_mutex_unlock(&xgt->cache_lock);
+    /* Ignore pthread errors. */
+    errno = saved_errno;
+}
+
+static struct gnttab_cache_page **hash_bucket(xengnttab_handle *xgt,
+                                              uint32_t domid, uint32_t ref)
+{
+    uint32_t h = (domid * 0x9e3779b1u) ^ ref;
+
+    return &xgt->cache_hash[h & (GNTTAB_CACHE_BUCKETS - 1)];
+}
+
+static struct gnttab_cache_page *page_find(xengnttab_handle *xgt,
+                                           uint32_t domid, uint32_t ref,
+                                           int prot)
+{
+    struct gnttab_cache_page *p;
+
+    for ( p = *hash_bucket(xgt, domid, ref); p; p = p->hash_next )
+        if ( p->domid == domid && p->ref == ref &&
+             (p->region->prot & prot) == prot )
+            return p;
+
+    return NULL;
+}
+
+static void region_unlink(xengnttab_handle *xgt,
+                          struct gnttab_cache_region *r)
+{
+    if ( r->prev )
+        r->prev->next = r->next;
+    else
+        xgt->cache_head = r->next;
+
+    if ( r->next )
+        r->next->prev = r->prev;
+    else
+        xgt->cache_tail = r->prev;
+}
+
+static void region_push(xengnttab_handle *xgt,
+                        struct gnttab_cache_region *r)
+{
+    r->prev = NULL;
+    r->next = xgt->cache_head;
+    if ( r->next )
+        r->next->prev = r;
+    else
+        xgt->cache_tail = r;
+    xgt->cache_head = r;
+}
+
+/* Take a reference on @p, and make its region the most recently used. */
+static void page_get(xengnttab_handle *xgt, struct gnttab_cache_page *p)
+{
+    struct gnttab_cache_region *r = p->region;
+
+    if ( p->refs++ == 0 && r->busy++ == 0 )
+        xgt->cache_idle_pages -= r->count;
+
+    if ( xgt->cache_head != r )
+    {
+        region_unlink(xgt, r);
+        region_push(xgt, r);
+    }
+}
+
+/* Remove @r, which must not be in use, from the cache and unmap it. */
+static void region_free(xengnttab_handle *xgt, struct gnttab_cache_region *r)
+{
+    int saved_errno = errno;
+    struct gnttab_cache_page **pp;
+    uint32_t i;
+
+    for ( i = 0; i < r->count; i++ )
+    {
+        pp = hash_bucket(xgt, r->pages[i].domid, r->pages[i].ref);
+        while ( *pp != &r->pages[i] )
+            pp = &(*pp)->hash_next;
+        *pp = r->pages[i].hash_next;
+    }
+
+    region_unlink(xgt, r);
+    xgt->cache_idle_pages -= r->count;
+
+    (void)osdep_gnttab_unmap(xgt, r->addr, r->count);
+    free(r);
+    errno = saved_errno;
+}
+
+/* Unmap the least recently used regions while too much is idle. */
+static void cache_trim(xengnttab_handle *xgt)
+{
+    struct gnttab_cache_region *r, *prev;
+
+    for ( r = xgt->cache_tail;
+          r && xgt->cache_idle_pages > XENGNTTAB_CACHE_PAGES;
+          r = prev )
+    {
+        prev = r->prev;
+        if ( !r->busy )
+            region_free(xgt, r);
+    }
+}
+
+static struct gnttab_cache_page *page_at(xengnttab_handle *xgt, void *addr)
+{
+    struct gnttab_cache_region *r;
+    char *a = addr;
+
+    for ( r = xgt->cache_head; r; r = r->next )
+        if ( a >= r->addr && a < r->addr + ((size_t)r->count << PAGE_SHIFT) )
+            return &r->pages[(a - r->addr) >> PAGE_SHIFT];
+
+    return NULL;
+}
+
+/* Drop a reference on each of the @count pages at @addrs. */
+static void put_pages(xengnttab_handle *xgt, uint32_t count, void **addrs)
+{
+    struct gnttab_cache_page *p;
+    uint32_t i;
+
+    for ( i = 0; i < count; i++ )
+    {
+        p = page_at(xgt, addrs[i]);
+        if ( --p->refs == 0 && --p->region->busy == 0 )
+            xgt->cache_idle_pages += p->region->count;
+    }
+}
+
+int xengnttab_map_cached(xengnttab_handle *xgt, uint32_t count,
+                         uint32_t *domids, uint32_t *refs, int prot,
+                         void **addrs)
+{
+    struct gnttab_cache_region *r;
+    struct gnttab_cache_page *p;
+    uint32_t *miss, *miss_domids, *miss_refs;
+    uint32_t i, j, nr_miss = 0;
+
+    miss = malloc(count * 3 * sizeof(*miss));
+    if ( miss == NULL )
+        return -1;
+    miss_domids = miss + count;
+    miss_refs = miss_domids + count;
+
+    cache_lock(xgt);
+
+    for ( i = 0; i < count; i++ )
+    {
+        p = page_find(xgt, domids[i], refs[i], prot);
+        if ( p )
+        {
+            page_get(xgt, p);
+            addrs[i] = p->region->addr + ((p - p->region->pages) << PAGE_SHIFT);
+            continue;
+        }
+
+        /* A grant may be wanted more than once: map it only once. */
+        for ( j = 0; j < nr_miss; j++ )
+            if ( miss_domids[j] == domids[i] && miss_refs[j] == refs[i] )
+                break;
+        if ( j == nr_miss )
+        {
+            miss_domids[nr_miss] = domids[i];
+            miss_refs[nr_miss] = refs[i];
+            nr_miss++;
+        }
+        miss[i] = j;
+        addrs[i] = NULL;
+    }
+
+    cache_unlock(xgt);
+
+    if ( nr_miss == 0 )
+        goto out;
+
+    r = malloc(sizeof(*r) + nr_miss * sizeof(r->pages[0]));
+    if ( r == NULL )
+        goto err;
+
+    /* Map without the lock: the hypercalls can take a while. */
+    r->addr = osdep_gnttab_grant_map(xgt, nr_miss, 0, prot,
+                                     miss_domids, miss_refs, -1, -1);
+    if ( r->addr == NULL )
+    {
+        free(r);
+        goto err;
+    }
+    r->prot = prot;
+    r->count = nr_miss;
+    r->busy = nr_miss;
+
+    cache_lock(xgt);
+
+    for ( j = 0; j < nr_miss; j++ )
+    {
+        struct gnttab_cache_page **bucket;
+
+        p = &r->pages[j];
+        p->region = r;
+        p->domid = miss_domids[j];
+        p->ref = miss_refs[j];
+        p->refs = 0;
+
+        bucket = hash_bucket(xgt, p->domid, p->ref);
+        p->hash_next = *bucket;
+        *bucket = p;
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( addrs[i] )
+            continue;
+        p = &r->pages[miss[i]];
+        p->refs++;
+        addrs[i] = r->addr + ((uint32_t)miss[i] << PAGE_SHIFT);
+    }
+    region_push(xgt, r);
+
+    cache_unlock(xgt);
+
+ out:
+    free(miss);
+    return 0;
+
+ err:
+    {
+        int saved_errno = errno;
+
+        /* Give back the hits, which are the entries already filled in. */
+        cache_lock(xgt);
+        for ( i = 0; i < count; i++ )
+            if ( addrs[i] )
+                put_pages(xgt, 1, &addrs[i]);
+        cache_trim(xgt);
+        cache_unlock(xgt);
+
+        for ( i = 0; i < count; i++ )
+            addrs[i] = NULL;
+        free(miss);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+int xengnttab_unmap_cached(xengnttab_handle *xgt, uint32_t count,
+                           void **addrs)
+{
+    struct gnttab_cache_page *p;
+    uint32_t i;
+
+    cache_lock(xgt);
+
+    /* Check them all first, so that nothing is done on error. */
+    for ( i = 0; i < count; i++ )
+    {
+        p = page_at(xgt, addrs[i]);
+        if ( p == NULL || p->refs == 0 )
+        {
+            cache_unlock(xgt);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    put_pages(xgt, count, addrs);
+    cache_trim(xgt);
+
+    cache_unlock(xgt);
+
+    return 0;
+}
+
+void xengnttab_cache_flush(xengnttab_handle *xgt, uint32_t domid)
+{
+    struct gnttab_cache_region *r, *next;
+    uint32_t i;
+
+    cache_lock(xgt);
+
+    for ( r = xgt->cache_head; r; r = next )
+    {
+        next = r->next;
+        if ( r->busy )
+            continue;
+
+        if ( domid != DOMID_INVALID )
+        {
+            for ( i = 0; i < r->count; i++ )
+                if ( r->pages[i].domid == domid )
+                    break;
+            if ( i == r->count )
+                continue;
+        }
+
+        region_free(xgt, r);
+    }
+
+    cache_unlock(xgt);
+}
+
+int gnttab_cache_init(xengnttab_handle *xgt)
+{
+    xgt->cache_head = xgt->cache_tail = NULL;
+    xgt->cache_idle_pages = 0;
+    xgt->cache_pid = getpid();
+
+    xgt->cache_hash = calloc(GNTTAB_CACHE_BUCKETS, sizeof(*xgt->cache_hash));
+    if ( xgt->cache_hash == NULL )
+    {
+        GTERROR(xgt->logger, "Could not allocate the grant cache");
+        return -1;
+    }
+
+    if ( pthread_mutex_init(&xgt->cache_lock, NULL) )
+    {
+        GTERROR(xgt->logger, "Could not initialise the grant cache lock");
+        free(xgt->cache_hash);
+        xgt->cache_hash = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void gnttab_cache_destroy(xengnttab_handle *xgt)
+{
+    struct gnttab_cache_region *r;
+
+    if ( xgt->cache_hash == NULL )
+        return;
+
+    /*
+     * After fork(2) the mappings aren't there to unmap, and something
+     * else may be at their addresses.  Closing the device releases the
+     * grants in any case.
+     */
+    while ( (r = xgt->cache_head) != NULL )
+    {
+        region_unlink(xgt, r);
+        if ( xgt->cache_pid == getpid() )
+            munmap(r->addr, (size_t)r->count << PAGE_SHIFT);
+        free(r);
+    }
+
+    free(xgt->cache_hash);
+    xgt->cache_hash = NULL;
+    pthread_mutex_destroy(&xgt->cache_lock);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -30,6 +30,7 @@ xengnttab_handle *xengnttab_open(xentoollog_logger *logger, unsigned open_flags)
     if (!xgt) return NULL;
 
     xgt->fd = -1;
+    xgt->cache_hash = NULL;
     xgt->logger = logger;
     xgt->logger_tofree  = NULL;
 
@@ -43,6 +44,9 @@ xengnttab_handle *xengnttab_open(xentoollog_logger *logger, unsigned open_flags)
     rc = osdep_gnttab_open(xgt);
     if ( rc  < 0 ) goto err;
 
+    rc = gnttab_cache_init(xgt);
+    if ( rc < 0 ) goto err;
+
     return xgt;
 
 err:
@@ -59,6 +63,7 @@ int xengnttab_close(xengnttab_handle *xgt)
     if ( !xgt )
         return 0;
 
+    gnttab_cache_destroy(xgt);
     rc = osdep_gnttab_close(xgt);
     xtl_logger_destroy(xgt->logger_tofree);
     free(xgt);
@@ -78,6 +78,24 @@ int xengnttab_unmap(xengnttab_handle *xgt, void *start_address, uint32_t count)
     abort();
 }
 
+int xengnttab_map_cached(xengnttab_handle *xgt, uint32_t count,
+                         uint32_t *domids, uint32_t *refs, int prot,
+                         void **addrs)
+{
+    abort();
+}
+
+int xengnttab_unmap_cached(xengnttab_handle *xgt, uint32_t count,
+                           void **addrs)
+{
+    abort();
+}
+
+void xengnttab_cache_flush(xengnttab_handle *xgt, uint32_t domid)
+{
+    abort();
+}
+
 /*
  * Local variables:
  * mode: C
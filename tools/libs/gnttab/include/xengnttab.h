@@ -244,6 +244,42 @@ void *xengnttab_map_grant_ref_notify(xengnttab_handle *xgt,
  */
 int xengnttab_unmap(xengnttab_handle *xgt, void *start_address, uint32_t count);
 
+/**
+ * Persistent grant mappings, for backends whose peer keeps granting the
+ * same pages, as with blkif's feature-persistent.
+ *
+ * xengnttab_map_cached() maps each of the @count grants (@domids[i],
+ * @refs[i]) and stores its address in @addrs[i].  Grants already
+ * mapped by the handle with at least @prot are not mapped again, and
+ * all the others are mapped together, with a single request to the
+ * driver.  The pages are not contiguous.  Logs errors.
+ *
+ * Each page must be given back by xengnttab_unmap_cached().  Grants
+ * no longer in use stay mapped, up to about XENGNTTAB_CACHE_PAGES
+ * pages, and the least recently used are unmapped first.  Pages mapped
+ * together are only unmapped together, once none of them is in use.
+ *
+ * A cached mapping keeps the peer's grant in use, so the peer must
+ * not revoke it while it is mapped.  When the frontend disconnects,
+ * xengnttab_cache_flush() unmaps the cached grants of @domid, or of
+ * every domain for DOMID_INVALID, which are not in use.
+ *
+ * Cached pages count towards the limit of xengnttab_set_max_grants().
+ * The cache may be used by several threads at once.
+ *
+ * On failure sets errno and returns -1, and no references are taken.
+ * xengnttab_unmap_cached() fails with EINVAL, and does nothing, if
+ * any of @addrs is not a page in use from xengnttab_map_cached().
+ */
+#define XENGNTTAB_CACHE_PAGES 1024
+
+int xengnttab_map_cached(xengnttab_handle *xgt, uint32_t count,
+                         uint32_t *domids, uint32_t *refs, int prot,
+                         void **addrs);
+int xengnttab_unmap_cached(xengnttab_handle *xgt, uint32_t count,
+                           void **addrs);
+void xengnttab_cache_flush(xengnttab_handle *xgt, uint32_t domid);
+
 /**
  * Sets the maximum number of grants that may be mapped by the given
  * instance to @count.  Never logs.
@@ -1,14 +1,30 @@
 #ifndef XENGNTTAB_PRIVATE_H
 #define XENGNTTAB_PRIVATE_H
 
+#include <pthread.h>
+#include <sys/types.h>
+
 #include <xentoollog.h>
 #include <xengnttab.h>
 
 struct xengntdev_handle {
     xentoollog_logger *logger, *logger_tofree;
     int fd;
+
+    /*
+     * Persistent grant mappings (gnttab handles only): regions most
+     * recently used first, a hash of their pages, and the number of
+     * pages in regions not in use.  Protected by cache_lock.
+     */
+    pthread_mutex_t cache_lock;
+    struct gnttab_cache_region *cache_head, *cache_tail;
+    struct gnttab_cache_page **cache_hash;
+    size_t cache_idle_pages;
+    pid_t cache_pid; /* Of the process the cached mappings are in. */
 };
 
+#define GNTTAB_CACHE_BUCKETS 1024
+
 int osdep_gnttab_open(xengnttab_handle *xgt);
 int osdep_gnttab_close(xengnttab_handle *xgt);
 
@@ -23,6 +39,10 @@ void *osdep_gnttab_grant_map(xengnttab_handle *xgt,
 int osdep_gnttab_unmap(xengnttab_handle *xgt,
                        void *start_address,
                        uint32_t count);
+
+int gnttab_cache_init(xengnttab_handle *xgt);
+void gnttab_cache_destroy(xengnttab_handle *xgt);
+
 int osdep_gntshr_open(xengntshr_handle *xgs);
 int osdep_gntshr_close(xengntshr_handle *xgs);
 
@@ -39,11 +39,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <xenctrl.h>
 #include <xenstore.h>
 #include <xen/sys/evtchn.h>
 #include <xen/sys/gntalloc.h>
 #include <xen/sys/gntdev.h>
-#include <libxenvchan.h>
+#include "libxenvchan_private.h"
 
 #ifndef PAGE_SHIFT
 #define PAGE_SHIFT 12
@@ -61,22 +62,155 @@
 #define MAX_LARGE_RING (1 << LARGE_RING_SHIFT)
 #define LARGE_RING_OFFSET 2048
 
-// if you go over this size, you'll have too many grants to fit in the shared page.
-#define MAX_RING_SHIFT 20
+/*
+ * Rings up to this size list their grants in the shared page.  Larger ones
+ * list there the grants of pages which list their grants, as otherwise
+ * there would be too many to fit.
+ */
+#define MAX_DIRECT_RING_SHIFT 20
+#define MAX_RING_SHIFT 26
 #define MAX_RING_SIZE (1 << MAX_RING_SHIFT)
 
+#define GRANTS_PER_PAGE (PAGE_SIZE / sizeof(uint32_t))
+
 #ifndef offsetof
 #define offsetof(TYPE, MEMBER) ((size_t) &((TYPE *)0)->MEMBER)
 #endif
 
 #define max(a,b) ((a > b) ? a : b)
 
-static int init_gnt_srv(struct libxenvchan *ctrl, int domain)
+/* Pages of a ring, 0 if it is within the shared page */
+static int ring_pages(int order)
+{
+	return order >= PAGE_SHIFT ? 1 << (order - PAGE_SHIFT) : 0;
+}
+
+/* Pages listing the grants of a ring, 0 if they are in the shared page */
+static int ring_dir_pages(int order)
+{
+	if (order <= MAX_DIRECT_RING_SHIFT)
+		return 0;
+	return (ring_pages(order) + GRANTS_PER_PAGE - 1) / GRANTS_PER_PAGE;
+}
+
+/* Entries of vchan_interface.grants used by a ring */
+static int ring_grant_slots(int order)
+{
+	return ring_dir_pages(order) ?: ring_pages(order);
+}
+
+/* Share the buffer of a ring of more than a page, and list its grants. */
+static void *share_ring(struct libxenvchan *ctrl, int domain,
+                        struct libxenvchan_ring *r, uint32_t *grants,
+                        int writable)
+{
+	int dir_pages = ring_dir_pages(r->order);
+	void *buffer;
+
+	if (dir_pages) {
+		r->grant_dir = xengntshr_share_pages(ctrl->gntshr, domain,
+			dir_pages, grants, 0);
+		if (!r->grant_dir)
+			return NULL;
+		grants = r->grant_dir;
+	}
+
+	buffer = xengntshr_share_pages(ctrl->gntshr, domain,
+		ring_pages(r->order), grants, writable);
+	if (!buffer && dir_pages) {
+		xengntshr_unshare(ctrl->gntshr, r->grant_dir, dir_pages);
+		r->grant_dir = NULL;
+	}
+	return buffer;
+}
+
+/* Map the buffer of a ring of more than a page from the grants listed. */
+static void *map_ring(struct libxenvchan *ctrl, int domain,
+                      struct libxenvchan_ring *r, uint32_t *grants, int prot)
+{
+	int pages = ring_pages(r->order), dir_pages = ring_dir_pages(r->order);
+	uint32_t *copy = NULL;
+	void *buffer, *dir;
+
+	if (dir_pages) {
+		dir = xengnttab_map_domain_grant_refs(ctrl->gnttab, dir_pages,
+			domain, grants, PROT_READ);
+		if (!dir)
+			return NULL;
+		/* Take a copy, as the peer can change the list under us. */
+		copy = malloc(pages * sizeof(*copy));
+		if (copy)
+			memcpy(copy, dir, pages * sizeof(*copy));
+		xengnttab_unmap(ctrl->gnttab, dir, dir_pages);
+		if (!copy)
+			return NULL;
+		grants = copy;
+	}
+
+	buffer = xengnttab_map_domain_grant_refs(ctrl->gnttab, pages,
+		domain, grants, prot);
+	free(copy);
+	return buffer;
+}
+
+void vchan_unmap_ring(struct libxenvchan *ctrl, struct libxenvchan_ring *r)
 {
-	int pages_left = ctrl->read.order >= PAGE_SHIFT ? 1 << (ctrl->read.order - PAGE_SHIFT) : 0;
-	int pages_right = ctrl->write.order >= PAGE_SHIFT ? 1 << (ctrl->write.order - PAGE_SHIFT) : 0;
+	if (r->order < PAGE_SHIFT)
+		return;
+	if (ctrl->is_server) {
+		xengntshr_unshare(ctrl->gntshr, r->buffer, ring_pages(r->order));
+		if (r->grant_dir)
+			xengntshr_unshare(ctrl->gntshr, r->grant_dir,
+			                  ring_dir_pages(r->order));
+	} else {
+		xengnttab_unmap(ctrl->gnttab, r->buffer, ring_pages(r->order));
+	}
+	r->order = 0;
+	r->grant_dir = NULL;
+}
+
+static int min_order(size_t siz)
+{
+	int rv = PAGE_SHIFT;
+	while (siz > (1 << rv))
+		rv++;
+	return rv;
+}
+
+static void choose_orders(size_t left_min, size_t right_min,
+                          int *left_order, int *right_order)
+{
+	*left_order = min_order(left_min);
+	*right_order = min_order(right_min);
+
+	// if we can avoid allocating extra pages by using in-page rings, do so
+	if (left_min <= MAX_SMALL_RING && right_min <= MAX_LARGE_RING) {
+		*left_order = SMALL_RING_SHIFT;
+		*right_order = LARGE_RING_SHIFT;
+	} else if (left_min <= MAX_LARGE_RING && right_min <= MAX_SMALL_RING) {
+		*left_order = LARGE_RING_SHIFT;
+		*right_order = SMALL_RING_SHIFT;
+	} else if (left_min <= MAX_LARGE_RING) {
+		*left_order = LARGE_RING_SHIFT;
+	} else if (right_min <= MAX_LARGE_RING) {
+		*right_order = LARGE_RING_SHIFT;
+	}
+}
+
+/*
+ * Share a ring page, and rings of the orders already in $read and $write,
+ * for the server.  Returns the grant of the ring page, or -1.
+ */
+static int share_rings(struct libxenvchan *ctrl, int domain,
+                       struct vchan_interface **ringp,
+                       struct libxenvchan_ring *read,
+                       struct libxenvchan_ring *write)
+{
+	int slots_left = ring_grant_slots(read->order);
 	uint32_t ring_ref = -1;
-	void *ring;
+	struct vchan_interface *ring;
+
+	read->grant_dir = write->grant_dir = NULL;
 
 	ring = xengntshr_share_page_notify(ctrl->gntshr, domain,
 			&ring_ref, 1, offsetof(struct vchan_interface, srv_live),
@@ -87,131 +221,137 @@ static int init_gnt_srv(struct libxenvchan *ctrl, int domain)
 
 	memset(ring, 0, PAGE_SIZE);
 
-	ctrl->ring = ring;
-	ctrl->read.shr = &ctrl->ring->left;
-	ctrl->write.shr = &ctrl->ring->right;
-	ctrl->ring->left_order = ctrl->read.order;
-	ctrl->ring->right_order = ctrl->write.order;
-	ctrl->ring->cli_live = 2;
-	ctrl->ring->srv_live = 1;
-	ctrl->ring->cli_notify = VCHAN_NOTIFY_WRITE;
-
-	switch (ctrl->read.order) {
+	read->shr = &ring->left;
+	write->shr = &ring->right;
+	ring->left_order = read->order;
+	ring->right_order = write->order;
+	ring->cli_live = 2;
+	ring->srv_live = 1;
+	ring->cli_notify = VCHAN_NOTIFY_WRITE;
+
+	switch (read->order) {
 	case SMALL_RING_SHIFT:
-		ctrl->read.buffer = ((void*)ctrl->ring) + SMALL_RING_OFFSET;
+		read->buffer = ((void*)ring) + SMALL_RING_OFFSET;
 		break;
 	case LARGE_RING_SHIFT:
-		ctrl->read.buffer = ((void*)ctrl->ring) + LARGE_RING_OFFSET;
+		read->buffer = ((void*)ring) + LARGE_RING_OFFSET;
 		break;
 	default:
-		ctrl->read.buffer = xengntshr_share_pages(ctrl->gntshr, domain,
-			pages_left, ctrl->ring->grants, 1);
-		if (!ctrl->read.buffer)
+		read->buffer = share_ring(ctrl, domain, read, ring->grants, 1);
+		if (!read->buffer)
 			goto out_ring;
 	}
 
-	switch (ctrl->write.order) {
+	switch (write->order) {
 	case SMALL_RING_SHIFT:
-		ctrl->write.buffer = ((void*)ctrl->ring) + SMALL_RING_OFFSET;
+		write->buffer = ((void*)ring) + SMALL_RING_OFFSET;
 		break;
 	case LARGE_RING_SHIFT:
-		ctrl->write.buffer = ((void*)ctrl->ring) + LARGE_RING_OFFSET;
+		write->buffer = ((void*)ring) + LARGE_RING_OFFSET;
 		break;
 	default:
-		ctrl->write.buffer = xengntshr_share_pages(ctrl->gntshr, domain,
-			pages_right, ctrl->ring->grants + pages_left, 1);
-		if (!ctrl->write.buffer)
+		write->buffer = share_ring(ctrl, domain, write,
+			ring->grants + slots_left, 1);
+		if (!write->buffer)
 			goto out_unmap_left;
 	}
 
+	*ringp = ring;
 out:
 	return ring_ref;
 out_unmap_left:
-	if (pages_left)
-		xengntshr_unshare(ctrl->gntshr, ctrl->read.buffer, pages_left);
+	vchan_unmap_ring(ctrl, read);
 out_ring:
 	xengntshr_unshare(ctrl->gntshr, ring, 1);
 	ring_ref = -1;
-	ctrl->ring = NULL;
-	ctrl->write.order = ctrl->read.order = 0;
+	write->order = read->order = 0;
 	goto out;
 }
 
-static int init_gnt_cli(struct libxenvchan *ctrl, int domain, uint32_t ring_ref)
+static int init_gnt_srv(struct libxenvchan *ctrl, int domain)
+{
+	return share_rings(ctrl, domain, &ctrl->ring, &ctrl->read, &ctrl->write);
+}
+
+/* Map a ring page and its rings, for the client. */
+static int map_rings(struct libxenvchan *ctrl, int domain, uint32_t ring_ref,
+                     struct vchan_interface **ringp,
+                     struct libxenvchan_ring *read,
+                     struct libxenvchan_ring *write)
 {
 	int rv = -1;
 	uint32_t *grants;
+	struct vchan_interface *ring;
+
+	read->grant_dir = write->grant_dir = NULL;
 
-	ctrl->ring = xengnttab_map_grant_ref_notify(ctrl->gnttab,
+	ring = xengnttab_map_grant_ref_notify(ctrl->gnttab,
 		domain, ring_ref, PROT_READ|PROT_WRITE,
 		offsetof(struct vchan_interface, cli_live), ctrl->event_port);
 
-	if (!ctrl->ring)
+	if (!ring)
 		goto out;
 
-	ctrl->write.order = ctrl->ring->left_order;
-	ctrl->read.order = ctrl->ring->right_order;
-	ctrl->write.shr = &ctrl->ring->left;
-	ctrl->read.shr = &ctrl->ring->right;
-	if (ctrl->write.order < SMALL_RING_SHIFT || ctrl->write.order > MAX_RING_SHIFT)
+	write->order = ring->left_order;
+	read->order = ring->right_order;
+	write->shr = &ring->left;
+	read->shr = &ring->right;
+	if (write->order < SMALL_RING_SHIFT || write->order > MAX_RING_SHIFT)
 		goto out_unmap_ring;
-	if (ctrl->read.order < SMALL_RING_SHIFT || ctrl->read.order > MAX_RING_SHIFT)
+	if (read->order < SMALL_RING_SHIFT || read->order > MAX_RING_SHIFT)
 		goto out_unmap_ring;
-	if (ctrl->read.order == ctrl->write.order && ctrl->read.order < PAGE_SHIFT)
+	if (read->order == write->order && read->order < PAGE_SHIFT)
 		goto out_unmap_ring;
 
-	grants = ctrl->ring->grants;
+	grants = ring->grants;
 
-	switch (ctrl->write.order) {
+	switch (write->order) {
 	case SMALL_RING_SHIFT:
-		ctrl->write.buffer = ((void*)ctrl->ring) + SMALL_RING_OFFSET;
+		write->buffer = ((void*)ring) + SMALL_RING_OFFSET;
 		break;
 	case LARGE_RING_SHIFT:
-		ctrl->write.buffer = ((void*)ctrl->ring) + LARGE_RING_OFFSET;
+		write->buffer = ((void*)ring) + LARGE_RING_OFFSET;
 		break;
 	default:
-		{
-			int pages_left = 1 << (ctrl->write.order - PAGE_SHIFT);
-			ctrl->write.buffer = xengnttab_map_domain_grant_refs(ctrl->gnttab,
-				pages_left, domain, grants, PROT_READ|PROT_WRITE);
-			if (!ctrl->write.buffer)
-				goto out_unmap_ring;
-			grants += pages_left;
-		}
+		write->buffer = map_ring(ctrl, domain, write, grants,
+			PROT_READ|PROT_WRITE);
+		if (!write->buffer)
+			goto out_unmap_ring;
+		grants += ring_grant_slots(write->order);
 	}
 
-	switch (ctrl->read.order) {
+	switch (read->order) {
 	case SMALL_RING_SHIFT:
-		ctrl->read.buffer = ((void*)ctrl->ring) + SMALL_RING_OFFSET;
+		read->buffer = ((void*)ring) + SMALL_RING_OFFSET;
 		break;
 	case LARGE_RING_SHIFT:
-		ctrl->read.buffer = ((void*)ctrl->ring) + LARGE_RING_OFFSET;
+		read->buffer = ((void*)ring) + LARGE_RING_OFFSET;
 		break;
 	default:
-		{
-			int pages_right = 1 << (ctrl->read.order - PAGE_SHIFT);
-			ctrl->read.buffer = xengnttab_map_domain_grant_refs(ctrl->gnttab,
-				pages_right, domain, grants, PROT_READ);
-			if (!ctrl->read.buffer)
-				goto out_unmap_left;
-		}
+		read->buffer = map_ring(ctrl, domain, read, grants, PROT_READ);
+		if (!read->buffer)
+			goto out_unmap_left;
 	}
 
+	*ringp = ring;
 	rv = 0;
  out:
 	return rv;
  out_unmap_left:
-	if (ctrl->write.order >= PAGE_SHIFT)
-		xengnttab_unmap(ctrl->gnttab, ctrl->write.buffer,
-		                1 << (ctrl->write.order - PAGE_SHIFT));
+	vchan_unmap_ring(ctrl, write);
  out_unmap_ring:
-	xengnttab_unmap(ctrl->gnttab, ctrl->ring, 1);
-	ctrl->ring = 0;
-	ctrl->write.order = ctrl->read.order = 0;
+	xengnttab_unmap(ctrl->gnttab, ring, 1);
+	write->order = read->order = 0;
 	rv = -1;
 	goto out;
 }
 
+static int init_gnt_cli(struct libxenvchan *ctrl, int domain, uint32_t ring_ref)
+{
+	return map_rings(ctrl, domain, ring_ref, &ctrl->ring,
+	                 &ctrl->read, &ctrl->write);
+}
+
 static int init_evt_srv(struct libxenvchan *ctrl, int domain,
                         struct xentoollog_logger *logger)
 {
@@ -286,14 +426,6 @@ static int init_xs_srv(struct libxenvchan *ctrl, int domain, const char* xs_base
 	return ret;
 }
 
-static int min_order(size_t siz)
-{
-	int rv = PAGE_SHIFT;
-	while (siz > (1 << rv))
-		rv++;
-	return rv;
-}
-
 struct libxenvchan *libxenvchan_server_init(struct xentoollog_logger *logger,
                                             int domain, const char* xs_path,
                                             size_t left_min, size_t right_min)
@@ -309,24 +441,22 @@ struct libxenvchan *libxenvchan_server_init(struct xentoollog_logger *logger,
 
 	ctrl->ring = NULL;
 	ctrl->event = NULL;
+	ctrl->gntshr = NULL;
 	ctrl->is_server = 1;
 	ctrl->server_persist = 0;
-
-	ctrl->read.order = min_order(left_min);
-	ctrl->write.order = min_order(right_min);
-
-	// if we can avoid allocating extra pages by using in-page rings, do so
-	if (left_min <= MAX_SMALL_RING && right_min <= MAX_LARGE_RING) {
-		ctrl->read.order = SMALL_RING_SHIFT;
-		ctrl->write.order = LARGE_RING_SHIFT;
-	} else if (left_min <= MAX_LARGE_RING && right_min <= MAX_SMALL_RING) {
-		ctrl->read.order = LARGE_RING_SHIFT;
-		ctrl->write.order = SMALL_RING_SHIFT;
-	} else if (left_min <= MAX_LARGE_RING) {
-		ctrl->read.order = LARGE_RING_SHIFT;
-	} else if (right_min <= MAX_LARGE_RING) {
-		ctrl->write.order = LARGE_RING_SHIFT;
-	}
+	ctrl->notify_batch = 0;
+	ctrl->notify_pending = 0;
+	ctrl->unnotified = 0;
+	ctrl->read.grant_dir = ctrl->write.grant_dir = NULL;
+	ctrl->domain = domain;
+	ctrl->xs_path = strdup(xs_path);
+	ctrl->old_ring = NULL;
+	ctrl->resizable = 0;
+
+	choose_orders(left_min, right_min, &ctrl->read.order, &ctrl->write.order);
+
+	if (!ctrl->xs_path)
+		goto out;
 
 	ctrl->gntshr = xengntshr_open(logger, 0);
 	if (!ctrl->gntshr)
@@ -393,6 +523,17 @@ struct libxenvchan *libxenvchan_client_init(struct xentoollog_logger *logger,
 	ctrl->gnttab = NULL;
 	ctrl->write.order = ctrl->read.order = 0;
 	ctrl->is_server = 0;
+	ctrl->notify_batch = 0;
+	ctrl->notify_pending = 0;
+	ctrl->unnotified = 0;
+	ctrl->read.grant_dir = ctrl->write.grant_dir = NULL;
+	ctrl->domain = domain;
+	ctrl->xs_path = strdup(xs_path);
+	ctrl->old_ring = NULL;
+	ctrl->resizable = 1;
+
+	if (!ctrl->xs_path)
+		goto fail;
 
 	xs = xs_daemon_open();
 	if (!xs)
@@ -431,7 +572,7 @@ struct libxenvchan *libxenvchan_client_init(struct xentoollog_logger *logger,
 		goto fail;
 
 	ctrl->ring->cli_live = 1;
-	ctrl->ring->srv_notify = VCHAN_NOTIFY_WRITE;
+	ctrl->ring->srv_notify = VCHAN_NOTIFY_WRITE | VCHAN_NOTIFY_RESIZE;
 
  out:
 	if (xs)
@@ -442,3 +583,116 @@ struct libxenvchan *libxenvchan_client_init(struct xentoollog_logger *logger,
 	ctrl = NULL;
 	goto out;
 }
+
+int libxenvchan_server_resize(struct libxenvchan *ctrl,
+                              size_t read_min, size_t write_min)
+{
+	struct vchan_interface *ring, *old = ctrl->ring;
+	struct libxenvchan_ring read, write;
+	int ring_ref;
+
+	if (!ctrl->is_server || ctrl->old_ring || old->cli_live != 1 ||
+	    !(old->srv_notify & VCHAN_NOTIFY_RESIZE))
+		return -1;
+	if (read_min > MAX_RING_SIZE || write_min > MAX_RING_SIZE)
+		return -1;
+
+	choose_orders(read_min, write_min, &read.order, &write.order);
+	ring_ref = share_rings(ctrl, ctrl->domain, &ring, &read, &write);
+	if (ring_ref < 0)
+		return -1;
+	if (init_xs_srv(ctrl, ctrl->domain, ctrl->xs_path, ring_ref)) {
+		vchan_unmap_ring(ctrl, &read);
+		vchan_unmap_ring(ctrl, &write);
+		xengntshr_unshare(ctrl->gntshr, ring, 1);
+		return -1;
+	}
+
+	/* Keep reading the old ring until the client has left it. */
+	ctrl->old_ring = old;
+	ctrl->old_write = ctrl->write;
+	ctrl->next_read = read;
+	ctrl->write = write;
+	ctrl->ring = ring;
+	/* Be told of anything the client sends before it moves... */
+	__sync_or_and_fetch(&old->cli_notify, VCHAN_NOTIFY_WRITE);
+	/* ...and tell it of anything sent after. */
+	ring->srv_notify = VCHAN_NOTIFY_WRITE | VCHAN_NOTIFY_READ;
+	xen_mb(); /* new ring-ref and ring /before/ the move is seen */
+	old->srv_live = VCHAN_LIVE_MOVED;
+
+	return xenevtchn_notify(ctrl->event, ctrl->event_port);
+}
+
+int vchan_client_move(struct libxenvchan *ctrl)
+{
+	struct vchan_interface *ring, *old = ctrl->ring;
+	struct libxenvchan_ring read, write;
+	struct xs_handle *xs;
+	char buf[64];
+	char *ref;
+	unsigned int len;
+	int ring_ref, rc;
+
+	xs = xs_daemon_open();
+	if (!xs)
+		xs = xs_domain_open();
+	if (!xs)
+		return -1;
+	snprintf(buf, sizeof buf, "%s/ring-ref", ctrl->xs_path);
+	ref = xs_read(xs, 0, buf, &len);
+	xs_daemon_close(xs);
+	if (!ref)
+		return -1;
+	ring_ref = atoi(ref);
+	free(ref);
+
+	if (!ring_ref || map_rings(ctrl, ctrl->domain, ring_ref,
+	                           &ring, &read, &write))
+		return -1;
+
+	/* Read what the server sent before it moved first. */
+	ctrl->old_ring = old;
+	ctrl->old_write = ctrl->write;
+	ctrl->next_read = read;
+	ctrl->write = write;
+	ctrl->ring = ring;
+	ring->cli_live = 1;
+	__sync_or_and_fetch(&ring->srv_notify, VCHAN_NOTIFY_WRITE |
+	                    VCHAN_NOTIFY_READ | VCHAN_NOTIFY_RESIZE);
+	xen_mb(); /* connected, and done with the old ring, /before/ saying so */
+	old->cli_live = VCHAN_LIVE_MOVED;
+
+	rc = xenevtchn_notify(ctrl->event, ctrl->event_port);
+
+	vchan_finish_move(ctrl);
+	return rc;
+}
+
+void vchan_finish_move(struct libxenvchan *ctrl)
+{
+	struct vchan_interface *old = ctrl->old_ring;
+	uint8_t *peer_live = ctrl->is_server ? &old->cli_live : &old->srv_live;
+
+	/* The peer may still be writing to the old ring, unless it has left. */
+	if (*peer_live == 1)
+		return;
+	xen_mb(); /* see the peer leave /before/ checking for its last data */
+	if (ctrl->read.shr->prod != ctrl->read.shr->cons)
+		return;
+
+	vchan_unmap_ring(ctrl, &ctrl->read);
+	vchan_unmap_ring(ctrl, &ctrl->old_write);
+	if (ctrl->is_server)
+		xengntshr_unshare(ctrl->gntshr, old, 1);
+	else
+		xengnttab_unmap(ctrl->gnttab, old, 1);
+	ctrl->read = ctrl->next_read;
+	ctrl->old_ring = NULL;
+
+	/* A client which closed rather than moved will not connect again. */
+	if (ctrl->is_server && ctrl->ring->cli_live == 2)
+		ctrl->ring->cli_live = 0;
+	/* Batches must still fit in the rings. */
+	libxenvchan_set_notify_batch(ctrl, ctrl->notify_batch);
+}
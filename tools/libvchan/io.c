@@ -34,11 +34,12 @@
 #include <sys/uio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <xenctrl.h>
-#include <libxenvchan.h>
+#include "libxenvchan_private.h"
 
 #ifndef PAGE_SHIFT
 #define PAGE_SHIFT 12
@@ -95,21 +96,66 @@ static inline void request_notify(struct libxenvchan *ctrl, uint8_t bit)
 {
 	uint8_t *notify = ctrl->is_server ? &ctrl->ring->cli_notify : &ctrl->ring->srv_notify;
 	__sync_or_and_fetch(notify, bit);
+	/* The peer may not have moved to the new ring page yet. */
+	if (ctrl->old_ring) {
+		notify = ctrl->is_server ? &ctrl->old_ring->cli_notify :
+		                           &ctrl->old_ring->srv_notify;
+		__sync_or_and_fetch(notify, bit);
+	}
 	xen_mb(); /* post the request /before/ caller re-reads any indexes */
 }
 
-static inline int send_notify(struct libxenvchan *ctrl, uint8_t bit)
+static inline int raw_notify(struct libxenvchan *ctrl, uint8_t bits)
 {
 	uint8_t *notify, prev;
 	xen_mb(); /* caller updates indexes /before/ we decode to notify */
 	notify = ctrl->is_server ? &ctrl->ring->srv_notify : &ctrl->ring->cli_notify;
-	prev = __sync_fetch_and_and(notify, ~bit);
-	if (prev & bit)
+	prev = __sync_fetch_and_and(notify, ~bits);
+	if (ctrl->old_ring) {
+		notify = ctrl->is_server ? &ctrl->old_ring->srv_notify :
+		                           &ctrl->old_ring->cli_notify;
+		prev |= __sync_fetch_and_and(notify, ~bits);
+	}
+	if (prev & bits)
 		return xenevtchn_notify(ctrl->event, ctrl->event_port);
 	else
 		return 0;
 }
 
+int libxenvchan_flush(struct libxenvchan *ctrl)
+{
+	uint8_t bits = ctrl->notify_pending;
+
+	ctrl->notify_pending = 0;
+	ctrl->unnotified = 0;
+	if (bits && raw_notify(ctrl, bits))
+		return -1;
+	return 0;
+}
+
+/* Notify the peer of $size bytes sent or consumed, unless batching. */
+static inline int send_notify(struct libxenvchan *ctrl, uint8_t bit,
+                              size_t size)
+{
+	if (!ctrl->notify_batch)
+		return raw_notify(ctrl, bit);
+	ctrl->notify_pending |= bit;
+	ctrl->unnotified += size;
+	if (ctrl->unnotified < ctrl->notify_batch)
+		return 0;
+	return libxenvchan_flush(ctrl);
+}
+
+void libxenvchan_set_notify_batch(struct libxenvchan *ctrl, size_t bytes)
+{
+	size_t max = rd_ring_size(ctrl) < wr_ring_size(ctrl) ?
+		rd_ring_size(ctrl) / 2 : wr_ring_size(ctrl) / 2;
+
+	ctrl->notify_batch = bytes < max ? bytes : max;
+	if (!ctrl->notify_batch)
+		libxenvchan_flush(ctrl);
+}
+
 /*
  * Get the amount of buffer space available, and do nothing about
  * notifications.
@@ -130,7 +176,10 @@ static inline int raw_get_data_ready(struct libxenvchan *ctrl)
  */
 static inline int fast_get_data_ready(struct libxenvchan *ctrl, size_t request)
 {
-	int ready = raw_get_data_ready(ctrl);
+	int ready;
+
+	vchan_update_rings(ctrl);
+	ready = raw_get_data_ready(ctrl);
 	if (ready >= request)
 		return ready;
 	/* We plan to consume all data; please tell us if you send more */
@@ -148,6 +197,7 @@ int libxenvchan_data_ready(struct libxenvchan *ctrl)
 	/* Since this value is being used outside libxenvchan, request notification
 	 * when it changes
 	 */
+	vchan_update_rings(ctrl);
 	request_notify(ctrl, VCHAN_NOTIFY_WRITE);
 	return raw_get_data_ready(ctrl);
 }
@@ -172,7 +222,10 @@ static inline int raw_get_buffer_space(struct libxenvchan *ctrl)
  */
 static inline int fast_get_buffer_space(struct libxenvchan *ctrl, size_t request)
 {
-	int ready = raw_get_buffer_space(ctrl);
+	int ready;
+
+	vchan_update_rings(ctrl);
+	ready = raw_get_buffer_space(ctrl);
 	if (ready >= request)
 		return ready;
 	/* We plan to fill the buffer; please tell us when you've read it */
@@ -190,41 +243,84 @@ int libxenvchan_buffer_space(struct libxenvchan *ctrl)
 	/* Since this value is being used outside libxenvchan, request notification
 	 * when it changes
 	 */
+	vchan_update_rings(ctrl);
 	request_notify(ctrl, VCHAN_NOTIFY_READ);
 	return raw_get_buffer_space(ctrl);
 }
 
 int libxenvchan_wait(struct libxenvchan *ctrl)
 {
-	int ret = xenevtchn_pending(ctrl->event);
+	int ret;
+
+	/* The peer may be waiting on us in turn. */
+	if (libxenvchan_flush(ctrl))
+		return -1;
+
+	ret = xenevtchn_pending(ctrl->event);
 	if (ret < 0)
 		return -1;
 	xenevtchn_unmask(ctrl->event, ret);
 	return 0;
 }
 
-/**
- * returns -1 on error, or size on success
- *
- * caller must have checked that enough space is available
- */
-static int do_send(struct libxenvchan *ctrl, const void *data, size_t size)
+/* Copy data into the ring, $off bytes past the producer index. */
+static void ring_write(struct libxenvchan *ctrl, size_t off,
+                       const void *data, size_t size)
 {
-	int real_idx = wr_prod(ctrl) & (wr_ring_size(ctrl) - 1);
+	int real_idx = (wr_prod(ctrl) + off) & (wr_ring_size(ctrl) - 1);
 	int avail_contig = wr_ring_size(ctrl) - real_idx;
 	if (avail_contig > size)
 		avail_contig = size;
-	xen_mb(); /* read indexes /then/ write data */
 	memcpy(wr_ring(ctrl) + real_idx, data, avail_contig);
 	if (avail_contig < size)
 	{
 		// we rolled across the end of the ring
 		memcpy(wr_ring(ctrl), data + avail_contig, size - avail_contig);
 	}
+}
+
+/**
+ * returns -1 on error, or size on success
+ *
+ * caller must have checked that enough space is available
+ */
+static int do_sendv(struct libxenvchan *ctrl, const struct iovec *iov,
+                    int iovcnt, size_t size)
+{
+	size_t off = 0;
+	int i;
+	xen_mb(); /* read indexes /then/ write data */
+	for (i = 0; i < iovcnt; i++) {
+		ring_write(ctrl, off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
 	xen_wmb(); /* write data /then/ notify */
 	wr_prod(ctrl) += size;
-	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE))
+	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE, size))
+		return -1;
+	return size;
+}
+
+static int do_send(struct libxenvchan *ctrl, const void *data, size_t size)
+{
+	struct iovec iov = { (void *)data, size };
+
+	return do_sendv(ctrl, &iov, 1, size);
+}
+
+/* Total size of an iovec array, or -1 if it is too big to return. */
+static int iov_size(const struct iovec *iov, int iovcnt)
+{
+	size_t size = 0;
+	int i;
+
+	if (iovcnt < 0)
 		return -1;
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > INT_MAX - size)
+			return -1;
+		size += iov[i].iov_len;
+	}
 	return size;
 }
 
@@ -249,6 +345,58 @@ int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size)
 	}
 }
 
+int libxenvchan_sendv(struct libxenvchan *ctrl, const struct iovec *iov,
+                      int iovcnt)
+{
+	int avail, size = iov_size(iov, iovcnt);
+	if (size < 0)
+		return -1;
+	while (1) {
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		avail = fast_get_buffer_space(ctrl, size);
+		if (size <= avail)
+			return do_sendv(ctrl, iov, iovcnt, size);
+		if (!ctrl->blocking)
+			return 0;
+		if (size > wr_ring_size(ctrl))
+			return -1;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+}
+
+void *libxenvchan_send_reserve(struct libxenvchan *ctrl, size_t *size)
+{
+	int real_idx, avail;
+
+	*size = 0;
+	if (!libxenvchan_is_open(ctrl))
+		return NULL;
+	avail = fast_get_buffer_space(ctrl, 1);
+	if (!avail)
+		return NULL;
+	real_idx = wr_prod(ctrl) & (wr_ring_size(ctrl) - 1);
+	if (avail > wr_ring_size(ctrl) - real_idx)
+		avail = wr_ring_size(ctrl) - real_idx;
+	xen_mb(); /* read indexes /then/ write data */
+	*size = avail;
+	return wr_ring(ctrl) + real_idx;
+}
+
+int libxenvchan_send_commit(struct libxenvchan *ctrl, size_t size)
+{
+	int real_idx = wr_prod(ctrl) & (wr_ring_size(ctrl) - 1);
+	if (size > raw_get_buffer_space(ctrl) ||
+	    size > wr_ring_size(ctrl) - real_idx)
+		return -1;
+	xen_wmb(); /* write data /then/ notify */
+	wr_prod(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE, size))
+		return -1;
+	return size;
+}
+
 int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
 {
 	int avail;
@@ -279,31 +427,51 @@ int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
 	}
 }
 
-/**
- * returns -1 on error, or size on success
- *
- * caller must have checked that enough data is available
- */
-static int do_recv(struct libxenvchan *ctrl, void *data, size_t size)
+/* Copy data out of the ring, $off bytes past the consumer index. */
+static void ring_read(struct libxenvchan *ctrl, size_t off,
+                      void *data, size_t size)
 {
-	int real_idx = rd_cons(ctrl) & (rd_ring_size(ctrl) - 1);
+	int real_idx = (rd_cons(ctrl) + off) & (rd_ring_size(ctrl) - 1);
 	int avail_contig = rd_ring_size(ctrl) - real_idx;
 	if (avail_contig > size)
 		avail_contig = size;
-	xen_rmb(); /* data read must happen /after/ rd_cons read */
 	memcpy(data, rd_ring(ctrl) + real_idx, avail_contig);
 	if (avail_contig < size)
 	{
 		// we rolled across the end of the ring
 		memcpy(data + avail_contig, rd_ring(ctrl), size - avail_contig);
 	}
+}
+
+/**
+ * returns -1 on error, or size on success
+ *
+ * caller must have checked that enough data is available
+ */
+static int do_recvv(struct libxenvchan *ctrl, const struct iovec *iov,
+                    int iovcnt, size_t size)
+{
+	size_t off = 0;
+	int i;
+	xen_rmb(); /* data read must happen /after/ rd_cons read */
+	for (i = 0; i < iovcnt; i++) {
+		ring_read(ctrl, off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
 	xen_mb(); /* consume /then/ notify */
 	rd_cons(ctrl) += size;
-	if (send_notify(ctrl, VCHAN_NOTIFY_READ))
+	if (send_notify(ctrl, VCHAN_NOTIFY_READ, size))
 		return -1;
 	return size;
 }
 
+static int do_recv(struct libxenvchan *ctrl, void *data, size_t size)
+{
+	struct iovec iov = { data, size };
+
+	return do_recvv(ctrl, &iov, 1, size);
+}
+
 /**
  * reads exactly size bytes from the vchan.
  * returns 0 if insufficient data is available, -1 on error, or size on success
@@ -325,6 +493,53 @@ int libxenvchan_recv(struct libxenvchan *ctrl, void *data, size_t size)
 	}
 }
 
+int libxenvchan_recvv(struct libxenvchan *ctrl, const struct iovec *iov,
+                      int iovcnt)
+{
+	int size = iov_size(iov, iovcnt);
+	if (size < 0)
+		return -1;
+	while (1) {
+		int avail = fast_get_data_ready(ctrl, size);
+		if (size <= avail)
+			return do_recvv(ctrl, iov, iovcnt, size);
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		if (!ctrl->blocking)
+			return 0;
+		if (size > rd_ring_size(ctrl))
+			return -1;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+}
+
+const void *libxenvchan_recv_peek(struct libxenvchan *ctrl, size_t *size)
+{
+	int real_idx, avail = fast_get_data_ready(ctrl, 1);
+
+	*size = 0;
+	if (!avail)
+		return NULL;
+	real_idx = rd_cons(ctrl) & (rd_ring_size(ctrl) - 1);
+	if (avail > rd_ring_size(ctrl) - real_idx)
+		avail = rd_ring_size(ctrl) - real_idx;
+	xen_rmb(); /* data read must happen /after/ rd_cons read */
+	*size = avail;
+	return rd_ring(ctrl) + real_idx;
+}
+
+int libxenvchan_recv_consume(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_data_ready(ctrl))
+		return -1;
+	xen_mb(); /* consume /then/ notify */
+	rd_cons(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_READ, size))
+		return -1;
+	return size;
+}
+
 int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 {
 	while (1) {
@@ -344,6 +559,7 @@ int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 
 int libxenvchan_is_open(struct libxenvchan* ctrl)
 {
+	vchan_update_rings(ctrl);
 	if (ctrl->is_server)
 		return ctrl->server_persist ? 1 : ctrl->ring->cli_live;
 	else
@@ -359,10 +575,22 @@ void libxenvchan_close(struct libxenvchan *ctrl)
 {
 	if (!ctrl)
 		return;
-	if (ctrl->read.order >= PAGE_SHIFT)
-		munmap(ctrl->read.buffer, 1 << ctrl->read.order);
-	if (ctrl->write.order >= PAGE_SHIFT)
-		munmap(ctrl->write.buffer, 1 << ctrl->write.order);
+	if (ctrl->old_ring) {
+		vchan_unmap_ring(ctrl, &ctrl->read);
+		vchan_unmap_ring(ctrl, &ctrl->old_write);
+		ctrl->read = ctrl->next_read;
+		if (ctrl->is_server) {
+			ctrl->old_ring->srv_live = 0;
+			xengntshr_unshare(ctrl->gntshr, ctrl->old_ring, 1);
+		} else {
+			ctrl->old_ring->cli_live = 0;
+			xengnttab_unmap(ctrl->gnttab, ctrl->old_ring, 1);
+		}
+	}
+	if (ctrl->ring) {
+		vchan_unmap_ring(ctrl, &ctrl->read);
+		vchan_unmap_ring(ctrl, &ctrl->write);
+	}
 	if (ctrl->ring) {
 		if (ctrl->is_server) {
 			ctrl->ring->srv_live = 0;
@@ -384,5 +612,6 @@ void libxenvchan_close(struct libxenvchan *ctrl)
 		if (ctrl->gnttab)
 			xengnttab_close(ctrl->gnttab);
 	}
+	free(ctrl->xs_path);
 	free(ctrl);
 }
@@ -42,6 +42,7 @@
  *  compile time, so the macros in ring.h cannot be used to access the rings.
  */
 
+#include <sys/uio.h>
 #include <xen/io/libxenvchan.h>
 #include <xen/sys/evtchn.h>
 #include <xenevtchn.h>
@@ -61,6 +62,8 @@ struct libxenvchan_ring {
 	 * in the shared page to remain constant.
 	 */
 	int order;
+	/* Pages listing the grants of a ring over 1M (server only) */
+	void *grant_dir;
 };
 
 /**
@@ -85,6 +88,27 @@ struct libxenvchan {
 	int blocking:1;
 	/* communication rings */
 	struct libxenvchan_ring read, write;
+	/*
+	 * Notifications of the peer are deferred until this many bytes have
+	 * been sent or consumed (0: never deferred); see
+	 * libxenvchan_set_notify_batch().
+	 */
+	uint32_t notify_batch;
+	/* VCHAN_NOTIFY_* bits deferred, and the bytes they cover */
+	uint8_t notify_pending;
+	uint32_t unnotified;
+	/* The peer, and where the ring page is advertised */
+	int domain;
+	char *xs_path;
+	/* client: true if following the server to a new ring page */
+	int resizable;
+	/*
+	 * While moving to a new ring page: the old one, with its write ring,
+	 * and the new read ring, used once the old one (still in $read) has
+	 * been drained.
+	 */
+	struct vchan_interface *old_ring;
+	struct libxenvchan_ring old_write, next_read;
 };
 
 /**
@@ -99,6 +123,24 @@ struct libxenvchan {
 struct libxenvchan *libxenvchan_server_init(struct xentoollog_logger *logger,
                                             int domain, const char* xs_path,
                                             size_t read_min, size_t write_min);
+/**
+ * Move a connected vchan to new rings of (at least) the given sizes, e.g. to
+ * grow them for a bulk transfer.  Data already sent in either direction is
+ * still delivered, in order; the client follows during its next operation.
+ *
+ * Rings of up to 64M can be used, here and with libxenvchan_server_init,
+ * though anything over a few hundred kilobytes may need the grant limits of
+ * the gntalloc and gntdev drivers raising on Linux (their "limit" module
+ * parameters), as each page of a ring is a grant.
+ *
+ * @param ctrl The vchan control structure, for the server
+ * @param read_min The minimum size (in bytes) of the new receive ring
+ * @param write_min The minimum size (in bytes) of the new send ring
+ * @return 0 on success, -1 on error, including if the client is not
+ *  connected, does not support resizing, or a move is still in progress
+ */
+int libxenvchan_server_resize(struct libxenvchan *ctrl,
+                              size_t read_min, size_t write_min);
 /**
  * Connect to an existing vchan. Note: you can reconnect to an existing vchan
  * safely, however no locking is performed, so you must prevent multiple clients
@@ -173,3 +215,65 @@ int libxenvchan_is_open(struct libxenvchan* ctrl);
 int libxenvchan_data_ready(struct libxenvchan *ctrl);
 /** Amount of data it is possible to send without blocking */
 int libxenvchan_buffer_space(struct libxenvchan *ctrl);
+
+/**
+ * Packet-based send of the concatenation of $iovcnt buffers, as one
+ * libxenvchan_send() of their total size.
+ * @return -1 on error, 0 if nonblocking and insufficient space is available,
+ *         or the total size
+ */
+int libxenvchan_sendv(struct libxenvchan *ctrl, const struct iovec *iov,
+                      int iovcnt);
+/**
+ * Packet-based receive into $iovcnt buffers, as one libxenvchan_recv() of
+ * their total size.
+ * @return -1 on error, 0 if nonblocking and insufficient data is available,
+ *         or the total size
+ */
+int libxenvchan_recvv(struct libxenvchan *ctrl, const struct iovec *iov,
+                      int iovcnt);
+
+/**
+ * Zero-copy send: get the free space at the head of the send ring, for the
+ * caller to write into, then publish what was written with
+ * libxenvchan_send_commit().  Space wraps at the end of the ring, so there
+ * may be more free space than one reservation returns.
+ * @param size Set to the contiguous free space, which may be 0
+ * @return Where to write, or NULL if there is no space or the vchan is closed
+ */
+void *libxenvchan_send_reserve(struct libxenvchan *ctrl, size_t *size);
+/**
+ * Publish $size bytes written at the last libxenvchan_send_reserve().
+ * @return -1 on error, or $size
+ */
+int libxenvchan_send_commit(struct libxenvchan *ctrl, size_t size);
+/**
+ * Zero-copy receive: get the data at the tail of the receive ring, then
+ * release what was used of it with libxenvchan_recv_consume().
+ * @param size Set to the contiguous data ready, which may be 0
+ * @return The data, or NULL if there is none
+ */
+const void *libxenvchan_recv_peek(struct libxenvchan *ctrl, size_t *size);
+/**
+ * Release $size bytes of the data from the last libxenvchan_recv_peek().
+ * @return -1 on error, or $size
+ */
+int libxenvchan_recv_consume(struct libxenvchan *ctrl, size_t size);
+
+/**
+ * Batch notifications of the peer: rather than an event for every send or
+ * receive the peer is waiting on, send one once $bytes have been sent or
+ * consumed since the last, capped at half the smaller ring so that the
+ * peer is kicked well before the ring fills or drains.  0, the default,
+ * notifies at once.
+ *
+ * Deferred notifications are sent by libxenvchan_flush(), and before the
+ * library blocks in libxenvchan_wait().  Callers which wait for the vchan
+ * themselves, through libxenvchan_fd_for_select(), must flush first.
+ */
+void libxenvchan_set_notify_batch(struct libxenvchan *ctrl, size_t bytes);
+/**
+ * Send any notifications deferred by libxenvchan_set_notify_batch().
+ * @return -1 on error, 0 on success
+ */
+int libxenvchan_flush(struct libxenvchan *ctrl);
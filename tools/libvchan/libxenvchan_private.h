@@ -0,0 +1,46 @@
+/**
+ * @file
+ * @section LICENSE
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ *  Internals shared between init.c and io.c.
+ */
+
+#ifndef LIBXENVCHAN_PRIVATE_H
+#define LIBXENVCHAN_PRIVATE_H
+
+#include <libxenvchan.h>
+
+/* Release a ring of more than a page, if it is one. */
+void vchan_unmap_ring(struct libxenvchan *ctrl, struct libxenvchan_ring *r);
+
+/* Client: follow the server to the ring page now in ring-ref. */
+int vchan_client_move(struct libxenvchan *ctrl);
+
+/* Release the old ring page, if it has been drained and left by the peer. */
+void vchan_finish_move(struct libxenvchan *ctrl);
+
+/* Make progress with any move to a new ring page, before using the rings. */
+static inline void vchan_update_rings(struct libxenvchan *ctrl)
+{
+	if (ctrl->old_ring)
+		vchan_finish_move(ctrl);
+	else if (ctrl->resizable && ctrl->ring->srv_live == VCHAN_LIVE_MOVED)
+		vchan_client_move(ctrl);
+}
+
+#endif /* LIBXENVCHAN_PRIVATE_H */
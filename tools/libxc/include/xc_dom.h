@@ -209,16 +209,33 @@ struct xc_dom_image {
     /* If unset disables the setup of the IOREQ pages. */
     bool device_model;
 
+    /*
+     * The domain was soft reset to be booted again in the memory it has,
+     * so only fill in, or give back, what differs from a fresh layout.
+     */
+    bool keep_memory;
+
     /* BIOS/Firmware passed to HVMLOADER */
     struct xc_hvm_firmware_module system_firmware_module;
 
-    /* Extra ACPI tables passed to HVMLOADER */
+    /*
+     * Extra ACPI tables passed to HVMLOADER, or without a device model the
+     * complete table set, including the RSDP, see XC_DOM_HVM_ACPI_START.
+     */
     struct xc_hvm_firmware_module acpi_module;
 
     /* Extra SMBIOS structures passed to HVMLOADER */
     struct xc_hvm_firmware_module smbios_module;
 };
 
+/*
+ * Without a device model there is no firmware to build ACPI tables, and
+ * acpi_module is copied as is into the legacy BIOS area, where guests also
+ * look for the RSDP.  The tables must therefore be linked to run there.
+ */
+#define XC_DOM_HVM_ACPI_START   0xe0000
+#define XC_DOM_HVM_ACPI_END     0x100000
+
 /* --- pluggable kernel loader ------------------------------------- */
 
 struct xc_dom_loader {
@@ -301,6 +318,12 @@ int xc_dom_do_gunzip(xc_interface *xch,
                      void *src, size_t srclen, void *dst, size_t dstlen);
 int xc_dom_try_gunzip(struct xc_dom_image *dom, void **blob, size_t * size);
 
+/* Run @decode on *blob, or use a cached result of doing so before. */
+typedef int xc_dom_decompress_fn(struct xc_dom_image *dom,
+                                 void **blob, size_t *size);
+int xc_dom_decompress_cached(struct xc_dom_image *dom, void **blob,
+                             size_t *size, xc_dom_decompress_fn *decode);
+
 int xc_dom_kernel_file(struct xc_dom_image *dom, const char *filename);
 int xc_dom_ramdisk_file(struct xc_dom_image *dom, const char *filename);
 int xc_dom_kernel_mem(struct xc_dom_image *dom, const void *mem,
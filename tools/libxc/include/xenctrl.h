@@ -820,6 +820,15 @@ int xc_domain_hvm_getcontext(xc_interface *xch,
                              uint8_t *ctxt_buf,
                              uint32_t size);
 
+/**
+ * As xc_domain_hvm_getcontext(), but saving straight into a hypercall
+ * buffer, which spares bouncing a possibly large context.
+ */
+int xc_domain_hvm_getcontext_buffer(xc_interface *xch,
+                                    uint32_t domid,
+                                    xc_hypercall_buffer_t *ctxt_buf,
+                                    uint32_t size);
+
 
 /**
  * This function returns one element of the context of a hvm domain
@@ -885,6 +894,27 @@ int xc_vcpu_getinfo(xc_interface *xch,
                     uint32_t vcpu,
                     xc_vcpuinfo_t *info);
 
+/**
+ * This function returns information about the vCPUs of multiple domains
+ * with a single hypercall, for as many whole domains from @first_domain on
+ * as fit in @info.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm first_domain the first domain to enumerate the vCPUs of
+ * @parm max_vcpus the number of elements in @info
+ * @parm info an array of max_vcpus size that will contain the information
+ *            for the enumerated vCPUs
+ * @parm next_domain the first domain not enumerated, or DOMID_INVALID
+ * @return the number of vCPUs enumerated or -1 on error (ENOBUFS if @info
+ *         is too small for the vCPUs of even one domain)
+ */
+typedef xen_sysctl_vcpuinfo_t xc_vcpuinfolist_t;
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t first_domain,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfolist_t *info,
+                        uint32_t *next_domain);
+
 long long xc_domain_get_cpu_usage(xc_interface *xch,
                                   domid_t domid,
                                   int vcpu);
@@ -1042,6 +1072,7 @@ typedef struct xc_cpupoolinfo {
     uint32_t cpupool_id;
     uint32_t sched_id;
     uint32_t n_dom;
+    uint32_t profile;
     xc_cpumap_t cpumap;
 } xc_cpupoolinfo_t;
 
@@ -1121,6 +1152,35 @@ int xc_cpupool_movedomain(xc_interface *xch,
                           uint32_t poolid,
                           uint32_t domid);
 
+/**
+ * Move several domains to another cpupool at once.
+ *
+ * @parm xc_handle a handle to an open hypervisor interface
+ * @parm poolid id of the destination cpupool
+ * @parm domids ids of the domains to move
+ * @parm nr_doms number of entries in domids
+ * @parm nr_moved number of domains moved, on failure the index of the
+ *       domain which couldn't be moved (may be NULL)
+ * return 0 on success, -1 on failure
+ */
+int xc_cpupool_movedomains(xc_interface *xch,
+                           uint32_t poolid,
+                           const uint32_t *domids,
+                           uint32_t nr_doms,
+                           uint32_t *nr_moved);
+
+/**
+ * Apply a scheduler tuning profile to a cpupool.
+ *
+ * @parm xc_handle a handle to an open hypervisor interface
+ * @parm poolid id of the cpupool
+ * @parm profile XEN_SYSCTL_CPUPOOL_PROFILE_*
+ * return 0 on success, -1 on failure
+ */
+int xc_cpupool_set_profile(xc_interface *xch,
+                           uint32_t poolid,
+                           uint32_t profile);
+
 /**
  * Return map of cpus not in any cpupool.
  *
@@ -1247,8 +1307,52 @@ int xc_domain_getvnuma(xc_interface *xch,
                        unsigned int *vdistance,
                        unsigned int *vcpu_to_vnode);
 
+/*
+ * Soft reset a domain which has shut down.  flags is a mask of
+ * XEN_DOMCTL_SOFT_RESET_*.
+ */
 int xc_domain_soft_reset(xc_interface *xch,
-                         uint32_t domid);
+                         uint32_t domid,
+                         uint32_t flags);
+
+/**
+ * This function moves the memory of a domain onto a NUMA node.
+ *
+ * Guest frames [start_gfn, start_gfn + nr_gfns) which are not already on
+ * @node get a copy allocated there and are remapped.  Frames with extra
+ * references (grant mappings, foreign mappings, ...) are left in place and
+ * counted in @nr_busy, so the caller may retry them later.  Only domains
+ * using HAP are supported.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id whose memory is to be moved
+ * @parm node the destination NUMA node
+ * @parm start_gfn the first guest frame to consider
+ * @parm nr_gfns the number of guest frames to consider
+ * @parm nr_migrated if not NULL, the number of frames moved
+ * @parm nr_busy if not NULL, the number of frames left in place
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_numa_migrate(xc_interface *xch,
+                           uint32_t domid,
+                           unsigned int node,
+                           xen_pfn_t start_gfn,
+                           xen_pfn_t nr_gfns,
+                           uint64_t *nr_migrated,
+                           uint64_t *nr_busy);
+
+/**
+ * This function grows the grant table of a domain ahead of time, so that
+ * the guest does not have to grow it while under load.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id whose grant table is to be grown
+ * @parm nr_frames the number of grant table frames to provide at least
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_set_grant_frames(xc_interface *xch,
+                               uint32_t domid,
+                               uint32_t nr_frames);
 
 #if defined(__i386__) || defined(__x86_64__)
 /*
@@ -1415,6 +1519,18 @@ int xc_perfc_query_number(xc_interface *xch,
 int xc_perfc_query(xc_interface *xch,
                    xc_hypercall_buffer_t *desc,
                    xc_hypercall_buffer_t *val);
+/*
+ * Per-domain counters, kept when Xen is booted with "perfc_domain": single
+ * counters have a value per vCPU, arrays are summed over the vCPUs.
+ */
+int xc_perfc_query_domain_number(xc_interface *xch,
+                                 uint32_t domid,
+                                 int *nbr_desc,
+                                 int *nbr_val);
+int xc_perfc_query_domain(xc_interface *xch,
+                          uint32_t domid,
+                          xc_hypercall_buffer_t *desc,
+                          xc_hypercall_buffer_t *val);
 
 typedef xen_sysctl_lockprof_data_t xc_lockprof_data_t;
 int xc_lockprof_reset(xc_interface *xch);
@@ -1425,6 +1541,76 @@ int xc_lockprof_query(xc_interface *xch,
                       uint64_t *time,
                       xc_hypercall_buffer_t *data);
 
+/* Sampled lock contention profiling: a @rate of 0 stops sampling. */
+typedef xen_sysctl_locksample_data_t xc_locksample_data_t;
+int xc_locksample_start(xc_interface *xch, uint32_t rate);
+int xc_locksample_reset(xc_interface *xch);
+int xc_locksample_query_number(xc_interface *xch,
+                               uint32_t *n_elems);
+int xc_locksample_query(xc_interface *xch,
+                        uint32_t *n_elems,
+                        uint32_t *rate,
+                        uint64_t *dropped,
+                        xc_hypercall_buffer_t *data);
+
+/*
+ * Latency histograms of type XEN_SYSCTL_LATHIST_*: on entry to
+ * xc_lathist_query() *nr_hists is the number of histograms (each of
+ * XEN_SYSCTL_LATHIST_BUCKETS uint64_t counts) @buckets has room for, on
+ * return the number available.
+ */
+int xc_lathist_reset(xc_interface *xch);
+int xc_lathist_query_number(xc_interface *xch,
+                            uint32_t type,
+                            uint32_t *nr_hists);
+int xc_lathist_query(xc_interface *xch,
+                     uint32_t type,
+                     uint32_t *nr_hists,
+                     xc_hypercall_buffer_t *buckets);
+
+/*
+ * Host PMU sampling: on entry to xc_pmusample_read() *nr_recs is the number
+ * of records @recs has room for, on return the number consumed from @cpu's
+ * ring.  A @domid of DOMID_INVALID samples Xen only.
+ */
+typedef xen_sysctl_pmusample_rec_t xc_pmusample_rec_t;
+int xc_pmusample_start(xc_interface *xch, uint32_t event, uint32_t period,
+                       uint32_t domid);
+int xc_pmusample_stop(xc_interface *xch);
+int xc_pmusample_read(xc_interface *xch,
+                      uint32_t cpu,
+                      uint32_t *nr_recs,
+                      uint64_t *lost,
+                      xc_hypercall_buffer_t *recs);
+
+/*
+ * Read hypervisor symbol *symnum, which is updated to the next one; it is
+ * left unchanged past the last symbol.
+ */
+int xc_xensyms_read(xc_interface *xch, uint32_t *symnum, char *type,
+                    uint64_t *address, char *name, uint32_t namelen);
+
+/*
+ * Map the read-only per-vCPU runstate statistics pages ("vcpustats=" on the
+ * Xen command line), returning the array of *nr_slots slots.  Use
+ * xc_vcpustats_read() to take a consistent copy of a slot: it returns 0 if
+ * the slot is in use, and -1 if it is free.
+ */
+typedef xen_vcpustats_t xc_vcpustats_t;
+const xc_vcpustats_t *xc_vcpustats_map(xc_interface *xch,
+                                       unsigned int *nr_slots);
+void xc_vcpustats_unmap(const xc_vcpustats_t *slots, unsigned int nr_slots);
+int xc_vcpustats_read(const xc_vcpustats_t *slot, xc_vcpustats_t *copy);
+
+/*
+ * NUMA balancing statistics of a domain ("p2m_numa_balance_ms=" on the Xen
+ * command line): on entry info->nr_nodes is the number of entries @samples
+ * (which may be NULL) has room for, on return the number of nodes.
+ */
+typedef xen_sysctl_numa_locality_t xc_numa_locality_t;
+int xc_numa_locality(xc_interface *xch, uint32_t domid,
+                     xc_numa_locality_t *info, uint64_t *samples);
+
 void *xc_memalign(xc_interface *xch, size_t alignment, size_t size);
 
 /**
@@ -1484,6 +1670,22 @@ long xc_get_tot_pages(xc_interface *xch, uint32_t domid);
 int xc_availheap(xc_interface *xch, int min_width, int max_width, int node,
                  uint64_t *bytes);
 
+/**
+ * This function retrieves the statistics of Xen's small object allocator,
+ * its size classes followed by the typed caches of subsystems.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm max_caches the number of elements in @info
+ * @parm info an array of max_caches size for the entries
+ * @parm pool_used, pool_total bytes of the underlying pool (or NULL)
+ * @return the number of entries there are (possibly more than max_caches),
+ *         or -1 on error
+ */
+typedef xen_sysctl_xmem_cache_t xc_xmem_cache_t;
+int xc_xmem_cacheinfo(xc_interface *xch, unsigned int max_caches,
+                      xc_xmem_cache_t *info, uint64_t *pool_used,
+                      uint64_t *pool_total);
+
 /*
  * Trace Buffer Operations
  */
@@ -1738,6 +1940,23 @@ int xc_hvm_set_ioreq_server_state(xc_interface *xch,
                                   ioservid_t id,
                                   int enabled);
 
+/**
+ * This function enables an IOREQ Server and sets whether its emulator is
+ * busy-polling for requests.  While polling, Xen does not signal the
+ * server's event channels for new requests.  Turning polling off makes Xen
+ * signal all of them once.
+ *
+ * @parm xch a handle to an open hypervisor interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm polling whether the emulator polls.
+ * @return 0 on success, -1 on failure.
+ */
+int xc_hvm_set_ioreq_server_polling(xc_interface *xch,
+                                    domid_t domid,
+                                    ioservid_t id,
+                                    int polling);
+
 /**
  * This function registers a range of memory or I/O ports for emulation.
  *
@@ -1756,6 +1975,28 @@ int xc_hvm_map_io_range_to_ioreq_server(xc_interface *xch,
                                         uint64_t start,
                                         uint64_t end);
 
+/**
+ * This function registers a range of memory or I/O ports for emulation,
+ * allowing writes to it to be posted to the buffered ioreq ring rather
+ * than waiting for the emulator.  The emulator must drain the buffered
+ * ring before handling each synchronous request.  The range is
+ * deregistered with xc_hvm_unmap_io_range_from_ioreq_server().
+ *
+ * @parm xch a handle to an open hypervisor interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm is_mmio is this a range of ports or memory
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xc_hvm_map_posted_io_range_to_ioreq_server(xc_interface *xch,
+                                               domid_t domid,
+                                               ioservid_t id,
+                                               int is_mmio,
+                                               uint64_t start,
+                                               uint64_t end);
+
 /**
  * This function deregisters a range of memory or I/O ports for emulation.
  *
@@ -2131,6 +2372,15 @@ int xc_set_mem_access(xc_interface *xch, domid_t domain_id,
 int xc_get_mem_access(xc_interface *xch, domid_t domain_id,
                       uint64_t pfn, xenmem_access_t *access);
 
+/*
+ * Install a table of nr filter entries, evaluated by the hypervisor before
+ * a mem_access violation is sent to the monitor ring (see
+ * XENMEM_access_op_set_filter).  nr == 0 removes the table.
+ */
+int xc_set_mem_access_filter(xc_interface *xch, domid_t domain_id,
+                             xen_mem_access_filter_t *filter,
+                             uint32_t nr);
+
 /***
  * Monitor control operations.
  *
@@ -2142,6 +2392,24 @@ int xc_get_mem_access(xc_interface *xch, domid_t domain_id,
  * Caller has to unmap this page when done.
  */
 void *xc_monitor_enable(xc_interface *xch, domid_t domain_id, uint32_t *port);
+/*
+ * Like xc_monitor_enable(), but with a ring spanning nr_frames pages
+ * (at most XEN_VM_EVENT_MAX_RING_FRAMES).
+ *
+ * With XEN_VM_EVENT_FLAG_PER_VCPU in flags, every vCPU gets its own ring
+ * and event channel.  ports must then have one entry per vCPU, and
+ * receives the event channel of each vCPU's ring.  The rings follow each
+ * other in the returned mapping, vCPU i's one starting at page
+ * i * nr_frames.  Requests from foreign domains arrive on vCPU 0's ring.
+ *
+ * Every ring must be initialised with SHARED_RING_INIT() and
+ * BACK_RING_INIT(..., nr_frames * XC_PAGE_SIZE) by the caller.  Caller has
+ * to unmap nr_frames pages per ring when done.
+ */
+void *xc_monitor_enable_rings(xc_interface *xch, domid_t domain_id,
+                              unsigned int nr_frames, unsigned int flags,
+                              uint32_t *port, uint32_t *ports,
+                              unsigned int nr_ports);
 int xc_monitor_disable(xc_interface *xch, domid_t domain_id);
 int xc_monitor_resume(xc_interface *xch, domid_t domain_id);
 /*
@@ -2180,6 +2448,18 @@ int xc_monitor_cpuid(xc_interface *xch, domid_t domain_id, bool enable);
 int xc_monitor_emulate_each_rep(xc_interface *xch, domid_t domain_id,
                                 bool enable);
 
+/**
+ * This function selects the events delivered record-only: posted to the
+ * ring without pausing the vCPU, and dropped when the ring is full.
+ *
+ * @parm xch a handle to an open hypervisor interface.
+ * @parm domain_id the domain id of the monitored domain.
+ * @parm events bitmap of (1 << XEN_DOMCTL_MONITOR_EVENT_*), 0 for none.
+ * @return 0 on success, -1 on failure.
+ */
+int xc_monitor_record_only(xc_interface *xch, domid_t domain_id,
+                           uint32_t events);
+
 /***
  * Memory sharing operations.
  *
@@ -2349,6 +2629,25 @@ int xc_memshr_range_share(xc_interface *xch,
                           uint64_t first_gfn,
                           uint64_t last_gfn);
 
+/* Makes the child domain a copy-on-write clone of the parent domain: all of
+ * the parent's memory is shared with the child, and its vCPU state, HVM
+ * context and HVM parameters are copied over.  Sharing is enabled on both
+ * domains.
+ *
+ * The parent must be paused for the duration of the call, and may be
+ * unpaused afterwards.  The child must have been created paused, with the
+ * same number of vCPUs as the parent and with no memory; it is left paused.
+ * Event channels, xenstore and device models are up to the caller.
+ *
+ * May fail with EINVAL if the domains do not match those requirements,
+ * EBUSY if the parent has paged out pages, and ENOMEM if there isn't enough
+ * memory for the pages which could not be shared or for the sharing
+ * metadata.  The child should be destroyed on failure.
+ */
+int xc_memshr_fork(xc_interface *xch,
+                   domid_t parent_domain,
+                   domid_t child_domain);
+
 /* Debug calls: return the number of pages referencing the shared frame backing
  * the input argument. Should be one or greater. 
  *
@@ -2493,6 +2792,13 @@ int xc_compression_compress_pages(xc_interface *xch, comp_ctx *ctx,
  */
 void xc_compression_reset_pagebuf(xc_interface *xch, comp_ctx *ctx);
 
+/**
+ * Drops the cached copy of a page, for pages which reach the receiver by
+ * other means (e.g. as zero pages), so that the next copy is sent in full.
+ */
+void xc_compression_invalidate_page(xc_interface *xch, comp_ctx *ctx,
+				    unsigned long pfn);
+
 /**
  * Caller must supply the compression buffer (compbuf),
  * its size (compbuf_size) and a reference to index variable (compbuf_pos)
@@ -2585,6 +2891,7 @@ enum xc_psr_cat_type {
     XC_PSR_CAT_L3_CBM      = 1,
     XC_PSR_CAT_L3_CBM_CODE = 2,
     XC_PSR_CAT_L3_CBM_DATA = 3,
+    XC_PSR_CAT_MBA_THRTL   = 4,
 };
 typedef enum xc_psr_cat_type xc_psr_cat_type;
 
@@ -2601,6 +2908,14 @@ int xc_psr_cmt_get_l3_cache_size(xc_interface *xch, uint32_t cpu,
 int xc_psr_cmt_get_data(xc_interface *xch, uint32_t rmid, uint32_t cpu,
                         uint32_t psr_cmt_type, uint64_t *monitor_data,
                         uint64_t *tsc);
+/*
+ * Memory traffic of a monitored domain as accounted by Xen: bytes since
+ * monitoring started and bytes/s over the last sampling period, in total
+ * and to local memory.
+ */
+int xc_psr_cmt_get_domain_mbm(xc_interface *xch, uint32_t domid,
+                              uint64_t *total, uint64_t *local,
+                              uint64_t *bw_total, uint64_t *bw_local);
 int xc_psr_cmt_enabled(xc_interface *xch);
 
 int xc_psr_cat_set_domain_data(xc_interface *xch, uint32_t domid,
@@ -2612,6 +2927,19 @@ int xc_psr_cat_get_domain_data(xc_interface *xch, uint32_t domid,
 int xc_psr_cat_get_l3_info(xc_interface *xch, uint32_t socket,
                            uint32_t *cos_max, uint32_t *cbm_len,
                            bool *cdp_enabled);
+int xc_psr_mba_get_info(xc_interface *xch, uint32_t socket,
+                        uint32_t *cos_max, uint32_t *thrtl_max,
+                        bool *linear);
+
+/*
+ * Hand the CBMs and MBA throttling of a domain over to Xen's cache
+ * controller (XEN_DOMCTL_PSR_CLASS_*).  @share is the target share of the
+ * L3, in percent, for XEN_DOMCTL_PSR_CLASS_LATENCY and must be 0 otherwise.
+ */
+int xc_psr_set_domain_class(xc_interface *xch, uint32_t domid,
+                            uint32_t class, uint32_t share);
+int xc_psr_get_domain_class(xc_interface *xch, uint32_t domid,
+                            uint32_t *class, uint32_t *share);
 
 int xc_get_cpu_levelling_caps(xc_interface *xch, uint32_t *caps);
 int xc_get_cpu_featureset(xc_interface *xch, uint32_t index,
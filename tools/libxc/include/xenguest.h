@@ -29,6 +29,8 @@
 #define XCFLAGS_HVM       (1 << 2)
 #define XCFLAGS_STDVGA    (1 << 3)
 #define XCFLAGS_CHECKPOINT_COMPRESS    (1 << 4)
+#define XCFLAGS_STREAM_COMPRESS        (1 << 5)
+#define XCFLAGS_POSTCOPY               (1 << 6)
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -39,6 +41,11 @@
  */
 struct xenevtchn_handle;
 
+/* Decisions of a precopy policy. */
+#define XGS_POLICY_ABORT            (-1)
+#define XGS_POLICY_CONTINUE_PRECOPY   0
+#define XGS_POLICY_STOP_AND_COPY      1
+
 /* callbacks provided by xc_domain_save */
 struct save_callbacks {
     /* Called after expiration of checkpoint interval,
@@ -80,6 +87,21 @@ struct save_callbacks {
     /* Enable qemu-dm logging dirty pages to xen */
     int (*switch_qemu_logdirty)(int domid, unsigned enable, void *data); /* HVM only */
 
+    /*
+     * Called after each iteration of a live migration with statistics
+     * about it: the number of pages dirtied during the iteration, the rate
+     * at which pages were dirtied and sent (in pages per second), and the
+     * predicted downtime in milliseconds if the guest were suspended now.
+     * decision is that of the built-in policy.
+     *
+     * Returns an XGS_POLICY_* value, which replaces the built-in decision.
+     * Optional.
+     */
+    int (*precopy_policy)(unsigned iteration, unsigned long dirty_count,
+                          unsigned long dirty_rate, unsigned long bandwidth,
+                          unsigned long downtime_ms, int decision,
+                          void *data);
+
     /* to be provided as the last argument to each callback function */
     void* data;
 };
@@ -98,6 +120,8 @@ typedef enum {
  * @parm dom the id of the domain
  * @param stream_type XC_MIG_STREAM_NONE if the far end of the stream
  *        doesn't use checkpointing
+ * @param recv_fd the back channel from the far end, for COLO or, with
+ *        XCFLAGS_POSTCOPY, a post-copy live migration
  * @return 0 on success, -1 on failure
  */
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
@@ -141,6 +165,19 @@ struct restore_callbacks {
     void (*restore_results)(xen_pfn_t store_gfn, xen_pfn_t console_gfn,
                             void *data);
 
+    /*
+     * Called, in a post-copy migration, once all of the domain's state
+     * but the contents of some of its memory has been restored, after
+     * restore_results.  Callback function resumes the guest & the device
+     * model, returns to xc_domain_restore, which then fetches the rest of
+     * memory as the guest touches it.
+     *
+     * returns:
+     * 0: failure, the migration is aborted
+     * 1: success
+     */
+    int (*postcopy_transition)(void *data);
+
     /* to be provided as the last argument to each callback function */
     void* data;
 };
@@ -285,7 +285,7 @@ void invalidate_cache_page(comp_ctx *ctx, xen_pfn_t pfn)
 int xc_compression_add_page(xc_interface *xch, comp_ctx *ctx,
                             char *page, xen_pfn_t pfn, int israw)
 {
-    if (pfn > ctx->dom_pfnlist_size)
+    if (pfn >= ctx->dom_pfnlist_size)
     {
         ERROR("Invalid pfn passed into "
               "xc_compression_add_page %" PRIpfn "\n", pfn);
@@ -360,6 +360,13 @@ void xc_compression_reset_pagebuf(xc_interface *xch, comp_ctx *ctx)
     ctx->pfns_index = ctx->pfns_len = 0;
 }
 
+void xc_compression_invalidate_page(xc_interface *xch, comp_ctx *ctx,
+                                    xen_pfn_t pfn)
+{
+    if (pfn < ctx->dom_pfnlist_size)
+        invalidate_cache_page(ctx, pfn);
+}
+
 int xc_compression_uncompress_page(xc_interface *xch, char *compbuf,
                                    unsigned long compbuf_size,
                                    unsigned long *compbuf_pos, char *destpage)
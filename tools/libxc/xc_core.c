@@ -416,6 +416,67 @@ elfnote_dump_format_version(xc_interface *xch,
     return dump_rtn(xch, args, (char*)&format_version, sizeof(format_version));
 }
 
+/* Guest frames queued for mapping in one go, and where they go. */
+struct dump_batch {
+    xen_pfn_t *gmfns;
+    uint64_t *pfns;
+    int *errs;
+    unsigned int nr;
+};
+
+/*
+ * Map the frames of the batch, copy those which could be mapped to the
+ * dump buffer, recording them in the p2m or pfn table from index *j on, and
+ * write the buffer out.  Frames which can't be mapped are left out, as a
+ * batch may well span ballooned out or otherwise absent frames.
+ */
+static int dump_batch_flush(xc_interface *xch, uint32_t domid,
+                            struct dump_batch *batch,
+                            int auto_translated_physmap,
+                            struct xen_dumpcore_p2m *p2m_array,
+                            uint64_t *pfn_array, unsigned long *j,
+                            char *dump_mem, void *args,
+                            dumpcore_rtn_t dump_rtn)
+{
+    unsigned int k, nr = 0;
+    char *vaddr;
+    int sts = 0;
+
+    if ( batch->nr == 0 )
+        return 0;
+
+    vaddr = xenforeignmemory_map(xch->fmem, domid, PROT_READ, batch->nr,
+                                 batch->gmfns, batch->errs);
+    if ( vaddr != NULL )
+    {
+        for ( k = 0; k < batch->nr; k++ )
+        {
+            if ( batch->errs[k] )
+                continue;
+
+            memcpy(dump_mem + nr * PAGE_SIZE, vaddr + k * PAGE_SIZE,
+                   PAGE_SIZE);
+            if ( !auto_translated_physmap )
+            {
+                p2m_array[*j].pfn = batch->pfns[k];
+                p2m_array[*j].gmfn = batch->gmfns[k];
+            }
+            else
+                pfn_array[*j] = batch->pfns[k];
+            (*j)++;
+            nr++;
+        }
+        xenforeignmemory_unmap(xch->fmem, vaddr, batch->nr);
+    }
+
+    batch->nr = 0;
+
+    if ( nr )
+        sts = dump_rtn(xch, args, dump_mem, nr * PAGE_SIZE);
+
+    return sts;
+}
+
 int
 xc_domain_dumpcore_via_callback(xc_interface *xch,
                                 uint32_t domid,
@@ -428,7 +489,8 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     struct domain_info_context *dinfo = &_dinfo;
 
     int nr_vcpus = 0;
-    char *dump_mem, *dump_mem_start = NULL;
+    char *dump_mem_start = NULL;
+    struct dump_batch batch = { 0 };
     vcpu_guest_context_any_t *ctxt = NULL;
     struct xc_core_arch_context arch_ctxt;
     char dummy[PAGE_SIZE];
@@ -471,6 +533,14 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         PERROR("Could not allocate dump_mem");
         goto out;
     }
+    batch.gmfns = malloc(DUMP_INCREMENT * sizeof(*batch.gmfns));
+    batch.pfns = malloc(DUMP_INCREMENT * sizeof(*batch.pfns));
+    batch.errs = malloc(DUMP_INCREMENT * sizeof(*batch.errs));
+    if ( !batch.gmfns || !batch.pfns || !batch.errs )
+    {
+        PERROR("Could not allocate dump batch");
+        goto out;
+    }
 
     if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 )
     {
@@ -777,7 +847,6 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
 
     /* dump pages: .xen_pages */
     j = 0;
-    dump_mem = dump_mem_start;
     for ( map_idx = 0; map_idx < nr_memory_map; map_idx++ )
     {
         uint64_t pfn_start;
@@ -788,8 +857,18 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         for ( i = pfn_start; i < pfn_end; i++ )
         {
             uint64_t gmfn;
-            void *vaddr;
-            
+
+            if ( j + batch.nr >= nr_pages )
+            {
+                /* Some of the queued frames may fail to map. */
+                sts = dump_batch_flush(xch, domid, &batch,
+                                       auto_translated_physmap, p2m_array,
+                                       pfn_array, &j, dump_mem_start,
+                                       args, dump_rtn);
+                if ( sts != 0 )
+                    goto out;
+            }
+
             if ( j >= nr_pages )
             {
                 /*
@@ -817,9 +896,6 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
                     if ( gmfn == (uint32_t)INVALID_PFN )
                        continue;
                 }
-
-                p2m_array[j].pfn = i;
-                p2m_array[j].gmfn = gmfn;
             }
             else
             {
@@ -827,31 +903,26 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
                     continue;
 
                 gmfn = i;
-                pfn_array[j] = i;
             }
 
-            vaddr = xc_map_foreign_range(
-                xch, domid, PAGE_SIZE, PROT_READ, gmfn);
-            if ( vaddr == NULL )
-                continue;
-            memcpy(dump_mem, vaddr, PAGE_SIZE);
-            munmap(vaddr, PAGE_SIZE);
-            dump_mem += PAGE_SIZE;
-            if ( (j + 1) % DUMP_INCREMENT == 0 )
+            batch.gmfns[batch.nr] = gmfn;
+            batch.pfns[batch.nr] = i;
+            if ( ++batch.nr == DUMP_INCREMENT )
             {
-                sts = dump_rtn(
-                    xch, args, dump_mem_start, dump_mem - dump_mem_start);
+                sts = dump_batch_flush(xch, domid, &batch,
+                                       auto_translated_physmap, p2m_array,
+                                       pfn_array, &j, dump_mem_start,
+                                       args, dump_rtn);
                 if ( sts != 0 )
                     goto out;
-                dump_mem = dump_mem_start;
             }
-
-            j++;
         }
     }
 
 copy_done:
-    sts = dump_rtn(xch, args, dump_mem_start, dump_mem - dump_mem_start);
+    sts = dump_batch_flush(xch, domid, &batch, auto_translated_physmap,
+                           p2m_array, pfn_array, &j, dump_mem_start,
+                           args, dump_rtn);
     if ( sts != 0 )
         goto out;
     if ( j < nr_pages )
@@ -909,6 +980,9 @@ out:
         free(ctxt);
     if ( dump_mem_start != NULL )
         free(dump_mem_start);
+    free(batch.gmfns);
+    free(batch.pfns);
+    free(batch.errs);
     if ( live_shinfo != NULL )
         munmap(live_shinfo, PAGE_SIZE);
     xc_core_arch_context_free(&arch_ctxt);
@@ -921,16 +995,55 @@ struct dump_args {
     int     fd;
 };
 
-/* Callback routine for writing to a local dump file. */
+static int page_is_zero(const char *page)
+{
+    const unsigned long *p = (const unsigned long *)page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i++ )
+        if ( p[i] )
+            return 0;
+
+    return 1;
+}
+
+/*
+ * Callback routine for writing to a local dump file.  Whole zero pages
+ * are seeked over, leaving holes in the file, which is truncated to its
+ * full size once the dump is complete.
+ */
 static int local_file_dump(xc_interface *xch,
                            void *args, char *buffer, unsigned int length)
 {
     struct dump_args *da = args;
+    unsigned int done = 0, len;
 
-    if ( write_exact(da->fd, buffer, length) == -1 )
+    while ( done < length )
     {
-        PERROR("Failed to write buffer");
-        return -errno;
+        for ( len = 0; length - done - len >= PAGE_SIZE &&
+                       page_is_zero(buffer + done + len); len += PAGE_SIZE )
+            ;
+        if ( len )
+        {
+            if ( lseek(da->fd, len, SEEK_CUR) == -1 )
+            {
+                PERROR("Failed to seek over zero pages");
+                return -errno;
+            }
+            done += len;
+            continue;
+        }
+
+        len = min_t(unsigned int, length - done, PAGE_SIZE);
+        while ( length - done - len >= PAGE_SIZE &&
+                !page_is_zero(buffer + done + len) )
+            len += PAGE_SIZE;
+        if ( write_exact(da->fd, buffer + done, len) == -1 )
+        {
+            PERROR("Failed to write buffer");
+            return -errno;
+        }
+        done += len;
     }
 
     if ( length >= (DUMP_INCREMENT * PAGE_SIZE) )
@@ -960,6 +1073,13 @@ xc_domain_dumpcore(xc_interface *xch,
     sts = xc_domain_dumpcore_via_callback(
         xch, domid, &da, &local_file_dump);
 
+    /* A trailing hole doesn't extend the file by itself. */
+    if ( sts == 0 && ftruncate(da.fd, lseek(da.fd, 0, SEEK_CUR)) )
+    {
+        PERROR("Could not size corefile %s", corename);
+        sts = -errno;
+    }
+
     /* flush and discard any remaining portion of the file from cache */
     discard_file_cache(xch, da.fd, 1/* flush first*/);
 
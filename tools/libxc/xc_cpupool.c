@@ -110,6 +110,7 @@ xc_cpupoolinfo_t *xc_cpupool_getinfo(xc_interface *xch,
     info->cpupool_id = sysctl.u.cpupool_op.cpupool_id;
     info->sched_id = sysctl.u.cpupool_op.sched_id;
     info->n_dom = sysctl.u.cpupool_op.n_dom;
+    info->profile = sysctl.u.cpupool_op.profile;
     memcpy(info->cpumap, local, local_size);
 
 out:
@@ -179,6 +180,57 @@ int xc_cpupool_movedomain(xc_interface *xch,
     return do_sysctl_save(xch, &sysctl);
 }
 
+int xc_cpupool_movedomains(xc_interface *xch,
+                           uint32_t poolid,
+                           const uint32_t *domids,
+                           uint32_t nr_doms,
+                           uint32_t *nr_moved)
+{
+    int err;
+    uint32_t i;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER(domid_t, local);
+
+    local = xc_hypercall_buffer_alloc(xch, local, nr_doms * sizeof(*local));
+    if ( local == NULL )
+    {
+        PERROR("Could not allocate locked memory for xc_cpupool_movedomains");
+        return -1;
+    }
+
+    for ( i = 0; i < nr_doms; i++ )
+        local[i] = domids[i];
+
+    sysctl.cmd = XEN_SYSCTL_cpupool_op;
+    sysctl.u.cpupool_op.op = XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAINS;
+    sysctl.u.cpupool_op.cpupool_id = poolid;
+    sysctl.u.cpupool_op.n_dom = nr_doms;
+    sysctl.u.cpupool_op.start = 0;
+    set_xen_guest_handle(sysctl.u.cpupool_op.domids, local);
+
+    err = do_sysctl_save(xch, &sysctl);
+
+    if ( nr_moved )
+        *nr_moved = sysctl.u.cpupool_op.start;
+
+    xc_hypercall_buffer_free(xch, local);
+
+    return err;
+}
+
+int xc_cpupool_set_profile(xc_interface *xch,
+                           uint32_t poolid,
+                           uint32_t profile)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_cpupool_op;
+    sysctl.u.cpupool_op.op = XEN_SYSCTL_CPUPOOL_OP_SETPROFILE;
+    sysctl.u.cpupool_op.cpupool_id = poolid;
+    sysctl.u.cpupool_op.profile = profile;
+    return do_sysctl_save(xch, &sysctl);
+}
+
 xc_cpumap_t xc_cpupool_freeinfo(xc_interface *xch)
 {
     int err = -1;
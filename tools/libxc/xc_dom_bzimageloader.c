@@ -34,6 +34,33 @@
 #include "xg_private.h"
 #include "xc_dom_decompress.h"
 
+/*
+ * The kernel build appends the uncompressed length of the payload to it,
+ * as a little endian 32 bit value (the gzip trailer already ends so).
+ * Use it, if plausible (at most 32 times the input), to allocate the
+ * output buffer at its final size rather than growing it by doubling,
+ * with slack for the decoder to see the end of the stream without
+ * asking for more room.
+ */
+static inline size_t decompressed_size_hint(struct xc_dom_image *dom)
+{
+    const uint8_t *p;
+    size_t sz;
+
+    if ( dom->kernel_size < 4 )
+        return dom->kernel_size;
+
+    p = (const uint8_t *)dom->kernel_blob + dom->kernel_size - 4;
+    sz = p[0] | (p[1] << 8) | (p[2] << 16) | ((size_t)p[3] << 24);
+    sz += XC_PAGE_SIZE;
+
+    if ( sz <= dom->kernel_size || sz / 32 > dom->kernel_size ||
+         (dom->max_kernel_size && sz > dom->max_kernel_size) )
+        return dom->kernel_size;
+
+    return sz;
+}
+
 #ifndef __MINIOS__
 
 #if defined(HAVE_BZLIB)
@@ -49,6 +76,7 @@ static int xc_try_bzip2_decode(
     char *tmp_buf;
     int retval = -1;
     unsigned int outsize;
+    size_t hint;
     uint64_t total;
 
     stream.bzalloc = NULL;
@@ -68,17 +96,18 @@ static int xc_try_bzip2_decode(
         return -1;
     }
 
-    /* sigh.  We don't know up-front how much memory we are going to need
-     * for the output buffer.  Allocate the output buffer to be equal
-     * the input buffer to start, and we'll realloc as needed.
+    /*
+     * The size hint may be missing or wrong, if the payload didn't come
+     * from a kernel build, so we'll still realloc as needed.
      */
-    outsize = dom->kernel_size;
+    hint = decompressed_size_hint(dom);
+    outsize = hint;
 
     /*
      * stream.avail_in and outsize are unsigned int, while kernel_size
-     * is a size_t. Check we aren't overflowing.
+     * is a size_t, no larger than hint. Check we aren't overflowing.
      */
-    if ( outsize != dom->kernel_size )
+    if ( outsize != hint )
     {
         DOMPRINTF("BZIP2: Input too large");
         goto bzip2_cleanup;
@@ -95,7 +124,7 @@ static int xc_try_bzip2_decode(
     stream.avail_in = dom->kernel_size;
 
     stream.next_out = out_buf;
-    stream.avail_out = dom->kernel_size;
+    stream.avail_out = outsize;
 
     for ( ; ; )
     {
@@ -214,11 +243,11 @@ static int _xc_try_lzma_decode(
         return -1;
     }
 
-    /* sigh.  We don't know up-front how much memory we are going to need
-     * for the output buffer.  Allocate the output buffer to be equal
-     * the input buffer to start, and we'll realloc as needed.
+    /*
+     * The size hint may be missing or wrong, if the payload didn't come
+     * from a kernel build, so we'll still realloc as needed.
      */
-    outsize = dom->kernel_size;
+    outsize = decompressed_size_hint(dom);
     out_buf = malloc(outsize);
     if ( out_buf == NULL )
     {
@@ -230,7 +259,7 @@ static int _xc_try_lzma_decode(
     stream->avail_in = dom->kernel_size;
 
     stream->next_out = out_buf;
-    stream->avail_out = dom->kernel_size;
+    stream->avail_out = outsize;
 
     for ( ; ; )
     {
@@ -704,7 +733,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
 
     if ( check_magic(dom, "\037\213", 2) )
     {
-        ret = xc_dom_try_gunzip(dom, &dom->kernel_blob, &dom->kernel_size);
+        ret = xc_dom_decompress_cached(dom, &dom->kernel_blob,
+                                       &dom->kernel_size, xc_dom_try_gunzip);
         if ( ret == -1 )
         {
             xc_dom_panic(dom->xch, XC_INVALID_KERNEL, "%s: unable to"
@@ -714,7 +744,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
     }
     else if ( check_magic(dom, "\102\132\150", 3) )
     {
-        ret = xc_try_bzip2_decode(dom, &dom->kernel_blob, &dom->kernel_size);
+        ret = xc_dom_decompress_cached(dom, &dom->kernel_blob,
+                                       &dom->kernel_size, xc_try_bzip2_decode);
         if ( ret < 0 )
         {
             xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
@@ -725,7 +756,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
     }
     else if ( check_magic(dom, "\3757zXZ", 6) )
     {
-        ret = xc_try_xz_decode(dom, &dom->kernel_blob, &dom->kernel_size);
+        ret = xc_dom_decompress_cached(dom, &dom->kernel_blob,
+                                       &dom->kernel_size, xc_try_xz_decode);
         if ( ret < 0 )
         {
             xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
@@ -736,7 +768,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
     }
     else if ( check_magic(dom, "\135\000", 2) )
     {
-        ret = xc_try_lzma_decode(dom, &dom->kernel_blob, &dom->kernel_size);
+        ret = xc_dom_decompress_cached(dom, &dom->kernel_blob,
+                                       &dom->kernel_size, xc_try_lzma_decode);
         if ( ret < 0 )
         {
             xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
@@ -747,7 +780,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
     }
     else if ( check_magic(dom, "\x89LZO", 5) )
     {
-        ret = xc_try_lzo1x_decode(dom, &dom->kernel_blob, &dom->kernel_size);
+        ret = xc_dom_decompress_cached(dom, &dom->kernel_blob,
+                                       &dom->kernel_size, xc_try_lzo1x_decode);
         if ( ret < 0 )
         {
             xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
@@ -758,7 +792,8 @@ static int xc_dom_probe_bzimage_kernel(struct xc_dom_image *dom)
     }
     else if ( check_magic(dom, "\x02\x21", 2) )
     {
-        ret = xc_try_lz4_decode(dom, &dom->kernel_blob, &dom->kernel_size);
+        ret = xc_dom_decompress_cached(dom, &dom->kernel_blob,
+                                       &dom->kernel_size, xc_try_lz4_decode);
         if ( ret < 0 )
         {
             xc_dom_panic(dom->xch, XC_INVALID_KERNEL,
@@ -417,6 +417,187 @@ int xc_dom_try_gunzip(struct xc_dom_image *dom, void **blob, size_t * size)
     return 0;
 }
 
+/* ------------------------------------------------------------------------ */
+/* cache of decompressed kernels                                            */
+
+/*
+ * Hosts often boot many guests from the same compressed kernel.  If the
+ * directory XC_DOM_DECOMPRESS_CACHE exists, each decompressed image is
+ * kept there, in a file named after a hash and the length of its
+ * compressed form, and later builds map that instead of decompressing
+ * again.  The file holds the compressed image too, which is compared
+ * in full before the cached copy is used, so a hash collision, however
+ * it is arrived at, can only cost a decompression.
+ */
+#ifdef __MINIOS__
+
+int xc_dom_decompress_cached(struct xc_dom_image *dom, void **blob,
+                             size_t *size, xc_dom_decompress_fn *decode)
+{
+    return decode(dom, blob, size);
+}
+
+#else
+
+#define XC_DOM_DECOMPRESS_CACHE XEN_RUN_DIR "/xc-dom-cache"
+#define DECOMPRESS_CACHE_MAGIC  "XCDOMDC1"
+
+struct decompress_cache_hdr {
+    char magic[8];
+    uint64_t in_size;
+    uint64_t out_offset;
+    uint64_t out_size;
+};
+
+static uint64_t decompress_cache_hash(const void *blob, size_t size)
+{
+    const unsigned char *p = blob;
+    uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+    size_t i;
+
+    for ( i = 0; i < size; i++ )
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+static void *decompress_cache_lookup(struct xc_dom_image *dom,
+                                     const char *path, const void *in,
+                                     size_t in_size, size_t *out_size)
+{
+    const struct decompress_cache_hdr *hdr;
+    struct xc_dom_mem *block;
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if ( fd == -1 )
+        return NULL;
+    if ( fstat(fd, &st) || st.st_size < sizeof(*hdr) )
+    {
+        close(fd);
+        return NULL;
+    }
+    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( ptr == MAP_FAILED )
+        return NULL;
+
+    hdr = ptr;
+    if ( memcmp(hdr->magic, DECOMPRESS_CACHE_MAGIC, sizeof(hdr->magic)) ||
+         hdr->in_size != in_size ||
+         hdr->out_offset < sizeof(*hdr) + in_size ||
+         hdr->out_offset > st.st_size ||
+         hdr->out_size > st.st_size - hdr->out_offset ||
+         xc_dom_kernel_check_size(dom, hdr->out_size) ||
+         memcmp(hdr + 1, in, in_size) )
+        goto fail;
+
+    block = malloc(sizeof(*block));
+    if ( block == NULL )
+        goto fail;
+    memset(block, 0, sizeof(*block));
+    block->ptr = ptr;
+    block->len = st.st_size;
+    block->type = XC_DOM_MEM_TYPE_MMAP;
+    block->next = dom->memblocks;
+    dom->memblocks = block;
+    dom->alloc_malloc += sizeof(*block);
+    dom->alloc_file_map += block->len;
+
+    *out_size = hdr->out_size;
+    return (char *)ptr + hdr->out_offset;
+
+ fail:
+    munmap(ptr, st.st_size);
+    return NULL;
+}
+
+static void decompress_cache_store(struct xc_dom_image *dom, const char *path,
+                                   const void *in, size_t in_size,
+                                   const void *out, size_t out_size)
+{
+    struct decompress_cache_hdr hdr;
+    char *tmp;
+    int fd;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DECOMPRESS_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.in_size = in_size;
+    /* Keep the image page aligned, as a malloc()ed one would be. */
+    hdr.out_offset = (sizeof(hdr) + in_size + XC_PAGE_SIZE - 1) &
+                     ~(uint64_t)(XC_PAGE_SIZE - 1);
+    hdr.out_size = out_size;
+
+    if ( asprintf(&tmp, "%s.XXXXXX", path) < 0 )
+        return;
+    fd = mkstemp(tmp);
+    if ( fd == -1 )
+        goto out;
+
+    if ( write_exact(fd, &hdr, sizeof(hdr)) ||
+         write_exact(fd, in, in_size) ||
+         lseek(fd, hdr.out_offset, SEEK_SET) == -1 ||
+         write_exact(fd, out, out_size) ||
+         fchmod(fd, 0644) )
+    {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    if ( close(fd) )
+    {
+        unlink(tmp);
+        goto out;
+    }
+
+    /* Last writer wins; an entry is never modified once in place. */
+    if ( rename(tmp, path) )
+        unlink(tmp);
+    else
+        DOMPRINTF("%s: cached 0x%zx -> 0x%zx as %s", __FUNCTION__,
+                  in_size, out_size, path);
+
+ out:
+    free(tmp);
+}
+
+int xc_dom_decompress_cached(struct xc_dom_image *dom, void **blob,
+                             size_t *size, xc_dom_decompress_fn *decode)
+{
+    void *in = *blob, *out;
+    size_t in_size = *size, out_size;
+    char *path;
+    int rc;
+
+    if ( access(XC_DOM_DECOMPRESS_CACHE, W_OK) )
+        return decode(dom, blob, size);
+
+    if ( asprintf(&path, XC_DOM_DECOMPRESS_CACHE "/%016"PRIx64"-%zx",
+                  decompress_cache_hash(in, in_size), in_size) < 0 )
+        return decode(dom, blob, size);
+
+    out = decompress_cache_lookup(dom, path, in, in_size, &out_size);
+    if ( out )
+    {
+        DOMPRINTF("%s: using %s", __FUNCTION__, path);
+        *blob = out;
+        *size = out_size;
+        free(path);
+        return 0;
+    }
+
+    rc = decode(dom, blob, size);
+    if ( rc >= 0 && *blob != in )
+        decompress_cache_store(dom, path, in, in_size, *blob, *size);
+
+    free(path);
+    return rc;
+}
+
+#endif /* !__MINIOS__ */
+
 /* ------------------------------------------------------------------------ */
 /* domain memory                                                            */
 
@@ -817,7 +998,8 @@ int xc_dom_kernel_file(struct xc_dom_image *dom, const char *filename)
                                              dom->max_kernel_size);
     if ( dom->kernel_blob == NULL )
         return -1;
-    return xc_dom_try_gunzip(dom, &dom->kernel_blob, &dom->kernel_size);
+    return xc_dom_decompress_cached(dom, &dom->kernel_blob, &dom->kernel_size,
+                                    xc_dom_try_gunzip);
 }
 
 int xc_dom_ramdisk_file(struct xc_dom_image *dom, const char *filename)
@@ -855,7 +1037,8 @@ int xc_dom_kernel_mem(struct xc_dom_image *dom, const void *mem, size_t memsize)
     DOMPRINTF_CALLED(dom->xch);
     dom->kernel_blob = (void *)mem;
     dom->kernel_size = memsize;
-    return xc_dom_try_gunzip(dom, &dom->kernel_blob, &dom->kernel_size);
+    return xc_dom_decompress_cached(dom, &dom->kernel_blob, &dom->kernel_size,
+                                    xc_dom_try_gunzip);
 }
 
 int xc_dom_ramdisk_mem(struct xc_dom_image *dom, const void *mem,
@@ -27,6 +27,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <xen/xen.h>
 #include <xen/foreign/x86_32.h>
@@ -48,6 +50,10 @@
 #define SUPERPAGE_1GB_SHIFT   18
 #define SUPERPAGE_1GB_NR_PFNS (1UL << SUPERPAGE_1GB_SHIFT)
 
+/* Extents per populate_physmap call when building HVM guests. */
+#define SUPERPAGE_1GB_BATCH   64
+#define SUPERPAGE_2MB_BATCH   512
+
 #define X86_CR0_PE 0x01
 #define X86_CR0_ET 0x10
 
@@ -600,8 +606,10 @@ static int alloc_magic_pages_hvm(struct xc_dom_image *dom)
     for ( i = 0; i < X86_HVM_NR_SPECIAL_PAGES; i++ )
         special_array[i] = special_pfn(i);
 
-    rc = xc_domain_populate_physmap_exact(xch, domid, X86_HVM_NR_SPECIAL_PAGES,
-                                          0, 0, special_array);
+    /* Kept memory has them already. */
+    rc = dom->keep_memory ? 0 :
+        xc_domain_populate_physmap_exact(xch, domid, X86_HVM_NR_SPECIAL_PAGES,
+                                         0, 0, special_array);
     if ( rc != 0 )
     {
         DOMPRINTF("Could not allocate special pages.");
@@ -657,8 +665,9 @@ static int alloc_magic_pages_hvm(struct xc_dom_image *dom)
         for ( i = 0; i < NR_IOREQ_SERVER_PAGES; i++ )
             ioreq_server_array[i] = ioreq_server_pfn(i);
 
-        rc = xc_domain_populate_physmap_exact(xch, domid, NR_IOREQ_SERVER_PAGES, 0,
-                                              0, ioreq_server_array);
+        rc = dom->keep_memory ? 0 :
+            xc_domain_populate_physmap_exact(xch, domid, NR_IOREQ_SERVER_PAGES,
+                                             0, 0, ioreq_server_array);
         if ( rc != 0 )
         {
             DOMPRINTF("Could not allocate ioreq server pages.");
@@ -1264,12 +1273,282 @@ static int check_mmio_hole(uint64_t start, uint64_t memsize,
         return 1;
 }
 
+struct populate_node {
+    struct xc_dom_image *dom;
+    const xen_vmemrange_t *vmemranges;
+    unsigned int nr_vmemranges;
+    unsigned int vnode;
+    unsigned int memflags;
+    unsigned long stat_normal_pages, stat_2mb_pages, stat_1gb_pages;
+    pthread_t thread;
+    int started;
+    int rc;
+};
+
+/*
+ * Populate one vmemrange, skipping VGA hole 0xA0000-0xC0000.
+ *
+ * We attempt to allocate 1GB pages if possible. It falls back on 2MB
+ * pages if 1GB allocation fails. 4KB pages will be used eventually if
+ * both fail.
+ *
+ * Xen checks for preemption between extents and continues the hypercall
+ * itself, so batches can be large without making dom0 unresponsive.
+ */
+static int populate_vmemrange(struct populate_node *node,
+                              const xen_vmemrange_t *range)
+{
+    struct xc_dom_image *dom = node->dom;
+    xc_interface *xch = dom->xch;
+    uint32_t domid = dom->guest_domid;
+    unsigned long i, cur_pages, cur_pfn;
+    uint64_t end_pages;
+    int rc = 0;
+
+    end_pages = range->end >> PAGE_SHIFT;
+    /*
+     * Consider vga hole belongs to the vmemrange that covers
+     * 0xA0000-0xC0000. Note that 0x00000-0xA0000 is populated before
+     * any vmemrange.
+     */
+    if ( range->start == 0 && dom->device_model )
+    {
+        cur_pages = 0xc0;
+        node->stat_normal_pages += 0xc0;
+    }
+    else
+        cur_pages = range->start >> PAGE_SHIFT;
+
+    while ( (rc == 0) && (end_pages > cur_pages) )
+    {
+        /* Clip count to maximum batch of 1GB extents. */
+        unsigned long count = end_pages - cur_pages;
+        unsigned long max_pages = SUPERPAGE_1GB_NR_PFNS * SUPERPAGE_1GB_BATCH;
+
+        if ( count > max_pages )
+            count = max_pages;
+
+        cur_pfn = dom->p2m_host[cur_pages];
+
+        /* Take care the corner cases of super page tails */
+        if ( ((cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
+             (count > (-cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1))) )
+            count = -cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1);
+        else if ( ((count & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
+                  (count > SUPERPAGE_1GB_NR_PFNS) )
+            count &= ~(SUPERPAGE_1GB_NR_PFNS - 1);
+
+        /*
+         * Attempt to allocate 1GB super pages.  None of them may overlap
+         * the MMIO hole, so go one at a time in the batch which does.
+         */
+        if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
+             check_mmio_hole((uint64_t)cur_pfn << PAGE_SHIFT,
+                             (uint64_t)count << PAGE_SHIFT,
+                             dom->mmio_start, dom->mmio_size) )
+            count = SUPERPAGE_1GB_NR_PFNS;
+
+        if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
+             !check_mmio_hole((uint64_t)cur_pfn << PAGE_SHIFT,
+                              (uint64_t)count << PAGE_SHIFT,
+                              dom->mmio_start, dom->mmio_size) )
+        {
+            long done;
+            unsigned long nr_extents = count >> SUPERPAGE_1GB_SHIFT;
+            xen_pfn_t sp_extents[nr_extents];
+
+            for ( i = 0; i < nr_extents; i++ )
+                sp_extents[i] =
+                    dom->p2m_host[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
+
+            done = xc_domain_populate_physmap(xch, domid, nr_extents,
+                                              SUPERPAGE_1GB_SHIFT,
+                                              node->memflags, sp_extents);
+
+            if ( done > 0 )
+            {
+                node->stat_1gb_pages += done;
+                done <<= SUPERPAGE_1GB_SHIFT;
+                cur_pages += done;
+                count -= done;
+            }
+        }
+
+        if ( count != 0 )
+        {
+            /* Clip count to maximum batch of 2MB extents. */
+            max_pages = SUPERPAGE_2MB_NR_PFNS * SUPERPAGE_2MB_BATCH;
+            if ( count > max_pages )
+                count = max_pages;
+
+            /* Clip partial superpage extents to superpage
+             * boundaries. */
+            if ( ((cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
+                 (count > (-cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1))) )
+                count = -cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1);
+            else if ( ((count & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
+                      (count > SUPERPAGE_2MB_NR_PFNS) )
+                count &= ~(SUPERPAGE_2MB_NR_PFNS - 1); /* clip non-s.p. tail */
+
+            /* Attempt to allocate superpage extents. */
+            if ( ((count | cur_pfn) & (SUPERPAGE_2MB_NR_PFNS - 1)) == 0 )
+            {
+                long done;
+                unsigned long nr_extents = count >> SUPERPAGE_2MB_SHIFT;
+                xen_pfn_t sp_extents[nr_extents];
+
+                for ( i = 0; i < nr_extents; i++ )
+                    sp_extents[i] =
+                        dom->p2m_host[cur_pages+(i<<SUPERPAGE_2MB_SHIFT)];
+
+                done = xc_domain_populate_physmap(xch, domid, nr_extents,
+                                                  SUPERPAGE_2MB_SHIFT,
+                                                  node->memflags, sp_extents);
+
+                if ( done > 0 )
+                {
+                    node->stat_2mb_pages += done;
+                    done <<= SUPERPAGE_2MB_SHIFT;
+                    cur_pages += done;
+                    count -= done;
+                }
+            }
+        }
+
+        /* Fall back to 4kB extents. */
+        if ( count != 0 )
+        {
+            rc = xc_domain_populate_physmap_exact(
+                xch, domid, count, 0, node->memflags,
+                &dom->p2m_host[cur_pages]);
+            cur_pages += count;
+            node->stat_normal_pages += count;
+        }
+    }
+
+    return rc;
+}
+
+/* Populate all vmemranges of one vnode. */
+static void *populate_vnode(void *arg)
+{
+    struct populate_node *node = arg;
+    unsigned int vmemid;
+
+    for ( vmemid = 0; vmemid < node->nr_vmemranges && !node->rc; vmemid++ )
+    {
+        if ( node->vmemranges[vmemid].nid != node->vnode )
+            continue;
+
+        node->rc = populate_vmemrange(node, &node->vmemranges[vmemid]);
+    }
+
+    return NULL;
+}
+
+/*
+ * Whether a fresh build would have a page at @pfn: RAM, less the VGA hole,
+ * and the special and ioreq server pages.
+ */
+static bool keep_pfn_hvm(struct xc_dom_image *dom, xen_pfn_t pfn)
+{
+    if ( pfn >= ioreq_server_pfn(0) && pfn < X86_HVM_END_SPECIAL_REGION )
+        return dom->device_model || pfn >= special_pfn(0);
+
+    if ( pfn >= dom->p2m_size || dom->p2m_host[pfn] == INVALID_PFN )
+        return false;
+
+    return !dom->device_model || pfn < 0xa0 || pfn >= 0xc0;
+}
+
+/*
+ * The memory of a domain being booted again in place: populate whatever
+ * the guest gave back or moved out of the layout, and give back whatever
+ * it, or its device model, added outside it.
+ */
+static int keep_memory_hvm(struct xc_dom_image *dom)
+{
+    xc_interface *xch = dom->xch;
+    uint32_t domid = dom->guest_domid;
+    xen_pfn_t max_gpfn, end, pfn, types[1024], fill[1024], drop[1024];
+    unsigned long nr_filled = 0, nr_dropped = 0;
+    unsigned int i, n, nr_fill, nr_drop;
+    int rc;
+
+    if ( xc_domain_maximum_gpfn(xch, domid, &max_gpfn) < 0 )
+    {
+        DOMPRINTF("Could not get the maximum gpfn of the domain");
+        return -1;
+    }
+
+    end = max_gpfn + 1;
+    if ( end < X86_HVM_END_SPECIAL_REGION )
+        end = X86_HVM_END_SPECIAL_REGION;
+    if ( end < dom->p2m_size )
+        end = dom->p2m_size;
+
+    for ( pfn = 0; pfn < end; pfn += n )
+    {
+        n = min_t(xen_pfn_t, ARRAY_SIZE(types), end - pfn);
+        for ( i = 0; i < n; i++ )
+            types[i] = pfn + i;
+
+        if ( xc_get_pfn_type_batch(xch, domid, n, types) )
+        {
+            DOMPRINTF("Could not get the types of pfns %#"PRIpfn"+%u",
+                      pfn, n);
+            return -1;
+        }
+
+        for ( i = nr_fill = nr_drop = 0; i < n; i++ )
+        {
+            bool present = types[i] != XEN_DOMCTL_PFINFO_XTAB;
+
+            if ( keep_pfn_hvm(dom, pfn + i) )
+            {
+                if ( !present )
+                    fill[nr_fill++] = pfn + i;
+            }
+            else if ( present && types[i] != XEN_DOMCTL_PFINFO_BROKEN )
+                drop[nr_drop++] = pfn + i;
+        }
+
+        if ( nr_fill )
+        {
+            rc = xc_domain_populate_physmap_exact(xch, domid, nr_fill, 0, 0,
+                                                  fill);
+            if ( rc )
+            {
+                DOMPRINTF("Could not populate %u pages from pfn %#"PRIpfn,
+                          nr_fill, fill[0]);
+                return rc;
+            }
+            nr_filled += nr_fill;
+        }
+
+        if ( nr_drop )
+        {
+            /* Not fatal: the pages stay, counted against maxmem. */
+            rc = xc_domain_decrease_reservation(xch, domid, nr_drop, 0, drop);
+            if ( rc != nr_drop )
+                DOMPRINTF("Could only release %d of %u pages from pfn %#"
+                          PRIpfn, rc, nr_drop, drop[0]);
+            if ( rc > 0 )
+                nr_dropped += rc;
+        }
+    }
+
+    DPRINTF("KEPT MEMORY: populated 0x%lx pages, released 0x%lx\n",
+            nr_filled, nr_dropped);
+
+    return 0;
+}
+
 static int meminit_hvm(struct xc_dom_image *dom)
 {
     unsigned long i, vmemid, nr_pages = dom->total_pages;
     unsigned long p2m_size;
     unsigned long target_pages = dom->target_pages;
-    unsigned long cur_pages, cur_pfn;
     int rc;
     unsigned long stat_normal_pages = 0, stat_2mb_pages = 0, 
         stat_1gb_pages = 0;
@@ -1281,6 +1560,7 @@ static int meminit_hvm(struct xc_dom_image *dom)
     xen_vmemrange_t *vmemranges;
     unsigned int *vnode_to_pnode;
     unsigned int nr_vmemranges, nr_vnodes;
+    struct populate_node *nodes = NULL;
     xc_interface *xch = dom->xch;
     uint32_t domid = dom->guest_domid;
 
@@ -1371,6 +1651,20 @@ static int meminit_hvm(struct xc_dom_image *dom)
             dom->p2m_host[pfn] = pfn;
     }
 
+    if ( dom->keep_memory )
+    {
+        if ( memflags & XENMEMF_populate_on_demand )
+        {
+            DOMPRINTF("Cannot keep the memory of a populate-on-demand guest");
+            goto error_out;
+        }
+
+        rc = keep_memory_hvm(dom);
+        if ( rc )
+            goto error_out;
+        goto out;
+    }
+
     /*
      * Try to claim pages for early warning of insufficient memory available.
      * This should go before xc_domain_set_pod_target, becuase that function
@@ -1408,12 +1702,9 @@ static int meminit_hvm(struct xc_dom_image *dom)
     /*
      * Allocate memory for HVM guest, skipping VGA hole 0xA0000-0xC0000.
      *
-     * We attempt to allocate 1GB pages if possible. It falls back on 2MB
-     * pages if 1GB allocation fails. 4KB pages will be used eventually if
-     * both fail.
-     * 
-     * Under 2MB mode, we allocate pages in batches of no more than 8MB to 
-     * ensure that we can be preempted and hence dom0 remains responsive.
+     * Each vnode is populated from its own thread: allocation, and the
+     * scrubbing that goes with it, happen on the pCPU issuing the hypercall,
+     * so a single thread bounds how fast a large guest can be built.
      */
     if ( dom->device_model )
     {
@@ -1426,139 +1717,64 @@ static int meminit_hvm(struct xc_dom_image *dom)
         }
     }
 
-    stat_normal_pages = 0;
-    for ( vmemid = 0; vmemid < nr_vmemranges; vmemid++ )
+    nodes = calloc(nr_vnodes, sizeof(*nodes));
+    if ( nodes == NULL )
     {
-        unsigned int new_memflags = memflags;
-        uint64_t end_pages;
-        unsigned int vnode = vmemranges[vmemid].nid;
-        unsigned int pnode = vnode_to_pnode[vnode];
+        DOMPRINTF("Could not allocate vnode state");
+        goto error_out;
+    }
 
-        if ( pnode != XC_NUMA_NO_NODE )
-            new_memflags |= XENMEMF_exact_node(pnode);
+    for ( i = 0; i < nr_vnodes; i++ )
+    {
+        nodes[i].dom = dom;
+        nodes[i].vmemranges = vmemranges;
+        nodes[i].nr_vmemranges = nr_vmemranges;
+        nodes[i].vnode = i;
+        nodes[i].memflags = memflags;
+        if ( vnode_to_pnode[i] != XC_NUMA_NO_NODE )
+            nodes[i].memflags |= XENMEMF_exact_node(vnode_to_pnode[i]);
+    }
 
-        end_pages = vmemranges[vmemid].end >> PAGE_SHIFT;
-        /*
-         * Consider vga hole belongs to the vmemrange that covers
-         * 0xA0000-0xC0000. Note that 0x00000-0xA0000 is populated just
-         * before this loop.
-         */
-        if ( vmemranges[vmemid].start == 0 && dom->device_model )
+    /* The calling thread takes the first vnode itself. */
+    for ( i = 1; i < nr_vnodes; i++ )
+    {
+        errno = pthread_create(&nodes[i].thread, NULL, populate_vnode,
+                               &nodes[i]);
+        if ( errno )
         {
-            cur_pages = 0xc0;
-            stat_normal_pages += 0xc0;
+            DOMPRINTF("Could not create thread for vnode %lu (%d), "
+                      "populating it serially", i, errno);
+            continue;
         }
-        else
-            cur_pages = vmemranges[vmemid].start >> PAGE_SHIFT;
-
-        rc = 0;
-        while ( (rc == 0) && (end_pages > cur_pages) )
-        {
-            /* Clip count to maximum 1GB extent. */
-            unsigned long count = end_pages - cur_pages;
-            unsigned long max_pages = SUPERPAGE_1GB_NR_PFNS;
-
-            if ( count > max_pages )
-                count = max_pages;
-
-            cur_pfn = dom->p2m_host[cur_pages];
-
-            /* Take care the corner cases of super page tails */
-            if ( ((cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
-                 (count > (-cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1))) )
-                count = -cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1);
-            else if ( ((count & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
-                      (count > SUPERPAGE_1GB_NR_PFNS) )
-                count &= ~(SUPERPAGE_1GB_NR_PFNS - 1);
-
-            /* Attemp to allocate 1GB super page. Because in each pass
-             * we only allocate at most 1GB, we don't have to clip
-             * super page boundaries.
-             */
-            if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
-                 /* Check if there exists MMIO hole in the 1GB memory
-                  * range */
-                 !check_mmio_hole(cur_pfn << PAGE_SHIFT,
-                                  SUPERPAGE_1GB_NR_PFNS << PAGE_SHIFT,
-                                  dom->mmio_start, dom->mmio_size) )
-            {
-                long done;
-                unsigned long nr_extents = count >> SUPERPAGE_1GB_SHIFT;
-                xen_pfn_t sp_extents[nr_extents];
-
-                for ( i = 0; i < nr_extents; i++ )
-                    sp_extents[i] =
-                        dom->p2m_host[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
-
-                done = xc_domain_populate_physmap(xch, domid, nr_extents,
-                                                  SUPERPAGE_1GB_SHIFT,
-                                                  new_memflags, sp_extents);
-
-                if ( done > 0 )
-                {
-                    stat_1gb_pages += done;
-                    done <<= SUPERPAGE_1GB_SHIFT;
-                    cur_pages += done;
-                    count -= done;
-                }
-            }
+        nodes[i].started = 1;
+    }
 
-            if ( count != 0 )
-            {
-                /* Clip count to maximum 8MB extent. */
-                max_pages = SUPERPAGE_2MB_NR_PFNS * 4;
-                if ( count > max_pages )
-                    count = max_pages;
-
-                /* Clip partial superpage extents to superpage
-                 * boundaries. */
-                if ( ((cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
-                     (count > (-cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1))) )
-                    count = -cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1);
-                else if ( ((count & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
-                          (count > SUPERPAGE_2MB_NR_PFNS) )
-                    count &= ~(SUPERPAGE_2MB_NR_PFNS - 1); /* clip non-s.p. tail */
-
-                /* Attempt to allocate superpage extents. */
-                if ( ((count | cur_pfn) & (SUPERPAGE_2MB_NR_PFNS - 1)) == 0 )
-                {
-                    long done;
-                    unsigned long nr_extents = count >> SUPERPAGE_2MB_SHIFT;
-                    xen_pfn_t sp_extents[nr_extents];
-
-                    for ( i = 0; i < nr_extents; i++ )
-                        sp_extents[i] =
-                            dom->p2m_host[cur_pages+(i<<SUPERPAGE_2MB_SHIFT)];
-
-                    done = xc_domain_populate_physmap(xch, domid, nr_extents,
-                                                      SUPERPAGE_2MB_SHIFT,
-                                                      new_memflags, sp_extents);
-
-                    if ( done > 0 )
-                    {
-                        stat_2mb_pages += done;
-                        done <<= SUPERPAGE_2MB_SHIFT;
-                        cur_pages += done;
-                        count -= done;
-                    }
-                }
-            }
+    populate_vnode(&nodes[0]);
 
-            /* Fall back to 4kB extents. */
-            if ( count != 0 )
-            {
-                rc = xc_domain_populate_physmap_exact(
-                    xch, domid, count, 0, new_memflags, &dom->p2m_host[cur_pages]);
-                cur_pages += count;
-                stat_normal_pages += count;
-            }
-        }
+    rc = 0;
+    for ( i = 0; i < nr_vnodes; i++ )
+    {
+        if ( nodes[i].started )
+            pthread_join(nodes[i].thread, NULL);
+        else if ( i )
+            populate_vnode(&nodes[i]);
 
-        if ( rc != 0 )
+        if ( nodes[i].rc != 0 )
         {
-            DOMPRINTF("Could not allocate memory for HVM guest.");
-            goto error_out;
+            DOMPRINTF("Could not allocate memory for vnode %lu of HVM guest.",
+                      i);
+            rc = -1;
         }
+
+        stat_normal_pages += nodes[i].stat_normal_pages;
+        stat_2mb_pages += nodes[i].stat_2mb_pages;
+        stat_1gb_pages += nodes[i].stat_1gb_pages;
+    }
+
+    if ( rc != 0 )
+    {
+        DOMPRINTF("Could not allocate memory for HVM guest.");
+        goto error_out;
     }
 
     DPRINTF("PHYSICAL MEMORY ALLOCATION:\n");
@@ -1571,6 +1787,7 @@ static int meminit_hvm(struct xc_dom_image *dom)
  error_out:
     rc = -1;
  out:
+    free(nodes);
 
     /* ensure no unclaimed pages are left unused */
     xc_domain_claim_pages(xch, domid, 0 /* cancels the claim */);
@@ -1749,6 +1966,64 @@ static void add_module_to_list(struct xc_dom_image *dom,
     start_info->nr_modules++;
 }
 
+/*
+ * Copy the ACPI tables of a guest booted without firmware to where they
+ * are linked to run, and find the RSDP among them.
+ */
+static int load_acpi_tables(struct xc_dom_image *dom, uint64_t *rsdp_paddr)
+{
+    struct xc_hvm_firmware_module *module = &dom->acpi_module;
+    size_t size = XC_DOM_HVM_ACPI_END - XC_DOM_HVM_ACPI_START;
+    const uint8_t *data = module->data;
+    uint32_t i, j;
+    uint8_t sum;
+    void *dest;
+
+    if ( module->length > size )
+    {
+        xc_dom_panic(dom->xch, XC_INVALID_PARAM,
+                     "%s: ACPI tables too big (%u bytes, max %zu)",
+                     __FUNCTION__, module->length, size);
+        return -1;
+    }
+
+    for ( i = 0; i + 20 <= module->length; i += 16 )
+    {
+        if ( memcmp(data + i, "RSD PTR ", 8) )
+            continue;
+        /* The ACPI 1.0 checksum covers the first 20 bytes. */
+        for ( j = 0, sum = 0; j < 20; j++ )
+            sum += data[i + j];
+        if ( !sum )
+            break;
+    }
+
+    if ( i + 20 > module->length )
+    {
+        xc_dom_panic(dom->xch, XC_INVALID_PARAM,
+                     "%s: no valid RSDP in the ACPI tables", __FUNCTION__);
+        return -1;
+    }
+
+    dest = xc_map_foreign_range(dom->xch, dom->guest_domid, size,
+                                PROT_READ | PROT_WRITE,
+                                XC_DOM_HVM_ACPI_START >> PAGE_SHIFT);
+    if ( dest == NULL )
+    {
+        DOMPRINTF("Unable to map the ACPI tables area");
+        return -1;
+    }
+
+    memcpy(dest, module->data, module->length);
+    memset(dest + module->length, 0, size - module->length);
+    munmap(dest, size);
+
+    module->guest_addr_out = XC_DOM_HVM_ACPI_START;
+    *rsdp_paddr = XC_DOM_HVM_ACPI_START + i;
+
+    return 0;
+}
+
 static int bootlate_hvm(struct xc_dom_image *dom)
 {
     uint32_t domid = dom->guest_domid;
@@ -1756,6 +2031,11 @@ static int bootlate_hvm(struct xc_dom_image *dom)
     struct hvm_start_info *start_info;
     size_t start_info_size;
     struct hvm_modlist_entry *modlist;
+    uint64_t rsdp_paddr = 0;
+
+    if ( !dom->device_model && dom->acpi_module.length &&
+         load_acpi_tables(dom, &rsdp_paddr) )
+        return -1;
 
     start_info_size = sizeof(*start_info) + dom->cmdline_size;
     if ( dom->ramdisk_blob )
@@ -1797,6 +2077,8 @@ static int bootlate_hvm(struct xc_dom_image *dom)
             modlist[0].size = dom->ramdisk_seg.vend - dom->ramdisk_seg.vstart;
             start_info->nr_modules = 1;
         }
+
+        start_info->rsdp_paddr = rsdp_paddr;
     }
     else
     {
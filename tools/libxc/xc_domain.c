@@ -436,6 +436,36 @@ int xc_domain_getinfolist(xc_interface *xch,
     return ret;
 }
 
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t first_domain,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfolist_t *info,
+                        uint32_t *next_domain)
+{
+    int ret = 0;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(info, max_vcpus*sizeof(*info), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, info) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_getvcpuinfolist;
+    sysctl.u.getvcpuinfolist.first_domain = first_domain;
+    sysctl.u.getvcpuinfolist.max_vcpus    = max_vcpus;
+    set_xen_guest_handle(sysctl.u.getvcpuinfolist.buffer, info);
+
+    if ( xc_sysctl(xch, &sysctl) < 0 )
+        ret = -1;
+    else
+        ret = sysctl.u.getvcpuinfolist.num_vcpus;
+
+    *next_domain = sysctl.u.getvcpuinfolist.next_domain;
+
+    xc_hypercall_bounce_post(xch, info);
+
+    return ret;
+}
+
 /* set broken page p2m */
 int xc_set_broken_page_p2m(xc_interface *xch,
                            uint32_t domid,
@@ -477,6 +507,25 @@ int xc_domain_hvm_getcontext(xc_interface *xch,
     return (ret < 0 ? -1 : domctl.u.hvmcontext.size);
 }
 
+int xc_domain_hvm_getcontext_buffer(xc_interface *xch,
+                                    uint32_t domid,
+                                    xc_hypercall_buffer_t *ctxt_buf,
+                                    uint32_t size)
+{
+    int ret;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(ctxt_buf);
+
+    domctl.cmd = XEN_DOMCTL_gethvmcontext;
+    domctl.domain = (domid_t)domid;
+    domctl.u.hvmcontext.size = size;
+    set_xen_guest_handle(domctl.u.hvmcontext.buffer, ctxt_buf);
+
+    ret = do_domctl(xch, &domctl);
+
+    return (ret < 0 ? -1 : domctl.u.hvmcontext.size);
+}
+
 /* Get just one element of the HVM guest context.
  * size must be >= HVM_SAVE_LENGTH(type) */
 int xc_domain_hvm_getcontext_partial(xc_interface *xch,
@@ -1262,6 +1311,39 @@ int xc_availheap(xc_interface *xch,
     return rc;
 }
 
+int xc_xmem_cacheinfo(xc_interface *xch,
+                      unsigned int max_caches,
+                      xc_xmem_cache_t *info,
+                      uint64_t *pool_used,
+                      uint64_t *pool_total)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(info, max_caches * sizeof(*info),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, info) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_xmem_cacheinfo;
+    sysctl.u.xmem_cacheinfo.max_caches = max_caches;
+    set_xen_guest_handle(sysctl.u.xmem_cacheinfo.buffer, info);
+
+    ret = xc_sysctl(xch, &sysctl);
+    if ( !ret )
+    {
+        ret = sysctl.u.xmem_cacheinfo.num_caches;
+        if ( pool_used )
+            *pool_used = sysctl.u.xmem_cacheinfo.pool_used;
+        if ( pool_total )
+            *pool_total = sysctl.u.xmem_cacheinfo.pool_total;
+    }
+
+    xc_hypercall_bounce_post(xch, info);
+
+    return ret;
+}
+
 int xc_vcpu_setcontext(xc_interface *xch,
                        uint32_t domid,
                        uint32_t vcpu,
@@ -1499,6 +1581,33 @@ int xc_hvm_map_io_range_to_ioreq_server(xc_interface *xch, domid_t domid,
     return rc;
 }
 
+int xc_hvm_map_posted_io_range_to_ioreq_server(xc_interface *xch,
+                                               domid_t domid,
+                                               ioservid_t id, int is_mmio,
+                                               uint64_t start, uint64_t end)
+{
+    DECLARE_HYPERCALL_BUFFER(xen_hvm_io_range_t, arg);
+    int rc;
+
+    arg = xc_hypercall_buffer_alloc(xch, arg, sizeof(*arg));
+    if ( arg == NULL )
+        return -1;
+
+    arg->domid = domid;
+    arg->id = id;
+    arg->type = (is_mmio ? HVMOP_IO_RANGE_MEMORY : HVMOP_IO_RANGE_PORT) |
+                HVMOP_IO_RANGE_POSTED;
+    arg->start = start;
+    arg->end = end;
+
+    rc = xencall2(xch->xcall, __HYPERVISOR_hvm_op,
+                  HVMOP_map_io_range_to_ioreq_server,
+                  HYPERCALL_BUFFER_AS_ARG(arg));
+
+    xc_hypercall_buffer_free(xch, arg);
+    return rc;
+}
+
 int xc_hvm_unmap_io_range_from_ioreq_server(xc_interface *xch, domid_t domid,
                                             ioservid_t id, int is_mmio,
                                             uint64_t start, uint64_t end)
@@ -1641,6 +1750,30 @@ int xc_hvm_set_ioreq_server_state(xc_interface *xch,
     return rc;
 }
 
+int xc_hvm_set_ioreq_server_polling(xc_interface *xch,
+                                    domid_t domid,
+                                    ioservid_t id,
+                                    int polling)
+{
+    DECLARE_HYPERCALL_BUFFER(xen_hvm_set_ioreq_server_state_t, arg);
+    int rc;
+
+    arg = xc_hypercall_buffer_alloc(xch, arg, sizeof(*arg));
+    if ( arg == NULL )
+        return -1;
+
+    arg->domid = domid;
+    arg->id = id;
+    arg->enabled = 1 | (polling ? HVM_IOREQSRV_POLLING : 0);
+
+    rc = xencall2(xch->xcall, __HYPERVISOR_hvm_op,
+                  HVMOP_set_ioreq_server_state,
+                  HYPERCALL_BUFFER_AS_ARG(arg));
+
+    xc_hypercall_buffer_free(xch, arg);
+    return rc;
+}
+
 int xc_domain_setdebugging(xc_interface *xch,
                            uint32_t domid,
                            unsigned int enable)
@@ -2513,11 +2646,55 @@ int xc_domain_getvnuma(xc_interface *xch,
 }
 
 int xc_domain_soft_reset(xc_interface *xch,
-                         uint32_t domid)
+                         uint32_t domid,
+                         uint32_t flags)
 {
     DECLARE_DOMCTL;
     domctl.cmd = XEN_DOMCTL_soft_reset;
     domctl.domain = (domid_t)domid;
+    domctl.u.soft_reset.flags = flags;
+    return do_domctl(xch, &domctl);
+}
+
+int xc_domain_numa_migrate(xc_interface *xch,
+                           uint32_t domid,
+                           unsigned int node,
+                           xen_pfn_t start_gfn,
+                           xen_pfn_t nr_gfns,
+                           uint64_t *nr_migrated,
+                           uint64_t *nr_busy)
+{
+    int rc;
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_numa_migrate;
+    domctl.domain = (domid_t)domid;
+    domctl.u.numa_migrate.start_gfn = start_gfn;
+    domctl.u.numa_migrate.nr_gfns = nr_gfns;
+    domctl.u.numa_migrate.nr_migrated = 0;
+    domctl.u.numa_migrate.nr_busy = 0;
+    domctl.u.numa_migrate.node = node;
+    domctl.u.numa_migrate.pad = 0;
+
+    rc = do_domctl(xch, &domctl);
+
+    if ( nr_migrated )
+        *nr_migrated = domctl.u.numa_migrate.nr_migrated;
+    if ( nr_busy )
+        *nr_busy = domctl.u.numa_migrate.nr_busy;
+
+    return rc;
+}
+
+int xc_domain_set_grant_frames(xc_interface *xch,
+                               uint32_t domid,
+                               uint32_t nr_frames)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_set_grant_frames;
+    domctl.domain = (domid_t)domid;
+    domctl.u.set_grant_frames.nr_frames = nr_frames;
     return do_domctl(xch, &domctl);
 }
 /*
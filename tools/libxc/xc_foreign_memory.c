@@ -35,22 +35,15 @@ void *xc_map_foreign_range(xc_interface *xch,
                            uint32_t dom, int size, int prot,
                            unsigned long mfn)
 {
-    xen_pfn_t *arr;
-    int num;
-    int i;
-    void *ret;
-
-    num = (size + XC_PAGE_SIZE - 1) >> XC_PAGE_SHIFT;
-    arr = calloc(num, sizeof(xen_pfn_t));
-    if ( arr == NULL )
+    if ( size < 0 )
+    {
+        errno = EINVAL;
         return NULL;
+    }
 
-    for ( i = 0; i < num; i++ )
-        arr[i] = mfn + i;
-
-    ret = xc_map_foreign_pages(xch, dom, prot, arr, num);
-    free(arr);
-    return ret;
+    return xenforeignmemory_map_range(xch->fmem, dom, prot, mfn,
+                                      (size + XC_PAGE_SIZE - 1) >>
+                                      XC_PAGE_SHIFT);
 }
 
 void *xc_map_foreign_ranges(xc_interface *xch,
@@ -62,6 +62,36 @@ int xc_get_mem_access(xc_interface *xch,
     return rc;
 }
 
+int xc_set_mem_access_filter(xc_interface *xch,
+                             domid_t domain_id,
+                             xen_mem_access_filter_t *filter,
+                             uint32_t nr)
+{
+    DECLARE_HYPERCALL_BOUNCE(filter, nr * sizeof(*filter),
+                             XC_HYPERCALL_BUFFER_BOUNCE_IN);
+    int rc;
+    xen_mem_access_op_t mao =
+    {
+        .op    = XENMEM_access_op_set_filter,
+        .domid = domain_id,
+        .nr    = nr
+    };
+
+    if ( xc_hypercall_bounce_pre(xch, filter) )
+    {
+        PERROR("Could not bounce memory for XENMEM_access_op_set_filter");
+        return -1;
+    }
+
+    mao.filter_list = HYPERCALL_BUFFER_AS_ARG(filter);
+
+    rc = do_memory_op(xch, XENMEM_access_op, &mao, sizeof(mao));
+
+    xc_hypercall_bounce_post(xch, filter);
+
+    return rc;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -200,6 +200,65 @@ int xc_memshr_range_share(xc_interface *xch,
     return xc_memshr_memop(xch, source_domain, &mso);
 }
 
+int xc_memshr_fork(xc_interface *xch,
+                   domid_t parent_domain,
+                   domid_t child_domain)
+{
+    /* The parameters a migration stream carries, and the callback. */
+    static const unsigned int params[] = {
+        HVM_PARAM_CALLBACK_IRQ,
+        HVM_PARAM_STORE_PFN,
+        HVM_PARAM_IOREQ_PFN,
+        HVM_PARAM_BUFIOREQ_PFN,
+        HVM_PARAM_PAGING_RING_PFN,
+        HVM_PARAM_MONITOR_RING_PFN,
+        HVM_PARAM_SHARING_RING_PFN,
+        HVM_PARAM_VM86_TSS,
+        HVM_PARAM_CONSOLE_PFN,
+        HVM_PARAM_ACPI_IOPORTS_LOCATION,
+        HVM_PARAM_VIRIDIAN,
+        HVM_PARAM_IDENT_PT,
+        HVM_PARAM_PAE_ENABLED,
+        HVM_PARAM_VM_GENERATION_ID_ADDR,
+        HVM_PARAM_IOREQ_SERVER_PFN,
+        HVM_PARAM_NR_IOREQ_SERVER_PAGES,
+        HVM_PARAM_X87_FIP_WIDTH,
+    };
+    xen_mem_sharing_op_t mso;
+    uint64_t value;
+    unsigned int i;
+    int rc;
+
+    if ( xc_memshr_control(xch, parent_domain, 1) ||
+         xc_memshr_control(xch, child_domain, 1) )
+        return -1;
+
+    memset(&mso, 0, sizeof(mso));
+
+    mso.op = XENMEM_sharing_op_fork;
+    mso.u.fork.client_domain = child_domain;
+
+    rc = xc_memshr_memop(xch, parent_domain, &mso);
+    if ( rc )
+        return rc;
+
+    for ( i = 0; i < ARRAY_SIZE(params); i++ )
+    {
+        rc = xc_hvm_param_get(xch, parent_domain, params[i], &value);
+        if ( rc )
+            return rc;
+
+        if ( value == 0 )
+            continue;
+
+        rc = xc_hvm_param_set(xch, child_domain, params[i], value);
+        if ( rc )
+            return rc;
+    }
+
+    return 0;
+}
+
 int xc_memshr_domain_resume(xc_interface *xch,
                             domid_t domid)
 {
@@ -393,6 +393,48 @@ int xc_perfc_query(xc_interface *xch,
     return do_sysctl(xch, &sysctl);
 }
 
+int xc_perfc_query_domain_number(xc_interface *xch,
+                                 uint32_t domid,
+                                 int *nbr_desc,
+                                 int *nbr_val)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_perfc_op;
+    sysctl.u.perfc_op.cmd = XEN_SYSCTL_PERFCOP_query_domain;
+    sysctl.u.perfc_op.domid = domid;
+    set_xen_guest_handle(sysctl.u.perfc_op.desc, HYPERCALL_BUFFER_NULL);
+    set_xen_guest_handle(sysctl.u.perfc_op.val, HYPERCALL_BUFFER_NULL);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    if ( nbr_desc )
+        *nbr_desc = sysctl.u.perfc_op.nr_counters;
+    if ( nbr_val )
+        *nbr_val = sysctl.u.perfc_op.nr_vals;
+
+    return rc;
+}
+
+int xc_perfc_query_domain(xc_interface *xch,
+                          uint32_t domid,
+                          struct xc_hypercall_buffer *desc,
+                          struct xc_hypercall_buffer *val)
+{
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(desc);
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(val);
+
+    sysctl.cmd = XEN_SYSCTL_perfc_op;
+    sysctl.u.perfc_op.cmd = XEN_SYSCTL_PERFCOP_query_domain;
+    sysctl.u.perfc_op.domid = domid;
+    set_xen_guest_handle(sysctl.u.perfc_op.desc, desc);
+    set_xen_guest_handle(sysctl.u.perfc_op.val, val);
+
+    return do_sysctl(xch, &sysctl);
+}
+
 int xc_lockprof_reset(xc_interface *xch)
 {
     DECLARE_SYSCTL;
@@ -443,6 +485,275 @@ int xc_lockprof_query(xc_interface *xch,
     return rc;
 }
 
+int xc_locksample_start(xc_interface *xch, uint32_t rate)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_locksample_op;
+    sysctl.u.locksample_op.cmd = rate ? XEN_SYSCTL_LOCKSAMPLE_start
+                                      : XEN_SYSCTL_LOCKSAMPLE_stop;
+    sysctl.u.locksample_op.rate = rate;
+    set_xen_guest_handle(sysctl.u.locksample_op.data, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_locksample_reset(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_locksample_op;
+    sysctl.u.locksample_op.cmd = XEN_SYSCTL_LOCKSAMPLE_reset;
+    set_xen_guest_handle(sysctl.u.locksample_op.data, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_locksample_query_number(xc_interface *xch,
+                               uint32_t *n_elems)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_locksample_op;
+    sysctl.u.locksample_op.cmd = XEN_SYSCTL_LOCKSAMPLE_query;
+    sysctl.u.locksample_op.max_elem = 0;
+    set_xen_guest_handle(sysctl.u.locksample_op.data, HYPERCALL_BUFFER_NULL);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.locksample_op.nr_elem;
+
+    return rc;
+}
+
+int xc_locksample_query(xc_interface *xch,
+                        uint32_t *n_elems,
+                        uint32_t *rate,
+                        uint64_t *dropped,
+                        struct xc_hypercall_buffer *data)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(data);
+
+    sysctl.cmd = XEN_SYSCTL_locksample_op;
+    sysctl.u.locksample_op.cmd = XEN_SYSCTL_LOCKSAMPLE_query;
+    sysctl.u.locksample_op.max_elem = *n_elems;
+    set_xen_guest_handle(sysctl.u.locksample_op.data, data);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.locksample_op.nr_elem;
+    *rate = sysctl.u.locksample_op.rate;
+    *dropped = sysctl.u.locksample_op.dropped;
+
+    return rc;
+}
+
+int xc_lathist_reset(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lathist_op;
+    sysctl.u.lathist_op.cmd = XEN_SYSCTL_LATHIST_reset;
+    set_xen_guest_handle(sysctl.u.lathist_op.buckets, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_lathist_query_number(xc_interface *xch,
+                            uint32_t type,
+                            uint32_t *nr_hists)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lathist_op;
+    sysctl.u.lathist_op.cmd = XEN_SYSCTL_LATHIST_query;
+    sysctl.u.lathist_op.type = type;
+    sysctl.u.lathist_op.nr_hists = 0;
+    set_xen_guest_handle(sysctl.u.lathist_op.buckets, HYPERCALL_BUFFER_NULL);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *nr_hists = sysctl.u.lathist_op.nr_hists;
+
+    return rc;
+}
+
+int xc_lathist_query(xc_interface *xch,
+                     uint32_t type,
+                     uint32_t *nr_hists,
+                     struct xc_hypercall_buffer *buckets)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(buckets);
+
+    sysctl.cmd = XEN_SYSCTL_lathist_op;
+    sysctl.u.lathist_op.cmd = XEN_SYSCTL_LATHIST_query;
+    sysctl.u.lathist_op.type = type;
+    sysctl.u.lathist_op.nr_hists = *nr_hists;
+    set_xen_guest_handle(sysctl.u.lathist_op.buckets, buckets);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *nr_hists = sysctl.u.lathist_op.nr_hists;
+
+    return rc;
+}
+
+int xc_numa_locality(xc_interface *xch, uint32_t domid,
+                     xc_numa_locality_t *info, uint64_t *samples)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(samples, info->nr_nodes * sizeof(*samples),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (ret = xc_hypercall_bounce_pre(xch, samples)) )
+        return ret;
+
+    sysctl.cmd = XEN_SYSCTL_numa_locality;
+    sysctl.u.numa_locality.domid = domid;
+    sysctl.u.numa_locality.pad = 0;
+    sysctl.u.numa_locality.nr_nodes = info->nr_nodes;
+    sysctl.u.numa_locality.pad2 = 0;
+    set_xen_guest_handle(sysctl.u.numa_locality.samples, samples);
+
+    ret = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, samples);
+
+    if ( !ret )
+        *info = sysctl.u.numa_locality;
+
+    return ret;
+}
+
+int xc_pmusample_start(xc_interface *xch, uint32_t event, uint32_t period,
+                       uint32_t domid)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_pmusample_op;
+    sysctl.u.pmusample_op.cmd = XEN_SYSCTL_PMUSAMPLE_start;
+    sysctl.u.pmusample_op.event = event;
+    sysctl.u.pmusample_op.period = period;
+    sysctl.u.pmusample_op.domid = domid;
+    set_xen_guest_handle(sysctl.u.pmusample_op.recs, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_pmusample_stop(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_pmusample_op;
+    sysctl.u.pmusample_op.cmd = XEN_SYSCTL_PMUSAMPLE_stop;
+    set_xen_guest_handle(sysctl.u.pmusample_op.recs, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_pmusample_read(xc_interface *xch,
+                      uint32_t cpu,
+                      uint32_t *nr_recs,
+                      uint64_t *lost,
+                      struct xc_hypercall_buffer *recs)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(recs);
+
+    sysctl.cmd = XEN_SYSCTL_pmusample_op;
+    sysctl.u.pmusample_op.cmd = XEN_SYSCTL_PMUSAMPLE_read;
+    sysctl.u.pmusample_op.cpu = cpu;
+    sysctl.u.pmusample_op.nr_recs = *nr_recs;
+    set_xen_guest_handle(sysctl.u.pmusample_op.recs, recs);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *nr_recs = sysctl.u.pmusample_op.nr_recs;
+    *lost = sysctl.u.pmusample_op.lost;
+
+    return rc;
+}
+
+int xc_xensyms_read(xc_interface *xch, uint32_t *symnum, char *type,
+                    uint64_t *address, char *name, uint32_t namelen)
+{
+    int rc;
+    DECLARE_PLATFORM_OP;
+    DECLARE_HYPERCALL_BOUNCE(name, namelen, XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, name) )
+        return -1;
+
+    platform_op.cmd = XENPF_get_symbol;
+    platform_op.u.symdata.symnum = *symnum;
+    platform_op.u.symdata.namelen = namelen;
+    set_xen_guest_handle(platform_op.u.symdata.name, name);
+
+    rc = do_platform_op(xch, &platform_op);
+
+    xc_hypercall_bounce_post(xch, name);
+
+    if ( !rc )
+    {
+        *symnum = platform_op.u.symdata.symnum;
+        *type = platform_op.u.symdata.type;
+        *address = platform_op.u.symdata.address;
+    }
+
+    return rc;
+}
+
+const xc_vcpustats_t *xc_vcpustats_map(xc_interface *xch,
+                                       unsigned int *nr_slots)
+{
+    const xc_vcpustats_t *slots;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_vcpustats_op;
+
+    if ( do_sysctl(xch, &sysctl) )
+        return NULL;
+
+    slots = xc_map_foreign_range(xch, DOMID_XEN,
+                                 sysctl.u.vcpustats_op.nr_frames * XC_PAGE_SIZE,
+                                 PROT_READ, sysctl.u.vcpustats_op.mfn);
+    if ( slots )
+        *nr_slots = sysctl.u.vcpustats_op.nr_slots;
+
+    return slots;
+}
+
+void xc_vcpustats_unmap(const xc_vcpustats_t *slots, unsigned int nr_slots)
+{
+    size_t len = nr_slots * sizeof(*slots);
+
+    munmap((void *)slots, (len + XC_PAGE_SIZE - 1) & ~(XC_PAGE_SIZE - 1));
+}
+
+int xc_vcpustats_read(const xc_vcpustats_t *slot, xc_vcpustats_t *copy)
+{
+    uint32_t version;
+
+    do {
+        /* An odd version means Xen is updating the slot. */
+        while ( (version = *(volatile const uint32_t *)&slot->version) & 1 )
+            ;
+        xen_rmb();
+        memcpy(copy, slot, sizeof(*copy));
+        xen_rmb();
+    } while ( *(volatile const uint32_t *)&slot->version != version );
+
+    return (copy->flags & XEN_VCPUSTATS_valid) ? 0 : -1;
+}
+
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus)
 {
@@ -28,6 +28,15 @@ void *xc_monitor_enable(xc_interface *xch, domid_t domain_id, uint32_t *port)
                               port);
 }
 
+void *xc_monitor_enable_rings(xc_interface *xch, domid_t domain_id,
+                              unsigned int nr_frames, unsigned int flags,
+                              uint32_t *port, uint32_t *ports,
+                              unsigned int nr_ports)
+{
+    return xc_vm_event_enable_rings(xch, domain_id, HVM_PARAM_MONITOR_RING_PFN,
+                                    nr_frames, flags, port, ports, nr_ports);
+}
+
 int xc_monitor_disable(xc_interface *xch, domid_t domain_id)
 {
     return xc_vm_event_control(xch, domain_id,
@@ -157,6 +166,19 @@ int xc_monitor_emulate_each_rep(xc_interface *xch, domid_t domain_id,
     return do_domctl(xch, &domctl);
 }
 
+int xc_monitor_record_only(xc_interface *xch, domid_t domain_id,
+                           uint32_t events)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_monitor_op;
+    domctl.domain = domain_id;
+    domctl.u.monitor_op.op = XEN_DOMCTL_MONITOR_OP_RECORD_ONLY;
+    domctl.u.monitor_op.event = events;
+
+    return do_domctl(xch, &domctl);
+}
+
 int xc_monitor_debug_exceptions(xc_interface *xch, domid_t domain_id,
                                 bool enable, bool sync)
 {
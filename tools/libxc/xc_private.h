@@ -428,6 +428,14 @@ int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
  */
 void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
                          uint32_t *port);
+/*
+ * As xc_vm_event_enable(), with rings of nr_frames pages, and with one ring
+ * per vCPU if flags has XEN_VM_EVENT_FLAG_PER_VCPU.
+ */
+void *xc_vm_event_enable_rings(xc_interface *xch, domid_t domain_id,
+                               int param, unsigned int nr_frames,
+                               unsigned int flags, uint32_t *port,
+                               uint32_t *ports, unsigned int nr_ports);
 
 #endif /* __XC_PRIVATE_H__ */
 
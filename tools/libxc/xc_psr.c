@@ -226,6 +226,31 @@ int xc_psr_cmt_get_data(xc_interface *xch, uint32_t rmid, uint32_t cpu,
     return 0;
 }
 
+int xc_psr_cmt_get_domain_mbm(xc_interface *xch, uint32_t domid,
+                              uint64_t *total, uint64_t *local,
+                              uint64_t *bw_total, uint64_t *bw_local)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_psr_cmt_op;
+    sysctl.u.psr_cmt_op.cmd = XEN_SYSCTL_PSR_CMT_get_domain_mbm;
+    sysctl.u.psr_cmt_op.flags = 0;
+    memset(&sysctl.u.psr_cmt_op.u.mbm, 0, sizeof(sysctl.u.psr_cmt_op.u.mbm));
+    sysctl.u.psr_cmt_op.u.mbm.domid = domid;
+
+    rc = xc_sysctl(xch, &sysctl);
+    if ( !rc )
+    {
+        *total = sysctl.u.psr_cmt_op.u.mbm.total;
+        *local = sysctl.u.psr_cmt_op.u.mbm.local;
+        *bw_total = sysctl.u.psr_cmt_op.u.mbm.bw_total;
+        *bw_local = sysctl.u.psr_cmt_op.u.mbm.bw_local;
+    }
+
+    return rc;
+}
+
 int xc_psr_cmt_enabled(xc_interface *xch)
 {
     static int val = -1;
@@ -266,6 +291,9 @@ int xc_psr_cat_set_domain_data(xc_interface *xch, uint32_t domid,
     case XC_PSR_CAT_L3_CBM_DATA:
         cmd = XEN_DOMCTL_PSR_CAT_OP_SET_L3_DATA;
         break;
+    case XC_PSR_CAT_MBA_THRTL:
+        cmd = XEN_DOMCTL_PSR_CAT_OP_SET_MBA_THRTL;
+        break;
     default:
         errno = EINVAL;
         return -1;
@@ -299,6 +327,9 @@ int xc_psr_cat_get_domain_data(xc_interface *xch, uint32_t domid,
     case XC_PSR_CAT_L3_CBM_DATA:
         cmd = XEN_DOMCTL_PSR_CAT_OP_GET_L3_DATA;
         break;
+    case XC_PSR_CAT_MBA_THRTL:
+        cmd = XEN_DOMCTL_PSR_CAT_OP_GET_MBA_THRTL;
+        break;
     default:
         errno = EINVAL;
         return -1;
@@ -340,6 +371,75 @@ int xc_psr_cat_get_l3_info(xc_interface *xch, uint32_t socket,
     return rc;
 }
 
+int xc_psr_mba_get_info(xc_interface *xch, uint32_t socket,
+                        uint32_t *cos_max, uint32_t *thrtl_max,
+                        bool *linear)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_psr_cat_op;
+    sysctl.u.psr_cat_op.cmd = XEN_SYSCTL_PSR_CAT_get_mba_info;
+    sysctl.u.psr_cat_op.target = socket;
+
+    rc = xc_sysctl(xch, &sysctl);
+    if ( !rc )
+    {
+        *cos_max = sysctl.u.psr_cat_op.u.mba_info.cos_max;
+        *thrtl_max = sysctl.u.psr_cat_op.u.mba_info.thrtl_max;
+        *linear = sysctl.u.psr_cat_op.u.mba_info.flags &
+                  XEN_SYSCTL_PSR_MBA_LINEAR;
+    }
+
+    return rc;
+}
+
+int xc_psr_set_domain_class(xc_interface *xch, uint32_t domid,
+                            uint32_t class, uint32_t share)
+{
+    DECLARE_DOMCTL;
+
+    if ( class > XEN_DOMCTL_PSR_CLASS_MASK ||
+         share > XEN_DOMCTL_PSR_CLASS_SHARE_MASK )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    domctl.cmd = XEN_DOMCTL_psr_cat_op;
+    domctl.domain = (domid_t)domid;
+    domctl.u.psr_cat_op.cmd = XEN_DOMCTL_PSR_CAT_OP_SET_CLASS;
+    domctl.u.psr_cat_op.target = 0;
+    domctl.u.psr_cat_op.data = class |
+        ((uint64_t)share << XEN_DOMCTL_PSR_CLASS_SHARE_SHIFT);
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_psr_get_domain_class(xc_interface *xch, uint32_t domid,
+                            uint32_t *class, uint32_t *share)
+{
+    int rc;
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_psr_cat_op;
+    domctl.domain = (domid_t)domid;
+    domctl.u.psr_cat_op.cmd = XEN_DOMCTL_PSR_CAT_OP_GET_CLASS;
+    domctl.u.psr_cat_op.target = 0;
+
+    rc = do_domctl(xch, &domctl);
+
+    if ( !rc )
+    {
+        *class = domctl.u.psr_cat_op.data & XEN_DOMCTL_PSR_CLASS_MASK;
+        *share = (domctl.u.psr_cat_op.data >>
+                  XEN_DOMCTL_PSR_CLASS_SHARE_SHIFT) &
+                 XEN_DOMCTL_PSR_CLASS_SHARE_MASK;
+    }
+
+    return rc;
+}
+
 /*
  * Local variables:
  * mode: C
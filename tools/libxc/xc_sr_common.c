@@ -36,6 +36,14 @@ static const char *mandatory_rec_types[] =
     [REC_TYPE_VERIFY]                       = "Verify",
     [REC_TYPE_CHECKPOINT]                   = "Checkpoint",
     [REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST]    = "Checkpoint dirty pfn list",
+    [REC_TYPE_PAGE_DATA_COMPRESSED]         = "Page data compressed",
+    [REC_TYPE_PAGE_DATA_ZERO]               = "Page data zero",
+    [REC_TYPE_PAGE_DATA_DELTA]              = "Page data delta",
+    [REC_TYPE_PAGE_DATA_ALIGNED]            = "Page data aligned",
+    [REC_TYPE_POSTCOPY_BEGIN]               = "Postcopy begin",
+    [REC_TYPE_POSTCOPY_PFNS]                = "Postcopy pfns",
+    [REC_TYPE_POSTCOPY_TRANSITION]          = "Postcopy transition",
+    [REC_TYPE_POSTCOPY_FAULT]               = "Postcopy fault",
 };
 
 const char *rec_type_to_str(uint32_t type)
@@ -89,25 +97,38 @@ int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
     return -1;
 }
 
-int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
+bool fd_is_file(int fd)
+{
+    struct stat st;
+
+    return !fstat(fd, &st) && S_ISREG(st.st_mode);
+}
+
+int read_record_header(struct xc_sr_context *ctx, int fd,
+                       struct xc_sr_rhdr *rhdr)
 {
     xc_interface *xch = ctx->xch;
-    struct xc_sr_rhdr rhdr;
-    size_t datasz;
 
-    if ( read_exact(fd, &rhdr, sizeof(rhdr)) )
+    if ( read_exact(fd, rhdr, sizeof(*rhdr)) )
     {
         PERROR("Failed to read Record Header from stream");
         return -1;
     }
-    else if ( rhdr.length > REC_LENGTH_MAX )
+    else if ( rhdr->length > REC_LENGTH_MAX )
     {
-        ERROR("Record (0x%08x, %s) length %#x exceeds max (%#x)", rhdr.type,
-              rec_type_to_str(rhdr.type), rhdr.length, REC_LENGTH_MAX);
+        ERROR("Record (0x%08x, %s) length %#x exceeds max (%#x)", rhdr->type,
+              rec_type_to_str(rhdr->type), rhdr->length, REC_LENGTH_MAX);
         return -1;
     }
 
-    datasz = ROUNDUP(rhdr.length, REC_ALIGN_ORDER);
+    return 0;
+}
+
+int read_record_data(struct xc_sr_context *ctx, int fd,
+                     const struct xc_sr_rhdr *rhdr, struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    size_t datasz = ROUNDUP(rhdr->length, REC_ALIGN_ORDER);
 
     if ( datasz )
     {
@@ -116,7 +137,7 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
         if ( !rec->data )
         {
             ERROR("Unable to allocate %zu bytes for record data (0x%08x, %s)",
-                  datasz, rhdr.type, rec_type_to_str(rhdr.type));
+                  datasz, rhdr->type, rec_type_to_str(rhdr->type));
             return -1;
         }
 
@@ -125,19 +146,209 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
             free(rec->data);
             rec->data = NULL;
             PERROR("Failed to read %zu bytes of data for record (0x%08x, %s)",
-                   datasz, rhdr.type, rec_type_to_str(rhdr.type));
+                   datasz, rhdr->type, rec_type_to_str(rhdr->type));
             return -1;
         }
     }
     else
         rec->data = NULL;
 
-    rec->type   = rhdr.type;
-    rec->length = rhdr.length;
+    rec->type   = rhdr->type;
+    rec->length = rhdr->length;
 
     return 0;
+}
+
+int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
+{
+    struct xc_sr_rhdr rhdr;
+
+    if ( read_record_header(ctx, fd, &rhdr) )
+        return -1;
+
+    return read_record_data(ctx, fd, &rhdr, rec);
+};
+
+/*
+ * Claim and run items of the current job until there are none left, or one
+ * of them has failed.  Called, and returns, with w->lock held.
+ */
+static void do_work(struct xc_sr_workers *w, unsigned slot)
+{
+    unsigned idx;
+    int rc;
+
+    while ( w->next < w->count && !w->rc )
+    {
+        idx = w->next++;
+
+        pthread_mutex_unlock(&w->lock);
+        rc = w->fn(w->ctx, idx, w->scratch[slot], w->arg);
+        pthread_mutex_lock(&w->lock);
+
+        if ( rc && !w->rc )
+        {
+            w->rc = rc;
+            w->err = errno;
+        }
+    }
+}
+
+struct worker_args
+{
+    struct xc_sr_workers *w;
+    unsigned slot;
 };
 
+static void *worker_main(void *_args)
+{
+    struct worker_args *args = _args;
+    struct xc_sr_workers *w = args->w;
+    unsigned slot = args->slot, seen;
+
+    free(args);
+
+    pthread_mutex_lock(&w->lock);
+    seen = w->generation;
+
+    for ( ;; )
+    {
+        while ( !w->exit && w->generation == seen )
+            pthread_cond_wait(&w->work_cond, &w->lock);
+
+        if ( w->exit )
+            break;
+
+        seen = w->generation;
+        w->busy++;
+        do_work(w, slot);
+        if ( --w->busy == 0 )
+            pthread_cond_signal(&w->done_cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+int init_workers(struct xc_sr_context *ctx, struct xc_sr_workers *w,
+                 size_t scratch_size)
+{
+    xc_interface *xch = ctx->xch;
+    struct worker_args *args;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned i, nr = (online > 1) ? online : 1;
+
+    memset(w, 0, sizeof(*w));
+    w->ctx = ctx;
+    nr = min_t(unsigned, nr, XC_SR_MAX_WORKERS);
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work_cond, NULL);
+    pthread_cond_init(&w->done_cond, NULL);
+
+    for ( i = 0; scratch_size && i < nr; ++i )
+    {
+        w->scratch[i] = malloc(scratch_size);
+        if ( !w->scratch[i] )
+        {
+            ERROR("Unable to allocate %zu bytes of worker scratch space",
+                  scratch_size);
+            goto err;
+        }
+    }
+
+    /* Slot nr - 1 is used by the thread calling run_workers(). */
+    for ( i = 0; i < nr - 1; ++i )
+    {
+        args = malloc(sizeof(*args));
+        if ( !args )
+        {
+            ERROR("Unable to allocate worker thread arguments");
+            goto err;
+        }
+
+        args->w = w;
+        args->slot = i;
+
+        errno = pthread_create(&w->threads[i], NULL, worker_main, args);
+        if ( errno )
+        {
+            PERROR("Unable to create worker thread %u", i);
+            free(args);
+            goto err;
+        }
+        w->nr_threads++;
+    }
+
+    DPRINTF("Using %u threads for page data", w->nr_threads + 1);
+
+    return 0;
+
+ err:
+    fini_workers(w);
+    return -1;
+}
+
+int run_workers(struct xc_sr_workers *w, unsigned count,
+                int (*fn)(struct xc_sr_context *ctx, unsigned idx,
+                          void *scratch, void *arg),
+                void *arg)
+{
+    int rc;
+
+    pthread_mutex_lock(&w->lock);
+
+    w->fn = fn;
+    w->arg = arg;
+    w->next = 0;
+    w->count = count;
+    w->rc = 0;
+    w->generation++;
+
+    if ( w->nr_threads && count > 1 )
+        pthread_cond_broadcast(&w->work_cond);
+
+    w->busy++;
+    do_work(w, w->nr_threads);
+    w->busy--;
+
+    while ( w->busy )
+        pthread_cond_wait(&w->done_cond, &w->lock);
+
+    rc = w->rc;
+    if ( rc )
+        errno = w->err;
+
+    pthread_mutex_unlock(&w->lock);
+
+    return rc;
+}
+
+void fini_workers(struct xc_sr_workers *w)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&w->lock);
+    w->exit = true;
+    pthread_cond_broadcast(&w->work_cond);
+    pthread_mutex_unlock(&w->lock);
+
+    for ( i = 0; i < w->nr_threads; ++i )
+        pthread_join(w->threads[i], NULL);
+    w->nr_threads = 0;
+
+    for ( i = 0; i < ARRAY_SIZE(w->scratch); ++i )
+    {
+        free(w->scratch[i]);
+        w->scratch[i] = NULL;
+    }
+
+    pthread_cond_destroy(&w->done_cond);
+    pthread_cond_destroy(&w->work_cond);
+    pthread_mutex_destroy(&w->lock);
+}
+
 static void __attribute__((unused)) build_assertions(void)
 {
     XC_BUILD_BUG_ON(sizeof(struct xc_sr_ihdr) != 24);
@@ -2,6 +2,10 @@
 #define __COMMON__H
 
 #include <stdbool.h>
+#include <pthread.h>
+
+#include <xenevtchn.h>
+#include <xen/vm_event.h>
 
 #include "xg_private.h"
 #include "xg_save_restore.h"
@@ -91,6 +95,18 @@ struct xc_sr_save_ops
      */
     int (*check_vm_state)(struct xc_sr_context *ctx);
 
+    /**
+     * In a post-copy migration, list the pfns which the restorer or Xen use
+     * before the guest resumes, and which therefore must be sent along with
+     * its state rather than demand-fetched.  This is called once, after the
+     * guest has been suspended.
+     *
+     * @returns the number of pfns written to pfns[], at most max, or -1 for
+     * failure, with errno appropriately set.
+     */
+    int (*postcopy_resident_pfns)(struct xc_sr_context *ctx, xen_pfn_t *pfns,
+                                  unsigned max);
+
     /**
      * Clean up the local environment.  Will be called exactly once, either
      * after a successful save, or upon encountering an error.
@@ -165,6 +181,86 @@ struct xc_sr_restore_ops
     int (*cleanup)(struct xc_sr_context *ctx);
 };
 
+/* Upper bound on the number of threads helping with page data. */
+#define XC_SR_MAX_WORKERS 8
+
+/**
+ * A pool of threads used to spread the CPU-heavy per-page work of a batch
+ * (compression on save, decompression on restore) across several cores.
+ * The thread calling run_workers() always participates, so a pool with no
+ * threads degrades to running the work inline.
+ */
+struct xc_sr_workers
+{
+    unsigned nr_threads;
+    pthread_t threads[XC_SR_MAX_WORKERS - 1];
+
+    /* Per-participant scratch space, indexed by slot. */
+    void *scratch[XC_SR_MAX_WORKERS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond, done_cond;
+
+    /* Current job, protected by lock. */
+    int (*fn)(struct xc_sr_context *ctx, unsigned idx, void *scratch,
+              void *arg);
+    void *arg;
+    unsigned next, count, busy, generation;
+    int rc, err;
+    bool exit;
+
+    struct xc_sr_context *ctx;
+};
+
+/*
+ * Create a pool of up to XC_SR_MAX_WORKERS participants, each with
+ * scratch_size bytes of private scratch space.  Returns 0 on success.
+ */
+int init_workers(struct xc_sr_context *ctx, struct xc_sr_workers *w,
+                 size_t scratch_size);
+
+/*
+ * Call fn() once for each idx in [0, count), spread across the pool.  Returns
+ * 0 if every call succeeded, or the first non-zero return value (with errno
+ * preserved) otherwise.  Remaining work is abandoned after a failure.
+ */
+int run_workers(struct xc_sr_workers *w, unsigned count,
+                int (*fn)(struct xc_sr_context *ctx, unsigned idx,
+                          void *scratch, void *arg),
+                void *arg);
+
+/* Tear down a pool created by init_workers(). */
+void fini_workers(struct xc_sr_workers *w);
+
+/* Scratch space required by compress_page(). */
+size_t compress_page_scratch_size(void);
+
+/*
+ * LZ4 compress a single page into dst, which must be at least PAGE_SIZE
+ * bytes.  Returns the compressed length, or 0 if the page doesn't compress
+ * into fewer than PAGE_SIZE bytes and should be sent as is.
+ */
+size_t compress_page(const void *page, void *dst, void *scratch);
+
+/*
+ * Decompress len bytes of LZ4 data at src into a single page.  Returns 0 on
+ * success, or -1 if the data is corrupt or doesn't describe exactly one page.
+ */
+int decompress_page(const void *src, size_t len, void *page);
+
+/* Does the page consist entirely of zeroes? */
+static inline bool page_is_zero(const void *page)
+{
+    const unsigned long *p = page;
+    unsigned i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); ++i )
+        if ( p[i] )
+            return false;
+
+    return true;
+}
+
 /* x86 PV per-vcpu storage structure for blobs heading Xen-wards. */
 struct xc_sr_x86_pv_restore_vcpu
 {
@@ -198,6 +294,25 @@ struct xc_sr_context
             /* Further debugging information in the stream. */
             bool debug;
 
+            /*
+             * Send page data as PAGE_DATA_ALIGNED records, as the stream is
+             * an image file which the restorer can map.
+             */
+            bool align_pages;
+
+            /* Send page data as PAGE_DATA_COMPRESSED records. */
+            bool compress;
+            struct xc_sr_workers workers;
+            void *compress_buf;
+
+            /*
+             * Send checkpoints as PAGE_DATA_DELTA records, against the
+             * copies of recently sent pages kept in delta.
+             */
+            bool checkpoint_compress;
+            comp_ctx *delta;
+            void *delta_buf;
+
             /* Parameters for tweaking live migration. */
             unsigned max_iterations;
             unsigned dirty_threshold;
@@ -209,6 +324,38 @@ struct xc_sr_context
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+
+            /* Dirty pfn list, used instead of the bitmap while live. */
+            xc_hypercall_buffer_t dirty_pfns_hbuf;
+            unsigned long dirty_pfns_size;
+
+            struct /* Post-copy state. */
+            {
+                /*
+                 * Resume the guest on the receiver after precopy, and send
+                 * the pages it dirtied since afterwards.
+                 */
+                bool enabled;
+
+                /*
+                 * Pages yet to be sent, in a bitmap bounded by p2m_size,
+                 * and the queue of those the receiver asked for.  Both
+                 * protected by lock.
+                 */
+                unsigned long *outstanding;
+                unsigned long nr_outstanding;
+                xen_pfn_t *faults;
+                unsigned fault_prod, fault_cons;
+
+                pthread_mutex_t lock;
+                pthread_cond_t cond;
+
+                /* The background pusher sending the outstanding pages. */
+                pthread_t pusher;
+                bool pusher_started, pusher_stop, pusher_done;
+                int pusher_rc, pusher_errno;
+                int done_pipe[2];
+            } postcopy;
         } save;
 
         struct /* Restore data. */
@@ -260,6 +407,49 @@ struct xc_sr_context
 
             /* Sender has invoked verify mode on the stream. */
             bool verify;
+
+            /*
+             * The stream is an image file, from which the data of
+             * PAGE_DATA_ALIGNED records is mapped, at page_map, while the
+             * record is processed.
+             */
+            bool map_pages;
+            void *page_map;
+            size_t page_map_len;
+
+            /* Decompression helpers, started on the first compressed record. */
+            bool workers_started;
+            struct xc_sr_workers workers;
+
+            struct /* Post-copy state. */
+            {
+                /* Sender has begun a post-copy migration. */
+                bool enabled;
+
+                /* The guest has been resumed. */
+                bool resumed;
+
+                /* END has been sent back, every page having been received. */
+                bool done;
+
+                /* Pages yet to be received, in a bitmap bounded by p2m_size. */
+                unsigned long *outstanding;
+                unsigned long nr_outstanding;
+
+                /* Paging ring, through which Xen reports guest accesses. */
+                bool paging;
+                void *ring_page;
+                vm_event_back_ring_t back_ring;
+                xenevtchn_handle *xce;
+                evtchn_port_t port;
+
+                /* Requests of the vcpus waiting for a page, by vcpu_id. */
+                vm_event_request_t *waiting;
+                unsigned nr_vcpus;
+
+                /* Page aligned buffer to load pages from. */
+                void *page;
+            } postcopy;
         } restore;
     };
 
@@ -391,6 +581,19 @@ static inline int write_record(struct xc_sr_context *ctx,
  */
 int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec);
 
+/* Whether fd is a regular file, so may be seeked within and mapped. */
+bool fd_is_file(int fd);
+
+/*
+ * The two halves of read_record(), for callers which need to look at the
+ * header before deciding how to read the rest.  read_record_header() checks
+ * the length against REC_LENGTH_MAX.
+ */
+int read_record_header(struct xc_sr_context *ctx, int fd,
+                       struct xc_sr_rhdr *rhdr);
+int read_record_data(struct xc_sr_context *ctx, int fd,
+                     const struct xc_sr_rhdr *rhdr, struct xc_sr_record *rec);
+
 /*
  * This would ideally be private in restore.c, but is needed by
  * x86_pv_localise_page() if we receive pagetables frames ahead of the
@@ -0,0 +1,71 @@
+/*
+ * LZ4 compression of page data for PAGE_DATA_COMPRESSED records.
+ *
+ * The compressor is built from the LZ4 sources shared with Xen.  The
+ * decompressor is already linked into libxenguest by
+ * xc_dom_decompress_lz4.c, so only its entry point is used here.
+ */
+
+#include <stdint.h>
+
+#include "xc_sr_common.h"
+
+#define CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define likely(a) a
+#define unlikely(a) a
+
+static inline uint_fast16_t le16_to_cpup(const unsigned char *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static inline uint_fast32_t le32_to_cpup(const unsigned char *buf)
+{
+    return le16_to_cpup(buf) | ((uint32_t)le16_to_cpup(buf + 2) << 16);
+}
+
+#include "../../xen/include/xen/lz4.h"
+#include "../../xen/common/decompress.h"
+#include "../../xen/common/lz4/compress.c"
+
+size_t compress_page_scratch_size(void)
+{
+    return LZ4_MEM_COMPRESS;
+}
+
+size_t compress_page(const void *page, void *dst, void *scratch)
+{
+    size_t len = PAGE_SIZE - 1;
+
+    if ( lz4_compress(page, PAGE_SIZE, dst, &len, scratch) )
+        return 0;
+
+    return len;
+}
+
+int decompress_page(const void *src, size_t len, void *page)
+{
+    size_t out_len = PAGE_SIZE;
+
+    if ( lz4_decompress_unknownoutputsize(src, len, page, &out_len) ||
+         out_len != PAGE_SIZE )
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
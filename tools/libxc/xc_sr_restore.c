@@ -1,6 +1,7 @@
 #include <arpa/inet.h>
 
 #include <assert.h>
+#include <poll.h>
 
 #include "xc_sr_common.h"
 
@@ -194,10 +195,575 @@ int populate_pfns(struct xc_sr_context *ctx, unsigned count,
     return rc;
 }
 
+/*
+ * Send a record to the saver on the back channel.
+ */
+static int postcopy_send_back(struct xc_sr_context *ctx, uint32_t type,
+                              void *data, uint32_t length)
+{
+    xc_interface *xch = ctx->xch;
+    struct iovec iov[] = {
+        { .iov_base = &type,   .iov_len = sizeof(type) },
+        { .iov_base = &length, .iov_len = sizeof(length) },
+        { .iov_base = data,    .iov_len = length },
+    };
+
+    if ( writev_exact(ctx->restore.send_back_fd, iov, length ? 3 : 2) )
+    {
+        PERROR("Failed to write %s record to the back channel",
+               rec_type_to_str(type));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Tell the saver that every outstanding page has been received.
+ */
+static int postcopy_check_done(struct xc_sr_context *ctx)
+{
+    if ( ctx->restore.postcopy.nr_outstanding ||
+         !ctx->restore.postcopy.resumed ||
+         ctx->restore.postcopy.done )
+        return 0;
+
+    ctx->restore.postcopy.done = true;
+
+    return postcopy_send_back(ctx, REC_TYPE_END, NULL, 0);
+}
+
+/*
+ * Answer a request from the paging ring, unpausing the vcpu which made it.
+ */
+static int postcopy_respond(struct xc_sr_context *ctx,
+                            const vm_event_request_t *req)
+{
+    xc_interface *xch = ctx->xch;
+    vm_event_back_ring_t *back_ring = &ctx->restore.postcopy.back_ring;
+    vm_event_response_t rsp = {
+        .version = VM_EVENT_INTERFACE_VERSION,
+        .flags = req->flags,
+        .reason = req->reason,
+        .vcpu_id = req->vcpu_id,
+        .u.mem_paging.gfn = req->u.mem_paging.gfn,
+        .u.mem_paging.flags = req->u.mem_paging.flags,
+    };
+
+    memcpy(RING_GET_RESPONSE(back_ring, back_ring->rsp_prod_pvt), &rsp,
+           sizeof(rsp));
+    back_ring->rsp_prod_pvt++;
+    RING_PUSH_RESPONSES(back_ring);
+
+    if ( xenevtchn_notify(ctx->restore.postcopy.xce,
+                          ctx->restore.postcopy.port) < 0 )
+    {
+        PERROR("Failed to notify the paging ring");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A page has arrived, or been dropped by the guest.  Resume the vcpus which
+ * were waiting for it.
+ */
+static int postcopy_wake(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    vm_event_request_t *req;
+    unsigned i;
+    int rc;
+
+    for ( i = 0; i < ctx->restore.postcopy.nr_vcpus; ++i )
+    {
+        req = &ctx->restore.postcopy.waiting[i];
+        if ( !(req->flags & VM_EVENT_FLAG_VCPU_PAUSED) ||
+             req->u.mem_paging.gfn != pfn )
+            continue;
+
+        rc = postcopy_respond(ctx, req);
+        if ( rc )
+            return rc;
+
+        memset(req, 0, sizeof(*req));
+    }
+
+    return 0;
+}
+
+/*
+ * Consume the requests on the paging ring.  Those for outstanding pages are
+ * passed to the saver in a POSTCOPY_FAULT record, the vcpu which made one
+ * waiting until the page arrives.  Xen retries foreign mappings itself.
+ */
+static int postcopy_handle_requests(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    vm_event_back_ring_t *back_ring = &ctx->restore.postcopy.back_ring;
+    vm_event_request_t req;
+    uint64_t faults[64];
+    unsigned nr_faults = 0;
+    xen_pfn_t gfn;
+    int rc = 0;
+
+    while ( RING_HAS_UNCONSUMED_REQUESTS(back_ring) )
+    {
+        memcpy(&req, RING_GET_REQUEST(back_ring, back_ring->req_cons),
+               sizeof(req));
+        back_ring->req_cons++;
+        back_ring->sring->req_event = back_ring->req_cons + 1;
+
+        gfn = req.u.mem_paging.gfn;
+        if ( req.version != VM_EVENT_INTERFACE_VERSION ||
+             req.reason != VM_EVENT_REASON_MEM_PAGING ||
+             gfn >= ctx->restore.p2m_size )
+        {
+            ERROR("Invalid paging request (version %#x, reason %u, gfn %#"
+                  PRIpfn")", req.version, req.reason, gfn);
+            return -1;
+        }
+
+        if ( req.u.mem_paging.flags & MEM_PAGING_DROP_PAGE )
+        {
+            /* The guest released the page, which needn't arrive now. */
+            if ( test_and_clear_bit(gfn, ctx->restore.postcopy.outstanding) )
+            {
+                --ctx->restore.postcopy.nr_outstanding;
+                rc = postcopy_wake(ctx, gfn);
+                if ( rc )
+                    return rc;
+            }
+            continue;
+        }
+
+        if ( !test_bit(gfn, ctx->restore.postcopy.outstanding) )
+        {
+            /* Loaded since the request was made. */
+            if ( (req.flags & VM_EVENT_FLAG_VCPU_PAUSED) ||
+                 (req.u.mem_paging.flags & MEM_PAGING_EVICT_FAIL) )
+            {
+                rc = postcopy_respond(ctx, &req);
+                if ( rc )
+                    return rc;
+            }
+            continue;
+        }
+
+        if ( req.flags & VM_EVENT_FLAG_VCPU_PAUSED )
+        {
+            if ( req.vcpu_id >= ctx->restore.postcopy.nr_vcpus )
+            {
+                ERROR("Paging request from invalid vcpu %u", req.vcpu_id);
+                return -1;
+            }
+            ctx->restore.postcopy.waiting[req.vcpu_id] = req;
+        }
+
+        faults[nr_faults++] = gfn;
+        if ( nr_faults == ARRAY_SIZE(faults) )
+        {
+            rc = postcopy_send_back(ctx, REC_TYPE_POSTCOPY_FAULT, faults,
+                                    nr_faults * sizeof(*faults));
+            if ( rc )
+                return rc;
+            nr_faults = 0;
+        }
+    }
+
+    if ( nr_faults )
+        rc = postcopy_send_back(ctx, REC_TYPE_POSTCOPY_FAULT, faults,
+                                nr_faults * sizeof(*faults));
+
+    return rc ?: postcopy_check_done(ctx);
+}
+
+/*
+ * Once the guest has been resumed, serve the paging ring until the next
+ * record can be read from the stream.
+ */
+static int postcopy_wait_for_stream(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct pollfd fds[2] = {
+        { .fd = ctx->fd, .events = POLLIN },
+        { .fd = xenevtchn_fd(ctx->restore.postcopy.xce), .events = POLLIN },
+    };
+    int port, rc;
+
+    for ( ;; )
+    {
+        if ( poll(fds, ARRAY_SIZE(fds), -1) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            PERROR("Failed to poll the stream and paging ring");
+            return -1;
+        }
+
+        if ( fds[1].revents )
+        {
+            port = xenevtchn_pending(ctx->restore.postcopy.xce);
+            if ( port < 0 ||
+                 xenevtchn_unmask(ctx->restore.postcopy.xce, port) < 0 )
+            {
+                PERROR("Failed to acknowledge the paging ring event");
+                return -1;
+            }
+
+            rc = postcopy_handle_requests(ctx);
+            if ( rc )
+                return rc;
+        }
+
+        if ( fds[0].revents )
+            return 0;
+    }
+}
+
+/*
+ * Start paging the guest, to be told of its accesses to outstanding pages,
+ * in the way xenpaging does.
+ */
+static int postcopy_enable_paging(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    uint64_t ring_pfn;
+    xen_pfn_t pfn;
+    uint32_t port;
+    int rc;
+
+    if ( xc_hvm_param_get(xch, ctx->domid, HVM_PARAM_PAGING_RING_PFN,
+                          &ring_pfn) )
+    {
+        PERROR("Failed to get HVM_PARAM_PAGING_RING_PFN");
+        return -1;
+    }
+    else if ( !ring_pfn )
+    {
+        ERROR("No paging ring for post-copy migration");
+        return -1;
+    }
+
+    /* Missing if the sender was itself being paged. */
+    pfn = ring_pfn;
+    rc = populate_pfns(ctx, 1, &pfn, NULL);
+    if ( rc )
+        return rc;
+
+    ctx->restore.postcopy.ring_page = xenforeignmemory_map(
+        xch->fmem, ctx->domid, PROT_READ | PROT_WRITE, 1, &pfn, NULL);
+    if ( !ctx->restore.postcopy.ring_page )
+    {
+        PERROR("Failed to map the paging ring");
+        return -1;
+    }
+
+    if ( xc_mem_paging_enable(xch, ctx->domid, &port) )
+    {
+        PERROR("Failed to enable paging for post-copy migration");
+        return -1;
+    }
+    ctx->restore.postcopy.paging = true;
+
+    ctx->restore.postcopy.xce = xenevtchn_open(NULL, 0);
+    if ( !ctx->restore.postcopy.xce )
+    {
+        PERROR("Failed to open event channel handle");
+        return -1;
+    }
+
+    rc = xenevtchn_bind_interdomain(ctx->restore.postcopy.xce, ctx->domid,
+                                    port);
+    if ( rc < 0 )
+    {
+        PERROR("Failed to bind the paging ring event channel");
+        return -1;
+    }
+    ctx->restore.postcopy.port = rc;
+
+    SHARED_RING_INIT((vm_event_sring_t *)ctx->restore.postcopy.ring_page);
+    BACK_RING_INIT(&ctx->restore.postcopy.back_ring,
+                   (vm_event_sring_t *)ctx->restore.postcopy.ring_page,
+                   PAGE_SIZE);
+
+    /* Now that the ring is set, remove it from the guest's physmap. */
+    if ( xc_domain_decrease_reservation_exact(xch, ctx->domid, 1, 0, &pfn) )
+        PERROR("Failed to remove ring from guest physmap");
+
+    return 0;
+}
+
+/*
+ * Handle a POSTCOPY_BEGIN record: memory is about to be demand-fetched.
+ */
+static int handle_postcopy_begin(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct restore_callbacks *callbacks = ctx->restore.callbacks;
+
+    if ( ctx->restore.postcopy.enabled )
+    {
+        ERROR("Duplicate POSTCOPY_BEGIN record");
+        return -1;
+    }
+    else if ( !ctx->dominfo.hvm ||
+              ctx->restore.checkpointed != XC_MIG_STREAM_NONE ||
+              ctx->restore.send_back_fd < 0 || !callbacks ||
+              !callbacks->restore_results || !callbacks->postcopy_transition )
+    {
+        ERROR("Post-copy migration not supported for this restore");
+        return -1;
+    }
+
+    ctx->restore.postcopy.outstanding = bitmap_alloc(ctx->restore.p2m_size);
+    ctx->restore.postcopy.nr_vcpus = ctx->dominfo.max_vcpu_id + 1;
+    ctx->restore.postcopy.waiting = calloc(
+        ctx->restore.postcopy.nr_vcpus,
+        sizeof(*ctx->restore.postcopy.waiting));
+    if ( posix_memalign(&ctx->restore.postcopy.page, PAGE_SIZE, PAGE_SIZE) )
+        ctx->restore.postcopy.page = NULL;
+
+    if ( !ctx->restore.postcopy.outstanding ||
+         !ctx->restore.postcopy.waiting || !ctx->restore.postcopy.page )
+    {
+        ERROR("Unable to allocate memory for post-copy migration");
+        return -1;
+    }
+
+    ctx->restore.postcopy.enabled = true;
+
+    return 0;
+}
+
+/*
+ * Evict the outstanding pages of a POSTCOPY_PFNS record, after recording
+ * their types, so that the guest's accesses to them fault to us.
+ */
+static int postcopy_evict_pfns(struct xc_sr_context *ctx, unsigned count,
+                               xen_pfn_t *pfns, uint32_t *types)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned i;
+    int rc;
+
+    if ( !ctx->restore.postcopy.enabled || ctx->restore.postcopy.resumed )
+    {
+        ERROR("POSTCOPY_PFNS record out of order");
+        return -1;
+    }
+
+    if ( !ctx->restore.postcopy.paging )
+    {
+        rc = postcopy_enable_paging(ctx);
+        if ( rc )
+            return rc;
+    }
+
+    rc = populate_pfns(ctx, count, pfns, types);
+    if ( rc )
+    {
+        ERROR("Failed to populate pfns for batch of %u pages", count);
+        return rc;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
+
+        if ( types[i] >= XEN_DOMCTL_PFINFO_BROKEN )
+            continue;
+
+        if ( test_and_set_bit(pfns[i], ctx->restore.postcopy.outstanding) )
+        {
+            ERROR("pfn %#"PRIpfn" already outstanding", pfns[i]);
+            return -1;
+        }
+
+        if ( xc_mem_paging_nominate(xch, ctx->domid, pfns[i]) ||
+             xc_mem_paging_evict(xch, ctx->domid, pfns[i]) )
+        {
+            PERROR("Failed to evict pfn %#"PRIpfn, pfns[i]);
+            return -1;
+        }
+
+        ++ctx->restore.postcopy.nr_outstanding;
+    }
+
+    return 0;
+}
+
+/*
+ * Handle a POSTCOPY_TRANSITION record: resume the guest, and fetch the
+ * outstanding pages from then on.
+ */
+static int handle_postcopy_transition(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct restore_callbacks *callbacks = ctx->restore.callbacks;
+    int rc;
+
+    if ( !ctx->restore.postcopy.enabled || ctx->restore.postcopy.resumed )
+    {
+        ERROR("POSTCOPY_TRANSITION record out of order");
+        return -1;
+    }
+
+    rc = ctx->restore.ops.stream_complete(ctx);
+    if ( rc )
+        return rc;
+
+    callbacks->restore_results(ctx->restore.xenstore_gfn,
+                               ctx->restore.console_gfn, callbacks->data);
+
+    if ( callbacks->postcopy_transition(callbacks->data) != 1 )
+    {
+        ERROR("Failed to resume the guest for post-copy");
+        return -1;
+    }
+
+    ctx->restore.postcopy.resumed = true;
+    IPRINTF("Guest resumed with %lu pages outstanding",
+            ctx->restore.postcopy.nr_outstanding);
+
+    return postcopy_check_done(ctx);
+}
+
+/*
+ * Load the pages of a record received once the guest has been resumed, and
+ * wake the vcpus waiting for them.  Pages which aren't outstanding have been
+ * dropped by the guest.
+ */
+static int postcopy_load_pages(struct xc_sr_context *ctx, unsigned count,
+                               xen_pfn_t *pfns, uint32_t *types,
+                               void *page_data)
+{
+    xc_interface *xch = ctx->xch;
+    void *page = ctx->restore.postcopy.page;
+    unsigned i;
+    int rc;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( types[i] >= XEN_DOMCTL_PFINFO_BROKEN )
+            continue;
+
+        if ( !test_and_clear_bit(pfns[i], ctx->restore.postcopy.outstanding) )
+        {
+            if ( page_data )
+                page_data += PAGE_SIZE;
+            continue;
+        }
+
+        if ( page_data )
+        {
+            memcpy(page, page_data, PAGE_SIZE);
+            page_data += PAGE_SIZE;
+
+            rc = ctx->restore.ops.localise_page(ctx, types[i], page);
+            if ( rc )
+            {
+                ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
+                      pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+                return rc;
+            }
+        }
+        else
+            memset(page, 0, PAGE_SIZE);
+
+        /* ENOENT if the guest has dropped the page meanwhile. */
+        if ( xc_mem_paging_load(xch, ctx->domid, pfns[i], page) &&
+             errno != ENOENT )
+        {
+            PERROR("Failed to load pfn %#"PRIpfn, pfns[i]);
+            return -1;
+        }
+
+        --ctx->restore.postcopy.nr_outstanding;
+
+        rc = postcopy_wake(ctx, pfns[i]);
+        if ( rc )
+            return rc;
+    }
+
+    return postcopy_check_done(ctx);
+}
+
+/*
+ * Finish a post-copy migration, once the saver has sent END.
+ */
+static int postcopy_complete(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned i;
+    int rc;
+
+    if ( !ctx->restore.postcopy.resumed )
+    {
+        ERROR("Post-copy stream ended before the guest was resumed");
+        return -1;
+    }
+    else if ( ctx->restore.postcopy.nr_outstanding )
+    {
+        ERROR("Post-copy stream ended with %lu pages outstanding",
+              ctx->restore.postcopy.nr_outstanding);
+        return -1;
+    }
+
+    if ( !ctx->restore.postcopy.paging )
+        return 0;
+
+    /* Requests made since the last page arrived. */
+    rc = postcopy_handle_requests(ctx);
+    if ( rc )
+        return rc;
+
+    for ( i = 0; i < ctx->restore.postcopy.nr_vcpus; ++i )
+        if ( ctx->restore.postcopy.waiting[i].flags &
+             VM_EVENT_FLAG_VCPU_PAUSED )
+        {
+            rc = postcopy_respond(ctx, &ctx->restore.postcopy.waiting[i]);
+            if ( rc )
+                return rc;
+        }
+
+    if ( xc_mem_paging_disable(xch, ctx->domid) )
+    {
+        PERROR("Failed to disable paging");
+        return -1;
+    }
+    ctx->restore.postcopy.paging = false;
+
+    return 0;
+}
+
+static void postcopy_cleanup(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( ctx->restore.postcopy.paging &&
+         xc_mem_paging_disable(xch, ctx->domid) )
+        PERROR("Failed to disable paging");
+
+    if ( ctx->restore.postcopy.port )
+        xenevtchn_unbind(ctx->restore.postcopy.xce,
+                         ctx->restore.postcopy.port);
+    if ( ctx->restore.postcopy.xce )
+        xenevtchn_close(ctx->restore.postcopy.xce);
+    if ( ctx->restore.postcopy.ring_page )
+        xenforeignmemory_unmap(xch->fmem, ctx->restore.postcopy.ring_page, 1);
+
+    free(ctx->restore.postcopy.page);
+    free(ctx->restore.postcopy.waiting);
+    free(ctx->restore.postcopy.outstanding);
+}
+
 /*
  * Given a list of pfns, their types, and a block of page data from the
  * stream, populate and record their types, map the relevant subset and copy
- * the data into the guest.
+ * the data into the guest.  A NULL page_data indicates that every page is
+ * zero.
  */
 static int process_page_data(struct xc_sr_context *ctx, unsigned count,
                              xen_pfn_t *pfns, uint32_t *types, void *page_data)
@@ -211,6 +777,13 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
         j,         /* j indexes the subset of pfns we decide to map. */
         nr_pages = 0;
 
+    if ( ctx->restore.postcopy.resumed )
+    {
+        free(map_errs);
+        free(mfns);
+        return postcopy_load_pages(ctx, count, pfns, types, page_data);
+    }
+
     if ( !mfns || !map_errs )
     {
         rc = -1;
@@ -285,6 +858,20 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
             goto err;
         }
 
+        if ( !page_data )
+        {
+            /* A zero page needs no localisation. */
+            if ( !ctx->restore.verify )
+                memset(guest_page, 0, PAGE_SIZE);
+            else if ( !page_is_zero(guest_page) )
+                ERROR("verify pfn %#"PRIpfn" failed (type %#"PRIx32")",
+                      pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+
+            ++j;
+            guest_page += PAGE_SIZE;
+            continue;
+        }
+
         /* Undo page normalisation done by the saver. */
         rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
         if ( rc )
@@ -325,9 +912,239 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
     return rc;
 }
 
+struct decompress_batch
+{
+    const void *src;
+    const uint32_t *lens;
+    const size_t *offsets;
+    void *dst;
+};
+
+static int decompress_one(struct xc_sr_context *ctx, unsigned idx,
+                          void *scratch, void *arg)
+{
+    xc_interface *xch = ctx->xch;
+    struct decompress_batch *batch = arg;
+    const void *src = batch->src + batch->offsets[idx];
+    void *dst = batch->dst + idx * PAGE_SIZE;
+
+    if ( batch->lens[idx] == PAGE_SIZE )
+        memcpy(dst, src, PAGE_SIZE);
+    else if ( decompress_page(src, batch->lens[idx], dst) )
+    {
+        ERROR("Failed to decompress page %u of record (%u bytes)",
+              idx, batch->lens[idx]);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Validate the per-page lengths of a PAGE_DATA_COMPRESSED record, and
+ * decompress its page data into a newly allocated buffer, which the caller
+ * must free().  The pages are spread across the worker pool.
+ */
+static int decompress_page_data(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec,
+                                unsigned pages_of_data, void **page_data)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_header *pages = rec->data;
+    const uint32_t *lens = (const void *)&pages->pfn[pages->count];
+    size_t total = sizeof(*pages) + (sizeof(uint64_t) * pages->count);
+    size_t *offsets = NULL;
+    void *buf = NULL;
+    struct decompress_batch batch;
+    unsigned i;
+    int rc = -1;
+
+    *page_data = NULL;
+
+    if ( pages_of_data == 0 )
+        return 0;
+
+    if ( pages_of_data > REC_LENGTH_MAX / PAGE_SIZE )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record has too many pages (%u)",
+              pages_of_data);
+        goto err;
+    }
+
+    if ( rec->length < total + (sizeof(*lens) * pages_of_data) )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record (length %u) too short to contain "
+              "%u page lengths", rec->length, pages_of_data);
+        goto err;
+    }
+    total += sizeof(*lens) * pages_of_data;
+
+    offsets = malloc(pages_of_data * sizeof(*offsets));
+    buf = malloc(pages_of_data * PAGE_SIZE);
+    if ( !offsets || !buf )
+    {
+        ERROR("Unable to allocate memory to decompress %u pages",
+              pages_of_data);
+        goto err;
+    }
+
+    for ( i = 0; i < pages_of_data; ++i )
+    {
+        if ( lens[i] == 0 || lens[i] > PAGE_SIZE )
+        {
+            ERROR("Invalid length %u for page %u of PAGE_DATA_COMPRESSED "
+                  "record", lens[i], i);
+            goto err;
+        }
+
+        offsets[i] = total;
+        total += lens[i];
+    }
+
+    if ( rec->length != total )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record wrong size: length %u, "
+              "expected %zu", rec->length, total);
+        goto err;
+    }
+
+    if ( !ctx->restore.workers_started )
+    {
+        rc = init_workers(ctx, &ctx->restore.workers, 0);
+        if ( rc )
+            goto err;
+        ctx->restore.workers_started = true;
+    }
+
+    batch.src = rec->data;
+    batch.lens = lens;
+    batch.offsets = offsets;
+    batch.dst = buf;
+
+    rc = run_workers(&ctx->restore.workers, pages_of_data,
+                     decompress_one, &batch);
+    if ( rc )
+        goto err;
+
+    *page_data = buf;
+    buf = NULL;
+
+ err:
+    free(buf);
+    free(offsets);
+
+    return rc;
+}
+
+/*
+ * Apply the delta encoded pages of a PAGE_DATA_DELTA record to copies of
+ * the guest's current pages, in a newly allocated buffer which the caller
+ * must free().  Pages sent in full need not exist yet, so every pfn is
+ * populated first.
+ */
+static int undelta_page_data(struct xc_sr_context *ctx,
+                             struct xc_sr_record *rec, unsigned count,
+                             xen_pfn_t *pfns, uint32_t *types,
+                             unsigned pages_of_data, void **page_data)
+{
+    xc_interface *xch = ctx->xch;
+    size_t start = sizeof(struct xc_sr_rec_page_data_header) +
+        (sizeof(uint64_t) * count);
+    unsigned long pos = start;
+    xen_pfn_t *gfns = NULL;
+    int *map_errs = NULL;
+    void *mapping = NULL, *buf = NULL;
+    unsigned i, p;
+    int rc = -1;
+
+    *page_data = NULL;
+
+    if ( pages_of_data == 0 )
+    {
+        if ( rec->length != start )
+        {
+            ERROR("PAGE_DATA_DELTA record wrong size: length %u, "
+                  "expected %zu", rec->length, start);
+            return -1;
+        }
+        return 0;
+    }
+
+    gfns = malloc(pages_of_data * sizeof(*gfns));
+    map_errs = malloc(pages_of_data * sizeof(*map_errs));
+    buf = malloc(pages_of_data * PAGE_SIZE);
+    if ( !gfns || !map_errs || !buf )
+    {
+        ERROR("Unable to allocate memory to apply %u delta pages",
+              pages_of_data);
+        goto err;
+    }
+
+    rc = populate_pfns(ctx, count, pfns, types);
+    if ( rc )
+    {
+        ERROR("Failed to populate pfns for batch of %u pages", count);
+        goto err;
+    }
+    rc = -1;
+
+    for ( i = 0, p = 0; i < count; ++i )
+        if ( types[i] < XEN_DOMCTL_PFINFO_BROKEN )
+            gfns[p++] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
+
+    mapping = xenforeignmemory_map(xch->fmem, ctx->domid, PROT_READ,
+                                   pages_of_data, gfns, map_errs);
+    if ( !mapping )
+    {
+        PERROR("Unable to map %u pages to apply deltas to", pages_of_data);
+        goto err;
+    }
+
+    for ( p = 0; p < pages_of_data; ++p )
+    {
+        if ( map_errs[p] )
+        {
+            ERROR("Mapping gfn %#"PRIpfn" failed with %d",
+                  gfns[p], map_errs[p]);
+            goto err;
+        }
+
+        memcpy(buf + p * PAGE_SIZE, mapping + p * PAGE_SIZE, PAGE_SIZE);
+        if ( xc_compression_uncompress_page(xch, rec->data, rec->length, &pos,
+                                            buf + p * PAGE_SIZE) )
+        {
+            ERROR("Invalid delta for page %u of PAGE_DATA_DELTA record", p);
+            goto err;
+        }
+    }
+
+    if ( pos != rec->length )
+    {
+        ERROR("PAGE_DATA_DELTA record wrong size: length %u, used %lu",
+              rec->length, pos);
+        goto err;
+    }
+
+    *page_data = buf;
+    buf = NULL;
+    rc = 0;
+
+ err:
+    if ( mapping )
+        xenforeignmemory_unmap(xch->fmem, mapping, pages_of_data);
+    free(buf);
+    free(map_errs);
+    free(gfns);
+
+    return rc;
+}
+
 /*
- * Validate a PAGE_DATA record from the stream, and pass the results to
- * process_page_data() to actually perform the legwork.
+ * Validate a PAGE_DATA, PAGE_DATA_ALIGNED, PAGE_DATA_COMPRESSED,
+ * PAGE_DATA_DELTA or PAGE_DATA_ZERO record from the stream, and pass the
+ * results to process_page_data() to actually perform the legwork.  The pfns
+ * of a POSTCOPY_PFNS record are passed to postcopy_evict_pfns() instead.
  */
 static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 {
@@ -338,6 +1155,7 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 
     xen_pfn_t *pfns = NULL, pfn;
     uint32_t *types = NULL, type;
+    void *page_data = NULL;
 
     if ( rec->length < sizeof(*pages) )
     {
@@ -392,6 +1210,79 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         types[i] = type;
     }
 
+    if ( rec->type == REC_TYPE_PAGE_DATA_COMPRESSED )
+    {
+        rc = decompress_page_data(ctx, rec, pages_of_data, &page_data);
+        if ( rc )
+            goto err;
+
+        rc = process_page_data(ctx, pages->count, pfns, types, page_data);
+        goto err;
+    }
+
+    if ( rec->type == REC_TYPE_PAGE_DATA_DELTA )
+    {
+        rc = undelta_page_data(ctx, rec, pages->count, pfns, types,
+                               pages_of_data, &page_data);
+        if ( rc )
+            goto err;
+
+        rc = process_page_data(ctx, pages->count, pfns, types, page_data);
+        goto err;
+    }
+
+    if ( rec->type == REC_TYPE_PAGE_DATA_ALIGNED )
+    {
+        struct xc_sr_rec_page_data_aligned_header *ahdr = rec->data;
+
+        if ( ahdr->data_offset < (sizeof(*ahdr) +
+                                  (sizeof(uint64_t) * pages->count)) ||
+             rec->length != (ahdr->data_offset +
+                             (PAGE_SIZE * pages_of_data)) )
+        {
+            ERROR("PAGE_DATA_ALIGNED record wrong size: length %u, data "
+                  "offset %u, expected %zu + %lu", rec->length,
+                  ahdr->data_offset, (sizeof(uint64_t) * pages->count),
+                  (PAGE_SIZE * pages_of_data));
+            goto err;
+        }
+
+        rc = process_page_data(ctx, pages->count, pfns, types,
+                               ctx->restore.page_map ?:
+                               rec->data + ahdr->data_offset);
+        goto err;
+    }
+
+    if ( rec->type == REC_TYPE_POSTCOPY_PFNS )
+    {
+        if ( rec->length != (sizeof(*pages) +
+                             (sizeof(uint64_t) * pages->count)) )
+        {
+            ERROR("POSTCOPY_PFNS record wrong size: length %u, expected "
+                  "%zu + %zu", rec->length, sizeof(*pages),
+                  (sizeof(uint64_t) * pages->count));
+            goto err;
+        }
+
+        rc = postcopy_evict_pfns(ctx, pages->count, pfns, types);
+        goto err;
+    }
+
+    if ( rec->type == REC_TYPE_PAGE_DATA_ZERO )
+    {
+        if ( rec->length != (sizeof(*pages) +
+                             (sizeof(uint64_t) * pages->count)) )
+        {
+            ERROR("PAGE_DATA_ZERO record wrong size: length %u, expected "
+                  "%zu + %zu", rec->length, sizeof(*pages),
+                  (sizeof(uint64_t) * pages->count));
+            goto err;
+        }
+
+        rc = process_page_data(ctx, pages->count, pfns, types, NULL);
+        goto err;
+    }
+
     if ( rec->length != (sizeof(*pages) +
                          (sizeof(uint64_t) * pages->count) +
                          (PAGE_SIZE * pages_of_data)) )
@@ -405,6 +1296,7 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
     rc = process_page_data(ctx, pages->count, pfns, types,
                            &pages->pfn[pages->count]);
  err:
+    free(page_data);
     free(types);
     free(pfns);
 
@@ -637,9 +1529,22 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         break;
 
     case REC_TYPE_PAGE_DATA:
+    case REC_TYPE_PAGE_DATA_ALIGNED:
+    case REC_TYPE_PAGE_DATA_COMPRESSED:
+    case REC_TYPE_PAGE_DATA_DELTA:
+    case REC_TYPE_PAGE_DATA_ZERO:
+    case REC_TYPE_POSTCOPY_PFNS:
         rc = handle_page_data(ctx, rec);
         break;
 
+    case REC_TYPE_POSTCOPY_BEGIN:
+        rc = handle_postcopy_begin(ctx);
+        break;
+
+    case REC_TYPE_POSTCOPY_TRANSITION:
+        rc = handle_postcopy_transition(ctx);
+        break;
+
     case REC_TYPE_VERIFY:
         DPRINTF("Verify mode enabled");
         ctx->restore.verify = true;
@@ -657,9 +1562,118 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
     free(rec->data);
     rec->data = NULL;
 
+    if ( ctx->restore.page_map )
+    {
+        munmap(ctx->restore.page_map, ctx->restore.page_map_len);
+        ctx->restore.page_map = NULL;
+    }
+
     return rc;
 }
 
+/*
+ * Read a record from an image file.  The page data of a PAGE_DATA_ALIGNED
+ * record which is page aligned in the file is mapped, at
+ * ctx->restore.page_map, rather than read into the record, leaving rec->data
+ * holding the header and pfn array only.
+ */
+static int read_record_mapped(struct xc_sr_context *ctx,
+                              struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rhdr rhdr;
+    struct xc_sr_rec_page_data_aligned_header hdr;
+    size_t datasz = ROUNDUP(rhdr.length, REC_ALIGN_ORDER);
+    off_t pos;
+    void *data, *map;
+
+    if ( read_record_header(ctx, ctx->fd, &rhdr) )
+        return -1;
+
+    if ( rhdr.type != REC_TYPE_PAGE_DATA_ALIGNED ||
+         rhdr.length < sizeof(hdr) )
+        return read_record_data(ctx, ctx->fd, &rhdr, rec);
+
+    if ( read_exact(ctx->fd, &hdr, sizeof(hdr)) )
+    {
+        PERROR("Failed to read PAGE_DATA_ALIGNED header from stream");
+        return -1;
+    }
+
+    if ( hdr.data_offset > rhdr.length ||
+         hdr.data_offset < sizeof(hdr) + (sizeof(uint64_t) * hdr.count) )
+    {
+        ERROR("PAGE_DATA_ALIGNED data offset %u invalid for %u pfns in "
+              "length %u", hdr.data_offset, hdr.count, rhdr.length);
+        return -1;
+    }
+
+    data = malloc(hdr.data_offset);
+    if ( !data )
+        goto nomem;
+
+    memcpy(data, &hdr, sizeof(hdr));
+    if ( read_exact(ctx->fd, data + sizeof(hdr),
+                    hdr.data_offset - sizeof(hdr)) )
+        goto err;
+
+    datasz -= hdr.data_offset;
+    pos = lseek(ctx->fd, 0, SEEK_CUR);
+    map = MAP_FAILED;
+    if ( datasz && pos >= 0 && !(pos & (PAGE_SIZE - 1)) )
+        map = mmap(NULL, datasz, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   ctx->fd, pos);
+
+    if ( map == MAP_FAILED )
+    {
+        /* Copied out of place, or a filesystem which can't map.  Read it. */
+        void *all = realloc(data, hdr.data_offset + datasz);
+
+        if ( !all )
+            goto nomem;
+        data = all;
+
+        if ( read_exact(ctx->fd, data + hdr.data_offset, datasz) )
+            goto err;
+    }
+    else
+    {
+        if ( lseek(ctx->fd, pos + datasz, SEEK_SET) < 0 )
+        {
+            PERROR("Failed to seek past PAGE_DATA_ALIGNED data");
+            munmap(map, datasz);
+            free(data);
+            return -1;
+        }
+
+        /* The restore will touch all of it soon, and in order. */
+        madvise(map, datasz, MADV_WILLNEED);
+
+        ctx->restore.page_map = map;
+        ctx->restore.page_map_len = datasz;
+    }
+
+    rec->type = rhdr.type;
+    rec->length = rhdr.length;
+    rec->data = data;
+
+    return 0;
+
+ nomem:
+    ERROR("Unable to allocate %zu bytes for record data (0x%08x, %s)",
+          (size_t)ROUNDUP(rhdr.length, REC_ALIGN_ORDER), rhdr.type,
+          rec_type_to_str(rhdr.type));
+    free(data);
+    return -1;
+
+ err:
+    PERROR("Failed to read %zu bytes of data for record (0x%08x, %s)",
+           (size_t)ROUNDUP(rhdr.length, REC_ALIGN_ORDER), rhdr.type,
+           rec_type_to_str(rhdr.type));
+    free(data);
+    return -1;
+}
+
 static int setup(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -723,6 +1737,9 @@ static void cleanup(struct xc_sr_context *ctx)
                                    NRPAGES(bitmap_size(ctx->restore.p2m_size)));
     free(ctx->restore.buffered_records);
     free(ctx->restore.populated_pfns);
+    postcopy_cleanup(ctx);
+    if ( ctx->restore.workers_started )
+        fini_workers(&ctx->restore.workers);
     if ( ctx->restore.ops.cleanup(ctx) )
         PERROR("Failed to clean up");
 }
@@ -744,7 +1761,17 @@ static int restore(struct xc_sr_context *ctx)
 
     do
     {
-        rc = read_record(ctx, ctx->fd, &rec);
+        if ( ctx->restore.postcopy.paging && ctx->restore.postcopy.resumed )
+        {
+            rc = postcopy_wait_for_stream(ctx);
+            if ( rc )
+                goto err;
+        }
+
+        if ( ctx->restore.map_pages )
+            rc = read_record_mapped(ctx, &rec);
+        else
+            rc = read_record(ctx, ctx->fd, &rec);
         if ( rc )
         {
             if ( ctx->restore.buffer_all_records )
@@ -787,6 +1814,17 @@ static int restore(struct xc_sr_context *ctx)
 
  remus_failover:
 
+    if ( ctx->restore.postcopy.enabled )
+    {
+        /* As with COLO, stream_complete has already been called. */
+        rc = postcopy_complete(ctx);
+        if ( rc )
+            goto err;
+
+        IPRINTF("Post-copy restore successful");
+        goto done;
+    }
+
     if ( ctx->restore.checkpointed == XC_MIG_STREAM_COLO )
     {
         /* With COLO, we have already called stream_complete */
@@ -844,6 +1882,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.restore.xenstore_evtchn = store_evtchn;
     ctx.restore.xenstore_domid = store_domid;
     ctx.restore.checkpointed = stream_type;
+    ctx.restore.map_pages = stream_type == XC_MIG_STREAM_NONE &&
+        fd_is_file(io_fd);
     ctx.restore.callbacks = callbacks;
     ctx.restore.send_back_fd = send_back_fd;
 
@@ -4,25 +4,17 @@
 #include "xc_sr_common_x86.h"
 
 /*
- * Process an HVM_CONTEXT record from the stream.
+ * Process an HVM_CONTEXT record from the stream.  The record's data is kept
+ * as it is until the stream is complete, rather than copied.
  */
 static int handle_hvm_context(struct xc_sr_context *ctx,
                               struct xc_sr_record *rec)
 {
-    xc_interface *xch = ctx->xch;
-    void *p;
-
-    p = malloc(rec->length);
-    if ( !p )
-    {
-        ERROR("Unable to allocate %u bytes for hvm context", rec->length);
-        return -1;
-    }
-
     free(ctx->x86_hvm.restore.context);
 
-    ctx->x86_hvm.restore.context = memcpy(p, rec->data, rec->length);
+    ctx->x86_hvm.restore.context = rec->data;
     ctx->x86_hvm.restore.contextsz = rec->length;
+    rec->data = NULL;
 
     return 0;
 }
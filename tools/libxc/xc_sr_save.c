@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <poll.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "xc_sr_common.h"
@@ -66,6 +68,28 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
     return write_record(ctx, &checkpoint);
 }
 
+/* Worst case size of a page encoded by xc_compression_compress_pages(). */
+#define DELTA_PAGE_MAX (PAGE_SIZE + 16)
+
+struct compress_batch
+{
+    void **data;
+    uint32_t *lens;
+};
+
+static int compress_one(struct xc_sr_context *ctx, unsigned idx,
+                        void *scratch, void *arg)
+{
+    struct compress_batch *batch = arg;
+    size_t len = compress_page(batch->data[idx],
+                               ctx->save.compress_buf + idx * PAGE_SIZE,
+                               scratch);
+
+    batch->lens[idx] = len ?: PAGE_SIZE;
+
+    return 0;
+}
+
 /*
  * Writes a batch of memory as a PAGE_DATA record into the stream.  The batch
  * is constructed in ctx->save.batch_pfns.
@@ -74,10 +98,18 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
  * - gets the types for each pfn in the batch.
  * - for each pfn with real data:
  *   - maps and attempts to localise the pages.
- * - construct and writes a PAGE_DATA record into the stream.
+ * - writes any pages which are entirely zero as a PAGE_DATA_ZERO record.
+ * - once checkpointing, optionally delta encodes the remaining pages against
+ *   what was sent in previous checkpoints.
+ * - otherwise, optionally compresses them, using the worker pool.
+ * - construct and writes a PAGE_DATA, PAGE_DATA_ALIGNED, PAGE_DATA_DELTA or
+ *   PAGE_DATA_COMPRESSED record into the stream.
  */
 static int write_batch(struct xc_sr_context *ctx)
 {
+    static const char zeroes[(1u << REC_ALIGN_ORDER) - 1] = { 0 };
+    static const char zero_page[PAGE_SIZE];
+
     xc_interface *xch = ctx->xch;
     xen_pfn_t *mfns = NULL, *types = NULL;
     void *guest_mapping = NULL;
@@ -85,11 +117,15 @@ static int write_batch(struct xc_sr_context *ctx)
     void **local_pages = NULL;
     int *errors = NULL, rc = -1;
     unsigned i, p, nr_pages = 0, nr_pages_mapped = 0;
-    unsigned nr_pfns = ctx->save.nr_batch_pfns;
+    unsigned nr_pfns = ctx->save.nr_batch_pfns, nr_rec_pfns = 0, nr_zero = 0;
     void *page, *orig_page;
-    uint64_t *rec_pfns = NULL;
+    uint64_t *rec_pfns = NULL, *zero_pfns = NULL;
+    uint32_t *rec_lens = NULL;
+    void **data = NULL;
+    size_t rec_length;
     struct iovec *iov = NULL; int iovcnt = 0;
     struct xc_sr_rec_page_data_header hdr = { 0 };
+    struct xc_sr_rec_page_data_aligned_header ahdr;
     struct xc_sr_record rec =
     {
         .type = REC_TYPE_PAGE_DATA,
@@ -108,7 +144,7 @@ static int write_batch(struct xc_sr_context *ctx)
     /* Pointers to locally allocated pages.  Need freeing. */
     local_pages = calloc(nr_pfns, sizeof(*local_pages));
     /* iovec[] for writev(). */
-    iov = malloc((nr_pfns + 4) * sizeof(*iov));
+    iov = malloc((nr_pfns + 6) * sizeof(*iov));
 
     if ( !mfns || !types || !errors || !guest_data || !local_pages || !iov )
     {
@@ -206,21 +242,62 @@ static int write_batch(struct xc_sr_context *ctx)
     }
 
     rec_pfns = malloc(nr_pfns * sizeof(*rec_pfns));
-    if ( !rec_pfns )
+    zero_pfns = malloc(nr_pfns * sizeof(*zero_pfns));
+    if ( !rec_pfns || !zero_pfns )
     {
         ERROR("Unable to allocate %zu bytes of memory for page data pfn list",
-              nr_pfns * sizeof(*rec_pfns));
+              2 * nr_pfns * sizeof(*rec_pfns));
         goto err;
     }
 
-    hdr.count = nr_pfns;
+    for ( i = 0; i < nr_pfns; ++i )
+    {
+        uint64_t pfn = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
 
-    rec.length = sizeof(hdr);
-    rec.length += nr_pfns * sizeof(*rec_pfns);
-    rec.length += nr_pages * PAGE_SIZE;
+        /* Zero pages are sent by pfn alone, without any page data. */
+        if ( guest_data[i] && page_is_zero(guest_data[i]) )
+        {
+            zero_pfns[nr_zero++] = pfn;
+            guest_data[i] = NULL;
+            --nr_pages;
+        }
+        else
+            rec_pfns[nr_rec_pfns++] = pfn;
+    }
 
-    for ( i = 0; i < nr_pfns; ++i )
-        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
+    /* Whatever the receiver has for pages sent without data, it isn't the
+     * copy in the delta cache. */
+    if ( ctx->save.delta )
+    {
+        for ( i = 0; i < nr_pfns; ++i )
+            if ( !guest_data[i] )
+                xc_compression_invalidate_page(xch, ctx->save.delta,
+                                               ctx->save.batch_pfns[i]);
+    }
+
+    if ( nr_zero )
+    {
+        struct xc_sr_rec_page_data_header zhdr = { .count = nr_zero };
+        struct xc_sr_record zrec =
+        {
+            .type = REC_TYPE_PAGE_DATA_ZERO,
+            .length = sizeof(zhdr),
+            .data = &zhdr,
+        };
+
+        if ( write_split_record(ctx, &zrec, zero_pfns,
+                                nr_zero * sizeof(*zero_pfns)) )
+            goto err;
+    }
+
+    /* Every page in the batch may have been zero. */
+    if ( nr_rec_pfns == 0 )
+        goto done;
+
+    hdr.count = nr_rec_pfns;
+
+    rec_length = sizeof(hdr);
+    rec_length += nr_rec_pfns * sizeof(*rec_pfns);
 
     iov[0].iov_base = &rec.type;
     iov[0].iov_len = sizeof(rec.type);
@@ -232,35 +309,167 @@ static int write_batch(struct xc_sr_context *ctx)
     iov[2].iov_len = sizeof(hdr);
 
     iov[3].iov_base = rec_pfns;
-    iov[3].iov_len = nr_pfns * sizeof(*rec_pfns);
+    iov[3].iov_len = nr_rec_pfns * sizeof(*rec_pfns);
 
     iovcnt = 4;
 
-    if ( nr_pages )
+    if ( ctx->save.delta && !ctx->save.live && nr_pages )
     {
+        unsigned long len = 0;
+
+        for ( i = 0; i < nr_pfns; ++i )
+        {
+            if ( !guest_data[i] )
+                continue;
+
+            /* Pagetables are localised by the receiver, so always sent whole. */
+            if ( xc_compression_add_page(
+                     xch, ctx->save.delta, guest_data[i],
+                     ctx->save.batch_pfns[i],
+                     !!(types[i] & XEN_DOMCTL_PFINFO_LTABTYPE_MASK)) )
+            {
+                ERROR("Unable to delta encode pfn %#"PRIpfn,
+                      ctx->save.batch_pfns[i]);
+                xc_compression_reset_pagebuf(xch, ctx->save.delta);
+                goto err;
+            }
+        }
+
+        rc = xc_compression_compress_pages(xch, ctx->save.delta,
+                                           ctx->save.delta_buf,
+                                           MAX_BATCH_SIZE * DELTA_PAGE_MAX,
+                                           &len);
+        xc_compression_reset_pagebuf(xch, ctx->save.delta);
+        if ( rc < 0 )
+        {
+            ERROR("Failed to delta encode batch of %u pages", nr_pages);
+            rc = -1;
+            goto err;
+        }
+        rc = -1;
+
+        rec.type = REC_TYPE_PAGE_DATA_DELTA;
+
+        iov[iovcnt].iov_base = ctx->save.delta_buf;
+        iov[iovcnt].iov_len = len;
+        rec_length += len;
+        iovcnt++;
+        nr_pages = 0;
+
+        iov[iovcnt].iov_base = (void *)zeroes;
+        iov[iovcnt].iov_len = ROUNDUP(rec_length, REC_ALIGN_ORDER) - rec_length;
+        iovcnt++;
+    }
+    else if ( ctx->save.compress && nr_pages )
+    {
+        struct compress_batch batch;
+
+        rec_lens = malloc(nr_pages * sizeof(*rec_lens));
+        data = malloc(nr_pages * sizeof(*data));
+        if ( !rec_lens || !data )
+        {
+            ERROR("Unable to allocate memory to compress %u pages", nr_pages);
+            goto err;
+        }
+
+        for ( i = 0, p = 0; i < nr_pfns; ++i )
+            if ( guest_data[i] )
+                data[p++] = guest_data[i];
+        assert(p == nr_pages);
+
+        batch.data = data;
+        batch.lens = rec_lens;
+
+        rc = run_workers(&ctx->save.workers, nr_pages, compress_one, &batch);
+        if ( rc )
+        {
+            PERROR("Failed to compress batch of %u pages", nr_pages);
+            goto err;
+        }
+        rc = -1;
+
+        rec.type = REC_TYPE_PAGE_DATA_COMPRESSED;
+
+        iov[iovcnt].iov_base = rec_lens;
+        iov[iovcnt].iov_len = nr_pages * sizeof(*rec_lens);
+        rec_length += iov[iovcnt].iov_len;
+        iovcnt++;
+
+        for ( p = 0; p < nr_pages; ++p )
+        {
+            iov[iovcnt].iov_base = (rec_lens[p] == PAGE_SIZE) ? data[p] :
+                ctx->save.compress_buf + p * PAGE_SIZE;
+            iov[iovcnt].iov_len = rec_lens[p];
+            rec_length += rec_lens[p];
+            iovcnt++;
+        }
+        nr_pages = 0;
+
+        iov[iovcnt].iov_base = (void *)zeroes;
+        iov[iovcnt].iov_len = ROUNDUP(rec_length, REC_ALIGN_ORDER) - rec_length;
+        iovcnt++;
+    }
+    else if ( nr_pages )
+    {
+        if ( ctx->save.align_pages )
+        {
+            off_t pos = lseek(ctx->fd, 0, SEEK_CUR);
+
+            if ( pos < 0 )
+            {
+                PERROR("Unable to get the position in the image file");
+                goto err;
+            }
+
+            /* Pad the pfn array out so that the data starts on a page. */
+            pos += sizeof(struct xc_sr_rhdr);
+            ahdr.count = hdr.count;
+            ahdr.data_offset = ROUNDUP(pos + rec_length, PAGE_SHIFT) - pos;
+
+            rec.type = REC_TYPE_PAGE_DATA_ALIGNED;
+            iov[2].iov_base = &ahdr;
+
+            iov[iovcnt].iov_base = (void *)zero_page;
+            iov[iovcnt].iov_len = ahdr.data_offset - rec_length;
+            rec_length = ahdr.data_offset;
+            iovcnt++;
+        }
+
         for ( i = 0; i < nr_pfns; ++i )
         {
             if ( guest_data[i] )
             {
                 iov[iovcnt].iov_base = guest_data[i];
                 iov[iovcnt].iov_len = PAGE_SIZE;
+                rec_length += PAGE_SIZE;
                 iovcnt++;
                 --nr_pages;
             }
         }
+
+        /* The image file needn't start the stream on an aligned offset. */
+        iov[iovcnt].iov_base = (void *)zeroes;
+        iov[iovcnt].iov_len = ROUNDUP(rec_length, REC_ALIGN_ORDER) - rec_length;
+        iovcnt++;
     }
 
+    rec.length = rec_length;
+
     if ( writev_exact(ctx->fd, iov, iovcnt) )
     {
         PERROR("Failed to write page data to stream");
         goto err;
     }
 
+ done:
     /* Sanity check we have sent all the pages we expected to. */
     assert(nr_pages == 0);
     rc = ctx->save.nr_batch_pfns = 0;
 
  err:
+    free(data);
+    free(rec_lens);
+    free(zero_pfns);
     free(rec_pfns);
     if ( guest_mapping )
         xenforeignmemory_unmap(xch->fmem, guest_mapping, nr_pages_mapped);
@@ -412,6 +621,88 @@ static int send_all_pages(struct xc_sr_context *ctx)
     return send_dirty_pages(ctx, ctx->save.p2m_size);
 }
 
+/* Maximum number of entries in the dirty pfn list (2MB worth). */
+#define MAX_DIRTY_PFNS (1U << 18)
+
+/*
+ * Retrieve and clean up to dirty_pfns_size entries of the log-dirty bitmap
+ * as a list of pfns.  Any which don't fit remain dirty.  Returns the number
+ * of pfns retrieved, or -1 on error.
+ */
+static long clean_dirty_pfns(struct xc_sr_context *ctx,
+                             xc_shadow_op_stats_t *stats)
+{
+    xc_interface *xch = ctx->xch;
+    long nr = xc_shadow_control(
+        xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+        &ctx->save.dirty_pfns_hbuf, ctx->save.dirty_pfns_size,
+        NULL, XEN_DOMCTL_SHADOW_LOGDIRTY_PFN_LIST, stats);
+
+    if ( nr < 0 )
+    {
+        PERROR("Failed to retrieve logdirty pfn list");
+        return -1;
+    }
+
+    return nr;
+}
+
+/*
+ * Send the nr pfns currently in the dirty pfn list.  If the list was full,
+ * keep retrieving and sending until entries pfns have been sent.
+ * Used for each subsequent iteration of the live migration loop, with a cost
+ * proportional to the number of dirty pages rather than the guest size.
+ */
+static int send_dirty_pfns(struct xc_sr_context *ctx, long nr,
+                           unsigned long entries)
+{
+    xc_interface *xch = ctx->xch;
+    xc_shadow_op_stats_t stats;
+    unsigned long written = 0;
+    long i;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_pfns,
+                                    &ctx->save.dirty_pfns_hbuf);
+
+    for ( ;; )
+    {
+        for ( i = 0; i < nr; ++i )
+        {
+            if ( dirty_pfns[i] >= ctx->save.p2m_size )
+                continue;
+
+            rc = add_to_batch(ctx, dirty_pfns[i]);
+            if ( rc )
+                return rc;
+
+            /* Update progress every 4MB worth of memory sent. */
+            if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
+                xc_report_progress_step(xch, written, entries);
+
+            ++written;
+        }
+
+        /*
+         * Stop once the pages dirty at the start of the iteration have been
+         * sent.  Anything still dirty is left for the next iteration.
+         */
+        if ( nr < ctx->save.dirty_pfns_size || written >= entries )
+            break;
+
+        nr = clean_dirty_pfns(ctx, &stats);
+        if ( nr < 0 )
+            return -1;
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        return rc;
+
+    xc_report_progress_step(xch, entries, entries);
+
+    return ctx->save.ops.check_vm_state(ctx);
+}
+
 static int enable_logdirty(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -466,6 +757,70 @@ static int update_progress_string(struct xc_sr_context *ctx,
     return 0;
 }
 
+/* Statistics about the most recent iteration of the live migration loop. */
+struct precopy_stats
+{
+    unsigned iteration;
+    unsigned long dirty_count;  /* Pages dirtied during the iteration. */
+    unsigned long dirty_rate;   /* Pages dirtied per second. */
+    unsigned long bandwidth;    /* Pages sent per second. */
+    unsigned long downtime_ms;  /* Predicted downtime if suspended now. */
+};
+
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * The built-in convergence policy.  Sending the current dirty set is
+ * predicted to take downtime_ms, during which the guest will dirty
+ * dirty_rate * downtime_ms more pages.  While that is smaller than the
+ * current dirty set, another iteration reduces the eventual downtime.  Once
+ * it isn't, the guest is dirtying memory at least as fast as it can be sent
+ * and the best time to suspend is now.
+ */
+static int default_precopy_policy(struct xc_sr_context *ctx,
+                                  const struct precopy_stats *stats)
+{
+    if ( stats->dirty_count <= ctx->save.dirty_threshold ||
+         stats->iteration >= ctx->save.max_iterations )
+        return XGS_POLICY_STOP_AND_COPY;
+
+    if ( stats->bandwidth && stats->dirty_rate >= stats->bandwidth )
+        return XGS_POLICY_STOP_AND_COPY;
+
+    return XGS_POLICY_CONTINUE_PRECOPY;
+}
+
+/*
+ * Decide whether to carry on with precopy, after the built-in policy has
+ * been consulted and the caller given an opportunity to override it.
+ */
+static int precopy_policy(struct xc_sr_context *ctx,
+                          const struct precopy_stats *stats)
+{
+    xc_interface *xch = ctx->xch;
+    struct save_callbacks *cb = ctx->save.callbacks;
+    int decision = default_precopy_policy(ctx, stats);
+
+    DPRINTF("Iteration %u: %lu dirty, %lu dirty/s, %lu sent/s, "
+            "predicted downtime %lums", stats->iteration, stats->dirty_count,
+            stats->dirty_rate, stats->bandwidth, stats->downtime_ms);
+
+    if ( cb->precopy_policy )
+        decision = cb->precopy_policy(stats->iteration, stats->dirty_count,
+                                      stats->dirty_rate, stats->bandwidth,
+                                      stats->downtime_ms, decision,
+                                      cb->data);
+
+    return decision;
+}
+
 /*
  * Send memory while guest is running.
  */
@@ -473,28 +828,31 @@ static int send_memory_live(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
     xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
+    struct precopy_stats policy_stats = { 0 };
     char *progress_str = NULL;
+    unsigned long sent = ctx->save.p2m_size;
+    uint64_t start, elapsed;
     unsigned x;
+    long i, nr;
     int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_pfns,
+                                    &ctx->save.dirty_pfns_hbuf);
 
     rc = update_progress_string(ctx, &progress_str, 0);
     if ( rc )
         goto out;
 
+    start = monotonic_us();
+
     rc = send_all_pages(ctx);
     if ( rc )
         goto out;
 
-    for ( x = 1;
-          ((x < ctx->save.max_iterations) &&
-           (stats.dirty_count > ctx->save.dirty_threshold)); ++x )
+    for ( x = 1; ; ++x )
     {
-        if ( xc_shadow_control(
-                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-                 &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
-                 NULL, 0, &stats) != ctx->save.p2m_size )
+        nr = clean_dirty_pfns(ctx, &stats);
+        if ( nr < 0 )
         {
-            PERROR("Failed to retrieve logdirty bitmap");
             rc = -1;
             goto out;
         }
@@ -502,11 +860,44 @@ static int send_memory_live(struct xc_sr_context *ctx)
         if ( stats.dirty_count == 0 )
             break;
 
+        elapsed = (monotonic_us() - start) ?: 1;
+
+        policy_stats.iteration = x;
+        policy_stats.dirty_count = stats.dirty_count;
+        policy_stats.dirty_rate = stats.dirty_count * 1000000ULL / elapsed;
+        policy_stats.bandwidth = sent * 1000000ULL / elapsed;
+        policy_stats.downtime_ms = policy_stats.bandwidth ?
+            stats.dirty_count * 1000ULL / policy_stats.bandwidth : 0;
+
+        rc = precopy_policy(ctx, &policy_stats);
+        if ( rc == XGS_POLICY_ABORT )
+        {
+            ERROR("Live migration aborted by precopy policy");
+            rc = -1;
+            goto out;
+        }
+        else if ( rc == XGS_POLICY_STOP_AND_COPY )
+        {
+            /*
+             * The pfns retrieved have been cleaned, so must be sent after
+             * suspending the guest.  Any others are still dirty.
+             */
+            for ( i = 0; i < nr; ++i )
+                if ( dirty_pfns[i] < ctx->save.p2m_size )
+                    set_bit(dirty_pfns[i], ctx->save.deferred_pages);
+            ctx->save.nr_deferred_pages += nr;
+            rc = 0;
+            break;
+        }
+
         rc = update_progress_string(ctx, &progress_str, x);
         if ( rc )
             goto out;
 
-        rc = send_dirty_pages(ctx, stats.dirty_count);
+        start = monotonic_us();
+        sent = stats.dirty_count;
+
+        rc = send_dirty_pfns(ctx, nr, stats.dirty_count);
         if ( rc )
             goto out;
     }
@@ -569,6 +960,426 @@ static int colo_merge_secondary_dirty_bitmap(struct xc_sr_context *ctx)
     return rc;
 }
 
+/* Upper bound on the pages sent ahead of a post-copy migration. */
+#define MAX_RESIDENT_PFNS 64
+
+/* Pages per batch once post-copy, bounding how long a fault waits. */
+#define POSTCOPY_BATCH_SIZE 64
+
+/* Capacity of the queue of faulted pages. */
+#define POSTCOPY_MAX_FAULTS MAX_BATCH_SIZE
+
+/*
+ * Begin a post-copy migration, once the guest has been suspended.  Rather
+ * than being sent now, the final dirty set becomes the outstanding pages,
+ * except for those which must be resident before the guest resumes.
+ */
+static int postcopy_begin(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec = { REC_TYPE_POSTCOPY_BEGIN, 0, NULL };
+    unsigned long *outstanding = ctx->save.postcopy.outstanding;
+    xen_pfn_t pfns[MAX_RESIDENT_PFNS], p;
+    int i, nr, rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        return rc;
+
+    memcpy(outstanding, dirty_bitmap, bitmap_size(ctx->save.p2m_size));
+
+    nr = ctx->save.ops.postcopy_resident_pfns(ctx, pfns, ARRAY_SIZE(pfns));
+    if ( nr < 0 )
+    {
+        PERROR("Failed to get the pages to send ahead of post-copy");
+        return -1;
+    }
+
+    for ( i = 0; i < nr; ++i )
+    {
+        if ( pfns[i] >= ctx->save.p2m_size ||
+             !test_and_clear_bit(pfns[i], outstanding) )
+            continue;
+
+        rc = add_to_batch(ctx, pfns[i]);
+        if ( rc )
+            return rc;
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        return rc;
+
+    for ( p = 0; p < ctx->save.p2m_size; ++p )
+        if ( test_bit(p, outstanding) )
+            ++ctx->save.postcopy.nr_outstanding;
+
+    DPRINTF("Post-copy with %lu pages outstanding",
+            ctx->save.postcopy.nr_outstanding);
+
+    return 0;
+}
+
+/*
+ * Write the batch of pfns as a POSTCOPY_PFNS record, with their types.
+ * Pages without any data aren't outstanding after all.
+ */
+static int write_postcopy_pfns(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned i, nr_pfns = ctx->save.nr_batch_pfns;
+    xen_pfn_t *types = malloc(nr_pfns * sizeof(*types));
+    uint64_t *rec_pfns = malloc(nr_pfns * sizeof(*rec_pfns));
+    struct xc_sr_rec_page_data_header hdr = { .count = nr_pfns };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_POSTCOPY_PFNS,
+        .length = sizeof(hdr),
+        .data = &hdr,
+    };
+    int rc = -1;
+
+    if ( !types || !rec_pfns )
+    {
+        ERROR("Unable to allocate arrays for a batch of %u pfns", nr_pfns);
+        goto err;
+    }
+
+    for ( i = 0; i < nr_pfns; ++i )
+        types[i] = ctx->save.ops.pfn_to_gfn(ctx, ctx->save.batch_pfns[i]);
+
+    rc = xc_get_pfn_type_batch(xch, ctx->domid, nr_pfns, types);
+    if ( rc )
+    {
+        PERROR("Failed to get types for pfn batch");
+        goto err;
+    }
+
+    for ( i = 0; i < nr_pfns; ++i )
+    {
+        switch ( types[i] )
+        {
+        case XEN_DOMCTL_PFINFO_BROKEN:
+        case XEN_DOMCTL_PFINFO_XALLOC:
+        case XEN_DOMCTL_PFINFO_XTAB:
+            clear_bit(ctx->save.batch_pfns[i], ctx->save.postcopy.outstanding);
+            --ctx->save.postcopy.nr_outstanding;
+            break;
+        }
+
+        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
+    }
+
+    rc = write_split_record(ctx, &rec, rec_pfns, nr_pfns * sizeof(*rec_pfns));
+    if ( rc )
+        goto err;
+
+    ctx->save.nr_batch_pfns = 0;
+
+ err:
+    free(rec_pfns);
+    free(types);
+
+    return rc;
+}
+
+/*
+ * List the outstanding pages in POSTCOPY_PFNS records, once the guest's
+ * state has been sent.
+ */
+static int send_postcopy_pfns(struct xc_sr_context *ctx)
+{
+    xen_pfn_t p;
+    int rc;
+
+    for ( p = 0; p < ctx->save.p2m_size; ++p )
+    {
+        if ( !test_bit(p, ctx->save.postcopy.outstanding) )
+            continue;
+
+        ctx->save.batch_pfns[ctx->save.nr_batch_pfns++] = p;
+        if ( ctx->save.nr_batch_pfns == MAX_BATCH_SIZE )
+        {
+            rc = write_postcopy_pfns(ctx);
+            if ( rc )
+                return rc;
+        }
+    }
+
+    if ( ctx->save.nr_batch_pfns )
+        return write_postcopy_pfns(ctx);
+
+    return 0;
+}
+
+/*
+ * Fill the batch with the next outstanding pages to push, those asked for
+ * by the receiver first.  *next is the pfn to carry on from in order.
+ * Returns the number of pages in the batch, 0 once there are none left.
+ */
+static unsigned postcopy_next_batch(struct xc_sr_context *ctx,
+                                    xen_pfn_t *next)
+{
+    unsigned long *outstanding = ctx->save.postcopy.outstanding;
+    xen_pfn_t pfn;
+    unsigned n = 0;
+
+    pthread_mutex_lock(&ctx->save.postcopy.lock);
+
+    if ( ctx->save.postcopy.pusher_stop )
+        goto out;
+
+    while ( n < POSTCOPY_BATCH_SIZE &&
+            ctx->save.postcopy.fault_cons != ctx->save.postcopy.fault_prod )
+    {
+        pfn = ctx->save.postcopy.faults[ctx->save.postcopy.fault_cons++ %
+                                        POSTCOPY_MAX_FAULTS];
+        if ( test_and_clear_bit(pfn, outstanding) )
+            ctx->save.batch_pfns[n++] = pfn;
+    }
+    pthread_cond_broadcast(&ctx->save.postcopy.cond);
+
+    for ( ; n < POSTCOPY_BATCH_SIZE && *next < ctx->save.p2m_size; ++*next )
+        if ( test_and_clear_bit(*next, outstanding) )
+            ctx->save.batch_pfns[n++] = *next;
+
+    ctx->save.postcopy.nr_outstanding -= n;
+
+ out:
+    pthread_mutex_unlock(&ctx->save.postcopy.lock);
+
+    ctx->save.nr_batch_pfns = n;
+
+    return n;
+}
+
+/*
+ * The background pusher: sends the outstanding pages in order, taking any
+ * the receiver faulted on first, until none are left.
+ */
+static void *postcopy_pusher(void *arg)
+{
+    struct xc_sr_context *ctx = arg;
+    xc_interface *xch = ctx->xch;
+    unsigned long entries = ctx->save.postcopy.nr_outstanding, written = 0;
+    xen_pfn_t next = 0;
+    unsigned n;
+    int rc = 0, err = 0;
+    char c = 0;
+
+    while ( (n = postcopy_next_batch(ctx, &next)) != 0 )
+    {
+        rc = flush_batch(ctx);
+        if ( rc )
+        {
+            err = errno;
+            break;
+        }
+
+        written += n;
+        xc_report_progress_step(xch, written, entries);
+    }
+
+    pthread_mutex_lock(&ctx->save.postcopy.lock);
+    ctx->save.postcopy.pusher_done = true;
+    ctx->save.postcopy.pusher_rc = rc;
+    ctx->save.postcopy.pusher_errno = err;
+    pthread_cond_broadcast(&ctx->save.postcopy.cond);
+    pthread_mutex_unlock(&ctx->save.postcopy.lock);
+
+    /* Wake the fault handler, which may be waiting for the receiver. */
+    if ( write(ctx->save.postcopy.done_pipe[1], &c, 1) != 1 )
+        PERROR("Failed to signal the end of post-copy");
+
+    return NULL;
+}
+
+static void postcopy_stop_pusher(struct xc_sr_context *ctx)
+{
+    if ( !ctx->save.postcopy.pusher_started )
+        return;
+
+    pthread_mutex_lock(&ctx->save.postcopy.lock);
+    ctx->save.postcopy.pusher_stop = true;
+    pthread_cond_broadcast(&ctx->save.postcopy.cond);
+    pthread_mutex_unlock(&ctx->save.postcopy.lock);
+
+    pthread_join(ctx->save.postcopy.pusher, NULL);
+    ctx->save.postcopy.pusher_started = false;
+}
+
+/*
+ * Queue the outstanding pages of a POSTCOPY_FAULT record for the pusher.
+ */
+static int postcopy_queue_faults(struct xc_sr_context *ctx,
+                                 struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    const uint64_t *pfns = rec->data;
+    unsigned i, count = rec->length / sizeof(*pfns);
+    int rc = 0;
+
+    if ( rec->length % sizeof(*pfns) )
+    {
+        ERROR("Invalid POSTCOPY_FAULT record length %u", rec->length);
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->save.postcopy.lock);
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( pfns[i] >= ctx->save.p2m_size )
+        {
+            ERROR("Invalid pfn %#"PRIx64" in POSTCOPY_FAULT record", pfns[i]);
+            rc = -1;
+            break;
+        }
+
+        if ( !test_bit(pfns[i], ctx->save.postcopy.outstanding) )
+            continue;
+
+        while ( !ctx->save.postcopy.pusher_done &&
+                (ctx->save.postcopy.fault_prod -
+                 ctx->save.postcopy.fault_cons) == POSTCOPY_MAX_FAULTS )
+            pthread_cond_wait(&ctx->save.postcopy.cond,
+                              &ctx->save.postcopy.lock);
+
+        if ( ctx->save.postcopy.pusher_done )
+            break;
+
+        ctx->save.postcopy.faults[ctx->save.postcopy.fault_prod++ %
+                                  POSTCOPY_MAX_FAULTS] = pfns[i];
+    }
+
+    pthread_mutex_unlock(&ctx->save.postcopy.lock);
+
+    return rc;
+}
+
+/*
+ * Send the outstanding pages, once the guest's state has been sent and
+ * POSTCOPY_TRANSITION tells the receiver to resume it.  The pusher thread
+ * writes the pages while this thread reads POSTCOPY_FAULT records from the
+ * back channel, until the receiver acknowledges the last page with END.
+ */
+static int send_postcopy_pages(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec = { REC_TYPE_POSTCOPY_TRANSITION, 0, NULL };
+    struct pollfd fds[2];
+    nfds_t nfds = ARRAY_SIZE(fds);
+    char c;
+    int rc;
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        return rc;
+
+    xc_set_progress_prefix(xch, "Post-copy");
+
+    if ( pipe(ctx->save.postcopy.done_pipe) )
+    {
+        PERROR("Failed to create post-copy pipe");
+        return -1;
+    }
+
+    errno = pthread_create(&ctx->save.postcopy.pusher, NULL,
+                           postcopy_pusher, ctx);
+    if ( errno )
+    {
+        PERROR("Unable to create post-copy pusher thread");
+        return -1;
+    }
+    ctx->save.postcopy.pusher_started = true;
+
+    fds[0].fd = ctx->save.recv_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = ctx->save.postcopy.done_pipe[0];
+    fds[1].events = POLLIN;
+
+    for ( ;; )
+    {
+        if ( poll(fds, nfds, -1) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            PERROR("Failed to poll the post-copy back channel");
+            rc = -1;
+            goto out;
+        }
+
+        if ( nfds > 1 && fds[1].revents )
+        {
+            if ( read(fds[1].fd, &c, 1) != 1 )
+            {
+                PERROR("Failed to read post-copy pipe");
+                rc = -1;
+                goto out;
+            }
+
+            pthread_mutex_lock(&ctx->save.postcopy.lock);
+            rc = ctx->save.postcopy.pusher_rc;
+            errno = ctx->save.postcopy.pusher_errno;
+            pthread_mutex_unlock(&ctx->save.postcopy.lock);
+
+            if ( rc )
+            {
+                PERROR("Failed to push outstanding pages");
+                goto out;
+            }
+
+            /* Every page has been sent.  Wait for the receiver's END. */
+            nfds = 1;
+        }
+
+        if ( !fds[0].revents )
+            continue;
+
+        rc = read_record(ctx, ctx->save.recv_fd, &rec);
+        if ( rc )
+            goto out;
+
+        switch ( rec.type )
+        {
+        case REC_TYPE_END:
+            break;
+
+        case REC_TYPE_POSTCOPY_FAULT:
+            rc = postcopy_queue_faults(ctx, &rec);
+            break;
+
+        default:
+            ERROR("Unexpected record %#x (%s) in post-copy back channel",
+                  rec.type, rec_type_to_str(rec.type));
+            rc = -1;
+            break;
+        }
+
+        free(rec.data);
+
+        if ( rc || rec.type == REC_TYPE_END )
+            break;
+    }
+
+ out:
+    postcopy_stop_pusher(ctx);
+
+    if ( !rc && ctx->save.postcopy.nr_outstanding )
+    {
+        ERROR("Post-copy receiver finished with %lu pages outstanding",
+              ctx->save.postcopy.nr_outstanding);
+        rc = -1;
+    }
+
+    xc_set_progress_prefix(xch, NULL);
+
+    return rc;
+}
+
 /*
  * Suspend the domain and send dirty memory.
  * This is the last iteration of the live migration and the
@@ -620,7 +1431,11 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
         }
     }
 
-    rc = send_dirty_pages(ctx, stats.dirty_count + ctx->save.nr_deferred_pages);
+    if ( ctx->save.postcopy.enabled )
+        rc = postcopy_begin(ctx);
+    else
+        rc = send_dirty_pages(ctx,
+                              stats.dirty_count + ctx->save.nr_deferred_pages);
     if ( rc )
         goto out;
 
@@ -759,6 +1574,74 @@ static int setup(struct xc_sr_context *ctx)
         goto err;
     }
 
+    if ( ctx->save.live )
+    {
+        DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_pfns,
+                                        &ctx->save.dirty_pfns_hbuf);
+
+        ctx->save.dirty_pfns_size = min_t(unsigned long, ctx->save.p2m_size,
+                                          MAX_DIRTY_PFNS);
+        dirty_pfns = xc_hypercall_buffer_alloc_pages(
+            xch, dirty_pfns,
+            NRPAGES(ctx->save.dirty_pfns_size * sizeof(*dirty_pfns)));
+        if ( !dirty_pfns )
+        {
+            ERROR("Unable to allocate memory for dirty pfn list");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
+    if ( ctx->save.postcopy.enabled )
+    {
+        ctx->save.postcopy.outstanding = bitmap_alloc(ctx->save.p2m_size);
+        ctx->save.postcopy.faults = malloc(
+            POSTCOPY_MAX_FAULTS * sizeof(*ctx->save.postcopy.faults));
+        if ( !ctx->save.postcopy.outstanding || !ctx->save.postcopy.faults )
+        {
+            ERROR("Unable to allocate memory for post-copy");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
+    if ( ctx->save.compress )
+    {
+        ctx->save.compress_buf = malloc(MAX_BATCH_SIZE * PAGE_SIZE);
+        if ( !ctx->save.compress_buf )
+        {
+            ERROR("Unable to allocate memory for compressed page data");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+
+        rc = init_workers(ctx, &ctx->save.workers,
+                          compress_page_scratch_size());
+        if ( rc )
+        {
+            free(ctx->save.compress_buf);
+            ctx->save.compress_buf = NULL;
+            goto err;
+        }
+    }
+
+    if ( ctx->save.checkpoint_compress )
+    {
+        ctx->save.delta_buf = malloc(MAX_BATCH_SIZE * DELTA_PAGE_MAX);
+        ctx->save.delta = xc_compression_create_context(xch,
+                                                        ctx->save.p2m_size);
+        if ( !ctx->save.delta_buf || !ctx->save.delta )
+        {
+            ERROR("Unable to allocate memory for delta compression");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
     rc = 0;
 
  err:
@@ -770,6 +1653,8 @@ static void cleanup(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_pfns,
+                                    &ctx->save.dirty_pfns_hbuf);
 
 
     xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
@@ -780,8 +1665,32 @@ static void cleanup(struct xc_sr_context *ctx)
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    xc_hypercall_buffer_free_pages(
+        xch, dirty_pfns,
+        NRPAGES(ctx->save.dirty_pfns_size * sizeof(*dirty_pfns)));
     free(ctx->save.deferred_pages);
     free(ctx->save.batch_pfns);
+
+    if ( ctx->save.compress_buf )
+    {
+        fini_workers(&ctx->save.workers);
+        free(ctx->save.compress_buf);
+    }
+
+    xc_compression_free_context(xch, ctx->save.delta);
+    free(ctx->save.delta_buf);
+
+    if ( ctx->save.postcopy.enabled )
+    {
+        postcopy_stop_pusher(ctx);
+        if ( ctx->save.postcopy.done_pipe[0] >= 0 )
+        {
+            close(ctx->save.postcopy.done_pipe[0]);
+            close(ctx->save.postcopy.done_pipe[1]);
+        }
+        free(ctx->save.postcopy.faults);
+        free(ctx->save.postcopy.outstanding);
+    }
 }
 
 /*
@@ -840,6 +1749,17 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
         if ( rc )
             goto err;
 
+        if ( ctx->save.postcopy.enabled )
+        {
+            rc = send_postcopy_pfns(ctx);
+            if ( rc )
+                goto err;
+
+            rc = send_postcopy_pages(ctx);
+            if ( rc )
+                goto err;
+        }
+
         if ( ctx->save.checkpointed != XC_MIG_STREAM_NONE )
         {
             /*
@@ -930,8 +1850,20 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.save.callbacks = callbacks;
     ctx.save.live  = !!(flags & XCFLAGS_LIVE);
     ctx.save.debug = !!(flags & XCFLAGS_DEBUG);
+    ctx.save.compress = !!(flags & XCFLAGS_STREAM_COMPRESS);
     ctx.save.checkpointed = stream_type;
+    /* Writing an image file for a plain restore, which can map the data. */
+    ctx.save.align_pages = !ctx.save.compress &&
+        stream_type == XC_MIG_STREAM_NONE && fd_is_file(io_fd);
+    /* The receiver of a COLO stream runs the domain, so has no copy of
+     * what was sent last to delta encode against. */
+    ctx.save.checkpoint_compress = (flags & XCFLAGS_CHECKPOINT_COMPRESS) &&
+        stream_type == XC_MIG_STREAM_REMUS;
     ctx.save.recv_fd = recv_fd;
+    ctx.save.postcopy.enabled = !!(flags & XCFLAGS_POSTCOPY);
+    ctx.save.postcopy.lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    ctx.save.postcopy.cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+    ctx.save.postcopy.done_pipe[0] = ctx.save.postcopy.done_pipe[1] = -1;
 
     /* If altering migration_stream update this assert too. */
     assert(stream_type == XC_MIG_STREAM_NONE ||
@@ -972,6 +1904,16 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
 
     ctx.domid = dom;
 
+    if ( ctx.save.postcopy.enabled &&
+         (!ctx.save.live || stream_type != XC_MIG_STREAM_NONE ||
+          recv_fd < 0 || !ctx.dominfo.hvm) )
+    {
+        ERROR("Post-copy needs a live migration of an HVM domain, with a "
+              "back channel");
+        errno = EINVAL;
+        return -1;
+    }
+
     if ( ctx.dominfo.hvm )
     {
         ctx.save.ops = save_ops_x86_hvm;
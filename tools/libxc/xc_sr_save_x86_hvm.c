@@ -6,11 +6,13 @@
 
 /*
  * Query for the HVM context and write an HVM_CONTEXT record into the stream.
+ * Xen saves into a hypercall buffer, which is written out as it is.
  */
 static int write_hvm_context(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
     int rc, hvm_buf_size;
+    DECLARE_HYPERCALL_BUFFER(uint8_t, hvm_buf);
     struct xc_sr_record hvm_rec =
     {
         .type = REC_TYPE_HVM_CONTEXT,
@@ -24,16 +26,17 @@ static int write_hvm_context(struct xc_sr_context *ctx)
         goto out;
     }
 
-    hvm_rec.data = malloc(hvm_buf_size);
-    if ( !hvm_rec.data )
+    hvm_buf = xc_hypercall_buffer_alloc(xch, hvm_buf, hvm_buf_size);
+    if ( !hvm_buf )
     {
         PERROR("Couldn't allocate memory");
         rc = -1;
         goto out;
     }
 
-    hvm_buf_size = xc_domain_hvm_getcontext(xch, ctx->domid,
-                                            hvm_rec.data, hvm_buf_size);
+    hvm_buf_size = xc_domain_hvm_getcontext_buffer(xch, ctx->domid,
+                                                   HYPERCALL_BUFFER(hvm_buf),
+                                                   hvm_buf_size);
     if ( hvm_buf_size < 0 )
     {
         PERROR("Couldn't get HVM context from Xen");
@@ -41,6 +44,7 @@ static int write_hvm_context(struct xc_sr_context *ctx)
         goto out;
     }
 
+    hvm_rec.data = hvm_buf;
     hvm_rec.length = hvm_buf_size;
     rc = write_record(ctx, &hvm_rec);
     if ( rc < 0 )
@@ -50,7 +54,7 @@ static int write_hvm_context(struct xc_sr_context *ctx)
     }
 
  out:
-    free(hvm_rec.data);
+    xc_hypercall_buffer_free(xch, hvm_buf);
     return rc;
 }
 
@@ -204,6 +208,73 @@ static int x86_hvm_end_of_checkpoint(struct xc_sr_context *ctx)
     return 0;
 }
 
+static int x86_hvm_postcopy_resident_pfns(struct xc_sr_context *ctx,
+                                          xen_pfn_t *pfns, unsigned max)
+{
+    /*
+     * Pages named by HVM params are cleared, mapped or shared by the
+     * restorer, Xen or QEMU before the guest resumes.  IDENT_PT and VM86_TSS
+     * hold addresses rather than pfns.
+     */
+    static const struct {
+        unsigned int index;
+        unsigned int shift;
+    } params[] = {
+        { HVM_PARAM_STORE_PFN,          0 },
+        { HVM_PARAM_IOREQ_PFN,          0 },
+        { HVM_PARAM_BUFIOREQ_PFN,       0 },
+        { HVM_PARAM_PAGING_RING_PFN,    0 },
+        { HVM_PARAM_MONITOR_RING_PFN,   0 },
+        { HVM_PARAM_SHARING_RING_PFN,   0 },
+        { HVM_PARAM_VM86_TSS,           PAGE_SHIFT },
+        { HVM_PARAM_CONSOLE_PFN,        0 },
+        { HVM_PARAM_IDENT_PT,           PAGE_SHIFT },
+    };
+
+    xc_interface *xch = ctx->xch;
+    uint64_t value, ioreq_server_pfn, nr_ioreq_server_pages;
+    unsigned int i, nr = 0;
+
+    for ( i = 0; i < ARRAY_SIZE(params); i++ )
+    {
+        if ( xc_hvm_param_get(xch, ctx->domid, params[i].index, &value) )
+        {
+            PERROR("Failed to get HVMPARAM at index %u", params[i].index);
+            return -1;
+        }
+
+        if ( !value )
+            continue;
+
+        if ( nr == max )
+            goto too_many;
+        pfns[nr++] = value >> params[i].shift;
+    }
+
+    if ( xc_hvm_param_get(xch, ctx->domid, HVM_PARAM_IOREQ_SERVER_PFN,
+                          &ioreq_server_pfn) ||
+         xc_hvm_param_get(xch, ctx->domid, HVM_PARAM_NR_IOREQ_SERVER_PAGES,
+                          &nr_ioreq_server_pages) )
+    {
+        PERROR("Failed to get the ioreq server pages");
+        return -1;
+    }
+
+    for ( i = 0; ioreq_server_pfn && i < nr_ioreq_server_pages; i++ )
+    {
+        if ( nr == max )
+            goto too_many;
+        pfns[nr++] = ioreq_server_pfn + i;
+    }
+
+    return nr;
+
+ too_many:
+    ERROR("More than %u pages to send ahead of a post-copy", max);
+    errno = E2BIG;
+    return -1;
+}
+
 static int x86_hvm_cleanup(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -229,6 +300,7 @@ struct xc_sr_save_ops save_ops_x86_hvm =
     .start_of_checkpoint = x86_hvm_start_of_checkpoint,
     .end_of_checkpoint   = x86_hvm_end_of_checkpoint,
     .check_vm_state      = x86_hvm_check_vm_state,
+    .postcopy_resident_pfns = x86_hvm_postcopy_resident_pfns,
     .cleanup             = x86_hvm_cleanup,
 };
 
@@ -1120,6 +1120,16 @@ static int x86_pv_check_vm_state(struct xc_sr_context *ctx)
     return x86_pv_check_vm_state_p2m_list(ctx);
 }
 
+/*
+ * save_ops function.  Post-copy is only supported for HVM guests.
+ */
+static int x86_pv_postcopy_resident_pfns(struct xc_sr_context *ctx,
+                                         xen_pfn_t *pfns, unsigned max)
+{
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
 /*
  * save_ops function.  Cleanup.
  */
@@ -1148,6 +1158,7 @@ struct xc_sr_save_ops save_ops_x86_pv =
     .start_of_checkpoint = x86_pv_start_of_checkpoint,
     .end_of_checkpoint   = x86_pv_end_of_checkpoint,
     .check_vm_state      = x86_pv_check_vm_state,
+    .postcopy_resident_pfns = x86_pv_postcopy_resident_pfns,
     .cleanup             = x86_pv_cleanup,
 };
 
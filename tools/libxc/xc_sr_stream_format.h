@@ -76,6 +76,14 @@ struct xc_sr_rhdr
 #define REC_TYPE_VERIFY                     0x0000000dU
 #define REC_TYPE_CHECKPOINT                 0x0000000eU
 #define REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST  0x0000000fU
+#define REC_TYPE_PAGE_DATA_COMPRESSED       0x00000010U
+#define REC_TYPE_PAGE_DATA_ZERO             0x00000011U
+#define REC_TYPE_PAGE_DATA_DELTA            0x00000012U
+#define REC_TYPE_PAGE_DATA_ALIGNED          0x00000013U
+#define REC_TYPE_POSTCOPY_BEGIN             0x00000014U
+#define REC_TYPE_POSTCOPY_PFNS              0x00000015U
+#define REC_TYPE_POSTCOPY_TRANSITION        0x00000016U
+#define REC_TYPE_POSTCOPY_FAULT             0x00000017U
 
 #define REC_TYPE_OPTIONAL             0x80000000U
 
@@ -90,6 +98,43 @@ struct xc_sr_rec_page_data_header
 #define PAGE_DATA_PFN_MASK  0x000fffffffffffffULL
 #define PAGE_DATA_TYPE_MASK 0xf000000000000000ULL
 
+/*
+ * PAGE_DATA_COMPRESSED uses the PAGE_DATA header and pfn array, followed by
+ * a uint32_t length for each page of data, followed by the data itself.  A
+ * length of exactly one page indicates the page was sent uncompressed.
+ *
+ * PAGE_DATA_ZERO uses the PAGE_DATA header and pfn array only.  Every pfn
+ * which would carry page data is filled with zeroes.
+ *
+ * PAGE_DATA_DELTA uses the PAGE_DATA header and pfn array, followed by each
+ * page of data encoded by xc_compression_compress_pages() against the copy
+ * the receiver already holds.
+ */
+
+/* PAGE_DATA_ALIGNED */
+struct xc_sr_rec_page_data_aligned_header
+{
+    uint32_t count;
+    uint32_t data_offset;
+    uint64_t pfn[0];
+};
+
+/*
+ * PAGE_DATA_ALIGNED is laid out as PAGE_DATA, but with zeroes between the
+ * pfn array and the page data, which starts data_offset octets into the
+ * record.  In an image file, the data is then page aligned so that it can
+ * be mapped rather than read.
+ */
+
+/*
+ * POSTCOPY_PFNS uses the PAGE_DATA header and pfn array only.  The data of
+ * every pfn listed with a type which would carry page data follows later,
+ * once the restorer has resumed the guest.
+ *
+ * POSTCOPY_FAULT, sent from the restorer to the saver, is an array of
+ * uint64_t pfns which the guest is waiting for.
+ */
+
 /* X86_PV_INFO */
 struct xc_sr_rec_x86_pv_info
 {
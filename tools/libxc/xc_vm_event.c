@@ -32,6 +32,10 @@ int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
     domctl.domain = domain_id;
     domctl.u.vm_event_op.op = op;
     domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.nr_frames = 0;
+    domctl.u.vm_event_op.flags = 0;
+    domctl.u.vm_event_op.pad = 0;
+    set_xen_guest_handle(domctl.u.vm_event_op.ports, HYPERCALL_BUFFER_NULL);
 
     rc = do_domctl(xch, &domctl);
     if ( !rc && port )
@@ -39,26 +43,95 @@ int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
     return rc;
 }
 
+static int vm_event_enable_op(xc_interface *xch, domid_t domain_id,
+                              unsigned int mode, unsigned int nr_frames,
+                              unsigned int flags, uint32_t *port,
+                              uint32_t *ports, unsigned int nr_ports)
+{
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(ports, nr_ports * sizeof(*ports),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+    int rc;
+
+    if ( ports && xc_hypercall_bounce_pre(xch, ports) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_vm_event_op;
+    domctl.domain = domain_id;
+    domctl.u.vm_event_op.op = XEN_VM_EVENT_ENABLE;
+    domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.nr_frames = nr_frames;
+    domctl.u.vm_event_op.flags = flags;
+    domctl.u.vm_event_op.pad = 0;
+    if ( ports )
+        set_xen_guest_handle(domctl.u.vm_event_op.ports, ports);
+    else
+        set_xen_guest_handle(domctl.u.vm_event_op.ports, HYPERCALL_BUFFER_NULL);
+
+    rc = do_domctl(xch, &domctl);
+    if ( !rc )
+        *port = domctl.u.vm_event_op.port;
+
+    if ( ports )
+        xc_hypercall_bounce_post(xch, ports);
+
+    return rc;
+}
+
 void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
                          uint32_t *port)
+{
+    return xc_vm_event_enable_rings(xch, domain_id, param, 1, 0,
+                                    port, NULL, 0);
+}
+
+void *xc_vm_event_enable_rings(xc_interface *xch, domid_t domain_id,
+                               int param, unsigned int nr_frames,
+                               unsigned int flags, uint32_t *port,
+                               uint32_t *ports, unsigned int nr_ports)
 {
     void *ring_page = NULL;
     uint64_t pfn;
-    xen_pfn_t ring_pfn, mmap_pfn;
-    unsigned int op, mode;
+    xen_pfn_t *ring_pfns = NULL, mmap_pfn;
+    unsigned int i, mode, nr_rings = 1, total;
     int rc1, rc2, saved_errno;
 
-    if ( !port )
+    if ( !port || !nr_frames )
     {
         errno = EINVAL;
         return NULL;
     }
 
+    if ( flags & XEN_VM_EVENT_FLAG_PER_VCPU )
+    {
+        xc_dominfo_t info;
+
+        /* Xen fills in a port for every vCPU */
+        if ( !ports || xc_domain_getinfo(xch, domain_id, 1, &info) != 1 ||
+             info.domid != domain_id || info.max_vcpu_id + 1 != nr_ports )
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+        nr_rings = nr_ports;
+    }
+    else
+    {
+        ports = NULL;
+        nr_ports = 0;
+    }
+
+    total = nr_frames * nr_rings;
+    ring_pfns = malloc(total * sizeof(*ring_pfns));
+    if ( !ring_pfns )
+        return NULL;
+
     /* Pause the domain for ring page setup */
     rc1 = xc_domain_pause(xch, domain_id);
     if ( rc1 != 0 )
     {
         PERROR("Unable to pause domain\n");
+        free(ring_pfns);
         return NULL;
     }
 
@@ -70,24 +143,60 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
         goto out;
     }
 
-    ring_pfn = pfn;
-    mmap_pfn = pfn;
-    rc1 = xc_get_pfn_type_batch(xch, domain_id, 1, &mmap_pfn);
-    if ( rc1 || mmap_pfn & XEN_DOMCTL_PFINFO_XTAB )
+    if ( total == 1 )
     {
-        /* Page not in the physmap, try to populate it */
-        rc1 = xc_domain_populate_physmap_exact(xch, domain_id, 1, 0, 0,
-                                              &ring_pfn);
+        ring_pfns[0] = pfn;
+        mmap_pfn = pfn;
+        rc1 = xc_get_pfn_type_batch(xch, domain_id, 1, &mmap_pfn);
+        if ( rc1 || mmap_pfn & XEN_DOMCTL_PFINFO_XTAB )
+        {
+            /* Page not in the physmap, try to populate it */
+            rc1 = xc_domain_populate_physmap_exact(xch, domain_id, 1, 0, 0,
+                                                  ring_pfns);
+            if ( rc1 != 0 )
+            {
+                PERROR("Failed to populate ring pfn\n");
+                goto out;
+            }
+        }
+    }
+    else
+    {
+        xen_pfn_t max_gpfn;
+
+        /*
+         * The single ring pfn set up at domain build time is too small.
+         * Place the rings above the guest's highest gfn instead, and point
+         * the ring param at them for Xen to find.
+         */
+        rc1 = xc_domain_maximum_gpfn(xch, domain_id, &max_gpfn);
         if ( rc1 != 0 )
         {
-            PERROR("Failed to populate ring pfn\n");
+            PERROR("Failed to get maximum gpfn\n");
+            goto out;
+        }
+
+        for ( i = 0; i < total; i++ )
+            ring_pfns[i] = max_gpfn + 1 + i;
+
+        rc1 = xc_domain_populate_physmap_exact(xch, domain_id, total, 0, 0,
+                                              ring_pfns);
+        if ( rc1 != 0 )
+        {
+            PERROR("Failed to populate %u ring pfns\n", total);
+            goto out;
+        }
+
+        rc1 = xc_hvm_param_set(xch, domain_id, param, ring_pfns[0]);
+        if ( rc1 != 0 )
+        {
+            PERROR("Failed to set pfn of ring pages\n");
             goto out;
         }
     }
 
-    mmap_pfn = ring_pfn;
     ring_page = xc_map_foreign_pages(xch, domain_id, PROT_READ | PROT_WRITE,
-                                         &mmap_pfn, 1);
+                                     ring_pfns, total);
     if ( !ring_page )
     {
         PERROR("Could not map the ring page\n");
@@ -97,17 +206,14 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
     switch ( param )
     {
     case HVM_PARAM_PAGING_RING_PFN:
-        op = XEN_VM_EVENT_ENABLE;
         mode = XEN_DOMCTL_VM_EVENT_OP_PAGING;
         break;
 
     case HVM_PARAM_MONITOR_RING_PFN:
-        op = XEN_VM_EVENT_ENABLE;
         mode = XEN_DOMCTL_VM_EVENT_OP_MONITOR;
         break;
 
     case HVM_PARAM_SHARING_RING_PFN:
-        op = XEN_VM_EVENT_ENABLE;
         mode = XEN_DOMCTL_VM_EVENT_OP_SHARING;
         break;
 
@@ -121,15 +227,17 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
         goto out;
     }
 
-    rc1 = xc_vm_event_control(xch, domain_id, op, mode, port);
+    rc1 = vm_event_enable_op(xch, domain_id, mode, nr_frames, flags,
+                             port, ports, nr_ports);
     if ( rc1 != 0 )
     {
         PERROR("Failed to enable vm_event\n");
         goto out;
     }
 
-    /* Remove the ring_pfn from the guest's physmap */
-    rc1 = xc_domain_decrease_reservation_exact(xch, domain_id, 1, 0, &ring_pfn);
+    /* Remove the ring pfns from the guest's physmap */
+    rc1 = xc_domain_decrease_reservation_exact(xch, domain_id, total, 0,
+                                               ring_pfns);
     if ( rc1 != 0 )
         PERROR("Failed to remove ring page from guest physmap");
 
@@ -147,12 +255,14 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
         }
 
         if ( ring_page )
-            xenforeignmemory_unmap(xch->fmem, ring_page, 1);
+            xenforeignmemory_unmap(xch->fmem, ring_page, total);
         ring_page = NULL;
 
         errno = saved_errno;
     }
 
+    free(ring_pfns);
+
     return ring_page;
 }
 
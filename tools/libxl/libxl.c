@@ -948,6 +948,7 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    dss->compress = flags & LIBXL_SUSPEND_COMPRESS;
     dss->checkpointed_stream = LIBXL_CHECKPOINTED_STREAM_NONE;
 
     rc = libxl__fd_flags_modify_save(gc, dss->fd,
@@ -1487,6 +1488,7 @@ void libxl__domain_destroy(libxl__egc *egc, libxl__domain_destroy_state *dds)
         dds->stubdom.domid = stubdomid;
         dds->stubdom.callback = stubdom_destroy_callback;
         dds->stubdom.soft_reset = false;
+        dds->stubdom.soft_reset_platform = false;
         libxl__destroy_domid(egc, &dds->stubdom);
     } else {
         dds->stubdom_finished = 1;
@@ -1496,6 +1498,7 @@ void libxl__domain_destroy(libxl__egc *egc, libxl__domain_destroy_state *dds)
     dds->domain.domid = dds->domid;
     dds->domain.callback = domain_destroy_callback;
     dds->domain.soft_reset = dds->soft_reset;
+    dds->domain.soft_reset_platform = dds->soft_reset_platform;
     libxl__destroy_domid(egc, &dds->domain);
 }
 
@@ -1691,7 +1694,9 @@ static void devices_destroy_cb(libxl__egc *egc,
         } else {
             rc = xc_domain_pause(ctx->xch, domid);
             if (rc < 0) goto badchild;
-            rc = xc_domain_soft_reset(ctx->xch, domid);
+            rc = xc_domain_soft_reset(ctx->xch, domid,
+                                      dis->soft_reset_platform ?
+                                      XEN_DOMCTL_SOFT_RESET_platform : 0);
             if (rc < 0) goto badchild;
             rc = xc_domain_unpause(ctx->xch, domid);
         }
@@ -4458,7 +4463,8 @@ int libxl_get_free_memory(libxl_ctx *ctx, uint64_t *memkb)
     if (rc < 0)
         goto out;
 
-    *memkb = (info.free_pages + info.scrub_pages) * 4;
+    /* scrub_pages are already included in free_pages. */
+    *memkb = info.free_pages * 4;
 
 out:
     GC_FREE;
@@ -4716,6 +4722,7 @@ libxl_numainfo *libxl_get_numainfo(libxl_ctx *ctx, int *nr)
        LIBXL_NUMAINFO_INVALID_ENTRY : val
         ret[i].size = V(meminfo[i].memsize, XEN_INVALID_MEM_SZ);
         ret[i].free = V(meminfo[i].memfree, XEN_INVALID_MEM_SZ);
+        ret[i].scrub = V(meminfo[i].memscrub, XEN_INVALID_MEM_SZ);
         ret[i].num_dists = num_nodes;
         for (j = 0; j < ret[i].num_dists; j++) {
             unsigned idx = i * num_nodes + j;
@@ -5024,6 +5031,32 @@ int libxl_domain_get_nodeaffinity(libxl_ctx *ctx, uint32_t domid,
     return 0;
 }
 
+int libxl_domain_numa_migrate(libxl_ctx *ctx, uint32_t domid, int node,
+                              uint64_t *nr_migrated, uint64_t *nr_busy)
+{
+    GC_INIT(ctx);
+    xen_pfn_t max_gpfn;
+    int rc;
+
+    if (xc_domain_maximum_gpfn(ctx->xch, domid, &max_gpfn) < 0) {
+        LOGE(ERROR, "getting max gpfn of domain %u", domid);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (xc_domain_numa_migrate(ctx->xch, domid, node, 0, max_gpfn + 1,
+                               nr_migrated, nr_busy)) {
+        LOGE(ERROR, "moving memory of domain %u to node %d", domid, node);
+        rc = errno == ENOMEM ? ERROR_NOMEM : ERROR_FAIL;
+        goto out;
+    }
+
+    rc = 0;
+ out:
+    GC_FREE;
+    return rc;
+}
+
 static int libxl__set_vcpuonline_xenstore(libxl__gc *gc, uint32_t domid,
                                          libxl_bitmap *cpumap,
                                          const libxl_dominfo *info)
@@ -6615,15 +6648,16 @@ out:
     return rc;
 }
 
-int libxl_retrieve_domain_configuration(libxl_ctx *ctx, uint32_t domid,
-                                        libxl_domain_config *d_config)
+/* Caller must hold the CTX lock. */
+static int retrieve_domain_configuration(libxl__gc *gc,
+                                         const libxl_dominfo *info,
+                                         libxl_domain_config *d_config)
 {
-    GC_INIT(ctx);
+    libxl_ctx *ctx = CTX;
+    uint32_t domid = info->domid;
     int rc;
     libxl__domain_userdata_lock *lock = NULL;
 
-    CTX_LOCK;
-
     lock = libxl__lock_domain_userdata(gc, domid);
     if (!lock) {
         rc = ERROR_LOCK_FAIL;
@@ -6650,18 +6684,7 @@ int libxl_retrieve_domain_configuration(libxl_ctx *ctx, uint32_t domid,
     }
 
     /* Domain UUID */
-    {
-        libxl_dominfo info;
-        libxl_dominfo_init(&info);
-        rc = libxl_domain_info(ctx, &info, domid);
-        if (rc) {
-            LOG(ERROR, "fail to get domain info for domain %d", domid);
-            libxl_dominfo_dispose(&info);
-            goto out;
-        }
-        libxl_uuid_copy(ctx, &d_config->c_info.uuid, &info.uuid);
-        libxl_dominfo_dispose(&info);
-    }
+    libxl_uuid_copy(ctx, &d_config->c_info.uuid, &info->uuid);
 
     /* VCPUs */
     {
@@ -6819,11 +6842,62 @@ int libxl_retrieve_domain_configuration(libxl_ctx *ctx, uint32_t domid,
 
 out:
     if (lock) libxl__unlock_domain_userdata(lock);
+    return rc;
+}
+
+int libxl_retrieve_domain_configuration(libxl_ctx *ctx, uint32_t domid,
+                                        libxl_domain_config *d_config)
+{
+    GC_INIT(ctx);
+    libxl_dominfo info;
+    int rc;
+
+    libxl_dominfo_init(&info);
+
+    CTX_LOCK;
+
+    rc = libxl_domain_info(ctx, &info, domid);
+    if (rc) {
+        LOG(ERROR, "fail to get domain info for domain %d", domid);
+        goto out;
+    }
+
+    rc = retrieve_domain_configuration(gc, &info, d_config);
+
+out:
     CTX_UNLOCK;
+    libxl_dominfo_dispose(&info);
     GC_FREE;
     return rc;
 }
 
+int libxl_retrieve_domain_configuration_list(libxl_ctx *ctx,
+                                             const libxl_dominfo *info,
+                                             int nb_domain,
+                                             libxl_domain_config *d_configs,
+                                             int *rcs)
+{
+    int i, nr = 0;
+
+    libxl__ctx_lock(ctx);
+
+    for (i = 0; i < nb_domain; i++) {
+        /* Each domain gets its own gc, or memory would pile up until the
+         * whole list were done. */
+        GC_INIT(ctx);
+
+        rcs[i] = retrieve_domain_configuration(gc, &info[i], &d_configs[i]);
+        if (!rcs[i])
+            nr++;
+
+        GC_FREE;
+    }
+
+    libxl__ctx_unlock(ctx);
+
+    return nr;
+}
+
 static int libxl_device_disk_compare(libxl_device_disk *d1,
                                      libxl_device_disk *d2)
 {
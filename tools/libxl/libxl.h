@@ -96,6 +96,14 @@
  */
 #define LIBXL_HAVE_VNUMA 1
 
+/* LIBXL_HAVE_VNUMA_AUTO
+ *
+ * If this is defined, libxl_domain_build_info has a 'vnuma_auto' field.
+ * When set, and no vnuma_nodes are given, the vNUMA topology of a HVM
+ * guest is derived from the result of automatic NUMA placement.
+ */
+#define LIBXL_HAVE_VNUMA_AUTO 1
+
 /* LIBXL_HAVE_USERDATA_UNLINK
  *
  * If it is defined, libxl has a library function called
@@ -262,12 +270,24 @@
  */
 #define LIBXL_HAVE_SOFT_RESET 1
 
+/*
+ * LIBXL_HAVE_REBOOT_IN_PLACE indicates that libxl_domain_reboot_in_place
+ * is available, and RESTART_IN_PLACE in enum libxl_action_on_shutdown.
+ */
+#define LIBXL_HAVE_REBOOT_IN_PLACE 1
+
 /*
  * LIBXL_HAVE_APIC_ASSIST indicates that the 'apic_assist' value
  * is present in the viridian enlightenment enumeration.
  */
 #define LIBXL_HAVE_APIC_ASSIST 1
 
+/*
+ * LIBXL_HAVE_VIRIDIAN_SYNIC_STIMER indicates that the 'synic' and
+ * 'stimer' values are present in the viridian enlightenment enumeration.
+ */
+#define LIBXL_HAVE_VIRIDIAN_SYNIC_STIMER 1
+
 /*
  * LIBXL_HAVE_BUILD_ID means that libxl_version_info has the extra
  * field for the hypervisor build_id.
@@ -512,6 +532,14 @@ typedef struct libxl__ctx libxl_ctx;
  */
 #define LIBXL_HAVE_RETRIEVE_DOMAIN_CONFIGURATION 1
 
+/* LIBXL_HAVE_RETRIEVE_DOMAIN_CONFIGURATION_LIST
+ *
+ * If this is defined we have libxl_retrieve_domain_configuration_list
+ * which returns the current configuration of each of a list of domains
+ * in one call.
+ */
+#define LIBXL_HAVE_RETRIEVE_DOMAIN_CONFIGURATION_LIST 1
+
 /*
  * LIBXL_HAVE_BUILDINFO_VCPU_AFFINITY_ARRAYS
  *
@@ -857,6 +885,15 @@ typedef struct libxl__ctx libxl_ctx;
  */
 #define LIBXL_HAVE_REMUS 1
 
+/*
+ * LIBXL_HAVE_REMUS_NETBUF_BYPASS
+ * If this is defined, libxl_domain_remus_info has a netbuf_bypass field:
+ * a comma separated list of <proto>:<port> (proto being tcp or udp), for
+ * the guest output to those destination ports to be released without
+ * waiting for a checkpoint.
+ */
+#define LIBXL_HAVE_REMUS_NETBUF_BYPASS 1
+
 typedef uint8_t libxl_mac[6];
 #define LIBXL_MAC_FMT "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx"
 #define LIBXL_MAC_FMTLEN ((2*6)+5) /* 6 hex bytes plus 5 colons */
@@ -878,6 +915,13 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_PSR_MBM 1
 
+/*
+ * LIBXL_HAVE_PSR_MBM_DOMAIN
+ *
+ * If this is defined, libxl_psr_mbm_get_domain_bandwidth() exists.
+ */
+#define LIBXL_HAVE_PSR_MBM_DOMAIN 1
+
 /*
  * LIBXL_HAVE_PSR_CAT
  *
@@ -949,6 +993,14 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_CHECKPOINTED_STREAM 1
 
+/*
+ * LIBXL_HAVE_SUSPEND_COMPRESS
+ *
+ * If this is defined, libxl_domain_suspend() accepts LIBXL_SUSPEND_COMPRESS,
+ * which sends guest memory LZ4 compressed, using several threads.
+ */
+#define LIBXL_HAVE_SUSPEND_COMPRESS 1
+
 /*
  * LIBXL_HAVE_BUILDINFO_HVM_SYSTEM_FIRMWARE
  *
@@ -999,6 +1051,31 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_MEMKB_64BITS 1
 
+/*
+ * LIBXL_HAVE_NUMAINFO_SCRUB
+ *
+ * If this is defined, libxl_numainfo has a scrub field holding how much of
+ * the node's free memory has not been scrubbed yet.
+ */
+#define LIBXL_HAVE_NUMAINFO_SCRUB 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_NUMA_MIGRATE
+ *
+ * If this is defined, libxl_domain_numa_migrate() is available to move the
+ * memory of a running domain onto a given NUMA node.
+ */
+#define LIBXL_HAVE_DOMAIN_NUMA_MIGRATE 1
+
+/*
+ * LIBXL_HAVE_BUILDINFO_GRANT_FRAMES
+ *
+ * If this is defined, libxl_domain_build_info has a grant_frames field
+ * giving the number of grant table frames the domain starts with.  Zero
+ * leaves the grant table at the hypervisor's initial size.
+ */
+#define LIBXL_HAVE_BUILDINFO_GRANT_FRAMES 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1325,6 +1402,19 @@ int libxl_domain_soft_reset(libxl_ctx *ctx,
                             *aop_console_how)
                             LIBXL_EXTERNAL_CALLERS_ONLY;
 
+/*
+ * Boot an HVM domain, which must not be populate-on-demand, again from
+ * scratch, as on reboot, but keeping the domain and the memory it has,
+ * rather than freeing, scrubbing and allocating it all again.
+ */
+int libxl_domain_reboot_in_place(libxl_ctx *ctx,
+                                 libxl_domain_config *d_config,
+                                 uint32_t domid,
+                                 const libxl_asyncop_how *ao_how,
+                                 const libxl_asyncprogress_how
+                                 *aop_console_how)
+                                 LIBXL_EXTERNAL_CALLERS_ONLY;
+
   /* A progress report will be made via ao_console_how, of type
    * domain_create_console_available, when the domain's primary
    * console is available and can be connected to.
@@ -1341,12 +1431,27 @@ void libxl_domain_config_dispose(libxl_domain_config *d_config);
 int libxl_retrieve_domain_configuration(libxl_ctx *ctx, uint32_t domid,
                                         libxl_domain_config *d_config);
 
+/*
+ * Retrieve the configuration of each domain of the nb_domain in info, as
+ * returned by libxl_list_domain, into the corresponding entry of
+ * d_configs, which the caller must have initialised.  This avoids looking
+ * up each domain again.  The result for info[i] is stored in rcs[i]: a
+ * domain may well go away while the list is walked.  Returns the number of
+ * configurations retrieved.
+ */
+int libxl_retrieve_domain_configuration_list(libxl_ctx *ctx,
+                                             const libxl_dominfo *info,
+                                             int nb_domain,
+                                             libxl_domain_config *d_configs,
+                                             int *rcs);
+
 int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          int flags, /* LIBXL_SUSPEND_* */
                          const libxl_asyncop_how *ao_how)
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+#define LIBXL_SUSPEND_COMPRESS 4
 
 /* @param suspend_cancel [from xenctrl.h:xc_domain_resume( @param fast )]
  *   If this parameter is true, use co-operative resume. The guest
@@ -1974,6 +2079,14 @@ int libxl_domain_set_nodeaffinity(libxl_ctx *ctx, uint32_t domid,
                                   libxl_bitmap *nodemap);
 int libxl_domain_get_nodeaffinity(libxl_ctx *ctx, uint32_t domid,
                                   libxl_bitmap *nodemap);
+/*
+ * Move the memory of domid onto node, e.g. after its node affinity was
+ * changed.  Pages in use by other domains or devices are not moved and are
+ * accounted in nr_busy; calling again later may pick them up.  Either
+ * counter pointer may be NULL.
+ */
+int libxl_domain_numa_migrate(libxl_ctx *ctx, uint32_t domid, int node,
+                              uint64_t *nr_migrated, uint64_t *nr_busy);
 int libxl_set_vcpuonline(libxl_ctx *ctx, uint32_t domid, libxl_bitmap *cpumap);
 
 /* A return value less than 0 should be interpreted as a libxl_error, while a
@@ -2116,6 +2229,15 @@ int libxl_psr_cmt_get_sample(libxl_ctx *ctx,
                              uint64_t *tsc_r);
 #endif
 
+#ifdef LIBXL_HAVE_PSR_MBM_DOMAIN
+/*
+ * Memory bandwidth of a monitored domain over all sockets, in bytes/s, as
+ * last sampled by Xen: in total, and to memory local to the socket.
+ */
+int libxl_psr_mbm_get_domain_bandwidth(libxl_ctx *ctx, uint32_t domid,
+                                       uint64_t *total_r, uint64_t *local_r);
+#endif
+
 #ifdef LIBXL_HAVE_PSR_CAT
 /*
  * Function to set a domain's cbm. It operates on a single or multiple
@@ -78,7 +78,7 @@ static int colo_proxy_send(libxl__colo_proxy_state *cps, uint8_t *buff,
 
 /* error: return -1, otherwise return 0 */
 static int64_t colo_proxy_recv(libxl__colo_proxy_state *cps, uint8_t **buff,
-                               unsigned int timeout_us)
+                               unsigned int timeout_us, int flags)
 {
     struct sockaddr_nl sa;
     struct iovec iov;
@@ -105,7 +105,7 @@ static int64_t colo_proxy_recv(libxl__colo_proxy_state *cps, uint8_t **buff,
     iov.iov_base = tmp;
     iov.iov_len = size;
 next:
-    ret = recvmsg(cps->sock_fd, &mh, 0);
+    ret = recvmsg(cps->sock_fd, &mh, flags);
     if (ret <= 0) {
         if (errno != EAGAIN && errno != EWOULDBLOCK)
             LOGE(ERROR, "can't recv msg from kernel by netlink");
@@ -138,6 +138,68 @@ out:
     return ret;
 }
 
+typedef struct colo_msg {
+    bool is_checkpoint;
+} colo_msg;
+
+/*
+ * Walk all the netlink messages received in one go.
+ * Return value:
+ * -1: error
+ *  0: none of them asks for a checkpoint
+ *  1: do checkpoint
+ */
+static int colo_proxy_parse(libxl__colo_proxy_state *cps, uint8_t *buff,
+                            int64_t size)
+{
+    struct nlmsghdr *h;
+    struct colo_msg *m;
+    int len = size;
+    int ret = 0;
+
+    STATE_AO_GC(cps->ao);
+
+    for (h = (struct nlmsghdr *)buff; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+        if (h->nlmsg_type == NLMSG_ERROR) {
+            LOG(ERROR, "receive NLMSG_ERROR");
+            return -1;
+        }
+
+        if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*m))) {
+            LOG(ERROR, "NLMSG_LENGTH is too short");
+            return -1;
+        }
+
+        m = NLMSG_DATA(h);
+        if (m->is_checkpoint)
+            ret = 1;
+    }
+
+    return ret;
+}
+
+/*
+ * Consume the messages already queued on the socket, without waiting.
+ * Return value: as colo_proxy_parse(), over all of them.
+ */
+static int colo_proxy_drain(libxl__colo_proxy_state *cps)
+{
+    uint8_t *buff;
+    int64_t size;
+    int rc, ret = 0;
+
+    while ((size = colo_proxy_recv(cps, &buff, 0, MSG_DONTWAIT)) > 0) {
+        rc = colo_proxy_parse(cps, buff, size);
+        free(buff);
+        if (rc < 0)
+            return rc;
+        ret |= rc;
+    }
+
+    return ret;
+}
+
 /* ========= colo-proxy: setup and teardown ========== */
 
 int colo_proxy_setup(libxl__colo_proxy_state *cps)
@@ -184,7 +246,7 @@ retry:
         goto out;
 
     /* receive ack */
-    size = colo_proxy_recv(cps, &buff, 500000);
+    size = colo_proxy_recv(cps, &buff, 500000, 0);
     if (size < 0) {
         LOG(ERROR, "Can't recv msg from kernel by netlink: %s",
             strerror(errno));
@@ -232,6 +294,12 @@ void colo_proxy_teardown(libxl__colo_proxy_state *cps)
 
 void colo_proxy_preresume(libxl__colo_proxy_state *cps)
 {
+    /*
+     * The proxy keeps reporting mismatches until it is told about the
+     * checkpoint, and those queued so far are answered by the checkpoint
+     * being taken: drop them, lest they trigger another one right away.
+     */
+    colo_proxy_drain(cps);
     colo_proxy_send(cps, NULL, 0, COLO_CHECKPOINT);
     /* TODO: need to handle if the call fails... */
 }
@@ -241,10 +309,6 @@ void colo_proxy_postresume(libxl__colo_proxy_state *cps)
     /* nothing to do... */
 }
 
-typedef struct colo_msg {
-    bool is_checkpoint;
-} colo_msg;
-
 /*
  * Return value:
  * -1: error
@@ -256,35 +320,24 @@ int colo_proxy_checkpoint(libxl__colo_proxy_state *cps,
 {
     uint8_t *buff;
     int64_t size;
-    struct nlmsghdr *h;
-    struct colo_msg *m;
-    int ret = -1;
+    int rc, ret;
 
-    STATE_AO_GC(cps->ao);
-
-    size = colo_proxy_recv(cps, &buff, timeout_us);
+    size = colo_proxy_recv(cps, &buff, timeout_us, 0);
 
     /* timeout, return no checkpoint message. */
     if (size <= 0)
         return 0;
 
-    h = (struct nlmsghdr *) buff;
-
-    if (h->nlmsg_type == NLMSG_ERROR) {
-        LOG(ERROR, "receive NLMSG_ERROR");
-        goto out;
-    }
-
-    if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*m))) {
-        LOG(ERROR, "NLMSG_LENGTH is too short");
-        goto out;
-    }
-
-    m = NLMSG_DATA(h);
+    ret = colo_proxy_parse(cps, buff, size);
+    free(buff);
+    if (ret < 0)
+        return ret;
 
-    ret = m->is_checkpoint ? 1 : 0;
+    /*
+     * Mismatches tend to come in bursts: whatever else is queued already
+     * is answered by the same checkpoint.
+     */
+    rc = colo_proxy_drain(cps);
 
-out:
-    free(buff);
-    return ret;
+    return rc < 0 ? rc : (ret | rc);
 }
@@ -196,6 +196,7 @@ int libxl__domain_build_info_setdefault(libxl__gc *gc,
     }
 
     libxl_defbool_setdefault(&b_info->numa_placement, true);
+    libxl_defbool_setdefault(&b_info->vnuma_auto, false);
 
     if (b_info->max_memkb == LIBXL_MEMKB_DEFAULT)
         b_info->max_memkb = 32 * 1024;
@@ -750,6 +751,9 @@ static int store_libxl_entry(libxl__gc *gc, uint32_t domid,
 static void domcreate_devmodel_started(libxl__egc *egc,
                                        libxl__dm_spawn_state *dmss,
                                        int rc);
+static void domcreate_qmp_initialized(libxl__egc *egc,
+                                      libxl__qmp_init_state *qis,
+                                      int rc);
 static void domcreate_bootloader_console_available(libxl__egc *egc,
                                                    libxl__bootloader_state *bl);
 static void domcreate_bootloader_done(libxl__egc *egc,
@@ -1045,7 +1049,8 @@ static void domcreate_bootloader_done(libxl__egc *egc,
     dcs->sdss.dm.callback = domcreate_devmodel_started;
     dcs->sdss.callback = domcreate_devmodel_started;
 
-    if (restore_fd < 0 && dcs->domid_soft_reset == INVALID_DOMID) {
+    if (restore_fd < 0 &&
+        (dcs->domid_soft_reset == INVALID_DOMID || dcs->reboot_in_place)) {
         rc = libxl__domain_build(gc, d_config, domid, state);
         domcreate_rebuild_done(egc, dcs, rc);
         return;
@@ -1497,12 +1502,16 @@ static void domcreate_devmodel_started(libxl__egc *egc,
     if (dcs->sdss.dm.guest_domid) {
         if (d_config->b_info.device_model_version
             == LIBXL_DEVICE_MODEL_VERSION_QEMU_XEN) {
-            libxl__qmp_initializations(gc, domid, d_config);
+            dcs->qis.ao = ao;
+            dcs->qis.domid = domid;
+            dcs->qis.guest_config = d_config;
+            dcs->qis.callback = domcreate_qmp_initialized;
+            libxl__qmp_initializations(egc, &dcs->qis);
+            return;
         }
     }
 
-    dcs->device_type_idx = -1;
-    domcreate_attach_devices(egc, &dcs->multidev, 0);
+    domcreate_qmp_initialized(egc, &dcs->qis, 0);
     return;
 
 error_out:
@@ -1510,6 +1519,21 @@ error_out:
     domcreate_complete(egc, dcs, ret);
 }
 
+static void domcreate_qmp_initialized(libxl__egc *egc,
+                                      libxl__qmp_init_state *qis,
+                                      int rc)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(qis, *dcs, qis);
+    STATE_AO_GC(dcs->ao);
+
+    /* Not being able to query the device model is not fatal. */
+    if (rc)
+        LOG(WARN, "Domain %u: QMP initialisations failed", qis->domid);
+
+    dcs->device_type_idx = -1;
+    domcreate_attach_devices(egc, &dcs->multidev, 0);
+}
+
 static void domcreate_complete(libxl__egc *egc,
                                libxl__domain_create_state *dcs,
                                int rc)
@@ -1648,6 +1672,11 @@ static void domain_soft_reset_cb(libxl__egc *egc,
     }
 
     cdcs->dcs.guest_domid = dds->domid;
+
+    /* Booting afresh: there is no state to carry over. */
+    if (cdcs->dcs.reboot_in_place)
+        goto create;
+
     rc = libxl__restore_emulator_xenstore_data(&cdcs->dcs, srs->toolstack_buf,
                                                srs->toolstack_len);
     if (rc) {
@@ -1663,6 +1692,7 @@ static void domain_soft_reset_cb(libxl__egc *egc,
         goto error;
     }
 
+ create:
     initiate_domain_create(egc, &cdcs->dcs);
     return;
 
@@ -1673,6 +1703,7 @@ error:
 static int do_domain_soft_reset(libxl_ctx *ctx,
                                 libxl_domain_config *d_config,
                                 uint32_t domid_soft_reset,
+                                bool reboot,
                                 const libxl_asyncop_how *ao_how,
                                 const libxl_asyncprogress_how
                                 *aop_console_how)
@@ -1700,6 +1731,7 @@ static int do_domain_soft_reset(libxl_ctx *ctx,
                              d_config);
     cdcs->dcs.restore_fd = -1;
     cdcs->dcs.domid_soft_reset = domid_soft_reset;
+    cdcs->dcs.reboot_in_place = reboot;
     cdcs->dcs.callback = domain_create_cb;
     libxl__ao_progress_gethow(&srs->cdcs.dcs.aop_console_how,
                               aop_console_how);
@@ -1712,6 +1744,16 @@ static int do_domain_soft_reset(libxl_ctx *ctx,
         goto out;
     }
 
+    if (reboot) {
+        /*
+         * The guest is built again from scratch, over the memory it
+         * already has, and the device model started afresh, so there is
+         * nothing of the running instance to save.
+         */
+        state->keep_memory = true;
+        goto release;
+    }
+
     xs_store_mfn = xs_read(ctx->xsh, XBT_NULL,
                            GCSPRINTF("%s/store/ring-ref", dom_path),
                            NULL);
@@ -1742,6 +1784,7 @@ static int do_domain_soft_reset(libxl_ctx *ctx,
         goto out;
     }
 
+ release:
     /*
      * Ask all backends to disconnect by removing the domain from
      * xenstore. On the creation path the domain will be introduced to
@@ -1754,6 +1797,7 @@ static int do_domain_soft_reset(libxl_ctx *ctx,
     srs->dds.domid = domid_soft_reset;
     srs->dds.callback = domain_soft_reset_cb;
     srs->dds.soft_reset = true;
+    srs->dds.soft_reset_platform = reboot;
     libxl__domain_destroy(egc, &srs->dds);
 
     return AO_INPROGRESS;
@@ -1843,7 +1887,25 @@ int libxl_domain_soft_reset(libxl_ctx *ctx,
 
     if (info->type != LIBXL_DOMAIN_TYPE_HVM) return ERROR_INVAL;
 
-    return do_domain_soft_reset(ctx, d_config, domid, ao_how,
+    return do_domain_soft_reset(ctx, d_config, domid, false, ao_how,
+                                aop_console_how);
+}
+
+int libxl_domain_reboot_in_place(libxl_ctx *ctx,
+                                 libxl_domain_config *d_config,
+                                 uint32_t domid,
+                                 const libxl_asyncop_how *ao_how,
+                                 const libxl_asyncprogress_how
+                                 *aop_console_how)
+{
+    libxl_domain_build_info *const info = &d_config->b_info;
+
+    /* A populate-on-demand guest's memory is not all there to keep. */
+    if (info->type != LIBXL_DOMAIN_TYPE_HVM ||
+        info->target_memkb < info->max_memkb)
+        return ERROR_INVAL;
+
+    return do_domain_soft_reset(ctx, d_config, domid, true, ao_how,
                                 aop_console_how);
 }
 
@@ -737,10 +737,10 @@ void libxl__devices_destroy(libxl__egc *egc, libxl__devices_remove_state *drs)
 {
     STATE_AO_GC(drs->ao);
     uint32_t domid = drs->domid;
-    char *path;
-    unsigned int num_kinds, num_dev_xsentries;
-    char **kinds = NULL, **devs = NULL;
-    int i, j, rc = 0;
+    char *path, *devid, *leaf;
+    unsigned int num_entries;
+    struct xs_subtree_entry *entries;
+    int i, rc = 0;
     libxl__device *dev;
     libxl__multidev *multidev = &drs->multidev;
     libxl__ao_device *aodev;
@@ -750,49 +750,49 @@ void libxl__devices_destroy(libxl__egc *egc, libxl__devices_remove_state *drs)
     multidev->callback = devices_remove_callback;
 
     path = GCSPRINTF("/libxl/%d/device", domid);
-    kinds = libxl__xs_directory(gc, XBT_NULL, path, &num_kinds);
-    if (!kinds) {
+    /* <kind>/<devid>/backend of every device, in one go. */
+    entries = libxl__xs_read_subtree(gc, XBT_NULL, path, 3, &num_entries);
+    if (!entries) {
         if (errno != ENOENT) {
             LOGE(ERROR, "unable to get xenstore device listing %s", path);
             goto out;
         }
-        num_kinds = 0;
+        num_entries = 0;
     }
-    for (i = 0; i < num_kinds; i++) {
-        if (libxl__device_kind_from_string(kinds[i], &kind))
+    for (i = 0; i < num_entries; i++) {
+        path = libxl__strdup(gc, entries[i].name);
+        devid = strchr(path, '/');
+        leaf = devid ? strchr(devid + 1, '/') : NULL;
+        if (!leaf || strcmp(leaf, "/backend"))
             continue;
-
-        path = GCSPRINTF("/libxl/%d/device/%s", domid, kinds[i]);
-        devs = libxl__xs_directory(gc, XBT_NULL, path, &num_dev_xsentries);
-        if (!devs)
+        *devid++ = '\0';
+        *leaf = '\0';
+        if (libxl__device_kind_from_string(path, &kind))
             continue;
-        for (j = 0; j < num_dev_xsentries; j++) {
-            path = GCSPRINTF("/libxl/%d/device/%s/%s/backend",
-                             domid, kinds[i], devs[j]);
-            path = libxl__xs_read(gc, XBT_NULL, path);
-            GCNEW(dev);
-            if (path && libxl__parse_backend_path(gc, path, dev) == 0) {
-                dev->domid = domid;
-                dev->kind = kind;
-                dev->devid = atoi(devs[j]);
-                if (dev->backend_kind == LIBXL__DEVICE_KIND_CONSOLE) {
-                    /* Currently console devices can be destroyed
-                     * synchronously by just removing xenstore entries,
-                     * this is what libxl__device_destroy does.
-                     */
-                    libxl__device_destroy(gc, dev);
-                    continue;
-                }
-                aodev = libxl__multidev_prepare(multidev);
-                aodev->action = LIBXL__DEVICE_ACTION_REMOVE;
-                aodev->dev = dev;
-                aodev->force = drs->force;
-                if (dev->backend_kind == LIBXL__DEVICE_KIND_VUSB ||
-                    dev->backend_kind == LIBXL__DEVICE_KIND_QUSB)
-                    libxl__initiate_device_usbctrl_remove(egc, aodev);
-                else
-                    libxl__initiate_device_generic_remove(egc, aodev);
+
+        path = entries[i].value;
+        GCNEW(dev);
+        if (path && libxl__parse_backend_path(gc, path, dev) == 0) {
+            dev->domid = domid;
+            dev->kind = kind;
+            dev->devid = atoi(devid);
+            if (dev->backend_kind == LIBXL__DEVICE_KIND_CONSOLE) {
+                /* Currently console devices can be destroyed
+                 * synchronously by just removing xenstore entries,
+                 * this is what libxl__device_destroy does.
+                 */
+                libxl__device_destroy(gc, dev);
+                continue;
             }
+            aodev = libxl__multidev_prepare(multidev);
+            aodev->action = LIBXL__DEVICE_ACTION_REMOVE;
+            aodev->dev = dev;
+            aodev->force = drs->force;
+            if (dev->backend_kind == LIBXL__DEVICE_KIND_VUSB ||
+                dev->backend_kind == LIBXL__DEVICE_KIND_QUSB)
+                libxl__initiate_device_usbctrl_remove(egc, aodev);
+            else
+                libxl__initiate_device_generic_remove(egc, aodev);
         }
     }
 
@@ -259,6 +259,12 @@ static int hvm_set_viridian_features(libxl__gc *gc, uint32_t domid,
     if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_APIC_ASSIST))
         mask |= HVMPV_apic_assist;
 
+    if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_SYNIC))
+        mask |= HVMPV_synic;
+
+    if (libxl_bitmap_test(&enlightenments, LIBXL_VIRIDIAN_ENLIGHTENMENT_STIMER))
+        mask |= HVMPV_stimer | HVMPV_synic | HVMPV_time_ref_count;
+
     if (mask != 0 &&
         xc_hvm_param_set(CTX->xch,
                          domid,
@@ -363,6 +369,26 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
 
             libxl_bitmap_dispose(&cpumap_soft);
 
+            /*
+             * Let the guest see the nodes it was placed on, if asked to.
+             * The soft affinity of each vcpu is then narrowed down to its
+             * vnode's pnode in libxl__build_post().
+             */
+            if (libxl_defbool_val(info->vnuma_auto) &&
+                !info->num_vnuma_nodes) {
+                if (info->type != LIBXL_DOMAIN_TYPE_HVM)
+                    LOG(WARN, "Automatic vNUMA is only supported for HVM "
+                              "guests");
+                else if (info->target_memkb < info->max_memkb)
+                    LOG(WARN, "Can't enable automatic vNUMA, as PoD is "
+                              "enabled");
+                else {
+                    rc = libxl__vnuma_from_placement(gc, info);
+                    if (rc)
+                        return rc;
+                }
+            }
+
             /*
              * Placement has run, so avoid for it to be re-run, if this
              * same config we are using and building here is ever re-used.
@@ -510,6 +536,15 @@ int libxl__build_post(libxl__gc *gc, uint32_t domid,
         return ERROR_FAIL;
     }
 
+    if (info->grant_frames) {
+        rc = xc_domain_set_grant_frames(ctx->xch, domid, info->grant_frames);
+        if (rc) {
+            LOGE(ERROR, "Failed to set up %u grant table frames",
+                 info->grant_frames);
+            return ERROR_FAIL;
+        }
+    }
+
     libxl_cpuid_apply_policy(ctx, domid);
     if (info->cpuid != NULL)
         libxl_cpuid_set(ctx, domid, info->cpuid);
@@ -615,6 +650,7 @@ static int libxl__build_dom(libxl__gc *gc, uint32_t domid,
              struct xc_dom_image *dom)
 {
     uint64_t mem_kb;
+    bool unlocked;
     int ret;
 
     if ( (ret = xc_dom_boot_xen_init(dom, CTX->xch, domid)) != 0 ) {
@@ -642,7 +678,12 @@ static int libxl__build_dom(libxl__gc *gc, uint32_t domid,
         LOGE(ERROR, "xc_dom_mem_init failed");
         goto out;
     }
-    if ( (ret = xc_dom_boot_mem_init(dom)) != 0 ) {
+    /* Populating the guest's memory can take seconds for a large
+     * guest; let other domains' creation proceed meanwhile. */
+    unlocked = libxl__ctx_unlock_long_op(CTX);
+    ret = xc_dom_boot_mem_init(dom);
+    libxl__ctx_relock_long_op(CTX, unlocked);
+    if ( ret != 0 ) {
         LOGE(ERROR, "xc_dom_boot_mem_init failed");
         goto out;
     }
@@ -1084,6 +1125,7 @@ int libxl__build_hvm(libxl__gc *gc, uint32_t domid,
     dom->mmio_start = mmio_start;
     dom->vga_hole_size = device_model ? LIBXL_VGA_HOLE_SIZE : 0;
     dom->device_model = device_model;
+    dom->keep_memory = state->keep_memory;
 
     rc = libxl__domain_device_construct_rdm(gc, d_config,
                                             info->u.hvm.rdm_mem_boundary_memkb*1024,
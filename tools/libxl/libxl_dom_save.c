@@ -262,6 +262,26 @@ static void switch_logdirty_done(libxl__egc *egc,
 
 /*----- callbacks, called by xc_domain_save -----*/
 
+void libxl__domain_save_precopy_policy(unsigned iteration,
+                                       unsigned long dirty_count,
+                                       unsigned long dirty_rate,
+                                       unsigned long bandwidth,
+                                       unsigned long downtime_ms,
+                                       int decision, void *user)
+{
+    libxl__save_helper_state *shs = user;
+    libxl__domain_save_state *dss = shs->caller_state;
+    STATE_AO_GC(dss->ao);
+
+    LOG(DEBUG, "domain %u precopy iteration %u: %lu pages dirty, "
+        "dirty rate %lu pages/s, bandwidth %lu pages/s, "
+        "predicted downtime %lums%s", dss->domid, iteration, dirty_count,
+        dirty_rate, bandwidth, downtime_ms,
+        decision == XGS_POLICY_STOP_AND_COPY ? ", suspending" : "");
+
+    libxl__xc_domain_saverestore_async_callback_done(shs->egc, shs, decision);
+}
+
 /*
  * Expand the buffer 'buf' of length 'len', to append 'str' including its NUL
  * terminator.
@@ -375,6 +395,7 @@ void libxl__domain_save(libxl__egc *egc, libxl__domain_save_state *dss)
 
     dss->xcflags = (live ? XCFLAGS_LIVE : 0)
           | (debug ? XCFLAGS_DEBUG : 0)
+          | (dss->compress ? XCFLAGS_STREAM_COMPRESS : 0)
           | (dss->hvm ? XCFLAGS_HVM : 0);
 
     /* Disallow saving a guest with vNUMA configured because migration
@@ -397,8 +418,11 @@ void libxl__domain_save(libxl__egc *egc, libxl__domain_save_state *dss)
             dss->xcflags |= XCFLAGS_CHECKPOINT_COMPRESS;
     }
 
-    if (dss->checkpointed_stream == LIBXL_CHECKPOINTED_STREAM_NONE)
+    if (dss->checkpointed_stream == LIBXL_CHECKPOINTED_STREAM_NONE) {
         callbacks->suspend = libxl__domain_suspend_callback;
+        if (live)
+            callbacks->precopy_policy = libxl__domain_save_precopy_policy;
+    }
 
     callbacks->switch_qemu_logdirty = libxl__domain_suspend_common_switch_qemu_logdirty;
 
@@ -437,6 +437,7 @@ struct libxl__ctx {
        * proper lock hierarchy, and these restrictions must then be
        * documented in the libxl public interface.
        */
+    unsigned lock_depth; /* protected by lock */
 
     LIBXL_TAILQ_HEAD(libxl__event_list, libxl_event) occurred;
 
@@ -700,6 +701,11 @@ _hidden char *libxl__xs_read(libxl__gc *gc, xs_transaction_t t,
 _hidden char **libxl__xs_directory(libxl__gc *gc, xs_transaction_t t,
                                    const char *path, unsigned int *nb);
    /* On error: returns NULL, sets errno (no logging) */
+_hidden struct xs_subtree_entry *libxl__xs_read_subtree(libxl__gc *gc,
+                                   xs_transaction_t t, const char *path,
+                                   unsigned int depth, unsigned int *nb);
+   /* The nodes below path, in one round trip where the daemon can.
+    * On error: returns NULL, sets errno (no logging) */
 _hidden char *libxl__xs_libxl_path(libxl__gc *gc, uint32_t domid);
 
 _hidden int libxl__backendpath_parse_domid(libxl__gc *gc, const char *be_path,
@@ -1107,6 +1113,7 @@ typedef struct {
     libxl__file_reference pv_ramdisk;
     const char * pv_cmdline;
     bool pvh_enabled;
+    bool keep_memory; /* rebuild over the memory the domain has */
 
     xen_vmemrange_t *vmemranges;
     uint32_t num_vmemranges;
@@ -1828,9 +1835,6 @@ _hidden void libxl__qmp_close(libxl__qmp_handler *qmp);
  * nothing happen */
 _hidden void libxl__qmp_cleanup(libxl__gc *gc, uint32_t domid);
 
-/* this helper calls qmp_initialize, query_serial and qmp_close */
-_hidden int libxl__qmp_initializations(libxl__gc *gc, uint32_t domid,
-                                       const libxl_domain_config *guest_config);
 
 /* on failure, logs */
 int libxl__sendmsg_fds(libxl__gc *gc, int carrier,
@@ -1997,6 +2001,81 @@ _hidden void libxl__json_object_free(libxl__gc *gc_opt,
 
 _hidden libxl__json_object *libxl__json_parse(libxl__gc *gc_opt, const char *s);
 
+/*----- ev_qmp: asynchronous QMP command -----*/
+
+typedef struct libxl__ev_qmp libxl__ev_qmp;
+
+/*
+ * Issues one QMP command to the device model of domid from the event
+ * loop: connects to its QMP socket, negotiates capabilities, sends the
+ * command and waits for the reply.  If QEMU is not listening yet, the
+ * connection is retried whenever the device model state in xenstore
+ * changes, rather than by polling.
+ *
+ * The callback is made exactly once, with:
+ *
+ * rc==0
+ *
+ *     response is the "return" member of the reply, allocated from the
+ *     ao gc.  It may be NULL if QEMU did not return anything.
+ *
+ * rc==ERROR_TIMEDOUT, rc==ERROR_ABORTED, or another error
+ *
+ *     The command failed, or QEMU reported an error, or timeout_ms
+ *     elapsed.  Errors other than ERROR_ABORTED have been logged.
+ *     response is NULL.
+ *
+ * In both cases the ev_qmp is idle again, and may be reused for another
+ * command, including from within the callback.
+ */
+typedef void libxl__ev_qmp_callback(libxl__egc *egc, libxl__ev_qmp *ev,
+                                    const libxl__json_object *response,
+                                    int rc);
+
+struct libxl__ev_qmp {
+    /* caller must fill these in, and they must all remain valid */
+    libxl__ao *ao;
+    uint32_t domid;
+    int timeout_ms; /* for the whole command, as for poll(2) */
+    libxl__ev_qmp_callback *callback;
+    /* remaining fields are private to ev_qmp */
+    int state;
+    int fd;
+    libxl__ev_fd efd;
+    libxl__ev_time timeout;
+    libxl__ev_xswatch ready_watch;
+    char *tx_buf, *rx_buf;
+    size_t tx_len, tx_off, rx_len, rx_size;
+};
+
+_hidden void libxl__ev_qmp_init(libxl__ev_qmp *ev);
+/* args, if any, is only used during the call. */
+_hidden int libxl__ev_qmp_send(libxl__gc *gc, libxl__ev_qmp *ev,
+                               const char *cmd, libxl__json_object *args);
+_hidden void libxl__ev_qmp_dispose(libxl__gc*, libxl__ev_qmp*); /*idempotent*/
+_hidden bool libxl__ev_qmp_inuse(const libxl__ev_qmp *ev);
+
+/*
+ * Asks a new device model for its serial ports and VNC server and
+ * stores them in xenstore, and sets the VNC password, asynchronously.
+ */
+typedef struct libxl__qmp_init_state libxl__qmp_init_state;
+typedef void libxl__qmp_init_callback(libxl__egc *egc,
+                                      libxl__qmp_init_state *qis, int rc);
+
+struct libxl__qmp_init_state {
+    /* caller must fill these in, and they must all remain valid */
+    libxl__ao *ao;
+    uint32_t domid;
+    const libxl_domain_config *guest_config;
+    libxl__qmp_init_callback *callback;
+    /* remaining fields are private to qmp_initializations */
+    libxl__ev_qmp qmp;
+};
+
+_hidden void libxl__qmp_initializations(libxl__egc *egc,
+                                        libxl__qmp_init_state *qis);
+
   /* Based on /local/domain/$domid/dm-version xenstore key
    * default is qemu xen traditional */
 _hidden int libxl__device_model_version_running(libxl__gc *gc, uint32_t domid);
@@ -3037,6 +3116,7 @@ struct libxl__remus_state {
     /*----- private for concrete (device-specific) layer only -----*/
     /* private for nic device subkind ops */
     char *netbufscript;
+    char *netbuf_bypass;
     struct nl_sock *nlsock;
     struct nl_cache *qdisc_cache;
 
@@ -3268,6 +3348,7 @@ struct libxl__domain_save_state {
     libxl_domain_type type;
     int live;
     int debug;
+    int compress;
     int checkpointed_stream;
     const libxl_domain_remus_info *remus;
     /* private */
@@ -3554,6 +3635,7 @@ struct libxl__destroy_domid_state {
     libxl__devices_remove_state drs;
     libxl__ev_child destroyer;
     bool soft_reset;
+    bool soft_reset_platform; /* also reset the emulated platform */
 };
 
 struct libxl__domain_destroy_state {
@@ -3569,6 +3651,7 @@ struct libxl__domain_destroy_state {
     libxl__destroy_domid_state domain;
     int domain_finished;
     bool soft_reset;
+    bool soft_reset_platform;
 };
 
 /*
@@ -3664,6 +3747,7 @@ struct libxl__domain_create_state {
     int send_back_fd;
     libxl_domain_restore_params restore_params;
     uint32_t domid_soft_reset;
+    bool reboot_in_place; /* domid_soft_reset is booted afresh */
     libxl__domain_create_cb *callback;
     libxl_asyncprogress_how aop_console_how;
     /* private to domain_create */
@@ -3681,6 +3765,7 @@ struct libxl__domain_create_state {
     /* necessary if the domain creation failed and we have to destroy it */
     libxl__domain_destroy_state dds;
     libxl__multidev multidev;
+    libxl__qmp_init_state qis;
 };
 
 _hidden int libxl__device_nic_set_devids(libxl__gc *gc,
@@ -3717,6 +3802,12 @@ _hidden void libxl__domain_suspend_common_switch_qemu_logdirty
 _hidden void libxl__domain_common_switch_qemu_logdirty(libxl__egc *egc,
                                                int domid, unsigned enable,
                                                libxl__logdirty_switch *lds);
+_hidden void libxl__domain_save_precopy_policy(unsigned iteration,
+                                               unsigned long dirty_count,
+                                               unsigned long dirty_rate,
+                                               unsigned long bandwidth,
+                                               unsigned long downtime_ms,
+                                               int decision, void *user);
 _hidden int libxl__save_emulator_xenstore_data(libxl__domain_save_state *dss,
                                                char **buf, uint32_t *len);
 _hidden int libxl__restore_emulator_xenstore_data
@@ -3891,16 +3982,41 @@ _hidden void libxl__remus_restore_setup(libxl__egc *egc,
 static inline void libxl__ctx_lock(libxl_ctx *ctx) {
     int r = pthread_mutex_lock(&ctx->lock);
     assert(!r);
+    ctx->lock_depth++;
 }
 
 static inline void libxl__ctx_unlock(libxl_ctx *ctx) {
-    int r = pthread_mutex_unlock(&ctx->lock);
+    int r;
+    assert(ctx->lock_depth);
+    ctx->lock_depth--;
+    r = pthread_mutex_unlock(&ctx->lock);
     assert(!r);
 }
 
 #define CTX_LOCK (libxl__ctx_lock(CTX))
 #define CTX_UNLOCK (libxl__ctx_unlock(CTX))
 
+/*
+ * For long-running operations, such as populating a new guest's
+ * memory, which touch nothing hanging off the ctx and so need not
+ * stop other threads from making progress with their own aos.
+ *
+ * libxl__ctx_unlock_long_op releases the ctx lock if it is held just
+ * once, ie not by some caller further up the stack which may be
+ * relying on it, and returns whether it did.  The operation must then
+ * use only its own state, the gc of its ao and CTX->xch, and must be
+ * followed by libxl__ctx_relock_long_op with the value returned.
+ */
+static inline bool libxl__ctx_unlock_long_op(libxl_ctx *ctx) {
+    if (ctx->lock_depth != 1) return false;
+    libxl__ctx_unlock(ctx);
+    return true;
+}
+
+static inline void libxl__ctx_relock_long_op(libxl_ctx *ctx, bool unlocked) {
+    if (unlocked) libxl__ctx_lock(ctx);
+}
+
 /*
  * Automatic NUMA placement
  *
@@ -4044,6 +4160,9 @@ int libxl__vnuma_build_vmemrange_hvm(libxl__gc *gc,
                                      libxl__domain_build_state *state,
                                      struct xc_dom_image *dom);
 bool libxl__vnuma_configured(const libxl_domain_build_info *b_info);
+/* Build vnuma_nodes from the result of automatic NUMA placement. */
+int libxl__vnuma_from_placement(libxl__gc *gc,
+                                libxl_domain_build_info *b_info);
 
 _hidden int libxl__ms_vm_genid_set(libxl__gc *gc, uint32_t domid,
                                    const libxl_ms_vm_genid *id);
@@ -16,6 +16,13 @@
 #include "libxl_osdeps.h" /* must come before any other headers */
 
 #include "libxl_internal.h"
+
+#include <mntent.h>
+#include <net/if.h>
+#include <sys/file.h>
+#include <sys/sysmacros.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
  
 int libxl__try_phy_backend(mode_t st_mode)
 {
@@ -93,6 +100,375 @@ static char **get_hotplug_env(libxl__gc *gc,
     return env;
 }
 
+/*
+ * Native hotplug
+ *
+ * Forking a script, which in turn runs ip, brctl and xenstore-*, costs
+ * tens to hundreds of milliseconds per device.  If LIBXL_NATIVE_HOTPLUG
+ * is set in the environment, the commonest cases are done here instead:
+ * vif-bridge for plain vifs on a Linux bridge, and block for physical
+ * devices.  Anything else, or any configuration these don't understand,
+ * is still left to the script.
+ *
+ * Unlike the scripts, the native vif-bridge does not add iptables rules
+ * for the vif or run any vif hooks.
+ *
+ * Each returns 0 if the device was dealt with, 1 if the script should
+ * be run instead, or an ERROR_* value.
+ */
+
+static bool native_hotplug_enabled(void)
+{
+    const char *e = getenv("LIBXL_NATIVE_HOTPLUG");
+
+    return e && *e && strcmp(e, "0");
+}
+
+static bool script_is(const char *script, const char *name)
+{
+    const char *base = strrchr(script, '/');
+
+    return !strcmp(base ? base + 1 : script, name);
+}
+
+struct nl_setlink_req {
+    struct nlmsghdr nh;
+    struct ifinfomsg ifi;
+    char attrs[64];
+};
+
+static void nl_addattr(struct nl_setlink_req *req, int type,
+                       const void *data, int len)
+{
+    struct rtattr *rta;
+
+    assert(NLMSG_ALIGN(req->nh.nlmsg_len) + RTA_LENGTH(len) <= sizeof(*req));
+    rta = (struct rtattr *)((char *)req + NLMSG_ALIGN(req->nh.nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    req->nh.nlmsg_len = NLMSG_ALIGN(req->nh.nlmsg_len) + RTA_LENGTH(len);
+}
+
+/*
+ * Bring @ifname up or down and, if given, set its MAC address, its MTU
+ * and its bridge (master: an ifindex, 0 for none, or -1 to leave it).
+ */
+static int nl_setlink(libxl__gc *gc, const char *ifname, bool up,
+                      const uint8_t *mac, unsigned int mtu, int master)
+{
+    struct nl_setlink_req req;
+    struct {
+        struct nlmsghdr nh;
+        struct nlmsgerr err;
+    } ack;
+    struct sockaddr_nl sa;
+    unsigned int ifindex;
+    ssize_t r;
+    int fd = -1, rc = ERROR_FAIL;
+
+    ifindex = if_nametoindex(ifname);
+    if (!ifindex) {
+        LOGE(ERROR, "cannot find network interface %s", ifname);
+        goto out;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type = RTM_NEWLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = ifindex;
+    req.ifi.ifi_change = IFF_UP;
+    req.ifi.ifi_flags = up ? IFF_UP : 0;
+    if (mac)
+        nl_addattr(&req, IFLA_ADDRESS, mac, 6);
+    if (mtu)
+        nl_addattr(&req, IFLA_MTU, &mtu, sizeof(mtu));
+    if (master >= 0)
+        nl_addattr(&req, IFLA_MASTER, &master, sizeof(master));
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        LOGE(ERROR, "cannot open netlink socket");
+        goto out;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    if (sendto(fd, &req, req.nh.nlmsg_len, 0,
+               (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        LOGE(ERROR, "cannot send netlink request for %s", ifname);
+        goto out;
+    }
+
+    r = recv(fd, &ack, sizeof(ack), 0);
+    if (r < 0) {
+        LOGE(ERROR, "cannot receive netlink reply for %s", ifname);
+        goto out;
+    }
+    if (r < (ssize_t)sizeof(ack) || ack.nh.nlmsg_type != NLMSG_ERROR) {
+        LOG(ERROR, "unexpected netlink reply for %s", ifname);
+        goto out;
+    }
+    if (ack.err.error) {
+        LOGEV(ERROR, -ack.err.error, "cannot configure %s", ifname);
+        goto out;
+    }
+
+    rc = 0;
+
+out:
+    if (fd >= 0) close(fd);
+    return rc;
+}
+
+static unsigned int get_mtu(libxl__gc *gc, const char *ifname)
+{
+    FILE *f;
+    unsigned int mtu = 0;
+
+    f = fopen(GCSPRINTF("/sys/class/net/%s/mtu", ifname), "r");
+    if (f) {
+        if (fscanf(f, "%u", &mtu) != 1)
+            mtu = 0;
+        fclose(f);
+    }
+
+    return mtu;
+}
+
+static int hotplug_nic_native(libxl__gc *gc, libxl__device *dev,
+                              const char *be_path,
+                              libxl__device_action action)
+{
+    /* As vif-bridge, a MAC the bridge won't pick for its own address. */
+    static const uint8_t mac[6] = { 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff };
+    const char *bridge, *ifname;
+    int brindex, rc;
+
+    /* Renaming, and finding a default bridge, are left to the script. */
+    if (libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/vifname", be_path)))
+        return 1;
+    bridge = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/bridge", be_path));
+    if (!bridge || !*bridge ||
+        access(GCSPRINTF("/sys/class/net/%s/bridge", bridge), F_OK))
+        return 1;
+
+    ifname = libxl__device_nic_devname(gc, dev->domid, dev->devid,
+                                       LIBXL_NIC_TYPE_VIF);
+
+    if (action == LIBXL__DEVICE_ACTION_REMOVE) {
+        /* Like the script, don't fail the removal for this. */
+        nl_setlink(gc, ifname, false, NULL, 0, 0);
+        return 0;
+    }
+
+    brindex = if_nametoindex(bridge);
+    if (!brindex) {
+        LOGE(ERROR, "cannot find bridge %s", bridge);
+        return ERROR_FAIL;
+    }
+
+    rc = nl_setlink(gc, ifname, false, NULL, 0, -1);
+    if (rc) return rc;
+    rc = nl_setlink(gc, ifname, true, mac, get_mtu(gc, bridge), brindex);
+    if (rc) return rc;
+
+    rc = libxl__xs_printf(gc, XBT_NULL,
+                          GCSPRINTF("%s/hotplug-status", be_path),
+                          "connected");
+    if (rc) return rc;
+
+    LOG(DEBUG, "added %s to bridge %s", ifname, bridge);
+    return 0;
+}
+
+/*
+ * The lock the block script takes around its sharing checks; see
+ * tools/hotplug/Linux/locking.sh, whose protocol this follows.
+ */
+#define HOTPLUG_LOCK_DIR "/var/run/xen-hotplug"
+
+static int claim_hotplug_lock(libxl__gc *gc, const char *path, int *fd_r)
+{
+    struct stat stab, fstab;
+    int fd;
+
+    if (mkdir(HOTPLUG_LOCK_DIR, 0755) && errno != EEXIST) {
+        LOGE(ERROR, "cannot create %s", HOTPLUG_LOCK_DIR);
+        return ERROR_FAIL;
+    }
+
+    for (;;) {
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            LOGE(ERROR, "cannot open lockfile %s", path);
+            return ERROR_FAIL;
+        }
+
+        while (flock(fd, LOCK_EX)) {
+            if (errno == EINTR)
+                continue;
+            LOGE(ERROR, "cannot lock %s", path);
+            close(fd);
+            return ERROR_FAIL;
+        }
+
+        if (!fstat(fd, &fstab) && !stat(path, &stab) &&
+            stab.st_dev == fstab.st_dev && stab.st_ino == fstab.st_ino)
+            break;
+
+        close(fd);
+    }
+
+    *fd_r = fd;
+    return 0;
+}
+
+static void release_hotplug_lock(const char *path, int fd)
+{
+    /* Unlink before closing; see libxl__unlock_domain_userdata. */
+    unlink(path);
+    close(fd);
+}
+
+/*
+ * The sharing check of the block script: a device may be used
+ * read-write only if nothing else uses it, and read-only only if
+ * nothing uses it read-write, whether a mount in this domain or
+ * another guest.  Mode is 'r', 'w' or, for no checks at all, '!'.
+ */
+static int disk_check_sharing(libxl__gc *gc, libxl__device *dev,
+                              const char *devpath, dev_t rdev, char mode,
+                              const char *mm)
+{
+    const char *base, *fe_vm, *d, *m, *vm;
+    char **doms, **devs;
+    unsigned int ndoms, ndevs, i, j;
+    struct mntent *ent;
+    struct stat st;
+    FILE *f;
+    int rc = 0;
+
+    if (mode == '!')
+        return 0;
+
+    f = setmntent("/proc/mounts", "r");
+    if (f) {
+        while ((ent = getmntent(f))) {
+            if (mode != 'w' && !hasmntopt(ent, "rw"))
+                continue;
+            if (stat(ent->mnt_fsname, &st) || !S_ISBLK(st.st_mode) ||
+                st.st_rdev != rdev)
+                continue;
+            LOG(ERROR, "%s is mounted %sin this domain, and so cannot be "
+                "attached %s by a guest", devpath,
+                mode == 'w' ? "" : "read-write ",
+                mode == 'w' ? "read-write" : "read-only");
+            rc = ERROR_FAIL;
+            break;
+        }
+        endmntent(f);
+        if (rc) return rc;
+    }
+
+    base = GCSPRINTF("%s/backend/%s",
+                     libxl__xs_get_dompath(gc, dev->backend_domid),
+                     libxl__device_kind_to_string(dev->backend_kind));
+    fe_vm = libxl__xs_read(gc, XBT_NULL,
+                           GCSPRINTF("/local/domain/%u/vm", dev->domid));
+
+    doms = libxl__xs_directory(gc, XBT_NULL, base, &ndoms);
+    for (i = 0; doms && i < ndoms; i++) {
+        devs = libxl__xs_directory(gc, XBT_NULL,
+                                   GCSPRINTF("%s/%s", base, doms[i]), &ndevs);
+        for (j = 0; devs && j < ndevs; j++) {
+            const char *p = GCSPRINTF("%s/%s/%s", base, doms[i], devs[j]);
+
+            d = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/physical-device", p));
+            if (!d || strcmp(d, mm))
+                continue;
+
+            if (mode != 'w') {
+                m = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/mode", p));
+                if (!m || !strchr(m, 'w') || strchr(m, '!'))
+                    continue;
+            }
+
+            /* Sharing with the same VM, or one going away, is allowed. */
+            vm = libxl__xs_read(gc, XBT_NULL,
+                                GCSPRINTF("/local/domain/%s/vm", doms[i]));
+            if (!vm || (fe_vm && !strcmp(vm, fe_vm)))
+                continue;
+
+            LOG(ERROR, "%s is used %sby domain %s, and so cannot be "
+                "attached %s", devpath, mode == 'w' ? "" : "read-write ",
+                doms[i], mode == 'w' ? "read-write" : "read-only");
+            return ERROR_FAIL;
+        }
+    }
+
+    return 0;
+}
+
+static int hotplug_disk_native(libxl__gc *gc, libxl__device *dev,
+                               const char *be_path,
+                               libxl__device_action action)
+{
+    const char *lockpath = HOTPLUG_LOCK_DIR "/block";
+    const char *params, *mode, *mm;
+    char path[PATH_MAX];
+    struct stat st;
+    int lockfd, rc;
+
+    /* Files need a loop device, which is left to the script. */
+    params = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/params", be_path));
+    if (!params || stat(params, &st) || !S_ISBLK(st.st_mode))
+        return 1;
+
+    /* As for the script, there is nothing to undo for a device. */
+    if (action == LIBXL__DEVICE_ACTION_REMOVE)
+        return 0;
+
+    if (libxl__xs_read(gc, XBT_NULL,
+                       GCSPRINTF("%s/physical-device", be_path)))
+        return 0;
+
+    if (!realpath(params, path)) {
+        LOGE(ERROR, "cannot resolve %s", params);
+        return ERROR_FAIL;
+    }
+    mode = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/mode", be_path)) ?: "r";
+    mm = GCSPRINTF("%x:%x", major(st.st_rdev), minor(st.st_rdev));
+
+    rc = claim_hotplug_lock(gc, lockpath, &lockfd);
+    if (rc) return rc;
+
+    rc = disk_check_sharing(gc, dev, path, st.st_rdev,
+                            !strchr(mode, 'w') ? 'r' :
+                            !strchr(mode, '!') ? 'w' : '!', mm);
+    if (rc) goto out;
+
+    rc = libxl__xs_printf(gc, XBT_NULL,
+                          GCSPRINTF("%s/physical-device", be_path), "%s", mm);
+    if (rc) goto out;
+    rc = libxl__xs_printf(gc, XBT_NULL,
+                          GCSPRINTF("%s/physical-device-path", be_path),
+                          "%s", path);
+    if (rc) goto out;
+    rc = libxl__xs_printf(gc, XBT_NULL,
+                          GCSPRINTF("%s/hotplug-status", be_path),
+                          "connected");
+    if (rc) goto out;
+
+    LOG(DEBUG, "attached %s (%s) to %s", path, mm, be_path);
+
+out:
+    release_hotplug_lock(lockpath, lockfd);
+    return rc;
+}
+
 /* Hotplug scripts caller functions */
 
 static int libxl__hotplug_nic(libxl__gc *gc, libxl__device *dev,
@@ -123,6 +499,12 @@ static int libxl__hotplug_nic(libxl__gc *gc, libxl__device *dev,
         goto out;
     }
 
+    if (nictype == LIBXL_NIC_TYPE_VIF && native_hotplug_enabled() &&
+        script_is(script, "vif-bridge")) {
+        rc = hotplug_nic_native(gc, dev, be_path, action);
+        if (rc <= 0) goto out;
+    }
+
     *env = get_hotplug_env(gc, script, dev);
     if (!*env) {
         rc = ERROR_FAIL;
@@ -166,6 +548,11 @@ static int libxl__hotplug_disk(libxl__gc *gc, libxl__device *dev,
         goto error;
     }
 
+    if (native_hotplug_enabled() && script_is(script, "block")) {
+        rc = hotplug_disk_native(gc, dev, be_path, action);
+        if (rc <= 0) goto error;
+    }
+
     *env = get_hotplug_env(gc, script, dev);
     if (!*env) {
         LOG(ERROR, "Failed to get hotplug environment");
@@ -76,6 +76,7 @@ int init_subkind_nic(libxl__checkpoint_devices_state *cds)
         rs->netbufscript = GCSPRINTF("%s/remus-netbuf-setup",
                                      libxl__xen_script_dir_path());
     }
+    rs->netbuf_bypass = libxl__strdup(gc, dss->remus->netbuf_bypass);
 
     rc = 0;
 
@@ -253,13 +254,17 @@ static void setup_async_exec(libxl__checkpoint_device *dev, char *op)
     const char *const vif = remus_nic->vif;
     const char *const ifb = remus_nic->ifb;
 
-    arraysize = 7;
+    arraysize = 9;
     GCNEW_ARRAY(env, arraysize);
     env[nr++] = "vifname";
     env[nr++] = libxl__strdup(gc, vif);
     env[nr++] = "XENBUS_PATH";
     env[nr++] = GCSPRINTF("%s/remus/netbuf/%d",
                           libxl__xs_libxl_path(gc, domid), dev_id);
+    if (!strcmp(op, "setup") && rs->netbuf_bypass) {
+        env[nr++] = "REMUS_NETBUF_BYPASS";
+        env[nr++] = libxl__strdup(gc, rs->netbuf_bypass);
+    }
     if (!strcmp(op, "teardown") && ifb) {
         env[nr++] = "REMUS_IFB";
         env[nr++] = libxl__strdup(gc, ifb);
@@ -1191,13 +1191,13 @@ static int libxl_pcidev_assignable(libxl_ctx *ctx, libxl_device_pci *pcidev)
     return i != num;
 }
 
-int libxl__device_pci_add(libxl__gc *gc, uint32_t domid, libxl_device_pci *pcidev, int starting)
+/* Checks that pcidev may be passed through to domid, before it is reset. */
+static int pci_add_check(libxl__gc *gc, uint32_t domid,
+                         libxl_device_pci *pcidev)
 {
     libxl_ctx *ctx = libxl__gc_owner(gc);
-    unsigned int orig_vdev, pfunc_mask;
     libxl_device_pci *assigned;
-    int num_assigned, i, rc;
-    int stubdomid = 0;
+    int num_assigned, rc;
 
     if (libxl__domain_type(gc, domid) == LIBXL_DOMAIN_TYPE_HVM) {
         rc = xc_test_assign_device(ctx->xch, domid, pcidev_encode_bdf(pcidev));
@@ -1240,7 +1240,18 @@ int libxl__device_pci_add(libxl__gc *gc, uint32_t domid, libxl_device_pci *pcide
         goto out;
     }
 
-    libxl__device_pci_reset(gc, pcidev->domain, pcidev->bus, pcidev->dev, pcidev->func);
+out:
+    return rc;
+}
+
+/* Assigns an already checked and reset pcidev to domid. */
+static int pci_add_assign(libxl__gc *gc, uint32_t domid,
+                          libxl_device_pci *pcidev, int starting)
+{
+    libxl_ctx *ctx = libxl__gc_owner(gc);
+    unsigned int orig_vdev, pfunc_mask;
+    int i, rc;
+    int stubdomid = 0;
 
     stubdomid = libxl_get_stubdom_id(ctx, domid);
     if (stubdomid != 0) {
@@ -1290,16 +1301,117 @@ out:
     return rc;
 }
 
+int libxl__device_pci_add(libxl__gc *gc, uint32_t domid, libxl_device_pci *pcidev, int starting)
+{
+    int rc;
+
+    rc = pci_add_check(gc, domid, pcidev);
+    if (rc) return rc;
+
+    libxl__device_pci_reset(gc, pcidev->domain, pcidev->bus, pcidev->dev, pcidev->func);
+
+    return pci_add_assign(gc, domid, pcidev, starting);
+}
+
+/*
+ * At domain creation all the devices are reset at once, each from its own
+ * child process: a function level reset blocks in sysfs for 100ms or
+ * more, which adds up quickly for guests with many devices.
+ */
+typedef struct {
+    libxl__multidev multidev;
+    libxl__ao_device *outer;
+    uint32_t domid;
+    libxl_domain_config *d_config;
+} pcidevs_add_state;
+
+static void pci_reset_exited(libxl__egc *egc, libxl__ev_child *child,
+                             pid_t pid, int status);
+static void pcidevs_reset_done(libxl__egc *egc, libxl__multidev *multidev,
+                               int rc);
+
+static void pci_reset_async(libxl__egc *egc, libxl__ao_device *aodev,
+                            libxl_device_pci *pcidev)
+{
+    STATE_AO_GC(aodev->ao);
+    pid_t pid;
+
+    pid = libxl__ev_child_fork(gc, &aodev->child, pci_reset_exited);
+    if (pid == -1) {
+        /* Resetting is best effort, as in libxl__device_pci_add. */
+        libxl__device_pci_reset(gc, pcidev->domain, pcidev->bus,
+                                pcidev->dev, pcidev->func);
+        aodev->callback(egc, aodev);
+        return;
+    }
+
+    if (!pid) {
+        /* child */
+        _exit(libxl__device_pci_reset(gc, pcidev->domain, pcidev->bus,
+                                      pcidev->dev, pcidev->func) ? 1 : 0);
+    }
+}
+
+static void pci_reset_exited(libxl__egc *egc, libxl__ev_child *child,
+                             pid_t pid, int status)
+{
+    libxl__ao_device *aodev = CONTAINER_OF(child, *aodev, child);
+    STATE_AO_GC(aodev->ao);
+
+    /* The child has logged why; a failed reset isn't fatal. */
+    if (status && !WIFEXITED(status))
+        libxl_report_child_exitstatus(CTX, XTL_WARN, "pci reset",
+                                      pid, status);
+
+    aodev->callback(egc, aodev);
+}
+
 static void libxl__add_pcidevs(libxl__egc *egc, libxl__ao *ao, uint32_t domid,
                                libxl_domain_config *d_config,
                                libxl__multidev *multidev)
 {
     AO_GC;
-    libxl__ao_device *aodev = libxl__multidev_prepare(multidev);
+    pcidevs_add_state *pas;
     int i, rc = 0;
 
+    GCNEW(pas);
+    pas->outer = libxl__multidev_prepare(multidev);
+    pas->domid = domid;
+    pas->d_config = d_config;
+
+    for (i = 0; i < d_config->num_pcidevs; i++) {
+        rc = pci_add_check(gc, domid, &d_config->pcidevs[i]);
+        if (rc < 0) {
+            LOG(ERROR, "libxl_device_pci_add failed: %d", rc);
+            goto out;
+        }
+    }
+
+    libxl__multidev_begin(ao, &pas->multidev);
+    pas->multidev.callback = pcidevs_reset_done;
+    for (i = 0; i < d_config->num_pcidevs; i++)
+        pci_reset_async(egc, libxl__multidev_prepare(&pas->multidev),
+                        &d_config->pcidevs[i]);
+    libxl__multidev_prepared(egc, &pas->multidev, 0);
+    return;
+
+out:
+    pas->outer->rc = rc;
+    pas->outer->callback(egc, pas->outer);
+}
+
+static void pcidevs_reset_done(libxl__egc *egc, libxl__multidev *multidev,
+                               int rc)
+{
+    pcidevs_add_state *pas = CONTAINER_OF(multidev, *pas, multidev);
+    libxl_domain_config *d_config = pas->d_config;
+    STATE_AO_GC(multidev->ao);
+    int i;
+
+    if (rc) goto out;
+
     for (i = 0; i < d_config->num_pcidevs; i++) {
-        rc = libxl__device_pci_add(gc, domid, &d_config->pcidevs[i], 1);
+        rc = pci_add_assign(gc, pas->domid, &d_config->pcidevs[i], 1);
         if (rc < 0) {
             LOG(ERROR, "libxl_device_pci_add failed: %d", rc);
             goto out;
@@ -1307,7 +1419,7 @@ static void libxl__add_pcidevs(libxl__egc *egc, libxl__ao *ao, uint32_t domid,
     }
 
     if (d_config->num_pcidevs > 0) {
-        rc = libxl__create_pci_backend(gc, domid, d_config->pcidevs,
+        rc = libxl__create_pci_backend(gc, pas->domid, d_config->pcidevs,
             d_config->num_pcidevs);
         if (rc < 0) {
             LOG(ERROR, "libxl_create_pci_backend failed: %d", rc);
@@ -1316,8 +1428,8 @@ static void libxl__add_pcidevs(libxl__egc *egc, libxl__ao *ao, uint32_t domid,
     }
 
 out:
-    aodev->rc = rc;
-    aodev->callback(egc, aodev);
+    pas->outer->rc = rc;
+    pas->outer->callback(egc, pas->outer);
 }
 
 static int qemu_pci_remove_xenstore(libxl__gc *gc, uint32_t domid,
@@ -293,6 +293,24 @@ out:
     return rc;
 }
 
+int libxl_psr_mbm_get_domain_bandwidth(libxl_ctx *ctx, uint32_t domid,
+                                       uint64_t *total_r, uint64_t *local_r)
+{
+    GC_INIT(ctx);
+    uint64_t total, local;
+    int rc;
+
+    rc = xc_psr_cmt_get_domain_mbm(ctx->xch, domid, &total, &local,
+                                   total_r, local_r);
+    if (rc < 0) {
+        libxl__psr_cmt_log_err_msg(gc, errno);
+        rc = ERROR_FAIL;
+    }
+
+    GC_FREE;
+    return rc;
+}
+
 static inline xc_psr_cat_type libxl__psr_cbm_type_to_libxc_psr_cat_type(
     libxl_psr_cbm_type type)
 {
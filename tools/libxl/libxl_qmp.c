@@ -88,30 +88,24 @@ static const int QMP_SOCKET_CONNECT_TIMEOUT = 5;
  * QMP callbacks functions
  */
 
-static int store_serial_port_info(libxl__qmp_handler *qmp,
+static int store_serial_port_info(libxl__gc *gc, uint32_t domid,
                                   const char *chardev,
                                   int port)
 {
-    GC_INIT(qmp->ctx);
     char *path = NULL;
-    int ret = 0;
 
     if (!(chardev && strncmp("pty:", chardev, 4) == 0)) {
         return 0;
     }
 
-    path = libxl__xs_get_dompath(gc, qmp->domid);
+    path = libxl__xs_get_dompath(gc, domid);
     path = GCSPRINTF("%s/serial/%d/tty", path, port);
 
-    ret = libxl__xs_printf(gc, XBT_NULL, path, "%s", chardev + 4);
-
-    GC_FREE;
-    return ret;
+    return libxl__xs_printf(gc, XBT_NULL, path, "%s", chardev + 4);
 }
 
-static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
-                                             const libxl__json_object *o,
-                                             void *unused)
+static int register_serials_chardev(libxl__gc *gc, uint32_t domid,
+                                    const libxl__json_object *o)
 {
     const libxl__json_object *obj = NULL;
     const libxl__json_object *label = NULL;
@@ -137,15 +131,13 @@ static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
             s += strlen("serial");
             port_number = strtol(s, &endptr, 10);
             if (*s == 0 || *endptr != 0) {
-                LIBXL__LOG(qmp->ctx, LIBXL__LOG_ERROR,
-                           "Invalid serial port number: %s", s);
+                LOG(ERROR, "Invalid serial port number: %s", s);
                 return -1;
             }
-            ret = store_serial_port_info(qmp, chardev, port_number);
+            ret = store_serial_port_info(gc, domid, chardev, port_number);
             if (ret) {
-                LIBXL__LOG_ERRNO(qmp->ctx, LIBXL__LOG_ERROR,
-                                 "Failed to store serial port information"
-                                 " in xenstore");
+                LOGE(ERROR, "Failed to store serial port information"
+                     " in xenstore");
                 return ret;
             }
         }
@@ -154,6 +146,17 @@ static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
     return ret;
 }
 
+static int register_serials_chardev_callback(libxl__qmp_handler *qmp,
+                                             const libxl__json_object *o,
+                                             void *unused)
+{
+    GC_INIT(qmp->ctx);
+    int ret = register_serials_chardev(gc, qmp->domid, o);
+
+    GC_FREE;
+    return ret;
+}
+
 static int qmp_write_domain_console_item(libxl__gc *gc, int domid,
                                          const char *item, const char *value)
 {
@@ -165,23 +168,20 @@ static int qmp_write_domain_console_item(libxl__gc *gc, int domid,
     return libxl__xs_printf(gc, XBT_NULL, path, "%s", value);
 }
 
-static int qmp_register_vnc_callback(libxl__qmp_handler *qmp,
-                                     const libxl__json_object *o,
-                                     void *unused)
+static int qmp_register_vnc(libxl__gc *gc, uint32_t domid,
+                            const libxl__json_object *o)
 {
-    GC_INIT(qmp->ctx);
     const libxl__json_object *obj;
     const char *addr, *port;
-    int rc = -1;
+    int rc;
 
     if (!libxl__json_object_is_map(o)) {
-        goto out;
+        return -1;
     }
 
     obj = libxl__json_map_get("enabled", o, JSON_BOOL);
     if (!obj || !libxl__json_object_get_bool(obj)) {
-        rc = 0;
-        goto out;
+        return 0;
     }
 
     obj = libxl__json_map_get("host", o, JSON_STRING);
@@ -191,15 +191,13 @@ static int qmp_register_vnc_callback(libxl__qmp_handler *qmp,
 
     if (!addr || !port) {
         LOG(ERROR, "Failed to retreive VNC connect information.");
-        goto out;
+        return -1;
     }
 
-    rc = qmp_write_domain_console_item(gc, qmp->domid, "vnc-listen", addr);
+    rc = qmp_write_domain_console_item(gc, domid, "vnc-listen", addr);
     if (!rc)
-        rc = qmp_write_domain_console_item(gc, qmp->domid, "vnc-port", port);
+        rc = qmp_write_domain_console_item(gc, domid, "vnc-port", port);
 
-out:
-    GC_FREE;
     return rc;
 }
 
@@ -225,8 +223,7 @@ static int enable_qmp_capabilities(libxl__qmp_handler *qmp)
  * Helpers
  */
 
-static libxl__qmp_message_type qmp_response_type(libxl__qmp_handler *qmp,
-                                                 const libxl__json_object *o)
+static libxl__qmp_message_type qmp_response_type(const libxl__json_object *o)
 {
     libxl__qmp_message_type type;
     libxl__json_map_node *node = NULL;
@@ -292,7 +289,7 @@ static int qmp_handle_response(libxl__gc *gc, libxl__qmp_handler *qmp,
 {
     libxl__qmp_message_type type = LIBXL__QMP_MESSAGE_TYPE_INVALID;
 
-    type = qmp_response_type(qmp, resp);
+    type = qmp_response_type(resp);
     LOG(DEBUG, "message type: %s", libxl__qmp_message_type_to_string(type));
 
     switch (type) {
@@ -504,17 +501,15 @@ static int qmp_next(libxl__gc *gc, libxl__qmp_handler *qmp)
     return rc;
 }
 
-static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
-                              const char *cmd, libxl__json_object *args,
-                              qmp_callback_t callback, void *opaque,
-                              qmp_request_context *context)
+/* Generate the QMP command message (without CRLF), from the gc. */
+static char *qmp_prepare_message(libxl__gc *gc, const char *cmd,
+                                 libxl__json_object *args, int id)
 {
     const unsigned char *buf = NULL;
     char *ret = NULL;
     libxl_yajl_length len = 0;
     yajl_gen_status s;
     yajl_gen hand;
-    callback_id_pair *elm = NULL;
 
     hand = libxl_yajl_gen_alloc(NULL);
 
@@ -526,7 +521,7 @@ static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
     libxl__yajl_gen_asciiz(hand, "execute");
     libxl__yajl_gen_asciiz(hand, cmd);
     libxl__yajl_gen_asciiz(hand, "id");
-    yajl_gen_integer(hand, ++qmp->last_id_used);
+    yajl_gen_integer(hand, id);
     if (args) {
         libxl__yajl_gen_asciiz(hand, "arguments");
         libxl__json_object_to_yajl_gen(gc, hand, args);
@@ -540,10 +535,31 @@ static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
         goto out;
     }
 
+    ret = libxl__strndup(gc, (const char*)buf, len);
+
+    LOG(DEBUG, "next qmp command: '%s'", buf);
+
+out:
+    yajl_gen_free(hand);
+    return ret;
+}
+
+static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
+                              const char *cmd, libxl__json_object *args,
+                              qmp_callback_t callback, void *opaque,
+                              qmp_request_context *context)
+{
+    char *ret = NULL;
+    callback_id_pair *elm = NULL;
+
+    ret = qmp_prepare_message(gc, cmd, args, ++qmp->last_id_used);
+    if (!ret)
+        return NULL;
+
     elm = malloc(sizeof (callback_id_pair));
     if (elm == NULL) {
         LOGE(ERROR, "Failed to allocate a QMP callback");
-        goto out;
+        return NULL;
     }
     elm->id = qmp->last_id_used;
     elm->callback = callback;
@@ -551,12 +567,6 @@ static char *qmp_send_prepare(libxl__gc *gc, libxl__qmp_handler *qmp,
     elm->context = context;
     LIBXL_STAILQ_INSERT_TAIL(&qmp->callback_list, elm, next);
 
-    ret = libxl__strndup(gc, (const char*)buf, len);
-
-    LOG(DEBUG, "next qmp command: '%s'", buf);
-
-out:
-    yajl_gen_free(hand);
     return ret;
 }
 
@@ -755,13 +765,6 @@ int libxl__qmp_query_serial(libxl__qmp_handler *qmp)
                                 NULL, qmp->timeout);
 }
 
-static int qmp_query_vnc(libxl__qmp_handler *qmp)
-{
-    return qmp_synchronous_send(qmp, "query-vnc", NULL,
-                                qmp_register_vnc_callback,
-                                NULL, qmp->timeout);
-}
-
 static int pci_add_callback(libxl__qmp_handler *qmp,
                             const libxl__json_object *response, void *opaque)
 {
@@ -932,24 +935,6 @@ int libxl__qmp_restore(libxl__gc *gc, int domid, const char *state_file)
                            NULL, NULL);
 }
 
-static int qmp_change(libxl__gc *gc, libxl__qmp_handler *qmp,
-                      char *device, char *target, char *arg)
-{
-    libxl__json_object *args = NULL;
-    int rc = 0;
-
-    qmp_parameters_add_string(gc, &args, "device", device);
-    qmp_parameters_add_string(gc, &args, "target", target);
-    if (arg) {
-        qmp_parameters_add_string(gc, &args, "arg", arg);
-    }
-
-    rc = qmp_synchronous_send(qmp, "change", args,
-                              NULL, NULL, qmp->timeout);
-
-    return rc;
-}
-
 int libxl__qmp_stop(libxl__gc *gc, int domid)
 {
     return qmp_run_command(gc, domid, "stop", NULL, NULL, NULL);
@@ -1129,26 +1114,436 @@ int libxl__qmp_hmp(libxl__gc *gc, int domid, const char *command_line)
                            NULL, NULL);
 }
 
-int libxl__qmp_initializations(libxl__gc *gc, uint32_t domid,
-                               const libxl_domain_config *guest_config)
+/*
+ * Asynchronous QMP
+ *
+ * One command per connection: connect, wait for the greeting, send
+ * qmp_capabilities followed by the command, and wait for the reply to
+ * the command, all from the event loop.
+ */
+
+enum {
+    EV_QMP_IDLE,
+    EV_QMP_CONNECTING,  /* waiting for the QMP socket to be there */
+    EV_QMP_GREETING,    /* waiting for the QMP greeting */
+    EV_QMP_WAITING,     /* waiting for the reply to the command */
+};
+
+#define EV_QMP_CAPABILITIES_ID 1
+#define EV_QMP_COMMAND_ID      2
+
+void libxl__ev_qmp_init(libxl__ev_qmp *ev)
 {
-    const libxl_vnc_info *vnc = libxl__dm_vnc(guest_config);
-    libxl__qmp_handler *qmp = NULL;
-    int ret = 0;
+    ev->state = EV_QMP_IDLE;
+    ev->fd = -1;
+    libxl__ev_fd_init(&ev->efd);
+    libxl__ev_time_init(&ev->timeout);
+    libxl__ev_xswatch_init(&ev->ready_watch);
+    ev->tx_buf = ev->rx_buf = NULL;
+    ev->tx_len = ev->tx_off = 0;
+    ev->rx_len = ev->rx_size = 0;
+}
 
-    qmp = libxl__qmp_initialize(gc, domid);
-    if (!qmp)
-        return -1;
-    ret = libxl__qmp_query_serial(qmp);
-    if (!ret && vnc && vnc->passwd) {
-        ret = qmp_change(gc, qmp, "vnc", "password", vnc->passwd);
-        qmp_write_domain_console_item(gc, domid, "vnc-pass", vnc->passwd);
+bool libxl__ev_qmp_inuse(const libxl__ev_qmp *ev)
+{
+    return ev->state != EV_QMP_IDLE;
+}
+
+void libxl__ev_qmp_dispose(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    libxl__ev_fd_deregister(gc, &ev->efd);
+    libxl__ev_time_deregister(gc, &ev->timeout);
+    libxl__ev_xswatch_deregister(gc, &ev->ready_watch);
+    if (ev->fd >= 0)
+        close(ev->fd);
+    ev->fd = -1;
+    ev->state = EV_QMP_IDLE;
+    ev->tx_len = ev->tx_off = 0;
+    ev->rx_len = 0;
+}
+
+static void ev_qmp_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                        const libxl__json_object *response, int rc)
+{
+    STATE_AO_GC(ev->ao);
+
+    libxl__ev_qmp_dispose(gc, ev);
+    ev->callback(egc, ev, response, rc);
+}
+
+static int ev_qmp_append(libxl__gc *gc, libxl__ev_qmp *ev, const char *cmd,
+                         libxl__json_object *args, int id)
+{
+    char *msg = qmp_prepare_message(gc, cmd, args, id);
+    size_t len;
+
+    if (!msg)
+        return ERROR_FAIL;
+
+    len = strlen(msg);
+    ev->tx_buf = libxl__realloc(gc, ev->tx_buf, ev->tx_len + len + 2);
+    memcpy(ev->tx_buf + ev->tx_len, msg, len);
+    memcpy(ev->tx_buf + ev->tx_len + len, "\r\n", 2);
+    ev->tx_len += len + 2;
+
+    return 0;
+}
+
+static void ev_qmp_fd_cb(libxl__egc *egc, libxl__ev_fd *efd,
+                         int fd, short events, short revents);
+
+/*
+ * Returns 0 once connected, 1 if QEMU is not listening yet, or an
+ * ERROR_* (logged).
+ */
+static int ev_qmp_connect(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    struct sockaddr_un addr;
+    const char *path;
+    int rc;
+
+    path = GCSPRINTF("%s/qmp-libxl-%d", libxl__run_dir_path(), ev->domid);
+    if (sizeof (addr.sun_path) <= strlen(path)) {
+        LOG(ERROR, "QMP socket path too long: %s", path);
+        return ERROR_FAIL;
     }
-    if (!ret) {
-        ret = qmp_query_vnc(qmp);
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof (addr.sun_path) - 1);
+
+    ev->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ev->fd < 0) {
+        LOGE(ERROR, "Failed to create QMP socket");
+        return ERROR_FAIL;
     }
-    libxl__qmp_close(qmp);
-    return ret;
+
+    /* Connecting to a listening local socket does not block. */
+    if (connect(ev->fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        rc = ERROR_FAIL;
+        /* ENOENT       : Socket may not have shown up yet
+         * ECONNREFUSED : Leftover socket hasn't been removed yet */
+        if (errno == ENOENT || errno == ECONNREFUSED)
+            rc = 1;
+        else
+            LOGE(ERROR, "Failed to connect to %s", path);
+        close(ev->fd);
+        ev->fd = -1;
+        return rc;
+    }
+
+    rc = libxl_fd_set_nonblock(CTX, ev->fd, 1);
+    if (!rc)
+        rc = libxl_fd_set_cloexec(CTX, ev->fd, 1);
+    if (!rc)
+        rc = libxl__ev_fd_register(gc, &ev->efd, ev_qmp_fd_cb, ev->fd,
+                                   POLLIN);
+    if (rc)
+        return rc;
+
+    LOG(DEBUG, "connected to %s", path);
+    ev->state = EV_QMP_GREETING;
+
+    return 0;
+}
+
+/* The device model has updated its state, so may be listening now. */
+static void ev_qmp_ready_cb(libxl__egc *egc, libxl__ev_xswatch *w,
+                            const char *watch_path, const char *event_path)
+{
+    libxl__ev_qmp *ev = CONTAINER_OF(w, *ev, ready_watch);
+    STATE_AO_GC(ev->ao);
+    int rc;
+
+    rc = ev_qmp_connect(gc, ev);
+    if (rc == 1)
+        return;
+    if (rc) {
+        ev_qmp_done(egc, ev, NULL, rc);
+        return;
+    }
+
+    libxl__ev_xswatch_deregister(gc, &ev->ready_watch);
+}
+
+static void ev_qmp_timeout_cb(libxl__egc *egc, libxl__ev_time *etime,
+                              const struct timeval *requested_abs, int rc)
+{
+    libxl__ev_qmp *ev = CONTAINER_OF(etime, *ev, timeout);
+    STATE_AO_GC(ev->ao);
+
+    if (rc == ERROR_TIMEDOUT)
+        LOG(ERROR, "Domain %u: timed out waiting for QMP %s", ev->domid,
+            ev->state == EV_QMP_CONNECTING ? "socket" : "reply");
+    ev_qmp_done(egc, ev, NULL, rc);
+}
+
+/*
+ * Returns 0 to keep waiting, 1 with *response_r set once the reply to the
+ * command is in, or an ERROR_* (logged).
+ */
+static int ev_qmp_handle_message(libxl__gc *gc, libxl__ev_qmp *ev,
+                                 const libxl__json_object *o,
+                                 const libxl__json_object **response_r)
+{
+    const libxl__json_object *id_object, *desc;
+    int id;
+
+    switch (qmp_response_type(o)) {
+    case LIBXL__QMP_MESSAGE_TYPE_QMP:
+        if (ev->state != EV_QMP_GREETING)
+            return 0;
+        /* Both messages were queued by libxl__ev_qmp_send. */
+        ev->state = EV_QMP_WAITING;
+        return libxl__ev_fd_modify(gc, &ev->efd, POLLIN | POLLOUT);
+    case LIBXL__QMP_MESSAGE_TYPE_RETURN:
+    case LIBXL__QMP_MESSAGE_TYPE_ERROR:
+        id_object = libxl__json_map_get("id", o, JSON_INTEGER);
+        id = id_object ? libxl__json_object_get_integer(id_object) : -1;
+        if (id != EV_QMP_CAPABILITIES_ID && id != EV_QMP_COMMAND_ID)
+            return 0;
+
+        desc = libxl__json_map_get("error", o, JSON_MAP);
+        if (desc) {
+            desc = libxl__json_map_get("desc", desc, JSON_STRING);
+            LOG(ERROR, "received an error message from QMP server: %s",
+                libxl__json_object_get_string(desc));
+            return ERROR_FAIL;
+        }
+
+        if (id != EV_QMP_COMMAND_ID)
+            return 0;
+        *response_r = libxl__json_map_get("return", o, JSON_ANY);
+        return 1;
+    case LIBXL__QMP_MESSAGE_TYPE_EVENT:
+        return 0;
+    case LIBXL__QMP_MESSAGE_TYPE_INVALID:
+        break;
+    }
+
+    LOG(ERROR, "Invalid message from QMP server");
+    return ERROR_FAIL;
+}
+
+static int ev_qmp_read(libxl__gc *gc, libxl__ev_qmp *ev,
+                       const libxl__json_object **response_r)
+{
+    char *s, *end;
+    ssize_t rd;
+    int rc = 0;
+
+    if (ev->rx_size - ev->rx_len < QMP_RECEIVE_BUFFER_SIZE + 1) {
+        ev->rx_size += QMP_RECEIVE_BUFFER_SIZE + 1;
+        ev->rx_buf = libxl__realloc(gc, ev->rx_buf, ev->rx_size);
+    }
+
+    rd = read(ev->fd, ev->rx_buf + ev->rx_len, QMP_RECEIVE_BUFFER_SIZE);
+    if (rd < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        LOGE(ERROR, "Socket read error");
+        return ERROR_FAIL;
+    }
+    if (rd == 0) {
+        LOG(ERROR, "Unexpected end of socket");
+        return ERROR_FAIL;
+    }
+
+    DEBUG_REPORT_RECEIVED(ev->rx_buf + ev->rx_len, (int)rd);
+    ev->rx_len += rd;
+    ev->rx_buf[ev->rx_len] = '\0';
+
+    s = ev->rx_buf;
+    while (!rc && (end = strstr(s, "\r\n"))) {
+        libxl__json_object *o;
+
+        *end = '\0';
+        o = libxl__json_parse(gc, s);
+        if (!o) {
+            LOG(ERROR, "Parse error of : %s", s);
+            return ERROR_FAIL;
+        }
+        rc = ev_qmp_handle_message(gc, ev, o, response_r);
+        s = end + 2;
+    }
+
+    ev->rx_len -= s - ev->rx_buf;
+    memmove(ev->rx_buf, s, ev->rx_len);
+
+    return rc;
+}
+
+static int ev_qmp_write(libxl__gc *gc, libxl__ev_qmp *ev)
+{
+    ssize_t wr;
+
+    while (ev->tx_off < ev->tx_len) {
+        wr = write(ev->fd, ev->tx_buf + ev->tx_off, ev->tx_len - ev->tx_off);
+        if (wr < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            LOGE(ERROR, "Socket write error");
+            return ERROR_FAIL;
+        }
+        ev->tx_off += wr;
+    }
+
+    return libxl__ev_fd_modify(gc, &ev->efd, POLLIN);
+}
+
+static void ev_qmp_fd_cb(libxl__egc *egc, libxl__ev_fd *efd,
+                         int fd, short events, short revents)
+{
+    libxl__ev_qmp *ev = CONTAINER_OF(efd, *ev, efd);
+    STATE_AO_GC(ev->ao);
+    const libxl__json_object *response = NULL;
+    int rc = 0;
+
+    if (revents & POLLOUT)
+        rc = ev_qmp_write(gc, ev);
+
+    if (!rc && (revents & (POLLIN | POLLHUP | POLLERR)))
+        rc = ev_qmp_read(gc, ev, &response);
+
+    if (rc == 1)
+        ev_qmp_done(egc, ev, response, 0);
+    else if (rc)
+        ev_qmp_done(egc, ev, NULL, rc);
+}
+
+int libxl__ev_qmp_send(libxl__gc *unused_gc, libxl__ev_qmp *ev,
+                       const char *cmd, libxl__json_object *args)
+{
+    STATE_AO_GC(ev->ao);
+    int rc;
+
+    assert(!libxl__ev_qmp_inuse(ev));
+
+    ev->tx_len = ev->tx_off = ev->rx_len = 0;
+    rc = ev_qmp_append(gc, ev, "qmp_capabilities", NULL,
+                       EV_QMP_CAPABILITIES_ID);
+    if (!rc)
+        rc = ev_qmp_append(gc, ev, cmd, args, EV_QMP_COMMAND_ID);
+    if (rc)
+        return rc;
+
+    rc = libxl__ev_time_register_rel(ao, &ev->timeout, ev_qmp_timeout_cb,
+                                     ev->timeout_ms);
+    if (rc)
+        return rc;
+
+    ev->state = EV_QMP_CONNECTING;
+    rc = ev_qmp_connect(gc, ev);
+    if (rc == 1) {
+        /* Try again when the device model reports a change of state. */
+        rc = libxl__ev_xswatch_register(gc, &ev->ready_watch,
+                                        ev_qmp_ready_cb,
+                                        DEVICE_MODEL_XS_PATH(gc,
+                                            LIBXL_TOOLSTACK_DOMID,
+                                            ev->domid, "/state"));
+    }
+    if (rc)
+        libxl__ev_qmp_dispose(gc, ev);
+
+    return rc;
+}
+
+/*
+ * Asynchronous initialisations of a new device model
+ */
+
+static void qmp_init_serial_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                                 const libxl__json_object *response, int rc);
+static void qmp_init_vnc_passwd_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                                     const libxl__json_object *response,
+                                     int rc);
+static void qmp_init_vnc_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                              const libxl__json_object *response, int rc);
+
+void libxl__qmp_initializations(libxl__egc *egc, libxl__qmp_init_state *qis)
+{
+    STATE_AO_GC(qis->ao);
+    int rc;
+
+    libxl__ev_qmp_init(&qis->qmp);
+    qis->qmp.ao = qis->ao;
+    qis->qmp.domid = qis->domid;
+    qis->qmp.timeout_ms = QMP_SOCKET_CONNECT_TIMEOUT * 1000;
+    qis->qmp.callback = qmp_init_serial_done;
+
+    rc = libxl__ev_qmp_send(gc, &qis->qmp, "query-chardev", NULL);
+    if (rc)
+        qis->callback(egc, qis, rc);
+}
+
+static void qmp_init_serial_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                                 const libxl__json_object *response, int rc)
+{
+    libxl__qmp_init_state *qis = CONTAINER_OF(ev, *qis, qmp);
+    STATE_AO_GC(qis->ao);
+    const libxl_vnc_info *vnc = libxl__dm_vnc(qis->guest_config);
+    libxl__json_object *args = NULL;
+
+    if (rc)
+        goto out;
+
+    if (register_serials_chardev(gc, qis->domid, response)) {
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (vnc && vnc->passwd) {
+        qmp_parameters_add_string(gc, &args, "device", "vnc");
+        qmp_parameters_add_string(gc, &args, "target", "password");
+        qmp_parameters_add_string(gc, &args, "arg", vnc->passwd);
+        ev->callback = qmp_init_vnc_passwd_done;
+        rc = libxl__ev_qmp_send(gc, ev, "change", args);
+    } else {
+        ev->callback = qmp_init_vnc_done;
+        rc = libxl__ev_qmp_send(gc, ev, "query-vnc", NULL);
+    }
+    if (rc)
+        goto out;
+    return;
+
+out:
+    qis->callback(egc, qis, rc);
+}
+
+static void qmp_init_vnc_passwd_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                                     const libxl__json_object *response,
+                                     int rc)
+{
+    libxl__qmp_init_state *qis = CONTAINER_OF(ev, *qis, qmp);
+    STATE_AO_GC(qis->ao);
+    const libxl_vnc_info *vnc = libxl__dm_vnc(qis->guest_config);
+
+    if (rc)
+        goto out;
+
+    qmp_write_domain_console_item(gc, qis->domid, "vnc-pass", vnc->passwd);
+
+    ev->callback = qmp_init_vnc_done;
+    rc = libxl__ev_qmp_send(gc, ev, "query-vnc", NULL);
+    if (rc)
+        goto out;
+    return;
+
+out:
+    qis->callback(egc, qis, rc);
+}
+
+static void qmp_init_vnc_done(libxl__egc *egc, libxl__ev_qmp *ev,
+                              const libxl__json_object *response, int rc)
+{
+    libxl__qmp_init_state *qis = CONTAINER_OF(ev, *qis, qmp);
+    STATE_AO_GC(qis->ao);
+
+    if (!rc && qmp_register_vnc(gc, qis->domid, response))
+        rc = ERROR_FAIL;
+
+    qis->callback(egc, qis, rc);
 }
 
 /*
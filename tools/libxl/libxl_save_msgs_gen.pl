@@ -33,6 +33,12 @@ our @msgs = (
                                               'xen_pfn_t', 'console_gfn'] ],
     [  9, 'srW',    "complete",              [qw(int retval
                                                  int errnoval)] ],
+    [ 10, 'scxA',   "precopy_policy",        [qw(unsigned iteration),
+                                              'unsigned long', 'dirty_count',
+                                              'unsigned long', 'dirty_rate',
+                                              'unsigned long', 'bandwidth',
+                                              'unsigned long', 'downtime_ms',
+                                              qw(int decision)] ],
 );
 
 #----------------------------------------
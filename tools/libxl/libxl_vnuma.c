@@ -318,6 +318,114 @@ out:
     return rc;
 }
 
+/*
+ * Derive a vNUMA topology from the result of automatic NUMA placement,
+ * i.e., from the nodes in b_info->nodemap: one vnode per pnode, with vcpus
+ * split evenly, memory split in proportion to the free memory of each pnode
+ * and distances copied from the host.
+ *
+ * Nothing is done if the domain fits in one node, or if its memory cannot
+ * sensibly be split.
+ */
+#define VNUMA_AUTO_ALIGN_KB 2048
+
+int libxl__vnuma_from_placement(libxl__gc *gc,
+                                libxl_domain_build_info *b_info)
+{
+    libxl_numainfo *ninfo = NULL;
+    libxl_vnode_info *vnodes = NULL;
+    unsigned int *pnodes;
+    unsigned int i, j, nr_vnodes;
+    uint64_t total_free = 0, memkb, left;
+    int nr_nodes = 0, rc;
+
+    nr_vnodes = libxl_bitmap_count_set(&b_info->nodemap);
+    if (nr_vnodes < 2)
+        return 0;
+
+    ninfo = libxl_get_numainfo(CTX, &nr_nodes);
+    if (!ninfo) {
+        LOG(ERROR, "libxl_get_numainfo failed");
+        return ERROR_FAIL;
+    }
+
+    pnodes = libxl__calloc(gc, nr_vnodes, sizeof(*pnodes));
+    i = 0;
+    libxl_for_each_set_bit(j, b_info->nodemap) {
+        if (j >= nr_nodes || ninfo[j].num_dists < nr_nodes) {
+            rc = 0;
+            goto out;
+        }
+        pnodes[i++] = j;
+        total_free += ninfo[j].free >> 10;
+    }
+
+    if (!total_free ||
+        b_info->max_memkb < nr_vnodes * VNUMA_AUTO_ALIGN_KB) {
+        LOG(DETAIL, "Not enough memory for automatic vNUMA");
+        rc = 0;
+        goto out;
+    }
+
+    vnodes = libxl__calloc(NOGC, nr_vnodes, sizeof(*vnodes));
+    left = b_info->max_memkb;
+    for (i = 0; i < nr_vnodes; i++) {
+        libxl_vnode_info *v = &vnodes[i];
+
+        libxl_vnode_info_init(v);
+        v->pnode = pnodes[i];
+
+        if (i == nr_vnodes - 1)
+            memkb = left;
+        else {
+            memkb = b_info->max_memkb * (ninfo[v->pnode].free >> 10) /
+                    total_free;
+            memkb &= ~(uint64_t)(VNUMA_AUTO_ALIGN_KB - 1);
+            if (!memkb)
+                memkb = VNUMA_AUTO_ALIGN_KB;
+            if (memkb > left - (nr_vnodes - i - 1) * VNUMA_AUTO_ALIGN_KB)
+                memkb = left - (nr_vnodes - i - 1) * VNUMA_AUTO_ALIGN_KB;
+        }
+        v->memkb = memkb;
+        left -= memkb;
+
+        v->num_distances = nr_vnodes;
+        v->distances = libxl__calloc(NOGC, nr_vnodes, sizeof(*v->distances));
+        for (j = 0; j < nr_vnodes; j++)
+            v->distances[j] = ninfo[v->pnode].dists[pnodes[j]];
+
+        rc = libxl_cpu_bitmap_alloc(CTX, &v->vcpus, b_info->max_vcpus);
+        if (rc)
+            goto out;
+        for (j = i * b_info->max_vcpus / nr_vnodes;
+             j < (i + 1) * b_info->max_vcpus / nr_vnodes; j++)
+            libxl_bitmap_set(&v->vcpus, j);
+    }
+
+    /* HVM guests keep their video ram in vnode 0. */
+    if (vnodes[0].memkb < b_info->video_memkb) {
+        LOG(DETAIL, "vnode 0 too small for video ram, no automatic vNUMA");
+        rc = 0;
+        goto out;
+    }
+
+    b_info->vnuma_nodes = vnodes;
+    b_info->num_vnuma_nodes = nr_vnodes;
+    vnodes = NULL;
+
+    LOG(DETAIL, "Automatic vNUMA: %u vnodes", nr_vnodes);
+    rc = 0;
+
+out:
+    if (vnodes) {
+        for (i = 0; i < nr_vnodes; i++)
+            libxl_vnode_info_dispose(&vnodes[i]);
+        free(vnodes);
+    }
+    libxl_numainfo_list_free(ninfo, nr_nodes);
+    return rc;
+}
+
 /*
  * Local variables:
  * mode: C
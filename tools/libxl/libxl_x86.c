@@ -470,6 +470,8 @@ int libxl__arch_domain_map_irq(libxl__gc *gc, uint32_t domid, int irq)
  * have enough space.
  * Note: Those stuffs below 1M are still constructed with multiple
  * e820 entries by hvmloader. At this point we don't change anything.
+ * Without a device model low RAM starts at 0, less the BIOS area when
+ * ACPI tables are loaded there.
  *
  * #2. RDM region if it exists
  *
@@ -492,6 +494,8 @@ int libxl__arch_domain_construct_memmap(libxl__gc *gc,
     uint64_t highmem_size =
                     dom->highmem_end ? dom->highmem_end - (1ull << 32) : 0;
     uint32_t lowmem_start = dom->device_model ? GUEST_LOW_MEM_START_DEFAULT : 0;
+    /* Firmware-less guests may be given ACPI tables in the BIOS area. */
+    bool acpi_tables = !dom->device_model && dom->acpi_module.length;
 
     /* Add all rdm entries. */
     for (i = 0; i < d_config->num_rdms; i++)
@@ -503,6 +507,10 @@ int libxl__arch_domain_construct_memmap(libxl__gc *gc,
     if (highmem_size)
         e820_entries++;
 
+    /* The BIOS area splits low memory in two. */
+    if (acpi_tables)
+        e820_entries += 2;
+
     if (e820_entries >= E820MAX) {
         LOG(ERROR, "Ooops! Too many entries in the memory map!");
         rc = ERROR_INVAL;
@@ -511,6 +519,20 @@ int libxl__arch_domain_construct_memmap(libxl__gc *gc,
 
     e820 = libxl__malloc(gc, sizeof(struct e820entry) * e820_entries);
 
+    if (acpi_tables) {
+        e820[nr].addr = 0;
+        e820[nr].size = XC_DOM_HVM_ACPI_START;
+        e820[nr].type = E820_RAM;
+        nr++;
+
+        e820[nr].addr = XC_DOM_HVM_ACPI_START;
+        e820[nr].size = XC_DOM_HVM_ACPI_END - XC_DOM_HVM_ACPI_START;
+        e820[nr].type = E820_RESERVED;
+        nr++;
+
+        lowmem_start = XC_DOM_HVM_ACPI_END;
+    }
+
     /* Low memory */
     e820[nr].addr = lowmem_start;
     e820[nr].size = dom->lowmem_end - lowmem_start;
@@ -159,6 +159,20 @@ char **libxl__xs_directory(libxl__gc *gc, xs_transaction_t t,
     return ret;
 }
 
+struct xs_subtree_entry *libxl__xs_read_subtree(libxl__gc *gc,
+                                                xs_transaction_t t,
+                                                const char *path,
+                                                unsigned int depth,
+                                                unsigned int *nb)
+{
+    libxl_ctx *ctx = libxl__gc_owner(gc);
+    struct xs_subtree_entry *ret;
+
+    ret = xs_read_subtree(ctx->xsh, t, path, depth, nb);
+    libxl__ptr_add(gc, ret);
+    return ret;
+}
+
 int libxl__xs_mknod(libxl__gc *gc, xs_transaction_t t,
                     const char *path, struct xs_permissions *perms,
                     unsigned int num_perms)
@@ -69,6 +69,7 @@ int main_config_update(int argc, char **argv);
 int main_button_press(int argc, char **argv);
 int main_vcpupin(int argc, char **argv);
 int main_vcpuset(int argc, char **argv);
+int main_numa_migrate(int argc, char **argv);
 int main_memmax(int argc, char **argv);
 int main_memset(int argc, char **argv);
 int main_sched_credit(int argc, char **argv);
@@ -123,11 +124,15 @@ int main_loadpolicy(int argc, char **argv);
 int main_remus(int argc, char **argv);
 #endif
 int main_devd(int argc, char **argv);
+int main_serve(int argc, char **argv);
 #ifdef LIBXL_HAVE_PSR_CMT
 int main_psr_hwinfo(int argc, char **argv);
 int main_psr_cmt_attach(int argc, char **argv);
 int main_psr_cmt_detach(int argc, char **argv);
 int main_psr_cmt_show(int argc, char **argv);
+#ifdef LIBXL_HAVE_PSR_MBM_DOMAIN
+int main_psr_mbm_show(int argc, char **argv);
+#endif
 #endif
 #ifdef LIBXL_HAVE_PSR_CAT
 int main_psr_cat_cbm_set(int argc, char **argv);
@@ -158,6 +163,7 @@ typedef struct {
 
 typedef enum {
     child_console, child_waitdaemon, child_migration, child_vncviewer,
+    child_serve,
     child_max
 } xlchildnum;
 
@@ -208,12 +214,14 @@ typedef enum {
     DOMAIN_RESTART_NORMAL,       /* Domain should be restarted */
     DOMAIN_RESTART_RENAME,       /* Domain should be renamed and restarted */
     DOMAIN_RESTART_SOFT_RESET,   /* Soft reset should be performed */
+    DOMAIN_RESTART_IN_PLACE,     /* Domain should be rebooted in place */
 } domain_restart_type;
 
 extern void printf_info_sexp(int domid, libxl_domain_config *d_config, FILE *fh);
 
 #define XL_GLOBAL_CONFIG XEN_CONFIG_DIR "/xl.conf"
 #define XL_LOCK_FILE XEN_LOCK_DIR "/xl"
+#define XL_SERVE_SOCKET XEN_RUN_DIR "/xl.sock"
 
 #endif /* XL_H */
 
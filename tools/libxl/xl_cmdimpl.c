@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/select.h>
 #include <sys/utsname.h> /* for utsname in xl info */
 #include <xentoollog.h>
@@ -138,6 +139,8 @@ static const char *action_on_shutdown_names[] = {
     [LIBXL_ACTION_ON_SHUTDOWN_COREDUMP_RESTART] = "coredump-restart",
 
     [LIBXL_ACTION_ON_SHUTDOWN_SOFT_RESET] = "soft-reset",
+
+    [LIBXL_ACTION_ON_SHUTDOWN_RESTART_IN_PLACE] = "restart-in-place",
 };
 
 /* Optional data, in order:
@@ -1434,6 +1437,7 @@ static void parse_config_data(const char *config_source,
         b_info->max_vcpus = l;
 
     parse_vnuma_config(config, b_info);
+    xlu_cfg_get_defbool(config, "vnuma_auto", &b_info->vnuma_auto, 0);
 
     /* Set max_memkb to target_memkb and max_vcpus to avail_vcpus if
      * they are not set by user specified config option or vnuma.
@@ -1544,6 +1548,9 @@ static void parse_config_data(const char *config_source,
     if (!xlu_cfg_get_long(config, "max_event_channels", &l, 0))
         b_info->event_channels = l;
 
+    if (!xlu_cfg_get_long(config, "grant_frames", &l, 0))
+        b_info->grant_frames = l;
+
     xlu_cfg_replace_string (config, "kernel", &b_info->kernel, 0);
     xlu_cfg_replace_string (config, "ramdisk", &b_info->ramdisk, 0);
     xlu_cfg_replace_string (config, "device_tree", &b_info->device_tree, 0);
@@ -2634,6 +2641,20 @@ static domain_restart_type handle_domain_death(uint32_t *r_domid,
         restart = DOMAIN_RESTART_SOFT_RESET;
         break;
 
+    case LIBXL_ACTION_ON_SHUTDOWN_RESTART_IN_PLACE:
+        reload_domain_config(*r_domid, d_config);
+        if (d_config->b_info.type == LIBXL_DOMAIN_TYPE_HVM &&
+            d_config->b_info.target_memkb >= d_config->b_info.max_memkb) {
+            restart = DOMAIN_RESTART_IN_PLACE;
+            break;
+        }
+        LOG("Domain %d cannot be restarted in place: destroying the domain",
+            *r_domid);
+        restart = DOMAIN_RESTART_NORMAL;
+        libxl_domain_destroy(ctx, *r_domid, 0);
+        *r_domid = INVALID_DOMID;
+        break;
+
     case LIBXL_ACTION_ON_SHUTDOWN_COREDUMP_DESTROY:
     case LIBXL_ACTION_ON_SHUTDOWN_COREDUMP_RESTART:
         /* Already handled these above. */
@@ -2819,6 +2840,7 @@ static int create_domain(struct domain_create *dom_info)
     int notify_pipe[2] = { -1, -1 };
     struct save_file_header hdr;
     uint32_t domid_soft_reset = INVALID_DOMID;
+    bool reboot_in_place = false;
 
     int restoring = (restore_file || (migrate_fd >= 0));
 
@@ -3037,6 +3059,12 @@ start:
          * restore/migrate-receive it again.
          */
         restoring = 0;
+    } else if (domid_soft_reset != INVALID_DOMID && reboot_in_place) {
+        ret = libxl_domain_reboot_in_place(ctx, &d_config, domid_soft_reset,
+                                           0, autoconnect_console_how);
+        domid = domid_soft_reset;
+        domid_soft_reset = INVALID_DOMID;
+        reboot_in_place = false;
     } else if (domid_soft_reset != INVALID_DOMID) {
         /* Do soft reset. */
         ret = libxl_domain_soft_reset(ctx, &d_config, domid_soft_reset,
@@ -3138,6 +3166,9 @@ start:
                 event->u.domain_shutdown.shutdown_reason,
                 event->u.domain_shutdown.shutdown_reason);
             switch (handle_domain_death(&domid, event, &d_config)) {
+            case DOMAIN_RESTART_IN_PLACE:
+                reboot_in_place = true;
+                /* fall through */
             case DOMAIN_RESTART_SOFT_RESET:
                 domid_soft_reset = domid;
                 domid = INVALID_DOMID;
@@ -3181,10 +3212,12 @@ start:
 
                 /*
                  * XXX FIXME: If this sleep is not there then domain
-                 * re-creation fails sometimes.
+                 * re-creation fails sometimes.  Nothing is re-created
+                 * when rebooting in place.
                  */
                 LOG("Done. Rebooting now");
-                sleep(2);
+                if (!reboot_in_place)
+                    sleep(2);
                 goto start;
 
             case DOMAIN_RESTART_NONE:
@@ -4193,9 +4226,10 @@ static void reboot_domain(uint32_t domid, libxl_evgen_domain_death **deathw,
 
 static void list_domains_details(const libxl_dominfo *info, int nb_domain)
 {
-    libxl_domain_config d_config;
+    libxl_domain_config *d_configs;
+    int *rcs;
 
-    int i, rc;
+    int i;
 
     yajl_gen hand = NULL;
     yajl_gen_status s;
@@ -4215,20 +4249,32 @@ static void list_domains_details(const libxl_dominfo *info, int nb_domain)
     } else
         s = yajl_gen_status_ok;
 
+    d_configs = xmalloc(sizeof(*d_configs) * nb_domain);
+    rcs = xmalloc(sizeof(*rcs) * nb_domain);
+    for (i = 0; i < nb_domain; i++)
+        libxl_domain_config_init(&d_configs[i]);
+
+    libxl_retrieve_domain_configuration_list(ctx, info, nb_domain,
+                                             d_configs, rcs);
+
     for (i = 0; i < nb_domain; i++) {
-        libxl_domain_config_init(&d_config);
-        rc = libxl_retrieve_domain_configuration(ctx, info[i].domid, &d_config);
-        if (rc)
+        if (rcs[i])
             continue;
         if (default_output_format == OUTPUT_FORMAT_JSON)
-            s = printf_info_one_json(hand, info[i].domid, &d_config);
+            s = printf_info_one_json(hand, info[i].domid, &d_configs[i]);
         else
-            printf_info_sexp(info[i].domid, &d_config, stdout);
-        libxl_domain_config_dispose(&d_config);
+            printf_info_sexp(info[i].domid, &d_configs[i], stdout);
         if (s != yajl_gen_status_ok)
-            goto out;
+            break;
     }
 
+    for (i = 0; i < nb_domain; i++)
+        libxl_domain_config_dispose(&d_configs[i]);
+    free(d_configs);
+    free(rcs);
+    if (s != yajl_gen_status_ok)
+        goto out;
+
     if (default_output_format == OUTPUT_FORMAT_JSON) {
         s = yajl_gen_array_close(hand);
         if (s != yajl_gen_status_ok)
@@ -4682,7 +4728,7 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
 }
 
 static void migrate_domain(uint32_t domid, const char *rune, int debug,
-                           const char *override_config_file)
+                           int compress, const char *override_config_file)
 {
     pid_t child = -1;
     int rc;
@@ -4710,6 +4756,8 @@ static void migrate_domain(uint32_t domid, const char *rune, int debug,
 
     if (debug)
         flags |= LIBXL_SUSPEND_DEBUG;
+    if (compress)
+        flags |= LIBXL_SUSPEND_COMPRESS;
     rc = libxl_domain_suspend(ctx, domid, send_fd, flags, NULL);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
@@ -5135,13 +5183,14 @@ int main_migrate(int argc, char **argv)
     char *rune = NULL;
     char *host;
     int opt, daemonize = 1, monitor = 1, debug = 0, pause_after_migration = 0;
+    int compress = 0;
     static struct option opts[] = {
         {"debug", 0, 0, 0x100},
         {"live", 0, 0, 0x200},
         COMMON_LONG_OPTS
     };
 
-    SWITCH_FOREACH_OPT(opt, "FC:s:ep", opts, "migrate", 2) {
+    SWITCH_FOREACH_OPT(opt, "FC:s:epz", opts, "migrate", 2) {
     case 'C':
         config_filename = optarg;
         break;
@@ -5158,6 +5207,9 @@ int main_migrate(int argc, char **argv)
     case 'p':
         pause_after_migration = 1;
         break;
+    case 'z':
+        compress = 1;
+        break;
     case 0x100: /* --debug */
         debug = 1;
         break;
@@ -5194,7 +5246,7 @@ int main_migrate(int argc, char **argv)
                   pause_after_migration ? " -p" : "");
     }
 
-    migrate_domain(domid, rune, debug, config_filename);
+    migrate_domain(domid, rune, debug, compress, config_filename);
     return EXIT_SUCCESS;
 }
 #endif
@@ -5980,6 +6032,37 @@ int main_vcpuset(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
+int main_numa_migrate(int argc, char **argv)
+{
+    uint32_t domid;
+    uint64_t nr_migrated = 0, nr_busy = 0;
+    char *endptr;
+    long node;
+    int opt;
+
+    SWITCH_FOREACH_OPT(opt, "", NULL, "numa-migrate", 2) {
+        /* No options */
+    }
+
+    domid = find_domain(argv[optind]);
+    node = strtol(argv[optind + 1], &endptr, 10);
+    if (*endptr != '\0' || node < 0) {
+        fprintf(stderr, "Invalid node: %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    if (libxl_domain_numa_migrate(ctx, domid, node, &nr_migrated, &nr_busy)) {
+        fprintf(stderr, "Could not move memory of domain %u to node %ld.\n",
+                domid, node);
+        return EXIT_FAILURE;
+    }
+
+    printf("%"PRIu64" pages moved, %"PRIu64" pages busy\n",
+           nr_migrated, nr_busy);
+
+    return EXIT_SUCCESS;
+}
+
 /* Possibly select a specific piece of `xl info` to print. */
 static const char *info_name;
 static int maybe_printf(const char *fmt, ...) __attribute__((format(printf,1,2)));
@@ -6092,6 +6175,7 @@ static void output_physinfo(void)
         i = (1 << 20) / vinfo->pagesize;
         maybe_printf("total_memory           : %"PRIu64"\n", info.total_pages / i);
         maybe_printf("free_memory            : %"PRIu64"\n", (info.free_pages - info.outstanding_pages) / i);
+        maybe_printf("scrub_memory           : %"PRIu64"\n", info.scrub_pages / i);
         maybe_printf("sharing_freed_memory   : %"PRIu64"\n", info.sharing_freed_pages / i);
         maybe_printf("sharing_used_memory    : %"PRIu64"\n", info.sharing_used_frames / i);
         maybe_printf("outstanding_claims     : %"PRIu64"\n", info.outstanding_pages / i);
@@ -6119,13 +6203,13 @@ static void output_numainfo(void)
     }
 
     printf("numa_info              :\n");
-    printf("node:    memsize    memfree    distances\n");
+    printf("node:    memsize    memfree    memscrub   distances\n");
 
     for (i = 0; i < nr; i++) {
         if (info[i].size != LIBXL_NUMAINFO_INVALID_ENTRY) {
-            printf("%4d:    %6"PRIu64"     %6"PRIu64"      %d", i,
-                   info[i].size >> 20, info[i].free >> 20,
-                   info[i].dists[0]);
+            printf("%4d:    %6"PRIu64"     %6"PRIu64"     %6"PRIu64"     %d",
+                   i, info[i].size >> 20, info[i].free >> 20,
+                   info[i].scrub >> 20, info[i].dists[0]);
             for (j = 1; j < info[i].num_dists; j++)
                 printf(",%d", info[i].dists[j]);
             printf("\n");
@@ -8834,7 +8918,7 @@ int main_remus(int argc, char **argv)
 
     memset(&r_info, 0, sizeof(libxl_domain_remus_info));
 
-    SWITCH_FOREACH_OPT(opt, "Fbundi:s:N:ec", NULL, "remus", 2) {
+    SWITCH_FOREACH_OPT(opt, "Fbundi:s:N:p:ec", NULL, "remus", 2) {
     case 'i':
         r_info.interval = atoi(optarg);
         break;
@@ -8853,6 +8937,9 @@ int main_remus(int argc, char **argv)
     case 'N':
         r_info.netbufscript = optarg;
         break;
+    case 'p':
+        r_info.netbuf_bypass = optarg;
+        break;
     case 'd':
         libxl_defbool_set(&r_info.diskbuf, false);
         break;
@@ -9003,6 +9090,275 @@ out:
     return ret;
 }
 
+/*
+ * xl serve: run query subcommands on behalf of clients of a local
+ * socket, from one long-lived process, so that monitoring scripts
+ * don't pay for setting up a libxl ctx and reading xl.conf for each.
+ *
+ * A request is the subcommand and its arguments, one per line, ended
+ * by an empty line.  The reply is a single line of JSON:
+ *   {"status": <exit status>, "stdout": "...", "stderr": "..."}
+ *
+ * Only commands which don't modify anything are run, except those
+ * which take over the terminal.  A command which exits rather than
+ * returns takes the worker with it: the client sees the connection
+ * closed without a reply, and a new worker is started.
+ */
+
+#define SERVE_MAX_REQUEST 4096
+#define SERVE_MAX_ARGS    64
+
+static const char *const serve_refused[] = {
+    "console", "vncviewer", "top", "serve",
+};
+
+static int serve_read_request(int fd, char *buf, int *argc, char **argv)
+{
+    size_t len = 0;
+    ssize_t r;
+    char *p;
+
+    for (;;) {
+        if (len == SERVE_MAX_REQUEST - 1)
+            return -1;
+        r = read(fd, buf + len, SERVE_MAX_REQUEST - 1 - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        len += r;
+        buf[len] = '\0';
+        if (!strncmp(buf, "\n", 1) || strstr(buf, "\n\n"))
+            break;
+    }
+
+    *argc = 0;
+    for (p = buf; *p != '\n'; p = strchr(p, '\0') + 1) {
+        if (*argc == SERVE_MAX_ARGS)
+            return -1;
+        argv[(*argc)++] = p;
+        *strchr(p, '\n') = '\0';
+    }
+    argv[*argc] = NULL;
+
+    return 0;
+}
+
+/* Run @argv with stdout and stderr sent to @out and @err. */
+static int serve_run(int argc, char **argv, FILE *out, FILE *err)
+{
+    struct cmd_spec *cspec;
+    int saved_out, saved_err, ret, i;
+
+    cspec = argc ? cmdtable_lookup(argv[0]) : NULL;
+    if (!cspec || cspec->modifies) {
+        fprintf(err, "command not available from xl serve\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < sizeof(serve_refused) / sizeof(serve_refused[0]); i++) {
+        if (!strcmp(cspec->cmd_name, serve_refused[i])) {
+            fprintf(err, "command not available from xl serve\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    CHK_SYSCALL(saved_out = dup(1));
+    CHK_SYSCALL(saved_err = dup(2));
+    dup2(fileno(out), 1);
+    dup2(fileno(err), 2);
+
+    optind = 1;
+    ret = cspec->cmd_impl(argc, argv);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, 1);
+    dup2(saved_err, 2);
+    close(saved_out);
+    close(saved_err);
+
+    return ret;
+}
+
+static yajl_gen_status serve_gen_file(yajl_gen hand, const char *key,
+                                      FILE *f)
+{
+    yajl_gen_status s;
+    char *buf;
+    long len;
+
+    s = yajl_gen_string(hand, (const unsigned char *)key, strlen(key));
+    if (s != yajl_gen_status_ok)
+        return s;
+
+    fflush(f);
+    len = ftell(f);
+    buf = xmalloc(len + 1);
+    rewind(f);
+    if (fread(buf, 1, len, f) != len)
+        len = 0;
+    s = yajl_gen_string(hand, (const unsigned char *)buf, len);
+    free(buf);
+
+    return s;
+}
+
+static void serve_reply(int fd, int status, FILE *out, FILE *err)
+{
+    const char *buf;
+    libxl_yajl_length len = 0;
+    yajl_gen_status s;
+    yajl_gen hand;
+
+    hand = libxl_yajl_gen_alloc(NULL);
+    if (!hand) {
+        fprintf(stderr, "unable to allocate JSON generator\n");
+        return;
+    }
+
+    s = yajl_gen_map_open(hand);
+    if (s != yajl_gen_status_ok) goto out;
+    s = yajl_gen_string(hand, (const unsigned char *)"status",
+                        sizeof("status") - 1);
+    if (s != yajl_gen_status_ok) goto out;
+    s = yajl_gen_integer(hand, status);
+    if (s != yajl_gen_status_ok) goto out;
+    s = serve_gen_file(hand, "stdout", out);
+    if (s != yajl_gen_status_ok) goto out;
+    s = serve_gen_file(hand, "stderr", err);
+    if (s != yajl_gen_status_ok) goto out;
+    s = yajl_gen_map_close(hand);
+    if (s != yajl_gen_status_ok) goto out;
+
+    s = yajl_gen_get_buf(hand, (const unsigned char **)&buf, &len);
+    if (s != yajl_gen_status_ok) goto out;
+
+    if (write(fd, buf, len) != len || write(fd, "\n", 1) != 1)
+        perror("xl serve: writing reply");
+
+out:
+    yajl_gen_free(hand);
+
+    if (s != yajl_gen_status_ok)
+        fprintf(stderr, "xl serve: unable to format reply (YAJL:%d)\n", s);
+}
+
+static void serve_worker(int sock) __attribute__((noreturn));
+static void serve_worker(int sock)
+{
+    char buf[SERVE_MAX_REQUEST], *argv[SERVE_MAX_ARGS + 1];
+    struct timeval tv = { .tv_sec = 5 };
+    FILE *out, *err;
+    int fd, argc, status;
+
+    postfork();
+
+    out = tmpfile();
+    err = tmpfile();
+    if (!out || !err) {
+        perror("xl serve: tmpfile");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("xl serve: accept");
+            exit(EXIT_FAILURE);
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        if (!serve_read_request(fd, buf, &argc, argv)) {
+            rewind(out);
+            rewind(err);
+            CHK_SYSCALL(ftruncate(fileno(out), 0));
+            CHK_SYSCALL(ftruncate(fileno(err), 0));
+
+            status = serve_run(argc, argv, out, err);
+            serve_reply(fd, status, out, err);
+        }
+
+        close(fd);
+    }
+}
+
+int main_serve(int argc, char **argv)
+{
+    int ret = 0, opt = 0, daemonize = 1, sock;
+    const char *pidfile = NULL, *path = XL_SERVE_SOCKET;
+    struct sockaddr_un sun;
+    time_t started;
+    pid_t got;
+    int status;
+    static const struct option opts[] = {
+        {"pidfile", 1, 0, 'p'},
+        {"socket", 1, 0, 's'},
+        COMMON_LONG_OPTS,
+        {0, 0, 0, 0}
+    };
+
+    SWITCH_FOREACH_OPT(opt, "Fp:s:", opts, "serve", 0) {
+    case 'F':
+        daemonize = 0;
+        break;
+    case 'p':
+        pidfile = optarg;
+        break;
+    case 's':
+        path = optarg;
+        break;
+    }
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "socket path %s too long\n", path);
+        return EXIT_FAILURE;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    CHK_SYSCALL(sock = socket(AF_UNIX, SOCK_STREAM, 0));
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&sun, sizeof(sun)) ||
+        chmod(path, 0600) || listen(sock, 64)) {
+        fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (daemonize) {
+        ret = do_daemonize("xlserve", pidfile);
+        if (ret) {
+            ret = (ret == 1) ? 0 : ret;
+            goto out;
+        }
+    }
+
+    for (;;) {
+        started = time(NULL);
+        if (!xl_fork(child_serve, "xl serve worker"))
+            serve_worker(sock);
+
+        got = xl_waitpid(child_serve, &status, 0);
+        if (got < 0) {
+            perror("xl serve: waitpid");
+            ret = EXIT_FAILURE;
+            goto out;
+        }
+        if (status)
+            xl_report_child_exitstatus(XTL_WARN, child_serve, got, status);
+
+        /* Don't spin if workers die as soon as they are started. */
+        if (time(NULL) == started)
+            sleep(1);
+    }
+
+out:
+    close(sock);
+    return ret;
+}
+
 #ifdef LIBXL_HAVE_PSR_CMT
 static int psr_cmt_hwinfo(void)
 {
@@ -9270,6 +9626,79 @@ int main_psr_cmt_show(int argc, char **argv)
 
     return ret;
 }
+
+#ifdef LIBXL_HAVE_PSR_MBM_DOMAIN
+static void psr_mbm_print_domain_info(libxl_dominfo *dominfo)
+{
+    char *domain_name;
+    uint64_t total, local, remote;
+
+    if (!libxl_psr_cmt_domain_attached(ctx, dominfo->domid) ||
+        libxl_psr_mbm_get_domain_bandwidth(ctx, dominfo->domid,
+                                           &total, &local))
+        return;
+
+    /* Local and total are sampled one after the other. */
+    remote = total > local ? total - local : 0;
+
+    domain_name = libxl_domid_to_name(ctx, dominfo->domid);
+    printf("%-40s %5d", domain_name, dominfo->domid);
+    free(domain_name);
+
+    printf("%14"PRIu64"%14"PRIu64"%14"PRIu64"%9"PRIu64"%%\n",
+           total / 1024, local / 1024, remote / 1024,
+           total ? remote * 100 / total : 0);
+}
+
+int main_psr_mbm_show(int argc, char **argv)
+{
+    int opt, i, nr_domains, rc = 0;
+
+    SWITCH_FOREACH_OPT(opt, "", NULL, "psr-mbm-show", 0) {
+        /* No options */
+    }
+
+    if (optind < argc - 1) {
+        help("psr-mbm-show");
+        return 2;
+    }
+
+    if (!libxl_psr_cmt_enabled(ctx)) {
+        fprintf(stderr, "CMT is disabled in the system\n");
+        return 1;
+    }
+
+    /* Header */
+    printf("%-40s %5s%14s%14s%14s%10s\n", "Name", "ID",
+           "Total KB/s", "Local KB/s", "Remote KB/s", "Remote");
+
+    if (optind < argc) {
+        libxl_dominfo dominfo;
+
+        libxl_dominfo_init(&dominfo);
+        if (libxl_domain_info(ctx, &dominfo, find_domain(argv[optind]))) {
+            fprintf(stderr, "Failed to get domain info for %s\n",
+                    argv[optind]);
+            rc = 1;
+        } else {
+            psr_mbm_print_domain_info(&dominfo);
+        }
+        libxl_dominfo_dispose(&dominfo);
+    } else {
+        libxl_dominfo *list;
+
+        if (!(list = libxl_list_domain(ctx, &nr_domains))) {
+            fprintf(stderr, "Failed to get domain info for domain list.\n");
+            return 1;
+        }
+        for (i = 0; i < nr_domains; i++)
+            psr_mbm_print_domain_info(list + i);
+        libxl_dominfo_list_free(list, nr_domains);
+    }
+
+    return rc;
+}
+#endif
 #endif
 
 #ifdef LIBXL_HAVE_PSR_CAT
@@ -165,7 +165,9 @@ struct cmd_spec cmd_table[] = {
       "-e              Do not wait in the background (on <host>) for the death\n"
       "                of the domain.\n"
       "--debug         Print huge (!) amount of debug during the migration process.\n"
-      "-p              Do not unpause domain after migrating it."
+      "-p              Do not unpause domain after migrating it.\n"
+      "-z              Compress guest memory while sending it, using several\n"
+      "                threads."
     },
     { "restore",
       &main_restore, 0, 1,
@@ -232,6 +234,11 @@ struct cmd_spec cmd_table[] = {
       "[option] <Domain> <vCPUs>",
       "-i, --ignore-host  Don't limit the vCPU based on the host CPU count",
     },
+    { "numa-migrate",
+      &main_numa_migrate, 0, 1,
+      "Move the memory of a domain onto a NUMA node",
+      "<Domain> <Node>",
+    },
     { "vm-list",
       &main_vm_list, 0, 0,
       "List guest domains, excluding dom0, stubdoms, etc.",
@@ -498,6 +505,8 @@ struct cmd_spec cmd_table[] = {
       "                        of the domain.\n"
       "-N <netbufscript>       Use netbufscript to setup network buffering instead of the\n"
       "                        default script (/etc/xen/scripts/remus-netbuf-setup).\n"
+      "-p <proto:port,...>     Release output to these tcp/udp destination ports without\n"
+      "                        waiting for a checkpoint. Only for idempotent services.\n"
       "-F                      Enable unsafe configurations [-b|-n|-d flags]. Use this option\n"
       "                        with caution as failover may not work as intended.\n"
       "-b                      Replicate memory checkpoints to /dev/null (blackhole).\n"
@@ -515,6 +524,14 @@ struct cmd_spec cmd_table[] = {
       "-F                      Run in the foreground.\n"
       "-p, --pidfile [FILE]    Write PID to pidfile when daemonizing.",
     },
+    { "serve",
+      &main_serve, 0, 0,
+      "Run query commands for clients of a local socket",
+      "[options]",
+      "-F                      Run in the foreground.\n"
+      "-p, --pidfile [FILE]    Write PID to pidfile when daemonizing.\n"
+      "-s, --socket [PATH]     Listen on PATH (default " XL_SERVE_SOCKET ").",
+    },
 #ifdef LIBXL_HAVE_PSR_CMT
     { "psr-hwinfo",
       &main_psr_hwinfo, 0, 1,
@@ -542,6 +559,13 @@ struct cmd_spec cmd_table[] = {
       "\"total-mem-bandwidth\":     Show total memory bandwidth(KB/s)\n"
       "\"local-mem-bandwidth\":     Show local memory bandwidth(KB/s)\n",
     },
+#ifdef LIBXL_HAVE_PSR_MBM_DOMAIN
+    { "psr-mbm-show",
+      &main_psr_mbm_show, 0, 1,
+      "Show total, local and remote memory bandwidth of monitored domains",
+      "[Domain]",
+    },
+#endif
 #endif
 #ifdef LIBXL_HAVE_PSR_CAT
     { "psr-cat-cbm-set",
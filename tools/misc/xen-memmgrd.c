@@ -0,0 +1,563 @@
+/*
+ * xen-memmgrd: keep host free memory at a target by reclaiming from guests.
+ *
+ * Every round compares the host's free memory with the target.  When it is
+ * short, memory is reclaimed in order of increasing cost to the guests:
+ *
+ *  1. sharing: xen-memshrd is run over HVM guests which have not been
+ *     scanned recently.  Shared pages cost the guest nothing until written.
+ *  2. ballooning: memory/target is lowered for guests with a balloon
+ *     driver.  The deficit is spread over them in proportion to how far
+ *     each is above its floor, so no guest is squeezed first.
+ *  3. paging: memory/target-tot_pages, which xenpaging follows, is lowered
+ *     for HVM guests without a balloon driver, the same way.
+ *
+ * When memory is plentiful again the targets lowered here are raised back,
+ * paging first as it hurts the most.  Memory requested from guests but not
+ * yet handed back counts as free for a while, so slow balloon drivers are
+ * not asked twice.  A target changed by someone else is left to them.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <xenctrl.h>
+#include <xenevtchn.h>
+#include <xenstore.h>
+
+#define DEFAULT_FREE_MB     512     /* Host free memory to maintain */
+#define DEFAULT_FLOOR_PCT   50      /* Of static-max, never reclaimed */
+#define DEFAULT_INTERVAL    5       /* Seconds between rounds */
+#define DEFAULT_SCAN_SECS   600     /* Between sharing scans of a guest */
+#define DEFAULT_MEMSHRD     "xen-memshrd"
+#define MIN_FLOOR_KB        (128 << 10)
+#define IN_FLIGHT_SECS      30      /* Allowed for a guest to give memory */
+#define MAX_DOMAINS         1024
+
+#define PAGE_KB             (XC_PAGE_SIZE >> 10)
+
+struct dom {
+    domid_t domid;
+    int present;
+    int balloon;                /* Guest runs a balloon driver */
+    int hap;                    /* Guest can be shared and paged */
+    uint64_t static_max;        /* All sizes in KiB */
+    uint64_t floor;
+    uint64_t cur;
+    uint64_t target;            /* memory/target as last read */
+    uint64_t orig_target;       /* Before we first lowered it */
+    uint64_t set_target;        /* What we wrote, 0 if not lowered */
+    uint64_t paging_target;     /* Written to target-tot_pages, 0 if none */
+    time_t asked;               /* When a target was last lowered */
+    time_t last_scan;
+};
+
+static xc_interface *xch;
+static xenevtchn_handle *xce;
+static struct xs_handle *xsh;
+
+static struct dom doms[MAX_DOMAINS];
+static unsigned int nr_doms;
+
+static uint64_t free_target = (uint64_t)DEFAULT_FREE_MB << 10;
+static unsigned int floor_pct = DEFAULT_FLOOR_PCT;
+static unsigned int scan_secs = DEFAULT_SCAN_SECS;
+static const char *memshrd = DEFAULT_MEMSHRD;
+static int use_sharing = 1, use_paging = 1;
+static int verbose;
+
+static pid_t scan_pid;
+
+static volatile sig_atomic_t quit;
+
+static void catch_exit(int sig)
+{
+    quit = 1;
+}
+
+static int read_kb(domid_t domid, const char *key, uint64_t *val)
+{
+    char path[64], *s, *end;
+    int rc = -1;
+
+    snprintf(path, sizeof(path), "/local/domain/%u/%s", domid, key);
+    s = xs_read(xsh, XBT_NULL, path, NULL);
+    if ( !s )
+        return -1;
+    *val = strtoull(s, &end, 10);
+    if ( end != s && *end == '\0' )
+        rc = 0;
+    free(s);
+
+    return rc;
+}
+
+static int write_kb(domid_t domid, const char *key, uint64_t val)
+{
+    char path[64], buf[24];
+
+    snprintf(path, sizeof(path), "/local/domain/%u/%s", domid, key);
+    snprintf(buf, sizeof(buf), "%"PRIu64, val);
+    if ( !xs_write(xsh, XBT_NULL, path, buf, strlen(buf)) )
+    {
+        syslog(LOG_WARNING, "d%u: failed to write %s: %s",
+               domid, key, strerror(errno));
+        return -1;
+    }
+    if ( verbose )
+        syslog(LOG_INFO, "d%u: %s = %"PRIu64" KiB", domid, key, val);
+
+    return 0;
+}
+
+static struct dom *find_dom(domid_t domid)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_doms; i++ )
+        if ( doms[i].domid == domid )
+            return &doms[i];
+
+    if ( nr_doms == MAX_DOMAINS )
+        return NULL;
+
+    memset(&doms[nr_doms], 0, sizeof(doms[nr_doms]));
+    doms[nr_doms].domid = domid;
+
+    return &doms[nr_doms++];
+}
+
+/* Update the table from the hypervisor and xenstore. */
+static void refresh(void)
+{
+    xc_dominfo_t info[64];
+    uint32_t next = 1;          /* dom0 is left to xen-lowmemd */
+    unsigned int i;
+    uint64_t val;
+    char *s;
+    char path[64];
+    int n;
+
+    for ( i = 0; i < nr_doms; i++ )
+        doms[i].present = 0;
+
+    while ( (n = xc_domain_getinfo(xch, next, 64, info)) > 0 )
+    {
+        for ( i = 0; i < n; i++ )
+        {
+            struct dom *d;
+
+            next = info[i].domid + 1;
+            if ( info[i].dying || info[i].shutdown )
+                continue;
+            if ( (d = find_dom(info[i].domid)) == NULL )
+                break;
+
+            d->present = 1;
+            d->hap = info[i].hvm && info[i].hap;
+            d->cur = (uint64_t)info[i].nr_pages * PAGE_KB;
+
+            if ( read_kb(d->domid, "memory/static-max", &d->static_max) )
+                d->static_max = info[i].max_memkb;
+            d->floor = d->static_max * floor_pct / 100;
+            if ( d->floor < MIN_FLOOR_KB )
+                d->floor = MIN_FLOOR_KB;
+
+            if ( read_kb(d->domid, "memory/target", &d->target) )
+                d->target = d->cur;
+            /* Somebody else set a new target: it is theirs now. */
+            if ( d->set_target && d->target != d->set_target )
+                d->set_target = 0;
+
+            snprintf(path, sizeof(path),
+                     "/local/domain/%u/control/feature-balloon", d->domid);
+            s = xs_read(xsh, XBT_NULL, path, NULL);
+            d->balloon = s && !strcmp(s, "1");
+            free(s);
+
+            if ( d->paging_target &&
+                 (read_kb(d->domid, "memory/target-tot_pages", &val) ||
+                  val != d->paging_target) )
+                d->paging_target = 0;
+        }
+        if ( n < 64 )
+            break;
+    }
+
+    /* Forget domains which went away. */
+    for ( i = 0; i < nr_doms; )
+        if ( !doms[i].present )
+            doms[i] = doms[--nr_doms];
+        else
+            i++;
+}
+
+/* Memory asked for but not yet given back by the guests. */
+static uint64_t in_flight(void)
+{
+    uint64_t sum = 0;
+    time_t now = time(NULL);
+    unsigned int i;
+
+    for ( i = 0; i < nr_doms; i++ )
+    {
+        const struct dom *d = &doms[i];
+
+        /* Whatever has not arrived by now is not coming. */
+        if ( now - d->asked >= IN_FLIGHT_SECS )
+            continue;
+        if ( d->set_target && d->cur > d->set_target )
+            sum += d->cur - d->set_target;
+        else if ( d->paging_target && d->cur > d->paging_target )
+            sum += d->cur - d->paging_target;
+    }
+
+    return sum;
+}
+
+/* Run xen-memshrd once over the HVM guests not scanned for a while. */
+static void schedule_scan(void)
+{
+    char *argv[MAX_DOMAINS + 3], ids[MAX_DOMAINS][8];
+    time_t now = time(NULL);
+    unsigned int i, argc = 0;
+    int status;
+
+    if ( !use_sharing )
+        return;
+    if ( scan_pid )
+    {
+        if ( waitpid(scan_pid, &status, WNOHANG) == 0 )
+            return;
+        scan_pid = 0;
+    }
+
+    argv[argc++] = (char *)memshrd;
+    argv[argc++] = "-o";
+    for ( i = 0; i < nr_doms; i++ )
+    {
+        if ( !doms[i].hap || now - doms[i].last_scan < scan_secs )
+            continue;
+        doms[i].last_scan = now;
+        snprintf(ids[i], sizeof(ids[i]), "%u", doms[i].domid);
+        argv[argc++] = ids[i];
+    }
+    argv[argc] = NULL;
+    if ( argc == 2 )
+        return;
+
+    switch ( scan_pid = fork() )
+    {
+    case -1:
+        syslog(LOG_WARNING, "fork: %s", strerror(errno));
+        scan_pid = 0;
+        return;
+    case 0:
+        execvp(memshrd, argv);
+        _exit(127);
+    }
+
+    if ( verbose )
+        syslog(LOG_INFO, "sharing scan of %u guests started", argc - 2);
+}
+
+/*
+ * Take up to @want KiB from the guests selected by @paging, in proportion
+ * to how far each sits above its floor.  Returns what was asked for.
+ */
+static uint64_t shrink(uint64_t want, int paging)
+{
+    uint64_t slack[MAX_DOMAINS], total = 0, got = 0, take, base;
+    unsigned int i;
+
+    for ( i = 0; i < nr_doms; i++ )
+    {
+        struct dom *d = &doms[i];
+
+        slack[i] = 0;
+        if ( paging ? (d->balloon || !d->hap) : !d->balloon )
+            continue;
+        base = paging ? (d->paging_target ?: d->cur)
+                      : (d->set_target ?: d->target);
+        if ( base > d->floor )
+            slack[i] = base - d->floor;
+        total += slack[i];
+    }
+    if ( !total )
+        return 0;
+
+    for ( i = 0; i < nr_doms && got < want; i++ )
+    {
+        struct dom *d = &doms[i];
+
+        if ( !slack[i] )
+            continue;
+        take = want >= total ? slack[i] : want * slack[i] / total + 1;
+        if ( take > slack[i] )
+            take = slack[i];
+
+        if ( paging )
+        {
+            base = d->paging_target ?: d->cur;
+            if ( write_kb(d->domid, "memory/target-tot_pages", base - take) )
+                continue;
+            d->paging_target = base - take;
+        }
+        else
+        {
+            base = d->set_target ?: d->target;
+            if ( write_kb(d->domid, "memory/target", base - take) )
+                continue;
+            if ( !d->set_target )
+                d->orig_target = d->target;
+            d->set_target = base - take;
+        }
+        d->asked = time(NULL);
+        got += take;
+    }
+
+    return got;
+}
+
+/* Give back up to @spare KiB, undoing paging before ballooning. */
+static void grow(uint64_t spare)
+{
+    unsigned int i;
+    uint64_t give;
+
+    for ( i = 0; i < nr_doms && spare; i++ )
+    {
+        struct dom *d = &doms[i];
+
+        if ( !d->paging_target )
+            continue;
+        give = d->static_max - d->paging_target;
+        if ( give > spare )
+            give = spare;
+        if ( write_kb(d->domid, "memory/target-tot_pages",
+                      d->paging_target + give) )
+            continue;
+        d->paging_target += give;
+        if ( d->paging_target >= d->static_max )
+            d->paging_target = 0;
+        spare -= give;
+    }
+
+    for ( i = 0; i < nr_doms && spare; i++ )
+    {
+        struct dom *d = &doms[i];
+
+        if ( !d->set_target )
+            continue;
+        give = d->orig_target > d->set_target ?
+               d->orig_target - d->set_target : 0;
+        if ( give > spare )
+            give = spare;
+        if ( write_kb(d->domid, "memory/target", d->set_target + give) )
+            continue;
+        d->set_target += give;
+        if ( d->set_target >= d->orig_target )
+            d->set_target = 0;
+        spare -= give;
+    }
+}
+
+static void round_once(void)
+{
+    xc_physinfo_t info = { 0 };
+    uint64_t free_kb, deficit;
+
+    if ( xc_physinfo(xch, &info) < 0 )
+    {
+        syslog(LOG_WARNING, "xc_physinfo: %s", strerror(errno));
+        return;
+    }
+
+    refresh();
+
+    free_kb = (uint64_t)info.free_pages * PAGE_KB + in_flight();
+
+    if ( free_kb < free_target )
+    {
+        deficit = free_target - free_kb;
+        if ( verbose )
+            syslog(LOG_INFO, "%"PRIu64" KiB short", deficit);
+
+        schedule_scan();
+        deficit -= shrink(deficit, 0);
+        if ( deficit && use_paging )
+            deficit -= shrink(deficit, 1);
+        if ( deficit )
+            syslog(LOG_NOTICE, "%"PRIu64" KiB short with all guests at "
+                   "their floor", deficit);
+    }
+    /* A quarter of the target as hysteresis, to avoid see-sawing. */
+    else if ( free_kb > free_target + free_target / 4 )
+        grow(free_kb - free_target - free_target / 4);
+}
+
+static void daemonize(void)
+{
+    switch ( fork() )
+    {
+    case -1:
+        err(1, "fork");
+    case 0:
+        break;
+    default:
+        exit(0);
+    }
+    umask(0);
+    if ( setsid() < 0 )
+        err(1, "setsid");
+    if ( chdir("/") < 0 )
+        err(1, "chdir /");
+    if ( freopen("/dev/null", "r", stdin) == NULL ||
+         freopen("/dev/null", "w", stdout) == NULL ||
+         freopen("/dev/null", "w", stderr) == NULL )
+        err(1, "reopen stdio");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "Keep host free memory at a target using page sharing, "
+            "ballooning\nand paging of guests, cheapest first.\n"
+            "  -t <MiB>     host free memory to maintain (default %u)\n"
+            "  -f <percent> floor of each guest, of its static-max "
+            "(default %u)\n"
+            "  -i <secs>    delay between rounds (default %u)\n"
+            "  -s <secs>    delay between sharing scans of a guest "
+            "(default %u)\n"
+            "  -m <path>    sharing scanner (default %s)\n"
+            "  -S           don't schedule sharing scans\n"
+            "  -P           don't set paging targets\n"
+            "  -o           make a single round and exit\n"
+            "  -F           stay in the foreground\n"
+            "  -v           log every decision\n",
+            prog, DEFAULT_FREE_MB, DEFAULT_FLOOR_PCT, DEFAULT_INTERVAL,
+            DEFAULT_SCAN_SECS, DEFAULT_MEMSHRD);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int interval = DEFAULT_INTERVAL;
+    int opt, once = 0, foreground = 0, port;
+    struct pollfd pfd;
+
+    while ( (opt = getopt(argc, argv, "t:f:i:s:m:SPoFvh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 't':
+            free_target = strtoull(optarg, NULL, 0) << 10;
+            break;
+        case 'f':
+            floor_pct = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            scan_secs = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            memshrd = optarg;
+            break;
+        case 'S':
+            use_sharing = 0;
+            break;
+        case 'P':
+            use_paging = 0;
+            break;
+        case 'o':
+            once = 1;
+            break;
+        case 'F':
+            foreground = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( optind != argc || !free_target || floor_pct > 100 || !interval )
+        usage(argv[0]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+    xsh = xs_daemon_open();
+    if ( !xsh )
+        err(1, "xs_daemon_open");
+    xce = xenevtchn_open(NULL, 0);
+    if ( !xce )
+        err(1, "xenevtchn_open");
+    /* Low memory warnings from Xen start a round early. */
+    port = xenevtchn_bind_virq(xce, VIRQ_ENOMEM);
+    if ( port < 0 )
+        err(1, "bind VIRQ_ENOMEM");
+
+    if ( !foreground && !once )
+        daemonize();
+
+    openlog("xen-memmgrd", LOG_PID, LOG_DAEMON);
+    signal(SIGTERM, catch_exit);
+    signal(SIGINT, catch_exit);
+
+    pfd.fd = xenevtchn_fd(xce);
+    pfd.events = POLLIN;
+
+    while ( !quit )
+    {
+        round_once();
+
+        if ( once )
+            break;
+
+        if ( poll(&pfd, 1, interval * 1000) > 0 )
+        {
+            evtchn_port_t p = xenevtchn_pending(xce);
+
+            if ( p != (evtchn_port_t)-1 )
+                xenevtchn_unmask(xce, p);
+        }
+    }
+
+    if ( scan_pid )
+        waitpid(scan_pid, NULL, 0);
+
+    xenevtchn_unbind(xce, port);
+    xenevtchn_close(xce);
+    xs_daemon_close(xsh);
+    xc_interface_close(xch);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
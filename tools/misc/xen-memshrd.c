@@ -0,0 +1,393 @@
+/*
+ * xen-memshrd: find identical pages across HVM guests and share them.
+ *
+ * Guest memory is read in batches through read-only foreign mappings and
+ * every page hashed.  When a hash has been seen before, both pages are
+ * nominated for sharing, which makes them read-only to their guests, then
+ * compared in full and finally shared.  Nominating before comparing means
+ * the contents can't change between comparison and sharing: a guest write
+ * in between unshares the page and invalidates its handle.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xenctrl.h>
+#include <xenforeignmemory.h>
+
+#define DEFAULT_BATCH       1024    /* Pages mapped at a time */
+#define DEFAULT_CPU         10      /* Percent of one CPU */
+#define DEFAULT_INTERVAL    60      /* Seconds between passes */
+#define DEFAULT_TABLE_ORDER 20      /* log2 of hash table entries */
+#define MAX_DOMAINS         1024
+
+/* Where a page with a given hash was last seen. */
+struct entry {
+    uint64_t hash;
+    xen_pfn_t gfn;
+    domid_t domid;              /* DOMID_INVALID if unused */
+};
+
+/* A page whose hash matches an earlier one. */
+struct candidate {
+    struct entry *seen;
+    xen_pfn_t gfn;
+};
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+
+static struct entry *table;
+static unsigned long table_mask;
+
+static unsigned int batch = DEFAULT_BATCH;
+static unsigned int cpu_pct = DEFAULT_CPU;
+static int verbose;
+
+static xen_pfn_t *pfns;
+static int *errs;
+static struct candidate *cands;
+
+static unsigned long nr_scanned, nr_shared, nr_mismatched;
+
+static volatile sig_atomic_t quit;
+
+static void catch_exit(int sig)
+{
+    quit = 1;
+}
+
+/*
+ * A 64-bit hash of a page.  Four independent lanes let the compiler keep
+ * several multiplies in flight (and vectorise where the target allows),
+ * rather than serialising on a single accumulator.
+ */
+static uint64_t page_hash(const void *page)
+{
+    static const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+    const uint64_t *p = page;
+    uint64_t h0 = 1, h1 = 2, h2 = 3, h3 = 4;
+    unsigned int i;
+
+    for ( i = 0; i < XC_PAGE_SIZE / sizeof(*p); i += 4 )
+    {
+        h0 = (h0 ^ p[i + 0]) * prime;
+        h1 = (h1 ^ p[i + 1]) * prime;
+        h2 = (h2 ^ p[i + 2]) * prime;
+        h3 = (h3 ^ p[i + 3]) * prime;
+    }
+
+    h0 ^= (h1 << 17 | h1 >> 47) ^ (h2 << 31 | h2 >> 33) ^
+          (h3 << 47 | h3 >> 17);
+
+    return h0 ^ (h0 >> 29);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Sleep long enough to keep to the CPU budget. */
+static void throttle(uint64_t start)
+{
+    uint64_t busy = now_ns() - start, idle;
+    struct timespec ts;
+
+    if ( cpu_pct >= 100 )
+        return;
+
+    idle = busy * (100 - cpu_pct) / cpu_pct;
+    ts.tv_sec = idle / 1000000000ULL;
+    ts.tv_nsec = idle % 1000000000ULL;
+    nanosleep(&ts, NULL);
+}
+
+static void record(struct entry *e, uint64_t hash, domid_t domid,
+                   xen_pfn_t gfn)
+{
+    e->hash = hash;
+    e->domid = domid;
+    e->gfn = gfn;
+}
+
+/* Returns 1 if the two pages were shared. */
+static int try_share(struct entry *seen, domid_t domid, xen_pfn_t gfn)
+{
+    uint64_t shandle, chandle;
+    void *s, *c;
+    int same;
+
+    if ( xc_memshr_nominate_gfn(xch, seen->domid, seen->gfn, &shandle) )
+        return 0;
+    if ( xc_memshr_nominate_gfn(xch, domid, gfn, &chandle) )
+        return 0;
+    /* Already backed by the same frame. */
+    if ( shandle == chandle )
+        return 0;
+
+    s = xenforeignmemory_map(fmem, seen->domid, PROT_READ, 1,
+                             &seen->gfn, NULL);
+    c = xenforeignmemory_map(fmem, domid, PROT_READ, 1, &gfn, NULL);
+    same = s && c && !memcmp(s, c, XC_PAGE_SIZE);
+    if ( s )
+        xenforeignmemory_unmap(fmem, s, 1);
+    if ( c )
+        xenforeignmemory_unmap(fmem, c, 1);
+
+    if ( !same )
+    {
+        nr_mismatched++;
+        return 0;
+    }
+
+    /* Our mappings are gone, so the client frame can now be freed. */
+    if ( xc_memshr_share_gfns(xch, seen->domid, seen->gfn, shandle,
+                              domid, gfn, chandle) )
+        return 0;
+
+    nr_shared++;
+    return 1;
+}
+
+static void scan_batch(domid_t domid, xen_pfn_t first, unsigned int nr)
+{
+    uint64_t start = now_ns();
+    unsigned int i, nr_cands = 0;
+    uint8_t *map;
+
+    for ( i = 0; i < nr; i++ )
+        pfns[i] = first + i;
+
+    map = xenforeignmemory_map(fmem, domid, PROT_READ, nr, pfns, errs);
+    if ( !map )
+        return;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        uint64_t hash;
+        struct entry *e;
+
+        if ( errs[i] )
+            continue;
+
+        hash = page_hash(map + (size_t)i * XC_PAGE_SIZE);
+        e = &table[hash & table_mask];
+        nr_scanned++;
+
+        if ( e->domid != DOMID_INVALID && e->hash == hash &&
+             !(e->domid == domid && e->gfn == first + i) )
+        {
+            cands[nr_cands].seen = e;
+            cands[nr_cands].gfn = first + i;
+            nr_cands++;
+        }
+        else
+            record(e, hash, domid, first + i);
+    }
+
+    /*
+     * Nomination fails for pages with extra references, such as our own
+     * mappings, so drop them before dealing with the candidates.
+     */
+    xenforeignmemory_unmap(fmem, map, nr);
+
+    for ( i = 0; i < nr_cands; i++ )
+        if ( !try_share(cands[i].seen, domid, cands[i].gfn) )
+            /* Stale or colliding entry: remember the newer page instead. */
+            record(cands[i].seen, cands[i].seen->hash, domid, cands[i].gfn);
+
+    throttle(start);
+}
+
+static void scan_domain(domid_t domid)
+{
+    xen_pfn_t max_gpfn, gfn;
+
+    if ( xc_memshr_control(xch, domid, 1) )
+    {
+        if ( verbose )
+            syslog(LOG_WARNING, "d%u: cannot enable sharing: %s",
+                   domid, strerror(errno));
+        return;
+    }
+
+    if ( xc_domain_maximum_gpfn(xch, domid, &max_gpfn) < 0 )
+        return;
+
+    for ( gfn = 0; gfn <= max_gpfn && !quit; gfn += batch )
+        scan_batch(domid, gfn,
+                   max_gpfn - gfn + 1 < batch ? max_gpfn - gfn + 1 : batch);
+}
+
+/* Scan either the given domains, or every HAP guest but dom0. */
+static void scan_pass(int nr_doms, domid_t *doms)
+{
+    static xc_dominfo_t info[MAX_DOMAINS];
+    int i, nr;
+
+    if ( nr_doms )
+    {
+        for ( i = 0; i < nr_doms && !quit; i++ )
+            scan_domain(doms[i]);
+        return;
+    }
+
+    nr = xc_domain_getinfo(xch, 1, MAX_DOMAINS, info);
+    for ( i = 0; i < nr && !quit; i++ )
+        if ( info[i].hvm && info[i].hap && !info[i].dying )
+            scan_domain(info[i].domid);
+}
+
+static void daemonize(void)
+{
+    switch ( fork() )
+    {
+    case -1:
+        err(1, "fork");
+    case 0:
+        break;
+    default:
+        exit(0);
+    }
+    umask(0);
+    if ( setsid() < 0 )
+        err(1, "setsid");
+    if ( chdir("/") < 0 )
+        err(1, "chdir /");
+    if ( freopen("/dev/null", "r", stdin) == NULL ||
+         freopen("/dev/null", "w", stdout) == NULL ||
+         freopen("/dev/null", "w", stderr) == NULL )
+        err(1, "reopen stdio");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] [domid...]\n"
+            "Share identical pages between HVM guests (all HAP guests but\n"
+            "dom0 unless domains are given).\n"
+            "  -b <pages>   pages mapped per batch (default %u)\n"
+            "  -c <percent> CPU budget, percent of one CPU (default %u)\n"
+            "  -i <secs>    delay between passes (default %u)\n"
+            "  -t <order>   log2 of hash table entries (default %u)\n"
+            "  -o           make a single pass and exit\n"
+            "  -F           stay in the foreground\n"
+            "  -v           log statistics after each pass\n",
+            prog, DEFAULT_BATCH, DEFAULT_CPU, DEFAULT_INTERVAL,
+            DEFAULT_TABLE_ORDER);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int interval = DEFAULT_INTERVAL, order = DEFAULT_TABLE_ORDER;
+    int opt, once = 0, foreground = 0, nr_doms, i;
+    domid_t doms[MAX_DOMAINS];
+    unsigned long e;
+
+    while ( (opt = getopt(argc, argv, "b:c:i:t:oFvh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cpu_pct = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            order = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            once = 1;
+            break;
+        case 'F':
+            foreground = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( !batch || !cpu_pct || order < 8 || order > 30 )
+        usage(argv[0]);
+
+    nr_doms = argc - optind;
+    if ( nr_doms > MAX_DOMAINS )
+        errx(1, "too many domains");
+    for ( i = 0; i < nr_doms; i++ )
+        doms[i] = strtoul(argv[optind + i], NULL, 0);
+
+    table_mask = (1UL << order) - 1;
+    table = malloc((table_mask + 1) * sizeof(*table));
+    pfns = malloc(batch * sizeof(*pfns));
+    errs = malloc(batch * sizeof(*errs));
+    cands = malloc(batch * sizeof(*cands));
+    if ( !table || !pfns || !errs || !cands )
+        errx(1, "out of memory");
+    for ( e = 0; e <= table_mask; e++ )
+        table[e].domid = DOMID_INVALID;
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+    fmem = xenforeignmemory_open(NULL, 0);
+    if ( !fmem )
+        err(1, "xenforeignmemory_open");
+
+    if ( !foreground && !once )
+        daemonize();
+
+    openlog("xen-memshrd", LOG_PID, LOG_DAEMON);
+    signal(SIGTERM, catch_exit);
+    signal(SIGINT, catch_exit);
+
+    while ( !quit )
+    {
+        scan_pass(nr_doms, doms);
+
+        if ( verbose )
+            syslog(LOG_INFO, "scanned %lu pages, shared %lu, mismatched %lu",
+                   nr_scanned, nr_shared, nr_mismatched);
+
+        if ( once )
+            break;
+        sleep(interval);
+    }
+
+    xenforeignmemory_close(fmem);
+    xc_interface_close(xch);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -118,6 +118,11 @@ void parse_global(char *s)
     unsigned long long pcd_tot_csize = parse(s,"Gz");
     unsigned long long deduped_puts = parse(s,"Gd");
     unsigned long long tot_good_eph_puts = parse(s,"Ep");
+    unsigned long long compress_attempts = parse(s,"Ca");
+    unsigned long long compress_skipped = parse(s,"Ck");
+    unsigned long long zero_pages = parse(s,"Zp");
+    unsigned long long compress_cycles = parse(s,"Ct");
+    unsigned long long compress_saved = parse(s,"Cb");
 
     printf("total tmem ops=%llu (errors=%llu) -- tmem pages avail=%llu\n",
            total_ops, errored_ops, avail_pages);
@@ -151,6 +156,17 @@ void parse_global(char *s)
            evicted_pgs, evict_attempts, relinq_pgs, relinq_attempts,
            max_evicts_per_relinq, total_flush_pool,
            global_eph_count, global_eph_max);
+    if (compress_attempts || zero_pages)
+    {
+           printf("compression: attempts=%llu skipped=%llu zero_pages=%llu "
+                  "saved=%llu bytes",
+                  compress_attempts, compress_skipped, zero_pages,
+                  compress_saved);
+           if (compress_saved)
+               printf(" cycles/saved byte=%4.2f",
+                      (compress_cycles*1.0)/compress_saved);
+           printf("\n");
+    }
 }
 
 #define PARSE_CYC_COUNTER(s,x,prefix) unsigned long long \
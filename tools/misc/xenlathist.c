@@ -0,0 +1,254 @@
+/*
+ * xenlathist.c
+ *
+ * Print percentiles of the hypervisor's latency histograms: HVM exit
+ * handling per exit reason, hypercall handling per hypercall, vCPU
+ * wakeup to run and softirq raise to handling per softirq.
+ *
+ * Each histogram is log2 bucketed, so percentiles are interpolated linearly
+ * within the bucket they fall in and are correct to within a factor of 2.
+ */
+
+#include <xenctrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define NR_BUCKETS XEN_SYSCTL_LATHIST_BUCKETS
+
+#define X(name) [__HYPERVISOR_##name] = #name
+static const char *hypercall_name_table[64] =
+{
+    X(set_trap_table),
+    X(mmu_update),
+    X(set_gdt),
+    X(stack_switch),
+    X(set_callbacks),
+    X(fpu_taskswitch),
+    X(sched_op_compat),
+    X(platform_op),
+    X(set_debugreg),
+    X(get_debugreg),
+    X(update_descriptor),
+    X(memory_op),
+    X(multicall),
+    X(update_va_mapping),
+    X(set_timer_op),
+    X(event_channel_op_compat),
+    X(xen_version),
+    X(console_io),
+    X(physdev_op_compat),
+    X(grant_table_op),
+    X(vm_assist),
+    X(update_va_mapping_otherdomain),
+    X(iret),
+    X(vcpu_op),
+    X(set_segment_base),
+    X(mmuext_op),
+    X(xsm_op),
+    X(nmi_op),
+    X(sched_op),
+    X(callback_op),
+    X(xenoprof_op),
+    X(event_channel_op),
+    X(physdev_op),
+    X(hvm_op),
+    X(sysctl),
+    X(domctl),
+    X(kexec_op),
+    X(arch_0),
+    X(arch_1),
+    X(arch_2),
+    X(arch_3),
+    X(arch_4),
+    X(arch_5),
+    X(arch_6),
+    X(arch_7),
+};
+#undef X
+
+static const struct {
+    uint32_t type;
+    const char *title;
+} types[] = {
+    { XEN_SYSCTL_LATHIST_vmexit,    "HVM exit handling (by exit reason)" },
+    { XEN_SYSCTL_LATHIST_hypercall, "Hypercall handling" },
+    { XEN_SYSCTL_LATHIST_wakeup,    "vCPU wakeup to run" },
+    { XEN_SYSCTL_LATHIST_softirq,   "Softirq raise to handling" },
+};
+
+static const double percentiles[] = { 50, 90, 99, 99.9 };
+
+static void print_ns(double ns)
+{
+    if ( ns < 1e3 )
+        printf(" %8.0fns", ns);
+    else if ( ns < 1e6 )
+        printf(" %8.1fus", ns / 1e3);
+    else
+        printf(" %8.1fms", ns / 1e6);
+}
+
+/* The value below which @pct percent of the samples fall. */
+static double percentile(const uint64_t *b, uint64_t total, double pct)
+{
+    double rank = total * pct / 100, lo, hi;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    for ( i = 0; i < NR_BUCKETS; i++ )
+    {
+        if ( b[i] && seen + b[i] >= rank )
+            break;
+        seen += b[i];
+    }
+
+    if ( i == NR_BUCKETS )
+        i--;
+
+    lo = i ? (double)(1ULL << i) : 0;
+    hi = (double)(1ULL << (i + 1));
+
+    return lo + (hi - lo) * (rank - seen) / (b[i] ?: 1);
+}
+
+static void print_hist(const char *name, const uint64_t *b, int full)
+{
+    uint64_t total = 0;
+    unsigned int i, last = 0;
+
+    for ( i = 0; i < NR_BUCKETS; i++ )
+    {
+        total += b[i];
+        if ( b[i] )
+            last = i;
+    }
+
+    if ( !total )
+        return;
+
+    printf("  %-30s %12"PRIu64, name, total);
+    for ( i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++ )
+        print_ns(percentile(b, total, percentiles[i]));
+    print_ns((double)(1ULL << (last + 1)));
+    printf("\n");
+
+    if ( !full )
+        return;
+
+    for ( i = 0; i <= last; i++ )
+        if ( b[i] )
+            printf("    < 2^%-2u ns %12"PRIu64"\n", i + 1, b[i]);
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface *xc_handle;
+    uint32_t t, i, nr, reset = 0, full = 0;
+    char name[40];
+    DECLARE_HYPERCALL_BUFFER(uint64_t, buckets);
+
+    if ( argc > 1 )
+    {
+        if ( !strcmp(argv[1], "-r") )
+            reset = 1;
+        else if ( !strcmp(argv[1], "-f") )
+            full = 1;
+        else
+        {
+            printf("%s: [-f|-r]\n", argv[0]);
+            printf("no args: print latency percentiles\n");
+            printf("    -f : also print the histogram buckets\n");
+            printf("    -r : reset the histograms\n");
+            return 1;
+        }
+    }
+
+    if ( (xc_handle = xc_interface_open(0,0,0)) == 0 )
+    {
+        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( reset )
+    {
+        if ( xc_lathist_reset(xc_handle) != 0 )
+        {
+            fprintf(stderr, "Error resetting histograms: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    for ( t = 0; t < sizeof(types) / sizeof(types[0]); t++ )
+    {
+        if ( xc_lathist_query_number(xc_handle, types[t].type, &nr) != 0 )
+        {
+            fprintf(stderr, "Error getting number of histograms: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+
+        buckets = xc_hypercall_buffer_alloc(xc_handle, buckets,
+                                            nr * NR_BUCKETS *
+                                            sizeof(*buckets));
+        if ( buckets == NULL )
+        {
+            fprintf(stderr, "Could not allocate buffer: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+
+        if ( xc_lathist_query(xc_handle, types[t].type, &nr,
+                              HYPERCALL_BUFFER(buckets)) != 0 )
+        {
+            fprintf(stderr, "Error getting histograms: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+
+        printf("%s\n  %-30s %12s %10s %10s %10s %10s %10s\n", types[t].title,
+               "", "samples", "p50", "p90", "p99", "p99.9", "max");
+
+        for ( i = 0; i < nr; i++ )
+        {
+            switch ( types[t].type )
+            {
+            case XEN_SYSCTL_LATHIST_vmexit:
+                snprintf(name, sizeof(name), "exit %#x%s", i,
+                         i == nr - 1 ? " (and above)" : "");
+                break;
+
+            case XEN_SYSCTL_LATHIST_hypercall:
+                if ( i < 64 && hypercall_name_table[i] )
+                    snprintf(name, sizeof(name), "%s",
+                             hypercall_name_table[i]);
+                else
+                    snprintf(name, sizeof(name), "[%u]", i);
+                break;
+
+            case XEN_SYSCTL_LATHIST_softirq:
+                snprintf(name, sizeof(name), "softirq %u", i);
+                break;
+
+            default:
+                snprintf(name, sizeof(name), "all");
+                break;
+            }
+
+            print_hist(name, buckets + i * NR_BUCKETS, full);
+        }
+
+        printf("\n");
+
+        xc_hypercall_buffer_free(xc_handle, buckets);
+    }
+
+    xc_interface_close(xc_handle);
+
+    return 0;
+}
@@ -18,6 +18,78 @@
 #include <string.h>
 #include <inttypes.h>
 
+static const char *const sample_kinds[] = {
+    [LOCKSAMPLE_KIND_SPIN]         = "spin",
+    [LOCKSAMPLE_KIND_READ]         = "read",
+    [LOCKSAMPLE_KIND_WRITE]        = "write",
+    [LOCKSAMPLE_KIND_PERCPU_WRITE] = "percpu write",
+};
+
+static int print_samples(xc_interface *xc_handle)
+{
+    uint32_t i, j, n, rate;
+    uint64_t dropped;
+    DECLARE_HYPERCALL_BUFFER(xc_locksample_data_t, data);
+
+    if ( xc_locksample_query_number(xc_handle, &n) != 0 )
+    {
+        fprintf(stderr, "Error getting number of sampled locks: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    n += 32;    /* just to be sure */
+    data = xc_hypercall_buffer_alloc(xc_handle, data, sizeof(*data) * n);
+    if ( data == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    i = n;
+    if ( xc_locksample_query(xc_handle, &i, &rate, &dropped,
+                             HYPERCALL_BUFFER(data)) != 0 )
+    {
+        fprintf(stderr, "Error getting sampled locks: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( i > n )
+    {
+        printf("data incomplete, %d records are missing!\n\n", i - n);
+        i = n;
+    }
+
+    if ( rate )
+        printf("sampling 1 in %u contended acquisitions\n", rate);
+    else
+        printf("sampling stopped\n");
+    if ( dropped )
+        printf("%"PRIu64" samples dropped for lack of space\n", dropped);
+
+    for ( j = 0; j < i; j++ )
+    {
+        uint32_t k;
+
+        printf("%-50s %-12s: samples:%12"PRIu64", wait avg:%12.3fus, "
+               "max:%12.3fus\n", data[j].name,
+               data[j].kind < sizeof(sample_kinds) / sizeof(sample_kinds[0]) ?
+               sample_kinds[data[j].kind] : "?",
+               data[j].samples,
+               (double)data[j].wait_time / data[j].samples / 1E+03,
+               (double)data[j].wait_max / 1E+03);
+        for ( k = 0; k < data[j].nr_callers; k++ )
+            printf("    %-60s %12"PRIu64"\n", data[j].callers[k].name,
+                   data[j].callers[k].samples);
+    }
+
+    xc_hypercall_buffer_free(xc_handle, data);
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     xc_interface      *xc_handle;
@@ -27,11 +99,18 @@ int main(int argc, char *argv[])
     char               name[60];
     DECLARE_HYPERCALL_BUFFER(xc_lockprof_data_t, data);
 
-    if ( (argc > 2) || ((argc == 2) && (strcmp(argv[1], "-r") != 0)) )
+    if ( (argc > 3) ||
+         ((argc == 3) && (strcmp(argv[1], "-s") != 0)) ||
+         ((argc == 2) && (strcmp(argv[1], "-r") != 0) &&
+          (strcmp(argv[1], "-c") != 0) && (strcmp(argv[1], "-C") != 0)) )
     {
-        printf("%s: [-r]\n", argv[0]);
+        printf("%s: [-r | -s <rate> | -c | -C]\n", argv[0]);
         printf("no args: print lock profile data\n");
         printf("    -r : reset profile data\n");
+        printf("    -s : sample 1 in <rate> contended lock acquisitions, "
+               "0 to stop\n");
+        printf("    -c : print sampled lock class data\n");
+        printf("    -C : reset sampled lock class data\n");
         return 1;
     }
 
@@ -42,6 +121,31 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if ( argc > 2 )
+    {
+        if ( xc_locksample_start(xc_handle, strtoul(argv[2], NULL, 0)) != 0 )
+        {
+            fprintf(stderr, "Error setting lock sampling: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    if ( argc > 1 && !strcmp(argv[1], "-c") )
+        return print_samples(xc_handle);
+
+    if ( argc > 1 && !strcmp(argv[1], "-C") )
+    {
+        if ( xc_locksample_reset(xc_handle) != 0 )
+        {
+            fprintf(stderr, "Error reseting sampled data: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
     if ( argc > 1 )
     {
         if ( xc_lockprof_reset(xc_handle) != 0 )
@@ -77,6 +77,7 @@ int main(int argc, char *argv[])
     xc_perfc_val_t  *val;
     int num_desc, num_val;
     unsigned int    sum, reset = 0, full = 0, pretty = 0;
+    long            domid = -1;
     char hypercall_name[36];
 
     if ( argc > 1 )
@@ -96,6 +97,12 @@ int main(int argc, char *argv[])
             case 'r':
                 reset = 1;
                 break;
+            case 'd':
+                if ( argc < 3 )
+                    goto error;
+                domid = strtol(argv[2], NULL, 0);
+                full = 1;
+                break;
             default:
                 goto error;
             }
@@ -103,11 +110,13 @@ int main(int argc, char *argv[])
         else
         {
         error:
-            printf("%s: [-r]\n", argv[0]);
+            printf("%s: [-r] [-d domid]\n", argv[0]);
             printf("no args: print digested counters\n");
             printf("    -f : print full arrays/histograms\n");
             printf("    -p : print full arrays/histograms in pretty format\n");
             printf("    -r : reset counters\n");
+            printf("    -d : print the counters of one domain, per vCPU\n");
+            printf("         (needs Xen booted with perfc_domain)\n");
             return 0;
         }
     }   
@@ -131,7 +140,10 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    if ( xc_perfc_query_number(xc_handle, &num_desc, &num_val) != 0 )
+    if ( (domid >= 0
+          ? xc_perfc_query_domain_number(xc_handle, domid,
+                                         &num_desc, &num_val)
+          : xc_perfc_query_number(xc_handle, &num_desc, &num_val)) != 0 )
     {
         fprintf(stderr, "Error getting number of perf counters: %d (%s)\n",
                 errno, strerror(errno));
@@ -148,7 +160,11 @@ int main(int argc, char *argv[])
         exit(-1);
     }
 
-    if ( xc_perfc_query(xc_handle, HYPERCALL_BUFFER(pcd), HYPERCALL_BUFFER(pcv)) != 0 )
+    if ( (domid >= 0
+          ? xc_perfc_query_domain(xc_handle, domid, HYPERCALL_BUFFER(pcd),
+                                  HYPERCALL_BUFFER(pcv))
+          : xc_perfc_query(xc_handle, HYPERCALL_BUFFER(pcd),
+                           HYPERCALL_BUFFER(pcv))) != 0 )
     {
         fprintf(stderr, "Error getting perf counter: %d (%s)\n",
                 errno, strerror(errno));
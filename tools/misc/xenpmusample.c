@@ -0,0 +1,377 @@
+/*
+ * xenpmusample.c
+ *
+ * Sample Xen, and optionally one domain's guest context, on host PMU
+ * overflow, and print the samples either as folded stacks, ready for
+ * flamegraph.pl, or in the format of "perf script", for stackcollapse-perf.pl
+ * and other perf post-processing.
+ *
+ * Xen addresses are resolved against the hypervisor's own symbol table.
+ * Only instruction pointers are recorded for guest context, which are
+ * printed as they are.
+ */
+
+#include <xenctrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#define NR_RECS   1024
+#define POLL_US   100000
+
+struct sym {
+    uint64_t addr;
+    char *name;
+};
+
+static struct sym *syms;
+static unsigned int nr_syms;
+
+static char **stacks;
+static unsigned int nr_stacks, max_stacks;
+
+static volatile sig_atomic_t interrupted;
+
+static void sigint(int sig)
+{
+    interrupted = 1;
+}
+
+static int sym_cmp(const void *a, const void *b)
+{
+    const struct sym *x = a, *y = b;
+
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* Load the text symbols of the hypervisor, sorted by address. */
+static int load_syms(xc_interface *xch)
+{
+    uint32_t symnum = 0, prev, max = 0;
+    uint64_t addr;
+    char type, name[128];
+
+    for ( ; ; )
+    {
+        prev = symnum;
+        if ( xc_xensyms_read(xch, &symnum, &type, &addr, name, sizeof(name)) )
+            return -1;
+        if ( symnum == prev )
+            break;
+
+        if ( type != 't' && type != 'T' )
+            continue;
+
+        if ( nr_syms == max )
+        {
+            max = max ? max * 2 : 4096;
+            syms = realloc(syms, max * sizeof(*syms));
+            if ( !syms )
+                return -1;
+        }
+
+        name[sizeof(name) - 1] = '\0';
+        syms[nr_syms].addr = addr;
+        syms[nr_syms].name = strdup(name);
+        if ( !syms[nr_syms].name )
+            return -1;
+        nr_syms++;
+    }
+
+    qsort(syms, nr_syms, sizeof(*syms), sym_cmp);
+
+    return 0;
+}
+
+/* The symbol containing @addr, or NULL. */
+static const struct sym *lookup(uint64_t addr)
+{
+    unsigned int lo = 0, hi = nr_syms;
+
+    while ( lo < hi )
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if ( syms[mid].addr <= addr )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo ? &syms[lo - 1] : NULL;
+}
+
+static const char *mode_name(uint8_t mode)
+{
+    switch ( mode )
+    {
+    case XEN_SYSCTL_PMUSAMPLE_MODE_user:   return "guest user";
+    case XEN_SYSCTL_PMUSAMPLE_MODE_kernel: return "guest kernel";
+    default:                               return "xen";
+    }
+}
+
+static void context_name(const xc_pmusample_rec_t *rec, char *buf, size_t len)
+{
+    if ( rec->domid == DOMID_IDLE )
+        snprintf(buf, len, "idle");
+    else
+        snprintf(buf, len, "d%uv%u", rec->domid, rec->vcpu);
+}
+
+/* Print @rec as an event of "perf script". */
+static void print_script(const xc_pmusample_rec_t *rec, uint32_t period,
+                         const char *event)
+{
+    const struct sym *s;
+    char ctx[32];
+    unsigned int i;
+
+    context_name(rec, ctx, sizeof(ctx));
+    printf("%s %u/%u [%03u] %"PRIu64".%06"PRIu64": %u %s:\n",
+           ctx, rec->domid, rec->vcpu, rec->cpu,
+           rec->time / 1000000000, (rec->time % 1000000000) / 1000,
+           period, event);
+
+    for ( i = 0; i < rec->depth && i < XEN_SYSCTL_PMUSAMPLE_DEPTH; i++ )
+    {
+        if ( rec->mode == XEN_SYSCTL_PMUSAMPLE_MODE_xen &&
+             (s = lookup(rec->ip[i])) != NULL )
+            printf("\t%16"PRIx64" %s+0x%"PRIx64" ([xen])\n",
+                   rec->ip[i], s->name, rec->ip[i] - s->addr);
+        else
+            printf("\t%16"PRIx64" [unknown] ([%s])\n",
+                   rec->ip[i], mode_name(rec->mode));
+    }
+
+    printf("\n");
+}
+
+/* Record @rec as a folded stack, outermost frame first. */
+static int add_folded(const xc_pmusample_rec_t *rec)
+{
+    char buf[XEN_SYSCTL_PMUSAMPLE_DEPTH * 136 + 64];
+    const struct sym *s;
+    size_t len;
+    int i;
+
+    context_name(rec, buf, sizeof(buf));
+    len = strlen(buf);
+    len += snprintf(buf + len, sizeof(buf) - len, ";[%s]",
+                    mode_name(rec->mode));
+
+    for ( i = rec->depth - 1; i >= 0 && len < sizeof(buf); i-- )
+    {
+        if ( i >= XEN_SYSCTL_PMUSAMPLE_DEPTH )
+            continue;
+
+        if ( rec->mode == XEN_SYSCTL_PMUSAMPLE_MODE_xen &&
+             (s = lookup(rec->ip[i])) != NULL )
+            len += snprintf(buf + len, sizeof(buf) - len, ";%s", s->name);
+        else
+            len += snprintf(buf + len, sizeof(buf) - len, ";%#"PRIx64,
+                            rec->ip[i]);
+    }
+
+    if ( nr_stacks == max_stacks )
+    {
+        max_stacks = max_stacks ? max_stacks * 2 : 65536;
+        stacks = realloc(stacks, max_stacks * sizeof(*stacks));
+        if ( !stacks )
+            return -1;
+    }
+
+    stacks[nr_stacks] = strdup(buf);
+    if ( !stacks[nr_stacks] )
+        return -1;
+    nr_stacks++;
+
+    return 0;
+}
+
+static int str_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void print_folded(void)
+{
+    unsigned int i, n;
+
+    qsort(stacks, nr_stacks, sizeof(*stacks), str_cmp);
+
+    for ( i = 0; i < nr_stacks; i += n )
+    {
+        for ( n = 1; i + n < nr_stacks && !strcmp(stacks[i], stacks[i + n]);
+              n++ )
+            ;
+        printf("%s %u\n", stacks[i], n);
+    }
+}
+
+static void usage(const char *prog)
+{
+    printf("%s: [-e cycles|instructions] [-p period] [-d domid] [-t secs] "
+           "[-s]\n", prog);
+    printf("Sample Xen (and the guest context of domid) and print folded\n");
+    printf("stacks for flamegraph.pl\n");
+    printf("    -e : event to sample on (default cycles)\n");
+    printf("    -p : events per sample (default 1000000)\n");
+    printf("    -d : also sample the guest context of this domain\n");
+    printf("    -t : seconds to sample for, or until interrupted (default 10)\n");
+    printf("    -s : print samples as \"perf script\" does instead\n");
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface *xch;
+    uint32_t event = XEN_SYSCTL_PMUSAMPLE_EVENT_cycles, period = 1000000;
+    uint32_t domid = DOMID_INVALID, nr, i;
+    unsigned int secs = 10, script = 0, done = 0;
+    int max_cpus, cpu, opt, rc = 1;
+    uint64_t lost, total_lost = 0, nr_samples = 0;
+    struct timeval start, now;
+    DECLARE_HYPERCALL_BUFFER(xc_pmusample_rec_t, recs);
+
+    while ( (opt = getopt(argc, argv, "e:p:d:t:sh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'e':
+            if ( !strcmp(optarg, "cycles") )
+                event = XEN_SYSCTL_PMUSAMPLE_EVENT_cycles;
+            else if ( !strcmp(optarg, "instructions") )
+                event = XEN_SYSCTL_PMUSAMPLE_EVENT_instructions;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            period = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            domid = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            secs = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            script = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt != 'h';
+        }
+    }
+
+    if ( (xch = xc_interface_open(0,0,0)) == 0 )
+    {
+        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( load_syms(xch) )
+    {
+        fprintf(stderr, "Error reading hypervisor symbols: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    if ( (max_cpus = xc_get_max_cpus(xch)) <= 0 )
+    {
+        fprintf(stderr, "Error getting number of CPUs: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    recs = xc_hypercall_buffer_alloc(xch, recs, NR_RECS * sizeof(*recs));
+    if ( recs == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffer: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    if ( xc_pmusample_start(xch, event, period, domid) )
+    {
+        fprintf(stderr, "Error starting sampling: %d (%s)\n",
+                errno, strerror(errno));
+        goto out_free;
+    }
+
+    signal(SIGINT, sigint);
+    gettimeofday(&start, NULL);
+
+    while ( !done )
+    {
+        usleep(POLL_US);
+
+        gettimeofday(&now, NULL);
+        if ( interrupted || (secs && now.tv_sec - start.tv_sec >= secs) )
+        {
+            /* Stop first, so that the last records are drained below. */
+            xc_pmusample_stop(xch);
+            done = 1;
+        }
+
+        for ( cpu = 0; cpu < max_cpus; cpu++ )
+        {
+            lost = 0;
+            do {
+                nr = NR_RECS;
+                if ( xc_pmusample_read(xch, cpu, &nr, &lost,
+                                       HYPERCALL_BUFFER(recs)) )
+                {
+                    /* Offline CPUs have no ring. */
+                    if ( errno == ENODATA )
+                        break;
+                    fprintf(stderr, "Error reading samples: %d (%s)\n",
+                            errno, strerror(errno));
+                    xc_pmusample_stop(xch);
+                    goto out_free;
+                }
+
+                for ( i = 0; i < nr; i++ )
+                {
+                    if ( script )
+                        print_script(&recs[i], period,
+                                     event == XEN_SYSCTL_PMUSAMPLE_EVENT_cycles
+                                     ? "cycles" : "instructions");
+                    else if ( add_folded(&recs[i]) )
+                    {
+                        fprintf(stderr, "Out of memory\n");
+                        xc_pmusample_stop(xch);
+                        goto out_free;
+                    }
+                }
+                nr_samples += nr;
+            } while ( nr == NR_RECS );
+
+            if ( done )
+                total_lost += lost;
+        }
+    }
+
+    if ( !script )
+        print_folded();
+
+    fprintf(stderr, "%"PRIu64" samples, %"PRIu64" lost\n",
+            nr_samples, total_lost);
+    rc = 0;
+
+ out_free:
+    xc_hypercall_buffer_free(xch, recs);
+ out:
+    xc_interface_close(xch);
+
+    return rc;
+}
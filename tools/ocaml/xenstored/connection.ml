@@ -37,6 +37,8 @@ and t = {
 	mutable nb_watches: int;
 	anonid: int;
 	mutable stat_nb_ops: int;
+	mutable stat_nb_commits: int;
+	mutable stat_nb_aborts: int;
 	mutable perm: Perms.Connection.t;
 }
 
@@ -56,6 +58,8 @@ let reconnect con =
 	(* anonid is the same *)
 	con.nb_watches <- 0;
 	con.stat_nb_ops <- 0;
+	con.stat_nb_commits <- 0;
+	con.stat_nb_aborts <- 0;
 	(* perm is the same *)
 	()
 
@@ -108,6 +112,8 @@ let create xbcon dom =
 	nb_watches = 0;
 	anonid = id;
 	stat_nb_ops = 0;
+	stat_nb_commits = 0;
+	stat_nb_aborts = 0;
 	perm = make_perm dom;
 	}
 	in 
@@ -236,7 +242,12 @@ let end_transaction con tid commit =
 	match commit with
 	| None -> true
 	| Some transaction_replay_f ->
-		Transaction.commit ~con:(get_domstr con) trans || transaction_replay_f con trans
+		let success =
+			Transaction.commit ~con:(get_domstr con) trans || transaction_replay_f con trans in
+		if success
+		then con.stat_nb_commits <- con.stat_nb_commits + 1
+		else con.stat_nb_aborts <- con.stat_nb_aborts + 1;
+		success
 
 let get_transaction con tid =
 	Hashtbl.find con.transactions tid
@@ -263,6 +274,10 @@ let mark_symbols con =
 let stats con =
 	Hashtbl.length con.watches, con.stat_nb_ops
 
+let debug_transactions con =
+	Printf.sprintf "transactions %s: %d committed, %d aborted\n"
+		(get_domstr con) con.stat_nb_commits con.stat_nb_aborts
+
 let dump con chan =
 	match con.dom with
 	| Some dom -> 
@@ -187,3 +187,8 @@ let debug cons =
 	let anonymous = Hashtbl.fold (fun _ con accu -> Connection.debug con :: accu) cons.anonymous [] in
 	let domains = Hashtbl.fold (fun _ con accu -> Connection.debug con :: accu) cons.domains [] in
 	String.concat "" (domains @ anonymous)
+
+let debug_transactions cons =
+	let anonymous = Hashtbl.fold (fun _ con accu -> Connection.debug_transactions con :: accu) cons.anonymous [] in
+	let domains = Hashtbl.fold (fun _ con accu -> Connection.debug_transactions con :: accu) cons.domains [] in
+	String.concat "" (domains @ anonymous)
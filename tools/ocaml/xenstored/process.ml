@@ -95,6 +95,9 @@ let do_debug con t domains cons data =
 	| "watches" :: _ ->
 		let watches = Connections.debug cons in
 		Some (watches ^ "\000")
+	| "transactions" :: _ ->
+		let transactions = Connections.debug_transactions cons in
+		Some (transactions ^ "\000")
 	| "mfn" :: domid :: _ ->
 		let domid = int_of_string domid in
 		let con = Connections.find_domain cons domid in
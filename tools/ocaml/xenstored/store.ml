@@ -147,6 +147,13 @@ let get_common_prefix p1 p2 =
 		in
 	compare p1 p2
 
+(* whether p1 is p2 or one of its ancestors *)
+let rec is_prefix p1 p2 =
+	match p1, p2 with
+	| [], _ -> true
+	| h1 :: tl1, h2 :: tl2 -> h1 = h2 && is_prefix tl1 tl2
+	| _ :: _, [] -> false
+
 let rec lookup_modify node path fct =
 	match path with
 	| []      -> raise (Define.Invalid_path)
@@ -377,6 +384,13 @@ let set_node store path node orig_quota mod_quota =
 	store.root <- root;
 	Quota.merge orig_quota mod_quota store.quota
 
+(* as set_node, for several disjoint subtrees *)
+let set_nodes store nodes orig_quota mod_quota =
+	let root = List.fold_left (fun root (path, node) ->
+		Path.set_node root path node) store.root nodes in
+	store.root <- root;
+	Quota.merge orig_quota mod_quota store.quota
+
 let write store perm path value =
 	let node, existing = get_deepest_existing_node store path in
 	let owner = Node.get_owner node in
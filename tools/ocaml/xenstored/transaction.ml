@@ -33,10 +33,11 @@ let check_parents_perms_identical root1 root2 path =
 	) false hierarch in
 	(not permdiff)
 
-let get_lowest path1 path2 =
-	match path2 with
-	| None       -> Some path1
-	| Some path2 -> Some (Store.Path.get_common_prefix path1 path2)
+(* a path stands for its whole subtree, so only the topmost paths are kept *)
+let add_path paths path =
+	if List.exists (fun p -> Store.Path.is_prefix p path) paths
+	then paths
+	else path :: List.filter (fun p -> not (Store.Path.is_prefix path p)) paths
 
 let test_coalesce oldroot currentroot optpath =
 	match optpath with
@@ -77,8 +78,8 @@ type t = {
 	quota: Quota.t;
 	mutable paths: (Xenbus.Xb.Op.operation * Store.Path.t) list;
 	mutable operations: (Packet.request * Packet.response) list;
-	mutable read_lowpath: Store.Path.t option;
-	mutable write_lowpath: Store.Path.t option;
+	mutable read_paths: Store.Path.t list;
+	mutable write_paths: Store.Path.t list;
 }
 
 let make id store =
@@ -89,8 +90,8 @@ let make id store =
 		quota = Quota.copy store.Store.quota;
 		paths = [];
 		operations = [];
-		read_lowpath = None;
-		write_lowpath = None;
+		read_paths = [];
+		write_paths = [];
 	}
 
 let get_id t = match t.ty with No -> none | Full (id, _, _) -> id
@@ -105,8 +106,8 @@ let add_operation ~perm t request response =
 		then raise Quota.Limit_reached;
 	t.operations <- (request, response) :: t.operations
 let get_operations t = List.rev t.operations
-let set_read_lowpath t path = t.read_lowpath <- get_lowest path t.read_lowpath
-let set_write_lowpath t path = t.write_lowpath <- get_lowest path t.write_lowpath
+let add_read_path t path = t.read_paths <- add_path t.read_paths path
+let add_write_path t path = t.write_paths <- add_path t.write_paths path
 
 let path_exists t path = Store.path_exists t.store path
 
@@ -114,39 +115,39 @@ let write t perm path value =
 	let path_exists = path_exists t path in
 	Store.write t.store perm path value;
 	if path_exists
-	then set_write_lowpath t path
-	else set_write_lowpath t (Store.Path.get_parent path);
+	then add_write_path t path
+	else add_write_path t (Store.Path.get_parent path);
 	add_wop t Xenbus.Xb.Op.Write path
 
 let mkdir ?(with_watch=true) t perm path =
 	Store.mkdir t.store perm path;
-	set_write_lowpath t path;
+	add_write_path t path;
 	if with_watch then
 		add_wop t Xenbus.Xb.Op.Mkdir path
 
 let setperms t perm path perms =
 	Store.setperms t.store perm path perms;
-	set_write_lowpath t path;
+	add_write_path t path;
 	add_wop t Xenbus.Xb.Op.Setperms path
 
 let rm t perm path =
 	Store.rm t.store perm path;
-	set_write_lowpath t (Store.Path.get_parent path);
+	add_write_path t (Store.Path.get_parent path);
 	add_wop t Xenbus.Xb.Op.Rm path
 
 let ls t perm path =	
 	let r = Store.ls t.store perm path in
-	set_read_lowpath t path;
+	add_read_path t path;
 	r
 
 let read t perm path =
 	let r = Store.read t.store perm path in
-	set_read_lowpath t path;
+	add_read_path t path;
 	r
 
 let getperms t perm path =
 	let r = Store.getperms t.store perm path in
-	set_read_lowpath t path;
+	add_read_path t path;
 	r
 
 let commit ~con t =
@@ -157,21 +158,26 @@ let commit ~con t =
 	| No                         -> true
 	| Full (id, oldroot, cstore) ->
 		let commit_partial oldroot cstore store =
-			(* get the lowest path of the query and verify that it hasn't
-			   been modified by others transactions. *)
-			if can_coalesce oldroot (Store.get_root cstore) t.read_lowpath
-			&& can_coalesce oldroot (Store.get_root cstore) t.write_lowpath then (
-				maybe (fun p ->
-					let n = Store.get_node store p in
-
-					(* it has to be in the store, otherwise it means bugs
-					   in the lowpath registration. we don't need to handle none. *)
-					maybe (fun n -> Store.set_node cstore p n t.quota store.Store.quota) n;
+			(* verify that none of the subtrees the transaction read or
+			   modified has been modified by others transactions, so
+			   that changes elsewhere in the store don't abort it. *)
+			let unchanged p = can_coalesce oldroot (Store.get_root cstore) (Some p) in
+			if List.for_all unchanged t.read_paths
+			&& List.for_all unchanged t.write_paths then (
+				let nodes = List.fold_left (fun acc p ->
 					Logging.write_coalesce ~tid:(get_id t) ~con (Store.Path.to_string p);
-				) t.write_lowpath;
-				maybe (fun p ->
+					(* it has to be in the store, otherwise it means bugs
+					   in the path registration. we don't need to handle none. *)
+					match Store.get_node store p with
+					| Some n -> (p, n) :: acc
+					| None   -> acc
+				) [] t.write_paths in
+				(match nodes with
+				| [] -> ()
+				| _  -> Store.set_nodes cstore nodes t.quota store.Store.quota);
+				List.iter (fun p ->
 					Logging.read_coalesce ~tid:(get_id t) ~con (Store.Path.to_string p)
-					) t.read_lowpath;
+					) t.read_paths;
 				has_coalesced := true;
 				Store.incr_transaction_coalesce cstore;
 				true
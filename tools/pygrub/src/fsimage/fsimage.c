@@ -107,9 +107,32 @@ PyDoc_STRVAR(fsimage_file_read__doc__,
    "file. If offset is specified as well, read from the given "
    "offset.\n");
 
+static PyObject *
+fsimage_file_stat(fsimage_file_t *file, PyObject *args)
+{
+	fsi_stat_t st;
+
+	if (!PyArg_ParseTuple(args, ""))
+		return (NULL);
+
+	if (fsi_stat_file(file->file, &st) == -1) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return (NULL);
+	}
+
+	return (Py_BuildValue("(KKI)", (unsigned PY_LONG_LONG)st.fst_size,
+	    (unsigned PY_LONG_LONG)st.fst_mtime, (unsigned int)st.fst_gen));
+}
+
+PyDoc_STRVAR(fsimage_file_stat__doc__,
+   "stat(file) - return (size, mtime, generation) for the given file. "
+   "Raises IOError if the filesystem plugin cannot tell.\n");
+
 static struct PyMethodDef fsimage_file_methods[] = {
 	{ "read", (PyCFunction) fsimage_file_read,
 	    METH_VARARGS|METH_KEYWORDS, fsimage_file_read__doc__ },
+	{ "stat", (PyCFunction) fsimage_file_stat,
+	    METH_VARARGS, fsimage_file_stat__doc__ },
 	{ NULL, NULL, 0, NULL }	
 };
 
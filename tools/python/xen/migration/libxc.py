@@ -61,6 +61,10 @@ REC_TYPE_x86_pv_vcpu_msrs           = 0x0000000c
 REC_TYPE_verify                     = 0x0000000d
 REC_TYPE_checkpoint                 = 0x0000000e
 REC_TYPE_checkpoint_dirty_pfn_list  = 0x0000000f
+REC_TYPE_page_data_compressed       = 0x00000010
+REC_TYPE_page_data_zero             = 0x00000011
+REC_TYPE_page_data_delta            = 0x00000012
+REC_TYPE_page_data_aligned          = 0x00000013
 
 rec_type_to_str = {
     REC_TYPE_end                        : "End",
@@ -78,7 +82,11 @@ rec_type_to_str = {
     REC_TYPE_x86_pv_vcpu_msrs           : "x86 PV vcpu msrs",
     REC_TYPE_verify                     : "Verify",
     REC_TYPE_checkpoint                 : "Checkpoint",
-    REC_TYPE_checkpoint_dirty_pfn_list  : "Checkpoint dirty pfn list"
+    REC_TYPE_checkpoint_dirty_pfn_list  : "Checkpoint dirty pfn list",
+    REC_TYPE_page_data_compressed       : "Page data compressed",
+    REC_TYPE_page_data_zero             : "Page data zero",
+    REC_TYPE_page_data_delta            : "Page data delta",
+    REC_TYPE_page_data_aligned          : "Page data aligned",
 }
 
 # page_data
@@ -238,8 +246,11 @@ class VerifyLibxc(VerifyBase):
             raise RecordError("End record with non-zero length")
 
 
-    def verify_record_page_data(self, content):
-        """ Page Data record """
+    def verify_page_data_pfns(self, content, has_offset = False):
+        """ Common header and pfn array of the Page Data records.  Returns
+        the size of the header and pfn array, and the number of pages of
+        data which should follow.  With has_offset, the reserved field of
+        the header holds an offset instead, which isn't checked """
         minsz = calcsize(PAGE_DATA_FORMAT)
 
         if len(content) <= minsz:
@@ -248,7 +259,7 @@ class VerifyLibxc(VerifyBase):
 
         count, res1 = unpack(PAGE_DATA_FORMAT, content[:minsz])
 
-        if res1 != 0:
+        if res1 != 0 and not has_offset:
             raise StreamError("Reserved bits set in PAGE_DATA record 0x%04x"
                               % (res1, ))
 
@@ -275,10 +286,86 @@ class VerifyLibxc(VerifyBase):
                     <= PAGE_DATA_TYPE_L4TAB:
                 nr_pages += 1
 
+        return minsz + pfnsz, nr_pages
+
+
+    def verify_record_page_data(self, content):
+        """ Page Data record """
+
+        hdrsz, nr_pages = self.verify_page_data_pfns(content)
+
         pagesz = nr_pages * 4096
-        if len(content) != minsz + pfnsz + pagesz:
+        if len(content) != hdrsz + pagesz:
+            raise RecordError("Expected %u + %u, got %u"
+                              % (hdrsz, pagesz, len(content)))
+
+
+    def verify_record_page_data_compressed(self, content):
+        """ Page Data Compressed record """
+
+        hdrsz, nr_pages = self.verify_page_data_pfns(content)
+
+        lensz = nr_pages * 4
+        if len(content) < hdrsz + lensz:
+            raise RecordError("PAGE_DATA_COMPRESSED record must contain a "
+                              "length for each page of data")
+
+        lens = list(unpack("=%dI" % (nr_pages, ),
+                           content[hdrsz:hdrsz + lensz]))
+
+        for idx, length in enumerate(lens):
+            if not 0 < length <= 4096:
+                raise RecordError("Invalid length for page %d: %u"
+                                  % (idx, length))
+
+        datasz = sum(lens)
+        if len(content) != hdrsz + lensz + datasz:
             raise RecordError("Expected %u + %u + %u, got %u"
-                              % (minsz, pfnsz, pagesz, len(content)))
+                              % (hdrsz, lensz, datasz, len(content)))
+
+
+    def verify_record_page_data_zero(self, content):
+        """ Page Data Zero record """
+
+        hdrsz, _ = self.verify_page_data_pfns(content)
+
+        if len(content) != hdrsz:
+            raise RecordError("Expected %u, got %u" % (hdrsz, len(content)))
+
+
+    def verify_record_page_data_aligned(self, content):
+        """ Page Data Aligned record """
+
+        hdrsz, nr_pages = self.verify_page_data_pfns(content, True)
+
+        _, offset = unpack(PAGE_DATA_FORMAT,
+                           content[:calcsize(PAGE_DATA_FORMAT)])
+
+        if offset < hdrsz:
+            raise RecordError("Data offset %u overlaps the pfn array of %u"
+                              % (offset, hdrsz))
+
+        padding = content[hdrsz:offset]
+        if padding != "\x00" * len(padding):
+            raise StreamError("Padding containing non0 bytes found")
+
+        pagesz = nr_pages * 4096
+        if len(content) != offset + pagesz:
+            raise RecordError("Expected %u + %u, got %u"
+                              % (offset, pagesz, len(content)))
+
+
+    def verify_record_page_data_delta(self, content):
+        """ Page Data Delta record """
+
+        hdrsz, nr_pages = self.verify_page_data_pfns(content)
+
+        # Each page takes at least one octet, and at most a page and 9 run
+        # headers.  The encoding itself can only be checked against the
+        # previous contents of the pages.
+        if not hdrsz + nr_pages <= len(content) <= hdrsz + nr_pages * 4105:
+            raise RecordError("Invalid length %u for %u pages of delta data"
+                              % (len(content) - hdrsz, nr_pages))
 
 
     def verify_record_x86_pv_info(self, content):
@@ -451,4 +538,12 @@ record_verifiers = {
         VerifyLibxc.verify_record_checkpoint,
     REC_TYPE_checkpoint_dirty_pfn_list:
         VerifyLibxc.verify_record_checkpoint_dirty_pfn_list,
+    REC_TYPE_page_data_compressed:
+        VerifyLibxc.verify_record_page_data_compressed,
+    REC_TYPE_page_data_zero:
+        VerifyLibxc.verify_record_page_data_zero,
+    REC_TYPE_page_data_delta:
+        VerifyLibxc.verify_record_page_data_delta,
+    REC_TYPE_page_data_aligned:
+        VerifyLibxc.verify_record_page_data_aligned,
     }
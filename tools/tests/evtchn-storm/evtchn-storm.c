@@ -0,0 +1,188 @@
+/*
+ * evtchn-storm: generate a storm of vcpu wakeups in the calling domain.
+ *
+ * Pairs of threads bounce notifications across loopback interdomain event
+ * channels. Every notification is an upcall into the domain, and, with
+ * more threads than vcpus, most of them cause a vcpu to block and wake up
+ * again, which exercises the scheduler's wakeup path (e.g. runq_tickle()
+ * in credit2). Run it in dom0 together with xenlockprof and xenperf to
+ * look at runqueue lock contention and tickling statistics.
+ *
+ * Usage: evtchn-storm [-p <pairs>] [-t <seconds>]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xenevtchn.h>
+#include <xen/xen.h>
+
+struct end {
+    xenevtchn_handle *xce;
+    evtchn_port_t port;
+    unsigned long count;
+    int starter;
+};
+
+static volatile int stop;
+
+static void *pingpong(void *arg)
+{
+    struct end *e = arg;
+    struct pollfd pfd = { .fd = xenevtchn_fd(e->xce), .events = POLLIN };
+
+    if ( e->starter && xenevtchn_notify(e->xce, e->port) < 0 )
+    {
+        perror("xenevtchn_notify");
+        return NULL;
+    }
+
+    while ( !stop )
+    {
+        xenevtchn_port_or_error_t port;
+
+        /* Time out now and then, so that we notice when to stop. */
+        if ( poll(&pfd, 1, 100) <= 0 )
+            continue;
+
+        port = xenevtchn_pending(e->xce);
+        if ( port < 0 )
+        {
+            perror("xenevtchn_pending");
+            break;
+        }
+        xenevtchn_unmask(e->xce, port);
+
+        e->count++;
+        if ( xenevtchn_notify(e->xce, e->port) < 0 )
+        {
+            perror("xenevtchn_notify");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int setup_pair(struct end *a, struct end *b)
+{
+    xenevtchn_port_or_error_t port;
+
+    a->xce = xenevtchn_open(NULL, 0);
+    b->xce = xenevtchn_open(NULL, 0);
+    if ( !a->xce || !b->xce )
+    {
+        perror("xenevtchn_open");
+        return -1;
+    }
+
+    port = xenevtchn_bind_unbound_port(a->xce, DOMID_SELF);
+    if ( port < 0 )
+    {
+        perror("xenevtchn_bind_unbound_port");
+        return -1;
+    }
+    a->port = port;
+
+    port = xenevtchn_bind_interdomain(b->xce, DOMID_SELF, a->port);
+    if ( port < 0 )
+    {
+        perror("xenevtchn_bind_interdomain");
+        return -1;
+    }
+    b->port = port;
+
+    a->starter = 1;
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-p <pairs>] [-t <seconds>]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int pairs = 0, secs = 10, i;
+    unsigned long total = 0;
+    struct end *ends;
+    pthread_t *threads;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "p:t:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'p':
+            pairs = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            secs = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    /* By default, have twice as many threads as online cpus. */
+    if ( !pairs )
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        pairs = n > 0 ? n : 1;
+    }
+
+    ends = calloc(2 * pairs, sizeof(*ends));
+    threads = calloc(2 * pairs, sizeof(*threads));
+    if ( !ends || !threads )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    for ( i = 0; i < pairs; i++ )
+        if ( setup_pair(&ends[2 * i], &ends[2 * i + 1]) )
+            return 1;
+
+    for ( i = 0; i < 2 * pairs; i++ )
+    {
+        errno = pthread_create(&threads[i], NULL, pingpong, &ends[i]);
+        if ( errno )
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    sleep(secs);
+    stop = 1;
+
+    for ( i = 0; i < 2 * pairs; i++ )
+    {
+        pthread_join(threads[i], NULL);
+        total += ends[i].count;
+        xenevtchn_close(ends[i].xce);
+    }
+
+    printf("%u pairs, %u seconds: %lu notifications, %lu per second\n",
+           pairs, secs, total, secs ? total / secs : total);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
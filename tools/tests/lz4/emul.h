@@ -0,0 +1,35 @@
+/*
+ * Userspace environment for building the hypervisor's LZ4 code, as done
+ * for libxenguest by xc_dom_decompress_lz4.c.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define likely(a) a
+#define unlikely(a) a
+
+#define min_t(type, x, y) \
+    ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+
+static inline uint_fast16_t le16_to_cpup(const unsigned char *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static inline uint_fast32_t le32_to_cpup(const unsigned char *buf)
+{
+    return le16_to_cpup(buf) | ((uint32_t)le16_to_cpup(buf + 2) << 16);
+}
+
+#include "../../../xen/include/xen/lz4.h"
+#include "../../../xen/common/decompress.h"
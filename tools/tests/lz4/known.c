@@ -0,0 +1,8 @@
+/*
+ * The decoder for a known output size, as used by the hypervisor to
+ * decompress boot modules.
+ */
+
+#define __MINIOS__
+#include "emul.h"
+#include "../../../xen/common/lz4/decompress.c"
@@ -0,0 +1,169 @@
+/*
+ * Tests for the hypervisor's LZ4 decoder.
+ *
+ * Builds xen/common/lz4 in userspace, decodes hand-made streams with both
+ * the known output size decoder used for boot modules (known.c) and the
+ * unknown output size one used by the tools, then round trips pages
+ * through the compressor and the latter, as done for migration streams.
+ *
+ * Pages aren't round tripped through the known output size decoder, which
+ * also refuses matches ending less than COPYLENGTH bytes before the end of
+ * the output even though the compressor emits them.
+ */
+
+#include "emul.h"
+#include "../../../xen/common/lz4/compress.c"
+#include "../../../xen/common/lz4/decompress.c"
+
+#define PAGE_SIZE 4096
+
+struct stream {
+    const char *name;
+    const unsigned char *data;
+    size_t len;
+    const char *out;            /* NULL if the stream must be rejected. */
+};
+
+#define LITS12 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p'
+#define STREAM(n, o, ...)                                           \
+    { n, (const unsigned char []){ __VA_ARGS__ },                   \
+      sizeof((const unsigned char []){ __VA_ARGS__ }), o }
+
+static const struct stream streams[] = {
+    /* Matches shorter than STEPSIZE end before the decoder's op. */
+    STREAM("4 byte match, offset 4", "abcdabcdefghijklmnop",
+           0x40, 'a', 'b', 'c', 'd', 0x04, 0x00, 0xc0, LITS12),
+    STREAM("5 byte match, offset 1", "aaaaaaefghijklmnop",
+           0x11, 'a', 0x01, 0x00, 0xc0, LITS12),
+    STREAM("7 byte match, offset 7", "abcdefgabcdefgefghijklmnop",
+           0x73, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 0x07, 0x00, 0xc0, LITS12),
+    STREAM("19 byte match, offset 2", "ababababababababababaefghijklmnop",
+           0x2f, 'a', 'b', 0x02, 0x00, 0x00, 0xc0, LITS12),
+
+    /* Corrupt streams. */
+    STREAM("offset before the output", NULL,
+           0x40, 'a', 'b', 'c', 'd', 0x08, 0x00, 0xc0, LITS12),
+    STREAM("match past the output", NULL,
+           0x4f, 'a', 'b', 'c', 'd', 0x04, 0x00, 0xff, 0xff, 0x10, 0xc0,
+           LITS12),
+    STREAM("literals past the output", NULL,
+           0xf0, 0xff, 0x10, 'a', 'b', 'c', 'd', LITS12),
+};
+
+static unsigned int failures;
+
+static void check(const char *what, const char *name, int ok)
+{
+    if ( ok )
+        return;
+    printf("FAIL: %s: %s\n", what, name);
+    failures++;
+}
+
+static void test_streams(void)
+{
+    unsigned char out[PAGE_SIZE];
+    unsigned int i;
+
+    for ( i = 0; i < sizeof(streams) / sizeof(streams[0]); i++ )
+    {
+        const struct stream *s = &streams[i];
+        size_t olen = s->out ? strlen(s->out) : 64, len;
+        int rc;
+
+        /* Known output size, which reads no further than the stream. */
+        memset(out, 0, sizeof(out));
+        rc = lz4_decompress(s->data, &len, out, olen);
+        if ( s->out )
+            check("known size", s->name,
+                  !rc && len == s->len && !memcmp(out, s->out, olen));
+        else
+            check("known size", s->name, rc);
+
+        memset(out, 0, sizeof(out));
+        len = olen;
+        rc = lz4_decompress_unknownoutputsize(s->data, s->len, out, &len);
+        if ( s->out )
+            check("unknown size", s->name,
+                  !rc && len == olen && !memcmp(out, s->out, olen));
+        else
+            check("unknown size", s->name, rc);
+    }
+}
+
+/* Random bytes, with short and long repeats of recent data mixed in. */
+static void fill_page(unsigned char *page, unsigned int seed)
+{
+    unsigned int i = 0;
+
+    srand(seed);
+    while ( i < PAGE_SIZE )
+    {
+        unsigned int len = 4 + rand() % (rand() % 4 ? 4 : 64);
+        unsigned int dist = 1 + rand() % 16;
+
+        if ( i < dist || rand() % 3 == 0 )
+            page[i++] = rand();
+        else
+            for ( ; len && i < PAGE_SIZE; len--, i++ )
+                page[i] = page[i - dist];
+    }
+}
+
+static void test_round_trip(unsigned int nr)
+{
+    static unsigned char page[PAGE_SIZE], out[PAGE_SIZE];
+    static unsigned char buf[PAGE_SIZE + PAGE_SIZE / 255 + 16];
+    static unsigned char wrkmem[LZ4_MEM_COMPRESS];
+    unsigned int seed, compressed = 0;
+
+    for ( seed = 0; seed < nr; seed++ )
+    {
+        size_t clen = sizeof(buf), len;
+
+        fill_page(page, seed);
+        if ( lz4_compress(page, PAGE_SIZE, buf, &clen, wrkmem) )
+        {
+            check("compress", "page", 0);
+            continue;
+        }
+        compressed += clen;
+
+        memset(out, 0, sizeof(out));
+        len = PAGE_SIZE;
+        check("round trip", "page",
+              !lz4_decompress_unknownoutputsize(buf, clen, out, &len) &&
+              len == PAGE_SIZE && !memcmp(out, page, PAGE_SIZE));
+    }
+
+    printf("%u pages, compressed to %u%%\n", nr,
+           (unsigned int)(compressed * 100ULL / ((unsigned long long)nr *
+                                                 PAGE_SIZE)));
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nr = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+
+    test_streams();
+    test_round_trip(nr);
+
+    if ( failures )
+    {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+
+    printf("All LZ4 tests passed\n");
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
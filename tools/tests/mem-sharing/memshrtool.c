@@ -26,6 +26,8 @@ static int usage(const char* prog)
     printf("                          - Share two pages.\n");
     printf("  range <source-domid> <destination-domid> <first-gfn> <last-gfn>\n");
     printf("                          - Share pages between domains in a range.\n");
+    printf("  fork <domid>            - Create a paused copy-on-write clone of a\n");
+    printf("                            paused domain, and print its domid.\n");
     printf("  unshare <domid> <gfn>   - Unshare a page by grabbing a writable map.\n");
     printf("  add-to-physmap <domid> <gfn> <source> <source-gfn> <source-handle>\n");
     printf("                          - Populate a page in a domain with a shared page.\n");
@@ -203,5 +205,36 @@ int main(int argc, const char** argv)
             return rc;
         }
     }
+    else if( !strcasecmp(cmd, "fork") )
+    {
+        xc_dominfo_t info;
+        domid_t pdomid;
+        uint32_t cdomid = 0;
+
+        if ( argc != 3 )
+            return usage(argv[0]);
+
+        pdomid = strtol(argv[2], NULL, 0);
+        if ( xc_domain_getinfo(xch, pdomid, 1, &info) != 1 ||
+             info.domid != pdomid || !info.hvm || !info.paused )
+        {
+            printf("domain %u is not a paused HVM domain\n", pdomid);
+            return 1;
+        }
+
+        /* Created domains start out paused, which the fork has to be. */
+        R(xc_domain_create(xch, info.ssidref, info.handle,
+                           XEN_DOMCTL_CDF_hvm_guest | XEN_DOMCTL_CDF_hap,
+                           &cdomid, NULL));
+        if ( xc_domain_max_vcpus(xch, cdomid, info.max_vcpu_id + 1) < 0 ||
+             xc_domain_setmaxmem(xch, cdomid, info.max_memkb) < 0 ||
+             xc_memshr_fork(xch, pdomid, cdomid) < 0 )
+        {
+            printf("error forking domain %u: %s\n", pdomid, strerror(errno));
+            xc_domain_destroy(xch, cdomid);
+            return 1;
+        }
+        printf("%u\n", cdomid);
+    }
     return 0;
 }
@@ -0,0 +1,127 @@
+/*
+ * Minimal single-CPU emulation of the hypervisor environment, enough to
+ * build xen/common/timer.c as a user space program.
+ */
+
+#ifndef __TEST_TIMER_EMUL_H__
+#define __TEST_TIMER_EMUL_H__
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef int64_t s_time_t;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int bool_t;
+typedef int spinlock_t;
+
+#define STIME_MAX ((s_time_t)((uint64_t)~0ull >> 1))
+#define MILLISECS(_ms) ((s_time_t)((_ms) * 1000000ULL))
+#define MICROSECS(_us) ((s_time_t)((_us) * 1000ULL))
+
+static inline s_time_t NOW(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define __init
+#define __initdata
+#define __read_mostly
+#define __cacheline_aligned __attribute__((__aligned__(64)))
+#define integer_param(_name, _var)
+#define boolean_param(_name, _var)
+
+#define likely(_x)   __builtin_expect(!!(_x), 1)
+#define unlikely(_x) __builtin_expect(!!(_x), 0)
+
+#define ASSERT(_p) assert(_p)
+#define BUG() abort()
+#define BUG_ON(_p) do { if ( _p ) BUG(); } while ( 0 )
+
+#define MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
+#define min(_a, _b) \
+    ({ typeof(_a) a__ = (_a), b__ = (_b); a__ < b__ ? a__ : b__; })
+#define max(_a, _b) \
+    ({ typeof(_a) a__ = (_a), b__ = (_b); a__ > b__ ? a__ : b__; })
+
+#define container_of(_ptr, _type, _member) \
+    ((_type *)((char *)(_ptr) - offsetof(_type, _member)))
+#define prefetch(_x) __builtin_prefetch(_x)
+#define smp_wmb() __asm__ __volatile__ ( "" ::: "memory" )
+#define rcu_dereference(_p) (_p)
+
+#define printk printf
+
+/* One CPU, no locking, no interrupts. */
+#define smp_processor_id() 0U
+#define cpu_online(_cpu) ((_cpu) == 0)
+#define cpumask_any(_mask) 0U
+#define for_each_online_cpu(_cpu) for ( (_cpu) = 0; (_cpu) < 1; (_cpu)++ )
+#define cpu_relax() ((void)0)
+extern int cpu_online_map;
+
+#define DECLARE_PER_CPU(_type, _name) extern __typeof__(_type) per_cpu__##_name
+#define DEFINE_PER_CPU(_type, _name) __typeof__(_type) per_cpu__##_name
+#define per_cpu(_name, _cpu) (*((void)(_cpu), &per_cpu__##_name))
+#define this_cpu(_name) per_cpu__##_name
+
+#define spin_lock_init(_l) ((void)(_l))
+#define spin_lock(_l) ((void)(_l))
+#define spin_unlock(_l) ((void)(_l))
+#define spin_lock_irq(_l) ((void)(_l))
+#define spin_unlock_irq(_l) ((void)(_l))
+#define spin_lock_irqsave(_l, _f) ((void)(_l), (_f) = 0)
+#define spin_unlock_irqrestore(_l, _f) ((void)(_l), (void)(_f))
+#define local_irq_save(_f) ((_f) = 0)
+#define local_irq_restore(_f) ((void)(_f))
+
+#define DEFINE_RCU_READ_LOCK(_x) int _x
+#define rcu_read_lock(_x) ((void)(_x))
+#define rcu_read_unlock(_x) ((void)(_x))
+
+#define read_atomic(_p) (*(_p))
+#define write_atomic(_p, _v) (*(_p) = (_v))
+
+/* Softirqs are counted, and run explicitly by the test. */
+#define TIMER_SOFTIRQ 0
+extern unsigned long nr_softirqs;
+#define open_softirq(_nr, _fn) ((void)(_fn))
+#define raise_softirq(_nr) (nr_softirqs++)
+#define cpu_raise_softirq(_cpu, _nr) ((void)(_cpu), nr_softirqs++)
+
+#define xmalloc_array(_type, _num) ((_type *)malloc(sizeof(_type) * (_num)))
+#define xfree(_p) free(_p)
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *, unsigned long, void *);
+    int priority;
+};
+#define CPU_UP_PREPARE  1
+#define CPU_UP_CANCELED 2
+#define CPU_DEAD        3
+#define NOTIFY_DONE     0
+#define register_cpu_notifier(_nb) ((void)(_nb))
+#define register_keyhandler(_key, _fn, _desc, _irq) ((void)(_fn))
+
+#endif /* __TEST_TIMER_EMUL_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
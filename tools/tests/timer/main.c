@@ -0,0 +1,126 @@
+/*
+ * Microbenchmark for the hypervisor timer queues.
+ *
+ * Builds xen/common/timer.c against a single-CPU emulation layer and
+ * measures the cost of arming, re-arming and stopping many short timers
+ * with the timer wheel enabled and disabled.
+ */
+
+#include "timer.c"
+
+int cpu_online_map;
+unsigned long nr_softirqs;
+
+int reprogram_timer(s_time_t timeout)
+{
+    return 1;
+}
+
+static void timer_fn(void *data)
+{
+    ++*(unsigned long *)data;
+}
+
+/* Grow the heap so that the measurement does not include reallocation. */
+static void grow_heap(struct timer *timers, unsigned int nr)
+{
+    unsigned long fired = 0;
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        init_timer(&timers[i], timer_fn, &fired, 0);
+        set_timer(&timers[i], NOW() + MILLISECS(3600000));
+        if ( this_cpu(timers).list != NULL )
+            timer_softirq_action();
+    }
+
+    for ( i = 0; i < nr; i++ )
+        kill_timer(&timers[i]);
+}
+
+static void run(struct timer *timers, unsigned int nr, bool_t wheel)
+{
+    unsigned long fired = 0;
+    unsigned int i;
+    s_time_t start, arm, rearm, stop, fire;
+
+    opt_timer_wheel = wheel;
+
+    for ( i = 0; i < nr; i++ )
+        init_timer(&timers[i], timer_fn, &fired, 0);
+
+    /* Short timeouts between 100us and 10ms, as for event/IO timeouts. */
+    start = NOW();
+    for ( i = 0; i < nr; i++ )
+        set_timer(&timers[i], start + MICROSECS(100 + (i * 7919) % 9900));
+    arm = NOW() - start;
+
+    start = NOW();
+    for ( i = 0; i < nr; i++ )
+        set_timer(&timers[i], start + MICROSECS(100 + (i * 104729) % 9900));
+    rearm = NOW() - start;
+
+    start = NOW();
+    for ( i = 0; i < nr; i++ )
+        stop_timer(&timers[i]);
+    stop = NOW() - start;
+
+    /* Every timer must fire, and none before its deadline. */
+    start = NOW();
+    for ( i = 0; i < nr; i++ )
+        set_timer(&timers[i], start + MICROSECS(i % 1000));
+    while ( fired < nr && NOW() - start < MILLISECS(1000) )
+        timer_softirq_action();
+    fire = NOW() - start;
+    if ( fired != nr )
+    {
+        printf("%s: only %lu of %u timers fired\n",
+               wheel ? "wheel" : "heap", fired, nr);
+        exit(1);
+    }
+
+    for ( i = 0; i < nr; i++ )
+        kill_timer(&timers[i]);
+
+    printf("%-5s arm %6.1f ns  rearm %6.1f ns  stop %6.1f ns  "
+           "fired all in %"PRId64"us\n", wheel ? "wheel" : "heap",
+           (double)arm / nr, (double)rearm / nr, (double)stop / nr,
+           fire / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nr = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+    struct timer *timers;
+
+    if ( nr == 0 || nr > 60000 )
+    {
+        fprintf(stderr, "usage: %s [nr_timers <= 60000]\n", argv[0]);
+        return 1;
+    }
+
+    timers = calloc(nr, sizeof(*timers));
+    if ( !timers )
+        return 1;
+
+    timer_init();
+    grow_heap(timers, nr);
+
+    printf("%u timers:\n", nr);
+    run(timers, nr, 0);
+    run(timers, nr, 1);
+
+    free(timers);
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <xen/xen.h>
 #include <sys/mman.h>
+#include <time.h>
 
 #define __packed __attribute__((packed))
 
@@ -192,6 +193,50 @@ static struct x86_emulate_ops emulops = {
     .get_fpu    = get_fpu,
 };
 
+/*
+ * Emulate the code sequence at @code to completion, returning the time it
+ * took in ns, or 0 on failure.  With @prefetch, the instruction bytes are
+ * handed to x86_emulate() up front, like the HVM and shadow callers do,
+ * rather than fetched through ops->insn_fetch().
+ */
+static unsigned long time_blob(struct x86_emulate_ctxt *ctxt, void *code,
+                               bool prefetch, unsigned long *insns)
+{
+    struct cpu_user_regs *regs = ctxt->regs;
+    struct timespec start, end;
+
+    regs->eax = 2;
+    regs->edx = 1;
+    regs->eip = (unsigned long)code;
+    regs->esp = (unsigned long)code + MMAP_SZ - 4;
+    if ( ctxt->addr_size == 64 )
+    {
+        *(uint32_t *)(unsigned long)regs->esp = 0;
+        regs->esp -= 4;
+    }
+    *(uint32_t *)(unsigned long)regs->esp = 0x12345678;
+    regs->eflags = 2;
+
+    *insns = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ( regs->eip != 0x12345678 )
+    {
+        if ( prefetch )
+        {
+            ctxt->insn_buf = (void *)(unsigned long)regs->eip;
+            ctxt->insn_buf_bytes = MAX_INST_LEN;
+        }
+        if ( x86_emulate(ctxt, &emulops) != X86EMUL_OKAY )
+            return 0;
+        ++*insns;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ctxt->insn_buf_bytes = 0;
+
+    return (end.tv_sec - start.tv_sec) * 1000000000UL +
+           end.tv_nsec - start.tv_nsec ?: 1;
+}
+
 int main(int argc, char **argv)
 {
     struct x86_emulate_ctxt ctxt;
@@ -207,6 +252,7 @@ int main(int argc, char **argv)
 
     ctxt.regs = &regs;
     ctxt.force_writeback = 0;
+    ctxt.insn_buf_bytes = 0;
     ctxt.addr_size = 8 * sizeof(void *);
     ctxt.sp_size   = 8 * sizeof(void *);
 
@@ -994,6 +1040,20 @@ int main(int argc, char **argv)
             goto fail;
         printf("okay\n");
 
+        {
+            unsigned long insns, ns, ns_prefetch;
+
+            i = printf("Timing %s %u-bit emulation...",
+                       blobs[j].name, ctxt.addr_size);
+            ns = time_blob(&ctxt, res, false, &insns);
+            ns_prefetch = time_blob(&ctxt, res, true, &insns);
+            if ( !ns || !ns_prefetch )
+                goto fail;
+            printf("%*s%lu insns, %lu/%lu ns per insn (fetched/prefetched)\n",
+                   i < 40 ? 40 - i : 0, "", insns,
+                   ns / insns, ns_prefetch / insns);
+        }
+
         if ( ctxt.addr_size != sizeof(void *) * CHAR_BIT )
             continue;
 
@@ -0,0 +1,702 @@
+/*
+ * xen-bench: measure the cost of hypervisor hot paths from dom0.
+ *
+ * Each test repeats one operation, timing every iteration, and prints one
+ * JSON object per test with latency percentiles and throughput, so that
+ * results can be collected and compared between releases:
+ *
+ *  hypercall    null hypercall (xen_version) through libxencall
+ *  yield        SCHEDOP_yield, with nothing else runnable on our pcpu
+ *  evtchn       round trip over a loopback interdomain event channel,
+ *               echoed by a second thread
+ *  evtchn-send  one-way EVTCHNOP_send over a loopback event channel, which
+ *               is never drained: the cost of the send hypercall alone
+ *  gnttab-map   map and unmap of a batch of pages granted to ourselves
+ *  gnttab-copy  GNTTABOP_copy of a batch of pages between two of our grants
+ *  ioreq        round trip of guest I/O exits to an ioreq server serving
+ *               a PIO (or, with -m, MMIO) range of an HVM guest.  Something
+ *               in the guest must access the range in a tight loop, e.g.
+ *               "outb" to the port; each iteration is the time from one
+ *               request to the next, i.e. exit, emulation and re-entry.
+ *
+ * Usage: xen-bench [-n <iterations>] [-w <warmup>] [-b <batch>]
+ *                  [-s <own domid>] [-d <domid> -a <address> [-m]]
+ *                  [<test>...]
+ *
+ * Without tests, all but ioreq are run.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+#include <xencall.h>
+#include <xenevtchn.h>
+#include <xengnttab.h>
+#include <xenforeignmemory.h>
+#include <xen/xen.h>
+#include <xen/sched.h>
+#include <xen/version.h>
+#include <xen/grant_table.h>
+#include <xen/hvm/ioreq.h>
+
+#define PAGE_SIZE 4096
+
+static unsigned int batch = 1;
+static uint32_t self_domid, guest_domid = DOMID_INVALID;
+static uint64_t io_addr = ~0ULL;
+static int io_mmio;
+
+struct test {
+    const char *name;
+    int (*setup)(void);
+    int (*op)(void);
+    void (*teardown)(void);
+    /* Bytes moved by one iteration, for throughput. */
+    unsigned int (*bytes)(void);
+    /* Not run by default, as it needs a guest. */
+    int explicit;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* hypercall */
+
+static xencall_handle *xcall;
+
+static int hypercall_setup(void)
+{
+    xcall = xencall_open(NULL, 0);
+    if ( !xcall )
+    {
+        perror("xencall_open");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int hypercall_op(void)
+{
+    if ( xencall2(xcall, __HYPERVISOR_xen_version, XENVER_version, 0) < 0 )
+    {
+        perror("xen_version");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void hypercall_teardown(void)
+{
+    xencall_close(xcall);
+}
+
+/* yield */
+
+static int yield_op(void)
+{
+    if ( xencall2(xcall, __HYPERVISOR_sched_op, SCHEDOP_yield, 0) < 0 )
+    {
+        perror("sched_op");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* evtchn */
+
+static xenevtchn_handle *xce_ping, *xce_echo;
+static evtchn_port_t port_ping, port_echo;
+static pthread_t echo_thread;
+static volatile int echo_stop;
+
+static int wait_port(xenevtchn_handle *xce)
+{
+    struct pollfd pfd = { .fd = xenevtchn_fd(xce), .events = POLLIN };
+    xenevtchn_port_or_error_t port;
+
+    if ( poll(&pfd, 1, -1) < 0 )
+        return -1;
+
+    port = xenevtchn_pending(xce);
+    if ( port < 0 )
+        return -1;
+
+    return xenevtchn_unmask(xce, port);
+}
+
+static void *echo(void *arg)
+{
+    while ( !echo_stop )
+    {
+        if ( wait_port(xce_echo) < 0 )
+        {
+            perror("echo: xenevtchn_pending");
+            break;
+        }
+        if ( !echo_stop && xenevtchn_notify(xce_echo, port_echo) < 0 )
+        {
+            perror("echo: xenevtchn_notify");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int evtchn_bind(void)
+{
+    xenevtchn_port_or_error_t port;
+
+    xce_ping = xenevtchn_open(NULL, 0);
+    xce_echo = xenevtchn_open(NULL, 0);
+    if ( !xce_ping || !xce_echo )
+    {
+        perror("xenevtchn_open");
+        return -1;
+    }
+
+    port = xenevtchn_bind_unbound_port(xce_ping, DOMID_SELF);
+    if ( port < 0 )
+    {
+        perror("xenevtchn_bind_unbound_port");
+        return -1;
+    }
+    port_ping = port;
+
+    port = xenevtchn_bind_interdomain(xce_echo, DOMID_SELF, port_ping);
+    if ( port < 0 )
+    {
+        perror("xenevtchn_bind_interdomain");
+        return -1;
+    }
+    port_echo = port;
+
+    return 0;
+}
+
+static int evtchn_setup(void)
+{
+    if ( evtchn_bind() < 0 )
+        return -1;
+
+    echo_stop = 0;
+    errno = pthread_create(&echo_thread, NULL, echo, NULL);
+    if ( errno )
+    {
+        perror("pthread_create");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int evtchn_op(void)
+{
+    if ( xenevtchn_notify(xce_ping, port_ping) < 0 )
+    {
+        perror("xenevtchn_notify");
+        return -1;
+    }
+
+    if ( wait_port(xce_ping) < 0 )
+    {
+        perror("xenevtchn_pending");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void evtchn_teardown(void)
+{
+    echo_stop = 1;
+    xenevtchn_notify(xce_ping, port_ping);
+    pthread_join(echo_thread, NULL);
+
+    xenevtchn_close(xce_ping);
+    xenevtchn_close(xce_echo);
+}
+
+/* evtchn-send */
+
+static int evtchn_send_op(void)
+{
+    if ( xenevtchn_notify(xce_ping, port_ping) < 0 )
+    {
+        perror("xenevtchn_notify");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void evtchn_send_teardown(void)
+{
+    xenevtchn_close(xce_ping);
+    xenevtchn_close(xce_echo);
+}
+
+/* gnttab-map and gnttab-copy */
+
+static xengntshr_handle *xgs;
+static xengnttab_handle *xgt;
+static void *shared;
+static uint32_t *refs;
+static struct gnttab_copy *copies;
+
+static unsigned int batch_bytes(void)
+{
+    return batch * PAGE_SIZE;
+}
+
+/* Grant @nr pages to ourselves. */
+static int share_pages(unsigned int nr)
+{
+    xgs = xengntshr_open(NULL, 0);
+    if ( !xgs )
+    {
+        perror("xengntshr_open");
+        return -1;
+    }
+
+    refs = calloc(nr, sizeof(*refs));
+    if ( !refs )
+    {
+        perror("calloc");
+        return -1;
+    }
+
+    shared = xengntshr_share_pages(xgs, self_domid, nr, refs, 1);
+    if ( !shared )
+    {
+        perror("xengntshr_share_pages");
+        return -1;
+    }
+    memset(shared, 0x5a, nr * PAGE_SIZE);
+
+    return 0;
+}
+
+static void unshare_pages(unsigned int nr)
+{
+    xengntshr_unshare(xgs, shared, nr);
+    xengntshr_close(xgs);
+    free(refs);
+}
+
+static int gnttab_map_setup(void)
+{
+    if ( share_pages(batch) )
+        return -1;
+
+    xgt = xengnttab_open(NULL, 0);
+    if ( !xgt )
+    {
+        perror("xengnttab_open");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int gnttab_map_op(void)
+{
+    void *p = xengnttab_map_domain_grant_refs(xgt, batch, self_domid, refs,
+                                              PROT_READ | PROT_WRITE);
+
+    if ( !p )
+    {
+        perror("xengnttab_map_domain_grant_refs");
+        return -1;
+    }
+
+    if ( xengnttab_unmap(xgt, p, batch) )
+    {
+        perror("xengnttab_unmap");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void gnttab_map_teardown(void)
+{
+    xengnttab_close(xgt);
+    unshare_pages(batch);
+}
+
+static int gnttab_copy_setup(void)
+{
+    unsigned int i;
+
+    /* The first half of the grants is copied to the second half. */
+    if ( hypercall_setup() || share_pages(2 * batch) )
+        return -1;
+
+    copies = xencall_alloc_buffer(xcall, batch * sizeof(*copies));
+    if ( !copies )
+    {
+        perror("xencall_alloc_buffer");
+        return -1;
+    }
+
+    for ( i = 0; i < batch; i++ )
+    {
+        memset(&copies[i], 0, sizeof(copies[i]));
+        copies[i].source.u.ref = refs[i];
+        copies[i].source.domid = DOMID_SELF;
+        copies[i].dest.u.ref = refs[batch + i];
+        copies[i].dest.domid = DOMID_SELF;
+        copies[i].len = PAGE_SIZE;
+        copies[i].flags = GNTCOPY_source_gref | GNTCOPY_dest_gref;
+    }
+
+    return 0;
+}
+
+static int gnttab_copy_op(void)
+{
+    unsigned int i;
+
+    if ( xencall3(xcall, __HYPERVISOR_grant_table_op, GNTTABOP_copy,
+                  (uintptr_t)copies, batch) )
+    {
+        perror("GNTTABOP_copy");
+        return -1;
+    }
+
+    for ( i = 0; i < batch; i++ )
+        if ( copies[i].status != GNTST_okay )
+        {
+            fprintf(stderr, "GNTTABOP_copy: status %d\n", copies[i].status);
+            return -1;
+        }
+
+    return 0;
+}
+
+static void gnttab_copy_teardown(void)
+{
+    xencall_free_buffer(xcall, copies);
+    unshare_pages(2 * batch);
+    hypercall_teardown();
+}
+
+/* ioreq */
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+static xenevtchn_handle *xce_io;
+static ioservid_t ioservid;
+static shared_iopage_t *iopage;
+static evtchn_port_t *io_ports;
+static unsigned int nr_vcpus;
+
+static int ioreq_setup(void)
+{
+    xc_dominfo_t info;
+    xen_pfn_t ioreq_pfn, bufioreq_pfn;
+    evtchn_port_t bufioreq_port;
+    xenevtchn_port_or_error_t port;
+    unsigned int i;
+
+    if ( guest_domid == DOMID_INVALID || io_addr == ~0ULL )
+    {
+        fprintf(stderr, "ioreq: needs -d <domid> and -a <address>\n");
+        return -1;
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fmem = xenforeignmemory_open(NULL, 0);
+    xce_io = xenevtchn_open(NULL, 0);
+    if ( !xch || !fmem || !xce_io )
+    {
+        perror("open");
+        return -1;
+    }
+
+    if ( xc_domain_getinfo(xch, guest_domid, 1, &info) != 1 ||
+         info.domid != guest_domid )
+    {
+        fprintf(stderr, "ioreq: no domain %u\n", guest_domid);
+        return -1;
+    }
+    nr_vcpus = info.max_vcpu_id + 1;
+
+    if ( xc_hvm_create_ioreq_server(xch, guest_domid,
+                                    HVM_IOREQSRV_BUFIOREQ_OFF, &ioservid) ||
+         xc_hvm_get_ioreq_server_info(xch, guest_domid, ioservid, &ioreq_pfn,
+                                      &bufioreq_pfn, &bufioreq_port) )
+    {
+        perror("ioreq server");
+        return -1;
+    }
+
+    /* The page must be mapped before enabling takes it out of the guest. */
+    iopage = xenforeignmemory_map(fmem, guest_domid, PROT_READ | PROT_WRITE,
+                                  1, &ioreq_pfn, NULL);
+    io_ports = calloc(nr_vcpus, sizeof(*io_ports));
+    if ( !iopage || !io_ports )
+    {
+        perror("ioreq page");
+        return -1;
+    }
+
+    if ( xc_hvm_map_io_range_to_ioreq_server(xch, guest_domid, ioservid,
+                                             io_mmio, io_addr,
+                                             io_addr + 7) ||
+         xc_hvm_set_ioreq_server_state(xch, guest_domid, ioservid, 1) )
+    {
+        perror("ioreq server");
+        return -1;
+    }
+
+    for ( i = 0; i < nr_vcpus; i++ )
+    {
+        port = xenevtchn_bind_interdomain(xce_io, guest_domid,
+                                          iopage->vcpu_ioreq[i].vp_eport);
+        if ( port < 0 )
+        {
+            perror("xenevtchn_bind_interdomain");
+            return -1;
+        }
+        io_ports[i] = port;
+    }
+
+    return 0;
+}
+
+/* Complete the next request, whichever vCPU it comes from. */
+static int ioreq_op(void)
+{
+    unsigned int i;
+
+    for ( ; ; )
+    {
+        if ( wait_port(xce_io) < 0 )
+        {
+            perror("xenevtchn_pending");
+            return -1;
+        }
+
+        for ( i = 0; i < nr_vcpus; i++ )
+        {
+            ioreq_t *req = &iopage->vcpu_ioreq[i];
+
+            if ( req->state != STATE_IOREQ_READY )
+                continue;
+
+            xen_rmb();
+            req->state = STATE_IOREQ_INPROCESS;
+            if ( req->dir == IOREQ_READ && !req->data_is_ptr )
+                req->data = ~0ULL;
+            xen_wmb();
+            req->state = STATE_IORESP_READY;
+            xenevtchn_notify(xce_io, io_ports[i]);
+
+            return 0;
+        }
+    }
+}
+
+static void ioreq_teardown(void)
+{
+    xc_hvm_destroy_ioreq_server(xch, guest_domid, ioservid);
+    xenforeignmemory_unmap(fmem, iopage, 1);
+    xenevtchn_close(xce_io);
+    xenforeignmemory_close(fmem);
+    xc_interface_close(xch);
+    free(io_ports);
+}
+
+static const struct test tests[] = {
+    { "hypercall", hypercall_setup, hypercall_op, hypercall_teardown },
+    { "yield", hypercall_setup, yield_op, hypercall_teardown },
+    { "evtchn", evtchn_setup, evtchn_op, evtchn_teardown },
+    { "evtchn-send", evtchn_bind, evtchn_send_op, evtchn_send_teardown },
+    { "gnttab-map", gnttab_map_setup, gnttab_map_op, gnttab_map_teardown,
+      batch_bytes },
+    { "gnttab-copy", gnttab_copy_setup, gnttab_copy_op, gnttab_copy_teardown,
+      batch_bytes },
+    { "ioreq", ioreq_setup, ioreq_op, ioreq_teardown, NULL, 1 },
+};
+
+#define NR_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Percentile @p, in tenths of a percent, of the sorted @samples. */
+static uint64_t pct(const uint64_t *samples, unsigned int nr, unsigned int p)
+{
+    return samples[(uint64_t)(nr - 1) * p / 1000];
+}
+
+static int run(const struct test *t, unsigned int iters, unsigned int warmup,
+               uint64_t *samples)
+{
+    uint64_t start, end, prev;
+    unsigned int i;
+    int rc = -1;
+
+    if ( t->setup() )
+        return -1;
+
+    for ( i = 0; i < warmup; i++ )
+        if ( t->op() )
+            goto out;
+
+    start = prev = now_ns();
+    for ( i = 0; i < iters; i++ )
+    {
+        uint64_t now;
+
+        if ( t->op() )
+            goto out;
+        now = now_ns();
+        samples[i] = now - prev;
+        prev = now;
+    }
+    end = prev;
+
+    qsort(samples, iters, sizeof(*samples), cmp_u64);
+
+    printf("{\"test\": \"%s\", \"iterations\": %u, \"batch\": %u, "
+           "\"min_ns\": %"PRIu64", \"p50_ns\": %"PRIu64", "
+           "\"p90_ns\": %"PRIu64", \"p99_ns\": %"PRIu64", "
+           "\"p999_ns\": %"PRIu64", \"max_ns\": %"PRIu64", "
+           "\"ops_per_sec\": %.1f",
+           t->name, iters, batch, samples[0], pct(samples, iters, 500),
+           pct(samples, iters, 900), pct(samples, iters, 990),
+           pct(samples, iters, 999), samples[iters - 1],
+           iters * 1e9 / (end - start ?: 1));
+    if ( t->bytes )
+        printf(", \"bytes_per_sec\": %.1f",
+               (double)iters * t->bytes() * 1e9 / (end - start ?: 1));
+    printf("}\n");
+    fflush(stdout);
+    rc = 0;
+
+ out:
+    t->teardown();
+
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    unsigned int i;
+
+    fprintf(stderr,
+            "Usage: %s [-n <iterations>] [-w <warmup>] [-b <batch>]\n"
+            "       [-s <own domid>] [-d <domid> -a <address> [-m]] "
+            "[<test>...]\n"
+            "Tests:", prog);
+    for ( i = 0; i < NR_TESTS; i++ )
+        fprintf(stderr, " %s", tests[i].name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int iters = 100000, warmup = ~0u, i;
+    uint64_t *samples;
+    int opt, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "n:w:b:s:d:a:mh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'n':
+            iters = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            warmup = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            self_domid = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            guest_domid = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            io_addr = strtoull(optarg, NULL, 0);
+            break;
+        case 'm':
+            io_mmio = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( !iters || !batch )
+        usage(argv[0]);
+    if ( warmup == ~0u )
+        warmup = iters / 10;
+
+    samples = calloc(iters, sizeof(*samples));
+    if ( !samples )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    if ( optind == argc )
+    {
+        for ( i = 0; i < NR_TESTS; i++ )
+            if ( !tests[i].explicit && run(&tests[i], iters, warmup, samples) )
+                rc = 1;
+    }
+    else
+        for ( ; optind < argc; optind++ )
+        {
+            for ( i = 0; i < NR_TESTS; i++ )
+                if ( !strcmp(argv[optind], tests[i].name) )
+                    break;
+            if ( i == NR_TESTS )
+                usage(argv[0]);
+            if ( run(&tests[i], iters, warmup, samples) )
+                rc = 1;
+        }
+
+    free(samples);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -22,20 +22,20 @@
 #include <unistd.h>
 #include <xc_private.h>
 
-static int file_op(int fd, void *page, int i,
+static int file_op(int fd, void *page, int i, int nr,
                    ssize_t (*fn)(int, void *, size_t))
 {
     off_t offset = i;
-    int total = 0;
-    int bytes;
+    size_t total = 0, size = (size_t)nr << PAGE_SHIFT;
+    ssize_t bytes;
 
     offset = lseek(fd, offset << PAGE_SHIFT, SEEK_SET);
     if ( offset == (off_t)-1 )
         return -1;
 
-    while ( total < PAGE_SIZE )
+    while ( total < size )
     {
-        bytes = fn(fd, page + total, PAGE_SIZE - total);
+        bytes = fn(fd, page + total, size - total);
         if ( bytes <= 0 )
             return -1;
 
@@ -52,12 +52,18 @@ static ssize_t my_write(int fd, void *buf, size_t count)
 
 int read_page(int fd, void *page, int i)
 {
-    return file_op(fd, page, i, &read);
+    return file_op(fd, page, i, 1, &read);
 }
 
 int write_page(int fd, void *page, int i)
 {
-    return file_op(fd, page, i, &my_write);
+    return file_op(fd, page, i, 1, &my_write);
+}
+
+/* Write nr contiguous pages to the nr slots starting at slot i */
+int write_pages(int fd, void *pages, int i, int nr)
+{
+    return file_op(fd, pages, i, nr, &my_write);
 }
 
 
@@ -28,6 +28,7 @@
 
 
 int policy_init(struct xenpaging *paging);
+void policy_teardown(struct xenpaging *paging);
 unsigned long policy_choose_victim(struct xenpaging *paging);
 void policy_notify_paged_out(unsigned long gfn);
 void policy_notify_paged_in(unsigned long gfn);
@@ -0,0 +1,247 @@
+/******************************************************************************
+ *
+ * Xen domain paging CLOCK policy.
+ *
+ * Victims are chosen by a clock hand sweeping the gfn space.  Every gfn
+ * carries a referenced bit, which is set when the page is paged back in
+ * and when the guest is seen writing to it.  The hand clears referenced
+ * bits and only nominates gfns whose bit is already clear, so recently
+ * used pages get a second chance before being evicted.
+ *
+ * Guest accesses are sampled from the log-dirty bitmap, as the hypervisor
+ * does not expose EPT accessed bits to the toolstack.  Only writes are
+ * observed this way, which makes the policy an approximation of LRU.
+ * Log-dirty mode is owned by the pager while it runs, so this policy
+ * cannot be combined with live migration of the guest.  If log-dirty mode
+ * cannot be enabled the policy degrades to second-chance on page-in only.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <time.h>
+#include "xc_bitops.h"
+#include "policy.h"
+
+
+#define DEFAULT_MRU_SIZE (1024 * 16)
+
+/* Minimum number of seconds between two samples of the dirty bitmap */
+#define SAMPLE_INTERVAL 1
+
+
+static unsigned long *bitmap;
+static unsigned long *unconsumed;
+static unsigned long *referenced;
+static unsigned int unconsumed_cleared;
+static unsigned long current_gfn;
+static unsigned long max_pages;
+static domid_t domain_id;
+static int logdirty;
+static time_t last_sample;
+static xc_hypercall_buffer_t dirty_hbuf;
+
+
+/* Fold the pages written since the last sample into the referenced bits */
+static void policy_sample(xc_interface *xch)
+{
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty, &dirty_hbuf);
+    time_t now = time(NULL);
+    unsigned char *ref = (unsigned char *)referenced;
+    unsigned long i;
+
+    if ( !logdirty || now - last_sample < SAMPLE_INTERVAL )
+        return;
+    last_sample = now;
+
+    if ( xc_shadow_control(xch, domain_id, XEN_DOMCTL_SHADOW_OP_CLEAN,
+                           HYPERCALL_BUFFER(dirty), max_pages,
+                           NULL, 0, NULL) < 0 )
+    {
+        PERROR("Error sampling dirty bitmap, stop sampling");
+        logdirty = 0;
+        return;
+    }
+
+    for ( i = 0; i < bitmap_size(max_pages); i++ )
+        ref[i] |= ((unsigned char *)dirty)[i];
+}
+
+int policy_init(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty, &dirty_hbuf);
+    int rc = -ENOMEM;
+
+    max_pages = paging->max_pages;
+    domain_id = paging->vm_event.domain_id;
+
+    /* Allocate bitmap for pages not to page out */
+    bitmap = bitmap_alloc(max_pages);
+    if ( !bitmap )
+        goto out;
+    /* Allocate bitmap to track unusable pages */
+    unconsumed = bitmap_alloc(max_pages);
+    if ( !unconsumed )
+        goto out;
+    /* Allocate bitmap to track recently used pages */
+    referenced = bitmap_alloc(max_pages);
+    if ( !referenced )
+        goto out;
+
+    dirty = xc_hypercall_buffer_alloc_pages(xch, dirty,
+                (bitmap_size(max_pages) + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    if ( !dirty )
+        goto out;
+
+    /* The MRU size is only used by the caller as a page-in threshold */
+    if ( paging->policy_mru_size <= 0 )
+        paging->policy_mru_size = DEFAULT_MRU_SIZE;
+
+    if ( xc_shadow_control(xch, domain_id,
+                           XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY,
+                           NULL, 0, NULL, 0, NULL) < 0 )
+        PERROR("Error enabling log-dirty mode, not sampling guest writes");
+    else
+        logdirty = 1;
+
+    /* Don't page out page 0 */
+    set_bit(0, bitmap);
+
+    /* Start in the middle to avoid paging during BIOS startup */
+    current_gfn = max_pages / 2;
+
+    rc = 0;
+ out:
+    return rc;
+}
+
+void policy_teardown(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty, &dirty_hbuf);
+
+    if ( logdirty &&
+         xc_shadow_control(xch, domain_id, XEN_DOMCTL_SHADOW_OP_OFF,
+                           NULL, 0, NULL, 0, NULL) < 0 )
+        PERROR("Error disabling log-dirty mode");
+    logdirty = 0;
+
+    xc_hypercall_buffer_free_pages(xch, dirty,
+        (bitmap_size(max_pages) + PAGE_SIZE - 1) >> PAGE_SHIFT);
+}
+
+unsigned long policy_choose_victim(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned long i;
+
+    policy_sample(xch);
+
+    /*
+     * Two revolutions of the hand: the first may only clear referenced
+     * bits, the second then finds those gfns cold.
+     */
+    for ( i = 0; i < 2 * max_pages; i++ )
+    {
+        /* Try next gfn */
+        current_gfn++;
+
+        /* Restart on wrap */
+        if ( current_gfn >= max_pages )
+            current_gfn = 0;
+
+        if ( (current_gfn & (BITS_PER_LONG - 1)) == 0 )
+        {
+            /* All gfns busy */
+            if ( ~bitmap[current_gfn >> ORDER_LONG] == 0 || ~unconsumed[current_gfn >> ORDER_LONG] == 0 )
+            {
+                current_gfn += BITS_PER_LONG;
+                i += BITS_PER_LONG;
+                continue;
+            }
+        }
+
+        /* gfn busy */
+        if ( test_bit(current_gfn, bitmap) )
+            continue;
+
+        /* gfn already tested */
+        if ( test_bit(current_gfn, unconsumed) )
+            continue;
+
+        /* gfn recently used, give it a second chance */
+        if ( test_and_clear_bit(current_gfn, referenced) )
+            continue;
+
+        /* gfn found */
+        break;
+    }
+
+    /* Could not nominate any gfn */
+    if ( i >= 2 * max_pages )
+    {
+        /* No more pages, wait in poll */
+        paging->use_poll_timeout = 1;
+        /* Count wrap arounds */
+        unconsumed_cleared++;
+        /* Force retry every few seconds (depends on poll() timeout) */
+        if ( unconsumed_cleared > 123)
+        {
+            /* Force retry of unconsumed gfns on next call */
+            bitmap_clear(unconsumed, max_pages);
+            unconsumed_cleared = 0;
+            DPRINTF("clearing unconsumed, current_gfn %lx", current_gfn);
+        }
+        return INVALID_MFN;
+    }
+
+    set_bit(current_gfn, unconsumed);
+    return current_gfn;
+}
+
+void policy_notify_paged_out(unsigned long gfn)
+{
+    set_bit(gfn, bitmap);
+    clear_bit(gfn, unconsumed);
+    clear_bit(gfn, referenced);
+}
+
+void policy_notify_paged_in(unsigned long gfn)
+{
+    /* The guest just touched it, so it is hot */
+    clear_bit(gfn, bitmap);
+    set_bit(gfn, referenced);
+}
+
+void policy_notify_paged_in_nomru(unsigned long gfn)
+{
+    clear_bit(gfn, bitmap);
+}
+
+void policy_notify_dropped(unsigned long gfn)
+{
+    clear_bit(gfn, bitmap);
+}
+
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -76,6 +76,10 @@ int policy_init(struct xenpaging *paging)
     return rc;
 }
 
+void policy_teardown(struct xenpaging *paging)
+{
+}
+
 unsigned long policy_choose_victim(struct xenpaging *paging)
 {
     xc_interface *xch = paging->xc_handle;
@@ -33,6 +33,7 @@
 #include "xc_bitops.h"
 #include "file_ops.h"
 #include "policy.h"
+#include "zpool.h"
 #include "xenpaging.h"
 
 /* Defines number of mfns a guest should use at a time, in KiB */
@@ -208,6 +209,8 @@ static void usage(void)
     printf(" -f <file>      --pagefile=<file>        pagefile to use. This option is required.\n");
     printf(" -m <max_memkb> --max_memkb=<max_memkb>  maximum amount of memory to handle.\n");
     printf(" -r <num>       --mru_size=<num>         number of paged-in pages to keep in memory.\n");
+    printf(" -z <kb>        --zpool=<kb>             size of the in-memory compressed page pool (default 0).\n");
+    printf(" -a <num>       --readahead=<num>        size of the gfn window paged in on a guest fault (default %d).\n", XENPAGING_READAHEAD);
     printf(" -v             --verbose                enable debug output.\n");
     printf(" -h             --help                   this output.\n");
 }
@@ -215,13 +218,15 @@ static void usage(void)
 static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
 {
     int ch;
-    static const char sopts[] = "hvd:f:m:r:";
+    static const char sopts[] = "hvd:f:m:r:a:z:";
     static const struct option lopts[] = {
         {"help", 0, NULL, 'h'},
         {"verbose", 0, NULL, 'v'},
         {"domain", 1, NULL, 'd'},
         {"pagefile", 1, NULL, 'f'},
         {"mru_size", 1, NULL, 'm'},
+        {"readahead", 1, NULL, 'a'},
+        {"zpool", 1, NULL, 'z'},
         { }
     };
 
@@ -242,6 +247,13 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
         case 'r':
             paging->policy_mru_size = atoi(optarg);
             break;
+        case 'a':
+            paging->readahead = atoi(optarg);
+            break;
+        case 'z':
+            /* KiB to bytes */
+            paging->zpool_size = strtoul(optarg, NULL, 0) << 10;
+            break;
         case 'v':
             paging->debug = 1;
             break;
@@ -287,6 +299,8 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
     if ( !paging )
         goto err;
 
+    paging->readahead = XENPAGING_READAHEAD;
+
     /* Get cmdline options and domain_id */
     if ( xenpaging_getopts(paging, argc, argv) )
         goto err;
@@ -466,6 +480,14 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
         goto err;
     }
 
+    /* Initialise compressed page pool */
+    rc = zpool_init(paging->zpool_size, paging->max_pages);
+    if ( rc != 0 )
+    {
+        PERROR("Error initialising compressed page pool");
+        goto err;
+    }
+
     paging->paging_buffer = init_page();
     if ( !paging->paging_buffer )
     {
@@ -521,6 +543,9 @@ static void xenpaging_teardown(struct xenpaging *paging)
     xs_unwatch(paging->xs_handle, watch_target_tot_pages, "");
     xs_unwatch(paging->xs_handle, "@releaseDomain", watch_token);
 
+    /* Tear down policy state before the interface goes away */
+    policy_teardown(paging);
+
     paging->xc_handle = NULL;
     /* Tear down domain paging in Xen */
     munmap(paging->vm_event.ring_page, PAGE_SIZE);
@@ -587,85 +612,6 @@ static void put_response(struct vm_event *vm_event, vm_event_response_t *rsp)
     RING_PUSH_RESPONSES(back_ring);
 }
 
-/* Evict a given gfn
- * Returns < 0 on fatal error
- * Returns 0 on successful evict
- * Returns > 0 if gfn can not be evicted
- */
-static int xenpaging_evict_page(struct xenpaging *paging, unsigned long gfn, int slot)
-{
-    xc_interface *xch = paging->xc_handle;
-    void *page;
-    xen_pfn_t victim = gfn;
-    int ret;
-
-    DECLARE_DOMCTL;
-
-    /* Nominate page */
-    ret = xc_mem_paging_nominate(xch, paging->vm_event.domain_id, gfn);
-    if ( ret < 0 )
-    {
-        /* unpageable gfn is indicated by EBUSY */
-        if ( errno == EBUSY )
-            ret = 1;
-        else
-            PERROR("Error nominating page %lx", gfn);
-        goto out;
-    }
-
-    /* Map page */
-    page = xc_map_foreign_pages(xch, paging->vm_event.domain_id, PROT_READ, &victim, 1);
-    if ( page == NULL )
-    {
-        PERROR("Error mapping page %lx", gfn);
-        ret = -1;
-        goto out;
-    }
-
-    /* Copy page */
-    ret = write_page(paging->fd, page, slot);
-    if ( ret < 0 )
-    {
-        PERROR("Error copying page %lx", gfn);
-        munmap(page, PAGE_SIZE);
-        ret = -1;
-        goto out;
-    }
-
-    /* Release page */
-    munmap(page, PAGE_SIZE);
-
-    /* Tell Xen to evict page */
-    ret = xc_mem_paging_evict(xch, paging->vm_event.domain_id, gfn);
-    if ( ret < 0 )
-    {
-        /* A gfn in use is indicated by EBUSY */
-        if ( errno == EBUSY )
-        {
-                ret = 1;
-                DPRINTF("Nominated page %lx busy", gfn);
-        } else
-            PERROR("Error evicting page %lx", gfn);
-        goto out;
-    }
-
-    DPRINTF("evict_page > gfn %lx pageslot %d\n", gfn, slot);
-    /* Notify policy of page being paged out */
-    policy_notify_paged_out(gfn);
-
-    /* Update index */
-    paging->slot_to_gfn[slot] = gfn;
-    paging->gfn_to_slot[gfn] = slot;
-
-    /* Record number of evicted pages */
-    paging->num_paged_out++;
-
-    ret = 0;
-
- out:
-    return ret;
-}
-
 static int xenpaging_resume_page(struct xenpaging *paging, vm_event_response_t *rsp, int notify_policy)
 {
     /* Put the page info on the ring */
@@ -699,8 +645,10 @@ static int xenpaging_populate_page(struct xenpaging *paging, unsigned long gfn,
 
     DPRINTF("populate_page < gfn %lx pageslot %d\n", gfn, i);
 
-    /* Read page */
-    ret = read_page(paging->fd, paging->paging_buffer, i);
+    /* Read page, from the compressed pool if it is there */
+    ret = zpool_load(gfn, paging->paging_buffer);
+    if ( ret > 0 )
+        ret = read_page(paging->fd, paging->paging_buffer, i);
     if ( ret != 0 )
     {
         PERROR("Error reading page");
@@ -732,6 +680,57 @@ static int xenpaging_populate_page(struct xenpaging *paging, unsigned long gfn,
     return ret;
 }
 
+/* Report how many evicted pages the guest had to fault back in */
+static void report_faultback(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned long zpages;
+    size_t zbytes;
+
+    IPRINTF("domain %u: %lu pages evicted, %lu faulted back (%lu%%)\n",
+            paging->vm_event.domain_id, paging->num_evicted,
+            paging->num_faulted_back,
+            paging->num_evicted ?
+            paging->num_faulted_back * 100 / paging->num_evicted : 0);
+
+    zpool_stats(&zpages, &zbytes);
+    if ( zpages )
+        IPRINTF("domain %u: %lu pages held compressed in %zu KiB\n",
+                paging->vm_event.domain_id, zpages, zbytes >> 10);
+}
+
+/* Queue paged-out pages next to a faulting gfn for page-in */
+static void readahead_pages(struct xenpaging *paging, unsigned long gfn)
+{
+    unsigned long start, end, i;
+    int q = 0, num = 0;
+
+    if ( paging->readahead <= 1 )
+        return;
+
+    start = gfn - gfn % paging->readahead;
+    end = start + paging->readahead;
+    if ( end > paging->max_pages )
+        end = paging->max_pages;
+
+    for ( i = start; i < end; i++ )
+    {
+        if ( i == gfn || !test_bit(i, paging->bitmap) )
+            continue;
+
+        /* Find a free entry, the queue may still hold earlier requests */
+        while ( q < XENPAGING_PAGEIN_QUEUE_SIZE && paging->pagein_queue[q] )
+            q++;
+        if ( q == XENPAGING_PAGEIN_QUEUE_SIZE )
+            break;
+        paging->pagein_queue[q] = i;
+        num++;
+    }
+
+    if ( num )
+        page_in_trigger();
+}
+
 /* Trigger a page-in for a batch of pages */
 static void resume_pages(struct xenpaging *paging, int num_pages)
 {
@@ -753,19 +752,61 @@ static void resume_pages(struct xenpaging *paging, int num_pages)
         page_in_trigger();
 }
 
-/* Evict one gfn and write it to the given slot
+/* Reserve a free slot in the paging file for gfn
+ * Returns the slot, or -1 if the paging file is full
+ */
+static int alloc_slot(struct xenpaging *paging, unsigned long gfn, int *scan)
+{
+    int slot;
+
+    /* Reuse known free slots */
+    if ( paging->stack_count > 0 )
+        slot = paging->free_slot_stack[--paging->stack_count];
+    else
+    {
+        /* Scan all slots for remainders */
+        for ( slot = *scan; slot < paging->max_pages; slot++ )
+            if ( !paging->slot_to_gfn[slot] )
+                break;
+        if ( slot >= paging->max_pages )
+            return -1;
+        *scan = slot + 1;
+    }
+
+    paging->slot_to_gfn[slot] = gfn;
+    return slot;
+}
+
+static void free_slot(struct xenpaging *paging, int slot)
+{
+    paging->slot_to_gfn[slot] = 0;
+    paging->free_slot_stack[paging->stack_count++] = slot;
+}
+
+/* Evict a batch of pages and write them to free slots in the paging file
+ * All victims are nominated first, then mapped with a single call and
+ * written out in runs of consecutive slots, before being evicted.
  * Returns < 0 on fatal error
- * Returns 0 on successful evict
- * Returns > 0 if no gfn can be evicted
+ * Returns 0 if no gfn can be evicted
+ * Returns > 0 on successful evict
  */
-static int evict_victim(struct xenpaging *paging, int slot)
+static int evict_pages(struct xenpaging *paging, int num_pages)
 {
     xc_interface *xch = paging->xc_handle;
-    unsigned long gfn;
+    xen_pfn_t gfns[XENPAGING_EVICT_BATCH];
+    int slots[XENPAGING_EVICT_BATCH];
+    int wslots[XENPAGING_EVICT_BATCH];
+    int err[XENPAGING_EVICT_BATCH];
     static int num_paged_out;
-    int ret;
+    unsigned long gfn;
+    void *page;
+    int i, j, nr = 0, mapped, num = 0, scan = 0;
 
-    do
+    if ( num_pages > XENPAGING_EVICT_BATCH )
+        num_pages = XENPAGING_EVICT_BATCH;
+
+    /* Nominate victims */
+    while ( nr < num_pages && !interrupted )
     {
         gfn = policy_choose_victim(paging);
         if ( gfn == INVALID_MFN )
@@ -781,70 +822,118 @@ static int evict_victim(struct xenpaging *paging, int slot)
                 xenpaging_mem_paging_flush_ioemu_cache(paging);
                 num_paged_out = paging->num_paged_out;
             }
-            ret = ENOSPC;
-            goto out;
+            break;
         }
 
-        if ( interrupted )
+        if ( xc_mem_paging_nominate(xch, paging->vm_event.domain_id, gfn) < 0 )
         {
-            ret = EINTR;
-            goto out;
+            /* unpageable gfn is indicated by EBUSY */
+            if ( errno == EBUSY )
+                continue;
+            PERROR("Error nominating page %lx", gfn);
+            return -1;
         }
 
-        ret = xenpaging_evict_page(paging, gfn, slot);
-        if ( ret < 0 )
-            goto out;
+        gfns[nr++] = gfn;
     }
-    while ( ret );
 
-    if ( test_and_set_bit(gfn, paging->bitmap) )
-        ERROR("Page %lx has been evicted before", gfn);
+    if ( !nr )
+        return 0;
 
-    ret = 0;
+    /* Map all victims at once */
+    page = xc_map_foreign_bulk(xch, paging->vm_event.domain_id, PROT_READ,
+                               gfns, err, nr);
+    if ( page == NULL )
+    {
+        PERROR("Error mapping %d pages", nr);
+        return -1;
+    }
+    mapped = nr;
 
- out:
-    return ret;
-}
+    for ( i = 0; i < nr; i++ )
+    {
+        slots[i] = -1;
+        if ( err[i] )
+        {
+            DPRINTF("Nominated page %"PRI_xen_pfn" not mappable: %d",
+                    gfns[i], err[i]);
+            continue;
+        }
+        slots[i] = alloc_slot(paging, gfns[i], &scan);
+        if ( slots[i] < 0 )
+            break;
+    }
+    nr = i;
 
-/* Evict a batch of pages and write them to a free slot in the paging file
- * Returns < 0 on fatal error
- * Returns 0 if no gfn can be evicted
- * Returns > 0 on successful evict
- */
-static int evict_pages(struct xenpaging *paging, int num_pages)
-{
-    xc_interface *xch = paging->xc_handle;
-    int rc, slot, num = 0;
+    /* Keep what compresses well in memory, the rest goes to disk */
+    for ( i = 0; i < nr; i++ )
+    {
+        wslots[i] = slots[i];
+        if ( slots[i] >= 0 &&
+             !zpool_store(gfns[i], page + ((size_t)i << PAGE_SHIFT)) )
+            wslots[i] = -1;
+    }
 
-    /* Reuse known free slots */
-    while ( paging->stack_count > 0 && num < num_pages )
+    /* Write out runs of pages going to consecutive slots in one go */
+    for ( i = 0; i < nr; i = j )
     {
-        slot = paging->free_slot_stack[--paging->stack_count];
-        rc = evict_victim(paging, slot);
-        if ( rc )
+        for ( j = i + 1; j < nr && wslots[i] >= 0 &&
+                         wslots[j] == wslots[j - 1] + 1; j++ )
+            ;
+        if ( wslots[i] < 0 )
+            continue;
+
+        if ( write_pages(paging->fd, page + ((size_t)i << PAGE_SHIFT),
+                         wslots[i], j - i) < 0 )
         {
-            num = rc < 0 ? -1 : num;
-            return num;
+            PERROR("Error copying pages %"PRI_xen_pfn"-%"PRI_xen_pfn,
+                   gfns[i], gfns[j - 1]);
+            munmap(page, (size_t)mapped << PAGE_SHIFT);
+            return -1;
         }
-        num++;
     }
 
-    /* Scan all slots slots for remainders */
-    for ( slot = 0; slot < paging->max_pages && num < num_pages; slot++ )
+    /* Release pages */
+    munmap(page, (size_t)mapped << PAGE_SHIFT);
+
+    for ( i = 0; i < nr; i++ )
     {
-        /* Slot is allocated */
-        if ( paging->slot_to_gfn[slot] )
+        if ( slots[i] < 0 )
             continue;
 
-        rc = evict_victim(paging, slot);
-        if ( rc )
+        /* Tell Xen to evict page */
+        if ( xc_mem_paging_evict(xch, paging->vm_event.domain_id, gfns[i]) < 0 )
         {
-            num = rc < 0 ? -1 : num;
-            break;
+            /* A gfn in use is indicated by EBUSY */
+            if ( errno == EBUSY )
+            {
+                DPRINTF("Nominated page %"PRI_xen_pfn" busy", gfns[i]);
+                zpool_drop(gfns[i]);
+                free_slot(paging, slots[i]);
+                continue;
+            }
+            PERROR("Error evicting page %"PRI_xen_pfn, gfns[i]);
+            return -1;
         }
 
+        DPRINTF("evict_page > gfn %"PRI_xen_pfn" pageslot %d\n",
+                gfns[i], slots[i]);
+        /* Notify policy of page being paged out */
+        policy_notify_paged_out(gfns[i]);
+
+        /* Update index */
+        paging->gfn_to_slot[gfns[i]] = slots[i];
+
+        /* Record number of evicted pages */
+        paging->num_paged_out++;
+        paging->num_evicted++;
+
+        if ( test_and_set_bit(gfns[i], paging->bitmap) )
+            ERROR("Page %"PRI_xen_pfn" has been evicted before", gfns[i]);
+
         num++;
     }
+
     return num;
 }
 
@@ -933,6 +1022,7 @@ int main(int argc, char *argv[])
                             req.u.mem_paging.gfn, slot);
                     /* Notify policy of page being dropped */
                     policy_notify_dropped(req.u.mem_paging.gfn);
+                    zpool_drop(req.u.mem_paging.gfn);
                 }
                 else
                 {
@@ -942,6 +1032,13 @@ int main(int argc, char *argv[])
                         ERROR("Error populating page %"PRIx64"", req.u.mem_paging.gfn);
                         goto out;
                     }
+
+                    /* A paused vcpu means the guest itself touched the page */
+                    if ( req.flags & VM_EVENT_FLAG_VCPU_PAUSED )
+                    {
+                        paging->num_faulted_back++;
+                        readahead_pages(paging, req.u.mem_paging.gfn);
+                    }
                 }
 
                 /* Prepare the response */
@@ -1030,10 +1127,10 @@ int main(int argc, char *argv[])
                 prev_num = num;
             }
             /* Limit the number of evicts to be able to process page-in requests */
-            if ( num > 42 )
+            if ( num > XENPAGING_EVICT_BATCH )
             {
                 paging->use_poll_timeout = 0;
-                num = 42;
+                num = XENPAGING_EVICT_BATCH;
             }
             if ( evict_pages(paging, num) < 0 )
                 goto out;
@@ -1052,6 +1149,8 @@ int main(int argc, char *argv[])
         /* Now target was reached, enable poll() timeout */
         else
         {
+            if ( !paging->use_poll_timeout )
+                report_faultback(paging);
             paging->use_poll_timeout = 1;
         }
 
@@ -1061,6 +1160,7 @@ int main(int argc, char *argv[])
     rc = 0;
 
     DPRINTF("xenpaging got signal %d\n", interrupted);
+    report_faultback(paging);
 
  out:
     close(paging->fd);
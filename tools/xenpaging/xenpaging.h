@@ -32,6 +32,10 @@
 #include <xen/vm_event.h>
 
 #define XENPAGING_PAGEIN_QUEUE_SIZE 64
+/* Maximum number of pages nominated, mapped and written out together */
+#define XENPAGING_EVICT_BATCH 256
+/* Default number of neighbouring gfns paged in on a guest fault */
+#define XENPAGING_READAHEAD 8
 
 struct vm_event {
     domid_t domain_id;
@@ -60,6 +64,12 @@ struct xenpaging {
     int num_paged_out;
     int target_tot_pages;
     int policy_mru_size;
+    int readahead;
+    /* size in bytes of the compressed page pool, 0 if disabled */
+    size_t zpool_size;
+    /* pages evicted, and pages the guest faulted back in, since start */
+    unsigned long num_evicted;
+    unsigned long num_faulted_back;
     int use_poll_timeout;
     int debug;
     int stack_count;
@@ -0,0 +1,138 @@
+/******************************************************************************
+ * tools/xenpaging/zpool.c
+ *
+ * In-memory pool of compressed guest pages.
+ *
+ * Evicted pages are LZ4 compressed into dom0 memory first, so that most
+ * page-ins are served from RAM.  Only pages which do not compress well,
+ * or do not fit into the pool any more, are written to the paging file.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <xc_private.h>
+#include "../../xen/include/xen/lz4.h"
+#include "zpool.h"
+
+
+/* Pages compressing worse than this go straight to the paging file */
+#define ZPOOL_MAX_LEN (PAGE_SIZE * 3 / 4)
+
+
+static void **entries;
+static unsigned short *lengths;
+static unsigned long nr_gfns;
+static unsigned long pool_pages;
+static size_t pool_used;
+static size_t pool_max;
+static void *wrkmem;
+static unsigned char *cbuf;
+
+
+int zpool_init(size_t max_bytes, unsigned long max_pages)
+{
+    pool_max = max_bytes;
+    if ( !pool_max )
+        return 0;
+
+    nr_gfns = max_pages;
+    entries = calloc(nr_gfns, sizeof(*entries));
+    lengths = calloc(nr_gfns, sizeof(*lengths));
+    wrkmem = malloc(LZ4_MEM_COMPRESS);
+    cbuf = malloc(lz4_compressbound(PAGE_SIZE));
+    if ( !entries || !lengths || !wrkmem || !cbuf )
+    {
+        pool_max = 0;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Returns 0 if the page went into the pool, 1 if it has to go to disk */
+int zpool_store(unsigned long gfn, const void *page)
+{
+    size_t len = lz4_compressbound(PAGE_SIZE);
+    void *p;
+
+    if ( !pool_max || gfn >= nr_gfns )
+        return 1;
+
+    if ( lz4_compress(page, PAGE_SIZE, cbuf, &len, wrkmem) ||
+         len > ZPOOL_MAX_LEN )
+        return 1;
+
+    /* Pool is full, spill to the paging file */
+    if ( pool_used + len > pool_max )
+        return 1;
+
+    p = malloc(len);
+    if ( !p )
+        return 1;
+    memcpy(p, cbuf, len);
+
+    zpool_drop(gfn);
+    entries[gfn] = p;
+    lengths[gfn] = len;
+    pool_used += len;
+    pool_pages++;
+
+    return 0;
+}
+
+/* Returns 0 if the page was found in the pool, 1 if not, < 0 on error */
+int zpool_load(unsigned long gfn, void *page)
+{
+    size_t len = PAGE_SIZE;
+    int rc;
+
+    if ( !pool_max || gfn >= nr_gfns || !entries[gfn] )
+        return 1;
+
+    rc = lz4_decompress_unknownoutputsize(entries[gfn], lengths[gfn],
+                                          page, &len);
+    zpool_drop(gfn);
+
+    return (rc || len != PAGE_SIZE) ? -EIO : 0;
+}
+
+void zpool_drop(unsigned long gfn)
+{
+    if ( !pool_max || gfn >= nr_gfns || !entries[gfn] )
+        return;
+
+    free(entries[gfn]);
+    entries[gfn] = NULL;
+    pool_used -= lengths[gfn];
+    pool_pages--;
+}
+
+void zpool_stats(unsigned long *pages, size_t *bytes)
+{
+    *pages = pool_pages;
+    *bytes = pool_used;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,44 @@
+/******************************************************************************
+ * tools/xenpaging/zpool.h
+ *
+ * In-memory pool of compressed guest pages.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __XEN_PAGING_ZPOOL_H__
+#define __XEN_PAGING_ZPOOL_H__
+
+
+#include <stddef.h>
+
+int zpool_init(size_t max_bytes, unsigned long max_pages);
+int zpool_store(unsigned long gfn, const void *page);
+int zpool_load(unsigned long gfn, void *page);
+void zpool_drop(unsigned long gfn);
+void zpool_stats(unsigned long *pages, size_t *bytes);
+
+#endif // __XEN_PAGING_ZPOOL_H__
+
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -60,7 +60,9 @@ static void xenstat_free_xen_version(xenstat_node * node);
 static void xenstat_free_vbds(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
-static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
+static int  xenstat_get_domain_names(xenstat_handle * handle,
+				     xc_domaininfo_t *info, unsigned int num,
+				     char *names[]);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
 static xenstat_collector collectors[] = {
@@ -164,9 +166,10 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 	xenstat_node *node;
 	xc_physinfo_t physinfo = { 0 };
 	xc_domaininfo_t domaininfo[DOMAIN_CHUNK_SIZE];
+	char *names[DOMAIN_CHUNK_SIZE];
 	int new_domains;
 	unsigned int i;
-	int rc;
+	int rc, tmem;
 
 	/* Create the node */
 	node = (xenstat_node *) calloc(1, sizeof(xenstat_node));
@@ -193,6 +196,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 	rc = xc_tmem_control(handle->xc_handle, -1,
                          XEN_SYSCTL_TMEM_OP_QUERY_FREEABLE_MB, -1, 0, 0, NULL);
 	node->freeable_mb = (rc < 0) ? 0 : rc;
+	/* Without tmem, don't ask for its statistics once per domain. */
+	tmem = rc >= 0;
 	/* malloc(0) is not portable, so allocate a single domain.  This will
 	 * be resized below. */
 	node->domains = malloc(sizeof(xenstat_domain));
@@ -220,6 +225,14 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 
 		node->domains = tmp;
 
+		/* All of the chunk's names, in as few round trips as we can */
+		if (xenstat_get_domain_names(handle, domaininfo, new_domains,
+					     names) < 0) {
+			/* fatal error */
+			xenstat_free_node(node);
+			return NULL;
+		}
+
 		domain = node->domains + node->num_domains;
 
 		/* zero out newly allocated memory in case error occurs below */
@@ -228,20 +241,12 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		for (i = 0; i < new_domains; i++) {
 			/* Fill in domain using domaininfo[i] */
 			domain->id = domaininfo[i].domain;
-			domain->name = xenstat_get_domain_name(handle, 
-							       domain->id);
+			domain->name = names[i];
 			if (domain->name == NULL) {
-				if (errno == ENOMEM) {
-					/* fatal error */
-					xenstat_free_node(node);
-					return NULL;
-				}
-				else {
-					/* failed to get name -- this means the
-					   domain is being destroyed so simply
-					   ignore this entry */
-					continue;
-				}
+				/* failed to get name -- this means the
+				   domain is being destroyed so simply
+				   ignore this entry */
+				continue;
 			}
 			domain->state = domaininfo[i].flags;
 			domain->cpu_ns = domaininfo[i].cpu_time;
@@ -260,7 +265,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 			domain->networks = NULL;
 			domain->num_vbds = 0;
 			domain->vbds = NULL;
-			domain_get_tmem_stats(handle,domain);
+			if (tmem)
+				domain_get_tmem_stats(handle,domain);
 
 			domain++;
 			node->num_domains++;
@@ -308,13 +314,18 @@ void xenstat_free_node(xenstat_node * node)
 
 xenstat_domain *xenstat_node_domain(xenstat_node * node, unsigned int domid)
 {
-	unsigned int i;
-
-	/* FIXME: binary search */
-	/* Find the appropriate domain entry in the node struct. */
-	for (i = 0; i < node->num_domains; i++) {
-		if (node->domains[i].id == domid)
-			return &(node->domains[i]);
+	unsigned int lo = 0, hi = node->num_domains, mid;
+
+	/* Find the appropriate domain entry in the node struct, which is
+	 * sorted by domain id as xc_domain_getinfolist() returns them. */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (node->domains[mid].id == domid)
+			return &(node->domains[mid]);
+		if (node->domains[mid].id < domid)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 	return NULL;
 }
@@ -483,44 +494,85 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /* Collect information about VCPUs */
 static int xenstat_collect_vcpus(xenstat_node * node)
 {
-	unsigned int i, vcpu, inc_index;
-
-	/* Fill in VCPU information */
-	for (i = 0; i < node->num_domains; i+=inc_index) {
-		inc_index = 1; /* default is to increment to next domain */
+#define VCPU_CHUNK_SIZE 1024
+	xc_vcpuinfolist_t *info;
+	unsigned int i, j, size = VCPU_CHUNK_SIZE;
+	uint32_t first = 0, next;
+	unsigned char *seen;
+	int n;
 
-		node->domains[i].vcpus = malloc(node->domains[i].num_vcpus
-						* sizeof(xenstat_vcpu));
+	for (i = 0; i < node->num_domains; i++) {
+		node->domains[i].vcpus = calloc(node->domains[i].num_vcpus,
+						sizeof(xenstat_vcpu));
 		if (node->domains[i].vcpus == NULL)
 			return 0;
-	
-		for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
-			/* FIXME: need to be using a more efficient mechanism*/
-			xc_vcpuinfo_t info;
-
-			if (xc_vcpu_getinfo(node->handle->xc_handle,
-					    node->domains[i].id, vcpu, &info) != 0) {
-				if (errno == ENOMEM) {
-					/* fatal error */ 
-					return 0;
-				}
-				else {
-					/* domain is in transition - remove
-					   from list */
-					xenstat_prune_domain(node, i);
-
-					/* remember not to increment index! */
-					inc_index = 0;
-					break;
-				}
-			}
-			else {
-				node->domains[i].vcpus[vcpu].online = info.online;
-				node->domains[i].vcpus[vcpu].ns = info.cpu_time;
-			}
+	}
+
+	seen = calloc(node->num_domains, 1);
+	info = malloc(size * sizeof(*info));
+	if (seen == NULL || info == NULL)
+		goto err;
+
+	/* Fetch the vCPUs of all domains in as few hypercalls as possible;
+	 * both lists are sorted by domain id, so walk them in step. */
+	i = 0;
+	for (;;) {
+		n = xc_vcpu_getinfolist(node->handle->xc_handle, first, size,
+					info, &next);
+		if (n < 0 && errno == ENOBUFS) {
+			/* A single domain with more vCPUs than fit. */
+			xc_vcpuinfolist_t *tmp;
+
+			size *= 2;
+			tmp = realloc(info, size * sizeof(*info));
+			if (tmp == NULL)
+				goto err;
+			info = tmp;
+			continue;
+		}
+		if (n < 0)
+			goto err;
+
+		for (j = 0; j < n; j++) {
+			xenstat_domain *domain;
+
+			while (i < node->num_domains &&
+			       node->domains[i].id < info[j].domid)
+				i++;
+			if (i == node->num_domains)
+				break;
+			domain = &node->domains[i];
+			if (domain->id != info[j].domid ||
+			    info[j].vcpu >= domain->num_vcpus)
+				continue;
+
+			domain->vcpus[info[j].vcpu].online = info[j].online;
+			domain->vcpus[info[j].vcpu].ns = info[j].cpu_time;
+			seen[i] = 1;
 		}
+
+		if (next == DOMID_INVALID)
+			break;
+		first = next;
 	}
+
+	/* Domains which have gone since are in transition - remove them */
+	for (i = node->num_domains; i-- > 0; ) {
+		if (seen[i])
+			continue;
+		free(node->domains[i].vcpus);
+		free(node->domains[i].name);
+		xenstat_prune_domain(node, i);
+	}
+
+	free(info);
+	free(seen);
 	return 1;
+
+err:
+	free(info);
+	free(seen);
+	return 0;
 }
 
 /* Free VCPU information */
@@ -763,13 +815,38 @@ unsigned long long xenstat_tmem_succ_pers_gets(xenstat_tmem *tmem)
 }
 
 
-static char *xenstat_get_domain_name(xenstat_handle *handle, unsigned int domain_id)
+/* Read the names of num domains into names[], NULL for any that couldn't
+ * be read.  Returns -1 if out of memory, which is fatal. */
+static int xenstat_get_domain_names(xenstat_handle *handle,
+				    xc_domaininfo_t *info, unsigned int num,
+				    char *names[])
 {
-	char path[80];
+	char (*buf)[32];
+	const char **paths;
+	unsigned int i;
+	int ret = 0;
+
+	buf = malloc(num * sizeof(*buf));
+	paths = malloc(num * sizeof(*paths));
+	if ((buf == NULL || paths == NULL) && num)
+		ret = -1;
 
-	snprintf(path, sizeof(path),"/local/domain/%i/name", domain_id);
+	for (i = 0; ret == 0 && i < num; i++) {
+		snprintf(buf[i], sizeof(buf[i]), "/local/domain/%u/name",
+			 info[i].domain);
+		paths[i] = buf[i];
+	}
+
+	/* Short of memory, xs_read_multi() fails as for the domains which
+	 * are going away, leaving all of names[] NULL. */
+	if (ret == 0 && !xs_read_multi(handle->xshandle, XBT_NULL, num,
+				       paths, (void **)names, NULL) &&
+	    errno == ENOMEM)
+		ret = -1;
 
-	return xs_read(handle->xshandle, XBT_NULL, path, NULL);
+	free(paths);
+	free(buf);
+	return ret;
 }
 
 /* Remove specified entry from list of domains */
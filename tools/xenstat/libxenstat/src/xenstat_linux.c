@@ -34,9 +34,27 @@
 
 #define SYSFS_VBD_PATH "/sys/bus/xen-backend/devices"
 
+/* The statistics files of a VBD backend, kept open across refreshes */
+static const char *vbd_stats[] = {
+	"statistics/oo_req",
+	"statistics/rd_req",
+	"statistics/wr_req",
+	"statistics/rd_sect",
+	"statistics/wr_sect",
+};
+#define NUM_VBD_STATS (sizeof(vbd_stats) / sizeof(vbd_stats[0]))
+
+struct vbd_files {
+	char name[64];
+	int fd[NUM_VBD_STATS];
+	int seen;
+};
+
 struct priv_data {
 	FILE *procnetdev;
 	DIR *sysfsvbd;
+	struct vbd_files *vbds;
+	unsigned int num_vbds, max_vbds, next_vbd;
 };
 
 static struct priv_data *
@@ -49,8 +67,7 @@ get_priv_data(xenstat_handle *handle)
 	if (handle->priv == NULL)
 		return (NULL);
 
-	((struct priv_data *)handle->priv)->procnetdev = NULL;
-	((struct priv_data *)handle->priv)->sysfsvbd = NULL;
+	memset(handle->priv, 0, sizeof(struct priv_data));
 
 	return handle->priv;
 }
@@ -385,20 +402,71 @@ void xenstat_uninit_networks(xenstat_handle * handle)
 		fclose(priv->procnetdev);
 }
 
-static int read_attributes_vbd(const char *vbd_directory, const char *what, char *ret, int cap)
+static void close_vbd_files(struct vbd_files *vbd)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_VBD_STATS; i++)
+		if (vbd->fd[i] >= 0)
+			close(vbd->fd[i]);
+}
+
+/* Find, or open, the statistics files of the backend in @vbd_directory.
+ * Directories are mostly listed in the same order at every refresh, so
+ * the search starts after the entry found last. */
+static struct vbd_files *get_vbd_files(struct priv_data *priv,
+				       const char *vbd_directory)
+{
+	char file_name[80];
+	struct vbd_files *vbd;
+	unsigned int i, n;
+
+	for (n = 0; n < priv->num_vbds; n++) {
+		i = (priv->next_vbd + n) % priv->num_vbds;
+		if (strcmp(priv->vbds[i].name, vbd_directory) == 0) {
+			priv->next_vbd = i + 1;
+			return &priv->vbds[i];
+		}
+	}
+
+	if (strlen(vbd_directory) >= sizeof(vbd->name))
+		return NULL;
+
+	if (priv->num_vbds == priv->max_vbds) {
+		unsigned int max = priv->max_vbds ? priv->max_vbds * 2 : 64;
+		struct vbd_files *tmp = realloc(priv->vbds, max * sizeof(*tmp));
+
+		if (tmp == NULL)
+			return NULL;
+		priv->vbds = tmp;
+		priv->max_vbds = max;
+	}
+
+	vbd = &priv->vbds[priv->num_vbds];
+	strcpy(vbd->name, vbd_directory);
+	vbd->seen = 0;
+	for (i = 0; i < NUM_VBD_STATS; i++) {
+		snprintf(file_name, sizeof(file_name), "%s/%s/%s",
+			 SYSFS_VBD_PATH, vbd_directory, vbd_stats[i]);
+		vbd->fd[i] = open(file_name, O_RDONLY, 0);
+	}
+
+	priv->num_vbds++;
+	priv->next_vbd = priv->num_vbds;
+	return vbd;
+}
+
+/* Re-read an attribute: sysfs regenerates it on a read from offset 0 */
+static int read_attributes_vbd(int fd, unsigned long long *val)
 {
-	static char file_name[80];
-	int fd, num_read;
-
-	snprintf(file_name, sizeof(file_name), "%s/%s/%s",
-		SYSFS_VBD_PATH, vbd_directory, what);
-	fd = open(file_name, O_RDONLY, 0);
-	if (fd==-1) return -1;
-	num_read = read(fd, ret, cap - 1);
-	close(fd);
+	char buf[256];
+	int num_read;
+
+	if (fd == -1) return -1;
+	num_read = pread(fd, buf, sizeof(buf) - 1, 0);
 	if (num_read<=0) return -1;
-	ret[num_read] = '\0';
-	return num_read;
+	buf[num_read] = '\0';
+	return sscanf(buf, "%llu", val) == 1 ? num_read : -1;
 }
 
 /* Collect information about VBDs */
@@ -406,6 +474,7 @@ int xenstat_collect_vbds(xenstat_node * node)
 {
 	struct dirent *dp;
 	struct priv_data *priv = get_priv_data(node->handle);
+	unsigned int i, j;
 
 	if (priv == NULL) {
 		perror("Allocation error");
@@ -429,6 +498,7 @@ int xenstat_collect_vbds(xenstat_node * node)
 	    dp = readdir(priv->sysfsvbd)) {
 		xenstat_domain *domain;
 		xenstat_vbd vbd;
+		struct vbd_files *files;
 		unsigned int domid;
 		int ret;
 		char buf[256];
@@ -453,33 +523,19 @@ int xenstat_collect_vbds(xenstat_node * node)
 			continue;
 		}
 
-		if((read_attributes_vbd(dp->d_name, "statistics/oo_req", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.oo_reqs)) != 1))
-		{
-			continue;
-		}
-
-		if((read_attributes_vbd(dp->d_name, "statistics/rd_req", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.rd_reqs)) != 1))
-		{
-			continue;
-		}
-
-		if((read_attributes_vbd(dp->d_name, "statistics/wr_req", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.wr_reqs)) != 1))
-		{
-			continue;
-		}
-
-		if((read_attributes_vbd(dp->d_name, "statistics/rd_sect", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.rd_sects)) != 1))
-		{
+		files = get_vbd_files(priv, dp->d_name);
+		if (files == NULL)
 			continue;
-		}
+		files->seen = 1;
 
-		if((read_attributes_vbd(dp->d_name, "statistics/wr_sect", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.wr_sects)) != 1))
+		if ((read_attributes_vbd(files->fd[0], &vbd.oo_reqs) <= 0) ||
+		    (read_attributes_vbd(files->fd[1], &vbd.rd_reqs) <= 0) ||
+		    (read_attributes_vbd(files->fd[2], &vbd.wr_reqs) <= 0) ||
+		    (read_attributes_vbd(files->fd[3], &vbd.rd_sects) <= 0) ||
+		    (read_attributes_vbd(files->fd[4], &vbd.wr_sects) <= 0))
 		{
+			/* Reopen them next time, the backend may be new */
+			files->seen = 0;
 			continue;
 		}
 
@@ -489,6 +545,18 @@ int xenstat_collect_vbds(xenstat_node * node)
 		}
 	}
 
+	/* Close the files of backends which have gone away */
+	for (i = j = 0; i < priv->num_vbds; i++) {
+		if (!priv->vbds[i].seen) {
+			close_vbd_files(&priv->vbds[i]);
+			continue;
+		}
+		priv->vbds[i].seen = 0;
+		priv->vbds[j++] = priv->vbds[i];
+	}
+	priv->num_vbds = j;
+	priv->next_vbd = 0;
+
 	return 1;	
 }
 
@@ -496,6 +564,13 @@ int xenstat_collect_vbds(xenstat_node * node)
 void xenstat_uninit_vbds(xenstat_handle * handle)
 {
 	struct priv_data *priv = get_priv_data(handle);
-	if (priv != NULL && priv->sysfsvbd != NULL)
+	unsigned int i;
+
+	if (priv == NULL)
+		return;
+	if (priv->sysfsvbd != NULL)
 		closedir(priv->sysfsvbd);
+	for (i = 0; i < priv->num_vbds; i++)
+		close_vbd_files(&priv->vbds[i]);
+	free(priv->vbds);
 }
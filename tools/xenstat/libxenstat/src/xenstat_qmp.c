@@ -141,52 +141,53 @@ done:
 static void lookup_xenstore_devid(xenstat_node * node, unsigned int domid, char *qmp_devname,
 	int qfd, unsigned int *dev, unsigned int *sector_size)
 {
-	char **dev_ids, *tmp, *ptr, *image, path[80];
-	unsigned int num_dev_ids;
-	int i, devid;
+	struct xs_subtree_entry *entries;
+	char *tmp, *leaf, *image, path[80];
+	unsigned int num_entries;
+	int i, j, devid;
 
-	/* Get all the qdisk dev IDs associated with the this VM */
+	/* Get all the qdisk devices associated with the this VM, and their
+	   parameters in the same round trip */
 	snprintf(path, sizeof(path),"/local/domain/0/backend/qdisk/%i", domid);
-	dev_ids = xs_directory(node->handle->xshandle, XBT_NULL, path, &num_dev_ids);
-	if (dev_ids == NULL) {
+	entries = xs_read_subtree(node->handle->xshandle, XBT_NULL, path, 2, &num_entries);
+	if (entries == NULL) {
 		return;
 	}
 
 	/* Get the filename of the image associated with this QMP device */
 	image = qmp_get_block_image(node, qmp_devname, qfd);
 	if (image == NULL) {
-		free(dev_ids);
+		free(entries);
 		return;
 	}
 
 	/* Look for a matching image in xenstore */
-	for (i=0; i<num_dev_ids; i++) {
-		devid = atoi(dev_ids[i]);
-		/* Get the xenstore name of the image */
-		snprintf(path, sizeof(path),"/local/domain/0/backend/qdisk/%i/%i/params", domid, devid);
-		if ((ptr = xs_read(node->handle->xshandle, XBT_NULL, path, NULL)) == NULL)
+	for (i=0; i<num_entries; i++) {
+		/* Get the xenstore name of the image, from <devid>/params */
+		leaf = strchr(entries[i].name, '/');
+		if (leaf == NULL || strcmp(leaf, "/params") || entries[i].value == NULL)
 			continue;
 
 		/* Get to actual path in string */
-		if ((tmp = strchr(ptr, '/')) == NULL)
-			tmp = ptr;
+		if ((tmp = strchr(entries[i].value, '/')) == NULL)
+			tmp = entries[i].value;
 		if (!strcmp(tmp,image)) {
+			devid = atoi(entries[i].name);
 			*dev = devid;
-			free(ptr);
 
 			/* Get the xenstore sector size of the image while we're here */
-			snprintf(path, sizeof(path),"/local/domain/0/backend/qdisk/%i/%i/sector-size", domid, devid);
-			if ((ptr = xs_read(node->handle->xshandle, XBT_NULL, path, NULL)) != NULL) {
-				*sector_size = atoi((char *)ptr);
-				free(ptr);
+			for (j=0; j<num_entries; j++) {
+				leaf = strchr(entries[j].name, '/');
+				if (leaf != NULL && !strcmp(leaf, "/sector-size") &&
+				    entries[j].value != NULL && atoi(entries[j].name) == devid)
+					*sector_size = atoi(entries[j].value);
 			}
 			break;
 		}
-		free(ptr);
 	}
 
 	free(image);
-	free(dev_ids);
+	free(entries);
 }
 
 /* Parse the stats buffer which contains I/O data for all the disks belonging to domid */
@@ -49,6 +49,8 @@
 
 struct xs_handle;
 typedef uint32_t xs_transaction_t;
+/* An asynchronous request: 0 means none. */
+typedef uint32_t xs_request_t;
 
 /* IMPORTANT: For details on xenstore protocol limits, see
  * docs/misc/xenstore.txt in the Xen public source repository, and use the
@@ -114,6 +116,60 @@ char **xs_directory(struct xs_handle *h, xs_transaction_t t,
 void *xs_read(struct xs_handle *h, xs_transaction_t t,
 	      const char *path, unsigned int *len);
 
+/* Get the values of several files, as if by xs_read() for each, in as few
+ * round trips as the daemon allows.  values[i] is set to the malloced value
+ * of paths[i], or NULL if it couldn't be read, and lens[i] (if lens isn't
+ * NULL) to its length.
+ * Returns false on failure, with all of values[] NULL.
+ */
+bool xs_read_multi(struct xs_handle *h, xs_transaction_t t,
+		   unsigned int num, const char *const paths[],
+		   void *values[], unsigned int lens[]);
+
+/* A node below the path given to xs_read_subtree(). */
+struct xs_subtree_entry {
+	char *name;		/* Relative to that path. */
+	void *value;		/* Nul terminated, or NULL if unreadable. */
+	unsigned int len;	/* Not counting the nul. */
+};
+
+/* Get the nodes below path, down to depth levels (0 for all of them), and
+ * their values, parents before their children.  This takes one round trip
+ * if the subtree fits in a reply, rather than one for each directory.
+ * Returns a malloced array: call free() on it after use.
+ * Num indicates size.
+ */
+struct xs_subtree_entry *xs_read_subtree(struct xs_handle *h,
+					 xs_transaction_t t,
+					 const char *path, unsigned int depth,
+					 unsigned int *num);
+
+/* Asynchronous requests.
+ * The xs_*_async() calls send a request and return at once, so that many
+ * can be outstanding, and the daemon's round trip time is paid once for
+ * all of them rather than for each.  They return the request, or 0 (with
+ * errno set) on failure.
+ * The reply must be collected, in any order and by any thread, with the
+ * xs_wait_*() call of the same name, which blocks until it arrives and then
+ * returns as the synchronous call would.  Every request must be waited for,
+ * as its reply is kept until then.
+ */
+xs_request_t xs_read_async(struct xs_handle *h, xs_transaction_t t,
+			   const char *path);
+xs_request_t xs_directory_async(struct xs_handle *h, xs_transaction_t t,
+				const char *path);
+xs_request_t xs_write_async(struct xs_handle *h, xs_transaction_t t,
+			    const char *path, const void *data,
+			    unsigned int len);
+xs_request_t xs_rm_async(struct xs_handle *h, xs_transaction_t t,
+			 const char *path);
+
+void *xs_wait_read(struct xs_handle *h, xs_request_t req, unsigned int *len);
+char **xs_wait_directory(struct xs_handle *h, xs_request_t req,
+			 unsigned int *num);
+bool xs_wait_write(struct xs_handle *h, xs_request_t req);
+bool xs_wait_rm(struct xs_handle *h, xs_request_t req);
+
 /* Write the value of a single file.
  * Returns false on failure.
  */
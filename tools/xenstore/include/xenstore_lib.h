@@ -42,6 +42,48 @@ struct xs_permissions
 	enum xs_perm_type perms;
 };
 
+/* Header of the node record in tdb. */
+struct xs_tdb_record_hdr {
+	uint64_t generation;
+	uint32_t num_perms;
+	uint32_t datalen;
+	uint32_t childlen;
+	struct xs_permissions perms[0];
+};
+
+/*
+ * Read-only snapshot of the store which xenstored can keep in a file next
+ * to its socket (see xs_daemon_snapshot()), for local clients to read
+ * without asking.  Nodes are in hash chains by path, lengths and offsets
+ * in bytes from the start of the file.
+ *
+ * generation is odd while the snapshot is not the same as the store:
+ * from the first change to it until the snapshot has been rewritten.
+ * Readers check it is even and unchanged after reading, and ask
+ * xenstored otherwise.
+ */
+#define XS_SNAPSHOT_MAGIC	0x58535331	/* "XSS1" */
+#define XS_SNAPSHOT_MAX_SIZE	(64u << 20)
+
+struct xs_snapshot {
+	uint32_t magic;
+	uint32_t generation;
+	uint32_t size;		/* Valid bytes, no more than MAX_SIZE. */
+	uint32_t nr_buckets;	/* A power of 2. */
+	uint32_t buckets[0];	/* First node of each chain, or 0. */
+};
+
+struct xs_snapshot_node {
+	uint32_t next;		/* Next node in the chain, or 0. */
+	uint32_t namelen;	/* Including the nul. */
+	uint32_t datalen;
+	uint32_t childlen;
+	char name[0];		/* Then the data, then the children. */
+};
+
+/* The hash chain of path in a snapshot with nr_buckets buckets. */
+uint32_t xs_snapshot_bucket(const char *path, uint32_t nr_buckets);
+
 /* Each 10 bits takes ~ 3 digits, plus one, plus one for nul terminator. */
 #define MAX_STRLEN(x) ((sizeof(x) * CHAR_BIT + CHAR_BIT-1) / 10 * 3 + 2)
 
@@ -52,6 +94,7 @@ const char *xs_daemon_socket(void);
 const char *xs_daemon_socket_ro(void);
 const char *xs_domain_dev(void);
 const char *xs_daemon_tdb(void);
+const char *xs_daemon_snapshot(void);
 
 /* Simple write function: loops for you. */
 bool xs_write_all(int fd, const void *data, unsigned int len);
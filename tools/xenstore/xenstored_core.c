@@ -19,6 +19,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #ifndef NO_SOCKETS
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -49,6 +52,7 @@
 #include "xenstored_core.h"
 #include "xenstored_watch.h"
 #include "xenstored_transaction.h"
+#include "xenstored_snapshot.h"
 #include "xenstored_domain.h"
 #include "tdb.h"
 
@@ -66,9 +70,15 @@
 
 extern xenevtchn_handle *xce_handle; /* in xenstored_domain.c */
 static int xce_pollfd_idx = -1;
-static struct pollfd *fds;
-static unsigned int current_array_size;
-static unsigned int nr_fds;
+
+/* Identify the non-connection fds in the event loop. */
+static char sock_tag, ro_sock_tag, reopen_log_tag, xce_tag;
+
+/* Domain connections which have requests or output pending. */
+static LIST_HEAD(active_domains);
+
+/* Requests handled from one ring before servicing other connections. */
+#define DOMAIN_REQUEST_BATCH 16
 
 #define ROUNDUP(_x, _w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
 
@@ -80,11 +90,11 @@ static bool remove_local = true;
 static int reopen_log_pipe[2];
 static int reopen_log_pipe0_pollfd_idx = -1;
 static char *tracefile = NULL;
-static TDB_CONTEXT *tdb_ctx = NULL;
+TDB_CONTEXT *tdb_ctx = NULL;
 static bool trigger_talloc_report = false;
 
-static void corrupt(struct connection *conn, const char *fmt, ...);
 static void check_store(void);
+static void del_fd(int fd, int idx, void *data);
 
 #define log(...)							\
 	do {								\
@@ -102,25 +112,14 @@ static void check_store(void);
 
 int quota_nb_entry_per_domain = 1000;
 int quota_nb_watch_per_domain = 128;
+int quota_nb_watch_per_conn = 0; /* unlimited */
 int quota_max_entry_size = 2048; /* 2K */
 int quota_max_transaction = 10;
 
-TDB_CONTEXT *tdb_context(struct connection *conn)
+void set_tdb_key(const char *name, TDB_DATA *key)
 {
-	/* conn = NULL used in manual_node at setup. */
-	if (!conn || !conn->transaction)
-		return tdb_ctx;
-	return tdb_transaction_context(conn->transaction);
-}
-
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb)
-{
-	if (!(tdb_ctx->flags & TDB_INTERNAL))
-		if (rename(newname, xs_daemon_tdb()) != 0)
-			return false;
-	tdb_close(tdb_ctx);
-	tdb_ctx = talloc_steal(talloc_autofree_context(), newtdb);
-	return true;
+	key->dptr = (char *)name;
+	key->dsize = strlen(name);
 }
 
 static char *sockmsg_string(enum xsd_sockmsg_type type)
@@ -147,6 +146,8 @@ static char *sockmsg_string(enum xsd_sockmsg_type type)
 	case XS_RESUME: return "RESUME";
 	case XS_SET_TARGET: return "SET_TARGET";
 	case XS_RESET_WATCHES: return "RESET_WATCHES";
+	case XS_READ_MULTI: return "READ_MULTI";
+	case XS_READ_SUBTREE: return "READ_SUBTREE";
 	default:
 		return "**UNKNOWN**";
 	}
@@ -310,21 +311,108 @@ static int destroy_conn(void *_conn)
 		       && poll(&pfd, 1, 0) == 1)
 			if (!write_messages(conn))
 				break;
+		if (conn->pollfd_idx != -1)
+			del_fd(conn->fd, conn->pollfd_idx, conn);
 		close(conn->fd);
 	}
         if (conn->target)
                 talloc_unlink(conn, conn->target);
 	list_del(&conn->list);
+	list_del(&conn->active_list);
 	trace_destroy(conn, "connection");
 	return 0;
 }
 
-/* This function returns index inside the array if succeed, -1 if fail */
-static int set_fd(int fd, short events)
+/*
+ * The main loop's fd set is maintained incrementally as fds come and go:
+ * with epoll on Linux, elsewhere with a persistent pollfd array in which
+ * free slots have fd == -1.  add_fd() returns the slot (0 for epoll), or -1
+ * on failure.
+ */
+#ifdef __linux__
+#define NR_READY_EVENTS 64
+
+static int epoll_fd = -1;
+static struct epoll_event ready_events[NR_READY_EVENTS];
+static int nr_ready;
+
+/* The EPOLL* event bits have the values of their POLL* counterparts. */
+static int add_fd(int fd, void *data, short events)
 {
-	int ret;
+	struct epoll_event ev = { .events = events, .data.ptr = data };
+
+	if (epoll_fd == -1) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd == -1)
+			barf_perror("Could not create epoll instance");
+	}
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		syslog(LOG_ERR, "epoll_ctl failed, ignoring fd %d\n", fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void mod_fd(int fd, int idx, void *data, short events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = data };
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev))
+		syslog(LOG_ERR, "epoll_ctl failed for fd %d\n", fd);
+}
+
+static void del_fd(int fd, int idx, void *data)
+{
+	int i;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+	/* Don't hand out stale events for it in this iteration. */
+	for (i = 0; i < nr_ready; i++)
+		if (ready_events[i].data.ptr == data)
+			ready_events[i].data.ptr = NULL;
+}
+
+static int wait_fds(int timeout)
+{
+	nr_ready = epoll_wait(epoll_fd, ready_events, NR_READY_EVENTS,
+			      timeout);
+	return nr_ready;
+}
+
+static void *next_ready_fd(int *iter, short *revents)
+{
+	while (*iter < nr_ready) {
+		struct epoll_event *ev = &ready_events[(*iter)++];
+
+		if (ev->data.ptr) {
+			*revents = ev->events;
+			return ev->data.ptr;
+		}
+	}
+
+	nr_ready = 0;
+	return NULL;
+}
+#else
+static struct pollfd *fds;
+static void **fds_data;
+static unsigned int current_array_size;
+static unsigned int nr_fds;
+
+static int add_fd(int fd, void *data, short events)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_fds; i++)
+		if (fds[i].fd == -1)
+			goto found;
+
 	if (current_array_size < nr_fds + 1) {
 		struct pollfd *new_fds = NULL;
+		void **new_data = NULL;
 		unsigned long newsize;
 
 		/* Round up to 2^8 boundary, in practice this just
@@ -336,60 +424,84 @@ static int set_fd(int fd, short events)
 		if (!new_fds)
 			goto fail;
 		fds = new_fds;
+		new_data = realloc(fds_data, sizeof(void *)*newsize);
+		if (!new_data)
+			goto fail;
+		fds_data = new_data;
 
 		memset(&fds[0] + current_array_size, 0,
 		       sizeof(struct pollfd ) * (newsize-current_array_size));
 		current_array_size = newsize;
 	}
+	i = nr_fds++;
 
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
+ found:
+	fds[i].fd = fd;
+	fds[i].events = events;
+	fds[i].revents = 0;
+	fds_data[i] = data;
 
-	return ret;
+	return i;
 fail:
 	syslog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
 	return -1;
 }
 
-static void initialize_fds(int sock, int *p_sock_pollfd_idx,
-			   int ro_sock, int *p_ro_sock_pollfd_idx,
-			   int *ptimeout)
+static void mod_fd(int fd, int idx, void *data, short events)
 {
-	struct connection *conn;
-
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
-	nr_fds = 0;
+	fds[idx].events = events;
+}
 
-	*ptimeout = -1;
+static void del_fd(int fd, int idx, void *data)
+{
+	fds[idx].fd = -1;
+	fds[idx].revents = 0;
+	fds_data[idx] = NULL;
+}
 
-	if (sock != -1)
-		*p_sock_pollfd_idx = set_fd(sock, POLLIN|POLLPRI);
-	if (ro_sock != -1)
-		*p_ro_sock_pollfd_idx = set_fd(ro_sock, POLLIN|POLLPRI);
-	if (reopen_log_pipe[0] != -1)
-		reopen_log_pipe0_pollfd_idx =
-			set_fd(reopen_log_pipe[0], POLLIN|POLLPRI);
+static int wait_fds(int timeout)
+{
+	return poll(fds, nr_fds, timeout);
+}
 
-	if (xce_handle != NULL)
-		xce_pollfd_idx = set_fd(xenevtchn_fd(xce_handle),
-					POLLIN|POLLPRI);
+static void *next_ready_fd(int *iter, short *revents)
+{
+	while (*iter < nr_fds) {
+		int i = (*iter)++;
 
-	list_for_each_entry(conn, &connections, list) {
-		if (conn->domain) {
-			if (domain_can_read(conn) ||
-			    (domain_can_write(conn) &&
-			     !list_empty(&conn->out_list)))
-				*ptimeout = 0;
-		} else {
-			short events = POLLIN|POLLPRI;
-			if (!list_empty(&conn->out_list))
-				events |= POLLOUT;
-			conn->pollfd_idx = set_fd(conn->fd, events);
+		if (fds[i].fd != -1 && fds[i].revents) {
+			*revents = fds[i].revents;
+			fds[i].revents = 0;
+			return fds_data[i];
 		}
 	}
+
+	return NULL;
+}
+#endif
+
+/* Poll a socket connection for output only while it has some queued. */
+static void update_conn_events(struct connection *conn)
+{
+	bool pollout = !list_empty(&conn->out_list);
+
+	if (conn->pollfd_idx == -1 || conn->pollout == pollout)
+		return;
+
+	conn->pollout = pollout;
+	mod_fd(conn->fd, conn->pollfd_idx, conn,
+	       POLLIN|POLLPRI|(pollout ? POLLOUT : 0));
+}
+
+void conn_wake(struct connection *conn)
+{
+	if (!conn->domain) {
+		update_conn_events(conn);
+		return;
+	}
+
+	if (list_empty(&conn->active_list))
+		list_add_tail(&conn->active_list, &active_domains);
 }
 
 /* Is child a subnode of parent, or equal? */
@@ -416,87 +528,123 @@ static struct node *read_node(struct connection *conn, const void *ctx,
 			      const char *name)
 {
 	TDB_DATA key, data;
-	uint32_t *p;
+	struct xs_tdb_record_hdr *hdr;
 	struct node *node;
-	TDB_CONTEXT * context = tdb_context(conn);
 
-	key.dptr = (void *)name;
-	key.dsize = strlen(name);
-	data = tdb_fetch(context, key);
+	node = talloc(ctx, struct node);
+	if (!node) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	node->name = talloc_strdup(node, name);
+	if (!node->name) {
+		talloc_free(node);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (transaction_prepend(conn, node, name, &key)) {
+		talloc_free(node);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	data = tdb_fetch(tdb_ctx, key);
 
 	if (data.dptr == NULL) {
-		if (tdb_error(context) == TDB_ERR_NOEXIST)
+		if (tdb_error(tdb_ctx) == TDB_ERR_NOEXIST) {
+			/* Record the absence so a later creation conflicts. */
+			node->generation = NO_GENERATION;
+			access_node(conn, node, NODE_ACCESS_READ, NULL);
 			errno = ENOENT;
-		else {
-			log("TDB error on read: %s", tdb_errorstr(context));
+		} else {
+			log("TDB error on read: %s", tdb_errorstr(tdb_ctx));
 			errno = EIO;
 		}
+		talloc_free(node);
 		return NULL;
 	}
 
-	node = talloc(ctx, struct node);
-	node->name = talloc_strdup(node, name);
 	node->parent = NULL;
-	node->tdb = tdb_context(conn);
+	node->conn = conn;
 	talloc_steal(node, data.dptr);
 
-	/* Datalen, childlen, number of permissions */
-	p = (uint32_t *)data.dptr;
-	node->num_perms = p[0];
-	node->datalen = p[1];
-	node->childlen = p[2];
+	/* Generation, datalen, childlen, number of permissions */
+	hdr = (void *)data.dptr;
+	node->generation = hdr->generation;
+	node->num_perms = hdr->num_perms;
+	node->datalen = hdr->datalen;
+	node->childlen = hdr->childlen;
 
 	/* Permissions are struct xs_permissions. */
-	node->perms = (void *)&p[3];
+	node->perms = hdr->perms;
 	/* Data is binary blob (usually ascii, no nul). */
 	node->data = node->perms + node->num_perms;
 	/* Children is strings, nul separated. */
 	node->children = node->data + node->datalen;
 
+	if (access_node(conn, node, NODE_ACCESS_READ, NULL)) {
+		talloc_free(node);
+		errno = ENOMEM;
+		return NULL;
+	}
+
 	return node;
 }
 
-static bool write_node(struct connection *conn, const struct node *node)
+int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node,
+		   bool no_quota_check)
 {
-	/*
-	 * conn will be null when this is called from manual_node.
-	 * tdb_context copes with this.
-	 */
-
-	TDB_DATA key, data;
+	TDB_DATA data;
 	void *p;
+	struct xs_tdb_record_hdr *hdr;
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
-	data.dsize = 3*sizeof(uint32_t)
+	data.dsize = sizeof(*hdr)
 		+ node->num_perms*sizeof(node->perms[0])
 		+ node->datalen + node->childlen;
 
-	if (domain_is_unprivileged(conn) && data.dsize >= quota_max_entry_size)
-		goto error;
+	if (!no_quota_check && domain_is_unprivileged(conn) &&
+	    data.dsize >= quota_max_entry_size) {
+		errno = ENOSPC;
+		return errno;
+	}
 
 	data.dptr = talloc_size(node, data.dsize);
-	((uint32_t *)data.dptr)[0] = node->num_perms;
-	((uint32_t *)data.dptr)[1] = node->datalen;
-	((uint32_t *)data.dptr)[2] = node->childlen;
-	p = data.dptr + 3 * sizeof(uint32_t);
+	if (!data.dptr) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	hdr = (void *)data.dptr;
+	hdr->generation = node->generation;
+	hdr->num_perms = node->num_perms;
+	hdr->datalen = node->datalen;
+	hdr->childlen = node->childlen;
 
-	memcpy(p, node->perms, node->num_perms*sizeof(node->perms[0]));
-	p += node->num_perms*sizeof(node->perms[0]);
+	memcpy(hdr->perms, node->perms, node->num_perms*sizeof(node->perms[0]));
+	p = hdr->perms + node->num_perms;
 	memcpy(p, node->data, node->datalen);
 	p += node->datalen;
 	memcpy(p, node->children, node->childlen);
 
 	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_context(conn), key, data, TDB_REPLACE) != 0) {
-		corrupt(conn, "Write of %s failed", key.dptr);
-		goto error;
+	if (tdb_store(tdb_ctx, *key, data, TDB_REPLACE) != 0) {
+		corrupt(conn, "Write of %s failed", key->dptr);
+		errno = ENOSPC;
+		return errno;
 	}
-	return true;
- error:
-	errno = ENOSPC;
-	return false;
+	return 0;
+}
+
+static bool write_node(struct connection *conn, struct node *node)
+{
+	/* conn will be null when this is called from manual_node. */
+	TDB_DATA key;
+
+	if (access_node(conn, node, NODE_ACCESS_WRITE, &key))
+		return false;
+
+	return !write_node_raw(conn, &key, node, false);
 }
 
 static enum xs_perm_type perm_for_conn(struct connection *conn,
@@ -689,6 +837,7 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
+	conn_wake(conn);
 }
 
 /* Some routines (write, mkdir, etc) just need a non-error return */
@@ -697,7 +846,7 @@ void send_ack(struct connection *conn, enum xsd_sockmsg_type type)
 	send_reply(conn, type, "OK", sizeof("OK"));
 }
 
-void send_error(struct connection *conn, int error)
+static const char *error_string(int error)
 {
 	unsigned int i;
 
@@ -708,8 +857,14 @@ void send_error(struct connection *conn, int error)
 			break;
 		}
 	}
-	send_reply(conn, XS_ERROR, xsd_errors[i].errstring,
-			  strlen(xsd_errors[i].errstring) + 1);
+	return xsd_errors[i].errstring;
+}
+
+void send_error(struct connection *conn, int error)
+{
+	const char *errstring = error_string(error);
+
+	send_reply(conn, XS_ERROR, errstring, strlen(errstring) + 1);
 }
 
 static bool valid_chars(const char *node)
@@ -822,14 +977,164 @@ static void do_read(struct connection *conn, struct buffered_data *in)
 	send_reply(conn, XS_READ, node->data, node->datalen);
 }
 
+/* As many nodes as fit in the reply: see XS_READ_MULTI in xs_wire.h. */
+static void do_read_multi(struct connection *conn, struct buffered_data *in)
+{
+	unsigned int num, i, len = 0, hdrlen, datalen;
+	char **vec, *reply, hdr[16];
+	const char *name, *data;
+	struct node *node;
+
+	num = xs_count_strings(in->buffer, in->used);
+	if (!num) {
+		send_error(conn, EINVAL);
+		return;
+	}
+
+	vec = talloc_array(in, char *, num);
+	reply = talloc_array(in, char, XENSTORE_PAYLOAD_MAX);
+	if (!vec || !reply) {
+		send_error(conn, ENOMEM);
+		return;
+	}
+	get_strings(in, vec, num);
+
+	for (i = 0; i < num; i++) {
+		name = canonicalize(conn, vec[i]);
+		node = get_node(conn, in, name, XS_PERM_READ);
+		if (node) {
+			snprintf(hdr, sizeof(hdr), "%u", node->datalen);
+			data = node->data;
+			datalen = node->datalen;
+		} else {
+			snprintf(hdr, sizeof(hdr), "%s", error_string(errno));
+			data = NULL;
+			datalen = 0;
+		}
+
+		hdrlen = strlen(hdr) + 1;
+		if (len + hdrlen + datalen > XENSTORE_PAYLOAD_MAX)
+			break;
+		memcpy(reply + len, hdr, hdrlen);
+		if (datalen)
+			memcpy(reply + len + hdrlen, data, datalen);
+		len += hdrlen + datalen;
+	}
+
+	send_reply(conn, XS_READ_MULTI, reply, len);
+}
+
+/* Append the records for the children of parent, and for their children
+ * down to depth levels (0 for all), to reply.  Returns an errno, or 0. */
+static int add_subtree(struct connection *conn, struct node *parent,
+		       const char *relname, unsigned int depth,
+		       char *reply, unsigned int *len)
+{
+	unsigned int i, namelen, hdrlen, datalen;
+	struct node *node;
+	char *path, *name, hdr[16];
+	const char *data;
+	void *ctx;
+	int ret = 0;
+
+	for (i = 0; i < parent->childlen && !ret;
+	     i += strlen(parent->children + i) + 1) {
+		ctx = talloc_new(NULL);
+		if (!ctx)
+			return ENOMEM;
+
+		path = talloc_asprintf(ctx, "%s%s%s", parent->name,
+				       streq(parent->name, "/") ? "" : "/",
+				       parent->children + i);
+		name = relname ? talloc_asprintf(ctx, "%s/%s", relname,
+						 parent->children + i)
+			       : talloc_strdup(ctx, parent->children + i);
+		if (!path || !name) {
+			talloc_free(ctx);
+			return ENOMEM;
+		}
+
+		node = get_node(conn, ctx, path, XS_PERM_READ);
+		if (node) {
+			snprintf(hdr, sizeof(hdr), "%u", node->datalen);
+			data = node->data;
+			datalen = node->datalen;
+		} else {
+			snprintf(hdr, sizeof(hdr), "%s", error_string(errno));
+			data = NULL;
+			datalen = 0;
+		}
+
+		namelen = strlen(name) + 1;
+		hdrlen = strlen(hdr) + 1;
+		if (*len + namelen + hdrlen + datalen > XENSTORE_PAYLOAD_MAX) {
+			talloc_free(ctx);
+			return E2BIG;
+		}
+		memcpy(reply + *len, name, namelen);
+		memcpy(reply + *len + namelen, hdr, hdrlen);
+		if (datalen)
+			memcpy(reply + *len + namelen + hdrlen, data, datalen);
+		*len += namelen + hdrlen + datalen;
+
+		if (node && depth != 1)
+			ret = add_subtree(conn, node, name,
+					  depth ? depth - 1 : 0, reply, len);
+		talloc_free(ctx);
+	}
+
+	return ret;
+}
+
+/* A whole subtree in one reply: see XS_READ_SUBTREE in xs_wire.h. */
+static void do_read_subtree(struct connection *conn, struct buffered_data *in)
+{
+	unsigned int len = 0;
+	struct node *node;
+	char *vec[2], *reply;
+	const char *name;
+	int ret;
+
+	if (get_strings(in, vec, ARRAY_SIZE(vec)) != ARRAY_SIZE(vec)) {
+		send_error(conn, EINVAL);
+		return;
+	}
+
+	name = canonicalize(conn, vec[0]);
+	node = get_node(conn, in, name, XS_PERM_READ);
+	if (!node) {
+		send_error(conn, errno);
+		return;
+	}
+
+	reply = talloc_array(in, char, XENSTORE_PAYLOAD_MAX);
+	if (!reply) {
+		send_error(conn, ENOMEM);
+		return;
+	}
+
+	ret = add_subtree(conn, node, NULL, atoi(vec[1]), reply, &len);
+	if (ret) {
+		send_error(conn, ret);
+		return;
+	}
+
+	send_reply(conn, XS_READ_SUBTREE, reply, len);
+}
+
 static void delete_node_single(struct connection *conn, struct node *node)
 {
 	TDB_DATA key;
+	int ret;
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
+	ret = access_node(conn, node, NODE_ACCESS_DELETE, &key);
+	if (ret < 0) {
+		corrupt(conn, "Could not delete '%s'", node->name);
+		return;
+	}
 
-	if (tdb_delete(tdb_context(conn), key) != 0) {
+	/* Nothing to delete if the transaction never held a copy. */
+	if (ret == 0 && tdb_delete(tdb_ctx, key) != 0) {
 		corrupt(conn, "Could not delete '%s'", node->name);
 		return;
 	}
@@ -870,8 +1175,9 @@ static struct node *construct_node(struct connection *conn, const char *name)
 
 	/* Allocate node */
 	node = talloc(name, struct node);
-	node->tdb = tdb_context(conn);
+	node->conn = conn;
 	node->name = talloc_strdup(node, name);
+	node->generation = NO_GENERATION;
 
 	/* Inherit permissions, except unprivileged domains own what they create */
 	node->num_perms = parent->num_perms;
@@ -896,10 +1202,8 @@ static int destroy_node(void *_node)
 	if (streq(node->name, "/"))
 		corrupt(NULL, "Destroying root node!");
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
-	tdb_delete(node->tdb, key);
+	if (access_node(node->conn, node, NODE_ACCESS_DELETE, &key) == 0)
+		tdb_delete(tdb_ctx, key);
 	return 0;
 }
 
@@ -1231,6 +1535,17 @@ static void do_debug(struct connection *conn, struct buffered_data *in)
 	if (streq(in->buffer, "check"))
 		check_store();
 
+	if (streq(in->buffer, "watches")) {
+		char *stats = watch_stats(in);
+
+		if (!stats) {
+			send_error(conn, ENOMEM);
+			return;
+		}
+		send_reply(conn, XS_DEBUG, stats, strlen(stats) + 1);
+		return;
+	}
+
 	send_ack(conn, XS_DEBUG);
 }
 
@@ -1259,6 +1574,14 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 		do_read(conn, in);
 		break;
 
+	case XS_READ_MULTI:
+		do_read_multi(conn, in);
+		break;
+
+	case XS_READ_SUBTREE:
+		do_read_subtree(conn, in);
+		break;
+
 	case XS_WRITE:
 		do_write(conn, in);
 		break;
@@ -1351,7 +1674,8 @@ static void consider_message(struct connection *conn)
 
 /* Errors in reading or allocating here mean we get out of sync, so we
  * drop the whole client connection. */
-static void handle_input(struct connection *conn)
+/* Returns false if conn was killed. */
+static bool handle_input(struct connection *conn)
 {
 	int bytes;
 	struct buffered_data *in = conn->in;
@@ -1364,7 +1688,7 @@ static void handle_input(struct connection *conn)
 			goto bad_client;
 		in->used += bytes;
 		if (in->used != sizeof(in->hdr))
-			return;
+			return true;
 
 		if (in->hdr.msg.len > XENSTORE_PAYLOAD_MAX) {
 			syslog(LOG_ERR, "Client tried to feed us %i",
@@ -1386,21 +1710,83 @@ static void handle_input(struct connection *conn)
 
 	in->used += bytes;
 	if (in->used != in->hdr.msg.len)
-		return;
+		return true;
 
 	trace_io(conn, in, 0);
 	consider_message(conn);
-	return;
+	return true;
 
 bad_client:
 	/* Kill it. */
 	talloc_free(conn);
+	return false;
+}
+
+/* Returns false if conn was killed. */
+static bool handle_output(struct connection *conn)
+{
+	if (!write_messages(conn)) {
+		talloc_free(conn);
+		return false;
+	}
+	return true;
 }
 
-static void handle_output(struct connection *conn)
+static void handle_socket_conn(struct connection *conn, short revents)
 {
-	if (!write_messages(conn))
+	/* Hold a reference: handling conn may free it. */
+	talloc_increase_ref_count(conn);
+	if (revents & ~(POLLIN|POLLOUT))
 		talloc_free(conn);
+	else if (revents & POLLIN)
+		handle_input(conn);
+	if (talloc_free(conn) == 0)
+		return;
+
+	if (revents & POLLOUT) {
+		talloc_increase_ref_count(conn);
+		handle_output(conn);
+		if (talloc_free(conn) == 0)
+			return;
+	}
+
+	update_conn_events(conn);
+}
+
+/*
+ * Service the domain connections which were signalled or had responses
+ * queued.  Several requests are taken from a ring per visit; a domain with
+ * more left, or with output the ring had no room for, stays active.
+ */
+static void handle_domain_conns(void)
+{
+	LIST_HEAD(work);
+	struct connection *conn;
+	unsigned int n;
+
+	list_splice_init(&active_domains, &work);
+
+	while ((conn = list_top(&work, struct connection, active_list))) {
+		list_del_init(&conn->active_list);
+
+		talloc_increase_ref_count(conn);
+		for (n = 0; n < DOMAIN_REQUEST_BATCH && domain_can_read(conn);
+		     n++)
+			if (!handle_input(conn))
+				break;
+		if (talloc_free(conn) == 0)
+			continue;
+
+		talloc_increase_ref_count(conn);
+		if (domain_can_write(conn) && !list_empty(&conn->out_list))
+			handle_output(conn);
+		if (talloc_free(conn) == 0)
+			continue;
+
+		if (domain_can_read(conn) ||
+		    (domain_can_write(conn) && !list_empty(&conn->out_list)))
+			conn_wake(conn);
+	}
 }
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
@@ -1413,6 +1799,7 @@ struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 
 	new->fd = -1;
 	new->pollfd_idx = -1;
+	new->pollout = false;
 	new->write = write;
 	new->read = read;
 	new->can_write = true;
@@ -1420,6 +1807,7 @@ struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 	INIT_LIST_HEAD(&new->out_list);
 	INIT_LIST_HEAD(&new->watches);
 	INIT_LIST_HEAD(&new->transaction_list);
+	INIT_LIST_HEAD(&new->active_list);
 
 	new->in = new_buffer(new);
 	if (new->in == NULL) {
@@ -1489,6 +1877,9 @@ static void accept_connection(int sock, bool canwrite)
 	if (conn) {
 		conn->fd = fd;
 		conn->can_write = canwrite;
+		conn->pollfd_idx = add_fd(fd, conn, POLLIN|POLLPRI);
+		if (conn->pollfd_idx == -1)
+			talloc_free(conn);
 	} else
 		close(fd);
 }
@@ -1588,7 +1979,7 @@ static void setup_structure(void)
 }
 
 
-static unsigned int hash_from_key_fn(void *k)
+unsigned int hash_from_key_fn(void *k)
 {
 	char *str = k;
 	unsigned int hash = 5381;
@@ -1601,7 +1992,7 @@ static unsigned int hash_from_key_fn(void *k)
 }
 
 
-static int keys_equal_fn(void *key1, void *key2)
+int keys_equal_fn(void *key1, void *key2)
 {
 	return 0 == strcmp((char *)key1, (char *)key2);
 }
@@ -1618,7 +2009,7 @@ static char *child_name(const char *s1, const char *s2)
 }
 
 
-static void remember_string(struct hashtable *hash, const char *str)
+void remember_string(struct hashtable *hash, const char *str)
 {
 	char *k = malloc(strlen(str) + 1);
 	strcpy(k, str);
@@ -1710,12 +2101,24 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
 			void *private)
 {
 	struct hashtable *reachable = private;
+	char *slash;
 	char * name = talloc_strndup(NULL, key.dptr, key.dsize);
 
+	/*
+	 * Transaction-private copies are keyed "<generation>/<path>".  They
+	 * are live as long as their transaction is.
+	 */
+	if (name[0] != '/') {
+		slash = strchr(name, '/');
+		if (slash)
+			*slash = 0;
+	}
+
 	if (!hashtable_search(reachable, name)) {
 		log("clean_store: '%s' is orphaned!", name);
 		if (recovery) {
 			tdb_delete(tdb, key);
+			snapshot_changed();
 		}
 	}
 
@@ -1743,6 +2146,7 @@ static void check_store(void)
  
 	log("Checking store ...");
 	check_store_(root, reachable);
+	check_transactions(reachable);
 	clean_store(reachable);
 	log("Checking store complete.");
 
@@ -1753,7 +2157,7 @@ static void check_store(void)
 
 
 /* Something is horribly wrong: check the store. */
-static void corrupt(struct connection *conn, const char *fmt, ...)
+void corrupt(struct connection *conn, const char *fmt, ...)
 {
 	va_list arglist;
 	char *str;
@@ -1860,12 +2264,15 @@ static void usage(void)
 "  -E, --entry-nb <nb>     limit the number of entries per domain,\n"
 "  -S, --entry-size <size> limit the size of entry per domain, and\n"
 "  -W, --watch-nb <nb>     limit the number of watches per domain,\n"
+"  -w, --conn-watch-nb <nb> limit the number of watches per connection,\n"
+"                          including privileged ones (default unlimited),\n"
 "  -t, --transaction <nb>  limit the number of transaction allowed per domain,\n"
 "  -R, --no-recovery       to request that no recovery should be attempted when\n"
 "                          the store is corrupted (debug only),\n"
 "  -I, --internal-db       store database in memory, not on disk\n"
 "  -L, --preserve-local    to request that /local is preserved on start-up,\n"
 "  -M, --memory-debug <file>  support memory debugging to file,\n"
+"  -Z, --snapshot          keep a read-only copy of the store for local clients,\n"
 "  -V, --verbose           to request verbose execution.\n");
 }
 
@@ -1888,7 +2295,9 @@ static struct option options[] = {
 	{ "internal-db", 0, NULL, 'I' },
 	{ "verbose", 0, NULL, 'V' },
 	{ "watch-nb", 1, NULL, 'W' },
+	{ "conn-watch-nb", 1, NULL, 'w' },
 	{ "memory-debug", 1, NULL, 'M' },
+	{ "snapshot", 0, NULL, 'Z' },
 	{ NULL, 0, NULL, 0 } };
 
 extern void dump_conn(struct connection *conn); 
@@ -1899,16 +2308,18 @@ int priv_domid = 0;
 int main(int argc, char *argv[])
 {
 	int opt, *sock = NULL, *ro_sock = NULL;
-	int sock_pollfd_idx = -1, ro_sock_pollfd_idx = -1;
 	bool dofork = true;
 	bool outputpid = false;
 	bool no_domain_init = false;
+	bool snapshot = false;
 	const char *pidfile = NULL;
 	const char *memfile = NULL;
-	int timeout;
+	int timeout, iter;
+	short revents;
+	void *data;
 
 
-	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RLVW:M:", options,
+	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RLVW:w:M:Z", options,
 				  NULL)) != -1) {
 		switch (opt) {
 		case 'D':
@@ -1953,6 +2364,9 @@ int main(int argc, char *argv[])
 		case 'W':
 			quota_nb_watch_per_domain = strtol(optarg, NULL, 10);
 			break;
+		case 'w':
+			quota_nb_watch_per_conn = strtol(optarg, NULL, 10);
+			break;
 		case 'e':
 			dom0_event = strtol(optarg, NULL, 10);
 			break;
@@ -1965,6 +2379,9 @@ int main(int argc, char *argv[])
 		case 'M':
 			memfile = optarg;
 			break;
+		case 'Z':
+			snapshot = true;
+			break;
 		}
 	}
 	if (optind != argc)
@@ -2003,6 +2420,9 @@ int main(int argc, char *argv[])
 	/* Setup the database */
 	setup_structure();
 
+	if (snapshot)
+		snapshot_init();
+
 	/* Listen to hypervisor. */
 	if (!no_domain_init)
 		domain_init();
@@ -2022,8 +2442,18 @@ int main(int argc, char *argv[])
 	signal(SIGHUP, trigger_reopen_log);
 
 	/* Get ready to listen to the tools. */
-	initialize_fds(*sock, &sock_pollfd_idx, *ro_sock, &ro_sock_pollfd_idx,
-		       &timeout);
+	if (*sock != -1 && add_fd(*sock, &sock_tag, POLLIN|POLLPRI) == -1)
+		barf("Could not poll socket");
+	if (*ro_sock != -1 &&
+	    add_fd(*ro_sock, &ro_sock_tag, POLLIN|POLLPRI) == -1)
+		barf("Could not poll ro socket");
+	if (reopen_log_pipe[0] != -1)
+		reopen_log_pipe0_pollfd_idx =
+			add_fd(reopen_log_pipe[0], &reopen_log_tag,
+			       POLLIN|POLLPRI);
+	if (xce_handle != NULL)
+		xce_pollfd_idx = add_fd(xenevtchn_fd(xce_handle), &xce_tag,
+					POLLIN|POLLPRI);
 
 	/* Tell the kernel we're up and running. */
 	xenbus_notify_running();
@@ -2035,7 +2465,6 @@ int main(int argc, char *argv[])
 
 	/* Main loop. */
 	for (;;) {
-		struct connection *conn, *next;
 
 		if (trigger_talloc_report) {
 			FILE *out;
@@ -2049,112 +2478,55 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		if (poll(fds, nr_fds, timeout) < 0) {
+		/* Don't block while domain requests are outstanding. */
+		timeout = list_empty(&active_domains) ? -1 : 0;
+		timeout = snapshot_timeout(timeout);
+
+		if (wait_fds(timeout) < 0) {
 			if (errno == EINTR)
 				continue;
 			barf_perror("Poll failed");
 		}
 
-		if (reopen_log_pipe0_pollfd_idx != -1) {
-			if (fds[reopen_log_pipe0_pollfd_idx].revents
-			    & ~POLLIN) {
-				close(reopen_log_pipe[0]);
-				close(reopen_log_pipe[1]);
-				init_pipe(reopen_log_pipe);
-			} else if (fds[reopen_log_pipe0_pollfd_idx].revents
-				   & POLLIN) {
-				char c;
-				if (read(reopen_log_pipe[0], &c, 1) != 1)
-					barf_perror("read failed");
-				reopen_log();
-			}
-			reopen_log_pipe0_pollfd_idx = -1;
-		}
-
-		if (sock_pollfd_idx != -1) {
-			if (fds[sock_pollfd_idx].revents & ~POLLIN) {
-				barf_perror("sock poll failed");
-				break;
-			} else if (fds[sock_pollfd_idx].revents & POLLIN) {
+		iter = 0;
+		while ((data = next_ready_fd(&iter, &revents))) {
+			if (data == &reopen_log_tag) {
+				if (revents & ~POLLIN) {
+					del_fd(reopen_log_pipe[0],
+					       reopen_log_pipe0_pollfd_idx,
+					       &reopen_log_tag);
+					close(reopen_log_pipe[0]);
+					close(reopen_log_pipe[1]);
+					init_pipe(reopen_log_pipe);
+					reopen_log_pipe0_pollfd_idx =
+						add_fd(reopen_log_pipe[0],
+						       &reopen_log_tag,
+						       POLLIN|POLLPRI);
+				} else if (revents & POLLIN) {
+					char c;
+					if (read(reopen_log_pipe[0], &c, 1) != 1)
+						barf_perror("read failed");
+					reopen_log();
+				}
+			} else if (data == &sock_tag) {
+				if (revents & ~POLLIN)
+					barf_perror("sock poll failed");
 				accept_connection(*sock, true);
-				sock_pollfd_idx = -1;
-			}
-		}
-
-		if (ro_sock_pollfd_idx != -1) {
-			if (fds[ro_sock_pollfd_idx].revents & ~POLLIN) {
-				barf_perror("ro sock poll failed");
-				break;
-			} else if (fds[ro_sock_pollfd_idx].revents & POLLIN) {
+			} else if (data == &ro_sock_tag) {
+				if (revents & ~POLLIN)
+					barf_perror("ro sock poll failed");
 				accept_connection(*ro_sock, false);
-				ro_sock_pollfd_idx = -1;
-			}
-		}
-
-		if (xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~POLLIN) {
-				barf_perror("xce_handle poll failed");
-				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN) {
+			} else if (data == &xce_tag) {
+				if (revents & ~POLLIN)
+					barf_perror("xce_handle poll failed");
 				handle_event();
-				xce_pollfd_idx = -1;
-			}
+			} else
+				handle_socket_conn(data, revents);
 		}
 
-		next = list_entry(connections.next, typeof(*conn), list);
-		if (&next->list != &connections)
-			talloc_increase_ref_count(next);
-		while (&next->list != &connections) {
-			conn = next;
-
-			next = list_entry(conn->list.next,
-					  typeof(*conn), list);
-			if (&next->list != &connections)
-				talloc_increase_ref_count(next);
-
-			if (conn->domain) {
-				if (domain_can_read(conn))
-					handle_input(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-				if (domain_can_write(conn) &&
-				    !list_empty(&conn->out_list))
-					handle_output(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-			} else {
-				if (conn->pollfd_idx != -1) {
-					if (fds[conn->pollfd_idx].revents
-					    & ~(POLLIN|POLLOUT))
-						talloc_free(conn);
-					else if (fds[conn->pollfd_idx].revents
-						 & POLLIN)
-						handle_input(conn);
-				}
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-
-				if (conn->pollfd_idx != -1) {
-					if (fds[conn->pollfd_idx].revents
-					    & ~(POLLIN|POLLOUT))
-						talloc_free(conn);
-					else if (fds[conn->pollfd_idx].revents
-						 & POLLOUT)
-						handle_output(conn);
-				}
-				if (talloc_free(conn) == 0)
-					continue;
-
-				conn->pollfd_idx = -1;
-			}
-		}
+		handle_domain_conns();
 
-		initialize_fds(*sock, &sock_pollfd_idx, *ro_sock,
-			       &ro_sock_pollfd_idx, &timeout);
+		snapshot_update();
 	}
 }
 
@@ -62,8 +62,13 @@ struct connection
 
 	/* The file descriptor we came in on. */
 	int fd;
-	/* The index of pollfd in global pollfd array */
+	/* Slot of fd in the main loop's fd set, -1 if not polled */
 	int pollfd_idx;
+	/* Is output readiness being polled for? */
+	bool pollout;
+
+	/* Entry in the list of domain connections with work pending */
+	struct list_head active_list;
 
 	/* Who am I? 0 for socket connections. */
 	unsigned int id;
@@ -93,6 +98,7 @@ struct connection
 
 	/* My watches. */
 	struct list_head watches;
+	unsigned int nr_watches;
 
 	/* Methods for communicating over this connection: write can be NULL */
 	connwritefn_t *write;
@@ -103,8 +109,12 @@ extern struct list_head connections;
 struct node {
 	const char *name;
 
-	/* Database I came from */
-	TDB_CONTEXT *tdb;
+	/* Connection which read or created me (NULL for the global store) */
+	struct connection *conn;
+
+	/* Generation count of the last change, NO_GENERATION if new */
+	uint64_t generation;
+#define NO_GENERATION ~((uint64_t)0)
 
 	/* Parent (optional) */
 	struct node *parent;
@@ -153,17 +163,29 @@ struct node *get_node(struct connection *conn,
 		      const char *name,
 		      enum xs_perm_type perm);
 
-/* Get TDB context for this connection */
-TDB_CONTEXT *tdb_context(struct connection *conn);
+/* Something is horribly wrong: check the store. */
+void corrupt(struct connection *conn, const char *fmt, ...);
+
+/* Write a node to the tdb data base. */
+int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node,
+		   bool no_quota_check);
 
-/* Destructor for tdbs: required for transaction code */
-int destroy_tdb(void *_tdb);
+/* Set the tdb key of a node to its name. */
+void set_tdb_key(const char *name, TDB_DATA *key);
 
-/* Replace the tdb: required for transaction code */
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb);
+/* Record a string in a check_store() hashtable. */
+struct hashtable;
+void remember_string(struct hashtable *hash, const char *str);
+
+/* Hash functions for hashtables keyed by strings. */
+unsigned int hash_from_key_fn(void *k);
+int keys_equal_fn(void *key1, void *key2);
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read);
 
+/* conn may have work to do: input on its ring, or queued output. */
+void conn_wake(struct connection *conn);
+
 
 /* Is this a valid node name? */
 bool is_valid_nodename(const char *node);
@@ -180,6 +202,8 @@ extern int dom0_domid;
 extern int dom0_event;
 extern int priv_domid;
 
+extern TDB_CONTEXT *tdb_ctx;
+
 /* Map the kernel's xenstore page. */
 void *xenbus_map(void);
 void unmap_xenbus(void *interface);
@@ -235,18 +235,41 @@ static void domain_cleanup(void)
 		fire_watches(NULL, NULL, "@releaseDomain", false);
 }
 
-/* We scan all domains rather than use the information given here. */
+static struct domain *find_domain_by_port(evtchn_port_t port)
+{
+	struct domain *i;
+
+	list_for_each_entry(i, &domains, list) {
+		if (i->port == port)
+			return i;
+	}
+	return NULL;
+}
+
+/* Event channels handled per read from the driver. */
+#define EVENT_BATCH 64
+
 void handle_event(void)
 {
-	evtchn_port_t port;
+	evtchn_port_t ports[EVENT_BATCH];
+	struct domain *domain;
+	int i, n;
 
-	if ((port = xenevtchn_pending(xce_handle)) == -1)
+	n = xenevtchn_pending_batch(xce_handle, ports, EVENT_BATCH);
+	if (n == -1)
 		barf_perror("Failed to read from event fd");
 
-	if (port == virq_port)
-		domain_cleanup();
+	for (i = 0; i < n; i++) {
+		if (ports[i] == virq_port)
+			domain_cleanup();
+		else {
+			domain = find_domain_by_port(ports[i]);
+			if (domain && domain->conn && domain->interface)
+				conn_wake(domain->conn);
+		}
+	}
 
-	if (xenevtchn_unmask(xce_handle, port) == -1)
+	if (xenevtchn_unmask_batch(xce_handle, ports, n) == -1)
 		barf_perror("Failed to write to event fd");
 }
 
@@ -403,6 +426,7 @@ void do_introduce(struct connection *conn, struct buffered_data *in)
 	}
 
 	domain_conn_reset(domain);
+	conn_wake(domain->conn);
 
 	send_ack(conn, XS_INTRODUCE);
 }
@@ -620,6 +644,7 @@ static int dom0_init(void)
 	talloc_steal(dom0->conn, dom0); 
 
 	xenevtchn_notify(xce_handle, dom0->port);
+	conn_wake(dom0->conn);
 
 	return 0; 
 }
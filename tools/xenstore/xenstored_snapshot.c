@@ -0,0 +1,326 @@
+/*
+    Read-only snapshot of the store for local clients.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The snapshot is a copy of the whole store in xenstore_lib.h's format,
+ * shared read-only with local clients, so that dom0 tools can read
+ * slowly changing nodes without a round trip.
+ *
+ * It is never patched: the first change to the store makes it odd, and
+ * so unused, and it is rewritten from the store once changes stop for a
+ * while.  Clients see the change before its reply or watch event, so
+ * they can't read anything older than they could from us.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "talloc.h"
+#include "utils.h"
+#include "xenstored_core.h"
+#include "xenstored_snapshot.h"
+
+/* Rewrite the snapshot once the store hasn't changed for this long, */
+#define SNAPSHOT_QUIET_MS	20
+/* or when it has been out of date for this long in any case. */
+#define SNAPSHOT_MAX_DELAY_MS	500
+
+static int snap_fd = -1;
+static struct xs_snapshot *snap;
+static uint32_t snap_size;
+static bool snap_dirty;
+static uint64_t first_change, last_change;
+
+struct snapshot_fill {
+	uint32_t nodes;
+	uint32_t used;
+	bool full;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void snapshot_invalidate(void)
+{
+	if (!(snap->generation & 1)) {
+		__atomic_store_n(&snap->generation, snap->generation + 1,
+				 __ATOMIC_RELAXED);
+		/* Readers must see it odd before anything else changes. */
+		__sync_synchronize();
+	}
+}
+
+static void snapshot_validate(void)
+{
+	/* Readers must see the new nodes before the even generation. */
+	__sync_synchronize();
+	__atomic_store_n(&snap->generation, snap->generation + 1,
+			 __ATOMIC_RELAXED);
+}
+
+/* Transaction-private copies are keyed "<generation>/<path>". */
+static inline bool is_global_node(TDB_DATA key)
+{
+	return key.dsize && key.dptr[0] == '/';
+}
+
+static uint32_t node_size(TDB_DATA key, TDB_DATA data)
+{
+	struct xs_tdb_record_hdr *hdr = (void *)data.dptr;
+
+	return (sizeof(struct xs_snapshot_node) + key.dsize + 1 +
+		hdr->datalen + hdr->childlen + 3) & ~3u;
+}
+
+static int count_node(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA data,
+		      void *private)
+{
+	struct snapshot_fill *fill = private;
+
+	if (!is_global_node(key))
+		return 0;
+
+	fill->nodes++;
+	fill->used += node_size(key, data);
+	if (fill->used > XS_SNAPSHOT_MAX_SIZE) {
+		fill->full = true;
+		return 1;
+	}
+	return 0;
+}
+
+static int copy_node(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA data,
+		     void *private)
+{
+	struct snapshot_fill *fill = private;
+	struct xs_tdb_record_hdr *hdr = (void *)data.dptr;
+	struct xs_snapshot_node *node;
+	uint32_t size, *bucket;
+	char *p;
+
+	if (!is_global_node(key))
+		return 0;
+
+	size = node_size(key, data);
+	if (fill->used + size > snap_size) {
+		fill->full = true;
+		return 1;
+	}
+
+	node = (void *)snap + fill->used;
+	node->namelen = key.dsize + 1;
+	node->datalen = hdr->datalen;
+	node->childlen = hdr->childlen;
+	memcpy(node->name, key.dptr, key.dsize);
+	node->name[key.dsize] = '\0';
+	p = node->name + node->namelen;
+	memcpy(p, hdr->perms + hdr->num_perms,
+	       hdr->datalen + hdr->childlen);
+
+	bucket = &snap->buckets[xs_snapshot_bucket(node->name,
+						   snap->nr_buckets)];
+	node->next = *bucket;
+	*bucket = fill->used;
+	fill->used += size;
+
+	return 0;
+}
+
+/* Make the file at least size bytes long. */
+static bool snapshot_grow(uint32_t size)
+{
+	void *map;
+
+	if (size <= snap_size)
+		return true;
+
+	/* Grow by at least half, so as not to do it all the time. */
+	if (size < snap_size + snap_size / 2)
+		size = snap_size + snap_size / 2;
+	size = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+	if (size > XS_SNAPSHOT_MAX_SIZE)
+		size = XS_SNAPSHOT_MAX_SIZE;
+
+	if (ftruncate(snap_fd, size)) {
+		syslog(LOG_ERR, "snapshot: cannot grow to %u bytes: %m", size);
+		return false;
+	}
+
+	map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, snap_fd, 0);
+	if (map == MAP_FAILED) {
+		syslog(LOG_ERR, "snapshot: cannot map %u bytes: %m", size);
+		return false;
+	}
+	if (snap)
+		munmap(snap, snap_size);
+	snap = map;
+	snap_size = size;
+	snap->size = size;
+
+	return true;
+}
+
+static void snapshot_rewrite(void)
+{
+	struct snapshot_fill fill = { 0 };
+	uint32_t nr_buckets, hdrlen;
+
+	snap_dirty = false;
+
+	tdb_traverse(tdb_ctx, count_node, &fill);
+	if (fill.full) {
+		/* Leave it out of date, so that it isn't used. */
+		syslog(LOG_WARNING, "snapshot: store is too big to copy");
+		return;
+	}
+
+	/* About two nodes a chain. */
+	for (nr_buckets = 64; nr_buckets < fill.nodes / 2; nr_buckets <<= 1)
+		;
+	hdrlen = sizeof(*snap) + nr_buckets * sizeof(snap->buckets[0]);
+	if (!snapshot_grow(hdrlen + fill.used))
+		return;
+
+	snap->nr_buckets = nr_buckets;
+	memset(snap->buckets, 0, nr_buckets * sizeof(snap->buckets[0]));
+
+	fill.used = hdrlen;
+	fill.full = false;
+	tdb_traverse(tdb_ctx, copy_node, &fill);
+	if (fill.full)
+		return;
+
+	snapshot_validate();
+}
+
+static void snapshot_exit(void)
+{
+	/* Nobody will keep it up to date any more. */
+	snapshot_invalidate();
+}
+
+void snapshot_init(void)
+{
+	const char *path = xs_daemon_snapshot();
+	struct xs_snapshot *old;
+	char *tmp;
+	int fd;
+
+	if (!path)
+		barf("snapshot: no path");
+
+	/* One left by a previous daemon may still be mapped by clients. */
+	fd = open(path, O_RDWR);
+	if (fd != -1) {
+		old = mmap(NULL, sizeof(*old), PROT_READ|PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+		if (old != MAP_FAILED) {
+			if (old->magic == XS_SNAPSHOT_MAGIC)
+				old->generation |= 1;
+			munmap(old, sizeof(*old));
+		}
+		close(fd);
+	}
+
+	/* Clients must never find it shorter than its header. */
+	tmp = talloc_asprintf(NULL, "%s.new", path);
+	if (!tmp)
+		barf("snapshot: no memory");
+	unlink(tmp);
+	snap_fd = open(tmp, O_RDWR|O_CREAT|O_EXCL, 0640);
+	if (snap_fd == -1)
+		barf_perror("snapshot: cannot create %s", tmp);
+
+	if (!snapshot_grow(getpagesize()))
+		barf("snapshot: cannot set up %s", tmp);
+	snap->magic = XS_SNAPSHOT_MAGIC;
+	snap->generation = 1;
+
+	if (rename(tmp, path))
+		barf_perror("snapshot: cannot rename %s", tmp);
+	talloc_free(tmp);
+
+	atexit(snapshot_exit);
+	snapshot_rewrite();
+}
+
+void snapshot_changed(void)
+{
+	if (!snap)
+		return;
+
+	last_change = now_ms();
+	if (!snap_dirty) {
+		snapshot_invalidate();
+		snap_dirty = true;
+		first_change = last_change;
+	}
+}
+
+/* How long after now the snapshot is due to be rewritten. */
+static int64_t snapshot_due(uint64_t now)
+{
+	int64_t quiet = last_change + SNAPSHOT_QUIET_MS - now;
+	int64_t max = first_change + SNAPSHOT_MAX_DELAY_MS - now;
+
+	return quiet < max ? quiet : max;
+}
+
+int snapshot_timeout(int timeout)
+{
+	int64_t due;
+
+	if (!snap_dirty)
+		return timeout;
+
+	due = snapshot_due(now_ms());
+	if (due < 0)
+		due = 0;
+	if (timeout == -1 || due < timeout)
+		return due;
+	return timeout;
+}
+
+void snapshot_update(void)
+{
+	if (snap_dirty && snapshot_due(now_ms()) <= 0)
+		snapshot_rewrite();
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -0,0 +1,44 @@
+/*
+    Read-only snapshot of the store for local clients.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _XENSTORED_SNAPSHOT_H
+#define _XENSTORED_SNAPSHOT_H
+
+#ifndef NO_SOCKETS
+
+/* Start keeping the snapshot in xs_daemon_snapshot(). */
+void snapshot_init(void);
+
+/* The store has changed: the snapshot is out of date from now on. */
+void snapshot_changed(void);
+
+/* The poll timeout, in ms, to rewrite the snapshot in time. */
+int snapshot_timeout(int timeout);
+
+/* Rewrite the snapshot, if it is out of date and the store has settled. */
+void snapshot_update(void);
+
+#else
+
+static inline void snapshot_init(void) { }
+static inline void snapshot_changed(void) { }
+static inline int snapshot_timeout(int timeout) { return timeout; }
+static inline void snapshot_update(void) { }
+
+#endif
+
+#endif /* _XENSTORED_SNAPSHOT_H */
@@ -26,15 +26,68 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include "talloc.h"
 #include "list.h"
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 #include "xenstored_domain.h"
+#include "xenstored_snapshot.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 
+/*
+ * Some notes regarding detection and handling of transaction conflicts:
+ *
+ * Basic source of reference is the 'generation' count. Each writing access
+ * (either normal write or in a transaction) to the tdb data base will set
+ * the node specific generation count to the global generation count.
+ * For being able to identify a transaction the transaction specific
+ * generation count is initialized with the global generation count when
+ * starting the transaction.
+ * Each time the global generation count is copied to either a node or a
+ * transaction it is incremented. This ensures all nodes and/or transactions
+ * are having a unique generation count.
+ *
+ * Transaction conflicts are detected by checking the generation count of all
+ * nodes read in the transaction to match with the generation count in the
+ * global data base at the end of the transaction. Nodes which have been
+ * modified in the transaction don't have to be checked to match even if they
+ * have been read, as the modified node will be visible only after the
+ * transaction has been committed.
+ *
+ * For each node accessed in the transaction a transaction specific copy is
+ * kept in the tdb data base, keyed by the transaction generation count and
+ * the node name.  This replaces copying the whole data base when starting a
+ * transaction.  A node which is only read needs its copy as well, so that
+ * later reads in the same transaction see a stable view.
+ *
+ * A non-existing node read in a transaction is recorded with the generation
+ * count NO_GENERATION, so creating it in parallel is detected as a conflict.
+ */
+
+struct accessed_node
+{
+	/* List of all changed nodes in the context of this transaction. */
+	struct list_head list;
+
+	/* The name of the node. */
+	char *node;
+
+	/* Generation count (or NO_GENERATION) for conflict checking. */
+	uint64_t generation;
+
+	/* Generation count checking required? */
+	bool check_gen;
+
+	/* Modified? */
+	bool modified;
+
+	/* Transaction node in data base? */
+	bool ta_node;
+};
+
 struct changed_node
 {
 	/* List of all changed nodes in the context of this transaction. */
@@ -68,11 +121,10 @@ struct transaction
 	uint32_t id;
 
 	/* Generation when transaction started. */
-	unsigned int generation;
+	uint64_t generation;
 
-	/* TDB to work on, and filename */
-	TDB_CONTEXT *tdb;
-	char *tdb_name;
+	/* List of accessed nodes. */
+	struct list_head accessed;
 
 	/* List of changed nodes. */
 	struct list_head changes;
@@ -82,12 +134,253 @@ struct transaction
 };
 
 extern int quota_max_transaction;
-static unsigned int generation;
+static uint64_t generation;
+
+static struct accessed_node *find_accessed_node(struct transaction *trans,
+						const char *name)
+{
+	struct accessed_node *i;
+
+	list_for_each_entry(i, &trans->accessed, list)
+		if (streq(i->node, name))
+			return i;
+
+	return NULL;
+}
+
+static char *transaction_get_node_name(void *ctx, struct transaction *trans,
+				       const char *name)
+{
+	return talloc_asprintf(ctx, "%"PRIu64"/%s", trans->generation, name);
+}
+
+/*
+ * Prepend the transaction to name if node has been modified in the current
+ * transaction.
+ */
+int transaction_prepend(struct connection *conn, void *ctx, const char *name,
+			TDB_DATA *key)
+{
+	char *tdb_name;
+
+	if (!conn || !conn->transaction ||
+	    !find_accessed_node(conn->transaction, name)) {
+		set_tdb_key(name, key);
+		return 0;
+	}
+
+	tdb_name = transaction_get_node_name(ctx, conn->transaction, name);
+	if (!tdb_name)
+		return -1;
+
+	set_tdb_key(tdb_name, key);
+	return 0;
+}
+
+/*
+ * A node has been accessed.
+ *
+ * Modifying accesses (write, delete) always update the generation (global and
+ * node->generation).
+ *
+ * Accesses in a transaction will be added to the list of accessed nodes
+ * if not already done. Read type accesses will copy the node to the
+ * transaction specific data base part, write type accesses go there
+ * anyway.
+ *
+ * If not NULL, key will be supplied with name and length of name of the node
+ * to be accessed in the data base.
+ *
+ * Returns 1 for a delete of a node without a copy in the transaction, which
+ * needs no data base access, 0 on success and -1 on failure.
+ */
+int access_node(struct connection *conn, struct node *node,
+		enum node_access_type type, TDB_DATA *key)
+{
+	struct accessed_node *i = NULL;
+	struct transaction *trans;
+	TDB_DATA local_key;
+	const char *trans_name = NULL;
+	int ret;
+	bool introduce = false;
+
+	if (type != NODE_ACCESS_READ)
+		node->generation = generation++;
+
+	if (!conn || !conn->transaction) {
+		/* They're changing the global database. */
+		if (type != NODE_ACCESS_READ)
+			snapshot_changed();
+		if (key)
+			set_tdb_key(node->name, key);
+		return 0;
+	}
+
+	trans = conn->transaction;
+
+	trans_name = transaction_get_node_name(node, trans, node->name);
+	if (!trans_name)
+		goto nomem;
+
+	i = find_accessed_node(trans, node->name);
+	if (!i) {
+		i = talloc_zero(trans, struct accessed_node);
+		if (!i)
+			goto nomem;
+		i->node = talloc_strdup(i, node->name);
+		if (!i->node)
+			goto nomem;
+
+		introduce = true;
+		i->ta_node = false;
+
+		/*
+		 * Additional transaction-specific node for read type. We only
+		 * have to verify read or write types, as delete types will
+		 * delete the node in the global data base in any case.
+		 */
+		if (type == NODE_ACCESS_READ) {
+			i->generation = node->generation;
+			i->check_gen = true;
+			if (node->generation != NO_GENERATION) {
+				set_tdb_key(trans_name, &local_key);
+				ret = write_node_raw(conn, &local_key, node,
+						     true);
+				if (ret)
+					goto err;
+				i->ta_node = true;
+			}
+		}
+		list_add_tail(&i->list, &trans->accessed);
+	}
+
+	if (type != NODE_ACCESS_READ)
+		i->modified = true;
+
+	if (type == NODE_ACCESS_DELETE) {
+		/* Nothing to delete if the transaction held no copy. */
+		ret = i->ta_node ? 0 : 1;
+		i->ta_node = false;
+		if (key)
+			set_tdb_key(trans_name, key);
+		return ret;
+	}
+
+	if (type == NODE_ACCESS_WRITE)
+		i->ta_node = true;
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans)
+	if (key)
+		set_tdb_key(trans_name, key);
+
+	return 0;
+
+nomem:
+	ret = ENOMEM;
+err:
+	talloc_free((void *)trans_name);
+	if (introduce)
+		talloc_free(i);
+	errno = ret;
+	return -1;
+}
+
+/*
+ * Finalize transaction:
+ * Walk through accessed nodes and check generation against global data.
+ * If all entries match, read the transaction entries and write them without
+ * transaction prepended. Delete all transaction specific nodes in the data
+ * base.
+ */
+static int finalize_transaction(struct connection *conn,
+				struct transaction *trans)
+{
+	struct accessed_node *i;
+	TDB_DATA key, ta_key, data;
+	struct xs_tdb_record_hdr *hdr;
+	uint64_t gen;
+	char *trans_name;
+	int ret;
+
+	list_for_each_entry(i, &trans->accessed, list) {
+		if (!i->check_gen || i->modified)
+			continue;
+
+		set_tdb_key(i->node, &key);
+		data = tdb_fetch(tdb_ctx, key);
+		hdr = (void *)data.dptr;
+		if (!data.dptr) {
+			if (tdb_error(tdb_ctx) != TDB_ERR_NOEXIST)
+				return EIO;
+			gen = NO_GENERATION;
+		} else
+			gen = hdr->generation;
+		talloc_free(data.dptr);
+		if (i->generation != gen)
+			return EAGAIN;
+	}
+
+	while ((i = list_top(&trans->accessed, struct accessed_node, list))) {
+		trans_name = transaction_get_node_name(i, trans, i->node);
+		if (!trans_name)
+			/* We are doomed: the transaction is only partial. */
+			goto err;
+
+		set_tdb_key(trans_name, &ta_key);
+
+		if (i->modified) {
+			snapshot_changed();
+			set_tdb_key(i->node, &key);
+			if (i->ta_node) {
+				data = tdb_fetch(tdb_ctx, ta_key);
+				if (!data.dptr)
+					goto err;
+				hdr = (void *)data.dptr;
+				hdr->generation = generation++;
+				ret = tdb_store(tdb_ctx, key, data,
+						TDB_REPLACE);
+				talloc_free(data.dptr);
+				if (ret)
+					goto err;
+			} else if (tdb_delete(tdb_ctx, key) &&
+				   tdb_error(tdb_ctx) != TDB_ERR_NOEXIST)
+				goto err;
+		}
+
+		if (i->ta_node && tdb_delete(tdb_ctx, ta_key))
+			goto err;
+		list_del(&i->list);
+		talloc_free(i);
+	}
+
+	return 0;
+
+err:
+	corrupt(conn, "Partial transaction");
+	return EIO;
+}
+
+static int destroy_transaction(void *_transaction)
 {
-	return trans->tdb;
+	struct transaction *trans = _transaction;
+	struct accessed_node *i;
+	char *trans_name;
+	TDB_DATA key;
+
+	trace_destroy(trans, "transaction");
+	while ((i = list_top(&trans->accessed, struct accessed_node, list))) {
+		if (i->ta_node) {
+			trans_name = transaction_get_node_name(i, trans,
+							       i->node);
+			if (trans_name) {
+				set_tdb_key(trans_name, &key);
+				tdb_delete(tdb_ctx, key);
+			}
+		}
+		list_del(&i->list);
+		talloc_free(i);
+	}
+
+	return 0;
 }
 
 /* Callers get a change node (which can fail) and only commit after they've
@@ -96,11 +389,8 @@ void add_change_node(struct transaction *trans, const char *node, bool recurse)
 {
 	struct changed_node *i;
 
-	if (!trans) {
-		/* They're changing the global database. */
-		generation++;
+	if (!trans)
 		return;
-	}
 
 	list_for_each_entry(i, &trans->changes, list)
 		if (streq(i->node, node))
@@ -112,17 +402,6 @@ void add_change_node(struct transaction *trans, const char *node, bool recurse)
 	list_add_tail(&i->list, &trans->changes);
 }
 
-static int destroy_transaction(void *_transaction)
-{
-	struct transaction *trans = _transaction;
-
-	trace_destroy(trans, "transaction");
-	if (trans->tdb)
-		tdb_close(trans->tdb);
-	unlink(trans->tdb_name);
-	return 0;
-}
-
 struct transaction *transaction_lookup(struct connection *conn, uint32_t id)
 {
 	struct transaction *trans;
@@ -154,19 +433,16 @@ void do_transaction_start(struct connection *conn, struct buffered_data *in)
 	}
 
 	/* Attach transaction to input for autofree until it's complete */
-	trans = talloc(in, struct transaction);
-	INIT_LIST_HEAD(&trans->changes);
-	INIT_LIST_HEAD(&trans->changed_domains);
-	trans->generation = generation;
-	trans->tdb_name = talloc_asprintf(trans, "%s.%p",
-					  xs_daemon_tdb(), trans);
-	trans->tdb = tdb_copy(tdb_context(conn), trans->tdb_name);
-	if (!trans->tdb) {
-		send_error(conn, errno);
+	trans = talloc_zero(in, struct transaction);
+	if (!trans) {
+		send_error(conn, ENOMEM);
 		return;
 	}
-	/* Make it close if we go away. */
-	talloc_steal(trans, trans->tdb);
+
+	INIT_LIST_HEAD(&trans->accessed);
+	INIT_LIST_HEAD(&trans->changes);
+	INIT_LIST_HEAD(&trans->changed_domains);
+	trans->generation = generation++;
 
 	/* Pick an unused transaction identifier. */
 	do {
@@ -190,6 +466,7 @@ void do_transaction_end(struct connection *conn, struct buffered_data *in)
 	struct changed_node *i;
 	struct changed_domain *d;
 	struct transaction *trans;
+	int ret;
 
 	if (!arg || (!streq(arg, "T") && !streq(arg, "F"))) {
 		send_error(conn, EINVAL);
@@ -209,17 +486,11 @@ void do_transaction_end(struct connection *conn, struct buffered_data *in)
 	talloc_steal(arg, trans);
 
 	if (streq(arg, "T")) {
-		/* FIXME: Merge, rather failing on any change. */
-		if (trans->generation != generation) {
-			send_error(conn, EAGAIN);
-			return;
-		}
-		if (!replace_tdb(trans->tdb_name, trans->tdb)) {
-			send_error(conn, errno);
+		ret = finalize_transaction(conn, trans);
+		if (ret) {
+			send_error(conn, ret);
 			return;
 		}
-		/* Don't close this: we won! */
-		trans->tdb = NULL;
 
 		/* fix domain entry for each changed domain */
 		list_for_each_entry(d, &trans->changed_domains, list)
@@ -228,7 +499,6 @@ void do_transaction_end(struct connection *conn, struct buffered_data *in)
 		/* Fire off the watches for everything that changed. */
 		list_for_each_entry(i, &trans->changes, list)
 			fire_watches(conn, in, i->node, i->recurse);
-		generation++;
 	}
 	send_ack(conn, XS_TRANSACTION_END);
 }
@@ -280,6 +550,24 @@ void conn_delete_all_transactions(struct connection *conn)
 	conn->transaction_started = 0;
 }
 
+void check_transactions(struct hashtable *hash)
+{
+	struct connection *conn;
+	struct transaction *trans;
+	char *tname;
+
+	list_for_each_entry(conn, &connections, list) {
+		list_for_each_entry(trans, &conn->transaction_list, list) {
+			tname = talloc_asprintf(trans, "%"PRIu64,
+						trans->generation);
+			if (!tname)
+				continue;
+			remember_string(hash, tname);
+			talloc_free(tname);
+		}
+	}
+}
+
 /*
  * Local variables:
  *  c-file-style: "linux"
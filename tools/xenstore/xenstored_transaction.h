@@ -34,8 +34,22 @@ void transaction_entry_dec(struct transaction *trans, unsigned int domid);
 void add_change_node(struct transaction *trans, const char *node,
                      bool recurse);
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans);
+enum node_access_type {
+    NODE_ACCESS_READ,
+    NODE_ACCESS_WRITE,
+    NODE_ACCESS_DELETE
+};
+
+/* Get the tdb key of a node as seen by conn's transaction, if any. */
+int transaction_prepend(struct connection *conn, void *ctx, const char *name,
+			TDB_DATA *key);
+
+/* Record an access to a node, keeping a transaction copy if required. */
+int access_node(struct connection *conn, struct node *node,
+                enum node_access_type type, TDB_DATA *key);
+
+/* Mark the data base keys of all live transactions reachable. */
+void check_transactions(struct hashtable *hash);
 
 void conn_delete_all_transactions(struct connection *conn);
 
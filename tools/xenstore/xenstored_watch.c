@@ -23,20 +23,51 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <string.h>
 #include "talloc.h"
 #include "list.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 #include "xenstored_domain.h"
+#include "hashtable.h"
 
 extern int quota_nb_watch_per_domain;
+extern int quota_nb_watch_per_conn;
+
+/*
+ * Watches are indexed by a trie of path components, so firing the watches
+ * for a node only visits the watches on the node itself, its ancestors and
+ * (for recursive changes) its descendants.  Special watches ("@...") are
+ * single components below the root.
+ */
+struct watch_node
+{
+	/* Path component, "" for the root. */
+	char *name;
+
+	struct watch_node *parent;
+
+	/* Children by name (allocated on first child), and as a list. */
+	struct hashtable *child_hash;
+	struct list_head children;
+	struct list_head sibling;
+
+	/* Watches on exactly this path. */
+	struct list_head watches;
+
+	/* Watches in this subtree, including on this node. */
+	unsigned int nr_watches;
+};
 
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on the same path */
+	struct list_head node_list;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
@@ -45,8 +76,140 @@ struct watch
 
 	char *token;
 	char *node;
+
+	struct connection *conn;
+	struct watch_node *wnode;
 };
 
+static struct watch_node *watch_root;
+static unsigned int nr_watch_nodes;
+static unsigned long nr_watch_events;
+
+static int destroy_watch_node(void *_wnode)
+{
+	struct watch_node *wnode = _wnode;
+
+	if (wnode->child_hash)
+		hashtable_destroy(wnode->child_hash, 0);
+	nr_watch_nodes--;
+	return 0;
+}
+
+static struct watch_node *new_watch_node(struct watch_node *parent,
+					 const char *name, size_t len)
+{
+	struct watch_node *wnode;
+	char *key;
+
+	wnode = talloc_zero(parent, struct watch_node);
+	if (!wnode)
+		return NULL;
+	wnode->name = talloc_strndup(wnode, name, len);
+	if (!wnode->name)
+		goto nomem;
+	wnode->parent = parent;
+	INIT_LIST_HEAD(&wnode->children);
+	INIT_LIST_HEAD(&wnode->sibling);
+	INIT_LIST_HEAD(&wnode->watches);
+
+	if (parent) {
+		if (!parent->child_hash) {
+			parent->child_hash = create_hashtable(16,
+							      hash_from_key_fn,
+							      keys_equal_fn);
+			if (!parent->child_hash)
+				goto nomem;
+		}
+		key = strdup(wnode->name);
+		if (!key || !hashtable_insert(parent->child_hash, key, wnode)) {
+			free(key);
+			goto nomem;
+		}
+		list_add_tail(&wnode->sibling, &parent->children);
+	}
+
+	nr_watch_nodes++;
+	talloc_set_destructor(wnode, destroy_watch_node);
+	return wnode;
+
+ nomem:
+	talloc_free(wnode);
+	return NULL;
+}
+
+/* Remove empty nodes from wnode upwards. */
+static void prune_watch_nodes(struct watch_node *wnode)
+{
+	struct watch_node *parent, *removed;
+
+	while (wnode->nr_watches == 0 && (parent = wnode->parent)) {
+		removed = hashtable_remove(parent->child_hash, wnode->name);
+		assert(removed == wnode);
+		list_del(&wnode->sibling);
+		talloc_free(wnode);
+		wnode = parent;
+	}
+}
+
+/* Get the length of the first path component of name. */
+static size_t component_len(const char *name)
+{
+	const char *slash = strchr(name, '/');
+
+	return slash ? slash - name : strlen(name);
+}
+
+/* Skip the leading "/" of a path, or nothing for a special watch. */
+static const char *first_component(const char *name)
+{
+	return name[0] == '/' ? name + 1 : name;
+}
+
+/*
+ * Find the trie node for name, creating it (and all nodes above it) if
+ * create is set.  Returns NULL if it doesn't exist or on allocation failure.
+ */
+static struct watch_node *find_watch_node(const char *name, bool create)
+{
+	struct watch_node *wnode, *child;
+	const char *p;
+	char *comp;
+	size_t len;
+
+	if (!watch_root) {
+		if (!create)
+			return NULL;
+		/* Not autofreed: watches may outlive it at exit. */
+		watch_root = new_watch_node(NULL, "", 0);
+		if (!watch_root)
+			return NULL;
+	}
+
+	wnode = watch_root;
+	for (p = first_component(name); *p; p += len + (p[len] == '/')) {
+		len = component_len(p);
+		comp = talloc_strndup(NULL, p, len);
+		if (!comp)
+			return NULL;
+		child = wnode->child_hash ?
+			hashtable_search(wnode->child_hash, comp) : NULL;
+		talloc_free(comp);
+
+		if (!child) {
+			if (!create)
+				return NULL;
+			child = new_watch_node(wnode, p, len);
+			if (!child) {
+				prune_watch_nodes(wnode);
+				return NULL;
+			}
+		}
+		wnode = child;
+	}
+
+	return wnode;
+}
+
 /*
  * Send a watch event.
  * Temporary memory allocations are done with ctx.
@@ -88,6 +251,27 @@ static void add_event(struct connection *conn,
 	strcpy(data + strlen(name) + 1, watch->token);
 	send_reply(conn, XS_WATCH_EVENT, data, len);
 	talloc_free(data);
+	nr_watch_events++;
+}
+
+static void fire_node_watches(struct watch_node *wnode, void *ctx,
+			      const char *name)
+{
+	struct watch *watch;
+
+	list_for_each_entry(watch, &wnode->watches, node_list)
+		add_event(watch->conn, ctx, watch, name ? name : watch->node);
+}
+
+/* Fire the watches below wnode, each with its own path. */
+static void fire_subtree_watches(struct watch_node *wnode, void *ctx)
+{
+	struct watch_node *child;
+
+	list_for_each_entry(child, &wnode->children, sibling) {
+		fire_node_watches(child, ctx, NULL);
+		fire_subtree_watches(child, ctx);
+	}
 }
 
 /*
@@ -97,33 +281,61 @@ static void add_event(struct connection *conn,
 void fire_watches(struct connection *conn, void *ctx, const char *name,
 		  bool recurse)
 {
-	struct connection *i;
-	struct watch *watch;
+	struct watch_node *wnode, *child;
+	const char *p;
+	char *comp;
+	size_t len;
 
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, ctx, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, ctx, watch, watch->node);
-		}
+	wnode = watch_root;
+	if (!wnode)
+		return;
+
+	/* Watches on name and on each of its ancestors. */
+	fire_node_watches(wnode, ctx, name);
+	for (p = first_component(name); *p; p += len + (p[len] == '/')) {
+		len = component_len(p);
+		if (!wnode->child_hash)
+			return;
+		comp = talloc_strndup(ctx, p, len);
+		if (!comp)
+			return;
+		child = hashtable_search(wnode->child_hash, comp);
+		talloc_free(comp);
+		if (!child)
+			return;
+		wnode = child;
+		fire_node_watches(wnode, ctx, name);
 	}
+
+	/* And the watches below it, if the whole subtree changed. */
+	if (recurse)
+		fire_subtree_watches(wnode, ctx);
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+	struct watch_node *wnode = watch->wnode;
+
 	trace_destroy(_watch, "watch");
+
+	list_del(&watch->node_list);
+	watch->conn->nr_watches--;
+	for (; wnode; wnode = wnode->parent)
+		wnode->nr_watches--;
+	prune_watch_nodes(watch->wnode);
+
 	return 0;
 }
 
 void do_watch(struct connection *conn, struct buffered_data *in)
 {
 	struct watch *watch;
+	struct watch_node *wnode;
 	char *vec[2];
 	bool relative;
 
@@ -149,19 +361,30 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 	}
 
 	/* Check for duplicates. */
-	list_for_each_entry(watch, &conn->watches, list) {
-		if (streq(watch->node, vec[0]) &&
-		    streq(watch->token, vec[1])) {
-			send_error(conn, EEXIST);
-			return;
+	wnode = find_watch_node(vec[0], false);
+	if (wnode) {
+		list_for_each_entry(watch, &wnode->watches, node_list) {
+			if (watch->conn == conn &&
+			    streq(watch->token, vec[1])) {
+				send_error(conn, EEXIST);
+				return;
+			}
 		}
 	}
 
-	if (domain_watch(conn) > quota_nb_watch_per_domain) {
+	if (domain_watch(conn) > quota_nb_watch_per_domain ||
+	    (quota_nb_watch_per_conn &&
+	     conn->nr_watches >= quota_nb_watch_per_conn)) {
 		send_error(conn, E2BIG);
 		return;
 	}
 
+	wnode = find_watch_node(vec[0], true);
+	if (!wnode) {
+		send_error(conn, ENOMEM);
+		return;
+	}
+
 	watch = talloc(conn, struct watch);
 	watch->node = talloc_strdup(watch, vec[0]);
 	watch->token = talloc_strdup(watch, vec[1]);
@@ -172,6 +395,13 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 
 	INIT_LIST_HEAD(&watch->events);
 
+	watch->conn = conn;
+	watch->wnode = wnode;
+	list_add_tail(&watch->node_list, &wnode->watches);
+	for (; wnode; wnode = wnode->parent)
+		wnode->nr_watches++;
+	conn->nr_watches++;
+
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
 	trace_create(watch, "watch");
@@ -185,6 +415,7 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 void do_unwatch(struct connection *conn, struct buffered_data *in)
 {
 	struct watch *watch;
+	struct watch_node *wnode;
 	char *node, *vec[2];
 
 	if (get_strings(in, vec, ARRAY_SIZE(vec)) != ARRAY_SIZE(vec)) {
@@ -193,13 +424,17 @@ void do_unwatch(struct connection *conn, struct buffered_data *in)
 	}
 
 	node = canonicalize(conn, vec[0]);
-	list_for_each_entry(watch, &conn->watches, list) {
-		if (streq(watch->node, node) && streq(watch->token, vec[1])) {
-			list_del(&watch->list);
-			talloc_free(watch);
-			domain_watch_dec(conn);
-			send_ack(conn, XS_UNWATCH);
-			return;
+	wnode = find_watch_node(node, false);
+	if (wnode) {
+		list_for_each_entry(watch, &wnode->watches, node_list) {
+			if (watch->conn == conn &&
+			    streq(watch->token, vec[1])) {
+				list_del(&watch->list);
+				talloc_free(watch);
+				domain_watch_dec(conn);
+				send_ack(conn, XS_UNWATCH);
+				return;
+			}
 		}
 	}
 	send_error(conn, ENOENT);
@@ -216,6 +451,16 @@ void conn_delete_all_watches(struct connection *conn)
 	}
 }
 
+char *watch_stats(const void *ctx)
+{
+	return talloc_asprintf(ctx,
+			       "watches: %u\n"
+			       "watch trie nodes: %u\n"
+			       "watch events fired: %lu\n",
+			       watch_root ? watch_root->nr_watches : 0,
+			       nr_watch_nodes, nr_watch_events);
+}
+
 /*
  * Local variables:
  *  c-file-style: "linux"
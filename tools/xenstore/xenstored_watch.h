@@ -32,4 +32,7 @@ void dump_watches(struct connection *conn);
 
 void conn_delete_all_watches(struct connection *conn);
 
+/* Watch statistics for "xenstore-control watches". */
+char *watch_stats(const void *ctx);
+
 #endif /* _XENSTORED_WATCH_H */
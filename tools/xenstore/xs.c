@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <string.h>
@@ -70,19 +71,31 @@ struct xs_handle {
 	bool unwatch_filter;
 
 	/*
-         * A list of replies. Currently only one will ever be outstanding
-         * because we serialise requests. The requester can wait on the
-         * conditional variable for its response.
+         * A list of replies, to requests which may have been sent by
+         * several threads or asynchronously.  Requesters can wait on the
+         * conditional variable for theirs, told apart by req_id.
          */
 	struct list_head reply_list;
 	pthread_mutex_t reply_mutex;
 	pthread_cond_t reply_condvar;
 
-	/* One request at a time. */
+	/* One request written at a time. */
 	pthread_mutex_t request_mutex;
 
+	/* req_id of the last request sent. */
+	uint32_t req_id;
+	/* Requests sent but not answered yet. */
+	unsigned int in_flight;
+	/* The daemon doesn't know XS_READ_MULTI or XS_READ_SUBTREE. */
+	bool no_read_multi;
+	bool no_read_subtree;
+
+	/* The daemon's snapshot of the store, if we can read it. */
+	const struct xs_snapshot *snapshot;
+
 	/* Lock discipline:
 	 *  Only holder of the request lock may write to h->fd.
+	 *  Only holder of the request lock may access req_id.
 	 *  Only holder of the request lock may access read_thr_exists.
 	 *  If read_thr_exists==0, only holder of request lock may read h->fd;
 	 *  If read_thr_exists==1, only the read thread may read h->fd.
@@ -99,6 +112,7 @@ struct xs_handle {
 #define mutex_lock(m)		pthread_mutex_lock(m)
 #define mutex_unlock(m)		pthread_mutex_unlock(m)
 #define condvar_signal(c)	pthread_cond_signal(c)
+#define condvar_broadcast(c)	pthread_cond_broadcast(c)
 #define condvar_wait(c,m)	pthread_cond_wait(c,m)
 #define cleanup_push(f, a)	\
     pthread_cleanup_push((void (*)(void *))(f), (void *)(a))
@@ -124,6 +138,11 @@ struct xs_handle {
 	int fd;
 	struct list_head reply_list;
 	struct list_head watch_list;
+	uint32_t req_id;
+	unsigned int in_flight;
+	bool no_read_multi;
+	bool no_read_subtree;
+	const struct xs_snapshot *snapshot;
 	/* Clients can select() on this pipe to wait for a watch to fire. */
 	int watch_pipe[2];
 	/* Filtering watch event in unwatch function? */
@@ -133,6 +152,7 @@ struct xs_handle {
 #define mutex_lock(m)		((void)0)
 #define mutex_unlock(m)		((void)0)
 #define condvar_signal(c)	((void)0)
+#define condvar_broadcast(c)	((void)0)
 #define condvar_wait(c,m)	((void)0)
 #define cleanup_push(f, a)	((void)0)
 #define cleanup_pop(run)	((void)0)
@@ -219,6 +239,127 @@ static int get_dev(const char *connect_to)
 	return open(connect_to, O_RDWR);
 }
 
+#ifndef NO_SOCKETS
+/* Map xenstored's snapshot of the store, if it keeps one. */
+static void snapshot_open(struct xs_handle *h)
+{
+	const char *path = xs_daemon_snapshot();
+	struct xs_snapshot *snap;
+	int fd;
+
+	if (!path)
+		return;
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	/* Enough for it to grow into: we never touch more than ->size. */
+	snap = mmap(NULL, XS_SNAPSHOT_MAX_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (snap == MAP_FAILED)
+		return;
+
+	if (snap->magic != XS_SNAPSHOT_MAGIC) {
+		munmap(snap, XS_SNAPSHOT_MAX_SIZE);
+		return;
+	}
+	h->snapshot = snap;
+}
+
+/* Look up path in the snapshot, as XS_READ (or as XS_DIRECTORY, with
+ * children) would.  Returns a malloced copy, or NULL if the snapshot can't
+ * tell, in which case ask the daemon. */
+static void *snapshot_read(struct xs_handle *h, xs_transaction_t t,
+			   const char *path, bool children, unsigned int *len)
+{
+	const struct xs_snapshot *snap = h->snapshot;
+	const struct xs_snapshot_node *node;
+	uint32_t gen, size, nr, off, namelen, hops;
+	uint64_t end;
+	unsigned int i, vlen = 0;
+	char *ret;
+
+	/*
+	 * Only for what xenstored would have answered from the same store:
+	 * outside transactions, not relative to our domain's path, and once
+	 * anything we sent before has been dealt with.
+	 */
+	if (!snap || t != XBT_NULL || path[0] != '/' || h->fd == -1 ||
+	    __atomic_load_n(&h->in_flight, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	namelen = strlen(path) + 1;
+
+	/* It is being rewritten under us if generation changes. */
+	for (i = 0; i < 3; i++) {
+		gen = __atomic_load_n(&snap->generation, __ATOMIC_ACQUIRE);
+		if (gen & 1)
+			return NULL;
+
+		/* Check everything against size, as it may be garbage. */
+		ret = NULL;
+		size = snap->size;
+		nr = snap->nr_buckets;
+		if (size > XS_SNAPSHOT_MAX_SIZE || !nr || (nr & (nr - 1)) ||
+		    sizeof(*snap) + (uint64_t)nr * sizeof(snap->buckets[0])
+		    > size)
+			goto retry;
+
+		off = snap->buckets[xs_snapshot_bucket(path, nr)];
+		for (hops = 0; off; off = node->next, hops++) {
+			if ((off & 3) || off + (uint64_t)sizeof(*node) > size ||
+			    hops > size / sizeof(*node))
+				goto retry;
+			node = (const void *)snap + off;
+
+			end = off + (uint64_t)sizeof(*node) + node->namelen +
+			      node->datalen + node->childlen;
+			if (end > size)
+				goto retry;
+			if (node->namelen != namelen ||
+			    memcmp(node->name, path, namelen))
+				continue;
+
+			vlen = children ? node->childlen : node->datalen;
+			ret = malloc(vlen + 1);
+			if (!ret)
+				return NULL;
+			memcpy(ret, node->name + namelen +
+			       (children ? node->datalen : 0), vlen);
+			ret[vlen] = '\0';
+			break;
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&snap->generation, __ATOMIC_RELAXED) == gen) {
+			/* Not there: let the daemon give the right error. */
+			if (ret && len)
+				*len = vlen;
+			return ret;
+		}
+
+	retry:
+		free(ret);
+	}
+
+	return NULL;
+}
+
+static void snapshot_close(struct xs_handle *h)
+{
+	if (h->snapshot)
+		munmap((void *)h->snapshot, XS_SNAPSHOT_MAX_SIZE);
+}
+#else
+static void snapshot_open(struct xs_handle *h) { }
+static void *snapshot_read(struct xs_handle *h, xs_transaction_t t,
+			   const char *path, bool children, unsigned int *len)
+{
+	return NULL;
+}
+static void snapshot_close(struct xs_handle *h) { }
+#endif
+
 static struct xs_handle *get_handle(const char *connect_to)
 {
 	struct stat buf;
@@ -256,6 +397,9 @@ static struct xs_handle *get_handle(const char *connect_to)
 
 	h->unwatch_filter = false;
 
+	if (S_ISSOCK(buf.st_mode))
+		snapshot_open(h);
+
 #ifdef USE_PTHREAD
 	pthread_mutex_init(&h->watch_mutex, NULL);
 	pthread_cond_init(&h->watch_condvar, NULL);
@@ -324,6 +468,7 @@ static void close_fds_free(struct xs_handle *h) {
 
         close(h->fd);
         
+	snapshot_close(h);
 	free(h);
 }
 
@@ -418,9 +563,25 @@ static int get_error(const char *errorstring)
 	return xsd_errors[i].errnum;
 }
 
-/* Adds extra nul terminator, because we generally (always?) hold strings. */
-static void *read_reply(
-	struct xs_handle *h, enum xsd_sockmsg_type *type, unsigned int *len)
+/* Take the reply to request $req_id off the list, if it has arrived. */
+static struct xs_stored_msg *find_reply(struct xs_handle *h, uint32_t req_id)
+{
+	struct xs_stored_msg *msg;
+
+	list_for_each_entry(msg, &h->reply_list, list) {
+		if (msg->hdr.req_id == req_id) {
+			list_del(&msg->list);
+			return msg;
+		}
+	}
+	return NULL;
+}
+
+/* Adds extra nul terminator, because we generally (always?) hold strings.
+ * Called with the request lock held, which is dropped once it is not needed.
+ */
+static void *read_reply(struct xs_handle *h, uint32_t req_id,
+			enum xsd_sockmsg_type *type, unsigned int *len)
 {
 	struct xs_stored_msg *msg;
 	char *body;
@@ -428,24 +589,41 @@ static void *read_reply(
 
 	read_from_thread = read_thread_exists(h);
 
-	/* Read from comms channel ourselves if there is no reader thread. */
-	if (!read_from_thread && (read_message(h, 0) == -1))
-		return NULL;
+	/* The reader thread reads for us, so others may send meanwhile. */
+	if (read_from_thread)
+		mutex_unlock(&h->request_mutex);
 
 	mutex_lock(&h->reply_mutex);
+	while ((msg = find_reply(h, req_id)) == NULL) {
+		if (read_from_thread) {
 #ifdef USE_PTHREAD
-	while (list_empty(&h->reply_list) && read_from_thread && h->fd != -1)
-		condvar_wait(&h->reply_condvar, &h->reply_mutex);
+			if (h->fd == -1)
+				break;
+			condvar_wait(&h->reply_condvar, &h->reply_mutex);
 #endif
-	if (list_empty(&h->reply_list)) {
+			continue;
+		}
+
+		/* Read from comms channel ourselves if there is no reader
+		 * thread: this may be the reply to someone else's request. */
 		mutex_unlock(&h->reply_mutex);
+		if (read_message(h, 0) == -1) {
+			mutex_unlock(&h->request_mutex);
+			return NULL;
+		}
+		mutex_lock(&h->reply_mutex);
+	}
+	mutex_unlock(&h->reply_mutex);
+
+	if (!read_from_thread)
+		mutex_unlock(&h->request_mutex);
+
+	if (!msg) {
 		errno = EINVAL;
 		return NULL;
 	}
-	msg = list_top(&h->reply_list, struct xs_stored_msg, list);
-	list_del(&msg->list);
-	assert(list_empty(&h->reply_list));
-	mutex_unlock(&h->reply_mutex);
+
+	__atomic_fetch_sub(&h->in_flight, 1, __ATOMIC_RELEASE);
 
 	*type = msg->hdr.type;
 	if (len)
@@ -457,21 +635,24 @@ static void *read_reply(
 	return body;
 }
 
-/* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
-static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
-		      enum xsd_sockmsg_type type,
-		      const struct iovec *iovec,
-		      unsigned int num_vecs,
-		      unsigned int *len)
+/* Send a request, with the request lock held.
+ * Returns its req_id, or 0 and set errno on error, with the fd closed. */
+static uint32_t send_request(struct xs_handle *h, xs_transaction_t t,
+			     enum xsd_sockmsg_type type,
+			     const struct iovec *iovec,
+			     unsigned int num_vecs)
 {
 	struct xsd_sockmsg msg;
-	void *ret = NULL;
 	int saved_errno;
 	unsigned int i;
 	struct sigaction ignorepipe, oldact;
 
+	/* 0 is never used, so that it can mean failure. */
+	if (++h->req_id == 0)
+		h->req_id++;
+
 	msg.tx_id = t;
-	msg.req_id = 0;
+	msg.req_id = h->req_id;
 	msg.type = type;
 	msg.len = 0;
 	for (i = 0; i < num_vecs; i++)
@@ -487,8 +668,6 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 	ignorepipe.sa_flags = 0;
 	sigaction(SIGPIPE, &ignorepipe, &oldact);
 
-	mutex_lock(&h->request_mutex);
-
 	if (!xs_write_all(h->fd, &msg, sizeof(msg)))
 		goto fail;
 
@@ -496,32 +675,50 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
 			goto fail;
 
-	ret = read_reply(h, &msg.type, len);
-	if (!ret)
-		goto fail;
-
-	mutex_unlock(&h->request_mutex);
+	sigaction(SIGPIPE, &oldact, NULL);
+	__atomic_fetch_add(&h->in_flight, 1, __ATOMIC_RELEASE);
+	return msg.req_id;
 
+fail:
+	/* We're in a bad state, so close fd. */
+	saved_errno = errno;
 	sigaction(SIGPIPE, &oldact, NULL);
-	if (msg.type == XS_ERROR) {
+	close(h->fd);
+	h->fd = -1;
+	errno = saved_errno;
+	return 0;
+}
+
+/* Get the malloc'ed reply to request $req_id, of type $type, sent with the
+ * request lock held, which is dropped.  NULL and set errno on error. */
+static void *wait_reply(struct xs_handle *h, uint32_t req_id,
+			enum xsd_sockmsg_type type, unsigned int *len)
+{
+	enum xsd_sockmsg_type reply_type;
+	void *ret;
+	int saved_errno;
+
+	ret = read_reply(h, req_id, &reply_type, len);
+	if (!ret) {
+		/* We're in a bad state, so close fd. */
+		saved_errno = errno;
+		goto close_fd;
+	}
+
+	if (reply_type == XS_ERROR) {
 		saved_errno = get_error(ret);
 		free(ret);
 		errno = saved_errno;
 		return NULL;
 	}
 
-	if (msg.type != type) {
+	if (reply_type != type) {
 		free(ret);
 		saved_errno = EBADF;
 		goto close_fd;
 	}
 	return ret;
 
-fail:
-	/* We're in a bad state, so close fd. */
-	saved_errno = errno;
-	mutex_unlock(&h->request_mutex);
-	sigaction(SIGPIPE, &oldact, NULL);
 close_fd:
 	close(h->fd);
 	h->fd = -1;
@@ -529,6 +726,26 @@ close_fd:
 	return NULL;
 }
 
+/* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
+static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
+		      enum xsd_sockmsg_type type,
+		      const struct iovec *iovec,
+		      unsigned int num_vecs,
+		      unsigned int *len)
+{
+	uint32_t req_id;
+
+	mutex_lock(&h->request_mutex);
+
+	req_id = send_request(h, t, type, iovec, num_vecs);
+	if (!req_id) {
+		mutex_unlock(&h->request_mutex);
+		return NULL;
+	}
+
+	return wait_reply(h, req_id, type, len);
+}
+
 /* free(), but don't change errno. */
 static void free_no_errno(void *p)
 {
@@ -558,15 +775,11 @@ static bool xs_bool(char *reply)
 	return true;
 }
 
-char **xs_directory(struct xs_handle *h, xs_transaction_t t,
-		    const char *path, unsigned int *num)
+/* Turn the body of an XS_DIRECTORY reply into an array, freeing it. */
+static char **directory_strings(char *strings, unsigned int len,
+				unsigned int *num)
 {
-	char *strings, *p, **ret;
-	unsigned int len;
-
-	strings = xs_single(h, t, XS_DIRECTORY, path, &len);
-	if (!strings)
-		return NULL;
+	char *p, **ret;
 
 	/* Count the strings. */
 	*num = xs_count_strings(strings, len);
@@ -586,6 +799,21 @@ char **xs_directory(struct xs_handle *h, xs_transaction_t t,
 	return ret;
 }
 
+char **xs_directory(struct xs_handle *h, xs_transaction_t t,
+		    const char *path, unsigned int *num)
+{
+	char *strings;
+	unsigned int len;
+
+	strings = snapshot_read(h, t, path, true, &len);
+	if (!strings)
+		strings = xs_single(h, t, XS_DIRECTORY, path, &len);
+	if (!strings)
+		return NULL;
+
+	return directory_strings(strings, len, num);
+}
+
 /* Get the value of a single file, nul terminated.
  * Returns a malloced value: call free() on it after use.
  * len indicates length in bytes, not including the nul.
@@ -593,7 +821,464 @@ char **xs_directory(struct xs_handle *h, xs_transaction_t t,
 void *xs_read(struct xs_handle *h, xs_transaction_t t,
 	      const char *path, unsigned int *len)
 {
-	return xs_single(h, t, XS_READ, path, len);
+	void *ret = snapshot_read(h, t, path, false, len);
+
+	return ret ? ret : xs_single(h, t, XS_READ, path, len);
+}
+
+/* Send a request without waiting for its reply. */
+static xs_request_t xs_send_async(struct xs_handle *h, xs_transaction_t t,
+				  enum xsd_sockmsg_type type,
+				  const struct iovec *iovec,
+				  unsigned int num_vecs)
+{
+	uint32_t req_id;
+
+	mutex_lock(&h->request_mutex);
+	req_id = send_request(h, t, type, iovec, num_vecs);
+	mutex_unlock(&h->request_mutex);
+
+	return req_id;
+}
+
+static xs_request_t xs_single_async(struct xs_handle *h, xs_transaction_t t,
+				    enum xsd_sockmsg_type type,
+				    const char *string)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)string;
+	iovec.iov_len = strlen(string) + 1;
+	return xs_send_async(h, t, type, &iovec, 1);
+}
+
+xs_request_t xs_read_async(struct xs_handle *h, xs_transaction_t t,
+			   const char *path)
+{
+	return xs_single_async(h, t, XS_READ, path);
+}
+
+xs_request_t xs_directory_async(struct xs_handle *h, xs_transaction_t t,
+				const char *path)
+{
+	return xs_single_async(h, t, XS_DIRECTORY, path);
+}
+
+xs_request_t xs_write_async(struct xs_handle *h, xs_transaction_t t,
+			    const char *path, const void *data,
+			    unsigned int len)
+{
+	struct iovec iovec[2];
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = (void *)data;
+	iovec[1].iov_len = len;
+
+	return xs_send_async(h, t, XS_WRITE, iovec, ARRAY_SIZE(iovec));
+}
+
+xs_request_t xs_rm_async(struct xs_handle *h, xs_transaction_t t,
+			 const char *path)
+{
+	return xs_single_async(h, t, XS_RM, path);
+}
+
+/* Wait for the reply to an asynchronous request, and check its type. */
+static void *xs_wait_type(struct xs_handle *h, xs_request_t req,
+			  enum xsd_sockmsg_type type, unsigned int *len)
+{
+	if (!req) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mutex_lock(&h->request_mutex);
+	return wait_reply(h, req, type, len);
+}
+
+void *xs_wait_read(struct xs_handle *h, xs_request_t req, unsigned int *len)
+{
+	return xs_wait_type(h, req, XS_READ, len);
+}
+
+char **xs_wait_directory(struct xs_handle *h, xs_request_t req,
+			 unsigned int *num)
+{
+	char *strings;
+	unsigned int len;
+
+	strings = xs_wait_type(h, req, XS_DIRECTORY, &len);
+	if (!strings)
+		return NULL;
+
+	return directory_strings(strings, len, num);
+}
+
+bool xs_wait_write(struct xs_handle *h, xs_request_t req)
+{
+	return xs_bool(xs_wait_type(h, req, XS_WRITE, NULL));
+}
+
+bool xs_wait_rm(struct xs_handle *h, xs_request_t req)
+{
+	return xs_bool(xs_wait_type(h, req, XS_RM, NULL));
+}
+
+/* Read paths [0, num) with XS_READ requests, all sent before any reply is
+ * waited for. */
+static bool read_pipelined(struct xs_handle *h, xs_transaction_t t,
+			   unsigned int num, const char *const paths[],
+			   void *values[], unsigned int lens[])
+{
+	xs_request_t *reqs;
+	unsigned int i;
+	bool ret = true;
+
+	reqs = malloc(num * sizeof(*reqs));
+	if (!reqs)
+		return false;
+
+	for (i = 0; i < num; i++) {
+		reqs[i] = xs_read_async(h, t, paths[i]);
+		if (!reqs[i] && errno != E2BIG) {
+			ret = false;
+			break;
+		}
+	}
+	num = i;
+
+	for (i = 0; i < num; i++) {
+		lens[i] = 0;
+		values[i] = reqs[i] ? xs_wait_read(h, reqs[i], &lens[i]) : NULL;
+		/* The connection is gone, and with it the other replies. */
+		if (!values[i] && h->fd == -1)
+			ret = false;
+	}
+
+	free_no_errno(reqs);
+	return ret;
+}
+
+/* Parse the XS_READ_MULTI reply $reply into values[] and lens[].
+ * Returns the number of values in it, or -1 if it isn't valid. */
+static int parse_read_multi(char *reply, unsigned int len, unsigned int num,
+			    void *values[], unsigned int lens[])
+{
+	char *p = reply, *end = reply + len, *nul;
+	unsigned long vlen;
+	unsigned int i;
+
+	for (i = 0; i < num && p < end; i++) {
+		nul = memchr(p, '\0', end - p);
+		if (!nul) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (*p == 'E') {
+			/* Couldn't be read: the error, as for XS_ERROR. */
+			values[i] = NULL;
+			lens[i] = 0;
+			p = nul + 1;
+			continue;
+		}
+
+		vlen = strtoul(p, NULL, 10);
+		p = nul + 1;
+		if (vlen > end - p) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		/* Values are nul terminated, as for xs_read(). */
+		values[i] = malloc(vlen + 1);
+		if (!values[i])
+			return -1;
+		memcpy(values[i], p, vlen);
+		((char *)values[i])[vlen] = '\0';
+		lens[i] = vlen;
+		p += vlen;
+	}
+
+	return i;
+}
+
+/* Most paths in an XS_READ_MULTI request, which bounds our stack use. */
+#define READ_MULTI_PATHS 128
+
+bool xs_read_multi(struct xs_handle *h, xs_transaction_t t,
+		   unsigned int num, const char *const paths[],
+		   void *values[], unsigned int lens[])
+{
+	struct iovec iov[READ_MULTI_PATHS];
+	unsigned int i, n, size, *l, len;
+	char *reply;
+	int got;
+
+	l = lens;
+	if (!l) {
+		l = malloc(num * sizeof(*l));
+		if (!l && num)
+			return false;
+	}
+
+	for (i = 0; i < num; i++)
+		values[i] = NULL;
+
+	for (i = 0; i < num && !h->no_read_multi; i += got) {
+		/* As many paths as fit in one request. */
+		size = 0;
+		for (n = 0; i + n < num && n < ARRAY_SIZE(iov); n++) {
+			iov[n].iov_base = (void *)paths[i + n];
+			iov[n].iov_len = strlen(paths[i + n]) + 1;
+			if (size + iov[n].iov_len > XENSTORE_PAYLOAD_MAX)
+				break;
+			size += iov[n].iov_len;
+		}
+		if (!n)
+			n = 1;
+
+		reply = xs_talkv(h, t, XS_READ_MULTI, iov, n, &len);
+		if (!reply) {
+			if (h->fd != -1 && (errno == ENOSYS || errno == EINVAL)) {
+				/* An older daemon. */
+				h->no_read_multi = true;
+				break;
+			}
+			goto fail;
+		}
+
+		got = parse_read_multi(reply, len, n, &values[i], &l[i]);
+		free_no_errno(reply);
+		if (got < 0)
+			goto fail;
+
+		/* The next value doesn't fit in a reply with any other. */
+		if (!got) {
+			l[i] = 0;
+			values[i] = xs_read(h, t, paths[i], &l[i]);
+			if (!values[i] && h->fd == -1)
+				goto fail;
+			got = 1;
+		}
+	}
+
+	if (i < num &&
+	    !read_pipelined(h, t, num - i, &paths[i], &values[i], &l[i]))
+		goto fail;
+
+	if (l != lens)
+		free(l);
+	return true;
+
+ fail:
+	for (i = 0; i < num; i++) {
+		free_no_errno(values[i]);
+		values[i] = NULL;
+	}
+	if (l != lens)
+		free_no_errno(l);
+	return false;
+}
+
+/* Turn the XS_READ_SUBTREE records $records into the array returned by
+ * xs_read_subtree(), freeing $records. */
+static struct xs_subtree_entry *subtree_entries(char *records,
+						unsigned int len,
+						unsigned int *num)
+{
+	struct xs_subtree_entry *ret = NULL;
+	char *p, *end = records + len, *nul, *hdr, *q;
+	unsigned long vlen;
+	size_t size = 0;
+	unsigned int i;
+
+	/* Check and measure the records first, then copy them. */
+	for (*num = 0, p = records; p < end; (*num)++) {
+		nul = memchr(p, '\0', end - p);
+		if (!nul)
+			goto inval;
+		size += nul + 1 - p;
+		hdr = nul + 1;
+		nul = memchr(hdr, '\0', end - hdr);
+		if (!nul)
+			goto inval;
+		p = nul + 1;
+		if (*hdr == 'E')
+			continue;
+		vlen = strtoul(hdr, NULL, 10);
+		if (vlen > end - p)
+			goto inval;
+		size += vlen + 1;
+		p += vlen;
+	}
+
+	ret = malloc(*num * sizeof(*ret) + size);
+	if (!ret)
+		goto out;
+
+	q = (char *)&ret[*num];
+	for (i = 0, p = records; i < *num; i++) {
+		ret[i].name = q;
+		strcpy(q, p);
+		q += strlen(p) + 1;
+		hdr = p + strlen(p) + 1;
+		p = hdr + strlen(hdr) + 1;
+		if (*hdr == 'E') {
+			ret[i].value = NULL;
+			ret[i].len = 0;
+			continue;
+		}
+		ret[i].len = strtoul(hdr, NULL, 10);
+		ret[i].value = q;
+		memcpy(q, p, ret[i].len);
+		q[ret[i].len] = '\0';
+		q += ret[i].len + 1;
+		p += ret[i].len;
+	}
+	goto out;
+
+ inval:
+	errno = EINVAL;
+ out:
+	free_no_errno(records);
+	return ret;
+}
+
+/* "$a/$b", malloced. */
+static char *join_names(const char *a, const char *b)
+{
+	char *ret = malloc(strlen(a) + 1 + strlen(b) + 1);
+
+	if (ret)
+		sprintf(ret, "%s/%s", a, b);
+	return ret;
+}
+
+/* Append to $records, as XS_READ_SUBTREE would, the children of $path
+ * named relative to it with prefix $relname, and their children down to
+ * $depth levels, by XS_DIRECTORY and XS_READ_MULTI.
+ * Returns false on failure. */
+static bool read_subtree_emulated(struct xs_handle *h, xs_transaction_t t,
+				  const char *path, const char *relname,
+				  unsigned int depth, char **records,
+				  unsigned int *len)
+{
+	char **children, **paths = NULL, **names = NULL, hdr[16], *tmp;
+	void **values = NULL;
+	unsigned int i, num, *lens = NULL, size;
+	bool ret = false;
+
+	children = xs_directory(h, t, path, &num);
+	if (!children)
+		/* Our caller's node has gone, or we can't list it. */
+		return relname && h->fd != -1;
+
+	paths = calloc(num, sizeof(*paths));
+	names = calloc(num, sizeof(*names));
+	values = calloc(num, sizeof(*values));
+	lens = calloc(num, sizeof(*lens));
+	if (num && (!paths || !names || !values || !lens))
+		goto out;
+
+	for (i = 0; i < num; i++) {
+		paths[i] = join_names(strcmp(path, "/") ? path : "",
+				      children[i]);
+		names[i] = relname ? join_names(relname, children[i])
+				   : strdup(children[i]);
+		if (!paths[i] || !names[i])
+			goto out;
+	}
+
+	if (!xs_read_multi(h, t, num, (const char *const *)paths,
+			   values, lens))
+		goto out;
+
+	for (i = 0; i < num; i++) {
+		if (values[i])
+			snprintf(hdr, sizeof(hdr), "%u", lens[i]);
+		else
+			strcpy(hdr, "ENOENT");
+
+		size = strlen(names[i]) + 1 + strlen(hdr) + 1 + lens[i];
+		tmp = realloc(*records, *len + size);
+		if (!tmp)
+			goto out;
+		*records = tmp;
+		tmp += *len;
+		strcpy(tmp, names[i]);
+		tmp += strlen(names[i]) + 1;
+		strcpy(tmp, hdr);
+		tmp += strlen(hdr) + 1;
+		if (lens[i])
+			memcpy(tmp, values[i], lens[i]);
+		*len += size;
+
+		if (values[i] && depth != 1 &&
+		    !read_subtree_emulated(h, t, paths[i], names[i],
+					   depth ? depth - 1 : 0,
+					   records, len))
+			goto out;
+	}
+
+	ret = true;
+
+ out:
+	for (i = 0; i < num; i++) {
+		if (paths)
+			free_no_errno(paths[i]);
+		if (names)
+			free_no_errno(names[i]);
+		if (values)
+			free_no_errno(values[i]);
+	}
+	free_no_errno(paths);
+	free_no_errno(names);
+	free_no_errno(values);
+	free_no_errno(lens);
+	free_no_errno(children);
+	return ret;
+}
+
+struct xs_subtree_entry *xs_read_subtree(struct xs_handle *h,
+					 xs_transaction_t t,
+					 const char *path, unsigned int depth,
+					 unsigned int *num)
+{
+	char depthstr[MAX_STRLEN(depth) + 1], *records;
+	struct iovec iov[2];
+	unsigned int len = 0;
+
+	if (!h->no_read_subtree) {
+		snprintf(depthstr, sizeof(depthstr), "%u", depth);
+		iov[0].iov_base = (void *)path;
+		iov[0].iov_len = strlen(path) + 1;
+		iov[1].iov_base = depthstr;
+		iov[1].iov_len = strlen(depthstr) + 1;
+
+		records = xs_talkv(h, t, XS_READ_SUBTREE, iov,
+				   ARRAY_SIZE(iov), &len);
+		if (records)
+			return subtree_entries(records, len, num);
+		if (h->fd == -1)
+			return NULL;
+		if (errno == ENOSYS || errno == EINVAL)
+			/* An older daemon. */
+			h->no_read_subtree = true;
+		else if (errno != E2BIG)
+			return NULL;
+	}
+
+	/* Too big for a reply, or not understood: go a level at a time. */
+	records = NULL;
+	len = 0;
+	if (!read_subtree_emulated(h, t, path, NULL, depth, &records, &len)) {
+		free_no_errno(records);
+		return NULL;
+	}
+
+	return subtree_entries(records, len, num);
 }
 
 /* Write the value of a single file.
@@ -1187,15 +1872,9 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	} else {
 		mutex_lock(&h->reply_mutex);
 
-		/* There should only ever be one response pending! */
-		if (!list_empty(&h->reply_list)) {
-			mutex_unlock(&h->reply_mutex);
-			saved_errno = EEXIST;
-			goto error_freebody;
-		}
-
+		/* Replies are told apart by req_id, so wake every waiter. */
 		list_add_tail(&msg->list, &h->reply_list);
-		condvar_signal(&h->reply_condvar);
+		condvar_broadcast(&h->reply_condvar);
 
 		mutex_unlock(&h->reply_mutex);
 	}
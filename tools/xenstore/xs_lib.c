@@ -73,6 +73,17 @@ const char *xs_daemon_socket_ro(void)
 	return buf;
 }
 
+const char *xs_daemon_snapshot(void)
+{
+	static char buf[PATH_MAX];
+	const char *s = xs_daemon_path();
+	if (s == NULL)
+		return NULL;
+	if (snprintf(buf, sizeof(buf), "%s_snapshot", s) >= PATH_MAX)
+		return NULL;
+	return buf;
+}
+
 const char *xs_domain_dev(void)
 {
 	char *s = getenv("XENSTORED_PATH");
@@ -185,6 +196,16 @@ unsigned int xs_count_strings(const char *strings, unsigned int len)
 	return num;
 }
 
+uint32_t xs_snapshot_bucket(const char *path, uint32_t nr_buckets)
+{
+	/* FNV-1a. */
+	uint32_t hash = 2166136261u;
+
+	while (*path)
+		hash = (hash ^ (unsigned char)*path++) * 16777619u;
+	return hash & (nr_buckets - 1);
+}
+
 char *expanding_buffer_ensure(struct expanding_buffer *ebuf, int min_avail)
 {
 	int want;
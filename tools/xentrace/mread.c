@@ -5,8 +5,11 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <limits.h>
 #include "mread.h"
 
+#define BITS_PER_LONG (sizeof(unsigned long) * CHAR_BIT)
+
 mread_handle_t mread_init(int fd)
 {
     struct stat s;
@@ -27,9 +30,48 @@ mread_handle_t mread_init(int fd)
     fstat(fd, &s);
     h->file_size = s.st_size;
 
+    /*
+     * Records are read from one stream per pcpu, each at its own offset;
+     * with many pcpus a handful of windows keep getting remapped.  Where
+     * the address space is large enough just map the whole file, and ask
+     * for each stream's next chunk to be read ahead as it gets there.
+     */
+    if ( sizeof(void *) >= 8 && h->file_size > 0 )
+    {
+        size_t chunks = (h->file_size >> (PAGE_SHIFT+MREAD_BUF_SHIFT)) + 1;
+
+        h->whole = mmap(NULL, h->file_size, PROT_READ, MAP_SHARED, fd, 0);
+        h->prefetched = calloc((chunks + BITS_PER_LONG - 1) / BITS_PER_LONG,
+                               sizeof(unsigned long));
+        if ( h->whole == MAP_FAILED || !h->prefetched )
+        {
+            if ( h->whole != MAP_FAILED )
+                munmap(h->whole, h->file_size);
+            free(h->prefetched);
+            h->whole = NULL;
+            h->prefetched = NULL;
+        }
+    }
+
     return h;
 }
 
+static void mread_prefetch(mread_handle_t h, off_t offset)
+{
+    off_t next = (offset & MREAD_BUF_MASK) + MREAD_BUF_SIZE;
+    size_t chunk = next >> (PAGE_SHIFT+MREAD_BUF_SHIFT);
+    unsigned long bit = 1UL << (chunk % BITS_PER_LONG);
+
+    if ( next >= h->file_size || (h->prefetched[chunk / BITS_PER_LONG] & bit) )
+        return;
+
+    h->prefetched[chunk / BITS_PER_LONG] |= bit;
+    madvise(h->whole + next,
+            (next + MREAD_BUF_SIZE > h->file_size) ?
+            h->file_size - next : MREAD_BUF_SIZE,
+            MADV_WILLNEED);
+}
+
 ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
 {
     /* Idea: have a "cache" of N mmaped regions.  If the offset is
@@ -66,6 +108,13 @@ ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
         len = h->file_size - offset;
     }
 
+    if ( h->whole )
+    {
+        mread_prefetch(h, offset);
+        bcopy(h->whole + offset, rec, len);
+        return len;
+    }
+
     /* Try to find the offset in our range */
     dprintf(warn, " Trying last, %d\n", last);
     if ( h->map[h->last].buffer
@@ -12,6 +12,10 @@ typedef struct mread_ctrl {
         int accessed;
     } map[MREAD_MAPS];
     int clock, last;
+    /* Whole file mapping, when the address space allows */
+    char * whole;
+    /* Chunks of MREAD_BUF_SIZE already asked to be read ahead */
+    unsigned long * prefetched;
 } *mread_handle_t;
 
 mread_handle_t mread_init(int fd);
@@ -69,6 +69,8 @@ struct {
     struct symbol_struct * symbols;
     char * symbol_file;
     char * trace_file;
+    char ** trace_files;
+    int nr_trace_files;
     int output_defined;
     off_t file_size;
     struct {
@@ -7775,6 +7777,23 @@ void sched_process(struct pcpu_info *p)
                        ri->dump_header, r->domid, r->vcpuid, r->rqi, r->cpu);
             }
             break;
+        case TRC_SCHED_CLASS_EVT(CSCHED2, 20): /* PICK_CAND        */
+            if (opt.dump_all) {
+                struct {
+                    uint64_t b_avgload, score;
+                    unsigned vcpuid:16, domid:16;
+                    unsigned rqi:16, distance:8, flags:8;
+                } *r = (typeof(r))ri->d;
+
+                printf(" %s csched2:pick_cand d%uv%u, rq# %u, "
+                       "avg_load = %"PRIu64", score = %"PRIu64", "
+                       "node distance %u%s%s\n",
+                       ri->dump_header, r->domid, r->vcpuid, r->rqi,
+                       r->b_avgload, r->score, r->distance,
+                       (r->flags & 1) ? ", shares LLC with waker" : "",
+                       (r->flags & 2) ? ", migration" : "");
+            }
+            break;
         /* RTDS (TRC_RTDS_xxx) */
         case TRC_SCHED_CLASS_EVT(RTDS, 1): /* TICKLE           */
             if(opt.dump_all) {
@@ -10321,8 +10340,13 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         /* FIXME - strcpy */
         if (state->arg_num == 0)
             G.trace_file = arg;
-        else
-            argp_usage(state);
+        G.trace_files = realloc(G.trace_files,
+                                (G.nr_trace_files + 1) * sizeof(char *));
+        if (G.trace_files == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        G.trace_files[G.nr_trace_files++] = arg;
     }
     break;
     case ARGP_KEY_END:
@@ -10617,13 +10641,60 @@ const struct argp_option cmd_opts[] =  {
 const struct argp parser_def = {
     .options = cmd_opts,
     .parser = cmd_parser,
-    .args_doc = "[trace file]",
+    .args_doc = "[trace file...]",
     .doc = "",
 };
 
 const char *argp_program_bug_address = "George Dunlap <george.dunlap@eu.citrix.com>";
 
 
+/*
+ * Each per-cpu file written by xentrace --per-cpu-files is a sequence of
+ * self-describing cpu change windows, like a normal trace, so concatenating
+ * them yields a valid trace.  Do that into an unlinked temporary file, and
+ * analyze that as usual.
+ */
+int merge_trace_files(void) {
+    static char buf[1 << 20];
+    FILE *out;
+    int i;
+
+    if ( (out = tmpfile()) == NULL ) {
+        perror("tmpfile");
+        return -1;
+    }
+
+    for (i = 0; i < G.nr_trace_files; i++) {
+        ssize_t r;
+        int fd;
+
+        if ( (fd = open(G.trace_files[i], O_RDONLY)) < 0 ) {
+            perror(G.trace_files[i]);
+            return -1;
+        }
+
+        while ( (r = read(fd, buf, sizeof(buf))) > 0 )
+            if ( fwrite(buf, r, 1, out) != 1 ) {
+                perror("fwrite");
+                return -1;
+            }
+
+        if ( r < 0 ) {
+            perror(G.trace_files[i]);
+            return -1;
+        }
+
+        close(fd);
+    }
+
+    if ( fflush(out) ) {
+        perror("fflush");
+        return -1;
+    }
+
+    return fileno(out);
+}
+
 int main(int argc, char *argv[]) {
     /* Start with warn at stderr. */
     warn = stderr;
@@ -10633,7 +10704,12 @@ int main(int argc, char *argv[]) {
     if (G.trace_file == NULL)
         exit(1);
 
-    if ( (G.fd = open(G.trace_file, O_RDONLY)) < 0) {
+    if ( G.nr_trace_files > 1 )
+        G.fd = merge_trace_files();
+    else
+        G.fd = open(G.trace_file, O_RDONLY);
+
+    if ( G.fd < 0) {
         perror("open");
         error(ERR_SYSTEM, NULL);
     } else {
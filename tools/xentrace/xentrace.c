@@ -26,6 +26,8 @@
 #include <ctype.h>
 #include <sys/poll.h>
 #include <sys/statvfs.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <xen/xen.h>
 #include <xen/trace.h>
@@ -43,6 +45,11 @@ do {                                                            \
 } while (0)
 
 
+/* *BSD has no O_LARGEFILE */
+#ifndef O_LARGEFILE
+#define O_LARGEFILE	0
+#endif
+
 /***** Compile time configuration of defaults ********************************/
 
 /* sleep for this long (milliseconds) between checking the trace buffers */
@@ -62,7 +69,8 @@ typedef struct settings_st {
     unsigned long memory_buffer;
     uint8_t discard:1,
         disable_tracing:1,
-        start_disabled:1;
+        start_disabled:1,
+        per_cpu_files:1;
 } settings_t;
 
 struct t_struct {
@@ -334,17 +342,17 @@ fail:
 
 /**
  * write_buffer - write a section of the trace buffer
+ * @fd       - output file descriptor
  * @cpu      - source buffer CPU ID
  * @start
  * @size     - size of write (may be less than total window size)
  * @total_size - total size of the window (0 on 2nd write of wrapped windows)
- * @out      - output stream
  *
  * Outputs the trace buffer to a filestream, prepending the CPU and size
  * of the buffer write.
  */
-static void write_buffer(unsigned int cpu, unsigned char *start, int size,
-                         int total_size)
+static void write_buffer(int fd, unsigned int cpu, unsigned char *start,
+                         int size, int total_size)
 {
     struct statvfs stat;
     size_t written = 0;
@@ -354,7 +362,7 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
         unsigned long long freespace;
 
         /* Check that filesystem has enough space. */
-        if ( fstatvfs (outfd, &stat) )
+        if ( fstatvfs (fd, &stat) )
         {
             fprintf(stderr, "Statfs failed!\n");
             goto fail;
@@ -393,7 +401,7 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
             rec.data.cpu = cpu;
             rec.data.window_size = total_size;
 
-            written = write(outfd, &rec, sizeof(rec));
+            written = write(fd, &rec, sizeof(rec));
             if ( written != sizeof(rec) )
             {
                 fprintf(stderr, "Cannot write cpu change (write returned %zd)\n",
@@ -409,7 +417,7 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
     }
     else
     {
-        written = write(outfd, start, size);
+        written = write(fd, start, size);
         if ( written != size )
         {
             fprintf(stderr, "Write failed! (size %d, returned %zd)\n",
@@ -658,6 +666,186 @@ static void wait_for_event_or_timeout(unsigned long milliseconds)
 }
 
 
+/**
+ * drain_tbuf - write out the records currently in one CPU's trace buffer
+ * @fd:        the file descriptor to write to
+ * @cpu:       the CPU owning the buffer
+ * @meta:      the trace buffer metadata
+ * @data:      the trace buffer data area
+ * @data_size: size of the data area
+ *
+ * The records are written straight from the mapped trace pages.
+ */
+static void drain_tbuf(int fd, unsigned int cpu, struct t_buf *meta,
+                       unsigned char *data, unsigned long data_size)
+{
+    unsigned long start_offset, end_offset, window_size, cons, prod;
+
+    /* Read window information only once. */
+    cons = meta->cons;
+    prod = meta->prod;
+    xen_rmb(); /* read prod, then read item. */
+
+    if ( cons == prod )
+        return;
+
+    assert(cons < 2*data_size);
+    assert(prod < 2*data_size);
+
+    // NB: if (prod<cons), then (prod-cons)%data_size will not yield
+    // the correct answer because data_size is not a power of 2.
+    if ( prod < cons )
+        window_size = (prod + 2*data_size) - cons;
+    else
+        window_size = prod - cons;
+    assert(window_size > 0);
+    assert(window_size <= data_size);
+
+    start_offset = cons % data_size;
+    end_offset = prod % data_size;
+
+    if ( end_offset > start_offset )
+    {
+        /* If window does not wrap, write in one big chunk */
+        write_buffer(fd, cpu, data+start_offset,
+                     window_size,
+                     window_size);
+    }
+    else
+    {
+        /* If wrapped, write in two chunks:
+         * - first, start to the end of the buffer
+         * - second, start of buffer to end of window
+         */
+        write_buffer(fd, cpu, data + start_offset,
+                     data_size - start_offset,
+                     window_size);
+        write_buffer(fd, cpu, data,
+                     end_offset,
+                     0);
+    }
+
+    xen_mb(); /* read buffer, then update cons. */
+    meta->cons = prod;
+}
+
+/*
+ * Per-CPU output mode: each CPU's buffer is drained by its own thread into
+ * its own file, so that one slow writer can't make every buffer overflow.
+ * The main thread waits for VIRQ_TBUF and wakes all the writers.
+ */
+struct cpu_writer {
+    pthread_t thread;
+    unsigned int cpu;
+    int fd;
+    struct t_buf *meta;
+    unsigned char *data;
+    unsigned long data_size;
+};
+
+static pthread_mutex_t writers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writers_wake = PTHREAD_COND_INITIALIZER;
+static unsigned long writers_gen;
+static int writers_stop;
+
+static void *cpu_writer_main(void *arg)
+{
+    struct cpu_writer *w = arg;
+    unsigned long gen = 0;
+    int stop = 0;
+
+    while ( !stop )
+    {
+        drain_tbuf(w->fd, w->cpu, w->meta, w->data, w->data_size);
+
+        pthread_mutex_lock(&writers_lock);
+        while ( gen == writers_gen )
+            pthread_cond_wait(&writers_wake, &writers_lock);
+        gen = writers_gen;
+        stop = writers_stop;
+        pthread_mutex_unlock(&writers_lock);
+    }
+
+    /* Last pass, after tracing got disabled. */
+    drain_tbuf(w->fd, w->cpu, w->meta, w->data, w->data_size);
+    close(w->fd);
+
+    return NULL;
+}
+
+static void wake_cpu_writers(int stop)
+{
+    pthread_mutex_lock(&writers_lock);
+    writers_gen++;
+    writers_stop = stop;
+    pthread_cond_broadcast(&writers_wake);
+    pthread_mutex_unlock(&writers_lock);
+}
+
+static struct cpu_writer *start_cpu_writers(struct t_struct *tbufs,
+                                            unsigned int num,
+                                            unsigned long data_size)
+{
+    struct cpu_writer *writers = calloc(num, sizeof(*writers));
+    sigset_t all, old;
+    unsigned int i;
+
+    if ( writers == NULL )
+    {
+        PERROR("Failed to allocate per-cpu writers");
+        exit(EXIT_FAILURE);
+    }
+
+    for ( i = 0; i < num; i++ )
+    {
+        char name[PATH_MAX];
+
+        snprintf(name, sizeof(name), "%s.%u", opts.outfile, i);
+        writers[i].fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
+                             0644);
+        if ( writers[i].fd < 0 )
+        {
+            PERROR("Could not open output file %s", name);
+            exit(EXIT_FAILURE);
+        }
+        writers[i].cpu = i;
+        writers[i].meta = tbufs->meta[i];
+        writers[i].data = tbufs->data[i];
+        writers[i].data_size = data_size;
+    }
+
+    /* Leave signal handling to the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for ( i = 0; i < num; i++ )
+    {
+        errno = pthread_create(&writers[i].thread, NULL, cpu_writer_main,
+                               &writers[i]);
+        if ( errno )
+        {
+            PERROR("Failed to create writer thread for cpu %u", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return writers;
+}
+
+static void stop_cpu_writers(struct cpu_writer *writers, unsigned int num)
+{
+    unsigned int i;
+
+    wake_cpu_writers(1);
+
+    for ( i = 0; i < num; i++ )
+        pthread_join(writers[i].thread, NULL);
+
+    free(writers);
+}
+
 /**
  * monitor_tbufs - monitor the contents of tbufs and output to a file
  * @logfile:       the FILE * representing the file to log to
@@ -674,6 +862,7 @@ static int monitor_tbufs(void)
     unsigned int  num;           /* number of trace buffers / logical CPUS   */
     unsigned long tinfo_size;    /* size of t_info metadata map */
     unsigned long size;          /* size of a single trace buffer            */
+    struct cpu_writer *writers = NULL;
 
     unsigned long data_size;
 
@@ -704,61 +893,17 @@ static int monitor_tbufs(void)
         for ( i = 0; i < num; i++ )
             meta[i]->cons = meta[i]->prod;
 
+    if ( opts.per_cpu_files )
+        writers = start_cpu_writers(tbufs, num, data_size);
+
     /* now, scan buffers for events */
     while ( 1 )
     {
-        for ( i = 0; i < num; i++ )
-        {
-            unsigned long start_offset, end_offset, window_size, cons, prod;
-                
-            /* Read window information only once. */
-            cons = meta[i]->cons;
-            prod = meta[i]->prod;
-            xen_rmb(); /* read prod, then read item. */
-
-            if ( cons == prod )
-                continue;
-           
-            assert(cons < 2*data_size);
-            assert(prod < 2*data_size);
-
-            // NB: if (prod<cons), then (prod-cons)%data_size will not yield
-            // the correct answer because data_size is not a power of 2.
-            if ( prod < cons )
-                window_size = (prod + 2*data_size) - cons;
-            else
-                window_size = prod - cons;
-            assert(window_size > 0);
-            assert(window_size <= data_size);
-
-            start_offset = cons % data_size;
-            end_offset = prod % data_size;
-
-            if ( end_offset > start_offset )
-            {
-                /* If window does not wrap, write in one big chunk */
-                write_buffer(i, data[i]+start_offset,
-                             window_size,
-                             window_size);
-            }
-            else
-            {
-                /* If wrapped, write in two chunks:
-                 * - first, start to the end of the buffer
-                 * - second, start of buffer to end of window
-                 */
-                write_buffer(i, data[i] + start_offset,
-                             data_size - start_offset,
-                             window_size);
-                write_buffer(i, data[i],
-                             end_offset,
-                             0);
-            }
-
-            xen_mb(); /* read buffer, then update cons. */
-            meta[i]->cons = prod;
-
-        }
+        if ( writers )
+            wake_cpu_writers(0);
+        else
+            for ( i = 0; i < num; i++ )
+                drain_tbuf(outfd, i, meta[i], data[i], data_size);
 
         if ( interrupted )
         {
@@ -777,6 +922,9 @@ static int monitor_tbufs(void)
         wait_for_event_or_timeout(opts.poll_sleep);
     }
 
+    if ( writers )
+        stop_cpu_writers(writers, num);
+
     if ( opts.memory_buffer )
         membuf_dump();
 
@@ -784,7 +932,8 @@ static int monitor_tbufs(void)
     free(meta);
     free(data);
     /* don't need to munmap - cleanup is automatic */
-    close(outfd);
+    if ( !writers )
+        close(outfd);
 
     return 0;
 }
@@ -832,6 +981,9 @@ static void usage(void)
 "  -V, --version           Print program version\n" \
 "  -M, --memory-buffer=b   Copy trace records to a circular memory buffer.\n" \
 "                          Dump to file on exit.\n" \
+"  -p, --per-cpu-files     Write each CPU's records to its own file, FILE.N\n" \
+"                          for CPU N, from a thread per CPU.  Use\n" \
+"                          xenalyze with all the files to merge them.\n" \
 "  -r  --reserve-disk-space=n Before writing trace records to disk, check to see\n" \
 "                          that after the write there will be at least n space\n" \
 "                          left on the disk.\n" \
@@ -1083,12 +1235,13 @@ static void parse_args(int argc, char **argv)
         { "discard-buffers", no_argument,      0, 'D' },
         { "dont-disable-tracing", no_argument, 0, 'x' },
         { "start-disabled", no_argument,       0, 'X' },
+        { "per-cpu-files",  no_argument,       0, 'p' },
         { "help",           no_argument,       0, '?' },
         { "version",        no_argument,       0, 'V' },
         { 0, 0, 0, 0 }
     };
 
-    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxX?V",
+    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxXp?V",
                     long_options, NULL)) != -1) 
     {
         switch ( option )
@@ -1137,6 +1290,10 @@ static void parse_args(int argc, char **argv)
             opts.memory_buffer = sargtol(optarg, 0);
             break;
 
+        case 'p': /* One output file per CPU */
+            opts.per_cpu_files = 1;
+            break;
+
         default:
             usage();
         }
@@ -1147,12 +1304,13 @@ static void parse_args(int argc, char **argv)
         usage();
 
     opts.outfile = argv[optind];
-}
 
-/* *BSD has no O_LARGEFILE */
-#ifndef O_LARGEFILE
-#define O_LARGEFILE	0
-#endif
+    if ( opts.per_cpu_files && opts.memory_buffer )
+    {
+        fprintf(stderr, "--per-cpu-files and --memory-buffer are exclusive.\n");
+        exit(EXIT_FAILURE);
+    }
+}
 
 int main(int argc, char **argv)
 {
@@ -1189,18 +1347,20 @@ int main(int argc, char **argv)
     if ( opts.timeout != 0 ) 
         alarm(opts.timeout);
 
-    if ( opts.outfile )
+    if ( opts.per_cpu_files )
+        outfd = -1; /* opened per CPU by monitor_tbufs() */
+    else if ( opts.outfile )
         outfd = open(opts.outfile,
                      O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
                      0644);
 
-    if ( outfd < 0 )
+    if ( outfd < 0 && !opts.per_cpu_files )
     {
         perror("Could not open output file");
         exit(EXIT_FAILURE);
     }        
 
-    if ( isatty(outfd) )
+    if ( !opts.per_cpu_files && isatty(outfd) )
     {
         fprintf(stderr, "Cannot output to a TTY, specify a log file.\n");
         exit(EXIT_FAILURE);
@@ -45,13 +45,17 @@ void idle_loop(void)
         if ( cpu_is_offline(smp_processor_id()) )
             stop_cpu();
 
-        local_irq_disable();
-        if ( cpu_is_haltable(smp_processor_id()) )
+        /* Scrub freed memory before going to sleep. */
+        if ( !scrub_free_pages() )
         {
-            dsb(sy);
-            wfi();
+            local_irq_disable();
+            if ( cpu_is_haltable(smp_processor_id()) )
+            {
+                dsb(sy);
+                wfi();
+            }
+            local_irq_enable();
         }
-        local_irq_enable();
 
         do_tasklet();
         do_softirq();
@@ -678,7 +682,7 @@ void arch_domain_unpause(struct domain *d)
 {
 }
 
-int arch_domain_soft_reset(struct domain *d)
+int arch_domain_soft_reset(struct domain *d, unsigned int flags)
 {
     return -ENOSYS;
 }
@@ -841,6 +845,8 @@ int domain_relinquish_resources(struct domain *d)
         if ( ret )
             return ret;
 
+        ioreq_domain_free(d);
+
         d->arch.relmem = RELMEM_xen;
         /* Fallthrough */
 
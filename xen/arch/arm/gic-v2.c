@@ -174,13 +174,16 @@ static unsigned int gicv2_cpu_mask(const cpumask_t *cpumask)
 
 static void gicv2_save_state(struct vcpu *v)
 {
-    int i;
+    unsigned int i;
 
     /* No need for spinlocks here because interrupts are disabled around
      * this call and it only accesses struct vcpu fields that cannot be
      * accessed simultaneously by another pCPU.
+     *
+     * Only the LRs in use by the vCPU hold state worth saving.
      */
-    for ( i = 0; i < gicv2_info.nr_lrs; i++ )
+    for_each_set_bit ( i, (const unsigned long *)&v->arch.lr_mask,
+                       gicv2_info.nr_lrs )
         v->arch.gic.v2.lr[i] = readl_gich(GICH_LR + i * 4);
 
     v->arch.gic.v2.apr = readl_gich(GICH_APR);
@@ -191,9 +194,10 @@ static void gicv2_save_state(struct vcpu *v)
 
 static void gicv2_restore_state(const struct vcpu *v)
 {
-    int i;
+    unsigned int i;
 
-    for ( i = 0; i < gicv2_info.nr_lrs; i++ )
+    for_each_set_bit ( i, (const unsigned long *)&v->arch.lr_mask,
+                       gicv2_info.nr_lrs )
         writel_gich(v->arch.gic.v2.lr[i], GICH_LR + i * 4);
 
     writel_gich(v->arch.gic.v2.apr, GICH_APR);
@@ -445,6 +449,9 @@ static void gicv2_update_lr(int lr, const struct pending_irq *p,
     if ( p->desc != NULL )
         lr_reg |= GICH_V2_LR_HW | ((p->desc->irq & GICH_V2_LR_PHYSICAL_MASK )
                                    << GICH_V2_LR_PHYSICAL_SHIFT);
+    else if ( p->hw_ppi )
+        lr_reg |= GICH_V2_LR_HW | ((p->hw_ppi & GICH_V2_LR_PHYSICAL_MASK )
+                                   << GICH_V2_LR_PHYSICAL_SHIFT);
 
     writel_gich(lr_reg, GICH_LR + lr * 4);
 }
@@ -507,6 +514,14 @@ static unsigned int gicv2_read_apr(int apr_reg)
    return readl_gich(GICH_APR);
 }
 
+static void gicv2_set_active_state(struct irq_desc *irqd, bool active)
+{
+    unsigned int irq = irqd->irq;
+
+    writel_gicd(1U << (irq % 32),
+                (active ? GICD_ISACTIVER : GICD_ICACTIVER) + (irq / 32) * 4);
+}
+
 static void gicv2_irq_enable(struct irq_desc *desc)
 {
     unsigned long flags;
@@ -1233,6 +1248,7 @@ const static struct gic_hw_operations gicv2_ops = {
     .write_lr            = gicv2_write_lr,
     .read_vmcr_priority  = gicv2_read_vmcr_priority,
     .read_apr            = gicv2_read_apr,
+    .set_active_state    = gicv2_set_active_state,
     .make_hwdom_dt_node  = gicv2_make_hwdom_dt_node,
     .make_hwdom_madt     = gicv2_make_hwdom_madt,
     .map_hwdom_extra_mappings = gicv2_map_hwdown_extra_mappings,
@@ -43,6 +43,7 @@
 #include <asm/device.h>
 #include <asm/gic.h>
 #include <asm/gic_v3_defs.h>
+#include <asm/gic_v3_its.h>
 #include <asm/cpufeature.h>
 #include <asm/acpi.h>
 
@@ -65,100 +66,6 @@ static DEFINE_PER_CPU(void __iomem*, rbase);
 #define GICD_RDIST_BASE        (this_cpu(rbase))
 #define GICD_RDIST_SGI_BASE    (GICD_RDIST_BASE + SZ_64K)
 
-/*
- * Saves all 16(Max) LR registers. Though number of LRs implemented
- * is implementation specific.
- */
-static inline void gicv3_save_lrs(struct vcpu *v)
-{
-    /* Fall through for all the cases */
-    switch ( gicv3_info.nr_lrs )
-    {
-    case 16:
-        v->arch.gic.v3.lr[15] = READ_SYSREG(ICH_LR15_EL2);
-    case 15:
-        v->arch.gic.v3.lr[14] = READ_SYSREG(ICH_LR14_EL2);
-    case 14:
-        v->arch.gic.v3.lr[13] = READ_SYSREG(ICH_LR13_EL2);
-    case 13:
-        v->arch.gic.v3.lr[12] = READ_SYSREG(ICH_LR12_EL2);
-    case 12:
-        v->arch.gic.v3.lr[11] = READ_SYSREG(ICH_LR11_EL2);
-    case 11:
-        v->arch.gic.v3.lr[10] = READ_SYSREG(ICH_LR10_EL2);
-    case 10:
-        v->arch.gic.v3.lr[9] = READ_SYSREG(ICH_LR9_EL2);
-    case 9:
-        v->arch.gic.v3.lr[8] = READ_SYSREG(ICH_LR8_EL2);
-    case 8:
-        v->arch.gic.v3.lr[7] = READ_SYSREG(ICH_LR7_EL2);
-    case 7:
-        v->arch.gic.v3.lr[6] = READ_SYSREG(ICH_LR6_EL2);
-    case 6:
-        v->arch.gic.v3.lr[5] = READ_SYSREG(ICH_LR5_EL2);
-    case 5:
-        v->arch.gic.v3.lr[4] = READ_SYSREG(ICH_LR4_EL2);
-    case 4:
-        v->arch.gic.v3.lr[3] = READ_SYSREG(ICH_LR3_EL2);
-    case 3:
-        v->arch.gic.v3.lr[2] = READ_SYSREG(ICH_LR2_EL2);
-    case 2:
-        v->arch.gic.v3.lr[1] = READ_SYSREG(ICH_LR1_EL2);
-    case 1:
-         v->arch.gic.v3.lr[0] = READ_SYSREG(ICH_LR0_EL2);
-         break;
-    default:
-         BUG();
-    }
-}
-
-/*
- * Restores all 16(Max) LR registers. Though number of LRs implemented
- * is implementation specific.
- */
-static inline void gicv3_restore_lrs(const struct vcpu *v)
-{
-    /* Fall through for all the cases */
-    switch ( gicv3_info.nr_lrs )
-    {
-    case 16:
-        WRITE_SYSREG(v->arch.gic.v3.lr[15], ICH_LR15_EL2);
-    case 15:
-        WRITE_SYSREG(v->arch.gic.v3.lr[14], ICH_LR14_EL2);
-    case 14:
-        WRITE_SYSREG(v->arch.gic.v3.lr[13], ICH_LR13_EL2);
-    case 13:
-        WRITE_SYSREG(v->arch.gic.v3.lr[12], ICH_LR12_EL2);
-    case 12:
-        WRITE_SYSREG(v->arch.gic.v3.lr[11], ICH_LR11_EL2);
-    case 11:
-        WRITE_SYSREG(v->arch.gic.v3.lr[10], ICH_LR10_EL2);
-    case 10:
-        WRITE_SYSREG(v->arch.gic.v3.lr[9], ICH_LR9_EL2);
-    case 9:
-        WRITE_SYSREG(v->arch.gic.v3.lr[8], ICH_LR8_EL2);
-    case 8:
-        WRITE_SYSREG(v->arch.gic.v3.lr[7], ICH_LR7_EL2);
-    case 7:
-        WRITE_SYSREG(v->arch.gic.v3.lr[6], ICH_LR6_EL2);
-    case 6:
-        WRITE_SYSREG(v->arch.gic.v3.lr[5], ICH_LR5_EL2);
-    case 5:
-        WRITE_SYSREG(v->arch.gic.v3.lr[4], ICH_LR4_EL2);
-    case 4:
-        WRITE_SYSREG(v->arch.gic.v3.lr[3], ICH_LR3_EL2);
-    case 3:
-        WRITE_SYSREG(v->arch.gic.v3.lr[2], ICH_LR2_EL2);
-    case 2:
-        WRITE_SYSREG(v->arch.gic.v3.lr[1], ICH_LR1_EL2);
-    case 1:
-        WRITE_SYSREG(v->arch.gic.v3.lr[0], ICH_LR0_EL2);
-        break;
-    default:
-         BUG();
-    }
-}
-
 static uint64_t gicv3_ich_read_lr(int lr)
 {
     switch ( lr )
@@ -242,6 +149,29 @@ static void gicv3_ich_write_lr(int lr, uint64_t val)
     isb();
 }
 
+/*
+ * Only the LRs in use by the vCPU, as tracked by its lr_mask, hold
+ * state worth saving. gic_restore_state() clears any LR left behind by
+ * the previous vCPU on this pCPU.
+ */
+static inline void gicv3_save_lrs(struct vcpu *v)
+{
+    unsigned int i;
+
+    for_each_set_bit ( i, (const unsigned long *)&v->arch.lr_mask,
+                       gicv3_info.nr_lrs )
+        v->arch.gic.v3.lr[i] = gicv3_ich_read_lr(i);
+}
+
+static inline void gicv3_restore_lrs(const struct vcpu *v)
+{
+    unsigned int i;
+
+    for_each_set_bit ( i, (const unsigned long *)&v->arch.lr_mask,
+                       gicv3_info.nr_lrs )
+        gicv3_ich_write_lr(i, v->arch.gic.v3.lr[i]);
+}
+
 /*
  * System Register Enable (SRE). Enable to access CPU & Virtual
  * interface registers as system registers in EL2
@@ -433,6 +363,20 @@ static void gicv3_poke_irq(struct irq_desc *irqd, u32 offset)
     gicv3_wait_for_rwp(irqd->irq);
 }
 
+static void gicv3_set_active_state(struct irq_desc *irqd, bool active)
+{
+    u32 mask = 1 << (irqd->irq % 32);
+    u32 offset = active ? GICD_ISACTIVER : GICD_ICACTIVER;
+    void __iomem *base;
+
+    if ( irqd->irq < NR_GIC_LOCAL_IRQS )
+        base = GICD_RDIST_SGI_BASE;
+    else
+        base = GICD;
+
+    writel_relaxed(mask, base + offset + (irqd->irq / 32) * 4);
+}
+
 static void gicv3_unmask_irq(struct irq_desc *irqd)
 {
     gicv3_poke_irq(irqd, GICD_ISENABLER);
@@ -655,6 +599,20 @@ static int __init gicv3_populate_rdist(void)
             if ( (typer >> 32) == aff )
             {
                 this_cpu(rbase) = ptr;
+
+                if ( typer & GICR_TYPER_PLPIS )
+                {
+                    paddr_t rdist_addr;
+                    unsigned int procnum;
+
+                    rdist_addr = gicv3.rdist_regions[i].base;
+                    rdist_addr += ptr - gicv3.rdist_regions[i].map_base;
+                    procnum = (typer & GICR_TYPER_PROC_NUM_MASK);
+                    procnum >>= GICR_TYPER_PROC_NUM_SHIFT;
+
+                    gicv3_set_redist_address(rdist_addr, procnum);
+                }
+
                 printk("GICv3: CPU%d: Found redistributor in region %d @%p\n",
                         smp_processor_id(), i, ptr);
                 return 0;
@@ -683,7 +641,7 @@ static int __init gicv3_populate_rdist(void)
 
 static int gicv3_cpu_init(void)
 {
-    int i;
+    int i, ret;
     uint32_t priority;
 
     /* Register ourselves with the rest of the world */
@@ -693,6 +651,13 @@ static int gicv3_cpu_init(void)
     if ( gicv3_enable_redist() )
         return -ENODEV;
 
+    if ( gicv3_its_host_has_its() )
+    {
+        ret = gicv3_lpi_init_rdist(GICD_RDIST_BASE);
+        if ( ret )
+            return ret;
+    }
+
     /* Set priority on PPI and SGI interrupts */
     priority = (GIC_PRI_IPI << 24 | GIC_PRI_IPI << 16 | GIC_PRI_IPI << 8 |
                 GIC_PRI_IPI);
@@ -733,6 +698,10 @@ static int gicv3_cpu_init(void)
     /* Sync at once at the end of cpu interface configuration */
     isb();
 
+    /* Map the host collection for this CPU on all host ITSes. */
+    if ( gicv3_its_host_has_its() )
+        return gicv3_its_setup_collection(smp_processor_id());
+
     return 0;
 }
 
@@ -904,6 +873,9 @@ static void gicv3_update_lr(int lr, const struct pending_irq *p,
    if ( p->desc != NULL )
        val |= GICH_LR_HW | (((uint64_t)p->desc->irq & GICH_LR_PHYSICAL_MASK)
                            << GICH_LR_PHYSICAL_SHIFT);
+   else if ( p->hw_ppi )
+       val |= GICH_LR_HW | (((uint64_t)p->hw_ppi & GICH_LR_PHYSICAL_MASK)
+                           << GICH_LR_PHYSICAL_SHIFT);
 
     gicv3_ich_write_lr(lr, val);
 }
@@ -1110,7 +1082,10 @@ static int gicv3_make_hwdom_dt_node(const struct domain *d,
     res = fdt_property(fdt, "reg", new_cells, len);
     xfree(new_cells);
 
-    return res;
+    if ( res )
+        return res;
+
+    return gicv3_its_make_hwdom_dt_nodes(d, gic, fdt);
 }
 
 static const hw_irq_controller gicv3_host_irq_type = {
@@ -1229,6 +1204,9 @@ static void __init gicv3_dt_init(void)
 
     dt_device_get_address(node, 1 + gicv3.rdist_count + 2,
                           &vbase, &vsize);
+
+    /* Check for ITS child nodes and build the host ITS list accordingly. */
+    gicv3_its_dt_init(node);
 }
 
 static int gicv3_iomem_deny_access(const struct domain *d)
@@ -1264,10 +1242,12 @@ static int gicv3_iomem_deny_access(const struct domain *d)
     {
         gfn = vbase >> PAGE_SHIFT;
         nr = DIV_ROUND_UP(csize, PAGE_SIZE);
-        return iomem_deny_access(d, gfn, gfn + nr);
+        rc = iomem_deny_access(d, gfn, gfn + nr);
+        if ( rc )
+            return rc;
     }
 
-    return 0;
+    return gicv3_its_deny_access(d);
 }
 
 #ifdef CONFIG_ACPI
@@ -1567,6 +1547,19 @@ static int __init gicv3_init(void)
     spin_lock(&gicv3.lock);
 
     gicv3_dist_init();
+
+    if ( gicv3_its_host_has_its() )
+    {
+        reg = readl_relaxed(GICD + GICD_TYPER);
+        res = gicv3_lpi_init_host_lpis(GICD_TYPE_ID_BITS(reg));
+        if ( res )
+            panic("GICv3: LPI initialization failed: %d\n", res);
+
+        res = gicv3_its_init();
+        if ( res )
+            panic("GICv3: ITS initialization failed: %d\n", res);
+    }
+
     res = gicv3_cpu_init();
     gicv3_hyp_init();
 
@@ -1597,10 +1590,13 @@ static const struct gic_hw_operations gicv3_ops = {
     .write_lr            = gicv3_write_lr,
     .read_vmcr_priority  = gicv3_read_vmcr_priority,
     .read_apr            = gicv3_read_apr,
+    .set_active_state    = gicv3_set_active_state,
     .secondary_init      = gicv3_secondary_cpu_init,
     .make_hwdom_dt_node  = gicv3_make_hwdom_dt_node,
     .make_hwdom_madt     = gicv3_make_hwdom_madt,
+    .map_hwdom_extra_mappings = gicv3_its_map_hwdom_doorbells,
     .iomem_deny_access   = gicv3_iomem_deny_access,
+    .do_LPI              = gicv3_do_LPI,
 };
 
 static int __init gicv3_dt_preinit(struct dt_device_node *node, const void *data)
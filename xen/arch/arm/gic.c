@@ -34,6 +34,7 @@
 #include <asm/device.h>
 #include <asm/io.h>
 #include <asm/gic.h>
+#include <asm/gic_v3_its.h>
 #include <asm/vgic.h>
 #include <asm/acpi.h>
 
@@ -56,6 +57,15 @@ void register_gic_ops(const struct gic_hw_operations *ops)
 
 static void clear_cpu_lr_mask(void)
 {
+    unsigned int i;
+
+    /*
+     * gic_restore_state() only writes the LRs a vCPU uses, so make sure
+     * the others start out empty.
+     */
+    for ( i = 0; i < gic_hw_ops->info->nr_lrs; i++ )
+        gic_hw_ops->clear_lr(i);
+
     this_cpu(lr_mask) = 0ULL;
 }
 
@@ -85,17 +95,43 @@ void gic_save_state(struct vcpu *v)
 
 void gic_restore_state(struct vcpu *v)
 {
+    /*
+     * LRs used by the vCPU which last ran on this pCPU, but not by this
+     * one. The hardware only restores the LRs in v->arch.lr_mask, so
+     * these have to be cleared by hand.
+     */
+    uint64_t stale = this_cpu(lr_mask) & ~v->arch.lr_mask;
+    unsigned int i;
+
     ASSERT(!local_irq_is_enabled());
     ASSERT(!is_idle_vcpu(v));
 
     this_cpu(lr_mask) = v->arch.lr_mask;
     gic_hw_ops->restore_state(v);
 
+    for_each_set_bit ( i, (const unsigned long *)&stale,
+                       gic_hw_ops->info->nr_lrs )
+        gic_hw_ops->clear_lr(i);
+
     isb();
 
     gic_restore_pending_irqs(v);
 }
 
+void gic_irq_deactivate_by_guest(struct irq_desc *desc)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&desc->lock, flags);
+    desc->handler = gic_hw_ops->gic_guest_irq_type;
+    spin_unlock_irqrestore(&desc->lock, flags);
+}
+
+void gic_set_active_state(struct irq_desc *desc, bool active)
+{
+    gic_hw_ops->set_active_state(desc, active);
+}
+
 /* desc->irq needs to be disabled before calling this function */
 void gic_set_irq_type(struct irq_desc *desc, unsigned int type)
 {
@@ -460,18 +496,38 @@ static void gic_update_one_lr(struct vcpu *v, int i)
     gic_hw_ops->read_lr(i, &lr_val);
     irq = lr_val.virq;
     p = irq_to_pending(v, irq);
+    /*
+     * An LPI might have been unmapped, in which case we just clean up here.
+     * If that LPI is marked as PENDING, it will be ignored and will
+     * disappear from the list registers.
+     */
+    if ( unlikely(!p) )
+    {
+        ASSERT(is_lpi(irq));
+
+        gic_hw_ops->clear_lr(i);
+        clear_bit(i, &this_cpu(lr_mask));
+
+        return;
+    }
+
     if ( lr_val.state & GICH_LR_ACTIVE )
     {
         set_bit(GIC_IRQ_GUEST_ACTIVE, &p->status);
         if ( test_bit(GIC_IRQ_GUEST_ENABLED, &p->status) &&
              test_and_clear_bit(GIC_IRQ_GUEST_QUEUED, &p->status) )
         {
-            if ( p->desc == NULL )
+            /*
+             * A linked PPI can't fire again until the guest deactivates
+             * it, and will then if its source is still asserted, so
+             * there is nothing to do for one.
+             */
+            if ( p->desc == NULL && !p->hw_ppi )
             {
                  lr_val.state |= GICH_LR_PENDING;
                  gic_hw_ops->write_lr(i, &lr_val);
             }
-            else
+            else if ( p->desc != NULL )
                 gdprintk(XENLOG_WARNING, "unable to inject hw irq=%d into d%dv%d: already active in LR%d\n",
                          irq, v->domain->domain_id, v->vcpu_id, i);
         }
@@ -615,6 +671,8 @@ int gic_events_need_delivery(void)
     mask_priority = gic_hw_ops->read_vmcr_priority();
     active_priority = find_next_bit(&apr, 32, 0);
 
+    vgic_flush_injected_irqs();
+
     spin_lock_irqsave(&v->arch.vgic.lock, flags);
 
     /* TODO: We order the guest irqs by priority, but we don't change
@@ -644,6 +702,7 @@ void gic_inject(void)
 {
     ASSERT(!local_irq_is_enabled());
 
+    vgic_flush_injected_irqs();
     gic_restore_pending_irqs(current);
 
     if ( !list_empty(&current->arch.vgic.lr_pending) && lr_all_full() )
@@ -695,6 +754,12 @@ void gic_interrupt(struct cpu_user_regs *regs, int is_fiq)
             do_IRQ(regs, irq, is_fiq);
             local_irq_disable();
         }
+        else if ( is_lpi(irq) )
+        {
+            local_irq_enable();
+            gic_hw_ops->do_LPI(irq);
+            local_irq_disable();
+        }
         else if (unlikely(irq < 16))
         {
             do_sgi(regs, irq);
@@ -19,13 +19,14 @@ static unsigned long raw_copy_to_guest_helper(void *to, const void *from,
 
         page = get_page_from_gva(current, (vaddr_t) to, GV2M_WRITE);
         if ( page == NULL )
-            return len;
+            break;
 
         p = __map_domain_page(page);
         p += offset;
         memcpy(p, from, size);
+        /* A single barrier for the whole copy, see below. */
         if ( flush_dcache )
-            clean_dcache_va_range(p, size);
+            __clean_dcache_va_range(p, size);
 
         unmap_domain_page(p - offset);
         put_page(page);
@@ -39,7 +40,10 @@ static unsigned long raw_copy_to_guest_helper(void *to, const void *from,
         offset = 0;
     }
 
-    return 0;
+    if ( flush_dcache )
+        dsb(sy);
+
+    return len;
 }
 
 unsigned long raw_copy_to_guest(void *to, const void *from, unsigned len)
@@ -60,7 +60,23 @@ long do_hvm_op(unsigned long op, XEN_GUEST_HANDLE_PARAM(void) arg)
 
         if ( op == HVMOP_set_param )
         {
-            d->arch.hvm_domain.params[a.index] = a.value;
+            switch ( a.index )
+            {
+            case HVM_PARAM_IOREQ_PFN:
+            case HVM_PARAM_DM_DOMAIN:
+                /* Only the toolstack gets to pick the device model. */
+                if ( d == current->domain )
+                {
+                    rc = -EPERM;
+                    break;
+                }
+                if ( a.index == HVM_PARAM_IOREQ_PFN )
+                    rc = ioreq_set_page(d, a.value);
+                break;
+            }
+
+            if ( !rc )
+                d->arch.hvm_domain.params[a.index] = a.value;
         }
         else
         {
@@ -18,28 +18,21 @@
 
 #include <xen/config.h>
 #include <xen/lib.h>
+#include <xen/event.h>
+#include <xen/mm.h>
 #include <xen/spinlock.h>
 #include <xen/sched.h>
 #include <xen/sort.h>
 #include <asm/current.h>
 #include <asm/mmio.h>
+#include <public/hvm/ioreq.h>
 
-static int handle_read(const struct mmio_handler *handler, struct vcpu *v,
-                       mmio_info_t *info)
+/* Write the result of a read to the guest's register, as the access needs. */
+static void set_read_result(const struct hsr_dabt dabt, register_t r)
 {
-    const struct hsr_dabt dabt = info->dabt;
     struct cpu_user_regs *regs = guest_cpu_user_regs();
-    /*
-     * Initialize to zero to avoid leaking data if there is an
-     * implementation error in the emulation (such as not correctly
-     * setting r).
-     */
-    register_t r = 0;
     uint8_t size = (1 << dabt.size) * 8;
 
-    if ( !handler->ops->read(v, info, &r, handler->priv) )
-        return 0;
-
     /*
      * Sign extend if required.
      * Note that we expect the read handler to have zeroed the bits
@@ -57,6 +50,22 @@ static int handle_read(const struct mmio_handler *handler, struct vcpu *v,
     }
 
     set_user_reg(regs, dabt.reg, r);
+}
+
+static int handle_read(const struct mmio_handler *handler, struct vcpu *v,
+                       mmio_info_t *info)
+{
+    /*
+     * Initialize to zero to avoid leaking data if there is an
+     * implementation error in the emulation (such as not correctly
+     * setting r).
+     */
+    register_t r = 0;
+
+    if ( !handler->ops->read(v, info, &r, handler->priv) )
+        return 0;
+
+    set_read_result(info->dabt, r);
 
     return 1;
 }
@@ -101,6 +110,112 @@ static const struct mmio_handler *find_mmio_handler(struct domain *d,
     return handler;
 }
 
+/*
+ * Forward an access no handler in Xen claims to the domain's device model,
+ * if it has one.  The data abort syndrome already gives the size,
+ * direction and register of the access, so the request can be built
+ * without decoding the instruction.  handle_ioreq_completion() finishes
+ * the access once the device model has responded.
+ */
+static int handle_ioserv(struct vcpu *v, mmio_info_t *info)
+{
+    struct domain *d = v->domain;
+    shared_iopage_t *iopage = d->arch.hvm_domain.ioreq_va;
+    const struct hsr_dabt dabt = info->dabt;
+    unsigned int size = 1U << dabt.size;
+    ioreq_t *p;
+
+    if ( !iopage )
+        return 0;
+
+    p = &iopage->vcpu_ioreq[v->vcpu_id];
+    if ( p->state != STATE_IOREQ_NONE )
+    {
+        gprintk(XENLOG_ERR, "ioreq already in flight (state %u)\n", p->state);
+        domain_crash(d);
+        return 0;
+    }
+
+    p->dir = dabt.write ? IOREQ_WRITE : IOREQ_READ;
+    p->type = IOREQ_TYPE_COPY;
+    p->addr = info->gpa;
+    p->size = size;
+    p->count = 1;
+    p->data_is_ptr = 0;
+    p->df = 0;
+    p->data = 0;
+    if ( dabt.write )
+    {
+        p->data = get_user_reg(guest_cpu_user_regs(), dabt.reg);
+        if ( size < sizeof(p->data) )
+            p->data &= (1ULL << (size * 8)) - 1;
+    }
+
+    v->arch.ioreq.dabt = dabt;
+    v->arch.ioreq.pending = true;
+
+    /* The request must be visible before its state says so. */
+    smp_wmb();
+    p->state = STATE_IOREQ_READY;
+    notify_via_xen_event_channel(d, v->arch.ioreq.evtchn);
+
+    return 1;
+}
+
+/*
+ * Called on every return to the guest.  Completes a forwarded access once
+ * the device model has responded, or blocks the vCPU until it notifies us;
+ * the caller then runs the scheduler and calls us again.
+ */
+void handle_ioreq_completion(void)
+{
+    struct vcpu *v = current;
+    const struct hsr_dabt dabt = v->arch.ioreq.dabt;
+    ioreq_t *p;
+    unsigned int state;
+
+    if ( likely(!v->arch.ioreq.pending) )
+        return;
+
+    p = &v->domain->arch.hvm_domain.ioreq_va->vcpu_ioreq[v->vcpu_id];
+    state = p->state;
+    smp_rmb();
+
+    switch ( state )
+    {
+    case STATE_IORESP_READY:
+        if ( !dabt.write )
+            set_read_result(dabt, p->data);
+        p->state = STATE_IOREQ_NONE;
+        v->arch.ioreq.pending = false;
+        break;
+
+    case STATE_IOREQ_NONE:
+        /*
+         * The only reason we should see this case is when the device
+         * model is dying and it races with the request.
+         */
+        if ( !dabt.write )
+            set_read_result(dabt, ~0UL);
+        v->arch.ioreq.pending = false;
+        break;
+
+    case STATE_IOREQ_READY:
+    case STATE_IOREQ_INPROCESS:
+        prepare_wait_on_xen_event_channel(v->arch.ioreq.evtchn);
+        /* Don't sleep if the response came in since we last looked. */
+        if ( p->state != state )
+            clear_bit(_VPF_blocked_in_xen, &v->pause_flags);
+        break;
+
+    default:
+        gprintk(XENLOG_ERR, "Weird ioreq state %u\n", state);
+        v->arch.ioreq.pending = false;
+        domain_crash(v->domain);
+        break;
+    }
+}
+
 int handle_mmio(mmio_info_t *info)
 {
     struct vcpu *v = current;
@@ -108,7 +223,7 @@ int handle_mmio(mmio_info_t *info)
 
     handler = find_mmio_handler(v->domain, info->gpa);
     if ( !handler )
-        return 0;
+        return handle_ioserv(v, info);
 
     if ( info->dabt.write )
         return handle_write(handler, v, info);
@@ -160,6 +275,83 @@ void domain_io_free(struct domain *d)
     xfree(d->arch.vmmio.handlers);
 }
 
+/*
+ * Set up the page of the domain's physmap that the device model uses to
+ * receive the accesses Xen doesn't handle, with an event channel for each
+ * vCPU to the domain in HVM_PARAM_DM_DOMAIN.
+ */
+int ioreq_set_page(struct domain *d, unsigned long gfn)
+{
+    domid_t dm_domid = d->arch.hvm_domain.params[HVM_PARAM_DM_DOMAIN];
+    struct page_info *page;
+    shared_iopage_t *iopage;
+    void *va;
+    struct vcpu *v;
+    int rc;
+
+    if ( d->max_vcpus > PAGE_SIZE / sizeof(ioreq_t) )
+        return -EINVAL;
+
+    rc = prepare_ring_for_helper(d, gfn, &page, &va);
+    if ( rc )
+        return rc;
+    iopage = va;
+
+    domain_lock(d);
+
+    rc = -EEXIST;
+    if ( d->arch.hvm_domain.ioreq_va || d->is_dying )
+        goto out;
+
+    for_each_vcpu ( d, v )
+    {
+        rc = alloc_unbound_xen_event_channel(d, v->vcpu_id, dm_domid, NULL);
+        if ( rc < 0 )
+            goto out_evtchn;
+
+        v->arch.ioreq.evtchn = rc;
+        iopage->vcpu_ioreq[v->vcpu_id].vp_eport = rc;
+    }
+
+    d->arch.hvm_domain.ioreq_page = page;
+    /* The event channels must be set up before anyone forwards accesses. */
+    smp_wmb();
+    d->arch.hvm_domain.ioreq_va = iopage;
+
+    domain_unlock(d);
+
+    return 0;
+
+ out_evtchn:
+    for_each_vcpu ( d, v )
+    {
+        if ( v->arch.ioreq.evtchn )
+            free_xen_event_channel(d, v->arch.ioreq.evtchn);
+        v->arch.ioreq.evtchn = 0;
+    }
+ out:
+    domain_unlock(d);
+    destroy_ring_for_helper(&va, page);
+
+    return rc;
+}
+
+void ioreq_domain_free(struct domain *d)
+{
+    struct vcpu *v;
+    void *va = d->arch.hvm_domain.ioreq_va;
+
+    if ( !va )
+        return;
+
+    for_each_vcpu ( d, v )
+        free_xen_event_channel(d, v->arch.ioreq.evtchn);
+
+    d->arch.hvm_domain.ioreq_va = NULL;
+    destroy_ring_for_helper(&va, d->arch.hvm_domain.ioreq_page);
+    d->arch.hvm_domain.ioreq_page = NULL;
+}
+
 /*
  * Local variables:
  * mode: C
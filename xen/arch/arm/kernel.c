@@ -59,7 +59,7 @@ void copy_from_paddr(void *dst, paddr_t paddr, unsigned long len)
 
         set_fixmap(FIXMAP_MISC, p, BUFFERABLE);
         memcpy(dst, src + s, l);
-        clean_dcache_va_range(dst, l);
+        __clean_dcache_va_range(dst, l);
 
         paddr += l;
         dst += l;
@@ -67,6 +67,54 @@ void copy_from_paddr(void *dst, paddr_t paddr, unsigned long len)
     }
 
     clear_fixmap(FIXMAP_MISC);
+    dsb(sy);
+}
+
+/**
+ * copy_from_paddr_to_guest - copy data from a physical address to the
+ * domain being built, which must be current
+ * @gaddr: destination guest virtual address
+ * @paddr: source physical address
+ * @len: length to copy
+ *
+ * The source page is only remapped when crossing a source page boundary,
+ * and the destination is cleaned to the PoC with a single barrier for the
+ * whole copy.
+ */
+void copy_from_paddr_to_guest(vaddr_t gaddr, paddr_t paddr,
+                              unsigned long len)
+{
+    const void *src = (void *)FIXMAP_ADDR(FIXMAP_MISC);
+    unsigned long src_pfn = ~0UL;
+
+    while ( len )
+    {
+        unsigned long s = paddr & ~PAGE_MASK, d = gaddr & ~PAGE_MASK;
+        unsigned long l = min(PAGE_SIZE - max(s, d), len);
+        paddr_t ma;
+        void *dst;
+
+        if ( gvirt_to_maddr(gaddr, &ma, GV2M_WRITE) )
+            panic("Unable to translate guest address %"PRIvaddr, gaddr);
+
+        if ( paddr_to_pfn(paddr) != src_pfn )
+        {
+            src_pfn = paddr_to_pfn(paddr);
+            set_fixmap(FIXMAP_MISC, src_pfn, BUFFERABLE);
+        }
+
+        dst = map_domain_page(_mfn(paddr_to_pfn(ma)));
+        memcpy(dst + d, src + s, l);
+        __clean_dcache_va_range(dst + d, l);
+        unmap_domain_page(dst);
+
+        paddr += l;
+        gaddr += l;
+        len -= l;
+    }
+
+    clear_fixmap(FIXMAP_MISC);
+    dsb(sy);
 }
 
 static void place_modules(struct kernel_info *info,
@@ -160,7 +208,6 @@ static void kernel_zimage_load(struct kernel_info *info)
     paddr_t load_addr = kernel_zimage_place(info);
     paddr_t paddr = info->zimage.kernel_addr;
     paddr_t len = info->zimage.len;
-    unsigned long offs;
 
     info->entry = load_addr;
 
@@ -168,29 +215,8 @@ static void kernel_zimage_load(struct kernel_info *info)
 
     printk("Loading zImage from %"PRIpaddr" to %"PRIpaddr"-%"PRIpaddr"\n",
            paddr, load_addr, load_addr + len);
-    for ( offs = 0; offs < len; )
-    {
-        int rc;
-        paddr_t s, l, ma;
-        void *dst;
-
-        s = offs & ~PAGE_MASK;
-        l = min(PAGE_SIZE - s, len);
 
-        rc = gvirt_to_maddr(load_addr + offs, &ma, GV2M_WRITE);
-        if ( rc )
-        {
-            panic("Unable to map translate guest address");
-            return;
-        }
-
-        dst = map_domain_page(_mfn(paddr_to_pfn(ma)));
-
-        copy_from_paddr(dst + s, paddr + offs, l);
-
-        unmap_domain_page(dst);
-        offs += l;
-    }
+    copy_from_paddr_to_guest(load_addr, paddr, len);
 }
 
 /*
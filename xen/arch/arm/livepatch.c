@@ -41,6 +41,17 @@ void arch_livepatch_unmask(void)
 {
 }
 
+bool_t arch_livepatch_can_poke(void)
+{
+    return 0;
+}
+
+bool_t arch_livepatch_poke_jmp(struct livepatch_func *func, bool_t apply,
+                               unsigned int step)
+{
+    return 0;
+}
+
 int arch_livepatch_verify_elf(const struct livepatch_elf *elf)
 {
     return -ENOSYS;
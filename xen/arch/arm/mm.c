@@ -1052,10 +1052,13 @@ int xenmem_add_to_physmap_one(
     int rc;
     p2m_type_t t;
     struct page_info *page = NULL;
+    struct gnttab_spare spare;
 
     switch ( space )
     {
     case XENMAPSPACE_grant_table:
+        /* Nothing gets set aside for status frame indexes, or past max. */
+        gnttab_prepare_grow(d, idx + 1, &spare);
         grant_write_lock(d->grant_table);
 
         if ( d->grant_table->gt_version == 0 )
@@ -1068,18 +1071,26 @@ int xenmem_add_to_physmap_one(
             if ( idx < nr_status_frames(d->grant_table) )
                 mfn = virt_to_mfn(d->grant_table->status[idx]);
             else
+            {
+                grant_write_unlock(d->grant_table);
+                gnttab_release_spare(&spare);
                 return -EINVAL;
+            }
         }
         else
         {
             if ( (idx >= nr_grant_frames(d->grant_table)) &&
                  (idx < max_grant_frames) )
-                gnttab_grow_table(d, idx + 1);
+                gnttab_grow_table(d, idx + 1, &spare);
 
             if ( idx < nr_grant_frames(d->grant_table) )
                 mfn = virt_to_mfn(d->grant_table->shared_raw[idx]);
             else
+            {
+                grant_write_unlock(d->grant_table);
+                gnttab_release_spare(&spare);
                 return -EINVAL;
+            }
         }
 
         d->arch.grant_table_gfn[idx] = gfn;
@@ -1087,6 +1098,7 @@ int xenmem_add_to_physmap_one(
         t = p2m_ram_rw;
 
         grant_write_unlock(d->grant_table);
+        gnttab_release_spare(&spare);
         break;
     case XENMAPSPACE_shared_info:
         if ( idx != 0 )
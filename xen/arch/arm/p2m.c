@@ -29,6 +29,9 @@ static unsigned int __read_mostly p2m_root_level;
 
 unsigned int __read_mostly p2m_ipa_bits;
 
+/* VTCR_EL2 value, for IOMMUs walking the p2m with the same layout */
+register_t __read_mostly p2m_vtcr;
+
 static bool_t p2m_valid(lpae_t pte)
 {
     return pte.p2m.valid;
@@ -137,7 +140,18 @@ void p2m_restore_state(struct vcpu *n)
     isb();
 }
 
-static void p2m_flush_tlb(struct p2m_domain *p2m)
+/*
+ * Above this many pages, invalidating the TLBs by IPA costs more than
+ * losing the rest of the VMID's stage 2 entries.
+ */
+#define P2M_TLB_FLUSH_RANGE_MAX     64
+
+/*
+ * Flush the TLBs of the given P2M for [start, start + size), or for the
+ * whole VMID if size is 0 or the range is large.
+ */
+static void p2m_flush_tlb_range(struct p2m_domain *p2m, paddr_t start,
+                                paddr_t size)
 {
     unsigned long flags = 0;
     uint64_t ovttbr;
@@ -154,7 +168,10 @@ static void p2m_flush_tlb(struct p2m_domain *p2m)
         isb();
     }
 
-    flush_tlb();
+    if ( size && (size >> PAGE_SHIFT) <= P2M_TLB_FLUSH_RANGE_MAX )
+        flush_guest_tlb_range_ipa(start, size);
+    else
+        flush_tlb();
 
     if ( ovttbr != READ_SYSREG64(VTTBR_EL2) )
     {
@@ -164,6 +181,11 @@ static void p2m_flush_tlb(struct p2m_domain *p2m)
     }
 }
 
+static void p2m_flush_tlb(struct p2m_domain *p2m)
+{
+    p2m_flush_tlb_range(p2m, 0, 0);
+}
+
 /*
  * Lookup the MFN corresponding to a domain's GFN.
  *
@@ -458,6 +480,13 @@ static int p2m_create_table(struct p2m_domain *p2m, lpae_t *entry,
               */
              pte.p2m.table = !(level_shift - LPAE_SHIFT);
 
+             /*
+              * The new entries are all alike and naturally aligned, so
+              * keep as much TLB reach as we can.  Whatever entry is about
+              * to be changed will break its own run when it is.
+              */
+             pte.p2m.contig = 1;
+
              write_pte(&p[i], pte);
          }
 
@@ -659,6 +688,69 @@ static const paddr_t level_masks[] =
 static const paddr_t level_shifts[] =
     { ZEROETH_SHIFT, FIRST_SHIFT, SECOND_SHIFT, THIRD_SHIFT };
 
+/*
+ * With a 4K granule, 16 adjacent entries mapping a naturally aligned,
+ * physically contiguous range with the same attributes can carry the
+ * contiguous hint, and be cached as a single TLB entry.
+ */
+#define P2M_CONTIG_ENTRIES     16
+
+/*
+ * Whether the entry about to be written at *addr for [start_gpaddr,
+ * end_gpaddr) can carry the contiguous hint: the whole run around it must
+ * be mapped by this operation, at this level, with maddr moving in step
+ * with addr.
+ */
+static bool_t p2m_contig_allowed(const lpae_t *entry, unsigned int level,
+                                 paddr_t start_gpaddr, paddr_t end_gpaddr,
+                                 paddr_t addr, paddr_t maddr)
+{
+    const paddr_t run_size = level_sizes[level] * P2M_CONTIG_ENTRIES;
+    const paddr_t run_start = addr & ~(run_size - 1);
+    const lpae_t *first;
+    unsigned int i;
+
+    /* A contiguous run of 1G entries would be 16G; don't bother. */
+    if ( level < 2 )
+        return false;
+
+    if ( run_start < start_gpaddr || run_start + run_size > end_gpaddr )
+        return false;
+
+    if ( (addr ^ maddr) & (run_size - 1) )
+        return false;
+
+    /* An existing table in the run is descended into, not replaced. */
+    first = entry - (((unsigned long)entry / sizeof(lpae_t)) &
+                     (P2M_CONTIG_ENTRIES - 1));
+    for ( i = 0; level < 3 && i < P2M_CONTIG_ENTRIES; i++ )
+        if ( p2m_table(first[i]) )
+            return false;
+
+    return true;
+}
+
+/*
+ * Clear the contiguous hint from the run the entry is part of, before
+ * the entry is changed.  The caller has to flush the TLBs.
+ */
+static void p2m_break_contig(lpae_t *entry, bool_t flush_cache)
+{
+    lpae_t *first = entry - (((unsigned long)entry / sizeof(lpae_t)) &
+                             (P2M_CONTIG_ENTRIES - 1));
+    lpae_t pte;
+    unsigned int i;
+
+    for ( i = 0; i < P2M_CONTIG_ENTRIES; i++ )
+    {
+        pte = first[i];
+        if ( !p2m_valid(pte) || !pte.p2m.contig )
+            continue;
+        pte.p2m.contig = 0;
+        p2m_write_pte(&first[i], pte, flush_cache);
+    }
+}
+
 static int p2m_shatter_page(struct p2m_domain *p2m,
                             lpae_t *entry,
                             unsigned int level,
@@ -703,11 +795,24 @@ static int apply_one_level(struct domain *d,
 
     struct p2m_domain *p2m = &d->arch.p2m;
     lpae_t pte;
-    const lpae_t orig_pte = *entry;
+    lpae_t orig_pte = *entry;
     int rc;
 
     BUG_ON(level > 3);
 
+    /*
+     * All the entries of a contiguous run must stay alike, so split it
+     * up before changing any of them.  A dying domain's p2m is going
+     * away entirely, so don't bother for RELINQUISH.
+     */
+    if ( op != CACHEFLUSH && op != RELINQUISH &&
+         p2m_mapping(orig_pte) && orig_pte.p2m.contig )
+    {
+        p2m_break_contig(entry, flush_cache);
+        orig_pte.p2m.contig = 0;
+        *flush = true;
+    }
+
     switch ( op )
     {
     case INSERT:
@@ -726,6 +831,9 @@ static int apply_one_level(struct domain *d,
             pte = mfn_to_p2m_entry(_mfn(*maddr >> PAGE_SHIFT), t, a);
             if ( level < 3 )
                 pte.p2m.table = 0; /* Superpage entry */
+            if ( p2m_contig_allowed(entry, level, start_gpaddr, end_gpaddr,
+                                    *addr, *maddr) )
+                pte.p2m.contig = 1;
 
             p2m_write_pte(entry, pte, flush_cache);
 
@@ -1162,7 +1270,13 @@ static int apply_p2m_changes(struct domain *d,
 out:
     if ( flush )
     {
-        p2m_flush_tlb(&d->arch.p2m);
+        /*
+         * Every entry changed lies in, or (for a shattered superpage)
+         * overlaps, the requested range, and invalidating any IPA of a
+         * block mapping drops the whole block from the TLBs.
+         */
+        p2m_flush_tlb_range(&d->arch.p2m, start_gpaddr,
+                            end_gpaddr - start_gpaddr);
         ret = iommu_iotlb_flush(d, gfn_x(sgfn), nr);
         if ( !rc )
             rc = ret;
@@ -1647,6 +1761,7 @@ void __init setup_virt_paging(void)
            4 - P2M_ROOT_LEVEL, P2M_ROOT_ORDER, val);
     /* It is not allowed to concatenate a level zero root */
     BUG_ON( P2M_ROOT_LEVEL == 0 && P2M_ROOT_ORDER > 0 );
+    p2m_vtcr = val;
     setup_virt_paging_one((void *)val);
     smp_call_function(setup_virt_paging_one, (void *)val, 1);
 }
@@ -260,8 +260,14 @@ static void vtimer_interrupt(int irq, void *dev_id, struct cpu_user_regs *regs)
 
     perfc_incr(virt_timer_irqs);
 
+    /*
+     * The interrupt is left active, and linked to the virtual one in the
+     * LR: the guest's deactivation deactivates it too, so there is no
+     * need to mask the timer until then. virt_timer_restore() takes care
+     * of the active state across vCPU switches, and of clearing it if
+     * the idle vCPU took it above.
+     */
     current->arch.virt_timer.ctl = READ_SYSREG32(CNTV_CTL_EL0);
-    WRITE_SYSREG32(current->arch.virt_timer.ctl | CNTx_CTL_MASK, CNTV_CTL_EL0);
     vgic_vcpu_inject_irq(current, current->arch.virt_timer.irq);
 }
 
@@ -306,6 +312,7 @@ void init_timer_interrupt(void)
                 "hyptimer", NULL);
     request_irq(timer_irq[TIMER_VIRT_PPI], 0, vtimer_interrupt,
                    "virtimer", NULL);
+    gic_irq_deactivate_by_guest(irq_to_desc(timer_irq[TIMER_VIRT_PPI]));
     request_irq(timer_irq[TIMER_PHYS_NONSECURE_PPI], 0, timer_interrupt,
                 "phytimer", NULL);
 
@@ -1468,6 +1468,7 @@ static void do_trap_hypercall(struct cpu_user_regs *regs, register_t *nr,
     }
 
     perfc_incra(hypercalls, *nr);
+    perfc_dom_incra(dom_hypercalls, *nr);
     call = arm_hypercall_table[*nr].fn;
     if ( call == NULL )
     {
@@ -2533,6 +2534,67 @@ static void enter_hypervisor_head(struct cpu_user_regs *regs)
         gic_clear_lrs(current);
 }
 
+#ifdef CONFIG_ARM_64
+/*
+ * The hypercalls hot enough to get their own path through the trap code.
+ * They must only need the arguments from the guest state, and must not
+ * deschedule the vCPU directly: raising a softirq is fine, as the full
+ * exit is taken whenever one is pending.
+ */
+static bool is_fast_hypercall(register_t nr, register_t op)
+{
+    switch ( nr )
+    {
+    case __HYPERVISOR_event_channel_op:
+        return op == EVTCHNOP_send;
+    case __HYPERVISOR_grant_table_op:
+        return op == GNTTABOP_copy;
+    case __HYPERVISOR_sched_op:
+        return op == SCHEDOP_yield;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Called from guest_sync for HVCs, before the callee-saved registers and
+ * the guest's EL1 state have been saved: regs only has the caller-saved
+ * registers, LR and the exception state.  Anything not on the list above
+ * goes back for the full entry and do_trap_hypervisor().
+ */
+asmlinkage int do_trap_hvc_fast(struct cpu_user_regs *regs)
+{
+    const union hsr hsr = { .bits = READ_SYSREG32(ESR_EL2) };
+    struct vcpu *v = current;
+
+    if ( hsr.iss != XEN_HYPERCALL_TAG ||
+         !is_fast_hypercall(regs->x16, regs->x0) )
+        return HVC_FAST_NOT_TAKEN;
+
+    perfc_incr(trap_hvc64);
+    perfc_incr(trap_hvc64_fast);
+
+    do_trap_hypercall(regs, &regs->x16, hsr.iss);
+
+    /*
+     * Nothing to do on the way out unless a softirq is pending or there are
+     * interrupts to move into the list registers.  Interrupts stay masked
+     * until the guest is back running, as in leave_hypervisor_tail().
+     */
+    local_irq_disable();
+    if ( likely(!softirq_pending(smp_processor_id()) &&
+                list_empty(&v->arch.vgic.lr_pending) &&
+                !read_atomic(&v->arch.vgic.inject_queued)) )
+        return HVC_FAST_RETURN;
+    local_irq_enable();
+
+    /* Catch up with what the full entry would have done. */
+    gic_clear_lrs(v);
+
+    return HVC_FAST_SLOW_EXIT;
+}
+#endif
+
 asmlinkage void do_trap_hypervisor(struct cpu_user_regs *regs)
 {
     const union hsr hsr = { .bits = READ_SYSREG32(ESR_EL2) };
@@ -2682,6 +2744,8 @@ asmlinkage void leave_hypervisor_tail(void)
 {
     while (1)
     {
+        handle_ioreq_completion();
+
         local_irq_disable();
         if (!softirq_pending(smp_processor_id())) {
             gic_inject();
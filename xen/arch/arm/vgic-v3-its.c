@@ -0,0 +1,1049 @@
+/*
+ * xen/arch/arm/vgic-v3-its.c
+ *
+ * ARM Interrupt Translation Service (ITS) emulation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Locking order:
+ *
+ * its->vcmd_lock                        (protects the command queue)
+ *     its->its_lock                     (protects the collection table)
+ *         v->arch.vgic.lock             (protects the pending_irq queues)
+ *             d->arch.vgic.pend_lpi_tree_lock (protects the LPI tree)
+ *
+ * The device and event state (the device table and the ITTs) is held by
+ * Xen rather than in guest memory, so the emulated GITS_BASERn registers
+ * don't describe any tables and read as zero.
+ * The collection of an event is resolved to its target VCPU by MAPTI,
+ * MOVI and MOVALL, remapping a collection with MAPC later does not move
+ * events which are already mapped to it.
+ */
+
+#include <xen/bitops.h>
+#include <xen/config.h>
+#include <xen/domain_page.h>
+#include <xen/lib.h>
+#include <xen/init.h>
+#include <xen/softirq.h>
+#include <xen/irq.h>
+#include <xen/sched.h>
+#include <xen/sizes.h>
+#include <asm/current.h>
+#include <asm/mmio.h>
+#include <asm/gic_v3_defs.h>
+#include <asm/gic_v3_its.h>
+#include <asm/vgic.h>
+#include <asm/vgic-emul.h>
+
+/*
+ * Data structure to describe a virtual ITS.
+ * If both the vcmd_lock and the its_lock are required, the vcmd_lock must
+ * be taken first.
+ */
+struct virt_its {
+    struct domain *d;
+    struct list_head vits_list;
+    paddr_t doorbell_address;
+    unsigned int devid_bits;
+    unsigned int evid_bits;
+    spinlock_t vcmd_lock;       /* Protects the virtual command buffer, which */
+    uint64_t cwriter;           /* consists of CWRITER and CREADR and those   */
+    uint64_t creadr;            /* shadow variables cwriter and creadr. */
+    /* Protects the rest of this structure, including the collection table. */
+    spinlock_t its_lock;
+    uint64_t cbaser;
+    bool enabled;
+    unsigned int max_collections;
+    uint16_t *coll_table;       /* Maps a collection ID to a VCPU ID */
+};
+
+#define UNMAPPED_COLLECTION      ((uint16_t)~0)
+
+/*
+ * ARM implementer (0x43b), revision 0, variant 0. Other values don't
+ * matter for a guest.
+ */
+#define GITS_IIDR_VALUE         0x34c
+
+/* Every event of a virtual device is described by 8 bytes. */
+#define VITS_ITTE_SIZE          8
+
+/* The PIDR2 we report: architecture revision GICv3. */
+#define GITS_PIDR2_VALUE        0x30
+
+unsigned int vgic_v3_its_count(const struct domain *d)
+{
+    struct host_its *hw_its;
+    unsigned int ret = 0;
+
+    /* Only the hardware domain can have ITSes for now. */
+    if ( !is_hardware_domain(d) )
+        return 0;
+
+    list_for_each_entry(hw_its, &host_its_list, entry)
+        ret++;
+
+    return ret;
+}
+
+/*
+ * Functions to extract the fields of an ITS command. All commands are
+ * 32 bytes, made up of four 64-bit little endian words.
+ */
+#define its_cmd_mask_field(_cmd, _word, _shift, _size) \
+        (((_cmd)[_word] >> (_shift)) & GENMASK((_size) - 1, 0))
+
+#define its_cmd_get_command(cmd)        its_cmd_mask_field(cmd, 0,  0,  8)
+#define its_cmd_get_deviceid(cmd)       its_cmd_mask_field(cmd, 0, 32, 32)
+#define its_cmd_get_size(cmd)           its_cmd_mask_field(cmd, 1,  0,  5)
+#define its_cmd_get_id(cmd)             its_cmd_mask_field(cmd, 1,  0, 32)
+#define its_cmd_get_physical_id(cmd)    its_cmd_mask_field(cmd, 1, 32, 32)
+#define its_cmd_get_collection(cmd)     its_cmd_mask_field(cmd, 2,  0, 16)
+#define its_cmd_get_target_addr(cmd)    its_cmd_mask_field(cmd, 2, 16, 32)
+#define its_cmd_get_validbit(cmd)       its_cmd_mask_field(cmd, 2, 63,  1)
+#define its_cmd_get_target_addr2(cmd)   its_cmd_mask_field(cmd, 3, 16, 32)
+
+#define ITS_CMD_BUFFER_SIZE(baser)      ((((baser) & 0xff) + 1) << 12)
+#define ITS_CMD_OFFSET(reg)             ((reg) & GENMASK(19, 5))
+
+/* Must be called with the ITS lock held. */
+static struct vcpu *get_vcpu_from_collection(struct virt_its *its,
+                                             uint16_t collid)
+{
+    uint16_t vcpu_id;
+
+    ASSERT(spin_is_locked(&its->its_lock));
+
+    if ( collid >= its->max_collections )
+        return NULL;
+
+    vcpu_id = its->coll_table[collid];
+    if ( vcpu_id == UNMAPPED_COLLECTION || vcpu_id >= its->d->max_vcpus )
+        return NULL;
+
+    return its->d->vcpu[vcpu_id];
+}
+
+/*
+ * The redistributor "address" in a command is the redistributor number,
+ * as we don't advertise GITS_TYPER.PTA. This is the VCPU ID, see
+ * GICR_TYPER.Processor_Number.
+ */
+static struct vcpu *get_vcpu_from_rdbase(struct virt_its *its,
+                                         uint64_t rdbase)
+{
+    if ( rdbase >= its->d->max_vcpus )
+        return NULL;
+
+    return its->d->vcpu[rdbase];
+}
+
+static struct pending_irq *get_mapped_event(struct virt_its *its,
+                                            uint32_t devid, uint32_t eventid)
+{
+    struct pending_irq *p;
+
+    p = gicv3_its_get_event_pending_irq(its->d, its->doorbell_address,
+                                        devid, eventid);
+    if ( !p || p->irq == INVALID_LPI )
+        return NULL;
+
+    return p;
+}
+
+/*
+ * Reads the priority and the enabled bit of an LPI from the guest's
+ * property table and caches them in its struct pending_irq.
+ */
+static int update_lpi_property(struct domain *d, struct pending_irq *p)
+{
+    paddr_t addr;
+    uint8_t property;
+    int ret;
+
+    /*
+     * If no redistributor has its LPIs enabled yet, we can't access the
+     * property table. In this case we just can't update the properties,
+     * but this should not be an error from an ITS point of view.
+     * PROPBASER can't change anymore once any redistributor has LPIs
+     * enabled, so with the barriers on both sides we can access it
+     * without taking a lock.
+     */
+    if ( !read_atomic(&d->arch.vgic.rdists_enabled) )
+        return 0;
+    smp_rmb();
+
+    addr = d->arch.vgic.rdist_propbase & GENMASK(51, 12);
+
+    /* The LPI must be covered by the number of IDs in the table. */
+    if ( p->irq >= BIT((d->arch.vgic.rdist_propbase &
+                        GICR_PROPBASER_IDBITS_MASK) + 1) )
+        return -EINVAL;
+
+    ret = vgic_access_guest_memory(d, addr + p->irq - LPI_OFFSET,
+                                   &property, sizeof(property), false);
+    if ( ret )
+        return ret;
+
+    write_atomic(&p->lpi_priority, property & LPI_PROP_PRIO_MASK);
+
+    if ( property & LPI_PROP_ENABLED )
+        set_bit(GIC_IRQ_GUEST_ENABLED, &p->status);
+    else
+        clear_bit(GIC_IRQ_GUEST_ENABLED, &p->status);
+
+    return 0;
+}
+
+/*
+ * Checks whether an LPI that got enabled or disabled needs to change
+ * something in the VGIC (added or removed from the LR or queues).
+ * Must be called with the VCPU's VGIC lock held.
+ */
+static void update_lpi_vgic_status(struct vcpu *v, struct pending_irq *p)
+{
+    ASSERT(spin_is_locked(&v->arch.vgic.lock));
+
+    if ( test_bit(GIC_IRQ_GUEST_ENABLED, &p->status) )
+    {
+        if ( !list_empty(&p->inflight) &&
+             !test_bit(GIC_IRQ_GUEST_VISIBLE, &p->status) )
+            gic_raise_guest_irq(v, p->irq, p->lpi_priority);
+    }
+    else
+        list_del_init(&p->lr_queue);
+}
+
+/*
+ * Moves an LPI to a new VCPU. Must be called with the old VCPU's VGIC
+ * lock held.
+ */
+static void its_migrate_lpi(struct vcpu *ovcpu, struct vcpu *nvcpu,
+                            struct pending_irq *p)
+{
+    ASSERT(spin_is_locked(&ovcpu->arch.vgic.lock));
+
+    write_atomic(&p->lpi_vcpu_id, nvcpu->vcpu_id);
+
+    /*
+     * TODO: An LPI which is already in an LR on the old VCPU stays there
+     * until the guest has handled it. This is a benign race which can
+     * happen on hardware as well (the affinity change just came too late).
+     */
+    if ( list_empty(&p->inflight) ||
+         test_bit(GIC_IRQ_GUEST_VISIBLE, &p->status) ||
+         ovcpu == nvcpu )
+        return;
+
+    /* Still pending: re-inject it on the new VCPU. */
+    list_del_init(&p->lr_queue);
+    list_del_init(&p->inflight);
+    clear_bit(GIC_IRQ_GUEST_QUEUED, &p->status);
+    vgic_vcpu_inject_irq(nvcpu, p->irq);
+}
+
+/*
+ * Call @fn for every LPI of the domain which targets VCPU @v, with
+ * @v's VGIC lock held.
+ */
+static void for_each_vcpu_lpi(struct vcpu *v,
+                              void (*fn)(struct vcpu *v, struct pending_irq *p,
+                                         void *data),
+                              void *data)
+{
+    struct domain *d = v->domain;
+    struct pending_irq *pirqs[16];
+    unsigned int vlpi = 0, nr_lpis, nr_matches, i;
+    unsigned long flags;
+
+    spin_lock_irqsave(&v->arch.vgic.lock, flags);
+
+    do {
+        /*
+         * Only our own LPIs are safe to touch once the tree lock has been
+         * dropped: releasing them requires our VGIC lock, which we hold.
+         */
+        read_lock(&d->arch.vgic.pend_lpi_tree_lock);
+        nr_lpis = radix_tree_gang_lookup(&d->arch.vgic.pend_lpi_tree,
+                                         (void **)pirqs, vlpi,
+                                         ARRAY_SIZE(pirqs));
+        for ( i = nr_matches = 0; i < nr_lpis; i++ )
+        {
+            vlpi = pirqs[i]->irq + 1;
+            if ( pirqs[i]->lpi_vcpu_id == v->vcpu_id )
+                pirqs[nr_matches++] = pirqs[i];
+        }
+        read_unlock(&d->arch.vgic.pend_lpi_tree_lock);
+
+        for ( i = 0; i < nr_matches; i++ )
+            fn(v, pirqs[i], data);
+
+    /* Repeat if we filled the array, there may be more LPIs. */
+    } while ( nr_lpis == ARRAY_SIZE(pirqs) );
+
+    spin_unlock_irqrestore(&v->arch.vgic.lock, flags);
+}
+
+/*
+ * Disconnects an event from its virtual LPI, so that it can't be injected
+ * anymore, and removes the LPI from the VGIC.
+ */
+static int its_discard_event(struct virt_its *its,
+                             uint32_t vdevid, uint32_t vevid)
+{
+    struct domain *d = its->d;
+    struct pending_irq *p;
+    struct vcpu *vcpu;
+    unsigned long flags;
+    uint32_t vlpi;
+
+    p = get_mapped_event(its, vdevid, vevid);
+    if ( !p )
+        return -ENOENT;
+
+    vlpi = p->irq;
+    vcpu = d->vcpu[read_atomic(&p->lpi_vcpu_id)];
+
+    /* Make sure the host LPI doesn't get injected anymore. */
+    gicv3_remove_guest_event(d, its->doorbell_address, vdevid, vevid);
+
+    spin_lock_irqsave(&vcpu->arch.vgic.lock, flags);
+
+    /*
+     * Once removed from the tree, no one can find this LPI anymore. An LR
+     * still holding it gets cleaned up when the VCPU syncs its LRs.
+     */
+    write_lock(&d->arch.vgic.pend_lpi_tree_lock);
+    radix_tree_delete(&d->arch.vgic.pend_lpi_tree, vlpi);
+    write_unlock(&d->arch.vgic.pend_lpi_tree_lock);
+
+    list_del_init(&p->lr_queue);
+    list_del_init(&p->inflight);
+    p->status = 0;
+    vgic_init_pending_irq(p, INVALID_LPI);
+
+    spin_unlock_irqrestore(&vcpu->arch.vgic.lock, flags);
+
+    return 0;
+}
+
+/* INT: inject the LPI of an event, as if the device had signalled it. */
+static int its_handle_int(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    uint32_t eventid = its_cmd_get_id(cmdptr);
+    struct pending_irq *p;
+
+    p = get_mapped_event(its, devid, eventid);
+    if ( !p )
+        return -1;
+
+    vgic_vcpu_inject_irq(its->d->vcpu[read_atomic(&p->lpi_vcpu_id)], p->irq);
+
+    return 0;
+}
+
+/* CLEAR: remove the pending state of an event's LPI. */
+static int its_handle_clear(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    uint32_t eventid = its_cmd_get_id(cmdptr);
+    struct pending_irq *p;
+    struct vcpu *vcpu;
+    unsigned long flags;
+
+    p = get_mapped_event(its, devid, eventid);
+    if ( !p )
+        return -1;
+
+    vcpu = its->d->vcpu[read_atomic(&p->lpi_vcpu_id)];
+
+    spin_lock_irqsave(&vcpu->arch.vgic.lock, flags);
+
+    clear_bit(GIC_IRQ_GUEST_QUEUED, &p->status);
+
+    /*
+     * If the LPI is already in an LR, the guest sees it anyway. Otherwise
+     * just forget about it.
+     */
+    if ( !test_bit(GIC_IRQ_GUEST_VISIBLE, &p->status) )
+    {
+        list_del_init(&p->lr_queue);
+        list_del_init(&p->inflight);
+    }
+
+    spin_unlock_irqrestore(&vcpu->arch.vgic.lock, flags);
+
+    return 0;
+}
+
+/* INV: re-read the property (enable and priority) of an event's LPI. */
+static int its_handle_inv(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    uint32_t eventid = its_cmd_get_id(cmdptr);
+    struct pending_irq *p;
+    struct vcpu *vcpu;
+    unsigned long flags;
+    int ret;
+
+    p = get_mapped_event(its, devid, eventid);
+    if ( !p )
+        return -1;
+
+    vcpu = its->d->vcpu[read_atomic(&p->lpi_vcpu_id)];
+
+    spin_lock_irqsave(&vcpu->arch.vgic.lock, flags);
+
+    ret = update_lpi_property(its->d, p);
+    if ( !ret )
+        update_lpi_vgic_status(vcpu, p);
+
+    spin_unlock_irqrestore(&vcpu->arch.vgic.lock, flags);
+
+    return ret;
+}
+
+static void invall_one_lpi(struct vcpu *v, struct pending_irq *p, void *data)
+{
+    /* If that fails for a single LPI, carry on to handle the rest. */
+    if ( !update_lpi_property(v->domain, p) )
+        update_lpi_vgic_status(v, p);
+}
+
+/* INVALL: re-read the properties of all LPIs of a collection. */
+static int its_handle_invall(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t collid = its_cmd_get_collection(cmdptr);
+    struct vcpu *vcpu;
+
+    vcpu = get_vcpu_from_collection(its, collid);
+    if ( !vcpu )
+        return -1;
+
+    for_each_vcpu_lpi(vcpu, invall_one_lpi, NULL);
+
+    return 0;
+}
+
+/* MAPC: map a collection to a redistributor (a VCPU) or unmap it. */
+static int its_handle_mapc(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t collid = its_cmd_get_collection(cmdptr);
+    uint64_t rdbase = its_cmd_get_target_addr(cmdptr);
+
+    if ( collid >= its->max_collections )
+        return -1;
+
+    if ( !its_cmd_get_validbit(cmdptr) )
+    {
+        its->coll_table[collid] = UNMAPPED_COLLECTION;
+        return 0;
+    }
+
+    if ( !get_vcpu_from_rdbase(its, rdbase) )
+        return -1;
+
+    its->coll_table[collid] = rdbase;
+
+    return 0;
+}
+
+/*
+ * MAPD: map a device, allocating its events on the host, or unmap it.
+ * Only the hardware domain can do this, and it sees the host device IDs.
+ */
+static int its_handle_mapd(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    unsigned int size = its_cmd_get_size(cmdptr) + 1;
+    bool valid = its_cmd_get_validbit(cmdptr);
+    uint32_t eventid;
+
+    /* Only the hardware domain can map devices for now. */
+    if ( !is_hardware_domain(its->d) )
+        return -1;
+
+    if ( devid >= BIT(its->devid_bits) || size > its->evid_bits )
+        return -1;
+
+    if ( !valid )
+    {
+        /* Unmapping the device discards all its events. */
+        for ( eventid = 0;
+              gicv3_its_get_event_pending_irq(its->d, its->doorbell_address,
+                                              devid, eventid);
+              eventid++ )
+            its_discard_event(its, devid, eventid);
+    }
+
+    return gicv3_its_map_guest_device(its->d, its->doorbell_address, devid,
+                                      its->doorbell_address, devid,
+                                      BIT(size), valid);
+}
+
+/* MAPTI/MAPI: connect an event to a virtual LPI and a collection. */
+static int its_handle_mapti(struct virt_its *its, uint64_t *cmdptr)
+{
+    struct domain *d = its->d;
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    uint32_t eventid = its_cmd_get_id(cmdptr);
+    uint32_t intid = its_cmd_get_physical_id(cmdptr);
+    uint16_t collid = its_cmd_get_collection(cmdptr);
+    struct pending_irq *p;
+    struct vcpu *vcpu;
+    int ret;
+
+    if ( its_cmd_get_command(cmdptr) == GITS_CMD_MAPI )
+        intid = eventid;
+
+    if ( !is_lpi(intid) || intid >= BIT(d->arch.vgic.intid_bits) )
+        return -1;
+
+    vcpu = get_vcpu_from_collection(its, collid);
+    if ( !vcpu )
+        return -1;
+
+    p = gicv3_its_get_event_pending_irq(d, its->doorbell_address,
+                                        devid, eventid);
+    /* Remapping a mapped event is UNPREDICTABLE, we refuse it. */
+    if ( !p || p->irq != INVALID_LPI )
+        return -1;
+
+    vgic_init_pending_irq(p, intid);
+    p->lpi_vcpu_id = vcpu->vcpu_id;
+    /* Start with the default priority until we read the property table. */
+    p->lpi_priority = GIC_PRI_IRQ;
+
+    write_lock_irq(&d->arch.vgic.pend_lpi_tree_lock);
+    ret = radix_tree_insert(&d->arch.vgic.pend_lpi_tree, intid, p);
+    write_unlock_irq(&d->arch.vgic.pend_lpi_tree_lock);
+
+    /* The virtual LPI is already used by another event. */
+    if ( ret )
+    {
+        p->irq = INVALID_LPI;
+        return -1;
+    }
+
+    /*
+     * The guest roughly knows what it does, so we just read the property
+     * table here and don't bother if it's not populated yet: a later INV
+     * picks it up.
+     */
+    update_lpi_property(d, p);
+
+    if ( !gicv3_assign_guest_event(d, its->doorbell_address, devid,
+                                   eventid, intid) )
+    {
+        its_discard_event(its, devid, eventid);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* MOVI: move an event to another collection, so to another VCPU. */
+static int its_handle_movi(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    uint32_t eventid = its_cmd_get_id(cmdptr);
+    uint16_t collid = its_cmd_get_collection(cmdptr);
+    struct pending_irq *p;
+    struct vcpu *ovcpu, *nvcpu;
+    unsigned long flags;
+
+    nvcpu = get_vcpu_from_collection(its, collid);
+    if ( !nvcpu )
+        return -1;
+
+    p = get_mapped_event(its, devid, eventid);
+    if ( !p )
+        return -1;
+
+    ovcpu = its->d->vcpu[read_atomic(&p->lpi_vcpu_id)];
+
+    spin_lock_irqsave(&ovcpu->arch.vgic.lock, flags);
+    its_migrate_lpi(ovcpu, nvcpu, p);
+    spin_unlock_irqrestore(&ovcpu->arch.vgic.lock, flags);
+
+    return 0;
+}
+
+static void movall_one_lpi(struct vcpu *v, struct pending_irq *p, void *data)
+{
+    its_migrate_lpi(v, data, p);
+}
+
+/* MOVALL: move all LPIs from one redistributor to another. */
+static int its_handle_movall(struct virt_its *its, uint64_t *cmdptr)
+{
+    struct vcpu *ovcpu, *nvcpu;
+
+    ovcpu = get_vcpu_from_rdbase(its, its_cmd_get_target_addr(cmdptr));
+    nvcpu = get_vcpu_from_rdbase(its, its_cmd_get_target_addr2(cmdptr));
+    if ( !ovcpu || !nvcpu )
+        return -1;
+
+    if ( ovcpu != nvcpu )
+        for_each_vcpu_lpi(ovcpu, movall_one_lpi, nvcpu);
+
+    return 0;
+}
+
+/* DISCARD: remove the mapping of an event. */
+static int its_handle_discard(struct virt_its *its, uint64_t *cmdptr)
+{
+    uint32_t devid = its_cmd_get_deviceid(cmdptr);
+    uint32_t eventid = its_cmd_get_id(cmdptr);
+
+    return its_discard_event(its, devid, eventid) ? -1 : 0;
+}
+
+/*
+ * Processes the commands between CREADR and CWRITER. As all commands take
+ * effect immediately, there is nothing to wait for and SYNC is a no-op.
+ * Must be called with the vcmd_lock held.
+ */
+static int vgic_its_handle_cmds(struct domain *d, struct virt_its *its)
+{
+    paddr_t addr = its->cbaser & GENMASK(51, 12);
+    uint64_t command[4];
+
+    ASSERT(spin_is_locked(&its->vcmd_lock));
+
+    if ( its->cwriter >= ITS_CMD_BUFFER_SIZE(its->cbaser) )
+        return -1;
+
+    while ( its->creadr != its->cwriter )
+    {
+        int ret;
+
+        ret = vgic_access_guest_memory(d, addr + its->creadr,
+                                       command, sizeof(command), false);
+        if ( ret )
+            return ret;
+
+        spin_lock(&its->its_lock);
+
+        switch ( its_cmd_get_command(command) )
+        {
+        case GITS_CMD_CLEAR:
+            ret = its_handle_clear(its, command);
+            break;
+        case GITS_CMD_DISCARD:
+            ret = its_handle_discard(its, command);
+            break;
+        case GITS_CMD_INT:
+            ret = its_handle_int(its, command);
+            break;
+        case GITS_CMD_INV:
+            ret = its_handle_inv(its, command);
+            break;
+        case GITS_CMD_INVALL:
+            ret = its_handle_invall(its, command);
+            break;
+        case GITS_CMD_MAPC:
+            ret = its_handle_mapc(its, command);
+            break;
+        case GITS_CMD_MAPD:
+            ret = its_handle_mapd(its, command);
+            break;
+        case GITS_CMD_MAPI:
+        case GITS_CMD_MAPTI:
+            ret = its_handle_mapti(its, command);
+            break;
+        case GITS_CMD_MOVALL:
+            ret = its_handle_movall(its, command);
+            break;
+        case GITS_CMD_MOVI:
+            ret = its_handle_movi(its, command);
+            break;
+        case GITS_CMD_SYNC:
+            /* We handle ITS commands synchronously, so we ignore SYNC. */
+            break;
+        default:
+            gdprintk(XENLOG_WARNING, "vGITS: unhandled ITS command %lu\n",
+                     its_cmd_get_command(command));
+            break;
+        }
+
+        spin_unlock(&its->its_lock);
+
+        write_u64_atomic(&its->creadr, (its->creadr + ITS_CMD_SIZE) %
+                         ITS_CMD_BUFFER_SIZE(its->cbaser));
+
+        if ( ret )
+            gdprintk(XENLOG_WARNING,
+                     "vGITS: ITS command error %d while handling command %lu\n",
+                     ret, its_cmd_get_command(command));
+    }
+
+    return 0;
+}
+
+/*****************************
+ * ITS registers read access *
+ *****************************/
+
+static int vgic_v3_its_mmio_read(struct vcpu *v, mmio_info_t *info,
+                                 register_t *r, void *priv)
+{
+    struct virt_its *its = priv;
+    uint64_t reg;
+
+    switch ( info->gpa & 0xffff )
+    {
+    case VREG32(GITS_CTLR):
+    {
+        /*
+         * We try to avoid waiting for the command queue lock and report
+         * non-quiescent if that lock is already taken.
+         */
+        bool have_cmd_lock;
+
+        if ( info->dabt.size != DABT_WORD ) goto bad_width;
+
+        have_cmd_lock = spin_trylock(&its->vcmd_lock);
+        reg = its->enabled ? GITS_CTLR_ENABLE : 0;
+
+        if ( have_cmd_lock && its->cwriter == its->creadr )
+            reg |= GITS_CTLR_QUIESCENT;
+
+        if ( have_cmd_lock )
+            spin_unlock(&its->vcmd_lock);
+
+        *r = vgic_reg32_extract(reg, info);
+        break;
+    }
+
+    case VREG32(GITS_IIDR):
+        if ( info->dabt.size != DABT_WORD ) goto bad_width;
+        *r = vgic_reg32_extract(GITS_IIDR_VALUE, info);
+        break;
+
+    case VREG64(GITS_TYPER):
+        if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+
+        reg = GITS_TYPER_PHYSICAL;
+        reg |= (VITS_ITTE_SIZE - 1) << GITS_TYPER_ITT_SIZE_SHIFT;
+        reg |= (its->evid_bits - 1) << GITS_TYPER_IDBITS_SHIFT;
+        reg |= (its->devid_bits - 1) << GITS_TYPER_DEVIDS_SHIFT;
+        /* All collections are held by the ITS, as we have no table. */
+        reg |= (uint64_t)min(its->max_collections, 255U) << GITS_TYPER_HCC_SHIFT;
+        *r = vgic_reg64_extract(reg, info);
+        break;
+
+    case VREG64(GITS_CBASER):
+        if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+        spin_lock(&its->its_lock);
+        *r = vgic_reg64_extract(its->cbaser, info);
+        spin_unlock(&its->its_lock);
+        break;
+
+    case VREG64(GITS_CWRITER):
+        if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+
+        /* CWRITER is only written by the guest, so no extra locking here. */
+        reg = its->cwriter;
+        *r = vgic_reg64_extract(reg, info);
+        break;
+
+    case VREG64(GITS_CREADR):
+        if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+
+        /*
+         * Lockless access, to avoid waiting for the whole command queue to be
+         * finished completely. Xen updates its->creadr atomically after each
+         * command has been handled, this allows other VCPUs to monitor the
+         * progress.
+         */
+        reg = read_u64_atomic(&its->creadr);
+        *r = vgic_reg64_extract(reg, info);
+        break;
+
+    case VRANGE64(GITS_BASER0, GITS_BASER7):
+        /* We keep the device and collection tables in Xen: type none. */
+        goto read_as_zero_64;
+
+    case VREG32(GITS_PIDR2):
+        if ( info->dabt.size != DABT_WORD ) goto bad_width;
+        *r = vgic_reg32_extract(GITS_PIDR2_VALUE, info);
+        break;
+
+    default:
+        printk(XENLOG_G_DEBUG
+               "%pv: vGITS: RAZ on reserved or implementation defined register offset %#04lx\n",
+               v, info->gpa & 0xffff);
+        *r = 0;
+        break;
+    }
+
+    return 1;
+
+read_as_zero_64:
+    if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+    *r = 0;
+
+    return 1;
+
+bad_width:
+    printk(XENLOG_G_ERR "vGITS: bad read width %d r%d offset %#04lx\n",
+           info->dabt.size, info->dabt.reg, (unsigned long)info->gpa & 0xffff);
+    domain_crash_synchronous();
+
+    return 0;
+}
+
+/******************************
+ * ITS registers write access *
+ ******************************/
+
+/* Keep the address, the size, the attributes and the valid bit. */
+#define GITS_CBASER_WRITABLE_MASK                                  \
+        (GITS_VALID_BIT | GITS_BASER_INNER_CACHEABILITY_MASK |     \
+         GITS_BASER_OUTER_CACHEABILITY_MASK |                      \
+         GITS_BASER_SHAREABILITY_MASK | GENMASK(51, 12) |          \
+         GITS_CBASER_SIZE_MASK)
+
+static int vgic_v3_its_mmio_write(struct vcpu *v, mmio_info_t *info,
+                                  register_t r, void *priv)
+{
+    struct domain *d = v->domain;
+    struct virt_its *its = priv;
+    uint64_t reg;
+    uint32_t reg32;
+
+    switch ( info->gpa & 0xffff )
+    {
+    case VREG32(GITS_CTLR):
+    {
+        uint32_t ctlr;
+
+        if ( info->dabt.size != DABT_WORD ) goto bad_width;
+
+        /*
+         * We need to take the vcmd_lock to prevent a guest from disabling
+         * the ITS while commands are still processed.
+         */
+        spin_lock(&its->vcmd_lock);
+        spin_lock(&its->its_lock);
+        ctlr = its->enabled ? GITS_CTLR_ENABLE : 0;
+        reg32 = ctlr;
+        vgic_reg32_update(&reg32, r, info);
+
+        /* The ITS can only be enabled with a valid command queue. */
+        if ( (reg32 & GITS_CTLR_ENABLE) && !(its->cbaser & GITS_VALID_BIT) )
+            reg32 &= ~GITS_CTLR_ENABLE;
+
+        its->enabled = reg32 & GITS_CTLR_ENABLE;
+        spin_unlock(&its->its_lock);
+
+        if ( !ctlr && its->enabled && its->cwriter != its->creadr )
+            vgic_its_handle_cmds(d, its);
+
+        spin_unlock(&its->vcmd_lock);
+
+        return 1;
+    }
+
+    case VREG32(GITS_IIDR):
+        goto write_ignore_32;
+
+    case VREG32(GITS_TYPER):
+        goto write_ignore_32;
+
+    case VREG64(GITS_CBASER):
+        if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+
+        spin_lock(&its->vcmd_lock);
+        spin_lock(&its->its_lock);
+
+        /* Changing base registers with the ITS enabled is UNPREDICTABLE. */
+        if ( its->enabled )
+        {
+            spin_unlock(&its->its_lock);
+            spin_unlock(&its->vcmd_lock);
+            gdprintk(XENLOG_WARNING,
+                     "vGITS: tried to change CBASER with the ITS enabled.\n");
+            return 1;
+        }
+
+        reg = its->cbaser;
+        vgic_reg64_update(&reg, r, info);
+        its->cbaser = reg & GITS_CBASER_WRITABLE_MASK;
+
+        /* Writing CBASER resets the read pointer. */
+        its->creadr = 0;
+
+        spin_unlock(&its->its_lock);
+        spin_unlock(&its->vcmd_lock);
+
+        return 1;
+
+    case VREG64(GITS_CWRITER):
+        if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+
+        spin_lock(&its->vcmd_lock);
+        reg = ITS_CMD_OFFSET(its->cwriter);
+        vgic_reg64_update(&reg, r, info);
+        its->cwriter = ITS_CMD_OFFSET(reg);
+
+        if ( its->enabled )
+            if ( vgic_its_handle_cmds(d, its) )
+                gdprintk(XENLOG_WARNING, "error handling ITS commands\n");
+
+        spin_unlock(&its->vcmd_lock);
+
+        return 1;
+
+    case VREG64(GITS_CREADR):
+        /* RO */
+        goto write_ignore_64;
+
+    case VRANGE64(GITS_BASER0, GITS_BASER7):
+        /* We keep the device and collection tables in Xen: WI. */
+        goto write_ignore_64;
+
+    case VREG32(GITS_PIDR2):
+        goto write_ignore_32;
+
+    default:
+        printk(XENLOG_G_DEBUG
+               "%pv: vGITS: WI on reserved or implementation defined register offset %#04lx\n",
+               v, info->gpa & 0xffff);
+        return 1;
+    }
+
+    return 1;
+
+write_ignore_64:
+    if ( !vgic_reg64_check_access(info->dabt) ) goto bad_width;
+    return 1;
+
+write_ignore_32:
+    if ( info->dabt.size != DABT_WORD ) goto bad_width;
+    return 1;
+
+bad_width:
+    printk(XENLOG_G_ERR "vGITS: bad write width %d r%d offset %#08lx\n",
+           info->dabt.size, info->dabt.reg, (unsigned long)info->gpa & 0xffff);
+
+    domain_crash_synchronous();
+
+    return 0;
+}
+
+static const struct mmio_handler_ops vgic_its_mmio_handler = {
+    .read  = vgic_v3_its_mmio_read,
+    .write = vgic_v3_its_mmio_write,
+};
+
+static int vgic_v3_its_init_virtual(struct domain *d, paddr_t guest_addr,
+                                    unsigned int devid_bits,
+                                    unsigned int evid_bits)
+{
+    struct virt_its *its;
+    unsigned int i;
+
+    its = xzalloc(struct virt_its);
+    if ( !its )
+        return -ENOMEM;
+
+    its->max_collections = MAX_VIRT_CPUS;
+    its->coll_table = xmalloc_array(uint16_t, its->max_collections);
+    if ( !its->coll_table )
+    {
+        xfree(its);
+        return -ENOMEM;
+    }
+
+    for ( i = 0; i < its->max_collections; i++ )
+        its->coll_table[i] = UNMAPPED_COLLECTION;
+
+    its->cbaser  = GIC_BASER_CACHE_RaWb << GITS_BASER_INNER_CACHEABILITY_SHIFT;
+    its->cbaser |= GIC_BASER_InnerShareable << GITS_BASER_SHAREABILITY_SHIFT;
+
+    its->d = d;
+    its->doorbell_address = guest_addr + ITS_DOORBELL_OFFSET;
+    its->devid_bits = devid_bits;
+    its->evid_bits = evid_bits;
+    spin_lock_init(&its->vcmd_lock);
+    spin_lock_init(&its->its_lock);
+
+    /* Only the control page is emulated, the doorbell page is mapped. */
+    register_mmio_handler(d, &vgic_its_mmio_handler, guest_addr, SZ_64K, its);
+
+    list_add_tail(&its->vits_list, &d->arch.vgic.vits_list);
+
+    return 0;
+}
+
+int vgic_v3_its_init_domain(struct domain *d)
+{
+    int ret;
+
+    INIT_LIST_HEAD(&d->arch.vgic.vits_list);
+    spin_lock_init(&d->arch.vgic.its_devices_lock);
+    d->arch.vgic.its_devices = RB_ROOT;
+
+    if ( is_hardware_domain(d) )
+    {
+        struct host_its *hw_its;
+
+        list_for_each_entry(hw_its, &host_its_list, entry)
+        {
+            /*
+             * For each host ITS create a virtual ITS using the same
+             * base and thus doorbell address.
+             * Use the same number of device ID and event ID bits as the host.
+             */
+            ret = vgic_v3_its_init_virtual(d, hw_its->addr,
+                                           hw_its->devid_bits,
+                                           hw_its->evid_bits);
+            if ( ret )
+                return ret;
+            else
+                d->arch.vgic.has_its = true;
+        }
+    }
+
+    return 0;
+}
+
+void vgic_v3_its_free_domain(struct domain *d)
+{
+    struct virt_its *pos, *temp;
+
+    list_for_each_entry_safe( pos, temp, &d->arch.vgic.vits_list, vits_list )
+    {
+        list_del(&pos->vits_list);
+        xfree(pos->coll_table);
+        xfree(pos);
+    }
+
+    ASSERT(RB_EMPTY_ROOT(&d->arch.vgic.its_devices));
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
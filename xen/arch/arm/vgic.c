@@ -25,11 +25,14 @@
 #include <xen/irq.h>
 #include <xen/sched.h>
 #include <xen/perfc.h>
+#include <xen/domain_page.h>
 
 #include <asm/current.h>
+#include <asm/p2m.h>
 
 #include <asm/mmio.h>
 #include <asm/gic.h>
+#include <asm/gic_v3_its.h>
 #include <asm/vgic.h>
 
 static inline struct vgic_irq_rank *vgic_get_rank(struct vcpu *v, int rank)
@@ -61,7 +64,7 @@ struct vgic_irq_rank *vgic_rank_irq(struct vcpu *v, unsigned int irq)
     return vgic_get_rank(v, rank);
 }
 
-static void vgic_init_pending_irq(struct pending_irq *p, unsigned int virq)
+void vgic_init_pending_irq(struct pending_irq *p, unsigned int virq)
 {
     INIT_LIST_HEAD(&p->inflight);
     INIT_LIST_HEAD(&p->lr_queue);
@@ -199,6 +202,14 @@ int vcpu_vgic_init(struct vcpu *v)
     /* SGIs/PPIs are always routed to this VCPU */
     vgic_rank_init(v->arch.vgic.private_irqs, 0, v->vcpu_id);
 
+    v->arch.vgic.inject_pending =
+        xzalloc_array(unsigned long, BITS_TO_LONGS(vgic_num_irqs(v->domain)));
+    if ( v->arch.vgic.inject_pending == NULL )
+    {
+        xfree(v->arch.vgic.private_irqs);
+        return -ENOMEM;
+    }
+
     v->domain->arch.vgic.handler->vcpu_init(v);
 
     memset(&v->arch.vgic.pending_irqs, 0, sizeof(v->arch.vgic.pending_irqs));
@@ -215,6 +226,7 @@ int vcpu_vgic_init(struct vcpu *v)
 int vcpu_vgic_free(struct vcpu *v)
 {
     xfree(v->arch.vgic.private_irqs);
+    xfree(v->arch.vgic.inject_pending);
     return 0;
 }
 
@@ -244,10 +256,15 @@ struct vcpu *vgic_get_target_vcpu(struct vcpu *v, unsigned int virq)
 
 static int vgic_get_virq_priority(struct vcpu *v, unsigned int virq)
 {
-    struct vgic_irq_rank *rank = vgic_rank_irq(v, virq);
+    struct vgic_irq_rank *rank;
     unsigned long flags;
     int priority;
 
+    /* LPIs don't have a rank, also store their priority separately. */
+    if ( is_lpi(virq) )
+        return v->domain->arch.vgic.handler->lpi_get_priority(v->domain, virq);
+
+    rank = vgic_rank_irq(v, virq);
     vgic_lock_rank(v, rank, flags);
     priority = rank->priority[virq & INTERRUPT_RANK_MASK];
     vgic_unlock_rank(v, rank, flags);
@@ -255,10 +272,72 @@ static int vgic_get_virq_priority(struct vcpu *v, unsigned int virq)
     return priority;
 }
 
+/*
+ * Add virq, whose pending_irq is n, to the inflight list of v, and to an LR
+ * if v is current. Called with v's vgic lock held.
+ */
+static void __vgic_queue_irq(struct vcpu *v, unsigned int virq,
+                             struct pending_irq *n, uint8_t priority)
+{
+    struct pending_irq *iter;
+
+    ASSERT(spin_is_locked(&v->arch.vgic.lock));
+
+    set_bit(GIC_IRQ_GUEST_QUEUED, &n->status);
+
+    if ( !list_empty(&n->inflight) )
+    {
+        gic_raise_inflight_irq(v, virq);
+        return;
+    }
+
+    n->priority = priority;
+
+    /* the irq is enabled */
+    if ( test_bit(GIC_IRQ_GUEST_ENABLED, &n->status) )
+        gic_raise_guest_irq(v, virq, priority);
+
+    list_for_each_entry ( iter, &v->arch.vgic.inflight_irqs, inflight )
+    {
+        if ( iter->priority > priority )
+        {
+            list_add_tail(&n->inflight, &iter->inflight);
+            return;
+        }
+    }
+    list_add_tail(&n->inflight, &v->arch.vgic.inflight_irqs);
+}
+
+/*
+ * Mark virq for v to queue on its way back to the guest. QUEUED is set
+ * right away, so that the interrupt is seen as pending before then.
+ */
+static void vgic_mark_injected(struct vcpu *v, unsigned int virq)
+{
+    set_bit(GIC_IRQ_GUEST_QUEUED, &irq_to_pending(v, virq)->status);
+    set_bit(virq, v->arch.vgic.inject_pending);
+    smp_wmb();
+    write_atomic(&v->arch.vgic.inject_queued, true);
+}
+
+/* we have a new higher priority irq, inject it into the guest */
+static void vgic_kick_vcpu(struct vcpu *v)
+{
+    bool_t running = v->is_running;
+
+    vcpu_unblock(v);
+    if ( running && v != current )
+    {
+        perfc_incr(vgic_cross_cpu_intr_inject);
+        smp_send_event_check_mask(cpumask_of(v->processor));
+    }
+}
+
 void vgic_migrate_irq(struct vcpu *old, struct vcpu *new, unsigned int irq)
 {
     unsigned long flags;
     struct pending_irq *p = irq_to_pending(old, irq);
+    bool_t moved;
 
     /* nothing to do for virtual interrupts */
     if ( p->desc == NULL )
@@ -272,11 +351,17 @@ void vgic_migrate_irq(struct vcpu *old, struct vcpu *new, unsigned int irq)
 
     spin_lock_irqsave(&old->arch.vgic.lock, flags);
 
+    /*
+     * Marked for old by another pCPU but not queued yet: move the mark to
+     * new, or old would queue the interrupt the guest routed away from it.
+     */
+    moved = test_and_clear_bit(irq, old->arch.vgic.inject_pending);
+
     if ( list_empty(&p->inflight) )
     {
         irq_set_affinity(p->desc, cpumask_of(new->processor));
         spin_unlock_irqrestore(&old->arch.vgic.lock, flags);
-        return;
+        goto out;
     }
     /* If the IRQ is still lr_pending, re-inject it to the new vcpu */
     if ( !list_empty(&p->lr_queue) )
@@ -295,6 +380,13 @@ void vgic_migrate_irq(struct vcpu *old, struct vcpu *new, unsigned int irq)
         set_bit(GIC_IRQ_GUEST_MIGRATING, &p->status);
 
     spin_unlock_irqrestore(&old->arch.vgic.lock, flags);
+
+ out:
+    if ( moved )
+    {
+        vgic_mark_injected(new, irq);
+        vgic_kick_vcpu(new);
+    }
 }
 
 void arch_move_irqs(struct vcpu *v)
@@ -318,6 +410,7 @@ void arch_move_irqs(struct vcpu *v)
 void vgic_disable_irqs(struct vcpu *v, uint32_t r, int n)
 {
     const unsigned long mask = r;
+    struct vgic_irq_rank *rank = vgic_get_rank(v, n);
     struct pending_irq *p;
     unsigned int irq;
     unsigned long flags;
@@ -329,6 +422,19 @@ void vgic_disable_irqs(struct vcpu *v, uint32_t r, int n)
         v_target = __vgic_get_target_vcpu(v, irq);
         p = irq_to_pending(v_target, irq);
         clear_bit(GIC_IRQ_GUEST_ENABLED, &p->status);
+        /*
+         * Queue an interrupt marked by another pCPU now, so that it stays
+         * pending, but not in an LR, while disabled.
+         */
+        if ( test_bit(irq, v_target->arch.vgic.inject_pending) )
+        {
+            spin_lock_irqsave(&v_target->arch.vgic.lock, flags);
+            if ( test_and_clear_bit(irq, v_target->arch.vgic.inject_pending) &&
+                 !test_bit(_VPF_down, &v_target->pause_flags) )
+                __vgic_queue_irq(v_target, irq, p,
+                                 rank->priority[irq & INTERRUPT_RANK_MASK]);
+            spin_unlock_irqrestore(&v_target->arch.vgic.lock, flags);
+        }
         gic_remove_from_queues(v_target, irq);
         if ( p->desc != NULL )
         {
@@ -453,6 +559,8 @@ struct pending_irq *irq_to_pending(struct vcpu *v, unsigned int irq)
      * are used for SPIs; the rests are used for per cpu irqs */
     if ( irq < 32 )
         n = &v->arch.vgic.pending_irqs[irq];
+    else if ( is_lpi(irq) )
+        n = v->domain->arch.vgic.handler->lpi_to_pending(v->domain, irq);
     else
         n = &v->domain->arch.vgic.pending_irqs[irq - 32];
     return n;
@@ -474,60 +582,78 @@ void vgic_clear_pending_irqs(struct vcpu *v)
     list_for_each_entry_safe ( p, t, &v->arch.vgic.inflight_irqs, inflight )
         list_del_init(&p->inflight);
     gic_clear_pending_irqs(v);
+    v->arch.vgic.inject_queued = false;
+    bitmap_zero(v->arch.vgic.inject_pending, vgic_num_irqs(v->domain));
     spin_unlock_irqrestore(&v->arch.vgic.lock, flags);
 }
 
-void vgic_vcpu_inject_irq(struct vcpu *v, unsigned int virq)
+/* Add virq to the inflight list of v, and to an LR if v is current. */
+static void vgic_queue_irq(struct vcpu *v, unsigned int virq)
 {
     uint8_t priority;
-    struct pending_irq *iter, *n = irq_to_pending(v, virq);
+    struct pending_irq *n;
     unsigned long flags;
-    bool_t running;
 
     priority = vgic_get_virq_priority(v, virq);
 
     spin_lock_irqsave(&v->arch.vgic.lock, flags);
 
-    /* vcpu offline */
-    if ( test_bit(_VPF_down, &v->pause_flags) )
+    /*
+     * An LPI might have been unmapped by the guest in the meantime, so
+     * look up its pending_irq only with the VGIC lock held.
+     */
+    n = irq_to_pending(v, virq);
+
+    /* vcpu offline or unmapped LPI */
+    if ( test_bit(_VPF_down, &v->pause_flags) || !n )
     {
         spin_unlock_irqrestore(&v->arch.vgic.lock, flags);
         return;
     }
 
-    set_bit(GIC_IRQ_GUEST_QUEUED, &n->status);
+    __vgic_queue_irq(v, virq, n, priority);
 
-    if ( !list_empty(&n->inflight) )
-    {
-        gic_raise_inflight_irq(v, virq);
-        goto out;
-    }
+    spin_unlock_irqrestore(&v->arch.vgic.lock, flags);
+}
 
-    n->priority = priority;
+/*
+ * Queue the interrupts other pCPUs have marked for the current vCPU
+ * since it last looked.
+ */
+void vgic_flush_injected_irqs(void)
+{
+    struct vcpu *v = current;
+    unsigned int nr = vgic_num_irqs(v->domain);
+    unsigned int virq;
 
-    /* the irq is enabled */
-    if ( test_bit(GIC_IRQ_GUEST_ENABLED, &n->status) )
-        gic_raise_guest_irq(v, virq, priority);
+    if ( !read_atomic(&v->arch.vgic.inject_queued) )
+        return;
 
-    list_for_each_entry ( iter, &v->arch.vgic.inflight_irqs, inflight )
-    {
-        if ( iter->priority > priority )
-        {
-            list_add_tail(&n->inflight, &iter->inflight);
-            goto out;
-        }
-    }
-    list_add_tail(&n->inflight, &v->arch.vgic.inflight_irqs);
-out:
-    spin_unlock_irqrestore(&v->arch.vgic.lock, flags);
-    /* we have a new higher priority irq, inject it into the guest */
-    running = v->is_running;
-    vcpu_unblock(v);
-    if ( running && v != current )
-    {
-        perfc_incr(vgic_cross_cpu_intr_inject);
-        smp_send_event_check_mask(cpumask_of(v->processor));
-    }
+    /*
+     * Clear the flag before scanning the bitmap: a producer sets its bit
+     * before the flag, so anything we miss here is caught next time.
+     */
+    write_atomic(&v->arch.vgic.inject_queued, false);
+    smp_mb();
+
+    for_each_set_bit ( virq, v->arch.vgic.inject_pending, nr )
+        if ( test_and_clear_bit(virq, v->arch.vgic.inject_pending) )
+            vgic_queue_irq(v, virq);
+}
+
+void vgic_vcpu_inject_irq(struct vcpu *v, unsigned int virq)
+{
+    /*
+     * Injecting into another vCPU only marks the interrupt, so the
+     * sender never contends on the target's vgic lock. LPIs have no bit
+     * in the bitmap and are always queued directly.
+     */
+    if ( v != current && virq < vgic_num_irqs(v->domain) )
+        vgic_mark_injected(v, virq);
+    else
+        vgic_queue_irq(v, virq);
+
+    vgic_kick_vcpu(v);
 }
 
 void vgic_vcpu_inject_spi(struct domain *d, unsigned int virq)
@@ -541,11 +667,77 @@ void vgic_vcpu_inject_spi(struct domain *d, unsigned int virq)
     vgic_vcpu_inject_irq(v, virq);
 }
 
+void vgic_vcpu_inject_lpi(struct domain *d, unsigned int virq)
+{
+    struct pending_irq *p;
+    unsigned int vcpu_id;
+
+    p = d->arch.vgic.handler->lpi_to_pending(d, virq);
+    if ( !p )
+        return;
+
+    /* The VCPU ID is set by MAPTI/MOVI and always refers to a valid VCPU. */
+    vcpu_id = read_atomic(&p->lpi_vcpu_id);
+    if ( vcpu_id >= d->max_vcpus )
+        return;
+
+    vgic_vcpu_inject_irq(d->vcpu[vcpu_id], virq);
+}
+
 void arch_evtchn_inject(struct vcpu *v)
 {
     vgic_vcpu_inject_irq(v, v->domain->arch.evtchn_irq);
 }
 
+int vgic_access_guest_memory(struct domain *d, paddr_t gpa, void *buf,
+                             uint32_t size, bool is_write)
+{
+    struct page_info *page;
+    uint64_t offset;
+    p2m_type_t p2mt;
+    void *p;
+
+    while ( size )
+    {
+        uint32_t chunk;
+
+        offset = gpa & ~PAGE_MASK;
+        chunk = min_t(uint32_t, size, PAGE_SIZE - offset);
+
+        page = get_page_from_gfn(d, paddr_to_pfn(gpa), &p2mt, P2M_ALLOC);
+        if ( !page )
+        {
+            printk(XENLOG_G_ERR "d%d: vITS: Failed to get table entry\n",
+                   d->domain_id);
+            return -EINVAL;
+        }
+
+        if ( !p2m_is_ram(p2mt) )
+        {
+            put_page(page);
+            printk(XENLOG_G_ERR "d%d: vITS: memory used by the ITS should be RAM.",
+                   d->domain_id);
+            return -EINVAL;
+        }
+
+        p = __map_domain_page(page);
+
+        if ( is_write )
+            memcpy(p + offset, buf, chunk);
+        else
+            memcpy(buf, p + offset, chunk);
+
+        unmap_domain_page(p);
+        put_page(page);
+
+        gpa += chunk;
+        buf += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
 int vgic_emulate(struct cpu_user_regs *regs, union hsr hsr)
 {
     struct vcpu *v = current;
@@ -120,6 +120,9 @@ int vcpu_vtimer_init(struct vcpu *v)
         : GUEST_TIMER_VIRT_PPI;
     t->v = v;
 
+    /* Let the guest deactivate the physical interrupt along with its own */
+    irq_to_pending(v, t->irq)->hw_ppi = timer_get_irq(TIMER_VIRT_PPI);
+
     v->arch.vtimer_initialized = 1;
 
     return 0;
@@ -152,8 +155,19 @@ int virt_timer_save(struct vcpu *v)
 
 int virt_timer_restore(struct vcpu *v)
 {
+    struct pending_irq *p = irq_to_pending(v, v->arch.virt_timer.irq);
+
     ASSERT(!is_idle_vcpu(v));
 
+    /*
+     * The physical interrupt is active for as long as the guest has the
+     * virtual one: whoever ran here before may have left it either way.
+     * The inflight list can't change under our feet, as interrupts
+     * raised by other pCPUs are only queued by v itself.
+     */
+    gic_set_active_state(irq_to_desc(timer_get_irq(TIMER_VIRT_PPI)),
+                         !list_empty(&p->inflight));
+
     stop_timer(&v->arch.virt_timer.timer);
     migrate_timer(&v->arch.virt_timer.timer, v->processor);
     migrate_timer(&v->arch.phys_timer.timer, v->processor);
@@ -345,6 +345,9 @@ static void dump_cx(unsigned char key)
     for_each_online_cpu ( cpu )
         if (processor_powers[cpu])
             print_acpi_power(cpu, processor_powers[cpu]);
+
+    if ( lapic_timer_off == hpet_broadcast_enter )
+        hpet_broadcast_dump();
 }
 
 static int __init cpu_idle_key_init(void)
@@ -550,7 +553,8 @@ static void acpi_processor_idle(void)
     u32 irq_traced[4] = { 0 };
 
     if ( max_cstate > 0 && power && !sched_has_urgent_vcpu() &&
-         (next_state = cpuidle_current_governor->select(power)) > 0 )
+         (next_state = cpuidle_cpu_is_free() ? power->count - 1
+                       : cpuidle_current_governor->select(power)) > 0 )
     {
         cx = &power->states[next_state];
         if ( cx->type == ACPI_STATE_C3 && power->flags.bm_check &&
@@ -558,7 +562,8 @@ static void acpi_processor_idle(void)
             cx = power->safe_state;
         if ( cx->idx > max_cstate )
             cx = &power->states[max_cstate];
-        menu_get_trace_data(&exp, &pred);
+        if ( cpuidle_current_governor->get_trace_data )
+            cpuidle_current_governor->get_trace_data(&exp, &pred);
     }
     if ( !cx )
     {
@@ -286,6 +286,13 @@ static int menu_enable_device(struct acpi_processor_power *power)
     return 0;
 }
 
+static void menu_get_trace_data(u32 *expected, u32 *pred)
+{
+    struct menu_device *data = &__get_cpu_var(menu_devices);
+    *expected = data->expected_us;
+    *pred = data->predicted_us;
+}
+
 static struct cpuidle_governor menu_governor =
 {
     .name =         "menu",
@@ -293,12 +300,7 @@ static struct cpuidle_governor menu_governor =
     .enable =       menu_enable_device,
     .select =       menu_select,
     .reflect =      menu_reflect,
+    .get_trace_data = menu_get_trace_data,
 };
 
 struct cpuidle_governor *cpuidle_current_governor = &menu_governor;
-void menu_get_trace_data(u32 *expected, u32 *pred)
-{
-    struct menu_device *data = &__get_cpu_var(menu_devices);
-    *expected = data->expected_us;
-    *pred = data->predicted_us;
-}
@@ -0,0 +1,250 @@
+/*
+ * cpuidle_teo - timer events oriented governor for cpu idle.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or (at
+ *  your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include <xen/config.h>
+#include <xen/errno.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/types.h>
+#include <xen/acpi.h>
+#include <xen/timer.h>
+#include <xen/softirq.h>
+#include <xen/cpuidle.h>
+
+/*
+ * Unlike menu, which scales the distance to the next timer by a correction
+ * factor, this governor starts from the deepest state the next timer
+ * allows, which is exactly known, and only backs off from it when recent
+ * history says the CPU is likely to be woken earlier by something else.
+ *
+ * Every wakeup is put down to its source:
+ * - the timer, when the CPU woke at or past the deadline it went idle with;
+ * - an event, when a vCPU was made runnable on it, be it by an event
+ *   channel, a device interrupt for a guest or an IPI from the scheduler;
+ * - an IRQ otherwise, i.e. an interrupt Xen dealt with itself.
+ *
+ * Wakeups are accounted in one bin per C-state, the bin of the deepest
+ * state whose target residency the idle period matched.  Bins decay, so
+ * they reflect the recent pattern.  If most of the weight lies in bins
+ * shallower than the timer's choice, the CPU is usually woken before that
+ * state pays off, and a shallower one selected instead.
+ *
+ * Additionally, the exit latency of the selected state must remain small
+ * compared with the average interval between wakeups of each source, as
+ * menu does for IRQs.  Event wakeups are given the larger multiplier: a
+ * guest is waiting on those.
+ */
+
+#define RESOLUTION 1024
+#define DECAY_SHIFT 3
+#define MAX_INTERVAL_US 1000000
+
+enum { WAKE_TIMER, WAKE_IRQ, WAKE_EVENT, WAKE_SOURCES };
+
+static const unsigned int latency_multiplier[WAKE_SOURCES] = {
+    [WAKE_IRQ]   = 8,
+    [WAKE_EVENT] = 16,
+};
+
+struct teo_device
+{
+    s_time_t        deadline;
+    unsigned int    expected_us;
+    unsigned int    predicted_us;
+    unsigned int    exit_us;
+    unsigned int    bins[ACPI_PROCESSOR_MAX_POWER][WAKE_SOURCES];
+    s_time_t        last_wakeup[WAKE_SOURCES];
+    unsigned int    interval_us[WAKE_SOURCES];
+};
+
+static DEFINE_PER_CPU(struct teo_device, teo_devices);
+
+static unsigned int get_sleep_length_us(s_time_t deadline, s_time_t now)
+{
+    s_time_t us = (deadline - now) / 1000;
+
+    /* See menu: stay clear of wrapping on addition with an exit latency. */
+    return (us >> 32) ? (unsigned int)-2000 : (unsigned int)us;
+}
+
+/*
+ * Average interval between wakeups from @src, which is stretched when
+ * the source has been quiet for longer than the average.
+ */
+static unsigned int wakeup_interval_us(const struct teo_device *data,
+                                       unsigned int src, s_time_t now)
+{
+    s_time_t since;
+
+    if ( !data->last_wakeup[src] )
+        return MAX_INTERVAL_US;
+
+    since = (now - data->last_wakeup[src]) / 1000;
+    if ( since > MAX_INTERVAL_US )
+        return MAX_INTERVAL_US;
+
+    return max_t(unsigned int, data->interval_us[src], since);
+}
+
+static int teo_select(struct acpi_processor_power *power)
+{
+    struct teo_device *data = &this_cpu(teo_devices);
+    s_time_t now = NOW();
+    unsigned int i, idx = CPUIDLE_DRIVER_STATE_START, src;
+    unsigned int total = 0, early = 0;
+
+    data->deadline = this_cpu(timer_deadline);
+    data->expected_us = get_sleep_length_us(data->deadline, now);
+
+    /* The deepest state the next timer leaves room for... */
+    for ( i = CPUIDLE_DRIVER_STATE_START + 1; i < power->count; i++ )
+    {
+        if ( power->states[i].target_residency > data->expected_us )
+            break;
+        idx = i;
+    }
+
+    /* ...unless most recent idle periods were cut shorter than that. */
+    for ( i = 0; i < power->count; i++ )
+    {
+        for ( src = 0; src < WAKE_SOURCES; src++ )
+            total += data->bins[i][src];
+        if ( i < idx )
+            early += data->bins[i][WAKE_IRQ] + data->bins[i][WAKE_EVENT];
+    }
+    while ( idx > CPUIDLE_DRIVER_STATE_START && 2 * early > total )
+    {
+        idx--;
+        early -= data->bins[idx][WAKE_IRQ] + data->bins[idx][WAKE_EVENT];
+    }
+
+    /* Keep exit latencies small compared with the wakeup intervals. */
+    for ( ; idx > CPUIDLE_DRIVER_STATE_START; idx-- )
+    {
+        const struct acpi_processor_cx *cx = &power->states[idx];
+
+        if ( cx->latency * latency_multiplier[WAKE_IRQ] <=
+             wakeup_interval_us(data, WAKE_IRQ, now) &&
+             cx->latency * latency_multiplier[WAKE_EVENT] <=
+             wakeup_interval_us(data, WAKE_EVENT, now) )
+            break;
+    }
+
+    data->predicted_us = min(power->states[idx].target_residency,
+                             data->expected_us);
+    data->exit_us = power->states[idx].latency;
+
+    return idx;
+}
+
+static void teo_reflect(struct acpi_processor_power *power)
+{
+    struct teo_device *data = &this_cpu(teo_devices);
+    s_time_t now = NOW();
+    unsigned int measured_us = power->last_residency;
+    unsigned int i, bin = 0, src;
+
+    if ( now >= data->deadline )
+        src = WAKE_TIMER;
+    else if ( softirq_pending(smp_processor_id()) & (1u << SCHEDULE_SOFTIRQ) )
+        src = WAKE_EVENT;
+    else
+        src = WAKE_IRQ;
+
+    /* As in menu, assume the exit latency followed the wakeup event. */
+    if ( measured_us > data->exit_us )
+        measured_us -= data->exit_us;
+
+    for ( i = CPUIDLE_DRIVER_STATE_START; i < power->count; i++ )
+        if ( power->states[i].target_residency <= measured_us )
+            bin = i;
+
+    for ( i = 0; i < power->count; i++ )
+    {
+        unsigned int s;
+
+        for ( s = 0; s < WAKE_SOURCES; s++ )
+            data->bins[i][s] -= data->bins[i][s] >> DECAY_SHIFT;
+    }
+    data->bins[bin][src] += RESOLUTION >> DECAY_SHIFT;
+
+    if ( src == WAKE_TIMER )
+        return;
+
+    if ( data->last_wakeup[src] )
+    {
+        s_time_t interval = (now - data->last_wakeup[src]) / 1000;
+
+        if ( interval > MAX_INTERVAL_US )
+            interval = MAX_INTERVAL_US;
+        data->interval_us[src] -= data->interval_us[src] >> DECAY_SHIFT;
+        data->interval_us[src] += interval >> DECAY_SHIFT;
+    }
+    else
+        data->interval_us[src] = MAX_INTERVAL_US;
+    data->last_wakeup[src] = now;
+}
+
+static int teo_enable_device(struct acpi_processor_power *power)
+{
+    if ( !cpu_online(power->cpu) )
+        return -1;
+
+    memset(&per_cpu(teo_devices, power->cpu), 0, sizeof(struct teo_device));
+
+    return 0;
+}
+
+static void teo_get_trace_data(u32 *expected, u32 *pred)
+{
+    const struct teo_device *data = &this_cpu(teo_devices);
+
+    *expected = data->expected_us;
+    *pred = data->predicted_us;
+}
+
+static struct cpuidle_governor teo_governor =
+{
+    .name =         "teo",
+    .rating =       30,
+    .enable =       teo_enable_device,
+    .select =       teo_select,
+    .reflect =      teo_reflect,
+    .get_trace_data = teo_get_trace_data,
+};
+
+static void __init parse_cpuidle_governor(const char *s)
+{
+    if ( !strcmp(s, teo_governor.name) )
+        cpuidle_current_governor = &teo_governor;
+    else if ( strcmp(s, "menu") )
+        printk(XENLOG_WARNING "Unknown cpuidle governor '%s'\n", s);
+}
+custom_param("cpuidle_governor", parse_cpuidle_governor);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
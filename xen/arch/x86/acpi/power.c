@@ -229,10 +229,12 @@ static int enter_state(u32 state)
 
     system_state = SYS_STATE_resume;
 
-    /* Restore CR4 and EFER from cached values. */
+    /* Restore CR4, EFER and TSC_AUX from cached values. */
     cr4 = read_cr4();
     write_cr4(cr4 & ~X86_CR4_MCE);
     write_efer(read_efer());
+    if ( cpu_has_rdtscp )
+        wrmsr(MSR_TSC_AUX, this_cpu(tsc_aux), 0);
 
     device_power_up(SAVED_ALL);
 
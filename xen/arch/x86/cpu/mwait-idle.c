@@ -690,13 +690,15 @@ static void mwait_idle(void)
 	u32 exp = 0, pred = 0, irq_traced[4] = { 0 };
 
 	if (max_cstate > 0 && power && !sched_has_urgent_vcpu() &&
-	    (next_state = cpuidle_current_governor->select(power)) > 0) {
+	    (next_state = cpuidle_cpu_is_free() ? power->count - 1
+			  : cpuidle_current_governor->select(power)) > 0) {
 		do {
 			cx = &power->states[next_state];
 		} while (cx->type > max_cstate && --next_state);
 		if (!next_state)
 			cx = NULL;
-		menu_get_trace_data(&exp, &pred);
+		if (cpuidle_current_governor->get_trace_data)
+			cpuidle_current_governor->get_trace_data(&exp, &pred);
 	}
 	if (!cx) {
 		if (pm_idle_save)
@@ -0,0 +1,432 @@
+/******************************************************************************
+ * pmusample.c
+ *
+ * Statistical profiling of Xen and of one domain's guest context through the
+ * host PMU.  General purpose counter 0 is programmed to overflow every
+ * @period events and to raise an NMI, whose handler appends the interrupted
+ * context - the instruction pointer, and for Xen the frame pointer call
+ * chain - to a ring private to the CPU.  Only the NMI handler produces
+ * records and only XEN_SYSCTL_PMUSAMPLE_read (under pmusample_lock)
+ * consumes them, so the rings need no locking.
+ *
+ * The PMU is claimed as a whole, excluding xenoprof, the NMI watchdog and
+ * guest vPMUs for the duration of a session.
+ */
+
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/smp.h>
+#include <xen/percpu.h>
+#include <xen/spinlock.h>
+#include <xen/guest_access.h>
+#include <xen/xenoprof.h>
+#include <xen/nmi.h>
+#include <asm/apic.h>
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <asm/regs.h>
+#include <asm/vpmu.h>
+#include <asm/pmusample.h>
+#include <asm/hvm/hvm.h>
+#include <public/pmu.h>
+
+#define PMUSAMPLE_RING_SIZE  1024        /* records per CPU, power of 2 */
+#define PMUSAMPLE_MIN_PERIOD 10000
+
+#define EVNTSEL_USR          (1u << 16)
+#define EVNTSEL_OS           (1u << 17)
+#define EVNTSEL_INT          (1u << 20)
+#define EVNTSEL_EN           (1u << 22)
+
+struct pmusample_ring {
+    unsigned int prod, cons;
+    uint64_t lost;
+    bool_t started;
+    xen_sysctl_pmusample_rec_t *recs;
+};
+
+static DEFINE_PER_CPU(struct pmusample_ring, pmusample_ring);
+static DEFINE_PER_CPU(uint32_t, pmusample_saved_lvtpc);
+static DEFINE_PER_CPU(uint64_t, pmusample_saved_global_ctrl);
+
+static DEFINE_SPINLOCK(pmusample_lock);
+static bool_t pmusample_active;
+
+/* Parameters of the session, constant while it is active. */
+static unsigned int evntsel_msr, perfctr_msr, counter_width, perfmon_version;
+static uint64_t evntsel, period;
+static domid_t sample_domid;
+
+extern char svm_stgi_label[];
+
+static int pmusample_get_mode(struct vcpu *v, const struct cpu_user_regs *regs)
+{
+    struct segment_register ss;
+
+    if ( !guest_mode(regs) )
+        return XEN_SYSCTL_PMUSAMPLE_MODE_xen;
+
+    if ( !is_hvm_vcpu(v) )
+        return guest_kernel_mode(v, regs) ? XEN_SYSCTL_PMUSAMPLE_MODE_kernel
+                                          : XEN_SYSCTL_PMUSAMPLE_MODE_user;
+
+    switch ( hvm_guest_x86_mode(v) )
+    {
+    case 0: /* real mode */
+        return XEN_SYSCTL_PMUSAMPLE_MODE_kernel;
+    case 1: /* vm86 mode */
+        return XEN_SYSCTL_PMUSAMPLE_MODE_user;
+    }
+
+    hvm_get_segment_register(v, x86_seg_ss, &ss);
+
+    return (ss.sel & 3) != 3 ? XEN_SYSCTL_PMUSAMPLE_MODE_kernel
+                             : XEN_SYSCTL_PMUSAMPLE_MODE_user;
+}
+
+/*
+ * Walk the Xen call chain of the interrupted context, in the same manner as
+ * _show_trace(), filling @ip from index 1.  Returns the resulting depth.
+ */
+static unsigned int pmusample_backtrace(const struct cpu_user_regs *regs,
+                                        uint64_t *ip)
+{
+    unsigned int depth = 1;
+#ifdef CONFIG_FRAME_POINTER
+    unsigned long *frame, next = regs->rbp, addr;
+    unsigned long low = regs->rsp, high = get_stack_trace_bottom(regs->rsp);
+
+    while ( depth < XEN_SYSCTL_PMUSAMPLE_DEPTH )
+    {
+        if ( (next < low) || (next >= high) )
+        {
+            /* Exception frames are denoted by an inverted frame pointer. */
+            next = ~next;
+            if ( (next < low) || (next >= high) )
+                break;
+            frame = (unsigned long *)next;
+            next  = frame[0];
+            addr  = frame[(offsetof(struct cpu_user_regs, rip) -
+                           offsetof(struct cpu_user_regs, rbp))
+                         / BYTES_PER_LONG];
+        }
+        else
+        {
+            frame = (unsigned long *)next;
+            next  = frame[0];
+            addr  = frame[1];
+        }
+
+        if ( !is_kernel_text(addr) )
+            break;
+
+        ip[depth++] = addr;
+        low = (unsigned long)&frame[2];
+    }
+#endif
+
+    return depth;
+}
+
+static void pmusample_log(struct pmusample_ring *ring,
+                          const struct cpu_user_regs *regs, unsigned int cpu)
+{
+    struct vcpu *curr = current;
+    xen_sysctl_pmusample_rec_t *rec;
+    unsigned int prod = ring->prod;
+    int mode;
+
+    /* An NMI taken between VMRUN and STGI belongs to the SVM guest. */
+    if ( !guest_mode(regs) && regs->rip == (unsigned long)svm_stgi_label )
+        regs = guest_cpu_user_regs();
+
+    mode = pmusample_get_mode(curr, regs);
+    if ( mode != XEN_SYSCTL_PMUSAMPLE_MODE_xen &&
+         curr->domain->domain_id != sample_domid )
+        return;
+
+    if ( prod - read_atomic(&ring->cons) >= PMUSAMPLE_RING_SIZE )
+    {
+        ring->lost++;
+        return;
+    }
+
+    rec = &ring->recs[prod & (PMUSAMPLE_RING_SIZE - 1)];
+    rec->time = NOW();
+    rec->cpu = cpu;
+    rec->domid = curr->domain->domain_id;
+    rec->vcpu = curr->vcpu_id;
+    rec->mode = mode;
+    rec->ip[0] = regs->rip;
+    rec->depth = mode == XEN_SYSCTL_PMUSAMPLE_MODE_xen
+                 ? pmusample_backtrace(regs, rec->ip) : 1;
+
+    smp_wmb();
+    write_atomic(&ring->prod, prod + 1);
+}
+
+static int pmusample_nmi(const struct cpu_user_regs *regs, int cpu)
+{
+    struct pmusample_ring *ring = &this_cpu(pmusample_ring);
+    uint64_t val;
+
+    if ( !ring->started )
+        return 0;
+
+    rdmsrl(perfctr_msr, val);
+    /* The counter starts at -@period, so its top bit clears on overflow. */
+    if ( val & (1ULL << (counter_width - 1)) )
+        return 0;
+
+    pmusample_log(ring, regs, cpu);
+
+    wrmsrl(perfctr_msr, -period);
+    if ( perfmon_version >= 2 )
+        wrmsrl(MSR_CORE_PERF_GLOBAL_OVF_CTRL, 1);
+    /* Intel masks LVTPC on delivery of a PMI. */
+    apic_write(APIC_LVTPC, APIC_DM_NMI);
+
+    return 1;
+}
+
+static void pmusample_cpu_start(void *unused)
+{
+    struct pmusample_ring *ring = &this_cpu(pmusample_ring);
+
+    /* CPUs brought up since the rings were allocated are not sampled. */
+    if ( !ring->recs )
+        return;
+
+    wrmsrl(evntsel_msr, 0);
+    wrmsrl(perfctr_msr, -period);
+    if ( perfmon_version >= 2 )
+    {
+        rdmsrl(MSR_CORE_PERF_GLOBAL_CTRL, this_cpu(pmusample_saved_global_ctrl));
+        wrmsrl(MSR_CORE_PERF_GLOBAL_CTRL,
+               this_cpu(pmusample_saved_global_ctrl) | 1);
+    }
+
+    this_cpu(pmusample_saved_lvtpc) = apic_read(APIC_LVTPC);
+    apic_write(APIC_LVTPC, APIC_DM_NMI);
+
+    ring->started = 1;
+    wrmsrl(evntsel_msr, evntsel);
+}
+
+static void pmusample_cpu_stop(void *unused)
+{
+    struct pmusample_ring *ring = &this_cpu(pmusample_ring);
+    uint32_t v;
+
+    if ( !ring->started )
+        return;
+
+    wrmsrl(evntsel_msr, 0);
+    ring->started = 0;
+    if ( perfmon_version >= 2 )
+        wrmsrl(MSR_CORE_PERF_GLOBAL_CTRL,
+               this_cpu(pmusample_saved_global_ctrl));
+
+    /* As in nmi_cpu_stop(), the original LVTPC may raise an APIC error. */
+    v = apic_read(APIC_LVTERR);
+    apic_write(APIC_LVTERR, v | APIC_LVT_MASKED);
+    apic_write(APIC_LVTPC, this_cpu(pmusample_saved_lvtpc));
+    apic_write(APIC_LVTERR, v);
+}
+
+/* Pick the counter MSRs and event encoding for this CPU. */
+static int pmusample_setup(uint32_t event)
+{
+    switch ( boot_cpu_data.x86_vendor )
+    {
+    case X86_VENDOR_INTEL:
+    {
+        unsigned int eax, ebx, ecx, edx;
+
+        if ( !cpu_has_arch_perfmon )
+            return -EOPNOTSUPP;
+
+        cpuid(0xa, &eax, &ebx, &ecx, &edx);
+        perfmon_version = eax & 0xff;
+        counter_width = (eax >> 16) & 0xff;
+        /* EBX flags events which are unavailable. */
+        if ( !perfmon_version || ((eax >> 8) & 0xff) < 1 ||
+             (ebx & (1u << event)) )
+            return -EOPNOTSUPP;
+        evntsel_msr = MSR_P6_EVNTSEL(0);
+        perfctr_msr = MSR_P6_PERFCTR(0);
+        evntsel = event == XEN_SYSCTL_PMUSAMPLE_EVENT_cycles ? 0x3c : 0xc0;
+        break;
+    }
+
+    case X86_VENDOR_AMD:
+        perfmon_version = 0;
+        counter_width = 48;
+        evntsel_msr = MSR_K7_EVNTSEL0;
+        perfctr_msr = MSR_K7_PERFCTR0;
+        evntsel = event == XEN_SYSCTL_PMUSAMPLE_EVENT_cycles ? 0x76 : 0xc0;
+        break;
+
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    evntsel |= EVNTSEL_USR | EVNTSEL_OS | EVNTSEL_INT | EVNTSEL_EN;
+
+    return 0;
+}
+
+static int pmusample_start(const xen_sysctl_pmusample_op_t *op)
+{
+    unsigned int cpu;
+    int rc;
+
+    if ( pmusample_active )
+        return -EBUSY;
+
+    if ( op->event > XEN_SYSCTL_PMUSAMPLE_EVENT_instructions ||
+         op->period < PMUSAMPLE_MIN_PERIOD || op->period > INT_MAX )
+        return -EINVAL;
+
+    rc = pmusample_setup(op->event);
+    if ( rc )
+        return rc;
+
+    /* Dom0 profiling through vPMU drives the PMU itself. */
+    if ( vpmu_mode & (XENPMU_MODE_HV | XENPMU_MODE_ALL) )
+        return -EBUSY;
+
+    if ( !acquire_pmu_ownership(PMU_OWNER_PMUSAMPLE) )
+        return -EBUSY;
+
+    if ( reserve_lapic_nmi() )
+    {
+        release_pmu_ownership(PMU_OWNER_PMUSAMPLE);
+        return -EBUSY;
+    }
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+    {
+        struct pmusample_ring *ring = &per_cpu(pmusample_ring, cpu);
+
+        ring->prod = ring->cons = 0;
+        ring->lost = 0;
+
+        if ( !ring->recs && cpu_online(cpu) )
+            ring->recs = xmalloc_array(xen_sysctl_pmusample_rec_t,
+                                       PMUSAMPLE_RING_SIZE);
+        if ( !ring->recs && cpu_online(cpu) )
+        {
+            release_lapic_nmi();
+            release_pmu_ownership(PMU_OWNER_PMUSAMPLE);
+            return -ENOMEM;
+        }
+    }
+
+    period = op->period;
+    sample_domid = op->domid;
+
+    set_nmi_callback(pmusample_nmi);
+    /* Ensure the callback is set before any counter can overflow. */
+    smp_wmb();
+    on_each_cpu(pmusample_cpu_start, NULL, 1);
+
+    pmusample_active = 1;
+
+    return 0;
+}
+
+static void pmusample_stop(void)
+{
+    if ( !pmusample_active )
+        return;
+
+    on_each_cpu(pmusample_cpu_stop, NULL, 1);
+    unset_nmi_callback();
+    release_lapic_nmi();
+    release_pmu_ownership(PMU_OWNER_PMUSAMPLE);
+
+    pmusample_active = 0;
+}
+
+static int pmusample_read(xen_sysctl_pmusample_op_t *op)
+{
+    struct pmusample_ring *ring;
+    unsigned int prod, cons, n, copied = 0;
+
+    if ( op->cpu >= nr_cpu_ids )
+        return -EINVAL;
+
+    ring = &per_cpu(pmusample_ring, op->cpu);
+    if ( !ring->recs )
+        return -ENODATA;
+
+    prod = read_atomic(&ring->prod);
+    smp_rmb();
+
+    for ( cons = ring->cons; cons != prod && copied < op->nr_recs;
+          cons += n, copied += n )
+    {
+        unsigned int idx = cons & (PMUSAMPLE_RING_SIZE - 1);
+
+        /* Copy up to the end of the ring, or as much as fits. */
+        n = min(min(prod - cons, PMUSAMPLE_RING_SIZE - idx),
+                op->nr_recs - copied);
+        if ( copy_to_guest_offset(op->recs, copied, &ring->recs[idx], n) )
+            return -EFAULT;
+    }
+
+    /* The records must be copied before their slots are handed back. */
+    smp_mb();
+    write_atomic(&ring->cons, cons);
+
+    op->nr_recs = copied;
+    op->lost = ring->lost;
+
+    return 0;
+}
+
+/* Dom0 control of PMU sampling */
+int pmusample_control(xen_sysctl_pmusample_op_t *op)
+{
+    int rc = 0;
+
+    if ( op->pad )
+        return -EINVAL;
+
+    spin_lock(&pmusample_lock);
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_PMUSAMPLE_start:
+        rc = pmusample_start(op);
+        break;
+
+    case XEN_SYSCTL_PMUSAMPLE_stop:
+        pmusample_stop();
+        break;
+
+    case XEN_SYSCTL_PMUSAMPLE_read:
+        rc = pmusample_read(op);
+        break;
+
+    default:
+        rc = -EINVAL;
+        break;
+    }
+
+    spin_unlock(&pmusample_lock);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -37,6 +37,8 @@
 #include <xen/wait.h>
 #include <xen/guest_access.h>
 #include <xen/livepatch.h>
+#include <xen/sched-if.h>
+#include <xen/tasklet.h>
 #include <public/sysctl.h>
 #include <public/hvm/hvm_vcpu.h>
 #include <asm/regs.h>
@@ -118,7 +120,9 @@ static void idle_loop(void)
     {
         if ( cpu_is_offline(smp_processor_id()) )
             play_dead();
-        (*pm_idle)();
+        /* Scrub freed memory before going to sleep. */
+        if ( !scrub_free_pages() )
+            (*pm_idle)();
         do_tasklet();
         do_softirq();
         /*
@@ -618,6 +622,7 @@ int arch_domain_create(struct domain *d, unsigned int domcr_flags,
             d->arch.cpuids[i].input[0] = XEN_CPUID_INPUT_UNUSED;
             d->arch.cpuids[i].input[1] = XEN_CPUID_INPUT_UNUSED;
         }
+        domain_cpuid_update_index(d);
 
         d->arch.x86_vendor = boot_cpu_data.x86_vendor;
         d->arch.x86        = boot_cpu_data.x86;
@@ -647,6 +652,7 @@ int arch_domain_create(struct domain *d, unsigned int domcr_flags,
             goto fail;
     }
     spin_lock_init(&d->arch.e820_lock);
+    spin_lock_init(&d->arch.ioport_lock);
 
     if ( (rc = psr_domain_init(d)) != 0 )
         goto fail;
@@ -716,10 +722,82 @@ void arch_domain_destroy(struct domain *d)
 
     free_xenheap_page(d->shared_info);
     cleanup_domain_irq_mapping(d);
+    xfree(d->arch.ioport_bitmap);
 
     psr_domain_free(d);
 }
 
+/*
+ * ioport_caps is mirrored in a bitmap, so that the permission check on
+ * every trapped port access is a bit test instead of a rangeset walk.
+ */
+static int ioports_update_access(struct domain *d, unsigned long s,
+                                 unsigned long e, bool_t allow)
+{
+    unsigned long *map = d->arch.ioport_bitmap, i;
+    int rc;
+
+    if ( e >= MAX_IOPORTS )
+        return -EINVAL;
+
+    if ( !map && allow )
+    {
+        map = xzalloc_array(unsigned long, BITS_TO_LONGS(MAX_IOPORTS));
+        if ( !map )
+            return -ENOMEM;
+    }
+
+    spin_lock(&d->arch.ioport_lock);
+
+    if ( !d->arch.ioport_bitmap && map )
+        d->arch.ioport_bitmap = map;
+    else if ( map != d->arch.ioport_bitmap )
+    {
+        /* Raced with another grant, which allocated the bitmap first. */
+        xfree(map);
+        map = d->arch.ioport_bitmap;
+    }
+
+    rc = allow ? rangeset_add_range(d->arch.ioport_caps, s, e)
+               : rangeset_remove_range(d->arch.ioport_caps, s, e);
+
+    if ( !rc && map )
+        for ( i = s; i <= e; i++ )
+        {
+            if ( allow )
+                __set_bit(i, map);
+            else
+                __clear_bit(i, map);
+        }
+
+    spin_unlock(&d->arch.ioport_lock);
+
+    return rc;
+}
+
+int ioports_permit_access(struct domain *d, unsigned long s, unsigned long e)
+{
+    return ioports_update_access(d, s, e, 1);
+}
+
+int ioports_deny_access(struct domain *d, unsigned long s, unsigned long e)
+{
+    return ioports_update_access(d, s, e, 0);
+}
+
+bool_t ioports_access_permitted(const struct domain *d,
+                                unsigned long s, unsigned long e)
+{
+    const unsigned long *map = d->arch.ioport_bitmap;
+
+    ASSERT(s <= e);
+
+    if ( !map || e >= MAX_IOPORTS )
+        return 0;
+
+    return find_next_zero_bit(map, e + 1, s) > e;
+}
+
 void arch_domain_shutdown(struct domain *d)
 {
     if ( has_viridian_time_ref_count(d) )
@@ -738,7 +816,7 @@ void arch_domain_unpause(struct domain *d)
         viridian_time_ref_count_thaw(d);
 }
 
-int arch_domain_soft_reset(struct domain *d)
+int arch_domain_soft_reset(struct domain *d, unsigned int flags)
 {
     struct page_info *page = virt_to_page(d->shared_info), *new_page;
     int ret = 0;
@@ -751,7 +829,7 @@ int arch_domain_soft_reset(struct domain *d)
     if ( !has_hvm_container_domain(d) )
         return -EINVAL;
 
-    hvm_domain_soft_reset(d);
+    hvm_domain_soft_reset(d, flags & XEN_DOMCTL_SOFT_RESET_platform);
 
     spin_lock(&d->event_lock);
     for ( i = 0; i < d->nr_pirqs ; i++ )
@@ -1920,7 +1998,7 @@ static void paravirt_ctxt_switch_to(struct vcpu *v)
 
     if ( (v->domain->arch.tsc_mode ==  TSC_MODE_PVRDTSCP) &&
          boot_cpu_has(X86_FEATURE_RDTSCP) )
-        write_rdtscp_aux(v->domain->arch.incarnation);
+        wrmsr_tsc_aux(v->domain->arch.incarnation);
 }
 
 /* Update per-VCPU guest runstate shared memory area (if registered). */
@@ -2395,6 +2473,7 @@ static int relinquish_memory(
 
     /* Use a recursive lock, as we may enter 'free_domheap_page'. */
     spin_lock_recursive(&d->page_alloc_lock);
+    free_domheap_batch_begin();
 
     while ( (page = page_list_remove_head(list)) )
     {
@@ -2494,10 +2573,172 @@ static int relinquish_memory(
     page_list_move(list, &d->arch.relmem_list);
 
  out:
+    free_domheap_batch_end();
     spin_unlock_recursive(&d->page_alloc_lock);
     return ret;
 }
 
+/*
+ * HVM guest memory is relinquished by tasklets on up to this many CPUs, as
+ * well as by the domain_kill() continuation itself.
+ */
+static unsigned int __read_mostly opt_relinquish_workers = 16;
+integer_param("relinquish_workers", opt_relinquish_workers);
+
+struct relmem_worker {
+    struct tasklet tasklet;
+    struct domain *d;
+};
+
+#define RELMEM_CHUNK 256
+
+/*
+ * Relinquish a chunk of pages off the head of d->page_list.  Unlike
+ * relinquish_memory(), d->page_alloc_lock is only held while moving pages
+ * between lists, so that several CPUs can do this in parallel.  Pinned and
+ * page table pages are left on d->arch.relmem_list for the serial passes.
+ * Returns 0 once d->page_list is empty.
+ */
+static int relinquish_chunk(struct domain *d)
+{
+    PAGE_LIST_HEAD(chunk);
+    struct page_info *page;
+    unsigned long type;
+    unsigned int i;
+    bool_t allocated;
+
+    spin_lock_recursive(&d->page_alloc_lock);
+    for ( i = 0; i < RELMEM_CHUNK; i++ )
+    {
+        if ( !(page = page_list_remove_head(&d->page_list)) )
+            break;
+
+        /*
+         * Only pages we hold a reference to may leave the domain's lists
+         * while the lock is dropped: one losing its last reference elsewhere
+         * (e.g. a backend's grant mapping) would otherwise get freed, and
+         * unlinked from d->page_list or relmem_list, while on ours.
+         */
+        if ( unlikely(!get_page(page, d)) )
+            page_list_add_tail(page, &d->arch.relmem_list);
+        else
+            page_list_add_tail(page, &chunk);
+    }
+    spin_unlock_recursive(&d->page_alloc_lock);
+
+    if ( !i )
+        return 0;
+
+    free_domheap_batch_begin();
+
+    while ( (page = page_list_remove_head(&chunk)) )
+    {
+        spin_lock_recursive(&d->page_alloc_lock);
+
+        /* Pinned and page table pages need the full treatment. */
+        type = page->u.inuse.type_info;
+        if ( unlikely(type & PGT_pinned) ||
+             unlikely((type & PGT_type_mask) >= PGT_l1_page_table &&
+                      (type & PGT_type_mask) <= PGT_l4_page_table) )
+        {
+            page_list_add_tail(page, &d->arch.relmem_list);
+            spin_unlock_recursive(&d->page_alloc_lock);
+            put_page(page);
+            continue;
+        }
+
+        clear_superpage_mark(page);
+        allocated = test_and_clear_bit(_PGC_allocated, &page->count_info);
+
+        /* Put the page on the list and /then/ potentially free it. */
+        page_list_add_tail(page, &d->arch.relmem_list);
+        spin_unlock_recursive(&d->page_alloc_lock);
+
+        if ( allocated )
+            put_page(page);
+        put_page(page);
+    }
+
+    free_domheap_batch_end();
+
+    return 1;
+}
+
+static void relmem_worker_fn(unsigned long data)
+{
+    struct relmem_worker *w = (struct relmem_worker *)data;
+    struct domain *d = w->d;
+
+    if ( relinquish_chunk(d) )
+        tasklet_schedule(&w->tasklet);
+    else
+        atomic_dec(&d->arch.relmem_busy);
+}
+
+static void relmem_workers_free(struct domain *d)
+{
+    unsigned int i;
+
+    if ( !d->arch.relmem_workers )
+        return;
+
+    for ( i = 0; i < d->arch.nr_relmem_workers; i++ )
+        tasklet_kill(&d->arch.relmem_workers[i].tasklet);
+    xfree(d->arch.relmem_workers);
+    d->arch.relmem_workers = NULL;
+}
+
+/*
+ * Fan the relinquishing of d->page_list out to tasklets on other CPUs,
+ * idle ones first, and help them out from the calling CPU.  Returns
+ * -ERESTART until all of them are done.
+ */
+static int relinquish_memory_parallel(struct domain *d)
+{
+    struct relmem_worker *w;
+    unsigned int i, cpu, nr, pass, this_cpu = smp_processor_id();
+
+    if ( !d->arch.relmem_workers )
+    {
+        nr = min_t(unsigned int, opt_relinquish_workers, num_online_cpus() - 1);
+        if ( !nr )
+            return 0;
+
+        w = xzalloc_array(struct relmem_worker, nr);
+        if ( !w )
+            return 0;
+
+        d->arch.relmem_workers = w;
+        d->arch.nr_relmem_workers = nr;
+        atomic_set(&d->arch.relmem_busy, nr);
+
+        /* Idle CPUs first, then busy ones. */
+        for ( i = pass = 0; pass < 2; pass++ )
+            for_each_online_cpu ( cpu )
+            {
+                if ( i == nr || cpu == this_cpu ||
+                     is_idle_vcpu(curr_on_cpu(cpu)) != !pass )
+                    continue;
+                w[i].d = d;
+                idle_tasklet_init(&w[i].tasklet, relmem_worker_fn,
+                                  (unsigned long)&w[i]);
+                tasklet_schedule_on_cpu(&w[i].tasklet, cpu);
+                i++;
+            }
+
+        /* Should CPUs have gone offline meanwhile. */
+        d->arch.nr_relmem_workers = i;
+        atomic_sub(nr - i, &d->arch.relmem_busy);
+    }
+
+    if ( relinquish_chunk(d) || atomic_read(&d->arch.relmem_busy) )
+        return -ERESTART;
+
+    relmem_workers_free(d);
+
+    return 0;
+}
+
 int domain_relinquish_resources(struct domain *d)
 {
     int ret;
@@ -2572,6 +2813,22 @@ int domain_relinquish_resources(struct domain *d)
         ret = relinquish_memory(d, &d->xenpage_list, ~0UL);
         if ( ret )
             return ret;
+        d->arch.relmem = RELMEM_parallel;
+        /* fallthrough */
+
+    case RELMEM_parallel:
+        if ( is_hvm_domain(d) )
+        {
+            ret = relinquish_memory_parallel(d);
+            if ( ret )
+                return ret;
+
+            /* Leave whatever is left for the serial passes. */
+            spin_lock(&d->page_alloc_lock);
+            page_list_splice(&d->arch.relmem_list, &d->page_list);
+            INIT_PAGE_LIST_HEAD(&d->arch.relmem_list);
+            spin_unlock(&d->page_alloc_lock);
+        }
         d->arch.relmem = RELMEM_l4;
         /* fallthrough */
 
@@ -2620,9 +2877,38 @@ void arch_dump_vcpu_info(struct vcpu *v)
 {
     paging_dump_vcpu_info(v);
 
+    xstate_dump_vcpu_info(v);
+
     vpmu_dump(v);
 }
 
+/*
+ * Recalculate cpuid_index[] after cpuids[] changed.  A leaf gets indexed
+ * if the first cpuids[] entry for it, which is the one the search in
+ * domain_cpuid() would find, covers all subleaves.
+ */
+void domain_cpuid_update_index(struct domain *d)
+{
+    unsigned int i, leaf;
+
+    memset(d->arch.cpuid_index, 0, sizeof(d->arch.cpuid_index));
+
+    for ( i = MAX_CPUID_INPUT; i-- > 0; )
+    {
+        const cpuid_input_t *cpuid = &d->arch.cpuids[i];
+        unsigned int range = cpuid->input[0] >> 31;
+
+        leaf = cpuid->input[0] & ~0x80000000u;
+        if ( cpuid->input[0] == XEN_CPUID_INPUT_UNUSED ||
+             leaf >= CPUID_INDEX_LEAVES )
+            continue;
+
+        /* Walking backwards, so the first entry for the leaf wins. */
+        d->arch.cpuid_index[range][leaf] =
+            cpuid->input[1] == XEN_CPUID_INPUT_UNUSED ? i + 1 : 0;
+    }
+}
+
 void domain_cpuid(
     struct domain *d,
     unsigned int  input,
@@ -2633,9 +2919,13 @@ void domain_cpuid(
     unsigned int  *edx)
 {
     cpuid_input_t *cpuid;
-    int i;
+    unsigned int leaf = input & ~0x80000000u;
+    int i = 0;
+
+    if ( leaf < CPUID_INDEX_LEAVES )
+        i = d->arch.cpuid_index[input >> 31][leaf];
 
-    for ( i = 0; i < MAX_CPUID_INPUT; i++ )
+    for ( i = i ? i - 1 : 0; i < MAX_CPUID_INPUT; i++ )
     {
         cpuid = &d->arch.cpuids[i];
 
@@ -2682,7 +2972,21 @@ void vcpu_kick(struct vcpu *v)
 
 void vcpu_mark_events_pending(struct vcpu *v)
 {
-    int already_pending = test_and_set_bit(
+    int already_pending;
+
+    /*
+     * Many senders may target a vCPU which hasn't yet taken its upcall.
+     * Don't pull the cache line over with a locked operation then: all
+     * callers have just set a selector or READY bit with one, which orders
+     * this read after it, and the guest reads those after clearing the flag.
+     */
+    if ( read_atomic(&vcpu_info(v, evtchn_upcall_pending)) )
+    {
+        perfc_incr(evtchn_upcall_coalesced);
+        return;
+    }
+
+    already_pending = test_and_set_bit(
         0, (unsigned long *)&vcpu_info(v, evtchn_upcall_pending));
 
     if ( already_pending )
@@ -244,7 +244,6 @@ void arch_get_domain_info(const struct domain *d,
         info->flags |= XEN_DOMINF_hap;
 }
 
-#define MAX_IOPORTS 0x10000
 
 long arch_do_domctl(
     struct xen_domctl *domctl, struct domain *d,
@@ -507,7 +506,7 @@ long arch_do_domctl(
         domain_unpause(d);
 
         domctl->u.hvmcontext.size = c.cur;
-        if ( copy_to_guest(domctl->u.hvmcontext.buffer, c.data, c.size) != 0 )
+        if ( copy_to_guest(domctl->u.hvmcontext.buffer, c.data, c.cur) != 0 )
             ret = -EFAULT;
 
     gethvmcontext_out:
@@ -908,7 +907,10 @@ long arch_do_domctl(
             ret = -ENOENT;
 
         if ( !ret )
+        {
+            domain_cpuid_update_index(d);
             update_domain_cpuid_info(d, ctl);
+        }
 
         domain_unpause(d);
         break;
@@ -1209,6 +1211,25 @@ long arch_do_domctl(
         break;
 #endif /* P2M_AUDIT */
 
+    case XEN_DOMCTL_numa_migrate:
+        if ( d == currd )
+        {
+            ret = -EPERM;
+            break;
+        }
+        ret = p2m_numa_migrate(d, &domctl->u.numa_migrate);
+        if ( ret == -ERESTART )
+        {
+            if ( __copy_to_guest(u_domctl, domctl, 1) )
+                ret = -EFAULT;
+            else
+                ret = hypercall_create_continuation(__HYPERVISOR_domctl,
+                                                    "h", u_domctl);
+            break;
+        }
+        copyback = 1;
+        break;
+
     case XEN_DOMCTL_set_broken_page_p2m:
     {
         p2m_type_t pt;
@@ -1424,6 +1445,26 @@ long arch_do_domctl(
             copyback = 1;
             break;
 
+        case XEN_DOMCTL_PSR_CAT_OP_SET_MBA_THRTL:
+            ret = psr_set_mba_thrtl(d, domctl->u.psr_cat_op.target,
+                                    domctl->u.psr_cat_op.data);
+            break;
+
+        case XEN_DOMCTL_PSR_CAT_OP_GET_MBA_THRTL:
+            ret = psr_get_mba_thrtl(d, domctl->u.psr_cat_op.target,
+                                    &domctl->u.psr_cat_op.data);
+            copyback = 1;
+            break;
+
+        case XEN_DOMCTL_PSR_CAT_OP_SET_CLASS:
+            ret = psr_set_class(d, domctl->u.psr_cat_op.data);
+            break;
+
+        case XEN_DOMCTL_PSR_CAT_OP_GET_CLASS:
+            ret = psr_get_class(d, &domctl->u.psr_cat_op.data);
+            copyback = 1;
+            break;
+
         default:
             ret = -EOPNOTSUPP;
             break;
@@ -42,6 +42,11 @@ struct hpet_event_channel
     unsigned int cpu;   /* msi target */
     struct msi_desc msi;/* msi state */
     unsigned int flags; /* HPET_EVT_x */
+
+    /* Wakeups through this channel, and how late they were. */
+    unsigned long nr_wakeups;
+    s_time_t      total_delay;
+    s_time_t      max_delay;
 } __cacheline_aligned;
 static struct hpet_event_channel *__read_mostly hpet_events;
 
@@ -181,6 +186,12 @@ again:
 
     spin_unlock_irqrestore(&ch->lock, flags);
 
+    /*
+     * Order the above against reading ch->cpumask below: see the lockless
+     * check in hpet_broadcast_enter().
+     */
+    smp_mb();
+
     next_event = STIME_MAX;
     cpumask_clear(&mask);
     now = NOW();
@@ -197,7 +208,14 @@ again:
             continue;
 
         if ( deadline <= now )
+        {
             __cpumask_set_cpu(cpu, &mask);
+            /* Not serialised, which is good enough for statistics. */
+            ch->nr_wakeups++;
+            ch->total_delay += now - deadline;
+            if ( now - deadline > ch->max_delay )
+                ch->max_delay = now - deadline;
+        }
         else if ( deadline < next_event )
             next_event = deadline;
     }
@@ -438,7 +456,7 @@ static void __init hpet_fsb_cap_lookup(void)
 static struct hpet_event_channel *hpet_get_channel(unsigned int cpu)
 {
     static unsigned int next_channel;
-    unsigned int i, next;
+    unsigned int i, next, owner;
     struct hpet_event_channel *ch;
 
     if ( num_hpets_used == 0 )
@@ -464,7 +482,18 @@ static struct hpet_event_channel *hpet_get_channel(unsigned int cpu)
         }
     }
 
-    /* share a in-use channel */
+    /*
+     * Share an in-use channel, preferably one whose interrupt is delivered
+     * on the same node, where the wakeup IPIs it sends have less far to go.
+     */
+    for ( i = next; i < next + num_hpets_used; i++ )
+    {
+        ch = &hpet_events[i % num_hpets_used];
+        owner = read_atomic(&ch->cpu);
+        if ( owner < nr_cpu_ids && cpu_to_node(owner) == cpu_to_node(cpu) )
+            return ch;
+    }
+
     ch = &hpet_events[next];
     if ( !test_and_set_bit(HPET_EVT_USED_BIT, &ch->flags) )
         ch->cpu = cpu;
@@ -714,6 +743,15 @@ void hpet_broadcast_enter(void)
     disable_APIC_timer();
     cpumask_set_cpu(cpu, ch->cpumask);
 
+    /*
+     * If the channel is due to fire no later than this CPU's deadline
+     * anyway, there is nothing to reprogram: setting the bit above is a
+     * full barrier, so the handler (which sets next_event to STIME_MAX
+     * before scanning the mask) will find this CPU then.
+     */
+    if ( per_cpu(timer_deadline, cpu) >= read_atomic(&ch->next_event) )
+        return;
+
     spin_lock(&ch->lock);
     /* reprogram if current cpu expire time is nearer */
     if ( per_cpu(timer_deadline, cpu) < ch->next_event )
@@ -743,6 +781,22 @@ void hpet_broadcast_exit(void)
         hpet_detach_channel(cpu, ch);
 }
 
+void hpet_broadcast_dump(void)
+{
+    unsigned int i, n = num_hpets_used ?: hpet_broadcast_is_available();
+
+    for ( i = 0; i < n; i++ )
+    {
+        const struct hpet_event_channel *ch = &hpet_events[i];
+
+        printk("HPET%u: CPU%d, %u CPUs, %lu wakeups, delay avg %"PRI_stime
+               "ns max %"PRI_stime"ns\n", ch->idx, (int)ch->cpu,
+               cpumask_weight(ch->cpumask), ch->nr_wakeups,
+               ch->nr_wakeups ? ch->total_delay / ch->nr_wakeups : 0,
+               ch->max_delay);
+    }
+}
+
 int hpet_broadcast_is_available(void)
 {
     return ((hpet_events && (hpet_events->flags & HPET_EVT_LEGACY))
@@ -14,6 +14,7 @@
 #include <xen/lib.h>
 #include <xen/sched.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/trace.h>
 #include <asm/event.h>
 #include <asm/xstate.h>
@@ -1776,6 +1777,8 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
     unsigned long addr;
     int rc;
 
+    perfc_dom_incr(dom_emulations);
+
     if ( hvm_long_mode_enabled(curr) &&
          hvmemul_ctxt->seg_reg[x86_seg_cs].attr.fields.l )
     {
@@ -1814,6 +1817,7 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
         hvmemul_ctxt->insn_buf_bytes = vio->mmio_insn_bytes;
         memcpy(hvmemul_ctxt->insn_buf, vio->mmio_insn, vio->mmio_insn_bytes);
     }
+    hvmemul_ctxt->ctxt.insn_buf_bytes = hvmemul_ctxt->insn_buf_bytes;
 
     hvmemul_ctxt->exn_pending = 0;
     vio->mmio_retry = 0;
@@ -1885,6 +1889,262 @@ int hvm_emulate_one_no_write(
     return _hvm_emulate_one(hvmemul_ctxt, &hvm_emulate_ops_no_write);
 }
 
+/*
+ * Decode a MOV between a register and memory (opcodes 88-8B), allowing only
+ * operand size, segment override and REX prefixes.  Anything else, including
+ * address size overrides, is left to x86_emulate().
+ */
+static bool_t hvmemul_decode_mov(struct hvm_mmio_insn *mi,
+                                 const uint8_t *buf, unsigned int bytes)
+{
+    unsigned int i, rex = 0, opsz = 0, opc, modrm, mod, rm, sib;
+    int seg = -1;
+    int32_t disp32;
+
+    mi->rip_rel = 0;
+    mi->scale = 0;
+    mi->index = -1;
+    mi->disp = 0;
+
+    for ( i = 0; i < bytes; i++ )
+    {
+        switch ( buf[i] )
+        {
+        case 0x66: opsz = 1; continue;
+        case 0x26: seg = x86_seg_es; continue;
+        case 0x2e: seg = x86_seg_cs; continue;
+        case 0x36: seg = x86_seg_ss; continue;
+        case 0x3e: seg = x86_seg_ds; continue;
+        case 0x64: seg = x86_seg_fs; continue;
+        case 0x65: seg = x86_seg_gs; continue;
+        }
+        break;
+    }
+
+    if ( i < bytes && mi->addr_size == 64 && (buf[i] & 0xf0) == 0x40 )
+        rex = buf[i++];
+
+    if ( i + 2 > bytes )
+        return 0;
+    opc = buf[i++];
+    modrm = buf[i++];
+    mod = modrm >> 6;
+    rm = modrm & 7;
+    if ( (opc & ~3) != 0x88 || mod == 3 )
+        return 0;
+
+    mi->write = !(opc & 2);
+    mi->reg = ((modrm >> 3) & 7) | ((rex & 4) << 1);
+    mi->highbyte = 0;
+    if ( !(opc & 1) )
+    {
+        mi->size = 1;
+        mi->highbyte = !rex;
+    }
+    else
+        mi->size = (rex & 8) ? 8 : opsz ? 2 : 4;
+
+    mi->base = rm | ((rex & 1) << 3);
+    if ( rm == 4 )
+    {
+        if ( i >= bytes )
+            return 0;
+        sib = buf[i++];
+        mi->scale = sib >> 6;
+        mi->index = ((sib >> 3) & 7) | ((rex & 2) << 2);
+        if ( mi->index == 4 )
+            mi->index = -1;
+        mi->base = (sib & 7) | ((rex & 1) << 3);
+        if ( (sib & 7) == 5 && mod == 0 )
+        {
+            mi->base = -1;
+            mod = 2;
+        }
+    }
+    else if ( rm == 5 && mod == 0 )
+    {
+        mi->base = -1;
+        mi->rip_rel = (mi->addr_size == 64);
+        mod = 2;
+    }
+
+    if ( seg >= 0 )
+        mi->seg = seg;
+    else if ( mi->base >= 0 && ((mi->base & 7) == 4 || (mi->base & 7) == 5) )
+        mi->seg = x86_seg_ss;
+    else
+        mi->seg = x86_seg_ds;
+
+    if ( mod == 1 )
+    {
+        if ( i >= bytes )
+            return 0;
+        mi->disp = (int8_t)buf[i++];
+    }
+    else if ( mod == 2 )
+    {
+        if ( i + 4 > bytes )
+            return 0;
+        memcpy(&disp32, &buf[i], sizeof(disp32));
+        mi->disp = disp32;
+        i += 4;
+    }
+
+    if ( i > sizeof(mi->insn) )
+        return 0;
+    mi->len = i;
+
+    return 1;
+}
+
+/*
+ * Complete a plain MOV to or from MMIO without x86_emulate(), using the
+ * translation latched by handle_mmio_with_translation() and a per-vCPU
+ * cache of decoded instructions.  Returns X86EMUL_UNHANDLEABLE whenever
+ * the full emulator has to be used instead.
+ */
+int hvm_emulate_mmio_mov(
+    struct hvm_emulate_ctxt *hvmemul_ctxt)
+{
+    struct vcpu *curr = current;
+    struct hvm_vcpu_io *vio = &curr->arch.hvm_vcpu.hvm_io;
+    struct cpu_user_regs *regs = hvmemul_ctxt->ctxt.regs;
+    unsigned long cr3 = curr->arch.hvm_vcpu.guest_cr[3];
+    unsigned long ea, addr, data = 0, reps = 1;
+    uint32_t pfec = PFEC_page_present;
+    struct hvm_mmio_insn *mi;
+    struct segment_register *sreg;
+    uint8_t buf[16];
+    unsigned int addr_size, bytes;
+    bool_t hit;
+    void *reg;
+    int rc;
+
+    if ( !vio->mmio_access.gla_valid || vio->mmio_access.insn_fetch ||
+         hvmemul_ctxt->intr_shadow || (regs->eflags & X86_EFLAGS_TF) )
+        return X86EMUL_UNHANDLEABLE;
+
+    switch ( hvm_guest_x86_mode(curr) )
+    {
+    case 8: addr_size = 64; break;
+    case 4: addr_size = 32; break;
+    default: return X86EMUL_UNHANDLEABLE;
+    }
+
+    mi = &vio->mmio_insn_cache[regs->eip % ARRAY_SIZE(vio->mmio_insn_cache)];
+    hit = mi->rip == regs->eip && mi->cr3 == cr3 &&
+          mi->addr_size == addr_size;
+    if ( hit && !mi->len )
+        return X86EMUL_UNHANDLEABLE;
+
+    if ( vio->mmio_insn_bytes )
+    {
+        bytes = vio->mmio_insn_bytes;
+        memcpy(buf, vio->mmio_insn, bytes);
+    }
+    else if ( !(bytes = hvm_get_insn_bytes(curr, buf)) )
+    {
+        bytes = hit ? mi->len : sizeof(buf);
+        if ( hvmemul_ctxt->seg_reg[x86_seg_ss].attr.fields.dpl == 3 )
+            pfec |= PFEC_user_mode;
+        if ( !hvm_virtual_to_linear_addr(x86_seg_cs,
+                                         &hvmemul_ctxt->seg_reg[x86_seg_cs],
+                                         regs->eip, bytes,
+                                         hvm_access_insn_fetch, addr_size,
+                                         &addr) ||
+             hvm_fetch_from_guest_virt_nofault(buf, addr, bytes,
+                                               pfec) != HVMCOPY_okay )
+            return X86EMUL_UNHANDLEABLE;
+    }
+
+    if ( hit && (bytes < mi->len || memcmp(buf, mi->insn, mi->len)) )
+        hit = 0;
+
+    if ( hit )
+        perfc_incr(mmio_fast_hit);
+    else
+    {
+        perfc_incr(mmio_fast_miss);
+        mi->rip = regs->eip;
+        mi->cr3 = cr3;
+        mi->addr_size = addr_size;
+        if ( !hvmemul_decode_mov(mi, buf, bytes) )
+        {
+            mi->len = 0;
+            return X86EMUL_UNHANDLEABLE;
+        }
+        memcpy(mi->insn, buf, mi->len);
+    }
+
+    if ( mi->write ? !vio->mmio_access.write_access
+                   : (!vio->mmio_access.read_access ||
+                      vio->mmio_access.write_access) )
+        return X86EMUL_UNHANDLEABLE;
+
+    ea = (long)mi->disp;
+    if ( mi->rip_rel )
+        ea += regs->eip + mi->len;
+    if ( mi->base >= 0 )
+        ea += *(unsigned long *)decode_register(mi->base, regs, 0);
+    if ( mi->index >= 0 )
+        ea += *(unsigned long *)decode_register(mi->index, regs, 0) <<
+              mi->scale;
+    if ( addr_size == 32 )
+        ea = (uint32_t)ea;
+
+    sreg = hvmemul_get_seg_reg(mi->seg, hvmemul_ctxt);
+    if ( !hvm_virtual_to_linear_addr(mi->seg, sreg, ea, mi->size,
+                                     mi->write ? hvm_access_write
+                                               : hvm_access_read,
+                                     addr_size, &addr) ||
+         (addr & PAGE_MASK) != vio->mmio_gla ||
+         (addr & ~PAGE_MASK) + mi->size > PAGE_SIZE )
+        return X86EMUL_UNHANDLEABLE;
+
+    reg = decode_register(mi->reg, regs, mi->highbyte);
+    if ( mi->write )
+        memcpy(&data, reg, mi->size);
+
+    vio->mmio_retry = 0;
+    rc = hvmemul_do_mmio_buffer(pfn_to_paddr(vio->mmio_gpfn) |
+                                (addr & ~PAGE_MASK), &reps, mi->size,
+                                mi->write ? IOREQ_WRITE : IOREQ_READ, 0,
+                                &data);
+    switch ( rc )
+    {
+    case X86EMUL_OKAY:
+        break;
+    case X86EMUL_RETRY:
+        vio->mmio_insn_bytes = mi->len;
+        memcpy(vio->mmio_insn, mi->insn, mi->len);
+        /* fallthrough */
+    default:
+        return rc;
+    }
+
+    vio->mmio_cache_count = 0;
+    vio->mmio_insn_bytes = 0;
+
+    if ( !mi->write )
+    {
+        switch ( mi->size )
+        {
+        case 1: *(uint8_t *)reg = data; break;
+        case 2: *(uint16_t *)reg = data; break;
+        /* 32-bit loads zero-extend into the full register. */
+        case 4: *(unsigned long *)reg = (uint32_t)data; break;
+        default: *(unsigned long *)reg = data; break;
+        }
+    }
+
+    regs->eip += mi->len;
+    if ( addr_size == 32 )
+        regs->eip = (uint32_t)regs->eip;
+    regs->eflags &= ~X86_EFLAGS_RF;
+
+    return X86EMUL_OKAY;
+}
+
 int hvm_emulate_one_mmio(unsigned long mfn, unsigned long gla)
 {
     static const struct x86_emulate_ops hvm_intercept_ops_mmcfg = {
@@ -1981,6 +2241,8 @@ void hvm_emulate_prepare(
     hvmemul_ctxt->intr_shadow = hvm_funcs.get_interrupt_shadow(current);
     hvmemul_ctxt->ctxt.regs = regs;
     hvmemul_ctxt->ctxt.force_writeback = 1;
+    hvmemul_ctxt->ctxt.insn_buf = hvmemul_ctxt->insn_buf;
+    hvmemul_ctxt->ctxt.insn_buf_bytes = 0;
     hvmemul_ctxt->seg_reg_accessed = 0;
     hvmemul_ctxt->seg_reg_dirty = 0;
     hvmemul_ctxt->set_context = 0;
@@ -38,6 +38,7 @@
 #include <xen/vm_event.h>
 #include <xen/monitor.h>
 #include <xen/warning.h>
+#include <xen/lathist.h>
 #include <asm/shadow.h>
 #include <asm/hap.h>
 #include <asm/current.h>
@@ -436,10 +437,9 @@ void hvm_migrate_timers(struct vcpu *v)
     pt_migrate(v);
 }
 
-static int hvm_migrate_pirq(struct domain *d, struct hvm_pirq_dpci *pirq_dpci,
-                            void *arg)
+void hvm_migrate_pirq(struct hvm_pirq_dpci *pirq_dpci, const struct vcpu *v)
 {
-    struct vcpu *v = arg;
+    ASSERT(spin_is_locked(&v->domain->event_lock));
 
     if ( (pirq_dpci->flags & HVM_IRQ_DPCI_MACH_MSI) &&
          (pirq_dpci->gmsi.dest_vcpu_id == v->vcpu_id) )
@@ -448,11 +448,17 @@ static int hvm_migrate_pirq(struct domain *d, struct hvm_pirq_dpci *pirq_dpci,
             pirq_spin_lock_irq_desc(dpci_pirq(pirq_dpci), NULL);
 
         if ( !desc )
-            return 0;
+            return;
         ASSERT(MSI_IRQ(desc - irq_desc));
         irq_set_affinity(desc, cpumask_of(v->processor));
         spin_unlock_irq(&desc->lock);
     }
+}
+
+static int migrate_pirq(struct domain *d, struct hvm_pirq_dpci *pirq_dpci,
+                        void *arg)
+{
+    hvm_migrate_pirq(pirq_dpci, arg);
 
     return 0;
 }
@@ -465,10 +471,30 @@ void hvm_migrate_pirqs(struct vcpu *v)
        return;
 
     spin_lock(&d->event_lock);
-    pt_pirq_iterate(d, hvm_migrate_pirq, v);
+    pt_pirq_iterate(d, migrate_pirq, v);
     spin_unlock(&d->event_lock);
 }
 
+/*
+ * Emulate the current instruction as requested by a vm_event response or
+ * by the mem_access filter.
+ */
+static void hvm_vm_event_emulate(struct vcpu *v)
+{
+    enum emul_kind kind = EMUL_KIND_NORMAL;
+
+    if ( v->arch.vm_event->emulate_flags & VM_EVENT_FLAG_SET_EMUL_READ_DATA )
+        kind = EMUL_KIND_SET_CONTEXT;
+    else if ( v->arch.vm_event->emulate_flags &
+              VM_EVENT_FLAG_EMULATE_NOWRITE )
+        kind = EMUL_KIND_NOWRITE;
+
+    hvm_mem_access_emulate_one(kind, TRAP_invalid_op,
+                               HVM_DELIVER_NO_ERROR_CODE);
+
+    v->arch.vm_event->emulate_flags = 0;
+}
+
 void hvm_do_resume(struct vcpu *v)
 {
     check_wakeup_from_wait();
@@ -484,21 +510,7 @@ void hvm_do_resume(struct vcpu *v)
         struct monitor_write_data *w = &v->arch.vm_event->write_data;
 
         if ( unlikely(v->arch.vm_event->emulate_flags) )
-        {
-            enum emul_kind kind = EMUL_KIND_NORMAL;
-
-            if ( v->arch.vm_event->emulate_flags &
-                 VM_EVENT_FLAG_SET_EMUL_READ_DATA )
-                kind = EMUL_KIND_SET_CONTEXT;
-            else if ( v->arch.vm_event->emulate_flags &
-                      VM_EVENT_FLAG_EMULATE_NOWRITE )
-                kind = EMUL_KIND_NOWRITE;
-
-            hvm_mem_access_emulate_one(kind, TRAP_invalid_op,
-                                       HVM_DELIVER_NO_ERROR_CODE);
-
-            v->arch.vm_event->emulate_flags = 0;
-        }
+            hvm_vm_event_emulate(v);
 
         if ( w->do_write.msr )
         {
@@ -601,6 +613,8 @@ int hvm_domain_initialise(struct domain *d)
 
     spin_lock_init(&d->arch.hvm_domain.irq_lock);
     spin_lock_init(&d->arch.hvm_domain.uc_lock);
+    spin_lock_init(&d->arch.hvm_domain.vlapic_map_lock);
+    d->arch.hvm_domain.vlapic_map_dirty = 1;
     spin_lock_init(&d->arch.hvm_domain.write_map.lock);
     INIT_LIST_HEAD(&d->arch.hvm_domain.write_map.list);
 
@@ -726,6 +740,7 @@ void hvm_domain_destroy(struct domain *d)
     rtc_deinit(d);
     stdvga_deinit(d);
     vioapic_deinit(d);
+    vlapic_map_destroy(d);
 
     xfree(d->arch.hvm_domain.pl_time);
     d->arch.hvm_domain.pl_time = NULL;
@@ -1524,6 +1539,10 @@ int hvm_vcpu_initialise(struct vcpu *v)
     spin_lock_init(&v->arch.hvm_vcpu.tm_lock);
     INIT_LIST_HEAD(&v->arch.hvm_vcpu.tm_list);
 
+    rc = viridian_vcpu_init(v); /* teardown: viridian_vcpu_deinit */
+    if ( rc != 0 )
+        return rc;
+
     rc = hvm_vcpu_cacheattr_init(v); /* teardown: vcpu_cacheattr_destroy */
     if ( rc != 0 )
         goto fail1;
@@ -1587,6 +1606,7 @@ int hvm_vcpu_initialise(struct vcpu *v)
  fail2:
     hvm_vcpu_cacheattr_destroy(v);
  fail1:
+    viridian_vcpu_deinit(v);
     return rc;
 }
 
@@ -1988,6 +2008,11 @@ out:
 
         xfree(req_ptr);
     }
+    /* Violations settled by the mem_access filter are emulated right away. */
+    if ( unlikely(curr->arch.vm_event) &&
+         unlikely(curr->arch.vm_event->emulate_flags) &&
+         !atomic_read(&curr->vm_event_pause_count) )
+        hvm_vm_event_emulate(curr);
     return rc;
 }
 
@@ -3695,6 +3720,19 @@ int hvm_msr_read_intercept(unsigned int msr, uint64_t *msr_content)
     bool mtrr = false;
     int ret = X86EMUL_OKAY;
 
+    /* Guests may access these at very high rates: handle them first. */
+    if ( msr == MSR_IA32_TSC_DEADLINE )
+    {
+        *msr_content = vlapic_tdt_msr_get(vcpu_vlapic(v));
+        goto out;
+    }
+    if ( msr - MSR_IA32_APICBASE_MSR <= 0x3ff )
+    {
+        if ( hvm_x2apic_msr_read(v, msr, msr_content) )
+            goto gp_fault;
+        goto out;
+    }
+
     var_range_base = (uint64_t *)v->arch.hvm_vcpu.mtrr.var_ranges;
     fixed_range_base = (uint64_t *)v->arch.hvm_vcpu.mtrr.fixed_ranges;
 
@@ -3732,15 +3770,6 @@ int hvm_msr_read_intercept(unsigned int msr, uint64_t *msr_content)
         *msr_content = vcpu_vlapic(v)->hw.apic_base_msr;
         break;
 
-    case MSR_IA32_APICBASE_MSR ... MSR_IA32_APICBASE_MSR + 0x3ff:
-        if ( hvm_x2apic_msr_read(v, msr, msr_content) )
-            goto gp_fault;
-        break;
-
-    case MSR_IA32_TSC_DEADLINE:
-        *msr_content = vlapic_tdt_msr_get(vcpu_vlapic(v));
-        break;
-
     case MSR_IA32_CR_PAT:
         hvm_get_guest_pat(v, msr_content);
         break;
@@ -3861,6 +3890,19 @@ int hvm_msr_write_intercept(unsigned int msr, uint64_t msr_content,
         return X86EMUL_OKAY;
     }
 
+    /* Guests may write these at very high rates: handle them first. */
+    if ( msr == MSR_IA32_TSC_DEADLINE )
+    {
+        vlapic_tdt_msr_set(vcpu_vlapic(v), msr_content);
+        return X86EMUL_OKAY;
+    }
+    if ( msr - MSR_IA32_APICBASE_MSR <= 0x3ff )
+    {
+        if ( hvm_x2apic_msr_write(v, msr, msr_content) )
+            goto gp_fault;
+        return X86EMUL_OKAY;
+    }
+
     switch ( msr )
     {
         unsigned int eax, ebx, ecx, index;
@@ -3882,7 +3924,7 @@ int hvm_msr_write_intercept(unsigned int msr, uint64_t msr_content,
         v->arch.hvm_vcpu.msr_tsc_aux = (uint32_t)msr_content;
         if ( cpu_has_rdtscp
              && (v->domain->arch.tsc_mode != TSC_MODE_PVRDTSCP) )
-            wrmsrl(MSR_TSC_AUX, (uint32_t)msr_content);
+            wrmsr_tsc_aux(msr_content);
         break;
 
     case MSR_IA32_APICBASE:
@@ -3891,15 +3933,6 @@ int hvm_msr_write_intercept(unsigned int msr, uint64_t msr_content,
             goto gp_fault;
         break;
 
-    case MSR_IA32_TSC_DEADLINE:
-        vlapic_tdt_msr_set(vcpu_vlapic(v), msr_content);
-        break;
-
-    case MSR_IA32_APICBASE_MSR ... MSR_IA32_APICBASE_MSR + 0x3ff:
-        if ( hvm_x2apic_msr_write(v, msr, msr_content) )
-            goto gp_fault;
-        break;
-
     case MSR_IA32_CR_PAT:
         if ( !hvm_set_guest_pat(v, msr_content) )
            goto gp_fault;
@@ -4233,6 +4266,7 @@ int hvm_do_hypercall(struct cpu_user_regs *regs)
     struct segment_register sreg;
     int mode = hvm_guest_x86_mode(curr);
     uint32_t eax = regs->eax;
+    s_time_t start;
 
     switch ( mode )
     {
@@ -4264,6 +4298,7 @@ int hvm_do_hypercall(struct cpu_user_regs *regs)
     }
 
     curr->arch.hvm_vcpu.hcall_preempted = 0;
+    start = lathist_start();
 
     if ( mode == 8 )
     {
@@ -4360,6 +4395,9 @@ int hvm_do_hypercall(struct cpu_user_regs *regs)
     HVM_DBG_LOG(DBG_LEVEL_HCALL, "hcall%u -> %lx",
                 eax, (unsigned long)regs->eax);
 
+    lathist_hypercall(eax, start);
+    perfc_dom_incra(dom_hypercalls, eax);
+
     if ( curr->arch.hvm_vcpu.hcall_preempted )
         return HVM_HCALL_preempted;
 
@@ -4544,21 +4582,11 @@ void hvm_vcpu_reset_state(struct vcpu *v, uint16_t cs, uint16_t ip)
     domain_unlock(d);
 }
 
-static void hvm_s3_suspend(struct domain *d)
+/* Put every vCPU down and the emulated platform in its power-on state. */
+static void hvm_reset_platform(struct domain *d)
 {
     struct vcpu *v;
 
-    domain_pause(d);
-    domain_lock(d);
-
-    if ( d->is_dying || (d->vcpu == NULL) || (d->vcpu[0] == NULL) ||
-         test_and_set_bool(d->arch.hvm_domain.is_s3_suspended) )
-    {
-        domain_unlock(d);
-        domain_unpause(d);
-        return;
-    }
-
     for_each_vcpu ( d, v )
     {
         int rc;
@@ -4574,6 +4602,22 @@ static void hvm_s3_suspend(struct domain *d)
     rtc_reset(d);
     pmtimer_reset(d);
     hpet_reset(d);
+}
+
+static void hvm_s3_suspend(struct domain *d)
+{
+    domain_pause(d);
+    domain_lock(d);
+
+    if ( d->is_dying || (d->vcpu == NULL) || (d->vcpu[0] == NULL) ||
+         test_and_set_bool(d->arch.hvm_domain.is_s3_suspended) )
+    {
+        domain_unlock(d);
+        domain_unpause(d);
+        return;
+    }
+
+    hvm_reset_platform(d);
 
     hvm_vcpu_reset_state(d->vcpu[0], 0xf000, 0xfff0);
 
@@ -4698,26 +4742,60 @@ static int hvmop_inject_msi(
     return rc;
 }
 
-static int hvmop_flush_tlb_all(void)
+static DEFINE_PER_CPU(cpumask_t, flush_cpumask);
+
+/*
+ * Flush the TLBs of the vCPUs of the current domain selected by
+ * flush_vcpu().  With HAP only their ASIDs need invalidating, which takes
+ * effect at their next VM entry, so only running targets get interrupted
+ * and descheduled ones aren't disturbed at all.  Shadow paging also needs
+ * the targets' paging soft state (e.g. va->gfn cache, PAE PDPE cache)
+ * flushed, which requires them to be paused.  Returns 0 if the caller
+ * should retry.
+ */
+bool_t hvm_flush_vcpu_tlb(bool_t (*flush_vcpu)(void *ctxt, struct vcpu *v),
+                          void *ctxt)
 {
-    struct domain *d = current->domain;
-    struct vcpu *v;
+    struct vcpu *curr = current, *v;
+    struct domain *d = curr->domain;
+    cpumask_t *mask = &this_cpu(flush_cpumask);
 
-    if ( !is_hvm_domain(d) )
-        return -EINVAL;
+    if ( hap_enabled(d) )
+    {
+        cpumask_clear(mask);
+
+        for_each_vcpu ( d, v )
+        {
+            if ( !flush_vcpu(ctxt, v) )
+                continue;
+
+            hvm_asid_flush_vcpu(v);
+            if ( v != curr && v->is_running )
+                __cpumask_set_cpu(v->processor, mask);
+        }
+
+        /*
+         * Force the CPUs running targets out of non-root mode.  They may
+         * have rescheduled meanwhile, so some IPIs may be unnecessary.
+         */
+        if ( !cpumask_empty(mask) )
+            smp_send_event_check_mask(mask);
+
+        return 1;
+    }
 
     /* Avoid deadlock if more than one vcpu tries this at the same time. */
     if ( !spin_trylock(&d->hypercall_deadlock_mutex) )
-        return -ERESTART;
+        return 0;
 
-    /* Pause all other vcpus. */
+    /* Pause all other target vcpus. */
     for_each_vcpu ( d, v )
-        if ( v != current )
+        if ( v != curr && flush_vcpu(ctxt, v) )
             vcpu_pause_nosync(v);
 
     /* Now that all VCPUs are signalled to deschedule, we wait... */
     for_each_vcpu ( d, v )
-        if ( v != current )
+        if ( v != curr && flush_vcpu(ctxt, v) )
             while ( !vcpu_runnable(v) && v->is_running )
                 cpu_relax();
 
@@ -4726,17 +4804,31 @@ static int hvmop_flush_tlb_all(void)
 
     /* Flush paging-mode soft state (e.g., va->gfn cache; PAE PDPE cache). */
     for_each_vcpu ( d, v )
-        paging_update_cr3(v);
+        if ( flush_vcpu(ctxt, v) )
+            paging_update_cr3(v);
 
     /* Flush all dirty TLBs. */
     flush_tlb_mask(d->domain_dirty_cpumask);
 
     /* Done. */
     for_each_vcpu ( d, v )
-        if ( v != current )
+        if ( v != curr && flush_vcpu(ctxt, v) )
             vcpu_unpause(v);
 
-    return 0;
+    return 1;
+}
+
+static bool_t always_flush(void *ctxt, struct vcpu *v)
+{
+    return 1;
+}
+
+static int hvmop_flush_tlb_all(void)
+{
+    if ( !is_hvm_domain(current->domain) )
+        return -EINVAL;
+
+    return hvm_flush_vcpu_tlb(always_flush, NULL) ? 0 : -ERESTART;
 }
 
 static int hvmop_create_ioreq_server(
@@ -4892,7 +4984,8 @@ static int hvmop_set_ioreq_server_state(
     if ( rc != 0 )
         goto out;
 
-    rc = hvm_set_ioreq_server_state(d, op.id, !!op.enabled);
+    rc = hvm_set_ioreq_server_state(d, op.id, !!op.enabled,
+                                    !!(op.enabled & HVM_IOREQSRV_POLLING));
 
  out:
     rcu_unlock_domain(d);
@@ -5050,6 +5143,10 @@ static int hvmop_set_param(
         if ( (a.value & ~HVMPV_feature_mask) ||
              !(a.value & HVMPV_base_freq) )
             rc = -EINVAL;
+        /* Synthetic timers are driven off reference time and the SynIC. */
+        else if ( (a.value & HVMPV_stimer) &&
+                  (~a.value & (HVMPV_synic | HVMPV_time_ref_count)) )
+            rc = -EINVAL;
         break;
     case HVM_PARAM_IDENT_PT:
         /*
@@ -5996,9 +6093,22 @@ int hvm_set_mode(struct vcpu *v, int mode)
     return 0;
 }
 
-void hvm_domain_soft_reset(struct domain *d)
+void hvm_domain_soft_reset(struct domain *d, bool_t platform)
 {
+    struct vcpu *v;
+
     hvm_destroy_all_ioreq_servers(d);
+
+    if ( !platform )
+        return;
+
+    domain_lock(d);
+    hvm_reset_platform(d);
+    domain_unlock(d);
+
+    /* As after S3, restart guest time from zero. */
+    for_each_vcpu ( d, v )
+        hvm_set_guest_tsc(v, 0);
 }
 
 /*
@@ -89,7 +89,9 @@ int handle_mmio(void)
 
     hvm_emulate_prepare(&ctxt, guest_cpu_user_regs());
 
-    rc = hvm_emulate_one(&ctxt);
+    rc = hvm_emulate_mmio_mov(&ctxt);
+    if ( rc == X86EMUL_UNHANDLEABLE )
+        rc = hvm_emulate_one(&ctxt);
 
     if ( hvm_vcpu_io_need_completion(vio) || vio->mmio_retry )
         vio->io_completion = HVMIO_mmio_completion;
@@ -496,7 +496,10 @@ static void hvm_ioreq_server_free_rangesets(struct hvm_ioreq_server *s,
         return;
 
     for ( i = 0; i < NR_IO_RANGE_TYPES; i++ )
+    {
         rangeset_destroy(s->range[i]);
+        rangeset_destroy(s->posted[i]);
+    }
 }
 
 static int hvm_ioreq_server_alloc_rangesets(struct hvm_ioreq_server *s,
@@ -510,13 +513,13 @@ static int hvm_ioreq_server_alloc_rangesets(struct hvm_ioreq_server *s,
 
     for ( i = 0; i < NR_IO_RANGE_TYPES; i++ )
     {
+        const char *type = (i == HVMOP_IO_RANGE_PORT) ? "port" :
+                           (i == HVMOP_IO_RANGE_MEMORY) ? "memory" :
+                           (i == HVMOP_IO_RANGE_PCI) ? "pci" :
+                           "";
         char *name;
 
-        rc = asprintf(&name, "ioreq_server %d %s", s->id,
-                      (i == HVMOP_IO_RANGE_PORT) ? "port" :
-                      (i == HVMOP_IO_RANGE_MEMORY) ? "memory" :
-                      (i == HVMOP_IO_RANGE_PCI) ? "pci" :
-                      "");
+        rc = asprintf(&name, "ioreq_server %d %s", s->id, type);
         if ( rc )
             goto fail;
 
@@ -530,6 +533,25 @@ static int hvm_ioreq_server_alloc_rangesets(struct hvm_ioreq_server *s,
             goto fail;
 
         rangeset_limit(s->range[i], MAX_NR_IO_RANGES);
+
+        /* Config space writes are never posted. */
+        if ( i == HVMOP_IO_RANGE_PCI )
+            continue;
+
+        rc = asprintf(&name, "ioreq_server %d posted %s", s->id, type);
+        if ( rc )
+            goto fail;
+
+        s->posted[i] = rangeset_new(s->domain, name,
+                                    RANGESETF_prettyprint_hex);
+
+        xfree(name);
+
+        rc = -ENOMEM;
+        if ( !s->posted[i] )
+            goto fail;
+
+        rangeset_limit(s->posted[i], MAX_NR_IO_RANGES);
     }
 
  done:
@@ -815,8 +837,11 @@ int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
                                      uint64_t end)
 {
     struct hvm_ioreq_server *s;
+    bool_t posted = !!(type & HVMOP_IO_RANGE_POSTED);
     int rc;
 
+    type &= ~HVMOP_IO_RANGE_POSTED;
+
     spin_lock_recursive(&d->arch.hvm_domain.ioreq_server.lock);
 
     rc = -ENOENT;
@@ -845,14 +870,18 @@ int hvm_map_io_range_to_ioreq_server(struct domain *d, ioservid_t id,
             }
 
             rc = -EINVAL;
-            if ( !r )
+            if ( !r || (posted && (!s->posted[type] || !s->bufioreq.va)) )
                 break;
 
             rc = -EEXIST;
             if ( rangeset_overlaps_range(r, start, end) )
                 break;
 
-            rc = rangeset_add_range(r, start, end);
+            rc = posted ? rangeset_add_range(s->posted[type], start, end) : 0;
+            if ( !rc )
+                rc = rangeset_add_range(r, start, end);
+            if ( rc && posted )
+                rc = rangeset_remove_range(s->posted[type], start, end) ?: rc;
             break;
         }
     }
@@ -869,6 +898,8 @@ int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
     struct hvm_ioreq_server *s;
     int rc;
 
+    type &= ~HVMOP_IO_RANGE_POSTED;
+
     spin_lock_recursive(&d->arch.hvm_domain.ioreq_server.lock);
 
     rc = -ENOENT;
@@ -905,6 +936,8 @@ int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
                 break;
 
             rc = rangeset_remove_range(r, start, end);
+            if ( !rc && s->posted[type] )
+                rc = rangeset_remove_range(s->posted[type], start, end);
             break;
         }
     }
@@ -914,8 +947,38 @@ int hvm_unmap_io_range_from_ioreq_server(struct domain *d, ioservid_t id,
     return rc;
 }
 
+static void hvm_ioreq_server_set_polling(struct hvm_ioreq_server *s,
+                                         bool_t polling)
+{
+    struct hvm_ioreq_vcpu *sv;
+    bool_t was_polling = s->polling;
+
+    s->polling = polling;
+    if ( polling || !was_polling )
+        return;
+
+    /*
+     * Requests raised while the emulator was polling went unsignalled, and
+     * it may be about to block: kick every event channel.  Pairs with the
+     * barriers in hvm_send_ioreq() and hvm_send_buffered_ioreq().
+     */
+    smp_mb();
+
+    spin_lock(&s->lock);
+
+    list_for_each_entry ( sv,
+                          &s->ioreq_vcpu_list,
+                          list_entry )
+        notify_via_xen_event_channel(s->domain, sv->ioreq_evtchn);
+
+    if ( s->bufioreq.va != NULL )
+        notify_via_xen_event_channel(s->domain, s->bufioreq_evtchn);
+
+    spin_unlock(&s->lock);
+}
+
 int hvm_set_ioreq_server_state(struct domain *d, ioservid_t id,
-                               bool_t enabled)
+                               bool_t enabled, bool_t polling)
 {
     struct list_head *entry;
     int rc;
@@ -945,6 +1008,8 @@ int hvm_set_ioreq_server_state(struct domain *d, ioservid_t id,
 
         domain_unpause(d);
 
+        hvm_ioreq_server_set_polling(s, enabled && polling);
+
         rc = 0;
         break;
     }
@@ -1201,7 +1266,36 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
     return d->arch.hvm_domain.default_ioreq_server;
 }
 
-static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
+/*
+ * Can this write be posted to @s's buffered ring rather than waiting for
+ * the emulator?
+ */
+static bool_t hvm_ioreq_posted(const struct hvm_ioreq_server *s,
+                               const ioreq_t *p)
+{
+    struct rangeset *r;
+
+    if ( p->dir != IOREQ_WRITE || p->data_is_ptr || p->count != 1 ||
+         !s->bufioreq.va )
+        return 0;
+
+    switch ( p->type )
+    {
+    case IOREQ_TYPE_PIO:
+        r = s->posted[HVMOP_IO_RANGE_PORT];
+        break;
+    case IOREQ_TYPE_COPY:
+        r = s->posted[HVMOP_IO_RANGE_MEMORY];
+        break;
+    default:
+        return 0;
+    }
+
+    return r && rangeset_contains_range(r, p->addr, p->addr + p->size - 1);
+}
+
+static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p,
+                                   bool_t posted)
 {
     struct domain *d = current->domain;
     struct hvm_ioreq_page *iorp;
@@ -1212,6 +1306,8 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
                        .dir = p->dir };
     /* Timeoffset sends 64b data, but no address. Use two consecutive slots. */
     int qw = 0;
+    /* Posted writes beyond 1MB carry the rest of the address in a slot. */
+    unsigned int ext = 0, nr;
 
     /* Ensure buffered_iopage fits in a page */
     BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
@@ -1230,9 +1326,17 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
      *  - the count field is usually used with data_is_ptr and since we don't
      *    support data_is_ptr we do not waste space for the count field either
      */
-    if ( (p->addr > 0xffffful) || p->data_is_ptr || (p->count != 1) )
+    if ( (!posted && (p->addr > 0xffffful)) || p->data_is_ptr ||
+         (p->count != 1) )
         return 0;
 
+    if ( p->addr > 0xffffful )
+    {
+        if ( p->addr >> 52 )
+            return X86EMUL_UNHANDLEABLE;
+        bp.pad = ext = 1;
+    }
+
     switch ( p->size )
     {
     case 1:
@@ -1253,10 +1357,12 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
         return X86EMUL_UNHANDLEABLE;
     }
 
+    nr = 1 + qw + ext;
+
     spin_lock(&s->bufioreq_lock);
 
-    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >=
-         (IOREQ_BUFFER_SLOT_NUM - qw) )
+    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >
+         (IOREQ_BUFFER_SLOT_NUM - nr) )
     {
         /* The queue is full: send the iopacket through the normal path. */
         spin_unlock(&s->bufioreq_lock);
@@ -1271,9 +1377,16 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
         pg->buf_ioreq[(pg->ptrs.write_pointer+1) % IOREQ_BUFFER_SLOT_NUM] = bp;
     }
 
+    if ( ext )
+    {
+        bp.data = p->addr >> 20;
+        pg->buf_ioreq[(pg->ptrs.write_pointer + 1 + qw) %
+                      IOREQ_BUFFER_SLOT_NUM] = bp;
+    }
+
     /* Make the ioreq_t visible /before/ write_pointer. */
     wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    pg->ptrs.write_pointer += nr;
 
     /* Canonicalize read/write pointers to prevent their overflow. */
     while ( s->bufioreq_atomic && qw++ < IOREQ_BUFFER_SLOT_NUM &&
@@ -1287,7 +1400,18 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
         cmpxchg(&pg->ptrs.full, old.full, new.full);
     }
 
-    notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    /*
+     * The consumer only needs waking if it had caught up with everything
+     * queued before: otherwise it is still draining the ring, or has yet to
+     * act on an earlier notification, and will pick these slots up as well.
+     * The barrier orders the write_pointer update above against the
+     * read_pointer read, pairing with the consumer's update of read_pointer
+     * before it re-reads write_pointer.
+     */
+    smp_mb();
+    if ( !s->polling &&
+         pg->ptrs.write_pointer - pg->ptrs.read_pointer <= nr )
+        notify_via_xen_event_channel(d, s->bufioreq_evtchn);
     spin_unlock(&s->bufioreq_lock);
 
     return X86EMUL_OKAY;
@@ -1303,7 +1427,12 @@ int hvm_send_ioreq(struct hvm_ioreq_server *s, ioreq_t *proto_p,
     ASSERT(s);
 
     if ( buffered )
-        return hvm_send_buffered_ioreq(s, proto_p);
+        return hvm_send_buffered_ioreq(s, proto_p, 0);
+
+    /* A posted write is complete once it is on the ring. */
+    if ( hvm_ioreq_posted(s, proto_p) &&
+         hvm_send_buffered_ioreq(s, proto_p, 1) == X86EMUL_OKAY )
+        return X86EMUL_OKAY;
 
     if ( unlikely(!vcpu_start_shutdown_deferral(curr)) )
         return X86EMUL_RETRY;
@@ -1343,7 +1472,11 @@ int hvm_send_ioreq(struct hvm_ioreq_server *s, ioreq_t *proto_p,
              * barrier.
              */
             p->state = STATE_IOREQ_READY;
-            notify_via_xen_event_channel(d, port);
+
+            /* Order the state update before the check for polling. */
+            smp_mb();
+            if ( !s->polling )
+                notify_via_xen_event_channel(d, port);
 
             sv->pending = 1;
             return X86EMUL_RETRY;
@@ -30,6 +30,12 @@
 #include <asm/vm_event.h>
 #include <public/vm_event.h>
 
+static inline bool_t hvm_monitor_recorded(const struct domain *d,
+                                           unsigned int event)
+{
+    return !!(d->arch.monitor.record_only & (1U << event));
+}
+
 bool_t hvm_monitor_cr(unsigned int index, unsigned long value, unsigned long old)
 {
     struct vcpu *curr = current;
@@ -49,6 +55,14 @@ bool_t hvm_monitor_cr(unsigned int index, unsigned long value, unsigned long old
             .u.write_ctrlreg.old_value = old
         };
 
+        /* A recorded write is not held back for the monitor to deny. */
+        if ( hvm_monitor_recorded(curr->domain,
+                                  XEN_DOMCTL_MONITOR_EVENT_WRITE_CTRLREG) )
+        {
+            monitor_record(curr, &req);
+            return 0;
+        }
+
         if ( monitor_traps(curr, sync, &req) >= 0 )
             return 1;
     }
@@ -93,6 +107,7 @@ int hvm_monitor_debug(unsigned long rip, enum hvm_monitor_debug_type type,
     struct vcpu *curr = current;
     struct arch_domain *ad = &curr->domain->arch;
     vm_event_request_t req = {};
+    unsigned int event;
     bool_t sync;
 
     switch ( type )
@@ -104,6 +119,7 @@ int hvm_monitor_debug(unsigned long rip, enum hvm_monitor_debug_type type,
         req.u.software_breakpoint.gfn = gfn_of_rip(rip);
         req.u.software_breakpoint.type = trap_type;
         req.u.software_breakpoint.insn_length = insn_length;
+        event = XEN_DOMCTL_MONITOR_EVENT_SOFTWARE_BREAKPOINT;
         sync = 1;
         break;
 
@@ -112,6 +128,7 @@ int hvm_monitor_debug(unsigned long rip, enum hvm_monitor_debug_type type,
             return 0;
         req.reason = VM_EVENT_REASON_SINGLESTEP;
         req.u.singlestep.gfn = gfn_of_rip(rip);
+        event = XEN_DOMCTL_MONITOR_EVENT_SINGLESTEP;
         sync = 1;
         break;
 
@@ -122,6 +139,7 @@ int hvm_monitor_debug(unsigned long rip, enum hvm_monitor_debug_type type,
         req.u.debug_exception.gfn = gfn_of_rip(rip);
         req.u.debug_exception.type = trap_type;
         req.u.debug_exception.insn_length = insn_length;
+        event = XEN_DOMCTL_MONITOR_EVENT_DEBUG_EXCEPTION;
         sync = !!ad->monitor.debug_exception_sync;
         break;
 
@@ -129,6 +147,12 @@ int hvm_monitor_debug(unsigned long rip, enum hvm_monitor_debug_type type,
         return -EOPNOTSUPP;
     }
 
+    if ( hvm_monitor_recorded(curr->domain, event) )
+    {
+        monitor_record(curr, &req);
+        return 0;
+    }
+
     return monitor_traps(curr, sync, &req);
 }
 
@@ -172,6 +172,39 @@ static void rtc_timer_update(RTCState *s)
     }
 }
 
+/*
+ * Without RTC_UIE or RTC_AIE set, no timer is armed to raise REG_C.UF or
+ * REG_C.AF: the guest can only tell by looking at REG_C, so the flags are
+ * set when it does, if the update cycle or the alarm time has since
+ * passed.  Idle guests with those interrupts masked thus cost no timer
+ * wakeups at all.
+ */
+static void check_for_uf_af(RTCState *s)
+{
+    s_time_t now;
+
+    ASSERT(spin_is_locked(&s->lock));
+
+    if ( s->hw.cmos_data[RTC_REG_B] & RTC_SET )
+        return;
+
+    now = NOW();
+
+    if ( !(s->hw.cmos_data[RTC_REG_B] & RTC_UIE) && s->next_update_time &&
+         now >= s->next_update_time + 244000UL )
+    {
+        s->hw.cmos_data[RTC_REG_C] |= RTC_UF;
+        s->next_update_time = 0;
+    }
+
+    if ( !(s->hw.cmos_data[RTC_REG_B] & RTC_AIE) && s->next_alarm_time &&
+         now >= s->next_alarm_time )
+    {
+        s->hw.cmos_data[RTC_REG_C] |= RTC_AF;
+        s->next_alarm_time = 0;
+    }
+}
+
 /* handle update-ended timer */
 static void check_update_timer(RTCState *s)
 {
@@ -183,17 +216,27 @@ static void check_update_timer(RTCState *s)
 
     ASSERT(spin_is_locked(&s->lock));
 
+    /* Any UIP from a timer armed so far is stale. */
+    if ( s->use_timer )
+        s->hw.cmos_data[RTC_REG_A] &= ~RTC_UIP;
+    s->use_timer = 0;
+    s->next_update_time = 0;
+
     if (!(s->hw.cmos_data[RTC_REG_C] & RTC_UF) &&
             !(s->hw.cmos_data[RTC_REG_B] & RTC_SET))
     {
-        s->use_timer = 1;
         guest_usec = get_localtime_us(d) % USEC_PER_SEC;
         if (guest_usec >= (USEC_PER_SEC - 244))
         {
             /* RTC is in update cycle */
-            s->hw.cmos_data[RTC_REG_A] |= RTC_UIP;
             next_update_time = (USEC_PER_SEC - guest_usec) * NS_PER_USEC;
             expire_time = NOW() + next_update_time;
+            s->next_update_time = expire_time - 244000UL;
+            /* UF is left to check_for_uf_af() unless it raises an IRQ. */
+            if (!(s->hw.cmos_data[RTC_REG_B] & RTC_UIE))
+                return;
+            s->use_timer = 1;
+            s->hw.cmos_data[RTC_REG_A] |= RTC_UIP;
             /* release lock before set timer */
             spin_unlock(&s->lock);
             set_timer(&s->update_timer2, expire_time);
@@ -205,6 +248,9 @@ static void check_update_timer(RTCState *s)
             next_update_time = (USEC_PER_SEC - guest_usec - 244) * NS_PER_USEC;
             expire_time = NOW() + next_update_time;
             s->next_update_time = expire_time;
+            if (!(s->hw.cmos_data[RTC_REG_B] & RTC_UIE))
+                return;
+            s->use_timer = 1;
             /* release lock before set timer */
             spin_unlock(&s->lock);
             set_timer(&s->update_timer, expire_time);
@@ -212,8 +258,6 @@ static void check_update_timer(RTCState *s)
             spin_lock(&s->lock);
         }
     }
-    else
-        s->use_timer = 0;
 }
 
 static void rtc_update_timer(void *opaque)
@@ -256,6 +300,7 @@ static void alarm_timer_update(RTCState *s)
     ASSERT(spin_is_locked(&s->lock));
 
     stop_timer(&s->alarm_timer);
+    s->next_alarm_time = 0;
 
     if (!(s->hw.cmos_data[RTC_REG_C] & RTC_AF) &&
             !(s->hw.cmos_data[RTC_REG_B] & RTC_SET))
@@ -412,6 +457,10 @@ static void alarm_timer_update(RTCState *s)
             }
         }
         expire_time = (next_alarm_sec - 1) * NS_PER_SEC + next_update_time;
+        s->next_alarm_time = expire_time;
+        /* AF is left to check_for_uf_af() unless it raises an IRQ. */
+        if (!(s->hw.cmos_data[RTC_REG_B] & RTC_AIE))
+            return;
         /* release lock before set timer */
         spin_unlock(&s->lock);
         set_timer(&s->alarm_timer, expire_time);
@@ -510,6 +559,7 @@ static int rtc_ioport_write(void *opaque, uint32_t addr, uint32_t data)
                 rtc_set_time(s);
         }
         check_for_pf_ticks(s);
+        check_for_uf_af(s);
         s->hw.cmos_data[RTC_REG_B] = data;
         /*
          * If the interrupt is already set when the interrupt becomes
@@ -523,9 +573,9 @@ static int rtc_ioport_write(void *opaque, uint32_t addr, uint32_t data)
             s->period = 0;
             rtc_timer_update(s);
         }
-        if ( (data ^ orig) & RTC_SET )
+        if ( (data ^ orig) & (RTC_SET | RTC_UIE) )
             check_update_timer(s);
-        if ( (data ^ orig) & (RTC_24H | RTC_DM_BINARY | RTC_SET) )
+        if ( (data ^ orig) & (RTC_24H | RTC_DM_BINARY | RTC_SET | RTC_AIE) )
             alarm_timer_update(s);
         break;
     case RTC_REG_C:
@@ -677,6 +727,7 @@ static uint32_t rtc_ioport_read(RTCState *s, uint32_t addr)
         break;
     case RTC_REG_C:
         check_for_pf_ticks(s);
+        check_for_uf_af(s);
         ret = s->hw.cmos_data[s->hw.cmos_index];
         s->hw.cmos_data[RTC_REG_C] = 0x00;
         if ( ret & RTC_IRQF )
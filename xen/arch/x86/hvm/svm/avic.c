@@ -0,0 +1,519 @@
+/*
+ * avic.c: AMD Advanced Virtual Interrupt Controller.
+ *
+ * With AVIC the processor delivers interrupts straight from the vlapic's
+ * IRR (the backing page is vcpu_vlapic(v)->regs_page), accelerates most
+ * APIC register accesses, and lets one vCPU send a fixed IPI to another
+ * without a VM exit.  Xen's part is to keep the domain's physical and
+ * logical APIC ID tables pointing at the right backing pages and physical
+ * CPUs, and to emulate whatever the hardware hands back to us:
+ *
+ *  - VMEXIT_AVIC_INCOMPLETE_IPI for IPIs it couldn't (fully) deliver;
+ *  - VMEXIT_AVIC_NOACCEL for register accesses with side effects.
+ *
+ * An IOMMU in guest virtual APIC mode posts passed-through MSIs the same
+ * way, using the IRTEs on each vCPU's ga_list.  Those follow the vCPU's
+ * IsRunning state: a vCPU which isn't running gets a GA log entry instead,
+ * and svm_avic_ga_log() kicks it.
+ *
+ * Only xAPIC mode is supported: x2APIC is hidden from AVIC guests, and a
+ * vCPU whose vlapic leaves the default xAPIC setup falls back to plain
+ * emulation for good.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/config.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/domain_page.h>
+#include <xen/event.h>
+#include <asm/apicdef.h>
+#include <asm/msi.h>
+#include <asm/p2m.h>
+#include <asm/hvm/hvm.h>
+#include <asm/hvm/io.h>
+#include <asm/hvm/support.h>
+#include <asm/hvm/vlapic.h>
+#include <asm/hvm/svm/avic.h>
+#include <asm/hvm/svm/svm.h>
+#include <asm/hvm/svm/vmcb.h>
+#include <asm/hvm/svm/amd-iommu-proto.h>
+
+static bool_t __initdata opt_avic;
+boolean_param("avic", opt_avic);
+
+bool_t __read_mostly svm_avic;
+
+/* How often to look for a window for a blocked ExtINT or NMI. */
+#define AVIC_WINDOW_POLL MICROSECS(100)
+
+void __init svm_avic_init(void)
+{
+    svm_avic = opt_avic && cpu_has_svm_avic && cpu_has_svm_npt;
+}
+
+static void avic_set_phys_entry(struct vcpu *v)
+{
+    const struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    uint64_t *table = v->domain->arch.hvm_domain.svm.avic_physical_table;
+    uint64_t entry = 0;
+
+    if ( avic->phys_id < 0 )
+        return;
+
+    if ( avic->active )
+    {
+        entry = (page_to_maddr(vcpu_vlapic(v)->regs_page) &
+                 AVIC_PHYS_BACKING_MASK) | AVIC_PHYS_VALID;
+
+        /*
+         * A physical CPU the doorbell can't name still works, just with
+         * every IPI to us taking the not-running path.
+         */
+        if ( avic->running &&
+             cpu_physical_id(v->processor) <= AVIC_PHYS_HOST_ID_MASK )
+            entry |= AVIC_PHYS_IS_RUNNING | cpu_physical_id(v->processor);
+    }
+
+    write_atomic(&table[avic->phys_id], entry);
+}
+
+static void avic_set_running(struct vcpu *v, bool_t running)
+{
+    struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    const struct msi_desc *msi_desc;
+    unsigned int dest = cpu_physical_id(v->processor);
+    unsigned long flags;
+
+    avic->ga_stale = 0;
+    avic->running = running;
+    avic_set_phys_entry(v);
+
+    spin_lock_irqsave(&avic->ga_lock, flags);
+    list_for_each_entry ( msi_desc, &avic->ga_list, pi_list )
+        amd_iommu_ga_update(msi_desc, dest, running);
+    spin_unlock_irqrestore(&avic->ga_lock, flags);
+}
+
+/* Logical ID table index for an LDR/DFR pair, or -1 if it has none. */
+static int avic_logical_index(uint32_t ldr, uint32_t dfr)
+{
+    unsigned int id = GET_xAPIC_LOGICAL_ID(ldr), bits;
+
+    if ( dfr == APIC_DFR_FLAT )
+    {
+        /* One bit per vCPU: more than one can't be described. */
+        if ( !id || (id & (id - 1)) )
+            return -1;
+
+        return ffs(id) - 1;
+    }
+
+    /* Cluster mode: four entries for each of clusters 0-14. */
+    bits = id & 0xf;
+    if ( !bits || (bits & (bits - 1)) || (id >> 4) == 0xf )
+        return -1;
+
+    return ((id >> 4) << 2) + ffs(bits) - 1;
+}
+
+static void avic_update_tables(struct vcpu *v)
+{
+    struct svm_domain *svm = &v->domain->arch.hvm_domain.svm;
+    struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    const struct vlapic *vlapic = vcpu_vlapic(v);
+    uint32_t id = vlapic_get_reg(vlapic, APIC_ID);
+    uint32_t ldr = vlapic_get_reg(vlapic, APIC_LDR);
+    uint32_t dfr = vlapic_get_reg(vlapic, APIC_DFR);
+    int phys_id = GET_xAPIC_ID(id);
+
+    if ( likely(avic->phys_id >= 0) && id == avic->id &&
+         ldr == avic->ldr && dfr == avic->dfr )
+        return;
+
+    spin_lock(&svm->avic_lock);
+
+    if ( avic->phys_id != phys_id )
+    {
+        if ( avic->phys_id >= 0 )
+            write_atomic(&svm->avic_physical_table[avic->phys_id], 0);
+        avic->phys_id = phys_id;
+        avic_set_phys_entry(v);
+    }
+
+    /* Only drop the old logical entry if nobody else has claimed it since. */
+    if ( avic->logical_idx >= 0 &&
+         (svm->avic_logical_table[avic->logical_idx] &
+          AVIC_LOGICAL_GUEST_ID_MASK) == GET_xAPIC_ID(avic->id) )
+        write_atomic(&svm->avic_logical_table[avic->logical_idx], 0);
+
+    avic->logical_idx = avic_logical_index(ldr, dfr);
+    if ( avic->logical_idx >= 0 )
+        write_atomic(&svm->avic_logical_table[avic->logical_idx],
+                     phys_id | AVIC_LOGICAL_VALID);
+
+    avic->id = id;
+    avic->ldr = ldr;
+    avic->dfr = dfr;
+
+    spin_unlock(&svm->avic_lock);
+}
+
+static void avic_vcpu_deactivate(struct vcpu *v)
+{
+    struct svm_domain *svm = &v->domain->arch.hvm_domain.svm;
+    struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    struct vmcb_struct *vmcb = v->arch.hvm_svm.vmcb;
+    vintr_t intr = vmcb_get_vintr(vmcb);
+
+    intr.fields.avic = 0;
+    vmcb_set_vintr(vmcb, intr);
+
+    /*
+     * With our table entries gone, IPIs to us exit as invalid-target and are
+     * emulated, and posted MSIs land in the GA log.
+     */
+    spin_lock(&svm->avic_lock);
+    avic->active = 0;
+    if ( avic->logical_idx >= 0 &&
+         (svm->avic_logical_table[avic->logical_idx] &
+          AVIC_LOGICAL_GUEST_ID_MASK) == GET_xAPIC_ID(avic->id) )
+        write_atomic(&svm->avic_logical_table[avic->logical_idx], 0);
+    avic->logical_idx = -1;
+    spin_unlock(&svm->avic_lock);
+
+    avic_set_running(v, 0);
+}
+
+static void avic_vcpu_block(struct vcpu *v)
+{
+    if ( v->arch.hvm_svm.avic.running )
+        avic_set_running(v, 0);
+}
+
+static void avic_window_timer_fn(void *data)
+{
+    vcpu_kick(data);
+}
+
+int svm_avic_domain_initialise(struct domain *d)
+{
+    struct svm_domain *svm = &d->arch.hvm_domain.svm;
+    struct page_info *pg;
+    unsigned long mfn;
+    int rc;
+
+    spin_lock_init(&svm->avic_lock);
+
+    if ( !svm_avic || !has_vlapic(d) || !hap_enabled(d) )
+        return 0;
+
+    svm->avic_physical_table = alloc_xenheap_page();
+    svm->avic_logical_table = alloc_xenheap_page();
+    pg = alloc_domheap_page(d, MEMF_no_owner);
+    if ( !svm->avic_physical_table || !svm->avic_logical_table || !pg )
+    {
+        if ( pg )
+            free_domheap_page(pg);
+        svm_avic_domain_destroy(d);
+        return -ENOMEM;
+    }
+
+    clear_page(svm->avic_physical_table);
+    clear_page(svm->avic_logical_table);
+
+    mfn = page_to_mfn(pg);
+    clear_domain_page(_mfn(mfn));
+    share_xen_page_with_guest(pg, d, XENSHARE_writable);
+    svm->avic_access_mfn = mfn;
+
+    rc = set_mmio_p2m_entry(d, paddr_to_pfn(APIC_DEFAULT_PHYS_BASE),
+                            _mfn(mfn), PAGE_ORDER_4K,
+                            p2m_get_hostp2m(d)->default_access);
+    if ( rc )
+    {
+        svm_avic_domain_destroy(d);
+        return rc;
+    }
+
+    svm->avic = 1;
+    svm->vcpu_block = avic_vcpu_block;
+
+    return 0;
+}
+
+void svm_avic_domain_destroy(struct domain *d)
+{
+    struct svm_domain *svm = &d->arch.hvm_domain.svm;
+
+    if ( svm->avic_access_mfn )
+        free_shared_domheap_page(mfn_to_page(svm->avic_access_mfn));
+    free_xenheap_page(svm->avic_logical_table);
+    free_xenheap_page(svm->avic_physical_table);
+
+    svm->avic_access_mfn = 0;
+    svm->avic_logical_table = NULL;
+    svm->avic_physical_table = NULL;
+    svm->avic = 0;
+}
+
+/*
+ * Turn AVIC off for a domain which turns out to be unsuitable (too many
+ * vCPUs, nested virtualisation).  Each vCPU drops out at its next VM entry.
+ */
+void svm_avic_domain_disable(struct domain *d)
+{
+    struct svm_domain *svm = &d->arch.hvm_domain.svm;
+    struct vcpu *v;
+    bool_t was_enabled;
+
+    spin_lock(&svm->avic_lock);
+    was_enabled = svm->avic;
+    svm->avic = 0;
+    spin_unlock(&svm->avic_lock);
+
+    if ( !was_enabled )
+        return;
+
+    /* Let the vlapic MMIO handler see the guest's accesses again. */
+    clear_mmio_p2m_entry(d, paddr_to_pfn(APIC_DEFAULT_PHYS_BASE),
+                         _mfn(svm->avic_access_mfn), PAGE_ORDER_4K);
+
+    for_each_vcpu ( d, v )
+        vcpu_kick(v);
+}
+
+void svm_avic_vcpu_initialise(struct vcpu *v)
+{
+    struct domain *d = v->domain;
+    struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    struct vmcb_struct *vmcb = v->arch.hvm_svm.vmcb;
+    vintr_t intr;
+
+    avic->phys_id = avic->logical_idx = -1;
+    spin_lock_init(&avic->ga_lock);
+    INIT_LIST_HEAD(&avic->ga_list);
+    init_timer(&avic->window_timer, avic_window_timer_fn, v, v->processor);
+
+    if ( !svm_avic_domain_enabled(d) )
+        return;
+
+    if ( v->vcpu_id >= AVIC_MAX_VCPUS )
+    {
+        printk(XENLOG_G_INFO "d%d: AVIC disabled: more than %u vCPUs\n",
+               d->domain_id, AVIC_MAX_VCPUS);
+        svm_avic_domain_disable(d);
+        return;
+    }
+
+    vmcb_set_avic_apic_bar(vmcb, APIC_DEFAULT_PHYS_BASE);
+    vmcb_set_avic_backing_page(vmcb,
+                               page_to_maddr(vcpu_vlapic(v)->regs_page));
+    vmcb_set_avic_logical_table(
+        vmcb, virt_to_maddr(d->arch.hvm_domain.svm.avic_logical_table));
+    vmcb_set_avic_physical_table(
+        vmcb, virt_to_maddr(d->arch.hvm_domain.svm.avic_physical_table) |
+              AVIC_PHYS_MAX_INDEX);
+
+    intr = vmcb_get_vintr(vmcb);
+    intr.fields.avic = 1;
+    vmcb_set_vintr(vmcb, intr);
+
+    avic->active = 1;
+}
+
+void svm_avic_vcpu_destroy(struct vcpu *v)
+{
+    kill_timer(&v->arch.hvm_svm.avic.window_timer);
+    ASSERT(list_empty(&v->arch.hvm_svm.avic.ga_list));
+}
+
+/* Called on every VM entry of an AVIC vCPU, with interrupts enabled. */
+void svm_avic_vcpu_resume(struct vcpu *v)
+{
+    struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    const struct vlapic *vlapic = vcpu_vlapic(v);
+
+    ASSERT(v == current);
+
+    if ( unlikely(!svm_avic_domain_enabled(v->domain)) ||
+         unlikely(vlapic_hw_disabled(vlapic)) ||
+         unlikely(vlapic_x2apic_mode(vlapic)) ||
+         unlikely(vlapic_base_address(vlapic) != APIC_DEFAULT_PHYS_BASE) )
+    {
+        avic_vcpu_deactivate(v);
+        return;
+    }
+
+    avic_update_tables(v);
+
+    if ( !avic->running || read_atomic(&avic->ga_stale) )
+        avic_set_running(v, 1);
+}
+
+void svm_avic_ctxt_switch_from(struct vcpu *v)
+{
+    if ( v->arch.hvm_svm.avic.running )
+        avic_set_running(v, 0);
+}
+
+/* hvm_funcs.deliver_posted_intr: vlapic_set_irq() for AVIC domains. */
+void svm_avic_deliver_intr(struct vcpu *v, u8 vector)
+{
+    const struct svm_avic_vcpu *avic = &v->arch.hvm_svm.avic;
+    struct vlapic *vlapic = vcpu_vlapic(v);
+    int phys_id = avic->phys_id;
+    uint64_t entry;
+
+    /* A locked op, so the IRR is visible before we look at IsRunning. */
+    if ( vlapic_test_and_set_vector(vector, &vlapic->regs->data[APIC_IRR]) )
+        return;
+
+    if ( v != current && avic->active && phys_id >= 0 )
+    {
+        entry = read_atomic(
+            &v->domain->arch.hvm_domain.svm.avic_physical_table[phys_id]);
+        if ( entry & AVIC_PHYS_IS_RUNNING )
+        {
+            wrmsrl(MSR_AMD_AVIC_DOORBELL, entry & AVIC_PHYS_HOST_ID_MASK);
+            return;
+        }
+    }
+
+    vcpu_kick(v);
+}
+
+void svm_avic_intr_window(struct vcpu *v)
+{
+    set_timer(&v->arch.hvm_svm.avic.window_timer, NOW() + AVIC_WINDOW_POLL);
+}
+
+void svm_avic_incomplete_ipi(struct cpu_user_regs *regs)
+{
+    struct vcpu *curr = current, *v;
+    const struct vmcb_struct *vmcb = curr->arch.hvm_svm.vmcb;
+    struct vlapic *vlapic = vcpu_vlapic(curr);
+    uint32_t icr = vmcb->exitinfo1, icr2 = vmcb->exitinfo1 >> 32;
+    unsigned int cause = vmcb->exitinfo2 >> 32;
+
+    switch ( cause )
+    {
+    case AVIC_IPI_TARGET_NOT_RUNNING:
+        /* The IRRs are already updated: just wake the targets up. */
+        for_each_vcpu ( curr->domain, v )
+            if ( v != curr &&
+                 vlapic_match_dest(vcpu_vlapic(v), vlapic,
+                                   icr & APIC_SHORT_MASK,
+                                   GET_xAPIC_DEST_FIELD(icr2),
+                                   !!(icr & APIC_DEST_LOGICAL)) )
+                vcpu_kick(v);
+        break;
+
+    case AVIC_IPI_INVALID_INT_TYPE:
+    case AVIC_IPI_INVALID_TARGET:
+        /* Nothing (or not everything) was delivered: emulate the write. */
+        vlapic_set_reg(vlapic, APIC_ICR2, icr2);
+        vlapic_set_reg(vlapic, APIC_ICR, icr);
+        vlapic_apicv_write(curr, APIC_ICR);
+        break;
+
+    default:
+        gprintk(XENLOG_ERR, "AVIC: bad IPI, cause %u ICR %08x:%08x\n",
+                cause, icr2, icr);
+        domain_crash(curr->domain);
+        break;
+    }
+}
+
+/* Writes the hardware completes to the backing page before exiting. */
+static bool_t avic_noaccel_is_trap(unsigned int offset)
+{
+    switch ( offset )
+    {
+    case APIC_ID:
+    case APIC_EOI:
+    case APIC_RRR:
+    case APIC_LDR:
+    case APIC_DFR:
+    case APIC_SPIV:
+    case APIC_ESR:
+    case APIC_ICR:
+    case APIC_LVTT:
+    case APIC_LVTTHMR:
+    case APIC_LVTPC:
+    case APIC_LVT0:
+    case APIC_LVT1:
+    case APIC_LVTERR:
+    case APIC_TMICT:
+    case APIC_TDCR:
+        return 1;
+    }
+
+    return 0;
+}
+
+void svm_avic_noaccel(struct cpu_user_regs *regs)
+{
+    struct vcpu *curr = current;
+    const struct vmcb_struct *vmcb = curr->arch.hvm_svm.vmcb;
+    unsigned int offset = vmcb->exitinfo1 & AVIC_NOACCEL_OFFSET_MASK;
+
+    if ( (vmcb->exitinfo1 & AVIC_NOACCEL_WRITE) &&
+         avic_noaccel_is_trap(offset) )
+    {
+        /* The value is in the backing page: apply its side effects. */
+        vlapic_apicv_write(curr, offset);
+        return;
+    }
+
+    /* Faulting access: nothing has happened yet, emulate it. */
+    if ( !handle_mmio() )
+        hvm_inject_hw_exception(TRAP_gp_fault, 0);
+}
+
+/*
+ * An IOMMU's IRTE(s) for v changed: have v rewrite them at its next VM
+ * entry, so they follow its running state from then on.
+ */
+void svm_avic_ga_refresh(struct vcpu *v)
+{
+    write_atomic(&v->arch.hvm_svm.avic.ga_stale, 1);
+    vcpu_kick(v);
+}
+
+/* An MSI was posted to a vCPU that wasn't running. */
+void svm_avic_ga_log(uint32_t tag)
+{
+    struct domain *d = rcu_lock_domain_by_id(AVIC_GA_TAG_DOMID(tag));
+    unsigned int id = AVIC_GA_TAG_VCPU(tag);
+
+    if ( !d )
+        return;
+
+    if ( id < d->max_vcpus && d->vcpu[id] )
+        vcpu_kick(d->vcpu[id]);
+
+    rcu_unlock_domain(d);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -30,6 +30,7 @@
 #include <asm/hvm/io.h>
 #include <asm/hvm/support.h>
 #include <asm/hvm/vlapic.h>
+#include <asm/hvm/svm/avic.h>
 #include <asm/hvm/svm/svm.h>
 #include <asm/hvm/svm/intr.h>
 #include <asm/hvm/nestedhvm.h> /* for nestedhvm_vcpu_in_guestmode */
@@ -121,6 +122,17 @@ static void svm_enable_intr_window(struct vcpu *v, struct hvm_intack intack)
          (general1_intercepts & GENERAL1_INTERCEPT_IRET) )
         return;
 
+    /*
+     * AVIC ignores V_IRQ, and delivers the vlapic's interrupts itself.
+     * Anything else is retried from a timer.
+     */
+    if ( svm_avic_vcpu_active(v) )
+    {
+        if ( intack.source != hvm_intsrc_lapic )
+            svm_avic_intr_window(v);
+        return;
+    }
+
     intr = vmcb_get_vintr(vmcb);
     intr.fields.irq     = 1;
     intr.fields.vector  = 0;
@@ -138,6 +150,9 @@ void svm_intr_assist(void)
     struct hvm_intack intack;
     enum hvm_intblk intblk;
 
+    if ( svm_avic_vcpu_active(v) )
+        svm_avic_vcpu_resume(v);
+
     /* Crank the handle on interrupt state. */
     pt_update_irq(v);
 
@@ -146,6 +161,13 @@ void svm_intr_assist(void)
         if ( likely(intack.source == hvm_intsrc_none) )
             return;
 
+        /* AVIC takes the vector from the IRR when the guest can accept it. */
+        if ( intack.source == hvm_intsrc_lapic && svm_avic_vcpu_active(v) )
+        {
+            pt_intr_post(v, intack);
+            return;
+        }
+
         intblk = hvm_interrupt_blocked(v, intack);
         if ( intblk == hvm_intblk_svm_gif ) {
             ASSERT(nestedhvm_enabled(v->domain));
@@ -26,6 +26,7 @@
 #include <xen/hypercall.h>
 #include <xen/domain_page.h>
 #include <xen/xenoprof.h>
+#include <xen/lathist.h>
 #include <asm/current.h>
 #include <asm/io.h>
 #include <asm/paging.h>
@@ -46,6 +47,7 @@
 #include <asm/hvm/io.h>
 #include <asm/hvm/emulate.h>
 #include <asm/hvm/svm/asid.h>
+#include <asm/hvm/svm/avic.h>
 #include <asm/hvm/svm/svm.h>
 #include <asm/hvm/svm/vmcb.h>
 #include <asm/hvm/svm/emulate.h>
@@ -1003,6 +1005,9 @@ static void svm_ctxt_switch_from(struct vcpu *v)
     if ( unlikely((read_efer() & EFER_SVME) == 0) )
         return;
 
+    if ( svm_avic_vcpu_active(v) )
+        svm_avic_ctxt_switch_from(v);
+
     svm_fpu_leave(v);
 
     svm_save_dr(v);
@@ -1050,7 +1055,7 @@ static void svm_ctxt_switch_to(struct vcpu *v)
     svm_tsc_ratio_load(v);
 
     if ( cpu_has_rdtscp )
-        wrmsrl(MSR_TSC_AUX, hvm_msr_tsc_aux(v));
+        wrmsr_tsc_aux(hvm_msr_tsc_aux(v));
 }
 
 static void noreturn svm_do_resume(struct vcpu *v)
@@ -1164,11 +1169,12 @@ void svm_host_osvw_init()
 
 static int svm_domain_initialise(struct domain *d)
 {
-    return 0;
+    return svm_avic_domain_initialise(d);
 }
 
 static void svm_domain_destroy(struct domain *d)
 {
+    svm_avic_domain_destroy(d);
 }
 
 static int svm_vcpu_initialise(struct vcpu *v)
@@ -1189,6 +1195,8 @@ static int svm_vcpu_initialise(struct vcpu *v)
         return rc;
     }
 
+    svm_avic_vcpu_initialise(v);
+
     /* PVH's VPMU is initialized via hypercall */
     if ( has_vlapic(v->domain) )
         vpmu_initialise(v);
@@ -1200,6 +1208,7 @@ static int svm_vcpu_initialise(struct vcpu *v)
 
 static void svm_vcpu_destroy(struct vcpu *v)
 {
+    svm_avic_vcpu_destroy(v);
     vpmu_destroy(v);
     svm_destroy_vmcb(v);
     passive_domain_destroy(v);
@@ -1456,6 +1465,10 @@ const struct hvm_function_table * __init start_svm(void)
     if ( cpu_has_tsc_ratio )
         svm_function_table.tsc_scaling.ratio_frac_bits = 32;
 
+    svm_avic_init();
+    if ( svm_avic )
+        svm_function_table.deliver_posted_intr = svm_avic_deliver_intr;
+
 #define P(p,s) if ( p ) { printk(" - %s\n", s); printed = 1; }
     P(cpu_has_svm_npt, "Nested Page Tables (NPT)");
     P(cpu_has_svm_lbrv, "Last Branch Record (LBR) Virtualisation");
@@ -1464,6 +1477,7 @@ const struct hvm_function_table * __init start_svm(void)
     P(cpu_has_svm_decode, "DecodeAssists");
     P(cpu_has_pause_filter, "Pause-Intercept Filter");
     P(cpu_has_tsc_ratio, "TSC Rate MSR");
+    P(cpu_has_svm_avic, svm_avic ? "AVIC (enabled)" : "AVIC");
 #undef P
 
     if ( !printed )
@@ -1578,6 +1592,11 @@ static void svm_cpuid_intercept(
     hvm_cpuid(input, eax, ebx, ecx, edx);
 
     switch (input) {
+    case 0x1:
+        /* AVIC only virtualises xAPIC mode. */
+        if ( svm_avic_domain_enabled(v->domain) )
+            __clear_bit(X86_FEATURE_X2APIC & 31, ecx);
+        break;
     case 0x80000001:
         /* Fix up VLAPIC details. */
         if ( vlapic_hw_disabled(vcpu_vlapic(v)) )
@@ -2020,7 +2039,7 @@ static void svm_vmexit_do_pause(struct cpu_user_regs *regs)
      * Do something useful, like reschedule the guest
      */
     perfc_incr(pauseloop_exits);
-    do_sched_op(SCHEDOP_yield, guest_handle_from_ptr(NULL, void));
+    vcpu_yield_directed();
 }
 
 static void
@@ -2295,6 +2314,7 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     vintr_t intr;
     bool_t vcpu_guestmode = 0;
     struct vlapic *vlapic = vcpu_vlapic(v);
+    s_time_t start = lathist_start();
 
     hvm_invalidate_regs_fields(regs);
 
@@ -2405,6 +2425,7 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     }
 
     perfc_incra(svmexits, exit_reason);
+    perfc_dom_incra(dom_svmexits, exit_reason);
 
     hvm_maybe_deassert_evtchn_irq();
 
@@ -2657,6 +2678,7 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
 
     case VMEXIT_NPF:
         perfc_incra(svmexits, VMEXIT_NPF_PERFC);
+        perfc_dom_incra(dom_svmexits, VMEXIT_NPF_PERFC);
         if ( cpu_has_svm_decode )
             v->arch.hvm_svm.cached_insn_len = vmcb->guest_ins_len & 0xf;
         rc = vmcb->exitinfo1 & PFEC_page_present
@@ -2695,6 +2717,14 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
         svm_vmexit_do_pause(regs);
         break;
 
+    case VMEXIT_AVIC_INCOMPLETE_IPI:
+        svm_avic_incomplete_ipi(regs);
+        break;
+
+    case VMEXIT_AVIC_NOACCEL:
+        svm_avic_noaccel(regs);
+        break;
+
     default:
     unexpected_exit_type:
         gdprintk(XENLOG_ERR, "unexpected VMEXIT: exit reason = %#"PRIx64", "
@@ -2706,14 +2736,16 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     }
 
   out:
-    if ( vcpu_guestmode || vlapic_hw_disabled(vlapic) )
-        return;
+    if ( !vcpu_guestmode && !vlapic_hw_disabled(vlapic) )
+    {
+        /* The exit may have updated the TPR: reflect this in the hardware vtpr */
+        intr = vmcb_get_vintr(vmcb);
+        intr.fields.tpr =
+            (vlapic_get_reg(vlapic, APIC_TASKPRI) & 0xFF) >> 4;
+        vmcb_set_vintr(vmcb, intr);
+    }
 
-    /* The exit may have updated the TPR: reflect this in the hardware vtpr */
-    intr = vmcb_get_vintr(vmcb);
-    intr.fields.tpr =
-        (vlapic_get_reg(vlapic, APIC_TASKPRI) & 0xFF) >> 4;
-    vmcb_set_vintr(vmcb, intr);
+    lathist_vmexit(exit_reason, start);
 }
 
 void svm_trace_vmentry(void)
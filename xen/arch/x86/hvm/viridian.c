@@ -18,8 +18,10 @@
 #include <asm/paging.h>
 #include <asm/p2m.h>
 #include <asm/apic.h>
+#include <asm/event.h>
 #include <asm/hvm/support.h>
 #include <public/sched.h>
+#include <public/hvm/hvm_info_table.h>
 #include <public/hvm/hvm_op.h>
 
 /* Viridian MSR numbers. */
@@ -34,6 +36,15 @@
 #define VIRIDIAN_MSR_ICR                        0x40000071
 #define VIRIDIAN_MSR_TPR                        0x40000072
 #define VIRIDIAN_MSR_APIC_ASSIST                0x40000073
+#define VIRIDIAN_MSR_SCONTROL                   0x40000080
+#define VIRIDIAN_MSR_SVERSION                   0x40000081
+#define VIRIDIAN_MSR_SIEFP                      0x40000082
+#define VIRIDIAN_MSR_SIMP                       0x40000083
+#define VIRIDIAN_MSR_EOM                        0x40000084
+#define VIRIDIAN_MSR_SINT0                      0x40000090
+#define VIRIDIAN_MSR_SINT15                     0x4000009F
+#define VIRIDIAN_MSR_STIMER0_CONFIG             0x400000B0
+#define VIRIDIAN_MSR_STIMER3_COUNT              0x400000B7
 
 /* Viridian Hypercall Status Codes. */
 #define HV_STATUS_SUCCESS                       0x0000
@@ -41,25 +52,36 @@
 #define HV_STATUS_INVALID_PARAMETER             0x0005
 
 /* Viridian Hypercall Codes. */
-#define HvFlushVirtualAddressSpace 2
-#define HvFlushVirtualAddressList  3
-#define HvNotifyLongSpinWait       8
+#define HvFlushVirtualAddressSpace   0x02
+#define HvFlushVirtualAddressList    0x03
+#define HvNotifyLongSpinWait         0x08
+#define HvFlushVirtualAddressSpaceEx 0x13
+#define HvFlushVirtualAddressListEx  0x14
 
 /* Viridian Hypercall Flags. */
 #define HV_FLUSH_ALL_PROCESSORS 1
 
+/* Viridian processor set formats. */
+#define HV_GENERIC_SET_SPARSE_4K 0
+#define HV_GENERIC_SET_ALL       1
+
 /* Viridian CPUID 4000003, Viridian MSR availability. */
 #define CPUID3A_MSR_TIME_REF_COUNT (1 << 1)
+#define CPUID3A_MSR_SYNIC          (1 << 2)
+#define CPUID3A_MSR_STIMER         (1 << 3)
 #define CPUID3A_MSR_APIC_ACCESS    (1 << 4)
 #define CPUID3A_MSR_HYPERCALL      (1 << 5)
 #define CPUID3A_MSR_VP_INDEX       (1 << 6)
 #define CPUID3A_MSR_REFERENCE_TSC  (1 << 9)
 #define CPUID3A_MSR_FREQ           (1 << 11)
+#define CPUID3D_DIRECT_STIMER      (1 << 19)
 
 /* Viridian CPUID 4000004, Implementation Recommendations. */
 #define CPUID4A_HCALL_REMOTE_TLB_FLUSH (1 << 2)
 #define CPUID4A_MSR_BASED_APIC         (1 << 3)
 #define CPUID4A_RELAX_TIMER_INT        (1 << 5)
+#define CPUID4A_DEPRECATE_AUTOEOI      (1 << 9)
+#define CPUID4A_EX_PROCESSOR_MASKS     (1 << 11)
 
 /* Viridian CPUID 4000006, Implementation HW features detected and in use. */
 #define CPUID6A_APIC_OVERLAY    (1 << 0)
@@ -112,6 +134,13 @@ int cpuid_viridian_leaves(unsigned int leaf, unsigned int *eax,
             *eax |= CPUID3A_MSR_TIME_REF_COUNT;
         if ( viridian_feature_mask(d) & HVMPV_reference_tsc )
             *eax |= CPUID3A_MSR_REFERENCE_TSC;
+        if ( viridian_feature_mask(d) & HVMPV_synic )
+            *eax |= CPUID3A_MSR_SYNIC;
+        if ( viridian_feature_mask(d) & HVMPV_stimer )
+        {
+            *eax |= CPUID3A_MSR_STIMER;
+            *edx |= CPUID3D_DIRECT_STIMER;
+        }
         break;
     case 4:
         /* Recommended hypercall usage. */
@@ -120,9 +149,14 @@ int cpuid_viridian_leaves(unsigned int leaf, unsigned int *eax,
             break;
         *eax = CPUID4A_RELAX_TIMER_INT;
         if ( viridian_feature_mask(d) & HVMPV_hcall_remote_tlb_flush )
-            *eax |= CPUID4A_HCALL_REMOTE_TLB_FLUSH;
+            *eax |= CPUID4A_HCALL_REMOTE_TLB_FLUSH |
+                    CPUID4A_EX_PROCESSOR_MASKS;
         if ( !cpu_has_vmx_apic_reg_virt )
             *eax |= CPUID4A_MSR_BASED_APIC;
+        /* Virtual interrupt delivery acknowledges interrupts in hardware. */
+        if ( (viridian_feature_mask(d) & HVMPV_synic) &&
+             vlapic_virtual_intr_delivery_enabled() )
+            *eax |= CPUID4A_DEPRECATE_AUTOEOI;
         *ebx = 2047; /* long spin count */
         break;
     case 6:
@@ -338,6 +372,152 @@ void viridian_abort_apic_assist(struct vcpu *v)
     v->arch.hvm_vcpu.viridian.apic_assist.vector = 0;
 }
 
+/*
+ * Type definitions as in Microsoft Hypervisor Top-Level Functional
+ * Specification v4.0b, sections 11.10 and 15.5.
+ */
+#define HvMessageTypeNone     0x00000000
+#define HvMessageTimerExpired 0x80000010
+
+typedef struct _HV_MESSAGE_HEADER
+{
+    uint32_t MessageType;
+    uint8_t  PayloadSize;
+    uint8_t  MessageFlags;
+    uint16_t Reserved;
+    uint64_t OriginationId;
+} HV_MESSAGE_HEADER;
+
+#define HV_MESSAGE_FLAG_PENDING 1
+
+typedef struct _HV_MESSAGE
+{
+    HV_MESSAGE_HEADER Header;
+    uint64_t Payload[30];
+} HV_MESSAGE;
+
+typedef struct _HV_TIMER_MESSAGE_PAYLOAD
+{
+    uint32_t TimerIndex;
+    uint32_t Reserved;
+    uint64_t ExpirationTime;
+    uint64_t DeliveryTime;
+} HV_TIMER_MESSAGE_PAYLOAD;
+
+static void dump_simp(const struct vcpu *v)
+{
+    const union viridian_synic_page *simp;
+
+    simp = &v->arch.hvm_vcpu.viridian.synic.simp;
+
+    printk(XENLOG_G_INFO "%pv: VIRIDIAN SIMP: enabled: %x pfn: %lx\n",
+           v, simp->fields.enabled, (unsigned long)simp->fields.pfn);
+}
+
+static void initialize_simp(struct vcpu *v)
+{
+    struct domain *d = v->domain;
+    unsigned long gmfn = v->arch.hvm_vcpu.viridian.synic.simp.fields.pfn;
+    struct page_info *page = get_page_from_gfn(d, gmfn, NULL, P2M_ALLOC);
+    void *va;
+
+    if ( !page || !get_page_type(page, PGT_writable_page) )
+    {
+        if ( page )
+            put_page(page);
+        gdprintk(XENLOG_WARNING, "Bad GMFN %#"PRI_gfn" (MFN %#"PRI_mfn")\n",
+                 gmfn, page ? page_to_mfn(page) : mfn_x(INVALID_MFN));
+        return;
+    }
+
+    va = __map_domain_page_global(page);
+    if ( !va )
+    {
+        put_page_and_type(page);
+        return;
+    }
+
+    clear_page(va);
+    v->arch.hvm_vcpu.viridian.synic.simp_va = va;
+}
+
+static void teardown_simp(struct vcpu *v)
+{
+    void *va = v->arch.hvm_vcpu.viridian.synic.simp_va;
+    struct page_info *page;
+
+    if ( !va )
+        return;
+
+    v->arch.hvm_vcpu.viridian.synic.simp_va = NULL;
+
+    page = mfn_to_page(domain_page_map_to_mfn(va));
+
+    unmap_domain_page_global(va);
+    put_page_and_type(page);
+}
+
+bool_t viridian_is_auto_eoi_sint(const struct vcpu *v, uint8_t vector)
+{
+    const struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    unsigned int i;
+
+    for ( i = 0; i < VIRIDIAN_SINT_NR; i++ )
+    {
+        const union viridian_sint *sint = &vv->synic.sint[i];
+
+        if ( !sint->fields.mask && sint->fields.auto_eoi &&
+             sint->fields.vector == vector )
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Post a timer expiry message into the slot of the timer's SINT and assert
+ * the SINT.  Returns 0 if the guest hasn't consumed the previous message
+ * yet, in which case the guest is asked to signal EOM so it can be retried.
+ */
+static bool_t deliver_stimer_msg(struct vcpu *v, unsigned int idx,
+                                 int64_t now)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    const struct viridian_stimer *vs = &vv->stimer[idx];
+    unsigned int sintx = vs->config.fields.sintx;
+    const union viridian_sint *sint = &vv->synic.sint[sintx];
+    HV_TIMER_MESSAGE_PAYLOAD payload = {
+        .TimerIndex = idx,
+        .ExpirationTime = vs->expiration,
+        .DeliveryTime = now,
+    };
+    volatile HV_MESSAGE *msg;
+
+    /* Without a message page enabled the message is lost. */
+    if ( !(vv->synic.scontrol & 1) || !vv->synic.simp_va )
+        return 1;
+
+    msg = (HV_MESSAGE *)vv->synic.simp_va + sintx;
+    if ( msg->Header.MessageType != HvMessageTypeNone )
+    {
+        msg->Header.MessageFlags |= HV_MESSAGE_FLAG_PENDING;
+        return 0;
+    }
+
+    msg->Header.PayloadSize = sizeof(payload);
+    msg->Header.MessageFlags = 0;
+    msg->Header.OriginationId = 0;
+    memcpy((void *)msg->Payload, &payload, sizeof(payload));
+    smp_wmb();
+    msg->Header.MessageType = HvMessageTimerExpired;
+
+    if ( !sint->fields.mask && !sint->fields.polling &&
+         sint->fields.vector >= 0x10 )
+        vlapic_set_irq(vcpu_vlapic(v), sint->fields.vector, 0);
+
+    return 1;
+}
+
 static void update_reference_tsc(struct domain *d, bool_t initialize)
 {
     unsigned long gmfn = d->arch.hvm_domain.viridian.reference_tsc.fields.pfn;
@@ -411,6 +591,152 @@ static void update_reference_tsc(struct domain *d, bool_t initialize)
     put_page_and_type(page);
 }
 
+static int64_t raw_trc_val(struct domain *d);
+
+/* Partition reference time, in 100ns units. */
+static int64_t time_now(struct domain *d)
+{
+    return raw_trc_val(d) + d->arch.hvm_domain.viridian.time_ref_count.off;
+}
+
+static void stimer_expire(void *data)
+{
+    struct viridian_stimer *vs = data;
+    struct vcpu *v = vs->v;
+
+    set_bit(vs - v->arch.hvm_vcpu.viridian.stimer,
+            &v->arch.hvm_vcpu.viridian.stimer_pending);
+    vcpu_kick(v);
+}
+
+static void arm_stimer(struct viridian_stimer *vs, int64_t now)
+{
+    struct vcpu *v = vs->v;
+    /*
+     * Cap the delay so the conversion to ns can't overflow; an early
+     * expiry is noticed and re-armed by viridian_poll_stimers().
+     */
+    int64_t delay = min_t(int64_t, max_t(int64_t, vs->expiration - now, 0),
+                          1LL << 40);
+
+    if ( vs->timer.cpu != v->processor )
+        migrate_timer(&vs->timer, v->processor);
+    set_timer(&vs->timer, NOW() + delay * 100);
+}
+
+static void start_stimer(struct viridian_stimer *vs, bool_t rearm)
+{
+    int64_t now = time_now(vs->v->domain);
+
+    if ( !vs->config.fields.periodic )
+        vs->expiration = vs->count;
+    else if ( !rearm )
+        vs->expiration = now + vs->count;
+    else
+    {
+        vs->expiration += vs->count;
+        /* Skip periods missed while descheduled rather than bursting. */
+        if ( vs->expiration <= now )
+            vs->expiration = now + vs->count;
+    }
+
+    vs->started = 1;
+    arm_stimer(vs, now);
+}
+
+static void stop_stimer(struct viridian_stimer *vs)
+{
+    struct viridian_vcpu *vv = &vs->v->arch.hvm_vcpu.viridian;
+    unsigned int idx = vs - vv->stimer;
+
+    stop_timer(&vs->timer);
+    clear_bit(idx, &vv->stimer_pending);
+    clear_bit(idx, &vv->stimer_retry);
+    vs->started = 0;
+}
+
+/*
+ * Deliver the synthetic timers which expired.  This runs in the context
+ * of the target vCPU, on its way into the guest.
+ */
+void viridian_poll_stimers(struct vcpu *v)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    unsigned int i;
+    int64_t now;
+
+    if ( likely(!read_atomic(&vv->stimer_pending)) )
+        return;
+
+    now = time_now(v->domain);
+
+    for ( i = 0; i < VIRIDIAN_STIMER_NR; i++ )
+    {
+        struct viridian_stimer *vs = &vv->stimer[i];
+
+        if ( !test_and_clear_bit(i, &vv->stimer_pending) ||
+             !vs->config.fields.enabled )
+            continue;
+
+        /* Restored timers get started once reference time is running. */
+        if ( !vs->started )
+        {
+            start_stimer(vs, 0);
+            continue;
+        }
+
+        /* Reference time doesn't advance while the domain is paused. */
+        if ( vs->expiration > now )
+        {
+            arm_stimer(vs, now);
+            continue;
+        }
+
+        perfc_incr(mshv_stimer_expired);
+
+        if ( vs->config.fields.direct_mode )
+        {
+            if ( vs->config.fields.vector >= 0x10 )
+                vlapic_set_irq(vcpu_vlapic(v), vs->config.fields.vector, 0);
+        }
+        else if ( !deliver_stimer_msg(v, i, now) )
+            set_bit(i, &vv->stimer_retry);
+
+        if ( vs->config.fields.periodic )
+            start_stimer(vs, 1);
+        else
+        {
+            vs->config.fields.enabled = 0;
+            vs->started = 0;
+        }
+    }
+}
+
+static void write_stimer(struct viridian_stimer *vs, bool_t count,
+                         uint64_t val)
+{
+    stop_stimer(vs);
+
+    if ( !count )
+    {
+        vs->config.raw = val;
+        /* Message mode timers can't use SINT0. */
+        if ( !vs->config.fields.direct_mode && !vs->config.fields.sintx )
+            vs->config.fields.enabled = 0;
+    }
+    else
+    {
+        vs->count = val;
+        if ( !vs->count )
+            vs->config.fields.enabled = 0;
+        else if ( vs->config.fields.auto_enable )
+            vs->config.fields.enabled = 1;
+    }
+
+    if ( vs->config.fields.enabled && vs->count )
+        start_stimer(vs, 0);
+}
+
 int wrmsr_viridian_regs(uint32_t idx, uint64_t val)
 {
     struct vcpu *v = current;
@@ -481,6 +807,72 @@ int wrmsr_viridian_regs(uint32_t idx, uint64_t val)
             update_reference_tsc(d, 1);
         break;
 
+    case VIRIDIAN_MSR_SCONTROL:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic_msr);
+        v->arch.hvm_vcpu.viridian.synic.scontrol = val;
+        break;
+
+    case VIRIDIAN_MSR_SIEFP:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        /* No events are ever signalled, so the page needn't be mapped. */
+        perfc_incr(mshv_wrmsr_synic_msr);
+        v->arch.hvm_vcpu.viridian.synic.siefp = val;
+        break;
+
+    case VIRIDIAN_MSR_SIMP:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic_msr);
+        teardown_simp(v); /* release any previous mapping */
+        v->arch.hvm_vcpu.viridian.synic.simp.raw = val;
+        dump_simp(v);
+        if ( v->arch.hvm_vcpu.viridian.synic.simp.fields.enabled )
+            initialize_simp(v);
+        break;
+
+    case VIRIDIAN_MSR_EOM:
+    {
+        struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+        unsigned int i;
+
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        /* A message slot was freed: retry the messages which found it busy. */
+        perfc_incr(mshv_wrmsr_eom);
+        for ( i = 0; i < VIRIDIAN_STIMER_NR; i++ )
+            if ( test_and_clear_bit(i, &vv->stimer_retry) )
+                set_bit(i, &vv->stimer_pending);
+        break;
+    }
+
+    case VIRIDIAN_MSR_SINT0 ... VIRIDIAN_MSR_SINT15:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_synic_msr);
+        v->arch.hvm_vcpu.viridian.synic.sint[idx - VIRIDIAN_MSR_SINT0].raw =
+            val;
+        break;
+
+    case VIRIDIAN_MSR_STIMER0_CONFIG ... VIRIDIAN_MSR_STIMER3_COUNT:
+    {
+        unsigned int n = (idx - VIRIDIAN_MSR_STIMER0_CONFIG) / 2;
+
+        if ( !(viridian_feature_mask(d) & HVMPV_stimer) )
+            return 0;
+
+        perfc_incr(mshv_wrmsr_stimer_msr);
+        write_stimer(&v->arch.hvm_vcpu.viridian.stimer[n], idx & 1, val);
+        break;
+    }
+
     default:
         return 0;
     }
@@ -604,6 +996,68 @@ int rdmsr_viridian_regs(uint32_t idx, uint64_t *val)
         break;
     }
 
+    case VIRIDIAN_MSR_SCONTROL:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic_msr);
+        *val = v->arch.hvm_vcpu.viridian.synic.scontrol;
+        break;
+
+    case VIRIDIAN_MSR_SVERSION:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic_msr);
+        *val = 1;
+        break;
+
+    case VIRIDIAN_MSR_SIEFP:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic_msr);
+        *val = v->arch.hvm_vcpu.viridian.synic.siefp;
+        break;
+
+    case VIRIDIAN_MSR_SIMP:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic_msr);
+        *val = v->arch.hvm_vcpu.viridian.synic.simp.raw;
+        break;
+
+    case VIRIDIAN_MSR_EOM:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic_msr);
+        *val = 0;
+        break;
+
+    case VIRIDIAN_MSR_SINT0 ... VIRIDIAN_MSR_SINT15:
+        if ( !(viridian_feature_mask(d) & HVMPV_synic) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_synic_msr);
+        *val = v->arch.hvm_vcpu.viridian.synic.sint[idx - VIRIDIAN_MSR_SINT0].raw;
+        break;
+
+    case VIRIDIAN_MSR_STIMER0_CONFIG ... VIRIDIAN_MSR_STIMER3_COUNT:
+    {
+        const struct viridian_stimer *vs =
+            &v->arch.hvm_vcpu.viridian.stimer[(idx -
+                                              VIRIDIAN_MSR_STIMER0_CONFIG) / 2];
+
+        if ( !(viridian_feature_mask(d) & HVMPV_stimer) )
+            return 0;
+
+        perfc_incr(mshv_rdmsr_stimer_msr);
+        *val = (idx & 1) ? vs->count : vs->config.raw;
+        break;
+    }
+
     default:
         return 0;
     }
@@ -611,9 +1065,49 @@ int rdmsr_viridian_regs(uint32_t idx, uint64_t *val)
     return 1;
 }
 
+int viridian_vcpu_init(struct vcpu *v)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    unsigned int i;
+
+    vv->stimer = xzalloc_array(struct viridian_stimer, VIRIDIAN_STIMER_NR);
+    if ( !vv->stimer )
+        return -ENOMEM;
+
+    for ( i = 0; i < VIRIDIAN_SINT_NR; i++ )
+        vv->synic.sint[i].fields.mask = 1;
+
+    for ( i = 0; i < VIRIDIAN_STIMER_NR; i++ )
+    {
+        struct viridian_stimer *vs = &vv->stimer[i];
+
+        vs->v = v;
+        init_timer(&vs->timer, stimer_expire, vs, v->processor);
+    }
+
+    return 0;
+}
+
+static void teardown_stimers(struct vcpu *v)
+{
+    struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
+    unsigned int i;
+
+    if ( !vv->stimer )
+        return;
+
+    for ( i = 0; i < VIRIDIAN_STIMER_NR; i++ )
+        kill_timer(&vv->stimer[i].timer);
+
+    xfree(vv->stimer);
+    vv->stimer = NULL;
+}
+
 void viridian_vcpu_deinit(struct vcpu *v)
 {
+    teardown_stimers(v);
     teardown_apic_assist(v);
+    teardown_simp(v);
 }
 
 void viridian_domain_deinit(struct domain *d)
@@ -621,10 +1115,75 @@ void viridian_domain_deinit(struct domain *d)
     struct vcpu *v;
 
     for_each_vcpu ( d, v )
+    {
+        teardown_stimers(v);
         teardown_apic_assist(v);
+        teardown_simp(v);
+    }
+}
+
+/* Number of 64-vCPU banks in a processor set which can name our vCPUs. */
+#define VP_SET_BANKS DIV_ROUND_UP(HVM_MAX_VCPUS, 64)
+
+static bool_t need_flush(void *ctxt, struct vcpu *v)
+{
+    const unsigned long *vcpu_mask = ctxt;
+
+    return test_bit(v->vcpu_id, vcpu_mask);
 }
 
-static DEFINE_PER_CPU(cpumask_t, ipi_cpumask);
+/*
+ * Read the vCPUs of the processor set at gpa, as used by the extended
+ * hypercalls, into vcpu_mask.  Banks naming vCPUs which can't exist are
+ * skipped.
+ */
+static int read_vp_set(unsigned long gpa, unsigned long *vcpu_mask)
+{
+    struct {
+        uint64_t format;
+        uint64_t valid_bank_mask;
+    } set;
+    unsigned int bank;
+
+    if ( hvm_copy_from_guest_phys(&set, gpa, sizeof(set)) != HVMCOPY_okay )
+        return -EFAULT;
+
+    switch ( set.format )
+    {
+    case HV_GENERIC_SET_ALL:
+        bitmap_fill(vcpu_mask, HVM_MAX_VCPUS);
+        return 0;
+
+    case HV_GENERIC_SET_SPARSE_4K:
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    /* The set only holds the contents of banks with their valid bit set. */
+    for ( bank = 0; bank < VP_SET_BANKS; bank++ )
+    {
+        uint64_t contents;
+        unsigned int idx;
+        unsigned int i;
+
+        if ( !(set.valid_bank_mask & (1ULL << bank)) )
+            continue;
+
+        idx = hweight64(set.valid_bank_mask & ((1ULL << bank) - 1));
+        if ( hvm_copy_from_guest_phys(&contents,
+                                      gpa + sizeof(set) + idx * 8,
+                                      sizeof(contents)) != HVMCOPY_okay )
+            return -EFAULT;
+
+        for ( i = 0; i < 64 && bank * 64 + i < HVM_MAX_VCPUS; i++ )
+            if ( contents & (1ULL << i) )
+                __set_bit(bank * 64 + i, vcpu_mask);
+    }
+
+    return 0;
+}
 
 int viridian_hypercall(struct cpu_user_regs *regs)
 {
@@ -688,9 +1247,10 @@ int viridian_hypercall(struct cpu_user_regs *regs)
 
     case HvFlushVirtualAddressSpace:
     case HvFlushVirtualAddressList:
+    case HvFlushVirtualAddressSpaceEx:
+    case HvFlushVirtualAddressListEx:
     {
-        cpumask_t *pcpu_mask;
-        struct vcpu *v;
+        DECLARE_BITMAP(vcpu_mask, HVM_MAX_VCPUS);
         struct {
             uint64_t address_space;
             uint64_t flags;
@@ -699,7 +1259,8 @@ int viridian_hypercall(struct cpu_user_regs *regs)
 
         /*
          * See Microsoft Hypervisor Top Level Spec. sections 12.4.2
-         * and 12.4.3.
+         * and 12.4.3.  The extended variants replace vcpu_mask with a
+         * variable sized processor set.
          */
         perfc_incr(mshv_call_flush);
 
@@ -710,47 +1271,44 @@ int viridian_hypercall(struct cpu_user_regs *regs)
 
         /* Get input parameters. */
         if ( hvm_copy_from_guest_phys(&input_params, input_params_gpa,
-                                      sizeof(input_params)) != HVMCOPY_okay )
+                                      offsetof(typeof(input_params),
+                                               vcpu_mask)) != HVMCOPY_okay )
             break;
 
+        bitmap_zero(vcpu_mask, HVM_MAX_VCPUS);
+
         /*
          * It is not clear from the spec. if we are supposed to
          * include current virtual CPU in the set or not in this case,
          * so err on the safe side.
          */
         if ( input_params.flags & HV_FLUSH_ALL_PROCESSORS )
-            input_params.vcpu_mask = ~0ul;
-
-        pcpu_mask = &this_cpu(ipi_cpumask);
-        cpumask_clear(pcpu_mask);
-
-        /*
-         * For each specified virtual CPU flush all ASIDs to invalidate
-         * TLB entries the next time it is scheduled and then, if it
-         * is currently running, add its physical CPU to a mask of
-         * those which need to be interrupted to force a flush.
-         */
-        for_each_vcpu ( currd, v )
+            bitmap_fill(vcpu_mask, HVM_MAX_VCPUS);
+        else if ( input.call_code == HvFlushVirtualAddressSpaceEx ||
+                  input.call_code == HvFlushVirtualAddressListEx )
         {
-            if ( v->vcpu_id >= (sizeof(input_params.vcpu_mask) * 8) )
+            if ( read_vp_set(input_params_gpa +
+                             offsetof(typeof(input_params), vcpu_mask),
+                             vcpu_mask) )
                 break;
-
-            if ( !(input_params.vcpu_mask & (1ul << v->vcpu_id)) )
-                continue;
-
-            hvm_asid_flush_vcpu(v);
-            if ( v != curr && v->is_running )
-                __cpumask_set_cpu(v->processor, pcpu_mask);
+        }
+        else
+        {
+            if ( hvm_copy_from_guest_phys(&input_params, input_params_gpa,
+                                          sizeof(input_params)) !=
+                 HVMCOPY_okay )
+                break;
+            bitmap_copy(vcpu_mask, (unsigned long *)&input_params.vcpu_mask,
+                        64);
         }
 
         /*
-         * Since ASIDs have now been flushed it just remains to
-         * force any CPUs currently running target vCPUs out of non-
-         * root mode. It's possible that re-scheduling has taken place
-         * so we may unnecessarily IPI some CPUs.
+         * Rather than the individual addresses of the List variants, flush
+         * the targets' whole ASIDs.  Only running targets get interrupted,
+         * the others pick up new ASIDs when they are next scheduled.
          */
-        if ( !cpumask_empty(pcpu_mask) )
-            smp_send_event_check_mask(pcpu_mask);
+        if ( !hvm_flush_vcpu_tlb(need_flush, vcpu_mask) )
+            return HVM_HCALL_preempted;
 
         output.rep_complete = input.rep_count;
 
@@ -822,10 +1380,24 @@ static int viridian_save_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
         return 0;
 
     for_each_vcpu( d, v ) {
+        const struct viridian_vcpu *vv = &v->arch.hvm_vcpu.viridian;
         struct hvm_viridian_vcpu_context ctxt = {
-            .apic_assist_msr = v->arch.hvm_vcpu.viridian.apic_assist.msr.raw,
-            .apic_assist_vector = v->arch.hvm_vcpu.viridian.apic_assist.vector,
+            .apic_assist_msr = vv->apic_assist.msr.raw,
+            .apic_assist_vector = vv->apic_assist.vector,
+            .synic_scontrol_msr = vv->synic.scontrol,
+            .synic_siefp_msr = vv->synic.siefp,
+            .synic_simp_msr = vv->synic.simp.raw,
         };
+        unsigned int i;
+
+        for ( i = 0; i < VIRIDIAN_SINT_NR; i++ )
+            ctxt.synic_sint_msr[i] = vv->synic.sint[i].raw;
+
+        for ( i = 0; i < VIRIDIAN_STIMER_NR; i++ )
+        {
+            ctxt.stimer_config_msr[i] = vv->stimer[i].config.raw;
+            ctxt.stimer_count_msr[i] = vv->stimer[i].count;
+        }
 
         if ( hvm_save_entry(VIRIDIAN_VCPU, v->vcpu_id, h, &ctxt) != 0 )
             return 1;
@@ -838,7 +1410,9 @@ static int viridian_load_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
 {
     int vcpuid;
     struct vcpu *v;
+    struct viridian_vcpu *vv;
     struct hvm_viridian_vcpu_context ctxt;
+    unsigned int i;
 
     vcpuid = hvm_load_instance(h);
     if ( vcpuid >= d->max_vcpus || (v = d->vcpu[vcpuid]) == NULL )
@@ -860,6 +1434,35 @@ static int viridian_load_vcpu_ctxt(struct domain *d, hvm_domain_context_t *h)
 
     v->arch.hvm_vcpu.viridian.apic_assist.vector = ctxt.apic_assist_vector;
 
+    vv = &v->arch.hvm_vcpu.viridian;
+
+    /* Records from before SynIC support leave all SINTs masked. */
+    vv->synic.scontrol = ctxt.synic_scontrol_msr;
+    vv->synic.siefp = ctxt.synic_siefp_msr;
+    for ( i = 0; i < VIRIDIAN_SINT_NR; i++ )
+        if ( ctxt.synic_scontrol_msr )
+            vv->synic.sint[i].raw = ctxt.synic_sint_msr[i];
+
+    teardown_simp(v);
+    vv->synic.simp.raw = ctxt.synic_simp_msr;
+    if ( vv->synic.simp.fields.enabled )
+        initialize_simp(v);
+
+    /*
+     * Reference time isn't running yet, so leave starting the timers to
+     * viridian_poll_stimers() once the vCPU runs.
+     */
+    for ( i = 0; i < VIRIDIAN_STIMER_NR; i++ )
+    {
+        struct viridian_stimer *vs = &vv->stimer[i];
+
+        stop_stimer(vs);
+        vs->config.raw = ctxt.stimer_config_msr[i];
+        vs->count = ctxt.stimer_count_msr[i];
+        if ( vs->config.fields.enabled && vs->count )
+            set_bit(i, &vv->stimer_pending);
+    }
+
     return 0;
 }
 
@@ -440,6 +440,208 @@ void vlapic_handle_EOI(struct vlapic *vlapic, u8 vector)
     hvm_dpci_msi_eoi(d, vector);
 }
 
+/*
+ * Destination lookup for vlapic_ipi(), resolving physical and logical
+ * destinations without matching against every vCPU.  It is rebuilt lazily
+ * once any vCPU has changed its APIC ID, LDR, DFR or mode, and only used
+ * while all vCPUs agree on the addressing mode and no two of them claim
+ * the same destination.  vCPUs are all created before the domain first
+ * runs, and only freed with it.
+ */
+#define VLAPIC_MAP_PHYS_NR      256
+#define VLAPIC_MAP_CLUSTERS     16
+#define VLAPIC_MAP_CLUSTER_BITS 16
+
+struct vlapic_map {
+    struct rcu_head rcu;
+    enum {
+        map_mixed,
+        map_flat,
+        map_cluster,
+        map_x2apic,
+    } mode;
+    bool_t phys_ok, logical_ok;
+    struct vcpu *phys[VLAPIC_MAP_PHYS_NR];
+    struct vcpu *logical[VLAPIC_MAP_CLUSTERS][VLAPIC_MAP_CLUSTER_BITS];
+};
+
+static DEFINE_RCU_READ_LOCK(vlapic_map_rcu_lock);
+
+static void vlapic_map_invalidate(struct domain *d)
+{
+    smp_wmb();
+    write_atomic(&d->arch.hvm_domain.vlapic_map_dirty, 1);
+}
+
+static unsigned int vlapic_map_mode(const struct vlapic *vlapic)
+{
+    if ( vlapic_x2apic_mode(vlapic) )
+        return map_x2apic;
+
+    switch ( vlapic_get_reg(vlapic, APIC_DFR) )
+    {
+    case APIC_DFR_FLAT:
+        return map_flat;
+    case APIC_DFR_CLUSTER:
+        return map_cluster;
+    }
+
+    return map_mixed;
+}
+
+/* Split a logical ID or destination into its cluster and member bits. */
+static unsigned int vlapic_map_cluster(unsigned int mode, uint32_t ldr,
+                                       unsigned long *bits)
+{
+    switch ( mode )
+    {
+    case map_flat:
+        *bits = (uint8_t)ldr;
+        return 0;
+    case map_cluster:
+        *bits = ldr & 0xf;
+        return (uint8_t)ldr >> 4;
+    }
+
+    ASSERT(mode == map_x2apic);
+    *bits = (uint16_t)ldr;
+    return ldr >> 16;
+}
+
+static struct vlapic_map *vlapic_map_build(struct domain *d)
+{
+    struct vlapic_map *map = xzalloc(struct vlapic_map);
+    struct vcpu *v;
+
+    if ( !map )
+        return NULL;
+
+    map->phys_ok = map->logical_ok = 1;
+
+    for_each_vcpu ( d, v )
+    {
+        const struct vlapic *vlapic = vcpu_vlapic(v);
+        unsigned int mode = vlapic_map_mode(vlapic);
+        uint32_t id = VLAPIC_ID(vlapic), ldr = vlapic_get_reg(vlapic, APIC_LDR);
+        unsigned int cluster, bit;
+        unsigned long bits;
+
+        if ( v == d->vcpu[0] )
+            map->mode = mode;
+        if ( mode != map->mode || mode == map_mixed )
+        {
+            map->mode = map_mixed;
+            break;
+        }
+
+        if ( id >= VLAPIC_MAP_PHYS_NR || map->phys[id] )
+            map->phys_ok = 0;
+        else
+            map->phys[id] = v;
+
+        if ( mode != map_x2apic )
+            ldr = GET_xAPIC_LOGICAL_ID(ldr);
+        cluster = vlapic_map_cluster(mode, ldr, &bits);
+        if ( !bits )
+            continue;
+        /* Members of several slots would get each interrupt repeatedly. */
+        if ( cluster >= VLAPIC_MAP_CLUSTERS || (bits & (bits - 1)) )
+        {
+            map->logical_ok = 0;
+            continue;
+        }
+
+        bit = find_first_bit(&bits, VLAPIC_MAP_CLUSTER_BITS);
+        if ( map->logical[cluster][bit] )
+            map->logical_ok = 0;
+        else
+            map->logical[cluster][bit] = v;
+    }
+
+    return map;
+}
+
+static void vlapic_map_free(struct rcu_head *rcu)
+{
+    xfree(container_of(rcu, struct vlapic_map, rcu));
+}
+
+static void vlapic_map_update(struct domain *d)
+{
+    struct hvm_domain *hd = &d->arch.hvm_domain;
+    struct vlapic_map *old;
+
+    spin_lock(&hd->vlapic_map_lock);
+
+    if ( hd->vlapic_map_dirty )
+    {
+        /* Register updates racing with the rebuild will mark it dirty again. */
+        hd->vlapic_map_dirty = 0;
+        smp_mb();
+
+        old = hd->vlapic_map;
+        rcu_assign_pointer(hd->vlapic_map, vlapic_map_build(d));
+        if ( old )
+            call_rcu(&old->rcu, vlapic_map_free);
+    }
+
+    spin_unlock(&hd->vlapic_map_lock);
+}
+
+/*
+ * Deliver a no-shorthand IPI to the targets the map resolves its destination
+ * to.  Returns 0 if the map can't, for the caller to match every vCPU.
+ */
+static bool_t vlapic_map_ipi(struct vlapic *vlapic, uint32_t icr_low,
+                             uint32_t dest, bool_t dest_mode)
+{
+    struct domain *d = vlapic_domain(vlapic);
+    const struct vlapic_map *map;
+    unsigned int cluster, bit;
+    unsigned long bits;
+    bool_t done = 0;
+
+    if ( unlikely(read_atomic(&d->arch.hvm_domain.vlapic_map_dirty)) )
+        vlapic_map_update(d);
+
+    rcu_read_lock(&vlapic_map_rcu_lock);
+
+    map = rcu_dereference(d->arch.hvm_domain.vlapic_map);
+    if ( !map || map->mode == map_mixed )
+        goto out;
+
+    if ( !dest_mode )
+    {
+        /* Leave broadcasts to the caller; they target everyone anyway. */
+        if ( !map->phys_ok ||
+             dest == (map->mode == map_x2apic ? 0xffffffff : 0xff) )
+            goto out;
+        if ( dest < VLAPIC_MAP_PHYS_NR && map->phys[dest] )
+            vlapic_accept_irq(map->phys[dest], icr_low);
+        done = 1;
+    }
+    else if ( map->logical_ok )
+    {
+        cluster = vlapic_map_cluster(map->mode, dest, &bits);
+        if ( cluster < VLAPIC_MAP_CLUSTERS )
+            for_each_set_bit ( bit, &bits, VLAPIC_MAP_CLUSTER_BITS )
+                if ( map->logical[cluster][bit] )
+                    vlapic_accept_irq(map->logical[cluster][bit], icr_low);
+        done = 1;
+    }
+
+ out:
+    rcu_read_unlock(&vlapic_map_rcu_lock);
+
+    return done;
+}
+
+void vlapic_map_destroy(struct domain *d)
+{
+    xfree(d->arch.hvm_domain.vlapic_map);
+    d->arch.hvm_domain.vlapic_map = NULL;
+}
+
 static bool_t is_multicast_dest(struct vlapic *vlapic, unsigned int short_hand,
                                 uint32_t dest, bool_t dest_mode)
 {
@@ -510,12 +712,14 @@ void vlapic_ipi(
 
         if ( batch )
             cpu_raise_softirq_batch_begin();
-        for_each_vcpu ( vlapic_domain(vlapic), v )
-        {
-            if ( vlapic_match_dest(vcpu_vlapic(v), vlapic,
-                                   short_hand, dest, dest_mode) )
-                vlapic_accept_irq(v, icr_low);
-        }
+        if ( short_hand != APIC_DEST_NOSHORT ||
+             !vlapic_map_ipi(vlapic, icr_low, dest, dest_mode) )
+            for_each_vcpu ( vlapic_domain(vlapic), v )
+            {
+                if ( vlapic_match_dest(vcpu_vlapic(v), vlapic,
+                                       short_hand, dest, dest_mode) )
+                    vlapic_accept_irq(v, icr_low);
+            }
         if ( batch )
             cpu_raise_softirq_batch_finish();
         break;
@@ -691,6 +895,7 @@ static void vlapic_reg_write(struct vcpu *v,
     {
     case APIC_ID:
         vlapic_set_reg(vlapic, APIC_ID, val);
+        vlapic_map_invalidate(v->domain);
         break;
 
     case APIC_TASKPRI:
@@ -703,10 +908,12 @@ static void vlapic_reg_write(struct vcpu *v,
 
     case APIC_LDR:
         vlapic_set_reg(vlapic, APIC_LDR, val & APIC_LDR_MASK);
+        vlapic_map_invalidate(v->domain);
         break;
 
     case APIC_DFR:
         vlapic_set_reg(vlapic, APIC_DFR, val | 0x0FFFFFFF);
+        vlapic_map_invalidate(v->domain);
         break;
 
     case APIC_SPIV:
@@ -996,6 +1203,7 @@ static void set_x2apic_id(struct vlapic *vlapic)
 
     vlapic_set_reg(vlapic, APIC_ID, id * 2);
     vlapic_set_reg(vlapic, APIC_LDR, ldr);
+    vlapic_map_invalidate(vlapic_domain(vlapic));
 }
 
 bool_t vlapic_msr_set(struct vlapic *vlapic, uint64_t value)
@@ -1027,6 +1235,7 @@ bool_t vlapic_msr_set(struct vlapic *vlapic, uint64_t value)
 
     vlapic->hw.apic_base_msr = value;
     memset(&vlapic->loaded, 0, sizeof(vlapic->loaded));
+    vlapic_map_invalidate(vlapic_domain(vlapic));
 
     if ( vlapic_x2apic_mode(vlapic) )
         set_x2apic_id(vlapic);
@@ -1184,6 +1393,9 @@ int vlapic_has_pending_irq(struct vcpu *v)
     if ( !vlapic_enabled(vlapic) )
         return -1;
 
+    if ( has_viridian_stimer(v->domain) )
+        viridian_poll_stimers(v);
+
     irr = vlapic_find_highest_irr(vlapic);
     if ( irr == -1 )
         return -1;
@@ -1243,7 +1455,10 @@ int vlapic_ack_pending_irq(struct vcpu *v, int vector, bool_t force_ack)
     viridian_start_apic_assist(v, vector);
 
  done:
-    vlapic_set_vector(vector, &vlapic->regs->data[APIC_ISR]);
+    /* AutoEOI SINTs are implicitly EOIed on acceptance. */
+    if ( !has_viridian_synic(v->domain) ||
+         !viridian_is_auto_eoi_sint(v, vector) )
+        vlapic_set_vector(vector, &vlapic->regs->data[APIC_ISR]);
     vlapic_clear_irr(vector, vlapic);
     return 1;
 }
@@ -1281,6 +1496,7 @@ void vlapic_reset(struct vlapic *vlapic)
     vlapic_set_tdcr(vlapic, 0);
 
     vlapic_set_reg(vlapic, APIC_DFR, 0xffffffffU);
+    vlapic_map_invalidate(v->domain);
 
     for ( i = 0; i < VLAPIC_LVT_NUM; i++ )
         vlapic_set_reg(vlapic, APIC_LVTT + 0x10 * i, APIC_LVT_MASKED);
@@ -1417,6 +1633,7 @@ static int lapic_load_hidden(struct domain *d, hvm_domain_context_t *h)
     s->loaded.hw = 1;
     if ( s->loaded.regs )
         lapic_load_fixup(s);
+    vlapic_map_invalidate(d);
 
     if ( !(s->hw.apic_base_msr & MSR_IA32_APICBASE_ENABLE) &&
          unlikely(vlapic_x2apic_mode(s)) )
@@ -1454,6 +1671,7 @@ static int lapic_load_regs(struct domain *d, hvm_domain_context_t *h)
     s->loaded.regs = 1;
     if ( s->loaded.hw )
         lapic_load_fixup(s);
+    vlapic_map_invalidate(d);
 
     if ( hvm_funcs.process_isr )
         hvm_funcs.process_isr(vlapic_find_highest_isr(s), v);
@@ -25,6 +25,7 @@
 #include <xen/domain_page.h>
 #include <xen/hypercall.h>
 #include <xen/perfc.h>
+#include <xen/lathist.h>
 #include <asm/current.h>
 #include <asm/io.h>
 #include <asm/iocap.h>
@@ -319,6 +320,11 @@ static void vmx_vcpu_destroy(struct vcpu *v)
 }
 
 static DEFINE_PER_CPU(struct vmx_msr_state, host_msr_state);
+/*
+ * The guest values currently loaded, for the MSRs flagged in host_msr_state
+ * (the flags of this one are unused).
+ */
+static DEFINE_PER_CPU(struct vmx_msr_state, loaded_msr_state);
 
 static const u32 msr_index[VMX_MSR_COUNT] =
 {
@@ -344,6 +350,8 @@ void vmx_save_host_msrs(void)
         __set_bit(VMX_INDEX_MSR_ ## address, &guest_msr_state->flags);  \
         wrmsrl(MSR_ ## address, msr_content);                           \
         __set_bit(VMX_INDEX_MSR_ ## address, &host_msr_state->flags);   \
+        this_cpu(loaded_msr_state).msrs[VMX_INDEX_MSR_ ## address] =    \
+            msr_content;                                                \
     } while ( 0 )
 
 static enum handler_return
@@ -453,7 +461,9 @@ long_mode_do_msr_write(unsigned int msr, uint64_t msr_content)
  * To avoid MSR save/restore at every VM exit/entry time, we restore
  * the x86_64 specific MSRs at domain switch time. Since these MSRs
  * are not modified once set for para domains, we don't save them,
- * but simply reset them to values set in percpu_traps_init().
+ * but simply reset them to values set in percpu_traps_init().  This is
+ * only done when switching away from HVM vcpus altogether: between two
+ * of them, vmx_restore_guest_msrs() only writes the values which differ.
  */
 static void vmx_restore_host_msrs(void)
 {
@@ -479,27 +489,46 @@ static void vmx_save_guest_msrs(struct vcpu *v)
 
 static void vmx_restore_guest_msrs(struct vcpu *v)
 {
-    struct vmx_msr_state *guest_msr_state, *host_msr_state;
-    unsigned long guest_flags;
+    struct vmx_msr_state *guest_msr_state, *host_msr_state, *loaded_msr_state;
     int i;
 
     guest_msr_state = &v->arch.hvm_vmx.msr_state;
     host_msr_state = &this_cpu(host_msr_state);
+    loaded_msr_state = &this_cpu(loaded_msr_state);
 
     wrmsrl(MSR_SHADOW_GS_BASE, v->arch.hvm_vmx.shadow_gs);
 
-    guest_flags = guest_msr_state->flags;
-
-    while ( guest_flags )
+    /*
+     * The previous vcpu may have left its values loaded: only write those
+     * differing from the ones this vcpu wants, i.e. its own if it set any,
+     * or else the host's.
+     */
+    for ( i = 0; i < VMX_MSR_COUNT; i++ )
     {
-        i = find_first_set_bit(guest_flags);
+        unsigned long val, cur;
+
+        val = test_bit(i, &guest_msr_state->flags) ? guest_msr_state->msrs[i]
+                                                   : host_msr_state->msrs[i];
+        cur = test_bit(i, &host_msr_state->flags) ? loaded_msr_state->msrs[i]
+                                                  : host_msr_state->msrs[i];
+        if ( val == cur )
+        {
+            if ( test_bit(i, &guest_msr_state->flags) )
+                perfc_incr(msr_writes_elided);
+            continue;
+        }
 
         HVM_DBG_LOG(DBG_LEVEL_2,
                     "restore guest's index %d msr %x with value %lx",
-                    i, msr_index[i], guest_msr_state->msrs[i]);
-        __set_bit(i, &host_msr_state->flags);
-        wrmsrl(msr_index[i], guest_msr_state->msrs[i]);
-        __clear_bit(i, &guest_flags);
+                    i, msr_index[i], val);
+        wrmsrl(msr_index[i], val);
+        if ( val != host_msr_state->msrs[i] )
+        {
+            __set_bit(i, &host_msr_state->flags);
+            loaded_msr_state->msrs[i] = val;
+        }
+        else
+            __clear_bit(i, &host_msr_state->flags);
     }
 
     if ( (v->arch.hvm_vcpu.guest_efer ^ read_efer()) & EFER_SCE )
@@ -512,7 +541,7 @@ static void vmx_restore_guest_msrs(struct vcpu *v)
     }
 
     if ( cpu_has_rdtscp )
-        wrmsrl(MSR_TSC_AUX, hvm_msr_tsc_aux(v));
+        wrmsr_tsc_aux(hvm_msr_tsc_aux(v));
 }
 
 void vmx_update_cpu_exec_control(struct vcpu *v)
@@ -898,7 +927,9 @@ static void vmx_ctxt_switch_from(struct vcpu *v)
 
     vmx_fpu_leave(v);
     vmx_save_guest_msrs(v);
-    vmx_restore_host_msrs();
+    /* current is the vcpu being switched to. */
+    if ( !has_hvm_container_vcpu(current) )
+        vmx_restore_host_msrs();
     vmx_save_dr(v);
 
     if ( v->domain->arch.hvm_domain.vmx.pi_switch_from )
@@ -3243,6 +3274,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
     unsigned long exit_qualification, exit_reason, idtv_info, intr_info = 0;
     unsigned int vector = 0, mode;
     struct vcpu *v = current;
+    s_time_t start = lathist_start();
 
     __vmread(GUEST_RIP,    &regs->rip);
     __vmread(GUEST_RSP,    &regs->rsp);
@@ -3269,6 +3301,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
                     0, 0, 0, 0);
 
     perfc_incra(vmexits, exit_reason);
+    perfc_dom_incra(dom_vmexits, exit_reason);
 
     /* Handle the interrupt we missed before allowing any more in. */
     switch ( (uint16_t)exit_reason )
@@ -3367,6 +3400,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
                 perfc_incr(realmode_exits);
                 v->arch.hvm_vmx.vmx_emulate = 1;
                 HVMTRACE_0D(REALMODE_EMULATE);
+                lathist_vmexit((uint16_t)exit_reason, start);
                 return;
             }
         case EXIT_REASON_EXTERNAL_INTERRUPT:
@@ -3819,7 +3853,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
 
     case EXIT_REASON_PAUSE_INSTRUCTION:
         perfc_incr(pauseloop_exits);
-        do_sched_op(SCHEDOP_yield, guest_handle_from_ptr(NULL, void));
+        vcpu_yield_directed();
         break;
 
     case EXIT_REASON_XSETBV:
@@ -3905,6 +3939,22 @@ out:
         else
             domain_crash(v->domain);
     }
+
+    lathist_vmexit((uint16_t)exit_reason, start);
+}
+
+/* Flush @p2m's translations on @cpu if it missed an invalidation. */
+static void vmx_flush_stale_ept(struct p2m_domain *p2m, unsigned int cpu)
+{
+    struct ept_data *ept = &p2m->ept;
+    unsigned long gen = read_atomic(&ept->flush_gen);
+
+    if ( ept->cpu_flush_gen[cpu] != gen )
+    {
+        ept->cpu_flush_gen[cpu] = gen;
+        perfc_incr(ept_invept);
+        __invept(INVEPT_SINGLE_CONTEXT, ept_get_eptp(ept), 0);
+    }
 }
 
 void vmx_vmenter_helper(const struct cpu_user_regs *regs)
@@ -3952,14 +4002,31 @@ void vmx_vmenter_helper(const struct cpu_user_regs *regs)
 
     if ( paging_mode_hap(curr->domain) )
     {
-        struct ept_data *ept = &p2m_get_hostp2m(curr->domain)->ept;
+        struct domain *currd = curr->domain;
+        struct p2m_domain *p2m = NULL;
         unsigned int cpu = smp_processor_id();
+        unsigned int i;
 
-        if ( cpumask_test_cpu(cpu, ept->invalidate) )
+        if ( !altp2m_active(currd) )
+            p2m = p2m_get_hostp2m(currd);
+        else if ( curr->arch.hvm_vmx.secondary_exec_control &
+                  SECONDARY_EXEC_ENABLE_VM_FUNCTIONS )
         {
-            cpumask_clear_cpu(cpu, ept->invalidate);
-            __invept(INVEPT_SINGLE_CONTEXT, ept_get_eptp(ept), 0);
+            /*
+             * VMFUNC switches views without an exit, so every view must be
+             * current before entering the guest.  Views already flushed on
+             * this PCPU are skipped, which keeps the switches themselves
+             * free of INVEPTs.
+             */
+            for ( i = 0; i < MAX_ALTP2M; i++ )
+                if ( currd->arch.altp2m_eptp[i] != mfn_x(INVALID_MFN) )
+                    vmx_flush_stale_ept(currd->arch.altp2m_p2m[i], cpu);
         }
+        else
+            p2m = p2m_get_altp2m(curr) ?: p2m_get_hostp2m(currd);
+
+        if ( p2m )
+            vmx_flush_stale_ept(p2m, cpu);
     }
 
  out:
@@ -116,6 +116,7 @@ int nvmx_vcpu_initialise(struct vcpu *v)
     nvmx->iobitmap[1] = NULL;
     nvmx->msrbitmap = NULL;
     INIT_LIST_HEAD(&nvmx->launched_list);
+    nvmx->gstate_dirty = ~0ULL;
     return 0;
 }
  
@@ -758,6 +759,8 @@ static void nvmx_purge_vvmcs(struct vcpu *v)
     nvcpu->nv_vvmcx = NULL;
     nvcpu->nv_vvmcxaddr = VMCX_EADDR;
     v->arch.hvm_vmx.vmcs_shadow_maddr = 0;
+    /* The shadow VMCS is shared by all virtual VMCSs. */
+    nvmx->gstate_dirty = ~0ULL;
     for (i=0; i<2; i++) {
         if ( nvmx->iobitmap[i] ) {
             hvm_unmap_guest_frame(nvmx->iobitmap[i], 1);
@@ -968,6 +971,41 @@ fallback:
         shadow_to_vvmcs(v, field[i]);
 }
 
+/*
+ * Without VMCS shadowing every L1 VMWRITE traps, so we know which guest
+ * state fields changed since the shadow VMCS was last synced with the
+ * virtual one, and only those need copying on virtual VM entry.
+ */
+static void vvmcs_gstate_mark_dirty(struct vcpu *v, u32 field)
+{
+    unsigned int i;
+
+    BUILD_BUG_ON(ARRAY_SIZE(vmcs_gstate_field) > 64);
+
+    for ( i = 0; i < ARRAY_SIZE(vmcs_gstate_field); i++ )
+        if ( vmcs_gstate_field[i] == (field & ~VMCS_HIGH(0)) )
+        {
+            vcpu_2_nvmx(v).gstate_dirty |= 1ULL << i;
+            break;
+        }
+}
+
+static void vvmcs_to_shadow_gstate(struct vcpu *v)
+{
+    struct nestedvmx *nvmx = &vcpu_2_nvmx(v);
+    unsigned int i;
+
+    if ( cpu_has_vmx_vmcs_shadowing )
+        vvmcs_to_shadow_bulk(v, ARRAY_SIZE(vmcs_gstate_field),
+                             vmcs_gstate_field);
+    else
+        for ( i = 0; i < ARRAY_SIZE(vmcs_gstate_field); i++ )
+            if ( nvmx->gstate_dirty & (1ULL << i) )
+                vvmcs_to_shadow(v, vmcs_gstate_field[i]);
+
+    nvmx->gstate_dirty = 0;
+}
+
 static void load_shadow_control(struct vcpu *v)
 {
     /*
@@ -1000,8 +1038,7 @@ static void load_shadow_guest_state(struct vcpu *v)
     };
 
     /* vvmcs.gstate to shadow vmcs.gstate */
-    vvmcs_to_shadow_bulk(v, ARRAY_SIZE(vmcs_gstate_field),
-                         vmcs_gstate_field);
+    vvmcs_to_shadow_gstate(v);
 
     nvcpu->guest_cr[0] = get_vvmcs(v, CR0_READ_SHADOW);
     nvcpu->guest_cr[4] = get_vvmcs(v, CR4_READ_SHADOW);
@@ -1160,6 +1197,7 @@ static void sync_vvmcs_guest_state(struct vcpu *v, struct cpu_user_regs *regs)
     /* copy shadow vmcs.gstate back to vvmcs.gstate */
     shadow_to_vvmcs_bulk(v, ARRAY_SIZE(vmcs_gstate_field),
                          vmcs_gstate_field);
+    vcpu_2_nvmx(v).gstate_dirty = 0;
     /* RIP, RSP are in user regs */
     set_vvmcs(v, GUEST_RIP, regs->eip);
     set_vvmcs(v, GUEST_RSP, regs->esp);
@@ -1716,6 +1754,7 @@ int nvmx_handle_vmwrite(struct cpu_user_regs *regs)
 
     vmcs_encoding = reg_read(regs, decode.reg2);
     set_vvmcs(v, vmcs_encoding, operand);
+    vvmcs_gstate_mark_dirty(v, vmcs_encoding);
 
     switch ( vmcs_encoding & ~VMCS_HIGH(0) )
     {
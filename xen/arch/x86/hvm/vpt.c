@@ -149,7 +149,10 @@ static void pt_process_missed_ticks(struct periodic_time *pt)
     if ( mode_is(pt->vcpu->domain, no_missed_ticks_pending) )
         pt->do_not_freeze = !pt->pending_intr_nr;
     else
+    {
         pt->pending_intr_nr += missed_ticks;
+        pt->vcpu->arch.hvm_vcpu.tm_pending = 1;
+    }
     pt->scheduled += missed_ticks * pt->period;
 }
 
@@ -222,6 +225,7 @@ static void pt_timer_fn(void *data)
     pt->pending_intr_nr++;
     pt->scheduled += pt->period;
     pt->do_not_freeze = 0;
+    pt->vcpu->arch.hvm_vcpu.tm_pending = 1;
 
     vcpu_kick(pt->vcpu);
 
@@ -235,6 +239,14 @@ int pt_update_irq(struct vcpu *v)
     uint64_t max_lag;
     int irq, is_lapic;
 
+    /*
+     * Nothing can be pending unless tm_pending is set.  A timer firing
+     * after this check sets it before kicking us, which makes us come
+     * back here before entering the guest.
+     */
+    if ( !read_atomic(&v->arch.hvm_vcpu.tm_pending) )
+        return -1;
+
     spin_lock(&v->arch.hvm_vcpu.tm_lock);
 
     earliest_pt = NULL;
@@ -263,6 +275,7 @@ int pt_update_irq(struct vcpu *v)
 
     if ( earliest_pt == NULL )
     {
+        v->arch.hvm_vcpu.tm_pending = 0;
         spin_unlock(&v->arch.hvm_vcpu.tm_lock);
         return -1;
     }
@@ -316,7 +329,9 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
     time_cb *cb;
     void *cb_priv;
 
-    if ( intack.source == hvm_intsrc_vector )
+    /* Only pending timers can have had an interrupt issued. */
+    if ( intack.source == hvm_intsrc_vector ||
+         !read_atomic(&v->arch.hvm_vcpu.tm_pending) )
         return;
 
     spin_lock(&v->arch.hvm_vcpu.tm_lock);
@@ -484,6 +499,8 @@ static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
     {
         pt->on_list = 1;
         list_add(&pt->list, &v->arch.hvm_vcpu.tm_list);
+        if ( pt->pending_intr_nr )
+            v->arch.hvm_vcpu.tm_pending = 1;
 
         migrate_timer(&pt->timer, v->processor);
     }
@@ -528,6 +545,7 @@ static void pt_resume(struct periodic_time *pt)
     {
         pt->on_list = 1;
         list_add(&pt->list, &pt->vcpu->arch.hvm_vcpu.tm_list);
+        pt->vcpu->arch.hvm_vcpu.tm_pending = 1;
         vcpu_kick(pt->vcpu);
     }
     pt_unlock(pt);
@@ -18,7 +18,9 @@
  */
 
 #include <xen/compiler.h>
+#include <xen/guest_access.h>
 #include <xen/hypercall.h>
+#include <xen/lathist.h>
 #include <xen/trace.h>
 
 #define ARGS(x, n)                              \
@@ -143,6 +145,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
     unsigned long old_rip = regs->rip;
 #endif
     unsigned long eax;
+    s_time_t start;
 
     ASSERT(guest_kernel_mode(curr, regs));
 
@@ -158,6 +161,8 @@ void pv_hypercall(struct cpu_user_regs *regs)
         return;
     }
 
+    start = lathist_start();
+
     if ( !is_pv_32bit_vcpu(curr) )
     {
         unsigned long rdi = regs->rdi;
@@ -252,7 +257,9 @@ void pv_hypercall(struct cpu_user_regs *regs)
 #endif
     }
 
+    lathist_hypercall(eax, start);
     perfc_incr(hypercalls);
+    perfc_dom_incra(dom_hypercalls, eax);
 }
 
 void arch_do_multicall_call(struct mc_state *state)
@@ -261,6 +268,38 @@ void arch_do_multicall_call(struct mc_state *state)
     {
         struct multicall_entry *call = &state->call;
 
+        /*
+         * The sub-calls PV guests batch the most, dispatched directly rather
+         * than through the table.
+         */
+        switch ( call->op )
+        {
+        case __HYPERVISOR_mmu_update:
+            call->result = do_mmu_update(
+                guest_handle_from_ptr(call->args[0], mmu_update_t),
+                call->args[1], guest_handle_from_ptr(call->args[2], uint),
+                call->args[3]);
+            return;
+
+        case __HYPERVISOR_update_va_mapping:
+            call->result = do_update_va_mapping(call->args[0], call->args[1],
+                                                call->args[2]);
+            return;
+
+        case __HYPERVISOR_mmuext_op:
+            call->result = do_mmuext_op(
+                guest_handle_from_ptr(call->args[0], mmuext_op_t),
+                call->args[1], guest_handle_from_ptr(call->args[2], uint),
+                call->args[3]);
+            return;
+
+        case __HYPERVISOR_grant_table_op:
+            call->result = do_grant_table_op(
+                call->args[0], guest_handle_from_ptr(call->args[1], void),
+                call->args[2]);
+            return;
+        }
+
         if ( (call->op < ARRAY_SIZE(pv_hypercall_table)) &&
              pv_hypercall_table[call->op].native )
             call->result = pv_hypercall_table[call->op].native(
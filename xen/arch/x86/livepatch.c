@@ -62,6 +62,47 @@ void arch_livepatch_revert_jmp(const struct livepatch_func *func)
     memcpy(func->old_addr, func->opaque, PATCH_INSN_SIZE);
 }
 
+bool_t arch_livepatch_can_poke(void)
+{
+    return 1;
+}
+
+/*
+ * In the manner of cross-modifying code elsewhere: an int3 covers the site
+ * while the displacement (or the saved bytes) are written behind it, and
+ * do_int3() forwards anyone hitting it to the new function.  The opcode goes
+ * in last.
+ */
+bool_t arch_livepatch_poke_jmp(struct livepatch_func *func, bool_t apply,
+                               unsigned int step)
+{
+    uint8_t *old_ptr = func->old_addr;
+    int32_t val;
+
+    switch ( step )
+    {
+    case 0:
+        if ( apply )
+            memcpy(func->opaque, old_ptr, PATCH_INSN_SIZE);
+        write_atomic(old_ptr, 0xcc);
+        return 1;
+
+    case 1:
+        if ( apply )
+        {
+            val = func->new_addr - func->old_addr - PATCH_INSN_SIZE;
+            memcpy(old_ptr + 1, &val, sizeof(val));
+        }
+        else
+            memcpy(old_ptr + 1, func->opaque + 1, PATCH_INSN_SIZE - 1);
+        return 1;
+
+    default:
+        write_atomic(old_ptr, apply ? 0xe9 : func->opaque[0]);
+        return 0;
+    }
+}
+
 /* Serialise the CPU pipeline. */
 void arch_livepatch_post_action(void)
 {
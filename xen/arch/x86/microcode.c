@@ -31,6 +31,7 @@
 #include <xen/smp.h>
 #include <xen/softirq.h>
 #include <xen/spinlock.h>
+#include <xen/stop_machine.h>
 #include <xen/tasklet.h>
 #include <xen/guest_access.h>
 #include <xen/earlycpio.h>
@@ -192,9 +193,30 @@ struct microcode_info {
     unsigned int cpu;
     uint32_t buffer_size;
     int error;
+    /* Parallel mode only. */
+    unsigned int lead;
+    s_time_t start, lead_done;
     char buffer[1];
 };
 
+/*
+ * In parallel mode, a late update is first performed on the first online
+ * CPU only, which parses the blob and keeps the patch for its core.  The
+ * first thread of every other core then copies that patch, if it fits,
+ * with interrupts still enabled.  Only then is the machine stopped, once,
+ * for all those threads to load the patch at the same time, while the
+ * other threads of each core, sharing its microcode engine, wait for them.
+ */
+static bool_t __read_mostly opt_ucode_parallel;
+boolean_param("ucode_parallel", opt_ucode_parallel);
+
+static bool_t ucode_parallel_busy;
+static cpumask_t ucode_pending;     /* Cores still to load the patch. */
+static cpumask_t ucode_done;        /* Cores done with loading. */
+static int ucode_apply_error;
+static DEFINE_PER_CPU(s_time_t, ucode_apply_start);
+static DEFINE_PER_CPU(s_time_t, ucode_apply_end);
+
 static void __microcode_fini_cpu(unsigned int cpu)
 {
     struct ucode_cpu_info *uci = &per_cpu(ucode_cpu_info, cpu);
@@ -303,6 +325,137 @@ static long do_microcode_update(void *_info)
     return error;
 }
 
+/* Copy the patch found on @lead, if this CPU's core should load it. */
+static int microcode_prepare_cpu(unsigned int lead)
+{
+    unsigned int cpu = smp_processor_id();
+    struct ucode_cpu_info *uci = &per_cpu(ucode_cpu_info, cpu);
+    const void *mc = per_cpu(ucode_cpu_info, lead).mc.mc_valid;
+    int err;
+
+    spin_lock(&microcode_mutex);
+
+    err = microcode_ops->collect_cpu_info(cpu, &uci->cpu_sig);
+    if ( unlikely(err) )
+        __microcode_fini_cpu(cpu);
+    else if ( mc )
+    {
+        err = microcode_ops->microcode_resume_match(cpu, mc);
+        if ( err > 0 )
+        {
+            cpumask_set_cpu(cpu, &ucode_pending);
+            err = 0;
+        }
+    }
+
+    spin_unlock(&microcode_mutex);
+
+    return err;
+}
+
+static int do_microcode_apply(void *unused)
+{
+    unsigned int cpu = smp_processor_id();
+    unsigned int first = cpumask_first(per_cpu(cpu_sibling_mask, cpu));
+    int err;
+
+    this_cpu(ucode_apply_start) = NOW();
+
+    if ( cpu == first )
+    {
+        if ( cpumask_test_cpu(cpu, &ucode_pending) )
+        {
+            err = microcode_ops->apply_microcode(cpu);
+            if ( err )
+                (void)cmpxchg(&ucode_apply_error, 0, err);
+        }
+        cpumask_set_cpu(cpu, &ucode_done);
+    }
+    else
+    {
+        while ( !cpumask_test_cpu(first, &ucode_done) )
+            cpu_relax();
+        /* Pick up the revision the core got updated to. */
+        microcode_ops->collect_cpu_info(cpu, &this_cpu(ucode_cpu_info).cpu_sig);
+    }
+
+    this_cpu(ucode_apply_end) = NOW();
+
+    return 0;
+}
+
+static long microcode_apply_parallel(struct microcode_info *info)
+{
+    s_time_t prepared = NOW(), entered = 0, done = 0;
+    unsigned int cpu, nr = cpumask_weight(&ucode_pending);
+    int error = info->error;
+
+    if ( !error && nr )
+    {
+        ucode_apply_error = 0;
+        cpumask_clear(&ucode_done);
+
+        error = stop_machine_run(do_microcode_apply, NULL, NR_CPUS);
+        if ( !error )
+            error = ucode_apply_error;
+
+        for_each_cpu ( cpu, &cpu_online_map )
+        {
+            entered = max(entered, per_cpu(ucode_apply_start, cpu));
+            done = max(done, per_cpu(ucode_apply_end, cpu));
+        }
+        printk(XENLOG_INFO "microcode: %u cores updated in parallel: "
+               "first core %"PRI_stime"us, prepare %"PRI_stime"us, "
+               "rendezvous %"PRI_stime"us, update %"PRI_stime"us\n",
+               nr, (info->lead_done - info->start) / MICROSECS(1),
+               (prepared - info->lead_done) / MICROSECS(1),
+               (entered - prepared) / MICROSECS(1),
+               (done - entered) / MICROSECS(1));
+    }
+
+    ucode_parallel_busy = 0;
+    xfree(info);
+
+    return error;
+}
+
+static long do_microcode_update_parallel(void *_info)
+{
+    struct microcode_info *info = _info;
+    int error;
+
+    BUG_ON(info->cpu != smp_processor_id());
+
+    if ( info->cpu == info->lead )
+    {
+        error = microcode_update_cpu(info->buffer, info->buffer_size);
+        info->lead_done = NOW();
+        if ( error )
+        {
+            info->error = error;
+            return microcode_apply_parallel(info);
+        }
+    }
+    else
+    {
+        error = microcode_prepare_cpu(info->lead);
+        if ( error )
+            info->error = error;
+    }
+
+    /* On to the first thread of the next core. */
+    do {
+        info->cpu = cpumask_next(info->cpu, &cpu_online_map);
+    } while ( info->cpu < nr_cpu_ids &&
+              cpumask_first(per_cpu(cpu_sibling_mask, info->cpu)) !=
+              info->cpu );
+    if ( info->cpu < nr_cpu_ids )
+        return continue_hypercall_on_cpu(info->cpu,
+                                         do_microcode_update_parallel, info);
+
+    return microcode_apply_parallel(info);
+}
+
 int microcode_update(XEN_GUEST_HANDLE_PARAM(const_void) buf, unsigned long len)
 {
     int ret;
@@ -329,16 +482,33 @@ int microcode_update(XEN_GUEST_HANDLE_PARAM(const_void) buf, unsigned long len)
     info->error = 0;
     info->cpu = cpumask_first(&cpu_online_map);
 
+    if ( opt_ucode_parallel && test_and_set_bool(ucode_parallel_busy) )
+    {
+        xfree(info);
+        return -EBUSY;
+    }
+
     if ( microcode_ops->start_update )
     {
         ret = microcode_ops->start_update();
         if ( ret != 0 )
         {
+            if ( opt_ucode_parallel )
+                ucode_parallel_busy = 0;
             xfree(info);
             return ret;
         }
     }
 
+    if ( opt_ucode_parallel )
+    {
+        info->lead = info->cpu;
+        info->start = NOW();
+        cpumask_clear(&ucode_pending);
+        return continue_hypercall_on_cpu(info->cpu,
+                                         do_microcode_update_parallel, info);
+    }
+
     return continue_hypercall_on_cpu(info->cpu, do_microcode_update, info);
 }
 
@@ -75,9 +75,6 @@ struct mpbhdr {
     uint8_t data[];
 };
 
-/* serialize access to the physical write */
-static DEFINE_SPINLOCK(microcode_update_lock);
-
 /* See comment in start_update() for cases when this routine fails */
 static int collect_cpu_info(unsigned int cpu, struct cpu_signature *csig)
 {
@@ -206,14 +203,15 @@ static int apply_microcode(unsigned int cpu)
     if ( hdr == NULL )
         return -EINVAL;
 
-    spin_lock_irqsave(&microcode_update_lock, flags);
+    /* No lock: only one thread of each core ever gets here at a time. */
+    local_irq_save(flags);
 
     hw_err = wrmsr_safe(MSR_AMD_PATCHLOADER, (unsigned long)hdr);
 
     /* get patch id after patching */
     rdmsrl(MSR_AMD_PATCHLEVEL, rev);
 
-    spin_unlock_irqrestore(&microcode_update_lock, flags);
+    local_irq_restore(flags);
 
     /* check current patch id and patch's id for match */
     if ( hw_err || (rev != hdr->patch_id) )
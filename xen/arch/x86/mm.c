@@ -4789,6 +4789,7 @@ int xenmem_add_to_physmap_one(
     unsigned long prev_mfn, mfn = 0, old_gpfn;
     int rc;
     p2m_type_t p2mt;
+    struct gnttab_spare spare;
 
     switch ( space )
     {
@@ -4797,6 +4798,8 @@ int xenmem_add_to_physmap_one(
                 mfn = virt_to_mfn(d->shared_info);
             break;
         case XENMAPSPACE_grant_table:
+            /* Nothing gets set aside for status frame indexes, or past max. */
+            gnttab_prepare_grow(d, idx + 1, &spare);
             grant_write_lock(d->grant_table);
 
             if ( d->grant_table->gt_version == 0 )
@@ -4813,13 +4816,14 @@ int xenmem_add_to_physmap_one(
             {
                 if ( (idx >= nr_grant_frames(d->grant_table)) &&
                      (idx < max_grant_frames) )
-                    gnttab_grow_table(d, idx + 1);
+                    gnttab_grow_table(d, idx + 1, &spare);
 
                 if ( idx < nr_grant_frames(d->grant_table) )
                     mfn = virt_to_mfn(d->grant_table->shared_raw[idx]);
             }
 
             grant_write_unlock(d->grant_table);
+            gnttab_release_spare(&spare);
             break;
         case XENMAPSPACE_gmfn_range:
         case XENMAPSPACE_gmfn:
@@ -5364,6 +5368,7 @@ int ptwr_do_page_fault(struct vcpu *v, unsigned long addr,
 
     ptwr_ctxt.ctxt.regs = regs;
     ptwr_ctxt.ctxt.force_writeback = 0;
+    ptwr_ctxt.ctxt.insn_buf_bytes = 0;
     ptwr_ctxt.ctxt.addr_size = ptwr_ctxt.ctxt.sp_size =
         is_pv_32bit_domain(d) ? 32 : BITS_PER_LONG;
     ptwr_ctxt.ctxt.swint_emulate = x86_swint_emulate_none;
@@ -5639,10 +5644,13 @@ int map_pages_to_xen(
     unsigned int flags)
 {
     bool_t locking = system_state > SYS_STATE_boot;
+    bool_t noflush = !!(flags & MAP_NO_FLUSH);
     l2_pgentry_t *pl2e, ol2e;
     l1_pgentry_t *pl1e, ol1e;
     unsigned int  i;
 
+    flags &= ~MAP_NO_FLUSH;
+
 #define flush_flags(oldf) do {                 \
     unsigned int o_ = (oldf);                  \
     if ( (o_) & _PAGE_GLOBAL )                 \
@@ -5878,7 +5886,8 @@ int map_pages_to_xen(
                 unsigned int flush_flags = FLUSH_TLB | FLUSH_ORDER(0);
 
                 flush_flags(l1e_get_flags(ol1e));
-                flush_area(virt, flush_flags);
+                if ( !noflush || (flush_flags & FLUSH_CACHE) )
+                    flush_area(virt, flush_flags);
             }
 
             virt    += 1UL << L1_PAGETABLE_SHIFT;
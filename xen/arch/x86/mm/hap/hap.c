@@ -768,7 +768,15 @@ hap_write_p2m_entry(struct domain *d, unsigned long gfn, l1_pgentry_t *p,
 
     safe_write_pte(p, new);
     if ( old_flags & _PAGE_PRESENT )
-        flush_tlb_mask(d->domain_dirty_cpumask);
+    {
+        struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+        /* Batch the flush up until the p2m lock is dropped, as EPT does. */
+        if ( p2m->defer_flush )
+            p2m->need_flush = 1;
+        else
+            flush_tlb_mask(d->domain_dirty_cpumask);
+    }
 
     paging_unlock(d);
 
@@ -30,6 +30,7 @@
 #include <xen/rcupdate.h>
 #include <xen/guest_access.h>
 #include <xen/vm_event.h>
+#include <xen/hvm/save.h>
 #include <asm/page.h>
 #include <asm/string.h>
 #include <asm/p2m.h>
@@ -173,18 +174,47 @@ static atomic_t nr_shared_mfns  = ATOMIC_INIT(0);
  * search linked list is good enough. For pages with higher degree of sharing,
  * we use a hash table instead. */
 
-typedef struct gfn_info
-{
-    unsigned long gfn;
-    domid_t domain; 
-    struct list_head list;
-} gfn_info_t;
-
 static inline void
 rmap_init(struct page_info *page)
 {
     /* We always start off as a doubly linked list. */
     INIT_LIST_HEAD(&page->sharing->gfns);
+    page->sharing->inline_used = 0;
+}
+
+/*
+ * Rmap entries come from the page's inline array while it has room, and
+ * from the heap beyond that.  Most frames are shared only a few times, so
+ * this saves an allocation (and the allocator's lock) per sharing.
+ */
+static inline gfn_info_t *
+rmap_entry_alloc_inline(struct page_info *page)
+{
+    struct page_sharing_info *sharing = page->sharing;
+    unsigned int i = ffs(~sharing->inline_used) - 1;
+
+    if ( i >= RMAP_INLINE_ENTRIES )
+        return NULL;
+
+    sharing->inline_used |= 1u << i;
+    return &sharing->inline_gfns[i];
+}
+
+static inline bool_t
+rmap_entry_is_inline(struct page_info *page, const gfn_info_t *gfn_info)
+{
+    return gfn_info >= page->sharing->inline_gfns &&
+           gfn_info < page->sharing->inline_gfns + RMAP_INLINE_ENTRIES;
+}
+
+static inline void
+rmap_entry_free(struct page_info *page, gfn_info_t *gfn_info)
+{
+    if ( rmap_entry_is_inline(page, gfn_info) )
+        page->sharing->inline_used &=
+            ~(1u << (gfn_info - page->sharing->inline_gfns));
+    else
+        xfree(gfn_info);
 }
 
 /* Exceedingly simple "hash function" */
@@ -375,8 +405,10 @@ static inline gfn_info_t *mem_sharing_gfn_alloc(struct page_info *page,
                                                 struct domain *d,
                                                 unsigned long gfn)
 {
-    gfn_info_t *gfn_info = xmalloc(gfn_info_t);
+    gfn_info_t *gfn_info = rmap_entry_alloc_inline(page);
 
+    if ( gfn_info == NULL )
+        gfn_info = xmalloc(gfn_info_t);
     if ( gfn_info == NULL )
         return NULL; 
 
@@ -400,7 +432,7 @@ static inline void mem_sharing_gfn_destroy(struct page_info *page,
 
     /* Free the gfn_info structure. */
     rmap_del(gfn_info, page, 1);
-    xfree(gfn_info);
+    rmap_entry_free(page, gfn_info);
 }
 
 static struct page_info* mem_sharing_lookup(unsigned long mfn)
@@ -952,7 +984,8 @@ int mem_sharing_share_pages(struct domain *sd, unsigned long sgfn, shr_handle_t
                             struct domain *cd, unsigned long cgfn, shr_handle_t ch) 
 {
     struct page_info *spage, *cpage, *firstpg, *secondpg;
-    gfn_info_t *gfn;
+    gfn_info_t *gfn, *spare[RMAP_INLINE_ENTRIES] = { NULL };
+    unsigned int i, nr_spare = 0;
     struct domain *d;
     int ret = -EINVAL;
     mfn_t smfn, cmfn;
@@ -1024,6 +1057,26 @@ int mem_sharing_share_pages(struct domain *sd, unsigned long sgfn, shr_handle_t
         goto err_out;
     }
 
+    /*
+     * Entries inline in the client's sharing info go away with it.  Find
+     * room for those the source's inline array can't take before changing
+     * anything, so that the merge itself can't fail.
+     */
+    i = hweight32(cpage->sharing->inline_used);
+    if ( i > RMAP_INLINE_ENTRIES - hweight32(spage->sharing->inline_used) )
+        nr_spare = i - (RMAP_INLINE_ENTRIES -
+                        hweight32(spage->sharing->inline_used));
+    for ( i = 0; i < nr_spare; i++ )
+        if ( (spare[i] = xmalloc(gfn_info_t)) == NULL )
+        {
+            while ( i-- )
+                xfree(spare[i]);
+            ret = -ENOMEM;
+            mem_sharing_page_unlock(secondpg);
+            mem_sharing_page_unlock(firstpg);
+            goto err_out;
+        }
+
     /* Merge the lists together */
     rmap_seed_iterator(cpage, &ri);
     while ( (gfn = rmap_iterate(cpage, &ri)) != NULL)
@@ -1034,6 +1087,20 @@ int mem_sharing_share_pages(struct domain *sd, unsigned long sgfn, shr_handle_t
         /* Move the gfn_info from client list to source list.
          * Don't change the type of rmap for the client page. */
         rmap_del(gfn, cpage, 0);
+        if ( rmap_entry_is_inline(cpage, gfn) )
+        {
+            gfn_info_t *copy = rmap_entry_alloc_inline(spage);
+
+            if ( copy == NULL )
+            {
+                BUG_ON(!nr_spare);
+                copy = spare[--nr_spare];
+            }
+            copy->gfn = gfn->gfn;
+            copy->domain = gfn->domain;
+            rmap_entry_free(cpage, gfn);
+            gfn = copy;
+        }
         rmap_add(gfn, spage);
         put_page_and_type(cpage);
         d = get_domain_by_id(gfn->domain);
@@ -1042,6 +1109,7 @@ int mem_sharing_share_pages(struct domain *sd, unsigned long sgfn, shr_handle_t
         put_domain(d);
     }
     ASSERT(list_empty(&cpage->sharing->gfns));
+    ASSERT(!nr_spare);
 
     /* Clear the rest of the shared state */
     page_sharing_dispose(cpage);
@@ -1377,6 +1445,155 @@ static int range_share(struct domain *d, struct domain *cd,
     return rc;
 }
 
+/*
+ * Give the fork a shared copy of gfn of the parent, or a copy of its own if
+ * the page cannot be shared.  Xen heap pages other than the shared info are
+ * left alone: the fork has grant table frames of its own.
+ */
+static int fork_page(struct domain *d, struct domain *cd, unsigned long gfn)
+{
+    struct page_info *page;
+    p2m_type_t p2mt;
+    shr_handle_t sh;
+    mfn_t mfn;
+    int rc;
+
+    rc = mem_sharing_nominate_page(d, gfn, 0, &sh);
+    if ( !rc )
+        return mem_sharing_add_to_physmap(d, gfn, sh, cd, gfn);
+    if ( rc == -ENOMEM )
+        return rc;
+
+    /* Not sharable, e.g. because Xen or a device model has it mapped. */
+    mfn = get_gfn_query(d, gfn, &p2mt);
+
+    rc = 0;
+    if ( p2m_is_paging(p2mt) )
+        rc = -EBUSY;
+    else if ( !p2m_is_ram(p2mt) || !mfn_valid(mfn) )
+        /* Nothing to do for holes and MMIO. */;
+    else if ( is_xen_heap_mfn(mfn_x(mfn)) )
+    {
+        if ( mfn_x(mfn) == virt_to_mfn(d->shared_info) )
+        {
+            memcpy(cd->shared_info, d->shared_info, PAGE_SIZE);
+            rc = guest_physmap_add_page(cd, _gfn(gfn),
+                                        _mfn(virt_to_mfn(cd->shared_info)), 0);
+        }
+    }
+    else if ( (page = alloc_domheap_page(cd, 0)) == NULL )
+        rc = -ENOMEM;
+    else
+    {
+        copy_domain_page(page_to_mfn(page), mfn);
+        rc = guest_physmap_add_entry(cd, _gfn(gfn), page_to_mfn(page), 0,
+                                     p2mt == p2m_ram_ro ? p2m_ram_ro
+                                                        : p2m_ram_rw);
+        if ( rc && test_and_clear_bit(_PGC_allocated, &page->count_info) )
+            put_page(page);
+    }
+
+    put_gfn(d, gfn);
+
+    return rc;
+}
+
+static bool_t fork_vcpus_match(const struct domain *d,
+                               const struct domain *cd)
+{
+    unsigned int i;
+
+    if ( cd->max_vcpus != d->max_vcpus )
+        return 0;
+
+    for ( i = 0; i < d->max_vcpus; i++ )
+        if ( !d->vcpu[i] != !cd->vcpu[i] )
+            return 0;
+
+    return 1;
+}
+
+static int fork_memory(struct domain *d, struct domain *cd,
+                       struct mem_sharing_op_fork *fork)
+{
+    unsigned long max_gfn = domain_get_maximum_gpfn(d);
+    unsigned long gfn = fork->opaque;
+    int rc = 0;
+
+    while ( gfn <= max_gfn )
+    {
+        rc = fork_page(d, cd, gfn);
+        if ( rc )
+            break;
+
+        /* Check for continuation if it's not the last iteration. */
+        if ( ++gfn <= max_gfn && hypercall_preempt_check() )
+        {
+            rc = 1;
+            break;
+        }
+    }
+
+    fork->opaque = gfn;
+
+    return rc;
+}
+
+/*
+ * Copy the state of the parent's vCPUs and of the domain, once the memory
+ * is in place.  vcpu_info areas are mapped before the HVM context is
+ * loaded, as that brings the vCPUs of the fork up.
+ */
+static int fork_state(struct domain *d, struct domain *cd)
+{
+    hvm_domain_context_t c = { 0 };
+    uint32_t tsc_mode, gtsc_khz, incarnation;
+    uint64_t elapsed_nsec;
+    unsigned int i;
+    int rc;
+
+    cd->arch.has_32bit_shinfo = d->arch.has_32bit_shinfo;
+
+    for ( i = 0; i < d->max_vcpus; i++ )
+    {
+        struct vcpu *v = d->vcpu[i], *cv = cd->vcpu[i];
+        unsigned long offset;
+
+        if ( !v )
+            continue;
+
+        cv->runstate_guest = v->runstate_guest;
+
+        if ( v->vcpu_info_mfn == mfn_x(INVALID_MFN) )
+            continue;
+
+        offset = (unsigned long)v->vcpu_info & ~PAGE_MASK;
+        rc = map_vcpu_info(cv, get_gpfn_from_mfn(v->vcpu_info_mfn), offset);
+        if ( rc )
+            return rc;
+        memcpy(cv->vcpu_info, v->vcpu_info, sizeof(vcpu_info_t));
+    }
+
+    tsc_get_info(d, &tsc_mode, &elapsed_nsec, &gtsc_khz, &incarnation);
+    tsc_set_info(cd, tsc_mode, elapsed_nsec, gtsc_khz, incarnation);
+
+    c.size = hvm_save_size(d);
+    if ( (c.data = xmalloc_bytes(c.size)) == NULL )
+        return -ENOMEM;
+
+    rc = hvm_save(d, &c);
+    if ( !rc )
+    {
+        c.size = c.cur;
+        c.cur = 0;
+        rc = hvm_load(cd, &c);
+    }
+
+    xfree(c.data);
+
+    return rc;
+}
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
 {
     int rc;
@@ -1641,6 +1858,67 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
         }
         break;
 
+        case XENMEM_sharing_op_fork:
+        {
+            struct domain *cd;
+
+            rc = -EINVAL;
+            if ( mso.u.fork._pad[0] || mso.u.fork._pad[1] ||
+                 mso.u.fork._pad[2] )
+                 goto out;
+
+            if ( !mem_sharing_enabled(d) )
+                goto out;
+
+            rc = rcu_lock_live_remote_domain_by_id(mso.u.fork.client_domain,
+                                                   &cd);
+            if ( rc )
+                goto out;
+
+            /* As for range sharing, this is sharing of many pages. */
+            rc = xsm_mem_sharing_op(XSM_DM_PRIV, d, cd,
+                                    XENMEM_sharing_op_share);
+            if ( rc )
+            {
+                rcu_unlock_domain(cd);
+                goto out;
+            }
+
+            /*
+             * The parent has to stay paused for the duration of this op, and
+             * the fork paused until it is complete.  The fork must start
+             * out with no memory, and with the same vCPUs as its parent.
+             */
+            rc = -EINVAL;
+            if ( cd == d || !mem_sharing_enabled(cd) || !hap_enabled(cd) ||
+                 !atomic_read(&d->pause_count) ||
+                 !atomic_read(&cd->pause_count) ||
+                 !fork_vcpus_match(d, cd) ||
+                 (!mso.u.fork.opaque && cd->tot_pages) )
+            {
+                rcu_unlock_domain(cd);
+                goto out;
+            }
+
+            rc = fork_memory(d, cd, &mso.u.fork);
+            if ( !rc )
+                rc = fork_state(d, cd);
+            rcu_unlock_domain(cd);
+
+            if ( rc > 0 )
+            {
+                if ( __copy_to_guest(arg, &mso, 1) )
+                    rc = -EFAULT;
+                else
+                    rc = hypercall_create_continuation(__HYPERVISOR_memory_op,
+                                                       "lh", XENMEM_sharing_op,
+                                                       arg);
+            }
+            else
+                mso.u.fork.opaque = 0;
+        }
+        break;
+
         case XENMEM_sharing_op_debug_gfn:
         {
             unsigned long gfn = mso.u.debug.u.gfn;
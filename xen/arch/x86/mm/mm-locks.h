@@ -31,15 +31,20 @@
 DECLARE_PER_CPU(int, mm_lock_level);
 #define __get_lock_level()  (this_cpu(mm_lock_level))
 
+/* Per-CPU read-held mm rwlocks, and the level to restore once all are gone */
+DECLARE_PER_CPU(unsigned int, mm_read_depth);
+DECLARE_PER_CPU(int, mm_read_unlock_level);
+
 DECLARE_PERCPU_RWLOCK_GLOBAL(p2m_percpu_rwlock);
 
-static inline void mm_lock_init(mm_lock_t *l)
-{
-    spin_lock_init(&l->lock);
-    l->locker = -1;
-    l->locker_function = "nobody";
-    l->unlock_level = 0;
-}
+/* A macro, so each mm lock gets a lock class of its own. */
+#define mm_lock_init(l)                                 \
+    do {                                                \
+        _spin_lock_init(&(l)->lock, #l);                \
+        (l)->locker = -1;                               \
+        (l)->locker_function = "nobody";                \
+        (l)->unlock_level = 0;                          \
+    } while ( 0 )
 
 static inline int mm_locked_by_me(mm_lock_t *l) 
 {
@@ -99,13 +104,13 @@ static inline void _mm_enforce_order_lock_post(int level, int *unlock_level,
 }
 
 
-static inline void mm_rwlock_init(mm_rwlock_t *l)
-{
-    percpu_rwlock_resource_init(&l->lock, p2m_percpu_rwlock);
-    l->locker = -1;
-    l->locker_function = "nobody";
-    l->unlock_level = 0;
-}
+#define mm_rwlock_init(l)                                               \
+    do {                                                                \
+        _percpu_rwlock_resource_init(&(l)->lock, p2m_percpu_rwlock, #l); \
+        (l)->locker = -1;                                               \
+        (l)->locker_function = "nobody";                                \
+        (l)->unlock_level = 0;                                          \
+    } while ( 0 )
 
 static inline int mm_write_locked_by_me(mm_rwlock_t *l)
 {
@@ -116,6 +121,8 @@ static inline void _mm_write_lock(mm_rwlock_t *l, const char *func, int level)
 {
     if ( !mm_write_locked_by_me(l) )
     {
+        /* Upgrading our own read lock would wait for ourselves. */
+        ASSERT(!percpu_read_locked_by_me(p2m_percpu_rwlock, &l->lock));
         __check_lock_level(level);
         percpu_write_lock(p2m_percpu_rwlock, &l->lock);
         l->locker = get_processor_id();
@@ -138,14 +145,38 @@ static inline void mm_write_unlock(mm_rwlock_t *l)
 
 static inline void _mm_read_lock(mm_rwlock_t *l, int level)
 {
-    __check_lock_level(level);
+    /* Reading under our own write lock just recurses on the latter. */
+    if ( mm_write_locked_by_me(l) )
+    {
+        l->recurse_count++;
+        return;
+    }
+
+    if ( !percpu_read_locked_by_me(p2m_percpu_rwlock, &l->lock) )
+        __check_lock_level(level);
     percpu_read_lock(p2m_percpu_rwlock, &l->lock);
-    /* There's nowhere to store the per-CPU unlock level so we can't
-     * set the lock level. */
+
+    /*
+     * Readers can't share the lock's unlock level, so the outermost read
+     * lock on this CPU remembers it for all of them.
+     */
+    if ( this_cpu(mm_read_depth)++ == 0 )
+        this_cpu(mm_read_unlock_level) = __get_lock_level();
+    if ( __get_lock_level() < level )
+        __set_lock_level(level);
 }
 
 static inline void mm_read_unlock(mm_rwlock_t *l)
 {
+    if ( mm_write_locked_by_me(l) )
+    {
+        mm_write_unlock(l);
+        return;
+    }
+
+    ASSERT(this_cpu(mm_read_depth));
+    if ( --this_cpu(mm_read_depth) == 0 )
+        __set_lock_level(this_cpu(mm_read_unlock_level));
     percpu_read_unlock(p2m_percpu_rwlock, &l->lock);
 }
 
@@ -23,6 +23,7 @@
 #include <asm/types.h>
 #include <asm/domain.h>
 #include <asm/p2m.h>
+#include <asm/altp2m.h>
 #include <asm/hvm/vmx/vmx.h>
 #include <asm/hvm/vmx/vmcs.h>
 #include <asm/hvm/nestedhvm.h>
@@ -143,12 +144,13 @@ static void ept_p2m_type_to_flags(struct p2m_domain *p2m, ept_entry_t *entry,
         case p2m_ram_logdirty:
             entry->r = entry->x = 1;
             /*
-             * In case of PML, we don't have to write protect 4K page, but
-             * only need to clear D-bit for it, but we still need to write
-             * protect super page in order to split it to 4K pages in EPT
-             * violation.
+             * In case of PML or D-bit harvesting, we don't have to write
+             * protect 4K page, but only need to clear D-bit for it, but we
+             * still need to write protect super page in order to split it
+             * to 4K pages in EPT violation.
              */
-            if ( vmx_domain_pml_enabled(p2m->domain) &&
+            if ( (vmx_domain_pml_enabled(p2m->domain) ||
+                  p2m->ept.ad_log_dirty) &&
                  !is_epte_superpage(entry) )
                 entry->w = 1;
             else
@@ -283,6 +285,8 @@ static bool_t ept_split_super_page(struct p2m_domain *p2m,
 
     ASSERT(is_epte_superpage(ept_entry));
 
+    p2m->superpage.demoted[level - 1]++;
+
     if ( !ept_set_middle_entry(p2m, &new_ept) )
         return 0;
 
@@ -413,16 +417,16 @@ static bool_t ept_invalidate_emt(mfn_t mfn, bool_t recalc, int level)
 }
 
 /*
- * Just like ept_invalidate_emt() except that
- * - not all entries at the targeted level may need processing,
- * - the re-calculation flag gets always set.
+ * Just like ept_invalidate_emt() except that not all entries at the
+ * targeted level may need processing.
  * The passed in range is guaranteed to not cross a page (table)
  * boundary at the targeted level.
  */
 static int ept_invalidate_emt_range(struct p2m_domain *p2m,
                                     unsigned int target,
                                     unsigned long first_gfn,
-                                    unsigned long last_gfn)
+                                    unsigned long last_gfn,
+                                    bool_t recalc)
 {
     ept_entry_t *table;
     unsigned long gfn_remainder = first_gfn;
@@ -469,10 +473,11 @@ static int ept_invalidate_emt_range(struct p2m_domain *p2m,
         ept_entry_t e = atomic_read_ept_entry(&table[index]);
 
         if ( is_epte_valid(&e) && is_epte_present(&e) &&
-             (e.emt != MTRR_NUM_TYPES || !e.recalc) )
+             (e.emt != MTRR_NUM_TYPES || (recalc && !e.recalc)) )
         {
             e.emt = MTRR_NUM_TYPES;
-            e.recalc = 1;
+            if ( recalc )
+                e.recalc = 1;
             wrc = atomic_write_ept_entry(&table[index], e, target);
             ASSERT(wrc == 0);
             rc = 1;
@@ -647,11 +652,37 @@ bool_t ept_handle_misconfig(uint64_t gpa)
     rc = resolve_misconfig(p2m, PFN_DOWN(gpa));
     curr->arch.hvm_vmx.ept_spurious_misconfig = 0;
 
+    /* This vCPU was the first to touch the range since it got invalidated. */
+    if ( rc > 0 )
+        p2m_numa_sample(p2m, PFN_DOWN(gpa));
+
     p2m_unlock(p2m);
 
     return spurious ? (rc >= 0) : (rc > 0);
 }
 
+/*
+ * Have every PCPU flush this p2m's translations before its next VMENTER,
+ * without interrupting the ones currently running the domain.  This is
+ * enough for entries which only gained access to the same MFN: a stale,
+ * more restrictive, translation at worst causes an EPT violation, which
+ * invalidates it.
+ */
+static void ept_sync_domain_lazy(struct p2m_domain *p2m)
+{
+    arch_fetch_and_add(&p2m->ept.flush_gen, 1);
+}
+
+/* Does replacing @old by @new only grant additional access? */
+static bool_t ept_entry_relaxed(const ept_entry_t *old, const ept_entry_t *new)
+{
+    return is_epte_present(old) && is_epte_present(new) &&
+           old->mfn == new->mfn && old->sp == new->sp &&
+           old->emt == new->emt && old->ipat == new->ipat &&
+           old->suppress_ve == new->suppress_ve &&
+           new->r >= old->r && new->w >= old->w && new->x >= old->x;
+}
+
 /*
  * ept_set_entry() computes 'need_modify_vtd_table' for itself,
  * by observing whether any gfn->mfn translations are modified.
@@ -673,7 +704,7 @@ ept_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
     bool_t need_modify_vtd_table = 1;
     bool_t vtd_pte_present = 0;
     unsigned int iommu_flags = p2m_get_iommu_flags(p2mt);
-    bool_t needs_sync = 1;
+    bool_t needs_sync = 1, lazy_sync = 0;
     ept_entry_t old_entry = { .epte = 0 };
     ept_entry_t new_entry = { .epte = 0 };
     struct ept_data *ept = &p2m->ept;
@@ -810,6 +841,12 @@ ept_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
         new_entry.suppress_ve = is_epte_valid(&old_entry) ?
                                     old_entry.suppress_ve : 1;
 
+    if ( needs_sync && ept_entry_relaxed(&old_entry, &new_entry) )
+    {
+        needs_sync = 0;
+        lazy_sync = 1;
+    }
+
     rc = atomic_write_ept_entry(ept_entry, new_entry, target);
     if ( unlikely(rc) )
         old_entry.epte = 0;
@@ -826,6 +863,8 @@ ept_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
 out:
     if ( needs_sync )
         ept_sync_domain(p2m);
+    else if ( lazy_sync )
+        ept_sync_domain_lazy(p2m);
 
     /* For host p2m, may need to change VT-d page table.*/
     if ( rc == 0 && p2m_is_hostp2m(p2m) && need_iommu(d) &&
@@ -833,30 +872,10 @@ out:
     {
         if ( iommu_hap_pt_share )
             rc = iommu_pte_flush(d, gfn, &ept_entry->epte, order, vtd_pte_present);
+        else if ( iommu_flags )
+            rc = iommu_map_pages(d, gfn, mfn_x(mfn), order, iommu_flags);
         else
-        {
-            if ( iommu_flags )
-                for ( i = 0; i < (1 << order); i++ )
-                {
-                    rc = iommu_map_page(d, gfn + i, mfn_x(mfn) + i, iommu_flags);
-                    if ( unlikely(rc) )
-                    {
-                        while ( i-- )
-                            /* If statement to satisfy __must_check. */
-                            if ( iommu_unmap_page(p2m->domain, gfn + i) )
-                                continue;
-
-                        break;
-                    }
-                }
-            else
-                for ( i = 0; i < (1 << order); i++ )
-                {
-                    ret = iommu_unmap_page(d, gfn + i);
-                    if ( !rc )
-                        rc = ret;
-                }
-        }
+            rc = iommu_unmap_pages(d, gfn, order);
     }
 
     unmap_domain_page(table);
@@ -874,6 +893,145 @@ out:
     return rc;
 }
 
+/*
+ * Set a run of 4k entries within one leaf table, walking down to the table
+ * only once.  Entries needing more than a plain write - a superpage to
+ * split, an IOMMU sharing the tables, or altp2m views to update - go
+ * through ept_set_entry() one at a time instead.
+ *
+ * Returns: 0 for success, -errno for failure
+ */
+static int ept_set_entry_range(struct p2m_domain *p2m, unsigned long gfn,
+                               mfn_t mfn, unsigned long nr, p2m_type_t p2mt,
+                               p2m_access_t p2ma)
+{
+    ept_entry_t *table;
+    unsigned long gfn_remainder = gfn, i;
+    unsigned int level;
+    int ret, rc = 0;
+    bool_t direct_mmio = (p2mt == p2m_mmio_direct);
+    bool_t needs_sync = 0, lazy_sync = 0;
+    bool_t iommu_flush = 0, iommu_dont_flush = this_cpu(iommu_dont_flush_iotlb);
+    unsigned int iommu_flags = p2m_get_iommu_flags(p2mt);
+    struct ept_data *ept = &p2m->ept;
+    struct domain *d = p2m->domain;
+
+    ASSERT(nr && nr <= EPT_PAGETABLE_ENTRIES -
+                       (gfn & (EPT_PAGETABLE_ENTRIES - 1)));
+
+    if ( ((u64)gfn >> ((ept_get_wl(ept) + 1) * EPT_TABLE_ORDER)) )
+        return -EINVAL;
+
+    if ( nr == 1 || (p2m_is_hostp2m(p2m) &&
+                     ((need_iommu(d) && iommu_hap_pt_share) ||
+                      altp2m_active(d))) )
+        goto single;
+
+    /* Carry out any eventually pending earlier changes first. */
+    ret = resolve_misconfig(p2m, gfn);
+    if ( ret < 0 )
+        return ret;
+
+    table = map_domain_page(_mfn(pagetable_get_pfn(p2m_get_pagetable(p2m))));
+
+    for ( level = ept_get_wl(ept); level > 0; level-- )
+        if ( ept_next_level(p2m, 0, &table, &gfn_remainder, level) !=
+             GUEST_TABLE_NORMAL_PAGE )
+            break;
+
+    if ( level )
+    {
+        /* Let ept_set_entry() split the superpage, or report the failure. */
+        unmap_domain_page(table);
+        goto single;
+    }
+
+    /* IOMMU updates get one IOTLB flush for the run, below. */
+    this_cpu(iommu_dont_flush_iotlb) = 1;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        ept_entry_t *ept_entry = table + gfn_remainder + i;
+        ept_entry_t old_entry = *ept_entry;
+        ept_entry_t new_entry = { .epte = 0 };
+        mfn_t m = mfn_eq(mfn, INVALID_MFN) ? mfn : mfn_add(mfn, i);
+
+        if ( mfn_valid(mfn_x(m)) || p2m_allows_invalid_mfn(p2mt) )
+        {
+            uint8_t ipat = 0;
+            int emt = epte_get_entry_emt(d, gfn + i, m, 0, &ipat,
+                                         direct_mmio);
+
+            new_entry.emt = emt >= 0 ? emt : MTRR_NUM_TYPES;
+            new_entry.ipat = ipat;
+            new_entry.sa_p2mt = p2mt;
+            new_entry.access = p2ma;
+            new_entry.snp = (iommu_enabled && iommu_snoop);
+            new_entry.mfn = mfn_x(m);
+
+            ept_p2m_type_to_flags(p2m, &new_entry, p2mt, p2ma);
+        }
+
+        new_entry.suppress_ve = is_epte_valid(&old_entry) ?
+                                    old_entry.suppress_ve : 1;
+
+        rc = atomic_write_ept_entry(ept_entry, new_entry, 0);
+        if ( unlikely(rc) )
+            break;
+
+        if ( ept_entry_relaxed(&old_entry, &new_entry) )
+            lazy_sync = 1;
+        else if ( is_epte_present(&old_entry) )
+            needs_sync = 1;
+
+        if ( p2mt != p2m_invalid && gfn + i > p2m->max_mapped_pfn )
+            p2m->max_mapped_pfn = gfn + i;
+
+        if ( p2m_is_hostp2m(p2m) && need_iommu(d) &&
+             (old_entry.mfn != new_entry.mfn ||
+              p2m_get_iommu_flags(old_entry.sa_p2mt) != iommu_flags) )
+        {
+            iommu_flush = 1;
+            if ( iommu_flags )
+                rc = iommu_map_page(d, gfn + i, mfn_x(m), iommu_flags);
+            else
+                rc = iommu_unmap_page(d, gfn + i);
+            if ( unlikely(rc) )
+                break;
+        }
+    }
+
+    unmap_domain_page(table);
+
+    this_cpu(iommu_dont_flush_iotlb) = iommu_dont_flush;
+    if ( iommu_flush && !iommu_dont_flush )
+    {
+        ret = iommu_iotlb_flush(d, gfn, nr);
+        if ( !rc )
+            rc = ret;
+    }
+
+    /* Deferred while the p2m lock is held: one flush for the whole range. */
+    if ( needs_sync )
+        ept_sync_domain(p2m);
+    else if ( lazy_sync )
+        ept_sync_domain_lazy(p2m);
+
+    return rc;
+
+ single:
+    for ( i = 0; i < nr; i++ )
+    {
+        ret = ept_set_entry(p2m, gfn + i,
+                            mfn_eq(mfn, INVALID_MFN) ? mfn : mfn_add(mfn, i),
+                            PAGE_ORDER_4K, p2mt, p2ma, -1);
+        if ( ret )
+            rc = ret;
+    }
+
+    return rc;
+}
+
 /* Read ept p2m entries */
 static mfn_t ept_get_entry(struct p2m_domain *p2m,
                            unsigned long gfn, p2m_type_t *t, p2m_access_t* a,
@@ -1052,17 +1210,21 @@ static void ept_change_entry_type_global(struct p2m_domain *p2m,
         ept_sync_domain(p2m);
 }
 
-static int ept_change_entry_type_range(struct p2m_domain *p2m,
-                                       p2m_type_t ot, p2m_type_t nt,
-                                       unsigned long first_gfn,
-                                       unsigned long last_gfn)
+/*
+ * Invalidate the EMT of [first_gfn, last_gfn], using entries as large as
+ * the alignment of the range permits.  Returns a negative errno value on
+ * error, else whether anything was changed (possibly also on error).
+ */
+static int ept_invalidate_emt_ranges(struct p2m_domain *p2m,
+                                     unsigned long first_gfn,
+                                     unsigned long last_gfn,
+                                     bool_t recalc, int *changed)
 {
     unsigned int i, wl = ept_get_wl(&p2m->ept);
     unsigned long mask = (1 << EPT_TABLE_ORDER) - 1;
-    int rc = 0, sync = 0;
+    int rc = 0;
 
-    if ( !ept_get_asr(&p2m->ept) )
-        return -EINVAL;
+    *changed = 0;
 
     for ( i = 0; i <= wl; )
     {
@@ -1070,8 +1232,8 @@ static int ept_change_entry_type_range(struct p2m_domain *p2m,
         {
             unsigned long end_gfn = min(first_gfn | mask, last_gfn);
 
-            rc = ept_invalidate_emt_range(p2m, i, first_gfn, end_gfn);
-            sync |= rc;
+            rc = ept_invalidate_emt_range(p2m, i, first_gfn, end_gfn, recalc);
+            *changed |= rc;
             if ( rc < 0 || end_gfn >= last_gfn )
                 break;
             first_gfn = end_gfn + 1;
@@ -1080,8 +1242,8 @@ static int ept_change_entry_type_range(struct p2m_domain *p2m,
         {
             unsigned long start_gfn = max(first_gfn, last_gfn & ~mask);
 
-            rc = ept_invalidate_emt_range(p2m, i, start_gfn, last_gfn);
-            sync |= rc;
+            rc = ept_invalidate_emt_range(p2m, i, start_gfn, last_gfn, recalc);
+            *changed |= rc;
             if ( rc < 0 || start_gfn <= first_gfn )
                 break;
             last_gfn = start_gfn - 1;
@@ -1093,10 +1255,150 @@ static int ept_change_entry_type_range(struct p2m_domain *p2m,
         }
     }
 
+    return rc < 0 ? rc : 0;
+}
+
+static int ept_change_entry_type_range(struct p2m_domain *p2m,
+                                       p2m_type_t ot, p2m_type_t nt,
+                                       unsigned long first_gfn,
+                                       unsigned long last_gfn)
+{
+    int rc, sync;
+
+    if ( !ept_get_asr(&p2m->ept) )
+        return -EINVAL;
+
+    rc = ept_invalidate_emt_ranges(p2m, first_gfn, last_gfn, 1, &sync);
+
     if ( sync )
         ept_sync_domain(p2m);
 
-    return rc < 0 ? rc : 0;
+    return rc;
+}
+
+/*
+ * An EMT invalidated without re-calculation merely costs an EPT
+ * misconfiguration exit on the next access, which restores it.  Stale
+ * translations only make accesses go unsampled, so there is no need to
+ * interrupt the PCPUs running the domain.
+ */
+static int ept_numa_sample_range(struct p2m_domain *p2m,
+                                 unsigned long first_gfn,
+                                 unsigned long last_gfn)
+{
+    int rc, sync;
+
+    if ( !ept_get_asr(&p2m->ept) )
+        return -EINVAL;
+
+    rc = ept_invalidate_emt_ranges(p2m, first_gfn, last_gfn, 0, &sync);
+
+    if ( sync )
+        ept_sync_domain_lazy(p2m);
+
+    return rc;
+}
+
+/*
+ * Replace the page table mapping the 2^@order aligned range at @gfn by a
+ * single superpage entry, if all its entries map an aligned, contiguous
+ * range of RAM with identical type, access and effective memory type, and
+ * have no re-calculation pending.
+ * Returns 1 if the range was recombined, 0 if not.
+ */
+static int ept_recombine_superpage(struct p2m_domain *p2m, unsigned long gfn,
+                                   unsigned int order)
+{
+    struct ept_data *ept = &p2m->ept;
+    struct domain *d = p2m->domain;
+    unsigned int i, level = order / EPT_TABLE_ORDER;
+    unsigned long gfn_remainder = gfn;
+    unsigned long stride = 1UL << ((level - 1) * EPT_TABLE_ORDER);
+    ept_entry_t *table, *entry, *l, old_entry, new_entry;
+    int emt, rc = 0;
+    uint8_t ipat = 0;
+
+    ASSERT(p2m_locked_by_me(p2m));
+    ASSERT(level == 1 || level == 2);
+
+    table = map_domain_page(_mfn(pagetable_get_pfn(p2m_get_pagetable(p2m))));
+
+    for ( i = ept_get_wl(ept); ; i-- )
+    {
+        entry = table + (gfn_remainder >> (i * EPT_TABLE_ORDER));
+        old_entry = atomic_read_ept_entry(entry);
+
+        /* Pending type or memory type changes need resolving first. */
+        if ( !is_epte_present(&old_entry) || is_epte_superpage(&old_entry) ||
+             old_entry.emt == MTRR_NUM_TYPES || old_entry.recalc )
+            goto out;
+
+        if ( i == level )
+            break;
+
+        if ( ept_next_level(p2m, 1, &table, &gfn_remainder, i) !=
+             GUEST_TABLE_NORMAL_PAGE )
+            goto out;
+    }
+
+    l = map_domain_page(_mfn(old_entry.mfn));
+
+    new_entry = atomic_read_ept_entry(&l[0]);
+    if ( new_entry.sa_p2mt != p2m_ram_rw ||
+         (new_entry.mfn & ((1UL << order) - 1)) )
+        i = 0;
+    else
+        for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+        {
+            ept_entry_t e = atomic_read_ept_entry(&l[i]);
+
+            if ( !is_epte_valid(&e) || !is_epte_present(&e) ||
+                 e.sp != (level > 1) || e.recalc ||
+                 e.emt == MTRR_NUM_TYPES || e.emt != new_entry.emt ||
+                 e.ipat != new_entry.ipat ||
+                 e.sa_p2mt != new_entry.sa_p2mt ||
+                 e.access != new_entry.access ||
+                 e.suppress_ve != new_entry.suppress_ve ||
+                 e.mfn != new_entry.mfn + i * stride )
+                break;
+        }
+
+    unmap_domain_page(l);
+
+    if ( i < EPT_PAGETABLE_ENTRIES )
+        goto out;
+
+    /* The whole range must have a single memory type, too. */
+    emt = epte_get_entry_emt(d, gfn, _mfn(new_entry.mfn), order, &ipat, 0);
+    if ( emt < 0 )
+        goto out;
+
+    new_entry.emt = emt;
+    new_entry.ipat = ipat;
+    new_entry.sp = 1;
+    ept_p2m_type_to_flags(p2m, &new_entry, new_entry.sa_p2mt,
+                          new_entry.access);
+
+    rc = atomic_write_ept_entry(entry, new_entry, level);
+    ASSERT(rc == 0);
+
+    /* The translations are unchanged, but the old table may be cached. */
+    ept_sync_domain(p2m);
+
+    if ( iommu_hap_pt_share && need_iommu(d) &&
+         iommu_pte_flush(d, gfn, &entry->epte, order, 1) )
+        gdprintk(XENLOG_WARNING, "IOMMU flush failed for gfn %lx\n", gfn);
+
+    rc = 1;
+
+ out:
+    unmap_domain_page(table);
+
+    /* Free the old table only once it can no longer be walked. */
+    if ( rc > 0 )
+        ept_free_entry(p2m, &old_entry, level);
+
+    return rc;
 }
 
 static void ept_memory_type_changed(struct p2m_domain *p2m)
@@ -1132,8 +1434,10 @@ static void ept_sync_domain_prepare(struct p2m_domain *p2m)
      * a) A VCPU has run and some translations may be cached.
      * b) A VCPU has not run and and the initial invalidation in case
      *    of an EP4TA reuse is still needed.
+     *
+     * The atomic update orders this after the entries were written.
      */
-    cpumask_setall(ept->invalidate);
+    arch_fetch_and_add(&ept->flush_gen, 1);
 }
 
 static void ept_sync_domain_mask(struct p2m_domain *p2m, const cpumask_t *mask)
@@ -1203,17 +1507,103 @@ static void ept_flush_pml_buffers(struct p2m_domain *p2m)
     vmx_domain_flush_pml_buffers(p2m->domain);
 }
 
+/*
+ * Without PML, writes to log-dirty pages can still be tracked without
+ * taking EPT violations: leave 4K log-dirty entries writable with D clear,
+ * and scan for the D bits hardware has set whenever the dirty state is
+ * wanted.
+ */
+static void ept_enable_ad_log_dirty(struct p2m_domain *p2m)
+{
+    /* Domain must have been paused */
+    ASSERT(atomic_read(&p2m->domain->pause_count));
+
+    p2m->ept.ad_log_dirty = 1;
+    p2m->ept.ept_ad = 1;
+    vmx_domain_update_eptp(p2m->domain);
+}
+
+static void ept_disable_ad_log_dirty(struct p2m_domain *p2m)
+{
+    /* Domain must have been paused */
+    ASSERT(atomic_read(&p2m->domain->pause_count));
+
+    p2m->ept.ad_log_dirty = 0;
+    p2m->ept.ept_ad = 0;
+    vmx_domain_update_eptp(p2m->domain);
+}
+
+/*
+ * Mark dirty every log-dirty 4K page below the given table whose D bit got
+ * set, and turn it back into normal RAM, just like flushing a PML buffer
+ * does.  Subtrees pending type re-calculation are skipped: they can't have
+ * been written since they were invalidated.
+ */
+static void ept_harvest_dirty(struct p2m_domain *p2m, mfn_t mfn,
+                              unsigned int level, unsigned long gfn)
+{
+    ept_entry_t *epte = map_domain_page(mfn);
+    unsigned int i;
+
+    for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+    {
+        ept_entry_t e = atomic_read_ept_entry(&epte[i]);
+        unsigned long cur = gfn + ((unsigned long)i <<
+                                   (level * EPT_TABLE_ORDER));
+        int rc;
+
+        if ( !is_epte_valid(&e) || !is_epte_present(&e) || e.recalc )
+            continue;
+
+        if ( level )
+        {
+            if ( !is_epte_superpage(&e) )
+                ept_harvest_dirty(p2m, _mfn(e.mfn), level - 1, cur);
+            continue;
+        }
+
+        if ( e.sa_p2mt != p2m_ram_logdirty || !e.d )
+            continue;
+
+        e.sa_p2mt = p2m_ram_rw;
+        ept_p2m_type_to_flags(p2m, &e, p2m_ram_rw, e.access);
+        rc = atomic_write_ept_entry(&epte[i], e, 0);
+        ASSERT(rc == 0);
+        paging_mark_gfn_dirty(p2m->domain, cur);
+    }
+
+    unmap_domain_page(epte);
+}
+
+static void ept_flush_ad_dirty(struct p2m_domain *p2m)
+{
+    unsigned long mfn = ept_get_asr(&p2m->ept);
+
+    /* Domain must have been paused */
+    ASSERT(atomic_read(&p2m->domain->pause_count));
+
+    /*
+     * Nothing but the type changes, and it only loses its write
+     * protection, so no flush of cached translations is needed.
+     */
+    if ( mfn && p2m->ept.ad_log_dirty )
+        ept_harvest_dirty(p2m, _mfn(mfn), ept_get_wl(&p2m->ept), 0);
+}
+
 int ept_p2m_init(struct p2m_domain *p2m)
 {
     struct ept_data *ept = &p2m->ept;
 
     p2m->set_entry = ept_set_entry;
+    p2m->set_entry_range = ept_set_entry_range;
     p2m->get_entry = ept_get_entry;
     p2m->change_entry_type_global = ept_change_entry_type_global;
     p2m->change_entry_type_range = ept_change_entry_type_range;
     p2m->memory_type_changed = ept_memory_type_changed;
     p2m->audit_p2m = NULL;
     p2m->tlb_flush = ept_tlb_flush;
+    p2m->recombine_superpage = ept_recombine_superpage;
+    p2m->numa_sample_range = ept_numa_sample_range;
 
     /* Set the memory type used when accessing EPT paging structures. */
     ept->ept_mt = EPT_DEFAULT_MT;
@@ -1227,15 +1617,22 @@ int ept_p2m_init(struct p2m_domain *p2m)
         p2m->disable_hardware_log_dirty = ept_disable_pml;
         p2m->flush_hardware_cached_dirty = ept_flush_pml_buffers;
     }
+    else if ( cpu_has_vmx_ept_ad )
+    {
+        p2m->enable_hardware_log_dirty = ept_enable_ad_log_dirty;
+        p2m->disable_hardware_log_dirty = ept_disable_ad_log_dirty;
+        p2m->flush_hardware_cached_dirty = ept_flush_ad_dirty;
+    }
 
-    if ( !zalloc_cpumask_var(&ept->invalidate) )
+    ept->cpu_flush_gen = xzalloc_array(unsigned long, nr_cpu_ids);
+    if ( !ept->cpu_flush_gen )
         return -ENOMEM;
 
     /*
      * Assume an initial invalidation is required, in case an EP4TA is
      * reused.
      */
-    cpumask_setall(ept->invalidate);
+    ept->flush_gen = 1;
 
     return 0;
 }
@@ -1243,7 +1640,8 @@ int ept_p2m_init(struct p2m_domain *p2m)
 void ept_p2m_uninit(struct p2m_domain *p2m)
 {
     struct ept_data *ept = &p2m->ept;
-    free_cpumask_var(ept->invalidate);
+
+    xfree(ept->cpu_flush_gen);
 }
 
 static const char *memory_type_to_str(unsigned int x)
@@ -413,6 +413,10 @@ int p2m_pod_empty_cache(struct domain *d)
 
     BUG_ON(p2m->pod.count != 0);
 
+    xfree(p2m->pod.sweep_hint);
+    p2m->pod.sweep_hint = NULL;
+    p2m->pod.sweep_hint_bits = 0;
+
  out:
     unlock_page_alloc(p2m);
     return p2m->pod.count ? -ERESTART : 0;
@@ -665,6 +669,23 @@ void p2m_pod_dump_data(struct domain *d)
 }
 
 
+/*
+ * Is the mapped page entirely zero?  Xen can't use vector registers here,
+ * so OR together a cache line's worth of words per iteration instead of
+ * testing them one by one.
+ */
+static bool_t pod_page_is_zero(const unsigned long *map)
+{
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*map); i += 8 )
+        if ( map[i] | map[i + 1] | map[i + 2] | map[i + 3] |
+             map[i + 4] | map[i + 5] | map[i + 6] | map[i + 7] )
+            return 0;
+
+    return 1;
+}
+
 /* Search for all-zero superpages to be reclaimed as superpages for the
  * PoD cache. Must be called w/ pod lock held, must lock the superpage
  * in the p2m */
@@ -776,12 +797,8 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, unsigned long gfn)
     {
         map = map_domain_page(_mfn(mfn_x(mfn0) + i));
 
-        for ( j=0; j<PAGE_SIZE/sizeof(*map); j++ )
-            if( *(map+j) != 0 )
-            {
-                reset = 1;
-                break;
-            }
+        if ( !pod_page_is_zero(map) )
+            reset = 1;
 
         unmap_domain_page(map);
 
@@ -893,18 +910,18 @@ p2m_pod_zero_check(struct p2m_domain *p2m, unsigned long *gfns, int count)
     /* Now check each page for real */
     for ( i=0; i < count; i++ )
     {
+        bool_t zero;
+
         if(!map[i])
             continue;
 
-        for ( j=0; j<PAGE_SIZE/sizeof(*map[i]); j++ )
-            if( *(map[i]+j) != 0 )
-                break;
+        zero = pod_page_is_zero(map[i]);
 
         unmap_domain_page(map[i]);
 
         /* See comment in p2m_pod_zero_check_superpage() re gnttab
          * check timing.  */
-        if ( j < PAGE_SIZE/sizeof(*map[i]) )
+        if ( !zero )
         {
             p2m_set_entry(p2m, gfns[i], mfns[i], PAGE_ORDER_4K,
                 types[i], p2m->default_access);
@@ -936,6 +953,87 @@ p2m_pod_zero_check(struct p2m_domain *p2m, unsigned long *gfns, int count)
 
 #define POD_SWEEP_LIMIT 1024
 #define POD_SWEEP_STRIDE  16
+
+/*
+ * Guests commonly scrub the memory they are given, so regions recently
+ * populated from the cache are the likeliest to be reclaimable.  Record
+ * them in a bitmap, sized as the toolstack marks gfns populate-on-demand.
+ */
+#define POD_HINT_LIMIT 8
+
+static void pod_hint_reserve(struct p2m_domain *p2m, unsigned long gfn)
+{
+    unsigned long nr = (gfn >> SUPERPAGE_ORDER) + 1, *hint;
+
+    ASSERT(pod_locked_by_me(p2m));
+
+    if ( nr <= p2m->pod.sweep_hint_bits )
+        return;
+
+    nr = max(nr, 2 * p2m->pod.sweep_hint_bits);
+    hint = xzalloc_array(unsigned long, BITS_TO_LONGS(nr));
+    /* The hints are only an optimisation: carry on without. */
+    if ( !hint )
+        return;
+
+    if ( p2m->pod.sweep_hint )
+    {
+        memcpy(hint, p2m->pod.sweep_hint,
+               BITS_TO_LONGS(p2m->pod.sweep_hint_bits) * sizeof(*hint));
+        xfree(p2m->pod.sweep_hint);
+    }
+
+    p2m->pod.sweep_hint = hint;
+    p2m->pod.sweep_hint_bits = BITS_TO_LONGS(nr) * BITS_PER_LONG;
+}
+
+static void pod_hint_record(struct p2m_domain *p2m, unsigned long gfn)
+{
+    unsigned long idx = gfn >> SUPERPAGE_ORDER;
+
+    if ( idx < p2m->pod.sweep_hint_bits )
+        __set_bit(idx, p2m->pod.sweep_hint);
+}
+
+/*
+ * Try to reclaim zeroed pages from a few hinted regions, as superpages
+ * where possible.  Must be called with the p2m and pod locks held.
+ */
+static void pod_sweep_hints(struct p2m_domain *p2m)
+{
+    unsigned long gfns[POD_SWEEP_STRIDE];
+    unsigned long idx = p2m->pod.sweep_hint_next, gfn, i;
+    unsigned int n, j;
+
+    for ( n = 0; n < POD_HINT_LIMIT && p2m->pod.count == 0; n++ )
+    {
+        idx = find_next_bit(p2m->pod.sweep_hint, p2m->pod.sweep_hint_bits,
+                            idx);
+        if ( idx >= p2m->pod.sweep_hint_bits )
+        {
+            idx = find_first_bit(p2m->pod.sweep_hint,
+                                 p2m->pod.sweep_hint_bits);
+            if ( idx >= p2m->pod.sweep_hint_bits )
+                break;
+        }
+
+        __clear_bit(idx, p2m->pod.sweep_hint);
+        gfn = idx << SUPERPAGE_ORDER;
+
+        if ( p2m_pod_zero_check_superpage(p2m, gfn) == 0 )
+            for ( i = 0; i < SUPERPAGE_PAGES; i += POD_SWEEP_STRIDE )
+            {
+                for ( j = 0; j < POD_SWEEP_STRIDE; j++ )
+                    gfns[j] = gfn + i + j;
+                p2m_pod_zero_check(p2m, gfns, POD_SWEEP_STRIDE);
+            }
+
+        idx++;
+    }
+
+    p2m->pod.sweep_hint_next = idx;
+}
+
 static void
 p2m_pod_emergency_sweep(struct p2m_domain *p2m)
 {
@@ -955,6 +1053,15 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
      * in a fine-grained scenario. If we lock each gfn individually we must be
      * careful about spinlock recursion limits and POD_SWEEP_STRIDE. */
     p2m_lock(p2m);
+
+    /* Look where zeroes are likeliest first. */
+    pod_sweep_hints(p2m);
+    if ( p2m->pod.count > 0 )
+    {
+        p2m_unlock(p2m);
+        return;
+    }
+
     for ( i=p2m->pod.reclaim_single; i > 0 ; i-- )
     {
         p2m_access_t a;
@@ -1058,6 +1165,7 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
     if ( unlikely(d->is_dying) )
         goto out_fail;
 
+    perfc_dom_incr(dom_pod_populate);
     
     /* Because PoD does not have cache list for 1GB pages, it has to remap
      * 1GB region to 2MB chunks for a retry. */
@@ -1119,6 +1227,7 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
     BUG_ON(p2m->pod.entry_count < 0);
 
     pod_eager_record(p2m, gfn_aligned, order);
+    pod_hint_record(p2m, gfn_aligned);
 
     if ( tb_init_done )
     {
@@ -1223,6 +1332,7 @@ guest_physmap_mark_populate_on_demand(struct domain *d, unsigned long gfn,
         p2m->pod.entry_count += 1 << order;
         p2m->pod.entry_count -= pod_count;
         BUG_ON(p2m->pod.entry_count < 0);
+        pod_hint_reserve(p2m, gfn + (1UL << order) - 1);
         pod_unlock(p2m);
     }
 
@@ -157,6 +157,8 @@ p2m_free_entry(struct p2m_domain *p2m, l1_pgentry_t *p2m_entry, int page_order)
         unmap_domain_page(l3_table);
     }
 
+    /* The table may still be cached by a deferred HAP TLB flush. */
+    p2m_tlb_flush_sync(p2m);
     p2m_free_ptp(p2m, mfn_to_page(_mfn(l1e_get_pfn(*p2m_entry))));
 }
 
@@ -233,6 +235,8 @@ p2m_next_level(struct p2m_domain *p2m, void **table,
         if ( pg == NULL )
             return -ENOMEM;
 
+        p2m->superpage.demoted[1]++;
+
         flags = l1e_get_flags(*p2m_entry);
         pfn = l1e_get_pfn(*p2m_entry);
 
@@ -261,6 +265,8 @@ p2m_next_level(struct p2m_domain *p2m, void **table,
         if ( pg == NULL )
             return -ENOMEM;
 
+        p2m->superpage.demoted[0]++;
+
         /* New splintered mappings inherit the flags of the old superpage, 
          * with a little reorganisation for the _PAGE_PSE_PAT bit. */
         flags = l1e_get_flags(*p2m_entry);
@@ -492,7 +498,7 @@ p2m_pt_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
 {
     /* XXX -- this might be able to be faster iff current->domain == d */
     void *table;
-    unsigned long i, gfn_remainder = gfn;
+    unsigned long gfn_remainder = gfn;
     l1_pgentry_t *p2m_entry, entry_content;
     /* Intermediate table to free if we're replacing it with a superpage. */
     l1_pgentry_t intermediate_entry = l1e_empty();
@@ -681,28 +687,10 @@ p2m_pt_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
                 amd_iommu_flush_pages(p2m->domain, gfn, page_order);
         }
         else if ( iommu_pte_flags )
-            for ( i = 0; i < (1UL << page_order); i++ )
-            {
-                rc = iommu_map_page(p2m->domain, gfn + i, mfn_x(mfn) + i,
-                                    iommu_pte_flags);
-                if ( unlikely(rc) )
-                {
-                    while ( i-- )
-                        /* If statement to satisfy __must_check. */
-                        if ( iommu_unmap_page(p2m->domain, gfn + i) )
-                            continue;
-
-                    break;
-                }
-            }
+            rc = iommu_map_pages(p2m->domain, gfn, mfn_x(mfn), page_order,
+                                 iommu_pte_flags);
         else
-            for ( i = 0; i < (1UL << page_order); i++ )
-            {
-                int ret = iommu_unmap_page(p2m->domain, gfn + i);
-
-                if ( !rc )
-                    rc = ret;
-            }
+            rc = iommu_unmap_pages(p2m->domain, gfn, page_order);
     }
 
     /*
@@ -718,6 +706,150 @@ p2m_pt_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
     return rc;
 }
 
+/*
+ * Set a run of 4k entries within one leaf table, walking down to the table
+ * only once.  With HAP the TLB flushes are deferred until the p2m lock is
+ * dropped, and a shared IOMMU is flushed once for the whole run.
+ *
+ * Returns: 0 for success, -errno for failure
+ */
+static int
+p2m_pt_set_entry_range(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
+                       unsigned long nr, p2m_type_t p2mt, p2m_access_t p2ma)
+{
+    void *table;
+    unsigned long i, gfn_remainder = gfn;
+    l1_pgentry_t *p2m_entry, entry_content;
+    unsigned int iommu_pte_flags = p2m_get_iommu_flags(p2mt);
+    bool_t flush_iommu = 0, iommu_dont_flush = this_cpu(iommu_dont_flush_iotlb);
+    int rc;
+
+    ASSERT(nr && nr <= L1_PAGETABLE_ENTRIES -
+                       (gfn & (L1_PAGETABLE_ENTRIES - 1)));
+
+    if ( nr == 1 || unlikely(p2m_is_foreign(p2mt)) )
+    {
+        rc = 0;
+        goto single;
+    }
+
+    /* Carry out any eventually pending earlier changes first. */
+    rc = do_recalc(p2m, gfn);
+    if ( rc < 0 )
+        return rc;
+
+    table = map_domain_page(pagetable_get_mfn(p2m_get_pagetable(p2m)));
+    rc = p2m_next_level(p2m, &table, &gfn_remainder, gfn,
+                        L4_PAGETABLE_SHIFT - PAGE_SHIFT,
+                        L4_PAGETABLE_ENTRIES, PGT_l3_page_table, 1);
+    if ( !rc )
+        rc = p2m_next_level(p2m, &table, &gfn_remainder, gfn,
+                            L3_PAGETABLE_SHIFT - PAGE_SHIFT,
+                            L3_PAGETABLE_ENTRIES, PGT_l2_page_table, 1);
+    if ( !rc )
+        rc = p2m_next_level(p2m, &table, &gfn_remainder, gfn,
+                            L2_PAGETABLE_SHIFT - PAGE_SHIFT,
+                            L2_PAGETABLE_ENTRIES, PGT_l1_page_table, 1);
+    if ( rc )
+        goto out;
+
+    /* IOMMU updates get one IOTLB flush for the run, below. */
+    this_cpu(iommu_dont_flush_iotlb) = 1;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        mfn_t m = mfn_eq(mfn, INVALID_MFN) ? mfn : mfn_add(mfn, i);
+        unsigned int iommu_old_flags;
+        unsigned long old_mfn;
+
+        if ( tb_init_done )
+        {
+            struct {
+                u64 gfn, mfn;
+                int p2mt;
+                int d:16,order:16;
+            } t;
+
+            t.gfn = gfn + i;
+            t.mfn = mfn_x(m);
+            t.p2mt = p2mt;
+            t.d = p2m->domain->domain_id;
+            t.order = PAGE_ORDER_4K;
+
+            __trace_var(TRC_MEM_SET_P2M_ENTRY, 0, sizeof(t), &t);
+        }
+
+        p2m_entry = (l1_pgentry_t *)table + gfn_remainder + i;
+        iommu_old_flags =
+            p2m_get_iommu_flags(p2m_flags_to_type(l1e_get_flags(*p2m_entry)));
+        old_mfn = l1e_get_pfn(*p2m_entry);
+
+        if ( mfn_valid(m) || p2m_allows_invalid_mfn(p2mt) )
+            entry_content = p2m_l1e_from_pfn(mfn_x(m),
+                                             p2m_type_to_flags(p2mt, m, 0));
+        else
+            entry_content = l1e_empty();
+
+        if ( entry_content.l1 != 0 )
+            p2m_add_iommu_flags(&entry_content, 0, iommu_pte_flags);
+
+        p2m->write_p2m_entry(p2m, gfn + i, p2m_entry, entry_content, 1);
+
+        if ( p2mt != p2m_invalid && gfn + i > p2m->max_mapped_pfn )
+            p2m->max_mapped_pfn = gfn + i;
+
+        if ( !iommu_enabled || !need_iommu(p2m->domain) ||
+             (iommu_old_flags == iommu_pte_flags && old_mfn == mfn_x(m)) )
+            continue;
+
+        if ( iommu_use_hap_pt(p2m->domain) )
+            flush_iommu |= !!iommu_old_flags;
+        else
+        {
+            flush_iommu = 1;
+            if ( iommu_pte_flags )
+                rc = iommu_map_page(p2m->domain, gfn + i, mfn_x(m),
+                                    iommu_pte_flags);
+            else
+                rc = iommu_unmap_page(p2m->domain, gfn + i);
+            if ( unlikely(rc) )
+                break;
+        }
+    }
+
+    this_cpu(iommu_dont_flush_iotlb) = iommu_dont_flush;
+
+    /* The run lies within one leaf table, so flush that as a whole. */
+    if ( flush_iommu && iommu_use_hap_pt(p2m->domain) )
+        amd_iommu_flush_pages(p2m->domain, gfn & ~(L1_PAGETABLE_ENTRIES - 1UL),
+                              PAGE_ORDER_2M);
+    else if ( flush_iommu && !iommu_dont_flush )
+    {
+        int ret = iommu_iotlb_flush(p2m->domain, gfn, nr);
+
+        if ( !rc )
+            rc = ret;
+    }
+
+ out:
+    unmap_domain_page(table);
+    return rc;
+
+ single:
+    for ( i = 0; i < nr; i++ )
+    {
+        int ret = p2m_pt_set_entry(p2m, gfn + i,
+                                   mfn_eq(mfn, INVALID_MFN) ? mfn
+                                                            : mfn_add(mfn, i),
+                                   PAGE_ORDER_4K, p2mt, p2ma, -1);
+
+        if ( ret )
+            rc = ret;
+    }
+
+    return rc;
+}
+
 static inline p2m_type_t recalc_type(bool_t recalc, p2m_type_t t,
                                      struct p2m_domain *p2m, unsigned long gfn)
 {
@@ -1121,13 +1253,107 @@ long p2m_pt_audit_p2m(struct p2m_domain *p2m)
 #endif /* P2M_AUDIT */
 
 /* Set up the p2m function pointers for pagetable format */
+/*
+ * Replace the page table mapping the 2^@order aligned range at @gfn by a
+ * single superpage entry, if all its entries map an aligned, contiguous
+ * range of RAM with identical flags, and have no re-calculation pending.
+ * Returns 1 if the range was recombined, 0 if not.
+ */
+static int p2m_pt_recombine_superpage(struct p2m_domain *p2m,
+                                      unsigned long gfn, unsigned int order)
+{
+    unsigned int i, level = order / PAGETABLE_ORDER;
+    unsigned long gfn_remainder = gfn, pfn, stride;
+    l1_pgentry_t *table, *pent, *ptab, old_entry, entry_content;
+    unsigned int flags;
+    int rc = 0;
+
+    ASSERT(p2m_locked_by_me(p2m));
+    ASSERT(level == 1 || level == 2);
+
+    stride = 1UL << ((level - 1) * PAGETABLE_ORDER);
+    table = map_domain_page(pagetable_get_mfn(p2m_get_pagetable(p2m)));
+
+    for ( i = 3; ; i-- )
+    {
+        pent = p2m_find_entry(table, &gfn_remainder, gfn,
+                              i * PAGETABLE_ORDER, 1 << PAGETABLE_ORDER);
+        if ( !pent )
+            goto out;
+
+        old_entry = *pent;
+        flags = l1e_get_flags(old_entry);
+        if ( !(flags & _PAGE_PRESENT) || (flags & _PAGE_PSE) ||
+             needs_recalc(l1, old_entry) )
+            goto out;
+
+        if ( i == level )
+            break;
+
+        ptab = map_domain_page(_mfn(l1e_get_pfn(old_entry)));
+        unmap_domain_page(table);
+        table = ptab;
+    }
+
+    ptab = map_domain_page(_mfn(l1e_get_pfn(old_entry)));
+
+    flags = l1e_get_flags(ptab[0]);
+    pfn = l1e_get_pfn(ptab[0]);
+    if ( p2m_flags_to_type(flags) != p2m_ram_rw ||
+         (pfn & ((1UL << order) - 1)) ||
+         !(flags & _PAGE_PRESENT) || !!(flags & _PAGE_PSE) != (level > 1) ||
+         needs_recalc(l1, ptab[0]) )
+        i = 0;
+    else
+        for ( i = 1; i < (1 << PAGETABLE_ORDER); i++ )
+            if ( l1e_get_flags(ptab[i]) != flags ||
+                 l1e_get_pfn(ptab[i]) != pfn + i * stride )
+                break;
+
+    unmap_domain_page(ptab);
+
+    if ( i < (1 << PAGETABLE_ORDER) )
+        goto out;
+
+    entry_content = l1e_from_pfn(pfn,
+                                 p2m_type_to_flags(p2m_ram_rw, _mfn(pfn),
+                                                   level) | _PAGE_PSE);
+    p2m_add_iommu_flags(&entry_content, 0,
+                        p2m_get_iommu_flags(p2m_ram_rw));
+
+    p2m->write_p2m_entry(p2m, gfn, pent, entry_content, level + 1);
+
+    if ( iommu_enabled && need_iommu(p2m->domain) &&
+         iommu_use_hap_pt(p2m->domain) )
+        amd_iommu_flush_pages(p2m->domain, gfn, order);
+
+    rc = 1;
+
+ out:
+    unmap_domain_page(table);
+
+    /* Free the old table only once it can no longer be walked. */
+    if ( rc > 0 )
+        p2m_free_entry(p2m, &old_entry, order);
+
+    return rc;
+}
+
+static void p2m_pt_tlb_flush(struct p2m_domain *p2m)
+{
+    flush_tlb_mask(p2m->domain->domain_dirty_cpumask);
+}
+
 void p2m_pt_init(struct p2m_domain *p2m)
 {
     p2m->set_entry = p2m_pt_set_entry;
+    p2m->set_entry_range = p2m_pt_set_entry_range;
     p2m->get_entry = p2m_pt_get_entry;
     p2m->change_entry_type_global = p2m_pt_change_entry_type_global;
     p2m->change_entry_type_range = p2m_pt_change_entry_type_range;
     p2m->write_p2m_entry = paging_write_p2m_entry;
+    p2m->recombine_superpage = p2m_pt_recombine_superpage;
+    p2m->tlb_flush = p2m_pt_tlb_flush;
 #if P2M_AUDIT
     p2m->audit_p2m = p2m_pt_audit_p2m;
 #else
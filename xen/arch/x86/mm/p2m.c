@@ -26,6 +26,9 @@
 #include <xen/iommu.h>
 #include <xen/vm_event.h>
 #include <xen/event.h>
+#include <xen/guest_access.h>
+#include <xen/mem_access.h>
+#include <public/sysctl.h>
 #include <public/vm_event.h>
 #include <asm/domain.h>
 #include <asm/page.h>
@@ -46,6 +49,20 @@ bool_t __initdata opt_hap_1gb = 1, __initdata opt_hap_2mb = 1;
 boolean_param("hap_1gb", opt_hap_1gb);
 boolean_param("hap_2mb", opt_hap_2mb);
 
+/*
+ * Interval (in ms) at which the p2m of a HAP domain is scanned for split
+ * superpages which can be recombined, 0 to disable.
+ */
+static unsigned int __read_mostly opt_p2m_recombine_ms = 1000;
+integer_param("p2m_recombine_ms", opt_p2m_recombine_ms);
+
+/*
+ * Interval (in ms) at which a new 1G window of the p2m of a HAP domain is
+ * armed for NUMA access sampling, 0 (the default) to disable balancing.
+ */
+static unsigned int __read_mostly opt_p2m_numa_balance_ms;
+integer_param("p2m_numa_balance_ms", opt_p2m_numa_balance_ms);
+
 /* Override macros from asm/page.h to make them work with mfn_t */
 #undef mfn_to_page
 #define mfn_to_page(_m) __mfn_to_page(mfn_x(_m))
@@ -115,9 +132,261 @@ static void p2m_free_one(struct p2m_domain *p2m)
     xfree(p2m);
 }
 
+/*
+ * Superpage recombination.
+ *
+ * Superpages get split whenever part of their range needs a different
+ * type or access (log-dirty, mem_access, PoD, ballooning ...), and nothing
+ * puts them back together once the range is uniform again.  A tasklet,
+ * kicked off by a timer, therefore walks the p2m of each HAP domain, one
+ * 1G region per run, and asks the implementation to replace every page
+ * table which maps a contiguous, aligned and uniformly typed range by a
+ * single 2M or 1G entry.
+ */
+static void p2m_recombine_timer_fn(void *data)
+{
+    struct p2m_domain *p2m = data;
+
+    tasklet_schedule(&p2m->superpage.tasklet);
+}
+
+static void p2m_recombine_tasklet_fn(unsigned long data)
+{
+    struct p2m_domain *p2m = (struct p2m_domain *)data;
+    struct domain *d = p2m->domain;
+    unsigned long gfn = p2m->superpage.next_gfn & ~((1UL << PAGE_ORDER_1G) - 1);
+    unsigned long end = gfn + (1UL << PAGE_ORDER_1G);
+
+    if ( d->is_dying )
+        return;
+
+    /* Log-dirty tracking would split the superpages again right away. */
+    if ( paging_mode_log_dirty(d) || !hap_has_2mb )
+        goto out;
+
+    for ( ; gfn < end; gfn += 1UL << PAGE_ORDER_2M )
+    {
+        p2m_lock(p2m);
+        if ( !d->is_dying &&
+             !pagetable_is_null(p2m_get_pagetable(p2m)) &&
+             p2m->recombine_superpage(p2m, gfn, PAGE_ORDER_2M) > 0 )
+            p2m->superpage.promoted[0]++;
+        p2m_unlock(p2m);
+    }
+
+    if ( hap_has_1gb )
+    {
+        gfn = end - (1UL << PAGE_ORDER_1G);
+        p2m_lock(p2m);
+        if ( !d->is_dying &&
+             !pagetable_is_null(p2m_get_pagetable(p2m)) &&
+             p2m->recombine_superpage(p2m, gfn, PAGE_ORDER_1G) > 0 )
+            p2m->superpage.promoted[1]++;
+        p2m_unlock(p2m);
+    }
+
+ out:
+    p2m->superpage.next_gfn = (end > p2m->max_mapped_pfn) ? 0 : end;
+    set_timer(&p2m->superpage.timer,
+              NOW() + MILLISECS(opt_p2m_recombine_ms));
+}
+
+/*
+ * NUMA balancing.
+ *
+ * Each period the balancer arms a 1G window of the p2m so that the first
+ * access to each range mapped by one entry takes an EPT misconfiguration
+ * exit.  That exit happens on the pCPU doing the access, which tells both
+ * the node the access came from and the node of the memory.  Accessed bits
+ * would be cheaper to collect, but say nothing about who set them.
+ *
+ * Samples feed two decisions:
+ * - a 2M chunk sampled twice in a row from the same remote node is queued
+ *   for migration there (the second sample filtering out one-off
+ *   accesses);
+ * - if one node took at least 3/4 of the last P2M_NUMA_MIN_SAMPLES or more
+ *   samples, it becomes the domain's home node, towards which the
+ *   scheduler pulls its vCPUs.  Chunks then only move to that node, so
+ *   that memory and vCPUs converge instead of chasing each other.
+ */
+#define P2M_NUMA_MIN_SAMPLES 64
+
+static bool_t p2m_numa_balanceable(struct domain *d)
+{
+    return num_online_nodes() > 1 && !need_iommu(d) && !altp2m_active(d) &&
+           !nestedhvm_enabled(d);
+}
+
+void p2m_numa_sample(struct p2m_domain *p2m, unsigned long gfn)
+{
+    nodeid_t cpu_node = cpu_to_node(smp_processor_id()), mem_node, home;
+    unsigned long chunk = gfn >> PAGE_ORDER_2M;
+    unsigned int slot = chunk % P2M_NUMA_FILTER_SIZE;
+    p2m_access_t a;
+    p2m_type_t t;
+    mfn_t mfn;
+
+    ASSERT(p2m_locked_by_me(p2m));
+
+    if ( !opt_p2m_numa_balance_ms || !p2m_is_hostp2m(p2m) )
+        return;
+
+    mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, NULL, NULL);
+    if ( !p2m_is_ram(t) || !mfn_valid(mfn) )
+        return;
+
+    mem_node = phys_to_nid(pfn_to_paddr(mfn_x(mfn)));
+    p2m->numa.window[mem_node]++;
+    p2m->numa.samples[mem_node]++;
+
+    if ( mem_node == cpu_node )
+    {
+        p2m->numa.local++;
+        return;
+    }
+    p2m->numa.remote++;
+
+    if ( p2m->numa.filter[slot].chunk != chunk ||
+         p2m->numa.filter[slot].node != cpu_node )
+    {
+        p2m->numa.filter[slot].chunk = chunk;
+        p2m->numa.filter[slot].node = cpu_node;
+        return;
+    }
+    p2m->numa.filter[slot].chunk = ~0UL;
+
+    home = p2m->domain->numa_home;
+    if ( (home == NUMA_NO_NODE || home == cpu_node) &&
+         p2m->numa.nr_queued < P2M_NUMA_QUEUE_SIZE )
+    {
+        p2m->numa.queue[p2m->numa.nr_queued].gfn = chunk << PAGE_ORDER_2M;
+        p2m->numa.queue[p2m->numa.nr_queued].node = cpu_node;
+        p2m->numa.nr_queued++;
+    }
+}
+
+static void p2m_numa_timer_fn(void *data)
+{
+    struct p2m_domain *p2m = data;
+
+    tasklet_schedule(&p2m->numa.tasklet);
+}
+
+static void p2m_numa_tasklet_fn(unsigned long data)
+{
+    struct p2m_domain *p2m = (struct p2m_domain *)data;
+    struct domain *d = p2m->domain;
+    typeof(p2m->numa.queue) queue;
+    unsigned long gfn = p2m->numa.next_gfn & ~((1UL << PAGE_ORDER_1G) - 1);
+    unsigned long end = gfn + (1UL << PAGE_ORDER_1G), total = 0, best = 0;
+    nodeid_t node, home = NUMA_NO_NODE;
+    unsigned int i, nr;
+
+    if ( d->is_dying )
+        return;
+
+    if ( !p2m_numa_balanceable(d) )
+        goto out;
+
+    p2m_lock(p2m);
+
+    for_each_online_node ( node )
+    {
+        total += p2m->numa.window[node];
+        if ( p2m->numa.window[node] > best )
+        {
+            best = p2m->numa.window[node];
+            home = node;
+        }
+    }
+    if ( total >= P2M_NUMA_MIN_SAMPLES )
+    {
+        write_atomic(&d->numa_home, best * 4 >= total * 3 ? home
+                                                          : NUMA_NO_NODE);
+        memset(p2m->numa.window, 0, sizeof(p2m->numa.window));
+    }
+
+    nr = p2m->numa.nr_queued;
+    memcpy(queue, p2m->numa.queue, nr * sizeof(*queue));
+    p2m->numa.nr_queued = 0;
+
+    if ( !d->is_dying && !pagetable_is_null(p2m_get_pagetable(p2m)) )
+        p2m->numa_sample_range(p2m, gfn, end - 1);
+
+    p2m_unlock(p2m);
+
+    for ( i = 0; i < nr && !d->is_dying; i++ )
+    {
+        struct xen_domctl_numa_migrate op = {
+            .start_gfn = queue[i].gfn,
+            .nr_gfns = 1UL << PAGE_ORDER_2M,
+            .node = queue[i].node,
+        };
+
+        /* On preemption, the rest of the chunk waits for more samples. */
+        p2m_numa_migrate(d, &op);
+        p2m->numa.migrated += op.nr_migrated;
+        p2m->numa.busy += op.nr_busy;
+    }
+
+ out:
+    p2m->numa.next_gfn = (end > p2m->max_mapped_pfn) ? 0 : end;
+    set_timer(&p2m->numa.timer, NOW() + MILLISECS(opt_p2m_numa_balance_ms));
+}
+
+int p2m_numa_locality(struct xen_sysctl_numa_locality *op)
+{
+    struct domain *d;
+    const struct p2m_domain *p2m;
+    unsigned int i, nr = last_node(node_online_map) + 1;
+    int rc = 0;
+
+    if ( op->pad || op->pad2 )
+        return -EINVAL;
+
+    d = rcu_lock_domain_by_id(op->domid);
+    if ( !d )
+        return -ESRCH;
+
+    p2m = p2m_get_hostp2m(d);
+    if ( !opt_p2m_numa_balance_ms || !hap_enabled(d) ||
+         !p2m->numa_sample_range )
+    {
+        rc = -EOPNOTSUPP;
+        goto out;
+    }
+
+    op->home_node = read_atomic(&d->numa_home);
+    if ( op->home_node == NUMA_NO_NODE )
+        op->home_node = XEN_INVALID_NODE_ID;
+    op->local = p2m->numa.local;
+    op->remote = p2m->numa.remote;
+    op->migrated = p2m->numa.migrated;
+    op->busy = p2m->numa.busy;
+
+    if ( !guest_handle_is_null(op->samples) )
+    {
+        nr = min(nr, op->nr_nodes);
+        for ( i = 0; i < nr; i++ )
+            if ( copy_to_guest_offset(op->samples, i,
+                                      &p2m->numa.samples[i], 1) )
+            {
+                rc = -EFAULT;
+                goto out;
+            }
+    }
+    op->nr_nodes = nr;
+
+ out:
+    rcu_unlock_domain(d);
+
+    return rc;
+}
+
 static int p2m_init_hostp2m(struct domain *d)
 {
     struct p2m_domain *p2m = p2m_init_one(d);
+    unsigned int i;
 
     if ( p2m )
     {
@@ -125,6 +394,16 @@ static int p2m_init_hostp2m(struct domain *d)
                                             RANGESETF_prettyprint_hex);
         if ( p2m->logdirty_ranges )
         {
+            init_timer(&p2m->superpage.timer, p2m_recombine_timer_fn, p2m,
+                       smp_processor_id());
+            idle_tasklet_init(&p2m->superpage.tasklet,
+                              p2m_recombine_tasklet_fn, (unsigned long)p2m);
+            init_timer(&p2m->numa.timer, p2m_numa_timer_fn, p2m,
+                       smp_processor_id());
+            idle_tasklet_init(&p2m->numa.tasklet,
+                              p2m_numa_tasklet_fn, (unsigned long)p2m);
+            for ( i = 0; i < P2M_NUMA_FILTER_SIZE; i++ )
+                p2m->numa.filter[i].chunk = ~0UL;
             d->arch.p2m = p2m;
             return 0;
         }
@@ -140,6 +419,10 @@ static void p2m_teardown_hostp2m(struct domain *d)
 
     if ( p2m )
     {
+        kill_timer(&p2m->superpage.timer);
+        tasklet_kill(&p2m->superpage.tasklet);
+        kill_timer(&p2m->numa.timer);
+        tasklet_kill(&p2m->numa.tasklet);
         rangeset_destroy(p2m->logdirty_ranges);
         p2m_free_one(p2m);
         d->arch.p2m = NULL;
@@ -465,42 +748,69 @@ struct page_info *get_page_from_gfn_p2m(
     return page;
 }
 
-/* Returns: 0 for success, -errno for failure */
-int p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
-                  unsigned int page_order, p2m_type_t p2mt, p2m_access_t p2ma)
+/*
+ * Map the 'nr' gfns starting at 'gfn' using the largest pages alignment
+ * permits.  Runs of 4k pages are handed to the implementation's
+ * set_entry_range() a leaf table at a time, so that each table is walked
+ * once rather than once per page.  Any TLB flush is deferred while the p2m
+ * lock is held, so the whole range is flushed once when it is dropped.
+ *
+ * Returns: 0 for success, -errno for failure
+ */
+int p2m_set_entry_range(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
+                        unsigned long nr, p2m_type_t p2mt, p2m_access_t p2ma)
 {
     struct domain *d = p2m->domain;
-    unsigned long todo = 1ul << page_order;
+    unsigned long count;
     unsigned int order;
     int set_rc, rc = 0;
 
     ASSERT(gfn_locked_by_me(p2m, gfn));
 
-    while ( todo )
+    while ( nr )
     {
         if ( hap_enabled(d) )
-            order = (!((gfn | mfn_x(mfn) | todo) &
+            order = (!((gfn | mfn_x(mfn) | nr) &
                        ((1ul << PAGE_ORDER_1G) - 1)) &&
                      hap_has_1gb) ? PAGE_ORDER_1G :
-                    (!((gfn | mfn_x(mfn) | todo) &
+                    (!((gfn | mfn_x(mfn) | nr) &
                        ((1ul << PAGE_ORDER_2M) - 1)) &&
                      hap_has_2mb) ? PAGE_ORDER_2M : PAGE_ORDER_4K;
         else
             order = 0;
 
-        set_rc = p2m->set_entry(p2m, gfn, mfn, order, p2mt, p2ma, -1);
+        count = 1ul << order;
+        if ( order == PAGE_ORDER_4K && p2m->set_entry_range )
+        {
+            /*
+             * Stop at the end of the leaf table: the next gfn may be
+             * suitably aligned for a superpage.
+             */
+            count = min(nr, (1ul << PAGE_ORDER_2M) -
+                            (gfn & ((1ul << PAGE_ORDER_2M) - 1)));
+            set_rc = p2m->set_entry_range(p2m, gfn, mfn, count, p2mt, p2ma);
+        }
+        else
+            set_rc = p2m->set_entry(p2m, gfn, mfn, order, p2mt, p2ma, -1);
         if ( set_rc )
             rc = set_rc;
 
-        gfn += 1ul << order;
+        gfn += count;
         if ( !mfn_eq(mfn, INVALID_MFN) )
-            mfn = mfn_add(mfn, 1ul << order);
-        todo -= 1ul << order;
+            mfn = mfn_add(mfn, count);
+        nr -= count;
     }
 
     return rc;
 }
 
+/* Returns: 0 for success, -errno for failure */
+int p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
+                  unsigned int page_order, p2m_type_t p2mt, p2m_access_t p2ma)
+{
+    return p2m_set_entry_range(p2m, gfn, mfn, 1ul << page_order, p2mt, p2ma);
+}
+
 struct page_info *p2m_alloc_ptp(struct p2m_domain *p2m, unsigned long type)
 {
     struct page_info *pg;
@@ -584,6 +894,17 @@ int p2m_alloc_table(struct p2m_domain *p2m)
                        p2m_invalid, p2m->default_access);
     p2m->defer_nested_flush = 0;
     p2m_unlock(p2m);
+
+    if ( p2m_is_hostp2m(p2m) && hap_enabled(d) && opt_p2m_recombine_ms &&
+         p2m->recombine_superpage )
+        set_timer(&p2m->superpage.timer,
+                  NOW() + MILLISECS(opt_p2m_recombine_ms));
+
+    if ( p2m_is_hostp2m(p2m) && hap_enabled(d) && opt_p2m_numa_balance_ms &&
+         p2m->numa_sample_range )
+        set_timer(&p2m->numa.timer,
+                  NOW() + MILLISECS(opt_p2m_numa_balance_ms));
+
     if ( !rc )
         P2M_PRINTK("p2m table initialised for slot zero\n");
     else
@@ -607,6 +928,14 @@ void p2m_teardown(struct p2m_domain *p2m)
 
     d = p2m->domain;
 
+    if ( p2m_is_hostp2m(p2m) )
+    {
+        kill_timer(&p2m->superpage.timer);
+        tasklet_kill(&p2m->superpage.tasklet);
+        kill_timer(&p2m->numa.timer);
+        tasklet_kill(&p2m->numa.tasklet);
+    }
+
     p2m_lock(p2m);
     ASSERT(atomic_read(&d->shr_pages) == 0);
     p2m->phys_table = pagetable_null();
@@ -644,15 +973,7 @@ p2m_remove_page(struct p2m_domain *p2m, unsigned long gfn, unsigned long mfn,
         int rc = 0;
 
         if ( need_iommu(p2m->domain) )
-        {
-            for ( i = 0; i < (1 << page_order); i++ )
-            {
-                int ret = iommu_unmap_page(p2m->domain, mfn + i);
-
-                if ( !rc )
-                    rc = ret;
-            }
-        }
+            rc = iommu_unmap_pages(p2m->domain, mfn, page_order);
 
         return rc;
     }
@@ -701,23 +1022,8 @@ guest_physmap_add_entry(struct domain *d, gfn_t gfn, mfn_t mfn,
     if ( !paging_mode_translate(d) )
     {
         if ( need_iommu(d) && t == p2m_ram_rw )
-        {
-            for ( i = 0; i < (1 << page_order); i++ )
-            {
-                rc = iommu_map_page(d, mfn_x(mfn_add(mfn, i)),
-                                    mfn_x(mfn_add(mfn, i)),
-                                    IOMMUF_readable|IOMMUF_writable);
-                if ( rc != 0 )
-                {
-                    while ( i-- > 0 )
-                        /* If statement to satisfy __must_check. */
-                        if ( iommu_unmap_page(d, mfn_x(mfn_add(mfn, i))) )
-                            continue;
-
-                    return rc;
-                }
-            }
-        }
+            return iommu_map_pages(d, mfn_x(mfn), mfn_x(mfn), page_order,
+                                   IOMMUF_readable|IOMMUF_writable);
         return 0;
     }
 
@@ -888,6 +1194,58 @@ int p2m_change_type_one(struct domain *d, unsigned long gfn,
     return rc;
 }
 
+/*
+ * Create IOMMU mappings for every p2m entry from *gfn onwards, for a domain
+ * whose IOMMU page tables are not shared with the p2m.  Each entry is
+ * mapped in one go, so superpages stay superpages where the IOMMU supports
+ * them, and the IOTLB flush is left to the caller.  Returns -ERESTART with
+ * *gfn updated if preempted.
+ */
+int p2m_iommu_populate(struct domain *d, unsigned long *gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long start = *gfn;
+    unsigned int n = 0;
+    int rc = 0;
+
+    ASSERT(this_cpu(iommu_dont_flush_iotlb));
+
+    p2m_lock(p2m);
+
+    while ( start <= p2m->max_mapped_pfn )
+    {
+        p2m_type_t t;
+        p2m_access_t a;
+        unsigned int order, flags;
+        mfn_t mfn = p2m->get_entry(p2m, start, &t, &a, 0, &order, NULL);
+
+        while ( start & ((1UL << order) - 1) )
+            order--;
+
+        flags = p2m_get_iommu_flags(t);
+        if ( flags )
+        {
+            rc = iommu_map_pages(d, start, mfn_x(mfn), order, flags);
+            if ( rc )
+                break;
+        }
+
+        start += 1UL << order;
+
+        if ( !(++n & 0xff) && hypercall_preempt_check() )
+        {
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    p2m_unlock(p2m);
+
+    *gfn = start;
+
+    return rc;
+}
+
 /* Modify the p2m type of a range of gfns from ot to nt. */
 void p2m_change_type_range(struct domain *d, 
                            unsigned long start, unsigned long end,
@@ -947,6 +1305,210 @@ void p2m_change_type_range(struct domain *d,
     p2m_unlock(p2m);
 }
 
+/*
+ * Move the chunk of 1 << @order frames at @gfn (aligned, and mapped by a
+ * single p2m entry of at least that order) to new pages on @node.
+ *
+ * The p2m write lock is held throughout, so no new references to the
+ * pages can be obtained through the p2m.  Pages with references other
+ * than the allocation one are in use elsewhere and are left alone.  The
+ * others are made read-only while being copied, so that guest writes
+ * fault and wait for the lock, and are stolen from the domain, which
+ * also fends off attempts to get references to them by MFN.  Finally the
+ * p2m entry is switched to the new pages, with the TLB flush this implies.
+ *
+ * Returns 1 if the chunk was moved, 0 if there was nothing to do, -EBUSY
+ * if the chunk is in use, or another -errno.
+ */
+static int p2m_numa_migrate_chunk(struct domain *d, unsigned long gfn,
+                                  unsigned int order, nodeid_t node)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long i, nr = 1UL << order, omfn, nmfn;
+    struct page_info *opg, *npg;
+    unsigned int cur_order = 0;
+    bool_t sve = 1, drop_dom_ref;
+    p2m_access_t a;
+    p2m_type_t t;
+    mfn_t mfn;
+    int rc = 0;
+
+    p2m_lock(p2m);
+
+    mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, &cur_order, &sve);
+    omfn = mfn_x(mfn);
+    if ( t != p2m_ram_rw || !mfn_valid(mfn) || cur_order < order ||
+         phys_to_nid(pfn_to_paddr(omfn)) == node )
+        goto out;
+
+    rc = -EBUSY;
+    opg = mfn_to_page(mfn);
+    for ( i = 0; i < nr; i++ )
+        if ( page_get_owner(opg + i) != d ||
+             (opg[i].count_info & (PGC_count_mask | PGC_allocated)) !=
+             (1 | PGC_allocated) ||
+             (opg[i].u.inuse.type_info & PGT_count_mask) )
+            goto out;
+
+    rc = -ENOMEM;
+    npg = alloc_domheap_pages(d, order,
+                              MEMF_no_owner | MEMF_node(node) | MEMF_exact_node);
+    if ( !npg )
+        goto out;
+    nmfn = mfn_x(page_to_mfn(npg));
+
+    rc = p2m->set_entry(p2m, gfn, mfn, order, p2m_ram_logdirty, a, sve);
+    if ( rc )
+        goto free;
+
+    for ( i = 0; i < nr; i++ )
+        if ( steal_page(d, opg + i, MEMF_no_refcount) )
+            break;
+    if ( i < nr )
+    {
+        /* Raced with someone getting a reference by MFN: put things back. */
+        rc = -EBUSY;
+        while ( i-- )
+            if ( assign_pages(d, opg + i, 0, MEMF_no_refcount) )
+                goto dying;
+        if ( p2m->set_entry(p2m, gfn, mfn, order, p2m_ram_rw, a, sve) )
+            domain_crash(d);
+        goto free;
+    }
+
+    for ( i = 0; i < nr; i++ )
+        copy_domain_page(_mfn(nmfn + i), _mfn(omfn + i));
+
+    if ( assign_pages(d, npg, order, MEMF_no_refcount) )
+    {
+        rc = -ESRCH;
+        goto dying;
+    }
+
+    if ( p2m->set_entry(p2m, gfn, _mfn(nmfn), order, p2m_ram_rw, a, sve) )
+    {
+        /* The entry was split to @order already, so this can't fail. */
+        domain_crash(d);
+        p2m_unlock(p2m);
+        return -EIO;
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        set_gpfn_from_mfn(nmfn + i, gfn + i);
+        set_gpfn_from_mfn(omfn + i, INVALID_M2P_ENTRY);
+    }
+
+    p2m_unlock(p2m);
+
+    for ( i = 0; i < nr; i++ )
+        if ( test_and_clear_bit(_PGC_allocated, &opg[i].count_info) )
+            put_page(opg + i);
+
+    return 1;
+
+ dying:
+    /*
+     * Pages can't be assigned to a dying domain: drop the chunk, with the
+     * pages which were stolen without adjusting tot_pages.
+     */
+    BUG_ON(!d->is_dying);
+    p2m->set_entry(p2m, gfn, INVALID_MFN, order, p2m_invalid,
+                   p2m->default_access, -1);
+    spin_lock(&d->page_alloc_lock);
+    drop_dom_ref = 0;
+    for ( i = 0; i < nr; i++ )
+        if ( !page_get_owner(opg + i) )
+        {
+            set_gpfn_from_mfn(omfn + i, INVALID_M2P_ENTRY);
+            if ( !domain_adjust_tot_pages(d, -1) )
+                drop_dom_ref = 1;
+        }
+    spin_unlock(&d->page_alloc_lock);
+    if ( drop_dom_ref )
+        put_domain(d);
+    for ( i = 0; i < nr; i++ )
+        if ( !page_get_owner(opg + i) &&
+             test_and_clear_bit(_PGC_allocated, &opg[i].count_info) )
+            put_page(opg + i);
+ free:
+    free_domheap_pages(npg, order);
+ out:
+    p2m_unlock(p2m);
+    return rc;
+}
+
+int p2m_numa_migrate(struct domain *d, struct xen_domctl_numa_migrate *op)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn = op->start_gfn, end = op->start_gfn + op->nr_gfns;
+    int rc = 0;
+
+    if ( op->pad || op->node >= MAX_NUMNODES || !node_online(op->node) ||
+         end < gfn )
+        return -EINVAL;
+
+    if ( !paging_mode_hap(d) || need_iommu(d) || altp2m_active(d) ||
+         nestedhvm_enabled(d) )
+        return -EOPNOTSUPP;
+
+    if ( end > p2m->max_mapped_pfn + 1 )
+        end = p2m->max_mapped_pfn + 1;
+
+    while ( gfn < end )
+    {
+        unsigned int order = 0;
+        p2m_access_t a;
+        p2m_type_t t;
+        mfn_t mfn;
+
+        p2m_read_lock(p2m);
+        mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, &order, NULL);
+        p2m_read_unlock(p2m);
+
+        if ( t == p2m_ram_rw && mfn_valid(mfn) )
+        {
+            /*
+             * Move superpages as a whole (1G ones 2M at a time), unless
+             * they stick out of the range.
+             */
+            order = min_t(unsigned int, order, PAGE_ORDER_2M);
+            if ( (gfn & ((1UL << order) - 1)) || gfn + (1UL << order) > end )
+                order = PAGE_ORDER_4K;
+
+            rc = p2m_numa_migrate_chunk(d, gfn, order, op->node);
+            if ( rc == -ENOMEM && order )
+            {
+                /* No contiguous memory left on the node: split. */
+                order = PAGE_ORDER_4K;
+                rc = p2m_numa_migrate_chunk(d, gfn, order, op->node);
+            }
+            if ( rc > 0 )
+                op->nr_migrated += 1UL << order;
+            else if ( rc == -EBUSY )
+                op->nr_busy += 1UL << order;
+            else if ( rc < 0 )
+                break;
+            rc = 0;
+        }
+
+        /* Skip the rest of whatever p2m entry @gfn was found in. */
+        gfn = (gfn | ((1UL << order) - 1)) + 1;
+
+        if ( gfn < end && hypercall_preempt_check() )
+        {
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    gfn = min(gfn, end);
+    op->nr_gfns -= min_t(uint64_t, gfn - op->start_gfn, op->nr_gfns);
+    op->start_gfn = gfn;
+
+    return rc;
+}
+
 /*
  * Returns:
  *    0              for success
@@ -1664,6 +2226,7 @@ bool_t p2m_mem_access_check(paddr_t gpa, unsigned long gla,
     p2m_type_t p2mt;
     p2m_access_t p2ma;
     vm_event_request_t *req;
+    bool_t sync;
     int rc;
 
     if ( altp2m_active(d) )
@@ -1724,6 +2287,35 @@ bool_t p2m_mem_access_check(paddr_t gpa, unsigned long gla,
     }
 
     *req_ptr = NULL;
+    sync = (p2ma != p2m_access_n2rwx);
+
+    /*
+     * Let the filter table settle a blocking violation without a round trip
+     * to the monitor.  The emulation is done by the caller once the gfn has
+     * been put.
+     */
+    switch ( !sync ? XENMEM_access_filter_event :
+             mem_access_filter_check(d, gfn,
+                 (npfec.read_access ? XENMEM_ACCESS_FILTER_R : 0) |
+                 (npfec.write_access ? XENMEM_ACCESS_FILTER_W : 0) |
+                 (npfec.insn_fetch ? XENMEM_ACCESS_FILTER_X : 0),
+                 guest_cpu_user_regs()->rip) )
+    {
+    case XENMEM_access_filter_allow:
+        v->arch.vm_event->emulate_flags = VM_EVENT_FLAG_EMULATE;
+        return 1;
+
+    case XENMEM_access_filter_emulate_nowrite:
+        v->arch.vm_event->emulate_flags = VM_EVENT_FLAG_EMULATE |
+                                          VM_EVENT_FLAG_EMULATE_NOWRITE;
+        return 1;
+
+    case XENMEM_access_filter_notify:
+        v->arch.vm_event->emulate_flags = VM_EVENT_FLAG_EMULATE;
+        sync = 0;
+        break;
+    }
+
     req = xzalloc(vm_event_request_t);
     if ( req )
     {
@@ -1748,7 +2340,7 @@ bool_t p2m_mem_access_check(paddr_t gpa, unsigned long gla,
     }
 
     /* Return whether vCPU pause is required (aka. sync event) */
-    return (p2ma != p2m_access_n2rwx);
+    return sync;
 }
 
 static inline
@@ -2363,6 +2955,7 @@ bool_t p2m_altp2m_lazy_copy(struct vcpu *v, paddr_t gpa,
 
     rv = p2m_set_entry(*ap2m, gfn_x(gfn) & mask, mfn, page_order, p2mt, p2ma);
     p2m_unlock(*ap2m);
+    perfc_incr(altp2m_lazy_copy);
 
     if ( rv )
     {
@@ -2384,9 +2977,8 @@ void p2m_flush_altp2m(struct domain *d)
     for ( i = 0; i < MAX_ALTP2M; i++ )
     {
         p2m_flush_table(d->arch.altp2m_p2m[i]);
-        /* Uninit and reinit ept to force TLB shootdown */
-        ept_p2m_uninit(d->arch.altp2m_p2m[i]);
-        ept_p2m_init(d->arch.altp2m_p2m[i]);
+        /* Force TLB shootdown */
+        ept_sync_domain(d->arch.altp2m_p2m[i]);
         d->arch.altp2m_eptp[i] = mfn_x(INVALID_MFN);
     }
 
@@ -2466,9 +3058,8 @@ int p2m_destroy_altp2m_by_id(struct domain *d, unsigned int idx)
         if ( !_atomic_read(p2m->active_vcpus) )
         {
             p2m_flush_table(d->arch.altp2m_p2m[idx]);
-            /* Uninit and reinit ept to force TLB shootdown */
-            ept_p2m_uninit(d->arch.altp2m_p2m[idx]);
-            ept_p2m_init(d->arch.altp2m_p2m[idx]);
+            /* Force TLB shootdown */
+            ept_sync_domain(d->arch.altp2m_p2m[idx]);
             d->arch.altp2m_eptp[idx] = mfn_x(INVALID_MFN);
             rc = 0;
         }
@@ -2596,18 +3187,32 @@ int p2m_change_altp2m_gfn(struct domain *d, unsigned int idx,
 static void p2m_reset_altp2m(struct p2m_domain *p2m)
 {
     p2m_flush_table(p2m);
-    /* Uninit and reinit ept to force TLB shootdown */
-    ept_p2m_uninit(p2m);
-    ept_p2m_init(p2m);
+    /*
+     * Force a TLB shootdown.  The EPT data is not torn down and set up
+     * again, as PCPUs entering the guest may be looking at it.
+     */
+    ept_sync_domain(p2m);
     p2m->min_remapped_gfn = gfn_x(INVALID_GFN);
     p2m->max_remapped_gfn = 0;
+    perfc_incr(altp2m_propagate_reset);
 }
 
+/*
+ * Views only learn about host p2m changes for gfns they hold an entry for;
+ * other gfns are copied from the host p2m on the first EPT violation (see
+ * p2m_altp2m_lazy_copy()).  The same lazy scheme deals with entries whose
+ * MFN goes away or changes: they are dropped rather than rewritten.
+ * Changes keeping the MFN are applied in place, so that new restrictions
+ * take effect at once and relaxations do not cost the view another fault.
+ *
+ * The views' flushes are batched into one IPI, since all of them go to the
+ * domain's dirty CPUs anyway.
+ */
 void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
                                  mfn_t mfn, unsigned int page_order,
                                  p2m_type_t p2mt, p2m_access_t p2ma)
 {
-    struct p2m_domain *p2m;
+    struct p2m_domain *p2m, *flush_p2m = NULL;
     p2m_access_t a;
     p2m_type_t t;
     mfn_t m;
@@ -2618,6 +3223,8 @@ void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
     if ( !altp2m_active(d) )
         return;
 
+    perfc_incr(altp2m_propagate);
+
     altp2m_list_lock(d);
 
     for ( i = 0; i < MAX_ALTP2M; i++ )
@@ -2659,12 +3266,36 @@ void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
             }
         }
         else if ( !mfn_eq(m, INVALID_MFN) )
-            p2m_set_entry(p2m, gfn_x(gfn), mfn, page_order, p2mt, p2ma);
+        {
+            p2m->defer_flush++;
+
+            if ( mfn_eq(m, mfn) )
+            {
+                p2m_set_entry(p2m, gfn_x(gfn), mfn, page_order, p2mt, p2ma);
+                perfc_incr(altp2m_propagate_set);
+            }
+            else
+            {
+                p2m_set_entry(p2m, gfn_x(gfn), INVALID_MFN, page_order,
+                              p2m_invalid, p2m->default_access);
+                perfc_incr(altp2m_propagate_drop);
+            }
+
+            if ( !--p2m->defer_flush && p2m->need_flush )
+            {
+                p2m->need_flush = 0;
+                flush_p2m = p2m;
+            }
+        }
 
         __put_gfn(p2m, gfn_x(gfn));
     }
 
  out:
+    /* Each view bumped its flush generation, one IPI covers them all. */
+    if ( flush_p2m )
+        flush_p2m->tlb_flush(flush_p2m);
+
     altp2m_list_unlock(d);
 }
 
@@ -46,6 +46,8 @@
 
 /* Per-CPU variable for enforcing the lock ordering */
 DEFINE_PER_CPU(int, mm_lock_level);
+DEFINE_PER_CPU(unsigned int, mm_read_depth);
+DEFINE_PER_CPU(int, mm_read_unlock_level);
 
 /* Override macros from asm/page.h to make them work with mfn_t */
 #undef mfn_to_page
@@ -407,13 +409,56 @@ int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn)
 }
 
 
+/*
+ * Append the pfns set in the log-dirty leaf l1, whose first bit is for pfn
+ * base, to the pfn list in sc->dirty_bitmap after the first done entries.
+ * Returns the number of pfns added, -ENOSPC if they don't all fit, or
+ * -EFAULT.
+ */
+static long log_dirty_copy_pfns(struct xen_domctl_shadow_op *sc,
+                                unsigned long done, const unsigned long *l1,
+                                unsigned long base)
+{
+    uint64_t buf[64];
+    unsigned int i, nr = 0;
+    unsigned long added = 0;
+
+    i = find_first_bit(l1, PAGE_SIZE * 8);
+    if ( i >= PAGE_SIZE * 8 )
+        return 0;
+
+    for ( ; i < PAGE_SIZE * 8; i = find_next_bit(l1, PAGE_SIZE * 8, i + 1) )
+    {
+        if ( done + added + nr >= sc->pages )
+            return -ENOSPC;
+
+        buf[nr++] = base + i;
+        if ( nr == ARRAY_SIZE(buf) )
+        {
+            if ( copy_to_guest_offset(sc->dirty_bitmap,
+                                      (done + added) * sizeof(*buf),
+                                      (uint8_t *)buf, nr * sizeof(*buf)) )
+                return -EFAULT;
+            added += nr;
+            nr = 0;
+        }
+    }
+
+    if ( nr && copy_to_guest_offset(sc->dirty_bitmap,
+                                    (done + added) * sizeof(*buf),
+                                    (uint8_t *)buf, nr * sizeof(*buf)) )
+        return -EFAULT;
+
+    return added + nr;
+}
+
 /* Read a domain's log-dirty bitmap and stats.  If the operation is a CLEAN,
  * clear the bitmap and stats as well. */
 static int paging_log_dirty_op(struct domain *d,
                                struct xen_domctl_shadow_op *sc,
                                bool_t resuming)
 {
-    int rv = 0, clean = 0, peek = 1;
+    int rv = 0, clean = 0, peek = 1, list, full = 0;
     unsigned long pages = 0;
     mfn_t *l4 = NULL, *l3 = NULL, *l2 = NULL;
     unsigned long *l1 = NULL;
@@ -454,6 +499,7 @@ static int paging_log_dirty_op(struct domain *d,
     }
 
     clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
+    list = !!(sc->mode & XEN_DOMCTL_SHADOW_LOGDIRTY_PFN_LIST);
 
     PAGING_DEBUG(LOGDIRTY, "log-dirty %s: dom %u faults=%u dirty=%u\n",
                  (clean) ? "clean" : "peek",
@@ -468,6 +514,12 @@ static int paging_log_dirty_op(struct domain *d,
         /* caller may have wanted just to clean the state or access stats. */
         peek = 0;
 
+    if ( list && !peek )
+    {
+        rv = -EINVAL;
+        goto out;
+    }
+
     if ( unlikely(d->arch.paging.log_dirty.failed_allocs) ) {
         printk(XENLOG_WARNING
                "%u failed page allocs while logging dirty pages of d%d\n",
@@ -481,15 +533,55 @@ static int paging_log_dirty_op(struct domain *d,
     i3 = d->arch.paging.preempt.log_dirty.i3;
     pages = d->arch.paging.preempt.log_dirty.done;
 
-    for ( ; (pages < sc->pages) && (i4 < LOGDIRTY_NODE_ENTRIES); i4++, i3 = 0 )
+    for ( ; !full && (pages < sc->pages) && (i4 < LOGDIRTY_NODE_ENTRIES);
+          i4++, i3 = 0 )
     {
         l3 = (l4 && mfn_valid(l4[i4])) ? map_domain_page(l4[i4]) : NULL;
-        for ( ; (pages < sc->pages) && (i3 < LOGDIRTY_NODE_ENTRIES); i3++ )
+        if ( list && !l3 )
+            continue;
+        for ( ; !full && (pages < sc->pages) && (i3 < LOGDIRTY_NODE_ENTRIES);
+              i3++ )
         {
             l2 = ((l3 && mfn_valid(l3[i3])) ?
                   map_domain_page(l3[i3]) : NULL);
             for ( i2 = 0;
-                  (pages < sc->pages) && (i2 < LOGDIRTY_NODE_ENTRIES);
+                  list && l2 && (pages < sc->pages) &&
+                  (i2 < LOGDIRTY_NODE_ENTRIES);
+                  i2++ )
+            {
+                long nr;
+
+                /* Only the populated parts of the trie need visiting. */
+                if ( !mfn_valid(l2[i2]) )
+                    continue;
+
+                l1 = map_domain_page(l2[i2]);
+                nr = log_dirty_copy_pfns(
+                    sc, pages, l1,
+                    ((((unsigned long)i4 * LOGDIRTY_NODE_ENTRIES) + i3) *
+                     LOGDIRTY_NODE_ENTRIES + i2) << (PAGE_SHIFT + 3));
+                if ( nr == -ENOSPC )
+                {
+                    /* Leave this leaf, and all after it, dirty. */
+                    unmap_domain_page(l1);
+                    l1 = NULL;
+                    full = 1;
+                    break;
+                }
+                if ( nr < 0 )
+                {
+                    rv = nr;
+                    goto out;
+                }
+                pages += nr;
+                if ( clean )
+                    clear_page(l1);
+                unmap_domain_page(l1);
+                l1 = NULL;
+            }
+            for ( i2 = 0;
+                  !list && (pages < sc->pages) &&
+                  (i2 < LOGDIRTY_NODE_ENTRIES);
                   i2++ )
             {
                 unsigned int bytes = PAGE_SIZE;
@@ -517,10 +609,13 @@ static int paging_log_dirty_op(struct domain *d,
                     unmap_domain_page(l1);
                 }
             }
+            l1 = NULL;
             if ( l2 )
                 unmap_domain_page(l2);
+            l2 = NULL;
 
-            if ( i3 < LOGDIRTY_NODE_ENTRIES - 1 && hypercall_preempt_check() )
+            if ( !full && i3 < LOGDIRTY_NODE_ENTRIES - 1 &&
+                 hypercall_preempt_check() )
             {
                 d->arch.paging.preempt.log_dirty.i4 = i4;
                 d->arch.paging.preempt.log_dirty.i3 = i3 + 1;
@@ -530,8 +625,9 @@ static int paging_log_dirty_op(struct domain *d,
         }
         if ( l3 )
             unmap_domain_page(l3);
+        l3 = NULL;
 
-        if ( !rv && i4 < LOGDIRTY_NODE_ENTRIES - 1 &&
+        if ( !rv && !full && i4 < LOGDIRTY_NODE_ENTRIES - 1 &&
              hypercall_preempt_check() )
         {
             d->arch.paging.preempt.log_dirty.i4 = i4 + 1;
@@ -550,7 +646,11 @@ static int paging_log_dirty_op(struct domain *d,
         if ( clean )
         {
             d->arch.paging.log_dirty.fault_count = 0;
-            d->arch.paging.log_dirty.dirty_count = 0;
+            /* A full pfn list leaves some pages dirty. */
+            if ( list && d->arch.paging.log_dirty.dirty_count > pages )
+                d->arch.paging.log_dirty.dirty_count -= pages;
+            else
+                d->arch.paging.log_dirty.dirty_count = 0;
         }
     }
     else
@@ -896,6 +996,22 @@ void paging_dump_domain_info(struct domain *d)
             printk("external ");
         printk("\n");
     }
+
+    if ( hap_enabled(d) )
+    {
+        const struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+        printk("    p2m superpages: 2M %lu recombined %lu split, "
+               "1G %lu recombined %lu split\n",
+               p2m->superpage.promoted[0], p2m->superpage.demoted[0],
+               p2m->superpage.promoted[1], p2m->superpage.demoted[1]);
+        if ( p2m->numa.local || p2m->numa.remote )
+            printk("    p2m NUMA: %"PRIu64" local %"PRIu64" remote samples, "
+                   "%"PRIu64" pages moved %"PRIu64" busy, home node %d\n",
+                   p2m->numa.local, p2m->numa.remote, p2m->numa.migrated,
+                   p2m->numa.busy,
+                   d->numa_home == NUMA_NO_NODE ? -1 : d->numa_home);
+    }
 }
 
 void paging_dump_vcpu_info(struct vcpu *v)
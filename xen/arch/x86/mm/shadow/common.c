@@ -93,6 +93,7 @@ void shadow_vcpu_init(struct vcpu *v)
         for ( j = 0; j < SHADOW_OOS_FIXUPS; j++ )
             v->arch.paging.shadow.oos_fixup[i].smfn[j] = INVALID_MFN;
     }
+    v->arch.paging.shadow.oos_sparse = INVALID_MFN;
 #endif
 
     v->arch.paging.mode = is_pv_vcpu(v) ?
@@ -386,6 +387,8 @@ const struct x86_emulate_ops *shadow_init_emulation(
     sh_ctxt->ctxt.regs = regs;
     sh_ctxt->ctxt.force_writeback = 0;
     sh_ctxt->ctxt.swint_emulate = x86_swint_emulate_none;
+    sh_ctxt->ctxt.insn_buf = sh_ctxt->insn_buf;
+    sh_ctxt->ctxt.insn_buf_bytes = 0;
 
     if ( is_pv_vcpu(v) )
     {
@@ -418,6 +421,7 @@ const struct x86_emulate_ops *shadow_init_emulation(
          !hvm_fetch_from_guest_virt_nofault(
              sh_ctxt->insn_buf, addr, sizeof(sh_ctxt->insn_buf), 0))
         ? sizeof(sh_ctxt->insn_buf) : 0;
+    sh_ctxt->ctxt.insn_buf_bytes = sh_ctxt->insn_buf_bytes;
 
     return &hvm_shadow_emulator_ops;
 }
@@ -447,7 +451,12 @@ void shadow_continue_emulation(struct sh_emulate_ctxt *sh_ctxt,
                      sh_ctxt->insn_buf, addr, sizeof(sh_ctxt->insn_buf), 0))
                 ? sizeof(sh_ctxt->insn_buf) : 0;
             sh_ctxt->insn_buf_eip = regs->eip;
+            diff = 0;
         }
+
+        /* Let x86_emulate() use what is left of the prefetched bytes. */
+        sh_ctxt->ctxt.insn_buf = sh_ctxt->insn_buf + diff;
+        sh_ctxt->ctxt.insn_buf_bytes = sh_ctxt->insn_buf_bytes - diff;
     }
 }
 
@@ -573,8 +582,10 @@ void oos_audit_hash_is_present(struct domain *d, mfn_t gmfn)
 }
 #endif
 
-/* Update the shadow, but keep the page out of sync. */
-static inline void _sh_resync_l1(struct vcpu *v, mfn_t gmfn, mfn_t snpmfn)
+/* Update the shadow, but keep the page out of sync.  Returns the number
+ * of guest entries that had changed since the last resync. */
+static inline unsigned int _sh_resync_l1(struct vcpu *v, mfn_t gmfn,
+                                         mfn_t snpmfn)
 {
     struct page_info *pg = mfn_to_page(gmfn);
 
@@ -583,11 +594,12 @@ static inline void _sh_resync_l1(struct vcpu *v, mfn_t gmfn, mfn_t snpmfn)
 
     /* Call out to the appropriate per-mode resyncing function */
     if ( pg->shadow_flags & SHF_L1_32 )
-        SHADOW_INTERNAL_NAME(sh_resync_l1, 2)(v, gmfn, snpmfn);
+        return SHADOW_INTERNAL_NAME(sh_resync_l1, 2)(v, gmfn, snpmfn);
     else if ( pg->shadow_flags & SHF_L1_PAE )
-        SHADOW_INTERNAL_NAME(sh_resync_l1, 3)(v, gmfn, snpmfn);
+        return SHADOW_INTERNAL_NAME(sh_resync_l1, 3)(v, gmfn, snpmfn);
     else if ( pg->shadow_flags & SHF_L1_64 )
-        SHADOW_INTERNAL_NAME(sh_resync_l1, 4)(v, gmfn, snpmfn);
+        return SHADOW_INTERNAL_NAME(sh_resync_l1, 4)(v, gmfn, snpmfn);
+    return 0;
 }
 
 
@@ -746,8 +758,16 @@ static void _sh_resync(struct vcpu *v, mfn_t gmfn,
     /* No more writable mappings of this page, please */
     pg->shadow_flags &= ~SHF_oos_may_write;
 
-    /* Update the shadows with current guest entries. */
-    _sh_resync_l1(v, gmfn, snp);
+    /* Update the shadows with current guest entries.  If hardly anything
+     * was written while the page was out of sync, the snapshot and resync
+     * cost more than emulating those writes would have: remember the page
+     * so that sh_unsync() prefers emulation for it next time. */
+    if ( _sh_resync_l1(v, gmfn, snp) <= 1 )
+    {
+        v->arch.paging.shadow.oos_sparse = gmfn;
+        v->arch.paging.shadow.oos_sparse_writes = 0;
+        perfc_incr(shadow_resync_sparse);
+    }
 
     /* Now we know all the entries are synced, and will stay that way */
     pg->shadow_flags &= ~SHF_out_of_sync;
@@ -917,6 +937,9 @@ void sh_resync_all(struct vcpu *v, int skip, int this, int others)
     if ( !this )
         goto resync_others;
 
+    /* A new resync interval for the sparse-write heuristic. */
+    v->arch.paging.shadow.oos_sparse_writes = 0;
+
     /* First: resync all of this vcpu's oos pages */
     for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
         if ( mfn_valid(oos[idx]) )
@@ -985,6 +1008,19 @@ int sh_unsync(struct vcpu *v, mfn_t gmfn)
          || !v->domain->arch.paging.shadow.oos_active )
         return 0;
 
+    /* Keep emulating writes to a sparsely written page, unless it gets
+     * written often enough between resyncs to be worth unsyncing again. */
+    if ( mfn_eq(gmfn, v->arch.paging.shadow.oos_sparse) )
+    {
+        if ( v->arch.paging.shadow.oos_sparse_writes++ <
+             SHADOW_OOS_SPARSE_WRITES )
+        {
+            perfc_incr(shadow_unsync_emulate);
+            return 0;
+        }
+        v->arch.paging.shadow.oos_sparse = INVALID_MFN;
+    }
+
     pg->shadow_flags |= SHF_out_of_sync|SHF_oos_may_write;
     oos_hash_add(v, gmfn);
     perfc_incr(shadow_unsync);
@@ -102,7 +102,7 @@ extern const struct paging_mode
 SHADOW_INTERNAL_NAME(sh_paging_mode, GUEST_LEVELS);
 
 #if SHADOW_OPTIMIZATIONS & SHOPT_OUT_OF_SYNC
-extern void
+extern unsigned int
 SHADOW_INTERNAL_NAME(sh_resync_l1, GUEST_LEVELS)
      (struct vcpu *v, mfn_t gmfn, mfn_t snpmfn);
 
@@ -704,16 +704,26 @@ ret_t do_platform_op(XEN_GUEST_HANDLE_PARAM(xen_platform_op_t) u_xenpf_op)
     {
         uint32_t idle_nums;
 
-        switch(op->u.core_parking.type)
+        switch(op->u.core_parking.type & ~XEN_CORE_PARKING_SOFT)
         {
         case XEN_CORE_PARKING_SET:
+        {
+            unsigned long data;
+
             idle_nums = min_t(uint32_t,
                     op->u.core_parking.idle_nums, num_present_cpus() - 1);
+            data = idle_nums;
+            if ( op->u.core_parking.type & XEN_CORE_PARKING_SOFT )
+                data |= CORE_PARKING_SOFT;
             ret = continue_hypercall_on_cpu(
-                    0, core_parking_helper, (void *)(unsigned long)idle_nums);
+                    0, core_parking_helper, (void *)data);
             break;
+        }
 
         case XEN_CORE_PARKING_GET:
+            ret = -EINVAL;
+            if ( op->u.core_parking.type & XEN_CORE_PARKING_SOFT )
+                break;
             op->u.core_parking.idle_nums = get_cur_idle_nums();
             ret = __copy_field_to_guest(u_xenpf_op, op, u.core_parking) ?
                   -EFAULT : 0;
@@ -17,11 +17,19 @@
 #include <xen/cpu.h>
 #include <xen/err.h>
 #include <xen/sched.h>
+#include <xen/tasklet.h>
+#include <xen/timer.h>
 #include <asm/psr.h>
 
 #define PSR_CMT        (1<<0)
 #define PSR_CAT        (1<<1)
 #define PSR_CDP        (1<<2)
+#define PSR_MBA        (1<<3)
+
+/* Dead band around the target L3 share of latency domains, in percent */
+#define PSR_CTRL_HYSTERESIS     5
+/* MBM counters are only guaranteed to be 24 bits wide */
+#define PSR_MBM_CTR_MASK        ((1ull << 24) - 1)
 
 struct psr_cat_cbm {
     union {
@@ -31,14 +39,26 @@ struct psr_cat_cbm {
             uint64_t data;
         };
     };
+    unsigned int thrtl;
     unsigned int ref;
 };
 
+/* Cache controller state of a socket */
+struct psr_ctrl_socket {
+    struct tasklet tasklet;
+    unsigned long l3_size;      /* in bytes, 0 if unknown */
+    unsigned int be_ways;       /* low order ways given to best effort */
+    unsigned int be_thrtl;      /* MBA throttling of best effort domains */
+};
+
 struct psr_cat_socket_info {
     unsigned int cbm_len;
     unsigned int cos_max;
+    unsigned int thrtl_max;     /* 0 if MBA is not enabled */
+    unsigned int thrtl_step;
     struct psr_cat_cbm *cos_to_cbm;
     spinlock_t cbm_lock;
+    struct psr_ctrl_socket ctrl;
 };
 
 struct psr_assoc {
@@ -55,11 +75,41 @@ static unsigned long *__read_mostly cdp_socket_enable;
 static unsigned int opt_psr;
 static unsigned int __initdata opt_rmid_max = 255;
 static unsigned int __read_mostly opt_cos_max = 255;
+static unsigned int __read_mostly opt_ctrl_ms = 100;
 static uint64_t rmid_mask;
 static DEFINE_PER_CPU(struct psr_assoc, psr_assoc);
 
 static struct psr_cat_cbm *temp_cos_to_cbm;
 
+/*
+ * The cache controller runs every opt_ctrl_ms while there are classed
+ * domains, with a tasklet per socket doing the measurements locally.
+ * ctrl_lock serialises it against class changes.
+ */
+static struct timer ctrl_timer;
+static unsigned int ctrl_nr_domains;
+static DEFINE_SPINLOCK(ctrl_lock);
+/* Last MBM total count of each RMID on each socket */
+static uint64_t *__read_mostly mbm_last;
+
+/*
+ * Memory traffic accounting runs every opt_mbm_ms while there are
+ * monitored domains: a tasklet per socket adds the total and local MBM
+ * deltas of each RMID to its domain, and the timer turns the sums into
+ * bandwidths.  Traffic to remote nodes is the difference of the two.
+ * mbm_sample_last keeps its own total/local counts so as not to disturb
+ * the cache controller's.
+ */
+static unsigned int __read_mostly opt_mbm_ms = 1000;
+static struct timer mbm_timer;
+static struct tasklet *__read_mostly mbm_tasklets;
+static uint64_t *__read_mostly mbm_sample_last;
+static unsigned int mbm_nr_domains;
+static DEFINE_SPINLOCK(mbm_lock);
+
+/* MBM counters are narrower than this, so it never matches a real count. */
+#define PSR_MBM_LAST_INVALID (~0ull)
+
 static unsigned int get_socket_cpu(unsigned int socket)
 {
     if ( likely(socket < nr_sockets) )
@@ -68,6 +118,12 @@ static unsigned int get_socket_cpu(unsigned int socket)
     return nr_cpu_ids;
 }
 
+/* Last MBM total and local counts of @rmid on @socket */
+static uint64_t *psr_mbm_sample_last(unsigned int socket, unsigned int rmid)
+{
+    return &mbm_sample_last[(socket * (psr_cmt->rmid_max + 1UL) + rmid) * 2];
+}
+
 static void __init parse_psr_bool(char *s, char *value, char *feature,
                                   unsigned int mask)
 {
@@ -103,6 +159,7 @@ static void __init parse_psr_param(char *s)
         parse_psr_bool(s, val_str, "cmt", PSR_CMT);
         parse_psr_bool(s, val_str, "cat", PSR_CAT);
         parse_psr_bool(s, val_str, "cdp", PSR_CDP);
+        parse_psr_bool(s, val_str, "mba", PSR_MBA);
 
         if ( val_str && !strcmp(s, "rmid_max") )
             opt_rmid_max = simple_strtoul(val_str, NULL, 0);
@@ -110,6 +167,12 @@ static void __init parse_psr_param(char *s)
         if ( val_str && !strcmp(s, "cos_max") )
             opt_cos_max = simple_strtoul(val_str, NULL, 0);
 
+        if ( val_str && !strcmp(s, "ctrl_ms") )
+            opt_ctrl_ms = simple_strtoul(val_str, NULL, 0);
+
+        if ( val_str && !strcmp(s, "mbm_ms") )
+            opt_mbm_ms = simple_strtoul(val_str, NULL, 0);
+
         s = ss + 1;
     } while ( ss );
 }
@@ -192,6 +255,24 @@ int psr_alloc_rmid(struct domain *d)
 
     d->arch.psr_rmid = rmid;
 
+    if ( mbm_sample_last )
+    {
+        unsigned int socket;
+
+        spin_lock(&mbm_lock);
+        /* The RMID's counters still hold the previous owner's traffic. */
+        for ( socket = 0; socket < nr_sockets; socket++ )
+        {
+            uint64_t *last = psr_mbm_sample_last(socket, rmid);
+
+            last[0] = last[1] = PSR_MBM_LAST_INVALID;
+        }
+        memset(&d->arch.psr_mbm, 0, sizeof(d->arch.psr_mbm));
+        if ( !mbm_nr_domains++ && opt_mbm_ms )
+            set_timer(&mbm_timer, NOW() + MILLISECS(opt_mbm_ms));
+        spin_unlock(&mbm_lock);
+    }
+
     return 0;
 }
 
@@ -207,6 +288,13 @@ void psr_free_rmid(struct domain *d)
 
     psr_cmt->rmid_to_dom[rmid] = DOMID_INVALID;
     d->arch.psr_rmid = 0;
+
+    if ( mbm_sample_last )
+    {
+        spin_lock(&mbm_lock);
+        mbm_nr_domains--;
+        spin_unlock(&mbm_lock);
+    }
 }
 
 static inline void psr_assoc_init(void)
@@ -293,6 +381,25 @@ int psr_get_cat_l3_info(unsigned int socket, uint32_t *cbm_len,
     return 0;
 }
 
+int psr_get_mba_info(unsigned int socket, uint32_t *thrtl_max,
+                     uint32_t *cos_max, uint32_t *flags)
+{
+    struct psr_cat_socket_info *info = get_cat_socket_info(socket);
+
+    if ( IS_ERR(info) )
+        return PTR_ERR(info);
+
+    if ( !info->thrtl_max )
+        return -EOPNOTSUPP;
+
+    *thrtl_max = info->thrtl_max;
+    *cos_max = info->cos_max;
+    /* Only linear MBA is enabled. */
+    *flags = XEN_SYSCTL_PSR_MBA_LINEAR;
+
+    return 0;
+}
+
 int psr_get_l3_cbm(struct domain *d, unsigned int socket,
                    uint64_t *cbm, enum cbm_type type)
 {
@@ -331,6 +438,22 @@ int psr_get_l3_cbm(struct domain *d, unsigned int socket,
     return 0;
 }
 
+int psr_get_mba_thrtl(struct domain *d, unsigned int socket,
+                      uint64_t *thrtl)
+{
+    struct psr_cat_socket_info *info = get_cat_socket_info(socket);
+
+    if ( IS_ERR(info) )
+        return PTR_ERR(info);
+
+    if ( !info->thrtl_max )
+        return -EOPNOTSUPP;
+
+    *thrtl = info->cos_to_cbm[d->arch.psr_cos_ids[socket]].thrtl;
+
+    return 0;
+}
+
 static bool_t psr_check_cbm(unsigned int cbm_len, uint64_t cbm)
 {
     unsigned int first_bit, zero_bit;
@@ -358,8 +481,10 @@ struct cos_cbm_info
 {
     unsigned int cos;
     bool_t cdp;
+    bool_t mba;
     uint64_t cbm_code;
     uint64_t cbm_data;
+    unsigned int thrtl;
 };
 
 static void do_write_l3_cbm(void *data)
@@ -373,10 +498,14 @@ static void do_write_l3_cbm(void *data)
     }
     else
         wrmsrl(MSR_IA32_PSR_L3_MASK(info->cos), info->cbm_code);
+
+    if ( info->mba )
+        wrmsrl(MSR_IA32_PSR_MBA_MASK(info->cos), info->thrtl);
 }
 
 static int write_l3_cbm(unsigned int socket, unsigned int cos,
-                        uint64_t cbm_code, uint64_t cbm_data, bool_t cdp)
+                        uint64_t cbm_code, uint64_t cbm_data, bool_t cdp,
+                        unsigned int thrtl, bool_t mba)
 {
     struct cos_cbm_info info =
     {
@@ -384,6 +513,8 @@ static int write_l3_cbm(unsigned int socket, unsigned int cos,
         .cbm_code = cbm_code,
         .cbm_data = cbm_data,
         .cdp = cdp,
+        .thrtl = thrtl,
+        .mba = mba,
     };
 
     if ( socket == cpu_to_socket(smp_processor_id()) )
@@ -401,13 +532,14 @@ static int write_l3_cbm(unsigned int socket, unsigned int cos,
 }
 
 static int find_cos(struct psr_cat_cbm *map, unsigned int cos_max,
-                    uint64_t cbm_code, uint64_t cbm_data, bool_t cdp_enabled)
+                    uint64_t cbm_code, uint64_t cbm_data, bool_t cdp_enabled,
+                    unsigned int thrtl)
 {
     unsigned int cos;
 
     for ( cos = 0; cos <= cos_max; cos++ )
     {
-        if ( (map[cos].ref || cos == 0) &&
+        if ( (map[cos].ref || cos == 0) && map[cos].thrtl == thrtl &&
              ((!cdp_enabled && map[cos].cbm == cbm_code) ||
               (cdp_enabled && map[cos].code == cbm_code &&
                               map[cos].data == cbm_data)) )
@@ -434,11 +566,69 @@ static int pick_avail_cos(struct psr_cat_cbm *map, unsigned int cos_max,
     return -ENOENT;
 }
 
+/* Switch the domain to a COS with the given CBMs and MBA throttling. */
+static int psr_set_cos(struct domain *d, unsigned int socket,
+                       struct psr_cat_socket_info *info,
+                       uint64_t cbm_code, uint64_t cbm_data,
+                       unsigned int thrtl)
+{
+    unsigned int old_cos = d->arch.psr_cos_ids[socket];
+    unsigned int cos_max = info->cos_max;
+    int cos, ret;
+    bool_t cdp_enabled = cdp_is_enabled(socket);
+    struct psr_cat_cbm *map = info->cos_to_cbm;
+
+    spin_lock(&info->cbm_lock);
+    cos = find_cos(map, cos_max, cbm_code, cbm_data, cdp_enabled, thrtl);
+    if ( cos >= 0 )
+    {
+        if ( cos == old_cos )
+        {
+            spin_unlock(&info->cbm_lock);
+            return 0;
+        }
+    }
+    else
+    {
+        cos = pick_avail_cos(map, cos_max, old_cos);
+        if ( cos < 0 )
+        {
+            spin_unlock(&info->cbm_lock);
+            return cos;
+        }
+
+        /* We try to avoid writing MSR. */
+        if ( (cdp_enabled &&
+             (map[cos].code != cbm_code || map[cos].data != cbm_data)) ||
+             (!cdp_enabled && map[cos].cbm != cbm_code) ||
+             map[cos].thrtl != thrtl )
+        {
+            ret = write_l3_cbm(socket, cos, cbm_code, cbm_data, cdp_enabled,
+                               thrtl, !!info->thrtl_max);
+            if ( ret )
+            {
+                spin_unlock(&info->cbm_lock);
+                return ret;
+            }
+            map[cos].code = cbm_code;
+            map[cos].data = cbm_data;
+            map[cos].thrtl = thrtl;
+        }
+    }
+
+    map[cos].ref++;
+    map[old_cos].ref--;
+    spin_unlock(&info->cbm_lock);
+
+    d->arch.psr_cos_ids[socket] = cos;
+
+    return 0;
+}
+
 int psr_set_l3_cbm(struct domain *d, unsigned int socket,
                    uint64_t cbm, enum cbm_type type)
 {
-    unsigned int old_cos, cos_max;
-    int cos, ret;
+    unsigned int old_cos;
     uint64_t cbm_data, cbm_code;
     bool_t cdp_enabled = cdp_is_enabled(socket);
     struct psr_cat_cbm *map;
@@ -454,7 +644,10 @@ int psr_set_l3_cbm(struct domain *d, unsigned int socket,
                           type == PSR_CBM_TYPE_L3_DATA) )
         return -ENXIO;
 
-    cos_max = info->cos_max;
+    /* The CBMs of classed domains belong to the cache controller. */
+    if ( d->arch.psr_class != XEN_DOMCTL_PSR_CLASS_NONE )
+        return -EBUSY;
+
     old_cos = d->arch.psr_cos_ids[socket];
     map = info->cos_to_cbm;
 
@@ -480,48 +673,374 @@ int psr_set_l3_cbm(struct domain *d, unsigned int socket,
         return -EINVAL;
     }
 
-    spin_lock(&info->cbm_lock);
-    cos = find_cos(map, cos_max, cbm_code, cbm_data, cdp_enabled);
-    if ( cos >= 0 )
+    return psr_set_cos(d, socket, info, cbm_code, cbm_data,
+                       map[old_cos].thrtl);
+}
+
+int psr_set_mba_thrtl(struct domain *d, unsigned int socket,
+                      uint64_t thrtl)
+{
+    unsigned int old_cos;
+    struct psr_cat_cbm *map;
+    struct psr_cat_socket_info *info = get_cat_socket_info(socket);
+
+    if ( IS_ERR(info) )
+        return PTR_ERR(info);
+
+    if ( !info->thrtl_max )
+        return -EOPNOTSUPP;
+
+    if ( thrtl > info->thrtl_max || thrtl % info->thrtl_step )
+        return -EINVAL;
+
+    if ( d->arch.psr_class != XEN_DOMCTL_PSR_CLASS_NONE )
+        return -EBUSY;
+
+    old_cos = d->arch.psr_cos_ids[socket];
+    map = info->cos_to_cbm;
+
+    return psr_set_cos(d, socket, info, map[old_cos].code, map[old_cos].data,
+                       thrtl);
+}
+
+/* Read a monitoring counter of the current socket. */
+static bool_t psr_read_counter(unsigned int rmid, unsigned int evtid,
+                               uint64_t *val)
+{
+    unsigned long flags;
+
+    /* Keep the EVTSEL/CTR pair atomic against resource_op IPIs. */
+    local_irq_save(flags);
+    wrmsrl(MSR_IA32_CMT_EVTSEL, ((uint64_t)rmid << 32) | evtid);
+    rdmsrl(MSR_IA32_CMT_CTR, *val);
+    local_irq_restore(flags);
+
+    /* Bit 63 means Error, bit 62 Unavailable. */
+    return !(*val & (3ull << 62));
+}
+
+/*
+ * Bytes of memory traffic counted by @evtid for @rmid on the current socket
+ * since *@last was recorded.
+ */
+static uint64_t psr_read_mbm_delta(unsigned int rmid, unsigned int evtid,
+                                   uint64_t *last)
+{
+    uint64_t val, delta;
+
+    if ( !psr_read_counter(rmid, evtid, &val) )
+        return 0;
+
+    val &= PSR_MBM_CTR_MASK;
+    delta = *last == PSR_MBM_LAST_INVALID ? 0
+                                          : (val - *last) & PSR_MBM_CTR_MASK;
+    *last = val;
+
+    return delta * psr_cmt->l3.upscaling_factor;
+}
+
+/* Bytes of memory traffic of @rmid on the current socket since last call. */
+static uint64_t psr_read_mbm(unsigned int socket, unsigned int rmid)
+{
+    if ( !mbm_last )
+        return 0;
+
+    return psr_read_mbm_delta(rmid, PSR_CMT_EVTID_MBM_TOTAL,
+                              &mbm_last[socket * (psr_cmt->rmid_max + 1UL) +
+                                        rmid]);
+}
+
+/*
+ * One step of the cache controller on @socket, run on a CPU of the socket.
+ * Latency domains get the high order ways, best effort domains share the
+ * remaining low order ones.  While any latency domain's L3 occupancy is
+ * below its target share, best effort domains lose a way per step, and
+ * get their memory bandwidth throttled further if they produce more
+ * traffic than the latency domains.  Once all latency domains are above
+ * their targets, throttling is released first, then ways are given back.
+ */
+static void psr_ctrl_tasklet_fn(unsigned long socket)
+{
+    struct psr_cat_socket_info *info = get_cat_socket_info(socket);
+    struct psr_ctrl_socket *ctrl;
+    struct domain *d;
+    uint64_t full, be_cbm, lat_cbm, val, be_bw = 0, lat_bw = 0;
+    unsigned int be_thrtl;
+    bool_t latency = 0, deficit = 0, surplus = 1;
+
+    /* The socket may have gone, or the tasklet migrated off it. */
+    if ( IS_ERR(info) || info->cbm_len < 2 ||
+         socket != cpu_to_socket(smp_processor_id()) )
+        return;
+
+    ctrl = &info->ctrl;
+
+    spin_lock(&ctrl_lock);
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
     {
-        if ( cos == old_cos )
+        unsigned int rmid = d->arch.psr_rmid;
+        unsigned int share;
+
+        if ( d->arch.psr_class == XEN_DOMCTL_PSR_CLASS_NONE || !rmid ||
+             d->is_dying )
+            continue;
+
+        if ( d->arch.psr_class == XEN_DOMCTL_PSR_CLASS_BEST_EFFORT )
         {
-            spin_unlock(&info->cbm_lock);
-            return 0;
+            be_bw += psr_read_mbm(socket, rmid);
+            continue;
         }
+
+        lat_bw += psr_read_mbm(socket, rmid);
+        latency = 1;
+
+        if ( !ctrl->l3_size ||
+             !psr_read_counter(rmid, PSR_CMT_EVTID_OCCUPANCY, &val) )
+            continue;
+
+        share = val * psr_cmt->l3.upscaling_factor * 100 / ctrl->l3_size;
+        if ( share + PSR_CTRL_HYSTERESIS < d->arch.psr_share )
+            deficit = 1;
+        if ( share < d->arch.psr_share + PSR_CTRL_HYSTERESIS )
+            surplus = 0;
+    }
+
+    if ( deficit )
+    {
+        if ( ctrl->be_ways > 1 )
+            ctrl->be_ways--;
+        if ( info->thrtl_max && be_bw > lat_bw )
+            ctrl->be_thrtl = min(ctrl->be_thrtl + info->thrtl_step,
+                                 info->thrtl_max);
+    }
+    else if ( surplus )
+    {
+        if ( ctrl->be_thrtl )
+            ctrl->be_thrtl -= info->thrtl_step;
+        else if ( ctrl->be_ways < info->cbm_len - 1 )
+            ctrl->be_ways++;
+    }
+
+    full = (1ull << info->cbm_len) - 1;
+    if ( latency )
+    {
+        be_cbm = (1ull << ctrl->be_ways) - 1;
+        lat_cbm = full & ~be_cbm;
+        be_thrtl = ctrl->be_thrtl;
     }
     else
     {
-        cos = pick_avail_cos(map, cos_max, old_cos);
-        if ( cos < 0 )
-        {
-            spin_unlock(&info->cbm_lock);
-            return cos;
-        }
+        /* Nothing to protect: let best effort domains use all of the L3. */
+        be_cbm = lat_cbm = full;
+        be_thrtl = 0;
+    }
 
-        /* We try to avoid writing MSR. */
-        if ( (cdp_enabled &&
-             (map[cos].code != cbm_code || map[cos].data != cbm_data)) ||
-             (!cdp_enabled && map[cos].cbm != cbm_code) )
+    /*
+     * Errors (running out of COS) are ignored: the domain simply keeps its
+     * previous COS until the next step.
+     */
+    for_each_domain ( d )
+    {
+        if ( d->arch.psr_class == XEN_DOMCTL_PSR_CLASS_NONE || d->is_dying )
+            continue;
+
+        if ( d->arch.psr_class == XEN_DOMCTL_PSR_CLASS_BEST_EFFORT )
+            psr_set_cos(d, socket, info, be_cbm, be_cbm, be_thrtl);
+        else
+            psr_set_cos(d, socket, info, lat_cbm, lat_cbm, 0);
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+    spin_unlock(&ctrl_lock);
+}
+
+static void psr_ctrl_timer_fn(void *unused)
+{
+    unsigned int socket;
+
+    if ( !read_atomic(&ctrl_nr_domains) )
+        return;
+
+    for_each_set_bit(socket, cat_socket_enable, nr_sockets)
+    {
+        unsigned int cpu = get_socket_cpu(socket);
+
+        if ( cpu < nr_cpu_ids )
+            tasklet_schedule_on_cpu(&cat_socket_info[socket].ctrl.tasklet,
+                                    cpu);
+    }
+
+    set_timer(&ctrl_timer, NOW() + MILLISECS(opt_ctrl_ms));
+}
+
+/* Add the traffic since the previous sample to each monitored domain. */
+static void psr_mbm_tasklet_fn(unsigned long socket)
+{
+    struct domain *d;
+    unsigned int features = psr_cmt->l3.features;
+
+    if ( socket != cpu_to_socket(smp_processor_id()) )
+        return;
+
+    spin_lock(&mbm_lock);
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        unsigned int rmid = d->arch.psr_rmid;
+        uint64_t *last;
+
+        if ( !rmid )
+            continue;
+
+        last = psr_mbm_sample_last(socket, rmid);
+        if ( features & PSR_CMT_L3_MBM_TOTAL )
+            d->arch.psr_mbm.total +=
+                psr_read_mbm_delta(rmid, PSR_CMT_EVTID_MBM_TOTAL, &last[0]);
+        if ( features & PSR_CMT_L3_MBM_LOCAL )
+            d->arch.psr_mbm.local +=
+                psr_read_mbm_delta(rmid, PSR_CMT_EVTID_MBM_LOCAL, &last[1]);
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+    spin_unlock(&mbm_lock);
+}
+
+static void psr_mbm_timer_fn(void *unused)
+{
+    struct domain *d;
+    unsigned int socket;
+
+    spin_lock(&mbm_lock);
+
+    if ( !mbm_nr_domains )
+    {
+        spin_unlock(&mbm_lock);
+        return;
+    }
+
+    /* The tasklets of the previous period have run by now. */
+    rcu_read_lock(&domlist_read_lock);
+    for_each_domain ( d )
+    {
+        struct psr_mbm_stats *mbm = &d->arch.psr_mbm;
+
+        if ( !d->arch.psr_rmid )
+            continue;
+
+        mbm->bw_total = (mbm->total - mbm->prev_total) * 1000 / opt_mbm_ms;
+        mbm->bw_local = (mbm->local - mbm->prev_local) * 1000 / opt_mbm_ms;
+        mbm->prev_total = mbm->total;
+        mbm->prev_local = mbm->local;
+    }
+    rcu_read_unlock(&domlist_read_lock);
+
+    spin_unlock(&mbm_lock);
+
+    for ( socket = 0; socket < nr_sockets; socket++ )
+    {
+        unsigned int cpu = get_socket_cpu(socket);
+
+        if ( cpu < nr_cpu_ids )
+            tasklet_schedule_on_cpu(&mbm_tasklets[socket], cpu);
+    }
+
+    set_timer(&mbm_timer, NOW() + MILLISECS(opt_mbm_ms));
+}
+
+int psr_get_mbm(struct domain *d, struct psr_mbm_stats *stats)
+{
+    if ( !mbm_sample_last || !opt_mbm_ms )
+        return -EOPNOTSUPP;
+
+    if ( !d->arch.psr_rmid )
+        return -ENOENT;
+
+    spin_lock(&mbm_lock);
+    *stats = d->arch.psr_mbm;
+    spin_unlock(&mbm_lock);
+
+    return 0;
+}
+
+int psr_get_class(struct domain *d, uint64_t *data)
+{
+    *data = d->arch.psr_class |
+            ((uint64_t)d->arch.psr_share << XEN_DOMCTL_PSR_CLASS_SHARE_SHIFT);
+
+    return 0;
+}
+
+int psr_set_class(struct domain *d, uint64_t data)
+{
+    unsigned int class = data & XEN_DOMCTL_PSR_CLASS_MASK;
+    unsigned int share = (data >> XEN_DOMCTL_PSR_CLASS_SHARE_SHIFT) &
+                         XEN_DOMCTL_PSR_CLASS_SHARE_MASK;
+    unsigned int socket;
+    int ret = 0;
+
+    if ( !cat_socket_info || !psr_cmt_enabled() ||
+         !(psr_cmt->l3.features & PSR_CMT_L3_OCCUPANCY) || !opt_ctrl_ms )
+        return -EOPNOTSUPP;
+
+    switch ( class )
+    {
+    case XEN_DOMCTL_PSR_CLASS_NONE:
+    case XEN_DOMCTL_PSR_CLASS_BEST_EFFORT:
+        if ( share )
+            return -EINVAL;
+        break;
+
+    case XEN_DOMCTL_PSR_CLASS_LATENCY:
+        if ( !share || share > 100 )
+            return -EINVAL;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    /* The controller monitors classed domains through their RMID. */
+    if ( class != XEN_DOMCTL_PSR_CLASS_NONE && !d->arch.psr_rmid )
+    {
+        ret = psr_alloc_rmid(d);
+        if ( ret )
+            return ret;
+    }
+
+    spin_lock(&ctrl_lock);
+
+    if ( class != XEN_DOMCTL_PSR_CLASS_NONE &&
+         d->arch.psr_class == XEN_DOMCTL_PSR_CLASS_NONE )
+    {
+        if ( !ctrl_nr_domains++ )
+            set_timer(&ctrl_timer, NOW() + MILLISECS(opt_ctrl_ms));
+    }
+    else if ( class == XEN_DOMCTL_PSR_CLASS_NONE &&
+              d->arch.psr_class != XEN_DOMCTL_PSR_CLASS_NONE )
+    {
+        ctrl_nr_domains--;
+
+        /* Back to the default COS on all sockets. */
+        for_each_set_bit(socket, cat_socket_enable, nr_sockets)
         {
-            ret = write_l3_cbm(socket, cos, cbm_code, cbm_data, cdp_enabled);
-            if ( ret )
-            {
-                spin_unlock(&info->cbm_lock);
-                return ret;
-            }
-            map[cos].code = cbm_code;
-            map[cos].data = cbm_data;
+            struct psr_cat_socket_info *info = cat_socket_info + socket;
+            uint64_t full = (1ull << info->cbm_len) - 1;
+            int rc = psr_set_cos(d, socket, info, full, full, 0);
+
+            if ( rc && !ret )
+                ret = rc;
         }
     }
 
-    map[cos].ref++;
-    map[old_cos].ref--;
-    spin_unlock(&info->cbm_lock);
+    d->arch.psr_class = class;
+    d->arch.psr_share = share;
 
-    d->arch.psr_cos_ids[socket] = cos;
+    spin_unlock(&ctrl_lock);
 
-    return 0;
+    return ret;
 }
 
 /* Called with domain lock held, no extra lock needed for 'psr_cos_ids' */
@@ -563,6 +1082,14 @@ int psr_domain_init(struct domain *d)
 
 void psr_domain_free(struct domain *d)
 {
+    if ( d->arch.psr_class != XEN_DOMCTL_PSR_CLASS_NONE )
+    {
+        spin_lock(&ctrl_lock);
+        ctrl_nr_domains--;
+        d->arch.psr_class = XEN_DOMCTL_PSR_CLASS_NONE;
+        spin_unlock(&ctrl_lock);
+    }
+
     psr_free_rmid(d);
     psr_free_cos(d);
 }
@@ -587,6 +1114,8 @@ static void cat_cpu_init(void)
     unsigned int socket;
     unsigned int cpu = smp_processor_id();
     uint64_t val;
+    unsigned int res;
+    struct cpuid4_info l3;
     const struct cpuinfo_x86 *c = cpu_data + cpu;
 
     if ( !cpu_has(c, X86_FEATURE_PQE) || c->cpuid_level < PSR_CPUID_LEVEL_CAT )
@@ -597,7 +1126,8 @@ static void cat_cpu_init(void)
         return;
 
     cpuid_count(PSR_CPUID_LEVEL_CAT, 0, &eax, &ebx, &ecx, &edx);
-    if ( ebx & PSR_RESOURCE_TYPE_L3 )
+    res = ebx;
+    if ( res & PSR_RESOURCE_TYPE_L3 )
     {
         cpuid_count(PSR_CPUID_LEVEL_CAT, 1, &eax, &ebx, &ecx, &edx);
         info = cat_socket_info + socket;
@@ -630,9 +1160,31 @@ static void cat_cpu_init(void)
 
             set_bit(socket, cdp_socket_enable);
         }
-        printk(XENLOG_INFO "CAT: enabled on socket %u, cos_max:%u, cbm_len:%u, CDP:%s\n",
+
+        /*
+         * MBA shares the COS with CAT.  Only linear delay values, which
+         * the cache controller can step through, are supported.
+         */
+        info->thrtl_max = 0;
+        if ( (res & PSR_RESOURCE_TYPE_MBA) && (opt_psr & PSR_MBA) )
+        {
+            cpuid_count(PSR_CPUID_LEVEL_CAT, 3, &eax, &ebx, &ecx, &edx);
+            if ( (ecx & PSR_MBA_LINEAR_CAPABILITY) && (eax & 0xfff) < 99 )
+            {
+                info->thrtl_max = (eax & 0xfff) + 1;
+                info->thrtl_step = 100 - info->thrtl_max;
+                info->cos_max = min(info->cos_max, edx & 0xffff);
+            }
+        }
+
+        info->ctrl.l3_size = cpuid4_cache_lookup(3, &l3) ? 0 : l3.size;
+        info->ctrl.be_ways = info->cbm_len / 2;
+        info->ctrl.be_thrtl = 0;
+
+        printk(XENLOG_INFO "CAT: enabled on socket %u, cos_max:%u, cbm_len:%u, CDP:%s, MBA:%s\n",
                socket, info->cos_max, info->cbm_len,
-               cdp_is_enabled(socket) ? "on" : "off");
+               cdp_is_enabled(socket) ? "on" : "off",
+               info->thrtl_max ? "on" : "off");
     }
 }
 
@@ -657,8 +1209,38 @@ static void cat_cpu_fini(unsigned int cpu)
     }
 }
 
+static void __init init_psr_mbm(void)
+{
+    unsigned long i, nr;
+    unsigned int socket;
+
+    if ( !psr_cmt_enabled() ||
+         !(psr_cmt->l3.features & (PSR_CMT_L3_MBM_TOTAL | PSR_CMT_L3_MBM_LOCAL)) )
+        return;
+
+    nr = nr_sockets * (psr_cmt->rmid_max + 1UL) * 2;
+    mbm_tasklets = xmalloc_array(struct tasklet, nr_sockets);
+    mbm_sample_last = xmalloc_array(uint64_t, nr);
+    if ( !mbm_tasklets || !mbm_sample_last )
+    {
+        xfree(mbm_tasklets);
+        mbm_tasklets = NULL;
+        xfree(mbm_sample_last);
+        mbm_sample_last = NULL;
+        return;
+    }
+
+    for ( i = 0; i < nr; i++ )
+        mbm_sample_last[i] = PSR_MBM_LAST_INVALID;
+    for ( socket = 0; socket < nr_sockets; socket++ )
+        tasklet_init(&mbm_tasklets[socket], psr_mbm_tasklet_fn, socket);
+    init_timer(&mbm_timer, psr_mbm_timer_fn, NULL, 0);
+}
+
 static void __init psr_cat_free(void)
 {
+    xfree(mbm_last);
+    mbm_last = NULL;
     xfree(cat_socket_enable);
     cat_socket_enable = NULL;
     xfree(cat_socket_info);
@@ -667,6 +1249,8 @@ static void __init psr_cat_free(void)
 
 static void __init init_psr_cat(void)
 {
+    unsigned int socket;
+
     if ( opt_cos_max < 1 )
     {
         printk(XENLOG_INFO "CAT: disabled, cos_max is too small\n");
@@ -678,7 +1262,20 @@ static void __init init_psr_cat(void)
     cdp_socket_enable = xzalloc_array(unsigned long, BITS_TO_LONGS(nr_sockets));
 
     if ( !cat_socket_enable || !cat_socket_info )
+    {
         psr_cat_free();
+        return;
+    }
+
+    for ( socket = 0; socket < nr_sockets; socket++ )
+        tasklet_init(&cat_socket_info[socket].ctrl.tasklet,
+                     psr_ctrl_tasklet_fn, socket);
+    init_timer(&ctrl_timer, psr_ctrl_timer_fn, NULL, 0);
+
+    /* Without MBM the controller only looks at occupancy. */
+    if ( psr_cmt_enabled() && (psr_cmt->l3.features & PSR_CMT_L3_MBM_TOTAL) )
+        mbm_last = xzalloc_array(uint64_t,
+                                 nr_sockets * (psr_cmt->rmid_max + 1UL));
 }
 
 static int psr_cpu_prepare(unsigned int cpu)
@@ -736,7 +1333,10 @@ static struct notifier_block cpu_nfb = {
 static int __init psr_presmp_init(void)
 {
     if ( (opt_psr & PSR_CMT) && opt_rmid_max )
+    {
         init_psr_cmt(opt_rmid_max);
+        init_psr_mbm();
+    }
 
     if ( opt_psr & PSR_CAT )
         init_psr_cat();
@@ -593,6 +593,42 @@ static char * __init cmdline_cook(char *p, const char *loader_name)
     return p;
 }
 
+/*
+ * Boot profile: the TSC is sampled at the end of each major boot phase,
+ * and the time spent in each phase gets logged just before dom0 starts.
+ */
+struct boot_phase {
+    const char *name;
+    uint64_t tsc;
+};
+static struct boot_phase __initdata boot_phases[12];
+static unsigned int __initdata nr_boot_phases;
+
+static void __init boot_phase_done(const char *name)
+{
+    if ( nr_boot_phases < ARRAY_SIZE(boot_phases) )
+    {
+        boot_phases[nr_boot_phases].name = name;
+        boot_phases[nr_boot_phases++].tsc = rdtsc();
+    }
+}
+
+static void __init boot_profile_print(void)
+{
+    unsigned int i;
+
+    if ( !cpu_khz || !nr_boot_phases )
+        return;
+
+    printk(XENLOG_INFO "Boot profile:\n");
+    for ( i = 1; i < nr_boot_phases; i++ )
+        printk(XENLOG_INFO "  %-24s %8"PRIu64" ms\n", boot_phases[i].name,
+               (boot_phases[i].tsc - boot_phases[i - 1].tsc) / cpu_khz);
+    printk(XENLOG_INFO "  %-24s %8"PRIu64" ms\n", "total",
+           (boot_phases[nr_boot_phases - 1].tsc - boot_phases[0].tsc) /
+           cpu_khz);
+}
+
 void __init noreturn __start_xen(unsigned long mbi_p)
 {
     char *memmap_type = NULL;
@@ -611,6 +647,8 @@ void __init noreturn __start_xen(unsigned long mbi_p)
     };
     struct xen_arch_domainconfig config = { .emulation_flags = 0 };
 
+    boot_phase_done("start");
+
     /* Critical region without IDT or TSS.  Any fault is deadly! */
 
     set_processor_id(0);
@@ -1357,6 +1395,7 @@ void __init noreturn __start_xen(unsigned long mbi_p)
     generic_apic_probe();
 
     acpi_boot_init();
+    boot_phase_done("memory and ACPI setup");
 
     if ( smp_found_config )
         get_smp_config();
@@ -1428,6 +1467,7 @@ void __init noreturn __start_xen(unsigned long mbi_p)
     rcu_init();
 
     early_time_init();
+    boot_phase_done("BSP and timer init");
 
     arch_init_memory();
 
@@ -1444,6 +1484,7 @@ void __init noreturn __start_xen(unsigned long mbi_p)
     early_msi_init();
 
     iommu_setup();    /* setup iommu if available */
+    boot_phase_done("memory and IOMMU init");
 
     smp_prepare_cpus(max_cpus);
 
@@ -1481,8 +1522,10 @@ void __init noreturn __start_xen(unsigned long mbi_p)
 
     printk("Brought up %ld CPUs\n", (long)num_online_cpus());
     smp_cpus_done();
+    boot_phase_done("AP bring-up");
 
     do_initcalls();
+    boot_phase_done("initcalls");
 
     if ( opt_watchdog ) 
         watchdog_setup();
@@ -1570,6 +1613,7 @@ void __init noreturn __start_xen(unsigned long mbi_p)
                         ? mod + initrdidx : NULL,
                         bootstrap_map, cmdline) != 0)
         panic("Could not set up DOM0 guest OS");
+    boot_phase_done("dom0 construction");
 
     if ( cpu_has_smap )
     {
@@ -1579,6 +1623,9 @@ void __init noreturn __start_xen(unsigned long mbi_p)
 
     /* Scrub RAM that is still free and so may go to an unprivileged domain. */
     scrub_heap_pages();
+    boot_phase_done("memory scrubbing");
+
+    boot_profile_print();
 
     init_trace_bufs();
 
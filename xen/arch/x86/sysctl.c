@@ -30,6 +30,8 @@
 #include <xen/cpu.h>
 #include <xsm/xsm.h>
 #include <asm/psr.h>
+#include <asm/pmusample.h>
+#include <asm/p2m.h>
 #include <asm/cpuid.h>
 
 struct l3_cache_info {
@@ -161,6 +163,28 @@ long arch_do_sysctl(
         case XEN_SYSCTL_PSR_CMT_get_l3_event_mask:
             sysctl->u.psr_cmt_op.u.data = psr_cmt->l3.features;
             break;
+        case XEN_SYSCTL_PSR_CMT_get_domain_mbm:
+        {
+            struct psr_mbm_stats stats;
+            struct domain *d =
+                rcu_lock_domain_by_id(sysctl->u.psr_cmt_op.u.mbm.domid);
+
+            if ( !d )
+            {
+                ret = -ESRCH;
+                break;
+            }
+            ret = psr_get_mbm(d, &stats);
+            rcu_unlock_domain(d);
+            if ( ret )
+                break;
+
+            sysctl->u.psr_cmt_op.u.mbm.total = stats.total;
+            sysctl->u.psr_cmt_op.u.mbm.local = stats.local;
+            sysctl->u.psr_cmt_op.u.mbm.bw_total = stats.bw_total;
+            sysctl->u.psr_cmt_op.u.mbm.bw_local = stats.bw_local;
+            break;
+        }
         default:
             sysctl->u.psr_cmt_op.u.data = 0;
             ret = -ENOSYS;
@@ -185,12 +209,34 @@ long arch_do_sysctl(
                 ret = -EFAULT;
             break;
 
+        case XEN_SYSCTL_PSR_CAT_get_mba_info:
+            ret = psr_get_mba_info(sysctl->u.psr_cat_op.target,
+                                   &sysctl->u.psr_cat_op.u.mba_info.thrtl_max,
+                                   &sysctl->u.psr_cat_op.u.mba_info.cos_max,
+                                   &sysctl->u.psr_cat_op.u.mba_info.flags);
+
+            if ( !ret && __copy_field_to_guest(u_sysctl, sysctl, u.psr_cat_op) )
+                ret = -EFAULT;
+            break;
+
         default:
             ret = -EOPNOTSUPP;
             break;
         }
         break;
 
+    case XEN_SYSCTL_pmusample_op:
+        ret = pmusample_control(&sysctl->u.pmusample_op);
+        if ( !ret && __copy_field_to_guest(u_sysctl, sysctl, u.pmusample_op) )
+            ret = -EFAULT;
+        break;
+
+    case XEN_SYSCTL_numa_locality:
+        ret = p2m_numa_locality(&sysctl->u.numa_locality);
+        if ( !ret && __copy_field_to_guest(u_sysctl, sysctl, u.numa_locality) )
+            ret = -EFAULT;
+        break;
+
     case XEN_SYSCTL_get_cpu_levelling_caps:
         sysctl->u.cpu_levelling_caps.caps = levelling_caps;
         if ( __copy_field_to_guest(u_sysctl, sysctl, u.cpu_levelling_caps.caps) )
@@ -994,6 +994,101 @@ int cpu_frequency_change(u64 freq)
 /* Per-CPU communication between rendezvous IRQ and softirq handler. */
 static DEFINE_PER_CPU(struct cpu_time_stamp, cpu_calibration);
 
+/*
+ * With constant-rate TSCs known to be in sync, calibration merely re-bases
+ * each CPU's time stamps, and CPUs need not meet for that.  CPU0 instead
+ * publishes a reference point which every CPU calibrates against from
+ * softirq context, checking on the way that its local clock hasn't drifted
+ * away from the reference.  Any such drift reverts to rendezvous
+ * calibration for good.
+ */
+static bool_t __read_mostly time_calibration_local;
+static bool_t __initdata opt_time_calibration_local = 1;
+boolean_param("time-calibration-local", opt_time_calibration_local);
+
+/* Largest tolerated difference between a CPU's clock and the reference. */
+#define CALIBRATION_MAX_DRIFT MICROSECS(20)
+
+static struct {
+    unsigned int seq;
+    u64 tsc;
+    s_time_t local_stime;
+    s_time_t master_stime;
+} calibration_ref;
+
+static s_time_t scale_sdelta(s64 delta, const struct time_scale *scale)
+{
+    if ( delta < 0 )
+        return -(s_time_t)scale_delta(-delta, scale);
+    return scale_delta(delta, scale);
+}
+
+/* Called on CPU0 with interrupts disabled. */
+static void time_calibration_publish_ref(void)
+{
+    u64 tsc;
+    s_time_t master_stime = read_platform_stime();
+
+    tsc = rdtsc_ordered();
+
+    calibration_ref.seq++;
+    smp_wmb();
+    calibration_ref.tsc = tsc;
+    calibration_ref.local_stime = get_s_time_fixed(tsc);
+    calibration_ref.master_stime = master_stime;
+    smp_wmb();
+    calibration_ref.seq++;
+}
+
+/*
+ * Fill this CPU's calibration stamp from the published reference.  Returns
+ * false (leaving the stamp alone) if the local clock drifted.
+ */
+static bool_t time_calibration_local_stamp(void)
+{
+    struct cpu_time_stamp *c = &this_cpu(cpu_calibration);
+    const struct time_scale *scale = &this_cpu(cpu_time).tsc_scale;
+    unsigned int seq;
+    u64 ref_tsc, tsc;
+    s_time_t ref_local, ref_master, local, drift;
+    s64 delta;
+
+    do {
+        seq = read_atomic(&calibration_ref.seq);
+        smp_rmb();
+        ref_tsc = calibration_ref.tsc;
+        ref_local = calibration_ref.local_stime;
+        ref_master = calibration_ref.master_stime;
+        smp_rmb();
+    } while ( (seq & 1) || seq != read_atomic(&calibration_ref.seq) );
+
+    local_irq_disable();
+    tsc = rdtsc_ordered();
+    local = get_s_time_fixed(tsc);
+    local_irq_enable();
+
+    delta = tsc - ref_tsc;
+    drift = local - ref_local - scale_sdelta(delta, scale);
+    if ( ABS(drift) > CALIBRATION_MAX_DRIFT )
+    {
+        if ( test_and_clear_bool(time_calibration_local) )
+            printk(XENLOG_WARNING
+                   "CPU%u: clock drifted by %"PRId64"ns, "
+                   "reverting to rendezvous time calibration\n",
+                   smp_processor_id(), drift);
+        return 0;
+    }
+
+    /* Atomically with respect to a (late) rendezvous IRQ. */
+    local_irq_disable();
+    c->local_tsc    = tsc;
+    c->local_stime  = local;
+    c->master_stime = ref_master + scale_sdelta(delta, scale);
+    local_irq_enable();
+
+    return 1;
+}
+
 /* Softirq handler for per-CPU time calibration. */
 static void local_time_calibration(void)
 {
@@ -1024,6 +1119,9 @@ static void local_time_calibration(void)
 
     if ( boot_cpu_has(X86_FEATURE_CONSTANT_TSC) )
     {
+        if ( time_calibration_local && !time_calibration_local_stamp() )
+            goto out;
+
         /* Atomically read cpu_calibration struct and write cpu_time struct. */
         local_irq_disable();
         t->stamp = *c;
@@ -1339,6 +1437,16 @@ static void time_calibration(void *unused)
         .semaphore = ATOMIC_INIT(0)
     };
 
+    if ( time_calibration_local )
+    {
+        local_irq_disable();
+        time_calibration_publish_ref();
+        local_irq_enable();
+
+        cpumask_raise_softirq(&cpu_online_map, TIME_CALIBRATE_SOFTIRQ);
+        return;
+    }
+
     cpumask_copy(&r.cpu_calibration_map, &cpu_online_map);
 
     /* @wait=1 because we must wait for all cpus before freeing @r. */
@@ -1472,6 +1580,10 @@ static int __init verify_tsc_reliability(void)
         }
     }
 
+    time_calibration_local = opt_time_calibration_local &&
+                             boot_cpu_has(X86_FEATURE_CONSTANT_TSC) &&
+                             boot_cpu_has(X86_FEATURE_TSC_RELIABLE);
+
     return 0;
 }
 __initcall(verify_tsc_reliability);
@@ -1503,6 +1615,7 @@ int __init init_xen_time(void)
     init_percpu_time();
 
     init_timer(&calibration_timer, time_calibration, NULL, 0);
+    set_timer_slack(&calibration_timer, TIMER_SLACK_relaxed);
     set_timer(&calibration_timer, NOW() + EPOCH);
 
     return 0;
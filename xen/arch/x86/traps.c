@@ -96,6 +96,8 @@ static DEFINE_PER_CPU(unsigned long, last_extable_addr);
 
 DEFINE_PER_CPU_READ_MOSTLY(u32, ler_msr);
 
+DEFINE_PER_CPU(u32, tsc_aux);
+
 DEFINE_PER_CPU_READ_MOSTLY(struct desc_struct *, gdt_table);
 DEFINE_PER_CPU_READ_MOSTLY(struct desc_struct *, compat_gdt_table);
 
@@ -1452,6 +1454,16 @@ void do_invalid_op(struct cpu_user_regs *regs)
 
 void do_int3(struct cpu_user_regs *regs)
 {
+    unsigned long target;
+
+    /* A site being live patched, which continues in the new code. */
+    if ( !guest_mode(regs) &&
+         (target = livepatch_poke_target(regs->rip - 1)) != 0 )
+    {
+        regs->rip = target;
+        return;
+    }
+
     if ( debugger_trap_entry(TRAP_int3, regs) )
         return;
 
@@ -2313,6 +2325,8 @@ static int emulate_privileged_op(struct cpu_user_regs *regs)
     uint64_t val;
     bool_t vpmu_msr;
 
+    perfc_dom_incr(dom_emulations);
+
     if ( !read_descriptor(regs->cs, v, &code_base, &code_limit, &ar, 1) )
         goto fail;
     op_default = op_bytes = (ar & (_SEGMENT_L|_SEGMENT_DB)) ? 4 : 2;
@@ -3812,6 +3826,20 @@ void write_efer(u64 val)
     wrmsrl(MSR_EFER, val);
 }
 
+void wrmsr_tsc_aux(u32 val)
+{
+    u32 *this_tsc_aux = &this_cpu(tsc_aux);
+
+    if ( *this_tsc_aux == val )
+    {
+        perfc_incr(msr_writes_elided);
+        return;
+    }
+
+    wrmsr(MSR_TSC_AUX, val, 0);
+    *this_tsc_aux = val;
+}
+
 static void ler_enable(void)
 {
     u64 debugctl;
@@ -3917,6 +3945,14 @@ void percpu_traps_init(void)
 {
     subarch_percpu_traps_init();
 
+    /*
+     * The MSR may hold anything left by firmware, a previous kernel or the
+     * last guest run here before going offline.  Bring it in line with
+     * the tsc_aux cache, which wrmsr_tsc_aux() relies on.
+     */
+    if ( cpu_has_rdtscp )
+        wrmsr(MSR_TSC_AUX, this_cpu(tsc_aux), 0);
+
     if ( !opt_ler )
         return;
 
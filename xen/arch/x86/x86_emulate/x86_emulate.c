@@ -586,15 +586,24 @@ do{ asm volatile (                                                      \
 #define __emulate_1op_8byte(_op, _dst, _eflags)
 #endif /* __i386__ */
 
-/* Fetch next part of the instruction being emulated. */
+/*
+ * Fetch next part of the instruction being emulated, from the bytes the
+ * caller prefetched if they cover it.
+ */
 #define insn_fetch_bytes(_size)                                         \
 ({ unsigned long _x = 0, _eip = _regs.eip;                              \
+   unsigned int _off = _eip - ctxt->regs->eip;                          \
    _regs.eip += (_size); /* real hardware doesn't truncate */           \
    generate_exception_if((uint8_t)(_regs.eip -                          \
                                    ctxt->regs->eip) > MAX_INST_LEN,     \
                          EXC_GP, 0);                                    \
-   rc = ops->insn_fetch(x86_seg_cs, _eip, &_x, (_size), ctxt);          \
-   if ( rc ) goto done;                                                 \
+   if ( _off + (_size) <= ctxt->insn_buf_bytes )                        \
+       memcpy(&_x, ctxt->insn_buf + _off, (_size));                     \
+   else                                                                 \
+   {                                                                    \
+       rc = ops->insn_fetch(x86_seg_cs, _eip, &_x, (_size), ctxt);      \
+       if ( rc ) goto done;                                             \
+   }                                                                    \
    _x;                                                                  \
 })
 #define insn_fetch_type(_type) ((_type)insn_fetch_bytes(sizeof(_type)))
@@ -421,6 +421,13 @@ struct x86_emulate_ctxt
     /* Software event injection support. */
     enum x86_swint_emulation swint_emulate;
 
+    /*
+     * Optional: instruction bytes already fetched by the caller, starting
+     * at regs->eip.  Fetches within them don't call ops->insn_fetch().
+     */
+    const uint8_t *insn_buf;
+    unsigned int insn_buf_bytes;
+
     /* Retirement state, set by the emulator (valid only on X86EMUL_OKAY). */
     union {
         struct {
@@ -31,6 +31,15 @@ static unsigned int __read_mostly xstate_features;
 
 static uint32_t __read_mostly mxcsr_mask = 0x0000ffbf;
 
+/*
+ * vCPU state is kept in the compacted format whenever the processor supports
+ * it: XSAVES and XSAVEC only write the components not in their initial
+ * configuration (XINUSE), packed according to xcomp_bv rather than at their
+ * fixed offsets, and XSAVES additionally skips those not modified since the
+ * last XRSTORS, like XSAVEOPT does.
+ */
+#define xsave_compact() (cpu_has_xsaves || cpu_has_xsavec)
+
 /* Cached xcr0 for fast read */
 static DEFINE_PER_CPU(uint64_t, xcr0);
 
@@ -243,7 +252,7 @@ void compress_xsave_states(struct vcpu *v, const void *src, unsigned int size)
 
     xstate_bv = ((const struct xsave_struct *)src)->xsave_hdr.xstate_bv;
 
-    if ( !(v->arch.xcr0_accum & XSTATE_XSAVES_ONLY) )
+    if ( !xsave_compact() )
     {
         memcpy(xsave, src, size);
         return;
@@ -286,17 +295,49 @@ void compress_xsave_states(struct vcpu *v, const void *src, unsigned int size)
     }
 }
 
+/* Account for the state a save of @mask wrote (or found unmodified). */
+static void xsave_account(struct vcpu *v, uint64_t mask)
+{
+    uint64_t valid = v->arch.xsave_area->xsave_hdr.xstate_bv & mask &
+                     ~XSTATE_FP_SSE;
+    unsigned int bytes = XSTATE_AREA_MIN_SIZE;
+
+    while ( valid )
+    {
+        unsigned int index = find_first_set_bit(valid);
+
+        bytes += xstate_sizes[index];
+        valid &= valid - 1;
+    }
+
+    v->arch.xsave_count++;
+    v->arch.xsave_bytes += bytes;
+}
+
 void xsave(struct vcpu *v, uint64_t mask)
 {
     struct xsave_struct *ptr = v->arch.xsave_area;
-    uint32_t hmask = mask >> 32;
-    uint32_t lmask = mask;
+    uint32_t hmask, lmask;
     unsigned int fip_width = v->domain->arch.x87_fip_width;
+
+    /*
+     * XSAVES also saves the supervisor components enabled in XSS, which
+     * may hold the guest's value: only ask for the ones the area has room
+     * for.
+     */
+    mask &= xfeature_mask;
+    hmask = mask >> 32;
+    lmask = mask;
+
 #define XSAVE(pfx) \
-        if ( v->arch.xcr0_accum & XSTATE_XSAVES_ONLY ) \
+        if ( cpu_has_xsaves ) \
             asm volatile ( ".byte " pfx "0x0f,0xc7,0x2f\n" /* xsaves */ \
                            : "=m" (*ptr) \
                            : "a" (lmask), "d" (hmask), "D" (ptr) ); \
+        else if ( cpu_has_xsavec ) \
+            asm volatile ( ".byte " pfx "0x0f,0xc7,0x27\n" /* xsavec */ \
+                           : "=m" (*ptr) \
+                           : "a" (lmask), "d" (hmask), "D" (ptr) ); \
         else \
             alternative_io(".byte " pfx "0x0f,0xae,0x27\n", /* xsave */ \
                            ".byte " pfx "0x0f,0xae,0x37\n", /* xsaveopt */ \
@@ -337,6 +378,7 @@ void xsave(struct vcpu *v, uint64_t mask)
         if ( ptr->fpu_sse.fip.addr == bad_fip )
         {
             ptr->fpu_sse.fip.addr = orig_fip;
+            xsave_account(v, mask);
             return;
         }
 
@@ -359,15 +401,21 @@ void xsave(struct vcpu *v, uint64_t mask)
 #undef XSAVE
     if ( mask & XSTATE_FP )
         ptr->fpu_sse.x[FPU_WORD_SIZE_OFFSET] = fip_width;
+
+    xsave_account(v, mask);
 }
 
 void xrstor(struct vcpu *v, uint64_t mask)
 {
-    uint32_t hmask = mask >> 32;
-    uint32_t lmask = mask;
+    uint32_t hmask, lmask;
     struct xsave_struct *ptr = v->arch.xsave_area;
     unsigned int faults, prev_faults;
 
+    /* Leave alone any supervisor component enabled in XSS, as in xsave(). */
+    mask &= xfeature_mask;
+    hmask = mask >> 32;
+    lmask = mask;
+
     /*
      * AMD CPUs don't save/restore FDP/FIP/FOP unless an exception
      * is pending. Clear the x87 state here by setting it to fixed
@@ -406,7 +454,7 @@ void xrstor(struct vcpu *v, uint64_t mask)
                          [ptr] "D" (ptr) )
 
 #define XRSTOR(pfx) \
-        if ( v->arch.xcr0_accum & XSTATE_XSAVES_ONLY ) \
+        if ( cpu_has_xsaves ) \
         { \
             if ( unlikely(!(ptr->xsave_hdr.xcomp_bv & \
                             XSTATE_COMPACTION_ENABLED)) ) \
@@ -455,7 +503,7 @@ void xrstor(struct vcpu *v, uint64_t mask)
                   ((mask & XSTATE_YMM) &&
                    !(ptr->xsave_hdr.xcomp_bv & XSTATE_COMPACTION_ENABLED))) )
                 ptr->fpu_sse.mxcsr &= mxcsr_mask;
-            if ( v->arch.xcr0_accum & XSTATE_XSAVES_ONLY )
+            if ( cpu_has_xsaves || xsave_area_compressed(ptr) )
             {
                 ptr->xsave_hdr.xcomp_bv &= this_cpu(xcr0) | this_cpu(xss);
                 ptr->xsave_hdr.xstate_bv &= ptr->xsave_hdr.xcomp_bv;
@@ -472,7 +520,7 @@ void xrstor(struct vcpu *v, uint64_t mask)
         case 2: /* Stage 2: Reset all state. */
             ptr->fpu_sse.mxcsr = MXCSR_DEFAULT;
             ptr->xsave_hdr.xstate_bv = 0;
-            ptr->xsave_hdr.xcomp_bv = v->arch.xcr0_accum & XSTATE_XSAVES_ONLY
+            ptr->xsave_hdr.xcomp_bv = xsave_compact()
                                       ? XSTATE_COMPACTION_ENABLED : 0;
             continue;
         }
@@ -529,6 +577,18 @@ void xstate_free_save_area(struct vcpu *v)
     v->arch.xsave_area = NULL;
 }
 
+void xstate_dump_vcpu_info(const struct vcpu *v)
+{
+    if ( !v->arch.xsave_area || !v->arch.xsave_count )
+        return;
+
+    printk("    xsave: %s, %lu saves, %"PRIu64" bytes (%"PRIu64" per save)\n",
+           xsave_area_compressed(v->arch.xsave_area) ? "compacted"
+                                                      : "standard",
+           v->arch.xsave_count, v->arch.xsave_bytes,
+           v->arch.xsave_bytes / v->arch.xsave_count);
+}
+
 static unsigned int _xstate_ctxt_size(u64 xcr0)
 {
     u64 act_xcr0 = get_xcr0();
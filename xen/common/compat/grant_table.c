@@ -125,6 +125,8 @@ int compat_grant_table_op(unsigned int cmd,
     if ( (int)count < 0 )
         rc = -EINVAL;
 
+    perfc_dom_incra(dom_gnttab_ops, cmd_op);
+
     for ( i = 0; i < count && rc == 0; )
     {
         unsigned int n;
@@ -15,6 +15,7 @@ CHECK_TYPE(domid);
 #undef compat_domid_t
 #undef xen_domid_t
 
+CHECK_mem_access_filter;
 CHECK_mem_access_op;
 CHECK_vmemrange;
 
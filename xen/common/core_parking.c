@@ -19,6 +19,7 @@
 #include <xen/cpu.h>
 #include <xen/init.h>
 #include <xen/cpumask.h>
+#include <xen/sched.h>
 #include <asm/percpu.h>
 #include <asm/smp.h>
 
@@ -31,6 +32,27 @@ static unsigned int core_parking_performance(unsigned int event);
 static uint32_t cur_idle_nums;
 static unsigned int core_parking_cpunum[NR_CPUS] = {[0 ... NR_CPUS-1] = -1};
 
+/*
+ * Soft parked cpus stay online, but are taken out of their cpupool (whose
+ * id is remembered here) so that they only ever idle.
+ */
+static cpumask_t core_parking_soft_map;
+static int core_parking_soft_pool[NR_CPUS];
+
+/* Candidates for parking, and the weight of a topology mask among them. */
+static void core_parking_candidates(cpumask_t *mask)
+{
+    cpumask_andnot(mask, &cpu_online_map, &core_parking_soft_map);
+}
+
+static int core_parking_weight(const cpumask_t *mask)
+{
+    cpumask_t unparked;
+
+    cpumask_andnot(&unparked, mask, &core_parking_soft_map);
+    return cpumask_weight(&unparked);
+}
+
 static struct core_parking_policy {
     char name[30];
     unsigned int (*next)(unsigned int event);
@@ -62,16 +84,17 @@ static unsigned int core_parking_performance(unsigned int event)
     {
         int core_tmp, core_weight = -1;
         int sibling_tmp, sibling_weight = -1;
-        cpumask_t core_candidate_map, sibling_candidate_map;
+        cpumask_t core_candidate_map, sibling_candidate_map, candidates;
         cpumask_clear(&core_candidate_map);
         cpumask_clear(&sibling_candidate_map);
+        core_parking_candidates(&candidates);
 
-        for_each_cpu(cpu, &cpu_online_map)
+        for_each_cpu(cpu, &candidates)
         {
             if ( cpu == 0 )
                 continue;
 
-            core_tmp = cpumask_weight(per_cpu(cpu_core_mask, cpu));
+            core_tmp = core_parking_weight(per_cpu(cpu_core_mask, cpu));
             if ( core_weight < core_tmp )
             {
                 core_weight = core_tmp;
@@ -83,7 +106,7 @@ static unsigned int core_parking_performance(unsigned int event)
 
         for_each_cpu(cpu, &core_candidate_map)
         {
-            sibling_tmp = cpumask_weight(per_cpu(cpu_sibling_mask, cpu));
+            sibling_tmp = core_parking_weight(per_cpu(cpu_sibling_mask, cpu));
             if ( sibling_weight < sibling_tmp )
             {
                 sibling_weight = sibling_tmp;
@@ -120,16 +143,17 @@ static unsigned int core_parking_power(unsigned int event)
     {
         int core_tmp, core_weight = NR_CPUS + 1;
         int sibling_tmp, sibling_weight = NR_CPUS + 1;
-        cpumask_t core_candidate_map, sibling_candidate_map;
+        cpumask_t core_candidate_map, sibling_candidate_map, candidates;
         cpumask_clear(&core_candidate_map);
         cpumask_clear(&sibling_candidate_map);
+        core_parking_candidates(&candidates);
 
-        for_each_cpu(cpu, &cpu_online_map)
+        for_each_cpu(cpu, &candidates)
         {
             if ( cpu == 0 )
                 continue;
 
-            core_tmp = cpumask_weight(per_cpu(cpu_core_mask, cpu));
+            core_tmp = core_parking_weight(per_cpu(cpu_core_mask, cpu));
             if ( core_weight > core_tmp )
             {
                 core_weight = core_tmp;
@@ -141,7 +165,7 @@ static unsigned int core_parking_power(unsigned int event)
 
         for_each_cpu(cpu, &core_candidate_map)
         {
-            sibling_tmp = cpumask_weight(per_cpu(cpu_sibling_mask, cpu));
+            sibling_tmp = core_parking_weight(per_cpu(cpu_sibling_mask, cpu));
             if ( sibling_weight > sibling_tmp )
             {
                 sibling_weight = sibling_tmp;
@@ -170,7 +194,8 @@ static unsigned int core_parking_power(unsigned int event)
 
 long core_parking_helper(void *data)
 {
-    uint32_t idle_nums = (unsigned long)data;
+    uint32_t idle_nums = (unsigned long)data & ~CORE_PARKING_SOFT;
+    bool_t soft = !!((unsigned long)data & CORE_PARKING_SOFT);
     unsigned int cpu;
     int ret = 0;
 
@@ -180,7 +205,14 @@ long core_parking_helper(void *data)
     while ( cur_idle_nums < idle_nums )
     {
         cpu = core_parking_policy->next(CORE_PARKING_INCREMENT);
-        ret = cpu_down(cpu);
+        if ( soft )
+        {
+            ret = cpupool_park_cpu(cpu, &core_parking_soft_pool[cpu]);
+            if ( !ret )
+                cpumask_set_cpu(cpu, &core_parking_soft_map);
+        }
+        else
+            ret = cpu_down(cpu);
         if ( ret )
             return ret;
         core_parking_cpunum[cur_idle_nums++] = cpu;
@@ -189,7 +221,14 @@ long core_parking_helper(void *data)
     while ( cur_idle_nums > idle_nums )
     {
         cpu = core_parking_policy->next(CORE_PARKING_DECREMENT);
-        ret = cpu_up(cpu);
+        if ( cpumask_test_cpu(cpu, &core_parking_soft_map) )
+        {
+            ret = cpupool_unpark_cpu(cpu, core_parking_soft_pool[cpu]);
+            if ( !ret )
+                cpumask_clear_cpu(cpu, &core_parking_soft_map);
+        }
+        else
+            ret = cpu_up(cpu);
         if ( ret )
             return ret;
         core_parking_cpunum[--cur_idle_nums] = -1;
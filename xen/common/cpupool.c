@@ -19,6 +19,8 @@
 #include <xen/sched-if.h>
 #include <xen/keyhandler.h>
 #include <xen/cpu.h>
+#include <xen/event.h>
+#include <xen/guest_access.h>
 
 #define for_each_cpupool(ptr)    \
     for ((ptr) = &cpupool_list; *(ptr) != NULL; (ptr) = &((*(ptr))->next))
@@ -257,6 +259,131 @@ int cpupool_move_domain(struct domain *d, struct cpupool *c)
     return ret;
 }
 
+#define CPUPOOL_MOVE_BATCH 16
+
+/*
+ * Move a batch of domains to a cpupool.  The scheduler data are allocated
+ * and all the domains paused before taking cpupool_lock, so that the lock
+ * is only held for switching them over.  Returns the number of domains
+ * moved; on error, that is the index of the domain which failed.
+ */
+static unsigned int cpupool_move_batch(struct cpupool *c,
+                                       struct domain **doms,
+                                       unsigned int nr, int *perr)
+{
+    struct sched_move_data m[CPUPOOL_MOVE_BATCH];
+    struct vcpu *v;
+    unsigned int i, n, done = 0;
+    int ret = 0, rc;
+
+    ASSERT(nr <= CPUPOOL_MOVE_BATCH);
+
+    for ( n = 0; n < nr; n++ )
+    {
+        ret = sched_move_prepare(doms[n], c, &m[n]);
+        if ( ret )
+            break;
+    }
+
+    /* Have the vcpus of all the domains descheduled in parallel. */
+    for ( i = 0; i < n; i++ )
+        domain_pause_nosync(doms[i]);
+    for ( i = 0; i < n; i++ )
+        for_each_vcpu ( doms[i], v )
+            vcpu_sleep_sync(v);
+
+    spin_lock(&cpupool_lock);
+
+    rc = 0;
+    if ( __cpupool_find_by_id(c->cpupool_id, 1) != c ||
+         !cpumask_weight(c->cpu_valid) )
+        rc = -ENOENT;
+
+    for ( i = 0; i < n; i++ )
+    {
+        struct domain *d = doms[i];
+
+        if ( !rc && d->cpupool == NULL )
+            rc = -EINVAL;
+        if ( rc )
+        {
+            sched_move_abort(c, &m[i]);
+            continue;
+        }
+
+        if ( d->cpupool == c )
+        {
+            sched_move_abort(c, &m[i]);
+            done++;
+            continue;
+        }
+
+        cpupool_dprintk("cpupool move_domain(dom=%d)->pool=%d\n",
+                        d->domain_id, c->cpupool_id);
+        d->cpupool->n_dom--;
+        rc = sched_move_commit(d, c, &m[i]);
+        if ( rc )
+        {
+            d->cpupool->n_dom++;
+            sched_move_abort(c, &m[i]);
+            continue;
+        }
+        c->n_dom++;
+        done++;
+    }
+
+    spin_unlock(&cpupool_lock);
+
+    for ( i = 0; i < n; i++ )
+        domain_unpause(doms[i]);
+
+    /* A failed move is reported ahead of a failed allocation after it. */
+    *perr = rc ?: ret;
+
+    return done;
+}
+
+static int cpupool_move_domains(struct xen_sysctl_cpupool_op *op)
+{
+    struct cpupool *c;
+    struct domain *doms[CPUPOOL_MOVE_BATCH];
+    unsigned int i, n;
+    int ret = 0, rc;
+
+    c = cpupool_get_by_id(op->cpupool_id);
+    if ( c == NULL )
+        return -ENOENT;
+
+    while ( !ret && op->start < op->n_dom )
+    {
+        for ( n = 0; n < CPUPOOL_MOVE_BATCH && op->start + n < op->n_dom; n++ )
+        {
+            domid_t domid;
+
+            if ( copy_from_guest_offset(&domid, op->domids, op->start + n, 1) )
+                ret = -EFAULT;
+            else
+                ret = rcu_lock_remote_domain_by_id(domid, &doms[n]);
+            if ( ret )
+                break;
+        }
+
+        op->start += cpupool_move_batch(c, doms, n, &rc);
+        if ( rc )
+            ret = rc;
+
+        for ( i = 0; i < n; i++ )
+            rcu_unlock_domain(doms[i]);
+
+        if ( !ret && op->start < op->n_dom && hypercall_preempt_check() )
+            ret = -ERESTART;
+    }
+
+    cpupool_put(c);
+
+    return ret;
+}
+
 /*
  * assign a specific cpu to a cpupool
  * cpupool_lock must be held
@@ -420,6 +547,78 @@ out:
     return ret;
 }
 
+/*
+ * Soft parking: take an online cpu out of its cpupool, so that it is left
+ * running its idle vcpu only, or give it back to a cpupool.  Unlike cpu
+ * hotplug this needs neither stop_machine nor tearing down per-cpu state.
+ * The cpu must not be the one we're running on.
+ * possible failures:
+ * - cpu not in a cpupool, or another cpu is being moved
+ * - last cpu of a cpupool with domains
+ * - vcpus pinned to the cpu which can't be moved (see cpu_disable_scheduler)
+ */
+int cpupool_park_cpu(unsigned int cpu, int *poolid)
+{
+    struct cpupool *c;
+    int ret;
+
+    ASSERT(cpu != smp_processor_id());
+
+    spin_lock(&cpupool_lock);
+    c = per_cpu(cpupool, cpu);
+    ret = -EADDRNOTAVAIL;
+    if ( !c || (cpupool_moving_cpu != -1) ||
+         cpumask_test_cpu(cpu, &cpupool_locked_cpus) )
+        goto out;
+    ret = -EBUSY;
+    if ( (c->n_dom > 0) && (cpumask_weight(c->cpu_valid) == 1) )
+        goto out;
+
+    *poolid = c->cpupool_id;
+    cpupool_moving_cpu = cpu;
+    atomic_inc(&c->refcnt);
+    cpupool_cpu_moving = c;
+    cpumask_clear_cpu(cpu, c->cpu_valid);
+    spin_unlock(&cpupool_lock);
+
+    ret = cpupool_unassign_cpu_helper(c);
+    if ( !ret )
+        return 0;
+
+    /* Don't leave the cpu half way out of its cpupool. */
+    spin_lock(&cpupool_lock);
+    if ( cpupool_moving_cpu == cpu )
+    {
+        cpumask_clear_cpu(cpu, &cpupool_free_cpus);
+        cpumask_set_cpu(cpu, c->cpu_valid);
+        cpupool_moving_cpu = -1;
+        cpupool_put(cpupool_cpu_moving);
+        cpupool_cpu_moving = NULL;
+    }
+
+out:
+    spin_unlock(&cpupool_lock);
+    return ret;
+}
+
+int cpupool_unpark_cpu(unsigned int cpu, int poolid)
+{
+    struct cpupool *c;
+    int ret = 0;
+
+    spin_lock(&cpupool_lock);
+    /* Someone may have given the cpu a new home already. */
+    if ( cpumask_test_cpu(cpu, &cpupool_free_cpus) )
+    {
+        /* Fall back to cpupool0 if the cpupool has gone meanwhile. */
+        c = cpupool_find_by_id(poolid) ?: cpupool0;
+        ret = cpupool_assign_cpu_locked(c, cpu);
+    }
+    spin_unlock(&cpupool_lock);
+
+    return ret;
+}
+
 /*
  * add a new domain to a cpupool
  * possible failures:
@@ -632,6 +831,7 @@ int cpupool_do_sysctl(struct xen_sysctl_cpupool_op *op)
         op->cpupool_id = c->cpupool_id;
         op->sched_id = c->sched->sched_id;
         op->n_dom = c->n_dom;
+        op->profile = c->profile;
         ret = cpumask_to_xenctl_bitmap(&op->cpumap, c->cpu_valid);
         cpupool_put(c);
     }
@@ -700,22 +900,38 @@ int cpupool_do_sysctl(struct xen_sysctl_cpupool_op *op)
             rcu_unlock_domain(d);
             break;
         }
-        cpupool_dprintk("cpupool move_domain(dom=%d)->pool=%d\n",
-                        d->domain_id, op->cpupool_id);
         ret = -ENOENT;
-        spin_lock(&cpupool_lock);
-
-        c = cpupool_find_by_id(op->cpupool_id);
-        if ( (c != NULL) && cpumask_weight(c->cpu_valid) )
-            ret = cpupool_move_domain_locked(d, c);
-
-        spin_unlock(&cpupool_lock);
+        c = cpupool_get_by_id(op->cpupool_id);
+        if ( c != NULL )
+        {
+            cpupool_move_batch(c, &d, 1, &ret);
+            cpupool_put(c);
+        }
         cpupool_dprintk("cpupool move_domain(dom=%d)->pool=%d ret %d\n",
                         d->domain_id, op->cpupool_id, ret);
         rcu_unlock_domain(d);
     }
     break;
 
+    case XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAINS:
+        ret = cpupool_move_domains(op);
+        break;
+
+    case XEN_SYSCTL_CPUPOOL_OP_SETPROFILE:
+    {
+        c = cpupool_get_by_id(op->cpupool_id);
+        ret = -ENOENT;
+        if ( c == NULL )
+            break;
+        ret = -EINVAL;
+        if ( op->profile <= XEN_SYSCTL_CPUPOOL_PROFILE_THROUGHPUT )
+            ret = sched_set_profile(c, op->profile);
+        if ( !ret )
+            c->profile = op->profile;
+        cpupool_put(c);
+    }
+    break;
+
     case XEN_SYSCTL_CPUPOOL_OP_FREEINFO:
     {
         ret = cpumask_to_xenctl_bitmap(
@@ -748,6 +964,7 @@ void dump_runq(unsigned char key)
 
     printk("sched_smt_power_savings: %s\n",
             sched_smt_power_savings? "enabled":"disabled");
+    printk("sched_core: %s\n", sched_core ? "enabled" : "disabled");
     printk("NOW=%"PRI_stime"\n", now);
 
     print_cpumap("Online Cpus", &cpu_online_map);
@@ -143,7 +143,8 @@ struct vcpu *alloc_vcpu(
          !zalloc_cpumask_var(&v->cpu_hard_affinity_tmp) ||
          !zalloc_cpumask_var(&v->cpu_hard_affinity_saved) ||
          !zalloc_cpumask_var(&v->cpu_soft_affinity) ||
-         !zalloc_cpumask_var(&v->vcpu_dirty_cpumask) )
+         !zalloc_cpumask_var(&v->vcpu_dirty_cpumask) ||
+         perfc_init_vcpu(v) )
         goto fail_free;
 
     if ( is_idle_domain(d) )
@@ -173,6 +174,7 @@ struct vcpu *alloc_vcpu(
         free_cpumask_var(v->cpu_hard_affinity_saved);
         free_cpumask_var(v->cpu_soft_affinity);
         free_cpumask_var(v->vcpu_dirty_cpumask);
+        perfc_destroy_vcpu(v);
         free_vcpu_struct(v);
         return NULL;
     }
@@ -230,6 +232,12 @@ static int late_hwdom_init(struct domain *d)
     rangeset_swap(d->iomem_caps, dom0->iomem_caps);
 #ifdef CONFIG_X86
     rangeset_swap(d->arch.ioport_caps, dom0->arch.ioport_caps);
+    {
+        unsigned long *map = d->arch.ioport_bitmap;
+
+        d->arch.ioport_bitmap = dom0->arch.ioport_bitmap;
+        dom0->arch.ioport_bitmap = map;
+    }
     setup_io_bitmap(d);
     setup_io_bitmap(dom0);
 #endif
@@ -291,6 +299,7 @@ struct domain *domain_create(domid_t domid, unsigned int domcr_flags,
     spin_lock_init(&d->node_affinity_lock);
     d->node_affinity = NODE_MASK_ALL;
     d->auto_node_affinity = 1;
+    d->numa_home = NUMA_NO_NODE;
 
     spin_lock_init(&d->shutdown_lock);
     d->shutdown_code = SHUTDOWN_CODE_INVALID;
@@ -834,6 +843,7 @@ static void complete_domain_destroy(struct rcu_head *head)
             free_cpumask_var(v->cpu_hard_affinity_saved);
             free_cpumask_var(v->cpu_soft_affinity);
             free_cpumask_var(v->vcpu_dirty_cpumask);
+            perfc_destroy_vcpu(v);
             free_vcpu_struct(v);
         }
 
@@ -877,8 +887,12 @@ void domain_destroy(struct domain *d)
     rcu_assign_pointer(*pd, d->next_in_hashbucket);
     spin_unlock(&domlist_update_lock);
 
-    /* Schedule RCU asynchronous completion of domain destroy. */
-    call_rcu(&d->rcu, complete_domain_destroy);
+    /*
+     * Schedule RCU asynchronous completion of domain destroy.  Its memory
+     * is only freed from there, so don't wait for the next natural grace
+     * period.
+     */
+    call_rcu_expedited(&d->rcu, complete_domain_destroy);
 }
 
 void vcpu_pause(struct vcpu *v)
@@ -1048,7 +1062,7 @@ void domain_unpause_except_self(struct domain *d)
         domain_unpause(d);
 }
 
-int domain_soft_reset(struct domain *d)
+int domain_soft_reset(struct domain *d, unsigned int flags)
 {
     struct vcpu *v;
     int rc;
@@ -1074,7 +1088,7 @@ int domain_soft_reset(struct domain *d)
         unmap_vcpu_info(v);
     }
 
-    rc = arch_domain_soft_reset(d);
+    rc = arch_domain_soft_reset(d, flags);
     if ( !rc )
         domain_resume(d);
     else
@@ -19,6 +19,7 @@
 #include <xen/trace.h>
 #include <xen/console.h>
 #include <xen/iocap.h>
+#include <xen/grant_table.h>
 #include <xen/rcupdate.h>
 #include <xen/guest_access.h>
 #include <xen/bitmap.h>
@@ -667,7 +668,23 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
             ret = -EINVAL;
             break;
         }
-        ret = domain_soft_reset(d);
+        if ( op->u.soft_reset.flags & ~XEN_DOMCTL_SOFT_RESET_platform )
+        {
+            ret = -EINVAL;
+            break;
+        }
+        /* Only HVM guests have an emulated platform to reset. */
+        if ( (op->u.soft_reset.flags & XEN_DOMCTL_SOFT_RESET_platform) &&
+             !is_hvm_domain(d) )
+        {
+            ret = -EOPNOTSUPP;
+            break;
+        }
+        ret = domain_soft_reset(d, op->u.soft_reset.flags);
+        break;
+
+    case XEN_DOMCTL_set_grant_frames:
+        ret = gnttab_presize(d, op->u.set_grant_frames.nr_frames);
         break;
 
     case XEN_DOMCTL_destroydomain:
@@ -25,6 +25,7 @@
 #include <xen/compat.h>
 #include <xen/guest_access.h>
 #include <xen/keyhandler.h>
+#include <xen/timer.h>
 #include <xen/event_fifo.h>
 #include <asm/current.h>
 
@@ -161,20 +162,37 @@ static int get_free_port(struct domain *d)
 {
     struct evtchn *chn;
     struct evtchn **grp;
-    int            port;
+    int            port, first_busy = -1;
 
     if ( d->is_dying )
         return -EINVAL;
 
-    for ( port = 0; port_is_valid(d, port); port++ )
+    /*
+     * No port below first_free_evtchn is free.  A free port which is still
+     * busy (linked on a FIFO queue) may become usable at any time, so the
+     * hint never moves past one.
+     */
+    for ( port = d->first_free_evtchn; port_is_valid(d, port); port++ )
     {
         if ( port > d->max_evtchn_port )
             return -ENOSPC;
-        if ( evtchn_from_port(d, port)->state == ECS_FREE
-             && !evtchn_port_is_busy(d, port) )
-            return port;
+        if ( evtchn_from_port(d, port)->state != ECS_FREE )
+            continue;
+        if ( !evtchn_port_is_busy(d, port) )
+            break;
+        if ( first_busy < 0 )
+            first_busy = port;
     }
 
+    /*
+     * The caller may still fail to use the port, so the hint stays at it
+     * rather than moving past it.
+     */
+    d->first_free_evtchn = first_busy >= 0 ? first_busy : port;
+
+    if ( port_is_valid(d, port) )
+        return port;
+
     if ( port == d->max_evtchns || port > d->max_evtchn_port )
         return -ENOSPC;
 
@@ -206,6 +224,9 @@ static void free_evtchn(struct domain *d, struct evtchn *chn)
     chn->notify_vcpu_id = 0;
     chn->xen_consumer   = 0;
 
+    if ( chn->port < d->first_free_evtchn )
+        d->first_free_evtchn = chn->port;
+
     xsm_evtchn_close_post(chn);
 }
 
@@ -316,6 +337,9 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
 
     double_evtchn_lock(lchn, rchn);
 
+    /* Moderation is dropped whenever a port leaves ECS_INTERDOMAIN. */
+    ASSERT(!lchn->moderation && !rchn->moderation);
+
     lchn->u.interdomain.remote_dom  = rd;
     lchn->u.interdomain.remote_port = rport;
     lchn->state                     = ECS_INTERDOMAIN;
@@ -512,6 +536,93 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
 }
 
 
+/*
+ * Notification moderation for an interdomain port.  Sends which arrive
+ * within the window after a delivered notification are merged into one,
+ * raised by the timer at the end of the window.  Protected by the channel
+ * lock; the domain's event_lock is also held while attaching or detaching.
+ */
+struct evtchn_moderation {
+    struct evtchn *chn;
+    struct timer   timer;
+    s_time_t       window;
+    s_time_t       last_sent;
+    unsigned int   count;    /* Deliver once this many sends accumulate. */
+    unsigned int   deferred; /* Sends merged since the last delivery. */
+};
+
+static void evtchn_notify_remote(struct evtchn *lchn)
+{
+    struct domain *rd = lchn->u.interdomain.remote_dom;
+    unsigned int rport = lchn->u.interdomain.remote_port;
+    struct evtchn *rchn = evtchn_from_port(rd, rport);
+
+    if ( consumer_is_xen(rchn) )
+        xen_notification_fn(rchn)(rd->vcpu[rchn->notify_vcpu_id], rport);
+    else
+        evtchn_port_set_pending(rd, rchn->notify_vcpu_id, rchn);
+}
+
+static void evtchn_moderation_timer_fn(void *data)
+{
+    struct evtchn_moderation *mod = data;
+    struct evtchn *chn = mod->chn;
+
+    spin_lock(&chn->lock);
+
+    if ( mod->deferred && chn->moderation == mod &&
+         chn->state == ECS_INTERDOMAIN )
+    {
+        evtchn_notify_remote(chn);
+        mod->last_sent = NOW();
+    }
+    mod->deferred = 0;
+
+    spin_unlock(&chn->lock);
+}
+
+/* Returns true if the send has been deferred to the moderation timer. */
+static bool_t evtchn_moderate(struct evtchn_moderation *mod)
+{
+    s_time_t now = NOW();
+
+    if ( (now - mod->last_sent) < mod->window &&
+         (!mod->count || (mod->deferred + 1) < mod->count) )
+    {
+        if ( !mod->deferred++ )
+            set_timer(&mod->timer, mod->last_sent + mod->window);
+        return 1;
+    }
+
+    if ( mod->deferred )
+    {
+        stop_timer(&mod->timer);
+        mod->deferred = 0;
+    }
+    mod->last_sent = now;
+
+    return 0;
+}
+
+/* Called with the domain's event_lock held, but not the channel lock. */
+static void evtchn_moderation_free(struct evtchn *chn)
+{
+    struct evtchn_moderation *mod = chn->moderation;
+
+    if ( !mod )
+        return;
+
+    spin_lock(&chn->lock);
+    if ( mod->deferred && chn->state == ECS_INTERDOMAIN )
+        evtchn_notify_remote(chn);
+    mod->deferred = 0;
+    chn->moderation = NULL;
+    spin_unlock(&chn->lock);
+
+    kill_timer(&mod->timer);
+    xfree(mod);
+}
+
 static long evtchn_close(struct domain *d1, int port1, bool_t guest)
 {
     struct domain *d2 = NULL;
@@ -538,6 +649,8 @@ static long evtchn_close(struct domain *d1, int port1, bool_t guest)
         goto out;
     }
 
+    evtchn_moderation_free(chn1);
+
     switch ( chn1->state )
     {
     case ECS_FREE:
@@ -627,6 +740,9 @@ static long evtchn_close(struct domain *d1, int port1, bool_t guest)
 
         double_evtchn_unlock(chn1, chn2);
 
+        /* Don't let a later bind of the remote port inherit moderation. */
+        evtchn_moderation_free(chn2);
+
         goto out;
 
     default:
@@ -652,13 +768,14 @@ static long evtchn_close(struct domain *d1, int port1, bool_t guest)
 
 int evtchn_send(struct domain *ld, unsigned int lport)
 {
-    struct evtchn *lchn, *rchn;
-    struct domain *rd;
-    int            rport, ret = 0;
+    struct evtchn *lchn;
+    int            ret = 0;
 
     if ( !port_is_valid(ld, lport) )
         return -EINVAL;
 
+    perfc_dom_incr(dom_evtchn_send);
+
     lchn = evtchn_from_port(ld, lport);
 
     spin_lock(&lchn->lock);
@@ -677,13 +794,8 @@ int evtchn_send(struct domain *ld, unsigned int lport)
     switch ( lchn->state )
     {
     case ECS_INTERDOMAIN:
-        rd    = lchn->u.interdomain.remote_dom;
-        rport = lchn->u.interdomain.remote_port;
-        rchn  = evtchn_from_port(rd, rport);
-        if ( consumer_is_xen(rchn) )
-            xen_notification_fn(rchn)(rd->vcpu[rchn->notify_vcpu_id], rport);
-        else
-            evtchn_port_set_pending(rd, rchn->notify_vcpu_id, rchn);
+        if ( !lchn->moderation || !evtchn_moderate(lchn->moderation) )
+            evtchn_notify_remote(lchn);
         break;
     case ECS_IPI:
         evtchn_port_set_pending(ld, lchn->notify_vcpu_id, lchn);
@@ -1027,6 +1139,64 @@ static long evtchn_set_priority(const struct evtchn_set_priority *set_priority)
     return ret;
 }
 
+static long evtchn_set_moderation(const struct evtchn_set_moderation *set)
+{
+    struct domain *d = current->domain;
+    unsigned int port = set->port;
+    struct evtchn *chn;
+    struct evtchn_moderation *mod;
+    long ret = 0;
+
+    if ( set->window_us > EVTCHN_MODERATION_MAX_WINDOW_US )
+        return -EINVAL;
+
+    spin_lock(&d->event_lock);
+
+    if ( !port_is_valid(d, port) )
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    chn = evtchn_from_port(d, port);
+    if ( chn->state != ECS_INTERDOMAIN || consumer_is_xen(chn) )
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if ( !set->window_us )
+    {
+        evtchn_moderation_free(chn);
+        goto out;
+    }
+
+    mod = chn->moderation;
+    if ( !mod )
+    {
+        mod = xzalloc(struct evtchn_moderation);
+        if ( !mod )
+        {
+            ret = -ENOMEM;
+            goto out;
+        }
+        mod->chn = chn;
+        init_timer(&mod->timer, evtchn_moderation_timer_fn, mod,
+                   smp_processor_id());
+    }
+
+    spin_lock(&chn->lock);
+    mod->window = MICROSECS(set->window_us);
+    mod->count = set->count;
+    chn->moderation = mod;
+    spin_unlock(&chn->lock);
+
+ out:
+    spin_unlock(&d->event_lock);
+
+    return ret;
+}
+
 long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
 {
     long rc;
@@ -1170,6 +1340,14 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_set_moderation: {
+        struct evtchn_set_moderation set_moderation;
+        if ( copy_from_guest(&set_moderation, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_set_moderation(&set_moderation);
+        break;
+    }
+
     default:
         rc = -ENOSYS;
         break;
@@ -17,6 +17,7 @@
 #include <xen/paging.h>
 #include <xen/mm.h>
 #include <xen/domain_page.h>
+#include <xen/perfc.h>
 
 #include <public/event_channel.h>
 
@@ -50,6 +51,15 @@ static void evtchn_fifo_init(struct domain *d, struct evtchn *evtchn)
                  d->domain_id, evtchn->port);
 }
 
+static void lock_queue(struct evtchn_fifo_queue *q, unsigned long *flags)
+{
+    if ( !spin_trylock_irqsave(&q->lock, *flags) )
+    {
+        perfc_incr(evtchn_fifo_queue_contended);
+        spin_lock_irqsave(&q->lock, *flags);
+    }
+}
+
 static struct evtchn_fifo_queue *lock_old_queue(const struct domain *d,
                                                 struct evtchn *evtchn,
                                                 unsigned long *flags)
@@ -63,7 +73,7 @@ static struct evtchn_fifo_queue *lock_old_queue(const struct domain *d,
         v = d->vcpu[evtchn->last_vcpu_id];
         old_q = &v->evtchn_fifo->queue[evtchn->last_priority];
 
-        spin_lock_irqsave(&old_q->lock, *flags);
+        lock_queue(old_q, flags);
 
         v = d->vcpu[evtchn->last_vcpu_id];
         q = &v->evtchn_fifo->queue[evtchn->last_priority];
@@ -72,6 +82,7 @@ static struct evtchn_fifo_queue *lock_old_queue(const struct domain *d,
             return old_q;
 
         spin_unlock_irqrestore(&old_q->lock, *flags);
+        perfc_incr(evtchn_fifo_queue_changed);
     }
 
     gprintk(XENLOG_WARNING,
@@ -93,6 +104,7 @@ static int try_set_link(event_word_t *word, event_word_t *w, uint32_t link)
     if ( *w == old )
         return 1;
 
+    perfc_incr(evtchn_fifo_link_retry);
     return -EAGAIN;
 }
 
@@ -124,6 +136,7 @@ static bool_t evtchn_fifo_set_link(const struct domain *d, event_word_t *word,
         return ret;
 
     /* Lock the word to prevent guest unmasking. */
+    perfc_incr(evtchn_fifo_link_busy);
     set_bit(EVTCHN_FIFO_BUSY, word);
 
     w = read_atomic(word);
@@ -221,7 +234,8 @@ static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
             evtchn->last_priority = evtchn->priority;
 
             spin_unlock_irqrestore(&old_q->lock, flags);
-            spin_lock_irqsave(&q->lock, flags);
+            perfc_incr(evtchn_fifo_queue_moved);
+            lock_queue(q, &flags);
         }
 
         /*
@@ -37,6 +37,7 @@
 #include <xen/paging.h>
 #include <xen/keyhandler.h>
 #include <xen/vmap.h>
+#include <xen/perfc.h>
 #include <xsm/xsm.h>
 #include <asm/flushtlb.h>
 
@@ -186,6 +187,26 @@ static inline void gnttab_flush_tlb(const struct domain *d)
         flush_tlb_mask(d->domain_dirty_cpumask);
 }
 
+/*
+ * IOMMU mapping changes made while unmapping a batch of grants are flushed
+ * from the IOTLB once, with the TLB, before the grants are released.
+ */
+static inline void gnttab_defer_iommu_flush(struct domain *d)
+{
+    if ( gnttab_need_iommu_mapping(d) )
+        this_cpu(iommu_dont_flush_iotlb) = 1;
+}
+
+static inline int gnttab_flush_iommu(struct domain *d)
+{
+    if ( !gnttab_need_iommu_mapping(d) )
+        return 0;
+
+    this_cpu(iommu_dont_flush_iotlb) = 0;
+
+    return iommu_iotlb_flush_all(d);
+}
+
 static inline unsigned int
 num_act_frames_from_sha_frames(const unsigned int num)
 {
@@ -325,6 +346,30 @@ __get_maptrack_handle(
     return head;
 }
 
+static inline void
+put_maptrack_handle(
+    struct grant_table *t, int handle)
+{
+    struct domain *currd = current->domain;
+    struct vcpu *v;
+    unsigned int prev_tail, cur_tail;
+
+    /* 1. Set entry to be a tail. */
+    maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
+
+    /* 2. Add entry to the tail of the list on the original VCPU. */
+    v = currd->vcpu[maptrack_entry(t, handle).vcpu];
+
+    cur_tail = read_atomic(&v->maptrack_tail);
+    do {
+        prev_tail = cur_tail;
+        cur_tail = cmpxchg(&v->maptrack_tail, prev_tail, handle);
+    } while ( cur_tail != prev_tail );
+
+    /* 3. Update the old tail entry to point to the new entry. */
+    write_atomic(&maptrack_entry(t, prev_tail).ref, handle);
+}
+
 /*
  * Try to "steal" a free maptrack entry from another VCPU.
  *
@@ -334,7 +379,13 @@ __get_maptrack_handle(
  * To avoid having to atomically count the number of free entries on
  * each VCPU and to avoid two VCPU repeatedly stealing entries from
  * each other, the initial victim VCPU is selected randomly.
+ *
+ * Once the thief has a free list of its own, up to MAPTRACK_STEAL_BATCH
+ * further entries are moved to it from the same victim, so that a VCPU
+ * which keeps mapping doesn't have to steal on every map.
  */
+#define MAPTRACK_STEAL_BATCH 16
+
 static int steal_maptrack_handle(struct grant_table *t,
                                  const struct vcpu *curr)
 {
@@ -352,7 +403,23 @@ static int steal_maptrack_handle(struct grant_table *t,
             handle = __get_maptrack_handle(t, currd->vcpu[i]);
             if ( handle != -1 )
             {
+                unsigned int n;
+
                 maptrack_entry(t, handle).vcpu = curr->vcpu_id;
+
+                if ( curr->maptrack_tail == MAPTRACK_TAIL )
+                    return handle;
+
+                for ( n = 0; n < MAPTRACK_STEAL_BATCH; n++ )
+                {
+                    int extra = __get_maptrack_handle(t, currd->vcpu[i]);
+
+                    if ( extra == -1 )
+                        break;
+                    maptrack_entry(t, extra).vcpu = curr->vcpu_id;
+                    put_maptrack_handle(t, extra);
+                }
+
                 return handle;
             }
         }
@@ -366,30 +433,6 @@ static int steal_maptrack_handle(struct grant_table *t,
     return -1;
 }
 
-static inline void
-put_maptrack_handle(
-    struct grant_table *t, int handle)
-{
-    struct domain *currd = current->domain;
-    struct vcpu *v;
-    unsigned int prev_tail, cur_tail;
-
-    /* 1. Set entry to be a tail. */
-    maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
-
-    /* 2. Add entry to the tail of the list on the original VCPU. */
-    v = currd->vcpu[maptrack_entry(t, handle).vcpu];
-
-    cur_tail = read_atomic(&v->maptrack_tail);
-    do {
-        prev_tail = cur_tail;
-        cur_tail = cmpxchg(&v->maptrack_tail, prev_tail, handle);
-    } while ( cur_tail != prev_tail );
-
-    /* 3. Update the old tail entry to point to the new entry. */
-    write_atomic(&maptrack_entry(t, prev_tail).ref, handle);
-}
-
 static inline int
 get_maptrack_handle(
     struct grant_table *lgt)
@@ -1332,7 +1375,7 @@ static long
 gnttab_unmap_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_unmap_grant_ref_t) uop, unsigned int count)
 {
-    int i, c, partial_done, done = 0;
+    int i, c, partial_done, done = 0, rc;
     struct gnttab_unmap_grant_ref op;
     struct gnttab_unmap_common common[GNTTAB_UNMAP_BATCH_SIZE];
 
@@ -1340,6 +1383,7 @@ gnttab_unmap_grant_ref(
     {
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
+        gnttab_defer_iommu_flush(current->domain);
 
         for ( i = 0; i < c; i++ )
         {
@@ -1353,10 +1397,14 @@ gnttab_unmap_grant_ref(
         }
 
         gnttab_flush_tlb(current->domain);
+        rc = gnttab_flush_iommu(current->domain);
 
         for ( i = 0; i < partial_done; i++ )
             __gnttab_unmap_common_complete(&(common[i]));
 
+        if ( rc )
+            return rc;
+
         count -= c;
         done += c;
 
@@ -1368,6 +1416,8 @@ gnttab_unmap_grant_ref(
 
 fault:
     gnttab_flush_tlb(current->domain);
+    if ( gnttab_flush_iommu(current->domain) )
+        gdprintk(XENLOG_WARNING, "IOMMU flush after grant unmap failed\n");
 
     for ( i = 0; i < partial_done; i++ )
         __gnttab_unmap_common_complete(&(common[i]));
@@ -1395,7 +1445,7 @@ static long
 gnttab_unmap_and_replace(
     XEN_GUEST_HANDLE_PARAM(gnttab_unmap_and_replace_t) uop, unsigned int count)
 {
-    int i, c, partial_done, done = 0;
+    int i, c, partial_done, done = 0, rc;
     struct gnttab_unmap_and_replace op;
     struct gnttab_unmap_common common[GNTTAB_UNMAP_BATCH_SIZE];
 
@@ -1403,6 +1453,7 @@ gnttab_unmap_and_replace(
     {
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
+        gnttab_defer_iommu_flush(current->domain);
         
         for ( i = 0; i < c; i++ )
         {
@@ -1416,10 +1467,14 @@ gnttab_unmap_and_replace(
         }
         
         gnttab_flush_tlb(current->domain);
+        rc = gnttab_flush_iommu(current->domain);
         
         for ( i = 0; i < partial_done; i++ )
             __gnttab_unmap_common_complete(&(common[i]));
 
+        if ( rc )
+            return rc;
+
         count -= c;
         done += c;
 
@@ -1431,15 +1486,121 @@ gnttab_unmap_and_replace(
 
 fault:
     gnttab_flush_tlb(current->domain);
+    if ( gnttab_flush_iommu(current->domain) )
+        gdprintk(XENLOG_WARNING, "IOMMU flush after grant unmap failed\n");
 
     for ( i = 0; i < partial_done; i++ )
         __gnttab_unmap_common_complete(&(common[i]));
     return -EFAULT;    
 }
 
+/*
+ * Spare frames for growing a grant table.  Allocating and initialising them
+ * before the grant table's write lock gets taken avoids stalling every map
+ * and copy operation on the domain meanwhile; gnttab_grow_table() falls back
+ * to allocating under the lock whatever was not set aside, e.g. because the
+ * table was changed concurrently.
+ */
+void gnttab_prepare_grow(struct domain *d, unsigned int req_nr_frames,
+                         struct gnttab_spare *spare)
+{
+    struct grant_table *gt = d->grant_table;
+    unsigned int cur_frames = read_atomic(&gt->nr_grant_frames);
+    unsigned int cur_status = read_atomic(&gt->nr_status_frames);
+    unsigned int nr_zeroed = 0, nr_active = 0, i, j;
+
+    INIT_PAGE_LIST_HEAD(&spare->zeroed);
+    INIT_PAGE_LIST_HEAD(&spare->active);
+
+    if ( req_nr_frames > max_grant_frames )
+        return;
+
+    if ( req_nr_frames > cur_frames )
+    {
+        nr_zeroed = req_nr_frames - cur_frames;
+        nr_active = num_act_frames_from_sha_frames(req_nr_frames) -
+                    num_act_frames_from_sha_frames(cur_frames);
+    }
+    if ( read_atomic(&gt->gt_version) > 1 &&
+         grant_to_status_frames(req_nr_frames) > cur_status )
+        nr_zeroed += grant_to_status_frames(req_nr_frames) - cur_status;
+
+    for ( i = 0; i < nr_zeroed; i++ )
+    {
+        void *frame = alloc_xenheap_page();
+
+        if ( !frame )
+            return;
+        clear_page(frame);
+        page_list_add(virt_to_page(frame), &spare->zeroed);
+    }
+
+    for ( i = 0; i < nr_active; i++ )
+    {
+        struct active_grant_entry *act = alloc_xenheap_page();
+
+        if ( !act )
+            return;
+        clear_page(act);
+        for ( j = 0; j < ACGNT_PER_PAGE; j++ )
+            spin_lock_init(&act[j].lock);
+        page_list_add(virt_to_page(act), &spare->active);
+    }
+}
+
+void gnttab_release_spare(struct gnttab_spare *spare)
+{
+    struct page_info *pg;
+
+    while ( (pg = page_list_remove_head(&spare->zeroed)) != NULL )
+        free_xenheap_page(page_to_virt(pg));
+    while ( (pg = page_list_remove_head(&spare->active)) != NULL )
+        free_xenheap_page(page_to_virt(pg));
+}
+
+/* A cleared frame for the shared or status table. */
+static void *gnttab_take_frame(struct gnttab_spare *spare)
+{
+    struct page_info *pg = spare ? page_list_remove_head(&spare->zeroed)
+                                 : NULL;
+    void *frame;
+
+    if ( pg )
+        return page_to_virt(pg);
+
+    frame = alloc_xenheap_page();
+    if ( frame )
+        clear_page(frame);
+
+    return frame;
+}
+
+static struct active_grant_entry *gnttab_take_active(
+    struct gnttab_spare *spare)
+{
+    struct page_info *pg = spare ? page_list_remove_head(&spare->active)
+                                 : NULL;
+    struct active_grant_entry *act;
+    unsigned int i;
+
+    if ( pg )
+        return page_to_virt(pg);
+
+    act = alloc_xenheap_page();
+    if ( act )
+    {
+        clear_page(act);
+        for ( i = 0; i < ACGNT_PER_PAGE; i++ )
+            spin_lock_init(&act[i].lock);
+    }
+
+    return act;
+}
+
 static int
 gnttab_populate_status_frames(struct domain *d, struct grant_table *gt,
-                              unsigned int req_nr_frames)
+                              unsigned int req_nr_frames,
+                              struct gnttab_spare *spare)
 {
     unsigned i;
     unsigned req_status_frames;
@@ -1447,9 +1608,8 @@ gnttab_populate_status_frames(struct domain *d, struct grant_table *gt,
     req_status_frames = grant_to_status_frames(req_nr_frames);
     for ( i = nr_status_frames(gt); i < req_status_frames; i++ )
     {
-        if ( (gt->status[i] = alloc_xenheap_page()) == NULL )
+        if ( (gt->status[i] = gnttab_take_frame(spare)) == NULL )
             goto status_alloc_failed;
-        clear_page(gt->status[i]);
     }
     /* Share the new status frames with the recipient domain */
     for ( i = nr_status_frames(gt); i < req_status_frames; i++ )
@@ -1488,14 +1648,16 @@ gnttab_unpopulate_status_frames(struct domain *d, struct grant_table *gt)
 }
 
 /*
- * Grow the grant table. The caller must hold the grant table's
- * write lock before calling this function.
+ * Grow the grant table, using the frames set aside in @spare (which may be
+ * NULL) where possible. The caller must hold the grant table's write lock
+ * before calling this function.
  */
 int
-gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
+gnttab_grow_table(struct domain *d, unsigned int req_nr_frames,
+                  struct gnttab_spare *spare)
 {
     struct grant_table *gt = d->grant_table;
-    unsigned int i, j;
+    unsigned int i;
 
     ASSERT(req_nr_frames <= max_grant_frames);
 
@@ -1507,25 +1669,21 @@ gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
     for ( i = nr_active_grant_frames(gt);
           i < num_act_frames_from_sha_frames(req_nr_frames); i++ )
     {
-        if ( (gt->active[i] = alloc_xenheap_page()) == NULL )
+        if ( (gt->active[i] = gnttab_take_active(spare)) == NULL )
             goto active_alloc_failed;
-        clear_page(gt->active[i]);
-        for ( j = 0; j < ACGNT_PER_PAGE; j++ )
-            spin_lock_init(&gt->active[i][j].lock);
     }
 
     /* Shared */
     for ( i = nr_grant_frames(gt); i < req_nr_frames; i++ )
     {
-        if ( (gt->shared_raw[i] = alloc_xenheap_page()) == NULL )
+        if ( (gt->shared_raw[i] = gnttab_take_frame(spare)) == NULL )
             goto shared_alloc_failed;
-        clear_page(gt->shared_raw[i]);
     }
 
     /* Status pages - version 2 */
     if (gt->gt_version > 1)
     {
-        if ( gnttab_populate_status_frames(d, gt, req_nr_frames) )
+        if ( gnttab_populate_status_frames(d, gt, req_nr_frames, spare) )
             goto shared_alloc_failed;
     }
 
@@ -1553,6 +1711,29 @@ active_alloc_failed:
     return 0;
 }
 
+/* Grow a domain's grant table ahead of its use by the guest. */
+int gnttab_presize(struct domain *d, unsigned int nr_frames)
+{
+    struct grant_table *gt = d->grant_table;
+    struct gnttab_spare spare;
+    int rc = 0;
+
+    if ( nr_frames > max_grant_frames )
+        return -EINVAL;
+
+    gnttab_prepare_grow(d, nr_frames, &spare);
+    grant_write_lock(gt);
+
+    if ( nr_frames > nr_grant_frames(gt) &&
+         !gnttab_grow_table(d, nr_frames, &spare) )
+        rc = -ENOMEM;
+
+    grant_write_unlock(gt);
+    gnttab_release_spare(&spare);
+
+    return rc;
+}
+
 static long 
 gnttab_setup_table(
     XEN_GUEST_HANDLE_PARAM(gnttab_setup_table_t) uop, unsigned int count)
@@ -1560,6 +1741,7 @@ gnttab_setup_table(
     struct gnttab_setup_table op;
     struct domain *d;
     struct grant_table *gt;
+    struct gnttab_spare spare;
     int            i;
     xen_pfn_t  gmfn;
 
@@ -1599,6 +1781,7 @@ gnttab_setup_table(
     }
 
     gt = d->grant_table;
+    gnttab_prepare_grow(d, op.nr_frames, &spare);
     grant_write_lock(gt);
 
     if ( gt->gt_version == 0 )
@@ -1607,7 +1790,7 @@ gnttab_setup_table(
     if ( (op.nr_frames > nr_grant_frames(gt) ||
           ((gt->gt_version > 1) &&
            (grant_to_status_frames(op.nr_frames) > nr_status_frames(gt)))) &&
-         !gnttab_grow_table(d, op.nr_frames) )
+         !gnttab_grow_table(d, op.nr_frames, &spare) )
     {
         gdprintk(XENLOG_INFO,
                  "Expand grant table to %u failed. Current: %u Max: %u\n",
@@ -1628,6 +1811,7 @@ gnttab_setup_table(
 
  out3:
     grant_write_unlock(gt);
+    gnttab_release_spare(&spare);
  out2:
     rcu_unlock_domain(d);
  out1:
@@ -2452,6 +2636,34 @@ static int gnttab_copy_claim_buf(const struct gnttab_copy *op,
     return rc;
 }
 
+/*
+ * A copy which has been checked but not yet done, so that it can be merged
+ * with the next one if that continues it in both pages.
+ */
+struct gnttab_copy_pending {
+    unsigned int src_offset;
+    unsigned int dest_offset;
+    unsigned int len;
+};
+
+static void gnttab_copy_flush(struct gnttab_copy_pending *pending,
+                              struct gnttab_copy_buf *dest,
+                              const struct gnttab_copy_buf *src)
+{
+    if ( !pending->len )
+        return;
+
+    /* Source and destination may overlap if both are the same frame. */
+    if ( src->frame == dest->frame )
+        memmove(dest->virt + pending->dest_offset,
+                src->virt + pending->src_offset, pending->len);
+    else
+        memcpy(dest->virt + pending->dest_offset,
+               src->virt + pending->src_offset, pending->len);
+    gnttab_mark_dirty(dest->domain, dest->frame);
+    pending->len = 0;
+}
+
 static bool_t gnttab_copy_buf_valid(const struct gnttab_copy_ptr *p,
                                     const struct gnttab_copy_buf *b,
                                     bool_t has_gref)
@@ -2465,7 +2677,8 @@ static bool_t gnttab_copy_buf_valid(const struct gnttab_copy_ptr *p,
 
 static int gnttab_copy_buf(const struct gnttab_copy *op,
                            struct gnttab_copy_buf *dest,
-                           const struct gnttab_copy_buf *src)
+                           const struct gnttab_copy_buf *src,
+                           struct gnttab_copy_pending *pending)
 {
     int rc;
 
@@ -2487,9 +2700,24 @@ static int gnttab_copy_buf(const struct gnttab_copy *op,
                  op->dest.offset, dest->ptr.offset,
                  op->len, dest->len);
 
-    memcpy(dest->virt + op->dest.offset, src->virt + op->source.offset,
-           op->len);
-    gnttab_mark_dirty(dest->domain, dest->frame);
+    /*
+     * Copies within a single frame are never merged, as the merged copy could
+     * overwrite source data before reading it.
+     */
+    if ( pending->len && src->frame != dest->frame &&
+         pending->src_offset + pending->len == op->source.offset &&
+         pending->dest_offset + pending->len == op->dest.offset )
+    {
+        perfc_incr(gnttab_copy_coalesced);
+        pending->len += op->len;
+    }
+    else
+    {
+        gnttab_copy_flush(pending, dest, src);
+        pending->src_offset = op->source.offset;
+        pending->dest_offset = op->dest.offset;
+        pending->len = op->len;
+    }
     rc = GNTST_okay;
  out:
     return rc;
@@ -2497,13 +2725,16 @@ static int gnttab_copy_buf(const struct gnttab_copy *op,
 
 static int gnttab_copy_one(const struct gnttab_copy *op,
                            struct gnttab_copy_buf *dest,
-                           struct gnttab_copy_buf *src)
+                           struct gnttab_copy_buf *src,
+                           struct gnttab_copy_pending *pending)
 {
     int rc;
 
     if ( !src->domain || op->source.domid != src->ptr.domid ||
          !dest->domain || op->dest.domid != dest->ptr.domid )
     {
+        perfc_incr(gnttab_copy_lock);
+        gnttab_copy_flush(pending, dest, src);
         gnttab_copy_release_buf(src);
         gnttab_copy_release_buf(dest);
         gnttab_copy_unlock_domains(src, dest);
@@ -2517,23 +2748,31 @@ static int gnttab_copy_one(const struct gnttab_copy *op,
     if ( !gnttab_copy_buf_valid(&op->source, src,
                                 op->flags & GNTCOPY_source_gref) )
     {
+        perfc_incr(gnttab_copy_buf_miss);
+        gnttab_copy_flush(pending, dest, src);
         gnttab_copy_release_buf(src);
         rc = gnttab_copy_claim_buf(op, &op->source, src, GNTCOPY_source_gref);
         if ( rc < 0 )
             goto out;
     }
+    else
+        perfc_incr(gnttab_copy_buf_hit);
 
     /* Different dest? */
     if ( !gnttab_copy_buf_valid(&op->dest, dest,
                                 op->flags & GNTCOPY_dest_gref) )
     {
+        perfc_incr(gnttab_copy_buf_miss);
+        gnttab_copy_flush(pending, dest, src);
         gnttab_copy_release_buf(dest);
         rc = gnttab_copy_claim_buf(op, &op->dest, dest, GNTCOPY_dest_gref);
         if ( rc < 0 )
             goto out;
     }
+    else
+        perfc_incr(gnttab_copy_buf_hit);
 
-    rc = gnttab_copy_buf(op, dest, src);
+    rc = gnttab_copy_buf(op, dest, src, pending);
  out:
     return rc;
 }
@@ -2545,6 +2784,7 @@ static long gnttab_copy(
     struct gnttab_copy op;
     struct gnttab_copy_buf src = {};
     struct gnttab_copy_buf dest = {};
+    struct gnttab_copy_pending pending = {};
     long rc = 0;
 
     for ( i = 0; i < count; i++ )
@@ -2561,9 +2801,10 @@ static long gnttab_copy(
             break;
         }
 
-        op.status = gnttab_copy_one(&op, &dest, &src);
+        op.status = gnttab_copy_one(&op, &dest, &src, &pending);
         if ( op.status != GNTST_okay )
         {
+            gnttab_copy_flush(&pending, &dest, &src);
             gnttab_copy_release_buf(&src);
             gnttab_copy_release_buf(&dest);
         }
@@ -2576,6 +2817,7 @@ static long gnttab_copy(
         guest_handle_add_offset(uop, 1);
     }
 
+    gnttab_copy_flush(&pending, &dest, &src);
     gnttab_copy_release_buf(&src);
     gnttab_copy_release_buf(&dest);
     gnttab_copy_unlock_domains(&src, &dest);
@@ -2630,7 +2872,8 @@ gnttab_set_version(XEN_GUEST_HANDLE_PARAM(gnttab_set_version_t) uop)
         {
     case 1:
             /* XXX: We could maybe shrink the active grant table here. */
-            res = gnttab_populate_status_frames(currd, gt, nr_grant_frames(gt));
+            res = gnttab_populate_status_frames(currd, gt, nr_grant_frames(gt),
+                                                NULL);
             if ( res < 0)
                 goto out_unlock;
         }
@@ -3026,6 +3269,8 @@ do_grant_table_op(
 
     if ( (cmd &= GNTTABOP_CMD_MASK) != GNTTABOP_cache_flush && opaque_in )
         return -EINVAL;
+
+    perfc_dom_incra(dom_gnttab_ops, cmd);
     
     rc = -EFAULT;
     switch ( cmd )
@@ -0,0 +1,187 @@
+/******************************************************************************
+ * lathist.c
+ *
+ * Always-on log2 latency histograms of VM exit handling, hypercalls, vCPU
+ * wakeup to run and softirq raise to handling.  Samples are only ever added
+ * by the CPU owning the histogram, so recording is a timestamp and a plain
+ * increment; unlike the perf counters these are cheap enough to be built in
+ * unconditionally.
+ */
+
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/percpu.h>
+#include <xen/cpumask.h>
+#include <xen/spinlock.h>
+#include <xen/guest_access.h>
+#include <xen/lathist.h>
+#include <xen/softirq.h>
+#include <asm/bitops.h>
+
+bool_t __read_mostly opt_lathist = 1;
+boolean_param("lathist", opt_lathist);
+
+struct lathist {
+    uint64_t bucket[LATHIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct lathist[LATHIST_VMEXIT_NR], vmexit_hists);
+static DEFINE_PER_CPU(struct lathist[LATHIST_HYPERCALL_NR], hypercall_hists);
+static DEFINE_PER_CPU(struct lathist, wakeup_hist);
+static DEFINE_PER_CPU(struct lathist[NR_SOFTIRQS], softirq_hists);
+
+static void lathist_add(struct lathist *h, s_time_t ns)
+{
+    unsigned int b = ns > 0 ? flsl(ns) - 1 : 0;
+
+    h->bucket[min_t(unsigned int, b, LATHIST_BUCKETS - 1)]++;
+}
+
+void lathist_vmexit(unsigned long reason, s_time_t start)
+{
+    if ( !start )
+        return;
+
+    if ( reason >= LATHIST_VMEXIT_NR )
+        reason = LATHIST_VMEXIT_NR - 1;
+
+    lathist_add(&this_cpu(vmexit_hists)[reason], NOW() - start);
+}
+
+void lathist_hypercall(unsigned long nr, s_time_t start)
+{
+    if ( !start || nr >= LATHIST_HYPERCALL_NR )
+        return;
+
+    lathist_add(&this_cpu(hypercall_hists)[nr], NOW() - start);
+}
+
+void lathist_wakeup(s_time_t latency)
+{
+    if ( likely(opt_lathist) )
+        lathist_add(&this_cpu(wakeup_hist), latency);
+}
+
+void lathist_softirq(unsigned int nr, s_time_t raised)
+{
+    if ( !raised )
+        return;
+
+    lathist_add(&this_cpu(softirq_hists)[nr], NOW() - raised);
+}
+
+static struct lathist *lathist_get(unsigned int cpu, unsigned int type,
+                                   unsigned int *nr)
+{
+    switch ( type )
+    {
+    case XEN_SYSCTL_LATHIST_vmexit:
+        *nr = LATHIST_VMEXIT_NR;
+        return per_cpu(vmexit_hists, cpu);
+
+    case XEN_SYSCTL_LATHIST_hypercall:
+        *nr = LATHIST_HYPERCALL_NR;
+        return per_cpu(hypercall_hists, cpu);
+
+    case XEN_SYSCTL_LATHIST_wakeup:
+        *nr = 1;
+        return &per_cpu(wakeup_hist, cpu);
+
+    case XEN_SYSCTL_LATHIST_softirq:
+        *nr = NR_SOFTIRQS;
+        return per_cpu(softirq_hists, cpu);
+    }
+
+    return NULL;
+}
+
+static int lathist_copy(xen_sysctl_lathist_op_t *op)
+{
+    unsigned int cpu, i, j, nr;
+    uint64_t sum[LATHIST_BUCKETS];
+
+    if ( !lathist_get(smp_processor_id(), op->type, &nr) )
+        return -EINVAL;
+
+    if ( !guest_handle_is_null(op->buckets) )
+    {
+        for ( i = 0; i < min(op->nr_hists, nr); i++ )
+        {
+            memset(sum, 0, sizeof(sum));
+
+            for_each_online_cpu ( cpu )
+            {
+                const struct lathist *h = lathist_get(cpu, op->type, &nr) + i;
+
+                for ( j = 0; j < LATHIST_BUCKETS; j++ )
+                    sum[j] += h->bucket[j];
+            }
+
+            if ( copy_to_guest_offset(op->buckets, i * LATHIST_BUCKETS,
+                                      sum, LATHIST_BUCKETS) )
+                return -EFAULT;
+        }
+    }
+
+    op->nr_hists = nr;
+
+    return 0;
+}
+
+static void lathist_reset(void)
+{
+    unsigned int cpu;
+
+    for_each_online_cpu ( cpu )
+    {
+        memset(per_cpu(vmexit_hists, cpu), 0,
+               sizeof(per_cpu(vmexit_hists, cpu)));
+        memset(per_cpu(hypercall_hists, cpu), 0,
+               sizeof(per_cpu(hypercall_hists, cpu)));
+        memset(&per_cpu(wakeup_hist, cpu), 0, sizeof(struct lathist));
+        memset(per_cpu(softirq_hists, cpu), 0,
+               sizeof(per_cpu(softirq_hists, cpu)));
+    }
+}
+
+/* Dom0 control of latency histograms */
+int lathist_control(xen_sysctl_lathist_op_t *op)
+{
+    static DEFINE_SPINLOCK(lock);
+    int rc;
+
+    if ( op->pad )
+        return -EINVAL;
+
+    spin_lock(&lock);
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_LATHIST_reset:
+        lathist_reset();
+        rc = 0;
+        break;
+
+    case XEN_SYSCTL_LATHIST_query:
+        rc = lathist_copy(op);
+        break;
+
+    default:
+        rc = -EINVAL;
+        break;
+    }
+
+    spin_unlock(&lock);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
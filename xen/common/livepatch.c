@@ -7,6 +7,7 @@
 #include <xen/elf.h>
 #include <xen/err.h>
 #include <xen/guest_access.h>
+#include <xen/init.h>
 #include <xen/keyhandler.h>
 #include <xen/lib.h>
 #include <xen/list.h>
@@ -83,6 +84,9 @@ struct livepatch_work
     volatile bool_t do_work;     /* Signals work to do. */
     volatile bool_t ready;       /* Signals all CPUs synchronized. */
     unsigned int cmd;            /* Action request: LIVEPATCH_ACTION_* */
+    bool_t nostop;               /* Patch without stopping the other CPUs. */
+    cpumask_t pending;           /* CPUs yet to pass a quiescent point. */
+    struct payload *volatile poking; /* Payload whose sites are in flux. */
 };
 
 /* There can be only one outstanding patching action. */
@@ -96,6 +100,13 @@ static struct livepatch_work livepatch_work;
  */
 static DEFINE_PER_CPU(bool_t, work_to_do);
 
+/*
+ * Apply and revert payloads while the other CPUs keep running, synchronising
+ * with them only at their quiescent points (see check_for_livepatch_work).
+ */
+static bool_t __read_mostly opt_livepatch_nostop;
+boolean_param("livepatch_nostop", opt_livepatch_nostop);
+
 static int get_name(const xen_livepatch_name_t *name, char *n)
 {
     if ( !name->size || name->size > XEN_LIVEPATCH_NAME_SIZE )
@@ -1001,6 +1012,71 @@ static int livepatch_list(xen_sysctl_livepatch_list_t *list)
  * for XEN_SYSCTL_LIVEPATCH_ACTION operation (see livepatch_action).
  */
 
+static int livepatch_quiesce_cpus(s_time_t timeout, bool_t abortable);
+
+/*
+ * Rewrite the patch sites of a payload without stopping the other CPUs.  The
+ * architecture does so in steps which keep each site executable throughout;
+ * after each step all other CPUs have to pass a quiescent point before the
+ * next one is taken.  The last wait also guarantees that no CPU is still
+ * within the payload's code after a revert.
+ */
+static int poke_payload(struct payload *data, bool_t apply)
+{
+    unsigned int i, step;
+    unsigned long flags;
+    bool_t more = 1;
+    int rc = 0;
+
+    livepatch_work.poking = data;
+    smp_wmb();
+
+    for ( step = 0; more; )
+    {
+        local_irq_save(flags);
+
+        rc = arch_livepatch_quiesce();
+        if ( !rc )
+        {
+            for ( more = 0, i = 0; i < data->nfuncs; i++ )
+                more = arch_livepatch_poke_jmp(&data->funcs[i], apply, step);
+
+            arch_livepatch_revive();
+            step++;
+        }
+
+        local_irq_restore(flags);
+
+        if ( rc && !step )
+            break;
+
+        /*
+         * Once sites are part way through, neither backing out nor carrying
+         * on without the other CPUs is an option, so a failed step is retried.
+         */
+        livepatch_quiesce_cpus(NOW() + livepatch_work.timeout, 0);
+    }
+
+    livepatch_work.poking = NULL;
+
+    return rc;
+}
+
+unsigned long livepatch_poke_target(unsigned long addr)
+{
+    const struct payload *data = livepatch_work.poking;
+    unsigned int i;
+
+    if ( !data )
+        return 0;
+
+    for ( i = 0; i < data->nfuncs; i++ )
+        if ( (unsigned long)data->funcs[i].old_addr == addr )
+            return (unsigned long)data->funcs[i].new_addr;
+
+    return 0;
+}
+
 static int apply_payload(struct payload *data)
 {
     unsigned int i;
@@ -1009,6 +1085,26 @@ static int apply_payload(struct payload *data)
     printk(XENLOG_INFO LIVEPATCH "%s: Applying %u functions\n",
             data->name, data->nfuncs);
 
+    if ( livepatch_work.nostop )
+    {
+        /*
+         * Other CPUs may run the new code as soon as the first site is
+         * rewritten, so its bug frames and fixups have to be known by then.
+         */
+        list_add_tail_rcu(&data->applied_list, &applied_list);
+        register_virtual_region(&data->region);
+
+        rc = poke_payload(data, 1);
+        if ( rc )
+        {
+            printk(XENLOG_ERR LIVEPATCH "%s: unable to quiesce!\n", data->name);
+            unregister_virtual_region(&data->region);
+            list_del_rcu(&data->applied_list);
+        }
+
+        return rc;
+    }
+
     rc = arch_livepatch_quiesce();
     if ( rc )
     {
@@ -1038,18 +1134,26 @@ static int revert_payload(struct payload *data)
 
     printk(XENLOG_INFO LIVEPATCH "%s: Reverting\n", data->name);
 
-    rc = arch_livepatch_quiesce();
+    if ( livepatch_work.nostop )
+        rc = poke_payload(data, 0);
+    else
+    {
+        rc = arch_livepatch_quiesce();
+        if ( !rc )
+        {
+            for ( i = 0; i < data->nfuncs; i++ )
+                arch_livepatch_revert_jmp(&data->funcs[i]);
+
+            arch_livepatch_revive();
+        }
+    }
+
     if ( rc )
     {
         printk(XENLOG_ERR LIVEPATCH "%s: unable to quiesce!\n", data->name);
         return rc;
     }
 
-    for ( i = 0; i < data->nfuncs; i++ )
-        arch_livepatch_revert_jmp(&data->funcs[i]);
-
-    arch_livepatch_revive();
-
     /*
      * We need RCU variant (which has barriers) in case we crash here.
      * The applied_list is iterated by the trap code.
@@ -1062,7 +1166,8 @@ static int revert_payload(struct payload *data)
 
 /*
  * This function is executed having all other CPUs with no deep stack (we may
- * have cpu_idle on it) and IRQs disabled.
+ * have cpu_idle on it) and IRQs disabled, or in nostop mode with IRQs enabled
+ * and the other CPUs running.
  */
 static void livepatch_do_action(void)
 {
@@ -1072,7 +1177,8 @@ static void livepatch_do_action(void)
     data = livepatch_work.data;
     /*
      * This function and the transition from asm to C code should be the only
-     * one on any stack. No need to lock the payload list or applied list.
+     * one on any stack. No need to lock the payload list or applied list,
+     * which livepatch_action() leaves alone while a nostop action runs.
      */
     switch ( livepatch_work.cmd )
     {
@@ -1149,6 +1255,7 @@ static int schedule_work(struct payload *data, uint32_t cmd, uint32_t timeout)
     livepatch_work.cmd = cmd;
     livepatch_work.data = data;
     livepatch_work.timeout = timeout ?: MILLISECS(30);
+    livepatch_work.nostop = opt_livepatch_nostop && arch_livepatch_can_poke();
 
     dprintk(XENLOG_DEBUG, LIVEPATCH "%s: timeout is %"PRI_stime"ms\n",
             data->name, livepatch_work.timeout / MILLISECS(1));
@@ -1173,6 +1280,58 @@ static void reschedule_fn(void *unused)
     raise_softirq(SCHEDULE_SOFTIRQ);
 }
 
+/*
+ * Wait for all other online CPUs to pass through check_for_livepatch_work(),
+ * i.e. the idle loop or the path back to guest context, where no hypervisor
+ * code other than the entry stubs is on their stack.  The IPI merely forces
+ * them there sooner.  Only a wait which happens before anything was changed
+ * may give up.
+ */
+static int livepatch_quiesce_cpus(s_time_t timeout, bool_t abortable)
+{
+    unsigned int cpu = smp_processor_id();
+    bool_t warned = 0;
+
+    cpumask_andnot(&livepatch_work.pending, &cpu_online_map,
+                   cpumask_of(cpu));
+    smp_wmb();
+
+    if ( !cpumask_empty(&livepatch_work.pending) )
+        smp_call_function(reschedule_fn, NULL, 0);
+
+    while ( !cpumask_empty(&livepatch_work.pending) )
+    {
+        if ( NOW() >= timeout && !warned )
+        {
+            printk(XENLOG_ERR LIVEPATCH "%s: Timed out waiting for %u CPUs to quiesce\n",
+                   livepatch_work.data->name,
+                   cpumask_weight(&livepatch_work.pending));
+            if ( abortable )
+                return -EBUSY;
+            warned = 1;
+        }
+        cpu_relax();
+    }
+
+    arch_livepatch_post_action();
+
+    return 0;
+}
+
+/* Acknowledge a quiescent point on behalf of a nostop action's master. */
+static void livepatch_quiescent(unsigned int cpu)
+{
+    per_cpu(work_to_do, cpu) = 0;
+    smp_mb();
+
+    if ( cpumask_test_cpu(cpu, &livepatch_work.pending) )
+    {
+        /* Discard whatever this CPU may have fetched of the old sites. */
+        arch_livepatch_post_action();
+        cpumask_clear_cpu(cpu, &livepatch_work.pending);
+    }
+}
+
 static int livepatch_spin(atomic_t *counter, s_time_t timeout,
                           unsigned int cpus, const char *s)
 {
@@ -1249,6 +1408,20 @@ void check_for_livepatch_work(void)
              */
             return;
         }
+
+        if ( livepatch_work.nostop )
+        {
+            /*
+             * Every CPU has to be responsive before anything is touched, as
+             * the waits once patching has begun cannot be given up on.
+             */
+            if ( livepatch_quiesce_cpus(livepatch_work.timeout + NOW(), 1) )
+                livepatch_work.data->rc = -EBUSY;
+            else
+                livepatch_do_action();
+            goto out;
+        }
+
         /* "Mask" NMIs. */
         arch_livepatch_mask();
 
@@ -1289,6 +1462,7 @@ void check_for_livepatch_work(void)
  abort:
         arch_livepatch_unmask();
 
+ out:
         per_cpu(work_to_do, cpu) = 0;
         livepatch_work.do_work = 0;
 
@@ -1298,6 +1472,8 @@ void check_for_livepatch_work(void)
         printk(XENLOG_INFO LIVEPATCH "%s finished %s with rc=%d\n",
                p->name, names[livepatch_work.cmd], p->rc);
     }
+    else if ( livepatch_work.nostop )
+        livepatch_quiescent(cpu);
     else
     {
         /* Wait for all CPUs to rendezvous. */
@@ -1402,6 +1578,13 @@ static int livepatch_action(xen_sysctl_livepatch_action_t *action)
         goto out;
     }
 
+    /* A nostop action walks the payloads while this CPU keeps running. */
+    if ( livepatch_work.do_work && livepatch_work.nostop )
+    {
+        rc = -EBUSY;
+        goto out;
+    }
+
     switch ( action->cmd )
     {
     case LIVEPATCH_ACTION_UNLOAD:
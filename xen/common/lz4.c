@@ -0,0 +1,21 @@
+/*
+ * lz4.c -- LZ4 compressor and decompressor for runtime use
+ *
+ * The boot-time decompressor (unlz4.c) and tmem share this copy, much as
+ * unlzo.c and tmem share lzo.c.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <xen/kernel.h>
+#include <xen/lib.h>
+#include <xen/lz4.h>
+#include <xen/string.h>
+#include <xen/types.h>
+
+#define INIT
+
+#include "lz4/compress.c"
+#include "lz4/decompress.c"
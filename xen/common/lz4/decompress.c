@@ -147,7 +147,13 @@ static int INIT lz4_uncompress(const unsigned char *source, unsigned char *dest,
 				goto _output_error;
 			continue;
 		}
-		if (unlikely((unsigned long)cpy < (unsigned long)op))
+		/*
+		 * op has already been advanced by STEPSIZE, so matches shorter
+		 * than that legitimately end up to STEPSIZE - 4 bytes before it.
+		 * cpy is lower only if op + length wrapped around.
+		 */
+		if (unlikely((unsigned long)cpy <
+			     (unsigned long)op - (STEPSIZE - 4)))
 			goto _output_error;
 		LZ4_SECURECOPY(ref, op, cpy);
 		op = cpy; /* correction */
@@ -279,7 +285,13 @@ static int lz4_uncompress_unknownoutputsize(const unsigned char *source,
 				goto _output_error;
 			continue;
 		}
-		if (unlikely((unsigned long)cpy < (unsigned long)op))
+		/*
+		 * op has already been advanced by STEPSIZE, so matches shorter
+		 * than that legitimately end up to STEPSIZE - 4 bytes before it.
+		 * cpy is lower only if op + length wrapped around.
+		 */
+		if (unlikely((unsigned long)cpy <
+			     (unsigned long)op - (STEPSIZE - 4)))
 			goto _output_error;
 		LZ4_SECURECOPY(ref, op, cpy);
 		op = cpy; /* correction */
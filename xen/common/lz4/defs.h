@@ -8,6 +8,9 @@
  * published by the Free Software Foundation.
  */
 
+#ifndef __LZ4_DEFS_H__
+#define __LZ4_DEFS_H__
+
 #ifdef __XEN__
 #include <asm/byteorder.h>
 #endif
@@ -32,6 +35,17 @@ static inline u32 INIT get_unaligned_le32(const void *p)
 #define LZ4_ARCH64 0
 #endif
 
+/*
+ * glibc's <endian.h> unconditionally defines __BIG_ENDIAN as one of the
+ * possible values of __BYTE_ORDER, so only rely on its mere presence when
+ * __BYTE_ORDER isn't around (i.e. when building Xen itself).
+ */
+#if defined(__BYTE_ORDER) ? __BYTE_ORDER == __BIG_ENDIAN : defined(__BIG_ENDIAN)
+#define LZ4_BIG_ENDIAN 1
+#else
+#define LZ4_BIG_ENDIAN 0
+#endif
+
 /*
  * Architecture-specific macros
  */
@@ -121,7 +135,7 @@ typedef struct _U64_S { u64 v; } U64_S;
 	} while (0)
 #define HTYPE u32
 
-#ifdef __BIG_ENDIAN
+#if LZ4_BIG_ENDIAN
 #define LZ4_NBCOMMONBYTES(val) (__builtin_clzll(val) >> 3)
 #else
 #define LZ4_NBCOMMONBYTES(val) (__builtin_ctzll(val) >> 3)
@@ -146,7 +160,7 @@ typedef struct _U64_S { u64 v; } U64_S;
 #define LZ4_SECURECOPY	LZ4_WILDCOPY
 #define HTYPE const u8*
 
-#ifdef __BIG_ENDIAN
+#if LZ4_BIG_ENDIAN
 #define LZ4_NBCOMMONBYTES(val) (__builtin_clz(val) >> 3)
 #else
 #define LZ4_NBCOMMONBYTES(val) (__builtin_ctz(val) >> 3)
@@ -168,3 +182,5 @@ typedef struct _U64_S { u64 v; } U64_S;
 		LZ4_WILDCOPY(s, d, e);	\
 		d = e;	\
 	} while (0)
+
+#endif /* __LZ4_DEFS_H__ */
@@ -23,11 +23,105 @@
 #include <xen/sched.h>
 #include <xen/guest_access.h>
 #include <xen/hypercall.h>
+#include <xen/kconfig.h>
+#include <xen/mem_access.h>
+#include <xen/perfc.h>
 #include <xen/vm_event.h>
 #include <public/memory.h>
 #include <asm/p2m.h>
 #include <xsm/xsm.h>
 
+unsigned int mem_access_filter_check(const struct domain *d,
+                                     unsigned long gfn, unsigned int access,
+                                     unsigned long ip)
+{
+    const struct mem_access_filter *f = d->vm_event->access_filter;
+    unsigned int i;
+
+    ASSERT(current->domain == d);
+
+    if ( likely(!f) )
+        return XENMEM_access_filter_event;
+
+    for ( i = 0; i < f->nr; i++ )
+    {
+        const xen_mem_access_filter_t *e = &f->ent[i];
+
+        if ( !(e->access_mask & access) ||
+             gfn < e->gfn_start || gfn > e->gfn_end ||
+             ip < e->ip_start || ip > e->ip_end )
+            continue;
+
+        if ( e->action != XENMEM_access_filter_event )
+            perfc_incr(mem_access_filtered);
+
+        return e->action;
+    }
+
+    return XENMEM_access_filter_event;
+}
+
+static int mem_access_set_filter(struct domain *d,
+                                 const xen_mem_access_op_t *mao)
+{
+    XEN_GUEST_HANDLE_PARAM(xen_mem_access_filter_t) list =
+        guest_handle_from_ptr((unsigned long)mao->filter_list,
+                              xen_mem_access_filter_t);
+    struct mem_access_filter *f = NULL;
+    unsigned int i;
+
+    if ( mao->nr > XENMEM_ACCESS_FILTER_MAX )
+        return -E2BIG;
+
+    if ( mao->nr )
+    {
+        f = xmalloc_bytes(sizeof(*f) + mao->nr * sizeof(f->ent[0]));
+        if ( !f )
+            return -ENOMEM;
+
+        f->nr = mao->nr;
+        if ( copy_from_guest(f->ent, list, mao->nr) )
+        {
+            xfree(f);
+            return -EFAULT;
+        }
+
+        for ( i = 0; i < f->nr; i++ )
+        {
+            const xen_mem_access_filter_t *e = &f->ent[i];
+
+            if ( (e->access_mask & ~(XENMEM_ACCESS_FILTER_R |
+                                     XENMEM_ACCESS_FILTER_W |
+                                     XENMEM_ACCESS_FILTER_X)) ||
+                 e->action > XENMEM_access_filter_notify ||
+                 e->gfn_start > e->gfn_end || e->ip_start > e->ip_end ||
+                 e->pad0 || e->pad1 )
+            {
+                xfree(f);
+                return -EINVAL;
+            }
+        }
+    }
+
+    /*
+     * The table is only read by vCPUs of the domain, on the fault path, so
+     * having them all descheduled makes the swap safe.
+     */
+    domain_pause(d);
+    f = xchg(&d->vm_event->access_filter, f);
+    domain_unpause(d);
+
+    xfree(f);
+
+    return 0;
+}
+
+void mem_access_filter_destroy(struct domain *d)
+{
+    xfree(d->vm_event->access_filter);
+    d->vm_event->access_filter = NULL;
+}
+
 int mem_access_memop(unsigned long cmd,
                      XEN_GUEST_HANDLE_PARAM(xen_mem_access_op_t) arg)
 {
@@ -98,6 +192,18 @@ int mem_access_memop(unsigned long cmd,
         break;
     }
 
+    case XENMEM_access_op_set_filter:
+        rc = -ENOSYS;
+        if ( unlikely(start_iter) )
+            break;
+
+        rc = -EOPNOTSUPP;
+        if ( !is_hvm_domain(d) || !IS_ENABLED(CONFIG_X86) )
+            break;
+
+        rc = mem_access_set_filter(d, &mao);
+        break;
+
     default:
         rc = -ENOSYS;
         break;
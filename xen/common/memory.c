@@ -24,6 +24,7 @@
 #include <xen/numa.h>
 #include <xen/mem_access.h>
 #include <xen/trace.h>
+#include <xen/vmap.h>
 #include <asm/current.h>
 #include <asm/hardirq.h>
 #include <asm/p2m.h>
@@ -533,20 +534,47 @@ static long memory_exchange(XEN_GUEST_HANDLE_PARAM(xen_memory_exchange_t) arg)
          * Success! Beyond this point we cannot fail for this chunk.
          */
 
-        /* Destroy final reference to each input page. */
-        while ( (page = page_list_remove_head(&in_chunk_list)) )
+#ifdef CONFIG_HAS_PASSTHROUGH
+        /*
+         * Rather than once per page, flush the IOTLB once for all the input
+         * pages, before any of them can be reused, and once for all the
+         * output pages.
+         */
+        if ( need_iommu(d) )
+            this_cpu(iommu_dont_flush_iotlb) = 1;
+#endif
+
+        /* Unmap the input pages... */
+        page_list_for_each ( page, &in_chunk_list )
         {
             unsigned long gfn;
 
-            if ( !test_and_clear_bit(_PGC_allocated, &page->count_info) )
-                BUG();
             mfn = page_to_mfn(page);
             gfn = mfn_to_gmfn(d, mfn);
             /* Pages were unshared above */
             BUG_ON(SHARED_M2P(gfn));
             guest_physmap_remove_page(d, _gfn(gfn), _mfn(mfn), 0);
+        }
+
+#ifdef CONFIG_HAS_PASSTHROUGH
+        if ( need_iommu(d) )
+        {
+            int ret = iommu_iotlb_flush_all(d);
+
+            if ( unlikely(ret) && !rc )
+                rc = ret;
+        }
+#endif
+
+        /* ...and destroy their final references, under one heap_lock. */
+        free_domheap_batch_begin();
+        while ( (page = page_list_remove_head(&in_chunk_list)) )
+        {
+            if ( !test_and_clear_bit(_PGC_allocated, &page->count_info) )
+                BUG();
             put_page(page);
         }
+        free_domheap_batch_end();
 
         /* Assign each output page to the domain. */
         for ( j = 0; (page = page_list_remove_head(&out_chunk_list)); ++j )
@@ -577,6 +605,9 @@ static long memory_exchange(XEN_GUEST_HANDLE_PARAM(xen_memory_exchange_t) arg)
                     put_domain(d);
 
                 free_domheap_pages(page, exch.out.extent_order);
+#ifdef CONFIG_HAS_PASSTHROUGH
+                this_cpu(iommu_dont_flush_iotlb) = 0;
+#endif
                 goto dying;
             }
 
@@ -602,6 +633,19 @@ static long memory_exchange(XEN_GUEST_HANDLE_PARAM(xen_memory_exchange_t) arg)
             }
         }
         BUG_ON( !(d->is_dying) && (j != (1UL << out_chunk_order)) );
+
+#ifdef CONFIG_HAS_PASSTHROUGH
+        if ( need_iommu(d) )
+        {
+            int ret;
+
+            this_cpu(iommu_dont_flush_iotlb) = 0;
+
+            ret = iommu_iotlb_flush_all(d);
+            if ( unlikely(ret) && !rc )
+                rc = ret;
+        }
+#endif
     }
 
     exch.nr_exchanged = exch.in.nr_extents;
@@ -872,6 +916,7 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
     long rc;
     struct xen_memory_reservation reservation;
     struct memop_args args;
+    struct memop_cursor *cursor;
     domid_t domid;
     unsigned long start_extent = cmd >> MEMOP_EXTENT_SHIFT;
     int op = cmd & MEMOP_CMD_MASK;
@@ -881,34 +926,55 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
     case XENMEM_increase_reservation:
     case XENMEM_decrease_reservation:
     case XENMEM_populate_physmap:
-        if ( copy_from_guest(&reservation, arg, 1) )
-            return start_extent;
+        cursor = &current->memop_cursor;
+        if ( start_extent && cursor->cmd == cmd &&
+             cursor->arg == (unsigned long)arg.p )
+        {
+            /* Continuation of our own preempted call: resume from cursor. */
+            cursor->cmd = 0;
+
+            d = rcu_lock_domain_by_any_id(cursor->domid);
+            if ( d == NULL )
+                return start_extent;
+            args.domain       = d;
+            args.extent_list  = cursor->extent_list;
+            args.nr_extents   = cursor->nr_extents;
+            args.extent_order = cursor->extent_order;
+            args.memflags     = cursor->memflags;
+        }
+        else
+        {
+            cursor->cmd = 0;
 
-        /* Is size too large for us to encode a continuation? */
-        if ( reservation.nr_extents > (UINT_MAX >> MEMOP_EXTENT_SHIFT) )
-            return start_extent;
+            if ( copy_from_guest(&reservation, arg, 1) )
+                return start_extent;
 
-        if ( unlikely(start_extent >= reservation.nr_extents) )
-            return start_extent;
+            /* Is size too large for us to encode a continuation? */
+            if ( reservation.nr_extents > (UINT_MAX >> MEMOP_EXTENT_SHIFT) )
+                return start_extent;
 
-        d = rcu_lock_domain_by_any_id(reservation.domid);
-        if ( d == NULL )
-            return start_extent;
-        args.domain = d;
+            if ( unlikely(start_extent >= reservation.nr_extents) )
+                return start_extent;
 
-        if ( construct_memop_from_reservation(&reservation, &args) )
-        {
-            rcu_unlock_domain(d);
-            return start_extent;
+            d = rcu_lock_domain_by_any_id(reservation.domid);
+            if ( d == NULL )
+                return start_extent;
+            args.domain = d;
+
+            if ( construct_memop_from_reservation(&reservation, &args) )
+            {
+                rcu_unlock_domain(d);
+                return start_extent;
+            }
+
+            if ( op == XENMEM_populate_physmap
+                 && (reservation.mem_flags & XENMEMF_populate_on_demand) )
+                args.memflags |= MEMF_populate_on_demand;
         }
 
         args.nr_done   = start_extent;
         args.preempted = 0;
 
-        if ( op == XENMEM_populate_physmap
-             && (reservation.mem_flags & XENMEMF_populate_on_demand) )
-            args.memflags |= MEMF_populate_on_demand;
-
         if ( xsm_memory_adjust_reservation(XSM_TARGET, curr_d, d) )
         {
             rcu_unlock_domain(d);
@@ -928,10 +994,29 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
             break;
         }
 
-        rcu_unlock_domain(d);
-
         rc = args.nr_done;
 
+        /*
+         * Compat callers come through here with a translated copy of their
+         * arguments, which gets rebuilt for every chunk, so don't cache it.
+         */
+        if ( args.preempted
+#ifdef CONFIG_COMPAT
+             && !is_compat_arg_xlat_range(arg.p, sizeof(reservation))
+#endif
+           )
+        {
+            cursor->cmd          = op | (rc << MEMOP_EXTENT_SHIFT);
+            cursor->arg          = (unsigned long)arg.p;
+            cursor->extent_list  = args.extent_list;
+            cursor->nr_extents   = args.nr_extents;
+            cursor->extent_order = args.extent_order;
+            cursor->memflags     = args.memflags;
+            cursor->domid        = d->domain_id;
+        }
+
+        rcu_unlock_domain(d);
+
         if ( args.preempted )
             return hypercall_create_continuation(
                 __HYPERVISOR_memory_op, "lh",
@@ -1346,13 +1431,11 @@ void destroy_ring_for_helper(
     }
 }
 
-int prepare_ring_for_helper(
-    struct domain *d, unsigned long gmfn, struct page_info **_page,
-    void **_va)
+static int get_page_for_helper(
+    struct domain *d, unsigned long gmfn, struct page_info **_page)
 {
     struct page_info *page;
     p2m_type_t p2mt;
-    void *va;
 
     page = get_page_from_gfn(d, gmfn, &p2mt, P2M_UNSHARE);
 
@@ -1383,6 +1466,23 @@ int prepare_ring_for_helper(
         return -EINVAL;
     }
 
+    *_page = page;
+
+    return 0;
+}
+
+int prepare_ring_for_helper(
+    struct domain *d, unsigned long gmfn, struct page_info **_page,
+    void **_va)
+{
+    struct page_info *page;
+    void *va;
+    int rc;
+
+    rc = get_page_for_helper(d, gmfn, &page);
+    if ( rc )
+        return rc;
+
     va = __map_domain_page_global(page);
     if ( va == NULL )
     {
@@ -1396,6 +1496,60 @@ int prepare_ring_for_helper(
     return 0;
 }
 
+void destroy_ring_frames_for_helper(
+    void **_va, struct page_info **pages, unsigned int nr)
+{
+    void *va = *_va;
+    unsigned int i;
+
+    if ( va != NULL )
+    {
+        vunmap(va);
+        for ( i = 0; i < nr; i++ )
+            put_page_and_type(pages[i]);
+        *_va = NULL;
+    }
+}
+
+/* Like prepare_ring_for_helper(), but maps nr consecutive gfns together. */
+int prepare_ring_frames_for_helper(
+    struct domain *d, unsigned long gmfn, unsigned int nr,
+    struct page_info **pages, void **_va)
+{
+    mfn_t *mfns = xmalloc_array(mfn_t, nr);
+    unsigned int i;
+    void *va;
+    int rc = -ENOMEM;
+
+    if ( !mfns )
+        return -ENOMEM;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        rc = get_page_for_helper(d, gmfn + i, &pages[i]);
+        if ( rc )
+            goto err;
+        mfns[i] = _mfn(page_to_mfn(pages[i]));
+    }
+
+    rc = -ENOMEM;
+    va = vmap(mfns, nr);
+    if ( va == NULL )
+        goto err;
+
+    xfree(mfns);
+    *_va = va;
+
+    return 0;
+
+ err:
+    while ( i-- )
+        put_page_and_type(pages[i]);
+    xfree(mfns);
+
+    return rc;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -21,6 +21,7 @@
 
 #include <xen/event.h>
 #include <xen/monitor.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/vm_event.h>
 #include <xsm/xsm.h>
@@ -87,6 +88,21 @@ int monitor_domctl(struct domain *d, struct xen_domctl_monitor_op *mop)
     return 0;
 }
 
+static void monitor_fill_request(struct vcpu *v, vm_event_request_t *req)
+{
+    struct domain *d = v->domain;
+
+    req->vcpu_id = v->vcpu_id;
+
+    if ( altp2m_active(d) )
+    {
+        req->flags |= VM_EVENT_FLAG_ALTERNATE_P2M;
+        req->altp2m_idx = altp2m_vcpu_idx(v);
+    }
+
+    vm_event_fill_regs(req);
+}
+
 int monitor_traps(struct vcpu *v, bool_t sync, vm_event_request_t *req)
 {
     int rc;
@@ -107,8 +123,6 @@ int monitor_traps(struct vcpu *v, bool_t sync, vm_event_request_t *req)
         return rc;
     };
 
-    req->vcpu_id = v->vcpu_id;
-
     if ( sync )
     {
         req->flags |= VM_EVENT_FLAG_VCPU_PAUSED;
@@ -116,18 +130,26 @@ int monitor_traps(struct vcpu *v, bool_t sync, vm_event_request_t *req)
         rc = 1;
     }
 
-    if ( altp2m_active(d) )
-    {
-        req->flags |= VM_EVENT_FLAG_ALTERNATE_P2M;
-        req->altp2m_idx = altp2m_vcpu_idx(v);
-    }
-
-    vm_event_fill_regs(req);
+    monitor_fill_request(v, req);
     vm_event_put_request(d, &d->vm_event->monitor, req);
 
     return rc;
 }
 
+/*
+ * Deliver a record-only event.  The vCPU always continues executing
+ * normally, even when the record had to be dropped.
+ */
+void monitor_record(struct vcpu *v, vm_event_request_t *req)
+{
+    struct domain *d = v->domain;
+
+    monitor_fill_request(v, req);
+
+    if ( vm_event_put_record(d, &d->vm_event->monitor, req) == -EBUSY )
+        perfc_incr(monitor_records_dropped);
+}
+
 void monitor_guest_request(void)
 {
     struct vcpu *curr = current;
@@ -33,12 +33,19 @@ static void trace_multicall_call(multicall_entry_t *call)
     __trace_multicall_call(call);
 }
 
+/* Entries copied in from and back out to the guest at a time. */
+#define MC_BATCH            8
+/* Interval at which batches look for pending work to be preempted by. */
+#define MC_PREEMPT_INTERVAL MICROSECS(20)
+
 ret_t
 do_multicall(
     XEN_GUEST_HANDLE_PARAM(multicall_entry_t) call_list, uint32_t nr_calls)
 {
     struct mc_state *mcs = &current->mc_state;
-    uint32_t         i;
+    struct multicall_entry batch[MC_BATCH];
+    uint32_t         i = 0, j, n;
+    s_time_t         now, next_check = 0;
     int              rc = 0;
 
     if ( unlikely(__test_and_set_bit(_MCSF_in_multicall, &mcs->flags)) )
@@ -50,36 +57,54 @@ do_multicall(
     if ( unlikely(!guest_handle_okay(call_list, nr_calls)) )
         rc = -EFAULT;
 
-    for ( i = 0; !rc && i < nr_calls; i++ )
+    while ( !rc && i < nr_calls )
     {
-        if ( i && hypercall_preempt_check() )
-            goto preempted;
+        if ( i && (now = NOW()) >= next_check )
+        {
+            if ( hypercall_preempt_check() )
+                goto preempted;
+            next_check = now + MC_PREEMPT_INTERVAL;
+        }
 
-        if ( unlikely(__copy_from_guest(&mcs->call, call_list, 1)) )
+        n = min_t(uint32_t, nr_calls - i, MC_BATCH);
+        if ( unlikely(__copy_from_guest(batch, call_list, n)) )
         {
             rc = -EFAULT;
             break;
         }
 
-        trace_multicall_call(&mcs->call);
+        for ( j = 0; j < n; j++ )
+        {
+            mcs->call = batch[j];
+
+            trace_multicall_call(&mcs->call);
+
+            arch_do_multicall_call(mcs);
 
-        arch_do_multicall_call(mcs);
+            if ( unlikely(mcs->flags & MCSF_call_preempted) )
+                break;
 
+            batch[j].result = mcs->call.result;
 #ifndef NDEBUG
-        {
             /*
              * Deliberately corrupt the contents of the multicall structure.
              * The caller must depend only on the 'result' field on return.
              */
-            struct multicall_entry corrupt;
-            memset(&corrupt, 0xAA, sizeof(corrupt));
-            (void)__copy_to_guest(call_list, &corrupt, 1);
-        }
+            memset(&batch[j].op, 0xAA, sizeof(batch[j].op));
+            memset(batch[j].args, 0xAA, sizeof(batch[j].args));
 #endif
+        }
 
-        if ( unlikely(__copy_field_to_guest(call_list, &mcs->call, result)) )
+        /* Write back the completed entries in one go. */
+        if ( unlikely(j && __copy_to_guest(call_list, batch, j)) )
+        {
             rc = -EFAULT;
-        else if ( mcs->flags & MCSF_call_preempted )
+            break;
+        }
+        guest_handle_add_offset(call_list, j);
+        i += j;
+
+        if ( mcs->flags & MCSF_call_preempted )
         {
             /* Translate sub-call continuation to guest layout */
             xlat_multicall_entry(mcs);
@@ -89,8 +114,6 @@ do_multicall(
                 goto preempted;
             rc = -EFAULT;
         }
-        else
-            guest_handle_add_offset(call_list, 1);
     }
 
     perfc_incr(calls_to_multicall);
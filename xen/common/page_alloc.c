@@ -135,6 +135,7 @@
 #include <xen/numa.h>
 #include <xen/nodemask.h>
 #include <xen/event.h>
+#include <xen/cpu.h>
 #include <xen/tmem.h>
 #include <xen/tmem_xen.h>
 #include <public/sysctl.h>
@@ -177,6 +178,13 @@ size_param("bootscrub_chunk", opt_bootscrub_chunk);
 static unsigned int dma_bitsize;
 integer_param("dma_bits", dma_bitsize);
 
+/*
+ * Maximum number of single pages held in each CPU's page cache, 0 to
+ * disable the caches.
+ */
+static unsigned int __read_mostly opt_pcp_high = 64;
+integer_param("pcp_high", opt_pcp_high);
+
 #define round_pgdown(_p)  ((_p)&PAGE_MASK)
 #define round_pgup(_p)    (((_p)+(PAGE_SIZE-1))&PAGE_MASK)
 
@@ -386,6 +394,23 @@ static heap_by_zone_and_order_t *_heap[MAX_NUMNODES];
 static unsigned long *avail[MAX_NUMNODES];
 static long total_avail_pages;
 
+/* Free pages, per node, which still need scrubbing. Protected by heap_lock. */
+static unsigned long node_need_scrub[MAX_NUMNODES];
+
+/*
+ * Chunk taken off its heap list by the idle scrubber on this CPU, while
+ * heap_lock is dropped to scrub it. Its head's order is set to
+ * SCRUBBING_ORDER meanwhile, so that it is never merged with a buddy.
+ * Protected by heap_lock.
+ */
+#define SCRUBBING_ORDER (~0U)
+struct scrub_chunk {
+    struct page_info *head;
+    unsigned int order;
+    bool_t tainted;         /* Page(s) offlined while off the heap lists? */
+};
+static DEFINE_PER_CPU(struct scrub_chunk, scrub_chunk);
+
 /* TMEM: Reserve a fraction of memory for mid-size (0<order<9) allocations.*/
 static long midsize_alloc_zone_pages;
 #define MIDSIZE_ALLOC_FRAC 128
@@ -683,13 +708,32 @@ static void check_low_mem_virq(void)
     }
 }
 
+/*
+ * Put a free chunk on its heap list. Clean chunks go at the head, and ones
+ * which may need scrubbing at the tail, so that allocations find clean
+ * memory first and the idle scrubber finds dirty memory first.
+ */
+static void page_list_add_scrub(struct page_info *pg, unsigned int node,
+                                unsigned int zone, unsigned int order,
+                                unsigned int first_dirty)
+{
+    PFN_ORDER(pg) = order;
+    pg->u.free.first_dirty = first_dirty;
+
+    if ( first_dirty != INVALID_DIRTY_IDX )
+        page_list_add_tail(pg, &heap(node, zone, order));
+    else
+        page_list_add(pg, &heap(node, zone, order));
+}
+
 /* Allocate 2^@order contiguous pages. */
 static struct page_info *alloc_heap_pages(
     unsigned int zone_lo, unsigned int zone_hi,
     unsigned int order, unsigned int memflags,
     struct domain *d)
 {
-    unsigned int i, j, zone = 0, nodemask_retry = 0;
+    unsigned int i, j, zone = 0, nodemask_retry = 0, first_dirty;
+    unsigned int dirty_cnt = 0;
     nodeid_t first_node, node = MEMF_get_node(memflags), req_node = node;
     unsigned long request = 1UL << order;
     struct page_info *pg;
@@ -756,10 +800,21 @@ static struct page_info *alloc_heap_pages(
             if ( !avail[node] || (avail[node][zone] < request) )
                 continue;
 
-            /* Find smallest order which can satisfy the request. */
+            /*
+             * Find smallest order which can satisfy the request, preferring
+             * clean chunks (which are at the head of their list).
+             */
             for ( j = order; j <= MAX_ORDER; j++ )
-                if ( (pg = page_list_remove_head(&heap(node, zone, j))) )
+                if ( !page_list_empty(&heap(node, zone, j)) &&
+                     (pg = page_list_first(&heap(node, zone, j)))->u.free
+                     .first_dirty == INVALID_DIRTY_IDX )
                     goto found;
+            for ( j = order; j <= MAX_ORDER; j++ )
+                if ( !page_list_empty(&heap(node, zone, j)) )
+                {
+                    pg = page_list_first(&heap(node, zone, j));
+                    goto found;
+                }
         } while ( zone-- > zone_lo ); /* careful: unsigned zone may wrap */
 
         if ( (memflags & MEMF_exact_node) && req_node != NUMA_NO_NODE )
@@ -803,12 +858,22 @@ static struct page_info *alloc_heap_pages(
     return NULL;
 
  found: 
+    page_list_del(pg, &heap(node, zone, j));
+    first_dirty = pg->u.free.first_dirty;
+
     /* We may have to halve the chunk a number of times. */
     while ( j != order )
     {
-        PFN_ORDER(pg) = --j;
-        page_list_add_tail(pg, &heap(node, zone, j));
+        j--;
+        page_list_add_scrub(pg, node, zone, j,
+                            (first_dirty < (1U << j)) ? first_dirty
+                                                      : INVALID_DIRTY_IDX);
         pg += 1 << j;
+
+        /* The upper half may be dirty from its start, conservatively. */
+        if ( first_dirty != INVALID_DIRTY_IDX )
+            first_dirty = (first_dirty < (1U << j)) ? 0
+                                                    : first_dirty - (1U << j);
     }
 
     ASSERT(avail[node][zone] >= request);
@@ -824,8 +889,13 @@ static struct page_info *alloc_heap_pages(
     for ( i = 0; i < (1 << order); i++ )
     {
         /* Reference count must continuously be zero for free pages. */
-        BUG_ON(pg[i].count_info != PGC_state_free);
-        pg[i].count_info = PGC_state_inuse;
+        BUG_ON((pg[i].count_info & ~PGC_need_scrub) != PGC_state_free);
+
+        /* Keep PGC_need_scrub, to scrub the page once heap_lock is dropped. */
+        if ( pg[i].count_info & PGC_need_scrub )
+            dirty_cnt++;
+        pg[i].count_info = PGC_state_inuse |
+                           (pg[i].count_info & PGC_need_scrub);
 
         if ( pg[i].u.free.need_tlbflush &&
              (pg[i].tlbflush_timestamp <= tlbflush_current_time()) &&
@@ -846,8 +916,17 @@ static struct page_info *alloc_heap_pages(
         flush_page_to_ram(page_to_mfn(&pg[i]));
     }
 
+    ASSERT(node_need_scrub[node] >= dirty_cnt);
+    node_need_scrub[node] -= dirty_cnt;
+
     spin_unlock(&heap_lock);
 
+    /* No clean memory was left: scrub the chunk on demand. */
+    if ( dirty_cnt )
+        for ( i = 0; i < (1 << order); i++ )
+            if ( test_and_clear_bit(_PGC_need_scrub, &pg[i].count_info) )
+                scrub_one_page(&pg[i]);
+
     if ( need_tlbflush )
     {
         cpumask_t mask = cpu_online_map;
@@ -910,8 +989,10 @@ static int reserve_offlined_page(struct page_info *head)
             {
             merge:
                 /* We don't consider merging outside the head_order. */
-                page_list_add_tail(cur_head, &heap(node, zone, cur_order));
-                PFN_ORDER(cur_head) = cur_order;
+                page_list_add_scrub(cur_head, node, zone, cur_order,
+                                    (head->u.free.first_dirty !=
+                                     INVALID_DIRTY_IDX) ? 0
+                                                        : INVALID_DIRTY_IDX);
                 cur_head += (1 << cur_order);
                 break;
             }
@@ -927,6 +1008,10 @@ static int reserve_offlined_page(struct page_info *head)
         total_avail_pages--;
         ASSERT(total_avail_pages >= 0);
 
+        /* PGC_need_scrub stays with the page, to be honoured by online_page. */
+        if ( cur_head->count_info & PGC_need_scrub )
+            node_need_scrub[node]--;
+
         page_list_add_tail(cur_head,
                            test_bit(_PGC_broken, &cur_head->count_info) ?
                            &page_broken_list : &page_offlined_list);
@@ -937,18 +1022,77 @@ static int reserve_offlined_page(struct page_info *head)
     return count;
 }
 
-/* Free 2^@order set of pages. */
-static void free_heap_pages(
-    struct page_info *pg, unsigned int order)
+/*
+ * Put the free 2^@order chunk @pg back on the heap lists, merging it with its
+ * free buddies as far as possible, and remove any of its pages offlined in
+ * the meantime if @tainted is set. Caller must hold heap_lock.
+ */
+static void add_free_chunk(struct page_info *pg, unsigned int node,
+                           unsigned int zone, unsigned int order,
+                           unsigned int first_dirty, bool_t tainted)
+{
+    unsigned long mask;
+
+    ASSERT(spin_is_locked(&heap_lock));
+
+    /* Merge chunks as far as possible. */
+    while ( order < MAX_ORDER )
+    {
+        mask = 1UL << order;
+
+        if ( (page_to_mfn(pg) & mask) )
+        {
+            /* Merge with predecessor block? */
+            if ( !mfn_valid(page_to_mfn(pg-mask)) ||
+                 !page_state_is(pg-mask, free) ||
+                 (PFN_ORDER(pg-mask) != order) ||
+                 (phys_to_nid(page_to_maddr(pg-mask)) != node) )
+                break;
+            pg -= mask;
+            page_list_del(pg, &heap(node, zone, order));
+            if ( pg->u.free.first_dirty != INVALID_DIRTY_IDX )
+                first_dirty = pg->u.free.first_dirty;
+            else if ( first_dirty != INVALID_DIRTY_IDX )
+                first_dirty += mask;
+        }
+        else
+        {
+            /* Merge with successor block? */
+            if ( !mfn_valid(page_to_mfn(pg+mask)) ||
+                 !page_state_is(pg+mask, free) ||
+                 (PFN_ORDER(pg+mask) != order) ||
+                 (phys_to_nid(page_to_maddr(pg+mask)) != node) )
+                break;
+            page_list_del(pg + mask, &heap(node, zone, order));
+            if ( first_dirty == INVALID_DIRTY_IDX &&
+                 (pg + mask)->u.free.first_dirty != INVALID_DIRTY_IDX )
+                first_dirty = mask + (pg + mask)->u.free.first_dirty;
+        }
+
+        order++;
+    }
+
+    page_list_add_scrub(pg, node, zone, order, first_dirty);
+
+    if ( tainted )
+        reserve_offlined_page(pg);
+}
+
+/*
+ * Free 2^@order set of pages, which need scrubbing before reuse if
+ * @need_scrub is set. Caller must hold heap_lock.
+ */
+static void __free_heap_pages(
+    struct page_info *pg, unsigned int order, bool_t need_scrub)
 {
-    unsigned long mask, mfn = page_to_mfn(pg);
+    unsigned long mfn = page_to_mfn(pg);
     unsigned int i, node = phys_to_nid(page_to_maddr(pg)), tainted = 0;
     unsigned int zone = page_to_zone(pg);
+    unsigned int first_dirty = INVALID_DIRTY_IDX;
 
     ASSERT(order <= MAX_ORDER);
     ASSERT(node >= 0);
-
-    spin_lock(&heap_lock);
+    ASSERT(spin_is_locked(&heap_lock));
 
     for ( i = 0; i < (1 << order); i++ )
     {
@@ -967,7 +1111,8 @@ static void free_heap_pages(
         pg[i].count_info =
             ((pg[i].count_info & PGC_broken) |
              (page_state_is(&pg[i], offlining)
-              ? PGC_state_offlined : PGC_state_free));
+              ? PGC_state_offlined : PGC_state_free) |
+             (need_scrub ? PGC_need_scrub : 0));
         if ( page_state_is(&pg[i], offlined) )
             tainted = 1;
 
@@ -983,47 +1128,68 @@ static void free_heap_pages(
 
     avail[node][zone] += 1 << order;
     total_avail_pages += 1 << order;
+    if ( need_scrub )
+    {
+        node_need_scrub[node] += 1 << order;
+        first_dirty = 0;
+    }
 
     if ( tmem_enabled() )
         midsize_alloc_zone_pages = max(
             midsize_alloc_zone_pages, total_avail_pages / MIDSIZE_ALLOC_FRAC);
 
-    /* Merge chunks as far as possible. */
-    while ( order < MAX_ORDER )
+    add_free_chunk(pg, node, zone, order, first_dirty, tainted);
+}
+
+/* Free 2^@order set of pages. */
+static void free_heap_pages(
+    struct page_info *pg, unsigned int order, bool_t need_scrub)
+{
+    spin_lock(&heap_lock);
+    __free_heap_pages(pg, order, need_scrub);
+    spin_unlock(&heap_lock);
+}
+
+/*
+ * Return a list of single pages, needing scrubbing if @need_scrub is set, to
+ * the heap under one acquisition of heap_lock.  Runs of contiguous pages are
+ * freed as the largest aligned chunks they contain, which saves most of the
+ * buddy merging work.
+ */
+static void free_heap_page_list(struct page_list_head *list, bool_t need_scrub)
+{
+    struct page_info *pg, *next;
+    unsigned long run;
+    unsigned int order;
+
+    spin_lock(&heap_lock);
+
+    while ( !page_list_empty(list) )
     {
-        mask = 1UL << order;
+        pg = page_list_first(list);
 
-        if ( (page_to_mfn(pg) & mask) )
-        {
-            /* Merge with predecessor block? */
-            if ( !mfn_valid(page_to_mfn(pg-mask)) ||
-                 !page_state_is(pg-mask, free) ||
-                 (PFN_ORDER(pg-mask) != order) ||
-                 (phys_to_nid(page_to_maddr(pg-mask)) != node) )
-                break;
-            pg -= mask;
-            page_list_del(pg, &heap(node, zone, order));
-        }
-        else
+        /* Length of the run of contiguous pages starting at pg. */
+        for ( run = 1, next = pg;
+              run < (1UL << MAX_ORDER) && next != page_list_last(list) &&
+              (next = page_list_next(next, list)) == pg + run; run++ )
+            continue;
+
+        for ( order = 0; order < MAX_ORDER; order++ )
         {
-            /* Merge with successor block? */
-            if ( !mfn_valid(page_to_mfn(pg+mask)) ||
-                 !page_state_is(pg+mask, free) ||
-                 (PFN_ORDER(pg+mask) != order) ||
-                 (phys_to_nid(page_to_maddr(pg+mask)) != node) )
+            unsigned long nr = 1UL << (order + 1);
+
+            if ( nr > run || (page_to_mfn(pg) & (nr - 1)) ||
+                 page_to_zone(pg) != page_to_zone(pg + nr - 1) ||
+                 phys_to_nid(page_to_maddr(pg)) !=
+                 phys_to_nid(page_to_maddr(pg + nr - 1)) )
                 break;
-            page_list_del(pg + mask, &heap(node, zone, order));
         }
 
-        order++;
+        for ( run = 0; run < (1UL << order); run++ )
+            page_list_del(pg + run, list);
+        __free_heap_pages(pg, order, need_scrub);
     }
 
-    PFN_ORDER(pg) = order;
-    page_list_add_tail(pg, &heap(node, zone, order));
-
-    if ( tainted )
-        reserve_offlined_page(pg);
-
     spin_unlock(&heap_lock);
 }
 
@@ -1083,6 +1249,19 @@ static int reserve_heap_page(struct page_info *pg)
         }
     }
 
+    /* Page of a chunk being scrubbed? Reserve it once the chunk is back. */
+    for_each_online_cpu ( i )
+    {
+        struct scrub_chunk *sc = &per_cpu(scrub_chunk, i);
+
+        if ( sc->head && (sc->head <= pg) &&
+             (sc->head + (1UL << sc->order) > pg) )
+        {
+            sc->tainted = 1;
+            return 0;
+        }
+    }
+
     return -EINVAL;
 
 }
@@ -1244,7 +1423,7 @@ unsigned int online_page(unsigned long mfn, uint32_t *status)
     spin_unlock(&heap_lock);
 
     if ( (y & PGC_state) == PGC_state_offlined )
-        free_heap_pages(pg, 0);
+        free_heap_pages(pg, 0, !!(y & PGC_need_scrub));
 
     return ret;
 }
@@ -1313,7 +1492,7 @@ static void init_heap_pages(
             nr_pages -= n;
         }
 
-        free_heap_pages(pg+i, 0);
+        free_heap_pages(pg+i, 0, 0);
     }
 }
 
@@ -1583,6 +1762,126 @@ void __init scrub_heap_pages(void)
     setup_low_mem_virq();
 }
 
+/* Number of pages to scrub with heap_lock dropped, at most. */
+#define SCRUB_BATCH 16
+
+/*
+ * Scrub the tail chunk of one heap list of @node, which must need scrubbing.
+ * The chunk is taken off its list and heap_lock is dropped while scrubbing
+ * it, SCRUB_BATCH pages at a time. Returns with the chunk back on the heap,
+ * either fully clean or partially scrubbed if work became pending in the
+ * meantime. Called with heap_lock held, which is dropped and re-taken
+ * meanwhile, so the caller must not rely on heap state read before.
+ */
+static void scrub_free_chunk(struct page_info *head, unsigned int node,
+                             unsigned int zone, unsigned int order)
+{
+    unsigned int cpu = smp_processor_id();
+    struct scrub_chunk *sc = &per_cpu(scrub_chunk, cpu);
+    unsigned int i = head->u.free.first_dirty, cnt;
+    bool_t tainted, skipped = 0;
+
+    ASSERT(spin_is_locked(&heap_lock));
+
+    page_list_del(head, &heap(node, zone, order));
+    PFN_ORDER(head) = SCRUBBING_ORDER;
+    sc->head = head;
+    sc->order = order;
+    sc->tainted = 0;
+
+    while ( i < (1U << order) )
+    {
+        spin_unlock(&heap_lock);
+
+        for ( cnt = 0;
+              i < (1U << order) && cnt < SCRUB_BATCH && !softirq_pending(cpu);
+              i++ )
+        {
+            /*
+             * Pages offlined meanwhile keep PGC_need_scrub, for online_page
+             * to honour.  reserve_offlined_page() takes them off the heap
+             * and out of node_need_scrub once the chunk is back.
+             */
+            if ( !page_state_is(&head[i], free) )
+                skipped = 1;
+            else if ( test_and_clear_bit(_PGC_need_scrub,
+                                         &head[i].count_info) )
+            {
+                scrub_one_page(&head[i]);
+                cnt++;
+            }
+        }
+
+        spin_lock(&heap_lock);
+
+        ASSERT(node_need_scrub[node] >= cnt);
+        node_need_scrub[node] -= cnt;
+
+        if ( !cpu_is_haltable(cpu) )
+            break;
+    }
+
+    tainted = sc->tainted || skipped;
+    sc->head = NULL;
+
+    add_free_chunk(head, node, zone, order,
+                   i < (1U << order) ? i : INVALID_DIRTY_IDX, tainted);
+}
+
+/*
+ * Called from the idle loop: scrub free pages of the local node, or of a
+ * node without online CPUs if the local one is clean, until a softirq or
+ * other work is pending on this CPU.  Returns whether any work was done, in
+ * which case the caller should check for pending work again rather than
+ * going to sleep.
+ */
+bool_t scrub_free_pages(void)
+{
+    unsigned int cpu = smp_processor_id();
+    unsigned int zone, order;
+    nodeid_t node = cpu_to_node(cpu), n;
+    struct page_info *pg;
+    bool_t scrubbed = 0;
+
+    if ( !node_need_scrub[node] )
+    {
+        node = NUMA_NO_NODE;
+        for_each_online_node ( n )
+            if ( node_need_scrub[n] && cpumask_empty(&node_to_cpumask(n)) )
+            {
+                node = n;
+                break;
+            }
+        if ( node == NUMA_NO_NODE )
+            return 0;
+    }
+
+    spin_lock(&heap_lock);
+
+    for ( zone = 0; zone < NR_ZONES && cpu_is_haltable(cpu); zone++ )
+    {
+        for ( order = MAX_ORDER + 1; order-- > 0 && cpu_is_haltable(cpu); )
+        {
+            /* Dirty chunks are kept at the tail of each list. */
+            while ( node_need_scrub[node] &&
+                    !page_list_empty(&heap(node, zone, order)) &&
+                    (pg = page_list_last(&heap(node, zone, order)))->u.free
+                    .first_dirty != INVALID_DIRTY_IDX )
+            {
+                scrub_free_chunk(pg, node, zone, order);
+                scrubbed = 1;
+
+                if ( !cpu_is_haltable(cpu) )
+                    break;
+            }
+        }
+    }
+
+    spin_unlock(&heap_lock);
+
+    return scrubbed;
+}
+
 
 
 /*************************
@@ -1639,7 +1938,7 @@ void free_xenheap_pages(void *v, unsigned int order)
 
     memguard_guard_range(v, 1 << (order + PAGE_SHIFT));
 
-    free_heap_pages(virt_to_page(v), order);
+    free_heap_pages(virt_to_page(v), order, 0);
 }
 
 #else
@@ -1693,12 +1992,9 @@ void free_xenheap_pages(void *v, unsigned int order)
     pg = virt_to_page(v);
 
     for ( i = 0; i < (1u << order); i++ )
-    {
-        scrub_one_page(&pg[i]);
         pg[i].count_info &= ~PGC_xen_heap;
-    }
 
-    free_heap_pages(pg, order);
+    free_heap_pages(pg, order, 1);
 }
 
 #endif
@@ -1724,6 +2020,282 @@ void init_domheap_pages(paddr_t ps, paddr_t pe)
     init_heap_pages(mfn_to_page(smfn), emfn - smfn);
 }
 
+/*
+ * Per-CPU page caches.
+ *
+ * Each CPU keeps up to opt_pcp_high single pages of its own node, taken from
+ * or returned to the heap PCP_BATCH pages at a time, so that most order-0
+ * domheap allocations and frees do not touch heap_lock.  Cached pages are
+ * accounted as allocated by the heap (and stay in PGC_state_inuse), so the
+ * buddy lists and claims never see them; they are added back in only when
+ * reporting free memory.  A cache's lock is only contended when it's
+ * drained from another CPU.
+ */
+#define PCP_BATCH_ORDER 4
+#define PCP_BATCH       (1U << PCP_BATCH_ORDER)
+
+struct page_cache {
+    spinlock_t lock;
+    struct page_list_head list;
+    unsigned int count, high;
+    /* Statistics, for tuning opt_pcp_high. */
+    unsigned long hits, refills, drains;
+};
+static DEFINE_PER_CPU(struct page_cache, page_cache);
+
+static unsigned int page_cache_zone_lo(void)
+{
+    unsigned int zone = dma_bitsize ? bits_to_zone(dma_bitsize) + 1
+                                    : MEMZONE_XEN + 1;
+
+    return max_t(unsigned int, zone, MEMZONE_XEN + 1);
+}
+
+/* Return @nr pages from the tail (the coldest end) of @pc to the heap. */
+static void page_cache_drain(struct page_cache *pc, unsigned int nr)
+{
+    PAGE_LIST_HEAD(list);
+    struct page_info *pg;
+    bool_t need_tlbflush = 0;
+    uint32_t tlbflush_timestamp = 0;
+
+    ASSERT(spin_is_locked(&pc->lock));
+
+    if ( !nr )
+        return;
+
+    while ( nr-- && !page_list_empty(&pc->list) )
+    {
+        pg = page_list_last(&pc->list);
+        page_list_del(pg, &pc->list);
+        pc->count--;
+        if ( pg->u.free.need_tlbflush &&
+             (pg->tlbflush_timestamp <= tlbflush_current_time()) &&
+             (!need_tlbflush ||
+              (pg->tlbflush_timestamp > tlbflush_timestamp)) )
+        {
+            need_tlbflush = 1;
+            tlbflush_timestamp = pg->tlbflush_timestamp;
+        }
+        page_list_add(pg, &list);
+    }
+
+    /*
+     * The heap records the TLB flush requirement of a page from its owner,
+     * which is gone by now: do any pending flush here instead.
+     */
+    if ( need_tlbflush )
+    {
+        cpumask_t mask = cpu_online_map;
+
+        tlbflush_filter(mask, tlbflush_timestamp);
+        if ( !cpumask_empty(&mask) )
+        {
+            perfc_incr(need_flush_tlb_flush);
+            flush_tlb_mask(&mask);
+        }
+    }
+
+    free_heap_page_list(&list, 0);
+    pc->drains++;
+}
+
+/* Empty the page caches of all CPUs.  Returns whether any page was freed. */
+static bool_t page_cache_drain_all(void)
+{
+    unsigned int cpu;
+    bool_t drained = 0;
+
+    for_each_online_cpu ( cpu )
+    {
+        struct page_cache *pc = &per_cpu(page_cache, cpu);
+
+        if ( !pc->count )
+            continue;
+
+        spin_lock(&pc->lock);
+        if ( pc->count )
+        {
+            page_cache_drain(pc, pc->count);
+            drained = 1;
+        }
+        spin_unlock(&pc->lock);
+    }
+
+    return drained;
+}
+
+/* Number of pages held in the page caches of @node, or of all nodes. */
+static unsigned long page_cache_pages(int node)
+{
+    unsigned long pages = 0;
+    unsigned int cpu;
+
+    for_each_online_cpu ( cpu )
+        if ( node < 0 || cpu_to_node(cpu) == node )
+            pages += per_cpu(page_cache, cpu).count;
+
+    return pages;
+}
+
+static struct page_info *page_cache_alloc(
+    struct domain *d, unsigned int memflags)
+{
+    struct page_cache *pc = &this_cpu(page_cache);
+    nodeid_t node = cpu_to_node(smp_processor_id());
+    nodeid_t req_node = MEMF_get_node(memflags);
+    struct page_info *pg;
+    unsigned int i;
+
+    if ( !pc->high )
+        return NULL;
+
+    /* Only serve requests which the local node could satisfy anyway. */
+    if ( req_node != NUMA_NO_NODE
+         ? req_node != node
+         : (d && !node_isset(node, d->node_affinity)) )
+        return NULL;
+
+    spin_lock(&pc->lock);
+
+    if ( !pc->count )
+    {
+        pg = alloc_heap_pages(page_cache_zone_lo(), NR_ZONES - 1,
+                              PCP_BATCH_ORDER,
+                              MEMF_node(node) | MEMF_exact_node, NULL);
+        if ( !pg )
+        {
+            spin_unlock(&pc->lock);
+            return NULL;
+        }
+
+        /* alloc_heap_pages() did any TLB flush these pages needed. */
+        for ( i = 0; i < PCP_BATCH; i++ )
+        {
+            pg[i].u.free.need_tlbflush = 0;
+            page_list_add_tail(&pg[i], &pc->list);
+        }
+        pc->count = PCP_BATCH;
+        pc->refills++;
+    }
+
+    for ( ; ; )
+    {
+        pg = page_list_remove_head(&pc->list);
+        pc->count--;
+
+        if ( likely(pg->count_info == PGC_state_inuse) )
+            break;
+
+        /* Being offlined: let the heap deal with it. */
+        pg->u.free.need_tlbflush = 0;
+        free_heap_pages(pg, 0, 0);
+
+        if ( !pc->count )
+        {
+            spin_unlock(&pc->lock);
+            return NULL;
+        }
+    }
+
+    pc->hits++;
+
+    spin_unlock(&pc->lock);
+
+    if ( pg->u.free.need_tlbflush &&
+         (pg->tlbflush_timestamp <= tlbflush_current_time()) )
+    {
+        cpumask_t mask = cpu_online_map;
+
+        tlbflush_filter(mask, pg->tlbflush_timestamp);
+        if ( !cpumask_empty(&mask) )
+        {
+            perfc_incr(need_flush_tlb_flush);
+            flush_tlb_mask(&mask);
+        }
+    }
+
+    pg->u.inuse.type_info = 0;
+    flush_page_to_ram(page_to_mfn(pg));
+
+    return pg;
+}
+
+/* Put a single, clean page into the local page cache, if it belongs there. */
+static bool_t page_cache_free(struct page_info *pg)
+{
+    struct page_cache *pc = &this_cpu(page_cache);
+
+    if ( !pc->high || pg->count_info != PGC_state_inuse ||
+         phys_to_nid(page_to_maddr(pg)) != cpu_to_node(smp_processor_id()) ||
+         page_to_zone(pg) < page_cache_zone_lo() )
+        return 0;
+
+    /* If a page has no owner it will need no safety TLB flush. */
+    pg->u.free.need_tlbflush = (page_get_owner(pg) != NULL);
+    if ( pg->u.free.need_tlbflush )
+        pg->tlbflush_timestamp = tlbflush_current_time();
+
+    /* This page is not a guest frame any more. */
+    page_set_owner(pg, NULL); /* set_gpfn_from_mfn snoops pg owner */
+    set_gpfn_from_mfn(page_to_mfn(pg), INVALID_M2P_ENTRY);
+
+    spin_lock(&pc->lock);
+
+    /* Most recently freed pages are the most likely to be cache hot. */
+    page_list_add(pg, &pc->list);
+    if ( ++pc->count > pc->high )
+        page_cache_drain(pc, pc->count - pc->high / 2);
+
+    spin_unlock(&pc->lock);
+
+    return 1;
+}
+
+static int cpu_page_cache_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+    struct page_cache *pc = &per_cpu(page_cache, cpu);
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        spin_lock_init(&pc->lock);
+        INIT_PAGE_LIST_HEAD(&pc->list);
+        pc->count = 0;
+        pc->high = opt_pcp_high;
+        break;
+    case CPU_DEAD:
+        spin_lock(&pc->lock);
+        pc->high = 0;
+        page_cache_drain(pc, pc->count);
+        spin_unlock(&pc->lock);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_page_cache_nfb = {
+    .notifier_call = cpu_page_cache_callback
+};
+
+static int __init page_cache_init(void)
+{
+    void *cpu = (void *)(long)smp_processor_id();
+
+    if ( opt_pcp_high && opt_pcp_high < 2 * PCP_BATCH )
+        opt_pcp_high = 2 * PCP_BATCH;
+
+    cpu_page_cache_callback(&cpu_page_cache_nfb, CPU_UP_PREPARE, cpu);
+    register_cpu_notifier(&cpu_page_cache_nfb);
+
+    return 0;
+}
+presmp_initcall(page_cache_init);
 
 int assign_pages(
     struct domain *d,
@@ -1784,6 +2356,7 @@ struct page_info *alloc_domheap_pages(
     struct page_info *pg = NULL;
     unsigned int bits = memflags >> _MEMF_bits, zone_hi = NR_ZONES - 1;
     unsigned int dma_zone;
+    bool_t drained = 0;
 
     ASSERT(!in_irq());
 
@@ -1795,25 +2368,67 @@ struct page_info *alloc_domheap_pages(
     if ( memflags & MEMF_no_owner )
         memflags |= MEMF_no_refcount;
 
-    if ( dma_bitsize && ((dma_zone = bits_to_zone(dma_bitsize)) < zone_hi) )
+    if ( order == 0 && zone_hi == NR_ZONES - 1 )
+        pg = page_cache_alloc(d, memflags);
+
+ retry:
+    if ( (pg == NULL) &&
+         dma_bitsize && ((dma_zone = bits_to_zone(dma_bitsize)) < zone_hi) )
         pg = alloc_heap_pages(dma_zone + 1, zone_hi, order, memflags, d);
 
     if ( (pg == NULL) &&
          ((memflags & MEMF_no_dma) ||
           ((pg = alloc_heap_pages(MEMZONE_XEN + 1, zone_hi, order,
                                   memflags, d)) == NULL)) )
-         return NULL;
+    {
+        /* The memory may be sitting in page caches. */
+        if ( !drained && (drained = page_cache_drain_all()) )
+            goto retry;
+        return NULL;
+    }
 
     if ( d && !(memflags & MEMF_no_owner) &&
          assign_pages(d, pg, order, memflags) )
     {
-        free_heap_pages(pg, order);
+        free_heap_pages(pg, order, 0);
         return NULL;
     }
     
     return pg;
 }
 
+/*
+ * Single pages freed between free_domheap_batch_begin() and
+ * free_domheap_batch_end() on a CPU are collected, and returned to the heap
+ * FREE_BATCH_MAX at a time.  This is meant for bulk frees such as the
+ * relinquishing of a dying domain's memory.
+ */
+#define FREE_BATCH_MAX 512
+static DEFINE_PER_CPU(struct page_list_head, free_batch);
+static DEFINE_PER_CPU(unsigned int, free_batch_count);
+static DEFINE_PER_CPU(bool_t, free_batch_active);
+
+static void free_domheap_batch_flush(void)
+{
+    free_heap_page_list(&this_cpu(free_batch), 1);
+    this_cpu(free_batch_count) = 0;
+}
+
+void free_domheap_batch_begin(void)
+{
+    ASSERT(!this_cpu(free_batch_active));
+    if ( !this_cpu(free_batch).next )
+        INIT_PAGE_LIST_HEAD(&this_cpu(free_batch));
+    this_cpu(free_batch_active) = 1;
+}
+
+void free_domheap_batch_end(void)
+{
+    ASSERT(this_cpu(free_batch_active));
+    this_cpu(free_batch_active) = 0;
+    free_domheap_batch_flush();
+}
+
 void free_domheap_pages(struct page_info *pg, unsigned int order)
 {
     struct domain *d = page_get_owner(pg);
@@ -1875,11 +2490,15 @@ void free_domheap_pages(struct page_info *pg, unsigned int order)
             scrub = 1;
         }
 
-        if ( unlikely(scrub) )
-            for ( i = 0; i < (1 << order); i++ )
-                scrub_one_page(&pg[i]);
-
-        free_heap_pages(pg, order);
+        /* Scrubbing is left to the idle loop, or the next allocation. */
+        if ( scrub && this_cpu(free_batch_active) && order == 0 )
+        {
+            page_list_add_tail(pg, &this_cpu(free_batch));
+            if ( ++this_cpu(free_batch_count) >= FREE_BATCH_MAX )
+                free_domheap_batch_flush();
+        }
+        else if ( scrub || order || !page_cache_free(pg) )
+            free_heap_pages(pg, order, scrub);
     }
 
     if ( drop_dom_ref )
@@ -1904,19 +2523,38 @@ unsigned long avail_domheap_pages(void)
 {
     return avail_heap_pages(MEMZONE_XEN + 1,
                             NR_ZONES - 1,
-                            -1);
+                            -1) + page_cache_pages(-1);
 }
 
 unsigned long avail_node_heap_pages(unsigned int nodeid)
 {
-    return avail_heap_pages(MEMZONE_XEN, NR_ZONES -1, nodeid);
+    return avail_heap_pages(MEMZONE_XEN, NR_ZONES -1, nodeid) +
+           page_cache_pages(nodeid);
+}
+
+/* Free pages, included in the counts above, which still need scrubbing. */
+unsigned long avail_scrub_pages(void)
+{
+    unsigned long pages = 0;
+    unsigned int node;
+
+    for_each_online_node ( node )
+        pages += node_need_scrub[node];
+
+    return pages;
+}
+
+unsigned long avail_node_scrub_pages(unsigned int nodeid)
+{
+    return node_need_scrub[nodeid];
 }
 
 
 static void pagealloc_info(unsigned char key)
 {
-    unsigned int zone = MEMZONE_XEN;
+    unsigned int zone = MEMZONE_XEN, cpu;
     unsigned long n, total = 0;
+    unsigned long cached = 0, hits = 0, refills = 0, drains = 0;
 
     printk("Physical memory information:\n");
     printk("    Xen heap: %lukB free\n",
@@ -1938,6 +2576,19 @@ static void pagealloc_info(unsigned char key)
     }
 
     printk("    Dom heap: %lukB free\n", total << (PAGE_SHIFT-10));
+    printk("    Unscrubbed: %lukB\n", avail_scrub_pages() << (PAGE_SHIFT-10));
+
+    for_each_online_cpu ( cpu )
+    {
+        const struct page_cache *pc = &per_cpu(page_cache, cpu);
+
+        cached += pc->count;
+        hits += pc->hits;
+        refills += pc->refills;
+        drains += pc->drains;
+    }
+    printk("    Page caches: %lukB cached, %lu hits, %lu refills, %lu drains\n",
+           cached << (PAGE_SHIFT-10), hits, refills, drains);
 }
 
 static __init int pagealloc_keyhandler_init(void)
@@ -6,6 +6,7 @@
 #include <xen/keyhandler.h> 
 #include <xen/spinlock.h>
 #include <xen/mm.h>
+#include <xen/sched.h>
 #include <xen/guest_access.h>
 #include <public/sysctl.h>
 #include <asm/perfc.h>
@@ -26,8 +27,34 @@ static const struct {
 
 #define NR_PERFCTRS (sizeof(perfc_info) / sizeof(perfc_info[0]))
 
+static const typeof(perfc_info[0]) perfc_dom_info[] = {
+#include <xen/perfc_dom_defn.h>
+};
+
+#define NR_DOM_PERFCTRS ARRAY_SIZE(perfc_dom_info)
+
 DEFINE_PER_CPU(perfc_t[NUM_PERFCOUNTERS], perfcounters);
 
+/* Keep the counters of perfc_dom_defn.h for every vCPU. */
+static bool_t __read_mostly opt_perfc_domain;
+boolean_param("perfc_domain", opt_perfc_domain);
+
+int perfc_init_vcpu(struct vcpu *v)
+{
+    if ( !opt_perfc_domain || is_idle_vcpu(v) )
+        return 0;
+
+    v->perfc = xzalloc_array(perfc_t, NUM_DOM_PERFCOUNTERS);
+
+    return v->perfc ? 0 : -ENOMEM;
+}
+
+void perfc_destroy_vcpu(struct vcpu *v)
+{
+    xfree(v->perfc);
+    v->perfc = NULL;
+}
+
 void perfc_printall(unsigned char key)
 {
     unsigned int i, j;
@@ -149,6 +176,19 @@ void perfc_reset(unsigned char key)
         }
     }
 
+    if ( opt_perfc_domain )
+    {
+        struct domain *d;
+        struct vcpu *v;
+
+        rcu_read_lock(&domlist_read_lock);
+        for_each_domain ( d )
+            for_each_vcpu ( d, v )
+                if ( v->perfc )
+                    memset(v->perfc, 0, NUM_DOM_PERFCOUNTERS * sizeof(perfc_t));
+        rcu_read_unlock(&domlist_read_lock);
+    }
+
     arch_perfc_reset();
 }
 
@@ -240,6 +280,79 @@ static int perfc_copy_info(XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc,
     return 0;
 }
 
+/*
+ * Counters of one domain: single counters have a value per vCPU, arrays are
+ * summed over the vCPUs.
+ */
+static int perfc_copy_dom_info(xen_sysctl_perfc_op_t *pc)
+{
+    struct domain *d;
+    struct vcpu *v;
+    xen_sysctl_perfc_desc_t desc;
+    xen_sysctl_perfc_val_t *vals;
+    unsigned int i, j, k, nr_vals = 0;
+    int rc = 0;
+
+    if ( !opt_perfc_domain )
+        return -EOPNOTSUPP;
+
+    if ( (d = rcu_lock_domain_by_id(pc->domid)) == NULL )
+        return -ESRCH;
+
+    for ( i = 0; i < NR_DOM_PERFCTRS; i++ )
+        nr_vals += perfc_dom_info[i].type == TYPE_ARRAY
+                   ? perfc_dom_info[i].nr_elements : d->max_vcpus;
+
+    pc->nr_counters = NR_DOM_PERFCTRS;
+    pc->nr_vals = nr_vals;
+
+    if ( guest_handle_is_null(pc->desc) )
+        goto out;
+
+    if ( (vals = xzalloc_array(xen_sysctl_perfc_val_t, nr_vals)) == NULL )
+    {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    for ( i = j = nr_vals = 0; i < NR_DOM_PERFCTRS; i++ )
+    {
+        memset(&desc, 0, sizeof(desc));
+        safe_strcpy(desc.name, perfc_dom_info[i].name);
+
+        if ( perfc_dom_info[i].type == TYPE_ARRAY )
+        {
+            desc.nr_vals = perfc_dom_info[i].nr_elements;
+            for_each_vcpu ( d, v )
+                if ( v->perfc )
+                    for ( k = 0; k < desc.nr_vals; k++ )
+                        vals[nr_vals + k] += v->perfc[j + k];
+        }
+        else
+        {
+            desc.nr_vals = d->max_vcpus;
+            for_each_vcpu ( d, v )
+                if ( v->perfc )
+                    vals[nr_vals + v->vcpu_id] = v->perfc[j];
+        }
+
+        if ( copy_to_guest_offset(pc->desc, i, &desc, 1) )
+            rc = -EFAULT;
+        nr_vals += desc.nr_vals;
+        j += perfc_dom_info[i].nr_elements ?: 1;
+    }
+
+    if ( !rc && copy_to_guest(pc->val, vals, nr_vals) )
+        rc = -EFAULT;
+
+    xfree(vals);
+
+ out:
+    rcu_unlock_domain(d);
+
+    return rc;
+}
+
 /* Dom0 control of perf counters */
 int perfc_control(xen_sysctl_perfc_op_t *pc)
 {
@@ -259,6 +372,11 @@ int perfc_control(xen_sysctl_perfc_op_t *pc)
         rc = perfc_copy_info(pc->desc, pc->val);
         break;
 
+    case XEN_SYSCTL_PERFCOP_query_domain:
+        rc = perfc_copy_dom_info(pc);
+        spin_unlock(&lock);
+        return rc;
+
     default:
         rc = -EINVAL;
         break;
@@ -10,11 +10,17 @@
 #include <xen/sched.h>
 #include <xen/errno.h>
 #include <xen/rangeset.h>
+#include <xen/rbtree.h>
 #include <xsm/xsm.h>
 
-/* An inclusive range [s,e] and pointer to next range in ascending order. */
+/*
+ * An inclusive range [s,e], linked to the next range in ascending order and
+ * into a tree keyed by s for lookups.  As ranges never overlap, adjusting
+ * their bounds never reorders them.
+ */
 struct range {
     struct list_head list;
+    struct rb_node node;
     unsigned long s, e;
 };
 
@@ -23,8 +29,9 @@ struct rangeset {
     struct list_head rangeset_list;
     struct domain   *domain;
 
-    /* Ordered list of ranges contained in this set, and protecting lock. */
+    /* Ordered list and tree of ranges contained in this set, and lock. */
     struct list_head range_list;
+    struct rb_root   range_tree;
 
     /* Number of ranges that can be allocated */
     long             nr_ranges;
@@ -38,20 +45,28 @@ struct rangeset {
 };
 
 /*****************************
- * Private range functions hide the underlying linked-list implemnetation.
+ * Private range functions hide the underlying list and tree implementation.
  */
 
+static struct xmem_cache *__read_mostly range_cache;
+
 /* Find highest range lower than or containing s. NULL if no such range. */
 static struct range *find_range(
     struct rangeset *r, unsigned long s)
 {
     struct range *x = NULL, *y;
+    struct rb_node *n = r->range_tree.rb_node;
 
-    list_for_each_entry ( y, &r->range_list, list )
+    while ( n )
     {
+        y = rb_entry(n, struct range, node);
         if ( y->s > s )
-            break;
-        x = y;
+            n = n->rb_left;
+        else
+        {
+            x = y;
+            n = n->rb_right;
+        }
     }
 
     return x;
@@ -79,7 +94,18 @@ static struct range *next_range(
 static void insert_range(
     struct rangeset *r, struct range *x, struct range *y)
 {
+    struct rb_node **link = &r->range_tree.rb_node, *parent = NULL;
+
     list_add(&y->list, (x != NULL) ? &x->list : &r->range_list);
+
+    while ( *link )
+    {
+        parent = *link;
+        link = rb_entry(parent, struct range, node)->s > y->s
+               ? &parent->rb_left : &parent->rb_right;
+    }
+    rb_link_node(&y->node, parent, link);
+    rb_insert_color(&y->node, &r->range_tree);
 }
 
 /* Remove a range from its list and free it. */
@@ -89,7 +115,11 @@ static void destroy_range(
     r->nr_ranges++;
 
     list_del(&x->list);
-    xfree(x);
+    rb_erase(&x->node, &r->range_tree);
+    if ( range_cache )
+        xmem_cache_free(range_cache, x);
+    else
+        xfree(x);
 }
 
 /* Allocate a new range */
@@ -101,7 +131,7 @@ static struct range *alloc_range(
     if ( r->nr_ranges == 0 )
         return NULL;
 
-    x = xmalloc(struct range);
+    x = range_cache ? xmem_cache_alloc(range_cache) : xmalloc(struct range);
     if ( x )
         --r->nr_ranges;
 
@@ -227,7 +257,8 @@ int rangeset_remove_range(
 
         if ( x->s < s )
         {
-            x->e = s - 1;
+            if ( x->e >= s )
+                x->e = s - 1;
             x = next_range(r, x);
         }
 
@@ -289,7 +320,8 @@ int rangeset_report_ranges(
 
     read_lock(&r->lock);
 
-    for ( x = first_range(r); x && (x->s <= e) && !rc; x = next_range(r, x) )
+    x = find_range(r, s) ?: first_range(r);
+    for ( ; x && (x->s <= e) && !rc; x = next_range(r, x) )
         if ( x->e >= s )
             rc = cb(max(x->s, s), min(x->e, e), ctxt);
 
@@ -333,6 +365,7 @@ struct rangeset *rangeset_new(
 
     rwlock_init(&r->lock);
     INIT_LIST_HEAD(&r->range_list);
+    r->range_tree = RB_ROOT;
     r->nr_ranges = -1;
 
     BUG_ON(flags & ~RANGESETF_prettyprint_hex);
@@ -411,6 +444,7 @@ void rangeset_domain_destroy(
 void rangeset_swap(struct rangeset *a, struct rangeset *b)
 {
     LIST_HEAD(tmp);
+    struct rb_root tree;
 
     if ( a < b )
     {
@@ -427,6 +461,10 @@ void rangeset_swap(struct rangeset *a, struct rangeset *b)
     list_splice_init(&b->range_list, &a->range_list);
     list_splice(&tmp, &b->range_list);
 
+    tree = a->range_tree;
+    a->range_tree = b->range_tree;
+    b->range_tree = tree;
+
     write_unlock(&a->lock);
     write_unlock(&b->lock);
 }
@@ -490,6 +528,14 @@ void rangeset_domain_printk(
     spin_unlock(&d->rangesets_lock);
 }
 
+static int __init rangeset_init(void)
+{
+    /* Ranges allocated before this are plain xmalloc()s, fine to mix. */
+    range_cache = xmem_cache_create_type("rangeset", struct range);
+    return 0;
+}
+presmp_initcall(rangeset_init);
+
 /*
  * Local variables:
  * mode: C
@@ -45,40 +45,69 @@
 #include <xen/cpu.h>
 #include <xen/stop_machine.h>
 
+/*
+ * Quiescent states are tracked in a two level tree.  Each leaf rcu_node
+ * covers RCU_FANOUT consecutive CPUs, which report to it under its own
+ * lock.  Only the last CPU of a node to pass through a quiescent state
+ * takes the global rcu_ctrlblk lock, to report the node as a whole.
+ */
+#define RCU_FANOUT     16
+#define RCU_NR_NODES   DIV_ROUND_UP(NR_CPUS, RCU_FANOUT)
+#define RCU_NODE_MASK  ((1UL << RCU_FANOUT) - 1)
+
+struct rcu_node {
+    spinlock_t    lock;
+    long          cur;      /* Batch qsmask refers to.                    */
+    unsigned long qsmask;   /* CPUs yet to pass through a quiescent state */
+} __cacheline_aligned;
+
+static struct rcu_node rcu_nodes[RCU_NR_NODES];
+
 /* Global control variables for rcupdate callback mechanism. */
 static struct rcu_ctrlblk {
     long cur;           /* Current batch number.                      */
     long completed;     /* Number of the last completed batch         */
     int  next_pending;  /* Is the next batch already waiting?         */
+    long expedited;     /* Last batch that somebody is waiting on.    */
 
     spinlock_t  lock __cacheline_aligned;
-    cpumask_t   cpumask; /* CPUs that need to switch in order    */
-    /* for current batch to proceed.        */
+    /* Nodes that need to report in order for current batch to proceed. */
+    DECLARE_BITMAP(nodemask, RCU_NR_NODES);
 } __cacheline_aligned rcu_ctrlblk = {
     .cur = -300,
     .completed = -300,
+    .expedited = -300,
     .lock = SPIN_LOCK_UNLOCKED,
 };
 
 /*
- * Per-CPU data for Read-Copy Update.
- * nxtlist - new callbacks are added here
- * curlist - current batch for which quiescent cycle started if any
+ * Per-CPU callbacks are kept on a single list, in segments delimited by
+ * the tails[] pointers:
+ *  DONE       - grace period has elapsed, ready to be invoked
+ *  WAIT       - waiting for batch gp[RCU_WAIT_TAIL]
+ *  NEXT_READY - waiting for batch gp[RCU_NEXT_READY_TAIL]
+ *  NEXT       - not yet assigned to a batch
+ * Callbacks queued while a batch is in progress are therefore assigned to
+ * the following batch straight away, rather than waiting for the previous
+ * set of callbacks to be retired first.
  */
+#define RCU_DONE_TAIL       0
+#define RCU_WAIT_TAIL       1
+#define RCU_NEXT_READY_TAIL 2
+#define RCU_NEXT_TAIL       3
+#define RCU_NR_SEGS         4
+
 struct rcu_data {
     /* 1) quiescent state handling : */
     long quiescbatch;    /* Batch # for grace period */
     int  qs_pending;     /* core waits for quiesc state */
+    bool_t expedite;     /* call_rcu_expedited() since last softirq */
 
     /* 2) batch handling */
-    long            batch;            /* Batch # for current RCU batch */
-    struct rcu_head *nxtlist;
-    struct rcu_head **nxttail;
+    struct rcu_head *cblist;
+    struct rcu_head **tails[RCU_NR_SEGS];
+    long            gp[RCU_NR_SEGS];  /* Batch # each segment waits for */
     long            qlen;             /* # of queued callbacks */
-    struct rcu_head *curlist;
-    struct rcu_head **curtail;
-    struct rcu_head *donelist;
-    struct rcu_head **donetail;
     long            blimit;           /* Upper limit on a processed batch */
     int cpu;
     struct rcu_head barrier;
@@ -141,6 +170,18 @@ static inline int rcu_batch_before(long a, long b)
     return (a - b) < 0;
 }
 
+/* Collect the CPUs which the current batch is still waiting for. */
+static void rcu_holdouts(struct rcu_ctrlblk *rcp, cpumask_t *mask)
+{
+    unsigned int node, cpu;
+
+    cpumask_clear(mask);
+    for_each_set_bit ( node, rcp->nodemask, RCU_NR_NODES )
+        for ( cpu = 0; cpu < RCU_FANOUT; cpu++ )
+            if ( rcu_nodes[node].qsmask & (1UL << cpu) )
+                cpumask_set_cpu(node * RCU_FANOUT + cpu, mask);
+}
+
 static void force_quiescent_state(struct rcu_data *rdp,
                                   struct rcu_ctrlblk *rcp)
 {
@@ -152,7 +193,8 @@ static void force_quiescent_state(struct rcu_data *rdp,
          * Don't send IPI to itself. With irqs disabled,
          * rdp->cpu is the current cpu.
          */
-        cpumask_andnot(&cpumask, &rcp->cpumask, cpumask_of(rdp->cpu));
+        rcu_holdouts(rcp, &cpumask);
+        cpumask_clear_cpu(rdp->cpu, &cpumask);
         cpumask_raise_softirq(&cpumask, SCHEDULE_SOFTIRQ);
     }
 }
@@ -178,8 +220,8 @@ void call_rcu(struct rcu_head *head,
     head->next = NULL;
     local_irq_save(flags);
     rdp = &__get_cpu_var(rcu_data);
-    *rdp->nxttail = head;
-    rdp->nxttail = &head->next;
+    *rdp->tails[RCU_NEXT_TAIL] = head;
+    rdp->tails[RCU_NEXT_TAIL] = &head->next;
     if (unlikely(++rdp->qlen > qhimark)) {
         rdp->blimit = INT_MAX;
         force_quiescent_state(rdp, &rcu_ctrlblk);
@@ -187,29 +229,173 @@ void call_rcu(struct rcu_head *head,
     local_irq_restore(flags);
 }
 
+/**
+ * call_rcu_expedited - Queue an RCU callback, and hurry its grace period.
+ * @head: structure to be used for queueing the RCU updates.
+ * @func: actual update function to be invoked after the grace period
+ *
+ * As call_rcu(), but rather than waiting for every CPU to pass through a
+ * quiescent state in its own time, the CPUs holding up the grace period
+ * are sent RCU_SOFTIRQ to report one immediately.  This costs an IPI to
+ * every online CPU, so it is meant for callers which are waiting on the
+ * callback, such as domain destruction, not for frequent updates.
+ */
+void call_rcu_expedited(struct rcu_head *head,
+                        void (*func)(struct rcu_head *rcu))
+{
+    unsigned long flags;
+
+    local_irq_save(flags);
+    call_rcu(head, func);
+    this_cpu(rcu_data).expedite = 1;
+    raise_softirq(RCU_SOFTIRQ);
+    local_irq_restore(flags);
+}
+
+/*
+ * Make sure batch is expedited when it starts, and kick the CPUs which
+ * are holding up the batches before it.
+ */
+static void rcu_expedite(struct rcu_ctrlblk *rcp, long batch)
+{
+    cpumask_t cpumask;
+
+    spin_lock(&rcp->lock);
+    if (rcu_batch_before(rcp->expedited, batch))
+        rcp->expedited = batch;
+    rcu_holdouts(rcp, &cpumask);
+    spin_unlock(&rcp->lock);
+
+    cpumask_raise_softirq(&cpumask, RCU_SOFTIRQ);
+}
+
+/*
+ * Callback segment handling.  All of these must be called with interrupts
+ * disabled, as call_rcu() may append to the NEXT segment from IRQ context.
+ */
+
+/* Are there no callbacks after segment seg? */
+static inline int rcu_seg_restempty(struct rcu_data *rdp, int seg)
+{
+    return !*rdp->tails[seg];
+}
+
+/* Move the callbacks whose batch has completed into the DONE segment. */
+static void rcu_seg_advance(struct rcu_data *rdp, long completed)
+{
+    int i, j;
+
+    for (i = RCU_WAIT_TAIL; i < RCU_NEXT_TAIL; i++) {
+        if (rcu_batch_before(completed, rdp->gp[i]))
+            break;
+        rdp->tails[RCU_DONE_TAIL] = rdp->tails[i];
+    }
+
+    if (i == RCU_WAIT_TAIL)
+        return;
+
+    /* Segments now merged into DONE are empty... */
+    for (j = RCU_WAIT_TAIL; j < i; j++)
+        rdp->tails[j] = rdp->tails[RCU_DONE_TAIL];
+
+    /* ...so shift the remaining ones down. */
+    for (j = RCU_WAIT_TAIL; i < RCU_NEXT_TAIL; i++, j++) {
+        if (rdp->tails[j] == rdp->tails[RCU_NEXT_TAIL])
+            break;
+        rdp->tails[j] = rdp->tails[i];
+        rdp->gp[j] = rdp->gp[i];
+    }
+}
+
+/*
+ * Find the segment the NEXT callbacks can be given batch number to, either
+ * by merging with a segment waiting for the same batch, or by taking a free
+ * one.  Returns RCU_NEXT_TAIL if there is none.
+ */
+static int rcu_seg_accel_target(struct rcu_data *rdp, long batch)
+{
+    int i;
+
+    for (i = RCU_NEXT_READY_TAIL; i > RCU_DONE_TAIL; i--)
+        if (rdp->tails[i] != rdp->tails[i - 1] &&
+            rcu_batch_before(rdp->gp[i], batch))
+            break;
+
+    return i + 1;
+}
+
+/*
+ * Assign batch to the callbacks not yet waiting for one.  Returns 1 if any
+ * callbacks are waiting for batch.
+ */
+static int rcu_seg_accelerate(struct rcu_data *rdp, long batch)
+{
+    int i;
+
+    if (!rcu_seg_restempty(rdp, RCU_DONE_TAIL)) {
+        i = rcu_seg_accel_target(rdp, batch);
+        if (!rcu_seg_restempty(rdp, i - 1) && i < RCU_NEXT_TAIL) {
+            for (; i < RCU_NEXT_TAIL; i++) {
+                rdp->tails[i] = rdp->tails[RCU_NEXT_TAIL];
+                rdp->gp[i] = batch;
+            }
+        }
+    }
+
+    for (i = RCU_WAIT_TAIL; i < RCU_NEXT_TAIL; i++)
+        if (rdp->tails[i] != rdp->tails[i - 1] && rdp->gp[i] == batch)
+            return 1;
+
+    return 0;
+}
+
 /*
  * Invoke the completed RCU callbacks. They are expected to be in
  * a per-cpu list.
  */
 static void rcu_do_batch(struct rcu_data *rdp)
 {
-    struct rcu_head *next, *list;
-    int count = 0;
+    struct rcu_head *next, *list, **tail;
+    int i, count = 0;
+
+    /* Detach the DONE segment. */
+    local_irq_disable();
+    list = rdp->cblist;
+    tail = rdp->tails[RCU_DONE_TAIL];
+    if (tail == &rdp->cblist) {
+        local_irq_enable();
+        return;
+    }
+    rdp->cblist = *tail;
+    *tail = NULL;
+    for (i = RCU_NR_SEGS - 1; i >= RCU_DONE_TAIL; i--)
+        if (rdp->tails[i] == tail)
+            rdp->tails[i] = &rdp->cblist;
+    local_irq_enable();
 
-    list = rdp->donelist;
     while (list) {
-        next = rdp->donelist = list->next;
+        next = list->next;
         list->func(list);
         list = next;
-        rdp->qlen--;
         if (++count >= rdp->blimit)
             break;
     }
+
+    /* Put back what is left over, still as DONE. */
+    local_irq_disable();
+    rdp->qlen -= count;
+    if (list) {
+        *tail = rdp->cblist;
+        rdp->cblist = list;
+        for (i = RCU_DONE_TAIL; i < RCU_NR_SEGS; i++)
+            if (rdp->tails[i] == &rdp->cblist)
+                rdp->tails[i] = tail;
+    }
+    local_irq_enable();
+
     if (rdp->blimit == INT_MAX && rdp->qlen <= qlowmark)
         rdp->blimit = blimit;
-    if (!rdp->donelist)
-        rdp->donetail = &rdp->donelist;
-    else
+    if (list)
         raise_softirq(RCU_SOFTIRQ);
 }
 
@@ -219,16 +405,17 @@ static void rcu_do_batch(struct rcu_data *rdp)
  * - A new grace period is started.
  *   This is done by rcu_start_batch. The start is not broadcasted to
  *   all cpus, they must pick this up by comparing rcp->cur with
- *   rdp->quiescbatch. All cpus are recorded  in the
- *   rcu_ctrlblk.cpumask bitmap.
+ *   rdp->quiescbatch. All cpus are recorded in the qsmask of their
+ *   rcu_node, and all nodes with online cpus in rcu_ctrlblk.nodemask.
  * - All cpus must go through a quiescent state.
  *   Since the start of the grace period is not broadcasted, at least two
  *   calls to rcu_check_quiescent_state are required:
  *   The first call just notices that a new grace period is running. The
  *   following calls check if there was a quiescent state since the beginning
- *   of the grace period. If so, it updates rcu_ctrlblk.cpumask. If
- *   the bitmap is empty, then the grace period is completed.
- *   rcu_check_quiescent_state calls rcu_start_batch(0) to start the next grace
+ *   of the grace period. If so, it updates the qsmask of its rcu_node, and
+ *   the last cpu of the node updates rcu_ctrlblk.nodemask. If that is
+ *   empty, then the grace period is completed.
+ *   rcu_report_qs calls rcu_start_batch(0) to start the next grace
  *   period (if necessary).
  */
 /*
@@ -238,6 +425,13 @@ static void rcu_do_batch(struct rcu_data *rdp)
  */
 static void rcu_start_batch(struct rcu_ctrlblk *rcp)
 {
+    unsigned int node, nr_nodes = DIV_ROUND_UP(nr_cpu_ids, RCU_FANOUT);
+    const unsigned long *online = cpumask_bits(&cpu_online_map);
+    struct rcu_node *rnp;
+    unsigned long qsmask;
+
+    BUILD_BUG_ON(BITS_PER_LONG % RCU_FANOUT);
+
     if (rcp->next_pending &&
         rcp->completed == rcp->cur) {
         rcp->next_pending = 0;
@@ -248,23 +442,63 @@ static void rcu_start_batch(struct rcu_ctrlblk *rcp)
         smp_wmb();
         rcp->cur++;
 
-        cpumask_copy(&rcp->cpumask, &cpu_online_map);
+        for (node = 0; node < nr_nodes; node++) {
+            qsmask = (online[node * RCU_FANOUT / BITS_PER_LONG] >>
+                      (node * RCU_FANOUT % BITS_PER_LONG)) & RCU_NODE_MASK;
+            if (!qsmask)
+                continue;
+            rnp = &rcu_nodes[node];
+            spin_lock(&rnp->lock);
+            rnp->cur = rcp->cur;
+            rnp->qsmask = qsmask;
+            spin_unlock(&rnp->lock);
+            __set_bit(node, rcp->nodemask);
+        }
+
+        if (!rcu_batch_before(rcp->expedited, rcp->cur))
+            cpumask_raise_softirq(&cpu_online_map, RCU_SOFTIRQ);
     }
 }
 
 /*
- * cpu went through a quiescent state since the beginning of the grace period.
- * Clear it from the cpu mask and complete the grace period if it was the last
- * cpu. Start another grace period if someone has further entries pending
+ * cpu went through a quiescent state since the beginning of grace period
+ * batch.  Clear it from its node's mask, and if it was the last cpu of the
+ * node clear the node from the global mask and complete the grace period if
+ * it was the last node.  Start another grace period if someone has further
+ * entries pending.
  */
-static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
+static void rcu_report_qs(struct rcu_ctrlblk *rcp, int cpu, long batch)
 {
-    cpumask_clear_cpu(cpu, &rcp->cpumask);
-    if (cpumask_empty(&rcp->cpumask)) {
+    struct rcu_node *rnp = &rcu_nodes[cpu / RCU_FANOUT];
+    unsigned long bit = 1UL << (cpu % RCU_FANOUT);
+    int node_done;
+
+    spin_lock(&rnp->lock);
+    /*
+     * rdp->quiescbatch/rcp->cur and the node mask can come out of sync
+     * during cpu startup. Ignore the quiescent state.
+     */
+    if (rnp->cur != batch || !(rnp->qsmask & bit)) {
+        spin_unlock(&rnp->lock);
+        return;
+    }
+    rnp->qsmask &= ~bit;
+    node_done = !rnp->qsmask;
+    spin_unlock(&rnp->lock);
+
+    if (!node_done)
+        return;
+
+    /* No new batch can start until this node has been cleared below. */
+    spin_lock(&rcp->lock);
+    ASSERT(rcp->cur == batch);
+    __clear_bit(cpu / RCU_FANOUT, rcp->nodemask);
+    if (bitmap_empty(rcp->nodemask, RCU_NR_NODES)) {
         /* batch completed ! */
         rcp->completed = rcp->cur;
         rcu_start_batch(rcp);
     }
+    spin_unlock(&rcp->lock);
 }
 
 /*
@@ -291,15 +525,7 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 
     rdp->qs_pending = 0;
 
-    spin_lock(&rcp->lock);
-    /*
-     * rdp->quiescbatch/rcp->cur and the cpu bitmap can come out of sync
-     * during cpu startup. Ignore the quiescent state.
-     */
-    if (likely(rdp->quiescbatch == rcp->cur))
-        cpu_quiet(rdp->cpu, rcp);
-
-    spin_unlock(&rcp->lock);
+    rcu_report_qs(rcp, rdp->cpu, rdp->quiescbatch);
 }
 
 
@@ -309,44 +535,38 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
                                     struct rcu_data *rdp)
 {
-    if (rdp->curlist && !rcu_batch_before(rcp->completed, rdp->batch)) {
-        *rdp->donetail = rdp->curlist;
-        rdp->donetail = rdp->curtail;
-        rdp->curlist = NULL;
-        rdp->curtail = &rdp->curlist;
-    }
+    long batch;
+    int need_batch;
+    bool_t expedite;
 
     local_irq_disable();
-    if (rdp->nxtlist && !rdp->curlist) {
-        rdp->curlist = rdp->nxtlist;
-        rdp->curtail = rdp->nxttail;
-        rdp->nxtlist = NULL;
-        rdp->nxttail = &rdp->nxtlist;
-        local_irq_enable();
+    rcu_seg_advance(rdp, rcp->completed);
 
-        /*
-         * start the next batch of callbacks
-         */
+    /* determine batch number */
+    batch = rcp->cur + 1;
+    /* see the comment and corresponding wmb() in
+     * the rcu_start_batch()
+     */
+    smp_rmb();
 
-        /* determine batch number */
-        rdp->batch = rcp->cur + 1;
-        /* see the comment and corresponding wmb() in
-         * the rcu_start_batch()
-         */
-        smp_rmb();
-
-        if (!rcp->next_pending) {
-            /* and start it/schedule start if it's a new batch */
-            spin_lock(&rcp->lock);
-            rcp->next_pending = 1;
-            rcu_start_batch(rcp);
-            spin_unlock(&rcp->lock);
-        }
-    } else {
-        local_irq_enable();
+    need_batch = rcu_seg_accelerate(rdp, batch);
+    expedite = rdp->expedite;
+    rdp->expedite = 0;
+    local_irq_enable();
+
+    if (expedite)
+        rcu_expedite(rcp, batch);
+
+    if (need_batch && !rcp->next_pending) {
+        /* and start it/schedule start if it's a new batch */
+        spin_lock(&rcp->lock);
+        rcp->next_pending = 1;
+        rcu_start_batch(rcp);
+        spin_unlock(&rcp->lock);
     }
+
     rcu_check_quiescent_state(rcp, rdp);
-    if (rdp->donelist)
+    if (rdp->tails[RCU_DONE_TAIL] != &rdp->cblist)
         rcu_do_batch(rdp);
 }
 
@@ -357,18 +577,27 @@ static void rcu_process_callbacks(void)
 
 static int __rcu_pending(struct rcu_ctrlblk *rcp, struct rcu_data *rdp)
 {
+    int i;
+
+    /* This cpu has finished callbacks to invoke */
+    if (rdp->tails[RCU_DONE_TAIL] != &rdp->cblist)
+        return 1;
+
     /* This cpu has pending rcu entries and the grace period
      * for them has completed.
      */
-    if (rdp->curlist && !rcu_batch_before(rcp->completed, rdp->batch))
+    for (i = RCU_WAIT_TAIL; i < RCU_NEXT_TAIL; i++)
+        if (rdp->tails[i] != rdp->tails[i - 1] &&
+            !rcu_batch_before(rcp->completed, rdp->gp[i]))
+            return 1;
+
+    /* This cpu has new entries which can be assigned to a batch */
+    if (rdp->tails[RCU_NEXT_TAIL] != rdp->tails[RCU_NEXT_READY_TAIL] &&
+        rcu_seg_accel_target(rdp, rcp->cur + 1) < RCU_NEXT_TAIL)
         return 1;
 
-    /* This cpu has no pending entries, but there are new entries */
-    if (!rdp->curlist && rdp->nxtlist)
-        return 1;
-
-    /* This cpu has finished callbacks to invoke */
-    if (rdp->donelist)
+    /* call_rcu_expedited() is waiting to be noticed */
+    if (rdp->expedite)
         return 1;
 
     /* The rcu core waits for a quiescent state from the cpu */
@@ -394,7 +623,7 @@ int rcu_needs_cpu(int cpu)
 {
     struct rcu_data *rdp = &per_cpu(rcu_data, cpu);
 
-    return (!!rdp->curlist || rcu_pending(cpu));
+    return (!!rdp->cblist || rcu_pending(cpu));
 }
 
 void rcu_check_callbacks(int cpu)
@@ -402,32 +631,30 @@ void rcu_check_callbacks(int cpu)
     raise_softirq(RCU_SOFTIRQ);
 }
 
-static void rcu_move_batch(struct rcu_data *this_rdp, struct rcu_head *list,
-                           struct rcu_head **tail)
-{
-    local_irq_disable();
-    *this_rdp->nxttail = list;
-    if (list)
-        this_rdp->nxttail = tail;
-    local_irq_enable();
-}
-
 static void rcu_offline_cpu(struct rcu_data *this_rdp,
                             struct rcu_ctrlblk *rcp, struct rcu_data *rdp)
 {
+    long cur;
+    int i, in_progress;
+
     /* If the cpu going offline owns the grace period we can block
      * indefinitely waiting for it, so flush it here.
      */
     spin_lock(&rcp->lock);
-    if (rcp->cur != rcp->completed)
-        cpu_quiet(rdp->cpu, rcp);
+    cur = rcp->cur;
+    in_progress = (rcp->cur != rcp->completed);
     spin_unlock(&rcp->lock);
+    if (in_progress)
+        rcu_report_qs(rcp, rdp->cpu, cur);
 
-    rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
-    rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
-    rcu_move_batch(this_rdp, rdp->nxtlist, rdp->nxttail);
-
+    /* All of its callbacks, whatever their segment, wait for a new batch. */
     local_irq_disable();
+    *this_rdp->tails[RCU_NEXT_TAIL] = rdp->cblist;
+    if (rdp->cblist)
+        this_rdp->tails[RCU_NEXT_TAIL] = rdp->tails[RCU_NEXT_TAIL];
+    rdp->cblist = NULL;
+    for (i = RCU_DONE_TAIL; i < RCU_NR_SEGS; i++)
+        rdp->tails[i] = &rdp->cblist;
     this_rdp->qlen += rdp->qlen;
     local_irq_enable();
 }
@@ -435,10 +662,13 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
 static void rcu_init_percpu_data(int cpu, struct rcu_ctrlblk *rcp,
                                  struct rcu_data *rdp)
 {
+    int i;
+
     memset(rdp, 0, sizeof(*rdp));
-    rdp->curtail = &rdp->curlist;
-    rdp->nxttail = &rdp->nxtlist;
-    rdp->donetail = &rdp->donelist;
+    for (i = RCU_DONE_TAIL; i < RCU_NR_SEGS; i++) {
+        rdp->tails[i] = &rdp->cblist;
+        rdp->gp[i] = rcp->completed;
+    }
     rdp->quiescbatch = rcp->completed;
     rdp->qs_pending = 0;
     rdp->cpu = cpu;
@@ -474,6 +704,13 @@ static struct notifier_block cpu_nfb = {
 void __init rcu_init(void)
 {
     void *cpu = (void *)(long)smp_processor_id();
+    unsigned int i;
+
+    for (i = 0; i < RCU_NR_NODES; i++) {
+        spin_lock_init(&rcu_nodes[i].lock);
+        rcu_nodes[i].cur = rcu_ctrlblk.completed;
+    }
+
     cpu_callback(&cpu_nfb, CPU_UP_PREPARE, cpu);
     register_cpu_notifier(&cpu_nfb);
     open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
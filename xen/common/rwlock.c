@@ -26,6 +26,7 @@ static inline void rspin_until_writer_unlock(rwlock_t *lock, u32 cnts)
 void queue_read_lock_slowpath(rwlock_t *lock)
 {
     u32 cnts;
+    s64 sample = lock_sample_begin();
 
     /*
      * Readers come here when they cannot get the lock without waiting.
@@ -54,6 +55,9 @@ void queue_read_lock_slowpath(rwlock_t *lock)
      * Signal the next one in queue to become queue head.
      */
     spin_unlock(&lock->lock);
+
+    lock_sample_end(&lock->lock, lock, LOCK_SAMPLE_read, sample,
+                    __builtin_return_address(0));
 }
 
 /*
@@ -63,6 +67,7 @@ void queue_read_lock_slowpath(rwlock_t *lock)
 void queue_write_lock_slowpath(rwlock_t *lock)
 {
     u32 cnts;
+    s64 sample = lock_sample_begin();
 
     /* Put the writer into the wait queue. */
     spin_lock(&lock->lock);
@@ -100,16 +105,21 @@ void queue_write_lock_slowpath(rwlock_t *lock)
     }
  unlock:
     spin_unlock(&lock->lock);
+
+    lock_sample_end(&lock->lock, lock, LOCK_SAMPLE_write, sample,
+                    __builtin_return_address(0));
 }
 
 
 static DEFINE_PER_CPU(cpumask_t, percpu_rwlock_readers);
 
-void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
+void _percpu_write_lock(percpu_rwlock_slots_t *per_cpudata,
                 percpu_rwlock_t *percpu_rwlock)
 {
     unsigned int cpu;
     cpumask_t *rwlock_readers = &this_cpu(percpu_rwlock_readers);
+    /* Writers always wait for readers to go, so are all sampling candidates. */
+    s64 sample = lock_sample_begin();
 
     /* Validate the correct per_cpudata variable has been provided. */
     _percpu_rwlock_owner_check(per_cpudata, percpu_rwlock);
@@ -137,7 +147,8 @@ void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
              * Remove any percpu readers not contending on this rwlock
              * from our check mask.
              */
-            if ( per_cpu_ptr(per_cpudata, cpu) != percpu_rwlock )
+            if ( _percpu_read_slot(&per_cpu_ptr(per_cpudata, cpu),
+                                   percpu_rwlock) == PERCPU_RWLOCK_SLOTS )
                 __cpumask_clear_cpu(cpu, rwlock_readers);
         }
         /* Check if we've cleared all percpu readers from check mask. */
@@ -146,4 +157,8 @@ void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
         /* Give the coherency fabric a break. */
         cpu_relax();
     };
+
+    lock_sample_end(&percpu_rwlock->rwlock.lock, percpu_rwlock,
+                    LOCK_SAMPLE_percpu_write, sample,
+                    __builtin_return_address(0));
 }
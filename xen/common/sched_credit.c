@@ -159,6 +159,10 @@
 static int __read_mostly sched_credit_tslice_ms = CSCHED_DEFAULT_TSLICE_MS;
 integer_param("sched_credit_tslice_ms", sched_credit_tslice_ms);
 
+/* Maximum number of peer runqueues a load balancing attempt locks (0: all). */
+static unsigned int __read_mostly sched_credit_balance_probes;
+integer_param("sched_credit_balance_probes", sched_credit_balance_probes);
+
 /*
  * Physical CPU
  */
@@ -168,6 +172,7 @@ struct csched_pcpu {
     struct timer ticker;
     unsigned int tick;
     unsigned int idle_bias;
+    bool_t tick_stopped; /* Idle: ticker restarted by csched_schedule(). */
 };
 
 /*
@@ -257,6 +262,13 @@ static inline bool_t is_runq_idle(unsigned int cpu)
            is_idle_vcpu(__runq_elem(RUNQ(cpu)->next)->vcpu);
 }
 
+/*
+ * Number of non-idle vcpus waiting on each pcpu's runqueue.  It is only
+ * updated with the runqueue lock held, but load balancing reads it without
+ * that lock, to skip peers with nothing to steal before trying theirs.
+ */
+static DEFINE_PER_CPU(unsigned int, nr_queued);
+
 static inline void
 __runq_insert(struct csched_vcpu *svc)
 {
@@ -285,6 +297,10 @@ __runq_insert(struct csched_vcpu *svc)
     }
 
     list_add_tail(&svc->runq_elem, iter);
+
+    if ( !is_idle_vcpu(svc->vcpu) )
+        write_atomic(&per_cpu(nr_queued, svc->vcpu->processor),
+                     per_cpu(nr_queued, svc->vcpu->processor) + 1);
 }
 
 static inline void
@@ -292,6 +308,10 @@ __runq_remove(struct csched_vcpu *svc)
 {
     BUG_ON( !__vcpu_on_runq(svc) );
     list_del_init(&svc->runq_elem);
+
+    if ( !is_idle_vcpu(svc->vcpu) )
+        write_atomic(&per_cpu(nr_queued, svc->vcpu->processor),
+                     per_cpu(nr_queued, svc->vcpu->processor) - 1);
 }
 
 
@@ -574,11 +594,13 @@ init_pdata(struct csched_private *prv, struct csched_pcpu *spc, int cpu)
     {
         prv->master = cpu;
         init_timer(&prv->master_ticker, csched_acct, prv, cpu);
+        set_timer_slack(&prv->master_ticker, TIMER_SLACK_relaxed);
         set_timer(&prv->master_ticker,
                   NOW() + MILLISECS(prv->tslice_ms));
     }
 
     init_timer(&spc->ticker, csched_tick, (void *)(unsigned long)cpu, cpu);
+    set_timer_slack(&spc->ticker, TIMER_SLACK_relaxed);
     set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
 
     INIT_LIST_HEAD(&spc->runq);
@@ -1158,6 +1180,30 @@ csched_vcpu_yield(const struct scheduler *ops, struct vcpu *vc)
     set_bit(CSCHED_FLAG_VCPU_YIELD, &svc->flags);
 }
 
+static void
+csched_vcpu_yield_to(const struct scheduler *ops, struct vcpu *vc,
+                     struct vcpu *target)
+{
+    struct csched_vcpu * const svc = CSCHED_VCPU(target);
+
+    /*
+     * Give the (probably preempted) target the same boost as a waking
+     * vcpu, so it gets ahead of the other UNDER vcpus on its runq.  As
+     * with wakeups, the boost goes away as soon as it gets accounted.
+     */
+    if ( !__vcpu_on_runq(svc) || svc->pri != CSCHED_PRI_TS_UNDER ||
+         test_bit(CSCHED_FLAG_VCPU_PARKED, &svc->flags) )
+        return;
+
+    TRACE_2D(TRC_CSCHED_BOOST_START, target->domain->domain_id,
+             target->vcpu_id);
+    SCHED_STAT_CRANK(vcpu_boost);
+    svc->pri = CSCHED_PRI_TS_BOOST;
+    __runq_remove(svc);
+    __runq_insert(svc);
+    __runq_tickle(svc);
+}
+
 static int
 csched_dom_cntl(
     const struct scheduler *ops,
@@ -1251,6 +1297,46 @@ csched_sys_cntl(const struct scheduler *ops,
     return rc;
 }
 
+/* Tuning profiles of a cpupool, see XEN_SYSCTL_CPUPOOL_OP_SETPROFILE */
+#define CSCHED_LATENCY_TSLICE_MS        5
+#define CSCHED_THROUGHPUT_TSLICE_MS     100
+#define CSCHED_THROUGHPUT_RATELIMIT_US  5000
+
+static int
+csched_set_profile(const struct scheduler *ops, unsigned int profile)
+{
+    struct csched_private *prv = CSCHED_PRIV(ops);
+    unsigned int tslice_ms, ratelimit_us;
+    unsigned long flags;
+
+    switch ( profile )
+    {
+    case XEN_SYSCTL_CPUPOOL_PROFILE_LATENCY:
+        tslice_ms = CSCHED_LATENCY_TSLICE_MS;
+        ratelimit_us = XEN_SYSCTL_SCHED_RATELIMIT_MIN;
+        break;
+
+    case XEN_SYSCTL_CPUPOOL_PROFILE_THROUGHPUT:
+        tslice_ms = CSCHED_THROUGHPUT_TSLICE_MS;
+        ratelimit_us = CSCHED_THROUGHPUT_RATELIMIT_US;
+        break;
+
+    default:
+        /* Back to the boot time settings, as csched_init() applies them. */
+        tslice_ms = sched_credit_tslice_ms;
+        ratelimit_us = min_t(unsigned int, sched_ratelimit_us,
+                             1000 * tslice_ms);
+        break;
+    }
+
+    spin_lock_irqsave(&prv->lock, flags);
+    __csched_set_tslice(prv, tslice_ms);
+    prv->ratelimit_us = ratelimit_us;
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return 0;
+}
+
 static void *
 csched_alloc_domdata(const struct scheduler *ops, struct domain *dom)
 {
@@ -1580,9 +1666,28 @@ csched_tick(void *_cpu)
      */
     csched_runq_sort(prv, cpu);
 
+    /*
+     * There is nothing to account on an idle pcpu, so stop ticking, rather
+     * than waking it up every tick_period_us. csched_schedule() restarts
+     * the ticker as soon as it picks a vcpu to run here.
+     */
+    if ( is_idle_vcpu(current) )
+    {
+        spc->tick_stopped = 1;
+        return;
+    }
+
     set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
 }
 
+static void csched_tick_restart(struct csched_private *prv,
+                                struct csched_pcpu *spc, s_time_t now)
+{
+    spc->tick_stopped = 0;
+    set_timer(&spc->ticker, now + MICROSECS(prv->tick_period_us)
+            - now % MICROSECS(prv->tick_period_us) );
+}
+
 static struct csched_vcpu *
 csched_runq_steal(int peer_cpu, int cpu, int pri, int balance_step)
 {
@@ -1656,10 +1761,11 @@ csched_load_balance(struct csched_private *prv, int cpu,
 {
     struct cpupool *c = per_cpu(cpupool, cpu);
     struct csched_vcpu *speer;
-    cpumask_t workers;
+    cpumask_t workers, probed;
     cpumask_t *online;
     int peer_cpu, peer_node, bstep;
     int node = cpu_to_node(cpu);
+    unsigned int level, probes = 0;
 
     BUG_ON( cpu != snext->vcpu->processor );
     online = cpupool_online_cpumask(c);
@@ -1688,25 +1794,58 @@ csched_load_balance(struct csched_private *prv, int cpu,
     for_each_csched_balance_step( bstep )
     {
         /*
-         * We peek at the non-idling CPUs in a node-wise fashion. In fact,
-         * it is more likely that we find some affine work on our same
-         * node, not to mention that migrating vcpus within the same node
-         * could well expected to be cheaper than across-nodes (memory
-         * stays local, there might be some node-wide cache[s], etc.).
+         * We peek at the non-idling CPUs from the closest outwards: our
+         * SMT siblings, the other cores of our socket, the rest of our
+         * node, and then the other nodes in turn.  It is more likely that
+         * we find some affine work close by, and migrating vcpus there is
+         * cheaper (shared caches, memory stays local, etc.).
          */
+        cpumask_clear(&probed);
         peer_node = node;
-        do
+        for ( level = 0; ; level++ )
         {
-            /* Find out what the !idle are in this node */
+            const cpumask_t *span;
+
+            if ( level == 0 )
+                span = per_cpu(cpu_sibling_mask, cpu);
+            else if ( level == 1 )
+                span = per_cpu(cpu_core_mask, cpu);
+            else
+            {
+                if ( level > 2 )
+                {
+                    peer_node = cycle_node(peer_node, node_online_map);
+                    if ( peer_node == node )
+                        break;
+                }
+                span = &node_to_cpumask(peer_node);
+            }
+
+            /* Find out what the !idle are in this span, not yet probed */
             cpumask_andnot(&workers, online, prv->idlers);
-            cpumask_and(&workers, &workers, &node_to_cpumask(peer_node));
+            cpumask_and(&workers, &workers, span);
+            cpumask_andnot(&workers, &workers, &probed);
             __cpumask_clear_cpu(cpu, &workers);
+            cpumask_or(&probed, &probed, &workers);
 
-            peer_cpu = cpumask_first(&workers);
-            if ( peer_cpu >= nr_cpu_ids )
-                goto next_node;
-            do
+            for_each_cpu ( peer_cpu, &workers )
             {
+                spinlock_t *lock;
+
+                /* Nothing queued over there: don't bother with its lock. */
+                if ( !read_atomic(&per_cpu(nr_queued, peer_cpu)) )
+                {
+                    SCHED_STAT_CRANK(steal_peer_empty);
+                    continue;
+                }
+
+                if ( sched_credit_balance_probes &&
+                     probes++ >= sched_credit_balance_probes )
+                {
+                    SCHED_STAT_CRANK(steal_probes_exhausted);
+                    goto out;
+                }
+
                 /*
                  * Get ahold of the scheduler lock for this peer CPU.
                  *
@@ -1714,12 +1853,10 @@ csched_load_balance(struct csched_private *prv, int cpu,
                  * could cause a deadlock if the peer CPU is also load
                  * balancing and trying to lock this CPU.
                  */
-                spinlock_t *lock = pcpu_schedule_trylock(peer_cpu);
-
+                lock = pcpu_schedule_trylock(peer_cpu);
                 if ( !lock )
                 {
                     SCHED_STAT_CRANK(steal_trylock_failed);
-                    peer_cpu = cpumask_cycle(peer_cpu, &workers);
                     continue;
                 }
 
@@ -1734,14 +1871,8 @@ csched_load_balance(struct csched_private *prv, int cpu,
                     *stolen = 1;
                     return speer;
                 }
-
-                peer_cpu = cpumask_cycle(peer_cpu, &workers);
-
-            } while( peer_cpu != cpumask_first(&workers) );
-
- next_node:
-            peer_node = cycle_node(peer_node, node_online_map);
-        } while( peer_node != node );
+            }
+        }
     }
 
  out:
@@ -1750,6 +1881,82 @@ csched_load_balance(struct csched_private *prv, int cpu,
     return snext;
 }
 
+/*
+ * Core scheduling.
+ *
+ * With sched_core, the threads of a core only run vcpus of the same domain
+ * at the same time. snext can run if it belongs to the same domain as the
+ * vcpus running on the siblings, or if it has higher priority than all of
+ * them, in which case the siblings are asked to reschedule. Otherwise, the
+ * highest priority vcpu of the right domain on our runqueue, or idle, runs
+ * instead, and snext is put back on the runqueue.
+ *
+ * Each pcpu has its own lock in this scheduler, so what the siblings run
+ * is sampled without holding their locks. A sibling which is choosing a
+ * vcpu at the same time can pick a conflicting one; the tickling makes
+ * such a situation resolve at the next scheduling decision.
+ */
+static struct csched_vcpu *
+csched_core_pick(struct csched_private *prv, int cpu,
+                 struct csched_vcpu *snext, bool_t *migrated)
+{
+    const struct domain *d = NULL;
+    int pri = CSCHED_PRI_IDLE;
+    struct list_head *iter;
+    unsigned int sib;
+
+    for_each_cpu ( sib, per_cpu(cpu_sibling_mask, cpu) )
+    {
+        const struct vcpu *v = curr_on_cpu(sib);
+
+        if ( sib == cpu || !cpumask_test_cpu(sib, prv->cpus) ||
+             is_idle_vcpu(v) )
+            continue;
+
+        if ( d == NULL )
+            d = v->domain;
+        pri = max_t(int, pri, CSCHED_VCPU(v)->pri);
+    }
+
+    if ( d != NULL && snext->vcpu->domain != d && snext->pri <= pri )
+    {
+        SCHED_STAT_CRANK(core_sched_filtered);
+
+        __runq_insert(snext);
+        list_for_each( iter, RUNQ(cpu) )
+        {
+            struct csched_vcpu *svc = __runq_elem(iter);
+
+            /* The idle vcpu is always on the runqueue, when not running. */
+            if ( svc->vcpu->domain == d || is_idle_vcpu(svc->vcpu) )
+            {
+                if ( svc != snext )
+                    *migrated = 0;
+                snext = svc;
+                break;
+            }
+        }
+        __runq_remove(snext);
+
+        if ( is_idle_vcpu(snext->vcpu) )
+            return snext;
+    }
+
+    for_each_cpu ( sib, per_cpu(cpu_sibling_mask, cpu) )
+    {
+        const struct vcpu *v = curr_on_cpu(sib);
+
+        if ( sib == cpu || !cpumask_test_cpu(sib, prv->cpus) ||
+             is_idle_vcpu(v) || v->domain == snext->vcpu->domain )
+            continue;
+
+        SCHED_STAT_CRANK(core_sched_evict);
+        cpu_raise_softirq(sib, SCHEDULE_SOFTIRQ);
+    }
+
+    return snext;
+}
+
 /*
  * This function is in the critical path. It is designed to be simple and
  * fast for the common case.
@@ -1851,6 +2058,10 @@ csched_schedule(
     else
         snext = csched_load_balance(prv, cpu, snext, &ret.migrated);
 
+    if ( unlikely(sched_core) && !tasklet_work_scheduled &&
+         !is_idle_vcpu(snext->vcpu) )
+        snext = csched_core_pick(prv, cpu, snext, &ret.migrated);
+
     /*
      * Update idlers mask if necessary. When we're idling, other CPUs
      * will tickle us when they get extra work.
@@ -1866,8 +2077,13 @@ csched_schedule(
     }
 
     if ( !is_idle_vcpu(snext->vcpu) )
+    {
         snext->start_time += now;
 
+        if ( unlikely(CSCHED_PCPU(cpu)->tick_stopped) )
+            csched_tick_restart(prv, CSCHED_PCPU(cpu), now);
+    }
+
 out:
     /*
      * Return task to run next...
@@ -2100,20 +2316,8 @@ static void csched_tick_suspend(const struct scheduler *ops, unsigned int cpu)
     spc = CSCHED_PCPU(cpu);
 
     stop_timer(&spc->ticker);
-}
-
-static void csched_tick_resume(const struct scheduler *ops, unsigned int cpu)
-{
-    struct csched_private *prv;
-    struct csched_pcpu *spc;
-    uint64_t now = NOW();
-
-    spc = CSCHED_PCPU(cpu);
-
-    prv = CSCHED_PRIV(ops);
-
-    set_timer(&spc->ticker, now + MICROSECS(prv->tick_period_us)
-            - now % MICROSECS(prv->tick_period_us) );
+    /* csched_schedule() restarts it, when there is something to run. */
+    spc->tick_stopped = 1;
 }
 
 static const struct scheduler sched_credit_def = {
@@ -2131,9 +2335,11 @@ static const struct scheduler sched_credit_def = {
     .sleep          = csched_vcpu_sleep,
     .wake           = csched_vcpu_wake,
     .yield          = csched_vcpu_yield,
+    .yield_to       = csched_vcpu_yield_to,
 
     .adjust         = csched_dom_cntl,
     .adjust_global  = csched_sys_cntl,
+    .set_profile    = csched_set_profile,
 
     .pick_cpu       = csched_cpu_pick,
     .do_schedule    = csched_schedule,
@@ -2153,7 +2359,6 @@ static const struct scheduler sched_credit_def = {
     .free_domdata   = csched_free_domdata,
 
     .tick_suspend   = csched_tick_suspend,
-    .tick_resume    = csched_tick_resume,
 };
 
 REGISTER_SCHEDULER(sched_credit_def);
@@ -54,6 +54,7 @@
 #define TRC_CSCHED2_LOAD_CHECK       TRC_SCHED_CLASS_EVT(CSCHED2, 16)
 #define TRC_CSCHED2_LOAD_BALANCE     TRC_SCHED_CLASS_EVT(CSCHED2, 17)
 #define TRC_CSCHED2_PICKED_CPU       TRC_SCHED_CLASS_EVT(CSCHED2, 19)
+#define TRC_CSCHED2_PICK_CAND        TRC_SCHED_CLASS_EVT(CSCHED2, 20)
 
 /*
  * WARNING: This is still in an experimental phase.  Status and work can be found at the
@@ -185,6 +186,14 @@
 static unsigned int __read_mostly opt_migrate_resist = 500;
 integer_param("sched_credit2_migrate_resist", opt_migrate_resist);
 
+/*
+ * Maximum number of busy pcpus runq_tickle() looks at when searching for
+ * one to preempt (0 means no limit). Tickling happens with the runqueue
+ * lock held, so this bounds its hold time on big runqueues.
+ */
+static unsigned int __read_mostly opt_tickle_scan = 16;
+integer_param("credit2_tickle_scan", opt_tickle_scan);
+
 /*
  * Useful macros
  */
@@ -283,6 +292,32 @@ integer_param("credit2_balance_under", opt_underload_balance_tolerance);
 static int __read_mostly opt_overload_balance_tolerance = -3;
 integer_param("credit2_balance_over", opt_overload_balance_tolerance);
 
+/*
+ * Placement weights.
+ *
+ * When choosing a runqueue for a vcpu, csched2_cpu_pick() adds to the load
+ * of each candidate a cost reflecting how good a home it would be for the
+ * vcpu. The weights below are percentages of the load of one fully busy
+ * vcpu:
+ *  - numa_penalty is charged for every LOCAL_DISTANCE units of node
+ *    distance between the runqueue and the closest node in the domain's
+ *    node affinity (so, once, for a typical remote node), or the domain's
+ *    NUMA balancing home node, if it has one within that affinity. It is
+ *    also accounted for by balance_load() when evaluating a push or a pull;
+ *  - llc_bonus is subtracted if the runqueue shares the last level cache
+ *    (approximated by the socket) with the pcpu of the vcpu that last woke
+ *    this one up (typically, the other end of an event channel);
+ *  - migrate_cost is charged for any runqueue other than the current one.
+ */
+static unsigned int __read_mostly opt_numa_penalty = 50;
+integer_param("credit2_numa_penalty", opt_numa_penalty);
+static unsigned int __read_mostly opt_llc_bonus = 25;
+integer_param("credit2_llc_bonus", opt_llc_bonus);
+static unsigned int __read_mostly opt_migrate_cost = 10;
+integer_param("credit2_migrate_cost", opt_migrate_cost);
+
+#define LOCAL_DISTANCE 10
+
 /*
  * Runqueue organization.
  *
@@ -360,6 +395,8 @@ struct csched2_runqueue_data {
     s_time_t load_last_update;  /* Last time average was updated */
     s_time_t avgload;           /* Decaying queue load */
     s_time_t b_avgload;         /* Decaying queue load modified by balancing */
+    unsigned int freq_util;     /* Utilisation last reported to cpufreq */
+    bool_t freq_boost;          /* Boost last requested from cpufreq */
 };
 
 /*
@@ -378,6 +415,7 @@ struct csched2_private {
     unsigned int load_precision_shift;
     unsigned int load_window_shift;
     unsigned ratelimit_us; /* each cpupool can have its own ratelimit */
+    int runqueue;          /* ... and runqueue arrangement (OPT_RUNQUEUE_*) */
 };
 
 /*
@@ -403,6 +441,8 @@ struct csched2_vcpu {
     s_time_t load_last_update;  /* Last time average was updated */
     s_time_t avgload;           /* Decaying queue load */
 
+    int waker_cpu;       /* pcpu of the vcpu that last woke us, or -1 */
+
     struct csched2_runqueue_data *migrate_rqd; /* Pre-determined rqd to which to migrate */
 };
 
@@ -664,6 +704,38 @@ __runq_elem(struct list_head *elem)
  *
  * Which, in both cases, is what we expect.
  */
+/*
+ * Tell the "sched" cpufreq governor how busy the pCPUs of the runqueue are.
+ * Only significant changes are reported, i.e., when vCPUs start or stop
+ * queueing up, or when utilisation moved by at least 1/16th of a pCPU.
+ */
+static void
+update_runq_freq(struct csched2_runqueue_data *rqd, unsigned int P)
+{
+    unsigned int nr = cpumask_weight(&rqd->active);
+    unsigned int util = 0;
+    bool_t boost;
+
+    if ( !nr )
+        return;
+
+    if ( rqd->load )
+    {
+        s_time_t avg = (rqd->avgload * CPUFREQ_SCHED_UTIL_SCALE >> P) / nr;
+
+        util = min_t(s_time_t, avg, CPUFREQ_SCHED_UTIL_SCALE);
+    }
+    boost = rqd->load > (int)nr;
+
+    if ( boost == rqd->freq_boost &&
+         ABS((int)util - (int)rqd->freq_util) < CPUFREQ_SCHED_UTIL_SCALE / 16 )
+        return;
+
+    rqd->freq_util = util;
+    rqd->freq_boost = boost;
+    cpufreq_sched_update(&rqd->active, util, boost);
+}
+
 static void
 __update_runq_load(const struct scheduler *ops,
                   struct csched2_runqueue_data *rqd, int change, s_time_t now)
@@ -734,6 +806,9 @@ __update_runq_load(const struct scheduler *ops,
     /* Overflow, capable of making the load look negative, must not occur. */
     ASSERT(rqd->avgload >= 0 && rqd->b_avgload >= 0);
 
+    if ( cpufreq_sched_users )
+        update_runq_freq(rqd, P);
+
     if ( unlikely(tb_init_done) )
     {
         struct {
@@ -908,6 +983,7 @@ static void
 runq_tickle(const struct scheduler *ops, struct csched2_vcpu *new, s_time_t now)
 {
     int i, ipid = -1;
+    unsigned int budget = opt_tickle_scan ?: UINT_MAX;
     s_time_t lowest = (1<<30);
     unsigned int cpu = new->vcpu->processor;
     struct csched2_runqueue_data *rqd = RQD(ops, cpu);
@@ -988,11 +1064,21 @@ runq_tickle(const struct scheduler *ops, struct csched2_vcpu *new, s_time_t now)
         }
     }
 
-    for_each_cpu(i, &mask)
+    /*
+     * Scan the others, starting from the one after cpu, and looking at no
+     * more than budget of them. Visited pcpus are removed from mask, so
+     * cycling through it terminates.
+     */
+    __cpumask_clear_cpu(cpu, &mask);
+    for ( i = cpumask_cycle(cpu, &mask); i < nr_cpu_ids;
+          i = cpumask_cycle(i, &mask) )
     {
-        /* Already looked at this one above */
-        if ( i == cpu )
-            continue;
+        if ( !budget-- )
+        {
+            SCHED_STAT_CRANK(tickle_scan_cut);
+            break;
+        }
+        __cpumask_clear_cpu(i, &mask);
 
         cur = CSCHED2_VCPU(curr_on_cpu(i));
 
@@ -1260,6 +1346,7 @@ csched2_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
     svc->sdom = dd;
     svc->vcpu = vc;
     svc->flags = 0U;
+    svc->waker_cpu = -1;
 
     if ( ! is_idle_vcpu(vc) )
     {
@@ -1379,6 +1466,13 @@ csched2_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
 
     ASSERT(!is_idle_vcpu(vc));
 
+    /*
+     * Remember who is waking us (e.g., the sender of an event), so that
+     * csched2_cpu_pick() can try to keep us close to them.
+     */
+    if ( !is_idle_vcpu(current) && current != vc )
+        svc->waker_cpu = current->processor;
+
     if ( unlikely(curr_on_cpu(cpu) == vc) )
     {
         SCHED_STAT_CRANK(vcpu_wake_running);
@@ -1423,6 +1517,32 @@ out:
     return;
 }
 
+static void
+csched2_vcpu_yield_to(const struct scheduler *ops, struct vcpu *vc,
+                      struct vcpu *target)
+{
+    struct csched2_vcpu * const svc = CSCHED2_VCPU(vc);
+    struct csched2_vcpu * const tsvc = CSCHED2_VCPU(target);
+    int transfer;
+
+    /*
+     * Only if both vcpus share the runqueue whose lock we hold.  Moving
+     * credit within a domain doesn't alter its overall share, and giving
+     * the target more than the spinner is left with gets it picked next.
+     */
+    if ( !__vcpu_on_runq(tsvc) || svc->rqd != tsvc->rqd ||
+         svc->credit <= tsvc->credit )
+        return;
+
+    transfer = (svc->credit - tsvc->credit) / 2 + 1;
+    svc->credit -= transfer;
+    tsvc->credit += transfer;
+
+    __runq_remove(tsvc);
+    runq_insert(ops, tsvc);
+    runq_tickle(ops, tsvc, NOW());
+}
+
 static void
 csched2_context_saved(const struct scheduler *ops, struct vcpu *vc)
 {
@@ -1458,14 +1578,108 @@ csched2_context_saved(const struct scheduler *ops, struct vcpu *vc)
     vcpu_schedule_unlock_irq(lock, vc);
 }
 
-#define MAX_LOAD (STIME_MAX);
+/*
+ * Cost, in load units, of svc's memory being far from rqd. The caller must
+ * hold rqd's lock, and rqd must have at least one active pcpu.
+ */
+static s_time_t numa_cost(const struct csched2_private *prv,
+                          const struct csched2_vcpu *svc,
+                          const struct csched2_runqueue_data *rqd,
+                          unsigned int *distance)
+{
+    const struct domain *d = svc->vcpu->domain;
+    nodeid_t node = cpu_to_node(cpumask_first(&rqd->active)), n;
+    nodeid_t home = d->numa_home;
+    unsigned int dist = LOCAL_DISTANCE;
+
+    if ( opt_numa_penalty && home != NUMA_NO_NODE &&
+         node_isset(home, d->node_affinity) )
+    {
+        /* Pull towards the node holding the memory being accessed. */
+        if ( node != home )
+            dist = max_t(unsigned int, __node_distance(node, home),
+                         LOCAL_DISTANCE);
+    }
+    else if ( opt_numa_penalty && !node_isset(node, d->node_affinity) )
+    {
+        dist = UINT_MAX;
+        for_each_node_mask ( n, d->node_affinity )
+            dist = min_t(unsigned int, dist, __node_distance(node, n));
+        if ( dist == UINT_MAX || dist < LOCAL_DISTANCE )
+            dist = LOCAL_DISTANCE;
+    }
+
+    if ( distance )
+        *distance = dist;
+
+    return ((((s_time_t)1 << prv->load_precision_shift) / 100) *
+            opt_numa_penalty * (dist - LOCAL_DISTANCE)) / LOCAL_DISTANCE;
+}
+
+#define PICK_LLC_SHARED  (1U << 0)
+#define PICK_MIGRATE     (1U << 1)
+
+/*
+ * Score rqd as a new home for svc: its load (b_avgload) plus the placement
+ * cost. The lower, the better. The caller must hold rqd's lock.
+ */
+static s_time_t pick_score(const struct csched2_private *prv,
+                           const struct csched2_vcpu *svc,
+                           const struct csched2_runqueue_data *rqd,
+                           s_time_t b_avgload)
+{
+    s_time_t unit = ((s_time_t)1 << prv->load_precision_shift) / 100;
+    s_time_t score;
+    unsigned int distance, flags = 0;
+
+    score = b_avgload + numa_cost(prv, svc, rqd, &distance);
+
+    if ( opt_llc_bonus && svc->waker_cpu >= 0 &&
+         cpu_to_socket(cpumask_first(&rqd->active)) ==
+         cpu_to_socket(svc->waker_cpu) )
+    {
+        score -= unit * opt_llc_bonus;
+        flags |= PICK_LLC_SHARED;
+    }
+
+    if ( rqd != svc->rqd )
+    {
+        score += unit * opt_migrate_cost;
+        flags |= PICK_MIGRATE;
+    }
+
+    score = max_t(s_time_t, score, 0);
+
+    if ( unlikely(tb_init_done) )
+    {
+        struct {
+            uint64_t b_avgload, score;
+            unsigned vcpu:16, dom:16;
+            unsigned rq_id:16, distance:8, flags:8;
+        } d;
+        d.dom = svc->vcpu->domain->domain_id;
+        d.vcpu = svc->vcpu->vcpu_id;
+        d.rq_id = rqd->id;
+        d.b_avgload = b_avgload;
+        d.score = score;
+        d.distance = min_t(unsigned int, distance, 0xff);
+        d.flags = flags;
+        __trace_var(TRC_CSCHED2_PICK_CAND, 1,
+                    sizeof(d),
+                    (unsigned char *)&d);
+    }
+
+    return score;
+}
+
+#define MAX_LOAD (STIME_MAX)
 static int
 csched2_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
 {
     struct csched2_private *prv = CSCHED2_PRIV(ops);
     int i, min_rqi = -1, new_cpu;
     struct csched2_vcpu *svc = CSCHED2_VCPU(vc);
-    s_time_t min_avgload = MAX_LOAD;
+    s_time_t min_avgload = MAX_LOAD, min_score = MAX_LOAD;
 
     ASSERT(!cpumask_empty(&prv->active_queues));
 
@@ -1519,11 +1733,14 @@ csched2_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
         /* Fall-through to normal cpu pick */
     }
 
-    /* Find the runqueue with the lowest average load. */
+    /*
+     * Find the runqueue with the lowest average load, adjusted by how
+     * suitable it is for the vcpu (see pick_score()).
+     */
     for_each_cpu(i, &prv->active_queues)
     {
         struct csched2_runqueue_data *rqd;
-        s_time_t rqd_avgload = MAX_LOAD;
+        s_time_t rqd_avgload = MAX_LOAD, rqd_score = MAX_LOAD;
 
         rqd = prv->rqd + i;
 
@@ -1543,18 +1760,25 @@ csched2_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
         if ( rqd == svc->rqd )
         {
             if ( cpumask_intersects(vc->cpu_hard_affinity, &rqd->active) )
+            {
                 rqd_avgload = max_t(s_time_t, rqd->b_avgload - svc->avgload, 0);
+                rqd_score = pick_score(prv, svc, rqd, rqd_avgload);
+            }
         }
         else if ( spin_trylock(&rqd->lock) )
         {
             if ( cpumask_intersects(vc->cpu_hard_affinity, &rqd->active) )
+            {
                 rqd_avgload = rqd->b_avgload;
+                rqd_score = pick_score(prv, svc, rqd, rqd_avgload);
+            }
 
             spin_unlock(&rqd->lock);
         }
 
-        if ( rqd_avgload < min_avgload )
+        if ( rqd_score < min_score )
         {
+            min_score = rqd_score;
             min_avgload = rqd_avgload;
             min_rqi = i;
         }
@@ -1605,6 +1829,7 @@ typedef struct {
     /* NB: Read by consider() */
     struct csched2_runqueue_data *lrqd;
     struct csched2_runqueue_data *orqd;                  
+    const struct csched2_private *prv;
 } balance_state_t;
 
 static void consider(balance_state_t *st, 
@@ -1632,6 +1857,14 @@ static void consider(balance_state_t *st,
     if ( delta < 0 )
         delta = -delta;
 
+    /* Moving a vcpu away from its memory costs; moving it closer pays. */
+    if ( push_svc )
+        delta += numa_cost(st->prv, push_svc, st->orqd, NULL) -
+                 numa_cost(st->prv, push_svc, st->lrqd, NULL);
+    if ( pull_svc )
+        delta += numa_cost(st->prv, pull_svc, st->lrqd, NULL) -
+                 numa_cost(st->prv, pull_svc, st->orqd, NULL);
+
     if ( delta < st->load_delta )
     {
         st->load_delta = delta;
@@ -1718,7 +1951,8 @@ static void balance_load(const struct scheduler *ops, int cpu, s_time_t now)
     struct list_head *push_iter, *pull_iter;
     bool_t inner_load_updated = 0;
 
-    balance_state_t st = { .best_push_svc = NULL, .best_pull_svc = NULL };
+    balance_state_t st = { .best_push_svc = NULL, .best_pull_svc = NULL,
+                           .prv = prv };
 
     /*
      * Basic algorithm: Push, pull, or swap.
@@ -2012,6 +2246,46 @@ static int csched2_sys_cntl(const struct scheduler *ops,
     return rc;
 }
 
+/*
+ * Tuning profiles of a cpupool, see XEN_SYSCTL_CPUPOOL_OP_SETPROFILE.
+ * Bigger runqueues find an idle cpu for a waking vcpu more easily, smaller
+ * ones keep vcpus closer to their caches.  As cpus are only assigned to a
+ * runqueue when added to the pool, the runqueue arrangement only applies
+ * to cpus added afterwards.
+ */
+#define CSCHED2_THROUGHPUT_RATELIMIT_US 5000
+
+static int
+csched2_set_profile(const struct scheduler *ops, unsigned int profile)
+{
+    struct csched2_private *prv = CSCHED2_PRIV(ops);
+    unsigned long flags;
+
+    write_lock_irqsave(&prv->lock, flags);
+
+    switch ( profile )
+    {
+    case XEN_SYSCTL_CPUPOOL_PROFILE_LATENCY:
+        prv->ratelimit_us = XEN_SYSCTL_SCHED_RATELIMIT_MIN;
+        prv->runqueue = OPT_RUNQUEUE_SOCKET;
+        break;
+
+    case XEN_SYSCTL_CPUPOOL_PROFILE_THROUGHPUT:
+        prv->ratelimit_us = CSCHED2_THROUGHPUT_RATELIMIT_US;
+        prv->runqueue = OPT_RUNQUEUE_CORE;
+        break;
+
+    default:
+        prv->ratelimit_us = sched_ratelimit_us;
+        prv->runqueue = opt_runqueue;
+        break;
+    }
+
+    write_unlock_irqrestore(&prv->lock, flags);
+
+    return 0;
+}
+
 static void *
 csched2_alloc_domdata(const struct scheduler *ops, struct domain *dom)
 {
@@ -2226,6 +2500,97 @@ csched2_runtime(const struct scheduler *ops, int cpu,
 
 void __dump_execstate(void *unused);
 
+/*
+ * Core scheduling.
+ *
+ * With sched_core, the threads of a core only run vcpus of the same domain
+ * at the same time. All the siblings of a pcpu that are in the same runqueue
+ * are serialized by the runqueue lock, and their curr pointers are updated
+ * with that lock held, so the following is stable while we hold it.
+ *
+ * A pcpu may pick a vcpu of a different domain than the one its siblings
+ * are running only if it has more credit (by CSCHED2_MIGRATE_RESIST) than
+ * all of them. If it does so, the siblings are tickled, and when they go
+ * through the scheduler they will pick a vcpu of the new domain, or idle.
+ * The old domain may run on the siblings until they have context switched
+ * away, which is not synchronized with the switch on this pcpu.
+ */
+static const struct domain *
+core_sibling_domain(const struct csched2_runqueue_data *rqd,
+                    unsigned int cpu, int *max_credit)
+{
+    const struct domain *d = NULL;
+    unsigned int sib;
+
+    *max_credit = INT_MIN;
+
+    for_each_cpu ( sib, per_cpu(cpu_sibling_mask, cpu) )
+    {
+        const struct vcpu *v = curr_on_cpu(sib);
+
+        if ( sib == cpu || !cpumask_test_cpu(sib, &rqd->active) ||
+             is_idle_vcpu(v) )
+            continue;
+
+        if ( d == NULL )
+            d = v->domain;
+        *max_credit = max(*max_credit, CSCHED2_VCPU(v)->credit);
+    }
+
+    return d;
+}
+
+static void
+core_evict_siblings(struct csched2_runqueue_data *rqd, unsigned int cpu,
+                    const struct domain *d)
+{
+    unsigned int sib;
+
+    for_each_cpu ( sib, per_cpu(cpu_sibling_mask, cpu) )
+    {
+        const struct vcpu *v = curr_on_cpu(sib);
+
+        if ( sib == cpu || !cpumask_test_cpu(sib, &rqd->active) ||
+             is_idle_vcpu(v) || v->domain == d )
+            continue;
+
+        SCHED_STAT_CRANK(core_sched_evict);
+        __cpumask_set_cpu(sib, &rqd->tickled);
+        cpu_raise_softirq(sib, SCHEDULE_SOFTIRQ);
+    }
+}
+
+/* Best vcpu of domain d that can run on cpu, or idle. */
+static struct csched2_vcpu *
+runq_core_candidate(struct csched2_runqueue_data *rqd,
+                    struct csched2_vcpu *scurr, int cpu,
+                    const struct domain *d)
+{
+    struct list_head *iter;
+    struct csched2_vcpu *snext = CSCHED2_VCPU(idle_vcpu[cpu]);
+
+    SCHED_STAT_CRANK(core_sched_filtered);
+
+    if ( vcpu_runnable(scurr->vcpu) && scurr->vcpu->domain == d )
+        snext = scurr;
+
+    list_for_each( iter, &rqd->runq )
+    {
+        struct csched2_vcpu * svc = list_entry(iter, struct csched2_vcpu, runq_elem);
+
+        if ( svc->vcpu->domain != d ||
+             !cpumask_test_cpu(cpu, svc->vcpu->cpu_hard_affinity) )
+            continue;
+
+        if ( svc->credit > snext->credit )
+            snext = svc;
+
+        break;
+    }
+
+    return snext;
+}
+
 /*
  * Find a candidate.
  */
@@ -2237,6 +2602,11 @@ runq_candidate(struct csched2_runqueue_data *rqd,
     struct list_head *iter;
     struct csched2_vcpu *snext = NULL;
     struct csched2_private *prv = CSCHED2_PRIV(per_cpu(scheduler, cpu));
+    const struct domain *cdom = NULL;
+    int cdom_credit = 0;
+
+    if ( unlikely(sched_core) )
+        cdom = core_sibling_domain(rqd, cpu, &cdom_credit);
 
     /* Default to current if runnable, idle otherwise */
     if ( vcpu_runnable(scurr->vcpu) )
@@ -2251,6 +2621,7 @@ runq_candidate(struct csched2_runqueue_data *rqd,
      */
     if ( prv->ratelimit_us && !is_idle_vcpu(scurr->vcpu) &&
          vcpu_runnable(scurr->vcpu) &&
+         (cdom == NULL || scurr->vcpu->domain == cdom) &&
          (now - scurr->vcpu->runstate.state_entry_time) <
           MICROSECS(prv->ratelimit_us) )
         return scurr;
@@ -2282,6 +2653,12 @@ runq_candidate(struct csched2_runqueue_data *rqd,
 
     }
 
+    /* With core scheduling, switching domain must be worth it. */
+    if ( cdom != NULL && !is_idle_vcpu(snext->vcpu) &&
+         snext->vcpu->domain != cdom &&
+         snext->credit <= cdom_credit + CSCHED2_MIGRATE_RESIST )
+        snext = runq_core_candidate(rqd, scurr, cpu, cdom);
+
     return snext;
 }
 
@@ -2348,6 +2725,9 @@ csched2_schedule(
     else
         snext=runq_candidate(rqd, scurr, cpu, now);
 
+    if ( unlikely(sched_core) && !is_idle_vcpu(snext->vcpu) )
+        core_evict_siblings(rqd, cpu, snext->vcpu->domain);
+
     /* If switching from a non-idle runnable vcpu, put it
      * back on the runqueue. */
     if ( snext != scurr
@@ -2516,9 +2896,13 @@ csched2_dump(const struct scheduler *ops)
     read_lock_irqsave(&prv->lock, flags);
 
     printk("Active queues: %d\n"
-           "\tdefault-weight     = %d\n",
+           "\tdefault-weight     = %d\n"
+           "\tratelimit          = %uus\n"
+           "\trunqueues          = %s\n",
            cpumask_weight(&prv->active_queues),
-           CSCHED2_DEFAULT_WEIGHT);
+           CSCHED2_DEFAULT_WEIGHT,
+           prv->ratelimit_us,
+           opt_runqueue_str[prv->runqueue]);
     for_each_cpu(i, &prv->active_queues)
     {
         s_time_t fraction;
@@ -2658,10 +3042,10 @@ cpu_to_runqueue(struct csched2_private *prv, unsigned int cpu)
         BUG_ON(cpu_to_socket(cpu) == XEN_INVALID_SOCKET_ID ||
                cpu_to_socket(peer_cpu) == XEN_INVALID_SOCKET_ID);
 
-        if ( opt_runqueue == OPT_RUNQUEUE_ALL ||
-             (opt_runqueue == OPT_RUNQUEUE_CORE && same_core(peer_cpu, cpu)) ||
-             (opt_runqueue == OPT_RUNQUEUE_SOCKET && same_socket(peer_cpu, cpu)) ||
-             (opt_runqueue == OPT_RUNQUEUE_NODE && same_node(peer_cpu, cpu)) )
+        if ( prv->runqueue == OPT_RUNQUEUE_ALL ||
+             (prv->runqueue == OPT_RUNQUEUE_CORE && same_core(peer_cpu, cpu)) ||
+             (prv->runqueue == OPT_RUNQUEUE_SOCKET && same_socket(peer_cpu, cpu)) ||
+             (prv->runqueue == OPT_RUNQUEUE_NODE && same_node(peer_cpu, cpu)) )
             break;
     }
 
@@ -2880,6 +3264,7 @@ csched2_init(struct scheduler *ops)
     }
     /* initialize ratelimit */
     prv->ratelimit_us = sched_ratelimit_us;
+    prv->runqueue = opt_runqueue;
 
     prv->load_precision_shift = opt_load_precision_shift;
     prv->load_window_shift = opt_load_window_shift - LOADAVG_GRANULARITY_SHIFT;
@@ -2912,9 +3297,11 @@ static const struct scheduler sched_credit2_def = {
 
     .sleep          = csched2_vcpu_sleep,
     .wake           = csched2_vcpu_wake,
+    .yield_to       = csched2_vcpu_yield_to,
 
     .adjust         = csched2_dom_cntl,
     .adjust_global  = csched2_sys_cntl,
+    .set_profile    = csched2_set_profile,
 
     .pick_cpu       = csched2_cpu_pick,
     .migrate        = csched2_vcpu_migrate,
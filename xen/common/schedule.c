@@ -35,6 +35,8 @@
 #include <xen/cpu.h>
 #include <xen/preempt.h>
 #include <xen/event.h>
+#include <xen/lathist.h>
+#include <xen/vcpustats.h>
 #include <public/sched.h>
 #include <xsm/xsm.h>
 #include <xen/err.h>
@@ -50,6 +52,13 @@ string_param("sched", opt_sched);
 bool_t sched_smt_power_savings = 0;
 boolean_param("sched_smt_power_savings", sched_smt_power_savings);
 
+/* if sched_core is set,
+ * the schedulers that support it only run, at the same time, vCPUs of the
+ * same domain on the SMT siblings of a core (of the same cpupool).
+ */
+bool_t __read_mostly sched_core = 0;
+boolean_param("sched_core", sched_core);
+
 /* Default scheduling rate limit: 1ms 
  * The behavior when sched_ratelimit_us is greater than sched_credit_tslice_ms is undefined
  * */
@@ -147,6 +156,7 @@ static inline void vcpu_runstate_change(
     struct vcpu *v, int new_state, s_time_t new_entry_time)
 {
     s_time_t delta;
+    int old_state = v->runstate.state;
 
     ASSERT(v->runstate.state != new_state);
     ASSERT(spin_is_locked(per_cpu(schedule_data,v->processor).schedule_lock));
@@ -163,6 +173,9 @@ static inline void vcpu_runstate_change(
     }
 
     v->runstate.state = new_state;
+
+    vcpustats_update(v, old_state == RUNSTATE_blocked &&
+                        new_state == RUNSTATE_runnable);
 }
 
 void vcpu_runstate_get(struct vcpu *v, struct vcpu_runstate_info *runstate)
@@ -261,6 +274,8 @@ int sched_init_vcpu(struct vcpu *v, unsigned int processor)
         SCHED_OP(DOM2OP(d), insert_vcpu, v);
     }
 
+    vcpustats_init_vcpu(v);
+
     return 0;
 }
 
@@ -270,15 +285,17 @@ static void sched_move_irqs(struct vcpu *v)
     evtchn_move_pirqs(v);
 }
 
-int sched_move_domain(struct domain *d, struct cpupool *c)
+/*
+ * Moving a domain to another cpupool is split in three steps, so that the
+ * allocations can be done up front and outside of cpupool_lock:
+ * sched_move_prepare() allocates the private data of the new scheduler,
+ * sched_move_commit() switches the (paused) domain over to it, and
+ * sched_move_abort() frees the data of a move which didn't take place.
+ */
+int sched_move_prepare(struct domain *d, struct cpupool *c,
+                       struct sched_move_data *m)
 {
     struct vcpu *v;
-    unsigned int new_p;
-    void **vcpu_priv;
-    void *domdata;
-    void *vcpudata;
-    struct scheduler *old_ops;
-    void *old_domdata;
 
     for_each_vcpu ( d, v )
     {
@@ -286,31 +303,58 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
             return -EBUSY;
     }
 
-    domdata = SCHED_OP(c->sched, alloc_domdata, d);
-    if ( domdata == NULL )
+    m->domdata = SCHED_OP(c->sched, alloc_domdata, d);
+    if ( m->domdata == NULL )
         return -ENOMEM;
 
-    vcpu_priv = xzalloc_array(void *, d->max_vcpus);
-    if ( vcpu_priv == NULL )
+    m->nr_vcpus = d->max_vcpus;
+    m->vcpu_priv = xzalloc_array(void *, m->nr_vcpus);
+    if ( m->vcpu_priv == NULL )
     {
-        SCHED_OP(c->sched, free_domdata, domdata);
+        SCHED_OP(c->sched, free_domdata, m->domdata);
         return -ENOMEM;
     }
 
     for_each_vcpu ( d, v )
     {
-        vcpu_priv[v->vcpu_id] = SCHED_OP(c->sched, alloc_vdata, v, domdata);
-        if ( vcpu_priv[v->vcpu_id] == NULL )
+        m->vcpu_priv[v->vcpu_id] = SCHED_OP(c->sched, alloc_vdata, v,
+                                            m->domdata);
+        if ( m->vcpu_priv[v->vcpu_id] == NULL )
         {
-            for_each_vcpu ( d, v )
-                xfree(vcpu_priv[v->vcpu_id]);
-            xfree(vcpu_priv);
-            SCHED_OP(c->sched, free_domdata, domdata);
+            sched_move_abort(c, m);
             return -ENOMEM;
         }
     }
 
-    domain_pause(d);
+    return 0;
+}
+
+void sched_move_abort(struct cpupool *c, struct sched_move_data *m)
+{
+    unsigned int i;
+
+    for ( i = 0; i < m->nr_vcpus; i++ )
+        if ( m->vcpu_priv[i] != NULL )
+            SCHED_OP(c->sched, free_vdata, m->vcpu_priv[i]);
+    xfree(m->vcpu_priv);
+    SCHED_OP(c->sched, free_domdata, m->domdata);
+}
+
+/* The domain must be paused, and the cpupool_lock held. */
+int sched_move_commit(struct domain *d, struct cpupool *c,
+                      struct sched_move_data *m)
+{
+    struct vcpu *v;
+    unsigned int new_p;
+    void *vcpudata;
+    struct scheduler *old_ops;
+    void *old_domdata;
+
+    for_each_vcpu ( d, v )
+    {
+        if ( v->affinity_broken )
+            return -EBUSY;
+    }
 
     old_ops = DOM2OP(d);
     old_domdata = d->sched_priv;
@@ -321,7 +365,7 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
     }
 
     d->cpupool = c;
-    d->sched_priv = domdata;
+    d->sched_priv = m->domdata;
 
     new_p = cpumask_first(c->cpu_valid);
     for_each_vcpu ( d, v )
@@ -346,7 +390,7 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
          */
         spin_unlock_irq(lock);
 
-        v->sched_priv = vcpu_priv[v->vcpu_id];
+        v->sched_priv = m->vcpu_priv[v->vcpu_id];
         if ( !d->is_dying )
             sched_move_irqs(v);
 
@@ -359,17 +403,45 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
 
     domain_update_node_affinity(d);
 
-    domain_unpause(d);
-
     SCHED_OP(old_ops, free_domdata, old_domdata);
 
-    xfree(vcpu_priv);
+    xfree(m->vcpu_priv);
 
     return 0;
 }
 
+int sched_move_domain(struct domain *d, struct cpupool *c)
+{
+    struct sched_move_data m;
+    int ret;
+
+    ret = sched_move_prepare(d, c, &m);
+    if ( ret )
+        return ret;
+
+    domain_pause(d);
+
+    ret = sched_move_commit(d, c, &m);
+
+    domain_unpause(d);
+
+    if ( ret )
+        sched_move_abort(c, &m);
+
+    return ret;
+}
+
+int sched_set_profile(struct cpupool *c, unsigned int profile)
+{
+    if ( c->sched->set_profile == NULL )
+        return -EOPNOTSUPP;
+
+    return SCHED_OP(c->sched, set_profile, profile);
+}
+
 void sched_destroy_vcpu(struct vcpu *v)
 {
+    vcpustats_destroy_vcpu(v);
     kill_timer(&v->periodic_timer);
     kill_timer(&v->singleshot_timer);
     kill_timer(&v->poll_timer);
@@ -864,6 +936,35 @@ static void vcpu_block_enable_events(void)
     vcpu_block();
 }
 
+/*
+ * When v is caught spinning, a preempted sibling (runnable, but not
+ * running) is the likely holder of the contended lock.  Have the scheduler
+ * boost the first one found after v, so that it can make progress.
+ */
+static void vcpu_boost_sibling(struct vcpu *v)
+{
+    struct domain *d = v->domain;
+    unsigned int i;
+
+    for ( i = 1; i < d->max_vcpus; i++ )
+    {
+        struct vcpu *t = d->vcpu[(v->vcpu_id + i) % d->max_vcpus];
+        spinlock_t *lock;
+
+        if ( !t || t->is_running || !vcpu_runnable(t) )
+            continue;
+
+        lock = vcpu_schedule_lock_irq(t);
+        if ( !t->is_running && vcpu_runnable(t) )
+        {
+            SCHED_STAT_CRANK(vcpu_yield_to);
+            SCHED_OP(VCPU2OP(t), yield_to, v, t);
+        }
+        vcpu_schedule_unlock_irq(lock, t);
+        break;
+    }
+}
+
 static long do_poll(struct sched_poll *sched_poll)
 {
     struct vcpu   *v = current;
@@ -926,6 +1027,9 @@ static long do_poll(struct sched_poll *sched_poll)
     if ( sched_poll->timeout != 0 )
         set_timer(&v->poll_timer, sched_poll->timeout);
 
+    /* PV spinlock waiters poll for the holder's kick: help the holder. */
+    vcpu_boost_sibling(v);
+
     TRACE_2D(TRC_SCHED_BLOCK, d->domain_id, v->vcpu_id);
     raise_softirq(SCHEDULE_SOFTIRQ);
 
@@ -952,6 +1056,14 @@ long vcpu_yield(void)
     return 0;
 }
 
+/* Yield, boosting a sibling which may hold the lock we're spinning on. */
+long vcpu_yield_directed(void)
+{
+    vcpu_boost_sibling(current);
+
+    return vcpu_yield();
+}
+
 static void domain_watchdog_timeout(void *data)
 {
     struct domain *d = data;
@@ -1346,8 +1458,8 @@ static void schedule(void)
 
     sd = &this_cpu(schedule_data);
 
-    /* Update tasklet scheduling status. */
-    switch ( *tasklet_work )
+    /* Update tasklet scheduling status.  Idle tasklets don't force idle. */
+    switch ( *tasklet_work & (TASKLET_enqueued|TASKLET_scheduled) )
     {
     case TASKLET_enqueued:
         set_bit(_TASKLET_scheduled, tasklet_work);
@@ -1410,6 +1522,15 @@ static void schedule(void)
         now);
     prev->last_run_time = now;
 
+    /*
+     * A vCPU descheduled while still runnable gets last_run_time set to its
+     * runstate entry time (see above), so any other runnable one was woken.
+     */
+    if ( next->runstate.state == RUNSTATE_runnable &&
+         next->runstate.state_entry_time != next->last_run_time &&
+         !is_idle_vcpu(next) )
+        lathist_wakeup(now - next->runstate.state_entry_time);
+
     ASSERT(next->runstate.state != RUNSTATE_running);
     vcpu_runstate_change(next, RUNSTATE_running, now);
 
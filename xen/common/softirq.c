@@ -11,7 +11,9 @@
 
 #include <xen/config.h>
 #include <xen/init.h>
+#include <xen/lathist.h>
 #include <xen/mm.h>
+#include <xen/perfc.h>
 #include <xen/preempt.h>
 #include <xen/sched.h>
 #include <xen/rcupdate.h>
@@ -26,10 +28,25 @@ static softirq_handler softirq_handlers[NR_SOFTIRQS];
 static DEFINE_PER_CPU(cpumask_t, batch_mask);
 static DEFINE_PER_CPU(unsigned int, batching);
 
+/* Softirqs which are not to wait behind the backlog of others. */
+#define LATENCY_SOFTIRQS ((1ul << TIMER_SOFTIRQ) | (1ul << SCHEDULE_SOFTIRQ) | \
+                          (1ul << NEW_TLBFLUSH_CLOCK_PERIOD_SOFTIRQ))
+
+/* Time (in microseconds) a handler may spend on a backlog in one go. */
+static unsigned int __read_mostly softirq_budget = 100;
+integer_param("softirq_budget", softirq_budget);
+
+/* When each softirq was raised, for the raise to handling histograms. */
+static DEFINE_PER_CPU(s_time_t[NR_SOFTIRQS], softirq_raised);
+/* Budget state of the handler running on this CPU. */
+static DEFINE_PER_CPU(s_time_t, softirq_start);
+static DEFINE_PER_CPU(unsigned long, softirq_ignore);
+
 static void __do_softirq(unsigned long ignore_mask)
 {
     unsigned int i, cpu;
     unsigned long pending;
+    s_time_t raised;
 
     for ( ; ; )
     {
@@ -48,10 +65,38 @@ static void __do_softirq(unsigned long ignore_mask)
 
         i = find_first_set_bit(pending);
         clear_bit(i, &softirq_pending(cpu));
+
+        raised = per_cpu(softirq_raised, cpu)[i];
+        per_cpu(softirq_raised, cpu)[i] = 0;
+        lathist_softirq(i, raised);
+
+        per_cpu(softirq_start, cpu) = 0;
+        per_cpu(softirq_ignore, cpu) = ignore_mask;
         (*softirq_handlers[i])();
     }
 }
 
+bool_t softirq_over_budget(void)
+{
+    unsigned int cpu = smp_processor_id();
+    s_time_t now = NOW();
+
+    if ( !per_cpu(softirq_start, cpu) )
+    {
+        per_cpu(softirq_start, cpu) = now;
+        return 0;
+    }
+
+    if ( !(softirq_pending(cpu) & LATENCY_SOFTIRQS &
+           ~per_cpu(softirq_ignore, cpu)) &&
+         now - per_cpu(softirq_start, cpu) < MICROSECS(softirq_budget) )
+        return 0;
+
+    perfc_incr(softirq_yields);
+
+    return 1;
+}
+
 void process_pending_softirqs(void)
 {
     ASSERT(!in_irq() && local_irq_is_enabled());
@@ -75,6 +120,7 @@ void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr)
 {
     unsigned int cpu, this_cpu = smp_processor_id();
     cpumask_t send_mask, *raise_mask;
+    s_time_t now = lathist_start();
 
     if ( !per_cpu(batching, this_cpu) || in_irq() )
     {
@@ -85,10 +131,13 @@ void cpumask_raise_softirq(const cpumask_t *mask, unsigned int nr)
         raise_mask = &per_cpu(batch_mask, this_cpu);
 
     for_each_cpu(cpu, mask)
-        if ( !test_and_set_bit(nr, &softirq_pending(cpu)) &&
-             cpu != this_cpu &&
-             !arch_skip_send_event_check(cpu) )
+    {
+        if ( test_and_set_bit(nr, &softirq_pending(cpu)) )
+            continue;
+        per_cpu(softirq_raised, cpu)[nr] = now;
+        if ( cpu != this_cpu && !arch_skip_send_event_check(cpu) )
             __cpumask_set_cpu(cpu, raise_mask);
+    }
 
     if ( raise_mask == &send_mask )
         smp_send_event_check_mask(raise_mask);
@@ -98,9 +147,12 @@ void cpu_raise_softirq(unsigned int cpu, unsigned int nr)
 {
     unsigned int this_cpu = smp_processor_id();
 
-    if ( test_and_set_bit(nr, &softirq_pending(cpu))
-         || (cpu == this_cpu)
-         || arch_skip_send_event_check(cpu) )
+    if ( test_and_set_bit(nr, &softirq_pending(cpu)) )
+        return;
+
+    per_cpu(softirq_raised, cpu)[nr] = lathist_start();
+
+    if ( (cpu == this_cpu) || arch_skip_send_event_check(cpu) )
         return;
 
     if ( !per_cpu(batching, this_cpu) || in_irq() )
@@ -130,7 +182,10 @@ void cpu_raise_softirq_batch_finish(void)
 
 void raise_softirq(unsigned int nr)
 {
-    set_bit(nr, &softirq_pending(smp_processor_id()));
+    unsigned int cpu = smp_processor_id();
+
+    if ( !test_and_set_bit(nr, &softirq_pending(cpu)) )
+        per_cpu(softirq_raised, cpu)[nr] = lathist_start();
 }
 
 void __init softirq_init(void)
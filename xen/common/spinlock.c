@@ -1,5 +1,6 @@
 #include <xen/lib.h>
 #include <xen/config.h>
+#include <xen/init.h>
 #include <xen/irq.h>
 #include <xen/smp.h>
 #include <xen/time.h>
@@ -130,12 +131,93 @@ static always_inline u16 observe_head(spinlock_tickets_t *t)
     return read_atomic(&t->head);
 }
 
-void _spin_lock(spinlock_t *lock)
+/*
+ * Queued (MCS) acquisition for heavily contended lock classes.
+ *
+ * With plain ticket locks every waiter spins on the lock's cache line, so
+ * each release sends that line round all of them.  Waiters of a queued
+ * class instead link up behind lock->mcs_tail and spin on a node of their
+ * own; only the head of that queue takes a ticket and spins on the lock,
+ * and it hands the queue head on just after acquiring it.  The ticket pair
+ * stays the actual lock, so release, trylock, is_locked and barrier are
+ * unaffected, and unqueued acquirers (trylock, or running out of nodes)
+ * may still mix with queued ones.
+ *
+ * Each CPU has a node per possible nesting level (task, softirq, IRQ,
+ * NMI); queue links encode (cpu, level) + 1.
+ */
+#define MCS_NODES 4
+
+struct mcs_node {
+    u16 next;                       /* successor's tail encoding, 0 if none */
+    bool_t locked;
+};
+
+static DEFINE_PER_CPU(struct mcs_node, mcs_nodes[MCS_NODES]);
+static DEFINE_PER_CPU(unsigned int, mcs_nest);
+
+#define LOCK_CLASS_MAX      1024
+
+static DECLARE_BITMAP(lock_class_queued, LOCK_CLASS_MAX) __read_mostly;
+static char __read_mostly opt_queued_spinlocks[128];
+string_param("queued_spinlocks", opt_queued_spinlocks);
+
+static struct mcs_node *mcs_decode(u16 tail)
+{
+    return &per_cpu(mcs_nodes, (tail - 1) / MCS_NODES)[(tail - 1) % MCS_NODES];
+}
+
+static bool_t spin_lock_queued(spinlock_t *lock, const void *caller)
 {
     spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
+    unsigned int idx = this_cpu(mcs_nest);
+    struct mcs_node *node;
+    u16 tail, prev, next;
+    s64 sample;
     LOCK_PROFILE_VAR;
 
-    check_lock(&lock->debug);
+    BUILD_BUG_ON(NR_CPUS * MCS_NODES >= 0xffff);
+
+    /* Uncontended: take the lock as spin_trylock() would. */
+    if ( !read_atomic(&lock->mcs_tail) )
+    {
+        spinlock_tickets_t old = observe_lock(&lock->tickets), new = old;
+
+        new.tail++;
+        if ( old.head == old.tail &&
+             cmpxchg(&lock->tickets.head_tail,
+                     old.head_tail, new.head_tail) == old.head_tail )
+            goto got;
+    }
+
+    if ( idx >= MCS_NODES )
+        return 0;
+    this_cpu(mcs_nest) = idx + 1;
+
+    node = &this_cpu(mcs_nodes)[idx];
+    node->next = 0;
+    node->locked = 0;
+    tail = smp_processor_id() * MCS_NODES + idx + 1;
+
+    sample = lock_sample_begin();
+
+    /* cmpxchg() is a full barrier, publishing the node initialisation. */
+    do {
+        prev = read_atomic(&lock->mcs_tail);
+    } while ( cmpxchg(&lock->mcs_tail, prev, tail) != prev );
+
+    if ( prev )
+    {
+        write_atomic(&mcs_decode(prev)->next, tail);
+        while ( !read_atomic(&node->locked) )
+        {
+            LOCK_PROFILE_BLOCK;
+            cpu_relax();
+        }
+        smp_mb();
+    }
+
+    /* Queue head: the only queued waiter spinning on the lock. */
     tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
                                            tickets.head_tail);
     while ( tickets.tail != observe_head(&lock->tickets) )
@@ -143,16 +225,69 @@ void _spin_lock(spinlock_t *lock)
         LOCK_PROFILE_BLOCK;
         arch_lock_relax();
     }
+
+    next = read_atomic(&node->next);
+    if ( !next )
+    {
+        if ( cmpxchg(&lock->mcs_tail, tail, 0) == tail )
+            goto done;
+        /* A successor is between updating the tail and linking up. */
+        while ( !(next = read_atomic(&node->next)) )
+            cpu_relax();
+    }
+    smp_mb();
+    write_atomic(&mcs_decode(next)->locked, 1);
+
+ done:
+    this_cpu(mcs_nest) = idx;
+    lock_sample_end(lock, lock, LOCK_SAMPLE_spin, sample, caller);
+ got:
+    LOCK_PROFILE_GOT;
+    return 1;
+}
+
+static always_inline void spin_lock_common(spinlock_t *lock,
+                                           const void *caller)
+{
+    spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
+    LOCK_PROFILE_VAR;
+
+    check_lock(&lock->debug);
+    if ( unlikely(test_bit(lock->class, lock_class_queued)) &&
+         spin_lock_queued(lock, caller) )
+    {
+        preempt_disable();
+        arch_lock_acquire_barrier();
+        return;
+    }
+    tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
+                                           tickets.head_tail);
+    if ( tickets.tail != observe_head(&lock->tickets) )
+    {
+        s64 sample = lock_sample_begin();
+
+        do {
+            LOCK_PROFILE_BLOCK;
+            arch_lock_relax();
+        } while ( tickets.tail != observe_head(&lock->tickets) );
+
+        lock_sample_end(lock, lock, LOCK_SAMPLE_spin, sample, caller);
+    }
     LOCK_PROFILE_GOT;
     preempt_disable();
     arch_lock_acquire_barrier();
 }
 
+void _spin_lock(spinlock_t *lock)
+{
+    spin_lock_common(lock, __builtin_return_address(0));
+}
+
 void _spin_lock_irq(spinlock_t *lock)
 {
     ASSERT(local_irq_is_enabled());
     local_irq_disable();
-    _spin_lock(lock);
+    spin_lock_common(lock, __builtin_return_address(0));
 }
 
 unsigned long _spin_lock_irqsave(spinlock_t *lock)
@@ -160,7 +295,7 @@ unsigned long _spin_lock_irqsave(spinlock_t *lock)
     unsigned long flags;
 
     local_irq_save(flags);
-    _spin_lock(lock);
+    spin_lock_common(lock, __builtin_return_address(0));
     return flags;
 }
 
@@ -278,7 +413,7 @@ void _spin_lock_recursive(spinlock_t *lock)
 
     if ( likely(lock->recurse_cpu != cpu) )
     {
-        _spin_lock(lock);
+        spin_lock_common(lock, __builtin_return_address(0));
         lock->recurse_cpu = cpu;
     }
 
@@ -296,6 +431,297 @@ void _spin_unlock_recursive(spinlock_t *lock)
     }
 }
 
+#define LOCK_SAMPLE_SLOTS   256
+#define LOCK_SAMPLE_CALLERS XEN_SYSCTL_LOCKSAMPLE_CALLERS
+
+extern struct lock_class *__lock_class_start;
+extern struct lock_class *__lock_class_end;
+
+static struct lock_class *lock_classes[LOCK_CLASS_MAX];
+static atomic_t nr_lock_classes = ATOMIC_INIT(0);
+
+/*
+ * Does a class name, as printed by lock sampling, appear in
+ * "queued_spinlocks="?  Entries may also name just the lock member, e.g.
+ * "event_lock" for every domain's "d->event_lock".
+ */
+static bool_t lock_class_match(const char *name)
+{
+    const char *s = opt_queued_spinlocks, *e, *member;
+    size_t len;
+
+    if ( !*s )
+        return 0;
+
+    name += (name[0] == '&');
+    for ( member = e = name; *e; e++ )
+        if ( *e == '>' || *e == '.' )
+            member = e + 1;
+
+    for ( ; *s; s = *e ? e + 1 : e )
+    {
+        e = strchr(s, ',') ?: s + strlen(s);
+        len = e - s;
+        if ( (strlen(name) == len && !strncmp(name, s, len)) ||
+             (strlen(member) == len && !strncmp(member, s, len)) )
+            return 1;
+    }
+
+    return 0;
+}
+
+unsigned int _lock_class_register(struct lock_class *class)
+{
+    unsigned int id = read_atomic(&class->id);
+
+    if ( likely(id) )
+        return id;
+
+    /* Losing a race for the same class just wastes an id. */
+    if ( atomic_read(&nr_lock_classes) >= LOCK_CLASS_MAX - 1 )
+        return 0;
+    id = atomic_inc_return(&nr_lock_classes);
+    if ( id >= LOCK_CLASS_MAX )
+        return 0;
+    if ( cmpxchg(&class->id, 0, id) != 0 )
+        return class->id;
+
+    lock_classes[id] = class;
+    if ( lock_class_match(class->name) )
+        __set_bit(id, lock_class_queued);
+
+    return id;
+}
+
+static int __init lock_class_init(void)
+{
+    struct lock_class **c;
+
+    for ( c = &__lock_class_start; c < &__lock_class_end; c++ )
+        (*c)->lock->class = _lock_class_register(*c);
+
+    return 0;
+}
+presmp_initcall(lock_class_init);
+
+struct lock_sample {
+    uint64_t samples;           /* 0 if the slot is free */
+    uint64_t wait_time;
+    uint64_t wait_max;
+    unsigned int class;
+    enum lock_sample_kind kind;
+    const void *addr;           /* unclassified locks only */
+    struct {
+        const void *caller;
+        uint64_t samples;
+    } callers[LOCK_SAMPLE_CALLERS];
+};
+
+unsigned int __read_mostly lock_sample_rate;
+static DEFINE_PER_CPU(unsigned int, lock_sample_nest);
+static DEFINE_PER_CPU(unsigned int, lock_sample_skip);
+static DEFINE_SPINLOCK(lock_sample_lock);
+static struct lock_sample lock_samples[LOCK_SAMPLE_SLOTS];
+static uint64_t lock_samples_dropped;
+
+s64 _lock_sample_begin(void)
+{
+    unsigned int rate = read_atomic(&lock_sample_rate);
+
+    /*
+     * Interrupts nesting in here unwind their own brackets before we
+     * resume, so plain per-CPU updates suffice.
+     */
+    if ( this_cpu(lock_sample_nest)++ || !rate )
+        return -1;
+
+    if ( this_cpu(lock_sample_skip) )
+    {
+        this_cpu(lock_sample_skip)--;
+        return -1;
+    }
+    this_cpu(lock_sample_skip) = rate - 1;
+
+    return NOW();
+}
+
+static void lock_sample_record(unsigned int class, const void *addr,
+                               enum lock_sample_kind kind, s_time_t wait,
+                               const void *caller)
+{
+    struct lock_sample *ls = NULL;
+    unsigned long flags, key = class ?: (unsigned long)addr >> 3;
+    unsigned int i, min = 0;
+
+    if ( class )
+        addr = NULL;
+
+    /*
+     * Contention on lock_sample_lock itself is not sampled as we're still
+     * within the caller's bracket.
+     */
+    spin_lock_irqsave(&lock_sample_lock, flags);
+
+    for ( i = 0; i < LOCK_SAMPLE_SLOTS; i++ )
+    {
+        ls = &lock_samples[(key * 31 + kind + i) % LOCK_SAMPLE_SLOTS];
+        if ( !ls->samples ||
+             (ls->class == class && ls->addr == addr && ls->kind == kind) )
+            break;
+    }
+
+    if ( i == LOCK_SAMPLE_SLOTS )
+    {
+        lock_samples_dropped++;
+        goto out;
+    }
+
+    if ( !ls->samples )
+    {
+        ls->class = class;
+        ls->addr = addr;
+        ls->kind = kind;
+    }
+    ls->samples++;
+    ls->wait_time += wait;
+    if ( wait > ls->wait_max )
+        ls->wait_max = wait;
+
+    /*
+     * Keep the hottest acquirers: once all entries are in use a new one
+     * replaces the coldest, inheriting its count, which overestimates but
+     * never misses a caller accounting for more than 1/LOCK_SAMPLE_CALLERS
+     * of the samples.
+     */
+    for ( i = 0; i < LOCK_SAMPLE_CALLERS; i++ )
+    {
+        if ( !ls->callers[i].caller || ls->callers[i].caller == caller )
+            break;
+        if ( ls->callers[i].samples < ls->callers[min].samples )
+            min = i;
+    }
+    if ( i == LOCK_SAMPLE_CALLERS )
+        i = min;
+    ls->callers[i].caller = caller;
+    ls->callers[i].samples++;
+
+ out:
+    spin_unlock_irqrestore(&lock_sample_lock, flags);
+}
+
+void _lock_sample_end(const spinlock_t *lock, const void *addr,
+                      enum lock_sample_kind kind, s64 start,
+                      const void *caller)
+{
+    if ( start > 0 )
+        lock_sample_record(lock->class, addr, kind, NOW() - start, caller);
+
+    this_cpu(lock_sample_nest)--;
+}
+
+static void lock_sample_fill(xen_sysctl_locksample_data_t *data,
+                             const struct lock_sample *ls)
+{
+    const struct lock_class *c = ls->class ? lock_classes[ls->class] : NULL;
+    unsigned int i, j;
+
+    memset(data, 0, sizeof(*data));
+
+    if ( c )
+        snprintf(data->name, sizeof(data->name), "%s (%s)%s",
+                 c->name + (c->name[0] == '&'), c->file,
+                 test_bit(ls->class, lock_class_queued) ? " queued" : "");
+    else
+        snprintf(data->name, sizeof(data->name), "unclassified %p", ls->addr);
+
+    data->kind = ls->kind;
+    data->samples = ls->samples;
+    data->wait_time = ls->wait_time;
+    data->wait_max = ls->wait_max;
+
+    /* Insertion sort the acquirers, hottest first. */
+    for ( i = 0; i < LOCK_SAMPLE_CALLERS && ls->callers[i].caller; i++ )
+    {
+        for ( j = i;
+              j && data->callers[j - 1].samples < ls->callers[i].samples;
+              j-- )
+            data->callers[j] = data->callers[j - 1];
+        snprintf(data->callers[j].name, sizeof(data->callers[j].name),
+                 "%pS", ls->callers[i].caller);
+        data->callers[j].samples = ls->callers[i].samples;
+    }
+    data->nr_callers = i;
+}
+
+static int lock_sample_copy(xen_sysctl_locksample_op_t *op)
+{
+    xen_sysctl_locksample_data_t data;
+    struct lock_sample ls;
+    unsigned long flags;
+    unsigned int i, n = 0;
+
+    for ( i = 0; i < LOCK_SAMPLE_SLOTS; i++ )
+    {
+        spin_lock_irqsave(&lock_sample_lock, flags);
+        ls = lock_samples[i];
+        spin_unlock_irqrestore(&lock_sample_lock, flags);
+
+        if ( !ls.samples )
+            continue;
+
+        if ( n < op->max_elem )
+        {
+            lock_sample_fill(&data, &ls);
+            if ( copy_to_guest_offset(op->data, n, &data, 1) )
+                return -EFAULT;
+        }
+        n++;
+    }
+
+    op->nr_elem = n;
+    op->rate = read_atomic(&lock_sample_rate);
+    op->dropped = lock_samples_dropped;
+
+    return 0;
+}
+
+/* Dom0 control of sampled lock profiling */
+int lock_sample_control(xen_sysctl_locksample_op_t *op)
+{
+    unsigned long flags;
+    int rc = 0;
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_LOCKSAMPLE_start:
+        if ( !op->rate )
+            return -EINVAL;
+        write_atomic(&lock_sample_rate, op->rate);
+        break;
+
+    case XEN_SYSCTL_LOCKSAMPLE_stop:
+        write_atomic(&lock_sample_rate, 0);
+        break;
+
+    case XEN_SYSCTL_LOCKSAMPLE_reset:
+        spin_lock_irqsave(&lock_sample_lock, flags);
+        memset(lock_samples, 0, sizeof(lock_samples));
+        lock_samples_dropped = 0;
+        spin_unlock_irqrestore(&lock_sample_lock, flags);
+        break;
+
+    case XEN_SYSCTL_LOCKSAMPLE_query:
+        rc = lock_sample_copy(op);
+        break;
+
+    default:
+        rc = -EINVAL;
+        break;
+    }
+
+    return rc;
+}
+
 #ifdef CONFIG_LOCK_PROFILE
 
 struct lock_profile_anc {
@@ -20,6 +20,8 @@
 #include <xen/iocap.h>
 #include <xen/guest_access.h>
 #include <xen/keyhandler.h>
+#include <xen/lathist.h>
+#include <xen/vcpustats.h>
 #include <asm/current.h>
 #include <xen/hypercall.h>
 #include <public/sysctl.h>
@@ -115,6 +117,84 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_getvcpuinfolist:
+    {
+        struct xen_sysctl_getvcpuinfolist *list = &op->u.getvcpuinfolist;
+        struct domain *d;
+        struct vcpu *v;
+        struct vcpu_runstate_info runstate;
+        struct xen_sysctl_vcpuinfo info = { 0 };
+        u32 num_vcpus = 0;
+
+        list->next_domain = DOMID_INVALID;
+
+        rcu_read_lock(&domlist_read_lock);
+
+        for_each_domain ( d )
+        {
+            unsigned int nr = 0;
+
+            if ( d->domain_id < list->first_domain )
+                continue;
+
+            for_each_vcpu ( d, v )
+                nr++;
+
+            /* Only report whole domains. */
+            if ( num_vcpus + nr > list->max_vcpus )
+            {
+                list->next_domain = d->domain_id;
+                if ( !num_vcpus )
+                    ret = -ENOBUFS;
+                break;
+            }
+
+            if ( xsm_getdomaininfo(XSM_HOOK, d) )
+                continue;
+
+            for_each_vcpu ( d, v )
+            {
+                vcpu_runstate_get(v, &runstate);
+
+                info.domid    = d->domain_id;
+                info.vcpu     = v->vcpu_id;
+                info.online   = !(v->pause_flags & VPF_down);
+                info.blocked  = !!(v->pause_flags & VPF_blocked);
+                info.running  = v->is_running;
+                info.cpu      = v->processor;
+                info.cpu_time = runstate.time[RUNSTATE_running];
+
+                if ( copy_to_guest_offset(list->buffer, num_vcpus, &info, 1) )
+                {
+                    ret = -EFAULT;
+                    break;
+                }
+
+                num_vcpus++;
+            }
+
+            if ( ret )
+                break;
+        }
+
+        rcu_read_unlock(&domlist_read_lock);
+
+        if ( ret == -EFAULT )
+            break;
+
+        list->num_vcpus = num_vcpus;
+        copyback = 1;
+    }
+    break;
+
+    case XEN_SYSCTL_vcpustats_op:
+        ret = vcpustats_get_info(&op->u.vcpustats_op);
+        break;
+
+    case XEN_SYSCTL_xmem_cacheinfo:
+        ret = xmem_cache_getinfo(&op->u.xmem_cacheinfo);
+        break;
+
 #ifdef CONFIG_PERF_COUNTERS
     case XEN_SYSCTL_perfc_op:
         ret = perfc_control(&op->u.perfc_op);
@@ -126,6 +206,15 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
         ret = spinlock_profile_control(&op->u.lockprof_op);
         break;
 #endif
+
+    case XEN_SYSCTL_lathist_op:
+        ret = lathist_control(&op->u.lathist_op);
+        break;
+
+    case XEN_SYSCTL_locksample_op:
+        ret = lock_sample_control(&op->u.locksample_op);
+        break;
+
     case XEN_SYSCTL_debug_keys:
     {
         char c;
@@ -243,6 +332,9 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 
     case XEN_SYSCTL_cpupool_op:
         ret = cpupool_do_sysctl(&op->u.cpupool_op);
+        /* Report the progress of bulk moves also on failure. */
+        if ( op->u.cpupool_op.op == XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAINS )
+            copyback = 1;
         break;
 
     case XEN_SYSCTL_scheduler_op:
@@ -265,7 +357,7 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
         pi->total_pages = total_pages;
         /* Protected by lock */
         get_outstanding_claims(&pi->free_pages, &pi->outstanding_pages);
-        pi->scrub_pages = 0;
+        pi->scrub_pages = avail_scrub_pages();
         pi->cpu_khz = cpu_khz;
         arch_do_physinfo(pi);
 
@@ -299,9 +391,12 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
                     {
                         meminfo.memsize = node_spanned_pages(i) << PAGE_SHIFT;
                         meminfo.memfree = avail_node_heap_pages(i) << PAGE_SHIFT;
+                        meminfo.memscrub =
+                            avail_node_scrub_pages(i) << PAGE_SHIFT;
                     }
                     else
-                        meminfo.memsize = meminfo.memfree = XEN_INVALID_MEM_SZ;
+                        meminfo.memsize = meminfo.memfree = meminfo.memscrub =
+                            XEN_INVALID_MEM_SZ;
 
                     if ( copy_to_guest_offset(ni->meminfo, i, &meminfo, 1) )
                     {
@@ -480,6 +575,10 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
          __copy_to_guest(u_sysctl, op, 1) )
         ret = -EFAULT;
 
+    if ( ret == -ERESTART )
+        ret = hypercall_create_continuation(
+            __HYPERVISOR_sysctl, "h", u_sysctl);
+
     return ret;
 }
 
@@ -5,6 +5,10 @@
  * (specifically, the idle VCPU's context) or in softirq context, on at most
  * one CPU at a time. Softirq versus VCPU context execution is specified
  * during per-tasklet initialisation.
+ *
+ * Work on idle tasklets does not make the scheduler run the idle VCPU; they
+ * are picked up by do_tasklet() when the CPU is idle anyway.  A timer bounds
+ * how long they can be starved by busy VCPUs.
  * 
  * Copyright (c) 2010, Citrix Systems, Inc.
  * Copyright (c) 1992, Linus Torvalds
@@ -18,7 +22,9 @@
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/tasklet.h>
+#include <xen/timer.h>
 #include <xen/cpu.h>
+#include <xen/perfc.h>
 
 /* Some subsystems call into us before we are initialised. We ignore them. */
 static bool_t tasklets_initialised;
@@ -27,6 +33,16 @@ DEFINE_PER_CPU(unsigned long, tasklet_work_to_do);
 
 static DEFINE_PER_CPU(struct list_head, tasklet_list);
 static DEFINE_PER_CPU(struct list_head, softirq_tasklet_list);
+static DEFINE_PER_CPU(struct list_head, idle_tasklet_list);
+static DEFINE_PER_CPU(s_time_t, idle_tasklet_since);
+
+/* Checks for starved idle tasklets, while there are any. */
+static struct timer idle_tasklet_timer;
+static bool_t idle_tasklet_timer_ready, idle_tasklet_timer_armed;
+
+/* Longest (in milliseconds) idle tasklets wait for their CPU to go idle. */
+static unsigned int __read_mostly tasklet_idle_defer = 10;
+integer_param("tasklet_idle_defer", tasklet_idle_defer);
 
 /* Protects all lists and tasklet structures. */
 static DEFINE_SPINLOCK(tasklet_lock);
@@ -43,6 +59,26 @@ static void tasklet_enqueue(struct tasklet *t)
         if ( was_empty )
             cpu_raise_softirq(cpu, TASKLET_SOFTIRQ);
     }
+    else if ( t->is_idle )
+    {
+        unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
+        list_add_tail(&t->list, &per_cpu(idle_tasklet_list, cpu));
+        perfc_incr(tasklets_idle_deferred);
+        if ( !test_and_set_bit(_TASKLET_idle, work_to_do) )
+        {
+            per_cpu(idle_tasklet_since, cpu) = NOW();
+            if ( idle_tasklet_timer_ready && !idle_tasklet_timer_armed )
+            {
+                idle_tasklet_timer_armed = 1;
+                set_timer(&idle_tasklet_timer,
+                          per_cpu(idle_tasklet_since, cpu) +
+                          MILLISECS(tasklet_idle_defer));
+            }
+            /* An idle CPU may be asleep, as nothing was raised. */
+            if ( cpu != smp_processor_id() )
+                smp_send_event_check_cpu(cpu);
+        }
+    }
     else
     {
         unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
@@ -104,6 +140,68 @@ static void do_tasklet_work(unsigned int cpu, struct list_head *list)
     }
 }
 
+/* Idle VCPU context work, with the CPU otherwise idle. */
+static void do_idle_tasklet(unsigned int cpu)
+{
+    struct list_head *list = &per_cpu(idle_tasklet_list, cpu);
+
+    spin_lock_irq(&tasklet_lock);
+
+    do_tasklet_work(cpu, list);
+
+    if ( list_empty(list) )
+        clear_bit(_TASKLET_idle, &per_cpu(tasklet_work_to_do, cpu));
+
+    spin_unlock_irq(&tasklet_lock);
+}
+
+/* Idle tasklets kept waiting too long get queued as ordinary ones. */
+static void idle_tasklet_timeout(void *unused)
+{
+    s_time_t now = NOW(), next = 0, expires;
+    unsigned long *work_to_do;
+    struct list_head *list;
+    struct tasklet *t;
+    unsigned int cpu;
+    unsigned long flags;
+
+    spin_lock_irqsave(&tasklet_lock, flags);
+
+    for_each_online_cpu ( cpu )
+    {
+        list = &per_cpu(idle_tasklet_list, cpu);
+        if ( list_empty(list) )
+            continue;
+
+        expires = per_cpu(idle_tasklet_since, cpu) +
+                  MILLISECS(tasklet_idle_defer);
+        if ( expires > now )
+        {
+            if ( !next || expires < next )
+                next = expires;
+            continue;
+        }
+
+        perfc_incr(tasklets_idle_promoted);
+        while ( !list_empty(list) )
+        {
+            t = list_entry(list->next, struct tasklet, list);
+            list_del(&t->list);
+            list_add_tail(&t->list, &per_cpu(tasklet_list, cpu));
+        }
+        work_to_do = &per_cpu(tasklet_work_to_do, cpu);
+        clear_bit(_TASKLET_idle, work_to_do);
+        if ( !test_and_set_bit(_TASKLET_enqueued, work_to_do) )
+            cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+    }
+
+    idle_tasklet_timer_armed = !!next;
+    if ( next )
+        set_timer(&idle_tasklet_timer, next);
+
+    spin_unlock_irqrestore(&tasklet_lock, flags);
+}
+
 /* VCPU context work */
 void do_tasklet(void)
 {
@@ -114,9 +212,15 @@ void do_tasklet(void)
     /*
      * Work must be enqueued *and* scheduled. Otherwise there is no work to
      * do, and/or scheduler needs to run to update idle vcpu priority.
+     * Idle tasklets are only run when there is no other work whatsoever.
      */
-    if ( likely(*work_to_do != (TASKLET_enqueued|TASKLET_scheduled)) )
+    if ( likely((*work_to_do & (TASKLET_enqueued|TASKLET_scheduled)) !=
+                (TASKLET_enqueued|TASKLET_scheduled)) )
+    {
+        if ( *work_to_do == TASKLET_idle )
+            do_idle_tasklet(cpu);
         return;
+    }
 
     spin_lock_irq(&tasklet_lock);
 
@@ -208,6 +312,13 @@ void softirq_tasklet_init(
     t->is_softirq = 1;
 }
 
+void idle_tasklet_init(
+    struct tasklet *t, void (*func)(unsigned long), unsigned long data)
+{
+    tasklet_init(t, func, data);
+    t->is_idle = 1;
+}
+
 static int cpu_callback(
     struct notifier_block *nfb, unsigned long action, void *hcpu)
 {
@@ -218,11 +329,14 @@ static int cpu_callback(
     case CPU_UP_PREPARE:
         INIT_LIST_HEAD(&per_cpu(tasklet_list, cpu));
         INIT_LIST_HEAD(&per_cpu(softirq_tasklet_list, cpu));
+        INIT_LIST_HEAD(&per_cpu(idle_tasklet_list, cpu));
         break;
     case CPU_UP_CANCELED:
     case CPU_DEAD:
+        clear_bit(_TASKLET_idle, &per_cpu(tasklet_work_to_do, cpu));
         migrate_tasklets_from_cpu(cpu, &per_cpu(tasklet_list, cpu));
         migrate_tasklets_from_cpu(cpu, &per_cpu(softirq_tasklet_list, cpu));
+        migrate_tasklets_from_cpu(cpu, &per_cpu(idle_tasklet_list, cpu));
         break;
     default:
         break;
@@ -245,6 +359,23 @@ void __init tasklet_subsys_init(void)
     tasklets_initialised = 1;
 }
 
+/* The timer subsystem is only initialised after us. */
+static int __init idle_tasklet_timer_init(void)
+{
+    unsigned long flags;
+
+    init_timer(&idle_tasklet_timer, idle_tasklet_timeout, NULL,
+               smp_processor_id());
+
+    spin_lock_irqsave(&tasklet_lock, flags);
+    idle_tasklet_timer_ready = idle_tasklet_timer_armed = 1;
+    set_timer(&idle_tasklet_timer, NOW() + MILLISECS(tasklet_idle_defer));
+    spin_unlock_irqrestore(&tasklet_lock, flags);
+
+    return 0;
+}
+presmp_initcall(idle_tasklet_timer_init);
+
 /*
  * Local variables:
  * mode: C
@@ -29,12 +29,31 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/* Granularity (in microseconds) of the timer slack classes. */
+static unsigned int timer_slack_relaxed __read_mostly = 1000;  /* 1 ms */
+integer_param("timer_slack_relaxed", timer_slack_relaxed);
+static unsigned int timer_slack_lazy __read_mostly = 10000;    /* 10 ms */
+integer_param("timer_slack_lazy", timer_slack_lazy);
+
+/*
+ * Timers expiring within the next WHEEL_SLOTS buckets of 2^WHEEL_SHIFT ns
+ * (~33ms) go on a per-CPU timer wheel, rather than on the heap.
+ */
+#define WHEEL_SHIFT 18
+#define WHEEL_SLOTS 128
+
+static bool_t __read_mostly opt_timer_wheel = 1;
+boolean_param("timer_wheel", opt_timer_wheel);
+
 struct timers {
     spinlock_t     lock;
     struct timer **heap;
     struct timer  *list;
     struct timer  *running;
     struct list_head inactive;
+    struct list_head wheel[WHEEL_SLOTS];
+    s_time_t       wheel_bucket; /* Earliest bucket in use on the wheel. */
+    unsigned int   wheel_count;
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -167,6 +186,101 @@ static int add_to_list(struct timer **pprev, struct timer *t)
 }
 
 
+/****************************************************************************
+ * WHEEL OPERATIONS.
+ *
+ * The wheel makes adding and removing a timer O(1), which matters for the
+ * many short timers that HVM guests keep re-arming (vlapic, vpt, rtc, ...).
+ * A timer's bucket is its expiry >> WHEEL_SHIFT, and bucket b lives in slot
+ * b % WHEEL_SLOTS. Only buckets from wheel_bucket to wheel_bucket + WHEEL_SLOTS
+ * - 1 are used, so each slot holds timers of a single bucket, unsorted.
+ * Timers which are already due go in the slot of wheel_bucket.
+ *
+ * The wheel does not know which of its timers is the earliest one, so add
+ * and remove report (conservatively) whether the programmed deadline may
+ * need updating, by comparing with timer_deadline.
+ */
+
+static bool_t wheel_fits(struct timers *ts, struct timer *t)
+{
+    return opt_timer_wheel &&
+           (t->expires >> WHEEL_SHIFT) < ts->wheel_bucket + WHEEL_SLOTS;
+}
+
+static int remove_from_wheel(struct timers *ts, struct timer *t,
+                             unsigned int cpu)
+{
+    s_time_t deadline = per_cpu(timer_deadline, cpu);
+
+    list_del(&t->wheel);
+    ts->wheel_count--;
+
+    return (deadline != 0) && (t->expires <= deadline);
+}
+
+static int add_to_wheel(struct timers *ts, struct timer *t, unsigned int cpu)
+{
+    s_time_t deadline = per_cpu(timer_deadline, cpu);
+    s_time_t b = max(t->expires >> WHEEL_SHIFT, ts->wheel_bucket);
+
+    list_add_tail(&t->wheel, &ts->wheel[b % WHEEL_SLOTS]);
+    ts->wheel_count++;
+
+    return (deadline == 0) || (t->expires < deadline);
+}
+
+/*
+ * Move the wheel timers which have expired by @now onto @expired. They stay
+ * TIMER_STATUS_in_wheel, so that they can still be removed while queued.
+ */
+static void wheel_collect_expired(struct timers *ts, s_time_t now,
+                                  struct list_head *expired)
+{
+    s_time_t b, last = now >> WHEEL_SHIFT;
+    struct timer *t, *tmp;
+
+    if ( ts->wheel_count == 0 )
+        return;
+
+    for ( b = ts->wheel_bucket;
+          b <= last && b < ts->wheel_bucket + WHEEL_SLOTS; b++ )
+        list_for_each_entry_safe ( t, tmp, &ts->wheel[b % WHEEL_SLOTS], wheel )
+            if ( t->expires < now )
+                list_move_tail(&t->wheel, expired);
+}
+
+static s_time_t wheel_deadline(struct timers *ts)
+{
+    s_time_t b, deadline = STIME_MAX;
+    struct timer *t;
+
+    if ( ts->wheel_count == 0 )
+        return STIME_MAX;
+
+    for ( b = ts->wheel_bucket; b < ts->wheel_bucket + WHEEL_SLOTS; b++ )
+    {
+        list_for_each_entry ( t, &ts->wheel[b % WHEEL_SLOTS], wheel )
+            if ( t->expires < deadline )
+                deadline = t->expires;
+        if ( deadline != STIME_MAX )
+            break;
+    }
+
+    return deadline;
+}
+
+static struct timer *wheel_any(struct timers *ts)
+{
+    unsigned int i;
+
+    for ( i = 0; ts->wheel_count && i < WHEEL_SLOTS; i++ )
+        if ( !list_empty(&ts->wheel[i]) )
+            return list_entry(ts->wheel[i].next, struct timer, wheel);
+
+    return NULL;
+}
+
+
 /****************************************************************************
  * TIMER OPERATIONS.
  */
@@ -184,6 +298,9 @@ static int remove_entry(struct timer *t)
     case TIMER_STATUS_in_list:
         rc = remove_from_list(&timers->list, t);
         break;
+    case TIMER_STATUS_in_wheel:
+        rc = remove_from_wheel(timers, t, t->cpu);
+        break;
     default:
         rc = 0;
         BUG();
@@ -200,6 +317,13 @@ static int add_entry(struct timer *t)
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
+    /* Timers expiring soon go on the wheel. */
+    if ( wheel_fits(timers, t) )
+    {
+        t->status = TIMER_STATUS_in_wheel;
+        return add_to_wheel(timers, t, t->cpu);
+    }
+
     /* Try to add to heap. t->heap_offset indicates whether we succeed. */
     t->heap_offset = 0;
     t->status = TIMER_STATUS_in_heap;
@@ -277,7 +401,7 @@ static inline void timer_unlock(struct timer *timer)
 static bool_t active_timer(struct timer *timer)
 {
     ASSERT(timer->status >= TIMER_STATUS_inactive);
-    ASSERT(timer->status <= TIMER_STATUS_in_list);
+    ASSERT(timer->status <= TIMER_STATUS_in_wheel);
     return (timer->status >= TIMER_STATUS_in_heap);
 }
 
@@ -301,6 +425,13 @@ void init_timer(
 }
 
 
+void set_timer_slack(struct timer *timer, unsigned int slack)
+{
+    ASSERT(slack < TIMER_SLACK_NR);
+    timer->slack = slack;
+}
+
+
 void set_timer(struct timer *timer, s_time_t expires)
 {
     unsigned long flags;
@@ -311,6 +442,13 @@ void set_timer(struct timer *timer, s_time_t expires)
     if ( active_timer(timer) )
         deactivate_timer(timer);
 
+    if ( timer->slack )
+    {
+        unsigned int slack = (timer->slack == TIMER_SLACK_lazy)
+                             ? timer_slack_lazy : timer_slack_relaxed;
+
+        expires = align_timer(expires, MICROSECS(slack));
+    }
     timer->expires = expires;
 
     activate_timer(timer);
@@ -433,6 +571,7 @@ static void timer_softirq_action(void)
     struct timer  *t, **heap, *next;
     struct timers *ts;
     s_time_t       now, deadline;
+    LIST_HEAD(expired);
 
     ts = &this_cpu(timers);
     heap = ts->heap;
@@ -476,6 +615,19 @@ static void timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    /* Execute ready wheel timers. */
+    wheel_collect_expired(ts, now, &expired);
+    while ( !list_empty(&expired) )
+    {
+        t = list_entry(expired.next, struct timer, wheel);
+        remove_from_wheel(ts, t, smp_processor_id());
+        execute_timer(ts, t);
+    }
+
+    /* All the buckets before the current one are empty now. */
+    if ( ts->wheel_bucket < (now >> WHEEL_SHIFT) )
+        ts->wheel_bucket = now >> WHEEL_SHIFT;
+
     /* Try to move timers from linked list to more efficient heap. */
     next = ts->list;
     ts->list = NULL;
@@ -492,6 +644,7 @@ static void timer_softirq_action(void)
         deadline = heap[1]->expires;
     if ( (ts->list != NULL) && (ts->list->expires < deadline) )
         deadline = ts->list->expires;
+    deadline = min(deadline, wheel_deadline(ts));
     now = NOW();
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : MAX(deadline, now + timer_slop);
@@ -512,8 +665,9 @@ s_time_t align_timer(s_time_t firsttick, uint64_t period)
 
 static void dump_timer(struct timer *t, s_time_t now)
 {
-    printk("  ex=%12"PRId64"us timer=%p cb=%ps(%p)\n",
-           (t->expires - now) / 1000, t, t->function, t->data);
+    printk("  ex=%12"PRId64"us timer=%p cb=%ps(%p)%s\n",
+           (t->expires - now) / 1000, t, t->function, t->data,
+           t->slack ? " slack" : "");
 }
 
 static void dump_timerq(unsigned char key)
@@ -536,6 +690,9 @@ static void dump_timerq(unsigned char key)
             dump_timer(ts->heap[j], now);
         for ( t = ts->list, j = 0; t != NULL; t = t->list_next, j++ )
             dump_timer(t, now);
+        for ( j = 0; j < WHEEL_SLOTS; j++ )
+            list_for_each_entry ( t, &ts->wheel[j], wheel )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
@@ -564,7 +721,8 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
     }
 
     while ( (t = GET_HEAP_SIZE(old_ts->heap)
-             ? old_ts->heap[1] : old_ts->list) != NULL )
+             ? old_ts->heap[1]
+             : old_ts->list ?: wheel_any(old_ts)) != NULL )
     {
         remove_entry(t);
         write_atomic(&t->cpu, new_cpu);
@@ -593,6 +751,7 @@ static int cpu_callback(
 {
     unsigned int cpu = (unsigned long)hcpu;
     struct timers *ts = &per_cpu(timers, cpu);
+    unsigned int i;
 
     switch ( action )
     {
@@ -600,6 +759,10 @@ static int cpu_callback(
         INIT_LIST_HEAD(&ts->inactive);
         spin_lock_init(&ts->lock);
         ts->heap = &dummy_heap;
+        for ( i = 0; i < WHEEL_SLOTS; i++ )
+            INIT_LIST_HEAD(&ts->wheel[i]);
+        ts->wheel_bucket = NOW() >> WHEEL_SHIFT;
+        ts->wheel_count = 0;
         break;
     case CPU_UP_CANCELED:
     case CPU_DEAD:
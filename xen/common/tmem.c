@@ -10,7 +10,6 @@
    - any better reclamation policy?
    - use different tlsf pools for each client (maybe each pool)
    - test shared access more completely (ocfs2)
-   - add feedback-driven compression (not for persistent pools though!)
    - add data-structure total bytes overhead stats
  */
 
@@ -39,7 +38,7 @@ struct tmem_statistics tmem_stats = {
 
 struct tmem_object_root {
     struct xen_tmem_oid oid;
-    struct rb_node rb_tree_node; /* Protected by pool->pool_rwlock. */
+    struct rb_node rb_tree_node; /* Protected by pool->obj_rb_rwlocks[]. */
     unsigned long objnode_count; /* Atomicity depends on obj_spinlock. */
     long pgp_count; /* Atomicity depends on obj_spinlock. */
     struct radix_tree_root tree_root; /* Tree of pages within object. */
@@ -747,15 +746,22 @@ static unsigned oid_hash(struct xen_tmem_oid *oidp)
                      BITS_PER_LONG) & OBJ_HASH_BUCKETS_MASK);
 }
 
+static rwlock_t *obj_rb_rwlock(struct tmem_pool *pool,
+                               struct xen_tmem_oid *oidp)
+{
+    return &pool->obj_rb_rwlocks[oid_hash(oidp)];
+}
+
 /* Searches for object==oid in pool, returns locked object if found. */
 static struct tmem_object_root * obj_find(struct tmem_pool *pool,
                                           struct xen_tmem_oid *oidp)
 {
     struct rb_node *node;
     struct tmem_object_root *obj;
+    rwlock_t *lock = obj_rb_rwlock(pool, oidp);
 
 restart_find:
-    read_lock(&pool->pool_rwlock);
+    read_lock(lock);
     node = pool->obj_rb_root[oid_hash(oidp)].rb_node;
     while ( node )
     {
@@ -765,10 +771,10 @@ restart_find:
             case 0: /* Equal. */
                 if ( !spin_trylock(&obj->obj_spinlock) )
                 {
-                    read_unlock(&pool->pool_rwlock);
+                    read_unlock(lock);
                     goto restart_find;
                 }
-                read_unlock(&pool->pool_rwlock);
+                read_unlock(lock);
                 return obj;
             case -1:
                 node = node->rb_left;
@@ -777,7 +783,7 @@ restart_find:
                 node = node->rb_right;
         }
     }
-    read_unlock(&pool->pool_rwlock);
+    read_unlock(lock);
     return NULL;
 }
 
@@ -793,13 +799,13 @@ static void obj_free(struct tmem_object_root *obj)
     pool = obj->pool;
     ASSERT(pool != NULL);
     ASSERT(pool->client != NULL);
-    ASSERT_WRITELOCK(&pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_rb_rwlock(pool, &obj->oid));
     if ( obj->tree_root.rnode != NULL ) /* May be a "stump" with no leaves. */
         radix_tree_destroy(&obj->tree_root, pgp_destroy);
     ASSERT((long)obj->objnode_count == 0);
     ASSERT(obj->tree_root.rnode == NULL);
-    pool->obj_count--;
-    ASSERT(pool->obj_count >= 0);
+    atomic_dec(&pool->obj_count);
+    ASSERT(_atomic_read(pool->obj_count) >= 0);
     obj->pool = NULL;
     old_oid = obj->oid;
     oid_set_invalid(&obj->oid);
@@ -816,7 +822,7 @@ static int obj_rb_insert(struct rb_root *root, struct tmem_object_root *obj)
     struct tmem_object_root *this;
 
     ASSERT(obj->pool);
-    ASSERT_WRITELOCK(&obj->pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_rb_rwlock(obj->pool, &obj->oid));
 
     new = &(root->rb_node);
     while ( *new )
@@ -852,9 +858,9 @@ static struct tmem_object_root * obj_alloc(struct tmem_pool *pool,
     ASSERT(pool != NULL);
     if ( (obj = tmem_malloc(sizeof(struct tmem_object_root), pool)) == NULL )
         return NULL;
-    pool->obj_count++;
-    if (pool->obj_count > pool->obj_count_max)
-        pool->obj_count_max = pool->obj_count;
+    atomic_inc(&pool->obj_count);
+    if ( _atomic_read(pool->obj_count) > pool->obj_count_max )
+        pool->obj_count_max = _atomic_read(pool->obj_count);
     atomic_inc_and_max(global_obj_count);
     radix_tree_init(&obj->tree_root);
     radix_tree_set_alloc_callbacks(&obj->tree_root, rtn_alloc, rtn_free, obj);
@@ -870,7 +876,7 @@ static struct tmem_object_root * obj_alloc(struct tmem_pool *pool,
 /* Free an object after destroying any pgps in it. */
 static void obj_destroy(struct tmem_object_root *obj)
 {
-    ASSERT_WRITELOCK(&obj->pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_rb_rwlock(obj->pool, &obj->oid));
     radix_tree_destroy(&obj->tree_root, pgp_destroy);
     obj_free(obj);
 }
@@ -882,10 +888,10 @@ static void pool_destroy_objs(struct tmem_pool *pool, domid_t cli_id)
     struct tmem_object_root *obj;
     int i;
 
-    write_lock(&pool->pool_rwlock);
     pool->is_dying = 1;
     for (i = 0; i < OBJ_HASH_BUCKETS; i++)
     {
+        write_lock(&pool->obj_rb_rwlocks[i]);
         node = rb_first(&pool->obj_rb_root[i]);
         while ( node != NULL )
         {
@@ -897,8 +903,8 @@ static void pool_destroy_objs(struct tmem_pool *pool, domid_t cli_id)
             else
                 spin_unlock(&obj->obj_spinlock);
         }
+        write_unlock(&pool->obj_rb_rwlocks[i]);
     }
-    write_unlock(&pool->pool_rwlock);
 }
 
 
@@ -912,9 +918,11 @@ static struct tmem_pool * pool_alloc(void)
     if ( (pool = xzalloc(struct tmem_pool)) == NULL )
         return NULL;
     for (i = 0; i < OBJ_HASH_BUCKETS; i++)
+    {
         pool->obj_rb_root[i] = RB_ROOT;
+        rwlock_init(&pool->obj_rb_rwlocks[i]);
+    }
     INIT_LIST_HEAD(&pool->persistent_page_list);
-    rwlock_init(&pool->pool_rwlock);
     return pool;
 }
 
@@ -1137,7 +1145,8 @@ static bool_t client_over_quota(struct client *client)
 
 /************ MEMORY REVOCATION ROUTINES *******************************/
 
-static bool_t tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp, bool_t *hold_pool_rwlock)
+static bool_t tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp,
+                                    rwlock_t **hold_obj_rwlock)
 {
     struct tmem_object_root *obj = pgp->us.obj;
     struct tmem_pool *pool = obj->pool;
@@ -1168,9 +1177,9 @@ static bool_t tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp, bool_t *ho
         }
         if ( obj->pgp_count > 1 )
             return 1;
-        if ( write_trylock(&pool->pool_rwlock) )
+        if ( write_trylock(obj_rb_rwlock(pool, &obj->oid)) )
         {
-            *hold_pool_rwlock = 1;
+            *hold_obj_rwlock = obj_rb_rwlock(pool, &obj->oid);
             return 1;
         }
 pcd_unlock:
@@ -1189,7 +1198,7 @@ int tmem_evict(void)
     struct tmem_object_root *obj;
     struct tmem_pool *pool;
     int ret = 0;
-    bool_t hold_pool_rwlock = 0;
+    rwlock_t *hold_obj_rwlock = NULL;
 
     tmem_stats.evict_attempts++;
     spin_lock(&eph_lists_spinlock);
@@ -1197,13 +1206,13 @@ int tmem_evict(void)
          !list_empty(&client->ephemeral_page_list) )
     {
         list_for_each_entry(pgp, &client->ephemeral_page_list, us.client_eph_pages)
-            if ( tmem_try_to_evict_pgp(pgp, &hold_pool_rwlock) )
+            if ( tmem_try_to_evict_pgp(pgp, &hold_obj_rwlock) )
                 goto found;
     }
     else if ( !list_empty(&tmem_global.ephemeral_page_list) )
     {
         list_for_each_entry(pgp, &tmem_global.ephemeral_page_list, global_eph_pages)
-            if ( tmem_try_to_evict_pgp(pgp, &hold_pool_rwlock) )
+            if ( tmem_try_to_evict_pgp(pgp, &hold_obj_rwlock) )
             {
                 client = pgp->us.obj->pool->client;
                 goto found;
@@ -1242,13 +1251,13 @@ found:
     pgp_free(pgp);
     if ( obj->pgp_count == 0 )
     {
-        ASSERT_WRITELOCK(&pool->pool_rwlock);
+        ASSERT(hold_obj_rwlock != NULL);
         obj_free(obj);
     }
     else
         spin_unlock(&obj->obj_spinlock);
-    if ( hold_pool_rwlock )
-        write_unlock(&pool->pool_rwlock);
+    if ( hold_obj_rwlock )
+        write_unlock(hold_obj_rwlock);
     tmem_stats.evicted_pgs++;
     ret = 1;
 out:
@@ -1282,12 +1291,47 @@ static inline bool_t tmem_ensure_avail_pages(void)
 
 /************ TMEM CORE OPERATIONS ************************************/
 
+/*
+ * Adaptive compression: a put whose page does not shrink below
+ * COMPRESS_POOR_SIZE makes the pool store the next puts uncompressed,
+ * doubling the length of that run each time up to COMPRESS_BACKOFF_MAX.
+ * A put which compresses well ends the back-off.
+ */
+#define COMPRESS_POOR_SIZE (PAGE_SIZE - PAGE_SIZE / 8)
+#define COMPRESS_BACKOFF_MIN 8
+#define COMPRESS_BACKOFF_MAX 1024
+
+static bool_t pool_compress_skip(struct tmem_pool *pool)
+{
+    if ( !pool->compress_skip )
+        return 0;
+    pool->compress_skip--;
+    tmem_stats.compress_skipped++;
+    return 1;
+}
+
+static void pool_compress_feedback(struct tmem_pool *pool, size_t size)
+{
+    if ( size < COMPRESS_POOR_SIZE )
+    {
+        pool->compress_backoff = 0;
+        return;
+    }
+    pool->compress_backoff = pool->compress_backoff ?
+        min_t(unsigned int, pool->compress_backoff * 2, COMPRESS_BACKOFF_MAX) :
+        COMPRESS_BACKOFF_MIN;
+    pool->compress_skip = pool->compress_backoff;
+}
+
 static int do_tmem_put_compress(struct tmem_page_descriptor *pgp, xen_pfn_t cmfn,
-                                         tmem_cli_va_param_t clibuf)
+                                tmem_cli_va_param_t clibuf, bool_t compress)
 {
     void *dst, *p;
-    size_t size;
+    size_t size = PAGE_SIZE;
     int ret = 0;
+    struct tmem_pool *pool;
+    /* Dedup keeps its own zero handling (tze) for ephemeral pools. */
+    bool_t zero;
 
     ASSERT(pgp != NULL);
     ASSERT(pgp->us.obj != NULL);
@@ -1295,12 +1339,20 @@ static int do_tmem_put_compress(struct tmem_page_descriptor *pgp, xen_pfn_t cmfn
     ASSERT(pgp->us.obj->pool != NULL);
     ASSERT(pgp->us.obj->pool->client != NULL);
 
+    pool = pgp->us.obj->pool;
+    zero = tmem_tze_enabled() && !(tmem_dedup_enabled() && !is_persistent(pool));
     if ( pgp->pfp != NULL )
-        pgp_free_data(pgp, pgp->us.obj->pool);
-    ret = tmem_compress_from_client(cmfn, &dst, &size, clibuf);
+        pgp_free_data(pgp, pool);
+    ret = tmem_compress_from_client(cmfn, &dst, &size, clibuf, compress, zero);
+    if ( ret == 0 && compress )
+        pool_compress_feedback(pool, PAGE_SIZE);
     if ( ret <= 0 )
         goto out;
-    else if ( (size == 0) || (size >= tmem_mempool_maxalloc) ) {
+    if ( ret == TMEM_COMPRESS_ZERO )
+        tmem_stats.zero_pages++;
+    else
+        pool_compress_feedback(pool, size);
+    if ( (size == 0) || (size >= tmem_mempool_maxalloc) ) {
         ret = 0;
         goto out;
     } else if ( tmem_dedup_enabled() && !is_persistent(pgp->us.obj->pool) ) {
@@ -1316,6 +1368,7 @@ static int do_tmem_put_compress(struct tmem_page_descriptor *pgp, xen_pfn_t cmfn
     pgp->size = size;
     pgp->us.obj->pool->client->compressed_pages++;
     pgp->us.obj->pool->client->compressed_sum_size += size;
+    tmem_stats.compress_saved_bytes += PAGE_SIZE - size;
     ret = 1;
 
 out:
@@ -1345,7 +1398,7 @@ static int do_tmem_dup_put(struct tmem_page_descriptor *pgp, xen_pfn_t cmfn,
     /* Can we successfully manipulate pgp to change out the data? */
     if ( client->compress && pgp->size != 0 )
     {
-        ret = do_tmem_put_compress(pgp, cmfn, clibuf);
+        ret = do_tmem_put_compress(pgp, cmfn, clibuf, 1);
         if ( ret == 1 )
             goto done;
         else if ( ret == 0 )
@@ -1398,9 +1451,11 @@ cleanup:
     pgp_delist_free(pgpfound);
     if ( obj->pgp_count == 0 )
     {
-        write_lock(&pool->pool_rwlock);
+        rwlock_t *lock = obj_rb_rwlock(pool, &obj->oid);
+
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     } else {
         spin_unlock(&obj->obj_spinlock);
     }
@@ -1416,6 +1471,7 @@ static int do_tmem_put(struct tmem_pool *pool,
     struct tmem_page_descriptor *pgp = NULL;
     struct client *client;
     int ret, newobj = 0;
+    bool_t compress;
 
     ASSERT(pool != NULL);
     client = pool->client;
@@ -1446,21 +1502,23 @@ refind:
         if ( (obj = obj_alloc(pool, oidp)) == NULL )
             return -ENOMEM;
 
-        write_lock(&pool->pool_rwlock);
+        write_lock(obj_rb_rwlock(pool, oidp));
         /*
          * Parallel callers may already allocated obj and inserted to obj_rb_root
          * before us.
          */
         if ( !obj_rb_insert(&pool->obj_rb_root[oid_hash(oidp)], obj) )
         {
+            atomic_dec(&pool->obj_count);
+            atomic_dec_and_assert(global_obj_count);
             tmem_free(obj, pool);
-            write_unlock(&pool->pool_rwlock);
+            write_unlock(obj_rb_rwlock(pool, oidp));
             goto refind;
         }
 
         spin_lock(&obj->obj_spinlock);
         newobj = 1;
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(obj_rb_rwlock(pool, oidp));
     }
 
     /* When arrive here, we have a spinlocked obj for use. */
@@ -1476,10 +1534,11 @@ refind:
     pgp->index = index;
     pgp->size = 0;
 
-    if ( client->compress )
+    compress = client->compress && !pool_compress_skip(pool);
+    if ( compress || tmem_tze_enabled() )
     {
         ASSERT(pgp->pfp == NULL);
-        ret = do_tmem_put_compress(pgp, cmfn, clibuf);
+        ret = do_tmem_put_compress(pgp, cmfn, clibuf, compress);
         if ( ret == 1 )
             goto insert_page;
         if ( ret == -ENOMEM )
@@ -1489,7 +1548,8 @@ refind:
         }
         if ( ret == 0 )
         {
-            client->compress_poor++;
+            if ( compress )
+                client->compress_poor++;
             goto copy_uncompressed;
         }
         if ( ret == -EFAULT )
@@ -1561,9 +1621,11 @@ free_pgp:
 unlock_obj:
     if ( newobj )
     {
-        write_lock(&pool->pool_rwlock);
+        rwlock_t *lock = obj_rb_rwlock(pool, &obj->oid);
+
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     }
     else
     {
@@ -1620,10 +1682,12 @@ static int do_tmem_get(struct tmem_pool *pool,
             pgp_delist_free(pgp);
             if ( obj->pgp_count == 0 )
             {
-                write_lock(&pool->pool_rwlock);
+                rwlock_t *lock = obj_rb_rwlock(pool, &obj->oid);
+
+                write_lock(lock);
                 obj_free(obj);
                 obj = NULL;
-                write_unlock(&pool->pool_rwlock);
+                write_unlock(lock);
             }
         } else {
             spin_lock(&eph_lists_spinlock);
@@ -1671,9 +1735,11 @@ static int do_tmem_flush_page(struct tmem_pool *pool,
     pgp_delist_free(pgp);
     if ( obj->pgp_count == 0 )
     {
-        write_lock(&pool->pool_rwlock);
+        rwlock_t *lock = obj_rb_rwlock(pool, &obj->oid);
+
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     } else {
         spin_unlock(&obj->obj_spinlock);
     }
@@ -1690,15 +1756,17 @@ static int do_tmem_flush_object(struct tmem_pool *pool,
                                 struct xen_tmem_oid *oidp)
 {
     struct tmem_object_root *obj;
+    rwlock_t *lock;
 
     pool->flush_objs++;
     obj = obj_find(pool,oidp);
     if ( obj == NULL )
         goto out;
-    write_lock(&pool->pool_rwlock);
+    lock = obj_rb_rwlock(pool, oidp);
+    write_lock(lock);
     obj_destroy(obj);
     pool->flush_objs_found++;
-    write_unlock(&pool->pool_rwlock);
+    write_unlock(lock);
 
 out:
     if ( pool->client->frozen )
@@ -2155,6 +2223,40 @@ int do_tmem_control(struct xen_sysctl_tmem_op *op)
     return ret;
 }
 
+/* Commands operating on pages of an existing pool. */
+static int tmem_page_op(struct tmem_pool *pool, struct tmem_op *op)
+{
+    struct xen_tmem_oid *oidp = &op->u.gen.oid;
+    int rc;
+
+    switch ( op->cmd )
+    {
+    case TMEM_PUT_PAGE:
+        if ( tmem_ensure_avail_pages() )
+            rc = do_tmem_put(pool, oidp, op->u.gen.index, op->u.gen.cmfn,
+                             tmem_cli_buf_null);
+        else
+            rc = -ENOMEM;
+        break;
+    case TMEM_GET_PAGE:
+        rc = do_tmem_get(pool, oidp, op->u.gen.index, op->u.gen.cmfn,
+                         tmem_cli_buf_null);
+        break;
+    case TMEM_FLUSH_PAGE:
+        rc = do_tmem_flush_page(pool, oidp, op->u.gen.index);
+        break;
+    case TMEM_FLUSH_OBJECT:
+        rc = do_tmem_flush_object(pool, oidp);
+        break;
+    default:
+        tmem_client_warn("tmem: op %d not implemented\n", op->cmd);
+        rc = -ENOSYS;
+        break;
+    }
+
+    return rc;
+}
+
 /************ EXPORTed FUNCTIONS **************************************/
 
 long do_tmem_op(tmem_cli_op_t uops)
@@ -2162,11 +2264,7 @@ long do_tmem_op(tmem_cli_op_t uops)
     struct tmem_op op;
     struct client *client = current->domain->tmem_client;
     struct tmem_pool *pool = NULL;
-    struct xen_tmem_oid *oidp;
     int rc = 0;
-    bool_t succ_get = 0, succ_put = 0;
-    bool_t non_succ_get = 0, non_succ_put = 0;
-    bool_t flush = 0, flush_obj = 0;
 
     if ( !tmem_initialized )
         return -ENODEV;
@@ -2189,7 +2287,32 @@ long do_tmem_op(tmem_cli_op_t uops)
         return -EFAULT;
     }
 
-    /* Acquire write lock for all commands at first. */
+    /*
+     * Page operations on a pool which already exists only need the read
+     * lock, so guests putting and getting pages do not serialise on one
+     * another.  Anything else, including the first use by a client, takes
+     * the write lock below.
+     */
+    switch ( op.cmd )
+    {
+    case TMEM_PUT_PAGE:
+    case TMEM_GET_PAGE:
+    case TMEM_FLUSH_PAGE:
+    case TMEM_FLUSH_OBJECT:
+        read_lock(&tmem_rwlock);
+        if ( client != NULL && (uint32_t)op.pool_id < MAX_POOLS_PER_DOMAIN &&
+             (pool = client->pools[op.pool_id]) != NULL )
+        {
+            rc = tmem_page_op(pool, &op);
+            read_unlock(&tmem_rwlock);
+            if ( rc < 0 )
+                tmem_stats.errored_tmem_ops++;
+            return rc;
+        }
+        read_unlock(&tmem_rwlock);
+        break;
+    }
+
     write_lock(&tmem_rwlock);
 
     if ( op.cmd == TMEM_CONTROL )
@@ -2239,49 +2362,7 @@ long do_tmem_op(tmem_cli_op_t uops)
                 rc = -ENODEV;
                 goto out;
             }
-            /* Commands that only need read lock. */
-            write_unlock(&tmem_rwlock);
-            read_lock(&tmem_rwlock);
-
-            oidp = &op.u.gen.oid;
-            switch ( op.cmd )
-            {
-            case TMEM_NEW_POOL:
-            case TMEM_DESTROY_POOL:
-                BUG(); /* Done earlier. */
-                break;
-            case TMEM_PUT_PAGE:
-                if (tmem_ensure_avail_pages())
-                    rc = do_tmem_put(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
-                                tmem_cli_buf_null);
-                else
-                    rc = -ENOMEM;
-                if (rc == 1) succ_put = 1;
-                else non_succ_put = 1;
-                break;
-            case TMEM_GET_PAGE:
-                rc = do_tmem_get(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
-                                tmem_cli_buf_null);
-                if (rc == 1) succ_get = 1;
-                else non_succ_get = 1;
-                break;
-            case TMEM_FLUSH_PAGE:
-                flush = 1;
-                rc = do_tmem_flush_page(pool, oidp, op.u.gen.index);
-                break;
-            case TMEM_FLUSH_OBJECT:
-                rc = do_tmem_flush_object(pool, oidp);
-                flush_obj = 1;
-                break;
-            default:
-                tmem_client_warn("tmem: op %d not implemented\n", op.cmd);
-                rc = -ENOSYS;
-                break;
-            }
-            read_unlock(&tmem_rwlock);
-            if ( rc < 0 )
-                tmem_stats.errored_tmem_ops++;
-            return rc;
+            rc = tmem_page_op(pool, &op);
         }
     }
 out:
@@ -2378,8 +2459,10 @@ static int __init init_tmem(void)
 
     if ( tmem_init() )
     {
-        printk("tmem: initialized comp=%d dedup=%d tze=%d\n",
-            tmem_compression_enabled(), tmem_dedup_enabled(), tmem_tze_enabled());
+        printk("tmem: initialized comp=%d (%s) dedup=%d tze=%d\n",
+            tmem_compression_enabled(),
+            opt_tmem_compress_alg == TMEM_COMPRESS_LZ4 ? "lz4" : "lzo",
+            tmem_dedup_enabled(), tmem_tze_enabled());
         if ( tmem_dedup_enabled()&&tmem_compression_enabled()&&tmem_tze_enabled() )
         {
             tmem_tze_disable();
@@ -52,6 +52,7 @@ static unsigned long tmem_flush_npages(unsigned long n)
     }
     if ( avail_pages )
     {
+        tmem_page_list_flush_cpu(smp_processor_id());
         spin_lock(&tmem_page_list_lock);
         while ( !page_list_empty(&tmem_page_list) )
         {
@@ -130,11 +131,11 @@ static int tmemc_list_client(struct client *c, tmem_cli_va_param_t buf,
                       use_long ? ',' : '\n');
         if (use_long)
             n += scnprintf(info+n,BSIZE-n,
-             "Pc:%d,Pm:%d,Oc:%ld,Om:%ld,Nc:%lu,Nm:%lu,"
+             "Pc:%d,Pm:%d,Oc:%d,Om:%d,Nc:%lu,Nm:%lu,"
              "ps:%lu,pt:%lu,pd:%lu,pr:%lu,px:%lu,gs:%lu,gt:%lu,"
              "fs:%lu,ft:%lu,os:%lu,ot:%lu\n",
              _atomic_read(p->pgp_count), p->pgp_count_max,
-             p->obj_count, p->obj_count_max,
+             _atomic_read(p->obj_count), p->obj_count_max,
              p->objnode_count, p->objnode_count_max,
              p->good_puts, p->puts,p->dup_puts_flushed, p->dup_puts_replaced,
              p->no_mem_puts,
@@ -169,11 +170,11 @@ static int tmemc_list_shared(tmem_cli_va_param_t buf, int off, uint32_t len,
         n += scnprintf(info+n,BSIZE-n,"%c", use_long ? ',' : '\n');
         if (use_long)
             n += scnprintf(info+n,BSIZE-n,
-             "Pc:%d,Pm:%d,Oc:%ld,Om:%ld,Nc:%lu,Nm:%lu,"
+             "Pc:%d,Pm:%d,Oc:%d,Om:%d,Nc:%lu,Nm:%lu,"
              "ps:%lu,pt:%lu,pd:%lu,pr:%lu,px:%lu,gs:%lu,gt:%lu,"
              "fs:%lu,ft:%lu,os:%lu,ot:%lu\n",
              _atomic_read(p->pgp_count), p->pgp_count_max,
-             p->obj_count, p->obj_count_max,
+             _atomic_read(p->obj_count), p->obj_count_max,
              p->objnode_count, p->objnode_count_max,
              p->good_puts, p->puts,p->dup_puts_flushed, p->dup_puts_replaced,
              p->no_mem_puts,
@@ -221,7 +222,8 @@ static int tmemc_list_global(tmem_cli_va_param_t buf, int off, uint32_t len,
     if (use_long)
         n += scnprintf(info+n,BSIZE-n,
           "Ec:%ld,Em:%ld,Oc:%d,Om:%d,Nc:%d,Nm:%d,Pc:%d,Pm:%d,"
-          "Fc:%d,Fm:%d,Sc:%d,Sm:%d,Ep:%lu,Gd:%lu,Zt:%lu,Gz:%lu\n",
+          "Fc:%d,Fm:%d,Sc:%d,Sm:%d,Ep:%lu,Gd:%lu,Zt:%lu,Gz:%lu,"
+          "Ca:%lu,Ck:%lu,Zp:%lu,Ct:%"PRIu64",Cb:%"PRIu64"\n",
           tmem_global.eph_count, tmem_stats.global_eph_count_max,
           _atomic_read(tmem_stats.global_obj_count), tmem_stats.global_obj_count_max,
           _atomic_read(tmem_stats.global_rtree_node_count), tmem_stats.global_rtree_node_count_max,
@@ -229,7 +231,9 @@ static int tmemc_list_global(tmem_cli_va_param_t buf, int off, uint32_t len,
           _atomic_read(tmem_stats.global_page_count), tmem_stats.global_page_count_max,
           _atomic_read(tmem_stats.global_pcd_count), tmem_stats.global_pcd_count_max,
          tmem_stats.tot_good_eph_puts,tmem_stats.deduped_puts,tmem_stats.pcd_tot_tze_size,
-         tmem_stats.pcd_tot_csize);
+         tmem_stats.pcd_tot_csize, tmem_stats.compress_attempts,
+         tmem_stats.compress_skipped, tmem_stats.zero_pages,
+         tmem_stats.compress_cycles, tmem_stats.compress_saved_bytes);
     if ( sum + n >= len )
         return sum;
     if ( !copy_to_guest_offset(buf, off + sum, info, n + 1) )
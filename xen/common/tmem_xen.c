@@ -8,7 +8,9 @@
 
 #include <xen/tmem.h>
 #include <xen/tmem_xen.h>
+#include <xen/tmem_control.h>
 #include <xen/lzo.h> /* compression code */
+#include <xen/lz4.h>
 #include <xen/paging.h>
 #include <xen/domain_page.h>
 #include <xen/cpu.h>
@@ -20,6 +22,20 @@ boolean_param("tmem", opt_tmem);
 bool_t __read_mostly opt_tmem_compress = 0;
 boolean_param("tmem_compress", opt_tmem_compress);
 
+/* Compressed data is kept for the lifetime of tmem, so this is fixed at boot. */
+unsigned int __read_mostly opt_tmem_compress_alg = TMEM_COMPRESS_LZO;
+
+static void __init parse_tmem_compress_alg(const char *s)
+{
+    if ( !strcmp(s, "lzo") )
+        opt_tmem_compress_alg = TMEM_COMPRESS_LZO;
+    else if ( !strcmp(s, "lz4") )
+        opt_tmem_compress_alg = TMEM_COMPRESS_LZ4;
+    else
+        printk("tmem: unknown compression algorithm '%s', using lzo\n", s);
+}
+custom_param("tmem_compress_alg", parse_tmem_compress_alg);
+
 bool_t __read_mostly opt_tmem_dedup = 0;
 boolean_param("tmem_dedup", opt_tmem_dedup);
 
@@ -39,6 +55,69 @@ static DEFINE_PER_CPU_READ_MOSTLY(unsigned char *, workmem);
 static DEFINE_PER_CPU_READ_MOSTLY(unsigned char *, dstmem);
 static DEFINE_PER_CPU_READ_MOSTLY(void *, scratch_page);
 
+/*
+ * The compressed form of an all-zeroes page.  Zero pages are recognised
+ * on put and stored as a copy of this, without running the compressor.
+ */
+static unsigned char __read_mostly zero_cdata[64];
+static size_t __read_mostly zero_csize;
+
+static DEFINE_PER_CPU(struct page_list_head, tmem_pcpu_page_list);
+static DEFINE_PER_CPU(unsigned int, tmem_pcpu_pages);
+
+/*
+ * Only hypercall and page allocator context use these, never an interrupt
+ * handler, so the per-CPU lists need no lock of their own.
+ */
+struct page_info *tmem_page_list_get(void)
+{
+    struct page_info *pi;
+
+    ASSERT(!in_irq());
+    if ( (pi = page_list_remove_head(&this_cpu(tmem_pcpu_page_list))) != NULL )
+        this_cpu(tmem_pcpu_pages)--;
+    else if ( tmem_page_list_pages )
+    {
+        spin_lock(&tmem_page_list_lock);
+        if ( (pi = page_list_remove_head(&tmem_page_list)) != NULL )
+            tmem_page_list_pages--;
+        spin_unlock(&tmem_page_list_lock);
+    }
+    ASSERT((pi == NULL) || IS_VALID_PAGE(pi));
+    return pi;
+}
+
+void tmem_page_list_put(struct page_info *pi)
+{
+    ASSERT(IS_VALID_PAGE(pi));
+    ASSERT(!in_irq());
+    if ( this_cpu(tmem_pcpu_pages) < TMEM_PCPU_PAGES )
+    {
+        page_list_add(pi, &this_cpu(tmem_pcpu_page_list));
+        this_cpu(tmem_pcpu_pages)++;
+        return;
+    }
+    spin_lock(&tmem_page_list_lock);
+    page_list_add(pi, &tmem_page_list);
+    tmem_page_list_pages++;
+    spin_unlock(&tmem_page_list_lock);
+}
+
+/* Hand a CPU's cached pages back to the global list. */
+void tmem_page_list_flush_cpu(unsigned int cpu)
+{
+    struct page_list_head *list = &per_cpu(tmem_pcpu_page_list, cpu);
+
+    if ( !per_cpu(tmem_pcpu_pages, cpu) )
+        return;
+    spin_lock(&tmem_page_list_lock);
+    page_list_splice(list, &tmem_page_list);
+    tmem_page_list_pages += per_cpu(tmem_pcpu_pages, cpu);
+    spin_unlock(&tmem_page_list_lock);
+    INIT_PAGE_LIST_HEAD(list);
+    per_cpu(tmem_pcpu_pages, cpu) = 0;
+}
+
 #if defined(CONFIG_ARM)
 static inline void *cli_get_page(xen_pfn_t cmfn, unsigned long *pcli_mfn,
                                  struct page_info **pcli_pfp, bool_t cli_write)
@@ -126,8 +205,59 @@ int tmem_copy_from_client(struct page_info *pfp,
     return rc;
 }
 
+static int compress_page(const void *src, unsigned char *dst, size_t *dst_len,
+                         void *wmem)
+{
+    switch ( opt_tmem_compress_alg )
+    {
+    case TMEM_COMPRESS_LZ4:
+        return lz4_compress(src, PAGE_SIZE, dst, dst_len, wmem) ? -EINVAL : 0;
+    default:
+        return lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, wmem) == LZO_E_OK
+               ? 0 : -EINVAL;
+    }
+}
+
+static int decompress_page(const void *src, size_t src_len, void *dst)
+{
+    size_t len;
+
+    switch ( opt_tmem_compress_alg )
+    {
+    case TMEM_COMPRESS_LZ4:
+        len = src_len;
+        if ( lz4_decompress(src, &len, dst, PAGE_SIZE) || len != src_len )
+            return -EINVAL;
+        return 0;
+    default:
+        len = PAGE_SIZE;
+        if ( lzo1x_decompress_safe(src, src_len, dst, &len) != LZO_E_OK ||
+             len != PAGE_SIZE )
+            return -EINVAL;
+        return 0;
+    }
+}
+
+static bool_t page_is_zero(const void *p)
+{
+    const unsigned long *q = p;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*q); i++ )
+        if ( q[i] )
+            return 0;
+    return 1;
+}
+
+/*
+ * Returns 1 if the page was compressed, TMEM_COMPRESS_ZERO if it was
+ * found to be all zeroes (only checked when @zero is set), and 0 if it
+ * should be stored uncompressed.  Without @compress only zero pages are
+ * taken.
+ */
 int tmem_compress_from_client(xen_pfn_t cmfn,
-    void **out_va, size_t *out_len, tmem_cli_va_param_t clibuf)
+    void **out_va, size_t *out_len, tmem_cli_va_param_t clibuf,
+    bool_t compress, bool_t zero)
 {
     int ret = 0;
     unsigned char *dmem = this_cpu(dstmem);
@@ -136,9 +266,14 @@ int tmem_compress_from_client(xen_pfn_t cmfn,
     struct page_info *cli_pfp = NULL;
     unsigned long cli_mfn = 0;
     void *cli_va = NULL;
+    uint64_t start;
 
     if ( dmem == NULL || wmem == NULL )
         return 0;  /* no buffer, so can't compress */
+    if ( !zero_csize )
+        zero = 0;
+    if ( !compress && !zero )
+        return 0;
     if ( guest_handle_is_null(clibuf) )
     {
         cli_va = cli_get_page(cmfn, &cli_mfn, &cli_pfp, 0);
@@ -150,12 +285,26 @@ int tmem_compress_from_client(xen_pfn_t cmfn,
     else if ( copy_from_guest(scratch, clibuf, PAGE_SIZE) )
         return -EFAULT;
     smp_mb();
-    ret = lzo1x_1_compress(cli_va ?: scratch, PAGE_SIZE, dmem, out_len, wmem);
-    ASSERT(ret == LZO_E_OK);
+    if ( zero && page_is_zero(cli_va ?: scratch) )
+    {
+        memcpy(dmem, zero_cdata, zero_csize);
+        *out_len = zero_csize;
+        ret = TMEM_COMPRESS_ZERO;
+    }
+    else if ( compress )
+    {
+        start = get_cycles();
+        *out_len = LZO_DSTMEM_PAGES * PAGE_SIZE;
+        ret = compress_page(cli_va ?: scratch, dmem, out_len, wmem);
+        ASSERT(ret == 0);
+        tmem_stats.compress_cycles += get_cycles() - start;
+        tmem_stats.compress_attempts++;
+        ret = 1;
+    }
     *out_va = dmem;
     if ( cli_va )
         cli_put_page(cli_va, cli_pfp, cli_mfn, 0);
-    return 1;
+    return ret;
 }
 
 int tmem_copy_to_client(xen_pfn_t cmfn, struct page_info *pfp,
@@ -194,7 +343,6 @@ int tmem_decompress_to_client(xen_pfn_t cmfn, void *tmem_va,
     struct page_info *cli_pfp = NULL;
     void *cli_va = NULL;
     char *scratch = this_cpu(scratch_page);
-    size_t out_len = PAGE_SIZE;
     int ret;
 
     if ( guest_handle_is_null(clibuf) )
@@ -205,9 +353,13 @@ int tmem_decompress_to_client(xen_pfn_t cmfn, void *tmem_va,
     }
     else if ( !scratch )
         return 0;
-    ret = lzo1x_decompress_safe(tmem_va, size, cli_va ?: scratch, &out_len);
-    ASSERT(ret == LZO_E_OK);
-    ASSERT(out_len == PAGE_SIZE);
+    if ( size == zero_csize && !memcmp(tmem_va, zero_cdata, size) )
+        clear_page(cli_va ?: scratch);
+    else
+    {
+        ret = decompress_page(tmem_va, size, cli_va ?: scratch);
+        ASSERT(ret == 0);
+    }
     if ( cli_va )
         cli_put_page(cli_va, cli_pfp, cli_mfn, 1);
     else if ( copy_to_guest(clibuf, scratch, PAGE_SIZE) )
@@ -249,6 +401,8 @@ static int cpu_callback(
     switch ( action )
     {
     case CPU_UP_PREPARE: {
+        if ( !per_cpu(tmem_pcpu_pages, cpu) )
+            INIT_PAGE_LIST_HEAD(&per_cpu(tmem_pcpu_page_list, cpu));
         if ( per_cpu(dstmem, cpu) == NULL )
             per_cpu(dstmem, cpu) = alloc_xenheap_pages(dstmem_order, 0);
         if ( per_cpu(workmem, cpu) == NULL )
@@ -259,6 +413,7 @@ static int cpu_callback(
     }
     case CPU_DEAD:
     case CPU_UP_CANCELED: {
+        tmem_page_list_flush_cpu(cpu);
         if ( per_cpu(dstmem, cpu) != NULL )
         {
             free_xenheap_pages(per_cpu(dstmem, cpu), dstmem_order);
@@ -287,12 +442,30 @@ static struct notifier_block cpu_nfb = {
     .notifier_call = cpu_callback
 };
 
+static void __init zero_cdata_init(void)
+{
+    unsigned char *dmem = this_cpu(dstmem);
+    unsigned char *wmem = this_cpu(workmem);
+    void *page = this_cpu(scratch_page);
+    size_t len = LZO_DSTMEM_PAGES * PAGE_SIZE;
+
+    if ( dmem == NULL || wmem == NULL || page == NULL )
+        return;
+    clear_page(page);
+    if ( compress_page(page, dmem, &len, wmem) || len > sizeof(zero_cdata) )
+        return;
+    memcpy(zero_cdata, dmem, len);
+    zero_csize = len;
+}
+
 int __init tmem_init(void)
 {
     unsigned int cpu;
 
     dstmem_order = get_order_from_pages(LZO_DSTMEM_PAGES);
-    workmem_order = get_order_from_bytes(LZO1X_1_MEM_COMPRESS);
+    workmem_order = get_order_from_bytes(
+        opt_tmem_compress_alg == TMEM_COMPRESS_LZ4 ? LZ4_MEM_COMPRESS
+                                                   : LZO1X_1_MEM_COMPRESS);
 
     for_each_online_cpu ( cpu )
     {
@@ -302,5 +475,7 @@ int __init tmem_init(void)
 
     register_cpu_notifier(&cpu_nfb);
 
+    zero_cdata_init();
+
     return 1;
 }
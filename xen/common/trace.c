@@ -54,15 +54,24 @@ static struct t_info *t_info;
 static unsigned int t_info_pages;
 
 static DEFINE_PER_CPU_READ_MOSTLY(struct t_buf *, t_bufs);
-static DEFINE_PER_CPU_READ_MOSTLY(spinlock_t, t_lock);
 static u32 data_size __read_mostly;
 
+/*
+ * Each CPU's buffer has a single producer, the CPU itself, possibly nested
+ * by interrupts and NMIs.  Space is reserved by advancing the private
+ * t_resv with cmpxchg; the shared t_buf prod is only moved up to t_resv by
+ * the outermost writer, once all nested records are complete, so neither
+ * a lock nor masking interrupts is needed.
+ */
+static DEFINE_PER_CPU(u32, t_resv);
+static DEFINE_PER_CPU(unsigned int, t_nesting);
+
 /* High water mark for trace buffers; */
 /* Send virtual interrupt when buffer level reaches this point */
 static u32 t_buf_highwater;
 
 /* Number of records lost due to per-CPU trace buffer being full. */
-static DEFINE_PER_CPU(unsigned long, lost_records);
+static DEFINE_PER_CPU(atomic_t, lost_records);
 static DEFINE_PER_CPU(unsigned long, lost_records_first_tsc);
 
 /* a flag recording whether initialization has been done */
@@ -79,21 +88,6 @@ static u32 tb_event_mask = TRC_ALL;
  * i.e., sizeof(_type) * ans >= _x. */
 #define fit_to_type(_type, _x) (((_x)+sizeof(_type)-1) / sizeof(_type))
 
-static int cpu_callback(
-    struct notifier_block *nfb, unsigned long action, void *hcpu)
-{
-    unsigned int cpu = (unsigned long)hcpu;
-
-    if ( action == CPU_UP_PREPARE )
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
-    return NOTIFY_DONE;
-}
-
-static struct notifier_block cpu_nfb = {
-    .notifier_call = cpu_callback
-};
-
 static uint32_t calc_tinfo_first_offset(void)
 {
     int offset_in_bytes = offsetof(struct t_info, mfn_offset[NR_CPUS]);
@@ -226,13 +220,12 @@ static int alloc_trace_bufs(unsigned int pages)
         struct t_buf *buf;
         struct page_info *pg;
 
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
         offset = t_info->mfn_offset[cpu];
 
         /* Initialize the buffer metadata */
         per_cpu(t_bufs, cpu) = buf = mfn_to_virt(t_info_mfn_list[offset]);
         buf->cons = buf->prod = 0;
+        per_cpu(t_resv, cpu) = 0;
 
         printk(XENLOG_INFO "xentrace: p%d mfn %x offset %u\n",
                    cpu, t_info_mfn_list[offset], offset);
@@ -342,7 +335,6 @@ int trace_will_trace_event(u32 event)
 void __init init_trace_bufs(void)
 {
     cpumask_setall(&tb_cpu_mask);
-    register_cpu_notifier(&cpu_nfb);
 
     if ( opt_tbuf_size )
     {
@@ -416,14 +408,13 @@ int tb_control(xen_sysctl_tbuf_op_t *tbc)
         tb_init_done = 0;
         smp_wmb();
         /* Clear any lost-record info so we don't get phantom lost records next time we
-         * start tracing.  Grab the lock to make sure we're not racing anyone.  After this
-         * hypercall returns, no more records should be placed into the buffers. */
+         * start tracing.  Wait for writers in flight to make sure we're not racing anyone.
+         * After this hypercall returns, no more records should be placed into the buffers. */
         for_each_online_cpu(i)
         {
-            unsigned long flags;
-            spin_lock_irqsave(&per_cpu(t_lock, i), flags);
-            per_cpu(lost_records, i)=0;
-            spin_unlock_irqrestore(&per_cpu(t_lock, i), flags);
+            while ( read_atomic(&per_cpu(t_nesting, i)) )
+                cpu_relax();
+            atomic_set(&per_cpu(lost_records, i), 0);
         }
     }
         break;
@@ -460,16 +451,10 @@ static inline bool_t bogus(u32 prod, u32 cons)
     return 0;
 }
 
-static inline u32 calc_unconsumed_bytes(const struct t_buf *buf)
+static inline u32 calc_unconsumed_bytes(u32 prod, u32 cons)
 {
-    u32 prod = buf->prod, cons = buf->cons;
-    s32 x;
-
-    barrier(); /* must read buf->prod and buf->cons only once */
-    if ( bogus(prod, cons) )
-        return data_size;
+    s32 x = prod - cons;
 
-    x = prod - cons;
     if ( x < 0 )
         x += 2*data_size;
 
@@ -479,16 +464,21 @@ static inline u32 calc_unconsumed_bytes(const struct t_buf *buf)
     return x;
 }
 
-static inline u32 calc_bytes_to_wrap(const struct t_buf *buf)
+/* Is @pos ahead of @prod, neither being more than data_size ahead? */
+static inline bool_t pos_after(u32 pos, u32 prod)
 {
-    u32 prod = buf->prod, cons = buf->cons;
-    s32 x;
+    s32 x = pos - prod;
 
-    barrier(); /* must read buf->prod and buf->cons only once */
-    if ( bogus(prod, cons) )
-        return 0;
+    if ( x < 0 )
+        x += 2*data_size;
+
+    return x > 0 && x <= data_size;
+}
+
+static inline u32 calc_bytes_to_wrap(u32 prod)
+{
+    s32 x = data_size - prod;
 
-    x = data_size - prod;
     if ( x <= 0 )
         x += data_size;
 
@@ -498,27 +488,25 @@ static inline u32 calc_bytes_to_wrap(const struct t_buf *buf)
     return x;
 }
 
-static inline u32 calc_bytes_avail(const struct t_buf *buf)
+static inline u32 advance_pos(u32 pos, u32 bytes)
 {
-    return data_size - calc_unconsumed_bytes(buf);
+    pos += bytes;
+    if ( pos >= 2*data_size )
+        pos -= 2*data_size;
+    ASSERT(pos < 2*data_size);
+
+    return pos;
 }
 
-static unsigned char *next_record(const struct t_buf *buf, uint32_t *next,
-                                 unsigned char **next_page,
-                                 uint32_t *offset_in_page)
+static unsigned char *next_record(u32 x, unsigned char **next_page,
+                                  uint32_t *offset_in_page)
 {
-    u32 x = buf->prod, cons = buf->cons;
     uint16_t per_cpu_mfn_offset;
     uint32_t per_cpu_mfn_nr;
     uint32_t *mfn_list;
     uint32_t mfn;
     unsigned char *this_page;
 
-    barrier(); /* must read buf->prod and buf->cons only once */
-    *next = x;
-    if ( !tb_init_done || bogus(x, cons) )
-        return NULL;
-
     if ( x >= data_size )
         x -= data_size;
 
@@ -547,28 +535,26 @@ static unsigned char *next_record(const struct t_buf *buf, uint32_t *next,
     return this_page;
 }
 
-static inline void __insert_record(struct t_buf *buf,
-                                   unsigned long event,
-                                   unsigned int extra,
-                                   bool_t cycles,
-                                   unsigned int rec_size,
-                                   const void *extra_data)
+/* Writes a record at the reserved position @pos, returning the next one. */
+static inline u32 __insert_record(u32 pos,
+                                  unsigned long event,
+                                  unsigned int extra,
+                                  bool_t cycles,
+                                  unsigned int rec_size,
+                                  const void *extra_data)
 {
     struct t_rec split_rec, *rec;
     uint32_t *dst;
     unsigned char *this_page, *next_page;
     unsigned int extra_word = extra / sizeof(u32);
     unsigned int local_rec_size = calc_rec_size(cycles, extra);
-    uint32_t next;
     uint32_t offset;
     uint32_t remaining;
 
     BUG_ON(local_rec_size != rec_size);
     BUG_ON(extra & 3);
 
-    this_page = next_record(buf, &next, &next_page, &offset);
-    if ( !this_page )
-        return;
+    this_page = next_record(pos, &next_page, &offset);
 
     remaining = PAGE_SIZE - offset;
 
@@ -578,9 +564,9 @@ static inline void __insert_record(struct t_buf *buf,
         {
             /* access beyond end of buffer */
             printk(XENLOG_WARNING
-                   "%s: size=%08x prod=%08x cons=%08x rec=%u remaining=%u\n",
-                   __func__, data_size, next, buf->cons, rec_size, remaining);
-            return;
+                   "%s: size=%08x pos=%08x rec=%u remaining=%u\n",
+                   __func__, data_size, pos, rec_size, remaining);
+            return advance_pos(pos, rec_size);
         }
         rec = &split_rec;
     } else {
@@ -596,7 +582,7 @@ static inline void __insert_record(struct t_buf *buf,
         rec->u.cycles.cycles_lo = (uint32_t)tsc;
         rec->u.cycles.cycles_hi = (uint32_t)(tsc >> 32);
         dst = rec->u.cycles.extra_u32;
-    } 
+    }
 
     if ( extra_data && extra )
         memcpy(dst, extra_data, extra);
@@ -607,19 +593,12 @@ static inline void __insert_record(struct t_buf *buf,
         memcpy(next_page, (char *)rec + remaining, rec_size - remaining);
     }
 
-    smp_wmb();
-
-    next += rec_size;
-    if ( next >= 2*data_size )
-        next -= 2*data_size;
-    ASSERT(next < 2*data_size);
-    buf->prod = next;
+    return advance_pos(pos, rec_size);
 }
 
-static inline void insert_wrap_record(struct t_buf *buf,
-                                      unsigned int size)
+static inline u32 insert_wrap_record(u32 pos, unsigned int size)
 {
-    u32 space_left = calc_bytes_to_wrap(buf);
+    u32 space_left = calc_bytes_to_wrap(pos);
     unsigned int extra_space = space_left - sizeof(u32);
     bool_t cycles = 0;
 
@@ -633,13 +612,14 @@ static inline void insert_wrap_record(struct t_buf *buf,
         ASSERT((extra_space/sizeof(u32)) <= TRACE_EXTRA_MAX);
     }
 
-    __insert_record(buf, TRC_TRACE_WRAP_BUFFER, extra_space, cycles,
-                    space_left, NULL);
+    return __insert_record(pos, TRC_TRACE_WRAP_BUFFER, extra_space, cycles,
+                           space_left, NULL);
 }
 
 #define LOST_REC_SIZE (4 + 8 + 16) /* header + tsc + sizeof(struct ed) */
 
-static inline void insert_lost_records(struct t_buf *buf)
+static inline u32 insert_lost_records(u32 pos, unsigned int lost,
+                                      u64 first_tsc)
 {
     struct __packed {
         u32 lost_records;
@@ -649,21 +629,55 @@ static inline void insert_lost_records(struct t_buf *buf)
 
     ed.vid = current->vcpu_id;
     ed.did = current->domain->domain_id;
-    ed.lost_records = this_cpu(lost_records);
-    ed.first_tsc = this_cpu(lost_records_first_tsc);
+    ed.lost_records = lost;
+    ed.first_tsc = first_tsc;
 
-    this_cpu(lost_records) = 0;
+    return __insert_record(pos, TRC_LOST_RECORDS, sizeof(ed), 1 /* cycles */,
+                           LOST_REC_SIZE, &ed);
+}
+
+/*
+ * Calculate the total size needed for a record of @rec_size bytes, preceded
+ * by a lost records record if @lost, when written at @pos: this includes
+ * the wrap records keeping records from straddling the end of the buffer.
+ */
+static u32 calc_total_size(u32 pos, unsigned int rec_size, bool_t lost)
+{
+    u32 total_size = 0, bytes_to_wrap = calc_bytes_to_wrap(pos);
 
-    __insert_record(buf, TRC_LOST_RECORDS, sizeof(ed), 1 /* cycles */,
-                    LOST_REC_SIZE, &ed);
+    if ( lost )
+    {
+        if ( LOST_REC_SIZE > bytes_to_wrap )
+        {
+            total_size += bytes_to_wrap;
+            bytes_to_wrap = data_size;
+        }
+        total_size += LOST_REC_SIZE;
+        bytes_to_wrap -= LOST_REC_SIZE;
+
+        /* LOST_REC might line up perfectly with the buffer wrap */
+        if ( bytes_to_wrap == 0 )
+            bytes_to_wrap = data_size;
+    }
+
+    if ( rec_size > bytes_to_wrap )
+        total_size += bytes_to_wrap;
+
+    return total_size + rec_size;
 }
 
 /*
  * Notification is performed in qtasklet to avoid deadlocks with contexts
  * which __trace_var() may be called from (e.g., scheduler critical regions).
+ * A single notification is outstanding at any time, however many CPUs
+ * cross their high water mark before the consumer runs.
  */
+static bool_t trace_notify_pending;
+
 static void trace_notify_dom0(unsigned long unused)
 {
+    trace_notify_pending = 0;
+    smp_mb();
     send_global_virq(VIRQ_TBUF);
 }
 static DECLARE_SOFTIRQ_TASKLET(trace_notify_dom0_tasklet,
@@ -682,11 +696,11 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
                  const void *extra_data)
 {
     struct t_buf *buf;
-    unsigned long flags;
-    u32 bytes_to_tail, bytes_to_wrap;
-    unsigned int rec_size, total_size;
+    u32 prod, cons, pos, next;
+    unsigned int rec_size, total_size, lost;
     unsigned int extra_word;
-    bool_t started_below_highwater;
+    u64 first_tsc = 0;
+    bool_t crossed_highwater = 0;
 
     if( !tb_init_done )
         return;
@@ -695,7 +709,7 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     extra_word = (extra / sizeof(u32));
     if ( (extra % sizeof(u32)) != 0 )
         extra_word++;
-    
+
     ASSERT(extra_word <= TRACE_EXTRA_MAX);
     extra_word = min_t(int, extra_word, TRACE_EXTRA_MAX);
 
@@ -720,99 +734,108 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     /* Read tb_init_done /before/ t_bufs. */
     smp_rmb();
 
-    spin_lock_irqsave(&this_cpu(t_lock), flags);
-
     buf = this_cpu(t_bufs);
-
     if ( unlikely(!buf) )
-    {
-        /* Make gcc happy */
-        started_below_highwater = 0;
-        goto unlock;
-    }
-
-    started_below_highwater = (calc_unconsumed_bytes(buf) < t_buf_highwater);
+        return;
 
     /* Calculate the record size */
     rec_size = calc_rec_size(cycles, extra);
- 
-    /* How many bytes are available in the buffer? */
-    bytes_to_tail = calc_bytes_avail(buf);
-    
-    /* How many bytes until the next wrap-around? */
-    bytes_to_wrap = calc_bytes_to_wrap(buf);
-    
-    /* 
-     * Calculate expected total size to commit this record by
-     * doing a dry-run.
-     */
-    total_size = 0;
 
-    /* First, check to see if we need to include a lost_record.
+    /*
+     * Writers interrupting us always finish before we resume, so a plain
+     * increment is fine even if not atomic; likewise the decrement below.
      */
-    if ( this_cpu(lost_records) )
-    {
-        if ( LOST_REC_SIZE > bytes_to_wrap )
+    this_cpu(t_nesting)++;
+    barrier();
+
+    /* Claim the pending lost records; they get handed back if no room. */
+    lost = atomic_xchg(&this_cpu(lost_records), 0);
+    if ( lost )
+        first_tsc = this_cpu(lost_records_first_tsc);
+
+    /* Reserve space for everything, retrying if a nested writer raced. */
+    do {
+        prod = read_atomic(&this_cpu(t_resv));
+        cons = read_atomic(&buf->cons);
+        if ( bogus(prod, cons) )
         {
-            total_size += bytes_to_wrap;
-            bytes_to_wrap = data_size;
-        } 
-        total_size += LOST_REC_SIZE;
-        bytes_to_wrap -= LOST_REC_SIZE;
+            /* Hand back the claimed lost records, with their tsc. */
+            if ( lost )
+            {
+                atomic_add(lost, &this_cpu(lost_records));
+                this_cpu(lost_records_first_tsc) = first_tsc;
+            }
+            goto out;
+        }
 
-        /* LOST_REC might line up perfectly with the buffer wrap */
-        if ( bytes_to_wrap == 0 )
-            bytes_to_wrap = data_size;
-    }
+        total_size = calc_total_size(prod, rec_size, lost);
 
-    if ( rec_size > bytes_to_wrap )
-    {
-        total_size += bytes_to_wrap;
-    } 
-    total_size += rec_size;
+        /* Do we have enough space for everything? */
+        if ( total_size > data_size - calc_unconsumed_bytes(prod, cons) )
+        {
+            /* The earliest loss, possibly our claimed one, keeps its tsc. */
+            if ( atomic_add_return(lost + 1,
+                                   &this_cpu(lost_records)) == lost + 1 ||
+                 lost )
+                this_cpu(lost_records_first_tsc) =
+                    lost ? first_tsc : (u64)get_cycles();
+            goto out;
+        }
 
-    /* Do we have enough space for everything? */
-    if ( total_size > bytes_to_tail )
-    {
-        if ( ++this_cpu(lost_records) == 1 )
-            this_cpu(lost_records_first_tsc)=(u64)get_cycles();
-        started_below_highwater = 0;
-        goto unlock;
-    }
+        next = advance_pos(prod, total_size);
+    } while ( cmpxchg(&this_cpu(t_resv), prod, next) != prod );
+
+    crossed_highwater =
+        (calc_unconsumed_bytes(prod, cons) < t_buf_highwater) &&
+        (calc_unconsumed_bytes(next, cons) >= t_buf_highwater);
 
     /*
-     * Now, actually write information 
+     * Now, actually write information
      */
-    bytes_to_wrap = calc_bytes_to_wrap(buf);
+    pos = prod;
 
-    if ( this_cpu(lost_records) )
+    if ( lost )
     {
-        if ( LOST_REC_SIZE > bytes_to_wrap )
-        {
-            insert_wrap_record(buf, LOST_REC_SIZE);
-            bytes_to_wrap = data_size;
-        } 
-        insert_lost_records(buf);
-        bytes_to_wrap -= LOST_REC_SIZE;
-
-        /* LOST_REC might line up perfectly with the buffer wrap */
-        if ( bytes_to_wrap == 0 )
-            bytes_to_wrap = data_size;
+        if ( LOST_REC_SIZE > calc_bytes_to_wrap(pos) )
+            pos = insert_wrap_record(pos, LOST_REC_SIZE);
+        pos = insert_lost_records(pos, lost, first_tsc);
     }
 
-    if ( rec_size > bytes_to_wrap )
-        insert_wrap_record(buf, rec_size);
+    if ( rec_size > calc_bytes_to_wrap(pos) )
+        pos = insert_wrap_record(pos, rec_size);
 
     /* Write the original record */
-    __insert_record(buf, event, extra, cycles, rec_size, extra_data);
+    pos = __insert_record(pos, event, extra, cycles, rec_size, extra_data);
+    ASSERT(pos == next);
 
-unlock:
-    spin_unlock_irqrestore(&this_cpu(t_lock), flags);
+ out:
+    barrier();
+    if ( --this_cpu(t_nesting) == 0 )
+    {
+        /*
+         * Publish everything reserved so far, including the records of
+         * writers which interrupted us.  One may get in just before the
+         * prod update and publish a later position itself, so prod is only
+         * ever moved forward, and t_resv rechecked afterwards.
+         */
+        do {
+            next = read_atomic(&this_cpu(t_resv));
+            smp_wmb();
+            prod = read_atomic(&buf->prod);
+            while ( pos_after(next, prod) )
+            {
+                u32 old = cmpxchg(&buf->prod, prod, next);
+
+                if ( old == prod )
+                    break;
+                prod = old;
+            }
+            barrier();
+        } while ( next != read_atomic(&this_cpu(t_resv)) );
+    }
 
     /* Notify trace buffer consumer that we've crossed the high water mark. */
-    if ( likely(buf!=NULL)
-         && started_below_highwater
-         && (calc_unconsumed_bytes(buf) >= t_buf_highwater) )
+    if ( crossed_highwater && !test_and_set_bool(trace_notify_pending) )
         tasklet_schedule(&trace_notify_dom0_tasklet);
 }
 
@@ -10,7 +10,12 @@
 
 #include "decompress.h"
 #include <xen/lz4.h>
+#ifdef __XEN__
+/* The decompressor itself is built once, for runtime use, in lz4.c. */
+#include "lz4/defs.h"
+#else
 #include "lz4/decompress.c"
+#endif
 
 /*
  * Note: Uncompressed chunk size is used in the compressor side
@@ -0,0 +1,161 @@
+/******************************************************************************
+ * vcpustats.c
+ *
+ * Runstate statistics of every vCPU, kept in xenheap pages shared read-only
+ * with privileged domains so that monitoring agents can sample steal time
+ * and CPU usage of the whole host without a hypercall per vCPU.
+ *
+ * A slot is only written with its vCPU's schedule lock held, so there is a
+ * single writer at a time and a sequence count is enough for readers.
+ */
+
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/sched.h>
+#include <xen/spinlock.h>
+#include <xen/bitmap.h>
+#include <xen/xmalloc.h>
+#include <xen/vcpustats.h>
+#include <asm/atomic.h>
+
+/* Number of slots, i.e. of vCPUs which can be tracked.  0 disables. */
+static unsigned int __initdata opt_vcpustats;
+integer_param("vcpustats", opt_vcpustats);
+
+static xen_vcpustats_t *slots;
+static unsigned int nr_slots, nr_frames;
+static unsigned long *slot_used;
+static DEFINE_SPINLOCK(slot_lock);
+
+static void slot_write_begin(xen_vcpustats_t *s)
+{
+    write_atomic(&s->version, s->version + 1);
+    smp_wmb();
+}
+
+static void slot_write_end(xen_vcpustats_t *s)
+{
+    smp_wmb();
+    write_atomic(&s->version, s->version + 1);
+}
+
+void _vcpustats_update(struct vcpu *v, bool_t wakeup)
+{
+    xen_vcpustats_t *s = v->vcpustats;
+
+    slot_write_begin(s);
+    s->state = v->runstate.state;
+    s->state_entry_time = v->runstate.state_entry_time;
+    memcpy(s->time, v->runstate.time, sizeof(s->time));
+    if ( wakeup )
+        s->wakeups++;
+    slot_write_end(s);
+}
+
+void vcpustats_init_vcpu(struct vcpu *v)
+{
+    xen_vcpustats_t *s;
+    unsigned int idx;
+
+    if ( !slots || is_idle_vcpu(v) )
+        return;
+
+    spin_lock(&slot_lock);
+    idx = find_first_zero_bit(slot_used, nr_slots);
+    if ( idx < nr_slots )
+        __set_bit(idx, slot_used);
+    spin_unlock(&slot_lock);
+
+    if ( idx >= nr_slots )
+        return;
+
+    s = &slots[idx];
+    slot_write_begin(s);
+    s->domid = v->domain->domain_id;
+    s->vcpu = v->vcpu_id;
+    s->state = v->runstate.state;
+    s->state_entry_time = v->runstate.state_entry_time;
+    memcpy(s->time, v->runstate.time, sizeof(s->time));
+    s->wakeups = 0;
+    s->flags = XEN_VCPUSTATS_valid;
+    slot_write_end(s);
+
+    v->vcpustats = s;
+}
+
+void vcpustats_destroy_vcpu(struct vcpu *v)
+{
+    xen_vcpustats_t *s = v->vcpustats;
+
+    if ( !s )
+        return;
+
+    v->vcpustats = NULL;
+
+    slot_write_begin(s);
+    s->flags = 0;
+    slot_write_end(s);
+
+    spin_lock(&slot_lock);
+    __clear_bit(s - slots, slot_used);
+    spin_unlock(&slot_lock);
+}
+
+int vcpustats_get_info(xen_sysctl_vcpustats_op_t *op)
+{
+    if ( !slots )
+        return -ENODEV;
+
+    op->nr_slots = nr_slots;
+    op->nr_frames = nr_frames;
+    op->mfn = virt_to_mfn(slots);
+
+    return 0;
+}
+
+static int __init vcpustats_init(void)
+{
+    unsigned int i, order;
+
+    if ( !opt_vcpustats )
+        return 0;
+
+    /* Use all of the allocation, which is a power of 2 pages. */
+    order = get_order_from_bytes(opt_vcpustats * sizeof(*slots));
+    nr_frames = 1u << order;
+    nr_slots = (nr_frames << PAGE_SHIFT) / sizeof(*slots);
+
+    slots = alloc_xenheap_pages(order, 0);
+    slot_used = xzalloc_array(unsigned long, BITS_TO_LONGS(nr_slots));
+    if ( !slots || !slot_used )
+    {
+        printk(XENLOG_ERR "vcpustats: cannot allocate %u slots\n", nr_slots);
+        if ( slots )
+            free_xenheap_pages(slots, order);
+        slots = NULL;
+        xfree(slot_used);
+        return -ENOMEM;
+    }
+
+    memset(slots, 0, nr_frames << PAGE_SHIFT);
+    for ( i = 0; i < nr_frames; i++ )
+        share_xen_page_with_privileged_guests(virt_to_page(slots) + i,
+                                              XENSHARE_readonly);
+
+    printk(XENLOG_INFO "vcpustats: %u slots in %u frames\n",
+           nr_slots, nr_frames);
+
+    return 0;
+}
+__initcall(vcpustats_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
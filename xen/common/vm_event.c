@@ -22,6 +22,7 @@
 
 #include <xen/sched.h>
 #include <xen/event.h>
+#include <xen/guest_access.h>
 #include <xen/wait.h>
 #include <xen/vm_event.h>
 #include <xen/mem_access.h>
@@ -39,43 +40,58 @@
 #define vm_event_ring_lock(_ved)       spin_lock(&(_ved)->ring_lock)
 #define vm_event_ring_unlock(_ved)     spin_unlock(&(_ved)->ring_lock)
 
-static int vm_event_enable(
+/* Number of rings making up a vm_event_domain */
+static unsigned int vm_event_nr_rings(const struct domain *d,
+                                      const struct vm_event_domain *ved)
+{
+    return ved->vcpu_rings ? d->max_vcpus : 1;
+}
+
+static struct vm_event_domain *vm_event_ring_nr(struct vm_event_domain *ved,
+                                                unsigned int i)
+{
+    return i ? &ved->vcpu_rings[i - 1] : ved;
+}
+
+/* The ring the current vCPU produces into */
+static struct vm_event_domain *vm_event_current_ring(
+    struct domain *d, struct vm_event_domain *ved)
+{
+    if ( ved->vcpu_rings && current->domain == d )
+        return vm_event_ring_nr(ved, current->vcpu_id);
+
+    return ved;
+}
+
+static int vm_event_enable_ring(
     struct domain *d,
-    xen_domctl_vm_event_op_t *vec,
     struct vm_event_domain *ved,
+    unsigned long ring_gfn,
+    unsigned int nr_frames,
+    struct vcpu *v,
     int pause_flag,
-    int param,
     xen_event_channel_notification_t notification_fn)
 {
     int rc;
-    unsigned long ring_gfn = d->arch.hvm_domain.params[param];
-
-    /* Only one helper at a time. If the helper crashed,
-     * the ring is in an undefined state and so is the guest.
-     */
-    if ( ved->ring_page )
-        return -EBUSY;
-
-    /* The parameter defaults to zero, and it should be
-     * set to something */
-    if ( ring_gfn == 0 )
-        return -ENOSYS;
 
     vm_event_ring_lock_init(ved);
     vm_event_ring_lock(ved);
 
-    rc = vm_event_init_domain(d);
-
-    if ( rc < 0 )
+    rc = -ENOMEM;
+    ved->ring_pg_struct = xzalloc_array(struct page_info *, nr_frames);
+    if ( !ved->ring_pg_struct )
         goto err;
 
-    rc = prepare_ring_for_helper(d, ring_gfn, &ved->ring_pg_struct,
-                                    &ved->ring_page);
+    rc = prepare_ring_frames_for_helper(d, ring_gfn, nr_frames,
+                                        ved->ring_pg_struct, &ved->ring_page);
     if ( rc < 0 )
         goto err;
 
+    ved->nr_frames = nr_frames;
+
     /* Set the number of currently blocked vCPUs to 0. */
     ved->blocked = 0;
+    ved->vcpu = v;
 
     /* Allocate event channel */
     rc = alloc_unbound_xen_event_channel(d, 0, current->domain->domain_id,
@@ -83,12 +99,12 @@ static int vm_event_enable(
     if ( rc < 0 )
         goto err;
 
-    ved->xen_port = vec->port = rc;
+    ved->xen_port = rc;
 
     /* Prepare ring buffer */
     FRONT_RING_INIT(&ved->front_ring,
                     (vm_event_sring_t *)ved->ring_page,
-                    PAGE_SIZE);
+                    nr_frames * PAGE_SIZE);
 
     /* Save the pause flag for this particular ring. */
     ved->pause_flag = pause_flag;
@@ -100,13 +116,135 @@ static int vm_event_enable(
     return 0;
 
  err:
-    destroy_ring_for_helper(&ved->ring_page,
-                            ved->ring_pg_struct);
+    destroy_ring_frames_for_helper(&ved->ring_page, ved->ring_pg_struct,
+                                   nr_frames);
+    xfree(ved->ring_pg_struct);
+    ved->ring_pg_struct = NULL;
     vm_event_ring_unlock(ved);
 
     return rc;
 }
 
+static void vm_event_disable_ring(struct domain *d,
+                                  struct vm_event_domain *ved)
+{
+    struct vcpu *v;
+
+    vm_event_ring_lock(ved);
+
+    /* Free domU's event channel and leave the other one unbound */
+    free_xen_event_channel(d, ved->xen_port);
+
+    /* Unblock all vCPUs */
+    for_each_vcpu ( d, v )
+    {
+        if ( ved->vcpu && ved->vcpu != v )
+            continue;
+
+        if ( test_and_clear_bit(ved->pause_flag, &v->pause_flags) )
+        {
+            vcpu_unpause(v);
+            ved->blocked--;
+        }
+    }
+
+    destroy_ring_frames_for_helper(&ved->ring_page, ved->ring_pg_struct,
+                                   ved->nr_frames);
+    xfree(ved->ring_pg_struct);
+    ved->ring_pg_struct = NULL;
+
+    vm_event_ring_unlock(ved);
+}
+
+static int vm_event_enable(
+    struct domain *d,
+    xen_domctl_vm_event_op_t *vec,
+    struct vm_event_domain *ved,
+    int pause_flag,
+    int param,
+    xen_event_channel_notification_t notification_fn)
+{
+    int rc;
+    unsigned long ring_gfn = d->arch.hvm_domain.params[param];
+    unsigned int nr_frames = vec->nr_frames ?: 1;
+    unsigned int i, nr_rings = 1;
+
+    /* Only one helper at a time. If the helper crashed,
+     * the ring is in an undefined state and so is the guest.
+     */
+    if ( ved->ring_page )
+        return -EBUSY;
+
+    /* The parameter defaults to zero, and it should be
+     * set to something */
+    if ( ring_gfn == 0 )
+        return -ENOSYS;
+
+    if ( nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES ||
+         (vec->flags & ~XEN_VM_EVENT_FLAG_PER_VCPU) )
+        return -EINVAL;
+
+    if ( vec->flags & XEN_VM_EVENT_FLAG_PER_VCPU )
+    {
+        if ( guest_handle_is_null(vec->ports) )
+            return -EINVAL;
+
+        for ( i = 0; i < d->max_vcpus; i++ )
+            if ( !d->vcpu[i] )
+                return -EINVAL;
+
+        nr_rings = d->max_vcpus;
+    }
+
+    rc = vm_event_init_domain(d);
+    if ( rc < 0 )
+        return rc;
+
+    if ( nr_rings > 1 )
+    {
+        ved->vcpu_rings = xzalloc_array(struct vm_event_domain, nr_rings - 1);
+        if ( !ved->vcpu_rings )
+            return -ENOMEM;
+    }
+
+    for ( i = 0; i < nr_rings; i++ )
+    {
+        struct vm_event_domain *ring = vm_event_ring_nr(ved, i);
+        uint32_t port;
+
+        rc = vm_event_enable_ring(d, ring, ring_gfn + i * nr_frames,
+                                  nr_frames,
+                                  (vec->flags & XEN_VM_EVENT_FLAG_PER_VCPU)
+                                  ? d->vcpu[i] : NULL,
+                                  pause_flag, notification_fn);
+        if ( rc < 0 )
+            goto err;
+
+        if ( !(vec->flags & XEN_VM_EVENT_FLAG_PER_VCPU) )
+            continue;
+
+        port = ring->xen_port;
+        if ( copy_to_guest_offset(vec->ports, i, &port, 1) )
+        {
+            rc = -EFAULT;
+            i++;
+            goto err;
+        }
+    }
+
+    vec->port = ved->xen_port;
+
+    return 0;
+
+ err:
+    while ( i-- )
+        vm_event_disable_ring(d, vm_event_ring_nr(ved, i));
+    xfree(ved->vcpu_rings);
+    ved->vcpu_rings = NULL;
+
+    return rc;
+}
+
 static unsigned int vm_event_ring_available(struct vm_event_domain *ved)
 {
     int avail_req = RING_FREE_REQUESTS(&ved->front_ring);
@@ -133,6 +271,17 @@ static void vm_event_wake_blocked(struct domain *d, struct vm_event_domain *ved)
     if ( avail_req == 0 || ved->blocked == 0 )
         return;
 
+    /* A per-vCPU ring only ever blocks its own vCPU */
+    if ( ved->vcpu )
+    {
+        if ( test_and_clear_bit(ved->pause_flag, &ved->vcpu->pause_flags) )
+        {
+            vcpu_unpause(ved->vcpu);
+            ved->blocked--;
+        }
+        return;
+    }
+
     /*
      * We ensure that we only have vCPUs online if there are enough free slots
      * for their memory events to be processed.  This will ensure that no
@@ -206,35 +355,28 @@ static int vm_event_disable(struct domain *d, struct vm_event_domain *ved)
 {
     if ( ved->ring_page )
     {
-        struct vcpu *v;
+        unsigned int i, nr_rings = vm_event_nr_rings(d, ved);
 
-        vm_event_ring_lock(ved);
-
-        if ( !list_empty(&ved->wq.list) )
+        for ( i = 0; i < nr_rings; i++ )
         {
-            vm_event_ring_unlock(ved);
-            return -EBUSY;
-        }
+            struct vm_event_domain *ring = vm_event_ring_nr(ved, i);
+            bool_t busy;
 
-        /* Free domU's event channel and leave the other one unbound */
-        free_xen_event_channel(d, ved->xen_port);
+            vm_event_ring_lock(ring);
+            busy = !list_empty(&ring->wq.list);
+            vm_event_ring_unlock(ring);
 
-        /* Unblock all vCPUs */
-        for_each_vcpu ( d, v )
-        {
-            if ( test_and_clear_bit(ved->pause_flag, &v->pause_flags) )
-            {
-                vcpu_unpause(v);
-                ved->blocked--;
-            }
+            if ( busy )
+                return -EBUSY;
         }
 
-        destroy_ring_for_helper(&ved->ring_page,
-                                ved->ring_pg_struct);
+        while ( nr_rings-- )
+            vm_event_disable_ring(d, vm_event_ring_nr(ved, nr_rings));
 
-        vm_event_cleanup_domain(d);
+        xfree(ved->vcpu_rings);
+        ved->vcpu_rings = NULL;
 
-        vm_event_ring_unlock(ved);
+        vm_event_cleanup_domain(d);
     }
 
     return 0;
@@ -293,6 +435,8 @@ void vm_event_put_request(struct domain *d,
 
     req->version = VM_EVENT_INTERFACE_VERSION;
 
+    ved = vm_event_current_ring(d, ved);
+
     vm_event_ring_lock(ved);
 
     /* Due to the reservations, this step must succeed. */
@@ -316,7 +460,7 @@ void vm_event_put_request(struct domain *d,
      * See the comments above wake_blocked() for more information
      * on how this mechanism works to avoid waiting. */
     avail_req = vm_event_ring_available(ved);
-    if( current->domain == d && avail_req < d->max_vcpus )
+    if( current->domain == d && avail_req < (ved->vcpu ? 1 : d->max_vcpus) )
         vm_event_mark_and_pause(current, ved);
 
     vm_event_ring_unlock(ved);
@@ -324,6 +468,63 @@ void vm_event_put_request(struct domain *d,
     notify_via_xen_event_channel(d, ved->xen_port);
 }
 
+/*
+ * Post a request the vCPU does not wait for, without ever blocking or
+ * pausing it: no slot is claimed beforehand, and the request is dropped
+ * rather than eat into the room kept for blocking requests.  The consumer
+ * is only notified when it had caught up, or once half the ring is
+ * waiting, so that it drains records in batches.
+ *
+ * Return codes: -ENOSYS: the ring is not yet configured
+ *               -EBUSY: the request was dropped
+ *               0: the request was posted
+ */
+int vm_event_put_record(struct domain *d, struct vm_event_domain *ved,
+                        vm_event_request_t *req)
+{
+    vm_event_front_ring_t *front_ring;
+    RING_IDX req_prod;
+    unsigned int used;
+
+    ASSERT(current->domain == d);
+
+    ved = vm_event_current_ring(d, ved);
+    if ( !ved->ring_page )
+        return -ENOSYS;
+
+    req->version = VM_EVENT_INTERFACE_VERSION;
+
+    vm_event_ring_lock(ved);
+
+    if ( vm_event_ring_available(ved) <= (ved->vcpu ? 1 : d->max_vcpus) )
+    {
+        ved->records_lost = 1;
+        vm_event_ring_unlock(ved);
+        return -EBUSY;
+    }
+
+    if ( ved->records_lost )
+    {
+        req->flags |= VM_EVENT_FLAG_RECORDS_LOST;
+        ved->records_lost = 0;
+    }
+
+    front_ring = &ved->front_ring;
+    req_prod = front_ring->req_prod_pvt;
+    memcpy(RING_GET_REQUEST(front_ring, req_prod), req, sizeof(*req));
+    front_ring->req_prod_pvt = req_prod + 1;
+    RING_PUSH_REQUESTS(front_ring);
+
+    used = RING_SIZE(front_ring) - RING_FREE_REQUESTS(front_ring);
+
+    vm_event_ring_unlock(ved);
+
+    if ( used == 1 || used == RING_SIZE(front_ring) / 2 )
+        notify_via_xen_event_channel(d, ved->xen_port);
+
+    return 0;
+}
+
 int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
                           vm_event_response_t *rsp)
 {
@@ -366,7 +567,8 @@ int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
  * Note: responses are handled the same way regardless of which ring they
  * arrive on.
  */
-void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
+static void vm_event_resume_ring(struct domain *d,
+                                 struct vm_event_domain *ved)
 {
     vm_event_response_t rsp;
 
@@ -440,8 +642,19 @@ void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
     }
 }
 
+/* Pull the responses from every ring making up ved. */
+void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
+{
+    unsigned int i;
+
+    for ( i = 0; i < vm_event_nr_rings(d, ved); i++ )
+        vm_event_resume_ring(d, vm_event_ring_nr(ved, i));
+}
+
 void vm_event_cancel_slot(struct domain *d, struct vm_event_domain *ved)
 {
+    ved = vm_event_current_ring(d, ved);
+
     vm_event_ring_lock(ved);
     vm_event_release_slot(d, ved);
     vm_event_ring_unlock(ved);
@@ -508,6 +721,8 @@ bool_t vm_event_check_ring(struct vm_event_domain *ved)
 int __vm_event_claim_slot(struct domain *d, struct vm_event_domain *ved,
                           bool_t allow_sleep)
 {
+    ved = vm_event_current_ring(d, ved);
+
     if ( (current->domain == d) && allow_sleep )
         return vm_event_wait_slot(ved);
     else
@@ -539,35 +754,37 @@ static void mem_sharing_notification(struct vcpu *v, unsigned int port)
 }
 #endif
 
+static void vm_event_cleanup_rings(struct domain *d,
+                                   struct vm_event_domain *ved)
+{
+    unsigned int i;
+
+    /* Destroying the wait queue head means waking up all
+     * queued vcpus. This will drain the list, allowing
+     * the disable routine to complete. It will also drop
+     * all domain refs the wait-queued vcpus are holding.
+     * Finally, because this code path involves previously
+     * pausing the domain (domain_kill), unpausing the
+     * vcpus causes no harm. */
+    for ( i = 0; i < vm_event_nr_rings(d, ved); i++ )
+        destroy_waitqueue_head(&vm_event_ring_nr(ved, i)->wq);
+    (void)vm_event_disable(d, ved);
+}
+
 /* Clean up on domain destruction */
 void vm_event_cleanup(struct domain *d)
 {
 #ifdef CONFIG_HAS_MEM_PAGING
     if ( d->vm_event->paging.ring_page )
-    {
-        /* Destroying the wait queue head means waking up all
-         * queued vcpus. This will drain the list, allowing
-         * the disable routine to complete. It will also drop
-         * all domain refs the wait-queued vcpus are holding.
-         * Finally, because this code path involves previously
-         * pausing the domain (domain_kill), unpausing the
-         * vcpus causes no harm. */
-        destroy_waitqueue_head(&d->vm_event->paging.wq);
-        (void)vm_event_disable(d, &d->vm_event->paging);
-    }
+        vm_event_cleanup_rings(d, &d->vm_event->paging);
 #endif
     if ( d->vm_event->monitor.ring_page )
-    {
-        destroy_waitqueue_head(&d->vm_event->monitor.wq);
-        (void)vm_event_disable(d, &d->vm_event->monitor);
-    }
+        vm_event_cleanup_rings(d, &d->vm_event->monitor);
 #ifdef CONFIG_HAS_MEM_SHARING
     if ( d->vm_event->share.ring_page )
-    {
-        destroy_waitqueue_head(&d->vm_event->share.wq);
-        (void)vm_event_disable(d, &d->vm_event->share);
-    }
+        vm_event_cleanup_rings(d, &d->vm_event->share);
 #endif
+    mem_access_filter_destroy(d);
 }
 
 int vm_event_domctl(struct domain *d, xen_domctl_vm_event_op_t *vec,
@@ -1,12 +1,16 @@
 #ifdef VMAP_VIRT_START
 #include <xen/bitmap.h>
 #include <xen/cache.h>
+#include <xen/cpu.h>
 #include <xen/init.h>
+#include <xen/irq.h>
 #include <xen/mm.h>
+#include <xen/perfc.h>
 #include <xen/pfn.h>
 #include <xen/spinlock.h>
 #include <xen/types.h>
 #include <xen/vmap.h>
+#include <asm/flushtlb.h>
 #include <asm/page.h>
 
 static DEFINE_SPINLOCK(vm_lock);
@@ -19,6 +23,25 @@ static unsigned int __read_mostly vm_end[VMAP_REGION_NR];
 /* lowest known clear bit in the bitmap */
 static unsigned int vm_low[VMAP_REGION_NR];
 
+/*
+ * Single page VMAP_DEFAULT allocations (map_domain_page_global() and the
+ * like) are cached per CPU, so they normally don't need vm_lock.  Where the
+ * architecture can unmap without flushing TLBs, freed pages are held back as
+ * lazy ones first, and become reusable together with a single flush once
+ * VMAP_CACHE_NR of them have accumulated.  The bitmap keeps both kinds of
+ * cached pages allocated.
+ */
+#define VMAP_CACHE_NR 32
+
+struct vm_cache {
+    unsigned int nr_free;
+    unsigned int nr_lazy;
+    void *free[VMAP_CACHE_NR];
+    void *lazy[VMAP_CACHE_NR];
+};
+
+static DEFINE_PER_CPU(struct vm_cache, vm_cache);
+
 void __init vm_init_type(enum vmap_region type, void *start, void *end)
 {
     unsigned int i, nr;
@@ -45,6 +68,12 @@ void __init vm_init_type(enum vmap_region type, void *start, void *end)
     populate_pt_range(va, 0, vm_low[type] - nr);
 }
 
+/* The caches are used only where all CPUs' TLBs can be flushed. */
+static bool_t vm_cache_usable(void)
+{
+    return !in_irq() && local_irq_is_enabled();
+}
+
 static void *vm_alloc(unsigned int nr, unsigned int align,
                       enum vmap_region t)
 {
@@ -59,6 +88,17 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
     if ( !vm_base[t] )
         return NULL;
 
+    if ( nr == 1 && t == VMAP_DEFAULT && vm_cache_usable() )
+    {
+        struct vm_cache *c = &this_cpu(vm_cache);
+
+        if ( c->nr_free )
+        {
+            perfc_incr(vmap_cache_alloc);
+            return c->free[--c->nr_free];
+        }
+    }
+
     spin_lock(&vm_lock);
     for ( ; ; )
     {
@@ -199,6 +239,58 @@ static void vm_free(const void *va)
     spin_unlock(&vm_lock);
 }
 
+/* Flush the TLBs of a CPU's lazily unmapped pages, making them reusable. */
+static void vm_cache_purge(struct vm_cache *c)
+{
+    unsigned int i;
+
+#ifdef MAP_NO_FLUSH
+    flush_all(FLUSH_TLB_GLOBAL);
+#endif
+    perfc_incr(vmap_lazy_purge);
+
+    for ( i = 0; i < c->nr_lazy; i++ )
+    {
+        if ( c->nr_free < VMAP_CACHE_NR )
+            c->free[c->nr_free++] = c->lazy[i];
+        else
+            vm_free(c->lazy[i]);
+    }
+    c->nr_lazy = 0;
+}
+
+static int cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+    struct vm_cache *c = &per_cpu(vm_cache, cpu);
+
+    switch ( action )
+    {
+    case CPU_DEAD:
+        if ( c->nr_lazy )
+            vm_cache_purge(c);
+        while ( c->nr_free )
+            vm_free(c->free[--c->nr_free]);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback
+};
+
+static int __init vm_cache_init(void)
+{
+    register_cpu_notifier(&cpu_nfb);
+    return 0;
+}
+presmp_initcall(vm_cache_init);
+
 void *__vmap(const mfn_t *mfn, unsigned int granularity,
              unsigned int nr, unsigned int align, unsigned int flags,
              enum vmap_region type)
@@ -227,6 +319,28 @@ void vunmap(const void *va)
 {
     unsigned long addr = (unsigned long)va;
     unsigned int pages = vm_size(va, VMAP_DEFAULT);
+    struct vm_cache *c;
+
+    if ( pages == 1 && vm_cache_usable() )
+    {
+        c = &this_cpu(vm_cache);
+#ifdef MAP_NO_FLUSH
+        map_pages_to_xen(addr, 0, 1, _PAGE_NONE | MAP_NO_FLUSH);
+        c->lazy[c->nr_lazy++] = (void *)va;
+        if ( c->nr_lazy == VMAP_CACHE_NR )
+            vm_cache_purge(c);
+        return;
+#else
+        destroy_xen_mappings(addr, addr + PAGE_SIZE);
+        if ( c->nr_free < VMAP_CACHE_NR )
+        {
+            c->free[c->nr_free++] = (void *)va;
+            return;
+        }
+        vm_free(va);
+        return;
+#endif
+    }
 
     if ( !pages )
         pages = vm_size(va, VMAP_XEN);
@@ -234,7 +348,16 @@ void vunmap(const void *va)
 #ifndef _PAGE_NONE
     destroy_xen_mappings(addr, addr + PAGE_SIZE * pages);
 #else /* Avoid tearing down intermediate page tables. */
-    map_pages_to_xen(addr, 0, pages, _PAGE_NONE);
+# ifdef MAP_NO_FLUSH
+    /* One flush for the whole range, rather than one per page. */
+    if ( pages > 1 && local_irq_is_enabled() )
+    {
+        map_pages_to_xen(addr, 0, pages, _PAGE_NONE | MAP_NO_FLUSH);
+        flush_all(FLUSH_TLB_GLOBAL);
+    }
+    else
+# endif
+        map_pages_to_xen(addr, 0, pages, _PAGE_NONE);
 #endif
     vm_free(va);
 }
@@ -24,9 +24,14 @@
  */
 
 #include <xen/config.h>
+#include <xen/cpu.h>
+#include <xen/guest_access.h>
+#include <xen/init.h>
 #include <xen/irq.h>
+#include <xen/keyhandler.h>
 #include <xen/mm.h>
 #include <xen/pfn.h>
+#include <public/sysctl.h>
 #include <asm/time.h>
 
 #define MAX_POOL_NAME_LEN       16
@@ -453,17 +458,15 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
     return NULL;
 }
 
-void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+static void __xmem_pool_free(void *ptr, struct xmem_pool *pool)
 {
     struct bhdr *b, *tmp_b;
     int fl = 0, sl = 0;
 
-    if ( unlikely(ptr == NULL) )
-        return;
+    ASSERT(spin_is_locked(&pool->lock));
 
     b = (struct bhdr *)((char *) ptr - BHDR_OVERHEAD);
 
-    spin_lock(&pool->lock);
     b->size |= FREE_BLOCK;
     pool->used_size -= (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
     b->ptr.free_ptr = (struct free_ptr) { NULL, NULL};
@@ -492,14 +495,22 @@ void xmem_pool_free(void *ptr, struct xmem_pool *pool)
         pool->put_mem(b);
         pool->num_regions--;
         pool->used_size -= BHDR_OVERHEAD; /* sentinel block header */
-        goto out;
+        return;
     }
 
     INSERT_BLOCK(b, pool, fl, sl);
 
     tmp_b->size |= PREV_FREE;
     tmp_b->prev_hdr = b;
- out:
+}
+
+void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+{
+    if ( unlikely(ptr == NULL) )
+        return;
+
+    spin_lock(&pool->lock);
+    __xmem_pool_free(ptr, pool);
     spin_unlock(&pool->lock);
 }
 
@@ -560,6 +571,397 @@ static void tlsf_init(void)
     BUG_ON(!xenpool);
 }
 
+/*
+ * Per-CPU object caches.
+ *
+ * Small xmalloc()s are rounded up to one of a few size classes, and freed
+ * blocks of these classes are kept in magazines of the freeing CPU, from
+ * which the next allocations of the class are served without touching the
+ * pool lock.  Cached blocks remain allocated as far as TLSF is concerned.
+ *
+ * Typed caches (xmem_cache_create()) put per-CPU magazines of their own in
+ * front of xmalloc(), for subsystems wanting objects of one kind kept apart
+ * and accounted separately.  Their objects are ordinary xmalloc()ations.
+ *
+ * As xmalloc() and xfree() aren't used in IRQ context, magazines need no
+ * locking: other CPUs only touch them once their owner is dead.
+ */
+#define XMEM_MAG_MAX    16
+#define XMEM_MAG_BYTES  4096    /* per magazine, for all but tiny objects */
+
+struct xmem_magazine {
+    unsigned int count, size;   /* size 0: caching disabled */
+    void *objs[XMEM_MAG_MAX];
+    /* Statistics. */
+    unsigned long allocs, hits, frees;
+} __cacheline_aligned;
+
+struct xmem_cache {
+    char name[MAX_POOL_NAME_LEN];
+    unsigned long size, align;
+    struct list_head list;
+    struct xmem_magazine *mags; /* indexed by CPU */
+};
+
+static bool_t __read_mostly opt_xmalloc_cache = 1;
+boolean_param("xmalloc_cache", opt_xmalloc_cache);
+
+#define XMALLOC_CACHE_MAX 2048
+static const unsigned short xmalloc_class_size[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+#define XMALLOC_CLASSES ARRAY_SIZE(xmalloc_class_size)
+#define XMALLOC_NO_CLASS 0xff
+
+/* Smallest class for an allocation, and class of a block, per MEM_ALIGN. */
+static uint8_t __read_mostly
+    xmalloc_alloc_class[XMALLOC_CACHE_MAX / MEM_ALIGN + 1];
+static uint8_t __read_mostly
+    xmalloc_free_class[XMALLOC_CACHE_MAX / MEM_ALIGN + 2];
+
+static DEFINE_PER_CPU(struct xmem_magazine, xmalloc_mags[XMALLOC_CLASSES]);
+
+static LIST_HEAD(xmem_cache_list);
+static DEFINE_SPINLOCK(xmem_cache_list_lock);
+
+static unsigned int xmem_magazine_size(unsigned long obj_size)
+{
+    if ( !opt_xmalloc_cache )
+        return 0;
+    return max(2UL, min((unsigned long)XMEM_MAG_MAX, XMEM_MAG_BYTES / obj_size));
+}
+
+/* Hand the @nr oldest objects of a magazine back to the pool. */
+static void xmalloc_mag_drain(struct xmem_magazine *mag, unsigned int nr)
+{
+    unsigned int i;
+
+    if ( !nr )
+        return;
+
+    spin_lock(&xenpool->lock);
+    for ( i = 0; i < nr; i++ )
+        __xmem_pool_free(mag->objs[i], xenpool);
+    spin_unlock(&xenpool->lock);
+
+    mag->count -= nr;
+    memmove(mag->objs, mag->objs + nr, mag->count * sizeof(*mag->objs));
+}
+
+/* Allocate a block for at least @size bytes. */
+static void *xmalloc_block(unsigned long size)
+{
+    struct xmem_magazine *mag;
+    unsigned int cls;
+    void *p;
+
+    if ( size > XMALLOC_CACHE_MAX )
+        return xmem_pool_alloc(size, xenpool);
+
+    cls = xmalloc_alloc_class[DIV_ROUND_UP(size, MEM_ALIGN)];
+    mag = &this_cpu(xmalloc_mags)[cls];
+    if ( !mag->size )
+        return xmem_pool_alloc(size, xenpool);
+
+    if ( mag->count )
+    {
+        mag->allocs++;
+        mag->hits++;
+        return mag->objs[--mag->count];
+    }
+
+    p = xmem_pool_alloc(xmalloc_class_size[cls], xenpool);
+    if ( p )
+        mag->allocs++;
+
+    return p;
+}
+
+/* Free a block, keeping it in the local magazine of its class if any. */
+static void xfree_block(void *p)
+{
+    const struct bhdr *b = (struct bhdr *)((char *)p - BHDR_OVERHEAD);
+    unsigned long size = b->size & BLOCK_SIZE_MASK;
+    struct xmem_magazine *mag;
+    unsigned int cls;
+
+    if ( size > XMALLOC_CACHE_MAX + MEM_ALIGN ||
+         (cls = xmalloc_free_class[size / MEM_ALIGN]) == XMALLOC_NO_CLASS )
+    {
+        xmem_pool_free(p, xenpool);
+        return;
+    }
+
+    mag = &this_cpu(xmalloc_mags)[cls];
+    if ( !mag->size )
+    {
+        xmem_pool_free(p, xenpool);
+        return;
+    }
+
+    mag->frees++;
+    if ( mag->count == mag->size )
+        xmalloc_mag_drain(mag, mag->size / 2);
+    mag->objs[mag->count++] = p;
+}
+
+/* Hand all objects of a typed cache's magazine back to xmalloc. */
+static void xmem_cache_mag_drain(struct xmem_magazine *mag)
+{
+    while ( mag->count )
+        xfree(mag->objs[--mag->count]);
+}
+
+struct xmem_cache *xmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align)
+{
+    struct xmem_cache *c = xzalloc(struct xmem_cache);
+    unsigned int cpu;
+
+    if ( !c )
+        return NULL;
+
+    c->mags = xzalloc_array(struct xmem_magazine, nr_cpu_ids);
+    if ( !c->mags )
+    {
+        xfree(c);
+        return NULL;
+    }
+
+    strlcpy(c->name, name, sizeof(c->name));
+    c->size = size;
+    c->align = align;
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        c->mags[cpu].size = xmem_magazine_size(size);
+
+    spin_lock(&xmem_cache_list_lock);
+    list_add_tail(&c->list, &xmem_cache_list);
+    spin_unlock(&xmem_cache_list_lock);
+
+    return c;
+}
+
+void xmem_cache_destroy(struct xmem_cache *c)
+{
+    unsigned int cpu;
+
+    if ( c == NULL )
+        return;
+
+    spin_lock(&xmem_cache_list_lock);
+    list_del(&c->list);
+    spin_unlock(&xmem_cache_list_lock);
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        xmem_cache_mag_drain(&c->mags[cpu]);
+
+    xfree(c->mags);
+    xfree(c);
+}
+
+void *xmem_cache_alloc(struct xmem_cache *c)
+{
+    struct xmem_magazine *mag = &c->mags[smp_processor_id()];
+    void *p;
+
+    ASSERT(!in_irq());
+
+    if ( mag->count )
+    {
+        mag->allocs++;
+        mag->hits++;
+        return mag->objs[--mag->count];
+    }
+
+    p = _xmalloc(c->size, c->align);
+    if ( p )
+        mag->allocs++;
+
+    return p;
+}
+
+void xmem_cache_free(struct xmem_cache *c, void *p)
+{
+    struct xmem_magazine *mag = &c->mags[smp_processor_id()];
+
+    if ( p == NULL )
+        return;
+
+    ASSERT(!in_irq());
+
+    mag->frees++;
+    if ( !mag->size )
+    {
+        xfree(p);
+        return;
+    }
+
+    if ( mag->count == mag->size )
+        while ( mag->count > mag->size / 2 )
+            xfree(mag->objs[--mag->count]);
+    mag->objs[mag->count++] = p;
+}
+
+static void xmem_mag_sum(const struct xmem_magazine *mag,
+                         xen_sysctl_xmem_cache_t *info)
+{
+    info->cached += mag->count;
+    info->allocs += mag->allocs;
+    info->hits += mag->hits;
+    info->frees += mag->frees;
+}
+
+/* Size class @i's or, past those, typed cache @i's statistics. */
+static bool_t xmem_cache_fill(unsigned int i, xen_sysctl_xmem_cache_t *info)
+{
+    const struct xmem_cache *c;
+    unsigned int cpu;
+
+    memset(info, 0, sizeof(*info));
+
+    if ( i < XMALLOC_CLASSES )
+    {
+        snprintf(info->name, sizeof(info->name), "xmalloc-%u",
+                 xmalloc_class_size[i]);
+        info->obj_size = xmalloc_class_size[i];
+        for_each_online_cpu ( cpu )
+            xmem_mag_sum(&per_cpu(xmalloc_mags, cpu)[i], info);
+        return 1;
+    }
+
+    i -= XMALLOC_CLASSES;
+    list_for_each_entry ( c, &xmem_cache_list, list )
+    {
+        if ( i-- )
+            continue;
+        strlcpy(info->name, c->name, sizeof(info->name));
+        info->obj_size = c->size;
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+            xmem_mag_sum(&c->mags[cpu], info);
+        return 1;
+    }
+
+    return 0;
+}
+
+int xmem_cache_getinfo(struct xen_sysctl_xmem_cacheinfo *op)
+{
+    xen_sysctl_xmem_cache_t info;
+    unsigned int i;
+    int rc = 0;
+
+    spin_lock(&xmem_cache_list_lock);
+
+    for ( i = 0; xmem_cache_fill(i, &info); i++ )
+        if ( i < op->max_caches &&
+             copy_to_guest_offset(op->buffer, i, &info, 1) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+    spin_unlock(&xmem_cache_list_lock);
+
+    op->num_caches = i;
+    op->pool_used = xenpool ? xmem_pool_get_used_size(xenpool) : 0;
+    op->pool_total = xenpool ? xmem_pool_get_total_size(xenpool) : 0;
+
+    return rc;
+}
+
+static void dump_xmem_caches(unsigned char key)
+{
+    xen_sysctl_xmem_cache_t info;
+    unsigned int i;
+
+    printk("'%c' pressed -> dumping xmalloc caches\n", key);
+    if ( xenpool )
+        printk("xmalloc pool: %lu bytes used of %lu\n",
+               xmem_pool_get_used_size(xenpool),
+               xmem_pool_get_total_size(xenpool));
+
+    spin_lock(&xmem_cache_list_lock);
+    for ( i = 0; xmem_cache_fill(i, &info); i++ )
+        if ( info.allocs || info.frees )
+            printk("  %-16s %5u bytes: %"PRIu64" cached, %"PRIu64" allocs"
+                   " (%"PRIu64" hits), %"PRIu64" frees\n",
+                   info.name, info.obj_size, info.cached, info.allocs,
+                   info.hits, info.frees);
+    spin_unlock(&xmem_cache_list_lock);
+}
+
+static int cpu_xmem_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu, i;
+    struct xmem_magazine *mags = per_cpu(xmalloc_mags, cpu);
+    struct xmem_cache *c;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        {
+            mags[i].count = 0;
+            mags[i].size = xmem_magazine_size(xmalloc_class_size[i]);
+        }
+        break;
+    case CPU_DEAD:
+        for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        {
+            xmalloc_mag_drain(&mags[i], mags[i].count);
+            mags[i].size = 0;
+        }
+        spin_lock(&xmem_cache_list_lock);
+        list_for_each_entry ( c, &xmem_cache_list, list )
+            xmem_cache_mag_drain(&c->mags[cpu]);
+        spin_unlock(&xmem_cache_list_lock);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_xmem_nfb = {
+    .notifier_call = cpu_xmem_callback
+};
+
+static int __init xmem_cache_init(void)
+{
+    void *cpu = (void *)(long)smp_processor_id();
+    unsigned int i, cls = 0;
+
+    if ( !xenpool )
+        tlsf_init();
+
+    for ( i = 0; i < ARRAY_SIZE(xmalloc_alloc_class); i++ )
+    {
+        while ( xmalloc_class_size[cls] < i * MEM_ALIGN )
+            cls++;
+        xmalloc_alloc_class[i] = cls;
+    }
+
+    /*
+     * TLSF may leave blocks one MEM_ALIGN larger than asked for; such go to
+     * their own class unless another one matches exactly.
+     */
+    memset(xmalloc_free_class, XMALLOC_NO_CLASS, sizeof(xmalloc_free_class));
+    for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        xmalloc_free_class[xmalloc_class_size[i] / MEM_ALIGN + 1] = i;
+    for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        xmalloc_free_class[xmalloc_class_size[i] / MEM_ALIGN] = i;
+
+    cpu_xmem_callback(&cpu_xmem_nfb, CPU_UP_PREPARE, cpu);
+    register_cpu_notifier(&cpu_xmem_nfb);
+
+    register_keyhandler('X', dump_xmem_caches, "dump xmalloc caches", 1);
+
+    return 0;
+}
+presmp_initcall(xmem_cache_init);
+
 /*
  * xmalloc()
  */
@@ -588,7 +990,7 @@ void *_xmalloc(unsigned long size, unsigned long align)
         tlsf_init();
 
     if ( size < PAGE_SIZE )
-        p = xmem_pool_alloc(size, xenpool);
+        p = xmalloc_block(size);
     if ( p == NULL )
         return xmalloc_whole_pages(size - align + MEM_ALIGN, align);
 
@@ -649,5 +1051,5 @@ void xfree(void *p)
         ASSERT(!(b->size & 1));
     }
 
-    xmem_pool_free(p, xenpool);
+    xfree_block(p);
 }
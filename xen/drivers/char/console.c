@@ -631,19 +631,22 @@ static void vprintk_common(const char *prefix, const char *fmt, va_list args)
         bool_t continued, do_print;
     }            *state;
     static DEFINE_PER_CPU(struct vps, state);
-    static char   buf[1024];
+    static DEFINE_PER_CPU(char[1024], printk_buf);
     char         *p, *q;
     unsigned long flags;
 
-    /* console_lock can be acquired recursively from __printk_ratelimit(). */
+    /*
+     * Format into a per-CPU buffer ahead of taking console_lock, so that
+     * CPUs printing at the same time only serialise on the actual output.
+     */
     local_irq_save(flags);
+    p = this_cpu(printk_buf);
+    (void)vsnprintf(p, sizeof(this_cpu(printk_buf)), fmt, args);
+
+    /* console_lock can be acquired recursively from __printk_ratelimit(). */
     spin_lock_recursive(&console_lock);
     state = &this_cpu(state);
 
-    (void)vsnprintf(buf, sizeof(buf), fmt, args);
-
-    p = buf;
-
     while ( (q = strchr(p, '\n')) != NULL )
     {
         *q = '\0';
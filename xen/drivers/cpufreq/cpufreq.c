@@ -579,7 +579,8 @@ void __init cpufreq_cmdline_parse(char *str)
         &cpufreq_gov_userspace,
         &cpufreq_gov_dbs,
         &cpufreq_gov_performance,
-        &cpufreq_gov_powersave
+        &cpufreq_gov_powersave,
+        &cpufreq_gov_sched
     };
     unsigned int gov_index = 0;
 
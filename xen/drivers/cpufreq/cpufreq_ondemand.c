@@ -191,6 +191,7 @@ static void dbs_timer_init(struct cpu_dbs_info_s *dbs_info)
 
     init_timer(&per_cpu(dbs_timer, dbs_info->cpu), do_dbs_timer,
         (void *)dbs_info, dbs_info->cpu);
+    set_timer_slack(&per_cpu(dbs_timer, dbs_info->cpu), TIMER_SLACK_relaxed);
 
     set_timer(&per_cpu(dbs_timer, dbs_info->cpu), NOW()+dbs_tuners_ins.sampling_rate);
 
@@ -0,0 +1,251 @@
+/*
+ *  xen/drivers/cpufreq/cpufreq_sched.c
+ *
+ *  Scheduler driven cpufreq governor.
+ *
+ *  Rather than sampling idle time, this governor is fed utilisation by the
+ *  scheduler (see cpufreq_sched_update()), which reports its runqueue load
+ *  averages as they change.  Frequency is raised straight away when vCPUs
+ *  queue up behind busy pCPUs, and lowered, at most once every down_rate,
+ *  as the runqueues drain.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <xen/types.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/percpu.h>
+#include <xen/cpumask.h>
+#include <xen/sched.h>
+#include <xen/sched-if.h>
+#include <xen/timer.h>
+#include <acpi/cpufreq/cpufreq.h>
+
+#define DEF_DOWN_RATE       MILLISECS(10)
+#define MIN_DOWN_RATE       MILLISECS(1)
+#define MAX_DOWN_RATE       MILLISECS(1000)
+
+/* Spare capacity, in 1/4ths, kept on top of the reported utilisation. */
+#define DEF_HEADROOM        1
+
+static s_time_t __read_mostly down_rate = DEF_DOWN_RATE;
+static unsigned int __read_mostly headroom = DEF_HEADROOM;
+
+/* Number of policies run by this governor. */
+unsigned int cpufreq_sched_users;
+
+struct sched_gov_info {
+    unsigned int util;      /* in 1/CPUFREQ_SCHED_UTIL_SCALE of a pCPU */
+    bool_t boost;           /* vCPUs are waiting for a pCPU */
+    bool_t enable;
+    unsigned int owner;     /* policy->cpu */
+};
+
+static DEFINE_PER_CPU(struct sched_gov_info, sched_gov_info);
+
+/* Only used on policy->cpu. */
+static DEFINE_PER_CPU(struct timer, sched_gov_timer);
+static DEFINE_PER_CPU(s_time_t, sched_gov_pending);
+static DEFINE_PER_CPU(s_time_t, sched_gov_last);
+
+static void sched_gov_kick(unsigned int owner, bool_t boost)
+{
+    s_time_t expires, pending = per_cpu(sched_gov_pending, owner);
+
+    expires = boost ? NOW() : per_cpu(sched_gov_last, owner) + down_rate;
+    if ( pending && pending <= expires )
+        return;
+
+    per_cpu(sched_gov_pending, owner) = expires;
+    set_timer(&per_cpu(sched_gov_timer, owner), expires);
+}
+
+/*
+ * Called by the scheduler, possibly with its locks held and interrupts
+ * disabled, when the utilisation of @cpus changes.  Frequency changes are
+ * left to the timer on each policy's CPU.
+ */
+void cpufreq_sched_update(const cpumask_t *cpus, unsigned int util,
+                          bool_t boost)
+{
+    unsigned int cpu, last = nr_cpu_ids;
+
+    for_each_cpu ( cpu, cpus )
+    {
+        struct sched_gov_info *info = &per_cpu(sched_gov_info, cpu);
+
+        if ( !info->enable )
+            continue;
+
+        info->util = util;
+        info->boost = boost;
+
+        /* CPUs sharing a policy are usually adjacent. */
+        if ( info->owner != last )
+        {
+            last = info->owner;
+            sched_gov_kick(last, boost);
+        }
+    }
+}
+
+static void sched_gov_timer_fn(void *data)
+{
+    struct cpufreq_policy *policy = data;
+    unsigned int cpu, util = 0, freq;
+    bool_t boost = 0;
+    s_time_t now = NOW();
+
+    this_cpu(sched_gov_pending) = 0;
+
+    for_each_cpu ( cpu, policy->cpus )
+    {
+        const struct sched_gov_info *info = &per_cpu(sched_gov_info, cpu);
+
+        if ( info->util > util )
+            util = info->util;
+        boost |= info->boost;
+    }
+
+    if ( boost || unlikely(policy->resume) )
+        freq = policy->max;
+    else
+    {
+        util += util * headroom / 4;
+        if ( util > CPUFREQ_SCHED_UTIL_SCALE )
+            util = CPUFREQ_SCHED_UTIL_SCALE;
+        freq = (uint64_t)policy->max * util / CPUFREQ_SCHED_UTIL_SCALE;
+        if ( freq < policy->min )
+            freq = policy->min;
+    }
+
+    if ( freq == policy->cur )
+        return;
+
+    if ( freq < policy->cur &&
+         now < this_cpu(sched_gov_last) + down_rate )
+    {
+        sched_gov_kick(policy->cpu, 0);
+        return;
+    }
+
+    __cpufreq_driver_target(policy, freq, freq == policy->max ?
+                            CPUFREQ_RELATION_H : CPUFREQ_RELATION_L);
+    this_cpu(sched_gov_last) = now;
+}
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+                                  unsigned int event)
+{
+    unsigned int cpu = policy->cpu, j;
+
+    switch ( event )
+    {
+    case CPUFREQ_GOV_START:
+        if ( !cpu_online(cpu) || !policy->cur )
+            return -EINVAL;
+
+        if ( per_cpu(sched_gov_info, cpu).enable )
+            break;
+
+        init_timer(&per_cpu(sched_gov_timer, cpu), sched_gov_timer_fn,
+                   policy, cpu);
+        per_cpu(sched_gov_pending, cpu) = 0;
+        per_cpu(sched_gov_last, cpu) = NOW();
+
+        for_each_cpu ( j, policy->cpus )
+        {
+            struct sched_gov_info *info = &per_cpu(sched_gov_info, j);
+
+            info->util = CPUFREQ_SCHED_UTIL_SCALE;
+            info->boost = 0;
+            info->owner = cpu;
+            smp_wmb();
+            info->enable = 1;
+        }
+        cpufreq_sched_users++;
+        break;
+
+    case CPUFREQ_GOV_STOP:
+        if ( !per_cpu(sched_gov_info, cpu).enable )
+            break;
+
+        for_each_cpu ( j, policy->cpus )
+            per_cpu(sched_gov_info, j).enable = 0;
+        cpufreq_sched_users--;
+        kill_timer(&per_cpu(sched_gov_timer, cpu));
+        break;
+
+    case CPUFREQ_GOV_LIMITS:
+        if ( !per_cpu(sched_gov_info, cpu).enable )
+        {
+            printk(KERN_WARNING "CPU%u sched governor not started yet,"
+                   " unable to GOV_LIMIT\n", cpu);
+            return -EINVAL;
+        }
+        if ( policy->max < policy->cur )
+            __cpufreq_driver_target(policy, policy->max, CPUFREQ_RELATION_H);
+        else if ( policy->min > policy->cur )
+            __cpufreq_driver_target(policy, policy->min, CPUFREQ_RELATION_L);
+        break;
+    }
+
+    return 0;
+}
+
+static bool_t __init cpufreq_sched_handle_option(const char *name,
+                                                 const char *val)
+{
+    if ( !strcmp(name, "down_rate") && val )
+    {
+        s_time_t tmp = simple_strtoull(val, NULL, 0) * MICROSECS(1);
+
+        if ( tmp < MIN_DOWN_RATE || tmp > MAX_DOWN_RATE )
+        {
+            printk(XENLOG_WARNING "cpufreq/sched: "
+                   "down_rate out of range, using %"PRI_stime"us\n",
+                   DEF_DOWN_RATE / MICROSECS(1));
+            tmp = DEF_DOWN_RATE;
+        }
+        down_rate = tmp;
+    }
+    else if ( !strcmp(name, "headroom") && val )
+    {
+        unsigned long tmp = simple_strtoul(val, NULL, 0);
+
+        if ( tmp > 4 )
+        {
+            printk(XENLOG_WARNING "cpufreq/sched: "
+                   "specified headroom too high, using 4\n");
+            tmp = 4;
+        }
+        headroom = tmp;
+    }
+    else
+        return 0;
+    return 1;
+}
+
+struct cpufreq_governor cpufreq_gov_sched = {
+    .name = "sched",
+    .governor = cpufreq_governor_sched,
+    .handle_option = cpufreq_sched_handle_option
+};
+
+static int __init cpufreq_gov_sched_init(void)
+{
+    return cpufreq_register_governor(&cpufreq_gov_sched);
+}
+__initcall(cpufreq_gov_sched_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
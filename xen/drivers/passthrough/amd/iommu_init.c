@@ -26,6 +26,7 @@
 #include <asm/amd-iommu.h>
 #include <asm/msi.h>
 #include <asm/hvm/svm/amd-iommu-proto.h>
+#include <asm/hvm/svm/avic.h>
 #include <asm-x86/fixmap.h>
 #include <mach_apic.h>
 #include <xen/delay.h>
@@ -203,6 +204,23 @@ static void register_iommu_ppr_log_in_mmio_space(struct amd_iommu *iommu)
     writel(entry, iommu->mmio_base + IOMMU_PPR_LOG_BASE_HIGH_OFFSET);
 }
 
+static void register_iommu_ga_log_in_mmio_space(struct amd_iommu *iommu)
+{
+    u64 entry;
+    u32 power_of2_entries;
+
+    ASSERT( iommu->ga_log.buffer && iommu->ga_log_tail );
+
+    power_of2_entries = get_order_from_bytes(iommu->ga_log.alloc_size) +
+                        IOMMU_GA_LOG_POWER_OF2_ENTRIES_PER_PAGE;
+
+    entry = (virt_to_maddr(iommu->ga_log.buffer) & IOMMU_GA_LOG_BASE_MASK) |
+            ((u64)power_of2_entries << IOMMU_GA_LOG_LENGTH_SHIFT);
+    writeq(entry, iommu->mmio_base + IOMMU_GA_LOG_BASE_OFFSET);
+
+    entry = virt_to_maddr(iommu->ga_log_tail) & IOMMU_GA_LOG_TAIL_ADDR_MASK;
+    writeq(entry, iommu->mmio_base + IOMMU_GA_LOG_TAIL_ADDR_OFFSET);
+}
 
 static void set_iommu_translation_control(struct amd_iommu *iommu,
                                                  int enable)
@@ -235,6 +253,30 @@ static void set_iommu_guest_translation_control(struct amd_iommu *iommu,
         AMD_IOMMU_DEBUG("Guest Translation Enabled.\n");
 }
 
+/* 128-bit IRTEs, with guest virtual APIC (posting) mode available. */
+static void set_iommu_guest_apic_control(struct amd_iommu *iommu, int enable)
+{
+    u32 entry;
+
+    entry = readl(iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
+
+    if ( enable )
+    {
+        iommu_set_bit(&entry, IOMMU_CONTROL_GA_ENABLE_SHIFT);
+        iommu_set_bit(&entry, IOMMU_CONTROL_GAM_ENABLE_SHIFT);
+    }
+    else
+    {
+        iommu_clear_bit(&entry, IOMMU_CONTROL_GA_ENABLE_SHIFT);
+        iommu_clear_bit(&entry, IOMMU_CONTROL_GAM_ENABLE_SHIFT);
+    }
+
+    writel(entry, iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
+
+    if ( enable )
+        AMD_IOMMU_DEBUG("Guest Virtual APIC Enabled.\n");
+}
+
 static void set_iommu_command_buffer_control(struct amd_iommu *iommu,
                                                     int enable)
 {
@@ -350,6 +392,30 @@ static void set_iommu_ppr_log_control(struct amd_iommu *iommu,
         AMD_IOMMU_DEBUG("PPR Log Enabled.\n");
 }
 
+static void set_iommu_ga_log_control(struct amd_iommu *iommu, int enable)
+{
+    u32 entry;
+
+    entry = readl(iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
+
+    /*reset head and tail pointer manually before enablement */
+    if ( enable )
+    {
+        writeq(0, iommu->mmio_base + IOMMU_GA_LOG_HEAD_OFFSET);
+        writeq(0, iommu->mmio_base + IOMMU_GA_LOG_TAIL_OFFSET);
+
+        iommu_set_bit(&entry, IOMMU_CONTROL_GA_LOG_INT_SHIFT);
+        iommu_set_bit(&entry, IOMMU_CONTROL_GA_LOG_ENABLE_SHIFT);
+    }
+    else
+    {
+        iommu_clear_bit(&entry, IOMMU_CONTROL_GA_LOG_INT_SHIFT);
+        iommu_clear_bit(&entry, IOMMU_CONTROL_GA_LOG_ENABLE_SHIFT);
+    }
+
+    writel(entry, iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
+}
+
 /* read event log or ppr log from iommu ring buffer */
 static int iommu_read_log(struct amd_iommu *iommu,
                           struct ring_buffer *log,
@@ -404,11 +470,15 @@ static void iommu_reset_log(struct amd_iommu *iommu,
     int log_run, run_bit;
     int loop_count = 1000;
 
-    BUG_ON(!iommu || ((log != &iommu->event_log) && (log != &iommu->ppr_log)));
+    BUG_ON(!iommu || ((log != &iommu->event_log) && (log != &iommu->ppr_log) &&
+                      (log != &iommu->ga_log)));
 
-    run_bit = ( log == &iommu->event_log ) ?
-        IOMMU_STATUS_EVENT_LOG_RUN_SHIFT :
-        IOMMU_STATUS_PPR_LOG_RUN_SHIFT;
+    if ( log == &iommu->event_log )
+        run_bit = IOMMU_STATUS_EVENT_LOG_RUN_SHIFT;
+    else if ( log == &iommu->ppr_log )
+        run_bit = IOMMU_STATUS_PPR_LOG_RUN_SHIFT;
+    else
+        run_bit = IOMMU_STATUS_GAPIC_LOG_RUN_SHIFT;
 
     /* wait until EventLogRun bit = 0 */
     do {
@@ -427,8 +497,9 @@ static void iommu_reset_log(struct amd_iommu *iommu,
     ctrl_func(iommu, IOMMU_CONTROL_DISABLED);
 
     /* RW1C overflow bit */
-    writel(log == &iommu->event_log ? IOMMU_STATUS_EVENT_OVERFLOW_MASK
-                                    : IOMMU_STATUS_PPR_LOG_OVERFLOW_MASK,
+    writel(log == &iommu->event_log ? IOMMU_STATUS_EVENT_OVERFLOW_MASK :
+           log == &iommu->ppr_log ? IOMMU_STATUS_PPR_LOG_OVERFLOW_MASK
+                                  : IOMMU_STATUS_GAPIC_LOG_OVERFLOW_MASK,
            iommu->mmio_base + IOMMU_STATUS_MMIO_OFFSET);
 
     /*reset event log base address */
@@ -728,6 +799,76 @@ static void iommu_check_ppr_log(struct amd_iommu *iommu)
     spin_unlock_irqrestore(&iommu->lock, flags);
 }
 
+static void parse_ga_log_entry(struct amd_iommu *iommu, u64 entry)
+{
+    unsigned int code = (entry >> IOMMU_GA_LOG_CODE_SHIFT) &
+                        IOMMU_GA_LOG_CODE_MASK;
+
+    if ( code == IOMMU_GA_LOG_CODE_GUEST_NR )
+        svm_avic_ga_log(entry & IOMMU_GA_LOG_TAG_MASK);
+    else
+        AMD_IOMMU_DEBUG("unknown GA log entry %016"PRIx64"\n", entry);
+}
+
+/*
+ * The GA log reports interrupts posted to vCPUs which weren't running:
+ * the vCPUs need waking up.
+ */
+static void iommu_check_ga_log(struct amd_iommu *iommu)
+{
+    struct ring_buffer *log = &iommu->ga_log;
+    u64 *raw;
+    u32 entry, tail;
+    unsigned long flags;
+
+    /* RW1C interrupt status bit */
+    writel(IOMMU_STATUS_GAPIC_LOG_INT_MASK,
+           iommu->mmio_base + IOMMU_STATUS_MMIO_OFFSET);
+
+    spin_lock(&log->lock);
+
+    tail = readl(iommu->mmio_base + IOMMU_GA_LOG_TAIL_OFFSET);
+    tail = (tail & IOMMU_GA_LOG_PTR_MASK) / IOMMU_GA_LOG_ENTRY_SIZE;
+
+    while ( tail != log->head )
+    {
+        raw = log->buffer + log->head * IOMMU_GA_LOG_ENTRY_SIZE;
+        parse_ga_log_entry(iommu, read_atomic(raw));
+        *raw = 0;
+
+        if ( ++log->head == log->entries )
+            log->head = 0;
+
+        writel(log->head * IOMMU_GA_LOG_ENTRY_SIZE,
+               iommu->mmio_base + IOMMU_GA_LOG_HEAD_OFFSET);
+    }
+
+    spin_unlock(&log->lock);
+
+    spin_lock_irqsave(&iommu->lock, flags);
+
+    /* Check GA log overflow. */
+    entry = readl(iommu->mmio_base + IOMMU_STATUS_MMIO_OFFSET);
+    if ( iommu_get_bit(entry, IOMMU_STATUS_GAPIC_LOG_OVERFLOW_SHIFT) )
+        iommu_reset_log(iommu, &iommu->ga_log, set_iommu_ga_log_control);
+    else
+    {
+        entry = readl(iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
+        if ( !(entry & IOMMU_CONTROL_GA_LOG_INT_MASK) )
+        {
+            entry |= IOMMU_CONTROL_GA_LOG_INT_MASK;
+            writel(entry, iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
+            /*
+             * Re-schedule the tasklet to handle eventual log entries added
+             * between reading the log above and re-enabling the interrupt.
+             */
+            tasklet_schedule(&amd_iommu_irq_tasklet);
+        }
+    }
+
+    spin_unlock_irqrestore(&iommu->lock, flags);
+}
+
 static void do_amd_iommu_irq(unsigned long data)
 {
     struct amd_iommu *iommu;
@@ -748,6 +889,9 @@ static void do_amd_iommu_irq(unsigned long data)
 
         if ( iommu->ppr_log.buffer != NULL )
             iommu_check_ppr_log(iommu);
+
+        if ( iommu->ga_log.buffer != NULL )
+            iommu_check_ga_log(iommu);
     }
 }
 
@@ -761,12 +905,13 @@ static void iommu_interrupt_handler(int irq, void *dev_id,
     spin_lock_irqsave(&iommu->lock, flags);
 
     /*
-     * Silence interrupts from both event and PPR by clearing the
+     * Silence interrupts from the event, PPR and GA logs by clearing the
      * enable logging bits in the control register
      */
     entry = readl(iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
     iommu_clear_bit(&entry, IOMMU_CONTROL_EVENT_LOG_INT_SHIFT);
     iommu_clear_bit(&entry, IOMMU_CONTROL_PPR_LOG_INT_SHIFT);
+    iommu_clear_bit(&entry, IOMMU_CONTROL_GA_LOG_INT_SHIFT);
     writel(entry, iommu->mmio_base + IOMMU_CONTROL_MMIO_OFFSET);
 
     spin_unlock_irqrestore(&iommu->lock, flags);
@@ -886,6 +1031,9 @@ static void enable_iommu(struct amd_iommu *iommu)
     if ( amd_iommu_has_feature(iommu, IOMMU_EXT_FEATURE_PPRSUP_SHIFT) )
         register_iommu_ppr_log_in_mmio_space(iommu);
 
+    if ( amd_iommu_irte_ga )
+        register_iommu_ga_log_in_mmio_space(iommu);
+
     desc = irq_to_desc(iommu->msi.irq);
     spin_lock(&desc->lock);
     set_msi_affinity(desc, &cpu_online_map);
@@ -903,6 +1051,12 @@ static void enable_iommu(struct amd_iommu *iommu)
     if ( amd_iommu_has_feature(iommu, IOMMU_EXT_FEATURE_GTSUP_SHIFT) )
         set_iommu_guest_translation_control(iommu, IOMMU_CONTROL_ENABLED);
 
+    if ( amd_iommu_irte_ga )
+    {
+        set_iommu_guest_apic_control(iommu, IOMMU_CONTROL_ENABLED);
+        set_iommu_ga_log_control(iommu, IOMMU_CONTROL_ENABLED);
+    }
+
     set_iommu_translation_control(iommu, IOMMU_CONTROL_ENABLED);
 
     if ( amd_iommu_has_feature(iommu, IOMMU_EXT_FEATURE_IASUP_SHIFT) )
@@ -992,16 +1146,20 @@ static void * __init allocate_ppr_log(struct amd_iommu *iommu)
                                 IOMMU_PPR_LOG_DEFAULT_ENTRIES, "PPR Log");
 }
 
-static int __init amd_iommu_init_one(struct amd_iommu *iommu)
+static void * __init allocate_ga_log(struct amd_iommu *iommu)
 {
-    if ( map_iommu_mmio_region(iommu) != 0 )
-        goto error_out;
-
-    get_iommu_features(iommu);
+    /* allocate 'ga log' in power of 2 increments of 4K */
+    if ( allocate_ring_buffer(&iommu->ga_log, IOMMU_GA_LOG_ENTRY_SIZE,
+                              IOMMU_GA_LOG_DEFAULT_ENTRIES,
+                              "GA Log") == NULL )
+        return NULL;
 
-    if ( iommu->features )
-        iommuv2_enabled = 1;
+    iommu->ga_log_tail = allocate_buffer(PAGE_SIZE, "GA Log Tail");
+    return iommu->ga_log_tail;
+}
 
+static int __init amd_iommu_init_one(struct amd_iommu *iommu)
+{
     if ( allocate_cmd_buffer(iommu) == NULL )
         goto error_out;
 
@@ -1012,6 +1170,9 @@ static int __init amd_iommu_init_one(struct amd_iommu *iommu)
         if ( allocate_ppr_log(iommu) == NULL )
             goto error_out;
 
+    if ( amd_iommu_irte_ga && allocate_ga_log(iommu) == NULL )
+        goto error_out;
+
     if ( !set_iommu_interrupt_handler(iommu) )
         goto error_out;
 
@@ -1048,13 +1209,17 @@ static void __init amd_iommu_init_cleanup(void)
             deallocate_ring_buffer(&iommu->cmd_buffer);
             deallocate_ring_buffer(&iommu->event_log);
             deallocate_ring_buffer(&iommu->ppr_log);
-            unmap_iommu_mmio_region(iommu);
+            deallocate_ring_buffer(&iommu->ga_log);
+            deallocate_buffer(iommu->ga_log_tail, PAGE_SIZE);
         }
+        unmap_iommu_mmio_region(iommu);
         xfree(iommu);
     }
 
     /* free interrupt remapping table */
     iterate_ivrs_entries(amd_iommu_free_intremap_table);
+    amd_iommu_irte_ga = 0;
+    iommu_intpost = 0;
 
     /* free device table */
     deallocate_device_table(&device_table);
@@ -1223,6 +1388,22 @@ static bool_t __init amd_sp5100_erratum28(void)
     return 0;
 }
 
+/* Posting interrupts needs guest virtual APIC mode on every IOMMU. */
+static bool_t __init amd_iommu_ga_supported(void)
+{
+    struct amd_iommu *iommu;
+
+    if ( !iommu_intremap || !iommu_intpost || !cpu_has_cx16 )
+        return 0;
+
+    for_each_amd_iommu ( iommu )
+        if ( !amd_iommu_has_feature(iommu, IOMMU_EXT_FEATURE_GASUP_SHIFT) ||
+             !amd_iommu_has_feature(iommu, IOMMU_EXT_FEATURE_GAMSUP_SHIFT) )
+            return 0;
+
+    return 1;
+}
+
 int __init amd_iommu_init(void)
 {
     struct amd_iommu *iommu;
@@ -1250,6 +1431,26 @@ int __init amd_iommu_init(void)
         goto error_out;
     ivrs_bdf_entries = rc;
 
+    /*
+     * The IRTE format, and with it the size of the interrupt remapping
+     * tables set up below, depends on the features of all IOMMUs.
+     */
+    for_each_amd_iommu ( iommu )
+    {
+        rc = map_iommu_mmio_region(iommu);
+        if ( rc )
+            goto error_out;
+
+        get_iommu_features(iommu);
+
+        if ( iommu->features )
+            iommuv2_enabled = 1;
+    }
+
+    amd_iommu_irte_ga = amd_iommu_ga_supported();
+    if ( !amd_iommu_irte_ga )
+        iommu_intpost = 0;
+
     radix_tree_init(&ivrs_maps);
     for_each_amd_iommu ( iommu )
     {
@@ -1318,6 +1519,12 @@ static void disable_iommu(struct amd_iommu *iommu)
     if ( amd_iommu_has_feature(iommu, IOMMU_EXT_FEATURE_GTSUP_SHIFT) )
         set_iommu_guest_translation_control(iommu, IOMMU_CONTROL_DISABLED);
 
+    if ( amd_iommu_irte_ga )
+    {
+        set_iommu_ga_log_control(iommu, IOMMU_CONTROL_DISABLED);
+        set_iommu_guest_apic_control(iommu, IOMMU_CONTROL_DISABLED);
+    }
+
     set_iommu_translation_control(iommu, IOMMU_CONTROL_DISABLED);
 
     iommu->enabled = 0;
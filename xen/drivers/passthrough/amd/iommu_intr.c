@@ -17,21 +17,70 @@
  */
 
 #include <xen/err.h>
+#include <xen/irq.h>
 #include <xen/sched.h>
 #include <asm/amd-iommu.h>
+#include <asm/msi.h>
+#include <asm/hvm/vlapic.h>
 #include <asm/hvm/svm/amd-iommu-proto.h>
+#include <asm/hvm/svm/avic.h>
 #include <asm/io_apic.h>
 #include <xen/keyhandler.h>
 
-#define INTREMAP_TABLE_ORDER    1
+#define INTREMAP_TABLE_ORDER    (amd_iommu_irte_ga ? 3 : 1)
 #define INTREMAP_LENGTH 0xB
 #define INTREMAP_ENTRIES (1 << INTREMAP_LENGTH)
 
+/*
+ * With guest virtual APIC mode enabled (GAEn) IRTEs are 128 bits wide, and
+ * can either remap an interrupt like the 32-bit format does, or post it
+ * into a vCPU's AVIC backing page (guest_mode set).
+ */
+union irte128 {
+    uint64_t raw[2];
+    __uint128_t val;
+    struct {
+        uint64_t remap_en:1;
+        uint64_t sup_io_pf:1;
+        uint64_t int_type:3;
+        uint64_t rq_eoi:1;
+        uint64_t dm:1;
+        uint64_t guest_mode:1;
+        uint64_t dest_lo:24;
+        uint64_t :32;
+        uint64_t vector:8;
+        uint64_t :48;
+        uint64_t dest_hi:8;
+    } full;
+    struct {
+        uint64_t remap_en:1;
+        uint64_t sup_io_pf:1;
+        uint64_t ga_log_intr:1;
+        uint64_t :3;
+        uint64_t is_run:1;
+        uint64_t guest_mode:1;
+        uint64_t dest_lo:24;
+        uint64_t ga_tag:32;
+        uint64_t vector:8;
+        uint64_t :4;
+        uint64_t ga_root_ptr:40;
+        uint64_t :4;
+        uint64_t dest_hi:8;
+    } ga;
+};
+
+union irte_ptr {
+    void *ptr;
+    u32 *ptr32;
+    union irte128 *ptr128;
+};
+
 struct ioapic_sbdf ioapic_sbdf[MAX_IO_APICS];
 struct hpet_sbdf hpet_sbdf;
 void *shared_intremap_table;
 unsigned long *shared_intremap_inuse;
 static DEFINE_SPINLOCK(shared_intremap_lock);
+bool_t __read_mostly amd_iommu_irte_ga;
 
 static void dump_intremap_tables(unsigned char key);
 
@@ -78,47 +127,109 @@ static unsigned int alloc_intremap_entry(int seg, int bdf, unsigned int nr)
     return slot;
 }
 
-static u32 *get_intremap_entry(int seg, int bdf, int offset)
+static union irte_ptr get_intremap_entry(int seg, int bdf, int offset)
 {
-    u32 *table = get_ivrs_mappings(seg)[bdf].intremap_table;
+    union irte_ptr table = {
+        .ptr = get_ivrs_mappings(seg)[bdf].intremap_table
+    };
 
-    ASSERT( (table != NULL) && (offset < INTREMAP_ENTRIES) );
+    ASSERT( (table.ptr != NULL) && (offset < INTREMAP_ENTRIES) );
 
-    return table + offset;
+    if ( amd_iommu_irte_ga )
+        table.ptr128 += offset;
+    else
+        table.ptr32 += offset;
+
+    return table;
+}
+
+/*
+ * 128-bit IRTEs are only ever written under the intremap lock, and the
+ * hardware doesn't write them, so the cmpxchg16b can't fail: it is used for
+ * its atomicity towards the IOMMU reading the entry.
+ */
+static void write_irte128(union irte128 *entry, const union irte128 *new)
+{
+    union irte128 old = *entry;
+    __uint128_t ret = cmpxchg16b(entry, &old.val, &new->val);
+
+    ASSERT(ret == old.val);
 }
 
 static void free_intremap_entry(int seg, int bdf, int offset)
 {
-    u32 *entry = get_intremap_entry(seg, bdf, offset);
+    union irte_ptr entry = get_intremap_entry(seg, bdf, offset);
+
+    if ( amd_iommu_irte_ga )
+    {
+        union irte128 irte = { .raw = { 0, 0 } };
+
+        write_irte128(entry.ptr128, &irte);
+    }
+    else
+        *entry.ptr32 = 0;
 
-    memset(entry, 0, sizeof(u32));
     __clear_bit(offset, get_ivrs_mappings(seg)[bdf].intremap_inuse);
 }
 
-static void update_intremap_entry(u32* entry, u8 vector, u8 int_type,
-    u8 dest_mode, u8 dest)
+static void update_intremap_entry(union irte_ptr entry, u8 vector,
+    u8 int_type, u8 dest_mode, u8 dest)
 {
+    if ( amd_iommu_irte_ga )
+    {
+        union irte128 irte = { .raw = { 0, 0 } };
+
+        irte.full.remap_en = 1;
+        irte.full.int_type = int_type;
+        irte.full.dm = dest_mode;
+        irte.full.dest_lo = dest;
+        irte.full.vector = vector;
+
+        write_irte128(entry.ptr128, &irte);
+        return;
+    }
+
     set_field_in_reg_u32(IOMMU_CONTROL_ENABLED, 0,
                             INT_REMAP_ENTRY_REMAPEN_MASK,
-                            INT_REMAP_ENTRY_REMAPEN_SHIFT, entry);
-    set_field_in_reg_u32(IOMMU_CONTROL_DISABLED, *entry,
+                            INT_REMAP_ENTRY_REMAPEN_SHIFT, entry.ptr32);
+    set_field_in_reg_u32(IOMMU_CONTROL_DISABLED, *entry.ptr32,
                             INT_REMAP_ENTRY_SUPIOPF_MASK,
-                            INT_REMAP_ENTRY_SUPIOPF_SHIFT, entry);
-    set_field_in_reg_u32(int_type, *entry,
+                            INT_REMAP_ENTRY_SUPIOPF_SHIFT, entry.ptr32);
+    set_field_in_reg_u32(int_type, *entry.ptr32,
                             INT_REMAP_ENTRY_INTTYPE_MASK,
-                            INT_REMAP_ENTRY_INTTYPE_SHIFT, entry);
-    set_field_in_reg_u32(IOMMU_CONTROL_DISABLED, *entry,
+                            INT_REMAP_ENTRY_INTTYPE_SHIFT, entry.ptr32);
+    set_field_in_reg_u32(IOMMU_CONTROL_DISABLED, *entry.ptr32,
                             INT_REMAP_ENTRY_REQEOI_MASK,
-                            INT_REMAP_ENTRY_REQEOI_SHIFT, entry);
-    set_field_in_reg_u32((u32)dest_mode, *entry,
+                            INT_REMAP_ENTRY_REQEOI_SHIFT, entry.ptr32);
+    set_field_in_reg_u32((u32)dest_mode, *entry.ptr32,
                             INT_REMAP_ENTRY_DM_MASK,
-                            INT_REMAP_ENTRY_DM_SHIFT, entry);
-    set_field_in_reg_u32((u32)dest, *entry,
+                            INT_REMAP_ENTRY_DM_SHIFT, entry.ptr32);
+    set_field_in_reg_u32((u32)dest, *entry.ptr32,
                             INT_REMAP_ENTRY_DEST_MAST,
-                            INT_REMAP_ENTRY_DEST_SHIFT, entry);
-    set_field_in_reg_u32((u32)vector, *entry,
+                            INT_REMAP_ENTRY_DEST_SHIFT, entry.ptr32);
+    set_field_in_reg_u32((u32)vector, *entry.ptr32,
                             INT_REMAP_ENTRY_VECTOR_MASK,
-                            INT_REMAP_ENTRY_VECTOR_SHIFT, entry);
+                            INT_REMAP_ENTRY_VECTOR_SHIFT, entry.ptr32);
+}
+
+static unsigned int get_full_vector(union irte_ptr entry)
+{
+    if ( amd_iommu_irte_ga )
+        return entry.ptr128->full.vector;
+
+    return get_field_from_reg_u32(*entry.ptr32,
+                                  INT_REMAP_ENTRY_VECTOR_MASK,
+                                  INT_REMAP_ENTRY_VECTOR_SHIFT);
+}
+
+static unsigned int get_full_int_type(union irte_ptr entry)
+{
+    if ( amd_iommu_irte_ga )
+        return entry.ptr128->full.guest_mode ? 0 : entry.ptr128->full.int_type;
+
+    return get_field_from_reg_u32(*entry.ptr32,
+                                  INT_REMAP_ENTRY_INTTYPE_MASK,
+                                  INT_REMAP_ENTRY_INTTYPE_SHIFT);
 }
 
 static inline int get_rte_index(const struct IO_APIC_route_entry *rte)
@@ -140,7 +251,7 @@ static int update_intremap_entry_from_ioapic(
     u16 *index)
 {
     unsigned long flags;
-    u32* entry;
+    union irte_ptr entry;
     u8 delivery_mode, dest, vector, dest_mode;
     int req_id;
     spinlock_t *lock;
@@ -178,12 +289,8 @@ static int update_intremap_entry_from_ioapic(
          * so need to recover vector and delivery mode from IRTE.
          */
         ASSERT(get_rte_index(rte) == offset);
-        vector = get_field_from_reg_u32(*entry,
-                                        INT_REMAP_ENTRY_VECTOR_MASK,
-                                        INT_REMAP_ENTRY_VECTOR_SHIFT);
-        delivery_mode = get_field_from_reg_u32(*entry,
-                                               INT_REMAP_ENTRY_INTTYPE_MASK,
-                                               INT_REMAP_ENTRY_INTTYPE_SHIFT);
+        vector = get_full_vector(entry);
+        delivery_mode = get_full_int_type(entry);
     }
     update_intremap_entry(entry, vector, delivery_mode, dest_mode, dest);
 
@@ -205,7 +312,7 @@ int __init amd_iommu_setup_ioapic_remapping(void)
 {
     struct IO_APIC_route_entry rte;
     unsigned long flags;
-    u32* entry;
+    union irte_ptr entry;
     int apic, pin;
     u8 delivery_mode, dest, vector, dest_mode;
     u16 seg, bdf, req_id;
@@ -366,16 +473,12 @@ unsigned int amd_iommu_read_ioapic_from_ire(
         u16 bdf = ioapic_sbdf[IO_APIC_ID(apic)].bdf;
         u16 seg = ioapic_sbdf[IO_APIC_ID(apic)].seg;
         u16 req_id = get_intremap_requestor_id(seg, bdf);
-        const u32 *entry = get_intremap_entry(seg, req_id, offset);
+        union irte_ptr entry = get_intremap_entry(seg, req_id, offset);
 
         ASSERT(offset == (val & (INTREMAP_ENTRIES - 1)));
         val &= ~(INTREMAP_ENTRIES - 1);
-        val |= get_field_from_reg_u32(*entry,
-                                      INT_REMAP_ENTRY_INTTYPE_MASK,
-                                      INT_REMAP_ENTRY_INTTYPE_SHIFT) << 8;
-        val |= get_field_from_reg_u32(*entry,
-                                      INT_REMAP_ENTRY_VECTOR_MASK,
-                                      INT_REMAP_ENTRY_VECTOR_SHIFT);
+        val |= get_full_int_type(entry) << 8;
+        val |= get_full_vector(entry);
     }
 
     return val;
@@ -386,7 +489,7 @@ static int update_intremap_entry_from_msi_msg(
     int *remap_index, const struct msi_msg *msg, u32 *data)
 {
     unsigned long flags;
-    u32* entry;
+    union irte_ptr entry;
     u16 req_id, alias_id;
     u8 delivery_mode, dest, vector, dest_mode;
     spinlock_t *lock;
@@ -458,6 +561,35 @@ done:
     return 0;
 }
 
+static void ga_detach(struct msi_desc *msi_desc)
+{
+    struct vcpu *v = msi_desc->pi_vcpu;
+    unsigned long flags;
+
+    if ( !v )
+        return;
+
+    spin_lock_irqsave(&v->arch.hvm_svm.avic.ga_lock, flags);
+    list_del(&msi_desc->pi_list);
+    msi_desc->pi_vcpu = NULL;
+    spin_unlock_irqrestore(&v->arch.hvm_svm.avic.ga_lock, flags);
+}
+
+static void flush_intremap_msi(struct amd_iommu *iommu, u16 req_id,
+                               u16 alias_id)
+{
+    unsigned long flags;
+
+    if ( !iommu->enabled )
+        return;
+
+    spin_lock_irqsave(&iommu->lock, flags);
+    amd_iommu_flush_intremap(iommu, req_id);
+    if ( alias_id != req_id )
+        amd_iommu_flush_intremap(iommu, alias_id);
+    spin_unlock_irqrestore(&iommu->lock, flags);
+}
+
 static struct amd_iommu *_find_iommu_for_device(int seg, int bdf)
 {
     struct amd_iommu *iommu;
@@ -496,6 +628,8 @@ int amd_iommu_msi_msg_update_ire(
 
     if ( msi_desc->remap_index >= 0 && !msg )
     {
+        ga_detach(msi_desc);
+
         do {
             update_intremap_entry_from_msi_msg(iommu, bdf, nr,
                                                &msi_desc->remap_index,
@@ -514,6 +648,17 @@ int amd_iommu_msi_msg_update_ire(
     if ( !msg )
         return 0;
 
+    /*
+     * A posted IRTE uses neither the host vector nor the destination, so
+     * there's nothing to update (and the guest's binding must survive).
+     */
+    if ( msi_desc->pi_vcpu )
+    {
+        msg->data = (msg->data & ~(INTREMAP_ENTRIES - 1)) |
+                    msi_desc->remap_index;
+        return 0;
+    }
+
     do {
         rc = update_intremap_entry_from_msi_msg(iommu, bdf, nr,
                                                 &msi_desc->remap_index,
@@ -540,7 +685,7 @@ void amd_iommu_read_msi_from_ire(
     const struct pci_dev *pdev = msi_desc->dev;
     u16 bdf = pdev ? PCI_BDF2(pdev->bus, pdev->devfn) : hpet_sbdf.bdf;
     u16 seg = pdev ? pdev->seg : hpet_sbdf.seg;
-    const u32 *entry;
+    union irte_ptr entry;
 
     if ( IS_ERR_OR_NULL(_find_iommu_for_device(seg, bdf)) )
         return;
@@ -556,12 +701,136 @@ void amd_iommu_read_msi_from_ire(
     }
 
     msg->data &= ~(INTREMAP_ENTRIES - 1);
-    msg->data |= get_field_from_reg_u32(*entry,
-                                        INT_REMAP_ENTRY_INTTYPE_MASK,
-                                        INT_REMAP_ENTRY_INTTYPE_SHIFT) << 8;
-    msg->data |= get_field_from_reg_u32(*entry,
-                                        INT_REMAP_ENTRY_VECTOR_MASK,
-                                        INT_REMAP_ENTRY_VECTOR_SHIFT);
+    msg->data |= get_full_int_type(entry) << 8;
+    msg->data |= get_full_vector(entry);
+}
+
+/*
+ * Post a passed-through MSI straight into an AVIC vCPU's backing page: the
+ * IRTE switches to guest mode, and follows v's running state from then on
+ * (see avic.c).  Only single-vector MSI/MSI-X without phantom functions is
+ * handled; everything else stays remapped.
+ */
+int amd_iommu_update_ire_posted(
+    const struct vcpu *cv, const struct pirq *pirq, uint8_t gvec)
+{
+    struct vcpu *v = cv->domain->vcpu[cv->vcpu_id];
+    struct irq_desc *desc;
+    struct msi_desc *msi_desc;
+    const struct pci_dev *pdev;
+    struct amd_iommu *iommu;
+    union irte_ptr entry;
+    union irte128 irte = { .raw = { 0, 0 } };
+    spinlock_t *lock;
+    unsigned long flags;
+    u16 bdf, req_id;
+    int rc = 0;
+
+    if ( !amd_iommu_irte_ga || !svm_avic_vcpu_active(v) )
+        return -EOPNOTSUPP;
+
+    desc = pirq_spin_lock_irq_desc(pirq, NULL);
+    if ( !desc )
+        return -EINVAL;
+
+    msi_desc = desc->msi_desc;
+    pdev = msi_desc ? msi_desc->dev : NULL;
+    if ( !pdev || msi_desc->remap_index < 0 )
+    {
+        rc = -ENODEV;
+        goto out;
+    }
+
+    if ( pdev->phantom_stride ||
+         (msi_desc->msi_attrib.type == PCI_CAP_ID_MSI &&
+          (msi_desc->msi_attrib.entry_nr || msi_desc->msi.nvec > 1)) )
+    {
+        rc = -EOPNOTSUPP;
+        goto out;
+    }
+
+    bdf = PCI_BDF2(pdev->bus, pdev->devfn);
+    iommu = find_iommu_for_device(pdev->seg, bdf);
+    if ( !iommu )
+    {
+        rc = -ENODEV;
+        goto out;
+    }
+
+    /* Stop following the old vCPU before the entry stops pointing at it. */
+    ga_detach(msi_desc);
+
+    /* IsRun and the destination get filled in by v, see avic.c. */
+    irte.ga.remap_en = 1;
+    irte.ga.ga_log_intr = 1;
+    irte.ga.guest_mode = 1;
+    irte.ga.ga_tag = AVIC_GA_TAG(v);
+    irte.ga.vector = gvec;
+    irte.ga.ga_root_ptr = page_to_maddr(vcpu_vlapic(v)->regs_page) >>
+                          PAGE_SHIFT;
+
+    req_id = get_dma_requestor_id(pdev->seg, bdf);
+    lock = get_intremap_lock(pdev->seg, req_id);
+    spin_lock_irqsave(lock, flags);
+    entry = get_intremap_entry(pdev->seg, req_id, msi_desc->remap_index);
+    write_irte128(entry.ptr128, &irte);
+    spin_unlock_irqrestore(lock, flags);
+
+    spin_lock_irqsave(&v->arch.hvm_svm.avic.ga_lock, flags);
+    msi_desc->pi_vcpu = v;
+    list_add(&msi_desc->pi_list, &v->arch.hvm_svm.avic.ga_list);
+    spin_unlock_irqrestore(&v->arch.hvm_svm.avic.ga_lock, flags);
+
+    flush_intremap_msi(iommu, req_id,
+                       get_intremap_requestor_id(pdev->seg, bdf));
+
+    svm_avic_ga_refresh(v);
+
+ out:
+    spin_unlock_irq(&desc->lock);
+
+    return rc;
+}
+
+/*
+ * Called by the vCPU a posted IRTE targets, with its ga_lock held, as it
+ * starts or stops running on a physical CPU.
+ */
+void amd_iommu_ga_update(
+    const struct msi_desc *msi_desc, unsigned int dest, bool_t is_run)
+{
+    const struct pci_dev *pdev = msi_desc->dev;
+    u16 bdf = PCI_BDF2(pdev->bus, pdev->devfn);
+    u16 req_id = get_dma_requestor_id(pdev->seg, bdf);
+    spinlock_t *lock = get_intremap_lock(pdev->seg, req_id);
+    struct amd_iommu *iommu;
+    union irte_ptr entry;
+    union irte128 irte;
+    unsigned long flags;
+    bool_t changed;
+
+    /* Physical CPUs the entry can't name get their interrupts via GA log. */
+    if ( dest > 0xff )
+    {
+        dest = 0;
+        is_run = 0;
+    }
+
+    spin_lock_irqsave(lock, flags);
+    entry = get_intremap_entry(pdev->seg, req_id, msi_desc->remap_index);
+    irte = *entry.ptr128;
+    ASSERT(irte.ga.guest_mode);
+    irte.ga.is_run = is_run;
+    irte.ga.dest_lo = dest;
+    changed = irte.raw[0] != entry.ptr128->raw[0];
+    if ( changed )
+        write_atomic(&entry.ptr128->raw[0], irte.raw[0]);
+    spin_unlock_irqrestore(lock, flags);
+
+    iommu = find_iommu_for_device(pdev->seg, bdf);
+    if ( changed && iommu )
+        flush_intremap_msi(iommu, req_id,
+                           get_intremap_requestor_id(pdev->seg, bdf));
 }
 
 int __init amd_iommu_free_intremap_table(
@@ -624,8 +893,9 @@ int __init amd_setup_hpet_msi(struct msi_desc *msi_desc)
     return rc;
 }
 
-static void dump_intremap_table(const u32 *table)
+static void dump_intremap_table(const void *table)
 {
+    union irte_ptr tbl = { .ptr = (void *)table };
     u32 count;
 
     if ( !table )
@@ -633,9 +903,19 @@ static void dump_intremap_table(const u32 *table)
 
     for ( count = 0; count < INTREMAP_ENTRIES; count++ )
     {
-        if ( !table[count] )
-            continue;
-        printk("    IRTE[%03x] %08x\n", count, table[count]);
+        if ( amd_iommu_irte_ga )
+        {
+            if ( !tbl.ptr128[count].raw[0] && !tbl.ptr128[count].raw[1] )
+                continue;
+            printk("    IRTE[%03x] %016"PRIx64"_%016"PRIx64"\n", count,
+                   tbl.ptr128[count].raw[1], tbl.ptr128[count].raw[0]);
+        }
+        else
+        {
+            if ( !tbl.ptr32[count] )
+                continue;
+            printk("    IRTE[%03x] %08x\n", count, tbl.ptr32[count]);
+        }
     }
 }
 
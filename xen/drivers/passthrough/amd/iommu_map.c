@@ -682,7 +682,7 @@ int amd_iommu_map_page(struct domain *d, unsigned long gfn, unsigned long mfn,
 
     /* 4K mapping for PV guests never changes, 
      * no need to flush if we trust non-present bits */
-    if ( is_hvm_domain(d) )
+    if ( is_hvm_domain(d) && !this_cpu(iommu_dont_flush_iotlb) )
         amd_iommu_flush_pages(d, gfn, 0);
 
     for ( merge_level = IOMMU_PAGING_MODE_LEVEL_2;
@@ -755,7 +755,8 @@ int amd_iommu_unmap_page(struct domain *d, unsigned long gfn)
     clear_iommu_pte_present(pt_mfn[1], gfn);
     spin_unlock(&hd->arch.mapping_lock);
 
-    amd_iommu_flush_pages(d, gfn, 0);
+    if ( !this_cpu(iommu_dont_flush_iotlb) )
+        amd_iommu_flush_pages(d, gfn, 0);
 
     return 0;
 }
@@ -282,30 +282,52 @@ static void __hwdom_init amd_iommu_hwdom_init(struct domain *d)
 
     if ( !iommu_passthrough && !need_iommu(d) )
     {
+        unsigned long start = 0, nr = 0;
         int rc = 0;
 
-        /* Set up 1:1 page table for dom0 */
+        /* Set up 1:1 page table for dom0, a run of contiguous frames at once */
         for ( i = 0; i < max_pdx; i++ )
         {
             unsigned long pfn = pdx_to_pfn(i);
 
+            if ( !(i & 0xfffff) )
+                process_pending_softirqs();
+
             /*
              * XXX Should we really map all non-RAM (above 4G)? Minimally
              * a pfn_valid() check would seem desirable here.
              */
-            if ( mfn_valid(pfn) )
+            if ( !mfn_valid(pfn) )
+                continue;
+
+            if ( nr && pfn == start + nr )
+            {
+                nr++;
+                continue;
+            }
+
+            if ( nr )
             {
-                int ret = amd_iommu_map_page(d, pfn, pfn,
-                                             IOMMUF_readable|IOMMUF_writable);
+                int ret = arch_iommu_hwdom_map_range(d, start, nr);
 
                 if ( !rc )
                     rc = ret;
             }
+            start = pfn;
+            nr = 1;
+        }
 
-            if ( !(i & 0xfffff) )
-                process_pending_softirqs();
+        if ( nr )
+        {
+            int ret = arch_iommu_hwdom_map_range(d, start, nr);
+
+            if ( !rc )
+                rc = ret;
         }
 
+        /* The mappings were installed without flushing. */
+        amd_iommu_flush_all_pages(d);
+
         if ( rc )
             AMD_IOMMU_DEBUG("d%d: IOMMU mapping failed: %d\n",
                             d->domain_id, rc);
@@ -602,6 +624,43 @@ static void amd_dump_p2m_table_level(struct page_info* pg, int level,
     unmap_domain_page(table_vaddr);
 }
 
+/*
+ * Invalidation commands cover a naturally aligned 4k, 2M or 1G region, so
+ * use the smallest of those containing the range, or the whole domain.
+ */
+static int __must_check amd_iommu_flush_iotlb_pages(struct domain *d,
+                                                    unsigned long gfn,
+                                                    unsigned int page_count)
+{
+    unsigned long last = gfn + page_count - 1;
+    unsigned int order;
+
+    if ( page_count == 0 || gfn == gfn_x(INVALID_GFN) )
+        order = ~0u;
+    else if ( gfn == last )
+        order = 0;
+    else if ( (gfn >> 9) == (last >> 9) )
+        order = 9;
+    else if ( (gfn >> 18) == (last >> 18) )
+        order = 18;
+    else
+        order = ~0u;
+
+    if ( order == ~0u )
+        amd_iommu_flush_all_pages(d);
+    else
+        amd_iommu_flush_pages(d, gfn & ~((1UL << order) - 1), order);
+
+    return 0;
+}
+
+static int __must_check amd_iommu_flush_iotlb_all(struct domain *d)
+{
+    amd_iommu_flush_all_pages(d);
+
+    return 0;
+}
+
 static void amd_dump_p2m_table(struct domain *d)
 {
     const struct domain_iommu *hd = dom_iommu(d);
@@ -630,9 +689,12 @@ const struct iommu_ops amd_iommu_ops = {
     .read_apic_from_ire = amd_iommu_read_ioapic_from_ire,
     .read_msi_from_ire = amd_iommu_read_msi_from_ire,
     .setup_hpet_msi = amd_setup_hpet_msi,
+    .update_ire_posted = amd_iommu_update_ire_posted,
     .suspend = amd_iommu_suspend,
     .resume = amd_iommu_resume,
     .share_p2m = amd_iommu_share_p2m,
     .crash_shutdown = amd_iommu_crash_shutdown,
+    .iotlb_flush = amd_iommu_flush_iotlb_pages,
+    .iotlb_flush_all = amd_iommu_flush_iotlb_all,
     .dump_p2m_table = amd_dump_p2m_table,
 };
@@ -0,0 +1,1444 @@
+/*
+ * xen/drivers/passthrough/arm/smmu-v3.c
+ *
+ * ARM System MMU architecture version 3 (SMMUv3) support
+ *
+ * Devices behind an SMMUv3 only get stage 2 translation, and the stream
+ * table entries point straight at the domain's p2m, so there are no IOMMU
+ * page tables to build or keep in sync: only the TLBs have to be
+ * invalidated when the p2m changes.  Invalidations go through the command
+ * queue in batches, with a single CMD_SYNC at the end of each batch.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/lib.h>
+#include <xen/delay.h>
+#include <xen/device_tree.h>
+#include <xen/iommu.h>
+#include <xen/irq.h>
+#include <xen/list.h>
+#include <xen/mm.h>
+#include <xen/sched.h>
+#include <xen/sizes.h>
+#include <xen/spinlock.h>
+#include <xen/vmap.h>
+#include <asm/device.h>
+#include <asm/io.h>
+#include <asm/p2m.h>
+#include <asm/page.h>
+
+/* MMIO registers */
+#define ARM_SMMU_IDR0                   0x0
+#define IDR0_ST_LVL                     GENMASK(28, 27)
+#define IDR0_ST_LVL_2LVL                1
+#define IDR0_TTENDIAN                   GENMASK(22, 21)
+#define IDR0_TTENDIAN_MIXED             0
+#define IDR0_TTENDIAN_LE                2
+#define IDR0_VMID16                     BIT(18)
+#define IDR0_COHACC                     BIT(4)
+#define IDR0_TTF                        GENMASK(3, 2)
+#define IDR0_TTF_AARCH64                2
+#define IDR0_TTF_AARCH32_64             3
+#define IDR0_S2P                        BIT(0)
+
+#define ARM_SMMU_IDR1                   0x4
+#define IDR1_TABLES_PRESET              BIT(30)
+#define IDR1_QUEUES_PRESET              BIT(29)
+#define IDR1_REL                        BIT(28)
+#define IDR1_CMDQS                      GENMASK(25, 21)
+#define IDR1_EVTQS                      GENMASK(20, 16)
+#define IDR1_SIDSIZE                    GENMASK(5, 0)
+
+#define ARM_SMMU_IDR3                   0xc
+#define IDR3_RIL                        BIT(10)
+
+#define ARM_SMMU_IDR5                   0x14
+#define IDR5_GRAN4K                     BIT(4)
+#define IDR5_OAS                        GENMASK(2, 0)
+
+#define ARM_SMMU_CR0                    0x20
+#define CR0_CMDQEN                      BIT(3)
+#define CR0_EVTQEN                      BIT(2)
+#define CR0_SMMUEN                      BIT(0)
+
+#define ARM_SMMU_CR0ACK                 0x24
+
+#define ARM_SMMU_CR1                    0x28
+#define CR1_TABLE_SH                    GENMASK(11, 10)
+#define CR1_TABLE_OC                    GENMASK(9, 8)
+#define CR1_TABLE_IC                    GENMASK(7, 6)
+#define CR1_QUEUE_SH                    GENMASK(5, 4)
+#define CR1_QUEUE_OC                    GENMASK(3, 2)
+#define CR1_QUEUE_IC                    GENMASK(1, 0)
+/* CR1 cacheability and shareability fields */
+#define CR1_CACHE_WB                    1
+#define CR1_SH_ISH                      3
+
+#define ARM_SMMU_CR2                    0x2c
+#define CR2_PTM                         BIT(2)
+#define CR2_RECINVSID                   BIT(1)
+
+#define ARM_SMMU_GBPA                   0x44
+#define GBPA_UPDATE                     BIT(31)
+#define GBPA_ABORT                      BIT(20)
+
+#define ARM_SMMU_IRQ_CTRL               0x50
+#define IRQ_CTRL_EVTQ_IRQEN             BIT(2)
+#define IRQ_CTRL_GERROR_IRQEN           BIT(0)
+
+#define ARM_SMMU_IRQ_CTRLACK            0x54
+
+#define ARM_SMMU_GERROR                 0x60
+#define GERROR_SFM_ERR                  BIT(8)
+#define GERROR_MSI_GERROR_ABT_ERR       BIT(7)
+#define GERROR_MSI_PRIQ_ABT_ERR         BIT(6)
+#define GERROR_MSI_EVTQ_ABT_ERR         BIT(5)
+#define GERROR_MSI_CMDQ_ABT_ERR         BIT(4)
+#define GERROR_PRIQ_ABT_ERR             BIT(3)
+#define GERROR_EVTQ_ABT_ERR             BIT(2)
+#define GERROR_CMDQ_ERR                 BIT(0)
+
+#define ARM_SMMU_GERRORN                0x64
+#define ARM_SMMU_GERROR_IRQ_CFG0        0x68
+
+#define ARM_SMMU_STRTAB_BASE            0x80
+#define STRTAB_BASE_RA                  BIT(62)
+#define STRTAB_BASE_ADDR_MASK           GENMASK(51, 6)
+
+#define ARM_SMMU_STRTAB_BASE_CFG        0x88
+#define STRTAB_BASE_CFG_FMT             GENMASK(17, 16)
+#define STRTAB_BASE_CFG_FMT_LINEAR      0
+#define STRTAB_BASE_CFG_FMT_2LVL        1
+#define STRTAB_BASE_CFG_SPLIT           GENMASK(10, 6)
+#define STRTAB_BASE_CFG_LOG2SIZE        GENMASK(5, 0)
+
+#define ARM_SMMU_CMDQ_BASE              0x90
+#define ARM_SMMU_CMDQ_PROD              0x98
+#define ARM_SMMU_CMDQ_CONS              0x9c
+
+#define ARM_SMMU_EVTQ_BASE              0xa0
+#define ARM_SMMU_EVTQ_PROD              0x100a8
+#define ARM_SMMU_EVTQ_CONS              0x100ac
+#define ARM_SMMU_EVTQ_IRQ_CFG0          0xb0
+
+/* The registers span two 64K pages. */
+#define ARM_SMMU_REG_SZ                 SZ_128K
+
+/* Common queue fields */
+#define Q_BASE_RWA                      BIT(62)
+#define Q_BASE_ADDR_MASK                GENMASK(51, 5)
+#define Q_BASE_LOG2SIZE                 GENMASK(4, 0)
+#define Q_OVERFLOW_FLAG                 BIT(31)
+#define CMDQ_CONS_ERR                   GENMASK(30, 24)
+
+/* Stream table */
+#define STRTAB_L1_DESC_DWORDS           1
+#define STRTAB_L1_DESC_SPAN             GENMASK(4, 0)
+#define STRTAB_L1_DESC_L2PTR_MASK       GENMASK(51, 6)
+/* Keep the level 1 table within 1MB, and each level 2 table 16KB. */
+#define STRTAB_L1_SZ_SHIFT              20
+#define STRTAB_SPLIT                    8
+
+#define STRTAB_STE_DWORDS               8
+#define STRTAB_STE_0_V                  BIT(0)
+#define STRTAB_STE_0_CFG                GENMASK(3, 1)
+#define STRTAB_STE_0_CFG_ABORT          0
+#define STRTAB_STE_0_CFG_S2_TRANS       6
+
+#define STRTAB_STE_1_SHCFG              GENMASK(45, 44)
+#define STRTAB_STE_1_SHCFG_INCOMING     1
+
+#define STRTAB_STE_2_S2VMID             GENMASK(15, 0)
+#define STRTAB_STE_2_VTCR               GENMASK(50, 32)
+#define STRTAB_STE_2_S2AA64             BIT(51)
+#define STRTAB_STE_2_S2R                BIT(58)
+
+#define STRTAB_STE_3_S2TTB_MASK         GENMASK(51, 4)
+
+/* The STE VTCR field has the layout of VTCR_EL2[18:0]. */
+#define STE_VTCR_MASK                   GENMASK(18, 0)
+#define STE_VTCR_S2PS                   GENMASK(18, 16)
+
+/* Command queue */
+#define CMDQ_ENT_DWORDS                 2
+#define CMDQ_MAX_SZ_SHIFT               12
+#define CMDQ_BATCH_ENTRIES              32
+
+#define CMDQ_0_OP                       GENMASK(7, 0)
+
+#define CMDQ_CFGI_0_SID                 GENMASK(63, 32)
+#define CMDQ_CFGI_1_LEAF                BIT(0)
+#define CMDQ_CFGI_1_RANGE               GENMASK(4, 0)
+
+#define CMDQ_TLBI_0_VMID                GENMASK(47, 32)
+#define CMDQ_TLBI_0_SCALE               GENMASK(24, 20)
+#define CMDQ_TLBI_0_NUM                 GENMASK(16, 12)
+#define CMDQ_TLBI_1_TG                  GENMASK(11, 10)
+#define CMDQ_TLBI_1_IPA_MASK            GENMASK(51, 12)
+#define CMDQ_TLBI_RANGE_NUM_MAX         31
+/* The range encoding of the 4K granule */
+#define CMDQ_TLBI_TG_4K                 1
+
+#define CMDQ_OP_CFGI_STE                0x3
+#define CMDQ_OP_CFGI_ALL                0x4
+#define CMDQ_OP_TLBI_S12_VMALL          0x28
+#define CMDQ_OP_TLBI_S2_IPA             0x2a
+#define CMDQ_OP_TLBI_NSNH_ALL           0x30
+#define CMDQ_OP_CMD_SYNC                0x46
+
+/* Event queue */
+#define EVTQ_ENT_DWORDS                 4
+#define EVTQ_MAX_SZ_SHIFT               7
+
+#define EVTQ_0_ID                       GENMASK(7, 0)
+#define EVTQ_0_SID                      GENMASK(63, 32)
+
+/*
+ * Invalidating more pages than this one by one takes longer than dropping
+ * all the TLB entries of the VMID, when range invalidation isn't there.
+ */
+#define ARM_SMMU_TLBI_PAGES_MAX         256
+
+#define ARM_SMMU_POLL_TIMEOUT           MILLISECS(100)
+
+#define ARM_SMMU_FEAT_2LVL_STRTAB       (1U << 0)
+#define ARM_SMMU_FEAT_COHERENCY         (1U << 1)
+#define ARM_SMMU_FEAT_RANGE_INV         (1U << 2)
+#define ARM_SMMU_FEAT_VMID16            (1U << 3)
+
+struct arm_smmu_queue {
+    uint64_t *base;
+    unsigned int max_n_shift;           /* log2 of the number of entries */
+    unsigned int ent_dwords;
+    /* Shadows of the index registers, with the wrap bit */
+    uint32_t prod;
+    uint32_t cons;
+    void __iomem *prod_reg;
+    void __iomem *cons_reg;
+    uint64_t q_base;                    /* Value of the base register */
+};
+
+struct arm_smmu_device {
+    struct list_head list;
+    const struct dt_device_node *node;
+    void __iomem *base;
+    unsigned int features;
+    unsigned int sid_bits;
+    unsigned int oas;                   /* IDR5.OAS encoding */
+
+    /* Protects the command queue and the stream table. */
+    spinlock_t cmdq_lock;
+    struct arm_smmu_queue cmdq;
+    struct arm_smmu_queue evtq;
+
+    uint64_t *strtab;                   /* Linear table or level 1 table */
+    uint64_t **strtab_l2;               /* Level 2 tables */
+    unsigned int num_l1_ents;
+    uint64_t strtab_base_cfg;
+};
+
+/* A device behind an SMMU, and the stream IDs it issues transactions with */
+struct arm_smmu_master {
+    struct list_head list;              /* Entry in the domain's masters */
+    struct arm_smmu_device *smmu;
+    struct domain *domain;
+    unsigned int num_sids;
+    uint32_t sids[];
+};
+
+/* Per-domain state */
+struct arm_smmu_domain {
+    spinlock_t lock;
+    struct list_head masters;
+};
+
+struct arm_smmu_cmdq_batch {
+    uint64_t cmds[CMDQ_BATCH_ENTRIES * CMDQ_ENT_DWORDS];
+    unsigned int num;
+};
+
+/*
+ * No lock here, as this list gets only populated upon boot while probing
+ * the SMMUs, and only gets iterated afterwards.
+ */
+static LIST_HEAD(arm_smmu_devices);
+
+/* The features that every SMMU has. */
+static unsigned int platform_features = ARM_SMMU_FEAT_COHERENCY;
+
+static void arm_smmu_sync_to_device(const struct arm_smmu_device *smmu,
+                                    void *va, size_t size)
+{
+    if ( smmu->features & ARM_SMMU_FEAT_COHERENCY )
+        dsb(ishst);
+    else
+        clean_and_invalidate_dcache_va_range(va, size);
+}
+
+static int arm_smmu_write_reg_sync(struct arm_smmu_device *smmu, uint32_t val,
+                                   unsigned int reg_off, unsigned int ack_off)
+{
+    s_time_t deadline = NOW() + ARM_SMMU_POLL_TIMEOUT;
+
+    writel_relaxed(val, smmu->base + reg_off);
+
+    do {
+        if ( readl_relaxed(smmu->base + ack_off) == val )
+            return 0;
+
+        cpu_relax();
+        udelay(1);
+    } while ( NOW() <= deadline );
+
+    return -ETIMEDOUT;
+}
+
+/* Set what happens to transactions while the SMMU is disabled. */
+static int arm_smmu_update_gbpa(struct arm_smmu_device *smmu, uint32_t val)
+{
+    s_time_t deadline = NOW() + ARM_SMMU_POLL_TIMEOUT;
+
+    writel_relaxed(GBPA_UPDATE | val, smmu->base + ARM_SMMU_GBPA);
+
+    do {
+        if ( !(readl_relaxed(smmu->base + ARM_SMMU_GBPA) & GBPA_UPDATE) )
+            return 0;
+
+        cpu_relax();
+        udelay(1);
+    } while ( NOW() <= deadline );
+
+    return -ETIMEDOUT;
+}
+
+/* Queue manipulation */
+static uint32_t queue_idx(const struct arm_smmu_queue *q, uint32_t p)
+{
+    return p & ((1U << q->max_n_shift) - 1);
+}
+
+static uint32_t queue_wrp(const struct arm_smmu_queue *q, uint32_t p)
+{
+    return p & (1U << q->max_n_shift);
+}
+
+/* The index and the wrap bit together count modulo twice the size. */
+static uint32_t queue_inc(const struct arm_smmu_queue *q, uint32_t p)
+{
+    return (p + 1) & ((2U << q->max_n_shift) - 1);
+}
+
+static bool queue_full(const struct arm_smmu_queue *q)
+{
+    return queue_idx(q, q->prod) == queue_idx(q, q->cons) &&
+           queue_wrp(q, q->prod) != queue_wrp(q, q->cons);
+}
+
+static bool queue_empty(const struct arm_smmu_queue *q)
+{
+    return q->prod == q->cons;
+}
+
+static uint64_t *queue_entry(const struct arm_smmu_queue *q, uint32_t p)
+{
+    return q->base + queue_idx(q, p) * q->ent_dwords;
+}
+
+static void queue_sync_cons(struct arm_smmu_queue *q)
+{
+    q->cons = readl_relaxed(q->cons_reg) & ((2U << q->max_n_shift) - 1);
+}
+
+static int queue_init(struct arm_smmu_device *smmu, struct arm_smmu_queue *q,
+                      unsigned int max_shift, unsigned int ent_dwords,
+                      unsigned int prod_off, unsigned int cons_off)
+{
+    size_t size;
+
+    q->max_n_shift = min(max_shift, q->max_n_shift);
+    q->ent_dwords = ent_dwords;
+    size = (ent_dwords * 8) << q->max_n_shift;
+
+    /* The queue has to be aligned to its size, and at least to 32 bytes. */
+    q->base = _xzalloc(size, max_t(size_t, size, 32));
+    if ( !q->base )
+        return -ENOMEM;
+    arm_smmu_sync_to_device(smmu, q->base, size);
+
+    q->prod = q->cons = 0;
+    q->prod_reg = smmu->base + prod_off;
+    q->cons_reg = smmu->base + cons_off;
+
+    q->q_base = Q_BASE_RWA | (virt_to_maddr(q->base) & Q_BASE_ADDR_MASK) |
+                MASK_INSR(q->max_n_shift, Q_BASE_LOG2SIZE);
+
+    return 0;
+}
+
+/* Command queue */
+static void arm_smmu_cmdq_skip_err(struct arm_smmu_device *smmu)
+{
+    struct arm_smmu_queue *q = &smmu->cmdq;
+    uint32_t cons = readl_relaxed(q->cons_reg);
+    uint64_t *cmd = queue_entry(q, cons);
+
+    printk(XENLOG_ERR "smmu-v3: %s: CMDQ error %lu on command 0x%016"PRIx64" 0x%016"PRIx64"\n",
+           dt_node_full_name(smmu->node), MASK_EXTR(cons, CMDQ_CONS_ERR),
+           cmd[0], cmd[1]);
+
+    /*
+     * The queue is stalled on the bad command: replace it with a CMD_SYNC
+     * so that the commands behind it still get executed.
+     */
+    cmd[0] = MASK_INSR(CMDQ_OP_CMD_SYNC, CMDQ_0_OP);
+    cmd[1] = 0;
+    arm_smmu_sync_to_device(smmu, cmd, CMDQ_ENT_DWORDS * 8);
+
+    /* Acknowledge the error, which restarts the queue. */
+    writel_relaxed(readl_relaxed(smmu->base + ARM_SMMU_GERRORN) ^
+                   GERROR_CMDQ_ERR, smmu->base + ARM_SMMU_GERRORN);
+}
+
+/* Wait for the SMMU to consume all the commands.  Called with the lock held. */
+static int arm_smmu_cmdq_drain(struct arm_smmu_device *smmu)
+{
+    struct arm_smmu_queue *q = &smmu->cmdq;
+    s_time_t deadline = NOW() + ARM_SMMU_POLL_TIMEOUT;
+
+    do {
+        uint32_t gerror = readl_relaxed(smmu->base + ARM_SMMU_GERROR) ^
+                          readl_relaxed(smmu->base + ARM_SMMU_GERRORN);
+
+        if ( gerror & GERROR_CMDQ_ERR )
+            arm_smmu_cmdq_skip_err(smmu);
+
+        queue_sync_cons(q);
+        if ( queue_empty(q) )
+            return 0;
+
+        cpu_relax();
+        udelay(1);
+    } while ( NOW() <= deadline );
+
+    printk(XENLOG_ERR "smmu-v3: %s: CMD_SYNC timeout\n",
+           dt_node_full_name(smmu->node));
+
+    return -ETIMEDOUT;
+}
+
+/* Copy a command to the queue, without telling the SMMU about it yet. */
+static int arm_smmu_cmdq_insert(struct arm_smmu_device *smmu,
+                                const uint64_t *cmd)
+{
+    struct arm_smmu_queue *q = &smmu->cmdq;
+    uint64_t *ent;
+
+    if ( queue_full(q) )
+    {
+        int ret;
+
+        /* Let the SMMU catch up with what has been queued so far. */
+        writel_relaxed(q->prod, q->prod_reg);
+        ret = arm_smmu_cmdq_drain(smmu);
+        if ( ret )
+            return ret;
+    }
+
+    ent = queue_entry(q, q->prod);
+    ent[0] = cmd[0];
+    ent[1] = cmd[1];
+    arm_smmu_sync_to_device(smmu, ent, CMDQ_ENT_DWORDS * 8);
+    q->prod = queue_inc(q, q->prod);
+
+    return 0;
+}
+
+/*
+ * Issue a number of commands, followed by a single CMD_SYNC when asked to,
+ * and wait for that to complete.
+ */
+static int arm_smmu_cmdq_issue(struct arm_smmu_device *smmu,
+                               const uint64_t *cmds, unsigned int num,
+                               bool sync)
+{
+    const uint64_t cmd_sync[CMDQ_ENT_DWORDS] = {
+        MASK_INSR(CMDQ_OP_CMD_SYNC, CMDQ_0_OP),
+    };
+    struct arm_smmu_queue *q = &smmu->cmdq;
+    unsigned long flags;
+    unsigned int i;
+    int ret = 0;
+
+    spin_lock_irqsave(&smmu->cmdq_lock, flags);
+
+    for ( i = 0; i < num && !ret; i++ )
+        ret = arm_smmu_cmdq_insert(smmu, &cmds[i * CMDQ_ENT_DWORDS]);
+
+    if ( !ret && sync )
+        ret = arm_smmu_cmdq_insert(smmu, cmd_sync);
+
+    /* Make the commands visible to the SMMU before publishing them. */
+    wmb();
+    writel_relaxed(q->prod, q->prod_reg);
+
+    if ( !ret && sync )
+        ret = arm_smmu_cmdq_drain(smmu);
+
+    spin_unlock_irqrestore(&smmu->cmdq_lock, flags);
+
+    return ret;
+}
+
+static void arm_smmu_cmdq_batch_add(struct arm_smmu_device *smmu,
+                                    struct arm_smmu_cmdq_batch *batch,
+                                    uint64_t cmd0, uint64_t cmd1)
+{
+    /* A full batch goes to the queue, but the CMD_SYNC waits until the end. */
+    if ( batch->num == CMDQ_BATCH_ENTRIES )
+    {
+        arm_smmu_cmdq_issue(smmu, batch->cmds, batch->num, false);
+        batch->num = 0;
+    }
+
+    batch->cmds[batch->num * CMDQ_ENT_DWORDS] = cmd0;
+    batch->cmds[batch->num * CMDQ_ENT_DWORDS + 1] = cmd1;
+    batch->num++;
+}
+
+static int arm_smmu_cmdq_batch_submit(struct arm_smmu_device *smmu,
+                                      struct arm_smmu_cmdq_batch *batch)
+{
+    return arm_smmu_cmdq_issue(smmu, batch->cmds, batch->num, true);
+}
+
+/* TLB invalidation */
+static int arm_smmu_tlb_inv_vmid(struct arm_smmu_device *smmu, uint16_t vmid)
+{
+    const uint64_t cmd[CMDQ_ENT_DWORDS] = {
+        MASK_INSR(CMDQ_OP_TLBI_S12_VMALL, CMDQ_0_OP) |
+        MASK_INSR(vmid, CMDQ_TLBI_0_VMID),
+    };
+
+    return arm_smmu_cmdq_issue(smmu, cmd, 1, true);
+}
+
+/*
+ * Invalidate the TLB entries of [gfn, gfn + nr) for a VMID.  When the SMMU
+ * has range invalidation, each command covers up to 31 aligned blocks of a
+ * power of two pages; otherwise there is one command per page.  Either way
+ * there is only one CMD_SYNC for the whole range.
+ */
+static int arm_smmu_tlb_inv_range(struct arm_smmu_device *smmu, uint16_t vmid,
+                                  unsigned long gfn, unsigned long nr)
+{
+    struct arm_smmu_cmdq_batch batch = { .num = 0 };
+    uint64_t cmd0 = MASK_INSR(CMDQ_OP_TLBI_S2_IPA, CMDQ_0_OP) |
+                    MASK_INSR(vmid, CMDQ_TLBI_0_VMID);
+    bool range = smmu->features & ARM_SMMU_FEAT_RANGE_INV;
+
+    if ( !range && nr > ARM_SMMU_TLBI_PAGES_MAX )
+        return arm_smmu_tlb_inv_vmid(smmu, vmid);
+
+    while ( nr )
+    {
+        uint64_t cmd1 = ((paddr_t)gfn << PAGE_SHIFT) & CMDQ_TLBI_1_IPA_MASK;
+        unsigned long pages = 1;
+
+        if ( range )
+        {
+            /*
+             * The largest power of two that divides the count, and as
+             * many of those as the command can take.
+             */
+            unsigned int scale = find_first_set_bit(nr);
+            unsigned long num = min_t(unsigned long, nr >> scale,
+                                      CMDQ_TLBI_RANGE_NUM_MAX);
+
+            pages = num << scale;
+            arm_smmu_cmdq_batch_add(smmu, &batch,
+                                    cmd0 | MASK_INSR(scale, CMDQ_TLBI_0_SCALE) |
+                                    MASK_INSR(num - 1, CMDQ_TLBI_0_NUM),
+                                    cmd1 | MASK_INSR(CMDQ_TLBI_TG_4K,
+                                                     CMDQ_TLBI_1_TG));
+        }
+        else
+            arm_smmu_cmdq_batch_add(smmu, &batch, cmd0, cmd1);
+
+        gfn += pages;
+        nr -= pages;
+    }
+
+    return arm_smmu_cmdq_batch_submit(smmu, &batch);
+}
+
+/* Stream table */
+static uint64_t *arm_smmu_get_ste(const struct arm_smmu_device *smmu,
+                                  uint32_t sid)
+{
+    if ( smmu->strtab_l2 )
+    {
+        uint64_t *l2 = smmu->strtab_l2[sid >> STRTAB_SPLIT];
+
+        if ( !l2 )
+            return NULL;
+
+        return &l2[(sid & ((1U << STRTAB_SPLIT) - 1)) * STRTAB_STE_DWORDS];
+    }
+
+    return &smmu->strtab[sid * STRTAB_STE_DWORDS];
+}
+
+static void arm_smmu_init_abort_stes(uint64_t *strtab, unsigned int nent)
+{
+    unsigned int i;
+
+    /* Transactions from streams no domain owns are aborted. */
+    for ( i = 0; i < nent; i++ )
+    {
+        strtab[0] = STRTAB_STE_0_V |
+                    MASK_INSR(STRTAB_STE_0_CFG_ABORT, STRTAB_STE_0_CFG);
+        strtab += STRTAB_STE_DWORDS;
+    }
+}
+
+static int arm_smmu_sync_ste(struct arm_smmu_device *smmu, uint32_t sid)
+{
+    const uint64_t cmd[CMDQ_ENT_DWORDS] = {
+        MASK_INSR(CMDQ_OP_CFGI_STE, CMDQ_0_OP) |
+        MASK_INSR(sid, CMDQ_CFGI_0_SID),
+        CMDQ_CFGI_1_LEAF,
+    };
+
+    return arm_smmu_cmdq_issue(smmu, cmd, 1, true);
+}
+
+/*
+ * Point a stream at the p2m of a domain, or abort its transactions when
+ * d is NULL.  The entry is made to abort first, so that the SMMU never
+ * sees a half-written entry.
+ */
+static int arm_smmu_write_ste(struct arm_smmu_device *smmu, uint32_t sid,
+                              struct domain *d)
+{
+    uint64_t *ste = arm_smmu_get_ste(smmu, sid);
+    const struct p2m_domain *p2m;
+    uint64_t vtcr;
+    int ret;
+
+    ASSERT(ste);
+
+    ste[0] = STRTAB_STE_0_V |
+             MASK_INSR(STRTAB_STE_0_CFG_ABORT, STRTAB_STE_0_CFG);
+    arm_smmu_sync_to_device(smmu, ste, STRTAB_STE_DWORDS * 8);
+    ret = arm_smmu_sync_ste(smmu, sid);
+    if ( ret || !d )
+        return ret;
+
+    p2m = &d->arch.p2m;
+
+    /* The SMMU may be able to output fewer address bits than the CPUs. */
+    vtcr = p2m_vtcr & STE_VTCR_MASK;
+    if ( MASK_EXTR(vtcr, STE_VTCR_S2PS) > smmu->oas )
+        vtcr = (vtcr & ~STE_VTCR_S2PS) | MASK_INSR(smmu->oas, STE_VTCR_S2PS);
+
+    ste[1] = MASK_INSR(STRTAB_STE_1_SHCFG_INCOMING, STRTAB_STE_1_SHCFG);
+    ste[2] = MASK_INSR(p2m->vmid, STRTAB_STE_2_S2VMID) |
+             MASK_INSR(vtcr, STRTAB_STE_2_VTCR) |
+             STRTAB_STE_2_S2AA64 | STRTAB_STE_2_S2R;
+    ste[3] = page_to_maddr(p2m->root) & STRTAB_STE_3_S2TTB_MASK;
+    arm_smmu_sync_to_device(smmu, ste, STRTAB_STE_DWORDS * 8);
+
+    ste[0] = STRTAB_STE_0_V |
+             MASK_INSR(STRTAB_STE_0_CFG_S2_TRANS, STRTAB_STE_0_CFG);
+    arm_smmu_sync_to_device(smmu, ste, STRTAB_STE_DWORDS * 8);
+
+    return arm_smmu_sync_ste(smmu, sid);
+}
+
+static int arm_smmu_init_l2_strtab(struct arm_smmu_device *smmu, uint32_t sid)
+{
+    unsigned int idx = sid >> STRTAB_SPLIT;
+    size_t size = (STRTAB_STE_DWORDS * 8) << STRTAB_SPLIT;
+    uint64_t *l2;
+
+    if ( smmu->strtab_l2[idx] )
+        return 0;
+
+    l2 = _xzalloc(size, size);
+    if ( !l2 )
+        return -ENOMEM;
+
+    arm_smmu_init_abort_stes(l2, 1U << STRTAB_SPLIT);
+    arm_smmu_sync_to_device(smmu, l2, size);
+    smmu->strtab_l2[idx] = l2;
+
+    smmu->strtab[idx] = MASK_INSR(STRTAB_SPLIT + 1, STRTAB_L1_DESC_SPAN) |
+                        (virt_to_maddr(l2) & STRTAB_L1_DESC_L2PTR_MASK);
+    arm_smmu_sync_to_device(smmu, &smmu->strtab[idx], 8);
+
+    return 0;
+}
+
+static int arm_smmu_init_strtab(struct arm_smmu_device *smmu)
+{
+    unsigned int nent, log2size;
+    size_t size;
+
+    if ( smmu->features & ARM_SMMU_FEAT_2LVL_STRTAB &&
+         smmu->sid_bits > STRTAB_SPLIT )
+    {
+        /*
+         * Level 2 tables are only allocated for the streams of the
+         * masters found in the device tree.
+         */
+        log2size = min_t(unsigned int, smmu->sid_bits,
+                         STRTAB_L1_SZ_SHIFT - 3 + STRTAB_SPLIT);
+        smmu->num_l1_ents = 1U << (log2size - STRTAB_SPLIT);
+        size = smmu->num_l1_ents * STRTAB_L1_DESC_DWORDS * 8;
+
+        smmu->strtab_l2 = xzalloc_array(uint64_t *, smmu->num_l1_ents);
+        if ( !smmu->strtab_l2 )
+            return -ENOMEM;
+
+        smmu->strtab = _xzalloc(size, max_t(size_t, size, 64));
+        if ( !smmu->strtab )
+            return -ENOMEM;
+
+        smmu->strtab_base_cfg =
+            MASK_INSR(STRTAB_BASE_CFG_FMT_2LVL, STRTAB_BASE_CFG_FMT) |
+            MASK_INSR(STRTAB_SPLIT, STRTAB_BASE_CFG_SPLIT);
+    }
+    else
+    {
+        log2size = smmu->sid_bits;
+        nent = 1U << log2size;
+        size = nent * STRTAB_STE_DWORDS * 8;
+
+        smmu->strtab = _xzalloc(size, max_t(size_t, size, 64));
+        if ( !smmu->strtab )
+            return -ENOMEM;
+
+        arm_smmu_init_abort_stes(smmu->strtab, nent);
+
+        smmu->strtab_base_cfg =
+            MASK_INSR(STRTAB_BASE_CFG_FMT_LINEAR, STRTAB_BASE_CFG_FMT);
+    }
+
+    arm_smmu_sync_to_device(smmu, smmu->strtab, size);
+    smmu->strtab_base_cfg |= MASK_INSR(log2size, STRTAB_BASE_CFG_LOG2SIZE);
+    smmu->sid_bits = log2size;
+
+    return 0;
+}
+
+/* Interrupts */
+static void arm_smmu_handle_gerror(struct arm_smmu_device *smmu)
+{
+    uint32_t gerror = readl_relaxed(smmu->base + ARM_SMMU_GERROR);
+    uint32_t gerrorn = readl_relaxed(smmu->base + ARM_SMMU_GERRORN);
+    /* Command queue errors are taken care of when waiting for a CMD_SYNC. */
+    uint32_t active = (gerror ^ gerrorn) & ~GERROR_CMDQ_ERR;
+
+    if ( !active )
+        return;
+
+    printk(XENLOG_WARNING "smmu-v3: %s: global error 0x%x%s%s%s\n",
+           dt_node_full_name(smmu->node), active,
+           active & GERROR_SFM_ERR ? ", entered service failure mode" : "",
+           active & GERROR_EVTQ_ABT_ERR ? ", EVTQ write aborted" : "",
+           active & GERROR_MSI_EVTQ_ABT_ERR ? ", EVTQ MSI aborted" : "");
+
+    writel_relaxed(gerrorn ^ active, smmu->base + ARM_SMMU_GERRORN);
+}
+
+static void arm_smmu_handle_evtq(struct arm_smmu_device *smmu)
+{
+    struct arm_smmu_queue *q = &smmu->evtq;
+    uint32_t prod = readl_relaxed(q->prod_reg);
+
+    q->prod = prod & ((2U << q->max_n_shift) - 1);
+
+    while ( !queue_empty(q) )
+    {
+        const uint64_t *evt = queue_entry(q, q->cons);
+
+        if ( !(smmu->features & ARM_SMMU_FEAT_COHERENCY) )
+            invalidate_dcache_va_range(evt, EVTQ_ENT_DWORDS * 8);
+
+        if ( printk_ratelimit() )
+            printk(XENLOG_WARNING "smmu-v3: %s: event 0x%02lx from SID 0x%lx, address 0x%016"PRIx64"\n",
+                   dt_node_full_name(smmu->node),
+                   MASK_EXTR(evt[0], EVTQ_0_ID), MASK_EXTR(evt[0], EVTQ_0_SID),
+                   evt[2]);
+
+        q->cons = queue_inc(q, q->cons);
+    }
+
+    if ( prod & Q_OVERFLOW_FLAG && printk_ratelimit() )
+        printk(XENLOG_WARNING "smmu-v3: %s: event queue overflow\n",
+               dt_node_full_name(smmu->node));
+
+    /* Acknowledge any overflow by copying the flag back. */
+    writel_relaxed(q->cons | (prod & Q_OVERFLOW_FLAG), q->cons_reg);
+}
+
+/*
+ * However the interrupts are wired up (one combined or one per source), the
+ * same handler deals with global errors and events.  PRI is never enabled.
+ */
+static void arm_smmu_irq_handler(int irq, void *dev, struct cpu_user_regs *regs)
+{
+    struct arm_smmu_device *smmu = dev;
+
+    arm_smmu_handle_gerror(smmu);
+    arm_smmu_handle_evtq(smmu);
+}
+
+static int arm_smmu_setup_irqs(struct arm_smmu_device *smmu)
+{
+    unsigned int i, nr = dt_number_of_irq(smmu->node);
+    int ret;
+
+    ret = arm_smmu_write_reg_sync(smmu, 0, ARM_SMMU_IRQ_CTRL,
+                                  ARM_SMMU_IRQ_CTRLACK);
+    if ( ret )
+        return ret;
+
+    /* Wired interrupts only: make sure no MSIs get written out. */
+    writeq_relaxed(0, smmu->base + ARM_SMMU_GERROR_IRQ_CFG0);
+    writeq_relaxed(0, smmu->base + ARM_SMMU_EVTQ_IRQ_CFG0);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        int irq = platform_get_irq(smmu->node, i);
+
+        if ( irq < 0 )
+            continue;
+
+        ret = request_irq(irq, IRQF_SHARED, arm_smmu_irq_handler,
+                          "arm-smmu-v3", smmu);
+        if ( ret )
+            printk(XENLOG_WARNING "smmu-v3: %s: failed to request IRQ %d\n",
+                   dt_node_full_name(smmu->node), irq);
+    }
+
+    return arm_smmu_write_reg_sync(smmu,
+                                   IRQ_CTRL_EVTQ_IRQEN | IRQ_CTRL_GERROR_IRQEN,
+                                   ARM_SMMU_IRQ_CTRL, ARM_SMMU_IRQ_CTRLACK);
+}
+
+static int arm_smmu_device_reset(struct arm_smmu_device *smmu)
+{
+    const uint64_t inv_cmds[2 * CMDQ_ENT_DWORDS] = {
+        MASK_INSR(CMDQ_OP_CFGI_ALL, CMDQ_0_OP),
+        MASK_INSR(31, CMDQ_CFGI_1_RANGE),
+        MASK_INSR(CMDQ_OP_TLBI_NSNH_ALL, CMDQ_0_OP), 0,
+    };
+    uint32_t reg;
+    int ret;
+
+    /* Abort incoming transactions until the stream table is in place. */
+    if ( readl_relaxed(smmu->base + ARM_SMMU_CR0) & CR0_SMMUEN )
+        printk(XENLOG_WARNING "smmu-v3: %s: already enabled, resetting\n",
+               dt_node_full_name(smmu->node));
+
+    ret = arm_smmu_update_gbpa(smmu, GBPA_ABORT);
+    if ( ret )
+        return ret;
+
+    ret = arm_smmu_write_reg_sync(smmu, 0, ARM_SMMU_CR0, ARM_SMMU_CR0ACK);
+    if ( ret )
+        return ret;
+
+    reg = MASK_INSR(CR1_SH_ISH, CR1_TABLE_SH) |
+          MASK_INSR(CR1_CACHE_WB, CR1_TABLE_OC) |
+          MASK_INSR(CR1_CACHE_WB, CR1_TABLE_IC) |
+          MASK_INSR(CR1_SH_ISH, CR1_QUEUE_SH) |
+          MASK_INSR(CR1_CACHE_WB, CR1_QUEUE_OC) |
+          MASK_INSR(CR1_CACHE_WB, CR1_QUEUE_IC);
+    writel_relaxed(reg, smmu->base + ARM_SMMU_CR1);
+
+    /*
+     * The SMMU is told about every p2m change through the command queue, so
+     * it can ignore the TLB maintenance the CPUs broadcast for the same
+     * VMIDs.
+     */
+    writel_relaxed(CR2_PTM | CR2_RECINVSID, smmu->base + ARM_SMMU_CR2);
+
+    writeq_relaxed(STRTAB_BASE_RA |
+                   (virt_to_maddr(smmu->strtab) & STRTAB_BASE_ADDR_MASK),
+                   smmu->base + ARM_SMMU_STRTAB_BASE);
+    writel_relaxed(smmu->strtab_base_cfg,
+                   smmu->base + ARM_SMMU_STRTAB_BASE_CFG);
+
+    writeq_relaxed(smmu->cmdq.q_base, smmu->base + ARM_SMMU_CMDQ_BASE);
+    writel_relaxed(smmu->cmdq.prod, smmu->cmdq.prod_reg);
+    writel_relaxed(smmu->cmdq.cons, smmu->cmdq.cons_reg);
+
+    reg = CR0_CMDQEN;
+    ret = arm_smmu_write_reg_sync(smmu, reg, ARM_SMMU_CR0, ARM_SMMU_CR0ACK);
+    if ( ret )
+        return ret;
+
+    /* Drop anything cached from before Xen took over. */
+    ret = arm_smmu_cmdq_issue(smmu, inv_cmds, 2, true);
+    if ( ret )
+        return ret;
+
+    writeq_relaxed(smmu->evtq.q_base, smmu->base + ARM_SMMU_EVTQ_BASE);
+    writel_relaxed(smmu->evtq.prod, smmu->evtq.prod_reg);
+    writel_relaxed(smmu->evtq.cons, smmu->evtq.cons_reg);
+
+    reg |= CR0_EVTQEN;
+    ret = arm_smmu_write_reg_sync(smmu, reg, ARM_SMMU_CR0, ARM_SMMU_CR0ACK);
+    if ( ret )
+        return ret;
+
+    ret = arm_smmu_setup_irqs(smmu);
+    if ( ret )
+        return ret;
+
+    reg |= CR0_SMMUEN;
+
+    return arm_smmu_write_reg_sync(smmu, reg, ARM_SMMU_CR0, ARM_SMMU_CR0ACK);
+}
+
+static int arm_smmu_device_hw_probe(struct arm_smmu_device *smmu)
+{
+    uint32_t reg = readl_relaxed(smmu->base + ARM_SMMU_IDR0);
+
+    if ( !(reg & IDR0_S2P) )
+    {
+        printk(XENLOG_ERR "smmu-v3: %s: no stage 2 translation\n",
+               dt_node_full_name(smmu->node));
+        return -ENODEV;
+    }
+
+    switch ( MASK_EXTR(reg, IDR0_TTF) )
+    {
+    case IDR0_TTF_AARCH64:
+    case IDR0_TTF_AARCH32_64:
+        break;
+    default:
+        printk(XENLOG_ERR "smmu-v3: %s: no AArch64 table format\n",
+               dt_node_full_name(smmu->node));
+        return -ENODEV;
+    }
+
+    switch ( MASK_EXTR(reg, IDR0_TTENDIAN) )
+    {
+    case IDR0_TTENDIAN_MIXED:
+    case IDR0_TTENDIAN_LE:
+        break;
+    default:
+        printk(XENLOG_ERR "smmu-v3: %s: no little-endian table walks\n",
+               dt_node_full_name(smmu->node));
+        return -ENODEV;
+    }
+
+    if ( MASK_EXTR(reg, IDR0_ST_LVL) == IDR0_ST_LVL_2LVL )
+        smmu->features |= ARM_SMMU_FEAT_2LVL_STRTAB;
+    if ( reg & IDR0_COHACC )
+        smmu->features |= ARM_SMMU_FEAT_COHERENCY;
+    if ( reg & IDR0_VMID16 )
+        smmu->features |= ARM_SMMU_FEAT_VMID16;
+
+    reg = readl_relaxed(smmu->base + ARM_SMMU_IDR1);
+    if ( reg & (IDR1_TABLES_PRESET | IDR1_QUEUES_PRESET | IDR1_REL) )
+    {
+        printk(XENLOG_ERR "smmu-v3: %s: embedded implementation not supported\n",
+               dt_node_full_name(smmu->node));
+        return -ENODEV;
+    }
+
+    smmu->cmdq.max_n_shift = min_t(unsigned int, CMDQ_MAX_SZ_SHIFT,
+                                   MASK_EXTR(reg, IDR1_CMDQS));
+    smmu->evtq.max_n_shift = min_t(unsigned int, EVTQ_MAX_SZ_SHIFT,
+                                   MASK_EXTR(reg, IDR1_EVTQS));
+    smmu->sid_bits = MASK_EXTR(reg, IDR1_SIDSIZE);
+
+    reg = readl_relaxed(smmu->base + ARM_SMMU_IDR3);
+    if ( reg & IDR3_RIL )
+        smmu->features |= ARM_SMMU_FEAT_RANGE_INV;
+
+    reg = readl_relaxed(smmu->base + ARM_SMMU_IDR5);
+    if ( !(reg & IDR5_GRAN4K) )
+    {
+        printk(XENLOG_ERR "smmu-v3: %s: no 4K granule\n",
+               dt_node_full_name(smmu->node));
+        return -ENODEV;
+    }
+    smmu->oas = MASK_EXTR(reg, IDR5_OAS);
+
+    printk(XENLOG_INFO "smmu-v3: %s: %u-bit SIDs%s%s%s\n",
+           dt_node_full_name(smmu->node), smmu->sid_bits,
+           smmu->features & ARM_SMMU_FEAT_2LVL_STRTAB ? ", 2-level" : "",
+           smmu->features & ARM_SMMU_FEAT_COHERENCY ? ", coherent" : "",
+           smmu->features & ARM_SMMU_FEAT_RANGE_INV ? ", range TLBI" : "");
+
+    return 0;
+}
+
+/*
+ * Find the devices using this SMMU through the generic "iommus" binding,
+ * and make sure the stream table has room for their stream IDs.  A device
+ * that can't be set up isn't protected, and so never gets assigned.
+ */
+static void arm_smmu_find_masters(struct arm_smmu_device *smmu)
+{
+    struct dt_device_node *np;
+
+    dt_for_each_device_node(dt_host, np)
+    {
+        struct dt_phandle_args args;
+        struct arm_smmu_master *master;
+        unsigned int i, num = 0;
+        int ret = 0;
+
+        while ( !dt_parse_phandle_with_args(np, "iommus", "#iommu-cells",
+                                            num, &args) )
+        {
+            if ( args.np != smmu->node || args.args_count != 1 )
+                break;
+            num++;
+        }
+
+        if ( !num )
+            continue;
+
+        if ( dt_to_dev(np)->archdata.iommu )
+        {
+            printk(XENLOG_ERR "smmu-v3: %s: master behind more than one IOMMU\n",
+                   dt_node_full_name(np));
+            continue;
+        }
+
+        master = _xzalloc(offsetof(struct arm_smmu_master, sids[num]),
+                          __alignof__(struct arm_smmu_master));
+        if ( !master )
+        {
+            printk(XENLOG_ERR "smmu-v3: %s: out of memory\n",
+                   dt_node_full_name(np));
+            continue;
+        }
+
+        INIT_LIST_HEAD(&master->list);
+        master->smmu = smmu;
+        master->num_sids = num;
+
+        for ( i = 0; i < num && !ret; i++ )
+        {
+            dt_parse_phandle_with_args(np, "iommus", "#iommu-cells", i, &args);
+            master->sids[i] = args.args[0];
+
+            if ( master->sids[i] >= (1U << smmu->sid_bits) )
+                ret = -ERANGE;
+            else if ( smmu->strtab_l2 )
+                ret = arm_smmu_init_l2_strtab(smmu, master->sids[i]);
+        }
+
+        if ( ret )
+        {
+            printk(XENLOG_ERR "smmu-v3: %s: cannot use SID 0x%x (%d)\n",
+                   dt_node_full_name(np), master->sids[i - 1], ret);
+            xfree(master);
+            continue;
+        }
+
+        dt_to_dev(np)->archdata.iommu = master;
+        dt_device_set_protected(np);
+    }
+}
+
+static int arm_smmu_device_probe(struct dt_device_node *node)
+{
+    struct arm_smmu_device *smmu;
+    uint64_t addr, size;
+    int ret;
+
+    smmu = xzalloc(struct arm_smmu_device);
+    if ( !smmu )
+        return -ENOMEM;
+
+    smmu->node = node;
+    spin_lock_init(&smmu->cmdq_lock);
+
+    ret = dt_device_get_address(node, 0, &addr, &size);
+    if ( ret || size < ARM_SMMU_REG_SZ )
+    {
+        printk(XENLOG_ERR "smmu-v3: %s: invalid MMIO region\n",
+               dt_node_full_name(node));
+        ret = -EINVAL;
+        goto out_free;
+    }
+
+    smmu->base = ioremap_nocache(addr, ARM_SMMU_REG_SZ);
+    if ( !smmu->base )
+    {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    ret = arm_smmu_device_hw_probe(smmu);
+    if ( ret )
+        goto out_unmap;
+
+    ret = queue_init(smmu, &smmu->cmdq, CMDQ_MAX_SZ_SHIFT, CMDQ_ENT_DWORDS,
+                     ARM_SMMU_CMDQ_PROD, ARM_SMMU_CMDQ_CONS);
+    if ( ret )
+        goto out_unmap;
+
+    ret = queue_init(smmu, &smmu->evtq, EVTQ_MAX_SZ_SHIFT, EVTQ_ENT_DWORDS,
+                     ARM_SMMU_EVTQ_PROD, ARM_SMMU_EVTQ_CONS);
+    if ( ret )
+        goto out_unmap;
+
+    ret = arm_smmu_init_strtab(smmu);
+    if ( ret )
+        goto out_unmap;
+
+    ret = arm_smmu_device_reset(smmu);
+    if ( ret )
+    {
+        /* Leave the SMMU disabled, as it might be using the tables. */
+        arm_smmu_write_reg_sync(smmu, 0, ARM_SMMU_CR0, ARM_SMMU_CR0ACK);
+        goto out_unmap;
+    }
+
+    /* The level 2 stream tables can be added with the SMMU running. */
+    arm_smmu_find_masters(smmu);
+
+    list_add_tail(&smmu->list, &arm_smmu_devices);
+    platform_features &= smmu->features;
+
+    return 0;
+
+ out_unmap:
+    iounmap(smmu->base);
+    xfree(smmu->strtab);
+    xfree(smmu->strtab_l2);
+    xfree(smmu->evtq.base);
+    xfree(smmu->cmdq.base);
+ out_free:
+    xfree(smmu);
+
+    return ret;
+}
+
+/* IOMMU operations */
+static bool arm_smmu_domain_uses(struct arm_smmu_domain *smmu_domain,
+                                 const struct arm_smmu_device *smmu)
+{
+    const struct arm_smmu_master *master;
+    bool used = false;
+
+    spin_lock(&smmu_domain->lock);
+    list_for_each_entry(master, &smmu_domain->masters, list)
+    {
+        if ( master->smmu == smmu )
+        {
+            used = true;
+            break;
+        }
+    }
+    spin_unlock(&smmu_domain->lock);
+
+    return used;
+}
+
+static int __must_check arm_smmu_iotlb_flush_all(struct domain *d)
+{
+    struct arm_smmu_domain *smmu_domain = dom_iommu(d)->arch.priv;
+    struct arm_smmu_device *smmu;
+    int ret = 0, rc;
+
+    list_for_each_entry(smmu, &arm_smmu_devices, list)
+    {
+        if ( !arm_smmu_domain_uses(smmu_domain, smmu) )
+            continue;
+
+        rc = arm_smmu_tlb_inv_vmid(smmu, d->arch.p2m.vmid);
+        if ( !ret )
+            ret = rc;
+    }
+
+    return ret;
+}
+
+static int __must_check arm_smmu_iotlb_flush(struct domain *d,
+                                             unsigned long gfn,
+                                             unsigned int page_count)
+{
+    struct arm_smmu_domain *smmu_domain = dom_iommu(d)->arch.priv;
+    struct arm_smmu_device *smmu;
+    int ret = 0, rc;
+
+    list_for_each_entry(smmu, &arm_smmu_devices, list)
+    {
+        if ( !arm_smmu_domain_uses(smmu_domain, smmu) )
+            continue;
+
+        rc = arm_smmu_tlb_inv_range(smmu, d->arch.p2m.vmid, gfn, page_count);
+        if ( !ret )
+            ret = rc;
+    }
+
+    return ret;
+}
+
+static int arm_smmu_attach_master(struct domain *d,
+                                  struct arm_smmu_master *master)
+{
+    unsigned int i;
+    int ret = 0;
+
+    for ( i = 0; i < master->num_sids && !ret; i++ )
+        ret = arm_smmu_write_ste(master->smmu, master->sids[i], d);
+
+    return ret;
+}
+
+static int arm_smmu_detach_master(struct domain *d,
+                                  struct arm_smmu_master *master)
+{
+    unsigned int i;
+    int ret = 0, rc;
+
+    for ( i = 0; i < master->num_sids; i++ )
+    {
+        rc = arm_smmu_write_ste(master->smmu, master->sids[i], NULL);
+        if ( !ret )
+            ret = rc;
+    }
+
+    /* The VMID is going to be reused by another domain at some point. */
+    rc = arm_smmu_tlb_inv_vmid(master->smmu, d->arch.p2m.vmid);
+
+    return ret ?: rc;
+}
+
+static int arm_smmu_assign_dev(struct domain *d, u8 devfn,
+                               struct device *dev, u32 flag)
+{
+    struct arm_smmu_domain *smmu_domain = dom_iommu(d)->arch.priv;
+    struct arm_smmu_master *master = dev->archdata.iommu;
+    int ret;
+
+    if ( !master )
+        return -ENODEV;
+
+    spin_lock(&smmu_domain->lock);
+
+    if ( master->domain )
+    {
+        ret = -EBUSY;
+        goto out;
+    }
+
+    ret = arm_smmu_attach_master(d, master);
+    if ( ret )
+    {
+        arm_smmu_detach_master(d, master);
+        goto out;
+    }
+
+    master->domain = d;
+    list_add(&master->list, &smmu_domain->masters);
+
+ out:
+    spin_unlock(&smmu_domain->lock);
+
+    return ret;
+}
+
+static int arm_smmu_deassign_dev(struct domain *d, struct device *dev)
+{
+    struct arm_smmu_domain *smmu_domain = dom_iommu(d)->arch.priv;
+    struct arm_smmu_master *master = dev->archdata.iommu;
+    int ret;
+
+    if ( !master || master->domain != d )
+    {
+        printk(XENLOG_ERR "smmu-v3: %s: not attached to domain %d\n",
+               dt_node_full_name(dev_to_dt(dev)), d->domain_id);
+        return -ESRCH;
+    }
+
+    spin_lock(&smmu_domain->lock);
+
+    ret = arm_smmu_detach_master(d, master);
+    list_del_init(&master->list);
+    master->domain = NULL;
+
+    spin_unlock(&smmu_domain->lock);
+
+    return ret;
+}
+
+static int arm_smmu_reassign_dev(struct domain *s, struct domain *t,
+                                 u8 devfn, struct device *dev)
+{
+    int ret;
+
+    /* Don't allow remapping on other domain than hwdom */
+    if ( t && t != hardware_domain )
+        return -EPERM;
+
+    if ( t == s )
+        return 0;
+
+    ret = arm_smmu_deassign_dev(s, dev);
+    if ( ret )
+        return ret;
+
+    if ( t )
+    {
+        /* No flags are defined for ARM. */
+        ret = arm_smmu_assign_dev(t, devfn, dev, 0);
+        if ( ret )
+            return ret;
+    }
+
+    return 0;
+}
+
+static int arm_smmu_iommu_domain_init(struct domain *d)
+{
+    struct arm_smmu_domain *smmu_domain;
+
+    smmu_domain = xzalloc(struct arm_smmu_domain);
+    if ( !smmu_domain )
+        return -ENOMEM;
+
+    spin_lock_init(&smmu_domain->lock);
+    INIT_LIST_HEAD(&smmu_domain->masters);
+
+    dom_iommu(d)->arch.priv = smmu_domain;
+
+    /* Coherent walk can be enabled only when all SMMUs support it. */
+    if ( platform_features & ARM_SMMU_FEAT_COHERENCY )
+        iommu_set_feature(d, IOMMU_FEAT_COHERENT_WALK);
+
+    return 0;
+}
+
+static void __hwdom_init arm_smmu_iommu_hwdom_init(struct domain *d)
+{
+}
+
+static void arm_smmu_iommu_domain_teardown(struct domain *d)
+{
+    struct arm_smmu_domain *smmu_domain = dom_iommu(d)->arch.priv;
+
+    ASSERT(list_empty(&smmu_domain->masters));
+    xfree(smmu_domain);
+}
+
+static int __must_check arm_smmu_map_page(struct domain *d, unsigned long gfn,
+                                          unsigned long mfn,
+                                          unsigned int flags)
+{
+    p2m_type_t t;
+
+    /*
+     * Grant mappings can be used for DMA requests. The dev_bus_addr
+     * returned by the hypercall is the MFN (not the IPA). For device
+     * protected by an IOMMU, Xen needs to add a 1:1 mapping in the domain
+     * p2m to allow DMA request to work.
+     * This is only valid when the domain is directed mapped. Hence this
+     * function should only be used by gnttab code with gfn == mfn.
+     */
+    BUG_ON(!is_domain_direct_mapped(d));
+    BUG_ON(mfn != gfn);
+
+    /* We only support readable and writable flags */
+    if ( !(flags & (IOMMUF_readable | IOMMUF_writable)) )
+        return -EINVAL;
+
+    t = (flags & IOMMUF_writable) ? p2m_iommu_map_rw : p2m_iommu_map_ro;
+
+    /*
+     * The function guest_physmap_add_entry replaces the current mapping
+     * if there is already one...
+     */
+    return guest_physmap_add_entry(d, _gfn(gfn), _mfn(mfn), 0, t);
+}
+
+static int __must_check arm_smmu_unmap_page(struct domain *d,
+                                            unsigned long gfn)
+{
+    /*
+     * This function should only be used by gnttab code when the domain
+     * is direct mapped
+     */
+    if ( !is_domain_direct_mapped(d) )
+        return -EINVAL;
+
+    guest_physmap_remove_page(d, _gfn(gfn), _mfn(gfn), 0);
+
+    return 0;
+}
+
+static const struct iommu_ops arm_smmu_iommu_ops = {
+    .init = arm_smmu_iommu_domain_init,
+    .hwdom_init = arm_smmu_iommu_hwdom_init,
+    .teardown = arm_smmu_iommu_domain_teardown,
+    .iotlb_flush = arm_smmu_iotlb_flush,
+    .iotlb_flush_all = arm_smmu_iotlb_flush_all,
+    .assign_device = arm_smmu_assign_dev,
+    .reassign_device = arm_smmu_reassign_dev,
+    .map_page = arm_smmu_map_page,
+    .unmap_page = arm_smmu_unmap_page,
+};
+
+static __init int arm_smmu_dt_init(struct dt_device_node *dev,
+                                   const void *data)
+{
+    int rc;
+
+    /*
+     * Even if the device can't be initialized, we don't want to
+     * give the SMMU device to dom0.
+     */
+    dt_device_set_used_by(dev, DOMID_XEN);
+
+    rc = arm_smmu_device_probe(dev);
+    if ( rc )
+        return rc;
+
+    iommu_set_ops(&arm_smmu_iommu_ops);
+
+    return 0;
+}
+
+static const struct dt_device_match arm_smmu_dt_match[] __initconst =
+{
+    DT_MATCH_COMPATIBLE("arm,smmu-v3"),
+    { /* sentinel */ },
+};
+
+DT_DEVICE_START(smmuv3, "ARM SMMU V3", DEVICE_IOMMU)
+    .dt_match = arm_smmu_dt_match,
+    .init = arm_smmu_dt_init,
+DT_DEVICE_END
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
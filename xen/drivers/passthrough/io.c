@@ -436,9 +436,13 @@ int pt_irq_create_bind(
 
         dest_vcpu_id = hvm_girq_dest_2_vcpu_id(d, dest, dest_mode);
         pirq_dpci->gmsi.dest_vcpu_id = dest_vcpu_id;
-        spin_unlock(&d->event_lock);
+        /*
+         * Only this pirq's destination changed, so don't walk all of the
+         * domain's pirqs: guests rebalance their vectors one at a time.
+         */
         if ( dest_vcpu_id >= 0 )
-            hvm_migrate_pirqs(d->vcpu[dest_vcpu_id]);
+            hvm_migrate_pirq(pirq_dpci, d->vcpu[dest_vcpu_id]);
+        spin_unlock(&d->event_lock);
 
         /* Use interrupt posting if it is supported. */
         if ( iommu_intpost )
@@ -917,6 +921,17 @@ static void dpci_softirq(void)
         struct hvm_pirq_dpci *pirq_dpci;
         struct domain *d;
 
+        /* Leave the rest for the next round, behind timers and scheduling. */
+        if ( softirq_over_budget() )
+        {
+            local_irq_disable();
+            list_splice_init(&this_cpu(dpci_list), our_list.prev);
+            list_splice_init(&our_list, &this_cpu(dpci_list));
+            local_irq_enable();
+            raise_softirq(HVM_DPCI_SOFTIRQ);
+            break;
+        }
+
         pirq_dpci = list_entry(our_list.next, struct hvm_pirq_dpci, softirq_list);
         list_del(&pirq_dpci->softirq_list);
 
@@ -297,6 +297,110 @@ int iommu_unmap_page(struct domain *d, unsigned long gfn)
     return rc;
 }
 
+int iommu_map_pages(struct domain *d, unsigned long gfn, unsigned long mfn,
+                    unsigned int order, unsigned int flags)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    bool_t flush = !this_cpu(iommu_dont_flush_iotlb);
+    unsigned long i;
+    int rc = 0;
+
+    if ( !iommu_enabled || !hd->platform_ops )
+        return 0;
+
+    if ( hd->platform_ops->map_pages )
+        rc = hd->platform_ops->map_pages(d, gfn, mfn, order, flags);
+    else
+    {
+        this_cpu(iommu_dont_flush_iotlb) = 1;
+
+        for ( i = 0; i < (1UL << order); i++ )
+        {
+            rc = hd->platform_ops->map_page(d, gfn + i, mfn + i, flags);
+            if ( unlikely(rc) )
+            {
+                while ( i-- )
+                    /* If statement to satisfy __must_check. */
+                    if ( hd->platform_ops->unmap_page(d, gfn + i) )
+                        continue;
+                break;
+            }
+        }
+
+        this_cpu(iommu_dont_flush_iotlb) = !flush;
+
+        if ( flush )
+        {
+            int err = iommu_iotlb_flush(d, gfn, 1u << order);
+
+            if ( !rc )
+                rc = err;
+        }
+    }
+
+    if ( unlikely(rc) )
+    {
+        if ( !d->is_shutting_down && printk_ratelimit() )
+            printk(XENLOG_ERR
+                   "d%d: IOMMU mapping gfn %#lx to mfn %#lx order %u failed: %d\n",
+                   d->domain_id, gfn, mfn, order, rc);
+
+        if ( !is_hardware_domain(d) )
+            domain_crash(d);
+    }
+
+    return rc;
+}
+
+int iommu_unmap_pages(struct domain *d, unsigned long gfn, unsigned int order)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    bool_t flush = !this_cpu(iommu_dont_flush_iotlb);
+    unsigned long i;
+    int rc = 0;
+
+    if ( !iommu_enabled || !hd->platform_ops )
+        return 0;
+
+    if ( hd->platform_ops->unmap_pages )
+        rc = hd->platform_ops->unmap_pages(d, gfn, order);
+    else
+    {
+        this_cpu(iommu_dont_flush_iotlb) = 1;
+
+        for ( i = 0; i < (1UL << order); i++ )
+        {
+            int err = hd->platform_ops->unmap_page(d, gfn + i);
+
+            if ( !rc )
+                rc = err;
+        }
+
+        this_cpu(iommu_dont_flush_iotlb) = !flush;
+
+        if ( flush )
+        {
+            int err = iommu_iotlb_flush(d, gfn, 1u << order);
+
+            if ( !rc )
+                rc = err;
+        }
+    }
+
+    if ( unlikely(rc) )
+    {
+        if ( !d->is_shutting_down && printk_ratelimit() )
+            printk(XENLOG_ERR
+                   "d%d: IOMMU unmapping gfn %#lx order %u failed: %d\n",
+                   d->domain_id, gfn, order, rc);
+
+        if ( !is_hardware_domain(d) )
+            domain_crash(d);
+    }
+
+    return rc;
+}
+
 static void iommu_free_pagetables(unsigned long unused)
 {
     do {
@@ -398,7 +502,7 @@ int __init iommu_setup(void)
                iommu_passthrough ? "Passthrough" :
                iommu_dom0_strict ? "Strict" : "Relaxed");
         printk("Interrupt remapping %sabled\n", iommu_intremap ? "en" : "dis");
-        tasklet_init(&iommu_pt_cleanup_tasklet, iommu_free_pagetables, 0);
+        idle_tasklet_init(&iommu_pt_cleanup_tasklet, iommu_free_pagetables, 0);
     }
 
     return rc;
@@ -1365,15 +1365,19 @@ static int assign_device(struct domain *d, u16 seg, u8 bus, u8 devfn, u32 flag)
              p2m_get_hostp2m(d)->global_logdirty)) )
         return -EXDEV;
 
-    if ( !pcidevs_trylock() )
-        return -ERESTART;
-
+    /*
+     * Populating the IOMMU page tables for the first device can take long
+     * (it is preemptible, and flushes the IOTLB at the end).  It only needs
+     * serialising against other assignments to this domain, which the
+     * domctl lock already does, so do it before taking pcidevs_lock
+     * rather than stalling PCI and MSI operations of every other domain.
+     */
     rc = iommu_construct(d);
     if ( rc )
-    {
-        pcidevs_unlock();
         return rc;
-    }
+
+    if ( !pcidevs_trylock() )
+        return -ERESTART;
 
     pdev = pci_get_pdev_by_domain(hardware_domain, seg, bus, devfn);
     if ( !pdev )
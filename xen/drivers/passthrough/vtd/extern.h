@@ -64,6 +64,27 @@ int __must_check qinval_device_iotlb_sync(struct iommu *iommu,
                                           struct pci_dev *pdev,
                                           u16 did, u16 size, u64 addr);
 
+/*
+ * Batched queued invalidation: the qinval_queue_*() functions add a
+ * descriptor, submitting the batch first if it is full, and
+ * qinval_batch_flush() submits what is left behind a single wait.
+ */
+void qinval_batch_init(struct qinval_batch *batch, struct iommu *iommu);
+int __must_check qinval_batch_flush(struct qinval_batch *batch);
+int __must_check qinval_queue_context(struct qinval_batch *batch, u16 did,
+                                      u16 source_id, u8 function_mask,
+                                      u8 granu);
+int __must_check qinval_queue_iotlb(struct qinval_batch *batch, u8 granu,
+                                    u8 dr, u8 dw, u16 did, u8 am, u8 ih,
+                                    u64 addr);
+int __must_check qinval_queue_iec(struct qinval_batch *batch, u8 granu,
+                                  u8 im, u16 iidx);
+int __must_check qinval_queue_device_iotlb(struct qinval_batch *batch,
+                                           struct pci_dev *pdev, u16 did,
+                                           u16 size, u64 addr);
+/* Like qinval_batch_flush(), but also drains interrupt entry cache flushes. */
+int __must_check qinval_batch_flush_iec(struct qinval_batch *batch);
+
 unsigned int get_cache_line_size(void);
 void cacheline_flush(char *);
 void flush_all_cache(void);
@@ -88,6 +109,8 @@ void msi_msg_read_remap_rte(struct msi_desc *, struct msi_msg *);
 int msi_msg_write_remap_rte(struct msi_desc *, struct msi_msg *);
 
 int intel_setup_hpet_msi(struct msi_desc *);
+int intel_pi_update_irte(const struct vcpu *v, const struct pirq *pirq,
+                         uint8_t gvec);
 
 int is_igd_vt_enabled_quirk(void);
 void platform_quirks_init(void);
@@ -169,26 +169,81 @@ bool_t __init iommu_supports_eim(void)
     return 1;
 }
 
+/*
+ * Update a live IRTE such that the IOMMU never sees it half written, and
+ * flush it from the CPU cache.  Returns whether anything changed, i.e.
+ * whether the caller needs to invalidate the interrupt entry cache.
+ */
+static bool_t update_irte(struct iommu *iommu, struct iremap_entry *entry,
+                          const struct iremap_entry *new_ire)
+{
+    ASSERT(spin_is_locked(&iommu_ir_ctrl(iommu)->iremap_lock));
+
+    if ( entry->val == new_ire->val )
+        return 0;
+
+    if ( cpu_has_cx16 )
+    {
+        struct iremap_entry old_ire = *entry;
+        __uint128_t ret = cmpxchg16b(entry, &old_ire, new_ire);
+
+        /*
+         * The hardware doesn't update IRTEs behind us, and we hold
+         * iremap_lock, so the exchange can't fail.
+         */
+        ASSERT(ret == old_ire.val);
+    }
+    else if ( entry->lo == new_ire->lo )
+        write_atomic(&entry->hi, new_ire->hi);
+    else if ( entry->hi == new_ire->hi )
+        write_atomic(&entry->lo, new_ire->lo);
+    else if ( new_ire->remap.p )
+    {
+        /*
+         * Both halves change only when the source-id does, i.e. when the
+         * entry is first set up.  Write the half holding the present bit
+         * last.
+         */
+        write_atomic(&entry->hi, new_ire->hi);
+        smp_wmb();
+        write_atomic(&entry->lo, new_ire->lo);
+    }
+    else
+    {
+        write_atomic(&entry->lo, new_ire->lo);
+        smp_wmb();
+        write_atomic(&entry->hi, new_ire->hi);
+    }
+
+    iommu_flush_cache_entry(entry, sizeof(*entry));
+
+    return 1;
+}
+
 /* Mark specified intr remap entry as free */
-static void free_remap_entry(struct iommu *iommu, int index)
+static int free_remap_entry(struct iommu *iommu, struct qinval_batch *batch,
+                            int index)
 {
     struct iremap_entry *iremap_entry = NULL, *iremap_entries;
+    struct iremap_entry new_ire = { };
     struct ir_ctrl *ir_ctrl = iommu_ir_ctrl(iommu);
+    int rc = 0;
 
     if ( index < 0 || index > IREMAP_ENTRY_NR - 1 )
-        return;
+        return 0;
 
     ASSERT( spin_is_locked(&ir_ctrl->iremap_lock) );
 
     GET_IREMAP_ENTRY(ir_ctrl->iremap_maddr, index,
                      iremap_entries, iremap_entry);
 
-    memset(iremap_entry, 0, sizeof(struct iremap_entry));
-    iommu_flush_cache_entry(iremap_entry, sizeof(struct iremap_entry));
-    iommu_flush_iec_index(iommu, 0, index);
+    if ( update_irte(iommu, iremap_entry, &new_ire) )
+        rc = qinval_queue_iec(batch, IEC_INDEX_INVL, 0, index);
 
     unmap_vtd_domain_page(iremap_entries);
     ir_ctrl->iremap_num--;
+
+    return rc;
 }
 
 /*
@@ -353,9 +408,8 @@ static int ioapic_rte_to_remap_entry(struct iommu *iommu,
         remap_rte->format = 1;    /* indicate remap format */
     }
 
-    memcpy(iremap_entry, &new_ire, sizeof(struct iremap_entry));
-    iommu_flush_cache_entry(iremap_entry, sizeof(struct iremap_entry));
-    iommu_flush_iec_index(iommu, 0, index);
+    if ( update_irte(iommu, iremap_entry, &new_ire) )
+        iommu_flush_iec_index(iommu, 0, index);
 
     unmap_vtd_domain_page(iremap_entries);
     spin_unlock_irqrestore(&ir_ctrl->iremap_lock, flags);
@@ -565,11 +619,22 @@ static int msi_msg_to_remap_entry(
 
     if ( msg == NULL )
     {
-        /* Free specified unused IRTEs */
+        struct qinval_batch batch;
+        int rc = 0;
+
+        /* Free specified unused IRTEs, with a single wait for the flushes. */
+        qinval_batch_init(&batch, iommu);
         for ( i = 0; i < nr; ++i )
-            free_remap_entry(iommu, msi_desc->remap_index + i);
+        {
+            int ret = free_remap_entry(iommu, &batch,
+                                       msi_desc->remap_index + i);
+
+            if ( !rc )
+                rc = ret;
+        }
+        rc = qinval_batch_flush_iec(&batch) ?: rc;
         spin_unlock_irqrestore(&ir_ctrl->iremap_lock, flags);
-        return 0;
+        return rc;
     }
 
     if ( msi_desc->remap_index < 0 )
@@ -637,9 +702,8 @@ static int msi_msg_to_remap_entry(
     remap_rte->address_hi = 0;
     remap_rte->data = index - i;
 
-    memcpy(iremap_entry, &new_ire, sizeof(struct iremap_entry));
-    iommu_flush_cache_entry(iremap_entry, sizeof(struct iremap_entry));
-    iommu_flush_iec_index(iommu, 0, index);
+    if ( update_irte(iommu, iremap_entry, &new_ire) )
+        iommu_flush_iec_index(iommu, 0, index);
 
     unmap_vtd_domain_page(iremap_entries);
     spin_unlock_irqrestore(&ir_ctrl->iremap_lock, flags);
@@ -942,8 +1006,8 @@ static void setup_posted_irte(
  * This function is used to update the IRTE for posted-interrupt
  * when guest changes MSI/MSI-X information.
  */
-int pi_update_irte(const struct vcpu *v, const struct pirq *pirq,
-    const uint8_t gvec)
+int intel_pi_update_irte(const struct vcpu *v, const struct pirq *pirq,
+    uint8_t gvec)
 {
     struct irq_desc *desc;
     const struct msi_desc *msi_desc;
@@ -954,9 +1018,8 @@ int pi_update_irte(const struct vcpu *v, const struct pirq *pirq,
     struct iommu *iommu;
     struct ir_ctrl *ir_ctrl;
     struct iremap_entry *iremap_entries = NULL, *p = NULL;
-    struct iremap_entry new_ire, old_ire;
+    struct iremap_entry new_ire;
     const struct pi_desc *pi_desc = &v->arch.hvm_vmx.pi_desc;
-    __uint128_t ret;
 
     desc = pirq_spin_lock_irq_desc(pirq, NULL);
     if ( !desc )
@@ -1000,21 +1063,14 @@ int pi_update_irte(const struct vcpu *v, const struct pirq *pirq,
 
     GET_IREMAP_ENTRY(ir_ctrl->iremap_maddr, remap_index, iremap_entries, p);
 
-    old_ire = *p;
-
-    /* Setup/Update interrupt remapping table entry. */
-    setup_posted_irte(&new_ire, &old_ire, pi_desc, gvec);
-    ret = cmpxchg16b(p, &old_ire, &new_ire);
-
     /*
-     * In the above, we use cmpxchg16 to atomically update the 128-bit IRTE,
-     * and the hardware cannot update the IRTE behind us, so the return value
-     * of cmpxchg16 should be the same as old_ire. This ASSERT validate it.
+     * Setup/Update interrupt remapping table entry.  Guests rebalancing
+     * their interrupts often rebind to the same vCPU and vector, in which
+     * case there is nothing to flush.
      */
-    ASSERT(ret == old_ire.val);
-
-    iommu_flush_cache_entry(p, sizeof(*p));
-    iommu_flush_iec_index(iommu, 0, remap_index);
+    setup_posted_irte(&new_ire, p, pi_desc, gvec);
+    if ( update_irte(iommu, p, &new_ire) )
+        iommu_flush_iec_index(iommu, 0, remap_index);
 
     unmap_vtd_domain_page(iremap_entries);
 
@@ -593,6 +593,7 @@ static int __must_check iommu_flush_iotlb(struct domain *d,
     struct acpi_drhd_unit *drhd;
     struct iommu *iommu;
     bool_t flush_dev_iotlb;
+    unsigned int order = get_order_from_pages(page_count);
     int iommu_domid;
     int rc = 0;
 
@@ -612,13 +613,18 @@ static int __must_check iommu_flush_iotlb(struct domain *d,
         if ( iommu_domid == -1 )
             continue;
 
-        if ( page_count != 1 || gfn == gfn_x(INVALID_GFN) )
+        /*
+         * Ranges within one naturally aligned block can use a single page
+         * selective flush of that block.
+         */
+        if ( page_count == 0 || gfn == gfn_x(INVALID_GFN) ||
+             (gfn >> order) != ((gfn + page_count - 1) >> order) )
             rc = iommu_flush_iotlb_dsi(iommu, iommu_domid,
                                        0, flush_dev_iotlb);
         else
             rc = iommu_flush_iotlb_psi(iommu, iommu_domid,
                                        (paddr_t)gfn << PAGE_SHIFT_4K,
-                                       PAGE_ORDER_4K,
+                                       order,
                                        !dma_old_pte_present,
                                        flush_dev_iotlb);
 
@@ -683,6 +689,53 @@ static int __must_check dma_pte_clear_one(struct domain *domain, u64 addr)
     return rc;
 }
 
+/* clear the page table entries of @nr pages from @gfn */
+static int __must_check dma_pte_clear_range(struct domain *domain,
+                                            unsigned long gfn,
+                                            unsigned long nr)
+{
+    struct domain_iommu *hd = dom_iommu(domain);
+    unsigned long i = 0;
+    bool_t cleared = 0;
+    int rc = 0;
+
+    spin_lock(&hd->arch.mapping_lock);
+
+    while ( i < nr )
+    {
+        unsigned int first = (gfn + i) & LEVEL_MASK, j;
+        struct dma_pte *page;
+        u64 pg_maddr;
+
+        pg_maddr = addr_to_dma_page_maddr(domain,
+                                          (paddr_t)(gfn + i) << PAGE_SHIFT_4K,
+                                          0);
+        if ( pg_maddr == 0 )
+        {
+            /* No last level table: nothing mapped up to its end. */
+            i += PTE_NUM - first;
+            continue;
+        }
+
+        page = map_vtd_domain_page(pg_maddr);
+        for ( j = first; j < PTE_NUM && i < nr; j++, i++ )
+            if ( dma_pte_present(page[j]) )
+            {
+                dma_clear_pte(page[j]);
+                cleared = 1;
+            }
+        iommu_flush_cache_entry(&page[first], (j - first) * sizeof(*page));
+        unmap_vtd_domain_page(page);
+    }
+
+    spin_unlock(&hd->arch.mapping_lock);
+
+    if ( cleared && !this_cpu(iommu_dont_flush_iotlb) )
+        rc = iommu_flush_iotlb_pages(domain, gfn, nr);
+
+    return rc;
+}
+
 static void iommu_free_pagetable(u64 pt_maddr, int level)
 {
     struct page_info *pg = maddr_to_page(pt_maddr);
@@ -1816,6 +1869,93 @@ static int __must_check intel_iommu_unmap_page(struct domain *d,
     return dma_pte_clear_one(d, (paddr_t)gfn << PAGE_SHIFT_4K);
 }
 
+/*
+ * Batched forms of the above: each last level table is looked up once and
+ * its entries written together, with one IOTLB flush for the whole range.
+ */
+static int __must_check intel_iommu_map_pages(struct domain *d,
+                                              unsigned long gfn,
+                                              unsigned long mfn,
+                                              unsigned int order,
+                                              unsigned int flags)
+{
+    struct domain_iommu *hd = dom_iommu(d);
+    unsigned long i = 0, nr = 1UL << order;
+    bool_t was_present = 0;
+    int rc = 0;
+
+    /* Do nothing if VT-d shares EPT page table */
+    if ( iommu_use_hap_pt(d) )
+        return 0;
+
+    /* Do nothing if hardware domain and iommu supports pass thru. */
+    if ( iommu_passthrough && is_hardware_domain(d) )
+        return 0;
+
+    spin_lock(&hd->arch.mapping_lock);
+
+    while ( i < nr )
+    {
+        struct dma_pte *page;
+        unsigned int first, j;
+        u64 pg_maddr;
+
+        pg_maddr = addr_to_dma_page_maddr(d,
+                                          (paddr_t)(gfn + i) << PAGE_SHIFT_4K,
+                                          1);
+        if ( pg_maddr == 0 )
+        {
+            rc = -ENOMEM;
+            break;
+        }
+
+        page = map_vtd_domain_page(pg_maddr);
+        first = (gfn + i) & LEVEL_MASK;
+        for ( j = first; j < PTE_NUM && i < nr; j++, i++ )
+        {
+            struct dma_pte new = { 0 };
+
+            dma_set_pte_addr(new, (paddr_t)(mfn + i) << PAGE_SHIFT_4K);
+            dma_set_pte_prot(new,
+                             ((flags & IOMMUF_readable) ? DMA_PTE_READ  : 0) |
+                             ((flags & IOMMUF_writable) ? DMA_PTE_WRITE : 0));
+            if ( iommu_snoop )
+                dma_set_pte_snp(new);
+
+            was_present |= dma_pte_present(page[j]);
+            page[j] = new;
+        }
+        iommu_flush_cache_entry(&page[first], (j - first) * sizeof(*page));
+        unmap_vtd_domain_page(page);
+    }
+
+    spin_unlock(&hd->arch.mapping_lock);
+
+    if ( unlikely(rc) )
+    {
+        /* Undo the part of the range already mapped. */
+        if ( i && dma_pte_clear_range(d, gfn, i) )
+            domain_crash(d);
+        return rc;
+    }
+
+    if ( !this_cpu(iommu_dont_flush_iotlb) )
+        rc = iommu_flush_iotlb(d, gfn, was_present, nr);
+
+    return rc;
+}
+
+static int __must_check intel_iommu_unmap_pages(struct domain *d,
+                                                unsigned long gfn,
+                                                unsigned int order)
+{
+    /* Do nothing if hardware domain and iommu supports pass thru. */
+    if ( iommu_passthrough && is_hardware_domain(d) )
+        return 0;
+
+    return dma_pte_clear_range(d, gfn, 1UL << order);
+}
+
 int iommu_pte_flush(struct domain *d, u64 gfn, u64 *pte,
                     int order, int present)
 {
@@ -1872,8 +2012,12 @@ static int __init vtd_ept_page_compatible(struct iommu *iommu)
     if ( rdmsr_safe(MSR_IA32_VMX_EPT_VPID_CAP, ept_cap) != 0 ) 
         return 0;
 
-    return (ept_has_2mb(ept_cap) && opt_hap_2mb) == cap_sps_2mb(vtd_cap) &&
-           (ept_has_1gb(ept_cap) && opt_hap_1gb) == cap_sps_1gb(vtd_cap);
+    /*
+     * Sharing only requires the IOMMU to cope with every superpage size
+     * EPT will use; larger IOMMU capabilities simply go unused.
+     */
+    return (!(ept_has_2mb(ept_cap) && opt_hap_2mb) || cap_sps_2mb(vtd_cap)) &&
+           (!(ept_has_1gb(ept_cap) && opt_hap_1gb) || cap_sps_1gb(vtd_cap));
 }
 
 /*
@@ -2639,6 +2783,8 @@ const struct iommu_ops intel_iommu_ops = {
     .teardown = iommu_domain_teardown,
     .map_page = intel_iommu_map_page,
     .unmap_page = intel_iommu_unmap_page,
+    .map_pages = intel_iommu_map_pages,
+    .unmap_pages = intel_iommu_unmap_pages,
     .free_page_table = iommu_free_page_table,
     .reassign_device = reassign_device_ownership,
     .get_device_group_id = intel_iommu_group_id,
@@ -2647,6 +2793,7 @@ const struct iommu_ops intel_iommu_ops = {
     .read_apic_from_ire = io_apic_read_remap_rte,
     .read_msi_from_ire = msi_msg_read_remap_rte,
     .setup_hpet_msi = intel_setup_hpet_msi,
+    .update_ire_posted = intel_pi_update_irte,
     .suspend = vtd_suspend,
     .resume = vtd_resume,
     .share_p2m = iommu_set_pgd,
@@ -505,6 +505,26 @@ extern struct list_head acpi_ioapic_units;
 
 struct qi_ctrl {
     u64 qinval_maddr;  /* queue invalidation page machine address */
+
+    /* Statistics, reported by the 'V' debug key. */
+    unsigned long nr_desc;       /* invalidation descriptors submitted */
+    unsigned long nr_wait;       /* wait descriptors, i.e. batches */
+    unsigned long nr_full;       /* times the queue was found full */
+    unsigned int max_depth;      /* deepest the queue has been seen */
+    s_time_t wait_total;         /* time spent waiting for completion */
+    s_time_t wait_max;
+};
+
+/* Descriptors gathered for submission behind a single wait descriptor. */
+#define QINVAL_BATCH_NR 16
+
+struct qinval_batch {
+    struct iommu *iommu;
+    unsigned int nr;
+    bool_t dev_iotlb;            /* contains device-IOTLB invalidations */
+    struct qinval_entry desc[QINVAL_BATCH_NR];
+    struct pci_dev *pdev[QINVAL_BATCH_NR];  /* for device-IOTLB ones */
+    u16 did[QINVAL_BATCH_NR];
 };
 
 struct ir_ctrl {
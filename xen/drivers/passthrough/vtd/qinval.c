@@ -31,7 +31,8 @@
 
 #define VTD_QI_TIMEOUT	1
 
-static int __must_check invalidate_sync(struct iommu *iommu);
+/* Upper bound on the number of pauses between polls of a wait status. */
+#define VTD_QI_POLL_MAX	128
 
 static void print_qi_regs(struct iommu *iommu)
 {
@@ -47,267 +48,348 @@ static void print_qi_regs(struct iommu *iommu)
     printk("DMAR_IQT_REG = %"PRIx64"\n", val);
 }
 
-static unsigned int qinval_next_index(struct iommu *iommu)
+static unsigned int qinval_head(struct iommu *iommu)
 {
-    u64 tail;
-
-    tail = dmar_readq(iommu->reg, DMAR_IQT_REG);
-    tail >>= QINVAL_INDEX_SHIFT;
-
-    /* (tail+1 == head) indicates a full queue, wait for HW */
-    while ( ( tail + 1 ) % QINVAL_ENTRY_NR ==
-            ( dmar_readq(iommu->reg, DMAR_IQH_REG) >> QINVAL_INDEX_SHIFT ) )
-        cpu_relax();
-
-    return tail;
+    return dmar_readq(iommu->reg, DMAR_IQH_REG) >> QINVAL_INDEX_SHIFT;
 }
 
-static void qinval_update_qtail(struct iommu *iommu, unsigned int index)
+static void qinval_update_qtail(struct iommu *iommu, unsigned int tail)
 {
-    u64 val;
-
     /* Need hold register lock when update tail */
     ASSERT( spin_is_locked(&iommu->register_lock) );
-    val = (index + 1) % QINVAL_ENTRY_NR;
-    dmar_writeq(iommu->reg, DMAR_IQT_REG, (val << QINVAL_INDEX_SHIFT));
+    dmar_writeq(iommu->reg, DMAR_IQT_REG, (u64)tail << QINVAL_INDEX_SHIFT);
 }
 
-static int __must_check queue_invalidate_context_sync(struct iommu *iommu,
-                                                      u16 did, u16 source_id,
-                                                      u8 function_mask,
-                                                      u8 granu)
+/*
+ * Copy @nr descriptors into the queue from @tail onwards, returning the new
+ * tail.  The hardware only sees them once the tail register is updated, so
+ * if the queue fills up what has been written so far is published first.
+ */
+static unsigned int qinval_post(struct iommu *iommu, unsigned int tail,
+                                const struct qinval_entry *desc,
+                                unsigned int nr)
 {
-    unsigned long flags;
-    unsigned int index;
-    u64 entry_base;
-    struct qinval_entry *qinval_entry, *qinval_entries;
+    struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+    struct qinval_entry *qinval_entries = NULL;
+    unsigned int head = qinval_head(iommu), page = ~0u, i;
 
-    spin_lock_irqsave(&iommu->register_lock, flags);
-    index = qinval_next_index(iommu);
-    entry_base = iommu_qi_ctrl(iommu)->qinval_maddr +
-                 ((index >> QINVAL_ENTRY_ORDER) << PAGE_SHIFT);
-    qinval_entries = map_vtd_domain_page(entry_base);
-    qinval_entry = &qinval_entries[index % (1 << QINVAL_ENTRY_ORDER)];
+    for ( i = 0; i < nr; i++ )
+    {
+        /* (tail+1 == head) indicates a full queue, wait for HW */
+        if ( (tail + 1) % QINVAL_ENTRY_NR == head )
+        {
+            qi_ctrl->nr_full++;
+            qinval_update_qtail(iommu, tail);
+            while ( (tail + 1) % QINVAL_ENTRY_NR ==
+                    (head = qinval_head(iommu)) )
+                cpu_relax();
+        }
 
-    qinval_entry->q.cc_inv_dsc.lo.type = TYPE_INVAL_CONTEXT;
-    qinval_entry->q.cc_inv_dsc.lo.granu = granu;
-    qinval_entry->q.cc_inv_dsc.lo.res_1 = 0;
-    qinval_entry->q.cc_inv_dsc.lo.did = did;
-    qinval_entry->q.cc_inv_dsc.lo.sid = source_id;
-    qinval_entry->q.cc_inv_dsc.lo.fm = function_mask;
-    qinval_entry->q.cc_inv_dsc.lo.res_2 = 0;
-    qinval_entry->q.cc_inv_dsc.hi.res = 0;
+        if ( (tail >> QINVAL_ENTRY_ORDER) != page )
+        {
+            if ( qinval_entries )
+                unmap_vtd_domain_page(qinval_entries);
+            page = tail >> QINVAL_ENTRY_ORDER;
+            qinval_entries = map_vtd_domain_page(qi_ctrl->qinval_maddr +
+                                                 ((u64)page << PAGE_SHIFT));
+        }
 
-    qinval_update_qtail(iommu, index);
-    spin_unlock_irqrestore(&iommu->register_lock, flags);
+        qinval_entries[tail % (1 << QINVAL_ENTRY_ORDER)] = desc[i];
+        tail = (tail + 1) % QINVAL_ENTRY_NR;
+    }
+
+    if ( qinval_entries )
+        unmap_vtd_domain_page(qinval_entries);
 
-    unmap_vtd_domain_page(qinval_entries);
+    i = (tail + QINVAL_ENTRY_NR - head) % QINVAL_ENTRY_NR;
+    if ( i > qi_ctrl->max_depth )
+        qi_ctrl->max_depth = i;
 
-    return invalidate_sync(iommu);
+    return tail;
 }
 
-static int __must_check queue_invalidate_iotlb_sync(struct iommu *iommu,
-                                                    u8 granu, u8 dr, u8 dw,
-                                                    u16 did, u8 am, u8 ih,
-                                                    u64 addr)
+/*
+ * Queue @nr descriptors followed by a single wait descriptor, and wait for
+ * the hardware to have processed all of them.
+ */
+static int __must_check qinval_submit(struct iommu *iommu,
+                                      const struct qinval_entry *desc,
+                                      unsigned int nr, bool_t flush_dev_iotlb)
 {
+    struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+    volatile u32 poll_slot = QINVAL_STAT_INIT;
+    struct qinval_entry wait = {};
+    unsigned int tail, spins = 1, i;
     unsigned long flags;
-    unsigned int index;
-    u64 entry_base;
-    struct qinval_entry *qinval_entry, *qinval_entries;
+    s_time_t start, timeout;
+
+    ASSERT(qi_ctrl->qinval_maddr);
+
+    /* Now we don't support interrupt method */
+    wait.q.inv_wait_dsc.lo.type = TYPE_INVAL_WAIT;
+    wait.q.inv_wait_dsc.lo.sw = 1;
+    wait.q.inv_wait_dsc.lo.fn = 1;
+    wait.q.inv_wait_dsc.lo.sdata = QINVAL_STAT_DONE;
+    wait.q.inv_wait_dsc.hi.saddr = virt_to_maddr(&poll_slot) >> 2;
 
     spin_lock_irqsave(&iommu->register_lock, flags);
-    index = qinval_next_index(iommu);
-    entry_base = iommu_qi_ctrl(iommu)->qinval_maddr +
-                 ((index >> QINVAL_ENTRY_ORDER) << PAGE_SHIFT);
-    qinval_entries = map_vtd_domain_page(entry_base);
-    qinval_entry = &qinval_entries[index % (1 << QINVAL_ENTRY_ORDER)];
+    tail = dmar_readq(iommu->reg, DMAR_IQT_REG) >> QINVAL_INDEX_SHIFT;
+    tail = qinval_post(iommu, tail, desc, nr);
+    tail = qinval_post(iommu, tail, &wait, 1);
+    qinval_update_qtail(iommu, tail);
+    qi_ctrl->nr_desc += nr;
+    qi_ctrl->nr_wait++;
+    spin_unlock_irqrestore(&iommu->register_lock, flags);
 
-    qinval_entry->q.iotlb_inv_dsc.lo.type = TYPE_INVAL_IOTLB;
-    qinval_entry->q.iotlb_inv_dsc.lo.granu = granu;
-    qinval_entry->q.iotlb_inv_dsc.lo.dr = dr;
-    qinval_entry->q.iotlb_inv_dsc.lo.dw = dw;
-    qinval_entry->q.iotlb_inv_dsc.lo.res_1 = 0;
-    qinval_entry->q.iotlb_inv_dsc.lo.did = did;
-    qinval_entry->q.iotlb_inv_dsc.lo.res_2 = 0;
+    /* In case all wait descriptor writes to same addr with same data */
+    start = NOW();
+    timeout = start + MILLISECS(flush_dev_iotlb ?
+                                iommu_dev_iotlb_timeout : VTD_QI_TIMEOUT);
 
-    qinval_entry->q.iotlb_inv_dsc.hi.am = am;
-    qinval_entry->q.iotlb_inv_dsc.hi.ih = ih;
-    qinval_entry->q.iotlb_inv_dsc.hi.res_1 = 0;
-    qinval_entry->q.iotlb_inv_dsc.hi.addr = addr >> PAGE_SHIFT_4K;
+    /*
+     * Callers may hold locks, so there's no blocking here.  Backing off
+     * between polls at least keeps the status line and the timer quiet
+     * while slow device-IOTLB invalidations complete.
+     */
+    while ( poll_slot != QINVAL_STAT_DONE )
+    {
+        if ( NOW() > timeout )
+        {
+            print_qi_regs(iommu);
+            printk(XENLOG_WARNING VTDPREFIX
+                   " Queue invalidate wait descriptor timed out\n");
+            return -ETIMEDOUT;
+        }
+        for ( i = 0; i < spins; i++ )
+            cpu_relax();
+        if ( spins < VTD_QI_POLL_MAX )
+            spins <<= 1;
+    }
 
-    unmap_vtd_domain_page(qinval_entries);
-    qinval_update_qtail(iommu, index);
-    spin_unlock_irqrestore(&iommu->register_lock, flags);
+    /* Updated without the lock, so only approximate. */
+    start = NOW() - start;
+    qi_ctrl->wait_total += start;
+    if ( start > qi_ctrl->wait_max )
+        qi_ctrl->wait_max = start;
 
-    return invalidate_sync(iommu);
+    return 0;
 }
 
-static int __must_check queue_invalidate_wait(struct iommu *iommu,
-                                              u8 iflag, u8 sw, u8 fn,
-                                              bool_t flush_dev_iotlb)
+void qinval_batch_init(struct qinval_batch *batch, struct iommu *iommu)
 {
-    volatile u32 poll_slot = QINVAL_STAT_INIT;
-    unsigned int index;
-    unsigned long flags;
-    u64 entry_base;
-    struct qinval_entry *qinval_entry, *qinval_entries;
+    batch->iommu = iommu;
+    batch->nr = 0;
+    batch->dev_iotlb = 0;
+}
 
-    spin_lock_irqsave(&iommu->register_lock, flags);
-    index = qinval_next_index(iommu);
-    entry_base = iommu_qi_ctrl(iommu)->qinval_maddr +
-                 ((index >> QINVAL_ENTRY_ORDER) << PAGE_SHIFT);
-    qinval_entries = map_vtd_domain_page(entry_base);
-    qinval_entry = &qinval_entries[index % (1 << QINVAL_ENTRY_ORDER)];
-
-    qinval_entry->q.inv_wait_dsc.lo.type = TYPE_INVAL_WAIT;
-    qinval_entry->q.inv_wait_dsc.lo.iflag = iflag;
-    qinval_entry->q.inv_wait_dsc.lo.sw = sw;
-    qinval_entry->q.inv_wait_dsc.lo.fn = fn;
-    qinval_entry->q.inv_wait_dsc.lo.res_1 = 0;
-    qinval_entry->q.inv_wait_dsc.lo.sdata = QINVAL_STAT_DONE;
-    qinval_entry->q.inv_wait_dsc.hi.res_1 = 0;
-    qinval_entry->q.inv_wait_dsc.hi.saddr = virt_to_maddr(&poll_slot) >> 2;
-
-    unmap_vtd_domain_page(qinval_entries);
-    qinval_update_qtail(iommu, index);
-    spin_unlock_irqrestore(&iommu->register_lock, flags);
+static int __must_check dev_invalidate_sync(struct iommu *iommu,
+                                            struct pci_dev *pdev, u16 did,
+                                            int rc)
+{
+    struct domain *d = NULL;
 
-    /* Now we don't support interrupt method */
-    if ( sw )
-    {
-        s_time_t timeout;
+    if ( rc != -ETIMEDOUT )
+        return rc;
 
-        /* In case all wait descriptor writes to same addr with same data */
-        timeout = NOW() + MILLISECS(flush_dev_iotlb ?
-                                    iommu_dev_iotlb_timeout : VTD_QI_TIMEOUT);
+    if ( test_bit(did, iommu->domid_bitmap) )
+        d = rcu_lock_domain_by_id(iommu->domid_map[did]);
 
-        while ( poll_slot != QINVAL_STAT_DONE )
-        {
-            if ( NOW() > timeout )
-            {
-                print_qi_regs(iommu);
-                printk(XENLOG_WARNING VTDPREFIX
-                       " Queue invalidate wait descriptor timed out\n");
-                return -ETIMEDOUT;
-            }
-            cpu_relax();
-        }
+    /*
+     * In case the domain has been freed or the IOMMU domid bitmap is
+     * not valid, the device no longer belongs to this domain.
+     */
+    if ( d == NULL )
+        return rc;
+
+    iommu_dev_iotlb_flush_timeout(d, pdev);
+    rcu_unlock_domain(d);
+
+    return rc;
+}
+
+int qinval_batch_flush(struct qinval_batch *batch)
+{
+    struct iommu *iommu = batch->iommu;
+    unsigned int i, nr = batch->nr;
+    int rc, ret;
+
+    if ( !nr )
         return 0;
+
+    batch->nr = 0;
+    rc = qinval_submit(iommu, batch->desc, nr, batch->dev_iotlb);
+    batch->dev_iotlb = 0;
+
+    if ( rc != -ETIMEDOUT )
+        return rc;
+
+    /*
+     * A timeout says nothing about which device failed to respond, so
+     * resubmit device-IOTLB invalidations one by one to find out.
+     */
+    for ( ret = 0, i = 0; i < nr; i++ )
+    {
+        if ( !batch->pdev[i] )
+            continue;
+
+        rc = qinval_submit(iommu, &batch->desc[i], 1, 1);
+        rc = dev_invalidate_sync(iommu, batch->pdev[i], batch->did[i], rc);
+        if ( !ret )
+            ret = rc;
     }
 
-    return -EOPNOTSUPP;
+    return ret ?: -ETIMEDOUT;
 }
 
-static int __must_check invalidate_sync(struct iommu *iommu)
+static struct qinval_entry *qinval_batch_next(struct qinval_batch *batch,
+                                              int *rc)
 {
-    struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+    struct qinval_entry *entry;
 
-    ASSERT(qi_ctrl->qinval_maddr);
+    *rc = 0;
+    if ( batch->nr == ARRAY_SIZE(batch->desc) )
+        *rc = qinval_batch_flush(batch);
+
+    entry = &batch->desc[batch->nr];
+    batch->pdev[batch->nr] = NULL;
+    batch->nr++;
+    memset(entry, 0, sizeof(*entry));
 
-    return queue_invalidate_wait(iommu, 0, 1, 1, 0);
+    return entry;
 }
 
-static int __must_check dev_invalidate_sync(struct iommu *iommu,
-                                            struct pci_dev *pdev, u16 did)
+int qinval_queue_context(struct qinval_batch *batch, u16 did, u16 source_id,
+                         u8 function_mask, u8 granu)
 {
-    struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
     int rc;
+    struct qinval_entry *qinval_entry = qinval_batch_next(batch, &rc);
 
-    ASSERT(qi_ctrl->qinval_maddr);
-    rc = queue_invalidate_wait(iommu, 0, 1, 1, 1);
-    if ( rc == -ETIMEDOUT )
-    {
-        struct domain *d = NULL;
+    qinval_entry->q.cc_inv_dsc.lo.type = TYPE_INVAL_CONTEXT;
+    qinval_entry->q.cc_inv_dsc.lo.granu = granu;
+    qinval_entry->q.cc_inv_dsc.lo.did = did;
+    qinval_entry->q.cc_inv_dsc.lo.sid = source_id;
+    qinval_entry->q.cc_inv_dsc.lo.fm = function_mask;
 
-        if ( test_bit(did, iommu->domid_bitmap) )
-            d = rcu_lock_domain_by_id(iommu->domid_map[did]);
+    return rc;
+}
 
-        /*
-         * In case the domain has been freed or the IOMMU domid bitmap is
-         * not valid, the device no longer belongs to this domain.
-         */
-        if ( d == NULL )
-            return rc;
+int qinval_queue_iotlb(struct qinval_batch *batch, u8 granu, u8 dr, u8 dw,
+                       u16 did, u8 am, u8 ih, u64 addr)
+{
+    int rc;
+    struct qinval_entry *qinval_entry = qinval_batch_next(batch, &rc);
 
-        iommu_dev_iotlb_flush_timeout(d, pdev);
-        rcu_unlock_domain(d);
-    }
+    qinval_entry->q.iotlb_inv_dsc.lo.type = TYPE_INVAL_IOTLB;
+    qinval_entry->q.iotlb_inv_dsc.lo.granu = granu;
+    qinval_entry->q.iotlb_inv_dsc.lo.dr = dr;
+    qinval_entry->q.iotlb_inv_dsc.lo.dw = dw;
+    qinval_entry->q.iotlb_inv_dsc.lo.did = did;
+
+    qinval_entry->q.iotlb_inv_dsc.hi.am = am;
+    qinval_entry->q.iotlb_inv_dsc.hi.ih = ih;
+    qinval_entry->q.iotlb_inv_dsc.hi.addr = addr >> PAGE_SHIFT_4K;
 
     return rc;
 }
 
-int qinval_device_iotlb_sync(struct iommu *iommu, struct pci_dev *pdev,
-                             u16 did, u16 size, u64 addr)
+int qinval_queue_iec(struct qinval_batch *batch, u8 granu, u8 im, u16 iidx)
 {
-    unsigned long flags;
-    unsigned int index;
-    u64 entry_base;
-    struct qinval_entry *qinval_entry, *qinval_entries;
+    int rc;
+    struct qinval_entry *qinval_entry = qinval_batch_next(batch, &rc);
+
+    qinval_entry->q.iec_inv_dsc.lo.type = TYPE_INVAL_IEC;
+    qinval_entry->q.iec_inv_dsc.lo.granu = granu;
+    qinval_entry->q.iec_inv_dsc.lo.im = im;
+    qinval_entry->q.iec_inv_dsc.lo.iidx = iidx;
+
+    return rc;
+}
+
+int qinval_queue_device_iotlb(struct qinval_batch *batch,
+                              struct pci_dev *pdev, u16 did, u16 size,
+                              u64 addr)
+{
+    int rc;
+    struct qinval_entry *qinval_entry = qinval_batch_next(batch, &rc);
 
     ASSERT(pdev);
-    spin_lock_irqsave(&iommu->register_lock, flags);
-    index = qinval_next_index(iommu);
-    entry_base = iommu_qi_ctrl(iommu)->qinval_maddr +
-                 ((index >> QINVAL_ENTRY_ORDER) << PAGE_SHIFT);
-    qinval_entries = map_vtd_domain_page(entry_base);
-    qinval_entry = &qinval_entries[index % (1 << QINVAL_ENTRY_ORDER)];
+    batch->pdev[batch->nr - 1] = pdev;
+    batch->did[batch->nr - 1] = did;
+    batch->dev_iotlb = 1;
 
     qinval_entry->q.dev_iotlb_inv_dsc.lo.type = TYPE_INVAL_DEVICE_IOTLB;
-    qinval_entry->q.dev_iotlb_inv_dsc.lo.res_1 = 0;
     qinval_entry->q.dev_iotlb_inv_dsc.lo.max_invs_pend = pdev->ats.queue_depth;
-    qinval_entry->q.dev_iotlb_inv_dsc.lo.res_2 = 0;
     qinval_entry->q.dev_iotlb_inv_dsc.lo.sid = PCI_BDF2(pdev->bus, pdev->devfn);
-    qinval_entry->q.dev_iotlb_inv_dsc.lo.res_3 = 0;
 
     qinval_entry->q.dev_iotlb_inv_dsc.hi.size = size;
-    qinval_entry->q.dev_iotlb_inv_dsc.hi.res_1 = 0;
     qinval_entry->q.dev_iotlb_inv_dsc.hi.addr = addr >> PAGE_SHIFT_4K;
 
-    unmap_vtd_domain_page(qinval_entries);
-    qinval_update_qtail(iommu, index);
-    spin_unlock_irqrestore(&iommu->register_lock, flags);
+    return rc;
+}
+
+static int __must_check queue_invalidate_context_sync(struct iommu *iommu,
+                                                      u16 did, u16 source_id,
+                                                      u8 function_mask,
+                                                      u8 granu)
+{
+    struct qinval_batch batch;
+    int rc;
+
+    qinval_batch_init(&batch, iommu);
+    rc = qinval_queue_context(&batch, did, source_id, function_mask, granu);
+
+    return qinval_batch_flush(&batch) ?: rc;
+}
+
+static int __must_check queue_invalidate_iotlb_sync(struct iommu *iommu,
+                                                    u8 granu, u8 dr, u8 dw,
+                                                    u16 did, u8 am, u8 ih,
+                                                    u64 addr)
+{
+    struct qinval_batch batch;
+    int rc;
+
+    qinval_batch_init(&batch, iommu);
+    rc = qinval_queue_iotlb(&batch, granu, dr, dw, did, am, ih, addr);
 
-    return dev_invalidate_sync(iommu, pdev, did);
+    return qinval_batch_flush(&batch) ?: rc;
+}
+
+int qinval_device_iotlb_sync(struct iommu *iommu, struct pci_dev *pdev,
+                             u16 did, u16 size, u64 addr)
+{
+    struct qinval_batch batch;
+    int rc;
+
+    qinval_batch_init(&batch, iommu);
+    rc = qinval_queue_device_iotlb(&batch, pdev, did, size, addr);
+
+    return qinval_batch_flush(&batch) ?: rc;
 }
 
 static int __must_check queue_invalidate_iec_sync(struct iommu *iommu,
                                                   u8 granu, u8 im, u16 iidx)
 {
-    unsigned long flags;
-    unsigned int index;
-    u64 entry_base;
-    struct qinval_entry *qinval_entry, *qinval_entries;
-    int ret;
-
-    spin_lock_irqsave(&iommu->register_lock, flags);
-    index = qinval_next_index(iommu);
-    entry_base = iommu_qi_ctrl(iommu)->qinval_maddr +
-                 ((index >> QINVAL_ENTRY_ORDER) << PAGE_SHIFT);
-    qinval_entries = map_vtd_domain_page(entry_base);
-    qinval_entry = &qinval_entries[index % (1 << QINVAL_ENTRY_ORDER)];
+    struct qinval_batch batch;
+    int rc;
 
-    qinval_entry->q.iec_inv_dsc.lo.type = TYPE_INVAL_IEC;
-    qinval_entry->q.iec_inv_dsc.lo.granu = granu;
-    qinval_entry->q.iec_inv_dsc.lo.res_1 = 0;
-    qinval_entry->q.iec_inv_dsc.lo.im = im;
-    qinval_entry->q.iec_inv_dsc.lo.iidx = iidx;
-    qinval_entry->q.iec_inv_dsc.lo.res_2 = 0;
-    qinval_entry->q.iec_inv_dsc.hi.res = 0;
+    qinval_batch_init(&batch, iommu);
+    rc = qinval_queue_iec(&batch, granu, im, iidx);
 
-    unmap_vtd_domain_page(qinval_entries);
-    qinval_update_qtail(iommu, index);
-    spin_unlock_irqrestore(&iommu->register_lock, flags);
+    return qinval_batch_flush_iec(&batch) ?: rc;
+}
 
-    ret = invalidate_sync(iommu);
+int qinval_batch_flush_iec(struct qinval_batch *batch)
+{
+    int rc = qinval_batch_flush(batch);
 
     /*
      * reading vt-d architecture register will ensure
      * draining happens in implementation independent way.
      */
-    (void)dmar_readq(iommu->reg, DMAR_CAP_REG);
+    (void)dmar_readq(batch->iommu->reg, DMAR_CAP_REG);
 
-    return ret;
+    return rc;
 }
 
 int iommu_flush_iec_global(struct iommu *iommu)
@@ -198,6 +198,19 @@ void vtd_dump_iommu_info(unsigned char key)
             ecap_queued_inval(iommu->ecap) ? "" : "not ",
            (status & DMA_GSTS_QIES) ? " and enabled" : "" );
 
+        if ( status & DMA_GSTS_QIES )
+        {
+            const struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+
+            printk("    %lu descriptors in %lu batches, max depth %u, "
+                   "queue full %lu times\n",
+                   qi_ctrl->nr_desc, qi_ctrl->nr_wait, qi_ctrl->max_depth,
+                   qi_ctrl->nr_full);
+            printk("    wait: avg %"PRI_stime"ns max %"PRI_stime"ns\n",
+                   qi_ctrl->nr_wait ? qi_ctrl->wait_total /
+                                      (s_time_t)qi_ctrl->nr_wait : 0,
+                   qi_ctrl->wait_max);
+        }
 
         printk("  Interrupt Remapping: %ssupported%s.\n",
             ecap_intr_remap(iommu->ecap) ? "" : "not ",
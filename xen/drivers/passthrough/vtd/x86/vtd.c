@@ -110,7 +110,9 @@ void hvm_dpci_isairq_eoi(struct domain *d, unsigned int isairq)
 
 void __hwdom_init vtd_set_hwdom_mapping(struct domain *d)
 {
-    unsigned long i, j, tmp, top;
+    unsigned long i, top, start = 0, nr = 0;
+    unsigned long tmp = 1 << (PAGE_SHIFT - PAGE_SHIFT_4K);
+    int rc = 0;
 
     BUG_ON(!is_hardware_domain(d));
 
@@ -118,8 +120,6 @@ void __hwdom_init vtd_set_hwdom_mapping(struct domain *d)
 
     for ( i = 0; i < top; i++ )
     {
-        int rc = 0;
-
         /*
          * Set up 1:1 mapping for dom0. Default to use only conventional RAM
          * areas and let RMRRs include needed reserved regions. When set, the
@@ -128,6 +128,9 @@ void __hwdom_init vtd_set_hwdom_mapping(struct domain *d)
          */
         unsigned long pfn = pdx_to_pfn(i);
 
+        if ( !(i & (0xfffff >> (PAGE_SHIFT - PAGE_SHIFT_4K))) )
+            process_pending_softirqs();
+
         if ( pfn > (0xffffffffUL >> PAGE_SHIFT) ?
              (!mfn_valid(pfn) ||
               !page_is_ram_type(pfn, RAM_TYPE_CONVENTIONAL)) :
@@ -140,22 +143,37 @@ void __hwdom_init vtd_set_hwdom_mapping(struct domain *d)
         if ( xen_in_range(pfn) )
             continue;
 
-        tmp = 1 << (PAGE_SHIFT - PAGE_SHIFT_4K);
-        for ( j = 0; j < tmp; j++ )
+        /*
+         * Gather contiguous frames, so that the mappings can be installed a
+         * whole last level table at a time.
+         */
+        if ( nr && pfn == start + nr )
         {
-            int ret = iommu_map_page(d, pfn * tmp + j, pfn * tmp + j,
-                                     IOMMUF_readable|IOMMUF_writable);
+            nr++;
+            continue;
+        }
+
+        if ( nr )
+        {
+            int ret = arch_iommu_hwdom_map_range(d, start * tmp, nr * tmp);
 
             if ( !rc )
-               rc = ret;
+                rc = ret;
         }
+        start = pfn;
+        nr = 1;
+    }
 
-        if ( rc )
-           printk(XENLOG_WARNING VTDPREFIX " d%d: IOMMU mapping failed: %d\n",
-                  d->domain_id, rc);
+    if ( nr )
+    {
+        int ret = arch_iommu_hwdom_map_range(d, start * tmp, nr * tmp);
 
-        if (!(i & (0xfffff >> (PAGE_SHIFT - PAGE_SHIFT_4K))))
-            process_pending_softirqs();
+        if ( !rc )
+            rc = ret;
     }
+
+    if ( rc )
+        printk(XENLOG_WARNING VTDPREFIX " d%d: IOMMU mapping failed: %d\n",
+               d->domain_id, rc);
 }
 
@@ -39,15 +39,39 @@ int __init iommu_setup_hpet_msi(struct msi_desc *msi)
     return ops->setup_hpet_msi ? ops->setup_hpet_msi(msi) : -ENODEV;
 }
 
+int pi_update_irte(const struct vcpu *v, const struct pirq *pirq,
+                   const uint8_t gvec)
+{
+    const struct iommu_ops *ops = iommu_get_ops();
+    return ops->update_ire_posted ? ops->update_ire_posted(v, pirq, gvec)
+                                  : -EOPNOTSUPP;
+}
+
 int arch_iommu_populate_page_table(struct domain *d)
 {
-    const struct domain_iommu *hd = dom_iommu(d);
+    struct domain_iommu *hd = dom_iommu(d);
     struct page_info *page;
     int rc = 0, n = 0;
 
     d->need_iommu = -1;
 
     this_cpu(iommu_dont_flush_iotlb) = 1;
+
+    /*
+     * Translated domains have their mappings constructed from the p2m in
+     * bulk, retaining superpages, rather than frame by frame.
+     */
+    if ( paging_mode_translate(d) )
+    {
+        if ( unlikely(d->is_dying) )
+            rc = -ESRCH;
+        else
+            rc = p2m_iommu_populate(d, &hd->arch.populate_gfn);
+        if ( rc != -ERESTART )
+            hd->arch.populate_gfn = 0;
+        goto done;
+    }
+
     spin_lock(&d->page_alloc_lock);
 
     if ( unlikely(d->is_dying) )
@@ -101,6 +125,8 @@ int arch_iommu_populate_page_table(struct domain *d)
     }
 
     spin_unlock(&d->page_alloc_lock);
+
+ done:
     this_cpu(iommu_dont_flush_iotlb) = 0;
 
     if ( !rc )
@@ -118,6 +144,44 @@ void __hwdom_init arch_iommu_check_autotranslated_hwdom(struct domain *d)
         panic("Presently, iommu must be enabled for PVH hardware domain\n");
 }
 
+/*
+ * Identity map [pfn, pfn + nr) for the hardware domain, in the largest
+ * naturally aligned chunks (up to 1Gb) the range allows.  The IOTLB is not
+ * flushed: the caller is expected to flush everything once when done.
+ */
+int __hwdom_init arch_iommu_hwdom_map_range(struct domain *d,
+                                            unsigned long pfn,
+                                            unsigned long nr)
+{
+    bool_t dont_flush = this_cpu(iommu_dont_flush_iotlb);
+    int rc = 0;
+
+    this_cpu(iommu_dont_flush_iotlb) = 1;
+
+    while ( nr )
+    {
+        unsigned int order = min(flsl(nr) - 1, PAGE_ORDER_1G);
+        int ret;
+
+        if ( pfn )
+            order = min(order, find_first_set_bit(pfn));
+
+        ret = iommu_map_pages(d, pfn, pfn, order,
+                              IOMMUF_readable|IOMMUF_writable);
+        if ( !rc )
+            rc = ret;
+
+        pfn += 1UL << order;
+        nr -= 1UL << order;
+
+        process_pending_softirqs();
+    }
+
+    this_cpu(iommu_dont_flush_iotlb) = dont_flush;
+
+    return rc;
+}
+
 int arch_iommu_domain_init(struct domain *d)
 {
     struct domain_iommu *hd = dom_iommu(d);
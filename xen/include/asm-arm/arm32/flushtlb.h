@@ -23,6 +23,19 @@ static inline void flush_tlb(void)
     isb();
 }
 
+/*
+ * Flush inner shareable TLBs for the guest physical range [ipa, ipa + size),
+ * current VMID only.
+ *
+ * TLBIALLIS is the only way for Hyp to drop the guest's stage 1 entries,
+ * and it takes the stage 2 ones with it, so there is nothing to gain from
+ * invalidating by IPA first.
+ */
+static inline void flush_guest_tlb_range_ipa(paddr_t ipa, paddr_t size)
+{
+    flush_tlb();
+}
+
 /* Flush local TLBs, all VMIDs, non-hypervisor mode */
 static inline void flush_tlb_all_local(void)
 {
@@ -23,6 +23,27 @@ static inline void flush_tlb(void)
         : : : "memory");
 }
 
+/*
+ * Flush innershareable TLBs for the guest physical range [ipa, ipa + size),
+ * current VMID only.
+ *
+ * TLBI IPAS2E1IS only removes the stage 2 entries, so the combined
+ * stage 1 + stage 2 entries of the VMID have to go as well.
+ */
+static inline void flush_guest_tlb_range_ipa(paddr_t ipa, paddr_t size)
+{
+    paddr_t end = ipa + size;
+
+    dsb(sy);
+    for ( ; ipa < end; ipa += PAGE_SIZE )
+        asm volatile("tlbi ipas2e1is, %0;" : : "r" (ipa >> PAGE_SHIFT)
+                     : "memory");
+    dsb(sy);
+    asm volatile("tlbi vmalle1is;" : : : "memory");
+    dsb(sy);
+    isb();
+}
+
 /* Flush local TLBs, all VMIDs, non-hypervisor mode */
 static inline void flush_tlb_all_local(void)
 {
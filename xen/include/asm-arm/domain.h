@@ -3,6 +3,9 @@
 
 #include <xen/config.h>
 #include <xen/cache.h>
+#include <xen/radix-tree.h>
+#include <xen/rbtree.h>
+#include <xen/rwlock.h>
 #include <xen/sched.h>
 #include <asm/page.h>
 #include <asm/p2m.h>
@@ -15,6 +18,10 @@
 struct hvm_domain
 {
     uint64_t              params[HVM_NR_PARAMS];
+
+    /* Page shared with the device model, see HVM_PARAM_IOREQ_PFN. */
+    struct page_info     *ioreq_page;
+    struct shared_iopage *ioreq_va;
 }  __cacheline_aligned;
 
 #ifdef CONFIG_ARM_64
@@ -109,6 +116,22 @@ struct arch_domain
         } *rdist_regions;
         int nr_regions;                     /* Number of rdist regions */
         uint32_t rdist_stride;              /* Re-Distributor stride */
+        unsigned int intid_bits;            /* Supported interrupt ID bits */
+        bool rdists_enabled;                /* Is any redistributor enabled? */
+        bool has_its;
+        /*
+         * The radix tree maps virtual LPIs to their struct pending_irq.
+         * Writers take the lock with interrupts disabled, as LPIs are
+         * looked up from the host LPI handler.
+         */
+        rwlock_t pend_lpi_tree_lock;
+        struct radix_tree_root pend_lpi_tree;
+        uint64_t rdist_propbase;            /* GICR_PROPBASER, shared by all */
+#endif
+#ifdef CONFIG_HAS_ITS
+        struct list_head vits_list;         /* The virtual ITSes */
+        spinlock_t its_devices_lock;        /* Protects the its_devices tree */
+        struct rb_root its_devices;         /* Devices mapped to an ITS */
 #endif
     } vgic;
 
@@ -245,9 +268,20 @@ struct arch_vcpu
         struct list_head lr_pending;
         spinlock_t lock;
 
+        /*
+         * SGIs, PPIs and SPIs injected from another pCPU are marked in
+         * this bitmap without taking the lock above, and moved to
+         * inflight_irqs by the vCPU itself on its way back to the guest.
+         * inject_queued is set once any bit has been.
+         */
+        unsigned long *inject_pending;
+        bool inject_queued;
+
         /* GICv3: redistributor base and flags for this vCPU */
         paddr_t rdist_base;
-#define VGIC_V3_RDIST_LAST  (1 << 0)        /* last vCPU of the rdist */
+        uint64_t rdist_pendbase;
+#define VGIC_V3_RDIST_LAST      (1 << 0)        /* last vCPU of the rdist */
+#define VGIC_V3_LPIS_ENABLED    (1 << 1)
         uint8_t flags;
     } vgic;
 
@@ -257,6 +291,13 @@ struct arch_vcpu
     struct vtimer phys_timer;
     struct vtimer virt_timer;
     bool_t vtimer_initialized;
+
+    /* MMIO access forwarded to the device model, see io.c */
+    struct {
+        int evtchn;
+        bool pending;
+        struct hsr_dabt dabt;
+    } ioreq;
 }  __cacheline_aligned;
 
 void vcpu_show_execution_state(struct vcpu *);
@@ -227,6 +227,13 @@ void gic_set_irq_type(struct irq_desc *desc, unsigned int type);
 
 /* Program the GIC to route an interrupt */
 extern void gic_route_irq_to_xen(struct irq_desc *desc, unsigned int priority);
+/*
+ * Leave a Xen-owned interrupt active once its handler has run, for a guest
+ * to deactivate through a hardware-linked LR.
+ */
+extern void gic_irq_deactivate_by_guest(struct irq_desc *desc);
+/* Set the active state of an IRQ, on this CPU for SGIs/PPIs */
+extern void gic_set_active_state(struct irq_desc *desc, bool active);
 extern int gic_route_irq_to_guest(struct domain *, unsigned int virq,
                                   struct irq_desc *desc,
                                   unsigned int priority);
@@ -355,6 +362,8 @@ struct gic_hw_operations {
     unsigned int (*read_vmcr_priority)(void);
     /* Read APRn register */
     unsigned int (*read_apr)(int apr_reg);
+    /* Set or clear the active state of an IRQ (banked for SGIs/PPIs) */
+    void (*set_active_state)(struct irq_desc *irqd, bool active);
     /* Secondary CPU init */
     int (*secondary_init)(void);
     /* Create GIC node for the hardware domain */
@@ -366,6 +375,8 @@ struct gic_hw_operations {
     int (*map_hwdom_extra_mappings)(struct domain *d);
     /* Deny access to GIC regions */
     int (*iomem_deny_access)(const struct domain *d);
+    /* Handle LPIs, which require special handling */
+    void (*do_LPI)(unsigned int lpi);
 };
 
 void register_gic_ops(const struct gic_hw_operations *ops);
@@ -64,6 +64,11 @@ void register_mmio_handler(struct domain *d,
 int domain_io_init(struct domain *d, int max_count);
 void domain_io_free(struct domain *d);
 
+/* Forwarding of unhandled accesses to a device model */
+int ioreq_set_page(struct domain *d, unsigned long gfn);
+void ioreq_domain_free(struct domain *d);
+void handle_ioreq_completion(void);
+
 
 #endif  /* __ASM_ARM_MMIO_H__ */
 
@@ -14,6 +14,9 @@
 /* Holds the bit size of IPAs in p2m tables.  */
 extern unsigned int p2m_ipa_bits;
 
+/* The VTCR_EL2 value describing the layout of the p2m tables. */
+extern register_t p2m_vtcr;
+
 struct domain;
 
 extern void memory_type_changed(struct domain *);
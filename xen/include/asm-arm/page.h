@@ -305,12 +305,24 @@ static inline int invalidate_dcache_va_range(const void *p, unsigned long size)
     return 0;
 }
 
+/*
+ * Clean a range without any barrier, for callers cleaning many ranges in
+ * a row (e.g. page by page while copying): they must issue a dsb(sy) once
+ * done, before relying on the data having reached the PoC.
+ */
+static inline void __clean_dcache_va_range(const void *p, unsigned long size)
+{
+    const void *end = p + size;
+
+    p = (const void *)((unsigned long)p & ~(cacheline_bytes - 1));
+    for ( ; p < end; p += cacheline_bytes )
+        asm volatile (__clean_dcache_one(0) : : "r" (p));
+}
+
 static inline int clean_dcache_va_range(const void *p, unsigned long size)
 {
-    const void *end;
     dsb(sy);           /* So the CPU issues all writes to the range */
-    for ( end = p + size; p < end; p += cacheline_bytes )
-        asm volatile (__clean_dcache_one(0) : : "r" (p));
+    __clean_dcache_va_range(p, size);
     dsb(sy);           /* So we know the flushes happen before continuing */
     /* ARM callers assume that dcache_* functions cannot fail. */
     return 0;
@@ -17,6 +17,7 @@ PERFCOUNTER(trap_hvc32,    "trap: 32-bit hvc")
 #ifdef CONFIG_ARM_64
 PERFCOUNTER(trap_smc64,    "trap: 64-bit smc")
 PERFCOUNTER(trap_hvc64,    "trap: 64-bit hvc")
+PERFCOUNTER(trap_hvc64_fast, "trap: 64-bit hvc fast path")
 PERFCOUNTER(trap_sysreg,   "trap: sysreg access")
 #endif
 PERFCOUNTER(trap_iabt,     "trap: guest instr abort")
@@ -0,0 +1,5 @@
+/* This file is legitimately included multiple times. */
+/*#ifndef __XEN_PERFC_DOM_DEFN_H__*/
+/*#define __XEN_PERFC_DOM_DEFN_H__*/
+
+/*#endif*/ /* __XEN_PERFC_DOM_DEFN_H__ */
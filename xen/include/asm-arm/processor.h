@@ -235,6 +235,8 @@
 #define HDCR_TPM        (_AC(1,U)<<6)           /* Trap Performance Monitors accesses */
 #define HDCR_TPMCR      (_AC(1,U)<<5)           /* Trap PMCR accesses */
 
+#define HSR_EC_SHIFT                26
+
 #define HSR_EC_UNKNOWN              0x00
 #define HSR_EC_WFI_WFE              0x01
 #define HSR_EC_CP15_32              0x03
@@ -262,6 +264,13 @@
 #define HSR_EC_BRK                  0x3c
 #endif
 
+#ifdef CONFIG_ARM_64
+/* Return values of do_trap_hvc_fast(), see arm64/entry.S */
+#define HVC_FAST_NOT_TAKEN          0 /* Do the full entry and trap handling */
+#define HVC_FAST_RETURN             1 /* Done, straight back to the guest */
+#define HVC_FAST_SLOW_EXIT          2 /* Done, but take the full exit */
+#endif
+
 /* FSR format, common */
 #define FSR_LPAE                (_AC(1,UL)<<9)
 /* FSR short format */
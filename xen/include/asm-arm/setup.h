@@ -50,6 +50,8 @@ extern struct bootinfo bootinfo;
 void arch_init_memory(void);
 
 void copy_from_paddr(void *dst, paddr_t paddr, unsigned long len);
+void copy_from_paddr_to_guest(vaddr_t gaddr, paddr_t paddr,
+                              unsigned long len);
 
 size_t estimate_efi_size(int mem_nr_banks);
 
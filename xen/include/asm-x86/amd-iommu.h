@@ -97,6 +97,8 @@ struct amd_iommu {
     struct ring_buffer cmd_buffer;
     struct ring_buffer event_log;
     struct ring_buffer ppr_log;
+    struct ring_buffer ga_log;
+    uint64_t *ga_log_tail;      /* GA log tail pointer, written by the IOMMU */
 
     int exclusion_enable;
     int exclusion_allow_all;
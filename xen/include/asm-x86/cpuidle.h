@@ -36,4 +36,13 @@ static inline int sched_has_urgent_vcpu(void)
     return atomic_read(&this_cpu(schedule_data).urgent_count);
 }
 
+/*
+ * A cpu outside of any cpupool, e.g. a soft parked one, only ever runs its
+ * idle vcpu, so it can as well sleep as deep as possible.
+ */
+static inline bool_t cpuidle_cpu_is_free(void)
+{
+    return !this_cpu(cpupool);
+}
+
 #endif /* __X86_ASM_CPUIDLE_H__ */
@@ -8,6 +8,7 @@
 #include <asm/hvm/domain.h>
 #include <asm/e820.h>
 #include <asm/mce.h>
+#include <asm/psr.h>
 #include <public/vcpu.h>
 #include <public/hvm/hvm_info_table.h>
 
@@ -38,8 +39,11 @@ struct trap_bounce {
     unsigned long eip;
 };
 
-#define MAPHASH_ENTRIES 8
-#define MAPHASH_HASHFN(pfn) ((pfn) & (MAPHASH_ENTRIES-1))
+#define MAPHASH_ORDER 4
+#define MAPHASH_ENTRIES (1U << MAPHASH_ORDER)
+/* Fold in the next bits, so that aligned strides don't all collide. */
+#define MAPHASH_HASHFN(pfn) \
+    (((pfn) ^ ((pfn) >> MAPHASH_ORDER)) & (MAPHASH_ENTRIES-1))
 #define MAPHASHENT_NOTINUSE ((u32)~0U)
 struct mapcache_vcpu {
     /* Shadow of mapcache_domain.epoch. */
@@ -141,10 +145,14 @@ struct shadow_vcpu {
     mfn_t oos[SHADOW_OOS_PAGES];
     mfn_t oos_snapshot[SHADOW_OOS_PAGES];
     struct oos_fixup {
-        int next;
+        uint16_t next;
+        uint16_t off[SHADOW_OOS_FIXUPS]; /* L1 slot, < L1_PAGETABLE_ENTRIES */
         mfn_t smfn[SHADOW_OOS_FIXUPS];
-        unsigned long off[SHADOW_OOS_FIXUPS];
     } oos_fixup[SHADOW_OOS_PAGES];
+    /* Last page that had at most one entry changed while out of sync,
+     * and how many writes to it have been emulated since the last resync */
+    mfn_t oos_sparse;
+    unsigned int oos_sparse_writes;
 
     bool_t pagetable_dying;
 #endif
@@ -236,12 +244,16 @@ struct paging_vcpu {
 #define MAX_CPUID_INPUT 40
 typedef xen_domctl_cpuid_t cpuid_input_t;
 
+/* Basic and extended leaves looked up directly by domain_cpuid(). */
+#define CPUID_INDEX_LEAVES 32
+
 #define MAX_NESTEDP2M 10
 
 #define MAX_ALTP2M      10 /* arbitrary */
 #define INVALID_ALTP2M  0xffff
 #define MAX_EPTP        (PAGE_SIZE / sizeof(uint64_t))
 struct p2m_domain;
+struct relmem_worker;
 struct time_scale {
     int shift;
     u32 mul_frac;
@@ -285,6 +297,9 @@ struct arch_domain
 
     /* I/O-port admin-specified access capabilities. */
     struct rangeset *ioport_caps;
+    /* The ports in ioport_caps, allocated when the first is granted. */
+    unsigned long *ioport_bitmap;
+    spinlock_t ioport_lock;
     uint32_t pci_cf8;
     uint8_t cmos_idx;
 
@@ -308,12 +323,16 @@ struct arch_domain
         RELMEM_not_started,
         RELMEM_shared,
         RELMEM_xen,
+        RELMEM_parallel,
         RELMEM_l4,
         RELMEM_l3,
         RELMEM_l2,
         RELMEM_done,
     } relmem;
     struct page_list_head relmem_list;
+    struct relmem_worker *relmem_workers;
+    unsigned int nr_relmem_workers;
+    atomic_t relmem_busy;              /* Workers still relinquishing. */
 
     /* nestedhvm: translate l2 guest physical to host physical */
     struct p2m_domain *nested_p2m[MAX_NESTEDP2M];
@@ -360,6 +379,12 @@ struct arch_domain
     uint8_t x87_fip_width;
 
     cpuid_input_t *cpuids;
+    /*
+     * For each basic (0x0...) and extended (0x8000000...) leaf, the
+     * cpuids[] slot plus one answering all its subleaves, or 0 if the
+     * leaf has to be searched for.
+     */
+    uint8_t cpuid_index[2][CPUID_INDEX_LEAVES];
 
     struct PITState vpit;
 
@@ -391,6 +416,11 @@ struct arch_domain
     unsigned int psr_rmid;
     /* COS assigned to the domain for each socket */
     unsigned int *psr_cos_ids;
+    /* Cache controller class and target L3 share (XEN_DOMCTL_PSR_CLASS_*) */
+    uint8_t psr_class;
+    uint8_t psr_share;
+    /* Memory traffic sampled from the RMID's MBM counters */
+    struct psr_mbm_stats psr_mbm;
 
     /* Shared page for notifying that explicit PIRQ EOI is required. */
     unsigned long *pirq_eoi_map;
@@ -406,6 +436,8 @@ struct arch_domain
         unsigned int debug_exception_enabled     : 1;
         unsigned int debug_exception_sync        : 1;
         unsigned int cpuid_enabled               : 1;
+        /* (1 << XEN_DOMCTL_MONITOR_EVENT_*) delivered as records */
+        unsigned int record_only;
         struct monitor_msr_bitmap *msr_bitmap;
     } monitor;
 
@@ -556,6 +588,9 @@ struct arch_vcpu
     /* This variable determines whether nonlazy extended state has been used,
      * and thus should be saved/restored. */
     bool_t nonlazy_xstate_used;
+    /* Number of XSAVEs of this vcpu's state, and bytes of state in use. */
+    unsigned long xsave_count;
+    uint64_t xsave_bytes;
 
     /*
      * The SMAP check policy when updating runstate_guest(v) and the
@@ -606,6 +641,7 @@ unsigned long pv_guest_cr4_fixup(const struct vcpu *, unsigned long guest_cr4);
              X86_CR4_OSXSAVE | X86_CR4_SMEP |               \
              X86_CR4_FSGSBASE | X86_CR4_SMAP))
 
+void domain_cpuid_update_index(struct domain *d);
 void domain_cpuid(struct domain *d,
                   unsigned int  input,
                   unsigned int  sub_input,
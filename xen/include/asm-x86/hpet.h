@@ -82,6 +82,7 @@ void hpet_broadcast_enter(void);
 void hpet_broadcast_exit(void);
 int hpet_broadcast_is_available(void);
 void hpet_disable_legacy_broadcast(void);
+void hpet_broadcast_dump(void);
 
 extern void (*pv_rtc_handler)(uint8_t reg, uint8_t value);
 
@@ -68,8 +68,12 @@ struct hvm_ioreq_server {
     spinlock_t             bufioreq_lock;
     evtchn_port_t          bufioreq_evtchn;
     struct rangeset        *range[NR_IO_RANGE_TYPES];
+    /* Subsets of the above whose writes may use the buffered ring */
+    struct rangeset        *posted[NR_IO_RANGE_TYPES];
     bool_t                 enabled;
     bool_t                 bufioreq_atomic;
+    /* Emulator polls for requests, so don't notify it */
+    bool_t                 polling;
 };
 
 struct hvm_domain {
@@ -105,6 +109,11 @@ struct hvm_domain {
     /* VCPU which is current target for 8259 interrupts. */
     struct vcpu           *i8259_target;
 
+    /* IPI destination lookup, see vlapic.c. */
+    struct vlapic_map     *vlapic_map;
+    spinlock_t             vlapic_map_lock;
+    bool_t                 vlapic_map_dirty;
+
     /* emulated irq to pirq */
     struct radix_tree_root emuirq_pirq;
 
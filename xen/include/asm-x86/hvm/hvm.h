@@ -250,7 +250,7 @@ extern const struct hvm_function_table *start_vmx(void);
 int hvm_domain_initialise(struct domain *d);
 void hvm_domain_relinquish_resources(struct domain *d);
 void hvm_domain_destroy(struct domain *d);
-void hvm_domain_soft_reset(struct domain *d);
+void hvm_domain_soft_reset(struct domain *d, bool_t platform);
 
 int hvm_vcpu_initialise(struct vcpu *v);
 void hvm_vcpu_destroy(struct vcpu *v);
@@ -409,6 +409,12 @@ bool hvm_set_guest_bndcfgs(struct vcpu *v, u64 val);
 #define has_viridian_apic_assist(d) \
     (is_viridian_domain(d) && (viridian_feature_mask(d) & HVMPV_apic_assist))
 
+#define has_viridian_synic(d) \
+    (is_viridian_domain(d) && (viridian_feature_mask(d) & HVMPV_synic))
+
+#define has_viridian_stimer(d) \
+    (is_viridian_domain(d) && (viridian_feature_mask(d) & HVMPV_stimer))
+
 void hvm_hypervisor_cpuid_leaf(uint32_t sub_idx,
                                uint32_t *eax, uint32_t *ebx,
                                uint32_t *ecx, uint32_t *edx);
@@ -416,6 +422,9 @@ void hvm_cpuid(unsigned int input, unsigned int *eax, unsigned int *ebx,
                                    unsigned int *ecx, unsigned int *edx);
 void hvm_migrate_timers(struct vcpu *v);
 void hvm_do_resume(struct vcpu *v);
+bool_t hvm_flush_vcpu_tlb(bool_t (*flush_vcpu)(void *ctxt, struct vcpu *v),
+                          void *ctxt);
+void hvm_migrate_pirq(struct hvm_pirq_dpci *pirq_dpci, const struct vcpu *v);
 void hvm_migrate_pirqs(struct vcpu *v);
 
 void hvm_inject_trap(const struct hvm_trap *trap);
@@ -623,6 +632,9 @@ unsigned long hvm_cr4_guest_reserved_bits(const struct vcpu *v, bool_t restore);
     if ( has_hvm_container_domain(d_) &&                        \
          (cpu_has_vmx && d_->arch.hvm_domain.vmx.vcpu_block) )  \
         d_->arch.hvm_domain.vmx.vcpu_block(v_);                 \
+    else if ( has_hvm_container_domain(d_) &&                   \
+              (cpu_has_svm && d_->arch.hvm_domain.svm.vcpu_block) ) \
+        d_->arch.hvm_domain.svm.vcpu_block(v_);                 \
 })
 
 #endif /* __ASM_X86_HVM_HVM_H__ */
@@ -29,6 +29,9 @@
 /* IOMMU PPR Log entries: in power of 2 increments, minimum of 256 */
 #define IOMMU_PPR_LOG_DEFAULT_ENTRIES       512
 
+/* IOMMU GA Log entries: in power of 2 increments, minimum of 512 */
+#define IOMMU_GA_LOG_DEFAULT_ENTRIES        512
+
 #define PTE_PER_TABLE_SHIFT		9
 #define PTE_PER_TABLE_SIZE		(1 << PTE_PER_TABLE_SHIFT)
 #define PTE_PER_TABLE_MASK		(~(PTE_PER_TABLE_SIZE - 1))
@@ -309,6 +312,23 @@
 #define IOMMU_PPR_LOG_CODE_MASK                         0xF0000000
 #define IOMMU_PPR_LOG_CODE_SHIFT                        28
 
+/* GA (Guest virtual APIC) Log */
+#define IOMMU_GA_LOG_ENTRY_SIZE                         8
+#define IOMMU_GA_LOG_POWER_OF2_ENTRIES_PER_PAGE         8
+
+#define IOMMU_GA_LOG_BASE_OFFSET                        0x00E0
+#define IOMMU_GA_LOG_TAIL_ADDR_OFFSET                   0x00E8
+#define IOMMU_GA_LOG_BASE_MASK                          0x000FFFFFFFFFF000ULL
+#define IOMMU_GA_LOG_LENGTH_SHIFT                       56
+#define IOMMU_GA_LOG_TAIL_ADDR_MASK                     0x000FFFFFFFFFFFF8ULL
+#define IOMMU_GA_LOG_HEAD_OFFSET                        0x2040
+#define IOMMU_GA_LOG_TAIL_OFFSET                        0x2048
+#define IOMMU_GA_LOG_PTR_MASK                           0x0007FFF8
+#define IOMMU_GA_LOG_TAG_MASK                           0xFFFFFFFFULL
+#define IOMMU_GA_LOG_CODE_SHIFT                         60
+#define IOMMU_GA_LOG_CODE_MASK                          0xF
+#define IOMMU_GA_LOG_CODE_GUEST_NR                      0x1
+
 #define IOMMU_LOG_ENTRY_TIMEOUT                         1000
 
 /* Control Register */
@@ -343,6 +363,14 @@
 #define IOMMU_CONTROL_PPR_ENABLE_SHIFT			15
 #define IOMMU_CONTROL_GT_ENABLE_MASK			0x00010000
 #define IOMMU_CONTROL_GT_ENABLE_SHIFT			16
+#define IOMMU_CONTROL_GA_ENABLE_MASK			0x00020000
+#define IOMMU_CONTROL_GA_ENABLE_SHIFT			17
+#define IOMMU_CONTROL_GAM_ENABLE_MASK			0x02000000
+#define IOMMU_CONTROL_GAM_ENABLE_SHIFT			25
+#define IOMMU_CONTROL_GA_LOG_ENABLE_MASK		0x10000000
+#define IOMMU_CONTROL_GA_LOG_ENABLE_SHIFT		28
+#define IOMMU_CONTROL_GA_LOG_INT_MASK			0x20000000
+#define IOMMU_CONTROL_GA_LOG_INT_SHIFT			29
 #define IOMMU_CONTROL_RESTART_MASK			0x80000000
 #define IOMMU_CONTROL_RESTART_SHIFT			31
 
@@ -381,6 +409,7 @@
 #define IOMMU_EXT_FEATURE_GATS_MASK                     0x00003000
 #define IOMMU_EXT_FEATURE_GLXSUP_SHIFT                  0x14
 #define IOMMU_EXT_FEATURE_GLXSUP_MASK                   0x0000C000
+#define IOMMU_EXT_FEATURE_GAMSUP_SHIFT                  0x15
 
 #define IOMMU_EXT_FEATURE_PASMAX_SHIFT                  0x0
 #define IOMMU_EXT_FEATURE_PASMAX_MASK                   0x0000001F
@@ -403,12 +432,12 @@
 #define IOMMU_STATUS_PPR_LOG_INT_SHIFT          6
 #define IOMMU_STATUS_PPR_LOG_RUN_MASK           0x00000080
 #define IOMMU_STATUS_PPR_LOG_RUN_SHIFT          7
-#define IOMMU_STATUS_GAPIC_LOG_OVERFLOW_MASK    0x00000100
-#define IOMMU_STATUS_GAPIC_LOG_OVERFLOW_SHIFT   8
-#define IOMMU_STATUS_GAPIC_LOG_INT_MASK         0x00000200
-#define IOMMU_STATUS_GAPIC_LOG_INT_SHIFT        9
-#define IOMMU_STATUS_GAPIC_LOG_RUN_MASK         0x00000400
-#define IOMMU_STATUS_GAPIC_LOG_RUN_SHIFT        10
+#define IOMMU_STATUS_GAPIC_LOG_RUN_MASK         0x00000100
+#define IOMMU_STATUS_GAPIC_LOG_RUN_SHIFT        8
+#define IOMMU_STATUS_GAPIC_LOG_OVERFLOW_MASK    0x00000200
+#define IOMMU_STATUS_GAPIC_LOG_OVERFLOW_SHIFT   9
+#define IOMMU_STATUS_GAPIC_LOG_INT_MASK         0x00000400
+#define IOMMU_STATUS_GAPIC_LOG_INT_SHIFT        10
 
 /* I/O Page Table */
 #define IOMMU_PAGE_TABLE_ENTRY_SIZE	8
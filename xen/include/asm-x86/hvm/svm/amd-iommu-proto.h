@@ -101,6 +101,13 @@ void amd_iommu_read_msi_from_ire(
     struct msi_desc *msi_desc, struct msi_msg *msg);
 int amd_setup_hpet_msi(struct msi_desc *msi_desc);
 
+/* guest virtual APIC mode (AVIC interrupt posting) */
+struct pirq;
+int amd_iommu_update_ire_posted(
+    const struct vcpu *v, const struct pirq *pirq, uint8_t gvec);
+void amd_iommu_ga_update(
+    const struct msi_desc *msi_desc, unsigned int dest, bool_t is_run);
+
 extern struct ioapic_sbdf {
     u16 bdf, seg;
     u16 *pin_2_idx;
@@ -117,6 +124,7 @@ extern struct hpet_sbdf {
 
 extern void *shared_intremap_table;
 extern unsigned long *shared_intremap_inuse;
+extern bool_t amd_iommu_irte_ga;
 
 /* power management support */
 void amd_iommu_resume(void);
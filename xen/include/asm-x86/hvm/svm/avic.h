@@ -0,0 +1,100 @@
+/*
+ * avic.h: AMD Advanced Virtual Interrupt Controller.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASM_X86_HVM_SVM_AVIC_H__
+#define __ASM_X86_HVM_SVM_AVIC_H__
+
+#include <xen/sched.h>
+
+/* Physical APIC ID table entry. */
+#define AVIC_PHYS_HOST_ID_MASK      0xffULL
+#define AVIC_PHYS_BACKING_MASK      0x000ffffffffff000ULL
+#define AVIC_PHYS_IS_RUNNING        (1ULL << 62)
+#define AVIC_PHYS_VALID             (1ULL << 63)
+
+/* Logical APIC ID table entry. */
+#define AVIC_LOGICAL_GUEST_ID_MASK  0xffU
+#define AVIC_LOGICAL_VALID          (1U << 31)
+
+/*
+ * The physical table is indexed by xAPIC ID and vlapic gives vCPU n the ID
+ * 2n, so this is as many vCPUs as AVIC can describe.
+ */
+#define AVIC_MAX_VCPUS              128
+#define AVIC_PHYS_MAX_INDEX         0xff
+#define AVIC_LOGICAL_ENTRIES        128
+
+/* VMEXIT_AVIC_INCOMPLETE_IPI: exitinfo2[63:32] */
+#define AVIC_IPI_INVALID_INT_TYPE   0
+#define AVIC_IPI_TARGET_NOT_RUNNING 1
+#define AVIC_IPI_INVALID_TARGET     2
+#define AVIC_IPI_INVALID_BACKING    3
+
+/* VMEXIT_AVIC_NOACCEL: exitinfo1 */
+#define AVIC_NOACCEL_OFFSET_MASK    0xff0
+#define AVIC_NOACCEL_WRITE          (1ULL << 32)
+
+/*
+ * IOMMU guest virtual APIC mode tags each posted IRTE, and reports the tag
+ * in its GA log when the target vCPU isn't running.
+ */
+#define AVIC_GA_TAG(v)              (((v)->domain->domain_id << 16) | \
+                                     (v)->vcpu_id)
+#define AVIC_GA_TAG_DOMID(t)        ((domid_t)((t) >> 16))
+#define AVIC_GA_TAG_VCPU(t)         ((t) & 0xffff)
+
+extern bool_t svm_avic;
+
+void svm_avic_init(void);
+
+int svm_avic_domain_initialise(struct domain *d);
+void svm_avic_domain_destroy(struct domain *d);
+void svm_avic_domain_disable(struct domain *d);
+void svm_avic_vcpu_initialise(struct vcpu *v);
+void svm_avic_vcpu_destroy(struct vcpu *v);
+
+void svm_avic_vcpu_resume(struct vcpu *v);
+void svm_avic_ctxt_switch_from(struct vcpu *v);
+void svm_avic_deliver_intr(struct vcpu *v, u8 vector);
+void svm_avic_intr_window(struct vcpu *v);
+
+void svm_avic_incomplete_ipi(struct cpu_user_regs *regs);
+void svm_avic_noaccel(struct cpu_user_regs *regs);
+
+void svm_avic_ga_refresh(struct vcpu *v);
+void svm_avic_ga_log(uint32_t tag);
+
+static inline bool_t svm_avic_domain_enabled(const struct domain *d)
+{
+    return d->arch.hvm_domain.svm.avic;
+}
+
+static inline bool_t svm_avic_vcpu_active(const struct vcpu *v)
+{
+    return v->arch.hvm_svm.avic.active;
+}
+
+#endif /* __ASM_X86_HVM_SVM_AVIC_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -21,6 +21,9 @@
 
 #include <xen/config.h>
 #include <xen/types.h>
+#include <xen/list.h>
+#include <xen/spinlock.h>
+#include <xen/timer.h>
 #include <asm/hvm/emulate.h>
 
 
@@ -302,6 +305,8 @@ enum VMEXIT_EXITCODE
     VMEXIT_MWAIT_CONDITIONAL= 140, /* 0x8c */
     VMEXIT_XSETBV           = 141, /* 0x8d */
     VMEXIT_NPF              = 1024, /* 0x400, nested paging fault */
+    VMEXIT_AVIC_INCOMPLETE_IPI = 1025, /* 0x401 */
+    VMEXIT_AVIC_NOACCEL     = 1026, /* 0x402 */
     VMEXIT_INVALID          =  -1
 };
 
@@ -334,7 +339,8 @@ typedef union __packed
         u64 ign_tpr:      1;
         u64 rsvd1:        3;
         u64 intr_masking: 1;
-        u64 rsvd2:        7;
+        u64 rsvd2:        6;
+        u64 avic:         1;
         u64 vector:       8;
         u64 rsvd3:       24;
     } fields;
@@ -394,7 +400,9 @@ typedef union __packed
         uint32_t cr2: 1;
         /* debugctlmsr, last{branch,int}{to,from}ip */
         uint32_t lbr: 1;
-        uint32_t resv: 21;
+        /* avic_{apic_bar,backing_page,logical_table,physical_table} */
+        uint32_t avic: 1;
+        uint32_t resv: 20;
     } fields;
 } vmcbcleanbits_t;
 
@@ -428,7 +436,8 @@ struct __packed vmcb_struct {
     u64 exitinfo2;              /* offset 0x80 */
     eventinj_t  exitintinfo;    /* offset 0x88 */
     u64 _np_enable;             /* offset 0x90 - cleanbit 4 */
-    u64 res08[2];
+    u64 _avic_apic_bar;         /* offset 0x98 - cleanbit 11 */
+    u64 res08;                  /* offset 0xA0 */
     eventinj_t  eventinj;       /* offset 0xA8 */
     u64 _h_cr3;                 /* offset 0xB0 - cleanbit 4 */
     lbrctrl_t lbr_control;      /* offset 0xB8 */
@@ -437,7 +446,11 @@ struct __packed vmcb_struct {
     u64 nextrip;                /* offset 0xC8 */
     u8  guest_ins_len;          /* offset 0xD0 */
     u8  guest_ins[15];          /* offset 0xD1 */
-    u64 res10a[100];            /* offset 0xE0 pad to save area */
+    u64 _avic_backing_page;     /* offset 0xE0 - cleanbit 11 */
+    u64 res10b;                 /* offset 0xE8 */
+    u64 _avic_logical_table;    /* offset 0xF0 - cleanbit 11 */
+    u64 _avic_physical_table;   /* offset 0xF8 - cleanbit 11 */
+    u64 res10a[96];             /* offset 0x100 pad to save area */
 
     svm_segment_register_t es;  /* offset 1024 - cleanbit 8 */
     svm_segment_register_t cs;  /* cleanbit 8 */
@@ -489,6 +502,38 @@ struct __packed vmcb_struct {
 };
 
 struct svm_domain {
+    /*
+     * AVIC: APIC ID tables shared by all vCPUs, and the page backing the
+     * guest's APIC MMIO range (accesses to it are redirected by AVIC, but
+     * it must be mapped in the NPT).  See avic.c.
+     */
+    bool_t avic;
+    spinlock_t avic_lock;       /* Protects the logical ID table. */
+    uint64_t *avic_physical_table;
+    uint32_t *avic_logical_table;
+    unsigned long avic_access_mfn;
+
+    /* Hook called from arch_vcpu_block(), see vmx_domain for the rationale. */
+    void (*vcpu_block)(struct vcpu *);
+};
+
+struct svm_avic_vcpu {
+    bool_t active;              /* AVIC enabled in our VMCB. */
+    bool_t running;             /* IsRunning set in our physical ID entry. */
+    bool_t ga_stale;            /* ga_list changed: rewrite its IRTEs. */
+    int phys_id;                /* Our physical ID table index, or -1. */
+    int logical_idx;            /* Our logical ID table index, or -1. */
+    uint32_t id, ldr, dfr;      /* ID/LDR/DFR the tables were built from. */
+
+    /*
+     * MSIs posted to us by the IOMMU (guest virtual APIC mode), whose IRTEs
+     * follow our running state and physical CPU.
+     */
+    spinlock_t ga_lock;
+    struct list_head ga_list;
+
+    /* V_IRQ is ignored with AVIC: wait for a blocked ExtINT/NMI by polling. */
+    struct timer window_timer;
 };
 
 struct arch_svm_struct {
@@ -522,6 +567,8 @@ struct arch_svm_struct {
         u64 length;
         u64 status;
     } osvw;
+
+    struct svm_avic_vcpu avic;
 };
 
 struct vmcb_struct *alloc_vmcb(void);
@@ -590,6 +637,10 @@ VMCB_ACCESSORS(u64, lastbranchfromip, lbr)
 VMCB_ACCESSORS(u64, lastbranchtoip, lbr)
 VMCB_ACCESSORS(u64, lastintfromip, lbr)
 VMCB_ACCESSORS(u64, lastinttoip, lbr)
+VMCB_ACCESSORS(u64, avic_apic_bar, avic)
+VMCB_ACCESSORS(u64, avic_backing_page, avic)
+VMCB_ACCESSORS(u64, avic_logical_table, avic)
+VMCB_ACCESSORS(u64, avic_physical_table, avic)
 
 #undef VMCB_ACCESSORS
 
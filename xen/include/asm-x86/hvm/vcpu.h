@@ -53,6 +53,29 @@ struct hvm_mmio_cache {
     uint8_t buffer[32];
 };
 
+/*
+ * A recently emulated MMIO instruction, decoded far enough to redo a plain
+ * MOV without going through x86_emulate().  Entries are keyed by RIP, CR3
+ * and address size, and only used if the instruction bytes still match.
+ */
+struct hvm_mmio_insn {
+    unsigned long rip;
+    unsigned long cr3;
+    uint8_t insn[15];
+    uint8_t len;        /* 0 if the instruction isn't a suitable MOV */
+    uint8_t addr_size;
+    uint8_t write;
+    uint8_t size;
+    uint8_t reg;
+    uint8_t highbyte;
+    uint8_t seg;
+    uint8_t rip_rel;
+    uint8_t scale;
+    int8_t base;        /* -1 if none */
+    int8_t index;       /* -1 if none */
+    int32_t disp;
+};
+
 struct hvm_vcpu_io {
     /* I/O request in flight to device model. */
     enum hvm_io_completion io_completion;
@@ -84,6 +107,9 @@ struct hvm_vcpu_io {
      */
     bool_t mmio_retry;
 
+    /* Decode cache for the MOV fast path, indexed by RIP. */
+    struct hvm_mmio_insn mmio_insn_cache[8];
+
     unsigned long msix_unmask_address;
     unsigned long msix_snoop_address;
     unsigned long msix_snoop_gpa;
@@ -163,6 +189,8 @@ struct hvm_vcpu {
     /* Lock and list for virtual platform timers. */
     spinlock_t          tm_lock;
     struct list_head    tm_list;
+    /* Set when a timer on tm_list may have an interrupt pending. */
+    bool_t              tm_pending;
 
     u8                  flag_dr_dirty;
     bool_t              debug_state_latch;
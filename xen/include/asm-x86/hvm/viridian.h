@@ -9,6 +9,8 @@
 #ifndef __ASM_X86_HVM_VIRIDIAN_H__
 #define __ASM_X86_HVM_VIRIDIAN_H__
 
+#include <xen/timer.h>
+
 union viridian_apic_assist
 {   uint64_t raw;
     struct
@@ -19,6 +21,58 @@ union viridian_apic_assist
     } fields;
 };
 
+union viridian_synic_page
+{   uint64_t raw;
+    struct
+    {
+        uint64_t enabled:1;
+        uint64_t reserved_preserved:11;
+        uint64_t pfn:48;
+    } fields;
+};
+
+union viridian_sint
+{   uint64_t raw;
+    struct
+    {
+        uint64_t vector:8;
+        uint64_t reserved_preserved1:8;
+        uint64_t mask:1;
+        uint64_t auto_eoi:1;
+        uint64_t polling:1;
+        uint64_t reserved_preserved2:45;
+    } fields;
+};
+
+#define VIRIDIAN_SINT_NR   16
+#define VIRIDIAN_STIMER_NR 4
+
+union viridian_stimer_config
+{   uint64_t raw;
+    struct
+    {
+        uint64_t enabled:1;
+        uint64_t periodic:1;
+        uint64_t lazy:1;
+        uint64_t auto_enable:1;
+        uint64_t vector:8;
+        uint64_t direct_mode:1;
+        uint64_t reserved_zero1:3;
+        uint64_t sintx:4;
+        uint64_t reserved_zero2:44;
+    } fields;
+};
+
+struct viridian_stimer
+{
+    struct vcpu *v;
+    struct timer timer;
+    union viridian_stimer_config config;
+    uint64_t count;
+    int64_t expiration;  /* in reference time */
+    bool_t started;
+};
+
 struct viridian_vcpu
 {
     struct {
@@ -26,6 +80,19 @@ struct viridian_vcpu
         void *va;
         int vector;
     } apic_assist;
+    struct {
+        uint64_t scontrol;
+        uint64_t siefp;
+        union viridian_synic_page simp;
+        void *simp_va;
+        union viridian_sint sint[VIRIDIAN_SINT_NR];
+    } synic;
+    /* VIRIDIAN_STIMER_NR entries, kept out of line to bound struct vcpu. */
+    struct viridian_stimer *stimer;
+    /* Timers which expired, to be delivered in vCPU context. */
+    unsigned long stimer_pending;
+    /* Timers whose message slot was busy, to be retried at EOM. */
+    unsigned long stimer_retry;
 };
 
 union viridian_guest_os_id
@@ -121,6 +188,7 @@ viridian_hypercall(struct cpu_user_regs *regs);
 void viridian_time_ref_count_freeze(struct domain *d);
 void viridian_time_ref_count_thaw(struct domain *d);
 
+int viridian_vcpu_init(struct vcpu *v);
 void viridian_vcpu_deinit(struct vcpu *v);
 void viridian_domain_deinit(struct domain *d);
 
@@ -128,6 +196,9 @@ void viridian_start_apic_assist(struct vcpu *v, int vector);
 int viridian_complete_apic_assist(struct vcpu *v);
 void viridian_abort_apic_assist(struct vcpu *v);
 
+void viridian_poll_stimers(struct vcpu *v);
+bool_t viridian_is_auto_eoi_sint(const struct vcpu *v, uint8_t vector);
+
 #endif /* __ASM_X86_HVM_VIRIDIAN_H__ */
 
 /*
@@ -67,8 +67,14 @@ struct ept_data {
         };
         u64 eptp;
     };
-    /* Set of PCPUs needing an INVEPT before a VMENTER. */
-    cpumask_var_t invalidate;
+    /*
+     * Bumped whenever cached translations must go.  A PCPU issues an
+     * INVEPT before a VMENTER if it last flushed an older generation.
+     */
+    unsigned long flush_gen;
+    unsigned long *cpu_flush_gen;
+    /* Log-dirty is tracked by harvesting EPT D bits (no PML). */
+    bool_t ad_log_dirty;
 };
 
 #define _VMX_DOMAIN_PML_ENABLED    0
@@ -44,6 +44,8 @@ struct nestedvmx {
     } ept;
     uint32_t guest_vpid;
     struct list_head launched_list;
+    /* vmcs_gstate_field[] entries L1 wrote since the shadow VMCS held them */
+    uint64_t gstate_dirty;
 };
 
 #define vcpu_2_nvmx(v)	(vcpu_nestedhvm(v).u.nvmx)
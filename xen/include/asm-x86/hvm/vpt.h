@@ -109,6 +109,7 @@ typedef struct RTCState {
     uint64_t next_update_time;
     /* alarm timer */
     struct timer alarm_timer;
+    uint64_t next_alarm_time;
     /* periodic timer */
     struct periodic_time pt;
     s_time_t start_time;
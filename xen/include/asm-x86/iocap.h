@@ -7,12 +7,14 @@
 #ifndef __X86_IOCAP_H__
 #define __X86_IOCAP_H__
 
-#define ioports_permit_access(d, s, e)                  \
-    rangeset_add_range((d)->arch.ioport_caps, s, e)
-#define ioports_deny_access(d, s, e)                    \
-    rangeset_remove_range((d)->arch.ioport_caps, s, e)
-#define ioports_access_permitted(d, s, e)               \
-    rangeset_contains_range((d)->arch.ioport_caps, s, e)
+#define MAX_IOPORTS 0x10000
+
+struct domain;
+
+int ioports_permit_access(struct domain *d, unsigned long s, unsigned long e);
+int ioports_deny_access(struct domain *d, unsigned long s, unsigned long e);
+bool_t ioports_access_permitted(const struct domain *d,
+                                unsigned long s, unsigned long e);
 
 #define cache_flush_permitted(d)                        \
     (!rangeset_is_empty((d)->iomem_caps) ||             \
@@ -37,6 +37,7 @@ struct arch_iommu
     struct list_head g2m_ioport_list;   /* guest to machine ioport mapping */
     u64 iommu_bitmap;              /* bitmap of iommu(s) that the domain uses */
     struct list_head mapped_rmrrs;
+    unsigned long populate_gfn;    /* arch_iommu_populate_page_table() */
 
     /* amd iommu support */
     int paging_mode;
@@ -83,6 +84,9 @@ static inline int iommu_hardware_setup(void)
 void iommu_update_ire_from_apic(unsigned int apic, unsigned int reg, unsigned int value);
 unsigned int iommu_read_apic_from_ire(unsigned int apic, unsigned int reg);
 int iommu_setup_hpet_msi(struct msi_desc *);
+int __must_check arch_iommu_hwdom_map_range(struct domain *d,
+                                            unsigned long pfn,
+                                            unsigned long nr);
 
 /* While VT-d specific, this must get declared in a generic header. */
 int adjust_vtd_irq_affinities(void);
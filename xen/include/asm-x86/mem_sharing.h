@@ -24,8 +24,12 @@
 #include <public/domctl.h>
 #include <public/memory.h>
 
-/* Auditing of memory sharing code? */
+/* Auditing of memory sharing code?  Its global list serialises sharing. */
+#ifndef NDEBUG
 #define MEM_SHARING_AUDIT 1
+#else
+#define MEM_SHARING_AUDIT 0
+#endif
 
 typedef uint64_t shr_handle_t; 
 
@@ -36,6 +40,17 @@ typedef struct rmap_hashtab {
     void *flag;
 } rmap_hashtab_t;
 
+/* Reverse map entry: a <domain, gfn> tuple backed by a shared frame. */
+typedef struct gfn_info
+{
+    unsigned long gfn;
+    domid_t domain; 
+    struct list_head list;
+} gfn_info_t;
+
+/* Rmap entries kept in the sharing info itself, saving an allocation each. */
+#define RMAP_INLINE_ENTRIES 4
+
 struct page_sharing_info
 {
     struct page_info *pg;   /* Back pointer to the page. */
@@ -49,6 +64,8 @@ struct page_sharing_info
         struct list_head    gfns;
         rmap_hashtab_t      hash_table;
     };
+    gfn_info_t inline_gfns[RMAP_INLINE_ENTRIES];
+    unsigned int inline_used;   /* Bitmap of inline_gfns[] in use. */
 };
 
 #define sharing_supported(_d) \
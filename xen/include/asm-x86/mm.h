@@ -89,7 +89,15 @@ struct page_info
         /* Page is on a free list: ((count_info & PGC_count_mask) == 0). */
         struct {
             /* Do TLBs need flushing for safety before next page use? */
-            bool_t need_tlbflush;
+            unsigned long need_tlbflush:1;
+
+            /*
+             * Index of the first page of this (head) chunk that may still
+             * need scrubbing, or INVALID_DIRTY_IDX if all of it is clean.
+             * One bit wider than MAX_ORDER to fit INVALID_DIRTY_IDX.
+             */
+#define INVALID_DIRTY_IDX ((1UL << (MAX_ORDER + 1)) - 1)
+            unsigned long first_dirty:MAX_ORDER + 1;
         } free;
 
     } u;
@@ -210,6 +218,12 @@ struct page_info
  /* Cleared when the owning guest 'frees' this page. */
 #define _PGC_allocated    PG_shift(1)
 #define PGC_allocated     PG_mask(1, 1)
+/*
+ * Page needs scrubbing.  Only ever set on free pages, which can't be
+ * allocated, so the PGC_allocated bit is reused.
+ */
+#define _PGC_need_scrub   _PGC_allocated
+#define PGC_need_scrub    PGC_allocated
  /* Page is Xen heap? */
 #define _PGC_xen_heap     PG_shift(2)
 #define PGC_xen_heap      PG_mask(1, 2)
@@ -259,11 +273,15 @@ struct spage_info
 #define PRtype_info "016lx"/* should only be used for printk's */
 
 /* The number of out-of-sync shadows we allow per vcpu (prime, please) */
-#define SHADOW_OOS_PAGES 3
+#define SHADOW_OOS_PAGES 5
 
 /* OOS fixup entries */
 #define SHADOW_OOS_FIXUPS 2
 
+/* Writes per resync interval we emulate to a page that was found to be
+ * only sparsely written while out of sync, before unsyncing it again */
+#define SHADOW_OOS_SPARSE_WRITES 4
+
 #define page_get_owner(_p)                                              \
     ((struct domain *)((_p)->v.inuse._domain ?                          \
                        pdx_to_virt((_p)->v.inuse._domain) : NULL))
@@ -53,6 +53,21 @@ int arch_monitor_domctl_op(struct domain *d, struct xen_domctl_monitor_op *mop)
         domain_unpause(d);
         break;
 
+    case XEN_DOMCTL_MONITOR_OP_RECORD_ONLY:
+        /* Breakpoints need the monitor to step over them. */
+        if ( mop->event & ~((1U << XEN_DOMCTL_MONITOR_EVENT_WRITE_CTRLREG) |
+                            (1U << XEN_DOMCTL_MONITOR_EVENT_SINGLESTEP) |
+                            (1U << XEN_DOMCTL_MONITOR_EVENT_DEBUG_EXCEPTION)) )
+        {
+            rc = -EOPNOTSUPP;
+            break;
+        }
+
+        domain_pause(d);
+        d->arch.monitor.record_only = mop->event;
+        domain_unpause(d);
+        break;
+
     default:
         rc = -EOPNOTSUPP;
     }
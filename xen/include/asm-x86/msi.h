@@ -118,6 +118,10 @@ struct msi_desc {
 	struct msi_msg msg;		/* Last set MSI message */
 
 	int remap_index;		/* index in interrupt remapping table */
+
+	/* AMD guest virtual APIC mode: the vCPU our IRTE posts to. */
+	struct vcpu *pi_vcpu;
+	struct list_head pi_list;	/* on pi_vcpu's AVIC ga_list */
 };
 
 /*
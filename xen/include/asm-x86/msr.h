@@ -104,8 +104,6 @@ static inline uint64_t rdtsc_ordered(void)
     __write_tsc(val);                                           \
 })
 
-#define write_rdtscp_aux(val) wrmsr(MSR_TSC_AUX, (val), 0)
-
 #define rdpmc(counter,low,high) \
      __asm__ __volatile__("rdpmc" \
 			  : "=a" (low), "=d" (high) \
@@ -191,6 +189,10 @@ void write_efer(u64 val);
 
 DECLARE_PER_CPU(u32, ler_msr);
 
+/* TSC_AUX is cached for each CPU, to skip redundant writes. */
+DECLARE_PER_CPU(u32, tsc_aux);
+void wrmsr_tsc_aux(u32 val);
+
 #endif /* !__ASSEMBLY__ */
 
 #endif /* __ASM_MSR_H */
@@ -29,6 +29,8 @@
 #include <xen/config.h>
 #include <xen/paging.h>
 #include <xen/p2m-common.h>
+#include <xen/tasklet.h>
+#include <xen/timer.h>
 #include <asm/mem_sharing.h>
 #include <asm/page.h>    /* for pagetable_t */
 
@@ -238,6 +240,17 @@ struct p2m_domain {
                                     p2m_type_t p2mt,
                                     p2m_access_t p2ma,
                                     int sve);
+    /*
+     * Set the 4k entries for the 'nr' gfns starting at 'gfn', which are all
+     * covered by the same leaf table, to the contiguous mfns starting at
+     * 'mfn' (or INVALID_MFN throughout).  Optional: p2m_set_entry_range()
+     * uses set_entry() when it is absent.
+     */
+    int                (*set_entry_range)(struct p2m_domain *p2m,
+                                          unsigned long gfn, mfn_t mfn,
+                                          unsigned long nr,
+                                          p2m_type_t p2mt,
+                                          p2m_access_t p2ma);
     mfn_t              (*get_entry)(struct p2m_domain *p2m,
                                     unsigned long gfn,
                                     p2m_type_t *p2mt,
@@ -261,6 +274,16 @@ struct p2m_domain {
                                           unsigned long gfn, l1_pgentry_t *p,
                                           l1_pgentry_t new, unsigned int level);
     long               (*audit_p2m)(struct p2m_domain *p2m);
+    int                (*recombine_superpage)(struct p2m_domain *p2m,
+                                              unsigned long gfn,
+                                              unsigned int order);
+    /*
+     * Make the next guest access to [first_gfn, last_gfn] fault, without
+     * changing any translation, so that it can be sampled.  Optional.
+     */
+    int                (*numa_sample_range)(struct p2m_domain *p2m,
+                                            unsigned long first_gfn,
+                                            unsigned long last_gfn);
 
     /*
      * P2M updates may require TLBs to be flushed (invalidated).
@@ -301,6 +324,46 @@ struct p2m_domain {
      * to resume the search */
     unsigned long next_shared_gfn_to_relinquish;
 
+    /*
+     * Host p2m: background recombination of split superpages.  The
+     * statistics are indexed by level - 1, i.e. [0] is 2M and [1] is 1G.
+     */
+    struct {
+        struct timer     timer;
+        struct tasklet   tasklet;
+        unsigned long    next_gfn;      /* Where the next scan resumes */
+        unsigned long    promoted[2];   /* Tables replaced by superpages */
+        unsigned long    demoted[2];    /* Superpages split into tables */
+    } superpage;
+
+    /*
+     * Host p2m: NUMA balancing.  Samples are guest accesses faulting on
+     * ranges armed with numa_sample_range(), and are protected by the p2m
+     * lock, like the migration queue they feed.
+     */
+#define P2M_NUMA_FILTER_SIZE 256
+#define P2M_NUMA_QUEUE_SIZE  16
+    struct {
+        struct timer     timer;
+        struct tasklet   tasklet;
+        unsigned long    next_gfn;      /* Where the next window starts */
+        /* 2M chunk last sampled from a remote node, hashed by chunk. */
+        struct {
+            unsigned long chunk;
+            nodeid_t      node;
+        }                filter[P2M_NUMA_FILTER_SIZE];
+        /* 2M chunks to move to the node which keeps accessing them. */
+        struct {
+            unsigned long gfn;
+            nodeid_t      node;
+        }                queue[P2M_NUMA_QUEUE_SIZE];
+        unsigned int     nr_queued;
+        unsigned long    window[MAX_NUMNODES]; /* Samples per memory node */
+        uint64_t         samples[MAX_NUMNODES];/* ... since creation */
+        uint64_t         local, remote; /* Node of pCPU vs. of memory */
+        uint64_t         migrated, busy;/* Pages moved, pages left in use */
+    } numa;
+
     /* Populate-on-demand variables
      * All variables are protected with the pod lock. We cannot rely on
      * the p2m lock if it's turned into a fine-grained lock.
@@ -329,6 +392,11 @@ struct p2m_domain {
             unsigned long list[NR_POD_MRP_ENTRIES];
             unsigned int idx;
         } mrp;
+
+        /* 2M regions populated from the cache, checked first for zeroes. */
+        unsigned long   *sweep_hint;   /* Bitmap, one bit per 2M of gfns */
+        unsigned long    sweep_hint_bits;
+        unsigned long    sweep_hint_next; /* Where the next scan resumes */
         mm_lock_t        lock;         /* Locking of private pod structs,   *
                                         * not relying on the p2m lock.      */
     } pod;
@@ -586,6 +654,9 @@ void p2m_change_type_range(struct domain *d,
                            unsigned long start, unsigned long end,
                            p2m_type_t ot, p2m_type_t nt);
 
+/* Create IOMMU mappings for the p2m, for non-shared IOMMU page tables */
+int p2m_iommu_populate(struct domain *d, unsigned long *gfn);
+
 /* Compare-exchange the type of a single p2m entry */
 int p2m_change_type_one(struct domain *d, unsigned long gfn,
                         p2m_type_t ot, p2m_type_t nt);
@@ -593,6 +664,15 @@ int p2m_change_type_one(struct domain *d, unsigned long gfn,
 /* Report a change affecting memory types. */
 void p2m_memory_type_changed(struct domain *d);
 
+/* Move a range of guest memory to another NUMA node: XEN_DOMCTL_numa_migrate */
+struct xen_domctl_numa_migrate;
+int p2m_numa_migrate(struct domain *d, struct xen_domctl_numa_migrate *op);
+
+/* NUMA balancing: account a sampled access, report: XEN_SYSCTL_numa_locality */
+void p2m_numa_sample(struct p2m_domain *p2m, unsigned long gfn);
+struct xen_sysctl_numa_locality;
+int p2m_numa_locality(struct xen_sysctl_numa_locality *op);
+
 int p2m_is_logdirty_range(struct p2m_domain *, unsigned long start,
                           unsigned long end);
 
@@ -698,6 +778,10 @@ void p2m_free_ptp(struct p2m_domain *p2m, struct page_info *pg);
 int p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
                   unsigned int page_order, p2m_type_t p2mt, p2m_access_t p2ma);
 
+/* As p2m_set_entry(), for an arbitrary number of pages. */
+int p2m_set_entry_range(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
+                        unsigned long nr, p2m_type_t p2mt, p2m_access_t p2ma);
+
 /* Set up function pointers for PT implementation: only for use by p2m code */
 extern void p2m_pt_init(struct p2m_domain *p2m);
 
@@ -339,6 +339,7 @@ void efi_update_l4_pgtable(unsigned int l4idx, l4_pgentry_t);
 #define __PAGE_HYPERVISOR_NOCACHE (__PAGE_HYPERVISOR | _PAGE_PCD)
 
 #define MAP_SMALL_PAGES _PAGE_AVAIL0 /* don't use superpages mappings */
+#define MAP_NO_FLUSH    _PAGE_AVAIL1 /* caller flushes TLBs for 4k mappings */
 
 #ifndef __ASSEMBLY__
 
@@ -15,6 +15,8 @@ PERFCOUNTER_ARRAY(svmexits,             "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
 
 PERFCOUNTER(seg_fixups,             "segmentation fixups")
 
+PERFCOUNTER(msr_writes_elided,      "context switch MSR writes elided")
+
 PERFCOUNTER(apic_timer,             "apic timer interrupts")
 
 PERFCOUNTER(domain_page_tlb_flush,  "domain page tlb flushes")
@@ -110,6 +112,8 @@ PERFCOUNTER(shadow_oos_fixup_evict,"shadow OOS fixup evictions")
 PERFCOUNTER(shadow_unsync,         "shadow OOS unsyncs")
 PERFCOUNTER(shadow_unsync_evict,   "shadow OOS evictions")
 PERFCOUNTER(shadow_resync,         "shadow OOS resyncs")
+PERFCOUNTER(shadow_resync_sparse,  "shadow OOS sparse resyncs")
+PERFCOUNTER(shadow_unsync_emulate, "shadow OOS unsyncs declined")
 
 PERFCOUNTER(mshv_call_sw_addr_space,    "MS Hv Switch Address Space")
 PERFCOUNTER(mshv_call_flush_tlb_list,   "MS Hv Flush TLB list")
@@ -136,10 +140,26 @@ PERFCOUNTER(mshv_wrmsr_eoi,             "MS Hv wrmsr eoi")
 PERFCOUNTER(mshv_wrmsr_apic_assist,     "MS Hv wrmsr APIC assist")
 PERFCOUNTER(mshv_wrmsr_apic_msr,        "MS Hv wrmsr APIC msr")
 PERFCOUNTER(mshv_wrmsr_tsc_msr,         "MS Hv wrmsr TSC msr")
+PERFCOUNTER(mshv_rdmsr_synic_msr,       "MS Hv rdmsr SynIC msr")
+PERFCOUNTER(mshv_wrmsr_synic_msr,       "MS Hv wrmsr SynIC msr")
+PERFCOUNTER(mshv_wrmsr_eom,             "MS Hv wrmsr eom")
+PERFCOUNTER(mshv_rdmsr_stimer_msr,      "MS Hv rdmsr stimer msr")
+PERFCOUNTER(mshv_wrmsr_stimer_msr,      "MS Hv wrmsr stimer msr")
+PERFCOUNTER(mshv_stimer_expired,        "MS Hv stimer expired")
 
 PERFCOUNTER(realmode_emulations, "realmode instructions emulated")
 PERFCOUNTER(realmode_exits,      "vmexits from realmode")
 
+PERFCOUNTER(mmio_fast_hit,       "MMIO MOVs handled from decode cache")
+PERFCOUNTER(mmio_fast_miss,      "MMIO decode cache misses")
+
 PERFCOUNTER(pauseloop_exits, "vmexits from Pause-Loop Detection")
 
+PERFCOUNTER(ept_invept,             "INVEPTs before VMENTER")
+PERFCOUNTER(altp2m_propagate,       "altp2m: host changes propagated")
+PERFCOUNTER(altp2m_propagate_set,   "altp2m: view entries updated")
+PERFCOUNTER(altp2m_propagate_drop,  "altp2m: view entries dropped")
+PERFCOUNTER(altp2m_propagate_reset, "altp2m: views reset")
+PERFCOUNTER(altp2m_lazy_copy,       "altp2m: view entries copied on fault")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -0,0 +1,11 @@
+/* This file is legitimately included multiple times. */
+/*#ifndef __XEN_PERFC_DOM_DEFN_H__*/
+/*#define __XEN_PERFC_DOM_DEFN_H__*/
+
+PERFCOUNTER_ARRAY(dom_vmexits,          "vmexits", VMX_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER_ARRAY(dom_svmexits,         "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
+
+PERFCOUNTER(dom_emulations,             "instruction emulations")
+PERFCOUNTER(dom_pod_populate,           "PoD demand populations")
+
+/*#endif*/ /* __XEN_PERFC_DOM_DEFN_H__ */
@@ -0,0 +1,9 @@
+#ifndef __ASM_X86_PMUSAMPLE_H__
+#define __ASM_X86_PMUSAMPLE_H__
+
+#include <public/sysctl.h>
+
+/* Host PMU sampling of Xen and guest context, see XEN_SYSCTL_pmusample_op. */
+int pmusample_control(xen_sysctl_pmusample_op_t *op);
+
+#endif /* __ASM_X86_PMUSAMPLE_H__ */
@@ -23,13 +23,24 @@
 
 /* Resource Type Enumeration */
 #define PSR_RESOURCE_TYPE_L3            0x2
+#define PSR_RESOURCE_TYPE_MBA           0x8
 
 /* L3 Monitoring Features */
 #define PSR_CMT_L3_OCCUPANCY           0x1
+#define PSR_CMT_L3_MBM_TOTAL           0x2
+#define PSR_CMT_L3_MBM_LOCAL           0x4
+
+/* Monitoring event IDs, as programmed into MSR_IA32_CMT_EVTSEL */
+#define PSR_CMT_EVTID_OCCUPANCY        0x1
+#define PSR_CMT_EVTID_MBM_TOTAL        0x2
+#define PSR_CMT_EVTID_MBM_LOCAL        0x3
 
 /* CDP Capability */
 #define PSR_CAT_CDP_CAPABILITY       (1u << 2)
 
+/* MBA delay values are linear */
+#define PSR_MBA_LINEAR_CAPABILITY    (1u << 2)
+
 /* L3 CDP Enable bit*/
 #define PSR_L3_QOS_CDP_ENABLE_BIT       0x0
 
@@ -46,6 +57,16 @@ struct psr_cmt {
     struct psr_cmt_l3 l3;
 };
 
+/* Memory traffic of a domain, as sampled from its RMID's MBM counters */
+struct psr_mbm_stats {
+    uint64_t total;         /* bytes since the RMID was allocated */
+    uint64_t local;         /* of which to the socket's local memory */
+    uint64_t bw_total;      /* bytes/s over the last sampling period */
+    uint64_t bw_local;
+    uint64_t prev_total;    /* sums at the start of the period */
+    uint64_t prev_local;
+};
+
 enum cbm_type {
     PSR_CBM_TYPE_L3,
     PSR_CBM_TYPE_L3_CODE,
@@ -70,6 +91,18 @@ int psr_get_l3_cbm(struct domain *d, unsigned int socket,
 int psr_set_l3_cbm(struct domain *d, unsigned int socket,
                    uint64_t cbm, enum cbm_type type);
 
+int psr_get_mba_info(unsigned int socket, uint32_t *thrtl_max,
+                     uint32_t *cos_max, uint32_t *flags);
+int psr_get_mba_thrtl(struct domain *d, unsigned int socket,
+                      uint64_t *thrtl);
+int psr_set_mba_thrtl(struct domain *d, unsigned int socket,
+                      uint64_t thrtl);
+
+int psr_get_mbm(struct domain *d, struct psr_mbm_stats *stats);
+
+int psr_get_class(struct domain *d, uint64_t *data);
+int psr_set_class(struct domain *d, uint64_t data);
+
 int psr_domain_init(struct domain *d);
 void psr_domain_free(struct domain *d);
 
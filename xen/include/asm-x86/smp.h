@@ -58,6 +58,8 @@ void __stop_this_cpu(void);
 long cpu_up_helper(void *data);
 long cpu_down_helper(void *data);
 
+/* Or'ed into core_parking_helper()'s data to park without cpu hotplug. */
+#define CORE_PARKING_SOFT (1UL << 31)
 long core_parking_helper(void *data);
 uint32_t get_cur_idle_nums(void);
 
@@ -591,6 +591,12 @@ struct hvm_viridian_vcpu_context {
     uint64_t apic_assist_msr;
     uint8_t  apic_assist_vector;
     uint8_t  _pad[7];
+    uint64_t synic_scontrol_msr;
+    uint64_t synic_siefp_msr;
+    uint64_t synic_simp_msr;
+    uint64_t synic_sint_msr[16];
+    uint64_t stimer_config_msr[4];
+    uint64_t stimer_count_msr[4];
 };
 
 DECLARE_HVM_SAVE_TYPE(VIRIDIAN_VCPU, 17, struct hvm_viridian_vcpu_context);
@@ -37,7 +37,7 @@
 #include "hvm/save.h"
 #include "memory.h"
 
-#define XEN_DOMCTL_INTERFACE_VERSION 0x0000000c
+#define XEN_DOMCTL_INTERFACE_VERSION 0x0000000d
 
 /*
  * NB. xen_domctl.domain is an IN/OUT parameter for this operation.
@@ -226,6 +226,13 @@ struct xen_domctl_getpageframeinfo3 {
   * writably by the hypervisor in the dirty bitmap.
   */
 #define XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL   (1 << 0)
+ /*
+  * Return the dirty pfns as an array of uint64_t in dirty_bitmap, rather
+  * than as a bitmap.  pages is the number of entries the array has room
+  * for, and is updated with the number written.  If the array fills up, the
+  * pfns which didn't fit are left dirty (and are not cleaned).
+  */
+#define XEN_DOMCTL_SHADOW_LOGDIRTY_PFN_LIST (1 << 1)
 
 struct xen_domctl_shadow_op_stats {
     uint32_t fault_count;
@@ -246,7 +253,7 @@ struct xen_domctl_shadow_op {
     uint32_t       mb;       /* Shadow memory allocation in MB */
 
     /* OP_PEEK / OP_CLEAN */
-    XEN_GUEST_HANDLE_64(uint8) dirty_bitmap;
+    XEN_GUEST_HANDLE_64(uint8) dirty_bitmap; /* Or pfn list, see above. */
     uint64_aligned_t pages; /* Size of buffer. Updated with actual size. */
     struct xen_domctl_shadow_op_stats stats;
 };
@@ -816,6 +823,18 @@ struct xen_domctl_gdbsx_domstatus {
 #define XEN_VM_EVENT_DISABLE              1
 #define XEN_VM_EVENT_RESUME               2
 
+/*
+ * A ring may span up to XEN_VM_EVENT_MAX_RING_FRAMES frames, which are
+ * the consecutive gfns starting at the gfn held in the ring's HVM param.
+ *
+ * With XEN_VM_EVENT_FLAG_PER_VCPU every vCPU gets its own ring and event
+ * channel, so that vCPUs can be serviced in parallel.  The ring of vCPU i
+ * occupies nr_frames gfns starting at the ring HVM param + i * nr_frames.
+ * Requests raised by foreign domains go to the ring of vCPU 0.
+ */
+#define XEN_VM_EVENT_MAX_RING_FRAMES      16
+#define XEN_VM_EVENT_FLAG_PER_VCPU        (1U << 0)
+
 /*
  * Domain memory paging
  * Page memory in and out.
@@ -878,6 +897,17 @@ struct xen_domctl_vm_event_op {
     uint32_t       mode;         /* XEN_DOMCTL_VM_EVENT_OP_* */
 
     uint32_t port;              /* OUT: event channel for ring */
+
+    /* IN: frames per ring for XEN_VM_EVENT_ENABLE, 0 meaning 1 */
+    uint32_t nr_frames;
+    /* IN: XEN_VM_EVENT_FLAG_* for XEN_VM_EVENT_ENABLE */
+    uint32_t flags;
+    uint32_t pad;
+    /*
+     * OUT: with XEN_VM_EVENT_FLAG_PER_VCPU, the event channel of each
+     * vCPU's ring, indexed by vCPU ID (max_vcpus entries).
+     */
+    XEN_GUEST_HANDLE_64(uint32) ports;
 };
 typedef struct xen_domctl_vm_event_op xen_domctl_vm_event_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_vm_event_op_t);
@@ -1077,6 +1107,16 @@ DEFINE_XEN_GUEST_HANDLE(xen_domctl_psr_cmt_op_t);
 #define XEN_DOMCTL_MONITOR_OP_DISABLE           1
 #define XEN_DOMCTL_MONITOR_OP_GET_CAPABILITIES  2
 #define XEN_DOMCTL_MONITOR_OP_EMULATE_EACH_REP  3
+/*
+ * RECORD_ONLY takes in the event field a bitmap, in the format
+ * (1 << XEN_DOMCTL_MONITOR_EVENT_*), of the events to deliver as records:
+ * they are appended to the ring without pausing the vCPU or waiting for
+ * room, and are dropped when the ring is full (see
+ * VM_EVENT_FLAG_RECORDS_LOST).  The monitor still has to put a response
+ * for each record to free its slot, but may batch them.  Only
+ * WRITE_CTRLREG, SINGLESTEP and DEBUG_EXCEPTION can be recorded.
+ */
+#define XEN_DOMCTL_MONITOR_OP_RECORD_ONLY       4
 
 #define XEN_DOMCTL_MONITOR_EVENT_WRITE_CTRLREG         0
 #define XEN_DOMCTL_MONITOR_EVENT_MOV_TO_MSR            1
@@ -1136,6 +1176,27 @@ struct xen_domctl_psr_cat_op {
 #define XEN_DOMCTL_PSR_CAT_OP_SET_L3_DATA    3
 #define XEN_DOMCTL_PSR_CAT_OP_GET_L3_CODE    4
 #define XEN_DOMCTL_PSR_CAT_OP_GET_L3_DATA    5
+/* MBA throttling (delay) value of the domain on socket @target. */
+#define XEN_DOMCTL_PSR_CAT_OP_SET_MBA_THRTL  6
+#define XEN_DOMCTL_PSR_CAT_OP_GET_MBA_THRTL  7
+/*
+ * Hand the domain's CBMs and MBA throttling on all sockets over to Xen's
+ * cache controller (@target is ignored).  Best effort domains share the
+ * ways latency domains don't need: the controller periodically reads the
+ * L3 occupancy of each latency domain and shrinks the best effort ways,
+ * and throttles their memory bandwidth, while one of them is below its
+ * target share of the L3.  The CBMs and throttling of a classed domain
+ * can't be set directly; setting the class to NONE resets them.
+ */
+#define XEN_DOMCTL_PSR_CAT_OP_SET_CLASS      8
+#define XEN_DOMCTL_PSR_CAT_OP_GET_CLASS      9
+#define XEN_DOMCTL_PSR_CLASS_MASK            0xff
+#define XEN_DOMCTL_PSR_CLASS_NONE            0
+#define XEN_DOMCTL_PSR_CLASS_BEST_EFFORT     1
+#define XEN_DOMCTL_PSR_CLASS_LATENCY         2
+/* Target share of the L3 of a latency domain, in percent. */
+#define XEN_DOMCTL_PSR_CLASS_SHARE_SHIFT     8
+#define XEN_DOMCTL_PSR_CLASS_SHARE_MASK      0xff
     uint32_t cmd;       /* IN: XEN_DOMCTL_PSR_CAT_OP_* */
     uint32_t target;    /* IN */
     uint64_t data;      /* IN/OUT */
@@ -1143,6 +1204,66 @@ struct xen_domctl_psr_cat_op {
 typedef struct xen_domctl_psr_cat_op xen_domctl_psr_cat_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_psr_cat_op_t);
 
+/*
+ * XEN_DOMCTL_soft_reset
+ *
+ * With XEN_DOMCTL_SOFT_RESET_platform, also reset every vCPU to the down
+ * state and the emulated platform devices to their power-on state, so
+ * that the toolstack can boot the domain again from scratch in the memory
+ * it already has.
+ */
+struct xen_domctl_soft_reset {
+#define _XEN_DOMCTL_SOFT_RESET_platform 0
+#define XEN_DOMCTL_SOFT_RESET_platform  (1U << _XEN_DOMCTL_SOFT_RESET_platform)
+    uint32_t flags;     /* IN: XEN_DOMCTL_SOFT_RESET_* */
+};
+typedef struct xen_domctl_soft_reset xen_domctl_soft_reset_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_soft_reset_t);
+
+/*
+ * XEN_DOMCTL_numa_migrate
+ *
+ * Move the memory backing guest frames [start_gfn, start_gfn + nr_gfns) of
+ * a (running) HAP guest to NUMA node @node.  Each chunk is made read-only
+ * in the p2m while it is being copied, so that guest writes to it wait for
+ * the switch to the new copy.  Frames which aren't ordinary RAM, or which
+ * already are on @node, are left alone.  RAM frames which are referenced
+ * other than through the guest's p2m (grant, foreign or Xen-internal
+ * mappings) are skipped and counted in nr_busy, for the caller to retry
+ * later.
+ *
+ * The operation is preemptible.  nr_migrated and nr_busy must be zeroed by
+ * the caller and are accumulated over the whole range; start_gfn and
+ * nr_gfns are updated to reflect the progress made, including when failing
+ * with -ENOMEM because @node ran out of free memory.  -EOPNOTSUPP is
+ * returned for guests using device passthrough, altp2m or nested
+ * virtualisation.
+ */
+struct xen_domctl_numa_migrate {
+    uint64_aligned_t start_gfn;     /* IN/OUT */
+    uint64_aligned_t nr_gfns;       /* IN/OUT */
+    uint64_aligned_t nr_migrated;   /* IN/OUT: pages moved */
+    uint64_aligned_t nr_busy;       /* IN/OUT: pages skipped as in use */
+    uint32_t node;                  /* IN: destination node */
+    uint32_t pad;                   /* IN: must be zero */
+};
+typedef struct xen_domctl_numa_migrate xen_domctl_numa_migrate_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_numa_migrate_t);
+
+/*
+ * XEN_DOMCTL_set_grant_frames
+ *
+ * Grow the grant table of a domain to at least @nr_frames frames, as if the
+ * guest had asked for them, so that it doesn't need to grow it later on.
+ * Fails with -EINVAL if @nr_frames exceeds the maximum Xen was configured
+ * with.  Grant tables never shrink: a smaller @nr_frames has no effect.
+ */
+struct xen_domctl_set_grant_frames {
+    uint32_t nr_frames;             /* IN */
+};
+typedef struct xen_domctl_set_grant_frames xen_domctl_set_grant_frames_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_set_grant_frames_t);
+
 struct xen_domctl {
     uint32_t cmd;
 #define XEN_DOMCTL_createdomain                   1
@@ -1220,6 +1341,8 @@ struct xen_domctl {
 #define XEN_DOMCTL_monitor_op                    77
 #define XEN_DOMCTL_psr_cat_op                    78
 #define XEN_DOMCTL_soft_reset                    79
+#define XEN_DOMCTL_numa_migrate                  80
+#define XEN_DOMCTL_set_grant_frames              81
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1282,6 +1405,9 @@ struct xen_domctl {
         struct xen_domctl_psr_cmt_op        psr_cmt_op;
         struct xen_domctl_monitor_op        monitor_op;
         struct xen_domctl_psr_cat_op        psr_cat_op;
+        struct xen_domctl_soft_reset        soft_reset;
+        struct xen_domctl_numa_migrate      numa_migrate;
+        struct xen_domctl_set_grant_frames  set_grant_frames;
         uint8_t                             pad[128];
     } u;
 };
@@ -74,6 +74,7 @@
 #define EVTCHNOP_init_control    11
 #define EVTCHNOP_expand_array    12
 #define EVTCHNOP_set_priority    13
+#define EVTCHNOP_set_moderation  14
 /* ` } */
 
 typedef uint32_t evtchn_port_t;
@@ -312,6 +313,28 @@ struct evtchn_set_priority {
 };
 typedef struct evtchn_set_priority evtchn_set_priority_t;
 
+/*
+ * EVTCHNOP_set_moderation: coalesce notifications sent on an interdomain
+ * event channel.
+ *
+ * After a notification has been delivered, further EVTCHNOP_send calls on
+ * <port> within the next <window_us> microseconds are deferred and merged
+ * into a single notification raised when the window expires, or as soon as
+ * <count> sends have accumulated (if <count> is non-zero).  Moderation stays
+ * in effect until it is disabled or the port is closed.
+ *
+ * A <window_us> of zero disables moderation.  <port> is a local port of the
+ * calling domain, which must be in the interdomain state.
+ */
+struct evtchn_set_moderation {
+    /* IN parameters. */
+    uint32_t port;
+    uint32_t window_us;
+    uint32_t count;
+};
+typedef struct evtchn_set_moderation evtchn_set_moderation_t;
+#define EVTCHN_MODERATION_MAX_WINDOW_US 10000
+
 /*
  * ` enum neg_errnoval
  * ` HYPERVISOR_event_channel_op_compat(struct evtchn_op *op)
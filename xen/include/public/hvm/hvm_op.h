@@ -339,6 +339,16 @@ struct xen_hvm_io_range {
 # define HVMOP_IO_RANGE_PORT   0 /* I/O port range */
 # define HVMOP_IO_RANGE_MEMORY 1 /* MMIO range */
 # define HVMOP_IO_RANGE_PCI    2 /* PCI segment/bus/dev/func range */
+/*
+ * Writes to a port or memory range mapped with HVMOP_IO_RANGE_POSTED set in
+ * <type> are posted to the buffered ioreq ring where possible, completing
+ * without waiting for the emulator.  Reads, and writes which can't be
+ * posted, stay synchronous, so the emulator must drain the buffered ring
+ * before handling each synchronous request.  The IOREQ Server must have
+ * been created with a buffered ioreq ring.  <type> is masked identically
+ * when unmapping.
+ */
+# define HVMOP_IO_RANGE_POSTED (1u << 31)
     uint64_aligned_t start, end; /* IN - inclusive start and end of range */
 };
 typedef struct xen_hvm_io_range xen_hvm_io_range_t;
@@ -373,12 +383,20 @@ DEFINE_XEN_GUEST_HANDLE(xen_hvm_destroy_ioreq_server_t);
  * Note that the contents of the ioreq_pfn and bufioreq_fn (see
  * HVMOP_get_ioreq_server_info) are not meaningful until the IOREQ Server is in
  * the enabled state.
+ *
+ * If HVM_IOREQSRV_POLLING is set in <enabled>, the emulator is busy-polling
+ * the state of its ioreq structures and buffered ring, and Xen will not signal
+ * their event channels when raising new requests.  Enabling the server again
+ * without the flag makes Xen signal all of them once, so that no request
+ * raised while polling is missed.  The emulator must still notify Xen when it
+ * completes a synchronous request.
  */
 #define HVMOP_set_ioreq_server_state 22
 struct xen_hvm_set_ioreq_server_state {
     domid_t domid;   /* IN - domain to be serviced */
     ioservid_t id;   /* IN - server id */
     uint8_t enabled; /* IN - enabled? */    
+#define HVM_IOREQSRV_POLLING 0x2
 };
 typedef struct xen_hvm_set_ioreq_server_state xen_hvm_set_ioreq_server_state_t;
 DEFINE_XEN_GUEST_HANDLE(xen_hvm_set_ioreq_server_state_t);
@@ -73,7 +73,7 @@ typedef struct shared_iopage shared_iopage_t;
 
 struct buf_ioreq {
     uint8_t  type;   /* I/O type                    */
-    uint8_t  pad:1;
+    uint8_t  pad:1;  /* posted write, see below     */
     uint8_t  dir:1;  /* 1=read, 0=write             */
     uint8_t  size:2; /* 0=>1, 1=>2, 2=>4, 3=>8. If 8, use two buf_ioreqs */
     uint32_t addr:20;/* physical address            */
@@ -81,6 +81,19 @@ struct buf_ioreq {
 };
 typedef struct buf_ioreq buf_ioreq_t;
 
+/*
+ * A posted write (see HVMOP_IO_RANGE_POSTED) whose address doesn't fit in
+ * @addr has @pad set, and is followed (after the slot holding the upper half
+ * of 8-byte data, if any) by a slot whose @data holds address bits 20-51.
+ */
+
+/*
+ * The buffered ioreq event channel is only notified when the ring was empty
+ * before the new slots were added, so a consumer must keep handling slots
+ * until it finds read_pointer equal to write_pointer, re-reading the latter
+ * after each update of the former.
+ */
+
 #define IOREQ_BUFFER_SLOT_NUM     511 /* 8 bytes each, plus 2 4-byte indexes */
 struct buffered_iopage {
 #ifdef __XEN__
@@ -132,13 +132,26 @@
 #define _HVMPV_apic_assist 5
 #define HVMPV_apic_assist (1 << _HVMPV_apic_assist)
 
+/* Enable Synthetic Interrupt Controller (SynIC) MSRs */
+#define _HVMPV_synic 6
+#define HVMPV_synic (1 << _HVMPV_synic)
+
+/*
+ * Enable Synthetic Timer MSRs (HV_X64_MSR_STIMERn_CONFIG/COUNT).
+ * Requires HVMPV_synic and HVMPV_time_ref_count.
+ */
+#define _HVMPV_stimer 7
+#define HVMPV_stimer (1 << _HVMPV_stimer)
+
 #define HVMPV_feature_mask \
         (HVMPV_base_freq | \
          HVMPV_no_freq | \
          HVMPV_time_ref_count | \
          HVMPV_reference_tsc | \
          HVMPV_hcall_remote_tlb_flush | \
-         HVMPV_apic_assist)
+         HVMPV_apic_assist | \
+         HVMPV_synic | \
+         HVMPV_stimer)
 
 #endif
 
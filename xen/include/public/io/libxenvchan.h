@@ -56,6 +56,11 @@ struct ring_shared {
 
 #define VCHAN_NOTIFY_WRITE 0x1
 #define VCHAN_NOTIFY_READ 0x2
+/* Only in srv_notify: the client can follow the server to a new page. */
+#define VCHAN_NOTIFY_RESIZE 0x4
+
+/* cli_live/srv_live: moved to the ring page now in ring-ref */
+#define VCHAN_LIVE_MOVED 3
 
 /**
  * vchan_interface: primary shared data structure
@@ -72,6 +77,9 @@ struct vchan_interface {
 	 * 10   - at offset 1024 in ring's page
 	 * 11   - at offset 2048 in ring's page
 	 * 12+  - uses 2^(N-12) grants to describe the multi-page ring
+	 * 21+  - the 2^(N-12) grants are listed, 1024 to a page, in
+	 *        read-only pages whose grants are listed here instead
+	 *        (up to 26)
 	 * These should remain constant once the page is shared.
 	 * Only one of the two orders can be 10 (or 11).
 	 */
@@ -81,6 +89,8 @@ struct vchan_interface {
 	 *  0: client (or server) has exited
 	 *  1: client (or server) is connected
 	 *  2: client has not yet connected
+	 *  3: (VCHAN_LIVE_MOVED) moved to a new ring page; nothing more will
+	 *     be written to the rings of this one
 	 */
 	uint8_t cli_live, srv_live;
 	/**
@@ -88,6 +98,9 @@ struct vchan_interface {
 	 *  VCHAN_NOTIFY_WRITE: send notify when data is written
 	 *  VCHAN_NOTIFY_READ: send notify when data is read (consumed)
 	 * cli_notify is used for the client to inform the server of its action
+	 *  VCHAN_NOTIFY_RESIZE: (srv_notify only, set by the client) the client
+	 *   follows the server to a new ring page when srv_live becomes
+	 *   VCHAN_LIVE_MOVED
 	 */
 	uint8_t cli_notify, srv_notify;
 	/**
@@ -50,6 +50,23 @@ enum xsd_sockmsg_type
     XS_SET_TARGET,
     XS_RESTRICT,
     XS_RESET_WATCHES,
+    /*
+     * Read several nodes: the request holds their paths, the reply one
+     * record for each of as many of them as fit, in order.  A record is
+     * the length of the value as a nul terminated decimal string followed
+     * by the value, or the nul terminated error (as for XS_ERROR) if the
+     * node couldn't be read.  Ask again for any paths left over.
+     */
+    XS_READ_MULTI,
+    /*
+     * Read the nodes below a path: the request holds the path and the
+     * number of levels to descend as a nul terminated decimal string, 0
+     * meaning all of them.  The reply holds one record for each node,
+     * parents before their children: its path relative to the one asked
+     * for, nul terminated, then a record as for XS_READ_MULTI.  Fails with
+     * E2BIG if the records don't all fit in a reply.
+     */
+    XS_READ_SUBTREE,
 
     XS_INVALID = 0xffff /* Guaranteed to remain an invalid type */
 };
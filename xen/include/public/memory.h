@@ -410,6 +410,7 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_paging_op_t);
  * #define XENMEM_access_op_enable_emulate     2
  * #define XENMEM_access_op_disable_emulate    3
  */
+#define XENMEM_access_op_set_filter         4
 
 typedef enum {
     XENMEM_access_n,
@@ -435,6 +436,50 @@ typedef enum {
     XENMEM_access_default
 } xenmem_access_t;
 
+/*
+ * In-hypervisor filtering of mem_access violations.
+ *
+ * XENMEM_access_op_set_filter installs a table of up to
+ * XENMEM_ACCESS_FILTER_MAX entries, replacing any previous one; nr == 0
+ * removes the table.  When a violation is about to be sent to the monitor
+ * ring, the table is searched in order and the first entry matching the
+ * gfn, the instruction pointer of the faulting vCPU and the kind of access
+ * decides what happens instead.  Accesses matching no entry are sent as
+ * usual.  Ranges are inclusive.
+ *
+ * Only x86 HVM guests consult the table.
+ */
+#define XENMEM_ACCESS_FILTER_MAX            64
+
+/* Access kinds an entry applies to (access_mask). */
+#define XENMEM_ACCESS_FILTER_R              (1u << 0)
+#define XENMEM_ACCESS_FILTER_W              (1u << 1)
+#define XENMEM_ACCESS_FILTER_X              (1u << 2)
+
+/* Send the event to the monitor, as if no entry had matched. */
+#define XENMEM_access_filter_event          0
+/* Emulate the faulting instruction ignoring the restrictions, no event. */
+#define XENMEM_access_filter_allow          1
+/* Emulate the faulting instruction discarding its writes, no event. */
+#define XENMEM_access_filter_emulate_nowrite 2
+/* Like allow, but also send an event without pausing the vCPU. */
+#define XENMEM_access_filter_notify         3
+
+struct xen_mem_access_filter {
+    uint64_aligned_t gfn_start;
+    uint64_aligned_t gfn_end;
+    uint64_aligned_t ip_start;
+    uint64_aligned_t ip_end;
+    /* XENMEM_ACCESS_FILTER_* */
+    uint8_t access_mask;
+    /* XENMEM_access_filter_* */
+    uint8_t action;
+    uint16_t pad0;
+    uint32_t pad1;
+};
+typedef struct xen_mem_access_filter xen_mem_access_filter_t;
+DEFINE_XEN_GUEST_HANDLE(xen_mem_access_filter_t);
+
 struct xen_mem_access_op {
     /* XENMEM_access_op_* */
     uint8_t op;
@@ -443,6 +488,7 @@ struct xen_mem_access_op {
     domid_t domid;
     /*
      * Number of pages for set op
+     * Number of filter_list entries for set_filter op
      * Ignored on setting default access and other ops
      */
     uint32_t nr;
@@ -452,6 +498,8 @@ struct xen_mem_access_op {
      * ~0ull is used to set and get the default access for pages
      */
     uint64_aligned_t pfn;
+    /* IN: address of the xen_mem_access_filter_t table for set_filter op */
+    uint64_aligned_t filter_list;
 };
 typedef struct xen_mem_access_op xen_mem_access_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
@@ -466,6 +514,7 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_sharing_op_add_physmap       6
 #define XENMEM_sharing_op_audit             7
 #define XENMEM_sharing_op_range_share       8
+#define XENMEM_sharing_op_fork              9
 
 #define XENMEM_SHARING_OP_S_HANDLE_INVALID  (-10)
 #define XENMEM_SHARING_OP_C_HANDLE_INVALID  (-9)
@@ -509,6 +558,18 @@ struct xen_mem_sharing_op {
             domid_t client_domain;           /* IN: the client domain id */
             uint16_t _pad[3];                /* Must be set to 0 */
         } range;
+        /*
+         * OP_FORK: make the client domain a copy of the (paused) source
+         * domain.  The client must have been created paused, with the same
+         * vCPUs and no memory.  Every sharable page of the source is shared
+         * copy-on-write with it, the others are copied, and the vCPU and
+         * HVM state of the source is loaded into it.
+         */
+        struct mem_sharing_op_fork {
+            domid_t client_domain;           /* IN: the client domain id */
+            uint16_t _pad[3];                /* Must be set to 0 */
+            uint64_aligned_t opaque;         /* Must be set to 0 */
+        } fork;
         struct mem_sharing_op_debug {     /* OP_DEBUG_xxx */
             union {
                 uint64_aligned_t gfn;      /* IN: gfn to debug          */
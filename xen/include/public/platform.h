@@ -537,6 +537,12 @@ struct xenpf_mem_hotadd
 
 #define XEN_CORE_PARKING_SET 1
 #define XEN_CORE_PARKING_GET 2
+/*
+ * Or'ed into XEN_CORE_PARKING_SET: cpus parked by this request are not
+ * offlined, but only taken out of their cpupool and left idle, which is
+ * much faster.  Unparking undoes whichever way a cpu was parked.
+ */
+#define XEN_CORE_PARKING_SOFT (1U << 31)
 struct xenpf_core_parking {
     /* IN variables */
     uint32_t type;
@@ -36,7 +36,7 @@
 #include "physdev.h"
 #include "tmem.h"
 
-#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000D
+#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000E
 
 /*
  * Read console content from Xen buffer ring.
@@ -101,8 +101,8 @@ struct xen_sysctl_physinfo {
     uint32_t max_node_id; /* Largest possible node ID on this host */
     uint32_t cpu_khz;
     uint64_aligned_t total_pages;
-    uint64_aligned_t free_pages;
-    uint64_aligned_t scrub_pages;
+    uint64_aligned_t free_pages;  /* Includes scrub_pages. */
+    uint64_aligned_t scrub_pages; /* Free pages not yet scrubbed. */
     uint64_aligned_t outstanding_pages;
     uint32_t hw_cap[8];
 
@@ -128,6 +128,7 @@ DEFINE_XEN_GUEST_HANDLE(xen_sysctl_sched_id_t);
 /* Sub-operations: */
 #define XEN_SYSCTL_PERFCOP_reset 1   /* Reset all counters to zero. */
 #define XEN_SYSCTL_PERFCOP_query 2   /* Get perfctr information. */
+#define XEN_SYSCTL_PERFCOP_query_domain 3 /* Get perfctrs of one domain. */
 struct xen_sysctl_perfc_desc {
     char         name[80];             /* name of perf counter */
     uint32_t     nr_vals;              /* number of values for this counter */
@@ -143,6 +144,9 @@ struct xen_sysctl_perfc_op {
     /* OUT variables. */
     uint32_t       nr_counters;       /*  number of counters description  */
     uint32_t       nr_vals;           /*  number of values  */
+    /* IN: domain of XEN_SYSCTL_PERFCOP_query_domain. */
+    domid_t        domid;
+    uint16_t       pad;
     /* counter information (or NULL) */
     XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc;
     /* counter values (or NULL) */
@@ -163,6 +167,105 @@ struct xen_sysctl_getdomaininfolist {
 typedef struct xen_sysctl_getdomaininfolist xen_sysctl_getdomaininfolist_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_getdomaininfolist_t);
 
+/*
+ * XEN_SYSCTL_getvcpuinfolist
+ *
+ * The vCPUs of all domains from @first_domain on, in domain order, for as
+ * many whole domains as fit in @buffer.  @next_domain is the first domain
+ * not reported, DOMID_INVALID once all have been.  -ENOBUFS if not even the
+ * vCPUs of the first domain fit.
+ */
+struct xen_sysctl_vcpuinfo {
+    domid_t  domid;
+    uint16_t vcpu;
+    uint8_t  online;               /* currently online (not hotplugged)? */
+    uint8_t  blocked;              /* blocked waiting for an event? */
+    uint8_t  running;              /* currently scheduled on its CPU? */
+    uint8_t  pad;
+    uint32_t cpu;                  /* current mapping */
+    uint64_aligned_t cpu_time;     /* total cpu time consumed (ns) */
+};
+typedef struct xen_sysctl_vcpuinfo xen_sysctl_vcpuinfo_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_vcpuinfo_t);
+struct xen_sysctl_getvcpuinfolist {
+    /* IN variables. */
+    domid_t               first_domain;
+    uint32_t              max_vcpus;
+    XEN_GUEST_HANDLE_64(xen_sysctl_vcpuinfo_t) buffer;
+    /* OUT variables. */
+    uint32_t              num_vcpus;
+    domid_t               next_domain;
+};
+typedef struct xen_sysctl_getvcpuinfolist xen_sysctl_getvcpuinfolist_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_getvcpuinfolist_t);
+
+/*
+ * XEN_SYSCTL_vcpustats_op
+ *
+ * Locate the runstate statistics of all vCPUs, which Xen keeps in @nr_frames
+ * machine-contiguous frames from @mfn when started with "vcpustats=<slots>".
+ * The frames can be mapped read-only by privileged domains.  They hold an
+ * array of @nr_slots xen_vcpustats_t, one per vCPU in no particular order;
+ * slots without XEN_VCPUSTATS_valid are unused.
+ *
+ * A slot is updated on every runstate change of its vCPU, @version being
+ * odd while it is: readers copy it out and retry if @version was odd or
+ * changed meanwhile.  @time is accounted up to @state_entry_time, so the
+ * time spent in the current state is not yet included.
+ */
+#define XEN_VCPUSTATS_valid          (1u << 0)
+struct xen_vcpustats {
+    uint32_t version;
+    uint32_t flags;                /* XEN_VCPUSTATS_* */
+    domid_t  domid;
+    uint16_t vcpu;
+    uint32_t state;                /* RUNSTATE_* */
+    uint64_aligned_t state_entry_time;
+    uint64_aligned_t time[4];      /* ns spent in each RUNSTATE_* */
+    uint64_aligned_t wakeups;      /* # of blocked -> runnable changes */
+};
+typedef struct xen_vcpustats xen_vcpustats_t;
+struct xen_sysctl_vcpustats_op {
+    /* OUT variables. */
+    uint32_t nr_slots;
+    uint32_t nr_frames;
+    uint64_aligned_t mfn;
+};
+typedef struct xen_sysctl_vcpustats_op xen_sysctl_vcpustats_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_vcpustats_op_t);
+
+/*
+ * XEN_SYSCTL_xmem_cacheinfo
+ *
+ * Statistics of Xen's small object allocator: its size classes, then the
+ * typed caches of individual subsystems.  Up to @max_caches entries are
+ * written to @buffer; @num_caches is the number there are.  @cached counts
+ * the free objects currently held in per-CPU magazines, and @hits the
+ * allocations served from them.
+ */
+struct xen_sysctl_xmem_cache {
+    char             name[16];
+    uint32_t         obj_size;
+    uint32_t         pad;
+    uint64_aligned_t cached;
+    uint64_aligned_t allocs;
+    uint64_aligned_t hits;
+    uint64_aligned_t frees;
+};
+typedef struct xen_sysctl_xmem_cache xen_sysctl_xmem_cache_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_xmem_cache_t);
+struct xen_sysctl_xmem_cacheinfo {
+    /* IN variables. */
+    uint32_t              max_caches;
+    XEN_GUEST_HANDLE_64(xen_sysctl_xmem_cache_t) buffer;
+    /* OUT variables. */
+    uint32_t              num_caches;
+    uint64_aligned_t      pool_used;    /* bytes, including cached objects */
+    uint64_aligned_t      pool_total;
+};
+typedef struct xen_sysctl_xmem_cacheinfo xen_sysctl_xmem_cacheinfo_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_xmem_cacheinfo_t);
+
 /* Inject debug keys into Xen. */
 /* XEN_SYSCTL_debug_keys */
 struct xen_sysctl_debug_keys {
@@ -464,6 +567,132 @@ struct xen_sysctl_lockprof_op {
 typedef struct xen_sysctl_lockprof_op xen_sysctl_lockprof_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockprof_op_t);
 
+/*
+ * XEN_SYSCTL_locksample_op
+ *
+ * Sampled lock contention profiling, available in all builds: while enabled
+ * every @rate-th contended lock acquisition on each CPU has its wait timed,
+ * and samples are aggregated by lock class and kind of acquisition.
+ */
+/* Sub-operations: */
+#define XEN_SYSCTL_LOCKSAMPLE_start  1   /* Start sampling 1 in @rate. */
+#define XEN_SYSCTL_LOCKSAMPLE_stop   2   /* Stop sampling. */
+#define XEN_SYSCTL_LOCKSAMPLE_reset  3   /* Discard all samples. */
+#define XEN_SYSCTL_LOCKSAMPLE_query  4   /* Get the aggregated samples. */
+/* Kinds of acquisition: */
+#define LOCKSAMPLE_KIND_SPIN         0   /* spin_lock() */
+#define LOCKSAMPLE_KIND_READ         1   /* read_lock() */
+#define LOCKSAMPLE_KIND_WRITE        2   /* write_lock() */
+#define LOCKSAMPLE_KIND_PERCPU_WRITE 3   /* percpu_write_lock() */
+#define XEN_SYSCTL_LOCKSAMPLE_CALLERS 4
+struct xen_sysctl_locksample_caller {
+    char     name[64];             /* symbol+offset of the acquirer */
+    uint64_aligned_t samples;
+};
+typedef struct xen_sysctl_locksample_caller xen_sysctl_locksample_caller_t;
+struct xen_sysctl_locksample_data {
+    char     name[64];             /* lock class, or lock address */
+    uint32_t kind;                 /* LOCKSAMPLE_KIND_??? */
+    uint32_t nr_callers;           /* valid entries in @callers */
+    uint64_aligned_t samples;      /* # of sampled contended acquisitions */
+    uint64_aligned_t wait_time;    /* nsecs waited in total */
+    uint64_aligned_t wait_max;     /* nsecs of the longest wait */
+    /* Most frequently sampled acquirers (approximate), hottest first. */
+    xen_sysctl_locksample_caller_t callers[XEN_SYSCTL_LOCKSAMPLE_CALLERS];
+};
+typedef struct xen_sysctl_locksample_data xen_sysctl_locksample_data_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_locksample_data_t);
+struct xen_sysctl_locksample_op {
+    uint32_t cmd;                  /* IN: XEN_SYSCTL_LOCKSAMPLE_??? */
+    uint32_t rate;                 /* IN: start; OUT: query, 0 if stopped */
+    uint32_t max_elem;             /* IN: size of output buffer */
+    uint32_t nr_elem;              /* OUT: number of elements available */
+    uint64_aligned_t dropped;      /* OUT: samples lost to a full table */
+    XEN_GUEST_HANDLE_64(xen_sysctl_locksample_data_t) data; /* or NULL */
+};
+typedef struct xen_sysctl_locksample_op xen_sysctl_locksample_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_locksample_op_t);
+
+/*
+ * XEN_SYSCTL_pmusample_op (x86 specific)
+ *
+ * Statistical profiling of Xen and of one domain's guest context: a counter
+ * of the host PMU raises an NMI every @period events, and each CPU appends
+ * the interrupted instruction pointer (plus, for samples taken in Xen, the
+ * call chain from frame pointers) to its own ring, which is drained with
+ * XEN_SYSCTL_PMUSAMPLE_read.  Unavailable while the PMU is in use by
+ * xenoprof, a guest's vPMU, or dom0 profiling through vPMU.
+ */
+/* Sub-operations: */
+#define XEN_SYSCTL_PMUSAMPLE_start  1   /* Discard old records, start. */
+#define XEN_SYSCTL_PMUSAMPLE_stop   2   /* Stop; records can still be read. */
+#define XEN_SYSCTL_PMUSAMPLE_read   3   /* Consume records of @cpu. */
+/* Events: */
+#define XEN_SYSCTL_PMUSAMPLE_EVENT_cycles       0  /* Unhalted core cycles. */
+#define XEN_SYSCTL_PMUSAMPLE_EVENT_instructions 1  /* Retired instructions. */
+/* Context of a sample: */
+#define XEN_SYSCTL_PMUSAMPLE_MODE_user   0   /* Guest user mode. */
+#define XEN_SYSCTL_PMUSAMPLE_MODE_kernel 1   /* Guest kernel mode. */
+#define XEN_SYSCTL_PMUSAMPLE_MODE_xen    2   /* Xen. */
+#define XEN_SYSCTL_PMUSAMPLE_DEPTH      16
+struct xen_sysctl_pmusample_rec {
+    uint64_aligned_t time;         /* system time (nsecs) of the sample */
+    uint32_t cpu;
+    domid_t  domid;                /* domain of the interrupted vCPU */
+    uint16_t vcpu;
+    uint8_t  mode;                 /* XEN_SYSCTL_PMUSAMPLE_MODE_??? */
+    uint8_t  depth;                /* valid entries in @ip */
+    uint8_t  pad[6];
+    uint64_aligned_t ip[XEN_SYSCTL_PMUSAMPLE_DEPTH]; /* innermost first */
+};
+typedef struct xen_sysctl_pmusample_rec xen_sysctl_pmusample_rec_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_pmusample_rec_t);
+struct xen_sysctl_pmusample_op {
+    uint32_t cmd;                  /* IN: XEN_SYSCTL_PMUSAMPLE_??? */
+    uint32_t event;                /* IN: start, XEN_SYSCTL_PMUSAMPLE_EVENT_ */
+    uint32_t period;               /* IN: start, events per sample */
+    domid_t  domid;                /* IN: start, domain whose guest context
+                                    * is sampled, DOMID_INVALID for none */
+    uint16_t pad;
+    uint32_t cpu;                  /* IN: read */
+    uint32_t nr_recs;              /* IN: read, size of @recs;
+                                    * OUT: records copied */
+    uint64_aligned_t lost;         /* OUT: read, records of @cpu dropped
+                                    * to a full ring since start */
+    XEN_GUEST_HANDLE_64(xen_sysctl_pmusample_rec_t) recs;
+};
+typedef struct xen_sysctl_pmusample_op xen_sysctl_pmusample_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_pmusample_op_t);
+
+/*
+ * XEN_SYSCTL_numa_locality (x86 specific)
+ *
+ * NUMA balancing statistics of a HAP domain, collected when Xen was started
+ * with "p2m_numa_balance_ms=<ms>".  Every period a window of the guest
+ * physical address space is made to fault on its next access; each such
+ * fault is a sample, attributed to the node of the pCPU taking it and to
+ * the node of the memory accessed.  2M chunks sampled twice in a row from
+ * the same remote node are moved there, and the domain's vCPUs are steered
+ * towards @home_node, the node taking most samples, if there is a clear one.
+ */
+struct xen_sysctl_numa_locality {
+    domid_t  domid;                /* IN */
+    uint16_t pad;                  /* IN: Always zero. */
+    uint32_t home_node;            /* OUT: XEN_INVALID_NODE_ID if none */
+    uint32_t nr_nodes;             /* IN: size of @samples;
+                                    * OUT: entries filled in */
+    uint32_t pad2;                 /* IN: Always zero. */
+    uint64_aligned_t local;        /* OUT: samples of memory on the node of
+                                    * the accessing pCPU */
+    uint64_aligned_t remote;       /* OUT: samples of memory elsewhere */
+    uint64_aligned_t migrated;     /* OUT: pages moved by the balancer */
+    uint64_aligned_t busy;         /* OUT: pages not moved as in use */
+    XEN_GUEST_HANDLE_64(uint64) samples; /* OUT: samples by memory node
+                                          * (or NULL) */
+};
+typedef struct xen_sysctl_numa_locality xen_sysctl_numa_locality_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_numa_locality_t);
+
 /* XEN_SYSCTL_cputopoinfo */
 #define XEN_INVALID_CORE_ID     (~0U)
 #define XEN_INVALID_SOCKET_ID   (~0U)
@@ -502,7 +731,8 @@ DEFINE_XEN_GUEST_HANDLE(xen_sysctl_cputopoinfo_t);
 
 struct xen_sysctl_meminfo {
     uint64_t memsize;
-    uint64_t memfree;
+    uint64_t memfree;  /* Includes memscrub. */
+    uint64_t memscrub; /* Free memory not yet scrubbed. */
 };
 typedef struct xen_sysctl_meminfo xen_sysctl_meminfo_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_meminfo_t);
@@ -546,15 +776,35 @@ DEFINE_XEN_GUEST_HANDLE(xen_sysctl_numainfo_t);
 #define XEN_SYSCTL_CPUPOOL_OP_RMCPU                 5  /* R */
 #define XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAIN            6  /* M */
 #define XEN_SYSCTL_CPUPOOL_OP_FREEINFO              7  /* F */
+/*
+ * Move the n_dom domains listed in domids to the cpupool, starting at
+ * domids[start].  The moves are done in batches, with the scheduler data
+ * allocated outside of the cpupool lock.  The operation is preemptible;
+ * start is updated with the progress made, and on error it is the index
+ * of the domain which couldn't be moved.
+ */
+#define XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAINS           8  /* B */
+/*
+ * Apply a tuning profile to the scheduler of the cpupool.  Time slice and
+ * rate limit take effect immediately, the runqueue arrangement (credit2)
+ * for cpus added to the pool afterwards.
+ */
+#define XEN_SYSCTL_CPUPOOL_OP_SETPROFILE            9  /* P */
 #define XEN_SYSCTL_CPUPOOL_PAR_ANY     0xFFFFFFFF
+#define XEN_SYSCTL_CPUPOOL_PROFILE_DEFAULT          0
+#define XEN_SYSCTL_CPUPOOL_PROFILE_LATENCY          1
+#define XEN_SYSCTL_CPUPOOL_PROFILE_THROUGHPUT       2
 struct xen_sysctl_cpupool_op {
     uint32_t op;          /* IN */
-    uint32_t cpupool_id;  /* IN: CDIARM OUT: CI */
-    uint32_t sched_id;    /* IN: C      OUT: I  */
-    uint32_t domid;       /* IN: M              */
-    uint32_t cpu;         /* IN: AR             */
-    uint32_t n_dom;       /*            OUT: I  */
-    struct xenctl_bitmap cpumap; /*     OUT: IF */
+    uint32_t cpupool_id;  /* IN: CDIARMBP OUT: CI */
+    uint32_t sched_id;    /* IN: C        OUT: I  */
+    uint32_t domid;       /* IN: M                */
+    uint32_t cpu;         /* IN: AR               */
+    uint32_t n_dom;       /* IN: B        OUT: I  */
+    struct xenctl_bitmap cpumap; /*       OUT: IF */
+    uint32_t profile;     /* IN: P        OUT: I  */
+    uint32_t start;       /* IN: B        OUT: B  */
+    XEN_GUEST_HANDLE_64(uint16) domids; /* IN: B    */
 };
 typedef struct xen_sysctl_cpupool_op xen_sysctl_cpupool_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_cpupool_op_t);
@@ -590,6 +840,9 @@ DEFINE_XEN_GUEST_HANDLE(xen_sysctl_cpupool_op_t);
  *    (remove).
  * -ENOENT:
  *  all: The cpupool with the specified cpupool_id doesn't exist.
+ * -EOPNOTSUPP:
+ *  XEN_SYSCTL_CPUPOOL_OP_SETPROFILE: The scheduler of the cpupool has no
+ *    tuning profiles.
  *
  * Some common error return values like -ENOMEM and -EFAULT are possible for
  * all the operations.
@@ -695,6 +948,11 @@ DEFINE_XEN_GUEST_HANDLE(xen_sysctl_coverage_op_t);
 #define XEN_SYSCTL_PSR_CMT_get_l3_cache_size         2
 #define XEN_SYSCTL_PSR_CMT_enabled                   3
 #define XEN_SYSCTL_PSR_CMT_get_l3_event_mask         4
+/*
+ * Memory traffic of a monitored domain, as sampled by Xen from the MBM
+ * counters of its RMID.  Traffic to remote memory is total - local.
+ */
+#define XEN_SYSCTL_PSR_CMT_get_domain_mbm            5
 struct xen_sysctl_psr_cmt_op {
     uint32_t cmd;       /* IN: XEN_SYSCTL_PSR_CMT_* */
     uint32_t flags;     /* padding variable, may be extended for future use */
@@ -704,6 +962,14 @@ struct xen_sysctl_psr_cmt_op {
             uint32_t cpu;   /* IN */
             uint32_t rsvd;
         } l3_cache;
+        struct {
+            domid_t domid;      /* IN */
+            uint16_t rsvd[3];
+            uint64_t total;     /* OUT: bytes since monitoring started */
+            uint64_t local;     /* OUT: of which to local memory */
+            uint64_t bw_total;  /* OUT: bytes/s over the last period */
+            uint64_t bw_local;  /* OUT */
+        } mbm;
     } u;
 };
 typedef struct xen_sysctl_psr_cmt_op xen_sysctl_psr_cmt_op_t;
@@ -734,6 +1000,7 @@ typedef struct xen_sysctl_pcitopoinfo xen_sysctl_pcitopoinfo_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_pcitopoinfo_t);
 
 #define XEN_SYSCTL_PSR_CAT_get_l3_info               0
+#define XEN_SYSCTL_PSR_CAT_get_mba_info              1
 struct xen_sysctl_psr_cat_op {
     uint32_t cmd;       /* IN: XEN_SYSCTL_PSR_CAT_* */
     uint32_t target;    /* IN */
@@ -744,6 +1011,12 @@ struct xen_sysctl_psr_cat_op {
 #define XEN_SYSCTL_PSR_CAT_L3_CDP       (1u << 0)
             uint32_t flags;     /* OUT: CAT flags */
         } l3_info;
+        struct {
+            uint32_t thrtl_max; /* OUT: Maximum throttling value */
+            uint32_t cos_max;   /* OUT: Maximum COS */
+#define XEN_SYSCTL_PSR_MBA_LINEAR       (1u << 0)
+            uint32_t flags;     /* OUT: MBA flags */
+        } mba_info;
     } u;
 };
 typedef struct xen_sysctl_psr_cat_op xen_sysctl_psr_cat_op_t;
@@ -1031,6 +1304,40 @@ struct xen_sysctl_livepatch_op {
 typedef struct xen_sysctl_livepatch_op xen_sysctl_livepatch_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_livepatch_op_t);
 
+/*
+ * XEN_SYSCTL_lathist_op
+ *
+ * Latency histograms, kept per physical CPU and summed over all online ones
+ * on query.  Each histogram has XEN_SYSCTL_LATHIST_BUCKETS log2 buckets:
+ * bucket n counts samples in [2^n, 2^(n+1)) ns, except that bucket 0 also
+ * counts 0ns samples and the last bucket anything longer.
+ */
+/* Sub-operations: */
+#define XEN_SYSCTL_LATHIST_reset     1   /* Clear all histograms. */
+#define XEN_SYSCTL_LATHIST_query     2   /* Read the histograms of a type. */
+/* Histogram types: */
+#define XEN_SYSCTL_LATHIST_vmexit    0   /* HVM exit handling, indexed by VMX */
+                                         /* exit reason or SVM exit code; SVM */
+                                         /* codes beyond the last index are */
+                                         /* counted there. */
+#define XEN_SYSCTL_LATHIST_hypercall 1   /* Hypercall handling (per preemption */
+                                         /* slice), indexed by number. */
+#define XEN_SYSCTL_LATHIST_wakeup    2   /* vCPU wakeup to running, 1 entry. */
+#define XEN_SYSCTL_LATHIST_softirq   3   /* Softirq raise to handling, indexed */
+                                         /* by the hypervisor's softirq number. */
+#define XEN_SYSCTL_LATHIST_BUCKETS   32
+struct xen_sysctl_lathist_op {
+    uint32_t cmd;                   /* IN: XEN_SYSCTL_LATHIST_*. */
+    uint32_t type;                  /* IN: histogram type (query only). */
+    uint32_t nr_hists;              /* IN: histograms @buckets has room for. */
+                                    /* OUT: histograms of this type. */
+    uint32_t pad;                   /* IN: Always zero. */
+    /* OUT: nr_hists * XEN_SYSCTL_LATHIST_BUCKETS counts (or NULL). */
+    XEN_GUEST_HANDLE_64(uint64) buckets;
+};
+typedef struct xen_sysctl_lathist_op xen_sysctl_lathist_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lathist_op_t);
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -1059,6 +1366,13 @@ struct xen_sysctl {
 #define XEN_SYSCTL_get_cpu_levelling_caps        25
 #define XEN_SYSCTL_get_cpu_featureset            26
 #define XEN_SYSCTL_livepatch_op                  27
+#define XEN_SYSCTL_lathist_op                    28
+#define XEN_SYSCTL_locksample_op                 29
+#define XEN_SYSCTL_pmusample_op                  30
+#define XEN_SYSCTL_getvcpuinfolist               31
+#define XEN_SYSCTL_vcpustats_op                  32
+#define XEN_SYSCTL_xmem_cacheinfo                33
+#define XEN_SYSCTL_numa_locality                 34
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1070,6 +1384,9 @@ struct xen_sysctl {
         struct xen_sysctl_sched_id          sched_id;
         struct xen_sysctl_perfc_op          perfc_op;
         struct xen_sysctl_getdomaininfolist getdomaininfolist;
+        struct xen_sysctl_getvcpuinfolist   getvcpuinfolist;
+        struct xen_sysctl_vcpustats_op      vcpustats_op;
+        struct xen_sysctl_xmem_cacheinfo    xmem_cacheinfo;
         struct xen_sysctl_debug_keys        debug_keys;
         struct xen_sysctl_getcpuinfo        getcpuinfo;
         struct xen_sysctl_availheap         availheap;
@@ -1087,6 +1404,10 @@ struct xen_sysctl {
         struct xen_sysctl_cpu_levelling_caps cpu_levelling_caps;
         struct xen_sysctl_cpu_featureset    cpu_featureset;
         struct xen_sysctl_livepatch_op      livepatch;
+        struct xen_sysctl_lathist_op        lathist_op;
+        struct xen_sysctl_locksample_op     locksample_op;
+        struct xen_sysctl_pmusample_op      pmusample_op;
+        struct xen_sysctl_numa_locality     numa_locality;
         uint8_t                             pad[128];
     } u;
 };
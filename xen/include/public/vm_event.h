@@ -97,6 +97,11 @@
  * Requires the vCPU to be paused already (synchronous events only).
  */
 #define VM_EVENT_FLAG_SET_REGISTERS      (1 << 8)
+/*
+ * On a record-only request (see XEN_DOMCTL_MONITOR_OP_RECORD_ONLY),
+ * indicates that earlier records were dropped because the ring was full.
+ */
+#define VM_EVENT_FLAG_RECORDS_LOST       (1 << 9)
 
 /*
  * Reasons for the vm event request
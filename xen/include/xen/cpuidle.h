@@ -82,6 +82,7 @@ struct cpuidle_governor
 
     int  (*select)          (struct acpi_processor_power *dev);
     void (*reflect)         (struct acpi_processor_power *dev);
+    void (*get_trace_data)  (u32 *expected, u32 *pred);
 };
 
 extern s8 xen_cpuidle;
@@ -94,6 +95,4 @@ extern void cpuidle_wakeup_mwait(cpumask_t *mask);
 
 #define CPUIDLE_DRIVER_STATE_START  1
 
-extern void menu_get_trace_data(u32 *expected, u32 *pred);
-
 #endif /* _XEN_CPUIDLE_H */
@@ -61,7 +61,7 @@ void arch_domain_shutdown(struct domain *d);
 void arch_domain_pause(struct domain *d);
 void arch_domain_unpause(struct domain *d);
 
-int arch_domain_soft_reset(struct domain *d);
+int arch_domain_soft_reset(struct domain *d, unsigned int flags);
 
 int arch_set_info_guest(struct vcpu *, vcpu_guest_context_u);
 void arch_get_info_guest(struct vcpu *, vcpu_guest_context_u);
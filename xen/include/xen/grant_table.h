@@ -23,6 +23,7 @@
 #ifndef __XEN_GRANT_TABLE_H__
 #define __XEN_GRANT_TABLE_H__
 
+#include <xen/mm.h>
 #include <xen/rwlock.h>
 #include <public/grant_table.h>
 #include <asm/page.h>
@@ -122,11 +123,27 @@ void
 gnttab_release_mappings(
     struct domain *d);
 
+/* Frames set aside for growing a grant table, see gnttab_prepare_grow(). */
+struct gnttab_spare {
+    struct page_list_head zeroed;   /* for shared and status frames */
+    struct page_list_head active;   /* with their entries' locks set up */
+};
+
+/* Allocate the frames needed to grow d's grant table without its lock. */
+void gnttab_prepare_grow(struct domain *d, unsigned int req_nr_frames,
+                         struct gnttab_spare *spare);
+/* Free whatever gnttab_grow_table() did not use. */
+void gnttab_release_spare(struct gnttab_spare *spare);
+
 /* Increase the size of a domain's grant table.
  * Caller must hold d's grant table write lock.
  */
 int
-gnttab_grow_table(struct domain *d, unsigned int req_nr_frames);
+gnttab_grow_table(struct domain *d, unsigned int req_nr_frames,
+                  struct gnttab_spare *spare);
+
+/* Grow d's grant table to at least nr_frames: XEN_DOMCTL_set_grant_frames. */
+int gnttab_presize(struct domain *d, unsigned int nr_frames);
 
 /* Number of grant table frames. Caller must hold d's grant table lock. */
 static inline unsigned int nr_grant_frames(struct grant_table *gt)
@@ -79,6 +79,16 @@ void iommu_teardown(struct domain *d);
 int __must_check iommu_map_page(struct domain *d, unsigned long gfn,
                                 unsigned long mfn, unsigned int flags);
 int __must_check iommu_unmap_page(struct domain *d, unsigned long gfn);
+/*
+ * Map or unmap 2^order contiguous pages, flushing the IOTLB once for the
+ * whole range (unless iommu_dont_flush_iotlb is set).  A failed map leaves
+ * none of the range mapped.
+ */
+int __must_check iommu_map_pages(struct domain *d, unsigned long gfn,
+                                 unsigned long mfn, unsigned int order,
+                                 unsigned int flags);
+int __must_check iommu_unmap_pages(struct domain *d, unsigned long gfn,
+                                   unsigned int order);
 
 enum iommu_feature
 {
@@ -171,11 +181,19 @@ struct iommu_ops {
     int __must_check (*map_page)(struct domain *d, unsigned long gfn,
                                  unsigned long mfn, unsigned int flags);
     int __must_check (*unmap_page)(struct domain *d, unsigned long gfn);
+    /* Optional: as above, for 2^order pages with a single IOTLB flush. */
+    int __must_check (*map_pages)(struct domain *d, unsigned long gfn,
+                                  unsigned long mfn, unsigned int order,
+                                  unsigned int flags);
+    int __must_check (*unmap_pages)(struct domain *d, unsigned long gfn,
+                                    unsigned int order);
     void (*free_page_table)(struct page_info *);
 #ifdef CONFIG_X86
     void (*update_ire_from_apic)(unsigned int apic, unsigned int reg, unsigned int value);
     unsigned int (*read_apic_from_ire)(unsigned int apic, unsigned int reg);
     int (*setup_hpet_msi)(struct msi_desc *);
+    int (*update_ire_posted)(const struct vcpu *v, const struct pirq *pirq,
+                             uint8_t gvec);
 #endif /* CONFIG_X86 */
     int __must_check (*suspend)(void);
     void (*resume)(void);
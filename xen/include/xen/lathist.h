@@ -0,0 +1,35 @@
+#ifndef __XEN_LATHIST_H__
+#define __XEN_LATHIST_H__
+
+#include <xen/time.h>
+#include <public/sysctl.h>
+
+/*
+ * Always-on latency histograms, read with XEN_SYSCTL_lathist_op.
+ *
+ * A sample is taken by passing the lathist_start() timestamp of the event to
+ * the matching lathist_*() once it is done.  lathist_start() returns 0 when
+ * the histograms are disabled on the command line, and such samples are
+ * dropped, so that path costs a single predictable branch.
+ */
+
+#define LATHIST_BUCKETS      XEN_SYSCTL_LATHIST_BUCKETS
+/* Covers VMX exit reasons and all SVM exit codes before VMEXIT_NPF. */
+#define LATHIST_VMEXIT_NR    144
+#define LATHIST_HYPERCALL_NR NR_hypercalls
+
+extern bool_t opt_lathist;
+
+static inline s_time_t lathist_start(void)
+{
+    return likely(opt_lathist) ? NOW() : 0;
+}
+
+void lathist_vmexit(unsigned long reason, s_time_t start);
+void lathist_hypercall(unsigned long nr, s_time_t start);
+void lathist_wakeup(s_time_t latency);
+void lathist_softirq(unsigned int nr, s_time_t raised);
+
+int lathist_control(xen_sysctl_lathist_op_t *op);
+
+#endif /* __XEN_LATHIST_H__ */
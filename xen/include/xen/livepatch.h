@@ -80,6 +80,17 @@ void arch_livepatch_post_action(void);
 
 void arch_livepatch_mask(void);
 void arch_livepatch_unmask(void);
+
+/*
+ * Patching without stopping the other CPUs.  Sites are rewritten in steps,
+ * starting from zero, with all CPUs serialised in between, while any of them
+ * reaching a site part way through is sent on to the new code (see
+ * livepatch_poke_target).  Returns whether further steps are needed.
+ */
+bool_t arch_livepatch_can_poke(void);
+bool_t arch_livepatch_poke_jmp(struct livepatch_func *func, bool_t apply,
+                               unsigned int step);
+unsigned long livepatch_poke_target(unsigned long addr);
 #else
 
 /*
@@ -102,6 +113,10 @@ static inline bool_t is_patch(const void *addr)
 {
     return 0;
 }
+static inline unsigned long livepatch_poke_target(unsigned long addr)
+{
+    return 0;
+}
 #endif /* CONFIG_LIVEPATCH */
 
 #endif /* __XEN_LIVEPATCH_H__ */
@@ -28,14 +28,16 @@ static inline size_t lz4_compressbound(size_t isize)
  *	src     : source address of the original data
  *	src_len : size of the original data
  *	dst	: output buffer address of the compressed data
- *		This requires 'dst' of size LZ4_COMPRESSBOUND.
- *	dst_len : is the output size, which is returned after compress done
+ *	dst_len : is the size of 'dst' on input, and the output size
+ *		which is returned after compress done
  *	workmem : address of the working memory.
  *		This requires 'workmem' of size LZ4_MEM_COMPRESS.
  *	return  : Success if return 0
- *		  Error if return (< 0)
- *	note :  Destination buffer and workmem must be already allocated with
- *		the defined size.
+ *		  Error if return (< 0), including when the compressed data
+ *		  doesn't fit in 'dst_len' bytes
+ *	note :  Destination buffer and workmem must be already allocated.
+ *		A 'dst' of size lz4_compressbound() never fails, while a
+ *		smaller one lets callers cheaply detect incompressible data.
  */
 int lz4_compress(const unsigned char *src, size_t src_len,
 		unsigned char *dst, size_t *dst_len, void *wrkmem);
@@ -25,11 +25,27 @@
 #include <public/memory.h>
 #include <asm/p2m.h>
 
+struct mem_access_filter {
+    unsigned int nr;
+    xen_mem_access_filter_t ent[];
+};
+
 #ifdef CONFIG_HAS_MEM_ACCESS
 
 int mem_access_memop(unsigned long cmd,
                      XEN_GUEST_HANDLE_PARAM(xen_mem_access_op_t) arg);
 
+/*
+ * Look up a violation in the domain's filter table, returning the
+ * XENMEM_access_filter_* action of the first matching entry.  @access is
+ * a mask of XENMEM_ACCESS_FILTER_*.  Must be called from a vCPU of @d.
+ */
+unsigned int mem_access_filter_check(const struct domain *d,
+                                     unsigned long gfn, unsigned int access,
+                                     unsigned long ip);
+
+void mem_access_filter_destroy(struct domain *d);
+
 static inline
 void mem_access_resume(struct vcpu *v, vm_event_response_t *rsp)
 {
@@ -51,6 +67,20 @@ void mem_access_resume(struct vcpu *vcpu, vm_event_response_t *rsp)
     /* Nothing to do. */
 }
 
+static inline
+unsigned int mem_access_filter_check(const struct domain *d,
+                                     unsigned long gfn, unsigned int access,
+                                     unsigned long ip)
+{
+    return XENMEM_access_filter_event;
+}
+
+static inline
+void mem_access_filter_destroy(struct domain *d)
+{
+    /* Nothing to do. */
+}
+
 #endif /* HAS_MEM_ACCESS */
 
 #endif /* _XEN_ASM_MEM_ACCESS_H */
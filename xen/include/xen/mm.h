@@ -164,10 +164,14 @@ void init_domheap_pages(paddr_t ps, paddr_t pe);
 struct page_info *alloc_domheap_pages(
     struct domain *d, unsigned int order, unsigned int memflags);
 void free_domheap_pages(struct page_info *pg, unsigned int order);
+void free_domheap_batch_begin(void);
+void free_domheap_batch_end(void);
 unsigned long avail_domheap_pages_region(
     unsigned int node, unsigned int min_width, unsigned int max_width);
 unsigned long avail_domheap_pages(void);
 unsigned long avail_node_heap_pages(unsigned int);
+unsigned long avail_scrub_pages(void);
+unsigned long avail_node_scrub_pages(unsigned int);
 #define alloc_domheap_page(d,f) (alloc_domheap_pages(d,0,f))
 #define free_domheap_page(p)  (free_domheap_pages(p,0))
 unsigned int online_page(unsigned long mfn, uint32_t *status);
@@ -176,6 +180,7 @@ int query_page_offline(unsigned long mfn, uint32_t *status);
 unsigned long total_free_pages(void);
 
 void scrub_heap_pages(void);
+bool_t scrub_free_pages(void);
 
 int assign_pages(
     struct domain *d,
@@ -566,5 +571,10 @@ int page_is_ram_type(unsigned long mfn, unsigned long mem_type);
 int prepare_ring_for_helper(struct domain *d, unsigned long gmfn,
                             struct page_info **_page, void **_va);
 void destroy_ring_for_helper(void **_va, struct page_info *page);
+int prepare_ring_frames_for_helper(struct domain *d, unsigned long gmfn,
+                                   unsigned int nr, struct page_info **pages,
+                                   void **_va);
+void destroy_ring_frames_for_helper(void **_va, struct page_info **pages,
+                                    unsigned int nr);
 
 #endif /* __XEN_MM_H__ */
@@ -31,5 +31,6 @@ int monitor_domctl(struct domain *d, struct xen_domctl_monitor_op *op);
 void monitor_guest_request(void);
 
 int monitor_traps(struct vcpu *v, bool_t sync, vm_event_request_t *req);
+void monitor_record(struct vcpu *v, vm_event_request_t *req);
 
 #endif /* __XEN_MONITOR_H__ */
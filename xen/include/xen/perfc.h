@@ -28,6 +28,11 @@
  * void perfc_add   (counter, value)           add a value to a counter     
  * void perfc_adda  (counter, index, value)    add a value to array counter 
  * void perfc_print (counter)                  print out the counter
+ *
+ * Per-domain counters are defined in perfc_dom_defn.h, are only kept when
+ * booted with "perfc_domain", and are charged to the current vCPU:
+ * void perfc_dom_incr  (counter)              increment a domain counter
+ * void perfc_dom_incra (counter, index)       increment a domain array counter
  */
 
 #define PERFCOUNTER( name, descr ) \
@@ -44,6 +49,11 @@ enum perfcounter {
 	NUM_PERFCOUNTERS
 };
 
+enum perfcounter_dom {
+#include <xen/perfc_dom_defn.h>
+	NUM_DOM_PERFCOUNTERS
+};
+
 #undef PERFCOUNTER
 #undef PERFCOUNTER_ARRAY
 #undef PERFSTATUS
@@ -72,6 +82,19 @@ DECLARE_PER_CPU(perfc_t[NUM_PERFCOUNTERS], perfcounters);
     ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
 	 this_cpu(perfcounters)[PERFC_ ## x + (y)] = (v) : (v) )
 
+#define perfc_dom_incr(x)                                               \
+    do {                                                                \
+        perfc_t *c_ = current->perfc;                                   \
+        if ( unlikely(c_ != NULL) )                                     \
+            ++c_[PERFC_ ## x];                                          \
+    } while ( 0 )
+#define perfc_dom_incra(x,y)                                            \
+    do {                                                                \
+        perfc_t *c_ = current->perfc;                                   \
+        if ( unlikely(c_ != NULL) && (y) <= PERFC_LAST_ ## x - PERFC_ ## x ) \
+            ++c_[PERFC_ ## x + (y)];                                    \
+    } while ( 0 )
+
 /*
  * Histogram: special treatment for 0 and 1 count. After that equally spaced 
  * with last bucket taking the rest.
@@ -96,6 +119,10 @@ DECLARE_PER_CPU(perfc_t[NUM_PERFCOUNTERS], perfcounters);
 struct xen_sysctl_perfc_op;
 int perfc_control(struct xen_sysctl_perfc_op *);
 
+struct vcpu;
+int perfc_init_vcpu(struct vcpu *v);
+void perfc_destroy_vcpu(struct vcpu *v);
+
 extern void perfc_printall(unsigned char key);
 extern void perfc_reset(unsigned char key);
 
@@ -113,6 +140,11 @@ extern void perfc_reset(unsigned char key);
 #define perfc_add(x,y)    ((void)0)
 #define perfc_adda(x,y,z) ((void)0)
 #define perfc_incr_histo(x,y,z) ((void)0)
+#define perfc_dom_incr(x)    ((void)0)
+#define perfc_dom_incra(x,y) ((void)0)
+
+#define perfc_init_vcpu(v)    0
+#define perfc_destroy_vcpu(v) ((void)0)
 
 #endif /* CONFIG_PERF_COUNTERS */
 
@@ -12,6 +12,10 @@ PERFCOUNTER(calls_from_multicall,       "calls from multicall")
 PERFCOUNTER(irqs,                   "#interrupts")
 PERFCOUNTER(ipis,                   "#IPIs")
 
+PERFCOUNTER(softirq_yields,         "softirq handlers over budget")
+PERFCOUNTER(tasklets_idle_deferred, "tasklets deferred to idle")
+PERFCOUNTER(tasklets_idle_promoted, "idle tasklets run when busy")
+
 /* Generic scheduler counters (applicable to all schedulers) */
 PERFCOUNTER(sched_irq,              "sched: timer")
 PERFCOUNTER(sched_run,              "sched: runs through scheduler")
@@ -30,7 +34,10 @@ PERFCOUNTER(vcpu_wake_not_runnable, "sched: vcpu_wake_not_runnable")
 PERFCOUNTER(tickled_no_cpu,         "sched: tickled_no_cpu")
 PERFCOUNTER(tickled_idle_cpu,       "sched: tickled_idle_cpu")
 PERFCOUNTER(tickled_busy_cpu,       "sched: tickled_busy_cpu")
+PERFCOUNTER(core_sched_filtered,    "sched: core_sched_filtered")
+PERFCOUNTER(core_sched_evict,       "sched: core_sched_evict")
 PERFCOUNTER(vcpu_check,             "sched: vcpu_check")
+PERFCOUNTER(vcpu_yield_to,          "sched: vcpu_yield_to")
 
 /* credit specific counters */
 PERFCOUNTER(delay_ms,               "csched: delay")
@@ -49,6 +56,8 @@ PERFCOUNTER(load_balance_over,      "csched: load_balance_over")
 PERFCOUNTER(load_balance_other,     "csched: load_balance_other")
 PERFCOUNTER(steal_trylock_failed,   "csched: steal_trylock_failed")
 PERFCOUNTER(steal_peer_idle,        "csched: steal_peer_idle")
+PERFCOUNTER(steal_peer_empty,       "csched: steal_peer_empty")
+PERFCOUNTER(steal_probes_exhausted, "csched: steal_probes_exhausted")
 PERFCOUNTER(migrate_queued,         "csched: migrate_queued")
 PERFCOUNTER(migrate_running,        "csched: migrate_running")
 PERFCOUNTER(migrate_kicked_away,    "csched: migrate_kicked_away")
@@ -65,8 +74,29 @@ PERFCOUNTER(runtime_min_timer,      "csched2: runtime_min_timer")
 PERFCOUNTER(runtime_max_timer,      "csched2: runtime_max_timer")
 PERFCOUNTER(migrated,               "csched2: migrated")
 PERFCOUNTER(migrate_resisted,       "csched2: migrate_resisted")
+PERFCOUNTER(tickle_scan_cut,        "csched2: tickle_scan_cut")
 PERFCOUNTER(credit_reset,           "csched2: credit_reset")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+PERFCOUNTER(vmap_cache_alloc,       "vmap: cached page allocations")
+PERFCOUNTER(vmap_lazy_purge,        "vmap: lazy unmap TLB flushes")
+
+/* grant copy counters */
+PERFCOUNTER(gnttab_copy_lock,       "gnttab_copy: domains locked")
+PERFCOUNTER(gnttab_copy_buf_hit,    "gnttab_copy: buffer reused")
+PERFCOUNTER(gnttab_copy_buf_miss,   "gnttab_copy: buffer acquired")
+PERFCOUNTER(gnttab_copy_coalesced,  "gnttab_copy: copies coalesced")
+
+/* FIFO event channel counters */
+PERFCOUNTER(evtchn_fifo_queue_contended, "evtchn_fifo: queue lock contended")
+PERFCOUNTER(evtchn_fifo_queue_changed, "evtchn_fifo: queue changed while locking")
+PERFCOUNTER(evtchn_fifo_queue_moved,  "evtchn_fifo: events moved queue")
+PERFCOUNTER(evtchn_fifo_link_retry,   "evtchn_fifo: LINK cmpxchg retries")
+PERFCOUNTER(evtchn_fifo_link_busy,    "evtchn_fifo: tail marked BUSY")
+PERFCOUNTER(evtchn_upcall_coalesced,  "evtchn: upcalls already pending")
+
+PERFCOUNTER(mem_access_filtered,    "mem_access: violations filtered")
+PERFCOUNTER(monitor_records_dropped, "monitor: records dropped")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -0,0 +1,17 @@
+/* This file is legitimately included multiple times. */
+/*#ifndef __XEN_PERFC_DOM_DEFN_H__*/
+/*#define __XEN_PERFC_DOM_DEFN_H__*/
+
+/*
+ * Counters kept per vCPU, when booted with "perfc_domain", and reported per
+ * domain.  They are charged to the vCPU running when the event happens.
+ */
+
+#include <asm/perfc_dom_defn.h>
+
+PERFCOUNTER_ARRAY(dom_hypercalls,       "hypercalls", NR_hypercalls)
+/* Indexed by GNTTABOP_* */
+PERFCOUNTER_ARRAY(dom_gnttab_ops,       "grant table ops", 16)
+PERFCOUNTER(dom_evtchn_send,            "event channel sends")
+
+/*#endif*/ /* __XEN_PERFC_DOM_DEFN_H__ */
@@ -143,6 +143,8 @@ void rcu_check_callbacks(int cpu);
 /* Exported interfaces */
 void call_rcu(struct rcu_head *head, 
               void (*func)(struct rcu_head *head));
+void call_rcu_expedited(struct rcu_head *head,
+                        void (*func)(struct rcu_head *head));
 
 int rcu_barrier(void);
 
@@ -16,8 +16,13 @@ typedef struct {
     .lock = SPIN_LOCK_UNLOCKED          \
 }
 
-#define DEFINE_RWLOCK(l) rwlock_t l = RW_LOCK_UNLOCKED
-#define rwlock_init(l) (*(l) = (rwlock_t)RW_LOCK_UNLOCKED)
+#define DEFINE_RWLOCK(l)                                \
+    rwlock_t l = RW_LOCK_UNLOCKED;                      \
+    _LOCK_CLASS_STATIC(l, l.lock)
+#define _rwlock_init(l, n)                              \
+    (*(l) = (rwlock_t)RW_LOCK_UNLOCKED,                 \
+     (l)->lock.class = _LOCK_CLASS_ID(n))
+#define rwlock_init(l) _rwlock_init(l, #l)
 
 /*
  * Writer states & reader shift and bias.
@@ -217,17 +222,32 @@ static inline int _rw_is_write_locked(rwlock_t *lock)
 
 typedef struct percpu_rwlock percpu_rwlock_t;
 
+/*
+ * Per-CPU reader state of all percpu_rwlock_t sharing an owner variable.
+ * Each slot records a lock this CPU holds for reading and how often, so
+ * that a few such locks can be read-held at once (e.g. the host p2m and an
+ * altp2m, or two domains' grant tables) and each can be taken recursively.
+ * Readers finding all slots in use fall back to the lock's rwlock, and so
+ * must not recurse on it.
+ */
+#define PERCPU_RWLOCK_SLOTS 4
+
+typedef struct percpu_rwlock_slots {
+    percpu_rwlock_t     *lock[PERCPU_RWLOCK_SLOTS];
+    uint8_t             recurse[PERCPU_RWLOCK_SLOTS];
+} percpu_rwlock_slots_t;
+
 struct percpu_rwlock {
     rwlock_t            rwlock;
     bool_t              writer_activating;
 #ifndef NDEBUG
-    percpu_rwlock_t     **percpu_owner;
+    percpu_rwlock_slots_t *percpu_owner;
 #endif
 };
 
 #ifndef NDEBUG
 #define PERCPU_RW_LOCK_UNLOCKED(owner) { RW_LOCK_UNLOCKED, 0, owner }
-static inline void _percpu_rwlock_owner_check(percpu_rwlock_t **per_cpudata,
+static inline void _percpu_rwlock_owner_check(percpu_rwlock_slots_t *per_cpudata,
                                          percpu_rwlock_t *percpu_rwlock)
 {
     ASSERT(per_cpudata == percpu_rwlock->percpu_owner);
@@ -238,71 +258,113 @@ static inline void _percpu_rwlock_owner_check(percpu_rwlock_t **per_cpudata,
 #endif
 
 #define DEFINE_PERCPU_RWLOCK_RESOURCE(l, owner) \
-    percpu_rwlock_t l = PERCPU_RW_LOCK_UNLOCKED(&get_per_cpu_var(owner))
+    percpu_rwlock_t l = PERCPU_RW_LOCK_UNLOCKED(&get_per_cpu_var(owner)); \
+    _LOCK_CLASS_STATIC(l, l.rwlock.lock)
+#define _percpu_rwlock_resource_init(l, owner, n) \
+    (*(l) = (percpu_rwlock_t)PERCPU_RW_LOCK_UNLOCKED(&get_per_cpu_var(owner)), \
+     (l)->rwlock.lock.class = _LOCK_CLASS_ID(n))
 #define percpu_rwlock_resource_init(l, owner) \
-    (*(l) = (percpu_rwlock_t)PERCPU_RW_LOCK_UNLOCKED(&get_per_cpu_var(owner)))
+    _percpu_rwlock_resource_init(l, owner, #l)
+
+/* Slot of this CPU's read hold on a lock, or PERCPU_RWLOCK_SLOTS if none. */
+static inline unsigned int _percpu_read_slot(percpu_rwlock_slots_t *slots,
+                                             percpu_rwlock_t *percpu_rwlock)
+{
+    unsigned int i;
+
+    for ( i = 0; i < PERCPU_RWLOCK_SLOTS; i++ )
+        if ( slots->lock[i] == percpu_rwlock )
+            break;
 
-static inline void _percpu_read_lock(percpu_rwlock_t **per_cpudata,
+    return i;
+}
+
+static inline void _percpu_read_lock(percpu_rwlock_slots_t *per_cpudata,
                                          percpu_rwlock_t *percpu_rwlock)
 {
+    percpu_rwlock_slots_t *slots = &this_cpu_ptr(per_cpudata);
+    unsigned int i;
+
     /* Validate the correct per_cpudata variable has been provided. */
     _percpu_rwlock_owner_check(per_cpudata, percpu_rwlock);
 
-    /* We cannot support recursion on the same lock. */
-    ASSERT(this_cpu_ptr(per_cpudata) != percpu_rwlock);
+    /* Recursion: any writer is already waiting for us. */
+    i = _percpu_read_slot(slots, percpu_rwlock);
+    if ( i < PERCPU_RWLOCK_SLOTS )
+    {
+        ASSERT(slots->recurse[i] < 0xff);
+        slots->recurse[i]++;
+        return;
+    }
+
     /*
-     * Detect using a second percpu_rwlock_t simulatenously and fallback
-     * to standard read_lock.
+     * Detect having run out of slots for concurrently held locks and
+     * fallback to standard read_lock.
      */
-    if ( unlikely(this_cpu_ptr(per_cpudata) != NULL ) )
+    i = _percpu_read_slot(slots, NULL);
+    if ( unlikely(i == PERCPU_RWLOCK_SLOTS) )
     {
         read_lock(&percpu_rwlock->rwlock);
         return;
     }
 
     /* Indicate this cpu is reading. */
-    this_cpu_ptr(per_cpudata) = percpu_rwlock;
+    slots->recurse[i] = 1;
+    slots->lock[i] = percpu_rwlock;
     smp_mb();
     /* Check if a writer is waiting. */
     if ( unlikely(percpu_rwlock->writer_activating) )
     {
         /* Let the waiting writer know we aren't holding the lock. */
-        this_cpu_ptr(per_cpudata) = NULL;
+        slots->lock[i] = NULL;
         /* Wait using the read lock to keep the lock fair. */
         read_lock(&percpu_rwlock->rwlock);
         /* Set the per CPU data again and continue. */
-        this_cpu_ptr(per_cpudata) = percpu_rwlock;
+        slots->lock[i] = percpu_rwlock;
         /* Drop the read lock because we don't need it anymore. */
         read_unlock(&percpu_rwlock->rwlock);
     }
 }
 
-static inline void _percpu_read_unlock(percpu_rwlock_t **per_cpudata,
+static inline void _percpu_read_unlock(percpu_rwlock_slots_t *per_cpudata,
                 percpu_rwlock_t *percpu_rwlock)
 {
+    percpu_rwlock_slots_t *slots = &this_cpu_ptr(per_cpudata);
+    unsigned int i;
+
     /* Validate the correct per_cpudata variable has been provided. */
     _percpu_rwlock_owner_check(per_cpudata, percpu_rwlock);
 
-    /* Verify the read lock was taken for this lock */
-    ASSERT(this_cpu_ptr(per_cpudata) != NULL);
     /*
-     * Detect using a second percpu_rwlock_t simulatenously and fallback
+     * Detect the read lock having been taken without a slot and fallback
      * to standard read_unlock.
      */
-    if ( unlikely(this_cpu_ptr(per_cpudata) != percpu_rwlock ) )
+    i = _percpu_read_slot(slots, percpu_rwlock);
+    if ( unlikely(i == PERCPU_RWLOCK_SLOTS) )
     {
+        ASSERT(rw_is_locked(&percpu_rwlock->rwlock));
         read_unlock(&percpu_rwlock->rwlock);
         return;
     }
-    this_cpu_ptr(per_cpudata) = NULL;
+    if ( --slots->recurse[i] )
+        return;
+    slots->lock[i] = NULL;
     smp_wmb();
 }
 
+/* Does this CPU hold the lock for reading?  Suitable for ASSERT()s. */
+static inline bool_t _percpu_read_locked_by_me(percpu_rwlock_slots_t *per_cpudata,
+                                               percpu_rwlock_t *percpu_rwlock)
+{
+    return _percpu_read_slot(&this_cpu_ptr(per_cpudata),
+                             percpu_rwlock) < PERCPU_RWLOCK_SLOTS;
+}
+
 /* Don't inline percpu write lock as it's a complex function. */
-void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
+void _percpu_write_lock(percpu_rwlock_slots_t *per_cpudata,
                         percpu_rwlock_t *percpu_rwlock);
 
-static inline void _percpu_write_unlock(percpu_rwlock_t **per_cpudata,
+static inline void _percpu_write_unlock(percpu_rwlock_slots_t *per_cpudata,
                 percpu_rwlock_t *percpu_rwlock)
 {
     /* Validate the correct per_cpudata variable has been provided. */
@@ -323,10 +385,12 @@ static inline void _percpu_write_unlock(percpu_rwlock_t **per_cpudata,
     _percpu_write_lock(&get_per_cpu_var(percpu), lock)
 #define percpu_write_unlock(percpu, lock) \
     _percpu_write_unlock(&get_per_cpu_var(percpu), lock)
+#define percpu_read_locked_by_me(percpu, lock) \
+    _percpu_read_locked_by_me(&get_per_cpu_var(percpu), lock)
 
-#define DEFINE_PERCPU_RWLOCK_GLOBAL(name) DEFINE_PER_CPU(percpu_rwlock_t *, \
+#define DEFINE_PERCPU_RWLOCK_GLOBAL(name) DEFINE_PER_CPU(percpu_rwlock_slots_t, \
                                                          name)
-#define DECLARE_PERCPU_RWLOCK_GLOBAL(name) DECLARE_PER_CPU(percpu_rwlock_t *, \
+#define DECLARE_PERCPU_RWLOCK_GLOBAL(name) DECLARE_PER_CPU(percpu_rwlock_slots_t, \
                                                            name)
 
 #endif /* __RWLOCK_H__ */
@@ -155,6 +155,9 @@ struct scheduler {
     void         (*sleep)          (const struct scheduler *, struct vcpu *);
     void         (*wake)           (const struct scheduler *, struct vcpu *);
     void         (*yield)          (const struct scheduler *, struct vcpu *);
+    /* Boost the 2nd vcpu, which the 1st is spinning on; 2nd one's lock held */
+    void         (*yield_to)       (const struct scheduler *, struct vcpu *,
+                                    struct vcpu *);
     void         (*context_saved)  (const struct scheduler *, struct vcpu *);
 
     struct task_slice (*do_schedule) (const struct scheduler *, s_time_t,
@@ -167,6 +170,8 @@ struct scheduler {
                                     struct xen_domctl_scheduler_op *);
     int          (*adjust_global)  (const struct scheduler *,
                                     struct xen_sysctl_scheduler_op *);
+    int          (*set_profile)    (const struct scheduler *,
+                                    unsigned int);
     void         (*dump_settings)  (const struct scheduler *);
     void         (*dump_cpu_state) (const struct scheduler *, int);
 
@@ -185,9 +190,24 @@ struct cpupool
     struct cpupool   *next;
     unsigned int     n_dom;
     struct scheduler *sched;
+    unsigned int     profile;        /* XEN_SYSCTL_CPUPOOL_PROFILE_* */
     atomic_t         refcnt;
 };
 
+/* Scheduler data of a domain being moved to another cpupool */
+struct sched_move_data {
+    void *domdata;
+    void **vcpu_priv;
+    unsigned int nr_vcpus;
+};
+
+int sched_move_prepare(struct domain *d, struct cpupool *c,
+                       struct sched_move_data *m);
+int sched_move_commit(struct domain *d, struct cpupool *c,
+                      struct sched_move_data *m);
+void sched_move_abort(struct cpupool *c, struct sched_move_data *m);
+int sched_set_profile(struct cpupool *c, unsigned int profile);
+
 #define cpupool_online_cpumask(_pool) \
     (((_pool) == NULL) ? &cpu_online_map : (_pool)->cpu_valid)
 
@@ -201,4 +221,21 @@ static inline cpumask_t* cpupool_domain_cpumask(struct domain *d)
     return d->cpupool->cpu_valid;
 }
 
+/*
+ * Load feedback for the "sched" cpufreq governor: @util is the average
+ * utilisation of each of @cpus, and @boost means vCPUs are waiting for a
+ * pCPU to become free.
+ */
+#define CPUFREQ_SCHED_UTIL_SCALE 1024
+
+#ifdef CONFIG_HAS_CPUFREQ
+extern unsigned int cpufreq_sched_users;
+void cpufreq_sched_update(const cpumask_t *cpus, unsigned int util,
+                          bool_t boost);
+#else
+#define cpufreq_sched_users 0
+static inline void cpufreq_sched_update(const cpumask_t *cpus,
+                                        unsigned int util, bool_t boost) {}
+#endif
+
 #endif /* __XEN_SCHED_IF_H__ */
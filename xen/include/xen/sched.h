@@ -112,6 +112,7 @@ struct evtchn
     u8 priority;
     u8 last_priority;
     u16 last_vcpu_id;
+    struct evtchn_moderation *moderation; /* ECS_INTERDOMAIN senders only */
 #ifdef CONFIG_XSM
     union {
 #ifdef XSM_NEED_GENERIC_EVTCHN_SSID
@@ -175,6 +176,14 @@ struct vcpu
     /* last time when vCPU is scheduled out */
     uint64_t last_run_time;
 
+    /* Slot in the shared runstate statistics, or NULL (see vcpustats.h). */
+    struct xen_vcpustats *vcpustats;
+
+#ifdef CONFIG_PERF_COUNTERS
+    /* Per-domain counters of this vCPU, or NULL (see perfc_dom_defn.h). */
+    perfc_t         *perfc;
+#endif
+
     /* Has the FPU been initialised? */
     bool_t           fpu_initialised;
     /* Has the FPU been used since it was last saved? */
@@ -249,6 +258,22 @@ struct vcpu
     /* Multicall information. */
     struct mc_state  mc_state;
 
+    /*
+     * Arguments of a preempted XENMEM_{increase,decrease}_reservation or
+     * XENMEM_populate_physmap, as validated on first entry, so that the
+     * continuation doesn't have to fetch and check them again.  Only
+     * valid while cmd matches the continuation's (see do_memory_op()).
+     */
+    struct memop_cursor {
+        unsigned long    cmd;       /* Sub-op and extent to resume at. */
+        unsigned long    arg;       /* Guest address of the reservation. */
+        XEN_GUEST_HANDLE(xen_pfn_t) extent_list;
+        unsigned int     nr_extents;
+        unsigned int     extent_order;
+        unsigned int     memflags;
+        domid_t          domid;
+    } memop_cursor;
+
     struct waitqueue_vcpu *waitqueue_vcpu;
 
     /* Guest-specified relocation of vcpu_info. */
@@ -271,9 +296,10 @@ struct vm_event_domain
     /* The ring has 64 entries */
     unsigned char foreign_producers;
     unsigned char target_producers;
-    /* shared ring page */
+    /* shared ring pages, mapped virtually contiguous */
     void *ring_page;
-    struct page_info *ring_pg_struct;
+    struct page_info **ring_pg_struct;
+    unsigned int nr_frames;
     /* front-end ring */
     vm_event_front_ring_t front_ring;
     /* event channel port (vcpu0 only) */
@@ -286,6 +312,12 @@ struct vm_event_domain
     unsigned int blocked;
     /* The last vcpu woken up */
     unsigned int last_vcpu_wake_up;
+    /* the only vcpu producing into this ring, NULL if shared by all */
+    struct vcpu *vcpu;
+    /* per-vCPU rings of vCPU 1 and up, vCPU 0 uses this one */
+    struct vm_event_domain *vcpu_rings;
+    /* records were dropped since the last one posted */
+    bool_t records_lost;
 };
 
 struct vm_event_per_domain
@@ -296,6 +328,8 @@ struct vm_event_per_domain
     struct vm_event_domain paging;
     /* VM event monitor support */
     struct vm_event_domain monitor;
+    /* mem_access violations handled without a monitor round trip */
+    struct mem_access_filter *access_filter;
 };
 
 struct evtchn_port_ops;
@@ -345,6 +379,7 @@ struct domain
     unsigned int     max_evtchns;     /* number supported by ABI */
     unsigned int     max_evtchn_port; /* max permitted port number */
     unsigned int     valid_evtchns;   /* number of allocated event channels */
+    unsigned int     first_free_evtchn; /* no free port below this one */
     spinlock_t       event_lock;
     const struct evtchn_port_ops *evtchn_port_ops;
     struct evtchn_fifo_domain *evtchn_fifo;
@@ -464,6 +499,12 @@ struct domain
     nodemask_t node_affinity;
     unsigned int last_alloc_node;
     spinlock_t node_affinity_lock;
+    /*
+     * Node the memory accesses of the domain were seen to concentrate on
+     * (NUMA_NO_NODE if none), which the scheduler may prefer within
+     * node_affinity.  Maintained by architecture NUMA balancing.
+     */
+    nodeid_t numa_home;
 
     /* vNUMA topology accesses are protected by rwlock. */
     rwlock_t vnuma_rwlock;
@@ -601,7 +642,7 @@ void domain_shutdown(struct domain *d, u8 reason);
 void domain_resume(struct domain *d);
 void domain_pause_for_debugger(void);
 
-int domain_soft_reset(struct domain *d);
+int domain_soft_reset(struct domain *d, unsigned int flags);
 
 int vcpu_start_shutdown_deferral(struct vcpu *v);
 void vcpu_end_shutdown_deferral(struct vcpu *v);
@@ -648,6 +689,7 @@ void sched_tick_suspend(void);
 void sched_tick_resume(void);
 void vcpu_wake(struct vcpu *v);
 long vcpu_yield(void);
+long vcpu_yield_directed(void);
 void vcpu_sleep_nosync(struct vcpu *v);
 void vcpu_sleep_sync(struct vcpu *v);
 
@@ -870,6 +912,7 @@ void set_vcpu_migration_delay(unsigned int delay);
 unsigned int get_vcpu_migration_delay(void);
 
 extern bool_t sched_smt_power_savings;
+extern bool_t sched_core;
 
 extern enum cpufreq_controller {
     FREQCTL_none, FREQCTL_dom0_kernel, FREQCTL_xen
@@ -883,6 +926,8 @@ int cpupool_add_domain(struct domain *d, int poolid);
 void cpupool_rm_domain(struct domain *d);
 int cpupool_move_domain(struct domain *d, struct cpupool *c);
 int cpupool_do_sysctl(struct xen_sysctl_cpupool_op *op);
+int cpupool_park_cpu(unsigned int cpu, int *poolid);
+int cpupool_unpark_cpu(unsigned int cpu, int poolid);
 void schedule_dump(struct cpupool *c);
 extern void dump_runq(unsigned char key);
 
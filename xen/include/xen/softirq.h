@@ -33,6 +33,14 @@ void raise_softirq(unsigned int nr);
 void cpu_raise_softirq_batch_begin(void);
 void cpu_raise_softirq_batch_finish(void);
 
+/*
+ * For softirq handlers working through a backlog: whether to re-raise the
+ * softirq and return, because a latency sensitive softirq (timer, schedule)
+ * is pending or the handler has used up its budget.  The first call of each
+ * handler invocation starts the clock and never asks to stop.
+ */
+bool_t softirq_over_budget(void);
+
 /*
  * Process pending softirqs on this CPU. This should be called periodically
  * when performing work that prevents softirqs from running in a timely manner.
@@ -20,6 +20,64 @@ struct lock_debug { };
 #define spin_debug_disable() ((void)0)
 #endif
 
+struct spinlock;
+
+/*
+ * Lock classes group locks for sampled contention profiling (see
+ * XEN_SYSCTL_locksample_op): every lock defined by DEFINE_SPINLOCK() and
+ * friends is a class of its own, while dynamically initialised locks share
+ * the class of their spin_lock_init() (rwlock_init(), ...) site, e.g. all
+ * domains' event locks.  Locks initialised otherwise are unclassified.
+ * Classes named by "queued_spinlocks=" make their waiters queue up MCS-style
+ * rather than all spinning on the lock itself.
+ */
+struct lock_class {
+    const char      *name;
+    const char      *file;
+    struct spinlock *lock;          /* DEFINE_*() locks only */
+    unsigned int    id;
+};
+
+unsigned int _lock_class_register(struct lock_class *class);
+
+#define _LOCK_CLASS_ID(n)                                                     \
+    ({                                                                        \
+        static struct lock_class __lock_class = { n, __FILE__ };              \
+        _lock_class_register(&__lock_class);                                  \
+    })
+#define _LOCK_CLASS_STATIC(l, spin)                                           \
+    static struct lock_class __lock_class_##l = { #l, __FILE__, &(spin) };    \
+    static struct lock_class * const __lock_class_ptr_##l                     \
+    __used_section(".lockclass.data") = &__lock_class_##l
+
+/*
+ * Sampled contention profiling.  The contended part of a lock acquisition
+ * is bracketed by lock_sample_begin() and lock_sample_end(), and while
+ * sampling is enabled every lock_sample_rate-th outermost bracket on a CPU
+ * (nested ones being e.g. an rwlock's internal spinlock) gets timed and
+ * accounted to the lock's class and the acquirer.
+ */
+enum lock_sample_kind {
+    LOCK_SAMPLE_spin,
+    LOCK_SAMPLE_read,
+    LOCK_SAMPLE_write,
+    LOCK_SAMPLE_percpu_write,
+};
+
+extern unsigned int lock_sample_rate;
+
+s64 _lock_sample_begin(void);
+void _lock_sample_end(const struct spinlock *lock, const void *addr,
+                      enum lock_sample_kind kind, s64 start,
+                      const void *caller);
+
+#define lock_sample_begin() (unlikely(lock_sample_rate) ? _lock_sample_begin() : 0)
+#define lock_sample_end(lock, addr, kind, start, caller)                      \
+    do {                                                                      \
+        if ( unlikely(start) )                                                \
+            _lock_sample_end(lock, addr, kind, start, caller);                \
+    } while ( 0 )
+
 #ifdef CONFIG_LOCK_PROFILE
 
 #include <public/sysctl.h>
@@ -58,8 +116,6 @@ struct lock_debug { };
       lock_profile_deregister_struct(type, ptr);
 */
 
-struct spinlock;
-
 struct lock_profile {
     struct lock_profile *next;       /* forward link */
     char                *name;       /* lock name */
@@ -82,12 +138,13 @@ struct lock_profile_qhead {
     static struct lock_profile * const __lock_profile_##name                  \
     __used_section(".lockprofile.data") =                                     \
     &__lock_profile_data_##name
-#define _SPIN_LOCK_UNLOCKED(x) { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG, x }
+#define _SPIN_LOCK_UNLOCKED(x) { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG, 0, 0, x }
 #define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL)
 #define DEFINE_SPINLOCK(l)                                                    \
     spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL);                                 \
     static struct lock_profile __lock_profile_data_##l = _LOCK_PROFILE(l);    \
-    _LOCK_PROFILE_PTR(l)
+    _LOCK_PROFILE_PTR(l);                                                     \
+    _LOCK_CLASS_STATIC(l, l)
 
 #define spin_lock_init_prof(s, l)                                             \
     do {                                                                      \
@@ -97,6 +154,7 @@ struct lock_profile_qhead {
         prof->name = #l;                                                      \
         prof->lock = &(s)->l;                                                 \
         (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof);                       \
+        (s)->l.class = _LOCK_CLASS_ID(#l);                                    \
         prof->next = (s)->profile_head.elem_q;                                \
         (s)->profile_head.elem_q = prof;                                      \
     } while(0)
@@ -118,10 +176,12 @@ extern void spinlock_profile_reset(unsigned char key);
 
 struct lock_profile_qhead { };
 
-#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG }
-#define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG, 0 }
+#define DEFINE_SPINLOCK(l)                                                    \
+    spinlock_t l = SPIN_LOCK_UNLOCKED;                                        \
+    _LOCK_CLASS_STATIC(l, l)
 
-#define spin_lock_init_prof(s, l) spin_lock_init(&((s)->l))
+#define spin_lock_init_prof(s, l) _spin_lock_init(&(s)->l, #l)
 #define lock_profile_register_struct(type, ptr, idx, print)
 #define lock_profile_deregister_struct(type, ptr)
 
@@ -144,13 +204,17 @@ typedef struct spinlock {
     u16 recurse_cnt:4;
 #define SPINLOCK_MAX_RECURSE 0xfu
     struct lock_debug debug;
+    u16 class;                      /* lock class id, 0 if unclassified */
+    u16 mcs_tail;                   /* last queued waiter, 0 if none */
 #ifdef CONFIG_LOCK_PROFILE
     struct lock_profile *profile;
 #endif
 } spinlock_t;
 
 
-#define spin_lock_init(l) (*(l) = (spinlock_t)SPIN_LOCK_UNLOCKED)
+#define _spin_lock_init(l, n)                                                 \
+    (*(l) = (spinlock_t)SPIN_LOCK_UNLOCKED, (l)->class = _LOCK_CLASS_ID(n))
+#define spin_lock_init(l) _spin_lock_init(l, #l)
 
 void _spin_lock(spinlock_t *lock);
 void _spin_lock_irq(spinlock_t *lock);
@@ -204,4 +268,7 @@ void _spin_unlock_recursive(spinlock_t *lock);
 #define spin_lock_recursive(l)        _spin_lock_recursive(l)
 #define spin_unlock_recursive(l)      _spin_unlock_recursive(l)
 
+struct xen_sysctl_locksample_op;
+int lock_sample_control(struct xen_sysctl_locksample_op *op);
+
 #endif /* __SPINLOCK_H__ */
@@ -5,6 +5,10 @@
  * (specifically, the idle VCPU's context) or in softirq context, on at most
  * one CPU at a time. Softirq versus VCPU context execution is specified
  * during per-tasklet initialisation.
+ *
+ * Idle tasklets are VCPU context tasklets for background work, which only
+ * run when their CPU has nothing else to do, or once they have been kept
+ * waiting for too long.
  */
 
 #ifndef __XEN_TASKLET_H__
@@ -19,6 +23,7 @@ struct tasklet
     struct list_head list;
     int scheduled_on;
     bool_t is_softirq;
+    bool_t is_idle;
     bool_t is_running;
     bool_t is_dead;
     void (*func)(unsigned long);
@@ -27,7 +32,7 @@ struct tasklet
 
 #define _DECLARE_TASKLET(name, func, data, softirq)                     \
     struct tasklet name = {                                             \
-        LIST_HEAD_INIT(name.list), -1, softirq, 0, 0, func, data }
+        LIST_HEAD_INIT(name.list), -1, softirq, 0, 0, 0, func, data }
 #define DECLARE_TASKLET(name, func, data)               \
     _DECLARE_TASKLET(name, func, data, 0)
 #define DECLARE_SOFTIRQ_TASKLET(name, func, data)       \
@@ -37,8 +42,10 @@ struct tasklet
 DECLARE_PER_CPU(unsigned long, tasklet_work_to_do);
 #define _TASKLET_enqueued  0 /* Tasklet work is enqueued for this CPU. */
 #define _TASKLET_scheduled 1 /* Scheduler has scheduled do_tasklet(). */
+#define _TASKLET_idle      2 /* Idle tasklet work is enqueued. */
 #define TASKLET_enqueued   (1ul << _TASKLET_enqueued)
 #define TASKLET_scheduled  (1ul << _TASKLET_scheduled)
+#define TASKLET_idle       (1ul << _TASKLET_idle)
 
 void tasklet_schedule_on_cpu(struct tasklet *t, unsigned int cpu);
 void tasklet_schedule(struct tasklet *t);
@@ -48,6 +55,8 @@ void tasklet_init(
     struct tasklet *t, void (*func)(unsigned long), unsigned long data);
 void softirq_tasklet_init(
     struct tasklet *t, void (*func)(unsigned long), unsigned long data);
+void idle_tasklet_init(
+    struct tasklet *t, void (*func)(unsigned long), unsigned long data);
 void tasklet_subsys_init(void);
 
 #endif /* __XEN_TASKLET_H__ */
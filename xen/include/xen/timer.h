@@ -24,6 +24,8 @@ struct timer {
         unsigned int heap_offset;
         /* Linked list (TIMER_STATUS_in_list). */
         struct timer *list_next;
+        /* Timer-wheel slot (TIMER_STATUS_in_wheel). */
+        struct list_head wheel;
         /* Linked list of inactive timers (TIMER_STATUS_inactive). */
         struct list_head inactive;
     };
@@ -42,9 +44,24 @@ struct timer {
 #define TIMER_STATUS_killed   2 /* Not in use; cannot be activated. */
 #define TIMER_STATUS_in_heap  3 /* In use; on timer heap.           */
 #define TIMER_STATUS_in_list  4 /* In use; on overflow linked list. */
+#define TIMER_STATUS_in_wheel 5 /* In use; on timer wheel.          */
     uint8_t status;
+
+    /* Timer slack class (TIMER_SLACK_*). */
+    uint8_t slack;
 };
 
+/*
+ * Timer slack classes. The expiry of a timer with slack is rounded up to a
+ * multiple of its class' granularity (see the timer_slack_* boot options),
+ * so that non-critical timers on the same CPU expire together rather than
+ * each waking it up.
+ */
+#define TIMER_SLACK_none      0 /* Expire as close to the deadline as we can. */
+#define TIMER_SLACK_relaxed   1 /* May be deferred; default up to 1ms.  */
+#define TIMER_SLACK_lazy      2 /* May be deferred; default up to 10ms. */
+#define TIMER_SLACK_NR        3
+
 /*
  * All functions below can be called for any CPU from any CPU in any context.
  */
@@ -61,6 +78,12 @@ void init_timer(
     void         *data,
     unsigned int  cpu);
 
+/*
+ * Set the slack class of a timer. Takes effect the next time the timer is
+ * set; init_timer() resets it to TIMER_SLACK_none.
+ */
+void set_timer_slack(struct timer *timer, unsigned int slack);
+
 /* Set the expiry time and activate a timer. */
 void set_timer(struct timer *timer, s_time_t expires);
 
@@ -41,6 +41,10 @@ static inline bool_t tmem_compression_enabled(void)
     return opt_tmem_compress;
 }
 
+#define TMEM_COMPRESS_LZO 0
+#define TMEM_COMPRESS_LZ4 1
+extern unsigned int opt_tmem_compress_alg;
+
 extern bool_t opt_tmem_dedup;
 static inline bool_t tmem_dedup_enabled(void)
 {
@@ -88,28 +92,16 @@ static inline void tmem_disable(void)
 
 /*
  * Memory free page list management
+ *
+ * Each CPU keeps a few free pages of its own in front of the global list,
+ * so that puts and flushes on different CPUs do not all serialise on
+ * tmem_page_list_lock.  tmem_page_list_pages only counts the global list.
  */
+#define TMEM_PCPU_PAGES 16
 
-static inline struct page_info *tmem_page_list_get(void)
-{
-    struct page_info *pi;
-
-    spin_lock(&tmem_page_list_lock);
-    if ( (pi = page_list_remove_head(&tmem_page_list)) != NULL )
-        tmem_page_list_pages--;
-    spin_unlock(&tmem_page_list_lock);
-    ASSERT((pi == NULL) || IS_VALID_PAGE(pi));
-    return pi;
-}
-
-static inline void tmem_page_list_put(struct page_info *pi)
-{
-    ASSERT(IS_VALID_PAGE(pi));
-    spin_lock(&tmem_page_list_lock);
-    page_list_add(pi, &tmem_page_list);
-    tmem_page_list_pages++;
-    spin_unlock(&tmem_page_list_lock);
-}
+extern struct page_info *tmem_page_list_get(void);
+extern void tmem_page_list_put(struct page_info *pi);
+extern void tmem_page_list_flush_cpu(unsigned int cpu);
 
 /*
  * Memory allocation for persistent data 
@@ -124,15 +116,12 @@ static inline struct page_info *__tmem_alloc_page_thispool(struct domain *d)
     if ( d->tot_pages >= d->max_pages )
         return NULL;
 
-    if ( tmem_page_list_pages )
+    if ( (pi = tmem_page_list_get()) != NULL )
     {
-        if ( (pi = tmem_page_list_get()) != NULL )
-        {
-            if ( donate_page(d,pi,0) == 0 )
-                goto out;
-            else
-                tmem_page_list_put(pi);
-        }
+        if ( donate_page(d,pi,0) == 0 )
+            goto out;
+        else
+            tmem_page_list_put(pi);
     }
 
     pi = alloc_domheap_pages(d,0,MEMF_tmem);
@@ -331,8 +320,9 @@ static inline int tmem_get_tmemop_from_client(tmem_op_t *op, tmem_cli_op_t uops)
 
 int tmem_decompress_to_client(xen_pfn_t, void *, size_t,
 			     tmem_cli_va_param_t);
+#define TMEM_COMPRESS_ZERO 2
 int tmem_compress_from_client(xen_pfn_t, void **, size_t *,
-			     tmem_cli_va_param_t);
+			     tmem_cli_va_param_t, bool_t compress, bool_t zero);
 
 int tmem_copy_from_client(struct page_info *, xen_pfn_t, tmem_cli_va_param_t);
 int tmem_copy_to_client(xen_pfn_t, struct page_info *, tmem_cli_va_param_t);
@@ -366,6 +356,12 @@ struct tmem_statistics {
     unsigned long failed_copies;
     unsigned long pcd_tot_tze_size;
     unsigned long pcd_tot_csize;
+    /* Compressor cost and benefit, for CPU cycles per saved byte. */
+    unsigned long compress_attempts;
+    unsigned long compress_skipped;
+    unsigned long zero_pages;
+    uint64_t compress_cycles;
+    uint64_t compress_saved_bytes;
     /* Global counters (should use long_atomic_t access). */
     atomic_t global_obj_count;
     atomic_t global_pgp_count;
@@ -442,8 +438,9 @@ struct tmem_pool {
     struct client *client;
     uint64_t uuid[2]; /* 0 for private, non-zero for shared. */
     uint32_t pool_id;
-    rwlock_t pool_rwlock;
-    struct rb_root obj_rb_root[OBJ_HASH_BUCKETS]; /* Protected by pool_rwlock. */
+    /* Each hash bucket's tree is protected by the matching rwlock. */
+    rwlock_t obj_rb_rwlocks[OBJ_HASH_BUCKETS];
+    struct rb_root obj_rb_root[OBJ_HASH_BUCKETS];
     struct list_head share_list; /* Valid if shared. */
     int shared_count; /* Valid if shared. */
     /* For save/restore/migration. */
@@ -452,8 +449,8 @@ struct tmem_pool {
     /* Statistics collection. */
     atomic_t pgp_count;
     int pgp_count_max;
-    long obj_count;  /* Atomicity depends on pool_rwlock held for write. */
-    long obj_count_max;
+    atomic_t obj_count;
+    int obj_count_max;
     unsigned long objnode_count, objnode_count_max;
     uint64_t sum_life_cycles;
     uint64_t sum_evicted_cycles;
@@ -462,6 +459,8 @@ struct tmem_pool {
     unsigned long gets, found_gets;
     unsigned long flushs, flushs_found;
     unsigned long flush_objs, flush_objs_found;
+    /* Puts left to store uncompressed, and the next back-off length. */
+    unsigned int compress_skip, compress_backoff;
 };
 
 struct share_list {
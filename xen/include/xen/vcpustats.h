@@ -0,0 +1,27 @@
+#ifndef __XEN_VCPUSTATS_H__
+#define __XEN_VCPUSTATS_H__
+
+#include <xen/sched.h>
+#include <public/sysctl.h>
+
+/*
+ * Runstate statistics of all vCPUs in pages shared read-only with
+ * privileged domains, located with XEN_SYSCTL_vcpustats_op.  vCPUs get a
+ * slot on creation if "vcpustats=<slots>" sized the array and one is free;
+ * those without one cost a NULL check on runstate change.
+ */
+
+void vcpustats_init_vcpu(struct vcpu *v);
+void vcpustats_destroy_vcpu(struct vcpu *v);
+void _vcpustats_update(struct vcpu *v, bool_t wakeup);
+
+/* Publish the runstate of @v, under its schedule lock. */
+static inline void vcpustats_update(struct vcpu *v, bool_t wakeup)
+{
+    if ( unlikely(v->vcpustats != NULL) )
+        _vcpustats_update(v, wakeup);
+}
+
+int vcpustats_get_info(xen_sysctl_vcpustats_op_t *op);
+
+#endif /* __XEN_VCPUSTATS_H__ */
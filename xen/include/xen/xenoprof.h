@@ -17,6 +17,7 @@
 #define PMU_OWNER_NONE          0
 #define PMU_OWNER_XENOPROF      1
 #define PMU_OWNER_HVM           2
+#define PMU_OWNER_PMUSAMPLE     3
 
 #ifdef CONFIG_XENOPROF
 
@@ -48,6 +48,26 @@ static inline void *_xzalloc_array(
     return _xzalloc(size * num, align);
 }
 
+/*
+ * Typed object caches: per-CPU magazines of objects of one size in front of
+ * xmalloc().  Objects are plain xmalloc()ations, so objects of the cache's
+ * size and alignment may be passed between xmem_cache_free() and xfree().
+ */
+
+struct xmem_cache;
+
+struct xmem_cache *xmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align);
+void xmem_cache_destroy(struct xmem_cache *cache);
+void *xmem_cache_alloc(struct xmem_cache *cache);
+void xmem_cache_free(struct xmem_cache *cache, void *ptr);
+
+#define xmem_cache_create_type(_name, _type) \
+    xmem_cache_create(_name, sizeof(_type), __alignof__(_type))
+
+struct xen_sysctl_xmem_cacheinfo;
+int xmem_cache_getinfo(struct xen_sysctl_xmem_cacheinfo *op);
+
 /*
  * Pooled allocator interface.
  */
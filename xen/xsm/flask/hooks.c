@@ -748,6 +748,12 @@ static int flask_domctl(struct domain *d, int cmd)
     case XEN_DOMCTL_soft_reset:
         return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__SOFT_RESET);
 
+    case XEN_DOMCTL_numa_migrate:
+        return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__NUMA_MIGRATE);
+
+    case XEN_DOMCTL_set_grant_frames:
+        return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__SET_GRANT_FRAMES);
+
     default:
         return avc_unknown_permission("domctl", cmd);
     }
@@ -760,6 +766,7 @@ static int flask_sysctl(int cmd)
     /* These have individual XSM hooks */
     case XEN_SYSCTL_readconsole:
     case XEN_SYSCTL_getdomaininfolist:
+    case XEN_SYSCTL_getvcpuinfolist:
     case XEN_SYSCTL_page_offline_op:
     case XEN_SYSCTL_scheduler_op:
 #ifdef CONFIG_X86
@@ -774,6 +781,11 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__GETSCHEDULER);
 
     case XEN_SYSCTL_perfc_op:
+    case XEN_SYSCTL_lathist_op:
+    case XEN_SYSCTL_vcpustats_op:
+#ifdef CONFIG_X86
+    case XEN_SYSCTL_numa_locality:
+#endif
         return domain_has_xen(current->domain, XEN__PERFCONTROL);
 
     case XEN_SYSCTL_debug_keys:
@@ -783,6 +795,7 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__GETCPUINFO);
 
     case XEN_SYSCTL_availheap:
+    case XEN_SYSCTL_xmem_cacheinfo:
         return domain_has_xen(current->domain, XEN__HEAP);
 
     case XEN_SYSCTL_get_pmstat:
@@ -792,6 +805,7 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__PM_OP);
 
     case XEN_SYSCTL_lockprof_op:
+    case XEN_SYSCTL_locksample_op:
         return domain_has_xen(current->domain, XEN__LOCKPROF);
 
     case XEN_SYSCTL_cpupool_op:
@@ -809,6 +823,9 @@ static int flask_sysctl(int cmd)
     case XEN_SYSCTL_psr_cat_op:
         return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
                                     XEN2__PSR_CAT_OP, NULL);
+    case XEN_SYSCTL_pmusample_op:
+        return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
+                                    XEN2__PMU_CTRL, NULL);
 
     case XEN_SYSCTL_tmem_op:
         return domain_has_xen(current->domain, XEN__TMEM_CONTROL);